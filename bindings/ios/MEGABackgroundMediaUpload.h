@@ -84,6 +84,15 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (nullable NSString *)encryptFileAtPath:(NSString *)inputFilePath startPosition:(int64_t)start length:(int64_t *)length outputFilePath:(nullable NSString *)outputFilePath adjustsSizeOnly:(BOOL)adjustsSizeOnly;
 
+/**
+ * @brief Get the number of bytes encrypted so far by encryptFileAtPath:startPosition:length:outputFilePath:adjustsSizeOnly:
+ *
+ * It can be called from another thread while the encryption runs, in order to show its progress.
+ *
+ * @return The number of bytes encrypted by the current or the last encryption.
+ */
+- (int64_t)encryptedBytes;
+
 /**
  * @brief Retrieves the value of the uploadURL once it has been successfully requested via requestBackgroundUploadURLWithFileSize:mediaUpload:delegate: in MEGASdk.
  *
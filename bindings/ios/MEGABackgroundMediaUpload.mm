@@ -62,6 +62,10 @@
     return suffix == NULL ? nil : @(suffix);
 }
 
+- (int64_t)encryptedBytes {
+    return self.mediaUpload->getEncryptedBytes();
+}
+
 - (NSString *)uploadURLString {
     const char *urlString = self.mediaUpload->getUploadURL();
     return urlString == NULL ? nil : @(urlString);
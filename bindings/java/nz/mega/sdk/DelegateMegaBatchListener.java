@@ -0,0 +1,232 @@
+/*
+ * (c) 2020 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,\
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * @copyright Simplified (2-clause) BSD License.
+ * You should have received a copy of the license along with this
+ * program.
+ */
+package nz.mega.sdk;
+
+import java.util.Arrays;
+import java.util.HashMap;
+import java.util.Timer;
+import java.util.TimerTask;
+
+/**
+ * Listener that gathers the changes of transfers and nodes, and sends them to the app in batches.
+ * <p>
+ * The callbacks of the SDK only read the values they need, without copying the transfers or the
+ * node lists. Every interval, the pending changes are delivered in one MegaApiJava.runCallback().
+ *
+ * @see MegaBatchListenerInterface
+ * @see MegaListener
+ */
+class DelegateMegaBatchListener extends MegaListener {
+    MegaApiJava megaApi;
+    MegaBatchListenerInterface listener;
+    int intervalMs;
+
+    private Timer timer;
+    private boolean flushScheduled;
+
+    // pending transfer changes, by tag, in parallel arrays
+    private HashMap<Integer, Integer> transferIndex = new HashMap<Integer, Integer>();
+    private int[] tags = new int[16];
+    private int[] states = new int[16];
+    private long[] transferredBytes = new long[16];
+    private long[] totalBytes = new long[16];
+    private long[] speeds = new long[16];
+    private int transferCount;
+
+    // pending node changes, by handle, and whether all nodes were reloaded
+    private HashMap<Long, Integer> nodeIndex = new HashMap<Long, Integer>();
+    private long[] handles = new long[16];
+    private int[] changes = new int[16];
+    private int nodeCount;
+    private boolean nodesReloaded;
+
+    DelegateMegaBatchListener(MegaApiJava megaApi, MegaBatchListenerInterface listener, int intervalMs) {
+        this.megaApi = megaApi;
+        this.listener = listener;
+        this.intervalMs = Math.max(intervalMs, 1);
+        this.timer = new Timer("MegaBatchListener", true);
+    }
+
+    MegaBatchListenerInterface getUserListener() {
+        return listener;
+    }
+
+    /**
+     * Stop delivering batches. Pending changes are dropped.
+     */
+    synchronized void stop() {
+        listener = null;
+        timer.cancel();
+    }
+
+    @Override
+    public void onTransferStart(MegaApi api, MegaTransfer transfer) {
+        addTransfer(transfer);
+    }
+
+    @Override
+    public void onTransferUpdate(MegaApi api, MegaTransfer transfer) {
+        addTransfer(transfer);
+    }
+
+    @Override
+    public void onTransferTemporaryError(MegaApi api, MegaTransfer transfer, MegaError e) {
+        addTransfer(transfer);
+    }
+
+    @Override
+    public void onTransferFinish(MegaApi api, MegaTransfer transfer, MegaError e) {
+        addTransfer(transfer);
+    }
+
+    @Override
+    public void onNodesUpdate(MegaApi api, MegaNodeList nodeList) {
+        if (listener == null) {
+            return;
+        }
+
+        if (nodeList == null) {
+            synchronized (this) {
+                nodesReloaded = true;
+                nodeIndex.clear();
+                nodeCount = 0;
+                scheduleFlush();
+            }
+            return;
+        }
+
+        int size = nodeList.size();
+        synchronized (this) {
+            for (int i = 0; i < size; i++) {
+                MegaNode node = nodeList.get(i);
+                long handle = node.getHandle();
+                int change = node.getChanges();
+
+                Integer index = nodeIndex.get(handle);
+                if (index != null) {
+                    changes[index] |= change;
+                    continue;
+                }
+
+                if (nodeCount == handles.length) {
+                    handles = Arrays.copyOf(handles, nodeCount * 2);
+                    changes = Arrays.copyOf(changes, nodeCount * 2);
+                }
+                nodeIndex.put(handle, nodeCount);
+                handles[nodeCount] = handle;
+                changes[nodeCount] = change;
+                nodeCount++;
+            }
+            scheduleFlush();
+        }
+    }
+
+    private void addTransfer(MegaTransfer transfer) {
+        if (listener == null) {
+            return;
+        }
+
+        int tag = transfer.getTag();
+        int state = transfer.getState();
+        long transferred = transfer.getTransferredBytes();
+        long total = transfer.getTotalBytes();
+        long speed = transfer.getSpeed();
+
+        synchronized (this) {
+            Integer index = transferIndex.get(tag);
+            int i;
+            if (index != null) {
+                i = index;
+            } else {
+                if (transferCount == tags.length) {
+                    int capacity = transferCount * 2;
+                    tags = Arrays.copyOf(tags, capacity);
+                    states = Arrays.copyOf(states, capacity);
+                    transferredBytes = Arrays.copyOf(transferredBytes, capacity);
+                    totalBytes = Arrays.copyOf(totalBytes, capacity);
+                    speeds = Arrays.copyOf(speeds, capacity);
+                }
+                i = transferCount++;
+                transferIndex.put(tag, i);
+                tags[i] = tag;
+            }
+
+            states[i] = state;
+            transferredBytes[i] = transferred;
+            totalBytes[i] = total;
+            speeds[i] = speed;
+            scheduleFlush();
+        }
+    }
+
+    // the first change after a batch starts the interval of the next one
+    private void scheduleFlush() {
+        if (flushScheduled || listener == null) {
+            return;
+        }
+
+        flushScheduled = true;
+        timer.schedule(new TimerTask() {
+            public void run() {
+                flush();
+            }
+        }, intervalMs);
+    }
+
+    private void flush() {
+        final MegaBatchListenerInterface l;
+        final int[] batchTags, batchStates, batchChanges;
+        final long[] batchTransferred, batchTotal, batchSpeeds, batchHandles;
+        final boolean reloaded;
+
+        synchronized (this) {
+            flushScheduled = false;
+            l = listener;
+            if (l == null) {
+                return;
+            }
+
+            batchTags = transferCount > 0 ? Arrays.copyOf(tags, transferCount) : null;
+            batchStates = transferCount > 0 ? Arrays.copyOf(states, transferCount) : null;
+            batchTransferred = transferCount > 0 ? Arrays.copyOf(transferredBytes, transferCount) : null;
+            batchTotal = transferCount > 0 ? Arrays.copyOf(totalBytes, transferCount) : null;
+            batchSpeeds = transferCount > 0 ? Arrays.copyOf(speeds, transferCount) : null;
+            transferIndex.clear();
+            transferCount = 0;
+
+            reloaded = nodesReloaded;
+            batchHandles = nodeCount > 0 ? Arrays.copyOf(handles, nodeCount) : null;
+            batchChanges = nodeCount > 0 ? Arrays.copyOf(changes, nodeCount) : null;
+            nodeIndex.clear();
+            nodeCount = 0;
+            nodesReloaded = false;
+        }
+
+        megaApi.runCallback(new Runnable() {
+            public void run() {
+                if (batchTags != null) {
+                    l.onTransfersUpdate(megaApi, batchTags, batchStates, batchTransferred, batchTotal, batchSpeeds);
+                }
+                if (reloaded) {
+                    l.onNodesUpdate(megaApi, null, null);
+                }
+                if (batchHandles != null) {
+                    l.onNodesUpdate(megaApi, batchHandles, batchChanges);
+                }
+            }
+        });
+    }
+}
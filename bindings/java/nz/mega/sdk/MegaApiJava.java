@@ -61,6 +61,7 @@ public class MegaApiJava {
     static Set<DelegateMegaLogger> activeMegaLoggers = Collections.synchronizedSet(new LinkedHashSet<DelegateMegaLogger>());
     static Set<DelegateMegaTreeProcessor> activeMegaTreeProcessors = Collections.synchronizedSet(new LinkedHashSet<DelegateMegaTreeProcessor>());
     static Set<DelegateMegaTransferListener> activeHttpServerListeners = Collections.synchronizedSet(new LinkedHashSet<DelegateMegaTransferListener>());
+    static Set<DelegateMegaBatchListener> activeBatchListeners = Collections.synchronizedSet(new LinkedHashSet<DelegateMegaBatchListener>());
 
     /**
      * INVALID_HANDLE Invalid value for a handle
@@ -309,6 +310,43 @@ public class MegaApiJava {
         megaApi.addGlobalListener(createDelegateGlobalListener(listener));
     }
 
+    /**
+     * Register a listener to receive the changes of all transfers and nodes in batches.
+     * <p>
+     * The changes are gathered for intervalMs from the first one, and delivered in a single
+     * callback with arrays of primitive values, without copying the transfers or the nodes. With
+     * many transfers in progress, this is much lighter than MegaTransferListenerInterface. The SDK
+     * can also coalesce its own callbacks before they reach the listener, see
+     * MegaApiJava.setCallbackIntervals().
+     * <p>
+     * You can use MegaApiJava.removeBatchListener() to stop receiving events.
+     *
+     * @param listener
+     *            Listener that will receive the batches.
+     * @param intervalMs
+     *            Interval over which changes are gathered, in milliseconds.
+     */
+    public void addBatchListener(MegaBatchListenerInterface listener, int intervalMs) {
+        DelegateMegaBatchListener delegateListener = new DelegateMegaBatchListener(this, listener, intervalMs);
+        activeBatchListeners.add(delegateListener);
+        megaApi.addListener(delegateListener);
+    }
+
+    /**
+     * Limit how often the SDK calls the node and transfer listeners.
+     * <p>
+     * Node updates within the interval are delivered together. Progress updates of a transfer
+     * are skipped until the interval since its last update has passed.
+     *
+     * @param nodesMs
+     *            Minimum interval between node updates, in milliseconds. 0 (the default) delivers them as they happen.
+     * @param transfersMs
+     *            Minimum interval between progress updates of a transfer, in milliseconds. The default, 100, is also the minimum.
+     */
+    public void setCallbackIntervals(int nodesMs, int transfersMs) {
+        megaApi.setCallbackIntervals(nodesMs, transfersMs);
+    }
+
     /**
      * Unregister a listener.
      * <p>
@@ -389,6 +427,34 @@ public class MegaApiJava {
         }
     }
 
+    /**
+     * Unregister a MegaBatchListenerInterface.
+     * <p>
+     * Stop receiving events from the specified listener. Changes not delivered yet are dropped.
+     *
+     * @param listener
+     *            Object that is unregistered.
+     */
+    public void removeBatchListener(MegaBatchListenerInterface listener) {
+        ArrayList<DelegateMegaBatchListener> listenersToRemove = new ArrayList<DelegateMegaBatchListener>();
+
+        synchronized (activeBatchListeners) {
+            Iterator<DelegateMegaBatchListener> it = activeBatchListeners.iterator();
+            while (it.hasNext()) {
+                DelegateMegaBatchListener delegate = it.next();
+                if (delegate.getUserListener() == listener) {
+                    listenersToRemove.add(delegate);
+                    it.remove();
+                }
+            }
+        }
+
+        for (int i=0;i<listenersToRemove.size();i++){
+            megaApi.removeListener(listenersToRemove.get(i));
+            listenersToRemove.get(i).stop();
+        }
+    }
+
     /**
      * Unregister a MegaGlobalListener.
      * <p>
@@ -0,0 +1,66 @@
+/*
+ * (c) 2020 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,\
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * @copyright Simplified (2-clause) BSD License.
+ * You should have received a copy of the license along with this
+ * program.
+ */
+package nz.mega.sdk;
+
+/**
+ * Interface to receive the changes of transfers and nodes in batches.
+ * <p>
+ * Instead of one callback per change, with a copy of the transfer or of the list of nodes,
+ * the changes are gathered for an interval and delivered in a single callback, as arrays of
+ * primitive values. A transfer or a node changed several times in the interval appears once,
+ * in its latest state.
+ *
+ * @see MegaApiJava#addBatchListener(MegaBatchListenerInterface listener, int intervalMs)
+ */
+public interface MegaBatchListenerInterface {
+    /**
+     * This function is called with the transfers that started, progressed, failed temporarily
+     * or finished during the interval.
+     * <p>
+     * The arrays have the same length, one entry per transfer, in the order the transfers
+     * changed first. They belong to the application.
+     *
+     * @param api
+     *          MegaApiJava object the listener was added to.
+     * @param tags
+     *          Tags of the transfers (see MegaTransfer.getTag()).
+     * @param states
+     *          Latest states of the transfers (see MegaTransfer.getState()).
+     * @param transferredBytes
+     *          Bytes transferred so far.
+     * @param totalBytes
+     *          Total bytes of the transfers.
+     * @param speeds
+     *          Current speeds, in bytes per second.
+     */
+    public void onTransfersUpdate(MegaApiJava api, int[] tags, int[] states, long[] transferredBytes, long[] totalBytes, long[] speeds);
+
+    /**
+     * This function is called with the nodes that changed during the interval.
+     * <p>
+     * The arrays have the same length, one entry per node. They belong to the application.
+     * When the full account is reloaded, both parameters are null and the application should
+     * read the nodes it shows again.
+     *
+     * @param api
+     *          MegaApiJava object the listener was added to.
+     * @param handles
+     *          Handles of the new, updated or removed nodes.
+     * @param changes
+     *          Changes of each node during the interval, combined (see MegaNode.getChanges()).
+     */
+    public void onNodesUpdate(MegaApiJava api, long[] handles, int[] changes);
+}
@@ -301,6 +301,13 @@ extern "C" jint JNIEXPORT JNICALL JNI_OnLoad(JavaVM *jvm, void *reserved)
 %}
 #endif
 
+#ifdef SWIGPYTHON
+// Release the GIL in every call into the SDK, which may wait for its mutex or for the SDK thread (the
+// destructor joins it), and take it back only while the Python side of a listener runs.  The same as
+// "swig -threads", for the builds that don't pass it
+%thread;
+#endif
+
 #ifdef SWIGPHP
 
 #ifndef SWIGPHP7
@@ -0,0 +1,118 @@
+# -*- coding: utf-8 -*-
+"""asyncio adapters for the listeners of the Python bindings (Python 3 only).
+
+The SDK calls its listeners from its own thread.  These adapters do nothing
+there but copy the result of a finished request or transfer and hand it to
+the event loop once, through ``call_soon_threadsafe()``, which completes an
+``asyncio.Future``::
+
+    api = mega.MegaApi('APP_KEY')
+    request = await megaasync.request(loop, api.login, 'user@example.com', 'password')
+    transfer = await megaasync.transfer(loop, api.startDownload, node, '/tmp/')
+
+The start and update callbacks are not forwarded to the loop, so many
+transfers in flight cost no thread switches until they finish.
+"""
+
+## (c) 2020 by Mega Limited, Auckland, New Zealand
+##     http://mega.co.nz/
+##     Simplified (2-clause) BSD License.
+##
+## You should have received a copy of the license along with this
+## program.
+
+import asyncio
+
+try:
+    from . import mega
+except ImportError:
+    import mega
+
+
+class MegaRequestError(Exception):
+    """A request or transfer that finished with an error other than API_OK."""
+
+    def __init__(self, error, result):
+        super(MegaRequestError, self).__init__(error.getErrorString())
+        self.error = error
+        self.result = result
+
+
+# the listeners waiting for their finish callback: SWIG does not keep them alive
+_pending = set()
+
+
+class _FutureListener(object):
+    """Completes a future on the loop from the finish callback."""
+
+    def _init_future(self, loop):
+        self.loop = loop
+        self.future = loop.create_future()
+        _pending.add(self)
+
+    def _finish(self, result, error):
+        # the SDK owns both: copy them before its thread goes on
+        result = result.copy()
+        error = error.copy()
+        self.loop.call_soon_threadsafe(self._complete, result, error)
+
+    def _complete(self, result, error):
+        _pending.discard(self)
+        if self.future.done():
+            return
+        if error.getErrorCode() == mega.MegaError.API_OK:
+            self.future.set_result(result)
+        else:
+            self.future.set_exception(MegaRequestError(error, result))
+
+
+class AsyncRequestListener(mega.MegaRequestListener, _FutureListener):
+    """A MegaRequestListener whose ``future`` gets the finished MegaRequest.
+
+    Requests that fail complete it with a MegaRequestError.  Temporary errors
+    are left to the SDK, which retries.
+    """
+
+    def __init__(self, loop=None):
+        mega.MegaRequestListener.__init__(self)
+        self._init_future(loop or asyncio.get_event_loop())
+
+    def onRequestFinish(self, api, request, error):
+        self._finish(request, error)
+
+
+class AsyncTransferListener(mega.MegaTransferListener, _FutureListener):
+    """A MegaTransferListener whose ``future`` gets the finished MegaTransfer.
+
+    ``on_update``, if given, is called in the SDK thread with each updated
+    MegaTransfer (owned by the SDK), for progress that is needed on the fly.
+    """
+
+    def __init__(self, loop=None, on_update=None):
+        mega.MegaTransferListener.__init__(self)
+        self._init_future(loop or asyncio.get_event_loop())
+        self.on_update = on_update
+
+    def onTransferUpdate(self, api, transfer):
+        if self.on_update is not None:
+            self.on_update(transfer)
+
+    def onTransferFinish(self, api, transfer, error):
+        self._finish(transfer, error)
+
+
+def request(loop, method, *args):
+    """Call a MegaApi request method with a new listener, and return its future."""
+    listener = AsyncRequestListener(loop)
+    method(*(args + (listener,)))
+    return listener.future
+
+
+def transfer(loop, method, *args, **kwargs):
+    """Call a MegaApi transfer method with a new listener, and return its future.
+
+    ``on_update`` is passed to AsyncTransferListener.
+    """
+    listener = AsyncTransferListener(loop, kwargs.get('on_update'))
+    method(*(args + (listener,)))
+    return listener.future
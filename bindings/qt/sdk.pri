@@ -27,6 +27,8 @@ SOURCES += src/attrmap.cpp \
     src/command.cpp \
     src/commands.cpp \
     src/db.cpp \
+    src/sharednodes.cpp \
+    src/workerpool.cpp \
     src/gfx.cpp \
     src/file.cpp \
     src/fileattributefetch.cpp \
@@ -386,6 +388,8 @@ HEADERS  += include/mega.h \
             include/mega/command.h \
             include/mega/console.h \
             include/mega/db.h \
+            include/mega/sharednodes.h \
+            include/mega/workerpool.h \
             include/mega/gfx.h \
             include/mega/file.h \
             include/mega/fileattributefetch.h \
@@ -424,6 +428,7 @@ HEADERS  += include/mega.h \
             include/mega/thread/qtthread.h \
             include/megaapi.h \
             include/megaapi_impl.h \
+            include/megaapi_coroutines.h \
             include/mega/mega_utf8proc.h \
             include/mega/mega_ccronexpr.h \
             include/mega/mega_evt_tls.h \
@@ -677,6 +682,7 @@ macx {
    }
 
    LIBS += -framework SystemConfiguration
+   !vcpkg:LIBS += -framework CoreServices
    
    vcpkg:LIBS += -liconv -framework CoreServices -framework CoreFoundation -framework AudioUnit -framework AudioToolbox -framework CoreAudio -framework CoreMedia -framework VideoToolbox -framework ImageIO -framework CoreVideo 
 }
@@ -23,34 +23,55 @@ LIBS += -lgtest
 include(../../../../bindings/qt/sdk.pri)
 
 SOURCES += \
+../../../../tests/unit/AccountGenerator.cpp \
+../../../../tests/unit/AccountGenerator_test.cpp \
+../../../../tests/unit/ApiServer.cpp \
 ../../../../tests/unit/AttrMap_test.cpp \
+../../../../tests/unit/Autocomplete_test.cpp \
+../../../../tests/unit/Base64_test.cpp \
 ../../../../tests/unit/ChunkMacMap_test.cpp \
 ../../../../tests/unit/Commands_test.cpp \
 ../../../../tests/unit/Crypto_test.cpp \
 ../../../../tests/unit/FileFingerprint_test.cpp \
 ../../../../tests/unit/File_test.cpp \
 ../../../../tests/unit/FsNode.cpp \
+../../../../tests/unit/Gfx_test.cpp \
 ../../../../tests/unit/Logging_test.cpp \
 ../../../../tests/unit/main.cpp \
 ../../../../tests/unit/MediaProperties_test.cpp \
 ../../../../tests/unit/MegaApi_test.cpp \
+../../../../tests/unit/MegaTCPServer_test.cpp \
+../../../../tests/unit/MemoryFileSystem.cpp \
+../../../../tests/unit/MemoryFileSystem_test.cpp \
+../../../../tests/unit/JSON_test.cpp \
+../../../../tests/unit/NodeMap_test.cpp \
+../../../../tests/unit/Node_test.cpp \
+../../../../tests/unit/Raid_test.cpp \
 ../../../../tests/unit/PayCrypter_test.cpp \
 ../../../../tests/unit/PendingContactRequest_test.cpp \
 ../../../../tests/unit/Serialization_test.cpp \
 ../../../../tests/unit/Share_test.cpp \
+../../../../tests/unit/Sqlite_test.cpp \
+../../../../tests/unit/StorageServer.cpp \
+../../../../tests/unit/StorageServer_test.cpp \
 ../../../../tests/unit/Sync_test.cpp \
 ../../../../tests/unit/TextChat_test.cpp \
 ../../../../tests/unit/Transfer_test.cpp \
 ../../../../tests/unit/User_test.cpp \
+../../../../tests/unit/UserAlerts_test.cpp \
 ../../../../tests/unit/utils.cpp \
 ../../../../tests/unit/utils_test.cpp
 
 HEADERS += \
+../../../../tests/unit/AccountGenerator.h \
+../../../../tests/unit/ApiServer.h \
 ../../../../tests/unit/constants.h \
 ../../../../tests/unit/DefaultedDbTable.h \
 ../../../../tests/unit/DefaultedDirAccess.h \
 ../../../../tests/unit/DefaultedFileAccess.h \
 ../../../../tests/unit/DefaultedFileSystemAccess.h \
 ../../../../tests/unit/FsNode.h \
+../../../../tests/unit/MemoryFileSystem.h \
 ../../../../tests/unit/NotImplemented.h \
+../../../../tests/unit/StorageServer.h \
 ../../../../tests/unit/utils.h
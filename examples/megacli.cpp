@@ -105,6 +105,18 @@ static int ets = 0;
 // import welcome pdf at account creation
 static bool pdf_to_import = false;
 
+// timed operations on the live session (the bench command)
+typedef std::chrono::steady_clock benchclock;
+
+static double msSince(benchclock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(benchclock::now() - start).count();
+}
+
+// `bench fetchnodes` in progress, reported by fetchnodes_result()
+static bool benchfetchnodes = false;
+static benchclock::time_point benchfetchnodesstart;
+
 // public link information
 static string publiclink;
 
@@ -804,7 +816,7 @@ void DemoApp::chaturl_result(string *url, error e)
     }
 }
 
-void DemoApp::chatgrantaccess_result(error e)
+void DemoApp::chatgrantaccess_result(handle, error e)
 {
     if (e)
     {
@@ -816,7 +828,7 @@ void DemoApp::chatgrantaccess_result(error e)
     }
 }
 
-void DemoApp::chatremoveaccess_result(error e)
+void DemoApp::chatremoveaccess_result(handle, error e)
 {
     if (e)
     {
@@ -1116,6 +1128,12 @@ void DemoApp::unlink_result(handle, error e)
 
 void DemoApp::fetchnodes_result(error e)
 {
+    if (benchfetchnodes)
+    {
+        cout << "bench fetchnodes: " << msSince(benchfetchnodesstart) << " ms, " << client->nodes.size() << " nodes" << endl;
+        benchfetchnodes = false;
+    }
+
     if (e)
     {
         cout << "File/folder retrieval failed (" << errorstring(e) << ")" << endl;
@@ -1128,7 +1146,7 @@ void DemoApp::fetchnodes_result(error e)
         if (h != UNDEF)
         {
             Node *n = client->nodebyhandle(h);
-            if (n && (n->attrs.map.find('n') == n->attrs.map.end()))
+            if (n && (n->attrs().map.find('n') == n->attrs().map.end()))
             {
                 cout << "File/folder retrieval succeed, but encryption key is wrong." << endl;
             }
@@ -2036,7 +2054,7 @@ public:
             key.setkey((const byte*) t->nodekey.data(), n->type);
 
             AttrMap tattrs;
-            tattrs.map = n->attrs.map;
+            tattrs.map = n->attrs().map;
             nameid rrname = AttrMap::string2nameid("rr");
             attr_map::iterator it = tattrs.map.find(rrname);
             if (it != tattrs.map.end())
@@ -2558,6 +2576,11 @@ Node* nodeFromRemotePath(const string& s)
     return n;
 }
 
+void exec_reqstats(autocomplete::ACState&)
+{
+    cout << client->reqs.statsReport() << endl;
+}
+
 #ifdef MEGA_MEASURE_CODE
 
 void exec_deferRequests(autocomplete::ACState& s)
@@ -2586,13 +2609,204 @@ void exec_sendDeferred(autocomplete::ACState& s)
     }
 }
 
+#endif
+
 void exec_codeTimings(autocomplete::ACState& s)
 {
     bool reset = s.extractflag("-reset");
-    cout << client->performanceStats.report(reset, client->httpio, client->waiter, client->reqs) << flush;
+    cout << client->performanceStats.report(reset, client->httpio, client->waiter, client->reqs, *client->bufferpool) << flush;
 }
 
-#endif
+void exec_perfcounters(autocomplete::ACState& s)
+{
+    if (s.words.size() > 1)
+    {
+        CodeCounter::setEnabled(s.words[1].s == "on");
+    }
+    cout << "Performance counters are " << (CodeCounter::enabled() ? "on" : "off") << endl;
+}
+
+// the live view of the performance counters: every interval, those that changed and by how much
+static dstime perftopinterval = 0;
+static dstime perftopnext = NEVER;
+static std::map<string, int64_t> perftoplast;
+
+static void perftop()
+{
+    if (!perftopinterval || Waiter::ds < perftopnext)
+    {
+        return;
+    }
+
+    std::map<string, int64_t> values;
+    client->performanceStats.snapshot(values, client->httpio, client->reqs, *client->bufferpool);
+
+    cout << "---- performance counters, changes in " << perftopinterval / 10.0 << " s" << endl;
+    for (auto& v : values)
+    {
+        auto it = perftoplast.find(v.first);
+        int64_t before = it == perftoplast.end() ? 0 : it->second;
+        if (v.second != before)
+        {
+            cout << "  " << std::left << setw(45) << v.first << std::right << setw(14) << v.second
+                 << "  (" << (v.second > before ? "+" : "") << v.second - before << ")" << endl;
+        }
+    }
+    perftoplast.swap(values);
+
+    perftopnext = Waiter::ds + perftopinterval;
+    client->appwakeupds = perftopnext;
+}
+
+void exec_perftop(autocomplete::ACState& s)
+{
+    if (s.words.size() > 1 && s.words[1].s == "off")
+    {
+        perftopinterval = 0;
+        perftopnext = NEVER;
+        client->appwakeupds = NEVER;
+        return;
+    }
+
+    int seconds = s.words.size() > 1 ? atoi(s.words[1].s.c_str()) : 5;
+    perftopinterval = dstime(std::max(seconds, 1) * 10);
+    perftoplast.clear();
+    if (!CodeCounter::enabled())
+    {
+        cout << "Performance counters are off, only the counts will change (see perfcounters)" << endl;
+    }
+
+    Waiter::bumpds();
+    perftopnext = Waiter::ds;
+    perftop();
+}
+
+// `bench transfers` in progress: the queued transfers when it started, reported when they are all done
+static bool benchtransfers = false;
+static benchclock::time_point benchtransfersstart;
+static size_t benchtransfercount = 0;
+static m_off_t benchtransferbytes = 0;
+
+static void benchtransferscheck()
+{
+    if (benchtransfers && appxferq[GET].empty() && appxferq[PUT].empty())
+    {
+        double ms = msSince(benchtransfersstart);
+        cout << "bench transfers: " << benchtransfercount << " transfers, " << benchtransferbytes << " bytes in "
+             << ms << " ms (" << (ms > 0 ? benchtransferbytes / 1024.0 / 1024.0 / (ms / 1000) : 0) << " MB/s)" << endl;
+        benchtransfers = false;
+    }
+}
+
+// the nodes below n whose name contains the pattern, ignoring the case of ASCII letters
+static void searchtree(Node* n, const string& pattern, std::vector<Node*>& found)
+{
+    auto sameletter = [](char a, char b) { return tolower((unsigned char)a) == tolower((unsigned char)b); };
+
+    for (Node* c : n->children)
+    {
+        const char* name = c->displayname();
+        const char* end = name + strlen(name);
+        if (std::search(name, end, pattern.begin(), pattern.end(), sameletter) != end)
+        {
+            found.push_back(c);
+        }
+        if (c->type != FILENODE)
+        {
+            searchtree(c, pattern, found);
+        }
+    }
+}
+
+void exec_bench(autocomplete::ACState& s)
+{
+    const string& what = s.words[1].s;
+
+    if (what == "fetchnodes")
+    {
+        // cold: from the servers, warm: from the local cache if there is one
+        bool cold = s.words.size() > 2 && s.words[2].s == "cold";
+        cout << "Reloading account " << (cold ? "from the servers" : "from the local cache") << "..." << endl;
+
+        cwd = UNDEF;
+        client->cachedscsn = UNDEF;
+        benchfetchnodes = true;
+        benchfetchnodesstart = benchclock::now();
+        client->fetchnodes(cold);
+        return;
+    }
+
+    if (what == "transfers")
+    {
+        benchtransfercount = appxferq[GET].size() + appxferq[PUT].size();
+        if (!benchtransfercount)
+        {
+            cout << "No transfers queued: start some with put or get, then bench them" << endl;
+            return;
+        }
+
+        benchtransferbytes = 0;
+        for (int d : { GET, PUT })
+        {
+            for (AppFile* f : appxferq[d])
+            {
+                benchtransferbytes += f->size;
+            }
+        }
+        benchtransfers = true;
+        benchtransfersstart = benchclock::now();
+        cout << "Timing " << benchtransfercount << " transfers..." << endl;
+        return;
+    }
+
+    // children and search: the average of some runs on the tree in memory
+    Node* n = client->nodebyhandle(cwd);
+    string pattern;
+    if (what == "children" && s.words.size() > 2)
+    {
+        n = nodebypath(s.words[2].s.c_str());
+    }
+    else if (what == "search")
+    {
+        if (s.words.size() < 3)
+        {
+            cout << "bench search <pattern> [runs]" << endl;
+            return;
+        }
+        pattern = s.words[2].s;
+    }
+
+    if (!n)
+    {
+        cout << "No such folder" << endl;
+        return;
+    }
+
+    int runs = s.words.size() > 3 ? std::max(atoi(s.words[3].s.c_str()), 1) : 10;
+    std::vector<Node*> found;
+    benchclock::time_point start = benchclock::now();
+    for (int i = 0; i < runs; i++)
+    {
+        found.clear();
+        if (what == "search")
+        {
+            searchtree(n, pattern, found);
+        }
+        else
+        {
+            // as listed by the apps: copied out and sorted by name
+            found.assign(n->children.begin(), n->children.end());
+            std::sort(found.begin(), found.end(), [](Node* a, Node* b)
+            {
+                return strcmp(a->displayname(), b->displayname()) < 0;
+            });
+        }
+    }
+    double ms = msSince(start);
+
+    cout << "bench " << what << ": " << found.size() << " nodes, " << ms / runs << " ms per run (" << runs << " runs, "
+         << client->nodes.size() << " nodes in the account)" << endl;
+}
 
 #ifdef USE_FILESYSTEM
 fs::path pathFromLocalPath(const string& s, bool mustexist)
@@ -2719,7 +2933,7 @@ void exec_showattributes(autocomplete::ACState& s)
 {
     if (const Node* n = nodeFromRemotePath(s.words[1].s))
     {
-        for (auto pair : n->attrs.map)
+        for (auto pair : n->attrs().map)
         {
             char namebuf[10]{};
             AttrMap::nameid2string(pair.first, namebuf);
@@ -2952,11 +3166,19 @@ autocomplete::ACN autocompleteSyntax()
     p->Add(exec_find, sequence(text("find"), text("raided")));
     p->Add(exec_findemptysubfoldertrees, sequence(text("findemptysubfoldertrees"), opt(flag("-movetotrash"))));
 
+    p->Add(exec_reqstats, text("reqstats"));
+
 #ifdef MEGA_MEASURE_CODE
     p->Add(exec_deferRequests, sequence(text("deferrequests"), repeat(either(flag("-putnodes")))));
     p->Add(exec_sendDeferred, sequence(text("senddeferred"), opt(flag("-reset"))));
-    p->Add(exec_codeTimings, sequence(text("codetimings"), opt(flag("-reset"))));
 #endif
+    p->Add(exec_codeTimings, sequence(text("codetimings"), opt(flag("-reset"))));
+    p->Add(exec_perfcounters, sequence(text("perfcounters"), opt(either(text("on"), text("off")))));
+    p->Add(exec_perftop, sequence(text("perftop"), opt(either(wholenumber(5), text("off")))));
+    p->Add(exec_bench, sequence(text("bench"), either(sequence(text("fetchnodes"), opt(either(text("cold"), text("warm")))),
+                                                      text("transfers"),
+                                                      sequence(text("children"), opt(sequence(remoteFSPath(client, &cwd), opt(wholenumber(10))))),
+                                                      sequence(text("search"), param("pattern"), opt(wholenumber(10))))));
 
 #ifdef USE_FILESYSTEM
     p->Add(exec_treecompare, sequence(text("treecompare"), localFSPath(), remoteFSPath(client, &cwd)));
@@ -3402,7 +3624,7 @@ void exec_mv(autocomplete::ACState& s)
 
                             // rename
                             client->fsaccess->normalize(&newname);
-                            n->attrs.map['n'] = newname;
+                            n->attrs().map['n'] = newname;
 
                             if ((e = client->setattr(n)))
                             {
@@ -3431,7 +3653,7 @@ void exec_mv(autocomplete::ACState& s)
                             }
 
                             // overwrite existing target file: rename source...
-                            n->attrs.map['n'] = tn->attrs.map['n'];
+                            n->attrs().map['n'] = tn->attrs().map['n'];
                             e = client->setattr(n);
 
                             if (e)
@@ -3571,8 +3793,8 @@ void exec_cp(autocomplete::ACState& s)
             }
             else
             {
-                attr_map::iterator it = n->attrs.map.find('n');
-                if (it != n->attrs.map.end())
+                attr_map::iterator it = n->attrs().map.find('n');
+                if (it != n->attrs().map.end())
                 {
                     sname = it->second;
                 }
@@ -3611,7 +3833,7 @@ void exec_cp(autocomplete::ACState& s)
                 // copy source attributes and rename
                 AttrMap attrs;
 
-                attrs.map = n->attrs.map;
+                attrs.map = n->attrs().map;
                 attrs.map['n'] = sname;
 
                 key.setkey((const byte*)tc.nn->nodekey.data(), tc.nn->type);
@@ -4842,8 +5064,10 @@ void exec_pause(autocomplete::ACState& s)
 
     if (getarg)
     {
-        client->pausexfers(GET, client->xferpaused[GET] ^= true, hardarg, committer);
-        if (client->xferpaused[GET])
+        bool paused = !client->xferpaused[GET];
+        client->xferpaused[GET] = paused;
+        client->pausexfers(GET, paused, hardarg, committer);
+        if (paused)
         {
             cout << "GET transfers paused. Resume using the same command." << endl;
         }
@@ -4855,8 +5079,10 @@ void exec_pause(autocomplete::ACState& s)
 
     if (putarg)
     {
-        client->pausexfers(PUT, client->xferpaused[PUT] ^= true, hardarg, committer);
-        if (client->xferpaused[PUT])
+        bool paused = !client->xferpaused[PUT];
+        client->xferpaused[PUT] = paused;
+        client->pausexfers(PUT, paused, hardarg, committer);
+        if (paused)
         {
             cout << "PUT transfers paused. Resume using the same command." << endl;
         }
@@ -7796,6 +8022,9 @@ void megacli()
             cout << "Downloads complete" << endl;
         }
 
+        benchtransferscheck();
+        perftop();
+
 
         if (clientFolder)
         {
@@ -7876,7 +8105,7 @@ void DemoAppFolder::fetchnodes_result(error e)
         if (h != UNDEF)
         {
             Node *n = clientFolder->nodebyhandle(h);
-            if (n && (n->attrs.map.find('n') == n->attrs.map.end()))
+            if (n && (n->attrs().map.find('n') == n->attrs().map.end()))
             {
                 cout << "File/folder retrieval succeed, but encryption key is wrong." << endl;
             }
@@ -135,8 +135,8 @@ struct DemoApp : public MegaApp
     void chatinvite_result(error) override;
     void chatremove_result(error) override;
     void chaturl_result(string *, error) override;
-    void chatgrantaccess_result(error) override;
-    void chatremoveaccess_result(error) override;
+    void chatgrantaccess_result(handle, error) override;
+    void chatremoveaccess_result(handle, error) override;
     virtual void chatupdatepermissions_result(error) override;
     virtual void chattruncate_result(error) override;
     virtual void chatsettitle_result(error) override;
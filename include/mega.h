@@ -46,6 +46,8 @@
 #include "mega/file.h"
 #include "mega/filesystem.h"
 #include "mega/db.h"
+#include "mega/sharednodes.h"
+#include "mega/workerpool.h"
 #include "mega/json.h"
 #include "mega/pubkeyaction.h"
 #include "mega/request.h"
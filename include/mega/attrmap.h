@@ -26,8 +26,8 @@
 
 namespace mega {
 
-// maps attribute names to attribute values
-typedef map<nameid, string> attr_map;
+// maps attribute names to attribute values (entries are pooled, as every node has a few)
+typedef map<nameid, string, std::less<nameid>, PoolAllocator<pair<const nameid, string>>> attr_map;
 
 struct MEGA_API AttrMap
 {
@@ -50,6 +50,14 @@ struct MEGA_API AttrMap
 
     // import raw binary serialize
     const char* unserialize(const char*, const char*);
+
+    // append one attribute to a raw binary serialize (a '\0' terminates the serialize after the last one).
+    // Values that don't fit (64 KB and up) are not added and make it return false
+    static bool serialize(string*, nameid, const string&);
+
+    // walk a raw binary serialize without importing it: the value of the attribute name, if asked
+    // for and present, and the final offset (NULL if malformed)
+    static const char* scan(const char*, const char*, nameid name = 0, string* value = NULL, bool* found = NULL);
 };
 } // namespace
 
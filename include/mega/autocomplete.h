@@ -29,6 +29,7 @@
 #include "mega/types.h"
 #include <string>
 #include <vector>
+#include <map>
 #include <memory>
 
 namespace mega {
@@ -209,6 +210,26 @@ namespace autocomplete {
         bool addCompletions(ACState& s) override;
         std::ostream& describe(std::ostream& s) const override;
         bool match(ACState& s) const override;
+
+    private:
+        // the children of a folder sorted by name, for prefix range queries.  Rebuilt when the
+        // children change, and the range of the last prefix is kept so that typing on narrows it
+        struct SortedChildren
+        {
+            bool built = false;
+            uint64_t childrenseq = 0;
+            std::vector<std::pair<std::string, Node*>> byname;
+            std::string lastprefix;
+            size_t first = 0, last = 0;
+
+            // the entries whose name starts with the prefix, as [first, last)
+            void range(const std::string& prefix);
+        };
+
+        // the folders completed lately
+        static const size_t MAX_SORTED_FOLDERS = 8;
+        std::map<::mega::handle, SortedChildren> sorted;
+        SortedChildren& sortedChildren(Node*);
     };
 
     struct MEGA_API MegaContactEmail : public ACNode
@@ -38,6 +38,7 @@ public:
     static int atob(const string&, string&);
     static string atob(const string&);
     static int atob(const char*, byte*, int);   // deprecated
+    static int atob(const char*, size_t, byte*, int);   // with the number of characters before the invalid one that ends them
 
     static void itoa(int64_t, string *);
     static int64_t atoi(string *);
@@ -60,6 +60,19 @@ public:
     // some commands are guaranteed to work if we query without specifying a SID (eg. gmf)
     bool suppressSID;
 
+    // the response can be parsed incrementally while it downloads (eg. f) - only when the command is alone in its batch
+    bool streamResponse;
+
+    // small commands the user is usually waiting on (eg. ug, uk) - they travel in the dispatcher's priority lane
+    bool latencySensitive;
+
+    // read-only commands whose result does not depend on the commands around them - they can travel on a pipelined connection
+    bool orderIndependent;
+
+    // background commands nobody waits on (eg. events, the periodic user data refresh) - held by the dispatcher,
+    // when it coalesces network activity, until other traffic wakes the radio up
+    bool deferrable;
+
     void cmd(const char*);
     void notself(MegaClient*);
     virtual void cancel(void);
@@ -81,6 +94,12 @@ public:
     void element(const byte*, int);
     void element(const char*);
 
+    // Base64 of the binary, encoded straight into the JSON
+    void appendbase64(const byte*, int);
+
+    // room for that many more bytes, for commands that can tell how large they grow
+    void reserve(size_t);
+
     void openobject();
     void closeobject();
     int elements();
@@ -88,6 +107,7 @@ public:
     virtual void procresult();
 
     const char* getstring() const;
+    size_t jsonlength() const;
 
     Command();
     virtual ~Command() = default;
@@ -102,6 +122,9 @@ struct MEGA_API HttpReqCommandPutFA : public HttpReq, public Command
     handle th;    // if th is UNDEF, just report the handle back to the client app rather than attaching to a node
     fatype type;
     m_off_t progressreported;
+    dstime sent = 0;    // when it was dispatched
+
+    size_t datasize() const { return data->size(); }
 
     void procresult();
 
@@ -363,7 +386,22 @@ public:
 class MEGA_API CommandKeyCR : public Command
 {
 public:
+    // the node keys of a new share that did not fit in its s2: each part reports progress to the
+    // share request, and the last one completes it
+    struct ShareParts
+    {
+        int total = 0;
+        int done = 0;
+        error e = API_OK;
+    };
+
+    void procresult();
+
     CommandKeyCR(MegaClient*, node_vector*, node_vector*, const char*);
+    CommandKeyCR(MegaClient*, TreeProcShareKeys&, size_t part, std::shared_ptr<ShareParts>);
+
+private:
+    std::shared_ptr<ShareParts> shareparts;
 };
 
 class MEGA_API CommandMoveNode : public Command
@@ -508,9 +546,14 @@ class MEGA_API CommandPutNodes : public Command
     handle targethandle;
     Transfer *transfer;
 
+    void batchresult(error);
+
 public:
     void procresult();
 
+    // tag of each node when they are the uploads of several files (MegaClient::putnodesbatched)
+    vector<int> batchtags;
+
     CommandPutNodes(MegaClient*, handle, const char*, NewNode*, int, int, putsource_t = PUTNODES_APP, const char *cauth = nullptr, Transfer *aTransfer = nullptr);
 };
 
@@ -534,6 +577,10 @@ class MEGA_API CommandSetShare : public Command
     string msg;
     string personal_representation;
 
+    // the cr parts of a new share beyond the first, sent once the share exists
+    vector<std::unique_ptr<Command>> keyparts;
+    std::shared_ptr<CommandKeyCR::ShareParts> shareparts;
+
     bool procuserresult(MegaClient*);
 
 public:
@@ -23,6 +23,8 @@
 #ifndef CRYPTOCRYPTOPP_H
 #define CRYPTOCRYPTOPP_H 1
 
+#include <memory>
+
 #include <cryptopp/cryptlib.h>
 #include <cryptopp/modes.h>
 #include <cryptopp/ccm.h>
@@ -78,14 +80,37 @@ private:
     CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption aescbc_e;
     CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption aescbc_d;
 
-    CryptoPP::CCM<CryptoPP::AES, 16>::Encryption aesccm16_e;
-    CryptoPP::CCM<CryptoPP::AES, 16>::Decryption aesccm16_d;
+    // the authenticated modes, which most keys never use: allocated on first use
+    struct AuthModes
+    {
+        CryptoPP::CCM<CryptoPP::AES, 16>::Encryption aesccm16_e;
+        CryptoPP::CCM<CryptoPP::AES, 16>::Decryption aesccm16_d;
+
+        CryptoPP::CCM<CryptoPP::AES, 8>::Encryption aesccm8_e;
+        CryptoPP::CCM<CryptoPP::AES, 8>::Decryption aesccm8_d;
+
+        CryptoPP::GCM<CryptoPP::AES>::Encryption aesgcm_e;
+        CryptoPP::GCM<CryptoPP::AES>::Decryption aesgcm_d;
+    };
+    std::unique_ptr<AuthModes> authmodes;
+
+    // setkey() only stores the key: each mode runs its key schedule when it is first used,
+    // and these are the ones done for the current key
+    enum
+    {
+        ECB_E = 1 << 0, ECB_D = 1 << 1, CBC_E = 1 << 2, CBC_D = 1 << 3,
+        CCM16_E = 1 << 4, CCM16_D = 1 << 5, CCM8_E = 1 << 6, CCM8_D = 1 << 7,
+        GCM_E = 1 << 8, GCM_D = 1 << 9
+    };
+    unsigned keyedmodes = 0;
 
-    CryptoPP::CCM<CryptoPP::AES, 8>::Encryption aesccm8_e;
-    CryptoPP::CCM<CryptoPP::AES, 8>::Decryption aesccm8_d;
+    template<class Mode> Mode& keyed(Mode&, unsigned);
+    AuthModes& auth();
 
-    CryptoPP::GCM<CryptoPP::AES>::Encryption aesgcm_e;
-    CryptoPP::GCM<CryptoPP::AES>::Decryption aesgcm_d;
+    // bytes of keystream generated per batch by ctr_crypt()
+    static const unsigned CTRBATCHSIZE = 128 * CryptoPP::AES::BLOCKSIZE;
+
+    void cbc_mac(const byte*, unsigned, unsigned, byte*, byte*);
 
 public:
     static byte zeroiv[CryptoPP::AES::BLOCKSIZE];
@@ -256,6 +281,28 @@ public:
     SymmCipher(const byte*);
 };
 
+// the ciphers of the last few keys used, so that using one of them again skips setting it up.
+// A cipher it returns stays valid (and keyed) until SIZE other keys have been set up
+class MEGA_API SymmCipherCache
+{
+public:
+    static const int SIZE = 8;
+
+    // the cipher for a key, as SymmCipher::setkey() takes it
+    SymmCipher* get(const byte*, int = 1);
+
+    // the cipher for a node key, or NULL if it is not one (as SymmCipher::setkey(const string*))
+    SymmCipher* get(const std::string*);
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+private:
+    SymmCipher ciphers[SIZE];
+    int used = 0;
+    int next = 0;
+};
+
 /**
  * @brief Asymmetric cryptography using RSA.
  */
@@ -399,9 +446,12 @@ public:
     void get(std::string*);
 };
 
+// CRC-32 as in zlib/CryptoPP::CRC32, using the CPU's carry-less multiply or CRC
+// instructions when available
 class MEGA_API HashCRC32
 {
-    CryptoPP::CRC32 hash;
+    // running value, bits inverted
+    uint32_t crc = 0xFFFFFFFF;
 
 public:
     void add(const byte*, unsigned);
@@ -438,17 +488,20 @@ public:
 };
 
 /**
- * @brief HMAC-SHA512 generator
+ * @brief PBKDF2 key derivation with HMAC-SHA512
+ *
+ * Same output as CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA512>, but the SHA-512 states after the
+ * inner and outer key pads are computed once, so that each iteration only takes two compressions
+ * (instead of four) through CryptoPP::SHA512::Transform, which uses the CPU's SHA-512
+ * instructions where Crypto++ supports them.
  */
 class MEGA_API PBKDF2_HMAC_SHA512
 {
-    CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA512> pbkdf2;
-
 public:
     PBKDF2_HMAC_SHA512();
     void deriveKey(byte* derivedkey, size_t derivedkeyLen,
-                   byte* pwd, size_t pwdLen,
-                   byte* salt, size_t saltLen, unsigned int iterations);
+                   const byte* pwd, size_t pwdLen,
+                   const byte* salt, size_t saltLen, unsigned int iterations);
 };
 
 } // namespace
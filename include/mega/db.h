@@ -33,6 +33,10 @@ class MEGA_API DbTable
     static const int IDSPACING = 16;
     PrnGen &rng;
 
+    // serialization buffer of put(), cleared but not freed between records so that
+    // writing many of them does not allocate for each one
+    string recordbuf;
+
 protected:
     bool mCheckAlwaysTransacted = false;
     DBTableTransactionCommitter* mTransactionCommitter = nullptr;
@@ -49,6 +53,9 @@ public:
     virtual bool next(uint32_t*, string*) = 0;
     bool next(uint32_t*, string*, SymmCipher*);
 
+    // as above, passing over records of type skiptype without decrypting them
+    bool next(uint32_t*, string*, SymmCipher*, uint32_t skiptype);
+
     // get specific record by key
     virtual bool get(uint32_t, string*) = 0;
 
@@ -57,9 +64,15 @@ public:
     bool put(uint32_t, string*);
     bool put(uint32_t, Cacheable *, SymmCipher*);
 
+    // put() the records in one go.  Tables may do so cheaper than record by record
+    virtual bool putBatch(uint32_t, const vector<Cacheable*>&, SymmCipher*);
+
     // delete specific record
     virtual bool del(uint32_t) = 0;
 
+    // del() the records in one go
+    virtual bool delBatch(const vector<uint32_t>&);
+
     // delete all records
     virtual void truncate() = 0;
 
@@ -75,6 +88,37 @@ public:
     // permanantly remove all database info
     virtual void remove() = 0;
 
+    // a single opaque blob stored alongside the table, outside its transactions (used for the node snapshot).
+    // Tables that can't store one report failure, and callers fall back to the records
+    virtual bool putsnapshot(const string&) { return false; }
+    virtual bool getsnapshot(string*) { return false; }
+    virtual void delsnapshot() { }
+
+    // secondary index of the node records, kept in step with them by the client, for queries that don't need every
+    // node in memory.  Names and fingerprints are stored as hashes keyed by the client.  Tables without one fail
+    struct NodeIndexEntry
+    {
+        handle nodehandle;
+        handle parenthandle;
+        uint64_t namehash;
+        uint64_t fingerprinthash;   // 0 for nodes without a valid fingerprint
+        m_off_t size;
+        m_time_t mtime;
+        int type;
+    };
+
+    enum NodeIndexColumn { INDEX_PARENT, INDEX_NAMEHASH, INDEX_FINGERPRINTHASH };
+
+    virtual bool putnodeindex(uint32_t /*dbid*/, const NodeIndexEntry&) { return false; }
+    virtual bool delnodeindex(uint32_t /*dbid*/) { return false; }
+    virtual void dropnodeindex() { }
+
+    // handles of the nodes whose column has this value
+    virtual bool querynodeindex(NodeIndexColumn, uint64_t /*value*/, vector<handle>*) { return false; }
+
+    // id of the record of the node with this handle
+    virtual bool nodeindexrecord(handle, uint32_t* /*dbid*/) { return false; }
+
     void checkCommitter(DBTableTransactionCommitter*);
 
     // autoincrement
@@ -144,11 +188,122 @@ public:
     MEGA_DISABLE_COPY_MOVE(DBTableTransactionCommitter)
 };
 
+// a table whose writes are applied to the one it wraps by a thread of its own, in transactions that group
+// everything committed since the thread's previous one, so that slow commits (fsync) don't hold the SDK thread.
+// Records written and not yet in the table are read from memory.  Reads of the whole table, of the node index and
+// of the snapshot first wait for the writes before them (see flush())
+class MEGA_API WriteBehindDbTable : public DbTable
+{
+public:
+    // takes ownership of table, which should not check that it is always transacted: the thread does
+    WriteBehindDbTable(PrnGen&, DbTable* table, bool checkAlwaysTransacted);
+
+    // writes what was committed, drops what wasn't
+    ~WriteBehindDbTable() override;
+
+    void rewind() override;
+    bool next(uint32_t*, string*) override;
+    bool get(uint32_t, string*) override;
+    bool put(uint32_t, char*, unsigned) override;
+    bool del(uint32_t) override;
+    void truncate() override;
+    void begin() override;
+    void commit() override;
+    void abort() override;
+    void remove() override;
+
+    bool putsnapshot(const string&) override;
+    bool getsnapshot(string*) override;
+    void delsnapshot() override;
+
+    bool putnodeindex(uint32_t, const NodeIndexEntry&) override;
+    bool delnodeindex(uint32_t) override;
+    void dropnodeindex() override;
+    bool querynodeindex(NodeIndexColumn, uint64_t, vector<handle>*) override;
+    bool nodeindexrecord(handle, uint32_t*) override;
+
+    // returns once everything written so far is in the table, including the writes of an open transaction
+    // (which abort() can no longer undo)
+    void flush();
+
+private:
+    struct Op
+    {
+        enum { PUT, DEL, TRUNCATE, PUTINDEX, DELINDEX, DROPINDEX } kind;
+        uint32_t id;
+        string data;
+        NodeIndexEntry entry;
+        uint64_t seq;
+    };
+
+    // the latest write of a record that is not in the table yet
+    struct Overlay
+    {
+        bool deleted;
+        string data;
+        uint64_t seq;
+    };
+
+    std::unique_ptr<DbTable> table;
+
+    // held while the table is used, by the thread or by a read
+    std::mutex tablemutex;
+
+    // the rest, which the thread waits on
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    bool intransaction = false;
+    vector<Op> uncommitted;
+    vector<Op> queued;
+    vector<Op> inflight;        // being written by the thread
+    bool stopping = false;
+
+    map<uint32_t, Overlay> overlay;
+    unsigned truncating = 0;    // truncations not in the table yet: records missing from the overlay don't exist
+    uint64_t seq = 0;
+
+    std::thread thread;
+
+    void note(const Op&);
+    void add(Op&&);
+    void queue(vector<Op>&);
+    void write(vector<Op>&);
+    void written(const vector<Op>&);
+    void loop();
+};
+
+// durability/performance settings for the tables a DbAccess opens.  Negative values keep the engine's default
+struct MEGA_API DbProfile
+{
+    enum {
+        PROFILE_DEFAULT = 0,
+        PROFILE_PERFORMANCE = 1,    // larger caches and memory mapping, fsync only at checkpoints
+        PROFILE_RECONSTRUCTIBLE = 2,    // as above, and never fsync: a crash may lose or corrupt the cache, which is then fetched again
+        PROFILE_CUSTOM = 3
+    };
+
+    int id = PROFILE_DEFAULT;
+
+    int synchronous = -1;           // 0 off, 1 normal, 2 full, 3 extra
+    int cacheSizeKiB = -1;
+    long long mmapSize = -1;        // bytes
+    int tempStore = -1;             // 0 default, 1 file, 2 memory
+    int pageSize = -1;              // bytes, only applies to new databases
+    int walAutocheckpoint = -1;     // pages
+
+    // one of the predefined profiles, or the default one for an unknown id
+    static DbProfile byid(int id);
+};
+
 struct MEGA_API DbAccess
 {
     static const int LEGACY_DB_VERSION = 11;
     static const int DB_VERSION = LEGACY_DB_VERSION + 1;
 
+    // applied to tables opened from now on
+    DbProfile profile;
+
     DbAccess();
     virtual DbTable* open(PrnGen &rng, FileSystemAccess*, string*, bool recycleLegacyDB, bool checkAlwaysTransacted) = 0;
 
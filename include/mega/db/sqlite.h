@@ -30,6 +30,8 @@ class MEGA_API SqliteDbAccess : public DbAccess
 {
     string dbpath;
 
+    static void pragma(sqlite3*, const char* name, long long value);
+
 public:
     DbTable* open(PrnGen &rng, FileSystemAccess*, string*, bool recycleLegacyDB, bool checkAlwaysTransacted) override;
 
@@ -41,21 +43,52 @@ class MEGA_API SqliteDbTable : public DbTable
 {
     sqlite3* db;
     sqlite3_stmt* pStmt;
+    bool pStmtDone;
     string dbfile;
     FileSystemAccess *fsaccess;
 
+    // compiled on first use, kept until the table is closed
+    sqlite3_stmt* getStmt = nullptr;
+    sqlite3_stmt* putStmt = nullptr;
+    sqlite3_stmt* delStmt = nullptr;
+
+    // node index, created on first use
+    bool nodeIndexCreated = false;
+    sqlite3_stmt* putIndexStmt = nullptr;
+    sqlite3_stmt* delIndexStmt = nullptr;
+    sqlite3_stmt* queryIndexStmts[3] = {};
+    sqlite3_stmt* recordIndexStmt = nullptr;
+    bool createnodeindex();
+
+    sqlite3_stmt* prepared(sqlite3_stmt*&, const char* sql);
+    void finalizestatements();
+
+    string snapshotpath() const;
+
 public:
     void rewind();
     bool next(uint32_t*, string*);
     bool get(uint32_t, string*);
     bool put(uint32_t, char*, unsigned);
+    bool putBatch(uint32_t, const vector<Cacheable*>&, SymmCipher*) override;
     bool del(uint32_t);
+    bool delBatch(const vector<uint32_t>&) override;
     void truncate();
     void begin();
     void commit();
     void abort();
     void remove();
 
+    bool putsnapshot(const string&) override;
+    bool getsnapshot(string*) override;
+    void delsnapshot() override;
+
+    bool putnodeindex(uint32_t, const NodeIndexEntry&) override;
+    bool delnodeindex(uint32_t) override;
+    void dropnodeindex() override;
+    bool querynodeindex(NodeIndexColumn, uint64_t, vector<handle>*) override;
+    bool nodeindexrecord(handle, uint32_t*) override;
+
     SqliteDbTable(PrnGen &rng, sqlite3*, FileSystemAccess *fs, string *filepath, bool checkAlwaysTransacted);
     ~SqliteDbTable();
 };
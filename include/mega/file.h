@@ -106,6 +106,9 @@ struct MEGA_API File: public FileFingerprint
 
     // tag of the file
     int tag;
+
+    // transfers are scheduled fairly between groups (e.g. the files of one folder transfer), see TransferScheduler.  0: no group
+    int schedulinggroup;
 };
 
 struct MEGA_API SyncFileGet: public File
@@ -28,6 +28,8 @@
 
 namespace mega {
 
+class DbTable;
+
 // file attribute fetching for a specific source cluster
 struct MEGA_API FileAttributeFetchChannel
 {
@@ -69,6 +71,67 @@ struct MEGA_API FileAttributeFetch
 
     FileAttributeFetch(handle, string, fatype, int);
 };
+
+// decrypted file attributes kept across sessions, in a table of their own encrypted with the account key.
+// One per node and type, keyed by the handle of the attribute so a new one replaces it, and the least
+// recently used are evicted once the cache goes over its size limit
+class MEGA_API FileAttributeCache
+{
+public:
+    // takes ownership of the table
+    FileAttributeCache(DbTable*, SymmCipher*, PrnGen&, size_t maxbytes = DEFAULT_MAX_BYTES);
+    ~FileAttributeCache();
+
+    bool get(handle nodehandle, fatype, handle fah, string* data);
+    bool contains(handle nodehandle, fatype, handle fah) const;
+    void put(handle nodehandle, fatype, handle fah, const char* data, size_t len);
+
+    // 0 empties the cache and keeps it empty
+    void setmaxbytes(size_t);
+    size_t bytes() const;
+    size_t count() const;
+
+    // delete the table for good
+    void remove();
+
+    static const size_t DEFAULT_MAX_BYTES = 64 << 20;
+
+    // the last use is only written back when it is older than this (seconds), so that
+    // scrolling through cached thumbnails doesn't turn into database writes
+    static const m_time_t LASTUSED_GRANULARITY = 3600;
+
+    // the metadata and the data records of an attribute share the rest of the id
+    enum { RECORD_META = 1, RECORD_DATA = 2 };
+
+private:
+    struct Entry
+    {
+        handle nodehandle;
+        fatype type;
+        handle fah;
+        uint32_t bytes;
+        m_time_t lastused;
+        m_time_t storedlastused;
+
+        void serialize(string*) const;
+        bool unserialize(const string&);
+    };
+
+    std::unique_ptr<DbTable> table;
+    SymmCipher* key;
+    PrnGen& rng;
+    size_t maxbytes;
+    size_t totalbytes;
+
+    // by id of their metadata record
+    std::map<uint32_t, Entry> entries;
+    std::map<std::pair<handle, fatype>, uint32_t> index;
+    std::set<std::pair<m_time_t, uint32_t>> lru;
+
+    bool putmeta(uint32_t, Entry&);
+    void erase(uint32_t);
+    void evict();
+};
 } // namespace
 
 #endif
@@ -22,12 +22,16 @@
 #pragma once
 
 #include <array>
+#include <map>
+#include <memory>
 
 #include "types.h"
 #include "filesystem.h"
 
 namespace mega {
 
+class DbTable;
+
 // sparse file fingerprint, including size and mtime
 struct MEGA_API FileFingerprint : public Cacheable
 {
@@ -42,6 +46,13 @@ struct MEGA_API FileFingerprint : public Cacheable
     // Generates a fingerprint by iterating through`fa`
     bool genfingerprint(FileAccess* fa, bool ignoremtime = false);
 
+    // Fingerprints many files concurrently, on up to `threads` threads (0: one per core,
+    // at most MAX_FINGERPRINT_THREADS). Each FileAccess has been fopen()ed (nonblocking) by the
+    // caller and is only used by one thread. Returns what genfingerprint() returned for each
+    static vector<bool> genfingerprints(const vector<std::pair<FileFingerprint*, FileAccess*>>& files, unsigned threads = 0, bool ignoremtime = false);
+
+    static const unsigned MAX_FINGERPRINT_THREADS = 8;
+
     // Generates a fingerprint by iterating through `is`
     bool genfingerprint(InputStreamAccess* is, m_time_t cmtime, bool ignoremtime = false);
 
@@ -63,6 +74,18 @@ struct MEGA_API FileFingerprintCmp
     bool operator()(const FileFingerprint* a, const FileFingerprint* b) const;
 };
 
+// hashes and compares file fingerprints by size / mtime / sparse CRC, the same fingerprints
+// FileFingerprintCmp considers equivalent (operator== is more lenient with mtimes)
+struct MEGA_API FileFingerprintHash
+{
+    size_t operator()(const FileFingerprint* fp) const;
+};
+
+struct MEGA_API FileFingerprintEqual
+{
+    bool operator()(const FileFingerprint* a, const FileFingerprint* b) const;
+};
+
 bool operator==(const FileFingerprint& lhs, const FileFingerprint& rhs);
 
 // A light-weight fingerprint only based on size and mtime
@@ -87,4 +110,50 @@ struct MEGA_API LightFileFingerprintCmp
 
 bool operator==(const LightFileFingerprint& lhs, const LightFileFingerprint& rhs);
 
+// fingerprints of local files kept across sessions, in a table of their own encrypted with the account key,
+// so that files whose fsid, size and mtime haven't changed aren't read again. The path is checked as well
+// because fsids are only unique within a filesystem. The oldest entries are dropped over the limit
+class MEGA_API FileFingerprintCache
+{
+public:
+    // takes ownership of the table
+    FileFingerprintCache(DbTable*, SymmCipher*, PrnGen&, size_t maxentries = DEFAULT_MAX_ENTRIES);
+    ~FileFingerprintCache();
+
+    bool get(handle fsid, const string& localpath, m_off_t size, m_time_t mtime, FileFingerprint*) const;
+    void put(handle fsid, const string& localpath, const FileFingerprint&);
+
+    // the file was notified as changed
+    void invalidate(handle fsid);
+
+    size_t count() const;
+
+    // delete the table for good
+    void remove();
+
+    static const size_t DEFAULT_MAX_ENTRIES = 1 << 18;
+
+private:
+    struct Entry
+    {
+        handle fsid;
+        string localpath;
+        FileFingerprint fp;
+
+        void serialize(string*) const;
+        bool unserialize(const string&);
+    };
+
+    std::unique_ptr<DbTable> table;
+    SymmCipher* key;
+    PrnGen& rng;
+    size_t maxentries;
+
+    // by id of their record, oldest first
+    std::map<uint32_t, Entry> entries;
+    std::map<handle, uint32_t> index;
+
+    void erase(uint32_t);
+};
+
 } // mega
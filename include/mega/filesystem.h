@@ -22,6 +22,10 @@
 #ifndef MEGA_FILESYSTEM_H
 #define MEGA_FILESYSTEM_H 1
 
+#include <condition_variable>
+#include <functional>
+#include <thread>
+
 #include "types.h"
 #include "waiter.h"
 
@@ -50,6 +54,11 @@ struct MEGA_API AsyncIOContext
     virtual ~AsyncIOContext();
     virtual void finish();
 
+    // records the start of its span on the timeline, if tracing (see CodeCounter::startTrace)
+    void tracebegin();
+    const char* tracename() const;
+    bool traced;
+
     // results
     asyncfscallback userCallback;
     void *userData;
@@ -119,6 +128,13 @@ struct MEGA_API FileAccess
     // absolute position read to byte buffer
     bool frawread(byte *, unsigned, m_off_t, bool caller_opened = false);
 
+    // read blocks of len bytes at each of the ascending offsets into consecutive parts of dst (file already open).
+    // Blocks close to each other are read together, and the reads are in flight at once where the platform allows
+    bool fsparseread(byte* dst, unsigned len, const vector<m_off_t>& offsets);
+
+    // blocks within this span are read with a single call
+    static const unsigned SPARSEREAD_MAXSPAN = 65536;
+
     // After a successful nonblocking fopen(), call openf() to really open the file (by localname)
     // (this is a lazy-type approach in case we don't actually need to open the file after finding out type/size/mtime).
     // If the size or mtime changed, it will fail.
@@ -130,6 +146,12 @@ struct MEGA_API FileAccess
     // absolute position write
     virtual bool fwrite(const byte *, unsigned, m_off_t) = 0;
 
+    // reserve disk space for a file opened for writing, without changing its size (if supported)
+    virtual bool fpreallocate(m_off_t) { return false; }
+
+    // hint that a file opened for reading will be read sequentially, and [pos, pos + len) soon (if supported)
+    virtual void freadahead(m_off_t /*pos*/, m_off_t /*len*/) { }
+
     FileAccess(Waiter *waiter);
     virtual ~FileAccess();
 
@@ -143,6 +165,9 @@ struct MEGA_API FileAccess
 
     AsyncIOContext *asyncfopen(string *, bool, bool, m_off_t = 0);
     AsyncIOContext* asyncfread(string *, unsigned, unsigned, m_off_t);
+
+    // into a buffer of at least len + pad bytes
+    AsyncIOContext* asyncfread(byte *, unsigned, unsigned, m_off_t);
     AsyncIOContext* asyncfwrite(const byte *, unsigned, m_off_t);
 
 
@@ -160,6 +185,16 @@ protected:
     virtual void asyncsysopen(AsyncIOContext*);
     virtual void asyncsysread(AsyncIOContext*);
     virtual void asyncsyswrite(AsyncIOContext*);
+
+    struct RawRead
+    {
+        byte* dst;
+        unsigned len;
+        m_off_t pos;
+    };
+
+    // a batch of independent reads; one sysread() after another unless the platform can do better
+    virtual bool sysreadbatch(const vector<RawRead>&);
 };
 
 struct MEGA_API InputStreamAccess
@@ -169,6 +204,20 @@ struct MEGA_API InputStreamAccess
     virtual ~InputStreamAccess() { }
 };
 
+// a directory record with the metadata that came with it from the enumeration
+struct MEGA_API DirEntry
+{
+    string localname;
+    nodetype_t type = TYPE_UNKNOWN;
+    m_off_t size = 0;
+    m_time_t mtime = 0;
+    handle fsid = UNDEF;
+    bool fsidvalid = false;
+
+    // false if the platform only returned the name and type: get the rest with a FileAccess
+    bool statvalid = false;
+};
+
 // generic host directory enumeration
 struct MEGA_API DirAccess
 {
@@ -178,6 +227,10 @@ struct MEGA_API DirAccess
     // get next record
     virtual bool dnext(string*, string*, bool = true, nodetype_t* = NULL) = 0;
 
+    // get next record with its size, mtime and fsid where the platform enumerates them in bulk,
+    // sparing a FileAccess::fopen() per entry (don't mix with dnext() on the same object)
+    virtual bool dnextstat(string*, DirEntry*, bool = true);
+
     virtual ~DirAccess() { }
 };
 
@@ -201,13 +254,27 @@ struct MEGA_API DirNotify
     // set if a temporary error occurred
     int error;
 
+    // notification buffer overflows not yet handled by the sync, and the journal position before the first of
+    // them (empty without a journal), for the sync to queue what changed since instead of scanning everything
+    unsigned overflows;
+    string overflowcursor;
+
     // base path
     string localbasepath;
 
     virtual void addnotify(LocalNode*, string*) { }
     virtual void delnotify(LocalNode*) { }
 
-    void notify(notifyqueue, LocalNode *, const char*, size_t, bool = false);
+    // closewrite: the item is a file that a writer just closed
+    void notify(notifyqueue, LocalNode *, const char*, size_t, bool = false, bool closewrite = false);
+
+    // the filesystem's change journal, to find out what changed while the sync wasn't running: journalcursor()
+    // gets the current position, journalchanges() passes the records since a position to the callback as
+    // (fsid, parent folder fsid, local name).  Both return false without a journal, and journalchanges() also
+    // if it was reset or has been overwritten since the position
+    typedef std::function<void(handle, handle, const string&)> journalchange_callback;
+    virtual bool journalcursor(string*) { return false; }
+    virtual bool journalchanges(const string&, const journalchange_callback&) { return false; }
 
     // filesystem fingerprint
     virtual fsfp_t fsfingerprint() const;
@@ -316,6 +383,13 @@ struct MEGA_API FileSystemAccess : public EventTrigger
     // delete notification
     virtual void delnotify(LocalNode*) { }
 
+    // watch whole filesystems rather than each folder, for the folders added from now on (fanotify on Linux, which
+    // needs CAP_SYS_ADMIN).  Returns false if not available, or when disabling while whole filesystems are watched
+    virtual bool setfswidenotify(bool) { return false; }
+
+    // folder watches and filesystem marks in place
+    virtual size_t notifywatches() const { return 0; }
+
     // get the absolute path corresponding to a path
     virtual bool expanselocalpath(string *path, string *absolutepath) = 0;
 
@@ -349,6 +423,53 @@ struct MEGA_API FileSystemAccess : public EventTrigger
     FileSystemAccess();
     virtual ~FileSystemAccess() { }
 };
+
+// reads folders on a pool of threads: each folder passed to add() comes back from next() as one batch with the
+// type, size, mtime and fsid of its entries.  It doesn't descend by itself: the caller adds the subfolders it wants
+class MEGA_API ParallelDirScanner
+{
+public:
+    // statvalid is false if the entry vanished or was locked between the listing and the stat
+    typedef DirEntry Entry;
+
+    struct Batch
+    {
+        string localpath;
+        bool success = false;   // the folder could be listed
+        vector<Entry> entries;
+    };
+
+    // the threads use fsaccess to create their DirAccess/FileAccess objects, and notify waiter after each batch
+    ParallelDirScanner(FileSystemAccess* fsaccess, unsigned threads, bool followsymlinks, Waiter* waiter);
+    ~ParallelDirScanner();
+
+    void add(const string& localpath);
+
+    // a finished batch, if any
+    bool next(Batch& batch);
+
+    // nothing queued, being read or waiting for next()
+    bool done();
+
+    unsigned threads() const;
+
+private:
+    FileSystemAccess* fsaccess;
+    bool followsymlinks;
+    Waiter* waiter;
+
+    std::deque<string> queued;
+    std::deque<Batch> finished;
+    unsigned reading = 0;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    bool stopping = false;
+
+    void workerLoop();
+    void read(Batch& batch);
+};
 } // namespace
 
 #endif
@@ -22,9 +22,11 @@
 #ifndef GFX_H
 #define GFX_H 1
 
+#include <atomic>
 #include <mutex>
 
 #include "megawaiter.h"
+#include "mega/mediafileattribute.h"
 #include "mega/thread/qtthread.h"
 #include "mega/thread/posixthread.h"
 #include "mega/thread/win32thread.h"
@@ -54,6 +56,89 @@ public:
 
     // resulting images
     vector<string *> images;
+
+#ifdef USE_MEDIAINFO
+    // extract the media properties of the file instead of generating images
+    // (flag is then set for an upload, and h is its upload handle)
+    bool mediainfo;
+
+    // opened by the client thread, so that the job doesn't need the FileSystemAccess
+    std::unique_ptr<FileAccess> fa;
+
+    // XXTEA key of the media attributes
+    uint32_t fakey[4];
+
+    // result
+    MediaProperties vp;
+#endif
+};
+
+// time spent by a backend and its workers on the images they processed
+struct MEGA_API GfxProcStats
+{
+    // files decoded, and those that couldn't be
+    unsigned images = 0;
+    unsigned failed = 0;
+    int64_t decodeus = 0;
+
+    // resizing and encoding, which the backends do in one step, per meta_t
+    unsigned resized[2] = {};
+    int64_t resizeus[2] = {};
+
+    // worker processes that crashed or hung, and were replaced
+    unsigned restarted = 0;
+};
+
+class GfxProc;
+
+// a child process doing the decoding and resizing of a GfxProc instance, forked from it when first needed, so that
+// a decoder that crashes or hangs on an untrusted file takes the child down rather than the app.  A child that dies
+// or doesn't answer in time is killed, and forked again for the next file.  The bitmap stays in the child, and the
+// JPEGs come back through memory shared with it
+class MEGA_API GfxWorkerProcess
+{
+public:
+    GfxWorkerProcess(GfxProc* backend, int steptimeoutms);
+    ~GfxWorkerProcess();
+
+    // false if no child could be started (no fork() on this platform, or out of resources)
+    bool start();
+
+    // as the backend's readbitmap(), resizebitmap() and freebitmap(), run by the child
+    bool readbitmap(string* localname, int size);
+    bool resizebitmap(int w, int h, string* jpeg);
+    void freebitmap();
+
+    // largest JPEG handed back
+    static const size_t SHARED_SIZE = 4 << 20;
+
+private:
+    enum { READ = 1, RESIZE, FREE };
+
+    struct Request
+    {
+        int32_t op, a, b;
+        uint32_t pathlen;
+    };
+
+    struct Reply
+    {
+        int32_t ok, w, h;
+        uint32_t jpeglen;
+    };
+
+    GfxProc* backend;
+    int steptimeoutms;
+    int pid = -1;
+    int sock = -1;
+    void* shared = nullptr;
+
+    // false if the child died or didn't reply in time, and was stopped
+    bool call(const Request&, const string* path, Reply* reply);
+    void stop(bool failed);
+
+    // the loop of the child
+    void serve();
 };
 
 class MEGA_API GfxJobQueue
@@ -66,6 +151,7 @@ class MEGA_API GfxJobQueue
         GfxJobQueue();
         void push(GfxJob *job);
         GfxJob *pop();
+        size_t size();
 };
 
 // bitmap graphics processor
@@ -81,6 +167,51 @@ class MEGA_API GfxProc
     static void *threadEntryPoint(void *param);
     void loop();
 
+    // process jobs queued in queues (this instance's, or its owner's) until batch of them are claimed, or none are left
+    void processjobs(GfxProc* queues, size_t batch, std::atomic<size_t>& claimed);
+
+    // additional instances of the backend, each with its own stored bitmap, processing the jobs queued
+    // in this one as tasks of the worker pool (WorkerPool::WORK_GFX).  Created on demand, up to maxworkers,
+    // and only touched by the thread of this one
+    vector<GfxProc*> workers;
+    std::atomic<unsigned> maxworkers;
+    std::atomic<unsigned> workercount;
+    bool startworker();
+
+    // instance whose queues a worker serves (NULL for the main one)
+    std::atomic<GfxProc*> owner;
+
+    // kept by the main instance for its workers too
+    std::mutex statsmutex;
+    GfxProcStats stats;
+
+    // started with the first job
+    bool threadstarted;
+    bool threadstopped;
+    void stopthread();
+    unsigned workerlimit();
+    void queuejob(GfxJob*);
+
+    // decoding in a worker process, which is only touched with mutex held
+    friend class GfxWorkerProcess;
+    std::atomic<bool> isolated;
+    std::atomic<int> isolatedtimeoutms;
+    std::unique_ptr<GfxWorkerProcess> process;
+    GfxWorkerProcess* bitmapprocess = nullptr;     // where the stored bitmap is (NULL: here)
+    void processfailed();
+
+    // readbitmap(), resizebitmap() and freebitmap(), in the worker process if isolated
+    bool decode(string*, int);
+    bool resize(int, int, string*);
+    void release();
+
+    // the upload a job is attaching attributes to, if it's still around
+    Transfer* uploadtransfer(handle);
+
+#ifdef USE_MEDIAINFO
+    void mediapropertiesready(GfxJob*);
+#endif
+
     // read and store bitmap
     virtual bool readbitmap(FileAccess*, string*, int) = 0;
 
@@ -100,6 +231,13 @@ protected:
     // list of supported video extensions (NULL if no pre-filtering is needed)
     virtual const char* supportedvideoformats();
 
+    // new instance of the backend to process jobs in parallel with this one
+    // (NULL if the backend can't run several instances at once)
+    virtual GfxProc* newworker();
+
+    // whether the backend can run in a forked child (false if it calls back into the app)
+    virtual bool forkable();
+
 public:
     virtual int checkevents(Waiter*);
 
@@ -115,6 +253,13 @@ public:
     // - must save at 85% quality (120*120 pixel result: ~4 KB)
     int gendimensionsputfa(FileAccess*, string*, handle, SymmCipher*, int = -1, bool checkAccess = true);
 
+#ifdef USE_MEDIAINFO
+    // extract the media properties of a video/audio file on the same threads and queue them
+    // for the upload (handle is its uploadhandle, and the upload must count one more
+    // attribute in minfa) or send them for the existing node
+    void genmediaproperties(string*, handle, uint32_t fakey[4], bool upload);
+#endif
+
     // FIXME: read dynamically from API server
     typedef enum { THUMBNAIL, PREVIEW } meta_t;
     typedef enum { AVATAR250X250 } avatar_t;
@@ -122,6 +267,27 @@ public:
     // generate and save a fa to a file
     bool savefa(string*, int, int, string*);
 
+    // number of backend instances (this one included) that may process queued jobs in parallel
+    // 0 (the default) sizes the pool to the cores left by the client and transfer crypto threads
+    void setmaxworkers(unsigned);
+    unsigned getworkers();
+
+    // decode and resize the images in worker processes, one per backend instance, where the platform and the
+    // backend allow it.  A step of a file (decoding, each resize) that takes longer than the timeout is given up
+    void setisolated(bool, int steptimeoutms = ISOLATED_STEP_TIMEOUT_MS);
+    bool getisolated();
+
+    static const int ISOLATED_STEP_TIMEOUT_MS = 30000;
+
+    // accumulated since the instance was created or the last reset
+    GfxProcStats getstats();
+    void resetstats();
+
+    static const unsigned MAX_WORKERS = 4;
+
+    // time a video may take to produce the frame for its thumbnail and preview (seconds)
+    static const int VIDEO_FRAME_TIME_BUDGET = 5;
+
     // - w*0: largest square crop at the center (landscape) or at 1/6 of the height above center (portrait)
     // - w*h: resize to fit inside w*h bounding box
     static const int dimensions[][2];
@@ -36,6 +36,8 @@ class MEGA_API GfxProcCG : public mega::GfxProc
     int maxSizeForThumbnail(const int rw, const int rh);
 private: // mega::GfxProc implementations
     const char* supportedformats();
+    mega::GfxProc* newworker();
+    bool forkable();
     bool readbitmap(mega::FileAccess*, mega::string*, int);
     bool resizebitmap(int, int, mega::string*);
     void freebitmap();
@@ -38,6 +38,9 @@ class GfxProcExternal : public GfxProc
     bool resizebitmap(int, int, string*);
     void freebitmap();
 
+    // the processor is the app's, possibly in another language runtime
+    bool forkable();
+
 public:
     GfxProcExternal();
     bool isgfx(string*);
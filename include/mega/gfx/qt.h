@@ -97,6 +97,7 @@ protected:
 
     const char* supportedformats();
     const char* supportedvideoformats();
+    GfxProc* newworker();
 
 public:
     static int getExifOrientation(QString &filePath);
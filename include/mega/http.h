@@ -22,9 +22,13 @@
 #ifndef MEGA_HTTP_H
 #define MEGA_HTTP_H 1
 
+#include <mutex>
+#include <deque>
+
 #include "types.h"
 #include "waiter.h"
 #include "backofftimer.h"
+#include "mega_ccronexpr.h"
 
 #ifndef _WIN32
 #include <sys/types.h>
@@ -117,6 +121,111 @@ protected:
     int speedCounter;
 };
 
+// the number of requests of a kind allowed in flight, adapted to their latency: it grows by one per round of
+// requests that complete about as fast as the fastest seen lately, shrinks by a quarter when they get much
+// slower and halves when the servers refuse them (API_EAGAIN, API_ERATELIMIT), at most once per round
+class MEGA_API AdaptiveConcurrency
+{
+public:
+    AdaptiveConcurrency(int minimum, int maximum, int initial);
+
+    int limit() const { return current; }
+
+    // a request completed in that time (ds) since it was sent
+    void completed(dstime latency);
+
+    // a request was refused, and will be retried
+    void refused();
+
+    // completions after which the fastest latency seen so far is forgotten, so that the limit follows
+    // a network that became slower
+    static const unsigned LATENCY_WINDOW = 64;
+
+private:
+    int minimum, maximum, current;
+    unsigned fastenough = 0;
+    unsigned sincedecrease = 0;     // requests since the last decrease (or the start)
+    unsigned seen = 0;
+    dstime best = NEVER;
+    dstime windowbest = NEVER;
+};
+
+// bytes per second, refilled continuously and holding up to a second's worth.  Data may go while there are
+// tokens left, even more than that (the debt is paid before anything else goes), so a whole cURL buffer never
+// waits on a rate smaller than itself
+struct MEGA_API TokenBucket
+{
+    m_off_t rate = 0;   // 0: unlimited
+    m_off_t tokens = 0;
+    dstime refilled = 0;
+
+    void setrate(m_off_t bps, dstime now);
+    void refill(dstime now);
+    bool empty() const { return rate && tokens <= 0; }
+};
+
+// hierarchical bandwidth limits shared by every transfer and streaming request: all of them (global), each
+// direction, and each scheduling group (File::schedulinggroup).  Data flows only if every bucket that applies
+// to it has tokens.  Schedules can replace the limits from the times a cron expression matches, for a while
+class MEGA_API BandwidthShaper
+{
+public:
+    // bytes per second, 0 for none
+    void setlimit(m_off_t bps);
+    void setlimit(direction_t d, m_off_t bps);
+    void setgrouplimit(int group, m_off_t bps);
+
+    // during `duration` seconds from each time `cron` matches (UTC, seconds first), the global limit is lifted,
+    // downloads and uploads are limited to `getbps` and `putbps` (0: unthrottled) and group limits don't apply.
+    // Returns false if the expression is not valid
+    bool addschedule(const char* cron, m_time_t duration, m_off_t getbps, m_off_t putbps);
+    void clearschedules();
+
+    // refill the buckets and pick the limits in force at `now`
+    void update(dstime ds, m_time_t now);
+
+    // limit for the downloads that are not streaming (0: none), while streams need the bandwidth
+    void setbackgroundlimit(m_off_t bps);
+
+    // scheduling group of the streaming requests, which the background limit doesn't apply to
+    static const int STREAMING_GROUP = -1;
+
+    enum { FREE, GROUP_LIMITED, DIRECTION_LIMITED };
+
+    // what keeps data of this direction and group from going now
+    int blocked(direction_t d, int group) const;
+
+    // bytes that may go now (-1: unlimited)
+    m_off_t available(direction_t d, int group) const;
+
+    void consume(direction_t d, int group, m_off_t bytes);
+
+    // the schedule in force, or -1
+    int activeschedule() const { return scheduled; }
+
+private:
+    struct Schedule
+    {
+        cron_expr expr;
+        m_time_t duration;
+        m_off_t limits[2];
+    };
+    vector<Schedule> schedules;
+    int scheduled = -1;
+    m_time_t evaluated = -1;
+
+    m_off_t limits[3] = { 0, 0, 0 };    // GET, PUT, and global (at API)
+    std::map<int, m_off_t> grouplimits;
+
+    TokenBucket buckets[3];
+    std::map<int, TokenBucket> groupbuckets;
+    TokenBucket background;
+    dstime lastds = 0;
+
+    void applylimits();
+    const TokenBucket* groupbucket(int group) const;
+};
+
 // generic host HTTP I/O interface
 struct MEGA_API HttpIO : public EventTrigger
 {
@@ -139,6 +248,9 @@ struct MEGA_API HttpIO : public EventTrigger
     virtual void lock() { }
     virtual void unlock() { }
 
+    // data received by in-flight requests is complete up to HttpReq::size(), so it can be consumed and purged early
+    virtual bool incrementalinput() const { return false; }
+
     virtual void disconnect() { }
 
     // track Internet connectivity issues
@@ -150,14 +262,14 @@ struct MEGA_API HttpIO : public EventTrigger
     // timestamp of last data received (across all connections)
     dstime lastdata;
     
-    // download speed
+    // download speed (the speeds are atomic: MegaApi reads them without the SDK mutex)
     SpeedController downloadSpeedController;
-    m_off_t downloadSpeed;
+    std::atomic<m_off_t> downloadSpeed;
     void updatedownloadspeed(m_off_t size = 0);
 
     // upload speed
     SpeedController uploadSpeedController;
-    m_off_t uploadSpeed;
+    std::atomic<m_off_t> uploadSpeed;
     void updateuploadspeed(m_off_t size = 0);
 
     // data receive timeout (ds)
@@ -193,8 +305,140 @@ struct MEGA_API HttpIO : public EventTrigger
     // get max upload speed
     virtual m_off_t getmaxuploadspeed();
 
+    // limits shared by all transfers and streaming requests (honoured by CurlHttpIO)
+    BandwidthShaper shaper;
+
+    // use HTTP/2 where the server supports it, multiplexing requests over shared connections
+    // (HTTP/1.1 otherwise).  Returns false if the implementation can't
+    virtual bool sethttp2(bool enable);
+
+    // requests made while a connection to the same host is being opened wait for it and share it
+    virtual bool multiplexes() const;
+
+    // the TLS sessions, to resume them after a restart (empty if not supported)
+    virtual void exportsslsessions(string* data);
+    virtual void importsslsessions(const string& data);
+
+    // the resolved addresses, to use them after a restart while they are checked again
+    virtual void exportdnscache(string* data);
+    virtual void importdnscache(const string& data);
+
+    struct ConnectionStats
+    {
+        uint64_t requests = 0;
+        uint64_t http2requests = 0;
+        uint64_t connections = 0;     // requests that opened a new connection
+        uint64_t handshakes = 0;      // and negotiated TLS for it
+        unsigned connectionsPerMinute = 0;
+        unsigned handshakesPerMinute = 0;
+    };
+    ConnectionStats getconnectionstats() const;
+
     HttpIO();
     virtual ~HttpIO() { }
+
+protected:
+    // account for a finished request
+    void countrequest(bool newconnection, bool handshake, bool http2);
+
+private:
+    ConnectionStats connectionstats;
+
+    // times (ds) of the connections and handshakes of the last minute
+    std::deque<dstime> recentconnections;
+    std::deque<dstime> recenthandshakes;
+};
+
+// recycles the download buffers (HttpReqDL, RaidBufferManager::FilePiece) instead of a new[]/delete[] per chunk.
+// Sizes are rounded up to classes a quarter of a power of two apart, and idle buffers are kept up to a byte limit
+// (the rest are freed).  Buffers can be returned from any thread
+class MEGA_API BufferPool
+{
+public:
+    // smaller or larger buffers are allocated directly
+    static const size_t MIN_POOLED = 64 << 10;
+    static const size_t MAX_POOLED = 64 << 20;
+
+    explicit BufferPool(size_t maxIdleBytes);
+    ~BufferPool();
+
+    // a buffer of at least `size` bytes, and its actual size
+    byte* get(size_t size, size_t& capacity);
+
+    // give back a buffer from get()
+    void put(byte* buf, size_t capacity);
+
+    // idle bytes kept at most.  0 frees them all and stops pooling
+    void setlimit(size_t maxIdleBytes);
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t dropped = 0;  // returned while at the limit
+        size_t idleBytes = 0;
+        size_t maxIdleBytes = 0;
+        size_t busyBytes = 0;  // handed out and not given back yet
+    };
+    Stats stats() const;
+
+    // the size get() allocates for `size`
+    static size_t classsize(size_t size);
+
+private:
+    mutable std::mutex mutex;
+    std::map<size_t, vector<byte*>> idle;
+    Stats counters;
+};
+
+// moving averages of the throughput, time to first byte and error rate of each storage server, from the
+// responses of the transfers that use it.  Hosts scoring poorly compared to the others are avoided for a while
+class MEGA_API StorageHealth
+{
+public:
+    // weight of a new sample in the averages, in percent
+    static const int EWMA_WEIGHT = 20;
+
+    // responses before a host can be judged, score (0..1) below which it is poor, and how long it is avoided (ds)
+    static const unsigned MIN_SAMPLES = 4;
+    static const int POOR_SCORE_PERCENT = 30;
+    static const dstime COOLDOWN_DS = 1800;
+
+    // smaller responses don't count for throughput, their duration is mostly the round trip
+    static const m_off_t MIN_THROUGHPUT_BYTES = 65536;
+
+    struct Host
+    {
+        double throughput = 0;  // bytes per second
+        double ttfbms = 0;
+        double errorrate = 0;
+        unsigned samples = 0;
+        unsigned throughputsamples = 0;
+        unsigned ttfbsamples = 0;
+        dstime avoidedsince = 0;
+        bool avoided = false;
+    };
+
+    // account a response of `bytes` that took `elapsedms` (first byte after `ttfbms`, -1 if unknown).
+    // They return true if the host just turned poor
+    bool success(const string& url, m_off_t bytes, int ttfbms, int elapsedms, dstime now);
+    bool failure(const string& url, dstime now);
+
+    // 0 (worst) to 1, relative to the other hosts
+    double score(const string& host) const;
+
+    // the host of `url` is poor, and within its cooldown
+    bool avoided(const string& url, dstime now);
+
+    const std::map<string, Host>& hosts() const { return hostmap; }
+
+    static string hostof(const string& url);
+
+private:
+    std::map<string, Host> hostmap;
+
+    bool sampled(const string& host, Host& h, dstime now);
+    static void average(double& value, double sample, unsigned samples);
 };
 
 // outgoing HTTP request
@@ -220,6 +464,25 @@ struct MEGA_API HttpReq
     string* out;
     string in;
     size_t inpurge;
+
+    // Content-Encoding of `out` (empty if sent as is)
+    string contentencoding;
+
+    // bytes already erased from the front of `in` after being purged
+    m_off_t indiscarded;
+
+    // the response is consumed incrementally through data()/purge(), so don't preallocate it
+    bool streamed;
+
+    // a dns() request that opens a connection for later transfers in this direction (NONE for plain ones)
+    direction_t preconnect;
+
+    // scheduling group of the transfer, for BandwidthShaper (0 for none)
+    int shapinggroup;
+
+    // timings of the last response in ms (-1 if unknown), set by the HttpIO as it completes
+    int ttfbms;
+    int elapsedms;
     size_t outpos;
 
     string outbuf;
@@ -227,6 +490,10 @@ struct MEGA_API HttpReq
     byte* buf;
     m_off_t buflen, bufpos, notifiedbufpos;
 
+    // where buf comes from (if set), and its allocated size
+    std::shared_ptr<BufferPool> bufferpool;
+    size_t bufcapacity;
+
     // we assume that API responses are smaller than 4 GB
     m_off_t contentlength;
 
@@ -246,6 +513,12 @@ struct MEGA_API HttpReq
     // identify different channels from different MegaClients etc in the log
     string logname;
 
+    // name of the async span of each request on the timeline (see CodeCounter::startTrace),
+    // and whether the current one has been recorded as started
+    const char* tracename;
+    bool traced;
+    void traceend();
+
     // set url and content type for subsequent requests
     void setreq(const char*, contenttype_t);
 
@@ -265,6 +538,9 @@ struct MEGA_API HttpReq
     char* data();
     size_t size();
 
+    // total response bytes received so far, including purged data
+    m_off_t received() const;
+
     // a buffer that the HttpReq filled in.   This struct owns the buffer (so HttpReq no longer has it).
     struct http_buf_t 
     { 
@@ -275,12 +551,15 @@ struct MEGA_API HttpReq
         size_t end;
 
         http_buf_t(byte* b, size_t s, size_t e);  // takes ownership of the byte*, which must have been allocated with new[]
+        http_buf_t(byte* b, size_t s, size_t e, std::shared_ptr<BufferPool> pool, size_t capacity);  // or taken from the pool, and returned to it
         ~http_buf_t();
         void swap(http_buf_t& other);
         bool isNull();
 
     private: 
         byte* buf;
+        std::shared_ptr<BufferPool> pool;
+        size_t capacity;
     };
     
     // give up ownership of the buffer for client to use.  The caller is the new owner of the http_buf_t, and the HttpReq no longer has the buffer or any info about it.
@@ -334,6 +613,70 @@ struct MEGA_API GenericHttpReq : public HttpReq
 
     // backoff to control the maximum allowed time for the request
     BackoffTimer maxbt;
+
+    // GeLB service of the request, to cache its response
+    string gelbservice;
+};
+
+// measures the round trip time and loss to the API and storage servers with small requests sent one at a time,
+// and derives the transfer settings that suit the link
+class MEGA_API NetworkProbe
+{
+public:
+    // requests to each endpoint, and how long one may take before it counts as lost (ds)
+    static const unsigned PINGS = 4;
+    static const dstime PING_TIMEOUT_DS = 50;
+
+    struct Endpoint
+    {
+        string url;
+        unsigned sent = 0;
+        unsigned lost = 0;
+        double rttms = 0;       // average time to the first byte of the replies
+    };
+
+    struct Profile
+    {
+        unsigned connections = 0;   // per transfer (0: unchanged)
+        unsigned transfers = 0;     // concurrent transfers per direction (0: unchanged)
+        m_off_t requestsize = 0;    // largest transfer request (0: unchanged)
+        bool altport = false;       // transfers on port 8080
+
+        // what it was derived from
+        double rttms = 0;
+        double loss = 0;            // 0..1
+        double bandwidth = 0;       // bytes per second (0 if unknown)
+        m_time_t measured = 0;
+
+        void serialize(string* data) const;
+        bool unserialize(const string& data);
+        string json() const;
+    };
+
+    // measure these URLs (the previous measurements are discarded)
+    void start(const vector<string>& urls);
+
+    // sends the next request and collects the finished one.  Returns true once all the endpoints are measured
+    bool exec(MegaClient*);
+
+    bool running() const { return current < targets.size(); }
+    dstime deadline() const { return sentds + PING_TIMEOUT_DS; }
+    const vector<Endpoint>& endpoints() const { return targets; }
+    void stop();
+
+    // the settings for a link with this round trip (ms), loss (0..1) and bandwidth (bytes per second, 0 if unknown).
+    // `altportonly`: the storage servers could only be reached on the alternative port.  High latency links
+    // get up to `maxtransfers` concurrent transfers
+    static Profile tune(double rttms, double loss, double bandwidth, bool altportonly, unsigned maxtransfers);
+
+    NetworkProbe();
+    ~NetworkProbe();
+
+private:
+    vector<Endpoint> targets;
+    size_t current;
+    unique_ptr<HttpReq> req;
+    dstime sentds;
 };
 
 class MEGA_API EncryptByChunks
@@ -355,12 +698,18 @@ public:
 
     bool encrypt(m_off_t pos, m_off_t npos, string& urlSuffix);
 
+    // XOR size bytes of data, at offset from the start of the piece, into crc.  Pieces of data may
+    // be folded in any order, and the crcs of separate pieces combined by XOR
+    static void updateCRC(byte* crc, const byte* data, unsigned size, unsigned offset);
+
+    // the suffix of the upload URL of the piece starting at pos
+    static string urlSuffix(m_off_t pos, const byte* crc);
+
 private:
     SymmCipher* key;
     chunkmac_map* macs;
     uint64_t ctriv;     // initialization vector for CTR mode
     byte crc[CRCSIZE];
-    void updateCRC(byte* data, unsigned size, unsigned offset);
 };
 
 class MEGA_API EncryptBufferByChunks : public EncryptByChunks
@@ -387,11 +736,44 @@ struct MEGA_API HttpReqXfer : public HttpReq
 // file chunk upload
 struct MEGA_API HttpReqUL : public HttpReqXfer
 {
+    // the chunk, read from the file into a buffer from the pool, encrypted in place and sent from there.
+    // Given back once the chunk is uploaded, so idle connections don't hold one
+    byte* body = nullptr;
+    size_t bodycapacity = 0;
+
+    // a body for `size` bytes of file data plus `pad` bytes of padding
+    byte* bodybuffer(unsigned size, unsigned pad);
+    void releasebody();
+
     void prepare(const char*, SymmCipher*, chunkmac_map*, uint64_t, m_off_t, m_off_t);
 
+    // the rest of prepare(), for a body encrypted elsewhere: its MACs are in macs and the end of its URL in urlsuffix
+    void prepared(const char* tempurl, chunkmac_map* macs, m_off_t pos, m_off_t npos);
+
+    // hand the body over while it is encrypted on another thread (which releases it if it is not given back)
+    byte* detachbody(size_t* capacity);
+    void attachbody(byte* b, size_t capacity);
+
+    // the range the body was encrypted for (empty until prepare()), the end of its URL and the MACs of its
+    // chunks, so that a later slot of the transfer can send it again as it is
+    m_off_t bodypos = 0;
+    m_off_t bodyend = 0;
+    string urlsuffix;
+    vector<pair<m_off_t, ChunkMAC>> bodymacs;
+
+    // swaps the bodies, and what they were encrypted for, with another request
+    void swapbody(HttpReqUL&);
+
+    // prepares the body, as it was encrypted, for tempurl
+    void resend(const char* tempurl, chunkmac_map*);
+
+    // send the body
+    void post(MegaClient*);
+
     m_off_t transferred(MegaClient*);
 
-    ~HttpReqUL() { }
+    HttpReqUL() { tracename = "upload chunk"; }
+    ~HttpReqUL();
 };
 
 // file chunk download
@@ -409,6 +791,7 @@ struct MEGA_API HttpReqDL : public HttpReqXfer
 // file attribute get
 struct MEGA_API HttpReqGetFA : public HttpReq
 {
+    HttpReqGetFA() { tracename = "file attribute"; }
     ~HttpReqGetFA() { }
 };
 } // namespace
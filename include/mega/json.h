@@ -26,6 +26,19 @@
 
 namespace mega {
 
+// non-owning slice of the JSON being parsed, valid while its buffer is (the std::string_view we can't have in C++11)
+// string values are held without their quotes and are not unescaped
+struct MEGA_API JSONView
+{
+    const char* data = nullptr;
+    size_t size = 0;
+
+    bool empty() const { return !size; }
+    string str() const { return data ? string(data, size) : string(); }
+    bool equals(const char* s) const { return data && !strncmp(data, s, size) && !s[size]; }
+    bool equals(const string& s) const { return data && s.size() == size && !memcmp(data, s.data(), size); }
+};
+
 // linear non-strict JSON scanner
 struct MEGA_API JSON
 {
@@ -39,9 +52,13 @@ struct MEGA_API JSON
     double getfloat();
     const char* getvalue();
 
+    // as getvalue(), also delimiting the value.  data is null if there is none
+    JSONView getvalueView();
+
     nameid getnameid();
     nameid getnameid(const char*) const;
     string getname();
+    JSONView getnameView();
 
     bool is(const char*);
 
@@ -60,6 +77,9 @@ struct MEGA_API JSON
 
     bool storeobject(string* = NULL);
 
+    // as storeobject(), pointing into the JSON instead of copying it
+    bool storeobjectView(JSONView*);
+
     static void unescape(string*);
 
     /**
@@ -77,6 +97,37 @@ struct MEGA_API JSON
     inline bool     getbool()   { return bool(getint()); }
 };
 
+// incremental scanner that delimits the elements of a JSON array arriving in chunks,
+// so that they can be parsed before the rest of the array has been received
+class MEGA_API JSONArrayScanner
+{
+public:
+    // start a new array, positioned just after its opening '['
+    void reset();
+
+    // scan data[0..len), which continues at the first byte not consumed by the previous call,
+    // and pass each complete element to `element` (scanning stops if it returns false).  Objects and arrays
+    // are passed as soon as they are closed, other values once their separator arrives
+    // returns the number of leading bytes consumed, which must not be presented again
+    size_t feed(const char* data, size_t len, const std::function<bool(const char*, size_t)>& element);
+
+    // the closing ']' of the array has been consumed
+    bool finished() const { return mFinished; }
+
+    // unbalanced data, or an element was rejected
+    bool failed() const { return mFailed; }
+
+private:
+    // bytes of the current (incomplete) element already scanned
+    size_t mScanned = 0;
+
+    int mDepth = 0;
+    bool mInString = false;
+    bool mEscape = false;
+    bool mFinished = false;
+    bool mFailed = false;
+};
+
 } // namespace
 
 #endif
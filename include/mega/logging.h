@@ -92,11 +92,15 @@
 #include <array>
 #include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 // define MEGA_QT_LOGGING to support QString
@@ -575,6 +579,159 @@ public:
 #endif
 };
 
+// Where and when the message being logged was produced: by the calling thread, or, while an
+// AsyncLogger delivers a message, by the thread that logged it
+struct LogOrigin
+{
+    unsigned thread = 0;    // numbered from 1 in order of first use
+    int64_t timeus = 0;     // system clock, microseconds since the Epoch
+
+    static LogOrigin current();
+};
+
+// Logger that hands the messages to a background thread, which delivers them to another Logger,
+// so the logging threads don't wait for the locks and the output of the target.
+// Messages are queued in a lock-free ring. They are dropped, and counted, if the ring is full or if
+// a call site logs more than `ratelimit` debug/info/verbose messages per second (0: no limit).
+// Warnings and errors are never rate limited
+class AsyncLogger : public Logger
+{
+public:
+    struct Stats
+    {
+        uint64_t delivered = 0;
+        uint64_t ratelimited = 0;
+        uint64_t queuefull = 0;
+    };
+
+    AsyncLogger(Logger* target, unsigned ratelimit = 1000, size_t capacity = 8192);
+    ~AsyncLogger();
+
+    void log(const char *time, int loglevel, const char *source, const char *message
+#ifdef ENABLE_LOG_PERFORMANCE
+             , const char **directMessages = nullptr, size_t *directMessagesSizes = nullptr, int numberMessages = 0
+#endif
+            ) override;
+
+    void setratelimit(unsigned perSecond);
+
+    // waits until the queued messages have been delivered
+    void flush();
+
+    // stops the background thread after delivering the queued messages; until start() is
+    // called again, messages are delivered on the logging thread
+    void stop();
+    void start();
+
+    Stats stats() const;
+
+private:
+    struct Record
+    {
+        int level = 0;
+        LogOrigin origin;
+        char time[16];
+        char source[64];
+        std::string message;
+    };
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        Record record;
+    };
+
+    Logger* target;
+    std::atomic<unsigned> ratelimit;
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    std::atomic<size_t> enqueuepos{ 0 };
+    size_t dequeuepos = 0;
+
+    // per call site (hashed): second << 32 | messages in that second
+    static const unsigned SITES = 512;
+    std::atomic<uint64_t> sites[SITES];
+
+    std::atomic<uint64_t> pushed{ 0 }, delivered{ 0 }, ratelimited{ 0 }, queuefull{ 0 };
+    uint64_t reportedratelimited = 0, reportedqueuefull = 0;
+
+    std::atomic<bool> running{ false };
+    std::atomic<bool> sleeping{ false };
+    std::mutex mutex;
+    std::condition_variable cv, drained;
+    std::thread thread;
+
+    bool allowed(int loglevel, const char* source, const char* message);
+    bool push(Record&&);
+    bool pop(Record&);
+    bool empty() const;
+    void deliver(const Record&);
+    void loop();
+};
+
+// Compact binary log: each message is split into a template, with the numbers and the words that
+// contain digits (handles, ids, sizes...) taken out as arguments, and the templates and the sources
+// ("file:line") are written once and referred to by number. BinaryLogReader (and the
+// tests/tool/binlog_decode tool) renders it back to text
+class BinaryLogger : public Logger
+{
+public:
+    // writes to `out`, which must outlive this object
+    BinaryLogger(std::ostream& out);
+
+    void log(const char *time, int loglevel, const char *source, const char *message
+#ifdef ENABLE_LOG_PERFORMANCE
+             , const char **directMessages = nullptr, size_t *directMessagesSizes = nullptr, int numberMessages = 0
+#endif
+            ) override;
+
+    static const char MAGIC[8];
+
+private:
+    // longer messages, and those beyond the template table, are written as they are
+    static const size_t MAXTEMPLATELENGTH = 2048;
+    static const size_t MAXTEMPLATES = 1 << 16;
+
+    std::mutex mutex;
+    std::ostream& out;
+    std::unordered_map<std::string, uint64_t> templates, sources;
+    int64_t lasttimeus = 0;
+    std::string record, pattern, args;
+
+    uint64_t intern(std::unordered_map<std::string, uint64_t>&, const std::string&, char tag);
+};
+
+class BinaryLogReader
+{
+public:
+    struct Entry
+    {
+        int64_t timeus = 0;
+        unsigned thread = 0;
+        int level = 0;
+        std::string source;
+        std::string message;
+
+        // "HH:MM:SS.uuuuuu t<thread> <level> <message> [<source>]"
+        std::string render() const;
+    };
+
+    BinaryLogReader(std::istream& in);
+
+    // false if the stream isn't a binary log
+    bool valid() const;
+
+    // false at the end, or if the log is truncated or corrupt
+    bool next(Entry&);
+
+private:
+    std::istream& in;
+    bool header;
+    int64_t lasttimeus = 0;
+    std::vector<std::string> templates, sources;
+};
+
 // source file leaf name - maybe to be compile time calculated one day
 template<std::size_t N> inline const char* log_file_leafname(const char(&fullpath)[N])
 {
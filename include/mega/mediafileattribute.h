@@ -35,6 +35,7 @@ void xxteaDecrypt(uint32_t* v, uint32_t vlen, uint32_t key[4], bool endianConv =
 
 struct MEGA_API MediaFileInfo;
 struct MEGA_API FileSystemAccess;
+struct MEGA_API FileAccess;
 
 struct MEGA_API MediaProperties
 {
@@ -76,6 +77,9 @@ struct MEGA_API MediaProperties
     // Open the specified local file with mediainfoLib and get its video parameters.  This function fills in the names but not the IDs
     void extractMediaPropertyFileAttributes(const std::string& localFilename, FileSystemAccess* fa);
 
+    // As above, from a file already open for reading.  Doesn't use the FileSystemAccess, so it can run off the client thread
+    void extractMediaPropertyFileAttributes(FileAccess* fa, const std::string& path);
+
     // Look up the IDs of the codecs and container, and encode and encrypt all the info into a string with file attribute 8, and possibly file attribute 9.
     std::string convertMediaPropertyFileAttributes(uint32_t attributekey[4], MediaFileInfo& mediaInfo);
 #endif
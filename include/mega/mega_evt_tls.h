@@ -37,6 +37,16 @@ typedef intptr_t ssize_t;
 
 typedef struct evt_tls_s evt_tls_t;
 
+//size of each end of the BIO pair of a connection: a few full records, so that
+//bulk writes go to the network in batches rather than a record at a time
+#define EVT_TLS_BIO_SIZE (4 * (16 * 1024 + 256))
+
+//seconds a session can be resumed for
+#define EVT_TLS_SESSION_TIMEOUT 3600
+
+//room for the session ticket keys of any OpenSSL version
+#define EVT_TLS_TICKET_KEYS_SIZE 128
+
 //callback used for handshake completion notificat6ion
 //common for both client and server role
 typedef void (*evt_handshake_cb)(evt_tls_t *con, int status);
@@ -121,6 +131,11 @@ int evt_ctx_init_ex(evt_ctx_t *tls, const char *crtf, const char *key);
 
 int evt_ctx_set_crt_key(evt_ctx_t *tls, const char *crtf, const char *key);
 
+/* set the keys that protect the session tickets, so that contexts sharing them resume
+each other's sessions. `keys` must hold EVT_TLS_TICKET_KEYS_SIZE random bytes.
+Returns 1 on success */
+int evt_ctx_set_ticket_keys(evt_ctx_t *tls, const unsigned char *keys);
+
 /* test if the certificate is set*/
 int evt_ctx_is_crtf_set(evt_ctx_t *t);
 
@@ -129,6 +129,10 @@ struct MEGA_API MegaApp
     virtual void share_result(error) { }
     virtual void share_result(int, error) { }
 
+    // parts of the node keys of a new share sent so far, when they do not fit in one request
+    // (share_result() follows the last one)
+    virtual void share_progress(int, int) { }
+
     // outgoing pending contact result
     virtual void setpcr_result(handle, error, opcactions_t) { }
     // incoming pending contact result
@@ -193,6 +197,10 @@ struct MEGA_API MegaApp
     virtual dstime pread_failure(error, int, void*, dstime) { return ~(dstime)0; }
     virtual bool pread_data(byte*, m_off_t, m_off_t, m_off_t, m_off_t, void*) { return false; }
 
+    // instead of pread_data() for reads queued with a lease limit: the app owns the lease (data, length and
+    // position) and destroys it when done with it, from any thread
+    virtual bool pread_lease(DirectReadLease*, m_off_t /*speed*/, m_off_t /*meanSpeed*/, void*) { return false; }
+
     // event reporting result
     virtual void reportevent_result(error) { }
 
@@ -239,8 +247,8 @@ struct MEGA_API MegaApp
     virtual void chatinvite_result(error) { }
     virtual void chatremove_result(error) { }
     virtual void chaturl_result(string*, error) { }
-    virtual void chatgrantaccess_result(error) { }
-    virtual void chatremoveaccess_result(error) { }
+    virtual void chatgrantaccess_result(handle, error) { }
+    virtual void chatremoveaccess_result(handle, error) { }
     virtual void chatupdatepermissions_result(error) { }
     virtual void chattruncate_result(error) { }
     virtual void chatsettitle_result(error) { }
@@ -330,6 +338,12 @@ struct MEGA_API MegaApp
 
     virtual void notify_business_status(BizStatus) { }
 
+    // the memory used went over or back under a threshold of the budget, see MegaClient::setmemorybudget()
+    virtual void memory_pressure(mempressure_t) { }
+
+    // the startup of the session reached a stage, see MegaClient::stagedstartup
+    virtual void startup_stage(startupstage_t) { }
+
     virtual void notify_change_to_https() { }
 
     // account confirmation via signup link
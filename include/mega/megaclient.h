@@ -24,6 +24,7 @@
 
 #include "json.h"
 #include "db.h"
+#include "sharednodes.h"
 #include "gfx.h"
 #include "filefingerprint.h"
 #include "request.h"
@@ -32,6 +33,7 @@
 #include "sharenodekeys.h"
 #include "account.h"
 #include "backofftimer.h"
+#include "fileattributefetch.h"
 #include "http.h"
 #include "pubkeyaction.h"
 #include "pendingcontactrequest.h"
@@ -42,6 +44,7 @@
 namespace mega {
 
 class SyncConfigBag;
+class SyncDebrisQueue;
 
 class MEGA_API FetchNodesStats
 {
@@ -138,6 +141,14 @@ public:
      */
     dstime timeToLastByte;
 
+    /**
+     * @brief Time until the first node is available
+     *
+     * From DB: NEVER, records are only loaded once the whole database has been read
+     * From API: time until the first node of the response has been parsed while it downloads
+     */
+    dstime timeToFirstNode;
+
     /**
      * @brief Time until the cached filesystem is ready
      *
@@ -178,6 +189,46 @@ public:
      * The resumption of transfers is done after the filesystem is current
      */
     dstime timeToTransfersResumed;
+
+    /**
+     * @brief Approximate memory cost per node (bytes) once the cached filesystem is ready
+     *
+     * Pooled node storage (Node objects, children list and attribute entries), which is shared
+     * by all clients of the process and so divided by the process-wide node count, plus this
+     * client's node table divided by its number of nodes. Variable-length strings are not included.
+     */
+    long long bytesPerNode;
+
+    /**
+     * @brief Durability/performance profile of the local cache database (DbProfile::PROFILE_*), -1 without one
+     */
+    int dbProfile;
+
+    ////////////////////////////////////////////////////////
+    // Stages of a staged startup (ds), NEVER without one //
+    ////////////////////////////////////////////////////////
+
+    /**
+     * @brief Time until the nodes are usable and the secondary data starts loading
+     */
+    dstime timeToSecondaryStage;
+
+    /**
+     * @brief Time until the authrings are loaded and the keys of the contacts requested
+     */
+    dstime timeToContactsKeys;
+
+    /**
+     * @brief Time until the user alerts are loaded (NEVER for folder links, which have none)
+     */
+    dstime timeToUserAlerts;
+
+    /**
+     * @brief Time until every stage has finished
+     *
+     * The statistics are reported then, instead of when the filesystem is current
+     */
+    dstime timeToStartupDone;
 };
 
 class MEGA_API MegaClient
@@ -193,6 +244,9 @@ public:
     // all nodes
     node_map nodes;
 
+    // source of Node::childrenseq values, unique for the client's lifetime
+    uint64_t childrenseq = 0;
+
     // keep track of user storage, inshare storage, file/folder counts per root node.
     NodeCounterMap mNodeCounters;
 
@@ -240,6 +294,15 @@ public:
 #ifdef ENABLE_CHAT
     // all chats
     textchat_map chats;
+
+    // the chats that each node is attached to, kept in step with their attachedNodes
+    map<handle, handle_set> attachmentchats;
+
+    // grant or revoke the access of a chat peer to an attached node, keeping attachmentchats in step
+    bool setattachmentaccess(TextChat*, handle h, handle uh, bool revoke = false);
+
+    // add or remove all the attachments of a chat to or from attachmentchats
+    void indexattachments(TextChat*, bool add);
 #endif
 
     // process API requests and HTTP I/O
@@ -300,7 +363,8 @@ public:
     error validatepwd(const byte *);
 
     // get user data
-    void getuserdata();
+    // deferrable for the periodic refresh of the cached data
+    void getuserdata(bool deferrable = false);
 
     // get miscelaneous flags
     void getmiscflags();
@@ -338,8 +402,8 @@ public:
     // extract public handle and key from a public file/folder link
     error parsepubliclink(const char *link, handle &ph, byte *key, bool isFolderLink);
 
-    // set folder link: node, key
-    error folderaccess(const char*folderlink);
+    // set folder link: node, key - and the only folder of the link whose nodes are loaded, if any
+    error folderaccess(const char*folderlink, handle subtree = UNDEF);
 
     // open exported file link (op=0 -> download, op=1 fetch data)
     void openfilelink(handle ph, const byte *key, int op);
@@ -361,6 +425,22 @@ public:
     // fetchnodes stats
     FetchNodesStats fnstats;
 
+    // if set, fetchnodes() only asks for what the nodes need, and the authrings (and with them the keys of the
+    // contacts), the push settings and the timezone are requested once the nodes are usable (STARTUP_SECONDARY).
+    // The session is STARTUP_DONE when those and the user alerts are loaded.  The app hears of each stage
+    // through MegaApp::startup_stage()
+    bool stagedstartup = false;
+    startupstage_t startupstage = STARTUP_NODES;
+
+    // the nodes are usable: request the rest (cached: the session was resumed from the local cache)
+    void startsecondarystage(bool cached);
+
+    // moves to STARTUP_DONE once the secondary data is loaded
+    void checkstartupdone();
+
+    // the user alerts caught up, or gave up doing so
+    void useralertsloaded();
+
     // load cryptographic keys: RSA, Ed25519, Cu25519 and their signatures
     void fetchkeys();
 
@@ -380,8 +460,25 @@ public:
     error trackKey(attr_t keyType, handle uh, const std::string &key);
 
     // track the signature of a public key in the authring for a given user
+    // (while checking all contacts, the signature is verified later, see verifysignatures())
     error trackSignature(attr_t signatureType, handle uh, const std::string &signature);
 
+    // signatures of contact keys waiting for verifysignatures()
+    struct PendingSignature
+    {
+        attr_t signatureType;
+        handle uh;
+        string pubKey;
+        string signature;
+        string signingPubKey;
+    };
+    vector<PendingSignature> mPendingSignatures;
+
+    // verify the pending signatures on a pool of threads, then track them in arrival order
+    void verifysignatures();
+
+    static const int SIGVERIFY_MINSHARD = 64;
+
     // set the Ed25519 public key as verified for a given user in the authring (done by user manually by comparing hash of keys)
     error verifyCredentials(handle uh);
 
@@ -427,6 +524,9 @@ public:
     // start/stop/pause file transfer
     bool startxfer(direction_t, File*, DBTableTransactionCommitter&, bool skipdupes = false, bool startfirst = false, bool donotpersist = false);
     void stopxfer(File* f, DBTableTransactionCommitter* committer);
+
+    // stop the files of a direction that match, in one pass over the queue and one batch of cache deletions
+    void stopxfers(direction_t, const std::function<bool(File*)>& match, DBTableTransactionCommitter& committer);
     void pausexfers(direction_t, bool pause, bool hard, DBTableTransactionCommitter& committer);
 
     // maximum number of connections per transfer
@@ -435,14 +535,72 @@ public:
     // set max connections per transfer
     void setmaxconnections(direction_t, int);
 
-    // enqueue/abort direct read
-    void pread(Node*, m_off_t, m_off_t, void*);
-    void pread(handle, SymmCipher* key, int64_t, m_off_t, m_off_t, void*, bool = false,  const char* = NULL, const char* = NULL, const char* = NULL);
+    // auto connection mode: starting from connections[d], each eligible transfer gets connections added (up to
+    // MAX_NUM_CONNECTIONS) while that measurably raises its speed, and those that gain least give theirs up
+    // to the ones that gain most once the total reaches the budget.  Off by default
+    void setautoconnections(direction_t, bool enable);
+
+    // maximum number of connections across all transfers in auto connection mode
+    void setconnectionbudget(unsigned budget);
+
+    // decrypt and mac downloads, and encrypt and mac uploads, on worker threads instead of the client thread, holding at most
+    // maxInFlightBytes of queued data.  0 threads (the default) keeps it inline
+    void settransfercryptothreads(unsigned threads, size_t maxInFlightBytes = 64 << 20);
+
+    // keep a snapshot of all nodes next to the state cache, so that a cold start reads and decrypts them in one go
+    // instead of record by record.  Off by default, as it roughly doubles the space used by the node cache
+    void setnodesnapshot(bool enable);
+
+    // keep a secondary index of the cached nodes (parent, name, fingerprint, size, mtime, type), so that the
+    // queries below can run on the database.  Off by default
+    void setnodeindex(bool enable);
+
+    // handles of the matching nodes according to the index.  False if there is none
+    bool indexedchildren(handle parent, vector<handle>* result);
+    bool indexedbyname(const string& name, vector<handle>* result);
+    bool indexedbyfingerprint(const FileFingerprint& fingerprint, vector<handle>* result);
+
+    // low-memory mode: keep the resident nodes within about this many bytes by paging the least recently looked up
+    // files out to the state cache, and back in from it by handle through the node index (which this enables).
+    // Folders, and nodes that are shared, synced, being read or changed, always stay.  0 (the default) disables it
+    void setlowmemory(size_t budgetbytes);
+
+    // keep the memory of the client's main consumers (see memsubsystem_t) within about this many bytes, 0 (the
+    // default) for no limit.  Their usage is estimated every MEMORY_INTERVAL.  From MEMORY_MODERATE_PERCENT of the
+    // budget, the streaming cache and the idle buffer pool are halved and transfers request smaller chunks; over the
+    // budget, they are dropped, nothing is read ahead, transfers go down to one connection and, in low-memory mode,
+    // nodes are paged out right away.  The app hears of every change of level through MegaApp::memory_pressure()
+    void setmemorybudget(size_t bytes);
+
+    // estimated bytes used by a subsystem, as of the last sample
+    size_t memoryusage(memsubsystem_t) const;
+
+    // keep the older versions of files out of memory: they are paged out to the state cache shortly after they
+    // appear, whatever the budget of setlowmemory(), and come back when the versions of a file are walked.  Counters
+    // and fingerprint lookups are not affected.  Enables the node index
+    void setcompactversions(bool enable);
+
+    // pinned nodes and everything below them stay resident
+    void pinnode(handle, bool pin);
+
+    // bring back the paged-out children of a folder, for code that walks its children list
+    void pageinchildren(Node*);
+
+    // ...and of every folder below it
+    void pageinsubtree(Node*);
+
+    // number of children of a folder that are paged out
+    size_t pagedchildren(handle) const;
+
+    // enqueue/abort direct read.  With maxleased, the data is lent to the app (see MegaApp::pread_lease()), which
+    // may hold up to that many bytes before the read waits for it
+    void pread(Node*, m_off_t, m_off_t, void*, m_off_t maxleased = 0);
+    void pread(handle, SymmCipher* key, int64_t, m_off_t, m_off_t, void*, bool = false,  const char* = NULL, const char* = NULL, const char* = NULL, m_off_t maxleased = 0);
     void preadabort(Node*, m_off_t = -1, m_off_t = -1);
     void preadabort(handle, m_off_t = -1, m_off_t = -1);
 
-    // pause flags
-    bool xferpaused[2];
+    // pause flags (atomic: MegaApi reads them without the SDK mutex)
+    std::atomic<bool> xferpaused[2];
 
 #ifdef ENABLE_SYNC
     // active syncs
@@ -456,21 +614,99 @@ public:
 
     // whether we allow the automatic resumption of syncs
     bool allowAutoResumeSyncs = true;
+
+    // threads reading folders for the initial scan of new syncs.  0 (the default) scans inline in addsync()
+    unsigned syncscanthreads = 0;
+    void setsyncscanthreads(unsigned threads);
+
+    // upload at most this many versions of a synced file per hour, holding later changes until the oldest
+    // of them is an hour old.  0 (the default): only the usual version rate control
+    unsigned syncmaxversionsperhour = 0;
+
+    // threads moving the items that syncdown() deletes to the local debris, each with a FileSystemAccess from
+    // newfsaccess.  0 (the default) moves them inline
+    unsigned syncdebristhreads = 0;
+    void setsyncdebristhreads(unsigned threads, std::function<FileSystemAccess*()> newfsaccess);
+    std::function<FileSystemAccess*()> syncdebrisfsaccess;
+    std::unique_ptr<SyncDebrisQueue> syncdebrisqueue;
+
+    // applies the moves to the local debris that finished
+    void syncdebriscompleted();
+
+    // files at the front of the notification queue of each sync whose fingerprints are read ahead of the scan,
+    // on a thread per sync with a FileSystemAccess from newfsaccess, so that a slow sync doesn't hold the others.
+    // 0 (the default) reads them inline
+    size_t syncprefetchdepth = 0;
+    void setsyncprefetch(size_t depth, std::function<FileSystemAccess*()> newfsaccess);
+    std::function<FileSystemAccess*()> syncprefetchfsaccess;
+
+    // if set, filesystem notifications and action packets only have syncdown()/syncup() visit the LocalNode
+    // subtrees they touched (see LocalNode::setsyncdirty()), instead of the whole trees.  Other triggers still
+    // get full passes
+    bool syncdirtysubtrees = false;
 #endif
 
     // if set, symlinks will be followed except in recursive deletions
     // (give the user ample warning about possible sync repercussions)
     bool followsymlinks;
 
+    // if set, downloads reserve the disk space for the whole file when they start
+    bool preallocatedownloads = false;
+
+    // if set, the temporary files of downloads are named after the node, and a download started without cached
+    // progress takes the leading chunks of the one it left behind (see PartialDownloadCheck)
+    bool resumepartialdownloads = false;
+    static const unsigned PARTIALCHECK_THREADS = 4;
+    unsigned partialchecks = 0;
+
+    // the name of the temporary file of a download, if resumepartialdownloads is set
+    bool partialdownloadname(Transfer*, string* localname);
+
+    // checks the partial file of a download to resume.  False while the check runs
+    bool resumepartialdownload(Transfer*);
+
+    // if set, downloads gather the contiguous pieces they receive into sequential writes of up to this many bytes
+    size_t coalesceddownloadwrites = 0;
+    static const size_t MAX_COALESCED_DOWNLOAD_WRITE = 64 << 20;
+
+    // if set, uploads of files larger than a block read this many bytes ahead of their connections, on a thread per upload
+    size_t uploadreadahead = 0;
+    static const size_t MAX_UPLOAD_READAHEAD = 256 << 20;
+
+    // account: only the nodes below these folders (and below inbound shares) are kept, with the
+    // folders leading to them (empty: all). Set before fetchnodes, as the cache holds only them.
+    handle_set nodescope;
+
+    // inbound shares read by the fetchnodes in flight, before mergenewshares() marks them
+    handle_set nodescopeshares;
+
+    // whether the node is in or below one of the folders of nodescope, or an inbound share
+    bool innodescope(const Node*) const;
+
+    // delete the nodes outside of nodescope that fetchnodes had to keep until its end
+    void prunenodescope();
+
     // number of parallel connections per transfer (PUT/GET)
     unsigned char connections[2];
 
+    // auto connection mode per direction, and its total budget
+    bool autoconnections[2];
+    unsigned connectionbudget;
+
     // generate & return next upload handle
     handle uploadhandle(int);
 
     // helper function for preparing a putnodes call for new folders
     void putnodes_prepareOneFolder(NewNode* newnode, std::string foldername);
 
+    // upload completions to the same folder share one putnodes of up to this many files, sent once full, after
+    // PUTNODES_BATCH_DELAY or when no upload is left to join it.  1 (the default): each file on its own
+    void setputnodesbatch(unsigned maxfiles);
+    unsigned putnodesbatch() const { return putnodesbatchsize; }
+
+    // queue the completion of one upload (newnode allocated with new NewNode[1], taken over) to th
+    void putnodesbatched(handle th, NewNode* newnode, int tag);
+
     // add nodes to specified parent node (complete upload, copy files, make
     // folders)
     void putnodes(handle, NewNode*, int, const char * = nullptr, Transfer * = nullptr);
@@ -483,6 +719,24 @@ public:
 
     // queue file attribute retrieval
     error getfa(handle h, string *fileattrstring, const string &nodekey, fatype, int = 0);
+
+    // queue the retrieval of the attributes of these nodes that aren't cached yet, with no request
+    // waiting for them: a list about to be shown is fetched in a few wide batches per cluster.
+    // Returns the number of attributes queued
+    int prefetchfa(const vector<handle>&, fatype);
+
+    // drop the prefetches of these nodes that haven't been sent yet (a request may have taken one over: it stays).
+    // Returns the number dropped
+    int cancelprefetchfa(const vector<handle>&, fatype);
+
+    // size limit of the file attribute cache, kept across sessions next to the state cache
+    // (FileAttributeCache::DEFAULT_MAX_BYTES by default, 0 disables and empties it)
+    void setfacachesize(size_t bytes);
+
+    // fingerprint of an open local file, taken from the fingerprint cache when the file's fsid, size
+    // and mtime haven't changed, and stored there otherwise. Returns whether it changed, as
+    // FileFingerprint::genfingerprint() does
+    bool genfingerprint(FileFingerprint*, FileAccess*, const string& localpath, bool usecache = true);
     
     // notify delayed upload completion subsystem about new file attribute
     void checkfacompletion(handle, Transfer* = NULL);
@@ -536,6 +790,16 @@ public:
 
     // close server-client HTTP connection
     void catchup();
+
+    // catching up from the local cache, a backlog of action packets larger than this percentage of
+    // the size of a fetchnodes response for the cached tree is reloaded instead of replayed (0: never)
+    unsigned catchupreloadpercent = 100;
+
+    // bytes of action packets received since the session was loaded from the local cache
+    m_off_t catchupbytes = 0;
+
+    // count an sc response of the catch-up: whether reloading is cheaper than replaying the backlog
+    bool catchupbyreload(size_t bytes);
     // abort lock request
     void abortlockrequest();
 
@@ -761,9 +1025,21 @@ public:
     // storage status
     storagestatus_t ststatus;
 
-    // minimum bytes per second for streaming (0 == no limit, -1 == use default)
+    // minimum bytes per second for streaming (0 == no limit, -1 == adapt it to the media and the link)
     int minstreamingrate;
 
+    // reserves bandwidth for the streams playing media
+    StreamingScheduler streamingscheduler;
+
+    // media bytes per second of a node being streamed (0 if unknown)
+    void setstreamingbitrate(handle, bool p, m_off_t bitrate);
+
+    // streamed data kept per node for later reads, which also enables reading ahead (0 == disabled)
+    size_t directreadcachelimit = 0;
+
+    // streamed blocks kept on disk for later reads of any node, if enabled
+    std::unique_ptr<StreamingBlockCache> streamingblockcache;
+
     // root URL for API requests
     static string APIURL;
 
@@ -798,8 +1074,10 @@ private:
     BackoffTimer btcs;
     BackoffTimer btbadhost;
     BackoffTimer btworkinglock;
+    BackoffTimer btpipelined;
 
-    vector<TimerWithBackoff *> bttimers;
+    // app timers by their trigger time, so that only the ones due are visited
+    multimap<dstime, TimerWithBackoff *> bttimers;
 
     // server-client command trigger connection
     HttpReq* pendingsc;
@@ -827,6 +1105,10 @@ private:
     // public handle being used
     handle publichandle;
 
+    // folder link: the nodes outside this folder are skipped as they are read (UNDEF: all)
+    // (the API returns parents before their children, so their parent being loaded is enough)
+    handle folderlinksubtree;
+
     // API response JSON object
     JSON response;
 
@@ -852,10 +1134,11 @@ private:
     // maximum number of concurrent transfers (uploads or downloads)
     static const unsigned MAXTRANSFERS;
 
-    // maximum number of queued putfa before halting the upload queue
-    static const int MAXQUEUEDFA;
+    // bytes of queued putfa data before halting the upload queue
+    static const size_t MAXQUEUEDFABYTES;
 
-    // maximum number of concurrent putfa
+    // bounds of the number of concurrent putfa, which adapts to their latency in between
+    static const int MINPUTFA;
     static const int MAXPUTFA;
 
 #ifdef ENABLE_SYNC
@@ -869,14 +1152,12 @@ private:
     // a TransferSlot chunk failed
     bool chunkfailed;
     
-    // fetch state serialize from local cache
-    bool fetchsc(DbTable*);
 
     // close the local transfer cache
     void closetc(bool remove = false);
 
     // server-client command processing
-    void sc_updatenode();
+    Node* sc_updatenode();
     Node* sc_deltree();
     handle sc_newnodes();
     void sc_contacts();
@@ -931,10 +1212,11 @@ private:
     bool isprivatehandle(handle*);
     
     // add direct read
-    void queueread(handle, bool, SymmCipher*, int64_t, m_off_t, m_off_t, void*, const char* = NULL, const char* = NULL, const char* = NULL);
+    void queueread(handle, bool, SymmCipher*, int64_t, m_off_t, m_off_t, void*, const char* = NULL, const char* = NULL, const char* = NULL, m_off_t = 0);
     
     // execute pending direct reads
     bool execdirectreads();
+    void schedulestreaming();
 
     // maximum number parallel connections for the direct read subsystem
     static const int MAXDRSLOTS = 16;
@@ -969,6 +1251,28 @@ public:
     // DB access
     DbAccess* dbaccess = nullptr;
 
+    // if set, the state cache, transfer cache and sync state cache tables opened from now on are written by a
+    // thread of their own (see WriteBehindDbTable)
+    bool dbwritebehind = false;
+
+    // opens one of those tables
+    DbTable* opencachetable(string* dbname, bool recycleLegacyDB, bool checkAlwaysTransacted);
+
+    // keeps a SharedNodeView of the nodes in memory at path, under key, for other processes (empty path: none)
+    void setsharednodeview(const string& path, const string& key);
+
+    string sharednodeviewpath;
+    string sharednodeviewkey;
+    uint64_t sharednodeviewgeneration = 0;
+    bool sharednodeviewdirty = false;
+    dstime sharednodeviewds = 0;
+
+    // minimum time between rewrites of the view, so bursts of actionpackets rewrite it once
+    static const dstime SHAREDNODEVIEW_INTERVAL = 50;
+
+    // writes the view, if it changed and the nodes are current
+    void writesharednodeview();
+
     // state cache table for logged in user
     DbTable* sctable;
 
@@ -992,22 +1296,206 @@ public:
     // have we just completed fetching new nodes?  (ie, caught up on all the historic actionpackets since the fetchnodes)
     bool statecurrent;
 
-    // pending file attribute writes
+    // pending file attribute writes, and the size of their data
     putfa_list queuedfa;
+    size_t queuedfabytes = 0;
 
     // current file attributes being sent
     putfa_list activefa;
 
+    // how many of them may be sent at once, starting from the former fixed limit
+    AdaptiveConcurrency putfaconcurrency{ MINPUTFA, MAXPUTFA, 10 };
+
+    // send queued file attributes while the limit allows
+    void dispatchputfa();
+
     // API request queue double buffering:
     // reqs[r] is open for adding commands
     // reqs[r^1] is being processed on the API server
     HttpReq* pendingcs;
 
+    // order-independent batches in flight beside pendingcs, by the dispatcher's sequence number
+    map<uint64_t, unique_ptr<HttpReq>> pipelinedcs;
+
+    // collect the responses of the pipelined batches and send more of them
+    void execpipelinedcs();
+
     // pending HTTP requests
     pendinghttp_map pendinghttp;
 
+    // mobile efficiency: deferrable commands wait up to MOBILE_MAX_DEFERRAL for other traffic to go with, so that
+    // background work does not wake the radio up on its own.  The radio is taken to stay up for RADIO_TAIL_DS after
+    // data arrives
+    void setmobileefficiency(bool enable);
+    static const dstime MOBILE_MAX_DEFERRAL = 600;
+    static const dstime RADIO_TAIL_DS = 50;
+
+    // open a connection to the host of a tempurl ahead of the transfer requests, at most once per
+    // host and direction every PRECONNECT_INTERVAL_DS (idle connections are kept for about two minutes)
+    void preconnect(const string& url, direction_t d);
+    static const dstime PRECONNECT_INTERVAL_DS = 600;
+    std::list<std::unique_ptr<HttpReq>> preconnects;
+    std::map<string, dstime> preconnected;
+
+    // health of the storage servers, from the transfer responses
+    StorageHealth storagehealth;
+
+    // GeLB responses by service.  They answer requests for GELB_CACHE_TTL seconds, and are
+    // refreshed in the background of the requests made after half of it
+    struct GelbCacheEntry
+    {
+        string response;
+        m_time_t ts;
+    };
+    static const m_time_t GELB_CACHE_TTL = 600;
+    std::map<string, GelbCacheEntry> gelbcache;
+    std::map<string, std::unique_ptr<GenericHttpReq>> gelbrefreshes;
+    void cachegelb(const string& service, const string& response);
+
+    // DNS, GeLB and TLS session results kept in the local db across restarts
+    enum { NETCACHE_DNS = 1, NETCACHE_GELB = 2, NETCACHE_TLS = 3, NETCACHE_PROFILE = 4 };
+    std::unique_ptr<DbTable> nctable;
+    void loadnetcache();
+    void savenetcache();
+
+    // measure the link to the API and the storage servers seen so far, then apply (and keep in the netcache)
+    // the settings that suit it.  The last profile is applied again on startup
+    void probenetwork();
+    void execnetprobe();
+    void applynetprofile(const NetworkProbe::Profile&);
+    NetworkProbe netprobe;
+
+    // set by the application when it needs exec() to run again by then (callbacks it is holding back)
+    dstime appwakeupds = NEVER;
+    NetworkProbe::Profile netprofile;
+
+    // concurrent transfers per direction (MAXTRANSFERS unless tuned), and the largest transfer request (0: by platform)
+    unsigned maxtransfers;
+    m_off_t maxrequestsize;
+
     // record type indicator for sctable
-    enum { CACHEDSCSN, CACHEDNODE, CACHEDUSER, CACHEDLOCALNODE, CACHEDPCR, CACHEDTRANSFER, CACHEDFILE, CACHEDCHAT } sctablerectype;
+    enum { CACHEDSCSN, CACHEDNODE, CACHEDUSER, CACHEDLOCALNODE, CACHEDPCR, CACHEDTRANSFER, CACHEDFILE, CACHEDCHAT, CACHEDNODESNAPSHOT, CACHEDNODEINDEX } sctablerectype;
+
+    // node snapshot: all CACHEDNODE records in one blob, valid only while the token recorded in the
+    // CACHEDNODESNAPSHOT record matches it (any node record change deletes that record, and so does
+    // paging nodes out: the snapshot is only written while they are all resident)
+    static const uint32_t NODESNAPSHOT_VERSION = 1;
+
+    // a stale snapshot is rewritten at most this often (ds)
+    static const dstime NODESNAPSHOT_INTERVAL = 36000;
+
+    bool usenodesnapshot = false;
+
+    // the snapshot matches the node records
+    bool nodesnapshotcurrent = false;
+
+    // when the snapshot was last written, 0 if not in this session
+    dstime nodesnapshotds = 0;
+
+    bool writenodesnapshot();
+    bool readnodesnapshot(node_vector* dp);
+
+    // node index: present while the CACHEDNODEINDEX record is, maintained along with the node records
+    bool usenodeindex = false;
+
+    // derived from the master key
+    string nodeindexkey;
+
+    uint64_t nodeindexhash(char field, const string& value);
+    bool indexnode(Node*);
+
+    // build or drop the index of a cache loaded from disk as needed, to match usenodeindex
+    void checknodeindex();
+
+    // low-memory mode, see setlowmemory()
+    size_t lowmemorybudget = 0;
+
+    // rough cost of a resident file node, with its attributes, fingerprint and links
+    static const size_t LOWMEMORY_NODEBYTES = 640;
+
+    // the resident nodes are trimmed to this percentage of the budget
+    static const size_t LOWMEMORY_TRIMPERCENT = 90;
+
+    handle_set pinnednodes;
+
+    // number of paged-out children of each folder or file (its versions), and their total
+    map<handle, size_t> pagedcounts;
+    size_t pagedoutnodes = 0;
+
+    // what the paged-out descendants of a paged-out version add to its subtree counts, restored with it
+    map<handle, NodeCounter> pagedsubtrees;
+
+    // see setcompactversions().  Nodes that became versions since the last pass
+    bool compactversions = false;
+    vector<handle> newversions;
+    dstime versionsds = 0;
+
+    // set while nodes are paged in or out, so that the counters of their ancestors and mNodeCounters are not touched
+    bool pagingnodes = false;
+
+    // set while all the nodes are deleted, so that each one doesn't unlink itself from its relatives and from the
+    // indexes that are cleared afterwards (see purgenodesusersabortsc())
+    bool discardingnodes = false;
+
+    // bumped by every lookup in nodebyhandle()
+    uint32_t nodeaccesstick = 0;
+
+    // the nodes are trimmed at most this often (ds)
+    static const dstime LOWMEMORY_INTERVAL = 10;
+    dstime lowmemoryds = 0;
+
+    // memory budget, see setmemorybudget()
+    size_t memorybudget = 0;
+    size_t memoryused[MEMORY_SUBSYSTEMS] = {};
+    mempressure_t memorypressure = MEMORY_PRESSURE_NONE;
+    static const dstime MEMORY_INTERVAL = 10;
+    static const size_t MEMORY_MODERATE_PERCENT = 80;
+    dstime memoryds = 0;
+
+    // the bytes of upload chunks kept for their retries (see Transfer::unackedchunks), and the most kept
+    size_t unackedchunkbytes = 0;
+    size_t maxunackedchunkbytes = 32 << 20;
+
+    // the largest request of a transfer under moderate and critical pressure
+    static const m_off_t MEMORY_MODERATE_REQSIZE = 4 << 20;
+    static const m_off_t MEMORY_CRITICAL_REQSIZE = 1 << 20;
+
+    // sample the usage, and on a change of level adjust the subsystems and tell the app
+    void measurememory();
+    void applymemorypressure();
+
+    // the streaming cache limit and request size currently in force under pressure
+    size_t directreadlimit() const;
+    m_off_t pressurerequestsize(m_off_t requestsize) const;
+
+    // auto connection mode: judge the last change and make the next one.  Longer than SPEED_MEAN_INTERVAL_DS,
+    // so that the speeds compared are measured after the change
+    static const dstime REBALANCE_INTERVAL = 100;
+    dstime rebalanceds = 0;
+    void rebalanceconnections();
+
+    // upload completions waiting to be sent, per target folder
+    struct PutnodesBatch
+    {
+        NewNode* nodes = nullptr;
+        vector<int> tags;
+        dstime since = 0;
+    };
+    std::map<handle, PutnodesBatch> putnodesbatches;
+    unsigned putnodesbatchsize = 1;
+    static const dstime PUTNODES_BATCH_DELAY = 5;
+    void sendputnodesbatch(handle th);
+    void sendputnodesbatches();
+    void clearputnodesbatches();
+
+    bool pageable(Node*);
+    void pageout(Node*);
+    void pageoutnodes();
+    void pageoutversions();
+    void queueversions();
+    Node* pageinnode(handle);
+    void pageinbyfingerprint(FileFingerprint*);
+    void pageinall();
 
     // open/create state cache database table
     void opensctable();
@@ -1017,6 +1505,9 @@ public:
     void updatesc();
     void finalizesc(bool);
 
+    // fetch state serialize from local cache
+    bool fetchsc(DbTable*);
+
     // flag to pause / resume the processing of action packets
     bool scpaused;
 
@@ -1056,12 +1547,37 @@ public:
     // pending file attributes
     fa_map pendingfa;
 
+    // the file attributes of existing nodes taken by uploads of the same content, by upload handle, in putnodes format
+    map<handle, string> reusedfa;
+
+    // if set, an upload of content that is in the account already, with file attributes, encrypts it with the key of
+    // that node and attaches its attributes instead of generating them again (the file is read once more up front
+    // to check it's the same content, so only files up to MAXFAREUSESIZE)
+    bool reusefileattributes = true;
+    static const m_off_t MAXFAREUSESIZE = 64 << 20;
+
+    // takes the key and the file attributes of a node with the content of the upload's file, if there is one.
+    // Returns the mask of the images still to be generated
+    int takefileattributes(Transfer*, FileAccess*);
+
     // upload waiting for file attributes
     handletransfer_map faputcompletion;    
 
     // file attribute fetch channels
     fafc_map fafcs;
 
+    // decrypted file attributes kept across sessions, NULL without a state cache
+    std::unique_ptr<FileAttributeCache> facache;
+    size_t facachemaxbytes;
+    void openfacache(const string& dbname);
+
+    // fingerprints of local files kept across sessions, NULL without a state cache
+    std::unique_ptr<FileFingerprintCache> fpcache;
+    void openfpcache(const string& dbname);
+
+    // requested attributes found in the cache, delivered by exec() as fetched ones are
+    std::deque<std::pair<FileAttributeFetch, string>> cachedfas;
+
     // generate attribute string based on the pending attributes for this upload
     void pendingattrstring(handle, string*);
 
@@ -1082,6 +1598,9 @@ public:
     // transfer list to manage the priority of transfers
     TransferList transferlist;
 
+    // order in which ready transfers are started, instead of strictly by priority (none by default)
+    std::unique_ptr<TransferScheduler> transferscheduler;
+
     // cached transfers (PUT/GET)
     transfer_map cachedtransfers[2];
 
@@ -1089,6 +1608,13 @@ public:
     vector<string> cachedfiles;
     vector<uint32_t> cachedfilesdbids;
 
+    // the cached files are resumed TRANSFERRESUME_BATCH at a time from cachedfilespos: the first batch at once,
+    // the rest from exec(), so that the first transfers start without waiting for the whole queue
+    static const unsigned TRANSFERRESUME_BATCH = 1000;
+    size_t cachedfilespos = 0;
+    bool cachedfilesresuming = false;
+    void resumecachedfiles();
+
     // database IDs of cached files and transfers
     // waiting for the completion of a putnodes
     pendingdbid_map pendingtcids;
@@ -1109,6 +1635,9 @@ public:
     // FileFingerprint to node mapping
     Fingerprints mFingerprints;
 
+    // file nodes (versions included) by creation time, for the recent nodes
+    node_ctime_map filesbyctime;
+
     // send updates to app when the storage size changes
     int64_t mNotifiedSumSize = 0;
 
@@ -1124,8 +1653,11 @@ public:
     // number of seconds to invalidate the cached user data
     static dstime USER_DATA_EXPIRATION_BACKOFF_SECS;
 
-    // total number of Node objects
-    long long totalNodes;
+    // total number of Node objects (atomic: MegaApi reads it without the SDK mutex)
+    std::atomic<long long> totalNodes;
+
+    // approximate memory cost per node (see FetchNodesStats::bytesPerNode)
+    long long bytespernode() const;
 
     // tracks how many nodes have had a successful applykey()
     long long mAppliedKeyNodeCount = 0;
@@ -1151,14 +1683,22 @@ public:
     // update transfer in the persistent cache
     void transfercacheadd(Transfer*, DBTableTransactionCommitter*);
 
+    // update transfer in the persistent cache with the next flush: the progress of every transfer is written
+    // at most once per TRANSFERCACHE_FLUSH_INTERVAL (ds), in one batch
+    void transfercachedirty(Transfer*);
+    void transfercacheflush(DBTableTransactionCommitter*);
+    static const dstime TRANSFERCACHE_FLUSH_INTERVAL = 20;
+    set<Transfer*> tcdirty;
+    dstime tcdirtyds = 0;
+
     // remove a transfer from the persistent cache
     void transfercachedel(Transfer*, DBTableTransactionCommitter* committer);
 
     // add a file to the persistent cache
     void filecacheadd(File*, DBTableTransactionCommitter& committer);
 
-    // remove a file from the persistent cache
-    void filecachedel(File*, DBTableTransactionCommitter* committer);
+    // remove a file from the persistent cache (or add its record to a batch, to be removed with DbTable::delBatch)
+    void filecachedel(File*, DBTableTransactionCommitter* committer, vector<uint32_t>* batch = nullptr);
 
 #ifdef ENABLE_CHAT
     textchat_map chatnotify;
@@ -1177,6 +1717,11 @@ public:
     void deltree(handle);
 
     Node* nodebyhandle(handle);
+
+    // the node if it is in memory, without paging it in or touching its access tick (safe from the
+    // worker pool while the client thread waits for it)
+    Node* residentnodebyhandle(handle) const;
+
     Node* nodebyfingerprint(FileFingerprint*);
     node_vector *nodesbyfingerprint(FileFingerprint* fingerprint);
     void nodesbyoriginalfingerprint(const char* fingerprint, Node* parent, node_vector *nv);
@@ -1217,6 +1762,13 @@ public:
 
     bool syncuprequired;
 
+    // syncdown() required, for the dirty subtrees only (with syncdirtysubtrees)
+    bool syncdowndirty = false;
+
+    // whether the current syncdown()/syncup() passes are full ones, or skip clean subtrees
+    bool syncdownfull = true;
+    bool syncupfull = true;
+
     // block local fs updates processing while locked ops are in progress
     bool syncfsopsfailed;
 
@@ -1232,6 +1784,10 @@ public:
     bool syncnagleretry;
     BackoffTimer syncnaglebt;
 
+    // synced files of at least this size keep a hash of their content, so that a new mtime with the same
+    // size and CRC is checked against the file's content before uploading it again (0: disabled)
+    m_off_t synccontenthashminsize = 0;
+
     // timer for extra notifications
     // (workaround for buggy network filesystems)
     bool syncextraretry;
@@ -1241,12 +1797,27 @@ public:
     bool syncscanfailed;
     BackoffTimer syncscanbt;
 
+    // poll the folders of network syncs instead of relying on their notifications (see Sync::pollfolders())
+    bool syncnetworkpoll = false;
+    BackoffTimer syncpollbt;
+
     // vanished from a local synced folder
     localnode_set localsyncnotseen;
 
+    // files that may turn up elsewhere, by size and mtime: vanished locally (to re-link their node when they
+    // reappear, for filesystems without stable fsids) or deleted remotely (to move them locally instead of
+    // downloading the node that replaces them).  Entries are checked when used, and go with their LocalNode
+    sizemtimelocalnode_map localsyncmovecandidates;
+
+    // a LocalNode of the sync matching the fingerprint, vanished locally (and synced) or deleted remotely
+    LocalNode* findmovedlocalnode(Sync*, const FileFingerprint&, bool remotelydeleted);
+
     // maps local fsid to corresponding LocalNode*
     handlelocalnode_map fsidnode;
 
+    // bumped whenever a LocalNode is renamed or moved, which invalidates the cached paths of the folders
+    uint64_t localpathgeneration = 1;
+
     // local nodes that need to be added remotely
     localnode_vector synccreate;
 
@@ -1276,6 +1847,9 @@ public:
     // start downloading/copy missing files, create missing directories
     bool syncdown(LocalNode*, string*, bool);
 
+    // whether a remote change to this node needs syncdown() before the next action packet
+    bool affectssync(Node*);
+
     // move nodes to //bin/SyncDebris/yyyy-mm-dd/ or unlink directly
     void movetosyncdebris(Node*, bool);
 
@@ -1310,6 +1884,9 @@ public:
     // transfer queue dispatch/retry handling
     void dispatchTransfers();
 
+    // let the transfers with a failed chunk retry it, once the network has worked again
+    void retryfailedchunks();
+
     void defer(direction_t, int td, int = 0);
     void freeq(direction_t);
 
@@ -1331,6 +1908,30 @@ public:
 
     // process object arrays by the API server
     int readnodes(JSON*, int, putsource_t = PUTNODES_APP, NewNode* = NULL, int = 0, int = 0, bool applykeys = false);
+    bool readnode(JSON*, int, putsource_t, NewNode*, int, int, bool applykeys, node_vector* dp);
+    bool readnodeinscope(handle, handle, nodetype_t, handle);
+    void setorphanparents(node_vector*);
+
+    // incremental parsing of the nodes array of an in-flight fetchnodes response
+    enum fnstream_t { FNSTREAM_OFF, FNSTREAM_PREFIX, FNSTREAM_NODES, FNSTREAM_DONE, FNSTREAM_FAILED };
+    fnstream_t fnstream = FNSTREAM_OFF;
+    JSONArrayScanner fnscanner;
+    node_vector fnorphans;
+    void procfetchnodesstream();
+    void finishfetchnodesstream();
+
+    // persistent server-client channel, used instead of the long poll while the API offers one ("ws" in
+    // sc responses): a JSON array of sc responses, one per batch of action packets, with 0 as keep-alive.
+    // Any error falls back to the long poll until the API offers it again
+    string scstreamurl;
+    unique_ptr<HttpReq> scstream;
+    JSONArrayScanner scstreamscanner;
+    bool scstreamopen = false;          // the '[' was received
+    std::deque<string> scstreambatches; // received, not yet processed
+    string scstreambatch;               // being processed by procsc()
+    void openscstream();
+    void procscstream();
+    void closescstream(bool fallback);
 
     void readok(JSON*);
     void readokelement(JSON*);
@@ -1382,6 +1983,24 @@ public:
     // max new nodes per request
     static const int MAX_NEWNODES = 2000;
 
+    // approximate size of a node record in a fetchnodes response (used to pre-size the node table)
+    static const int FETCHNODES_RECORD_SIZE = 200;
+
+    // parallel key application: minimum number of nodes per thread, and maximum number of threads
+    static const int KEYAPPLY_MINSHARD = 2000;
+    static const int KEYAPPLY_MAXTHREADS = 8;
+
+    // parallel RSA decryption of node keys: keys per thread and round, and how long the SDK thread
+    // is blocked on them per call to applyrsakeys() at most (beyond its first round)
+    static const int RSAKEY_SHARD = 32;
+    static const int RSAKEY_MAXBLOCKMS = 100;
+
+    // key payloads are split in commands of about this size (cr elements) or this many handles
+    // (key rewrites), so that sharing or fixing up a large tree neither sends one huge request nor
+    // stalls the batches around it
+    static const size_t KEYCR_MAXBYTES = 256 * 1024;
+    static const size_t KEYREWRITE_MAXHANDLES = 4096;
+
     // session ID length (binary)
     static const unsigned SIDLEN = 2 * SymmCipher::KEYLENGTH + USERHANDLE * 4 / 3 + 1;
 
@@ -1413,6 +2032,10 @@ public:
     // used during initialization to accumulate required updates to authring (to send them all atomically)
     AuthRingsMap mAuthRingsTemp;
 
+    // contacts that may still be untracked in each of mAuthRingsTemp, to tell when one is complete
+    // without walking all users on every key
+    std::map<attr_t, handle_set> mAuthRingsTempUntracked;
+
     // true while authrings are being fetched
     bool mFetchingAuthrings;
 
@@ -1434,6 +2057,30 @@ public:
     // apply keys
     void applykeys();
 
+    // decrypt the symmetric keys and attributes of many nodes on a pool of threads
+    void applykeysparallel(const node_vector&);
+
+    // import the attributes of all nodes not used yet (see Node::attrs()), on a pool of threads
+    // for large trees, ahead of walking all names
+    void importattrs();
+
+    // the authring to track a key or signature of the given type in: the temporal one while checking
+    // all contacts, otherwise a copy of the current one in aux (NULL if not available)
+    AuthRing* trackingauthring(attr_t authringType, std::unique_ptr<AuthRing>& aux, bool& temporal);
+
+    // whether all contacts are tracked in a temporal authring
+    bool authringtempcomplete(attr_t authringType, const AuthRing&);
+
+    // track a signature already checked by trackSignature() or verifysignatures()
+    error applysignature(attr_t signatureType, handle uh, const string& pubKey, bool signatureVerified);
+
+    // decrypt the RSA-wrapped keys of rsakeypending on a pool of threads, applying them in handle
+    // order, for up to RSAKEY_MAXBLOCKMS; exec() calls again for those left, notifying them if asked
+    void applyrsakeys(bool notify);
+
+    // nodes whose RSA-wrapped keys wait for applyrsakeys()
+    handle_set rsakeypending;
+
     // send andy key rewrites prepared when keys were applied
     void sendkeyrewrites();
 
@@ -1484,9 +2131,12 @@ public:
     //returns true if the node referenced by the handle belongs to other account than the logged-in account
     bool isForeignNode(handle h);
 
-    // process node subtree
+    // process node subtree, children before their parent - on several threads for processors
+    // that fork (see TreeProc::fork), once the subtree is large enough
     void proctree(Node*, TreeProc*, bool skipinshares = false, bool skipversions = false);
 
+    static const size_t PROCTREE_MINSHARD = 16384;
+
     // hash password
     error pw_key(const char*, byte*) const;
 
@@ -1497,6 +2147,20 @@ public:
     SymmCipher tmpnodecipher;
     SymmCipher tmptransfercipher;
 
+    // the ciphers of the node keys used last (see Node::nodecipher()), as nodes tend to be
+    // decrypted again soon: attributes, then thumbnails and previews
+    SymmCipherCache nodeciphers;
+
+    // worker threads for transfer crypto, see settransfercryptothreads()
+    std::unique_ptr<TransferCryptoPool> transferCryptoPool;
+
+    // download buffers, recycled between chunks, transfers and streaming.  Shared with the buffers that are still out
+    std::shared_ptr<BufferPool> bufferpool;
+
+    // idle bytes the buffer pool keeps at most (64 MB by default).  0 disables it
+    void setbufferpoollimit(size_t bytes);
+    size_t bufferpoollimit = 64 << 20;
+
     void exportDatabase(string filename);
     bool compareDatabases(string filename1, string filename2);
 
@@ -1593,14 +2257,91 @@ public:
         CodeCounter::ScopeStats dispatchTransfers = { "dispatchTransfers" };
         CodeCounter::ScopeStats csResponseProcessingTime = { "cs batch response processing" };
         CodeCounter::ScopeStats scProcessingTime = { "sc processing" };
+        CodeCounter::ScopeStats dbCommit = { "state cache commit" };
         uint64_t transferStarts = 0, transferFinishes = 0;
         uint64_t transferTempErrors = 0, transferFails = 0;
         uint64_t prepwaitImmediate = 0, prepwaitZero = 0, prepwaitHttpio = 0, prepwaitFsaccess = 0, nonzeroWait = 0;
         CodeCounter::DurationSum csRequestWaitTime;
+        CodeCounter::DurationSum scBatchTime;
+        uint64_t scBatches = 0, scPackets = 0, scSyncdownYields = 0;
+        // from the API signalling action packets (wait request returning, or batch streamed) to the batch being applied
+        CodeCounter::DurationSum scPropagationTime;
+        uint64_t scPropagations = 0, scStreamedBatches = 0;
         CodeCounter::DurationSum transfersActiveTime;
-        std::string report(bool reset, HttpIO* httpio, Waiter* waiter, const RequestDispatcher& reqs);
+        // filesystem notification buffer overflows, and how they were recovered: from the change journal or by a full rescan
+        uint64_t syncNotifyOverflows = 0, syncOverflowJournalRecoveries = 0, syncOverflowRescans = 0;
+        std::string report(bool reset, HttpIO* httpio, Waiter* waiter, const RequestDispatcher& reqs, const BufferPool& bufferpool);
+
+        // the same as name/value pairs: <scope>.count, <scope>.ms, <scope>.p50us, <scope>.p99us for the timed
+        // scopes (named in snake case), and the counters and durations (ms) above
+        void snapshot(std::map<string, int64_t>& values, HttpIO* httpio, const RequestDispatcher& reqs, const BufferPool& bufferpool);
+        void reset(HttpIO* httpio);
+
+        // the timed scopes above and those of the HttpIO, and their names in snake case
+        vector<CodeCounter::ScopeStats*> scopes(HttpIO* httpio);
+        static string scopename(const CodeCounter::ScopeStats&);
     } performanceStats;
 
+    // Opt-in stall detector: times the phases of each exec() iteration, logs those taking longer
+    // than the threshold with their breakdown, and keeps the slowest of them.
+    // The time spent in a nested phase isn't counted in the enclosing one.
+    struct ExecTracer
+    {
+        typedef std::chrono::high_resolution_clock clock;
+        enum phase_t { OTHER, CS, SC, DISPATCH, DOIO, SYNCDOWN, SYNCUP, DIRECTREADS, DBCOMMIT, NUMPHASES };
+        static const char* phasename(int);
+
+        static const size_t SLOWEST = 10;
+
+        struct Iteration
+        {
+            m_time_t when = 0;
+            clock::duration total{};
+            clock::duration phases[NUMPHASES] = {};
+
+            // "<total> ms: <phase> <ms> ms, ..." for the phases that took 1 ms or more, longest first
+            string report() const;
+        };
+
+        // in milliseconds, 0 (the default) disables the tracer; it can be changed from any thread
+        void setthreshold(unsigned ms);
+        unsigned getthreshold() const;
+
+        // the slowest iterations over the threshold, slowest first
+        const vector<Iteration>& slowest() const;
+        void clear();
+
+        // brackets an iteration
+        struct Cycle
+        {
+            ExecTracer& tracer;
+            Cycle(ExecTracer& t) : tracer(t) { tracer.begin(); }
+            ~Cycle() { tracer.end(); }
+        };
+
+        // brackets a phase, if an iteration is being traced
+        struct Phase
+        {
+            ExecTracer* tracer;
+            phase_t previous = OTHER;
+            Phase(ExecTracer& t, phase_t p) : tracer(t.tracing ? &t : nullptr) { if (tracer) previous = tracer->enter(p); }
+            ~Phase() { if (tracer) tracer->enter(previous); }
+        };
+
+        void begin();
+        void end();
+
+    private:
+        std::atomic<unsigned> thresholdms{ 0 };
+        bool tracing = false;
+        phase_t current = OTHER;
+        clock::time_point start, mark;
+        Iteration iteration;
+        vector<Iteration> slowestiterations;
+
+        phase_t enter(phase_t);
+    } execTracer;
+
 #ifdef ENABLE_SYNC
     void resetSyncConfigs();
 #endif
@@ -28,6 +28,10 @@
 #include "attrmap.h"
 
 namespace mega {
+
+// enumerates a node's children (list entries are pooled, as there is one per node)
+typedef list<Node*, PoolAllocator<Node*>> node_list;
+
 struct MEGA_API NodeCore
 {
     // node's own handle
@@ -64,6 +68,12 @@ struct MEGA_API NewNode : public NodeCore
     std::unique_ptr<string> fileattributes;
 
     bool added = false;
+
+    // handle of the node created from this one
+    handle addedhandle = UNDEF;
+
+    // take over the contents of another (one that is not linked to a LocalNode)
+    void take(NewNode& other);
 };
 
 struct MEGA_API PublicLink
@@ -79,11 +89,11 @@ struct MEGA_API PublicLink
     bool isExpired();
 };
 
-// Container storing FileFingerprint* (Node* in practice) ordered by fingerprint.
+// Container storing FileFingerprint* (Node* in practice) hashed by fingerprint.
 struct Fingerprints
 {
     // maps FileFingerprints to node
-    using fingerprint_set = std::multiset<FileFingerprint*, FileFingerprintCmp>;
+    using fingerprint_set = std::unordered_multiset<FileFingerprint*, FileFingerprintHash, FileFingerprintEqual>;
     using iterator = fingerprint_set::iterator;
 
     void newnode(Node* n);
@@ -127,7 +137,28 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
     // try to resolve node key string
     bool applykey();
 
-    // set up nodekey in a static SymmCipher
+    // per-thread state for applysymmetrickey()
+    struct KeyApplyContext
+    {
+        handle me = UNDEF;
+        SymmCipher master;
+        SymmCipher share;
+        const SymmCipher* sharesource = nullptr;
+        SymmCipher node;
+    };
+
+    // thread-safe subset of applykey() for the parallel phase of MegaClient::applykeys(): unwraps a
+    // symmetric key and decrypts the attributes using only the context's ciphers, leaving the client untouched
+    // (the caller accounts for the applied key and calls setfingerprint() if attrsdecrypted)
+    // RSA-wrapped keys and keys that are not available yet are left for applykey()
+    bool applysymmetrickey(KeyApplyContext&, bool& attrsdecrypted);
+
+    // whether the key applykey() would use is RSA-wrapped, and its ciphertext (if asked for), which
+    // MegaClient::applyrsakeys() decrypts off the SDK thread and completes with applyrsakey()
+    bool rsawrappedkey(string* ciphertext = nullptr);
+    void applyrsakey(const byte* key);
+
+    // a cipher for the node key, from the client's cache (valid until SymmCipherCache::SIZE other keys are used)
     SymmCipher* nodecipher();
 
     // decrypt attribute string and set fileattrs
@@ -139,8 +170,15 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
     // display path from its root in the cloud (UTF-8)
     string displaypath() const;
 
-    // node attributes
-    AttrMap attrs;
+    // node attributes, imported on first use (see pendingattrs)
+    AttrMap& attrs();
+    const AttrMap& attrs() const;
+
+    // an attribute's value, without importing the attributes
+    bool getattr(nameid, string*) const;
+
+    // whether the attributes have not been imported yet
+    bool attrspending() const;
 
     // owner
     handle owner = mega::UNDEF;
@@ -148,6 +186,9 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
     // actual time this node was created (cannot be set by user)
     m_time_t ctime = 0;
 
+    // files: updates ctime and the position in MegaClient::filesbyctime
+    void setctime(m_time_t);
+
     // file attributes
     string fileattrstring;
 
@@ -201,8 +242,16 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
 
     void faspec(string*);
 
+    // counters of the node and everything below it, in O(1)
     NodeCounter subnodeCounts() const;
 
+    // the part of them below the node, set aside while it is paged out with versions that stay paged out
+    NodeCounter descendantcounts() const;
+    void restoredescendantcounts(const NodeCounter&);
+
+    // change the size of a file, along with the counters that include it
+    void setsize(m_off_t);
+
     // parent
     Node* parent = nullptr;
 
@@ -212,8 +261,17 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
     // own position in parent's children
     node_list::iterator child_it;
 
-    // own position in fingerprint set (only valid for file nodes)
-    Fingerprints::iterator fingerprint_it;
+    // files: own position in MegaClient::filesbyctime
+    node_ctime_map::iterator ctime_it;
+
+    // changes whenever a child is added, removed or notified, so that views of the children
+    // sorted elsewhere can tell they are stale (see MegaApiImpl::getSortedChildren)
+    uint64_t childrenseq;
+    void childrenchanged();
+
+    // whether the node is in the fingerprint set (only file nodes are). Not an iterator:
+    // those of a hashed container don't survive rehashing
+    bool infingerprints = false;
 
 #ifdef ENABLE_SYNC
     // related synced item or NULL
@@ -236,6 +294,9 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
     // source tag
     int tag = 0;
 
+    // when the node was last looked up by handle, in MegaClient::nodeaccesstick units (low-memory mode)
+    uint32_t lastaccess = 0;
+
     // check if node is below this node
     bool isbelow(Node*) const;
 
@@ -246,11 +307,41 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
 
     bool serialize(string*) override;
     static Node* unserialize(MegaClient*, const string*, node_vector*);
+    static Node* unserialize(MegaClient*, const char*, size_t, node_vector*);
 
     Node(MegaClient*, vector<Node*>*, handle, handle, nodetype_t, m_off_t, handle, const char*, m_time_t);
     ~Node();
 
+    // Node objects are allocated from a slab pool
+    static void* operator new(size_t);
+    static void operator delete(void*, size_t);
+
+    // approximate bytes held by node storage pools (nodes, children entries, attributes), and the
+    // number of Node objects they serve - both process-wide, for all MegaClient instances
+    static size_t poolBytes();
+    static size_t pooledNodes();
+
 private:
+    // locate the encrypted node key and the cipher that unwraps it - NULL if it isn't available yet
+    // resident: share nodes are only looked up in memory, leaving the client untouched
+    const char* wrappedkey(handle me, SymmCipher*&, bool resident = false);
+
+    // decrypt attrstring with the node key loaded in the cipher into pendingattrs
+    bool decryptattrs(SymmCipher*);
+
+    // Most nodes' attributes are never looked at: once decrypted (or loaded from the state cache),
+    // they are kept as a raw binary serialize (see AttrMap::serialize()) until attrs() imports them
+    // into the map, normalizing the name as it goes
+    mutable AttrMap attrmap;
+    mutable std::unique_ptr<string> pendingattrs;
+    void importattrs() const;
+
+    // kept up to date by setparent(), setsize() and the destructor, and propagated to all ancestors
+    NodeCounter subtreecounts;
+
+    // what the node itself adds to the counters, which depends on its parent for versions
+    NodeCounter selfcounts() const;
+
     // full folder/file key, symmetrically or asymmetrically encrypted
     // node crypto keys (raw or cooked -
     // cooked if size() == FOLDERNODEKEYLENGTH or FILEFOLDERNODEKEYLENGTH)
@@ -285,6 +376,9 @@ struct MEGA_API LocalNode : public File
     // stored to rebuild tree after serialization => this must not be a pointer to parent->dbid
     int32_t parent_dbid = 0;
 
+    // hash of the record last written to the state cache, so that unchanged nodes are not rewritten
+    size_t statecachehash = 0;
+
     // whether this node can be synced to the remote tree
     bool mSyncable = true;
 
@@ -295,6 +389,14 @@ struct MEGA_API LocalNode : public File
     string* slocalname = nullptr;
     localnode_map schildren;
 
+    // large folders also index their children by the hashes of their names and short names, so that lookups
+    // don't string-compare their way down the maps.  Built once children reaches CHILDINDEX_THRESHOLD
+    size_t namehash = 0;
+    unique_ptr<localnodehash_map> childindex;
+    static const size_t CHILDINDEX_THRESHOLD = 256;
+    void indexchild(LocalNode*);
+    void unindexchild(LocalNode*);
+
     // local filesystem node ID (inode...) for rename/move detection
     handle fsid = mega::UNDEF;
     handlelocalnode_map::iterator fsid_it{};
@@ -330,6 +432,9 @@ struct MEGA_API LocalNode : public File
 
         // checked for missing attributes
         bool checked : 1;
+
+        // queued for a move to the local debris (see SyncDebrisQueue)
+        bool debrispending : 1;
     };
 
     // current subtree sync state: current and displayed
@@ -342,16 +447,56 @@ struct MEGA_API LocalNode : public File
     // check the current state (only useful for folders)
     treestate_t checkstate();
 
-    // timer to delay upload start
+    // timer to delay upload start, pushed back by each change.  Changes that keep coming have it follow
+    // their average interval (changeintervalds), from the first one not uploaded yet (nagleinitialds)
     dstime nagleds = 0;
+    dstime lastchangeds = 0;
+    dstime changeintervalds = 0;
+    dstime nagleinitialds = 0;
     void bumpnagleds();
 
+    // the platform reported that a writer closed the file: files that aren't rewritten over and over go
+    // as soon as they are stable
+    void closewritten();
+
+    // whether syncdown()/syncup() have to look at this subtree, cleared by them when they do
+    bool syncdowndirty = true;
+    bool syncupdirty = true;
+
+    // flag this node and its ancestors for both
+    void setsyncdirty();
+
+    // folder polling (see Sync::pollfolders()): the mtime last seen (0: not yet, -1: to be rescanned
+    // regardless), when to look again and the current interval
+    m_time_t pollmtime = 0;
+    dstime pollds = 0;
+    dstime pollintervalds = 0;
+
+    // timestamp of the last filesystem notification that led to this file, until its upload is committed
+    dstime notifiedds = 0;
+
+    // SHA-256 of the whole file when it was last in sync, or empty (see MegaClient::synccontenthashminsize)
+    string contenthash;
+
+    // hash the current content of the file. False if it can't be read, or its size doesn't match
+    bool gencontenthash(string*) const;
+
     // if delage > 0, own iterator inside MegaClient::localsyncnotseen
     localnode_set::iterator notseen_it{};
 
+    // own iterator inside MegaClient::localsyncmovecandidates, if there (files only)
+    bool movecandidate = false;
+    sizemtimelocalnode_map::iterator movecandidate_it{};
+    void setmovecandidate(bool);
+
     // build full local path to this node
     void getlocalpath(string*, bool sdisable = false, const std::string* localseparator = nullptr) const;
     void getlocalsubpath(string*) const;
+
+    // full local path of a folder (with short names), rebuilt from the parent's only after a rename or move
+    const string& folderpath() const;
+    mutable string cachedpath;
+    mutable uint64_t cachedpathgeneration = 0;
     string localnodedisplaypath(FileSystemAccess& fsa) const;
 
     // return child node by name
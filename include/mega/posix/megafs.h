@@ -38,11 +38,41 @@
 #include <aio.h>
 #endif
 
+// macOS syncs are watched with an FSEventStream each, unless a /dev/fsevents fd is passed to PosixFileSystemAccess
+#if defined(__APPLE__) && !(TARGET_OS_IPHONE) && defined(ENABLE_SYNC)
+#define USE_FSEVENTS
+#include <CoreServices/CoreServices.h>
+#include <dispatch/dispatch.h>
+#endif
+
+// io_uring operations use the aio context, and fall back to aio when the kernel refuses io_uring
+#if defined(USE_IO_URING) && !defined(HAVE_AIO_RT)
+#undef USE_IO_URING
+#endif
+
+#ifdef USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#endif
+
+// fanotify marks cover whole filesystems, and inotify watches the folders where they can't be placed
+#if defined(USE_FANOTIFY) && !defined(USE_INOTIFY)
+#undef USE_FANOTIFY
+#endif
+
+#ifdef USE_FANOTIFY
+#include <sys/fanotify.h>
+#endif
+
 #include "mega.h"
 
 #define DEBRISFOLDER ".debris"
 
 namespace mega {
+#ifdef USE_IO_URING
+class PosixIoUring;
+#endif
+
 struct MEGA_API PosixDirAccess : public DirAccess
 {
     DIR* dp;
@@ -52,9 +82,13 @@ struct MEGA_API PosixDirAccess : public DirAccess
 
     bool dopen(string*, FileAccess*, bool);
     bool dnext(string*, string*, bool, nodetype_t*);
+    bool dnextstat(string*, DirEntry*, bool) override;
 
     PosixDirAccess();
     virtual ~PosixDirAccess();
+
+private:
+    bool readentry(string*, string*, bool, struct stat*, bool*);
 };
 
 class MEGA_API PosixFileSystemAccess : public FileSystemAccess
@@ -72,10 +106,33 @@ public:
     string lastname;
 #endif
 
+#ifdef USE_FANOTIFY
+    // one FAN_MARK_FILESYSTEM mark per filesystem (fsid), with the events matched to the folders' LocalNodes by
+    // file handle, -1 unless enabled with setfswidenotify()
+    int fanotifyfd;
+    set<string> fanotifymarks;
+    set<string> fanotifyunmarkable;
+
+    typedef map<string, LocalNode*> fhlocalnode_map;
+    fhlocalnode_map fhnodes;
+    map<LocalNode*, string> nodefhs;
+
+    // fsid + handle type + handle of a folder as it comes in the events
+    static bool fanotifykey(const string* path, string* fsid, string* key);
+#endif
+
 #ifdef USE_IOS
     static char *appbasepath;
 #endif
 
+#ifdef USE_FSEVENTS
+    // the syncs' streams, whose events checkevents() queues.  The latency lets FSEvents coalesce bursts of
+    // changes, it applies to the syncs added from now on
+    set<PosixDirNotify*> fseventnotifys;
+    static constexpr CFTimeInterval FSEVENTS_LATENCY = 0.1;
+    CFTimeInterval fseventslatency;
+#endif
+
     bool notifyerr;
     int defaultfilepermissions;
     int defaultfolderpermissions;
@@ -106,6 +163,14 @@ public:
     void addevents(Waiter*, int) override;
     int checkevents(Waiter*) override;
 
+    bool setfswidenotify(bool) override;
+    size_t notifywatches() const override;
+
+#ifdef USE_IO_URING
+    // shared with the file accesses created here, NULL if aio is in use
+    std::shared_ptr<PosixIoUring> iouring;
+#endif
+
     void osversion(string*) const override;
     void statsid(string*) const override;
 
@@ -120,6 +185,74 @@ public:
     ~PosixFileSystemAccess();
 };
 
+#ifdef USE_IO_URING
+struct PosixAsyncIOContext;
+
+// An io_uring for the async reads and writes of one PosixFileSystemAccess, instead of aio's helper thread per operation.
+// Operations are queued as they start and handed to the kernel in one batch before the waiter sleeps (addevents()).
+// The ring's fd wakes the waiter when operations complete, and checkevents() reaps them.
+class MEGA_API PosixIoUring
+{
+public:
+    // NULL if the kernel (or a seccomp policy) does not allow io_uring
+    static std::shared_ptr<PosixIoUring> create(unsigned entries = 128);
+    ~PosixIoUring();
+
+    int fd() const;
+
+    // false if the ring is full: use aio for this one
+    bool queue(PosixAsyncIOContext* context, int filefd);
+
+    // hand the queued operations to the kernel
+    void submit();
+
+    // complete the finished operations, returns how many
+    int reap();
+
+    // block until the context has finished
+    void wait(PosixAsyncIOContext* context);
+
+private:
+    PosixIoUring();
+
+    int ringfd;
+
+    void* sqring;
+    size_t sqringsize;
+    void* cqring;
+    size_t cqringsize;
+    io_uring_sqe* sqes;
+    size_t sqessize;
+
+    unsigned* sqhead;
+    unsigned* sqtail;
+    unsigned* sqarray;
+    unsigned sqmask;
+    unsigned sqentries;
+
+    unsigned* cqhead;
+    unsigned* cqtail;
+    io_uring_cqe* cqes;
+    unsigned cqmask;
+    unsigned cqentries;
+
+    // filled in but not submitted yet / submitted and not reaped yet
+    unsigned queued;
+    unsigned inflight;
+
+    // set when waiting failed: new operations use aio or plain reads and writes instead
+    bool broken;
+
+    std::mutex mutex;
+
+    bool queueLocked(PosixAsyncIOContext* context);
+    void submitLocked();
+
+    // make sure the kernel no longer uses the context, which is then finished (failed if it didn't complete)
+    void abandon(PosixAsyncIOContext* context);
+};
+#endif
+
 #ifdef HAVE_AIO_RT
 struct MEGA_API PosixAsyncIOContext : public AsyncIOContext
 {
@@ -128,6 +261,15 @@ struct MEGA_API PosixAsyncIOContext : public AsyncIOContext
     virtual void finish();
 
     struct aiocb *aiocb;
+
+#ifdef USE_IO_URING
+    // set while the operation runs on an io_uring rather than aio
+    std::shared_ptr<PosixIoUring> iouring;
+    int filefd;
+
+    // the part of the buffer still to transfer, advanced after short reads and writes
+    struct iovec iov;
+#endif
 };
 #endif
 
@@ -147,6 +289,8 @@ public:
     void updatelocalname(string*);
     bool fread(string *, unsigned, unsigned, m_off_t);
     bool fwrite(const byte *, unsigned, m_off_t);
+    bool fpreallocate(m_off_t) override;
+    void freadahead(m_off_t pos, m_off_t len) override;
 
     bool sysread(byte *, unsigned, m_off_t);
     bool sysstat(m_time_t*, m_off_t*);
@@ -163,6 +307,14 @@ public:
 
     ~PosixFileAccess();
 
+#ifdef USE_IO_URING
+    std::shared_ptr<PosixIoUring> iouring;
+
+protected:
+    // all in flight on the io_uring at once
+    bool sysreadbatch(const vector<RawRead>&) override;
+#endif
+
 #ifdef HAVE_AIO_RT
 protected:
     virtual AsyncIOContext* newasynccontext();
@@ -185,6 +337,31 @@ public:
     fsfp_t fsfingerprint() const override;
     bool fsstableids() const override;
 
+#ifdef USE_FSEVENTS
+    // file-level events under the sync root, from FSEvents' dispatch queue to the SDK thread through pending
+    FSEventStreamRef stream;
+    dispatch_queue_t queue;
+    string streampath;
+
+    std::mutex pendingmutex;
+    vector<pair<string, FSEventStreamEventFlags>> pending;
+    FSEventStreamEventId lastid;
+    FSEventStreamEventId lostsince;
+
+    void startstream();
+    void stopstream();
+
+    // on the SDK thread: queue the pending events, returns whether there were any
+    bool procevents();
+
+    // FSEvents' event ids, with the UUID of the volume's event database, which changes when its history is lost
+    bool journalcursor(string*) override;
+    bool journalchanges(const string&, const journalchange_callback&) override;
+    bool cursorprefix(string*) const;
+
+    ~PosixDirNotify();
+#endif
+
     PosixDirNotify(string*, string*);
 };
 } // namespace
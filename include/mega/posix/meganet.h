@@ -83,6 +83,8 @@ protected:
     string useragent;
     CURLM* curlm[3];
 
+    // the DNS and TLS session caches of every instance in the process, so that each MegaClient
+    // resumes the TLS sessions of the others instead of a full handshake per server and client
     CURLSH* curlsh;
     ares_channel ares;
     string proxyurl;
@@ -150,6 +152,9 @@ protected:
     void filterDNSservers();
 
     bool curlipv6;
+    bool curlhttp2;
+    bool http2;
+    void setmultiplexing();
     bool reset;
     bool statechange;
     bool dnsok;
@@ -172,7 +177,6 @@ protected:
     bool arerequestspaused[3];
     int numconnections[3];
     set<CURL *>pausedrequests[3];
-    m_off_t partialdata[2];
     m_off_t maxspeed[2];
     bool curlsocketsprocessed;
     m_time_t arestimeout;
@@ -186,6 +190,9 @@ public:
     bool doio(void);
     bool multidoio(CURLM *curlmhandle);
 
+    // responses are appended with HttpReq::put()
+    bool incrementalinput() const override { return true; }
+
     void addevents(Waiter*, int);
 
     void setuseragent(string*);
@@ -205,17 +212,52 @@ public:
     // get max upload speed
     virtual m_off_t getmaxuploadspeed();
 
+    // HTTP/2 with multiplexing, if cURL was built with it
+    bool sethttp2(bool enable) override;
+    bool multiplexes() const override;
+
+    // through the shared session cache, with cURL 8.12.0 or later
+    void exportsslsessions(string* data) override;
+    void importsslsessions(const string& data) override;
+
+    void exportdnscache(string* data) override;
+    void importdnscache(const string& data) override;
+
+    // the connection cache of instances that one thread drives (SharedEventLoops), with their DNS and TLS session
+    // caches.  libcurl doesn't support connections shared by threads that use them at the same time
+    struct ConnectionShare
+    {
+        CURLSH* sh;
+        std::mutex mutexes[CURL_LOCK_DATA_LAST];
+
+        ConnectionShare();
+        ~ConnectionShare();
+        MEGA_DISABLE_COPY_MOVE(ConnectionShare)
+    };
+
+    // use the cache of a thread's instances instead of the process-wide one, which has no connections.
+    // Only before the first request
+    void setconnectionshare(std::shared_ptr<ConnectionShare>);
+
     CurlHttpIO();
     ~CurlHttpIO();
 
-private:
-    static int instanceCount;
-
+    // reported with MegaClient::performanceStats
     CodeCounter::ScopeStats countCurlHttpIOAddevents = { "curl-httpio-addevents" };
     CodeCounter::ScopeStats countAddAresEventsCode = { "ares-add-events" };
     CodeCounter::ScopeStats countAddCurlEventsCode = { "curl-add-events" };
     CodeCounter::ScopeStats countProcessAresEventsCode = { "ares-process-events" };
     CodeCounter::ScopeStats countProcessCurlEventsCode = { "curl-process-events" };
+
+private:
+    static int instanceCount;
+
+    static CURLSH* sharedcurlsh;
+    static std::mutex sharemutexes[CURL_LOCK_DATA_LAST];
+    static void sharelock(CURL*, curl_lock_data, curl_lock_access, void*);
+    static void shareunlock(CURL*, curl_lock_data, void*);
+
+    std::shared_ptr<ConnectionShare> connectionshare;
 };
 
 struct MEGA_API CurlHttpContext
@@ -238,6 +280,11 @@ struct MEGA_API CurlHttpContext
     unsigned len;
     const char* data;
     int ares_pending;
+
+    // cached IPv4 address that cURL races with the IPv6 one (hostip), through resolve
+    string racingipv4;
+    struct curl_slist* resolve = nullptr;
+    ~CurlHttpContext();
 };
 
 struct MEGA_API CurlDNSEntry
@@ -252,6 +299,9 @@ struct MEGA_API CurlDNSEntry
     dstime ipv6timestamp;
 
     bool mNeedsResolvingAgain = false;
+
+    // time of the last resolution, to expire the entry after a restart
+    m_time_t resolvedat = 0;
 };
 
 } // namespace
@@ -44,6 +44,8 @@
 #include <sstream>
 #include <fstream>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <deque>
 #include <set>
 #include <iterator>
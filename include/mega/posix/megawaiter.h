@@ -24,22 +24,41 @@
 
 #include "mega/waiter.h"
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace mega {
+// Waits on file descriptors with epoll (Linux) or kqueue (BSD, macOS), falling back to poll() elsewhere.
+// Callers watch their fds every loop between init() and wait(), as they would fill fd_sets for select(), but the
+// kernel registrations persist across loops and are only updated for fds whose interest changed.
 struct PosixWaiter : public Waiter
 {
     PosixWaiter();
     ~PosixWaiter();
 
-    int maxfd;
-    fd_set rfds, wfds, efds;
-    fd_set ignorefds;
+    enum { WATCH_READ = 1, WATCH_WRITE = 2, WATCH_IGNORED = 4 };
 
-    bool fd_filter(int nfds, fd_set* fds, fd_set* ignorefds) const;
+    // wait on fd in the next wait().  A WATCH_IGNORED fd wakes wait() without requesting exec()
+    void watchfd(int fd, int what);
+
+    // the fd is being (or has been) closed, so the number may be reused for a different file.
+    // Must be called before a closed number is watched again, or the new file is not waited on
+    void forgetfd(int fd);
+
+    // after wait(), whether fd is readable/writable.  Level-triggered like select(): it stays ready until drained
+    bool isready(int fd, int what) const;
 
     void init(dstime);
     int wait();
-    void bumpmaxfd(int);
+
+    // wait() in two halves, for a caller that waits on many waiters at once (SharedEventLoops): arm() updates the
+    // registrations and returns how long wait() would wait in ms (-1: no timeout), and collect() waits up to that
+    // (0 once eventfd() has been seen readable or the time is up), and returns what wait() would have
+    int arm();
+    int collect(int timeoutms);
+
+    // readable whenever wait() would return before its timeout.  -1 with poll(), which has no such descriptor
+    int eventfd() const;
 
     void notify();
 
@@ -47,6 +66,30 @@ protected:
     int m_pipe[2];
     std::mutex mMutex;
     bool alreadyNotified = false;
+
+private:
+    struct WatchedFd
+    {
+        int want = 0;
+        int registered = 0;
+        int ready = 0;
+        unsigned loop = 0;
+
+        // forgetfd() was called: drop the registration before making a new one
+        bool stale = false;
+
+        // regular files can't be waited on, and always count as ready (as with select())
+        bool always = false;
+    };
+
+    std::unordered_map<int, WatchedFd> fds;
+    unsigned loop = 0;
+
+    // epoll or kqueue descriptor, -1 with poll()
+    int pollfd;
+
+    void updateregistration(int fd, WatchedFd& w);
+    int waitevents(int timeoutms, bool& triggered);
 };
 } // namespace
 
@@ -22,6 +22,10 @@
 #ifndef MEGA_RAID_H
 #define MEGA_RAID_H 1
 
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+
 #include "http.h"
 #include "utils.h"
 
@@ -48,7 +52,7 @@ namespace mega {
             chunkmac_map chunkmacs;
 
             FilePiece();
-            FilePiece(m_off_t p, size_t len);    // makes a buffer of the specified size (with extra space for SymmCipher::ctr_crypt padding)
+            FilePiece(m_off_t p, size_t len, const std::shared_ptr<BufferPool>& pool = nullptr);    // makes a buffer of the specified size (with extra space for SymmCipher::ctr_crypt padding), from the pool if given
             FilePiece(m_off_t p, HttpReq::http_buf_t* b); // takes ownership of the buffer
             void swap(FilePiece& other);
         };
@@ -71,6 +75,9 @@ namespace mega {
         // indicate that the buffer written by asyncIO (or synchronously) can now be discarded.
         void bufferWriteCompleted(unsigned connectionNum, bool succeeded);
 
+        // true while the output for the connection is still being decrypted off the client thread.  getAsyncOutputBufferPointer() returns NULL meanwhile
+        virtual bool outputPending(unsigned connectionNum);
+
         // temp URL to use on a given connection.  The same on all connections for a non-raid file.
         const std::string& tempURL(unsigned connectionNum);
 
@@ -92,6 +99,9 @@ namespace mega {
         // calculate the exact size of each of the 6 parts of a raid file.  Some may not have a full last sector
         static m_off_t raidPartSize(unsigned part, m_off_t fullfilesize);
 
+        // interleave `lines` raid lines of the data parts (1..5) into dest, starting at `offset` in each part.  A missing (NULL) data part is rebuilt from the parity (part 0) and the others
+        static void combineRaidLines(byte* dest, byte* const inputbufs[RAIDPARTS], size_t offset, size_t lines);
+
         // report a failed connection.  The function tries to switch to 5 connection raid or a different 5 connections.  Two fails without progress and we should fail the transfer as usual
         bool tryRaidHttpGetErrorRecovery(unsigned errorConnectionNum);
 
@@ -104,9 +114,26 @@ namespace mega {
         // returns how far we are through the file on average, including uncombined data
         m_off_t progress() const;
 
+        // the raid part not being downloaded (RAIDPARTS if all six are)
+        unsigned unusedRaidPart() const;
+
+        // download from the other five parts from the start (before any request)
+        void setUnusedRaidPart(unsigned part);
+
         RaidBufferManager();
         ~RaidBufferManager();
 
+        // the pieces made here take their buffers from this pool, if set
+        std::shared_ptr<BufferPool> bufferpool;
+
+    protected:
+
+        // finalize the piece and make it the output for the connection.  Transfers may finalize it on the crypto pool instead
+        virtual void finalizeOutput(unsigned connectionNum, FilePiece* piece);
+
+        // the piece (finalized already) is the connection's output now
+        void setAsyncOutputBuffer(unsigned connectionNum, FilePiece* piece);
+
     private:
 
         // parameters to control raid download
@@ -166,7 +193,6 @@ namespace mega {
         // take raid input part buffers and combine to form the asyncoutputbuffers
         void combineRaidParts(unsigned connectionNum);
         FilePiece* combineRaidParts(size_t partslen, size_t bufflen, m_off_t filepos, FilePiece& prevleftoverchunk);
-        void recoverSectorFromParity(byte* dest, byte* inputbufs[], unsigned offset);
         void combineLastRaidLine(byte* dest, size_t nbytes);
         void rollInputBuffers(size_t dataToDiscard);
         virtual void bufferWriteCompletedAction(FilePiece& r);
@@ -180,6 +206,68 @@ namespace mega {
     };
 
 
+    // Runs the decryption and macing of downloaded pieces, and the encryption and macing of upload chunks, on worker threads,
+    // so the client thread only combines, writes and sends them.
+    // Jobs of the same owner (a transfer) run one at a time in submission order, and the data held by submitted jobs
+    // that have not finished yet is capped at maxInFlightBytes.
+    class MEGA_API TransferCryptoPool
+    {
+    public:
+        struct Job
+        {
+            virtual ~Job() = default;
+
+            // called on a worker thread, with that worker's cipher
+            virtual void run(SymmCipher& cipher) = 0;
+
+            size_t bytes = 0;
+            bool submitted = false;
+            std::atomic<bool> done{false};
+        };
+
+        TransferCryptoPool(unsigned threads, size_t maxInFlightBytes, Waiter* waiter);
+
+        // runs any jobs still queued before returning
+        ~TransferCryptoPool();
+
+        // number of worker threads actually started
+        unsigned threads() const;
+
+        // queue the job behind the owner's earlier ones.  False if it would go over the in-flight budget: submit it again once other jobs finish
+        bool submit(const void* owner, std::shared_ptr<Job> job);
+
+        // drop the owner's jobs that have not started yet.  One that is running completes on its own
+        void cancel(const void* owner);
+
+        // block until a submitted job has run
+        void wait(const Job& job);
+
+    private:
+        struct OwnerQueue
+        {
+            std::deque<std::shared_ptr<Job>> jobs;
+            bool running = false;
+        };
+
+        std::map<const void*, OwnerQueue> queues;
+
+        // owners with queued jobs and none running
+        std::deque<const void*> ready;
+
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable workAvailable;
+        std::condition_variable jobFinished;
+        size_t inFlightBytes = 0;
+        size_t maxInFlightBytes;
+        bool stopping = false;
+
+        // woken when a job finishes, so the client picks up the result
+        Waiter* waiter;
+
+        void workerLoop();
+    };
+
     class MEGA_API TransferBufferManager : public RaidBufferManager
     {
     public:
@@ -192,14 +280,95 @@ namespace mega {
         // Get the file position to upload/download to on the specified connection
         std::pair<m_off_t, m_off_t> nextNPosForConnection(unsigned connectionNum, m_off_t maxDownloadRequestSize, unsigned connectionCount, bool& newBufferSupplied, bool& pauseConnectionForRaid);
 
+        bool outputPending(unsigned connectionNum) override;
+
+        // finish decrypting all pieces handed to the crypto pool, eg. to save them before the transfer slot goes away
+        void waitForPendingOutput();
+
+        // encrypt and mac the upload chunk in the body of req on the crypto pool, which holds the body meanwhile.  False if
+        // there is no pool, or it has no room for it in its budget: prepare() it inline then
+        bool encryptInput(unsigned connectionNum, HttpReqUL* req, const string& tempurl, m_off_t pos, m_off_t npos);
+
+        // true while the chunk of the connection is being encrypted.  Once it is, the body is back in req, its MACs are
+        // in the transfer's and req is prepared to send it
+        bool inputPending(unsigned connectionNum, HttpReqUL* req);
+
+        // Write coalescing: move the output piece of the connection to the end of the gathered data, to be written together
+        // with it, up to `limit` bytes.  Returns false if the piece stays with the connection: to write it itself when it's
+        // too large, or, with `waitForFlush` set, to try again once the data gathered before it is written
+        bool coalesceOutput(unsigned connectionNum, size_t limit, bool& waitForFlush);
+
+        // what was gathered so far is written next (if no gathered data is being written already)
+        void flushCoalescedOutput();
+
+        // the gathered data to write now, if any.  Call coalescedWriteCompleted() once it is written
+        FilePiece* getCoalescedOutputPointer();
+        void coalescedWriteCompleted(bool succeeded);
+
+        bool gatheringOutput() const;
+
+        // bytes gathered, or being written, that don't count as completed yet
+        m_off_t coalescedBytes() const;
+
         TransferBufferManager();
+        ~TransferBufferManager();
 
     private:
 
         Transfer* transfer;
 
+        struct FinalizeJob : public TransferCryptoPool::Job
+        {
+            std::unique_ptr<FilePiece> piece;
+            byte transferkey[SymmCipher::KEYLENGTH];
+            int64_t ctriv;
+            m_off_t transfersize;
+
+            // the transfer's macs for the chunks the piece touches, as they were when it was queued
+            chunkmac_map transfermacs;
+
+            void run(SymmCipher& cipher) override;
+        };
+
+        // pieces being finalized on the crypto pool, by connection
+        std::map<unsigned, std::shared_ptr<FinalizeJob>> finalizejobs;
+
+        struct EncryptJob : public TransferCryptoPool::Job
+        {
+            // owned until given back to the request: the request may go away meanwhile
+            byte* body = nullptr;
+            size_t capacity = 0;
+            std::shared_ptr<BufferPool> bufferpool;
+
+            byte transferkey[SymmCipher::KEYLENGTH];
+            int64_t ctriv;
+            m_off_t pos;
+            m_off_t npos;
+            string tempurl;
+
+            // the results, for the client thread to take
+            chunkmac_map macs;
+            string urlsuffix;
+
+            void run(SymmCipher& cipher) override;
+            ~EncryptJob();
+        };
+
+        // upload chunks being encrypted on the crypto pool, by connection
+        std::map<unsigned, std::shared_ptr<EncryptJob>> encryptjobs;
+
+        // jobs that did not fit in the pool's in-flight budget yet, oldest first
+        std::deque<std::shared_ptr<FinalizeJob>> unsubmittedjobs;
+
+        void submitFinalizeJobs();
+
+        // contiguous output pieces gathered for one write, and the previous ones while they are written
+        std::unique_ptr<FilePiece> gathering, flushing;
+
         // decrypt and mac downloaded chunk
+        static void finalizePiece(FilePiece& r, SymmCipher& cipher, int64_t ctriv, m_off_t transfersize, chunkmac_map& transfermacs);
         void finalize(FilePiece& r) override;
+        void finalizeOutput(unsigned connectionNum, FilePiece* piece) override;
         m_off_t calcOutputChunkPos(m_off_t acquiredpos) override;
         void bufferWriteCompletedAction(FilePiece& r) override;
 
@@ -37,50 +37,128 @@ private:
     JSON json;
     size_t processindex = 0;
 
+    // JSON bytes of the commands, and when the first of them was queued
+    size_t bytes = 0;
+    dstime queuedds = 0;
+
 public:
     void add(Command*);
 
     size_t size() const;
+    size_t jsonbytes() const;
+    dstime queuedsince() const;
 
     void get(string*, bool& suppressSID) const;
 
     void serverresponse(string&& movestring, MegaClient*);
     void servererror(error e, MegaClient* client);
 
+    // the response of a batch that failed as a whole: the error for each command
+    string errorresponse(error e) const;
+
     void process(MegaClient* client);
 
     void clear();
     bool empty() const; 
     void swap(Request&);
 
+    // the only command of this batch, if it processes its response incrementally
+    Command* streamingcommand() const;
+
     bool stopProcessing = false;
 };
 
 
+// limits for closing a batch early, so that it neither grows without bound nor keeps growing while it waits
+struct MEGA_API BatchPolicy
+{
+    // a batch is closed once its commands' JSON reaches this size (a single bigger command still goes, alone)
+    size_t maxBytes = 1 << 20;
+
+    // a batch whose first command waited this long (ds) is sent ahead of the priority lane, so neither lane starves
+    dstime maxDelay = 20;
+
+    // deferrable commands wait up to this long (ds) for other traffic to go along with.  0 (the default) sends them
+    // as any other
+    dstime maxDeferral = 0;
+};
+
 class MEGA_API RequestDispatcher
 {
+public:
+    enum Lane { LANE_NORMAL = 0, LANE_PRIORITY = 1, LANE_PIPELINED = 2, LANE_COUNT };
+
+    struct LaneStats
+    {
+        uint64_t batches = 0;
+        uint64_t commands = 0;
+
+        // from the first command being queued until the response arrives, in ds
+        uint64_t totalLatency = 0;
+        dstime maxLatency = 0;
+    };
+
+private:
     // these ones have been sent to the server, but we haven't received the response yet
     Request inflightreq;
+    Lane inflightlane = LANE_NORMAL;
 
     // client-server request double-buffering, in batches of up to MAX_COMMANDS
     deque<Request> nextreqs;
 
+    // latency-sensitive commands, sent ahead of the normal batches
+    Request priorityreq;
+
+    // deferrable commands, held until releasedeferred()
+    Request deferredreq;
+
+    // order-independent commands, sent on extra connections beside the ordered ones when pipelining is enabled.
+    // Responses are processed in the order the batches were sent, so early arrivals wait in pipelinedresponses
+    deque<Request> pipelinedreqs;
+    map<uint64_t, Request> pipelinedinflight;
+    map<uint64_t, string> pipelinedresponses;
+    Request pipelinedprocessing;
+    uint64_t pipelinedseq = 0;
+    unsigned maxpipelined = 0;
+
+    size_t compressthreshold = 0;
+    bool compress(string* out);
+
     // flags for dealing with resetting everything from a command in progress
     bool processing = false;
     bool clearWhenSafe = false;
 
     static const int MAX_COMMANDS = 10000;
 
+    bool full(const Request&, const Command*) const;
+    void recordresponse(const Request&, Lane);
+
 public:
     RequestDispatcher();
 
+    BatchPolicy policy;
+
     // Queue a command to be send to MEGA. Some commands must go in their own batch (in case other commands fail the whole batch), determined by the Command's `batchSeparately` field.
     void add(Command*);
 
     bool cmdspending() const;
 
-    // get the set of commands to be sent to the server (could be a retry)
-    void serverrequest(string*, bool& suppressSID);
+    // held deferrable commands go to the normal lane, as the radio is up: along with other traffic, or because they
+    // waited policy.maxDeferral
+    bool deferredpending() const;
+    dstime deferreduntil() const;
+    void releasedeferred(bool ridealong);
+
+    // the command of the in-flight batch whose response is being processed as it downloads, if any
+    Command* inflightstreamingcommand() const;
+
+    // get the set of commands to be sent to the server (could be a retry).
+    // With `compressed`, large batches may come gzipped, as reported there
+    void serverrequest(string*, bool& suppressSID, bool* compressed = nullptr);
+
+    // gzip batches of at least `threshold` bytes (0, the default, disables it)
+    void setcompression(size_t threshold);
+    size_t compression() const;
 
     // once the server response is determined, call one of these to specify the results
     void requeuerequest();
@@ -89,12 +167,33 @@ public:
 
     void clear();
 
+    // allow up to `batches` order-independent batches in flight beside the ordered one (0, the default, disables it)
+    void setpipelinedepth(unsigned batches);
+    unsigned pipelinedepth() const;
+
+    // the pipelined counterparts of the above. Batches are identified by the sequence number sendpipelined() returns
+    bool pipelinedpending() const;
+    uint64_t sendpipelined(string*, bool& suppressSID);
+    void requeuepipelined(uint64_t seq);
+    void pipelinedresponse(uint64_t seq, string&& movestring, MegaClient*);
+    void pipelinederror(uint64_t seq, error, MegaClient*);
+
+    uint64_t csRequestsSent = 0, csRequestsCompleted = 0;
+    uint64_t csBatchesSent = 0, csBatchesReceived = 0;
+    uint64_t csCompressedBatches = 0, csBytesBeforeCompression = 0, csBytesAfterCompression = 0;
+
+    // deferrable commands held, and the times they were released with other traffic (a wakeup of the radio saved each)
+    // or on their own
+    uint64_t csDeferredCommands = 0, csDeferredRidealongs = 0, csDeferredExpirations = 0;
+    LaneStats laneStats[LANE_COUNT];
+
+    // one line summary of the counters above, for logs and diagnostics
+    string statsReport() const;
+
 #ifdef MEGA_MEASURE_CODE
     Request deferredRequests;
     std::function<bool(Command*)> deferRequests;
     void sendDeferred();
-    uint64_t csRequestsSent = 0, csRequestsCompleted = 0;
-    uint64_t csBatchesSent = 0, csBatchesReceived = 0;
 #endif
 
 };
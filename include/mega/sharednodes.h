@@ -0,0 +1,101 @@
+/**
+ * @file mega/sharednodes.h
+ * @brief Read-only view of the nodes, shared with other processes
+ *
+ * (c) 2013-2020 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGA_SHAREDNODES_H
+#define MEGA_SHAREDNODES_H 1
+
+#include "types.h"
+
+namespace mega {
+// the nodes of an account in a file that the process owning the MegaClient writes and others (such as an app
+// extension) map to answer metadata queries without a client of their own.  Each write replaces the file, so a
+// view keeps reading the generation it opened until it refresh()es.  Handles, types, sizes and times are in the
+// clear, as in the node index; the names are encrypted with the key of the view.
+//
+// Layout: a header (with a block that checks the key), then the records sorted by handle, then their indexes
+// sorted by parent, then the names, each at a multiple of the cipher block size
+class MEGA_API SharedNodeView
+{
+public:
+    static const char MAGIC[8];
+    static const uint32_t VERSION = 1;
+    static const size_t HEADERSIZE = 88;
+    static const size_t RECORDSIZE = 56;
+
+    struct Record
+    {
+        handle nodehandle;
+        handle parenthandle;
+        m_off_t size;
+        m_time_t ctime;
+        m_time_t mtime;
+        nodetype_t type;
+    };
+
+    // replaces the file at path with the nodes (and the roots of the account), which take the generation
+    static bool write(const string& path, const string& key, PrnGen&, const node_map& nodes, const handle* rootnodes, uint64_t generation);
+
+    // maps the file at path, false if it is missing, damaged or not of this key
+    bool open(const string& path, const string& key);
+    void close();
+
+    // maps the newer generation, if one was written since, and tells whether it did
+    bool refresh();
+
+    // the generation of the file at path, 0 if it can't be read
+    static uint64_t generationof(const string& path);
+
+    uint64_t generation() const { return mGeneration; }
+    handle rootnode(int i) const { return mRootNodes[i]; }
+    size_t size() const { return mCount; }
+
+    bool find(handle, Record*, string* name = nullptr) const;
+    bool children(handle parent, vector<Record>*, vector<string>* names = nullptr) const;
+
+    SharedNodeView() = default;
+    ~SharedNodeView();
+    MEGA_DISABLE_COPY_MOVE(SharedNodeView)
+
+private:
+    string mPath;
+    string mKey;
+
+    // the mapped file, or a copy of it where it can't be mapped
+    const char* mData = nullptr;
+    size_t mLength = 0;
+    bool mMapped = false;
+    string mCopy;
+
+    uint64_t mGeneration = 0;
+    uint32_t mCount = 0;
+    handle mRootNodes[3] = { UNDEF, UNDEF, UNDEF };
+    int64_t mIv = 0;
+    const char* mRecords = nullptr;
+    const char* mByParent = nullptr;
+    const char* mNames = nullptr;
+    size_t mNamesLength = 0;
+
+    Record record(uint32_t index) const;
+    bool name(uint32_t index, string*) const;
+};
+} // namespace
+
+#endif
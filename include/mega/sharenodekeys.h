@@ -28,14 +28,28 @@ namespace mega {
 // cr element share/node map key generator
 class MEGA_API ShareNodeKeys
 {
-    node_vector shares;
-    vector<string> items;
+    // the shares, items and keys of one cr element, indexed on their own
+    struct Part
+    {
+        node_vector shares;
+        vector<string> items;
 
-    string keys;
+        string keys;
 
-    int addshare(Node*);
+        // JSON size, roughly
+        size_t bytes = 0;
+
+        int addshare(Node*);
+    };
+
+    vector<Part> parts;
+    size_t maxbytes;
 
 public:
+    // with maxbytes, the keys are split in parts whose cr elements are about that size at most
+    // (0: a single part)
+    explicit ShareNodeKeys(size_t maxbytes = 0);
+
     // a convenience function for calling the full add() below when working with Node*
     void add(Node*, Node*, int);
 
@@ -44,7 +58,11 @@ public:
     // The result is suitable for sending all the collected keys for each share, per Node, to the API.
     void add(const string& nodekey, handle nodehandle, Node*, int, const byte* = NULL, int = 0);
 
-    void get(Command*, bool skiphandles = false);
+    // the number of parts that have keys
+    size_t size() const;
+
+    // emit a part's cr element, if it has keys
+    void get(Command*, bool skiphandles = false, size_t index = 0);
 };
 } // namespace
 
@@ -41,6 +41,131 @@ int computeReversePathMatchScore(string& accumulated, const string& path1, const
 bool assignFilesystemIds(Sync& sync, MegaApp& app, FileSystemAccess& fsaccess, handlelocalnode_map& fsidnodes,
                          const string& localdebris, const string& localseparator);
 
+// Moves localpath into a folder of the day in localdebris, creating them as needed (see Sync::movetolocaldebris())
+bool moveToLocalDebris(FileSystemAccess& fsaccess, string localdebris, string* localpath);
+
+// Moves the items that syncdown() deletes to the local debris of their syncs, on a pool of threads that have
+// a FileSystemAccess each, so that slow filesystems don't hold the SDK thread.  Each path always goes to the same
+// thread, so the moves of a path are done in the order they were queued.  Files are only moved if they still
+// have the fingerprint they were last synced with
+class MEGA_API SyncDebrisQueue
+{
+public:
+    enum result_t { MOVED, FAILED, TRANSIENT, CHANGED };
+
+    struct Result
+    {
+        LocalNode* localnode;
+        string localpath;
+        result_t result;
+    };
+
+    // the threads get their FileSystemAccess from newfsaccess, and notify waiter after each move
+    SyncDebrisQueue(std::function<FileSystemAccess*()> newfsaccess, unsigned threads, Waiter* waiter);
+    ~SyncDebrisQueue();
+
+    // fingerprint: for files, the content that may be moved
+    void add(LocalNode* localnode, const string& localpath, const string& localdebris, const FileFingerprint* fingerprint);
+
+    // the LocalNode is going away: its move goes on, but its result is dropped
+    void forget(LocalNode* localnode);
+
+    // a finished move, if any
+    bool next(Result& result);
+
+    // no moves queued, running or waiting for next()
+    bool idle();
+
+    unsigned threads() const;
+
+private:
+    struct Op
+    {
+        LocalNode* localnode;
+        string localpath;
+        string localdebris;
+        bool isfile;
+        FileFingerprint fingerprint;
+    };
+
+    struct Worker
+    {
+        std::deque<Op> queued;
+        LocalNode* current = nullptr;
+        std::unique_ptr<FileSystemAccess> fsaccess;
+        std::thread thread;
+    };
+
+    Waiter* waiter;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::unique_ptr<FileSystemAccess> inlinefsaccess;    // when no threads could be started
+    std::deque<Result> finished;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    unsigned pending = 0;   // queued or running
+    bool stopping = false;
+
+    void workerLoop(Worker* worker);
+    static result_t move(FileSystemAccess& fsaccess, Op& op);
+};
+
+// Takes the fingerprints of the files in the notification queue of one sync ahead of procscanq(), on a thread
+// with a FileSystemAccess of its own, so that a sync on a slow disk or network share only holds its own thread
+// while the files are read, and the SDK thread goes on with the other syncs.  The thread only opens and reads
+// files by path: the LocalNodes, fsidnode, the node tree and the transfers are only touched by checkpath() on the
+// SDK thread, which takes the fingerprints that are still valid for the files it stats
+class MEGA_API SyncFingerprintPrefetcher
+{
+public:
+    // the thread gets its FileSystemAccess from newfsaccess, keeps at most depth paths queued, being read or
+    // read, and notifies waiter after each file
+    SyncFingerprintPrefetcher(std::function<FileSystemAccess*()> newfsaccess, size_t depth, Waiter* waiter);
+    ~SyncFingerprintPrefetcher();
+
+    // queue localpath, unless it is already there.  False when full
+    bool add(const string& localpath);
+
+    // the fingerprint read from localpath, if fa (open on it) still has its size, mtime and fsid.  Any result for
+    // the path is consumed
+    bool take(const string& localpath, const FileAccess& fa, FileFingerprint* fingerprint);
+
+    // queued, being read or read
+    size_t size();
+
+    // nothing queued or being read
+    bool idle();
+
+    bool threaded() const;
+
+private:
+    struct Result
+    {
+        bool done = false;
+        bool isfile = false;
+        m_off_t size = -1;
+        m_time_t mtime = 0;
+        handle fsid = UNDEF;
+        bool fsidvalid = false;
+        FileFingerprint fingerprint;
+    };
+
+    size_t depth;
+    Waiter* waiter;
+    std::unique_ptr<FileSystemAccess> fsaccess;
+    std::thread thread;
+
+    std::deque<string> queued;
+    string reading;
+    map<string, Result> results;
+    std::deque<string> resultorder;     // oldest first, to make room for new paths
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    bool stopping = false;
+
+    void workerLoop();
+    void read(const string& localpath, Result* result);
+};
+
 // A collection of sync configs backed by a database table
 class MEGA_API SyncConfigBag
 {
@@ -69,6 +194,37 @@ private:
     std::map<std::string, SyncConfig> mSyncConfigs; // map of local paths to sync configs
 };
 
+// A snapshot of a sync's queues and throughput, cheap enough to be taken every second
+struct MEGA_API SyncStats
+{
+    // pending notifications by DirNotify::notifyqueue, and the age of the oldest one
+    size_t queued[DirNotify::NUMQUEUES] = {};
+    dstime queuelagds = 0;
+
+    // directory entries visited by scans, in total and per second lately
+    unsigned long long scanentries = 0;
+    unsigned scanrate = 0;
+
+    // folders waiting to be created remotely, and vanished LocalNodes waiting to be deleted
+    size_t synccreate = 0;
+    size_t notseen = 0;
+
+    // transfers started by the sync and not yet completed
+    size_t gets = 0;
+    size_t puts = 0;
+
+    // state cache flushes: count, total time and duration of the last one
+    unsigned statecacheflushes = 0;
+    unsigned long long statecacheflushms = 0;
+    unsigned statecachelastflushms = 0;
+
+    // from a file's last filesystem event to the remote commit of its upload
+    unsigned long long lagsamples = 0;
+    dstime lastlagds = 0;
+    dstime maxlagds = 0;
+    dstime avglagds = 0;
+};
+
 class MEGA_API Sync
 {
 public:
@@ -89,6 +245,10 @@ public:
     // root of local filesystem tree, holding the sync's root folder.  Never null except briefly in the destructor (to ensure efficient db usage)
     unique_ptr<LocalNode> localroot;
 
+    // set while the destructor deletes the tree, whose nodes then don't unlink themselves from their parents
+    // and from the notification queues one by one
+    bool discardinglocalnodes = false;
+
     // Path used to normalize sync locaroot name when using prefix /System/Volumes/Data needed by fsevents, due to notification paths
     // are served with such prefix from macOS catalina +
 #ifdef __APPLE__
@@ -118,8 +278,27 @@ public:
     // recursively add children
     void addstatecachechildren(uint32_t, idlocalnode_map*, string*, LocalNode*, int);
     
-    // Caches all synchronized LocalNode
-    void cachenodes();
+    // Caches all synchronized LocalNode.  While notifications are still being processed, writes are held back
+    // until enough have queued up or some time has passed, unless forced
+    void cachenodes(bool force = false);
+    static const size_t STATECACHE_FLUSH_THRESHOLD = 256;
+    static const dstime STATECACHE_FLUSH_INTERVAL_DS = 20;
+    dstime statecacheflushds = 0;
+
+    struct StateCacheStats
+    {
+        unsigned flushes = 0;
+        unsigned long long written = 0;
+        unsigned long long unchanged = 0;
+        unsigned long long deleted = 0;
+        unsigned long long flushms = 0;
+        unsigned lastflushms = 0;
+        dstime since = 0;
+    };
+    StateCacheStats statecachestats;
+
+    // one-line summary of statecachestats, including the milliseconds spent flushing per second of sync
+    string statecachereport() const;
 
     // change state, signal to application
     void changestate(syncstate_t);
@@ -144,8 +323,30 @@ public:
     bool assignfsids();
 
     // scan items in specified path and add as children of the specified
-    // LocalNode
-    bool scan(string*, FileAccess*);
+    // LocalNode (optionally collecting the names found)
+    bool scan(string*, FileAccess*, set<string>* = NULL);
+
+    // the initial scan, when it runs on worker threads (null otherwise, and once it is merged)
+    std::unique_ptr<ParallelDirScanner> dirscanner;
+
+    // start reading the tree on `threads` worker threads instead of the recursive scan()
+    void startdirscan(const string& rootpath, unsigned threads);
+
+    // merge the folders read so far into the LocalNodes and the notification queue, as scan() does, subfolders
+    // with valid cached LocalNodes going back to the workers.  Returns false if the root could not be read
+    bool procdirscan();
+    static const unsigned DIRSCAN_BATCHES_PER_CALL = 256;
+
+    // reads the files at the front of the notification queue ahead of procscanq() (null when disabled)
+    std::unique_ptr<SyncFingerprintPrefetcher> prefetcher;
+
+    // queue the files of the notifications that are due to be scanned to the prefetcher, starting or dropping it
+    // as MegaClient::syncprefetchdepth says
+    void prefetchfingerprints();
+
+    // MegaClient::genfingerprint(), with the fingerprint read by the prefetcher when it is still valid
+    bool genfingerprint(FileFingerprint*, FileAccess*, const string& localpath, bool usecache = true);
+    unsigned prefetchedfingerprints = 0;
 
     // own position in session sync list
     sync_list::iterator sync_it{};
@@ -166,6 +367,28 @@ public:
     // state cache table
     DbTable* statecachetable = nullptr;
 
+    // change journal position up to which the state cache is complete, stored in the state cache as record 0.
+    // A position is only stored at the idle check after the one that took it, so that the changes before it
+    // have surely been delivered and processed by then
+    string journalcursor;
+    string pendingjournalcursor;
+    dstime journalcursords = 0;
+    static const dstime JOURNAL_CURSOR_INTERVAL_DS = 600;
+
+    // with all notifications processed and cached
+    void updatejournalcursor();
+
+    // instead of the initial scan: queue what the journal recorded since the stored position and keep the rest
+    // of the cached tree.  Returns false if there's no usable position or journal
+    bool resumefromjournal();
+
+    // queue the paths of this sync that the journal recorded since a position
+    bool queuejournalchanges(const string& cursor);
+
+    // after the notification buffer overflowed: queue what the journal recorded since the read that overflowed,
+    // or flag the notifications as failed for a full rescan
+    void procoverflow();
+
     // move file or folder to localdebris
     bool movetolocaldebris(string* localpath);
 
@@ -184,6 +407,38 @@ public:
     // true if the local synced folder is a network folder
     bool isnetwork = false;
 
+    // for network folders, whose notifications can't be relied on (see MegaClient::syncnetworkpoll): stat up
+    // to POLL_FOLDERS_PER_CALL folders that are due and rescan those with a new mtime.  Folders that changed are
+    // polled again after POLL_MIN_INTERVAL_DS and their ancestors sooner, unchanged ones less and less often.
+    // Returns whether changes were queued
+    bool pollfolders();
+    static const dstime POLL_TICK_DS;
+    static const dstime POLL_MIN_INTERVAL_DS;
+    static const dstime POLL_MAX_INTERVAL_DS;
+    static const unsigned POLL_FOLDERS_PER_CALL;
+
+    // files changed in place don't change their folder's mtime: those are only seen by the full rescans,
+    // which polling syncs do this often at most
+    static const dstime POLL_FULLSCAN_INTERVAL_DS;
+    dstime fullscands = 0;
+
+    // directory entries visited by scan(), and the rate over the last window of at least a second
+    unsigned long long scanentries = 0;
+    unsigned scanrate = 0;
+    unsigned long long scanratebase = 0;
+    dstime scanrateds = 0;
+    void updatescanrate();
+
+    // fs event to remote commit of uploads (see LocalNode::notifiedds)
+    unsigned long long lagsamples = 0;
+    unsigned long long totallagds = 0;
+    dstime lastlagds = 0;
+    dstime maxlagds = 0;
+    void addlag(dstime);
+
+    // fill in a snapshot of the sync's queues and counters
+    void getstats(SyncStats&) const;
+
     // values related to possible files being updated
     m_off_t updatedfilesize = ~0;
     m_time_t updatedfilets = 0;
@@ -198,6 +453,13 @@ public:
     static const int FILE_UPDATE_MAX_DELAY_SECS;
     static const dstime RECENT_VERSION_INTERVAL_SECS;
 
+    // upload delay after a file changes (see LocalNode::bumpnagleds()): FILE_NAGLE_DS, or the file's usual
+    // interval between changes if those come closer than FILE_CADENCE_WINDOW_DS, but never holding a file
+    // that keeps changing for more than FILE_NAGLE_MAX_DS
+    static const dstime FILE_NAGLE_DS;
+    static const dstime FILE_CADENCE_WINDOW_DS;
+    static const dstime FILE_NAGLE_MAX_DS;
+
 protected :
     bool readstatecache();
 
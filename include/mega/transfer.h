@@ -43,6 +43,7 @@ struct TransferCategory
 };
 
 class DBTableTransactionCommitter;
+class PartialDownloadCheck;
 
 // pending/active up/download ordered by file fingerprint (size - mtime - sparse CRC)
 struct MEGA_API Transfer : public FileFingerprint
@@ -115,7 +116,21 @@ struct MEGA_API Transfer : public FileFingerprint
     void completefiles();
 
     // remove file from transfer including in cache
-    void removeTransferFile(error, File* f, DBTableTransactionCommitter* committer);
+    void removeTransferFile(error, File* f, DBTableTransactionCommitter* committer, vector<uint32_t>* batch = nullptr);
+
+    // upload chunks that a slot encrypted but that were not acknowledged when it went away, by position.  The key
+    // and the IV don't change between attempts, so the next slot sends them as they are instead of reading and
+    // encrypting them again, as long as the file is the one they were read from
+    map<m_off_t, unique_ptr<HttpReqUL>> unackedchunks;
+    m_time_t unackedmtime = 0;
+    size_t unackedbytes = 0;
+
+    // keeps the body of the request, within the budget of the client
+    void keepunackedchunk(HttpReqUL*, m_time_t mtime);
+
+    // the request kept for [pos, npos) of the file with that mtime, if any
+    unique_ptr<HttpReqUL> takeunackedchunk(m_off_t pos, m_off_t npos, m_time_t mtime);
+    void dropunackedchunks();
 
     // previous wrong fingerprint
     FileFingerprint badfp;
@@ -141,6 +156,14 @@ struct MEGA_API Transfer : public FileFingerprint
 
     // context of the async fopen operation
     AsyncIOContext* asyncopencontext;
+
+    // the check of the partial file of a download started without its cached progress, while it runs, and whether it
+    // was done (it's done once: a download that fails its MAC after resuming starts again from zero)
+    PartialDownloadCheck* partialcheck = nullptr;
+    bool partialchecked = false;
+
+    // an upload that took the media attributes of a node with its content (see MegaClient::takefileattributes)
+    bool reusedmedia = false;
    
     // timestamp of the start of the transfer
     m_time_t lastaccesstime;
@@ -166,6 +189,61 @@ struct MEGA_API Transfer : public FileFingerprint
     void addAnyMissingMediaFileAttributes(Node* node, std::string& localpath);
 };
 
+// decides the order in which the queued transfers are offered to dispatchTransfers(), which starts them while the
+// slot and outstanding-bytes limits allow.  Without one, transfers go strictly by priority
+class MEGA_API TransferScheduler
+{
+public:
+    virtual ~TransferScheduler() = default;
+
+    // reorder the ready transfers of one direction, given in priority order
+    virtual void order(direction_t, vector<Transfer*>& transfers, const transferslot_list& active) = 0;
+
+    // the transfer got a slot
+    virtual void started(Transfer*) { }
+};
+
+// weighted fair queuing between scheduling groups: each group is charged the bytes of the transfers it starts
+// (plus a per-file overhead) divided by its weight, and the group charged least goes next.  On top of that, groups
+// below their minimum speed go first, and small files may take a fast lane ahead of everything else
+class MEGA_API FairTransferScheduler : public TransferScheduler
+{
+public:
+    // cost of a file beyond its size: per-file requests, open, fingerprint and putnodes
+    static const m_off_t FILE_OVERHEAD = 65536;
+
+    // weight relative to other groups (1 by default)
+    void setweight(int group, unsigned weight);
+
+    // bytes per second the group should get while it has queued transfers (0 by default: none)
+    void setminspeed(int group, m_off_t speed);
+
+    // up to `slots` files of at most `maxsize` bytes go first, whatever their group.  0 slots (the default) disables it
+    void setfastlane(m_off_t maxsize, unsigned slots);
+
+    static int groupof(const Transfer*);
+
+    void order(direction_t, vector<Transfer*>& transfers, const transferslot_list& active) override;
+    void started(Transfer*) override;
+
+private:
+    struct GroupConfig
+    {
+        unsigned weight = 1;
+        m_off_t minspeed = 0;
+    };
+    std::map<int, GroupConfig> configs;
+
+    // virtual time (weighted bytes started) per group with transfers, and the start time of groups that (re)join
+    std::map<int, double> virtualtimes[2];
+    double systemtime[2] = { 0, 0 };
+
+    m_off_t fastlanesize = 131072;
+    unsigned fastlaneslots = 0;
+
+    double cost(const Transfer*) const;
+};
+
 class MEGA_API TransferList
 {
 public:
@@ -199,11 +277,129 @@ public:
     uint64_t currentpriority;
 
 private:
+    vector<Transfer*> readytransfers(direction_t);
+    uint64_t makeroom(Transfer *transfer, size_t srcindex, size_t dstindex, DBTableTransactionCommitter& committer);
     void prepareIncreasePriority(Transfer *transfer, transfer_list::iterator srcit, transfer_list::iterator dstit, DBTableTransactionCommitter& committer);
     void prepareDecreasePriority(Transfer *transfer, transfer_list::iterator it, transfer_list::iterator dstit);
     bool isReady(Transfer *transfer);
 };
 
+// Blocks of streamed files kept on disk for every later read of the client, least recently used dropped first.
+// They are stored as the server sends them, encrypted with the key of the file
+class MEGA_API StreamingBlockCache
+{
+public:
+    static const m_off_t BLOCKSIZE = 1 << 20;
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t bytesSaved = 0;
+        uint64_t bytesStored = 0;
+        size_t blocks = 0;
+    };
+
+    // localfolder in local encoding. Files left in it by an earlier cache are deleted
+    StreamingBlockCache(FileSystemAccess& fsaccess, const string& localfolder, m_off_t maxbytes);
+
+    // deletes the cached blocks
+    ~StreamingBlockCache();
+
+    // the plaintext of the block, if it is cached
+    bool get(handle h, m_off_t block, SymmCipher& key, int64_t ctriv, string& data);
+
+    void put(handle h, m_off_t block, SymmCipher& key, int64_t ctriv, const byte* data, size_t len);
+
+    // bytes delivered from the cache instead of from the server
+    void served(m_off_t bytes);
+
+    Stats stats() const;
+
+private:
+    typedef std::pair<handle, m_off_t> BlockKey;
+
+    struct Entry
+    {
+        size_t size;
+        std::list<BlockKey>::iterator lru;
+    };
+
+    FileSystemAccess& fsaccess;
+    string folder;
+    m_off_t maxbytes;
+    std::map<BlockKey, Entry> blocks;
+
+    // most recently used first
+    std::list<BlockKey> lru;
+    Stats counters;
+
+    void blockpath(const BlockKey& key, string& localpath) const;
+    void remove(std::map<BlockKey, Entry>::iterator it);
+};
+
+// bandwidth for the streams that play media.  Each stream needs its bitrate (size over playtime, from the media
+// file attribute) and should stay BUFFER_SECONDS ahead of playback.  While one is behind, the downloads that don't
+// stream are limited to what the link leaves to them, and slots are only retried for being slow when a faster
+// one is plausible: below half the bitrate on a link that can do better, never below the fair share of the link
+class MEGA_API StreamingScheduler
+{
+public:
+    static const int BUFFER_SECONDS = 10;
+
+    // throttled background downloads don't go slower than this
+    static const m_off_t MIN_BACKGROUND_SPEED = 32768;
+
+    // media bytes per second of a file (0 if unknown)
+    static m_off_t bitrateof(m_off_t size, uint32_t playtime);
+
+    // new state of the active streams: number, total bitrate and whether any is behind its target
+    void update(BandwidthShaper&, m_off_t downloadspeed, size_t streams, m_off_t bitrate, bool behind, dstime now);
+
+    // mean speed below which a slot of a stream with this bitrate (0 if unknown) is retried
+    m_off_t minspeed(m_off_t bitrate) const;
+
+    // estimated link capacity: the best recent total download speed
+    m_off_t capacity() const { return m_off_t(linkcapacity); }
+
+    // limit in force for the background downloads (0: none)
+    m_off_t backgroundlimit() const { return limit; }
+
+private:
+    double linkcapacity = 0;
+    dstime measured = 0;
+    size_t activestreams = 0;
+    m_off_t limit = 0;
+};
+
+// shared by a DirectRead that lends its data to the app and the DirectReadLeases it handed out
+struct MEGA_API DirectReadLeases
+{
+    // held by the app, and the most it may hold before the read waits for it
+    std::atomic<m_off_t> bytes;
+    m_off_t limit;
+
+    // notified when the app gives a piece back, until the read is gone
+    std::mutex mutex;
+    Waiter* waiter;
+
+    DirectReadLeases(m_off_t limit, Waiter*);
+};
+
+// a decrypted piece of a direct read, lent to the app without copying (see MegaApp::pread_lease()).  Destroying
+// it, from any thread, gives the buffer back and lets the read go on
+struct MEGA_API DirectReadLease
+{
+    m_off_t pos;
+    HttpReq::http_buf_t buf;
+
+    DirectReadLease(m_off_t pos, std::shared_ptr<DirectReadLeases>);
+    ~DirectReadLease();
+
+private:
+    std::shared_ptr<DirectReadLeases> leases;
+};
+
 struct MEGA_API DirectReadSlot
 {
     m_off_t pos;
@@ -251,8 +447,28 @@ struct MEGA_API DirectRead
 
     int reqtag;
 
+    // fetching ahead for the node's cache, not for the app
+    bool prefetch = false;
+
+    // set for reads that lend their pieces to the app instead of passing them to pread_data()
+    std::shared_ptr<DirectReadLeases> leases;
+
+    // the app holds as much as it may
+    bool held() const;
+
+    // hand buf (left empty) over in a DirectReadLease.  False if the app aborted the read
+    bool lend(HttpReq::http_buf_t& buf, m_off_t pos, m_off_t speed, m_off_t meanSpeed);
+
+    // data received since the last block boundary, for MegaClient::streamingblockcache
+    string blockdata;
+    m_off_t blockpos = -1;
+    void cacheblocks(m_off_t pos, const byte* data, size_t len);
+
     void abort();
 
+    // deliver what the node has cached at the current position.  True if the read is over (and deleted)
+    bool servecached();
+
     DirectRead(DirectReadNode*, m_off_t, m_off_t, int, void*);
     ~DirectRead();
 };
@@ -285,11 +501,43 @@ struct MEGA_API DirectReadNode
     handledrn_map::iterator hdrn_it;
     dsdrn_map::iterator dsdrn_it;
 
+    // pieces delivered by any read of this node, by file position, up to client->directreadcachelimit bytes
+    std::map<m_off_t, string> cached;
+    size_t cachedbytes = 0;
+
+    // readahead: sequential reads double the window, a seek starts over with a short burst
+    static const m_off_t READAHEAD_BURST = 256 * 1024;
+    static const m_off_t READAHEAD_MAX = 16 * 1024 * 1024;
+    m_off_t lastreadend = -1;
+    m_off_t readaheadwindow = 0;
+    DirectRead* prefetchread = nullptr;
+
+    // media bytes per second (0 if unknown), and the bytes fetched since playback (re)started at streamstart,
+    // which the first read and every seek do
+    m_off_t bitrate = 0;
+    dstime streamstart = 0;
+    m_off_t streambytes = 0;
+    m_off_t streampos = -1;
+
+    // behind StreamingScheduler::BUFFER_SECONDS of media ahead of playback
+    bool streamingbehind(dstime now) const;
+
+    void cachepiece(m_off_t pos, const byte* data, size_t len);
+
+    // keep at most `limit` cached bytes, around `pos` (the playback position if negative)
+    void trimcache(size_t limit, m_off_t pos = -1);
+
+    // true if the read ahead will deliver this position
+    bool prefetching(m_off_t pos) const;
+
     // API command result
     void cmdresult(error, dstime = 0);
     
     // enqueue new read
-    void enqueue(m_off_t, m_off_t, int, void*);
+    void enqueue(m_off_t, m_off_t, int, void*, m_off_t maxleased = 0);
+
+    // fetch the range after an app read into the cache
+    void readahead(m_off_t offset, m_off_t count);
 
     // dispatch all reads
     void dispatch();
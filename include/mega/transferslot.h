@@ -46,6 +46,126 @@ public:
 
 class DBTableTransactionCommitter;
 
+// BBR-style sizing of the next download request on one connection.  Each finished request yields a round trip sample
+// (post to first byte) and a delivery rate sample (bytes over the time they took to arrive).  The next request asks for
+// REQUEST_ROUNDTRIPS times the bandwidth-delay product of the best recent rate and the lowest recent round trip, so the
+// idle round trip between requests costs a small, fixed share of throughput: big requests on fast distant links, and
+// short ones on slow mobile links.  The caller still rounds the size to chunk MAC boundaries
+class MEGA_API RequestSizeController
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    void posted(clock::time_point);
+    void received(clock::time_point, m_off_t bytes);
+    void completed(clock::time_point, m_off_t bytes);
+
+    // record one request directly: `rttus` until the first byte, then `transferus` to receive `bytes`
+    void sample(m_off_t bytes, int64_t rttus, int64_t transferus);
+
+    // `fallback` until there is an estimate, anyway at most `ceiling`
+    m_off_t nextRequestSize(m_off_t fallback, m_off_t ceiling) const;
+
+    static const int REQUEST_ROUNDTRIPS = 8;
+    static const size_t BANDWIDTH_SAMPLES = 8;
+    static const size_t RTT_SAMPLES = 16;
+
+private:
+    clock::time_point postedAt, firstByteAt;
+    bool inflight = false;
+    bool firstByte = false;
+
+    // bytes per second, and microseconds
+    deque<m_off_t> bandwidths;
+    deque<int64_t> rtts;
+};
+
+// Reads the file of an upload ahead of its connections, on a thread of its own and in blocks from the buffer pool,
+// so that the connections find their next chunks in memory instead of waiting for the disk
+class MEGA_API UploadReadahead
+{
+public:
+    // the file is opened again here, by name, and read from `pos` on, at most `window` bytes ahead of what was taken.
+    // Nothing is read ahead if its size or mtime are not the ones given
+    UploadReadahead(FileSystemAccess* fsaccess, const string& localname, m_off_t size, m_time_t mtime, m_off_t pos,
+                    size_t window, std::shared_ptr<BufferPool> pool, Waiter* waiter);
+    ~UploadReadahead();
+
+    enum result_t { READ, PENDING, MISSED };
+
+    // READ: [pos, pos + len) was read ahead and copied to dst.  PENDING: it's being read (the waiter is notified after
+    // each block).  MISSED: it was not, and won't be, read ahead: read it directly.  The readahead then goes on after it
+    result_t take(byte* dst, unsigned len, m_off_t pos);
+
+    static const unsigned BLOCKSIZE = 1 << 20;
+
+private:
+    struct Block
+    {
+        byte* buf;
+        size_t capacity;
+        unsigned len;
+        unsigned taken;
+    };
+
+    void readLoop(FileSystemAccess* fsaccess, string localname, m_time_t mtime);
+    void release(std::map<m_off_t, Block>::iterator it);
+
+    m_off_t size;
+    size_t window;
+    unsigned blocksize;
+    std::shared_ptr<BufferPool> pool;
+    Waiter* waiter;
+
+    std::mutex mutex;
+    std::condition_variable moreWanted;
+    std::map<m_off_t, Block> blocks;
+    size_t buffered = 0;
+    m_off_t reading;            // start of the block being read, or of the next one
+    m_off_t next;               // start of the block after it
+    bool failed = false;
+    bool stopping = false;
+
+    std::thread reader;
+};
+
+// Reads the temporary file a download left behind, when the download is started again without its cache entry, and
+// MACs its chunks with the key of the node, split over the worker pool from a thread of its own.  The leading chunks that are complete and not
+// zeros (holes, or space preallocated and never written) are taken as downloaded.  Nothing can check those MACs
+// until the download finishes: the MAC of the file covers them with the rest, and a download that fails it starts
+// again from zero
+class MEGA_API PartialDownloadCheck
+{
+public:
+    PartialDownloadCheck(FileSystemAccess* fsaccess, const string& localname, m_off_t size, const byte* transferkey,
+                         int64_t ctriv, unsigned threads, Waiter* waiter);
+    ~PartialDownloadCheck();
+
+    // the waiter is notified once it is
+    bool finished() const;
+
+    // adds the MACs of the leading chunks to macs, and returns where they end
+    m_off_t take(chunkmac_map* macs);
+
+private:
+    void checkLoop(FileSystemAccess* fsaccess, string localname, unsigned first, unsigned stride);
+
+    m_off_t size;
+    byte transferkey[SymmCipher::KEYLENGTH];
+    int64_t ctriv;
+    Waiter* waiter;
+
+    std::mutex mutex;
+    std::map<m_off_t, ChunkMAC> macs;
+
+    // the index of the first chunk that is not there, that the threads don't read past
+    std::atomic<unsigned> firstmissing{UINT_MAX};
+    std::atomic<bool> done{false};
+
+    // waits for the tasks on the worker pool, so that the client doesn't
+    std::thread checker;
+};
+
 // active transfer
 struct MEGA_API TransferSlot
 {
@@ -70,6 +190,14 @@ struct MEGA_API TransferSlot
 
     m_off_t maxRequestSize;
 
+    // how far the per-connection controllers may grow non-raid download requests
+    static const m_off_t MAX_ADAPTIVE_REQ_SIZE;
+
+    m_off_t maxAdaptiveRequestSize;
+
+    // one per connection, for non-raid downloads
+    vector<RequestSizeController> requestSizers;
+
     m_off_t progressreported;
 
     m_off_t progresscontiguous;
@@ -103,18 +231,42 @@ struct MEGA_API TransferSlot
     // async IO operations
     AsyncIOContext** asyncIO;
 
+    // async write of the output pieces that transferbuf gathered (MegaClient::coalesceddownloadwrites)
+    AsyncIOContext* coalescedIO = nullptr;
+
+    // for uploads, the file read ahead of the connections (MegaClient::uploadreadahead)
+    std::unique_ptr<UploadReadahead> readahead;
+
     // handle I/O for this slot
     void doio(MegaClient*, DBTableTransactionCommitter&);
 
     // helper for doio to delay connection creation until we know if it's raid or non-raid
     bool createconnectionsonce();
 
+    // auto connection mode (MegaClient::rebalanceconnections): the number of connections wanted.  Extra ones are
+    // opened at the next doio(), surplus ones are closed once they finish their current request
+    int targetconnections;
+
+    // speed before the connection being probed was added (-1 if none), and the speed gain that connection brought
+    m_off_t probespeed;
+    m_off_t connectiongain;
+
+    // whether the number of connections can be changed - not for raid, nor for small transfers
+    bool autoconnectable() const;
+
     // disconnect and reconnect all open connections for this transfer
     void disconnect();
 
     // indicate progress
     void progress();
 
+    // the tempurls are known: warm up the connections that the requests won't open right away
+    void tempurlsready();
+
+    // milliseconds from the tempurls to the first data transferred (-1 until then)
+    int ttfbms;
+    std::chrono::steady_clock::time_point tempurlstime;
+
     // update the contiguous progress
     void updatecontiguousprogress();
 
@@ -135,8 +287,16 @@ struct MEGA_API TransferSlot
     ~TransferSlot();
 
 private:
+    void resizeconnections();
+
+    // write what transferbuf gathered, and account for it once written (async: at the next doio, before the
+    // connections that may be waiting for it).  Return true if the transfer is over
+    bool writecoalesced(MegaClient*, DBTableTransactionCommitter&, dstime& backoff);
+    bool coalescedwritten(MegaClient*, DBTableTransactionCommitter&, dstime& backoff);
     void toggleport(HttpReqXfer* req);
     bool tryRaidRecoveryFromHttpGetError(unsigned i);
+    void firstdata();
+    bool samplehost(unsigned i, bool failed);
     bool checkTransferFinished(DBTableTransactionCommitter& committer, MegaClient* client);
 };
 } // namespace
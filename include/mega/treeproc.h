@@ -34,6 +34,11 @@ class MEGA_API TreeProc
 public:
     virtual void proc(MegaClient*, Node*) = 0;
 
+    // processors that only read the nodes can run on several threads: each thread processes its
+    // part of the tree with a fork (NULL: not supported), merged back in tree order at the end
+    virtual TreeProc* fork() const { return NULL; }
+    virtual void merge(const TreeProc&) { }
+
     virtual ~TreeProc() { }
 };
 
@@ -70,6 +75,8 @@ public:
     int numfolders;
 
     void proc(MegaClient*, Node*);
+    TreeProc* fork() const override;
+    void merge(const TreeProc&) override;
     TreeProcDU();
 };
 
@@ -80,9 +87,12 @@ class MEGA_API TreeProcShareKeys : public TreeProc
 
 public:
     void proc(MegaClient*, Node*);
-    void get(Command*);
+    void get(Command*, size_t part = 0);
+
+    // the parts of the keys, with maxbytes (see ShareNodeKeys)
+    size_t parts() const;
 
-    TreeProcShareKeys(Node* = NULL);
+    TreeProcShareKeys(Node* = NULL, size_t maxbytes = 0);
 };
 
 class MEGA_API TreeProcForeignKeys : public TreeProc
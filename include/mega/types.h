@@ -72,6 +72,7 @@ typedef unsigned char byte;
 
 #include "mega/crypto/sodium.h"
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <chrono>
@@ -102,6 +103,7 @@ class CommandPubKeyRequest;
 struct DirectRead;
 struct DirectReadNode;
 struct DirectReadSlot;
+struct DirectReadLease;
 struct FileAccess;
 struct FileAttributeFetch;
 struct FileAttributeFetchChannel;
@@ -119,6 +121,7 @@ class PubKeyAction;
 class Request;
 struct Transfer;
 class TreeProc;
+class TreeProcShareKeys;
 class LocalTreeProc;
 struct User;
 struct Waiter;
@@ -148,7 +151,7 @@ typedef uint32_t dstime;
 #define TOSTRING(x) STRINGIFY(x)
 
 // HttpReq states
-typedef enum { REQ_READY, REQ_PREPARED, REQ_INFLIGHT, REQ_SUCCESS, REQ_FAILURE, REQ_DONE, REQ_ASYNCIO } reqstatus_t;
+typedef enum { REQ_READY, REQ_PREPARED, REQ_INFLIGHT, REQ_SUCCESS, REQ_FAILURE, REQ_DONE, REQ_ASYNCIO, REQ_ENCRYPTING } reqstatus_t;
 
 typedef enum { USER_HANDLE, NODE_HANDLE } targettype_t;
 
@@ -290,13 +293,14 @@ typedef map<handle, LocalNode*> handlelocalnode_map;
 
 typedef set<LocalNode*> localnode_set;
 
+typedef multimap<pair<m_off_t, m_time_t>, LocalNode*> sizemtimelocalnode_map;
+
 typedef multimap<int32_t, LocalNode*> idlocalnode_map;
 
 typedef set<Node*> node_set;
 
-// enumerates a node's children
-// FIXME: switch to forward_list once C++11 becomes more widely available
-typedef list<Node*> node_list;
+// nodes by creation time
+typedef multimap<m_time_t, Node*> node_ctime_map;
 
 // undefined node handle
 const handle UNDEF = ~(handle)0;
@@ -328,8 +332,221 @@ typedef map<int, vector<string> > pendingfiles_map;
 // map an upload handle to the corresponding transer
 typedef map<handle, Transfer*> handletransfer_map;
 
+// open-addressing hash table keyed by handle (linear probing, backward-shift deletion)
+// exposes the subset of the std::map interface used for node lookups, but iteration
+// order is unspecified and iterators are invalidated by any insertion or erasure.
+// slots with key UNDEF are free, so UNDEF itself cannot be stored.
+template<typename T>
+class handle_hashmap
+{
+public:
+    typedef pair<handle, T> value_type;
+
+    template<typename V>
+    class iterator_base
+    {
+        friend class handle_hashmap;
+        template<typename> friend class iterator_base;
+
+        V* slot;
+        V* last;
+
+        void skipfree()
+        {
+            while (slot != last && slot->first == UNDEF)
+            {
+                slot++;
+            }
+        }
+
+    public:
+        iterator_base(V* s = nullptr, V* l = nullptr) : slot(s), last(l) { }
+
+        // allow iterator -> const_iterator conversion
+        template<typename W>
+        iterator_base(const iterator_base<W>& o) : slot(o.slot), last(o.last) { }
+
+        V& operator*() const { return *slot; }
+        V* operator->() const { return slot; }
+        iterator_base& operator++() { slot++; skipfree(); return *this; }
+        iterator_base operator++(int) { iterator_base i = *this; ++*this; return i; }
+        bool operator==(const iterator_base& o) const { return slot == o.slot; }
+        bool operator!=(const iterator_base& o) const { return slot != o.slot; }
+    };
+
+    typedef iterator_base<value_type> iterator;
+    typedef iterator_base<const value_type> const_iterator;
+
+    iterator begin() { iterator i(slots.data(), slots.data() + slots.size()); i.skipfree(); return i; }
+    iterator end() { return iterator(slots.data() + slots.size(), slots.data() + slots.size()); }
+    const_iterator begin() const { const_iterator i(slots.data(), slots.data() + slots.size()); i.skipfree(); return i; }
+    const_iterator end() const { return const_iterator(slots.data() + slots.size(), slots.data() + slots.size()); }
+
+    size_t size() const { return count_; }
+    bool empty() const { return !count_; }
+    size_t capacity() const { return slots.size(); }
+
+    iterator find(handle h)
+    {
+        size_t i = locate(h);
+        return i == NOTFOUND ? end() : iterator(&slots[i], slots.data() + slots.size());
+    }
+
+    const_iterator find(handle h) const
+    {
+        size_t i = locate(h);
+        return i == NOTFOUND ? end() : const_iterator(&slots[i], slots.data() + slots.size());
+    }
+
+    size_t count(handle h) const
+    {
+        return locate(h) != NOTFOUND;
+    }
+
+    pair<iterator, bool> insert(const value_type& v)
+    {
+        assert(v.first != UNDEF);
+
+        if ((count_ + 1) * 4 > slots.size() * 3)
+        {
+            rehash(slots.empty() ? MINCAPACITY : slots.size() * 2);
+        }
+
+        size_t i = ideal(v.first);
+
+        while (slots[i].first != UNDEF)
+        {
+            if (slots[i].first == v.first)
+            {
+                return std::make_pair(iterator(&slots[i], slots.data() + slots.size()), false);
+            }
+
+            i = (i + 1) & mask;
+        }
+
+        slots[i] = v;
+        count_++;
+        return std::make_pair(iterator(&slots[i], slots.data() + slots.size()), true);
+    }
+
+    T& operator[](handle h)
+    {
+        return insert(value_type(h, T())).first->second;
+    }
+
+    size_t erase(handle h)
+    {
+        size_t i = locate(h);
+
+        if (i == NOTFOUND)
+        {
+            return 0;
+        }
+
+        // shift back subsequent entries of the probe run so that no tombstones are needed
+        for (size_t j = (i + 1) & mask; slots[j].first != UNDEF; j = (j + 1) & mask)
+        {
+            size_t k = ideal(slots[j].first);
+
+            if (((j - k) & mask) >= ((j - i) & mask))
+            {
+                slots[i] = std::move(slots[j]);
+                i = j;
+            }
+        }
+
+        slots[i] = value_type(UNDEF, T());
+        count_--;
+        return 1;
+    }
+
+    void clear()
+    {
+        vector<value_type>().swap(slots);
+        count_ = 0;
+        mask = 0;
+        shift = 64;
+    }
+
+    // pre-size the table for n entries, avoiding incremental rehashing
+    void reserve(size_t n)
+    {
+        size_t needed = MINCAPACITY;
+
+        while (needed * 3 < n * 4)
+        {
+            needed *= 2;
+        }
+
+        if (needed > slots.size())
+        {
+            rehash(needed);
+        }
+    }
+
+private:
+    static const size_t MINCAPACITY = 16;
+    static const size_t NOTFOUND = ~(size_t)0;
+
+    vector<value_type> slots;
+    size_t count_ = 0;
+    size_t mask = 0;
+    unsigned shift = 64;
+
+    // Fibonacci hashing: node handles are only 48 bits wide, so spread them over the whole word
+    size_t ideal(handle h) const
+    {
+        return size_t((h * 0x9E3779B97F4A7C15ull) >> shift);
+    }
+
+    size_t locate(handle h) const
+    {
+        if (!count_ || h == UNDEF)
+        {
+            return NOTFOUND;
+        }
+
+        for (size_t i = ideal(h); slots[i].first != UNDEF; i = (i + 1) & mask)
+        {
+            if (slots[i].first == h)
+            {
+                return i;
+            }
+        }
+
+        return NOTFOUND;
+    }
+
+    void rehash(size_t newcapacity)
+    {
+        vector<value_type> old(newcapacity, value_type(UNDEF, T()));
+        old.swap(slots);
+
+        mask = newcapacity - 1;
+        for (shift = 64; newcapacity > 1; newcapacity >>= 1)
+        {
+            shift--;
+        }
+
+        for (value_type& v : old)
+        {
+            if (v.first != UNDEF)
+            {
+                size_t i = ideal(v.first);
+
+                while (slots[i].first != UNDEF)
+                {
+                    i = (i + 1) & mask;
+                }
+
+                slots[i] = std::move(v);
+            }
+        }
+    }
+};
+
 // maps node handles to Node pointers
-typedef map<handle, Node*> node_map;
+typedef handle_hashmap<Node*> node_map;
 
 struct NodeCounter
 {
@@ -394,6 +611,7 @@ typedef list<DirectRead*> dr_list;
 typedef list<DirectReadSlot*> drs_list;
 
 typedef map<const string*, LocalNode*, StringCmp> localnode_map;
+typedef std::unordered_multimap<size_t, LocalNode*> localnodehash_map;
 typedef map<const string*, Node*, StringCmp> remotenode_map;
 
 typedef enum { TREESTATE_NONE = 0, TREESTATE_SYNCED, TREESTATE_PENDING, TREESTATE_SYNCING } treestate_t;
@@ -407,6 +625,9 @@ struct Notification
     dstime timestamp;
     string path;
     LocalNode* localnode;
+
+    // the platform reported that a writer closed the file (IN_CLOSE_WRITE)
+    bool closewrite = false;
 };
 
 typedef deque<Notification> notify_deque;
@@ -539,6 +760,14 @@ typedef enum { RETRY_NONE = 0, RETRY_CONNECTIVITY = 1, RETRY_SERVERS_BUSY = 2, R
 
 typedef enum { STORAGE_UNKNOWN = -9, STORAGE_GREEN = 0, STORAGE_ORANGE = 1, STORAGE_RED = 2, STORAGE_CHANGE = 3 } storagestatus_t;
 
+// the parts of the client whose memory is accounted against MegaClient::setmemorybudget()
+typedef enum { MEMORY_NODES = 0, MEMORY_TRANSFERBUFFERS = 1, MEMORY_DIRECTREADS = 2, MEMORY_RESPONSES = 3, MEMORY_SUBSYSTEMS } memsubsystem_t;
+
+typedef enum { MEMORY_PRESSURE_NONE = 0, MEMORY_PRESSURE_MODERATE = 1, MEMORY_PRESSURE_CRITICAL = 2 } mempressure_t;
+
+// stages of the startup of a session, see MegaClient::stagedstartup
+typedef enum { STARTUP_NODES = 0, STARTUP_SECONDARY = 1, STARTUP_DONE = 2 } startupstage_t;
+
 
 enum SmsVerificationState {
     // These values (except unknown) are delivered from the servers
@@ -584,50 +813,61 @@ unique_ptr<T> make_unique(constructorArgs&&... args)
     return (unique_ptr<T>(new T(std::forward<constructorArgs>(args)...)));
 }
 
-//#define MEGA_MEASURE_CODE   // uncomment this to track time spent in major subsystems, and log it every 2 minutes, with extra control from megacli
+//#define MEGA_MEASURE_CODE   // uncomment this to track time spent in major subsystems from the start, and log it every 2 minutes, with extra control from megacli
 
 namespace CodeCounter
 {
-    // Some classes that allow us to easily measure the number of times a block of code is called, and the sum of the time it takes.
-    // Only enabled if MEGA_MEASURE_CODE is turned on.
-    // Usage generally doesn't need to be protected by the macro as the classes and methods will be empty when not enabled.
+    // Some classes that allow us to easily measure the number of times a block of code is called, the sum of the time it takes,
+    // and how that time is distributed. They are always built in and switched on at runtime with setEnabled(); while off,
+    // a measurement costs a branch.  MEGA_MEASURE_CODE switches them on from the start.
+    // They aren't synchronized: the measured code runs on the client thread, and they are read there or under the SDK mutex.
 
     using namespace std::chrono;
 
+    extern std::atomic<bool> gEnabled;
+    inline bool enabled() { return gEnabled.load(std::memory_order_relaxed); }
+    void setEnabled(bool);
+
+    // latency distribution in four linear buckets per power of two of microseconds,
+    // so that percentiles are within 25% of the exact value
+    struct Histogram
+    {
+        static const unsigned BUCKETS = 160;
+        uint64_t counts[BUCKETS] = {};
+
+        inline void add(high_resolution_clock::duration d)
+        {
+            ++counts[bucket(uint64_t(duration_cast<microseconds>(d).count()))];
+        }
+
+        // upper bound of the bucket reached by that fraction (0..1) of the samples, in microseconds
+        uint64_t percentile(double) const;
+        void reset();
+
+        static unsigned bucket(uint64_t us);
+        static uint64_t upperbound(unsigned bucket);
+    };
+
     struct ScopeStats
     {
-#ifdef MEGA_MEASURE_CODE
         uint64_t count = 0;
         uint64_t starts = 0;
         uint64_t finishes = 0;
         high_resolution_clock::duration timeSpent{};
+        Histogram latency;
         std::string name;
         ScopeStats(std::string s) : name(std::move(s)) {}
 
-        inline string report(bool reset = false) 
-        { 
-            string s = " " + name + ": " + std::to_string(count) + " " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(timeSpent).count()); 
-            if (reset)
-            {
-                count = 0;
-                starts -= finishes;
-                finishes = 0;
-                timeSpent = high_resolution_clock::duration{};
-            }
-            return s;
-        }
-#else
-        ScopeStats(std::string s) {}
-#endif
+        string report(bool reset = false);
+        void reset();
     };
 
     struct DurationSum
     {
-#ifdef MEGA_MEASURE_CODE
         high_resolution_clock::duration sum{ 0 };
         high_resolution_clock::time_point deltaStart;
         bool started = false;
-        inline void start(bool b = true) { if (b && !started) { deltaStart = high_resolution_clock::now(); started = true; }  }
+        inline void start(bool b = true) { if (b && !started && enabled()) { deltaStart = high_resolution_clock::now(); started = true; }  }
         inline void stop(bool b = true) { if (b && started) { sum += high_resolution_clock::now() - deltaStart; started = false; } }
         inline bool inprogress() { return started; }
         inline string report(bool reset = false) 
@@ -636,33 +876,94 @@ namespace CodeCounter
             if (reset) sum = high_resolution_clock::duration{ 0 };
             return s;
         }
-#else
-        inline void start(bool = true) {  }
-        inline void stop(bool = true) {  }
-#endif
+    };
+
+    // Timeline of spans in the Chrome trace-event format (chrome://tracing, Perfetto), recorded
+    // between startTrace() and stopTrace(): the ScopeTimer sites, TraceSpan sites, and async spans
+    // for operations that outlive a scope. Each thread writes to its own ring buffer without locks,
+    // keeping its latest events; the buffers are read at stopTrace()
+    struct TraceEvent
+    {
+        static const size_t NAMELENGTH = 40;
+
+        char name[NAMELENGTH];
+        const char* category;   // a literal
+        char phase;             // 'X' complete, 'b' and 'e' async begin and end
+        uint64_t ts;            // microseconds since startTrace()
+        uint64_t dur;
+        uint64_t id;            // of async spans
+    };
+
+    extern std::atomic<bool> gTracing;
+    inline bool tracing() { return gTracing.load(std::memory_order_relaxed); }
+
+    void startTrace();
+    // stops recording and returns the events as trace-event JSON
+    string stopTrace();
+
+    void traceComplete(const char* category, const char* name, high_resolution_clock::time_point start, high_resolution_clock::duration d);
+    void traceAsync(const char* category, const char* name, char phase, uint64_t id);
+
+    // a span on the timeline, for code that isn't measured with ScopeStats
+    struct TraceSpan
+    {
+        const char* category;
+        const char* name;
+        high_resolution_clock::time_point start;
+        bool traced;
+
+        TraceSpan(const char* c, const char* n) : category(c), name(n), traced(tracing())
+        {
+            if (traced)
+            {
+                start = high_resolution_clock::now();
+            }
+        }
+        ~TraceSpan()
+        {
+            if (traced)
+            {
+                traceComplete(category, name, start, high_resolution_clock::now() - start);
+            }
+        }
     };
 
     struct ScopeTimer
     {
-#ifdef MEGA_MEASURE_CODE
-        ScopeStats& scope;
+        ScopeStats& stats;
+        bool measured;
+        bool traced;
         high_resolution_clock::time_point blockStart;
 
-        ScopeTimer(ScopeStats& sm) : scope(sm), blockStart(high_resolution_clock::now())
+        ScopeTimer(ScopeStats& sm) : stats(sm), measured(enabled()), traced(tracing())
         {
-            ++scope.starts;
+            if (measured || traced)
+            {
+                blockStart = high_resolution_clock::now();
+            }
+            if (measured)
+            {
+                ++stats.starts;
+            }
         }
         ~ScopeTimer()
         {
-            ++scope.count;
-            ++scope.finishes;
-            scope.timeSpent += high_resolution_clock::now() - blockStart;
-        }
-#else
-        ScopeTimer(ScopeStats& sm)
-        {
+            if (measured || traced)
+            {
+                high_resolution_clock::duration d = high_resolution_clock::now() - blockStart;
+                if (measured)
+                {
+                    ++stats.count;
+                    ++stats.finishes;
+                    stats.timeSpent += d;
+                    stats.latency.add(d);
+                }
+                if (traced)
+                {
+                    traceComplete("scope", stats.name.c_str(), blockStart, d);
+                }
+            }
         }
-#endif
     };
 }
 
@@ -114,6 +114,11 @@ public:
     bool isattrvalid(attr_t at);
     void removeattr(attr_t at, const string *version = nullptr);
 
+    // the attribute does not exist (API_ENOENT): cached with an empty value and a version no
+    // attribute has, so the next change reported by an action packet invalidates it
+    void setnonexistentattr(attr_t at);
+    bool isattrnonexistent(attr_t at);
+
     static string attr2string(attr_t at);
     static string attr2longname(attr_t at);
     static attr_t string2attr(const char *name);
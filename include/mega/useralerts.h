@@ -270,6 +270,12 @@ private:
     bool notingSharedNodes;
     handle ignoreNodesUnderShare;
 
+    // the latest alert of new shared nodes by user and folder, for those that follow to merge into
+    map<pair<handle, handle>, UserAlert::NewSharedNodes*> lastSharedNodes;
+
+    // payment reminders still relevant, until a successful payment hides them
+    vector<UserAlert::Base*> relevantReminders;
+
     bool isUnwantedAlert(nameid type, int action);
 
 public:
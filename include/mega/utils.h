@@ -22,6 +22,7 @@
 #ifndef MEGA_UTILS_H
 #define MEGA_UTILS_H 1
 
+#include <mutex>
 #include <type_traits>
 
 #include "types.h"
@@ -422,9 +423,19 @@ int macOSmajorVersion();
 class chunkmac_map : public map<m_off_t, ChunkMAC>
 {
 public:
+    // the finished chunks below foldedpos are no longer in the map: their macs have been chained into foldedmac already,
+    // so that the file mac, resuming and caching only cost the chunks after them
+    m_off_t foldedpos = 0;
+    byte foldedmac[SymmCipher::BLOCKSIZE] = {};
+
     int64_t macsmac(SymmCipher *cipher);
     void serialize(string& d) const;
     bool unserialize(const char*& ptr, const char* end);
+    void serializefolded(string& d) const;
+    bool unserializefolded(const char*& ptr, const char* end);
+    void foldfinished(SymmCipher *cipher, m_off_t fileSize);
+    void clear();
+    void swap(chunkmac_map& other);
     void calcprogress(m_off_t size, m_off_t& chunkpos, m_off_t& completedprogress, m_off_t* lastblockprogress = nullptr);
     m_off_t nextUnprocessedPosFrom(m_off_t pos);
     m_off_t expandUnprocessedPiece(m_off_t pos, m_off_t npos, m_off_t fileSize, m_off_t maxReqSize);
@@ -457,6 +468,7 @@ struct CacheableWriter
 struct CacheableReader
 {
     CacheableReader(const string& d);
+    CacheableReader(const char* data, size_t len);  // reads the buffer in place, which must outlive the reader
     const char* ptr;
     const char* end;
     unsigned fieldnum;
@@ -478,6 +490,103 @@ struct CacheableReader
     void eraseused(string& d); // must be the same string, unchanged
 };
 
+// Hands out fixed-size blocks carved from large slabs, recycling freed blocks through a free list.
+// Used for the millions of small same-sized objects of large accounts (nodes, their children list
+// entries and attribute map entries), avoiding the per-allocation heap header and fragmentation.
+// Pools are shared amongst all MegaClient instances, so thread safety is needed.
+// With threadcache, each thread keeps a few freed blocks aside and trades them with the shared
+// free list in batches, so that threads allocating concurrently rarely meet on the pool mutex.
+// Such a pool must outlive every thread that used it (the process-wide pools are never destroyed).
+class MEGA_API FixedSizePool
+{
+public:
+    FixedSizePool(size_t blocksize, size_t alignment, size_t slabblocks = 4096, bool threadcache = false);
+    ~FixedSizePool();
+
+    void* allocate();
+    void deallocate(void*);
+
+    // blocks / bytes currently handed out (including those kept aside by threads) / bytes obtained from the heap
+    size_t blocksInUse() const;
+    size_t bytesInUse() const;
+    size_t bytesReserved() const;
+
+    // process-wide pool for blocks of the given size and alignment (never destroyed, so it outlives static objects)
+    static FixedSizePool& forSize(size_t blocksize, size_t alignment);
+
+    // sum of bytesReserved() over all process-wide pools
+    static size_t totalBytesReserved();
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    struct ThreadCache;
+    ThreadCache* threadCache();
+
+    // move blocks between the shared free list and a caller's chain under the pool mutex
+    FreeBlock* acquire(size_t count);
+    void release(FreeBlock* head, FreeBlock* tail, size_t count);
+
+    const size_t mBlockSize;
+    const size_t mSlabBlocks;
+    const bool mThreadCache;
+    vector<char*> mSlabs;
+    FreeBlock* mFreeList = nullptr;
+    size_t mSlabUsed;
+    size_t mBlocksInUse = 0;
+    mutable std::mutex mMutex;
+
+    FixedSizePool(const FixedSizePool&) = delete;
+    FixedSizePool& operator=(const FixedSizePool&) = delete;
+};
+
+// STL allocator serving single-object allocations from the matching FixedSizePool (node based containers)
+template<class T>
+struct PoolAllocator
+{
+    typedef T value_type;
+
+    PoolAllocator() = default;
+    template<class U> PoolAllocator(const PoolAllocator<U>&) { }
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(n == 1 ? pool().allocate() : ::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        n == 1 ? pool().deallocate(p) : ::operator delete(p);
+    }
+
+    static FixedSizePool& pool()
+    {
+        static FixedSizePool& p = FixedSizePool::forSize(sizeof(T), alignof(T));
+        return p;
+    }
+
+    template<class U> struct rebind { typedef PoolAllocator<U> other; };
+};
+
+template<class T, class U> bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) { return true; }
+template<class T, class U> bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) { return false; }
+
+// Instruction set extensions of the x86 CPU running the process (all false elsewhere), for the
+// routines built with the matching target attribute and selected at runtime (base64, CRC32, RAID)
+struct MEGA_API CpuFeatures
+{
+    bool ssse3 = false;
+    bool sse41 = false;
+    bool pclmul = false;
+    bool avx2 = false;
+
+    // detected once
+    static const CpuFeatures& get();
+};
+
 template<typename T, typename U>
 void hashCombine(T& seed, const U& v)
 {
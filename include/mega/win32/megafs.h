@@ -31,10 +31,20 @@ struct MEGA_API WinDirAccess : public DirAccess
     WIN32_FIND_DATAW ffd;
     HANDLE hFind;
     string globbase;
+    bool globbing;
+
+    // bulk enumeration with GetFileInformationByHandleEx(FileIdBothDirectoryInfo), which returns
+    // the same file IDs as WinFileAccess along with the sizes and mtimes
+    HANDLE hDir;
+    bool bulkfailed;
+    std::vector<LONGLONG> bulkbuf;
+    size_t bulkpos;
+    size_t bulklen;
 
 public:
     bool dopen(string*, FileAccess*, bool) override;
     bool dnext(string*, string*, bool, nodetype_t*) override;
+    bool dnextstat(string*, DirEntry*, bool) override;
 
     WinDirAccess();
     virtual ~WinDirAccess();
@@ -84,6 +94,12 @@ public:
     ~WinFileSystemAccess();
 
     std::set<WinDirNotify*> dirnotifys;
+
+    // size of the change notification buffers of the syncs added from now on.  Network shares are limited to
+    // 64 KB, which is used there instead
+    static const size_t NOTIFY_BUFFER_SIZE = 1048576;
+    static const size_t NOTIFY_NETWORK_BUFFER_SIZE = 65534;
+    size_t notifybuffersize;
 };
 
 struct MEGA_API WinDirNotify : public DirNotify
@@ -96,6 +112,10 @@ struct MEGA_API WinDirNotify : public DirNotify
 
     HANDLE hDirectory;
 
+    // the volume, kept open to take the journal position before each read of changes
+    HANDLE hVolume;
+    string readcursor;
+
     bool enabled;
     bool exit;
     int active;
@@ -113,7 +133,12 @@ struct MEGA_API WinDirNotify : public DirNotify
     fsfp_t fsfingerprint() const override;
     bool fsstableids() const override;
 
-    WinDirNotify(string*, string*);
+    // the volume's NTFS USN journal, the cursor being its id and next USN
+    bool journalcursor(string*) override;
+    bool journalchanges(const string&, const journalchange_callback&) override;
+    HANDLE openvolume() const;
+
+    WinDirNotify(string*, string*, size_t = WinFileSystemAccess::NOTIFY_BUFFER_SIZE);
     ~WinDirNotify();
 };
 
@@ -141,6 +166,7 @@ public:
     void updatelocalname(string*) override;
     bool fread(string *, unsigned, unsigned, m_off_t);
     bool fwrite(const byte *, unsigned, m_off_t);
+    bool fpreallocate(m_off_t) override;
 
     bool sysread(byte *, unsigned, m_off_t) override;
     bool sysstat(m_time_t*, m_off_t*) override;
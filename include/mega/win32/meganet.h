@@ -38,6 +38,13 @@ typedef LPVOID HINTERNET;   // from <winhttp.h>
 #endif
 #endif
 
+// nor do older SDKs have the HTTP/2 options (Windows 10 1607 and later)
+#ifndef WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL
+#define WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL 133
+#define WINHTTP_OPTION_HTTP_PROTOCOL_USED 134
+#define WINHTTP_PROTOCOL_FLAG_HTTP2 0x1
+#endif
+
 namespace mega {
 extern bool debug;
 
@@ -52,8 +59,17 @@ protected:
     string proxyUsername;
     string proxyPassword;
 
+    // connection handles by scheme, host and port, shared by all requests to that server
+    // so that WinHTTP keeps reusing its pooled connections
+    map<string, HINTERNET> connections;
+    HINTERNET connect(const WCHAR* host, WORD port, bool https);
+
+    bool http2;
+    void applyhttp2();
+
 public:
-    static const unsigned HTTP_POST_CHUNK_SIZE = 16384;
+    // each chunk is a round trip through the callback: keep them large enough not to starve fast uplinks
+    static const unsigned HTTP_POST_CHUNK_SIZE = 131072;
 
     static VOID CALLBACK asynccallback(HINTERNET, DWORD_PTR, DWORD,
                                        LPVOID lpvStatusInformation,
@@ -78,6 +94,9 @@ public:
     void setuseragent(string*);
     void setproxy(Proxy *);
 
+    bool sethttp2(bool enable);
+    bool multiplexes() const;
+
     WinHttpIO();
     ~WinHttpIO();
 };
@@ -85,7 +104,7 @@ public:
 struct MEGA_API WinHttpContext
 {
     HINTERNET hRequest;
-    HINTERNET hConnect;
+    HINTERNET hConnect;             // owned by WinHttpIO (shared)
 
     HttpReq* req;                   // backlink to underlying HttpReq
     WinHttpIO* httpio;              // backlink to application-wide WinHttpIO object
@@ -97,6 +116,12 @@ struct MEGA_API WinHttpContext
     bool gzip;
     z_stream z;
     string zin;
+
+    // for the connection statistics and the time to first byte
+    bool https;
+    bool newconnection;
+    ULONGLONG started;
+    int ttfbms;
 };
 } // namespace
 
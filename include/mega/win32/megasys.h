@@ -55,6 +55,8 @@
 #include <string>   // the MEGA SDK assumes writable, contiguous string::data()
 #include <sstream>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <deque>
 #include <set>
 #include <iterator>
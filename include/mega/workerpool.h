@@ -0,0 +1,115 @@
+/**
+ * @file mega/workerpool.h
+ * @brief Threads shared by the parallel parts of the SDK
+ *
+ * (c) 2013-2020 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGA_WORKERPOOL_H
+#define MEGA_WORKERPOOL_H 1
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "types.h"
+
+namespace mega {
+// one set of threads for the work that the SDK spreads over the cores while the caller waits, instead of each
+// part starting threads of its own.  A job is split into tasks that the caller and the threads claim one at a
+// time, so the caller always makes progress, even with every thread busy.  The classes are also priorities: a
+// free thread takes the tasks of the first class below its cap
+class MEGA_API WorkerPool
+{
+public:
+    enum workclass_t
+    {
+        WORK_NODES,     // node keys, attributes, signatures and tree walks, with the client waiting
+        WORK_FILES,     // fingerprints and encryption of local files
+        WORK_GFX,       // decoding and resizing of images, and extraction of media properties, behind the gfx thread
+        WORK_CLASSES
+    };
+
+    // the pool of the process
+    static WorkerPool& get();
+
+    // how many threads (the caller included) can work on a job of the class right now: run()'s task count
+    unsigned parallelism(workclass_t);
+
+    // run fn(i) for every i in [0, tasks), once each, and return when all have run
+    void run(workclass_t, size_t tasks, const std::function<void(size_t)>& fn);
+
+    // the threads (0 runs everything in the caller), started when the first job needs them.  -1: one per core
+    void setthreads(int threads);
+    unsigned threads();
+
+    // at most this many threads on the jobs of a class at once (0: no cap)
+    void setclasslimit(workclass_t, unsigned maxthreads);
+
+    // pin the threads to the cores of the mask (bit i: core i), on the platforms that support it.  0: don't
+    void setaffinity(uint64_t cpumask);
+
+    struct ClassStats
+    {
+        uint64_t jobs = 0;
+        uint64_t tasks = 0;
+        uint64_t queuedtasks = 0;   // of them, run by a thread of the pool
+        double totalqueueseconds = 0;
+        double maxqueueseconds = 0;
+    };
+    ClassStats stats(workclass_t);
+
+    static const char* classname(workclass_t);
+
+    WorkerPool() = default;
+    ~WorkerPool();
+    MEGA_DISABLE_COPY_MOVE(WorkerPool)
+
+private:
+    struct Job;
+
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::deque<std::shared_ptr<Job>> queued[WORK_CLASSES];
+    unsigned running[WORK_CLASSES] = {};
+    unsigned limits[WORK_CLASSES] = {};
+    ClassStats classstats[WORK_CLASSES];
+
+    std::vector<std::thread> workers;
+    int wantedthreads = -1;
+    uint64_t affinity = 0;
+    bool started = false;
+
+    // the threads of older generations (before setthreads() or the destructor) exit
+    unsigned generation = 0;
+
+    void startthreads();
+    void stopthreads(std::unique_lock<std::mutex>&);
+    std::shared_ptr<Job> nextjob(workclass_t*);
+    void workerLoop(unsigned generation);
+    void pin(std::thread&);
+
+    // claim and run the tasks of the job until there are none left, and return how many
+    static size_t work(Job&, ClassStats* queuestats);
+};
+} // namespace
+
+#endif
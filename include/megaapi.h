@@ -69,6 +69,7 @@ class MegaEvent;
 class MegaTransfer;
 class MegaBackup;
 class MegaSync;
+class MegaSyncStats;
 class MegaStringList;
 class MegaNodeList;
 class MegaUserList;
@@ -2760,6 +2761,9 @@ class MegaRequest
             TYPE_GET_REGISTERED_CONTACTS, TYPE_GET_COUNTRY_CALLING_CODES,
             TYPE_VERIFY_CREDENTIALS, TYPE_GET_MISC_FLAGS, TYPE_RESEND_VERIFICATION_EMAIL,
             TYPE_SUPPORT_TICKET,
+            TYPE_MOVE_NODES, TYPE_REMOVE_NODES, TYPE_SET_ATTR_NODES,
+            TYPE_CHAT_GRANT_ACCESS_NODES, TYPE_CHAT_REMOVE_ACCESS_NODES,
+            TYPE_SEARCH,
             TOTAL_OF_REQUEST_TYPES
         };
 
@@ -3413,6 +3417,19 @@ class MegaRequest
          */
         virtual MegaFolderInfo *getMegaFolderInfo() const;
 
+        /**
+         * @brief Returns a list of nodes
+         *
+         * The SDK retains the ownership of the returned value. It will be valid until
+         * the MegaRequest object is deleted.
+         *
+         * This value is valid for these requests in onRequestUpdate:
+         * - MegaApi::searchInPages - Returns the nodes of the latest page of results
+         *
+         * @return List of nodes
+         */
+        virtual MegaNodeList *getMegaNodeList() const;
+
         /**
          * @brief Returns settings for push notifications
          *
@@ -3464,6 +3481,8 @@ public:
         EVENT_BUSINESS_STATUS           = 9,
         EVENT_KEY_MODIFIED              = 10,
         EVENT_MISC_FLAGS_READY          = 11,
+        EVENT_MEMORY_PRESSURE           = 12,
+        EVENT_STARTUP_STAGE             = 13,
     };
 
     virtual ~MegaEvent();
@@ -3770,6 +3789,36 @@ class MegaTransfer
          */
         virtual long long getMeanSpeed() const;
 
+        /**
+         * @brief Returns the number of connections this transfer is using
+         *
+         * It changes during the transfer when MegaApi::setAutoConnections is enabled.
+         *
+         * @return Number of connections of this transfer, 0 if it is not in progress
+         */
+        virtual int getNumConnections() const;
+
+        /**
+         * @brief Returns the time from the start of the transfer to its first data
+         *
+         * It's measured from the moment the storage servers of the transfer are known, so it
+         * includes the name resolution, the connection and the TLS handshake, or their savings.
+         *
+         * @return Milliseconds to the first data, -1 if nothing has been transferred yet
+         */
+        virtual int getTimeToFirstByte() const;
+
+        /**
+         * @brief Returns the number of bytes this upload didn't have to send
+         *
+         * When a file with the same fingerprint already exists in the account, the upload
+         * completes by copying that node (or, in the same folder and with the same name, by
+         * reusing it) and only the fingerprint of the local file is read.
+         *
+         * @return Size of the file if the upload was completed without sending it, 0 otherwise
+         */
+        virtual long long getSavedBytes() const;
+
         /**
 		 * @brief Returns the number of bytes transferred since the previous callback
 		 * @return Number of bytes transferred since the previous callback
@@ -4376,6 +4425,40 @@ public:
     virtual void enableChats(bool enable);
 };
 
+/**
+ * @brief A piece of the data of a streaming transfer, lent to the app without copying
+ *
+ * Objects of this class are provided by MegaTransferListener::onTransferBuffer for the transfers
+ * started with MegaApi::startStreamingBuffers. The data is decrypted into this buffer by the SDK
+ * and stays valid until the object is deleted, which gives the memory back to the SDK. It can be
+ * deleted from any thread.
+ *
+ * While the app holds the limit of bytes of its transfer, the transfer waits for it to delete some.
+ */
+class MegaTransferBuffer
+{
+public:
+    virtual ~MegaTransferBuffer();
+
+    /**
+     * @brief Returns the data of the piece
+     * @return Pointer to the data, valid until this object is deleted
+     */
+    virtual const char *getData() const;
+
+    /**
+     * @brief Returns the size of the piece
+     * @return Number of bytes provided by MegaTransferBuffer::getData
+     */
+    virtual size_t getSize() const;
+
+    /**
+     * @brief Returns the position of the piece in the file
+     * @return Offset of the first byte of the piece
+     */
+    virtual long long getOffset() const;
+};
+
 /**
  * @brief Provides information about transfer queues
  *
@@ -4857,6 +4940,144 @@ public:
     virtual int getState() const;
 };
 
+/**
+ * @brief Provides a snapshot of the queues and counters of a synchronization
+ *
+ * Taking it is cheap enough to monitor a synchronization every second.
+ *
+ * @see MegaApi::getSyncStats
+ */
+class MegaSyncStats
+{
+public:
+    virtual ~MegaSyncStats();
+
+    /**
+     * @brief Creates a copy of this MegaSyncStats object
+     *
+     * You are the owner of the returned object
+     *
+     * @return Copy of the MegaSyncStats object
+     */
+    virtual MegaSyncStats *copy() const;
+
+    /**
+     * @brief Returns the identifier of the synchronization
+     * @return Identifier of the synchronization
+     */
+    virtual int getTag() const;
+
+    /**
+     * @brief Returns the number of filesystem notifications waiting to be processed
+     * @return Number of pending filesystem notifications
+     */
+    virtual long long getQueuedNotifications() const;
+
+    /**
+     * @brief Returns the number of paths waiting to be checked again after a transient error
+     * @return Number of paths to be retried
+     */
+    virtual long long getQueuedRetries() const;
+
+    /**
+     * @brief Returns the number of notifications whose processing is delayed on purpose
+     *
+     * This queue is only used by synchronizations of network folders.
+     *
+     * @return Number of delayed notifications
+     */
+    virtual long long getQueuedDelayed() const;
+
+    /**
+     * @brief Returns how long the oldest notification of any queue has been waiting
+     * @return Age of the oldest pending notification, in milliseconds
+     */
+    virtual long long getQueueLag() const;
+
+    /**
+     * @brief Returns the number of directory entries visited by scans since the synchronization started
+     * @return Number of scanned entries
+     */
+    virtual long long getScannedEntries() const;
+
+    /**
+     * @brief Returns the number of directory entries scanned per second, over the last second or so
+     * @return Scanned entries per second
+     */
+    virtual long long getScanRate() const;
+
+    /**
+     * @brief Returns the number of local folders waiting to be created in MEGA
+     * @return Number of pending folder creations
+     */
+    virtual long long getPendingFolderCreations() const;
+
+    /**
+     * @brief Returns the number of files and folders that vanished locally and are
+     * waiting to be confirmed as deleted
+     * @return Number of vanished files and folders
+     */
+    virtual long long getVanishedNodes() const;
+
+    /**
+     * @brief Returns the number of downloads started by the synchronization that haven't finished
+     * @return Number of pending downloads
+     */
+    virtual long long getQueuedDownloads() const;
+
+    /**
+     * @brief Returns the number of uploads started by the synchronization that haven't finished
+     * @return Number of pending uploads
+     */
+    virtual long long getQueuedUploads() const;
+
+    /**
+     * @brief Returns the number of times the local state cache has been written
+     * @return Number of state cache flushes
+     */
+    virtual long long getStateCacheFlushes() const;
+
+    /**
+     * @brief Returns the time spent writing the local state cache
+     * @return Total duration of the state cache flushes, in milliseconds
+     */
+    virtual long long getStateCacheFlushTime() const;
+
+    /**
+     * @brief Returns the duration of the last state cache flush
+     * @return Duration of the last state cache flush, in milliseconds
+     */
+    virtual long long getLastStateCacheFlushTime() const;
+
+    /**
+     * @brief Returns the number of uploads for which the lag has been measured
+     *
+     * The lag of an upload goes from the last filesystem notification about the file
+     * to the creation of its node in MEGA.
+     *
+     * @return Number of measured uploads
+     */
+    virtual long long getLagSamples() const;
+
+    /**
+     * @brief Returns the lag of the last upload
+     * @return Lag of the last upload, in milliseconds
+     */
+    virtual long long getLastLag() const;
+
+    /**
+     * @brief Returns the largest lag of an upload
+     * @return Largest lag, in milliseconds
+     */
+    virtual long long getMaxLag() const;
+
+    /**
+     * @brief Returns the average lag of the uploads
+     * @return Average lag, in milliseconds
+     */
+    virtual long long getAverageLag() const;
+};
+
 #endif
 
 
@@ -5679,6 +5900,29 @@ class MegaTransferListener
          * @see MegaApi::startStreaming
          */
         virtual bool onTransferData(MegaApi *api, MegaTransfer *transfer, char *buffer, size_t size);
+
+        /**
+         * @brief This function is called with the data of the downloads started with MegaApi::startStreamingBuffers
+         *
+         * Instead of a buffer that is only valid during the call, the app receives the buffer that the
+         * SDK decrypted the data into, and gives it back by deleting it, from any thread, when it is done
+         * with it. While the app holds the limit of bytes passed to MegaApi::startStreamingBuffers, the
+         * download waits.
+         *
+         * You take the ownership of the buffer parameter. The SDK retains the ownership of the
+         * transfer parameter. Don't use it after this functions returns.
+         *
+         * The default implementation passes the data to MegaTransferListener::onTransferData, and
+         * deletes the buffer.
+         *
+         * @param api MegaApi object that started the transfer
+         * @param transfer Information about the transfer
+         * @param buffer Piece of the data, and its position in the file
+         * @return true to continue the transfer, false to cancel it
+         *
+         * @see MegaApi::startStreamingBuffers
+         */
+        virtual bool onTransferBuffer(MegaApi *api, MegaTransfer *transfer, MegaTransferBuffer *buffer);
 };
 
 
@@ -6010,6 +6254,18 @@ class MegaGlobalListener
          *
          * - MegaEvent::EVENT_MISC_FLAGS_READY: when the miscellaneous flags are available/updated.
          *
+         * - MegaEvent::EVENT_MEMORY_PRESSURE: when the memory used crosses a threshold of the budget
+         * set with MegaApi::setMemoryBudget.
+         *
+         * For this event type, MegaEvent::getNumber provides the new level, one of
+         * MegaApi::MEMORY_PRESSURE_NONE, MegaApi::MEMORY_PRESSURE_MODERATE or MegaApi::MEMORY_PRESSURE_CRITICAL
+         *
+         * - MegaEvent::EVENT_STARTUP_STAGE: when a staged startup (see MegaApi::setStagedStartup) reaches
+         * a stage.
+         *
+         * For this event type, MegaEvent::getNumber provides the stage, MegaApi::STARTUP_STAGE_SECONDARY
+         * or MegaApi::STARTUP_STAGE_DONE
+         *
          * @param api MegaApi object connected to the account
          * @param event Details about the event
          */
@@ -6514,6 +6770,18 @@ class MegaListener
          *
          * - MegaEvent::EVENT_MISC_FLAGS_READY: when the miscellaneous flags are available/updated.
          *
+         * - MegaEvent::EVENT_MEMORY_PRESSURE: when the memory used crosses a threshold of the budget
+         * set with MegaApi::setMemoryBudget.
+         *
+         * For this event type, MegaEvent::getNumber provides the new level, one of
+         * MegaApi::MEMORY_PRESSURE_NONE, MegaApi::MEMORY_PRESSURE_MODERATE or MegaApi::MEMORY_PRESSURE_CRITICAL
+         *
+         * - MegaEvent::EVENT_STARTUP_STAGE: when a staged startup (see MegaApi::setStagedStartup) reaches
+         * a stage.
+         *
+         * For this event type, MegaEvent::getNumber provides the stage, MegaApi::STARTUP_STAGE_SECONDARY
+         * or MegaApi::STARTUP_STAGE_DONE
+         *
          * @param api MegaApi object connected to the account
          * @param event Details about the event
          */
@@ -6579,7 +6847,8 @@ public:
      * the 'adjustsizeonly' parameter, and iterating from the start of the file, specifying the approximate sizes of the portions.
      *
      * Encryption is done by reading small pieces of the file, encrypting them, and outputting to the new file,
-     * so that RAM usage is not excessive.
+     * so that RAM usage is not excessive. The pieces are encrypted on several threads at once, so that
+     * encryption keeps pace with the storage. Progress may be followed with MegaBackgroundMediaUpload::getEncryptedBytes.
      *
      * You take ownership of the returned value.
      *
@@ -6597,6 +6866,16 @@ public:
      */
     virtual char *encryptFile(const char* inputFilepath, int64_t startPos, int64_t* length, const char* outputFilepath, bool adjustsizeonly);
 
+    /**
+     * @brief Get the number of bytes encrypted so far by MegaBackgroundMediaUpload::encryptFile
+     *
+     * This function can be called from another thread while MegaBackgroundMediaUpload::encryptFile runs,
+     * in order to show its progress. Once it returns, this is the size of the portion encrypted by it.
+     *
+     * @return The number of bytes encrypted by the current or the last call to MegaBackgroundMediaUpload::encryptFile
+     */
+    virtual int64_t getEncryptedBytes();
+
     /**
      * @brief Retrieves the value of the uploadURL once it has been successfully requested via MegaApi::backgroundMediaUploadRequestUploadURL
      *
@@ -7028,6 +7307,24 @@ class MegaApi
          */
         void addGlobalListener(MegaGlobalListener* listener);
 
+        /**
+         * @brief Register a listener to receive the node updates of one folder only
+         *
+         * The listener only gets MegaGlobalListener::onNodesUpdate, with the nodes of the update
+         * that are the folder itself or its children (or, if \c recursive is true, anywhere below
+         * it), and isn't called for updates without any of them. Nodes that were moved are always
+         * included, because they may have left the folder. When all the nodes are reloaded, the
+         * listener gets NULL, as global listeners do.
+         *
+         * Calling it again for the same listener replaces its folder. You can use
+         * MegaApi::removeNodeListener or MegaApi::removeGlobalListener to stop receiving events.
+         *
+         * @param listener Listener that will receive the node updates of the folder
+         * @param parentHandle Handle of the folder
+         * @param recursive True to receive the updates of the whole subtree of the folder
+         */
+        void addNodeListener(MegaGlobalListener* listener, MegaHandle parentHandle, bool recursive);
+
 #ifdef ENABLE_SYNC
         /**
          * @brief Add a listener for all events related to synchronizations
@@ -7090,6 +7387,15 @@ class MegaApi
          */
         void removeGlobalListener(MegaGlobalListener* listener);
 
+        /**
+         * @brief Unregister a listener added with MegaApi::addNodeListener
+         *
+         * This listener won't receive more node updates.
+         *
+         * @param listener Object that is unregistered
+         */
+        void removeNodeListener(MegaGlobalListener* listener);
+
         /**
          * @brief Get the current request
          *
@@ -7630,6 +7936,26 @@ class MegaApi
          */
         void loginToFolder(const char* megaFolderLink, MegaRequestListener *listener = NULL);
 
+        /**
+         * @brief Log in to a folder of a public folder link, without loading the rest of the link
+         *
+         * As MegaApi::loginToFolder, but MegaApi::fetchNodes then only loads the nodes of that
+         * folder and its descendants, skipping the others as the response is received, and the
+         * folder becomes the root node (MegaApi::getRootNode). Use it to open a subfolder of a
+         * large link without keeping the whole tree in memory.
+         *
+         * The associated request type with this request is MegaRequest::TYPE_LOGIN.
+         * Valid data in the MegaRequest object received on callbacks:
+         * - MegaRequest::getEmail - Retuns the string "FOLDER"
+         * - MegaRequest::getLink - Returns the public link to the folder
+         * - MegaRequest::getNodeHandle - Returns the handle of the folder to load
+         *
+         * @param megaFolderLink Public link to a folder in MEGA
+         * @param subtree Handle of the folder of the link to load
+         * @param listener MegaRequestListener to track this request
+         */
+        void loginToFolderSubtree(const char* megaFolderLink, MegaHandle subtree, MegaRequestListener *listener = NULL);
+
         /**
          * @brief Log in to a MEGA account using precomputed keys
          *
@@ -8647,6 +8973,44 @@ class MegaApi
          */
         static void setLogToConsole(bool enable);
 
+        /**
+         * @brief Deliver the logs to the MegaLogger objects from a background thread
+         *
+         * By default, the messages are delivered on the thread that logs them, which waits for
+         * a lock and for the MegaLogger objects. When enabled, messages are queued without locks and
+         * a background thread delivers them in order, so MegaLogger::log is always called from
+         * that thread.
+         *
+         * Under pressure, messages are dropped: when the queue is full (8192 messages), and beyond
+         * rateLimit debug and info messages per second from the same line of code. Warnings and errors
+         * are not rate limited. The number of dropped messages is logged as a warning every second.
+         * A fatal message waits until it has been delivered.
+         *
+         * When disabled, the queued messages are delivered before this function returns.
+         *
+         * @param enable True to log asynchronously, false to log on the calling thread (the default)
+         * @param rateLimit Maximum number of debug and info messages per second from each line of code,
+         * or 0 for no limit
+         */
+        static void setLogAsync(bool enable, unsigned rateLimit = 1000);
+
+        /**
+         * @brief Also write the logs to a file in a compact binary format
+         *
+         * Each message is stored as its time, thread, level and source, and the message split into
+         * a template and its variable parts (numbers, handles, ids...). Templates and sources are
+         * stored once. This is usually an order of magnitude smaller than the text, and cheaper to
+         * write. The tests/tool/binlog_decode tool renders the file as text.
+         *
+         * The MegaLogger objects, if any, still receive the messages. The log level applies
+         * too (see MegaApi::setLogLevel). With MegaApi::setLogAsync, the file is written by
+         * the background thread, with the time and the thread of the original message.
+         *
+         * @param path Path of the file, which is overwritten, or NULL to stop writing it
+         * @return false if the file couldn't be created, otherwise true
+         */
+        static bool setBinaryLog(const char* path);
+
         /**
          * @brief Add a MegaLogger implementation to receive SDK logs
          *
@@ -8773,6 +9137,40 @@ class MegaApi
          */
         void moveNode(MegaNode* node, MegaNode* newParent, const char* newName, MegaRequestListener *listener = NULL);
 
+        /**
+         * @brief Move many nodes in the MEGA account to the same folder
+         *
+         * The commands for all the nodes are sent to MEGA together, so moving a big selection
+         * costs a few requests instead of one per node.
+         * Nodes that can't be moved get their own error code in the results, and don't fail the
+         * request: it finishes with MegaError::API_OK when every node succeeded, otherwise with
+         * MegaError::API_EINCOMPLETE. The changes to the nodes are applied locally in one pass,
+         * so they are notified together by an onNodesUpdate callback.
+         *
+         * Unlike MegaApi::moveNode, nodes that can only be moved by copying them to another tree
+         * (i.e. from an incoming share to the account) are not copied: their result is
+         * MegaError::API_EACCESS.
+         *
+         * The associated request type with this request is MegaRequest::TYPE_MOVE_NODES
+         * Valid data in the MegaRequest object received on callbacks:
+         * - MegaRequest::getParentHandle - Returns the handle of the new parent for the nodes
+         * - MegaRequest::getTotalBytes - Returns the number of nodes
+         * - MegaRequest::getTransferredBytes - Returns the number of nodes done
+         * - MegaRequest::getNumDetails - Returns the number of nodes that failed
+         *
+         * Valid data in the MegaRequest object received in onRequestFinish:
+         * - MegaRequest::getMegaStringMap - Returns the error code of each node (as a decimal
+         * string), by the Base64 handle of the node
+         *
+         * If the MEGA account is a business account and it's status is expired, onRequestFinish will
+         * be called with the error code MegaError::API_EBUSINESSPASTDUE.
+         *
+         * @param nodes Nodes to move
+         * @param newParent New parent for the nodes
+         * @param listener MegaRequestListener to track this request
+         */
+        void moveNodes(MegaNodeList* nodes, MegaNode* newParent, MegaRequestListener *listener = NULL);
+
         /**
          * @brief Copy a node in the MEGA account
          *
@@ -8869,6 +9267,35 @@ class MegaApi
          */
         void removeVersions(MegaRequestListener *listener = NULL);
 
+        /**
+         * @brief Remove many nodes from the MEGA account
+         *
+         * As MegaApi::remove, this function doesn't move the nodes to the Rubbish Bin, it fully
+         * removes them, with their previous versions. The commands for all the nodes are sent to
+         * MEGA together, so removing a big selection costs a few requests instead of one per node.
+         * Nodes that can't be removed get their own error code in the results, and don't fail the
+         * request: it finishes with MegaError::API_OK when every node succeeded, otherwise with
+         * MegaError::API_EINCOMPLETE. The changes to the nodes are applied locally in one pass,
+         * so they are notified together by an onNodesUpdate callback.
+         *
+         * The associated request type with this request is MegaRequest::TYPE_REMOVE_NODES
+         * Valid data in the MegaRequest object received on callbacks:
+         * - MegaRequest::getTotalBytes - Returns the number of nodes
+         * - MegaRequest::getTransferredBytes - Returns the number of nodes done
+         * - MegaRequest::getNumDetails - Returns the number of nodes that failed
+         *
+         * Valid data in the MegaRequest object received in onRequestFinish:
+         * - MegaRequest::getMegaStringMap - Returns the error code of each node (as a decimal
+         * string), by the Base64 handle of the node
+         *
+         * If the MEGA account is a sub-user business account, onRequestFinish will
+         * be called with the error code MegaError::API_EMASTERONLY.
+         *
+         * @param nodes Nodes to remove
+         * @param listener MegaRequestListener to track this request
+         */
+        void removeNodes(MegaNodeList* nodes, MegaRequestListener *listener = NULL);
+
         /**
          * @brief Remove a version of a file from the MEGA account
          *
@@ -8972,6 +9399,11 @@ class MegaApi
          * - MegaRequest::getEmail - Returns the email of the user that receives the shared folder
          * - MegaRequest::getAccess - Returns the access that is granted to the user
          *
+         * When a large folder is shared for the first time, its node keys are sent in several parts, and
+         * onRequestUpdate reports them:
+         * - MegaRequest::getTransferredBytes - Returns the parts sent so far
+         * - MegaRequest::getTotalBytes - Returns the number of parts
+         *
          * If the MEGA account is a business account and it's status is expired, onRequestFinish will
          * be called with the error code MegaError::API_EBUSINESSPASTDUE.
          *
@@ -9003,6 +9435,11 @@ class MegaApi
          * - MegaRequest::getEmail - Returns the email of the user that receives the shared folder
          * - MegaRequest::getAccess - Returns the access that is granted to the user
          *
+         * When a large folder is shared for the first time, its node keys are sent in several parts, and
+         * onRequestUpdate reports them:
+         * - MegaRequest::getTransferredBytes - Returns the parts sent so far
+         * - MegaRequest::getTotalBytes - Returns the number of parts
+         *
          * If the MEGA account is a business account and it's status is expired, onRequestFinish will
          * be called with the error code MegaError::API_EBUSINESSPASTDUE.
          *
@@ -9169,6 +9606,63 @@ class MegaApi
          */
         void getPreview(MegaNode* node, const char *dstFilePath, MegaRequestListener *listener = NULL);
 
+        /**
+         * @brief Fetch the thumbnails of a list of nodes in advance
+         *
+         * The thumbnails are downloaded in batches, grouped by storage cluster, and kept in
+         * a local cache so that later calls to MegaApi::getThumbnail for those nodes complete
+         * without network access. Nodes without a thumbnail, and thumbnails already in the
+         * cache, are skipped. No callbacks are received for the prefetched thumbnails.
+         *
+         * The local cache is only available for accounts with a local node cache (logged in
+         * with MegaApi::login or MegaApi::fastLogin and a base path).
+         *
+         * @param nodes Handles of the nodes
+         * @return Number of thumbnails queued for download
+         */
+        int prefetchThumbnails(MegaHandleList *nodes);
+
+        /**
+         * @brief Fetch the previews of a list of nodes in advance
+         *
+         * Same as MegaApi::prefetchThumbnails, but for previews.
+         *
+         * @param nodes Handles of the nodes
+         * @return Number of previews queued for download
+         */
+        int prefetchPreviews(MegaHandleList *nodes);
+
+        /**
+         * @brief Set the maximum size of the local cache of thumbnails and previews
+         *
+         * When the cache grows beyond this size, the least recently used entries are
+         * discarded. The default size is 64 MB. Setting a size of 0 disables the cache and
+         * removes it from disk.
+         *
+         * @param bytes Maximum size of the cache, in bytes
+         */
+        void setFileAttributeCacheSize(long long bytes);
+
+        /**
+         * @brief Prefetch what the app is likely to show next while it browses folders
+         *
+         * When enabled, each call to MegaApi::getChildren or MegaApi::getChildrenPage is followed,
+         * in the background, by:
+         * - the prefetch of the thumbnails of the nodes listed and of the next page, in a few wide
+         *   batches (see MegaApi::prefetchThumbnails), so that the calls to MegaApi::getThumbnail
+         *   for the visible nodes don't wait for a round trip each
+         * - the sorting of the children of the first subfolders, in the same order, so that
+         *   listing one of them next doesn't have to sort it
+         *
+         * The thumbnails prefetched for a folder and not downloaded yet are cancelled when the app
+         * lists another one.
+         *
+         * By default, this is disabled.
+         *
+         * @param pageSize Number of nodes the app shows at once (0 disables the prefetch)
+         */
+        void setBrowsePrefetch(int pageSize);
+
         /**
          * @brief Get the avatar of a MegaUser
          *
@@ -9762,6 +10256,40 @@ class MegaApi
          */
         void setCustomNodeAttribute(MegaNode *node, const char *attrName, const char* value, MegaRequestListener *listener = NULL);
 
+        /**
+         * @brief Set a custom attribute for many nodes
+         *
+         * As MegaApi::setCustomNodeAttribute, for every node of the list. The commands for all the
+         * nodes are sent to MEGA together, so a big selection costs a few requests instead of one
+         * per node.
+         * Nodes that can't be updated get their own error code in the results, and don't fail the
+         * request: it finishes with MegaError::API_OK when every node succeeded, otherwise with
+         * MegaError::API_EINCOMPLETE. The changes to the nodes are applied locally in one pass,
+         * so they are notified together by an onNodesUpdate callback.
+         *
+         * The associated request type with this request is MegaRequest::TYPE_SET_ATTR_NODES
+         * Valid data in the MegaRequest object received on callbacks:
+         * - MegaRequest::getName - Returns the name of the custom attribute
+         * - MegaRequest::getText - Returns the text for the attribute
+         * - MegaRequest::getTotalBytes - Returns the number of nodes
+         * - MegaRequest::getTransferredBytes - Returns the number of nodes done
+         * - MegaRequest::getNumDetails - Returns the number of nodes that failed
+         *
+         * Valid data in the MegaRequest object received in onRequestFinish:
+         * - MegaRequest::getMegaStringMap - Returns the error code of each node (as a decimal
+         * string), by the Base64 handle of the node
+         *
+         * If the MEGA account is a business account and it's status is expired, onRequestFinish will
+         * be called with the error code MegaError::API_EBUSINESSPASTDUE.
+         *
+         * @param nodes Nodes that will receive the attribute
+         * @param attrName Name of the custom attribute.
+         * The length of this parameter must be between 1 and 7 UTF8 bytes
+         * @param value Value for the attribute, or NULL to remove it
+         * @param listener MegaRequestListener to track this request
+         */
+        void setCustomNodesAttribute(MegaNodeList *nodes, const char *attrName, const char* value, MegaRequestListener *listener = NULL);
+
         /**
          * @brief Set the duration of audio/video files as a node attribute.
          *
@@ -9929,6 +10457,31 @@ class MegaApi
          */
         void fetchNodesAndResumeSyncs(MegaRequestListener *listener = NULL);
 
+        enum {
+            STARTUP_STAGE_NODES = 0,
+            STARTUP_STAGE_SECONDARY = 1,
+            STARTUP_STAGE_DONE = 2
+        };
+
+        /**
+         * @brief Make the nodes usable before the secondary data of the account is loaded
+         *
+         * MegaApi::fetchNodes then only requests what the nodes need. The authrings and the keys
+         * of the contacts, the push notification settings and the timezone are requested once the
+         * nodes are usable, after onRequestFinish of the fetchnodes request. The user alerts are
+         * loaded afterwards, as usual.
+         *
+         * Each stage is reported with a MegaEvent::EVENT_STARTUP_STAGE, whose number is
+         * MegaApi::STARTUP_STAGE_SECONDARY when the nodes are usable and the rest starts loading,
+         * and MegaApi::STARTUP_STAGE_DONE when the contacts' keys are requested and the user alerts
+         * loaded.
+         *
+         * It applies to the next call to MegaApi::fetchNodes. It is disabled by default.
+         *
+         * @param enable True to load the secondary data once the nodes are usable
+         */
+        void setStagedStartup(bool enable);
+
         /**
          * @brief Get the sum of sizes of all the files stored in the MEGA cloud.
          *
@@ -11235,7 +11788,41 @@ class MegaApi
         void startDownloadWithTopPriority(MegaNode* node, const char* localPath, const char *appData, MegaTransferListener *listener = NULL);
 
         /**
-         * @brief Start an streaming download for a file in MEGA
+         * @brief Upload a batch of files to the same folder in MEGA
+         *
+         * All the files are queued at once and processed together, which is much cheaper than calling
+         * MegaApi::startUpload for each of them.
+         *
+         * The listener receives the callbacks of a parent transfer (MegaTransfer::isFolderTransfer returns
+         * true for it) that aggregates the size and the progress of all the files and finishes when all of
+         * them have finished, with MegaError::API_EINCOMPLETE if any of them failed. The transfers of the
+         * files can be obtained with MegaApi::getChildTransfers.
+         *
+         * @param localPaths Local paths of the files to upload
+         * @param parent Parent node for the files in MEGA
+         * @param listener MegaTransferListener to track the batch
+         */
+        void startUploads(MegaStringList* localPaths, MegaNode* parent, MegaTransferListener *listener = NULL);
+
+        /**
+         * @brief Download a batch of files or folders from MEGA to the same local folder
+         *
+         * All the nodes are queued at once and processed together, which is much cheaper than calling
+         * MegaApi::startDownload for each of them.
+         *
+         * The listener receives the callbacks of a parent transfer (MegaTransfer::isFolderTransfer returns
+         * true for it) that aggregates the size and the progress of all the downloads and finishes when all of
+         * them have finished, with MegaError::API_EINCOMPLETE if any of them failed. The transfers of the
+         * nodes can be obtained with MegaApi::getChildTransfers.
+         *
+         * @param nodes Nodes to download
+         * @param localFolder Destination folder, ending with a '\' or '/' character
+         * @param listener MegaTransferListener to track the batch
+         */
+        void startDownloads(MegaNodeList* nodes, const char* localFolder, MegaTransferListener *listener = NULL);
+
+        /**
+         * @brief Start an streaming download for a file in MEGA
          *
          * Streaming downloads don't save the downloaded data into a local file. It is provided
          * in MegaTransferListener::onTransferUpdate in a byte buffer. The pointer is returned by
@@ -11257,6 +11844,28 @@ class MegaApi
          */
         void startStreaming(MegaNode* node, int64_t startPos, int64_t size, MegaTransferListener *listener);
 
+        /**
+         * @brief Start an streaming download that lends its data to the app
+         *
+         * Like MegaApi::startStreaming, but the data is provided in MegaTransferListener::onTransferBuffer,
+         * in the buffers that the SDK decrypts it into, so that it doesn't have to be copied. The app keeps
+         * each MegaTransferBuffer as long as it needs it, and deletes it to give the memory back. When the
+         * app holds maxHeldBytes (it may hold a bit more, up to the piece being processed), the download
+         * stops reading from the network until the app deletes some buffers, with no stall detection in
+         * the meantime, so there is no need to cancel and restart it to slow it down.
+         *
+         * MegaTransfer::getLastBytes and MegaTransfer::getDeltaSize are still provided in
+         * MegaTransferListener::onTransferUpdate, but MegaTransferListener::onTransferData is only called
+         * if onTransferBuffer isn't overridden.
+         *
+         * @param node MegaNode that identifies the file
+         * @param startPos First byte to download from the file
+         * @param size Size of the data to download
+         * @param maxHeldBytes Bytes the app may hold before the download waits for it
+         * @param listener MegaTransferListener to track this transfer
+         */
+        void startStreamingBuffers(MegaNode* node, int64_t startPos, int64_t size, int64_t maxHeldBytes, MegaTransferListener *listener);
+
         /**
          * @brief Set the miniumum acceptable streaming speed for streaming transfers
          *
@@ -11265,12 +11874,71 @@ class MegaApi
          * the minimum rate specified (determined by this function, or by default a reasonable rate
          * for audio/video, then the streaming operation will fail with MegaError::API_EAGAIN.
          *
+         * The default adapts to the media and the link: for files with a known playtime it goes up
+         * to half their bitrate when the connection can do better, and when several streams share
+         * the connection it never exceeds their fair share of it. While a stream is behind its
+         * bitrate, the downloads that aren't streaming are slowed down to leave it the bandwidth.
+         *
          * @param bytesPerSecond The minimum acceptable rate for streaming.
          *                       Use -1 to use the default built into the library.
          *                       Use 0 to prevent the check.
          */
         void setStreamingMinimumRate(int bytesPerSecond);
 
+        /**
+         * @brief Keep streamed data for later reads of the same file, and read ahead
+         *
+         * Data received by streaming transfers (see MegaApi::startStreaming) is kept for a few minutes,
+         * for each file, up to this size. Later reads of the same ranges, e.g. seeking back in a video,
+         * or concurrent reads of the same file, take it from there instead of the server.
+         *
+         * Reads are also followed by a read ahead of the next part of the file. It grows while the reads
+         * are sequential and is a short burst after a seek. The data read ahead counts against the
+         * transfer quota like any other.
+         *
+         * @param bytes Maximum data kept per file, 0 (the default) to disable it
+         */
+        void setStreamingReadahead(long long bytes);
+
+        /**
+         * @brief Keep streamed data on disk, for any later streaming of the same files
+         *
+         * Streaming transfers (see MegaApi::startStreaming) store the blocks they receive in this
+         * folder, encrypted as they are in MEGA, up to \c maxBytes. The least recently used blocks are
+         * deleted first. Later streams of the same files start from these blocks, and only download
+         * what is missing. Files already in the folder are deleted when the cache is enabled, and the
+         * cached blocks are deleted when it is disabled.
+         *
+         * @param localFolder Local folder (UTF-8) for the cache, or NULL to disable it
+         * @param maxBytes Maximum size of the cached blocks, 0 to disable it
+         */
+        void setStreamingDiskCache(const char *localFolder, long long maxBytes);
+
+        enum
+        {
+            STREAMING_CACHE_HITS = 0,
+            STREAMING_CACHE_MISSES = 1,
+            STREAMING_CACHE_BYTES_SAVED = 2,
+            STREAMING_CACHE_BYTES_STORED = 3,
+            STREAMING_CACHE_BLOCKS = 4
+        };
+
+        /**
+         * @brief Get statistics of the streaming disk cache
+         *
+         * The counters start with MegaApi::setStreamingDiskCache.
+         *
+         * @param stat One of these:
+         * - MegaApi::STREAMING_CACHE_HITS: Blocks read from the cache
+         * - MegaApi::STREAMING_CACHE_MISSES: Blocks looked for and not in the cache
+         * - MegaApi::STREAMING_CACHE_BYTES_SAVED: Bytes delivered to streams from cached data instead of the server
+         * - MegaApi::STREAMING_CACHE_BYTES_STORED: Current size of the cached blocks
+         * - MegaApi::STREAMING_CACHE_BLOCKS: Current number of cached blocks
+         *
+         * @return The value, or -1 if the cache is not enabled or the stat is unknown
+         */
+        long long getStreamingCacheStat(int stat);
+
         /**
          * @brief Cancel a transfer
          *
@@ -11514,6 +12182,11 @@ class MegaApi
          * Valid data in the MegaRequest object received on callbacks:
          * - MegaRequest::getParamType - Returns the first parameter
          *
+         * All the transfers are cancelled at once, before the request finishes. The files that
+         * belong to a folder transfer don't call MegaTransferListener::onTransferFinish of the
+         * listeners added with MegaApi::addTransferListener or MegaApi::addListener: the folder
+         * transfer finishes once, with MegaError::API_EINCOMPLETE, after the last of them.
+         *
          * @param type Type of transfers to cancel.
          * Valid values are:
          * - MegaTransfer::TYPE_DOWNLOAD = 0
@@ -11696,6 +12369,152 @@ class MegaApi
          */
         void setMaxConnections(int connections, MegaRequestListener* listener = NULL);
 
+        /**
+         * @brief Let the SDK choose the number of connections of each transfer
+         *
+         * Transfers start with the number of connections set by MegaApi::setMaxConnections. While enabled,
+         * the SDK periodically adds a connection to the transfer expected to gain most from it (up to 6), and
+         * keeps it only if the speed of that transfer rises accordingly. Once the total number of connections
+         * of all transfers reaches \c budget, connections move from the transfers that gain least from them to
+         * the ones that gain most.
+         *
+         * Streaming (CloudRAID) downloads and files up to 128 KB are not affected.
+         * MegaTransfer::getNumConnections reports the connections currently used by each transfer.
+         *
+         * @param direction Direction of transfers
+         * Valid values for this parameter are:
+         * - MegaTransfer::TYPE_DOWNLOAD = 0
+         * - MegaTransfer::TYPE_UPLOAD = 1
+         * @param enable True to enable the automatic mode, false to go back to the fixed number of connections
+         * @param budget Maximum number of connections across all transfers (32 by default)
+         */
+        void setAutoConnections(int direction, bool enable, int budget = 32);
+
+        /**
+         * @brief Start queued transfers fairly between groups instead of strictly by priority
+         *
+         * The transfers of a folder upload or download form a group, identified by the tag of the folder
+         * transfer (MegaTransfer::getFolderTransferTag); the remaining ones form a group of their own. Groups
+         * take turns in proportion to their weight, counting the bytes of the transfers they start plus a
+         * fixed overhead per file, so that a folder of many small files and a large backup both make progress.
+         * Within a group, transfers keep their priority order.
+         *
+         * The fair scheduling is disabled by default. The setters below enable it too.
+         *
+         * @param enable True to schedule fairly, false to go back to priority order
+         */
+        void setFairTransferScheduling(bool enable);
+
+        /**
+         * @brief Set the share of a group of transfers in the fair scheduling
+         *
+         * @param folderTransferTag Tag of the folder transfer, 0 for the transfers that are not part of one
+         * @param weight Weight relative to the other groups (1 by default)
+         * @see MegaApi::setFairTransferScheduling
+         */
+        void setTransferGroupWeight(int folderTransferTag, int weight);
+
+        /**
+         * @brief Set the speed a group of transfers should get in the fair scheduling
+         *
+         * While the transfers of the group that are in progress go slower than this, its next queued transfer
+         * starts ahead of the other groups.
+         *
+         * @param folderTransferTag Tag of the folder transfer, 0 for the transfers that are not part of one
+         * @param bytesPerSecond Minimum speed, 0 (the default) for none
+         * @see MegaApi::setFairTransferScheduling
+         */
+        void setTransferGroupMinSpeed(int folderTransferTag, long long bytesPerSecond);
+
+        /**
+         * @brief Let small files start ahead of any group in the fair scheduling
+         *
+         * @param maxFileSize Largest file that can use the fast lane
+         * @param slots Number of transfers that can be in the fast lane at once, 0 (the default) to disable it
+         * @see MegaApi::setFairTransferScheduling
+         */
+        void setSmallFileFastLane(long long maxFileSize, int slots);
+
+        /**
+         * @brief Limit the bandwidth of all transfers and streaming, uploads and downloads together
+         *
+         * This limit applies on top of MegaApi::setMaxDownloadSpeed, MegaApi::setMaxUploadSpeed and
+         * MegaApi::setTransferGroupBandwidthLimit: data goes only while all the limits that apply to it allow.
+         *
+         * @param bytesPerSecond Maximum speed, 0 (the default) for none
+         */
+        void setTotalBandwidthLimit(long long bytesPerSecond);
+
+        /**
+         * @brief Limit the bandwidth of a group of transfers
+         *
+         * Groups are the same as in the fair scheduling (see MegaApi::setFairTransferScheduling), but the limit
+         * applies whether it's enabled or not.
+         *
+         * @param folderTransferTag Tag of the folder transfer, 0 for the transfers that are not part of one
+         * @param bytesPerSecond Maximum speed, 0 (the default) for none
+         */
+        void setTransferGroupBandwidthLimit(int folderTransferTag, long long bytesPerSecond);
+
+        /**
+         * @brief Use other bandwidth limits during some periods of time
+         *
+         * From each time the cron expression matches and for the given duration, downloads and uploads are limited
+         * to the given speeds instead, and the total and group limits are lifted. For example,
+         * "0 0 1 * * *" with a duration of 5 hours and no limits lets backups run unthrottled from 1 AM to 6 AM.
+         * If several schedules are in force, the first one added applies.
+         *
+         * @param cronExpression Cron expression with seconds, in UTC
+         * @param durationSeconds Length of every period
+         * @param downloadBytesPerSecond Download limit during the period, 0 for none
+         * @param uploadBytesPerSecond Upload limit during the period, 0 for none
+         * @return False if the cron expression or the duration is not valid
+         */
+        bool addBandwidthSchedule(const char* cronExpression, long long durationSeconds,
+                                  long long downloadBytesPerSecond, long long uploadBytesPerSecond);
+
+        /**
+         * @brief Remove the schedules added with MegaApi::addBandwidthSchedule
+         */
+        void clearBandwidthSchedules();
+
+        /**
+         * @brief Complete uploads to the same folder together
+         *
+         * Each finished upload needs a request to add the new file to its folder. With this setting, up
+         * to \c maxFiles of them share one request. A request is sent when it is full, half a second after
+         * its first upload finished, or when there are no more uploads in progress. That saves many round
+         * trips when uploading a lot of small files, e.g. a folder upload.
+         *
+         * Each transfer is still finished on its own, with its own result. Uploads of synced files and
+         * uploads to the inbox of other users are not grouped.
+         *
+         * @param maxFiles Maximum number of uploads completed together. 1 (the default) disables it
+         */
+        void setUploadCompletionBatching(int maxFiles);
+
+        /**
+         * @brief Set the memory kept to reuse download buffers
+         *
+         * Downloads and streaming reuse the buffers of the chunks already written instead of allocating
+         * new ones. This limits the memory held by the unused buffers. The buffers in use are not limited.
+         *
+         * @param bytes Maximum size of the unused buffers (64 MB by default), 0 to not reuse them
+         */
+        void setTransferBufferPoolLimit(long long bytes);
+
+        /**
+         * @brief Fingerprint queued uploads ahead of time
+         *
+         * Before an upload starts, its file is read to compute a fingerprint, used to detect files
+         * already in the account. With this setting, a background thread does that for the next uploads
+         * waiting in the queue, in their order, while the earlier ones are being started. It also reads
+         * the start of each file, so the first chunks of the upload come from the cache of the system.
+         *
+         * @param uploads Number of queued uploads to fingerprint ahead (8 by default), 0 to disable it
+         */
+        void setUploadFingerprintLookahead(int uploads);
+
         /**
          * @brief Set the transfer method for downloads
          *
@@ -11790,6 +12609,97 @@ class MegaApi
          */
         int getMaxUploadSpeed();
 
+        /**
+         * @brief Use HTTP/2 for the requests to the API and to the storage servers
+         *
+         * Requests to the same server share one connection, instead of a connection (and a TLS
+         * handshake) each. Servers without HTTP/2 are still used with HTTP/1.1.
+         *
+         * Currently, this method is only available using the cURL-based network layer, if cURL
+         * was built with HTTP/2 support. The default is HTTP/1.1.
+         *
+         * @param enable True to use HTTP/2 where available
+         * @return true if the network layer supports it, otherwise false
+         */
+        bool setHttp2(bool enable);
+
+        enum
+        {
+            CONNECTION_STAT_REQUESTS = 0,
+            CONNECTION_STAT_HTTP2_REQUESTS = 1,
+            CONNECTION_STAT_CONNECTIONS = 2,
+            CONNECTION_STAT_HANDSHAKES = 3,
+            CONNECTION_STAT_CONNECTIONS_PER_MINUTE = 4,
+            CONNECTION_STAT_HANDSHAKES_PER_MINUTE = 5
+        };
+
+        /**
+         * @brief Get statistics of the connections of the network layer
+         *
+         * @param stat One of these:
+         * - MegaApi::CONNECTION_STAT_REQUESTS: Finished requests
+         * - MegaApi::CONNECTION_STAT_HTTP2_REQUESTS: Finished requests that used HTTP/2
+         * - MegaApi::CONNECTION_STAT_CONNECTIONS: Requests that opened a new connection
+         * - MegaApi::CONNECTION_STAT_HANDSHAKES: New connections with a TLS handshake
+         * - MegaApi::CONNECTION_STAT_CONNECTIONS_PER_MINUTE: New connections during the last minute
+         * - MegaApi::CONNECTION_STAT_HANDSHAKES_PER_MINUTE: TLS handshakes during the last minute
+         *
+         * @return The value, or -1 if the stat is unknown
+         */
+        long long getConnectionStat(int stat);
+
+        /**
+         * @brief Get the health of the storage servers used by the transfers of this session
+         *
+         * The SDK keeps moving averages of the throughput, the time to first byte and the error rate of
+         * every storage server, and scores each one from 0 to 1 compared to the best of the others. Servers
+         * scoring below 0.3 are avoided for 3 minutes: downloads request other servers, and cloudraid
+         * downloads leave their part out.
+         *
+         * The result is a JSON array with one object per server, like:
+         * [{"host":"gfs262n300.userstorage.mega.co.nz","score":0.82,"throughput":5242880,"ttfb":180,
+         * "errorrate":0.04,"samples":37,"avoided":false}]
+         * where throughput is in bytes per second and ttfb in milliseconds.
+         *
+         * You take the ownership of the returned value.
+         * Use delete [] to free it.
+         *
+         * @return JSON array with the health of the storage servers
+         */
+        char* getStorageServerHealth();
+
+        /**
+         * @brief Measure the network and tune the transfers for it
+         *
+         * The SDK sends a few small requests, one at a time, to the API and to the two storage servers
+         * used the most so far (on the default and the alternative port), and measures their round trip
+         * time and loss. With the throughput seen by the transfers, they give a profile: connections per
+         * transfer, concurrent transfers, request size and port, which is applied at once, kept in the
+         * local cache and applied again the next time the app starts.
+         *
+         * The probe takes a few seconds. Calling MegaApi::setMaxConnections, MegaApi::setDownloadMethod or
+         * MegaApi::setUploadMethod afterwards overrides the corresponding part of the profile.
+         *
+         * Run it after some transfers so that the storage servers and the bandwidth are known.
+         */
+        void probeNetwork();
+
+        /**
+         * @brief Get the network profile applied from the last MegaApi::probeNetwork
+         *
+         * The result is a JSON object like:
+         * {"connections":6,"transfers":32,"requestSize":8388608,"altPort":false,"rttMs":240,
+         * "lossPercent":1,"bandwidth":12582912,"measured":1609464600}
+         * where 0 means that setting was left unchanged, bandwidth is in bytes per second (0 if unknown)
+         * and measured is the timestamp of the probe (0 if the network was never probed).
+         *
+         * You take the ownership of the returned value.
+         * Use delete [] to free it.
+         *
+         * @return JSON object with the network profile
+         */
+        char* getNetworkProfile();
+
         /**
          * @brief Return the current download speed
          * @return Download speed in bytes per second
@@ -12357,6 +13267,134 @@ class MegaApi
          */
         void setExclusionUpperSizeLimit(long long limit);
 
+        /**
+         * @brief Check the content of large synced files before uploading them again
+         *
+         * The SDK detects changes in synced files by their size, modification time and a checksum
+         * of some parts of them. A file that is touched, or rewritten with the same content, is
+         * uploaded again as a new version. With this setting, synced files of at least \c minSize
+         * bytes are read once to keep a hash of their content. When only their modification time
+         * changes, they are read again and, if the content is the same, only the modification time
+         * of the file in MEGA is updated.
+         *
+         * Reading large files takes time, during which other sync activity waits.
+         *
+         * @param minSize Minimum size of the files to check, 0 (the default) to disable it
+         */
+        void setSyncContentCheck(long long minSize);
+
+        /**
+         * @brief Read folders on several threads during the initial scan of new syncs
+         *
+         * By default, the initial scan of a sync lists and inspects every local folder on the SDK
+         * thread before MegaApi::syncFolder finishes. With this setting, the folders are listed by
+         * \c threads worker threads while the SDK keeps processing other requests, and the sync
+         * stays in the initial scan state until the last folder has been merged. This helps with
+         * large trees, network drives and slow disks.
+         *
+         * Syncs whose initial scan already started keep their threads.
+         *
+         * @param threads Number of worker threads (at most 64), 0 (the default) to scan inline
+         */
+        void setSyncScanThreads(int threads);
+
+        /**
+         * @brief Move the items deleted remotely to the local debris on several threads
+         *
+         * By default, when a synced file or folder is deleted in MEGA, the SDK thread moves the local
+         * item to the local debris folder of the sync (and, for files, reads it to check that it didn't
+         * change) before going on with the next one. With this setting, the moves are done by \c threads
+         * worker threads, keeping the order of the moves of each path, so that many deletions or a slow
+         * disk don't hold other requests. Items whose move fails temporarily are retried as before.
+         *
+         * @param threads Number of worker threads (at most 64), 0 (the default) to move them inline
+         */
+        void setSyncDebrisThreads(int threads);
+
+        /**
+         * @brief Read the changed files of each sync on a thread of its own
+         *
+         * By default, the SDK thread reads the files reported as new or changed, to take their
+         * fingerprints, one sync after another, so a large or slow sync (for example, on a network
+         * drive) delays all the others. With this setting, each sync has a thread that reads up to
+         * \c files of the files waiting to be scanned ahead of the SDK thread, which then only
+         * checks that they didn't change since. Everything else about the syncs is still done by
+         * the SDK thread.
+         *
+         * @param files Number of files read ahead per sync (at most 1024), 0 (the default) to read
+         * them inline
+         */
+        void setSyncFingerprintPrefetch(int files);
+
+        /**
+         * @brief Limit the versions of each synced file uploaded per hour
+         *
+         * Files that are written continuously, like logs or databases, would otherwise get a new version
+         * every time they settle. With this setting, once a file has \c versions versions uploaded in the
+         * last hour, its next change is uploaded when the oldest of them is an hour old. The latest content
+         * is the one uploaded then.
+         *
+         * @param versions Maximum number of versions per file and hour, 0 (the default) for no limit
+         */
+        void setSyncMaxVersionsPerHour(int versions);
+
+        /**
+         * @brief Only revisit the parts of synced trees that changed
+         *
+         * By default, each change notified by the local filesystem or received from MEGA has the
+         * SDK compare the whole local and remote trees of the syncs. With this setting, only the
+         * folders where changes happened (and the ones containing them) are compared, which
+         * makes a big difference for large trees with few changes.
+         *
+         * Retries and other events still compare the whole trees.
+         *
+         * @param enable True to compare only the changed folders, false (the default) to compare everything
+         */
+        void setSyncDirtySubtreesOnly(bool enable);
+
+        /**
+         * @brief Poll network folders for changes instead of rescanning them completely
+         *
+         * Change notifications from network filesystems (SMB, NFS) can't be relied on, so syncs
+         * of network folders are rescanned completely whenever notifications fail. With this
+         * setting, the SDK instead checks the modification time of the synced folders every now
+         * and then, and only scans again the ones that changed. Folders with recent changes are
+         * checked more often than folders that haven't changed in a while.
+         *
+         * Files modified in place don't always update the modification time of their folder, so
+         * complete rescans still happen, but at most every 6 hours.
+         *
+         * @param enable True to poll network folders, false (the default) to rescan them
+         */
+        void setNetworkSyncPolling(bool enable);
+
+        /**
+         * @brief Watch whole filesystems for changes in synced folders
+         *
+         * By default, the SDK adds a filesystem watch for every synced folder. On Linux, large trees can
+         * reach the inotify limit (/proc/sys/fs/inotify/max_user_watches), after which changes are only
+         * detected by periodic full scans. With this setting, folders added from now on are watched with
+         * one fanotify mark per filesystem instead. This requires the CAP_SYS_ADMIN capability; folders
+         * on filesystems that can't be marked keep using a watch of their own.
+         *
+         * The setting can't be disabled while there are folders watched this way.
+         *
+         * @param enable True to watch whole filesystems, false to watch each folder
+         * @return True if the setting was applied, false if not available on this platform or build
+         *
+         * @see MegaApi::getNumNotifyWatches
+         */
+        bool setFilesystemWideNotifications(bool enable);
+
+        /**
+         * @brief Get the number of filesystem watches used by the synchronizations
+         *
+         * This counts one watch per folder watched on its own, and one per filesystem watched as a whole.
+         *
+         * @return Number of folder watches and filesystem marks in place
+         */
+        long long getNumNotifyWatches();
+
         /**
          * @brief Move a local file to the local "Debris" folder
          *
@@ -12439,6 +13477,19 @@ class MegaApi
          */
         MegaSync *getSyncByPath(const char *localPath);
 
+        /**
+         * @brief Get a snapshot of the queues and counters of a synchronization
+         *
+         * This is cheap enough to be called every second, to monitor a synchronization
+         * or to find out why it is slow.
+         *
+         * You take the ownership of the returned value
+         *
+         * @param tag Tag that identifies the synchronization
+         * @return Stats of the synchronization, or NULL if there isn't any active synchronization with that tag
+         */
+        MegaSyncStats *getSyncStats(int tag);
+
 #ifdef USE_PCRE
         /**
         * @brief Set a list of rules to exclude files and folders for a given synchronized folder
@@ -12676,6 +13727,95 @@ class MegaApi
          */
         long long getTotalUploadBytes();
 
+        /**
+         * @brief Enable or disable the performance counters of the SDK
+         *
+         * They time the main loop (exec, waits, event checks), the processing of server-client
+         * action packets and client-server responses, transfer slots, node key decryption and
+         * the commits to the local cache, and count transfers, requests and wait reasons.
+         *
+         * They are disabled by default (unless the SDK is built with MEGA_MEASURE_CODE), in
+         * which case measuring costs a branch. They are shared by all MegaApi instances.
+         *
+         * @param enable True to start counting, false to stop
+         */
+        void setPerformanceStatsEnabled(bool enable);
+
+        /**
+         * @brief Get the current values of the performance counters
+         *
+         * The keys are "<scope>.count", "<scope>.ms", "<scope>.p50us" and "<scope>.p99us"
+         * for each timed scope (number of runs, total milliseconds, and median and 99th
+         * percentile of a run in microseconds, within 25%), and "cs.*", "sc.*",
+         * "transfers.*", "wait.*" and "bufferpool.*" for the counters. Values are decimal
+         * integers.
+         *
+         * You take the ownership of the returned value.
+         *
+         * @param reset True to restart the counters afterwards
+         * @return Names and values of the counters
+         * @see MegaApi::setPerformanceStatsEnabled
+         */
+        MegaStringMap *getPerformanceSnapshot(bool reset = false);
+
+        /**
+         * @brief Detect stalls of the SDK thread
+         *
+         * When a threshold is set, each iteration of the main loop of the SDK is timed by phases:
+         * client-server responses ("cs"), action packets ("sc"), dispatching of transfers
+         * ("dispatchtransfers"), transfer slots ("doio"), "syncdown", "syncup", direct reads
+         * ("execdirectreads"), commits to the local cache ("dbcommit"), and the rest ("other").
+         * Those that take longer than the threshold are logged as warnings with the time spent
+         * in each phase, and the slowest of them are kept (see MegaApi::getEventLoopStalls).
+         *
+         * The tracer is disabled by default. It is independent of MegaApi::setPerformanceStatsEnabled.
+         *
+         * @param thresholdMs Milliseconds over which an iteration is reported, or 0 to disable the tracer
+         */
+        void setEventLoopStallThreshold(unsigned thresholdMs);
+
+        /**
+         * @brief Get the slowest iterations of the main loop of the SDK over the stall threshold
+         *
+         * Up to 10 iterations, slowest first, as "<timestamp> <total> ms: <phase> <ms> ms, ...",
+         * the phases that took 1 ms or more, longest first. The timestamp is in seconds since
+         * the Epoch.
+         *
+         * You take the ownership of the returned value.
+         *
+         * @param reset True to forget the iterations afterwards
+         * @return Description of the slowest iterations
+         * @see MegaApi::setEventLoopStallThreshold
+         */
+        MegaStringList *getEventLoopStalls(bool reset = false);
+
+        /**
+         * @brief Start recording a timeline of the activity of the SDK
+         *
+         * The timeline is written by MegaApi::stopTrace in the Chrome trace-event JSON format,
+         * which chrome://tracing and https://ui.perfetto.dev open. It has spans for the timed
+         * sections of the SDK (see MegaApi::setPerformanceStatsEnabled), the HTTP requests
+         * (API batches, action packets, transfer chunks of each connection, including those of
+         * RAID parts, file attributes), the asynchronous disk reads and writes, the jobs of the
+         * thumbnail and preview generation, and the scans of the syncs.
+         *
+         * Each thread keeps its latest 16384 events, so only the end of long traces is kept.
+         * Tracing is shared by all MegaApi instances; recording costs a branch per span while
+         * it is stopped.
+         *
+         * @param outputPath Path of the file to write the timeline to. If it exists, it's overwritten
+         * @return false if a trace is already being recorded, otherwise true
+         */
+        bool startTrace(const char* outputPath);
+
+        /**
+         * @brief Stop recording the timeline and write it to the file passed to MegaApi::startTrace
+         *
+         * @return false if no trace was being recorded by this MegaApi or the file couldn't be written,
+         * otherwise true
+         */
+        bool stopTrace();
+
         /**
          * @brief Update the number of pending downloads/uploads
          *
@@ -12807,6 +13947,28 @@ class MegaApi
          */
         MegaNodeList* getChildren(MegaNode *parent, int order = 1);
 
+        /**
+         * @brief Get a page of the children of a node
+         *
+         * This returns the same nodes as MegaApi::getChildren, in the same order, from the
+         * position offset and up to limit of them. Only the requested nodes are copied, so
+         * this is the way to show large folders a screenful at a time. While the folder
+         * doesn't change, the sorted children are kept between calls and each page starts
+         * in O(log n) for any order other than MegaApi::ORDER_NONE.
+         *
+         * If the parent node doesn't exist or it isn't a folder, this function
+         * returns an empty list
+         *
+         * You take the ownership of the returned value
+         *
+         * @param parent Parent node
+         * @param order Order for the returned list (see MegaApi::getChildren)
+         * @param offset Position of the first child to return
+         * @param limit Maximum number of children to return
+         * @return List with the child MegaNode objects of the page
+         */
+        MegaNodeList* getChildrenPage(MegaNode *parent, int order, int offset, int limit);
+
         /**
          * @brief Get all versions of a file
          * @param node Node to check
@@ -13045,10 +14207,24 @@ class MegaApi
         MegaUserAlertList* getUserAlerts();
 
         /**
-         * @brief Get the number of unread user alerts for the logged in user
-         *
-         * @return Number of unread user alerts
-         */
+        * @brief Get a page of the MegaUserAlerts for the logged in user
+        *
+        * The alerts are in the same order as MegaApi::getUserAlerts returns them, from the oldest
+        * one, so that an app can show a long list of alerts without copying all of them each time.
+        *
+        * You take the ownership of the returned value
+        *
+        * @param start Position of the first alert to get
+        * @param count Maximum number of alerts to get
+        * @return List of up to count MegaUserAlert objects (empty if start is out of range)
+        */
+        MegaUserAlertList* getUserAlerts(int start, int count);
+
+        /**
+         * @brief Get the number of unread user alerts for the logged in user
+         *
+         * @return Number of unread user alerts
+         */
         int getNumUnreadUserAlerts();
 
         /**
@@ -13910,6 +15086,74 @@ class MegaApi
          */
         MegaNodeList* search(const char* searchString, MegaCancelToken *cancelToken, int order = ORDER_NONE);
 
+        /**
+         * @brief Search files and folders by a name pattern, type, size and modification time
+         *
+         * The pattern has to match the whole name, case-insensitively. It can contain the
+         * wildcards '*' (any number of characters) and '?' (a single character), so "report*"
+         * is a prefix search and "*report*" the same search as MegaApi::search.
+         *
+         * Like MegaApi::search, the names are looked up in an index instead of walking the
+         * whole tree of nodes, except when the SDK has part of the nodes out of memory
+         * (see MegaApi::setNodeMemoryBudget).
+         *
+         * This function allows to cancel the processing at any time by passing a MegaCancelToken and calling
+         * to MegaCancelToken::setCancelFlag(true). If a valid object is passed, it must be kept alive until
+         * this method returns.
+         *
+         * You take the ownership of the returned value.
+         *
+         * @param node Folder to search in, at any depth, or NULL to search the cloud drive, the
+         * inbox, the rubbish bin and the incoming shares
+         * @param pattern Pattern for the names
+         * @param type MegaNode::TYPE_FILE or MegaNode::TYPE_FOLDER to get only files or folders,
+         * MegaNode::TYPE_UNKNOWN for both
+         * @param minSize Minimum size of the files, or -1
+         * @param maxSize Maximum size of the files, or -1
+         * @param minMtime Minimum modification time of the files (in seconds since the Epoch), or -1
+         * @param maxMtime Maximum modification time of the files (in seconds since the Epoch), or -1
+         * Any of the size or modification time limits leaves the folders out of the results.
+         * @param cancelToken MegaCancelToken to be able to cancel the processing at any time.
+         * @param order Order for the returned list (see MegaApi::search)
+         * @return List of nodes whose name matches the pattern
+         */
+        MegaNodeList* searchByPattern(MegaNode* node, const char* pattern, int type = MegaNode::TYPE_UNKNOWN,
+                                      long long minSize = -1, long long maxSize = -1, long long minMtime = -1, long long maxMtime = -1,
+                                      MegaCancelToken *cancelToken = nullptr, int order = ORDER_NONE);
+
+        /**
+         * @brief Search nodes containing a search string in their name, and get them in pages
+         *
+         * Unlike MegaApi::search, the results are not returned in a single MegaNodeList: the
+         * search runs in the SDK thread, like any request, and the matches are delivered to the
+         * listener a page at a time, by onRequestUpdate, so that the app can show the first ones
+         * without holding copies of all of them. Nodes that are not in memory (see
+         * MegaApi::setNodeMemoryBudget) are read from the local cache as the search reaches them.
+         *
+         * Node names are encrypted, so MEGA can't search them: only the nodes known to this
+         * session are searched (see MegaApi::setNodeScope).
+         *
+         * The associated request type with this request is MegaRequest::TYPE_SEARCH
+         * Valid data in the MegaRequest object received on callbacks:
+         * - MegaRequest::getNodeHandle - Returns the handle of the folder to search in
+         * - MegaRequest::getText - Returns the search string
+         * - MegaRequest::getNumber - Returns the size of the pages
+         * - MegaRequest::getTotalBytes - Returns the number of matches
+         * - MegaRequest::getTransferredBytes - Returns the number of matches delivered so far
+         *
+         * Valid data in the MegaRequest object received in onRequestUpdate:
+         * - MegaRequest::getMegaNodeList - Returns the nodes of this page, in no particular order
+         *
+         * onRequestFinish is called once all the pages have been delivered.
+         *
+         * @param node Folder to search in, at any depth, or NULL to search the cloud drive, the
+         * inbox, the rubbish bin and the incoming shares
+         * @param searchString Search string. The search is case-insensitive
+         * @param pageSize Maximum number of nodes of each page (at least 1)
+         * @param listener MegaRequestListener to track this request
+         */
+        void searchInPages(MegaNode* node, const char* searchString, int pageSize, MegaRequestListener *listener = NULL);
+
         /**
          * @brief Return a list of buckets, each bucket containing a list of recently added/modified nodes
          *
@@ -14022,156 +15266,572 @@ class MegaApi
          * authorize the access can be retrieved from MegaChatRoom::getAuthorizationToken when
          * the chatroom in in preview mode.
          *
-         * You can use MegaApi::startDownload and/or MegaApi::copyNode with the resulting
-         * node with any instance of MegaApi, even if it's logged into another account,
-         * a public folder, or not logged in.
+         * You can use MegaApi::startDownload and/or MegaApi::copyNode with the resulting
+         * node with any instance of MegaApi, even if it's logged into another account,
+         * a public folder, or not logged in.
+         *
+         * You take the ownership of the returned value.
+         *
+         * @param node MegaNode to authorize
+         * @param cauth Authorization token (public handle of the chatroom in B64url encoding)
+         * @return Authorized node, or NULL if the node can't be authorized
+         */
+        MegaNode *authorizeChatNode(MegaNode *node, const char *cauth);
+#endif
+
+        /**
+         * @brief Get the SDK version
+         *
+         * The returned string is an statically allocated array.
+         * Do not delete it.
+         *
+         * @return SDK version
+         */
+        const char *getVersion();
+
+        /**
+         * @brief Get a string with the version of the operating system
+         *
+         * You take the ownership of the returned string
+         *
+         * @return Version of the operating system
+         */
+        char *getOperatingSystemVersion();
+
+        /**
+         * @brief Get the last available version of the app
+         *
+         * It returns the last available version corresponding to an app token
+         *
+         * The associated request type with this request is MegaRequest::TYPE_APP_VERSION
+         * Valid data in the MegaRequest object received on callbacks:
+         * - MegaRequest::getText - Returns the app token
+         *
+         * Valid data in the MegaRequest object received in onRequestFinish when the error code
+         * is MegaError::API_OK:
+         * - MegaRequest::getNumber - Returns the last available version code of the app
+         * - MegaRequest::getName - Returns the last available version string of the app
+         *
+         * Usually, the version code is used to internally control updates, and the version
+         * string is intended to be shown to final users.
+         *
+         * @param appKey Token of the app to check or NULL to use the same value as in the
+         * initialization of the MegaApi object
+         * @param listener MegaRequestListener to track this request
+         */
+        void getLastAvailableVersion(const char *appKey = NULL, MegaRequestListener *listener = NULL);
+
+        /**
+         * @brief Get a SSL certificate for communications with the webclient
+         *
+         * The associated request type with this request is MegaRequest::TYPE_GET_LOCAL_SSL_CERT
+         *
+         * Valid data in the MegaRequest object received in onRequestFinish when the error code
+         * is MegaError::API_OK:
+         * - MegaRequest::getNumber - Returns the expiration time of the certificate (in seconds since the Epoch)
+         * - MegaRequest::getMegaStringMap - Returns the data of the certificate
+         *
+         * The data returned in the string map is encoded in PEM format.
+         * The key "key" of the map contains the private key of the certificate.
+         * The key "cert" of the map contains the certificate.
+         * Intermediate certificates are provided in keys "intermediate_1" - "intermediate_X".
+         *
+         * @param listener MegaRequestListener to track this request
+         */
+        void getLocalSSLCertificate(MegaRequestListener *listener = NULL);
+
+        /**
+         * @brief Get the IP of a MegaChat server
+         *
+         * This function allows to get the correct IP to connect to a MEGAchat server
+         * using Websockets.
+         *
+         * The associated request type with this request is MegaRequest::TYPE_QUERY_DNS
+         *
+         * Valid data in the MegaRequest object received in onRequestFinish when the error code
+         * is MegaError::API_OK:
+         * - MegaRequest::getText - Returns the IP of the hostname.
+         * IPv6 addresses are returned between brackets
+         *
+         * @param hostname Hostname to resolve
+         * @param listener MegaRequestListener to track this request
+         */
+        void queryDNS(const char *hostname, MegaRequestListener *listener = NULL);
+
+        /**
+         * @brief queryGeLB Query the GeLB server for a given service
+         *
+         * The associated request type with this request is MegaRequest::TYPE_QUERY_GELB
+         *
+         * Valid data in the MegaRequest object received in onRequestFinish when the error code
+         * is MegaError::API_OK:
+         * - MegaRequest::getNumber - Return the HTTP status code from the GeLB server
+         * - MegaRequest::getText - Returns the JSON response from the GeLB server
+         * - MegaRequest::getTotalBytes - Returns the number of bytes in the response
+         *
+         * @param service Service to check
+         * @param timeoutds Timeout for the request, including all possible retries (in deciseconds)
+         * A value <= 0 means no (or infinite) timeout.
+         * @param maxretries Maximum number of retries for the request
+         * @param listener MegaRequestListener to track this request
+         */
+        void queryGeLB(const char *service, int timeoutds = 40, int maxretries = 4, MegaRequestListener *listener = NULL);
+
+        /**
+         * @brief Download a file using a HTTP GET request
+         *
+         * The associated request type with this request is MegaRequest::TYPE_DOWNLOAD_FILE
+         *
+         * Valid data in the MegaRequest object received in onRequestFinish when the error code
+         * is MegaError::API_OK:
+         * - MegaRequest::getNumber - Return the HTTP status code from the server
+         * - MegaRequest::getTotalBytes - Returns the number of bytes of the file
+         *
+         * If the request finishes with the error code MegaError::API_OK, the destination path
+         * contains the downloaded file. If it's not possible to write in the destination path
+         * the error code will be MegaError::API_EWRITE
+         *
+         * @param url URL of the file
+         * @param dstpath Destination path for the downloaded file
+         * @param listener MegaRequestListener to track this request
+         */
+        void downloadFile(const char *url, const char *dstpath, MegaRequestListener *listener = NULL);
+
+        /**
+         * @brief Get the User-Agent header used by the SDK
+         *
+         * The SDK retains the ownership of the returned value. It will be valid until
+         * the MegaApi object is deleted.
+         *
+         * @return User-Agent used by the SDK
+         */
+        const char *getUserAgent();
+
+        /**
+         * @brief Get the base path set during initialization
+         *
+         * The SDK retains the ownership of the returned value. It will be valid until
+         * the MegaApi object is deleted.
+         *
+         * @return Base path
+         */
+        const char *getBasePath();
+
+        enum {
+            DB_PROFILE_DEFAULT = 0,
+            DB_PROFILE_PERFORMANCE = 1,
+            DB_PROFILE_RECONSTRUCTIBLE = 2,
+            DB_PROFILE_CUSTOM = 3
+        };
+
+        /**
+         * @brief Trade durability of the local cache databases for speed
+         *
+         * The profile applies to the databases opened afterwards, so it should be set before
+         * logging in or resuming a session. It has no effect if no base path was set in the
+         * constructor of MegaApi. The profile in use is reported in the fetchnodes statistics.
+         *
+         * @param profile Valid values for this parameter are:
+         * - MegaApi::DB_PROFILE_DEFAULT = 0
+         * SQLite defaults: data is synced to disk on every commit.
+         *
+         * - MegaApi::DB_PROFILE_PERFORMANCE = 1
+         * Larger page cache and memory-mapped reads. Data is only synced to disk at checkpoints,
+         * so the last commits may be lost on power failure, but the databases stay consistent.
+         *
+         * - MegaApi::DB_PROFILE_RECONSTRUCTIBLE = 2
+         * Like MegaApi::DB_PROFILE_PERFORMANCE, and data is never synced to disk. A power failure
+         * or OS crash may corrupt the cache, which is then fetched again from the servers.
+         * Only intended for caches that are cheap to rebuild, such as in disposable containers.
+         */
+        void setDatabaseProfile(int profile);
+
+        /**
+         * @brief Set each SQLite setting of the local cache databases
+         *
+         * As MegaApi::setDatabaseProfile, the settings apply to the databases opened afterwards,
+         * and the profile is reported as MegaApi::DB_PROFILE_CUSTOM. A negative value keeps
+         * SQLite's default for that setting.
+         *
+         * @param synchronous PRAGMA synchronous: 0 off, 1 normal, 2 full, 3 extra
+         * @param cacheSizeKiB Page cache size in KiB
+         * @param mmapSize Maximum number of bytes read through memory mapping
+         * @param tempStore PRAGMA temp_store: 0 default, 1 file, 2 memory
+         * @param pageSize Page size in bytes, only used when a database is created
+         * @param walAutocheckpoint Write-ahead log size in pages that triggers a checkpoint
+         */
+        void setDatabaseTuning(int synchronous, int cacheSizeKiB, long long mmapSize, int tempStore, int pageSize, int walAutocheckpoint);
+
+        /**
+         * @brief Get the profile of the local cache databases
+         *
+         * @return One of the values accepted by MegaApi::setDatabaseProfile, or
+         * MegaApi::DB_PROFILE_CUSTOM after MegaApi::setDatabaseTuning
+         */
+        int getDatabaseProfile();
+
+        /**
+         * @brief Write the local cache databases from a thread of their own
+         *
+         * The changes of the local cache, of the transfer cache and of the caches of the syncs are
+         * handed to a dedicated thread, which writes them in transactions that group everything changed
+         * since its previous one. The SDK thread no longer waits for each commit to reach the disk,
+         * which can take tens of milliseconds on slow storage. The changes are read back from memory
+         * until they are written, and all of them are written before logging out.
+         *
+         * Like MegaApi::setDatabaseProfile, it applies to the databases opened afterwards, so it should
+         * be set before logging in or resuming a session. It is disabled by default.
+         *
+         * @param enable True to write the databases from their own threads
+         */
+        void setDatabaseWriteBehind(bool enable);
+
+        /**
+         * @brief Keep the nodes in memory within a budget, paging files out to the local cache
+         *
+         * The files looked up least recently are dropped from memory and loaded back from the local
+         * cache when they are needed again. Folders stay in memory, as do files that are shared, synced,
+         * being streamed or below a node pinned with MegaApi::pinNode. Storage and file counts are not
+         * affected. The mode requires a base path in the constructor of MegaApi, and it enables an index
+         * of the nodes, stored next to the local cache.
+         *
+         * Listing or searching below a folder loads its files back, so the budget can be exceeded until
+         * the next trim.
+         *
+         * @param megabytes Approximate memory budget for nodes, in MB. 0 (the default) keeps all nodes in memory
+         */
+        void setNodeMemoryBudget(int megabytes);
+
+        /**
+         * @brief Keep the previous versions of files out of memory
+         *
+         * Previous versions are dropped from memory shortly after they are loaded or created, and
+         * loaded back from the local cache when they are needed, for example by MegaApi::getVersions.
+         * Storage and version counts, and searches by fingerprint, are not affected. Like
+         * MegaApi::setNodeMemoryBudget, it requires a base path in the constructor of MegaApi, and it
+         * enables an index of the nodes, stored next to the local cache.
+         *
+         * @param enable True to keep versions out of memory, false (the default) to keep them all loaded
+         */
+        void setCompactVersions(bool enable);
+
+        /**
+         * @brief Keep a read-only view of the nodes in a file that other processes can open
+         *
+         * The view lets a process without a MegaApi of its own, such as a file provider extension,
+         * list the folders of the account with MegaSharedNodeView. The SDK rewrites the file once the
+         * nodes are up to date and, at most every 5 seconds, after they change. Each rewrite replaces
+         * the file, so readers keep the version they opened until they call MegaSharedNodeView::refresh.
+         *
+         * The names of the nodes are encrypted with the key, which the app generates and shares with the
+         * other processes. Handles, types, sizes and times are stored in the clear. The nodes kept out of
+         * memory by MegaApi::setNodeMemoryBudget or MegaApi::setCompactVersions are not in the view.
+         * The file is deleted when the local cache is removed on logout.
+         *
+         * @param path Path of the file, in a location the other processes can read (for example an app
+         * group container). NULL to stop updating it
+         * @param base64Key Base64-encoded 16-byte key
+         */
+        void setSharedNodeView(const char *path, const char *base64Key);
+
+        enum {
+            MEMORY_NODES = 0,
+            MEMORY_TRANSFER_BUFFERS = 1,
+            MEMORY_STREAMING_CACHE = 2,
+            MEMORY_API_RESPONSES = 3
+        };
+
+        enum {
+            MEMORY_PRESSURE_NONE = 0,
+            MEMORY_PRESSURE_MODERATE = 1,
+            MEMORY_PRESSURE_CRITICAL = 2
+        };
+
+        /**
+         * @brief Keep the memory used by the SDK within a budget
+         *
+         * The usage of the nodes, the transfer buffers, the streaming cache and the API responses
+         * being received is estimated every second. From 80% of the budget (moderate pressure), the
+         * streaming cache and the idle transfer buffers are halved and transfers use smaller requests.
+         * Over the budget (critical pressure), they are dropped, streaming reads no more ahead,
+         * transfers go down to one connection and, with MegaApi::setNodeMemoryBudget, nodes are paged
+         * out right away. Everything returns to its settings once the usage goes back down.
+         *
+         * Every change of level is reported with a MegaEvent::EVENT_MEMORY_PRESSURE.
+         *
+         * @param bytes Memory budget, in bytes. 0 (the default) disables it
+         */
+        void setMemoryBudget(long long bytes);
+
+        /**
+         * @brief Get the estimated memory used by a part of the SDK
+         *
+         * The value is the one of the last sample taken under MegaApi::setMemoryBudget, or 0 before it
+         * is set.
+         *
+         * @param subsystem MegaApi::MEMORY_NODES, MegaApi::MEMORY_TRANSFER_BUFFERS,
+         * MegaApi::MEMORY_STREAMING_CACHE or MegaApi::MEMORY_API_RESPONSES
+         * @return Estimated bytes in use
+         */
+        long long getMemoryUsage(int subsystem);
+
+        /**
+         * @brief Get the current memory pressure
+         *
+         * @return MegaApi::MEMORY_PRESSURE_NONE, MegaApi::MEMORY_PRESSURE_MODERATE or MegaApi::MEMORY_PRESSURE_CRITICAL
+         */
+        int getMemoryPressure();
+
+        /**
+         * @brief Limit how often MegaListener::onNodesUpdate and MegaListener::onTransferUpdate are called
+         *
+         * Node updates arriving within the interval are held back and delivered together, in a
+         * single list shared by all listeners. A node updated several times appears once, in its
+         * latest state and with the changes of all the updates (see MegaNode::getChanges). A reload
+         * of all the nodes discards the updates held back.
+         *
+         * Transfer updates that only report progress are skipped while the interval since the last
+         * update of the transfer hasn't passed. Updates that change the state or the priority of a
+         * transfer, and the first and last ones, are always delivered.
+         *
+         * @param nodesMs Minimum interval between node updates, in milliseconds. 0 (the default)
+         * delivers them as they happen
+         * @param transfersMs Minimum interval between progress updates of a transfer, in milliseconds.
+         * The default, 100, is also the minimum
+         */
+        void setCallbackIntervals(int nodesMs, int transfersMs);
+
+        /**
+         * @brief Set the order in which folder downloads queue their files
+         *
+         * Folder downloads first create all the local folders and then queue all the files at once.
+         * By default the files are queued in the order of the tree, keeping the files of each
+         * folder together.
+         *
+         * @param order MegaApi::ORDER_SIZE_ASC to download the smallest files first,
+         * MegaApi::ORDER_SIZE_DESC for the largest first, or MegaApi::ORDER_NONE (the default) for the order of the tree
+         */
+        void setFolderDownloadOrder(int order);
+
+        /**
+         * @brief Reserve the disk space of downloads when they start
+         *
+         * When enabled, the disk space for the whole file is allocated when a download starts,
+         * without changing the size of the file, so that the file is less fragmented on disk and
+         * a full disk is detected early. Resumed downloads are not affected.
+         *
+         * It is supported on Linux, macOS and Windows. Elsewhere, this setting has no effect.
+         *
+         * @param enable True to preallocate downloads, false (the default) to let files grow as they are written
+         */
+        void setDownloadPreallocation(bool enable);
+
+        /**
+         * @brief Resume downloads from the temporary files they left behind
+         *
+         * Downloads keep their progress in the local cache, and start again from zero without it
+         * (for example, after the app is reinstalled or its cache is deleted), even if most of the
+         * temporary file is still on disk.
          *
-         * You take the ownership of the returned value.
+         * When enabled, the temporary files of new downloads are named after the node, instead of
+         * the process, and a download started without cached progress reads the temporary file
+         * it would write, if there is one. The leading chunks of that file are checked on
+         * background threads and kept, and only the rest of the file is downloaded. The MAC of the
+         * file still verifies the whole download: if it fails, the download starts again from zero.
          *
-         * @param node MegaNode to authorize
-         * @param cauth Authorization token (public handle of the chatroom in B64url encoding)
-         * @return Authorized node, or NULL if the node can't be authorized
+         * Downloads of syncs are not affected.
+         *
+         * @param enable True to resume downloads from their temporary files, false (the default) to
+         * start them from zero when they have no cached progress
          */
-        MegaNode *authorizeChatNode(MegaNode *node, const char *cauth);
-#endif
+        void setPartialDownloadResumption(bool enable);
 
         /**
-         * @brief Get the SDK version
+         * @brief Coalesce background network activity, to save battery on mobile networks
          *
-         * The returned string is an statically allocated array.
-         * Do not delete it.
+         * Every request wakes the cellular radio up, and the radio stays in a high power state for
+         * some seconds after it. Many requests of the SDK are background work that nobody waits on,
+         * such as the periodic refresh of the user data and the events it reports.
          *
-         * @return SDK version
+         * When enabled, those requests are held until other traffic wakes the radio up anyway (a
+         * request of the app, a transfer, or an action packet), and go with it. A request held for
+         * a minute goes on its own. Requests of the app are never held.
+         *
+         * @param enable True to hold background requests, false (the default) to send them at once
+         * @see MegaApi::getRadioWakeupsSaved
          */
-        const char *getVersion();
+        void setMobileEfficiency(bool enable);
 
         /**
-         * @brief Get a string with the version of the operating system
+         * @brief Get the number of times background requests went along with other traffic
          *
-         * You take the ownership of the returned string
+         * Each of them is a wakeup of the radio saved by MegaApi::setMobileEfficiency since the
+         * MegaApi was created.
          *
-         * @return Version of the operating system
+         * @return Number of radio wakeups saved
          */
-        char *getOperatingSystemVersion();
+        long long getRadioWakeupsSaved();
+
+        enum {
+            WORKER_CLASS_NODES = 0,
+            WORKER_CLASS_FILES = 1,
+            WORKER_CLASS_GFX = 2
+        };
 
         /**
-         * @brief Get the last available version of the app
+         * @brief Set the number of worker threads the SDK uses for parallel work
          *
-         * It returns the last available version corresponding to an app token
+         * Some work is spread over several threads while the SDK waits for it: decrypting the keys
+         * and attributes of many nodes, checking their signatures, fingerprinting several files,
+         * encrypting pieces of files, and generating thumbnails, previews and media properties. All of
+         * it runs on one pool of worker threads, shared by all the MegaApi objects of the process, plus
+         * the thread that waits. By default, there is one worker
+         * thread per core, minus one.
          *
-         * The associated request type with this request is MegaRequest::TYPE_APP_VERSION
-         * Valid data in the MegaRequest object received on callbacks:
-         * - MegaRequest::getText - Returns the app token
+         * Threads that wait on the network or the disk, such as those of transfers, syncs, logging
+         * and the local cache, are not part of the pool.
          *
-         * Valid data in the MegaRequest object received in onRequestFinish when the error code
-         * is MegaError::API_OK:
-         * - MegaRequest::getNumber - Returns the last available version code of the app
-         * - MegaRequest::getName - Returns the last available version string of the app
+         * @param threads Number of worker threads, 0 to do all the work in the waiting thread, or -1
+         * for the default
+         */
+        static void setWorkerThreads(int threads);
+
+        /**
+         * @brief Limit the worker threads that work on one class of work at once
          *
-         * Usually, the version code is used to internally control updates, and the version
-         * string is intended to be shown to final users.
+         * Work of the class MegaApi::WORKER_CLASS_NODES (node keys, attributes, signatures) is taken
+         * before work of the class MegaApi::WORKER_CLASS_FILES (fingerprints and encryption of local
+         * files), and both before work of the class MegaApi::WORKER_CLASS_GFX (thumbnails, previews and
+         * media properties), by the worker threads that are free. A limit keeps some threads for the
+         * other classes.
          *
-         * @param appKey Token of the app to check or NULL to use the same value as in the
-         * initialization of the MegaApi object
-         * @param listener MegaRequestListener to track this request
+         * @param workerClass MegaApi::WORKER_CLASS_NODES, MegaApi::WORKER_CLASS_FILES or
+         * MegaApi::WORKER_CLASS_GFX
+         * @param maxThreads Maximum number of worker threads for the class, 0 (the default) for no limit
          */
-        void getLastAvailableVersion(const char *appKey = NULL, MegaRequestListener *listener = NULL);
+        static void setWorkerClassLimit(int workerClass, int maxThreads);
 
         /**
-         * @brief Get a SSL certificate for communications with the webclient
+         * @brief Run the worker threads on some cores only
          *
-         * The associated request type with this request is MegaRequest::TYPE_GET_LOCAL_SSL_CERT
+         * The threads are pinned to the cores of the mask (bit i is core i) on Linux and Windows, and
+         * the setting is ignored elsewhere. The threads are started again with the new setting.
          *
-         * Valid data in the MegaRequest object received in onRequestFinish when the error code
-         * is MegaError::API_OK:
-         * - MegaRequest::getNumber - Returns the expiration time of the certificate (in seconds since the Epoch)
-         * - MegaRequest::getMegaStringMap - Returns the data of the certificate
+         * @param cpuMask Cores for the worker threads, 0 (the default) for any
+         */
+        static void setWorkerAffinity(long long cpuMask);
+
+        /**
+         * @brief Run many MegaApi objects on a few threads
          *
-         * The data returned in the string map is encoded in PEM format.
-         * The key "key" of the map contains the private key of the certificate.
-         * The key "cert" of the map contains the certificate.
-         * Intermediate certificates are provided in keys "intermediate_1" - "intermediate_X".
+         * By default, each MegaApi object has a thread of its own, which waits on its connections and
+         * runs its requests, transfers and callbacks. With shared event loops, the MegaApi objects
+         * created afterwards are spread over a fixed set of threads instead, each waiting on the
+         * connections of many objects at once and running those that have work. The objects of one
+         * thread also share their connections to MEGA, so fewer of them stay open.
          *
-         * @param listener MegaRequestListener to track this request
+         * Each object keeps its own session, cache and transfers. The objects of one thread run one at
+         * a time, so a callback that takes long delays the others of its thread.
+         *
+         * Objects created before the call, or while it is set to 0, keep threads of their own. The
+         * setting is ignored on Windows and iOS.
+         *
+         * @param threads Number of threads, 0 (the default) for a thread per MegaApi object
          */
-        void getLocalSSLCertificate(MegaRequestListener *listener = NULL);
+        static void setSharedEventLoops(int threads);
 
         /**
-         * @brief Get the IP of a MegaChat server
+         * @brief Write downloads to disk in large sequential pieces
          *
-         * This function allows to get the correct IP to connect to a MEGAchat server
-         * using Websockets.
+         * Downloads receive their data in pieces of up to a few MB, on several connections, and write
+         * each piece as soon as it is decrypted, in the order the pieces arrive. On spinning disks and
+         * network shares, these small writes all over the file are slow.
          *
-         * The associated request type with this request is MegaRequest::TYPE_QUERY_DNS
+         * When enabled, the pieces that follow each other are gathered in memory and written together,
+         * so that files are written front to back in large writes. The gathered data counts as saved
+         * (and is kept if the download is resumed later) once it is written. Pieces that arrive out of
+         * order are still written on their own.
          *
-         * Valid data in the MegaRequest object received in onRequestFinish when the error code
-         * is MegaError::API_OK:
-         * - MegaRequest::getText - Returns the IP of the hostname.
-         * IPv6 addresses are returned between brackets
+         * Best combined with MegaApi::setDownloadPreallocation.
          *
-         * @param hostname Hostname to resolve
-         * @param listener MegaRequestListener to track this request
+         * @param bytes Size of the writes, from 1 MB to 64 MB (e.g. 16 MB), or 0 (the default) to write
+         * each piece as it arrives
          */
-        void queryDNS(const char *hostname, MegaRequestListener *listener = NULL);
+        void setDownloadWriteCoalescing(int bytes);
 
         /**
-         * @brief queryGeLB Query the GeLB server for a given service
+         * @brief Read the files of uploads ahead of their connections
          *
-         * The associated request type with this request is MegaRequest::TYPE_QUERY_GELB
+         * Uploads read their files one chunk at a time, when a connection is ready to send it, so
+         * each connection waits for the disk before it sends. On network shares and slow disks,
+         * every chunk costs a round trip to the storage.
          *
-         * Valid data in the MegaRequest object received in onRequestFinish when the error code
-         * is MegaError::API_OK:
-         * - MegaRequest::getNumber - Return the HTTP status code from the GeLB server
-         * - MegaRequest::getText - Returns the JSON response from the GeLB server
-         * - MegaRequest::getTotalBytes - Returns the number of bytes in the response
+         * When enabled, each upload of a file larger than 1 MB reads its file ahead on a thread of
+         * its own, up to the given number of bytes ahead of what the connections have sent, and
+         * tells the system that the file is read sequentially. The connections take their chunks
+         * from memory, and read them directly only if they were not read ahead.
          *
-         * @param service Service to check
-         * @param timeoutds Timeout for the request, including all possible retries (in deciseconds)
-         * A value <= 0 means no (or infinite) timeout.
-         * @param maxretries Maximum number of retries for the request
-         * @param listener MegaRequestListener to track this request
+         * @param bytes Bytes read ahead per upload, up to 256 MB (e.g. 16 MB), or 0 (the default) to
+         * read each chunk when it's sent
          */
-        void queryGeLB(const char *service, int timeoutds = 40, int maxretries = 4, MegaRequestListener *listener = NULL);
+        void setUploadReadahead(int bytes);
 
         /**
-         * @brief Download a file using a HTTP GET request
+         * @brief Keep only some folders of the account in memory
          *
-         * The associated request type with this request is MegaRequest::TYPE_DOWNLOAD_FILE
+         * After fetchnodes, the whole tree of the account is in memory, even if the app only
+         * syncs one folder. With a scope, only the nodes below the given folders and below the
+         * inbound shares are kept, with the folders on the way to them and the root nodes. The
+         * nodes outside of it are dropped as they are read, both from the filesystem fetched at
+         * login and from the changes received later, so the memory and the local cache hold
+         * only the scope.
          *
-         * Valid data in the MegaRequest object received in onRequestFinish when the error code
-         * is MegaError::API_OK:
-         * - MegaRequest::getNumber - Return the HTTP status code from the server
-         * - MegaRequest::getTotalBytes - Returns the number of bytes of the file
+         * The scope must be set before MegaApi::fetchNodes, and applies to the current session
+         * (logging out clears it). Each scope has its own local cache. Nodes created by this
+         * MegaApi outside of the scope are still available until the next fetch.
          *
-         * If the request finishes with the error code MegaError::API_OK, the destination path
-         * contains the downloaded file. If it's not possible to write in the destination path
-         * the error code will be MegaError::API_EWRITE
+         * Syncs and operations on nodes out of the scope are not possible.
          *
-         * @param url URL of the file
-         * @param dstpath Destination path for the downloaded file
-         * @param listener MegaRequestListener to track this request
+         * @param folders Handles of the folders to keep (e.g. the remote roots of the syncs),
+         * or NULL to keep the whole account
          */
-        void downloadFile(const char *url, const char *dstpath, MegaRequestListener *listener = NULL);
+        void setNodeScope(MegaHandleList *folders);
 
         /**
-         * @brief Get the User-Agent header used by the SDK
+         * @brief Keep a node, and everything below it, in memory
          *
-         * The SDK retains the ownership of the returned value. It will be valid until
-         * the MegaApi object is deleted.
+         * Only relevant with MegaApi::setNodeMemoryBudget.
          *
-         * @return User-Agent used by the SDK
+         * @param node Node to pin or unpin
+         * @param pin True to pin it, false to release it
          */
-        const char *getUserAgent();
+        void pinNode(MegaNode *node, bool pin);
 
         /**
-         * @brief Get the base path set during initialization
+         * @brief Send read-only requests on extra connections instead of queueing them behind the others
          *
-         * The SDK retains the ownership of the returned value. It will be valid until
-         * the MegaApi object is deleted.
+         * Requests whose result does not depend on the requests around them (currently, fetching
+         * user attributes and public keys) are batched apart and sent on up to this many additional
+         * connections, in parallel with the ordered channel. Their results are still delivered in
+         * the order they were sent. Everything else keeps its strict ordering.
          *
-         * @return Base path
+         * @param connections Maximum number of extra in-flight batches. 0 (the default) disables it
          */
-        const char *getBasePath();
+        void setApiPipelining(int connections);
+
+        /**
+         * @brief Compress large batches of requests before sending them
+         *
+         * Batches of at least this size (typically, creating many nodes or rewriting share keys)
+         * are sent gzipped, which shortens them many times over on slow uplinks. If the server
+         * rejects a compressed batch, it is sent again as is and compression is turned off.
+         *
+         * The number of compressed batches and the bytes saved are part of the request statistics
+         * in the logs.
+         *
+         * @param minBatchSize Smallest batch, in bytes, to compress. 0 (the default) disables it
+         */
+        void setRequestCompression(long long minBatchSize);
 
         /**
          * @brief Disable special features related to images and videos
@@ -14203,6 +15863,34 @@ class MegaApi
          */
         bool areGfxFeaturesDisabled();
 
+        /**
+         * @brief Decode images and videos in separate processes
+         *
+         * Thumbnails and previews are generated from files that may come from anywhere. When this is
+         * enabled, each instance of the graphic processor decodes them in a child process of its own, so
+         * that a decoder that crashes or hangs on a file only loses that file: the child is restarted for
+         * the next one. Each step of a file (decoding, generating the thumbnail or the preview) is given
+         * up after 30 seconds.
+         *
+         * This is only available on platforms that can fork processes (not Windows nor iOS), and with the
+         * graphic processors built in the SDK. Otherwise, images are still processed in the app.
+         *
+         * By default, images are processed in the app.
+         *
+         * @param enable True to decode images and videos in separate processes
+         */
+        void setGfxIsolation(bool enable);
+
+        /**
+         * @brief Check if images and videos are decoded in separate processes
+         *
+         * It becomes false if no child process could be started.
+         *
+         * @return True if images and videos are decoded in separate processes
+         * @see MegaApi::setGfxIsolation
+         */
+        bool isGfxIsolated();
+
         /**
          * @brief Change the API URL
          *
@@ -14643,6 +16331,7 @@ class MegaApi
          * - Folder nodes are NOT allowed to be served (see MegaApi::httpServerEnableFolderServer)
          * - File nodes are allowed to be served (see MegaApi::httpServerEnableFileServer)
          * - Subtitles support is disabled (see MegaApi::httpServerEnableSubtitlesSupport)
+         * - HLS playlists are disabled (see MegaApi::httpServerEnableHLSSupport)
          *
          * The HTTP server will only stream a node if it's allowed by all configuration options.
          *
@@ -14848,6 +16537,68 @@ class MegaApi
          */
         bool httpServerIsSubtitlesSupportEnabled();
 
+        /**
+         * @brief Enable/disable HLS playlists for MPEG-TS files
+         *
+         * When this feature is enabled, appending ".m3u8" to the link of a file ending in ".ts" returns
+         * an HLS playlist for it:
+         * http://120.0.0.1:4443/<Base64Handle>/MyHolidays.ts.m3u8
+         *
+         * The playlist splits the original file into byte ranges of about six seconds of media, using
+         * its duration, so clients on unreliable connections can fetch, retry and seek by segments.
+         * Nothing is transcoded: the segments are served as ranges of the original link, through the
+         * same streaming path and readahead (see MegaApi::setStreamingReadahead).
+         *
+         * Files that are not MPEG-TS, or without a known duration, don't have a playlist.
+         *
+         * This feature is disabled by default.
+         *
+         * @param enable True to enable HLS playlists, false to disable them
+         */
+        void httpServerEnableHLSSupport(bool enable);
+
+        /**
+         * @brief Check if HLS playlists are enabled
+         *
+         * See MegaApi::httpServerEnableHLSSupport.
+         *
+         * This feature is disabled by default.
+         *
+         * @return true if HLS playlists are enabled, otherwise false
+         */
+        bool httpServerIsHLSSupportEnabled();
+
+        /**
+         * @brief Enable/disable the metrics endpoint of the HTTP proxy server
+         *
+         * When this feature is enabled, http://127.0.0.1:4443/metrics returns, in the OpenMetrics
+         * text format (which Prometheus scrapes), the bytes transferred, the transfer speeds, the
+         * transfers queued and active, the API requests and batches in flight, the action packets
+         * and how long own changes take to come back as one, the notifications waiting in the
+         * syncs, and the duration of the timed sections of the SDK (such as the commits to the
+         * local cache). The durations are only measured while MegaApi::setPerformanceStatsEnabled
+         * is on.
+         *
+         * The endpoint doesn't depend on the restricted mode of the server and doesn't reveal
+         * any node. Only GET and HEAD are answered.
+         *
+         * This feature is disabled by default.
+         *
+         * @param enable True to enable the metrics endpoint, false to disable it
+         */
+        void httpServerEnableMetrics(bool enable);
+
+        /**
+         * @brief Check if the metrics endpoint of the HTTP proxy server is enabled
+         *
+         * See MegaApi::httpServerEnableMetrics.
+         *
+         * This feature is disabled by default.
+         *
+         * @return true if the metrics endpoint is enabled, otherwise false
+         */
+        bool httpServerIsMetricsEnabled();
+
         /**
          * @brief Add a listener to receive information about the HTTP proxy server
          *
@@ -14998,6 +16749,9 @@ class MegaApi
          * It's recommended to set this value to at least 8192 and no more than the 25% of
          * the maximum buffer size (MegaApi::httpServerSetMaxBufferSize).
          *
+         * By default, the size of each write follows the send buffer of the socket, with
+         * a minimum of 16384 bytes and no more than the 25% of the maximum buffer size.
+         *
          * The new value will be taken into account since the next request received by
          * the HTTP proxy server, not for ongoing requests. It's possible and effective
          * to call this function even before the server has been started, and the value
@@ -15017,6 +16771,36 @@ class MegaApi
          */
         int httpServerGetMaxOutputSize();
 
+        /**
+         * @brief Set the number of event loops of the HTTP proxy server
+         *
+         * By default, all the connections of the HTTP proxy server are served by a single
+         * thread. With more than one loop, each one runs on its own thread and accepts its
+         * own connections on the same port, so the load is spread over several cores.
+         * Each connection stays in the loop that accepted it until it's closed.
+         *
+         * This requires the kernel to balance the connections between sockets bound with
+         * SO_REUSEPORT, so it's only available on Linux. On other platforms a single loop
+         * is always used.
+         *
+         * The new value will be taken into account the next time the HTTP proxy server
+         * is started. It's possible to call this function before the server has been
+         * started, and the value will be still active even if the server is stopped and
+         * started again.
+         *
+         * @param loops Number of event loops. A number <= 1 means a single loop
+         */
+        void httpServerSetEventLoops(int loops);
+
+        /**
+         * @brief Get the number of event loops of the HTTP proxy server
+         *
+         * See MegaApi::httpServerSetEventLoops
+         *
+         * @return Number of event loops requested for the HTTP proxy server
+         */
+        int httpServerGetEventLoops();
+
         /**
          * @brief Start an FTP server in specified port
          *
@@ -15264,6 +17048,9 @@ class MegaApi
          * It's recommended to set this value to at least 8192 and no more than the 25% of
          * the maximum buffer size (MegaApi::ftpServerSetMaxBufferSize).
          *
+         * By default, the size of each write follows the send buffer of the socket, with
+         * a minimum of 16384 bytes and no more than the 25% of the maximum buffer size.
+         *
          * The new value will be taken into account since the next request received by
          * the FTP server, not for ongoing requests. It's possible and effective
          * to call this function even before the server has been started, and the value
@@ -15524,6 +17311,66 @@ class MegaApi
          */
         void removeAccessInChat(MegaHandle chatid, MegaNode *n, MegaHandle uh, MegaRequestListener *listener = NULL);
 
+        /**
+         * @brief Allows a logged in operator/moderator to grant access to many nodes to a user
+         *
+         * It works like MegaApi::grantAccessInChat for every node, but the commands for all
+         * of them are sent to MEGA together, so attaching many files to a message costs a few
+         * requests instead of one per node.
+         * Nodes that fail get their own error code in the results, and don't fail the request:
+         * it finishes with MegaError::API_OK when every node succeeded, otherwise with
+         * MegaError::API_EINCOMPLETE.
+         *
+         * The associated request type with this request is MegaRequest::TYPE_CHAT_GRANT_ACCESS_NODES
+         * Valid data in the MegaRequest object received on callbacks:
+         * - MegaRequest::getParentHandle - Returns the chat identifier
+         * - MegaRequest::getEmail - Returns the MegaHandle of the user in Base64 enconding
+         * - MegaRequest::getTotalBytes - Returns the number of nodes
+         * - MegaRequest::getTransferredBytes - Returns the number of nodes done
+         * - MegaRequest::getNumDetails - Returns the number of nodes that failed
+         *
+         * Valid data in the MegaRequest object received in onRequestFinish:
+         * - MegaRequest::getMegaStringMap - Returns the error code of each node (as a decimal
+         * string), by the Base64 handle of the node
+         *
+         * On the onRequestFinish error, the error code associated to the MegaError can be:
+         * - MegaError::API_ENOENT- If the chatroom doesn't exist.
+         *
+         * @param chatid MegaHandle that identifies the chat room
+         * @param nodes Nodes that want to be shared
+         * @param uh MegaHandle that identifies the user
+         * @param listener MegaRequestListener to track this request
+         */
+        void grantAccessToNodesInChat(MegaHandle chatid, MegaNodeList *nodes, MegaHandle uh, MegaRequestListener *listener = NULL);
+
+        /**
+         * @brief Removes access to many nodes from a user you previously granted access to.
+         *
+         * It works like MegaApi::removeAccessInChat for every node, with the commands sent
+         * together and the results reported as by MegaApi::grantAccessToNodesInChat.
+         *
+         * The associated request type with this request is MegaRequest::TYPE_CHAT_REMOVE_ACCESS_NODES
+         * Valid data in the MegaRequest object received on callbacks:
+         * - MegaRequest::getParentHandle - Returns the chat identifier
+         * - MegaRequest::getEmail - Returns the MegaHandle of the user in Base64 enconding
+         * - MegaRequest::getTotalBytes - Returns the number of nodes
+         * - MegaRequest::getTransferredBytes - Returns the number of nodes done
+         * - MegaRequest::getNumDetails - Returns the number of nodes that failed
+         *
+         * Valid data in the MegaRequest object received in onRequestFinish:
+         * - MegaRequest::getMegaStringMap - Returns the error code of each node (as a decimal
+         * string), by the Base64 handle of the node
+         *
+         * On the onRequestFinish error, the error code associated to the MegaError can be:
+         * - MegaError::API_ENOENT- If the chatroom doesn't exist.
+         *
+         * @param chatid MegaHandle that identifies the chat room
+         * @param nodes Nodes whose access wants to be revoked
+         * @param uh MegaHandle that identifies the user
+         * @param listener MegaRequestListener to track this request
+         */
+        void removeAccessToNodesInChat(MegaHandle chatid, MegaNodeList *nodes, MegaHandle uh, MegaRequestListener *listener = NULL);
+
         /**
          * @brief Allows a logged in operator/moderator to adjust the permissions on any other user
          * in their group chat. This does not work for a 1:1 chat.
@@ -15698,6 +17545,19 @@ class MegaApi
          */
         bool hasAccessToAttachment(MegaHandle chatid, MegaHandle h, MegaHandle uh);
 
+        /**
+         * @brief Get the chatrooms the specified node is attached to
+         *
+         * The chats are found from an index kept by the SDK, without going through every chat.
+         *
+         * You take the ownership of the returned value
+         *
+         * @param h MegaHandle that identifies the node
+         *
+         * @return A list of the handles of the chats where some user has access to the node
+         */
+        MegaHandleList *getAttachmentChats(MegaHandle h);
+
         /**
          * @brief Get files attributes from a node
          * You take the ownership of the returned value
@@ -16179,6 +18039,97 @@ private:
 	MegaHashSignatureImpl *pImpl;
 };
 
+class MegaSharedNodeViewImpl;
+
+/**
+ * @brief Read-only view of the nodes written by another process with MegaApi::setSharedNodeView
+ *
+ * The file is mapped in memory and searched in place, so opening it is cheap even for large
+ * accounts. The nodes returned only have their handle, parent handle, type, name, size and times.
+ * They can't be used in requests of a MegaApi.
+ */
+class MegaSharedNodeView
+{
+public:
+    /**
+     * @brief Open the view written at a path
+     *
+     * Check MegaSharedNodeView::isValid to know if it could be opened.
+     *
+     * @param path Path of the file
+     * @param base64Key Base64-encoded 16-byte key the file was written with
+     */
+    MegaSharedNodeView(const char *path, const char *base64Key);
+    ~MegaSharedNodeView();
+
+    /**
+     * @brief Check if the view is open
+     * @return false if the file is missing, damaged, or was written with another key
+     */
+    bool isValid();
+
+    /**
+     * @brief Get the version of the nodes in the view
+     *
+     * It grows each time the file is rewritten.
+     *
+     * @return Version of the nodes, 0 if the view isn't open
+     */
+    long long getGeneration();
+
+    /**
+     * @brief Open the latest version of the file, if it was rewritten since
+     *
+     * The nodes previously returned remain valid.
+     *
+     * @return true if a newer version was opened
+     */
+    bool refresh();
+
+    /**
+     * @brief Get the handle of the root node of the account
+     * @return Handle of the root node
+     */
+    MegaHandle getRootNode();
+
+    /**
+     * @brief Get the handle of the inbox of the account
+     * @return Handle of the inbox
+     */
+    MegaHandle getInboxNode();
+
+    /**
+     * @brief Get the handle of the rubbish bin of the account
+     * @return Handle of the rubbish bin
+     */
+    MegaHandle getRubbishNode();
+
+    /**
+     * @brief Get a node of the view
+     *
+     * You take the ownership of the returned value
+     *
+     * @param handle Handle of the node
+     * @return The node, or NULL if it isn't in the view
+     */
+    MegaNode *getNodeByHandle(MegaHandle handle);
+
+    /**
+     * @brief Get the children of a node of the view
+     *
+     * You take the ownership of the returned value
+     *
+     * @param parentHandle Handle of the parent node
+     * @return List with the children, in no particular order
+     */
+    MegaNodeList *getChildren(MegaHandle parentHandle);
+
+private:
+    MegaSharedNodeViewImpl *pImpl;
+    MegaSharedNodeView(const MegaSharedNodeView&) = delete;
+    MegaSharedNodeView& operator=(const MegaSharedNodeView&) = delete;
+};
+
 /**
  * @brief Details about a MEGA balance
  */
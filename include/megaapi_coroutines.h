@@ -0,0 +1,540 @@
+/**
+ * @file megaapi_coroutines.h
+ * @brief C++20 coroutines over the requests and transfers of MegaApi
+ *
+ * (c) 2013-2020 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGAAPI_COROUTINES_H
+#define MEGAAPI_COROUTINES_H
+
+// header only, and empty unless the compiler has coroutines: the SDK itself is built as C++11
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "megaapi.h"
+
+namespace mega {
+namespace coro {
+
+/**
+ * @brief Where a coroutine goes on once the operation it awaits finishes
+ *
+ * post() is called in the SDK thread, from the callback that finished the operation.
+ */
+class Executor
+{
+public:
+    virtual void post(std::coroutine_handle<> continuation) = 0;
+    virtual ~Executor() = default;
+};
+
+/**
+ * @brief Resumes the coroutine right away, in the SDK thread
+ *
+ * No thread switch, but the SDK waits for the coroutine to suspend again, as it waits for any
+ * callback: keep the work between two operations short.
+ */
+class InlineExecutor : public Executor
+{
+public:
+    void post(std::coroutine_handle<> continuation) override
+    {
+        continuation.resume();
+    }
+
+    static InlineExecutor& get()
+    {
+        static InlineExecutor executor;
+        return executor;
+    }
+};
+
+/**
+ * @brief Resumes the coroutines in the thread that calls run() or runOne()
+ */
+class QueueExecutor : public Executor
+{
+public:
+    void post(std::coroutine_handle<> continuation) override
+    {
+        {
+            std::lock_guard<std::mutex> g(mutex);
+            ready.push_back(continuation);
+        }
+        available.notify_one();
+    }
+
+    // wait for a coroutine to be ready and resume it, unless stop() was called
+    bool runOne()
+    {
+        std::coroutine_handle<> continuation;
+        {
+            std::unique_lock<std::mutex> g(mutex);
+            available.wait(g, [this]() { return stopped || !ready.empty(); });
+            if (ready.empty())
+            {
+                return false;
+            }
+            continuation = ready.front();
+            ready.pop_front();
+        }
+        continuation.resume();
+        return true;
+    }
+
+    // resume coroutines until stop()
+    void run()
+    {
+        while (runOne()) { }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> g(mutex);
+            stopped = true;
+        }
+        available.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable available;
+    std::deque<std::coroutine_handle<>> ready;
+    bool stopped = false;
+};
+
+/**
+ * @brief A finished request: a copy of the MegaRequest and its error
+ *
+ * request is null if the request was not started because its MegaCancelToken was cancelled
+ * (the error is then MegaError::API_EINCOMPLETE).
+ */
+struct RequestResult
+{
+    std::unique_ptr<MegaRequest> request;
+    std::unique_ptr<MegaError> error;
+
+    int errorCode() const { return error->getErrorCode(); }
+    explicit operator bool() const { return error->getErrorCode() == MegaError::API_OK; }
+};
+
+/**
+ * @brief A finished transfer: a copy of the MegaTransfer and its error
+ *
+ * transfer is null if the transfer was not started because its MegaCancelToken was cancelled
+ * (the error is then MegaError::API_EINCOMPLETE).
+ */
+struct TransferResult
+{
+    std::unique_ptr<MegaTransfer> transfer;
+    std::unique_ptr<MegaError> error;
+
+    int errorCode() const { return error->getErrorCode(); }
+    explicit operator bool() const { return error->getErrorCode() == MegaError::API_OK; }
+};
+
+/**
+ * @brief The request started by start(listener), as an awaitable
+ *
+ * The awaiter is the listener of the request: it lives in the frame of the awaiting coroutine,
+ * so awaiting a request allocates nothing besides the copies of the finished MegaRequest and
+ * its MegaError, which the SDK deletes once the callback returns.
+ */
+template <typename Start>
+class RequestAwaiter : public MegaRequestListener
+{
+public:
+    RequestAwaiter(Start s, Executor& e, MegaCancelToken* t)
+        : start(std::move(s)), executor(e), cancelToken(t)
+    {
+    }
+
+    bool await_ready() const
+    {
+        return cancelToken && cancelToken->isCancelled();
+    }
+
+    void await_suspend(std::coroutine_handle<> continuation)
+    {
+        awaiting = continuation;
+        started = true;
+
+        // the request may finish, and the frame be gone, before start() returns
+        Start s = std::move(start);
+        s(static_cast<MegaRequestListener*>(this));
+    }
+
+    RequestResult await_resume()
+    {
+        if (!started)
+        {
+            result.error.reset(new MegaError(MegaError::API_EINCOMPLETE));
+        }
+        return std::move(result);
+    }
+
+    void onRequestFinish(MegaApi*, MegaRequest* request, MegaError* e) override
+    {
+        result.request.reset(request->copy());
+        result.error.reset(e->copy());
+
+        // nothing of this object is used once the coroutine can run
+        Executor& ex = executor;
+        ex.post(awaiting);
+    }
+
+private:
+    Start start;
+    Executor& executor;
+    MegaCancelToken* cancelToken;
+    std::coroutine_handle<> awaiting;
+    RequestResult result;
+    bool started = false;
+};
+
+/**
+ * @brief The transfer started by start(listener), as an awaitable
+ *
+ * Cancelling the MegaCancelToken cancels the transfer at its next update, and the result has the
+ * error it finished with (usually MegaError::API_EINCOMPLETE).
+ */
+template <typename Start>
+class TransferAwaiter : public MegaTransferListener
+{
+public:
+    TransferAwaiter(Start s, MegaApi& a, Executor& e, MegaCancelToken* t)
+        : start(std::move(s)), api(a), executor(e), cancelToken(t)
+    {
+    }
+
+    bool await_ready() const
+    {
+        return cancelToken && cancelToken->isCancelled();
+    }
+
+    void await_suspend(std::coroutine_handle<> continuation)
+    {
+        awaiting = continuation;
+        started = true;
+
+        Start s = std::move(start);
+        s(static_cast<MegaTransferListener*>(this));
+    }
+
+    TransferResult await_resume()
+    {
+        if (!started)
+        {
+            result.error.reset(new MegaError(MegaError::API_EINCOMPLETE));
+        }
+        return std::move(result);
+    }
+
+    void onTransferStart(MegaApi*, MegaTransfer* transfer) override
+    {
+        cancelIfRequested(transfer);
+    }
+
+    void onTransferUpdate(MegaApi*, MegaTransfer* transfer) override
+    {
+        cancelIfRequested(transfer);
+    }
+
+    void onTransferFinish(MegaApi*, MegaTransfer* transfer, MegaError* e) override
+    {
+        result.transfer.reset(transfer->copy());
+        result.error.reset(e->copy());
+
+        Executor& ex = executor;
+        ex.post(awaiting);
+    }
+
+private:
+    Start start;
+    MegaApi& api;
+    Executor& executor;
+    MegaCancelToken* cancelToken;
+    std::coroutine_handle<> awaiting;
+    TransferResult result;
+    bool started = false;
+    bool cancelRequested = false;
+
+    void cancelIfRequested(MegaTransfer* transfer)
+    {
+        if (!cancelRequested && cancelToken && cancelToken->isCancelled())
+        {
+            cancelRequested = true;
+            api.cancelTransfer(transfer);
+        }
+    }
+};
+
+/**
+ * @brief Await a request started by start, which gets the listener to pass to MegaApi
+ *
+ * @code
+ * RequestResult r = co_await mega::coro::request([&](MegaRequestListener* l) { api.fetchNodes(l); });
+ * @endcode
+ *
+ * start is not called if cancelToken is already cancelled.
+ */
+template <typename Start>
+RequestAwaiter<Start> request(Start start, Executor& executor = InlineExecutor::get(), MegaCancelToken* cancelToken = nullptr)
+{
+    return RequestAwaiter<Start>(std::move(start), executor, cancelToken);
+}
+
+/**
+ * @brief Await a transfer started by start, which gets the listener to pass to MegaApi
+ */
+template <typename Start>
+TransferAwaiter<Start> transfer(MegaApi& api, Start start, Executor& executor = InlineExecutor::get(), MegaCancelToken* cancelToken = nullptr)
+{
+    return TransferAwaiter<Start>(std::move(start), api, executor, cancelToken);
+}
+
+/**
+ * @brief The requests and transfers of a MegaApi that are usually chained, as awaitables
+ *
+ * @code
+ * mega::coro::Api a(api, executor);
+ * if (co_await a.login(email, password) && co_await a.fetchNodes())
+ * {
+ *     std::unique_ptr<MegaNode> node(api.getNodeByPath("/file"));
+ *     TransferResult t = co_await a.startDownload(node.get(), "/tmp/");
+ * }
+ * @endcode
+ *
+ * Any other call goes through request() or transfer().  The MegaApi, the executor and the
+ * MegaCancelToken must outlive the operations.
+ */
+class Api
+{
+public:
+    explicit Api(MegaApi& a, Executor& e = InlineExecutor::get(), MegaCancelToken* t = nullptr)
+        : api(a), executor(e), cancelToken(t)
+    {
+    }
+
+    auto login(const char* email, const char* password)
+    {
+        return request([this, email, password](MegaRequestListener* l) { api.login(email, password, l); });
+    }
+
+    auto fetchNodes()
+    {
+        return request([this](MegaRequestListener* l) { api.fetchNodes(l); });
+    }
+
+    auto logout()
+    {
+        return request([this](MegaRequestListener* l) { api.logout(l); });
+    }
+
+    auto createFolder(const char* name, MegaNode* parent)
+    {
+        return request([this, name, parent](MegaRequestListener* l) { api.createFolder(name, parent, l); });
+    }
+
+    auto startDownload(MegaNode* node, const char* localPath)
+    {
+        return transfer([this, node, localPath](MegaTransferListener* l) { api.startDownload(node, localPath, l); });
+    }
+
+    auto startUpload(const char* localPath, MegaNode* parent)
+    {
+        return transfer([this, localPath, parent](MegaTransferListener* l) { api.startUpload(localPath, parent, l); });
+    }
+
+    template <typename Start>
+    RequestAwaiter<Start> request(Start start)
+    {
+        return coro::request(std::move(start), executor, cancelToken);
+    }
+
+    template <typename Start>
+    TransferAwaiter<Start> transfer(Start start)
+    {
+        return coro::transfer(api, std::move(start), executor, cancelToken);
+    }
+
+private:
+    MegaApi& api;
+    Executor& executor;
+    MegaCancelToken* cancelToken;
+};
+
+/**
+ * @brief A coroutine that returns a T, started when it is awaited
+ *
+ * For the coroutines that chain the operations of MegaApi.  A task that nothing awaits can be
+ * started with detach(), and frees itself when it ends.
+ */
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+template <typename T>
+struct TaskPromiseBase
+{
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+    bool detached = false;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+        {
+            auto& promise = h.promise();
+            if (promise.detached)
+            {
+                h.destroy();
+                return std::noop_coroutine();
+            }
+            return promise.continuation ? promise.continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept { }
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception()
+    {
+        if (detached)
+        {
+            std::terminate();
+        }
+        exception = std::current_exception();
+    }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase<T>
+{
+    T value{};
+
+    Task<T> get_return_object();
+    void return_value(T v) { value = std::move(v); }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase<void>
+{
+    Task<void> get_return_object();
+    void return_void() { }
+};
+
+} // namespace detail
+
+template <typename T>
+class Task
+{
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> h) : handle(h) { }
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, {})) { }
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            handle = std::exchange(other.handle, {});
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() { reset(); }
+
+    bool await_ready() const noexcept { return !handle || handle.done(); }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+    {
+        handle.promise().continuation = continuation;
+        return handle;
+    }
+
+    T await_resume()
+    {
+        if (handle.promise().exception)
+        {
+            std::rethrow_exception(handle.promise().exception);
+        }
+        if constexpr (!std::is_void<T>::value)
+        {
+            return std::move(handle.promise().value);
+        }
+    }
+
+    // run it with nothing awaiting it
+    void detach()
+    {
+        auto h = std::exchange(handle, {});
+        h.promise().detached = true;
+        h.resume();
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    void reset()
+    {
+        if (handle)
+        {
+            handle.destroy();
+            handle = {};
+        }
+    }
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+} // namespace coro
+} // namespace mega
+
+#endif
+#endif // MEGAAPI_COROUTINES_H
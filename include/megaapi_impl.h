@@ -23,6 +23,7 @@
 #define MEGAAPI_IMPL_H
 
 #include <atomic>
+#include <fstream>
 #include <memory>
 
 #include "mega.h"
@@ -136,6 +137,8 @@ public:
     void removeMegaLogger(MegaLogger *logger);
     void setLogLevel(int logLevel);
     void setLogToConsole(bool enable);
+    void setAsync(bool enable, unsigned rateLimit);
+    bool setBinaryLog(const char* path);
     void postLog(int logLevel, const char *message, const char *filename, int line);
     void log(const char *time, int loglevel, const char *source, const char *message
 #ifdef ENABLE_LOG_PERFORMANCE
@@ -147,9 +150,18 @@ private:
     std::recursive_mutex mutex;
     set <MegaLogger *> megaLoggers;
     bool logToConsole;
+
+    // also written to, if set
+    std::unique_ptr<std::ofstream> binaryLogFile;
+    std::unique_ptr<BinaryLogger> binaryLogger;
+
+    // delivers to this one from its thread, if enabled; never deleted before this one, as
+    // threads may still be logging to it
+    std::unique_ptr<AsyncLogger> asyncLogger;
 };
 
 class MegaTransferPrivate;
+class MegaRequestPrivate;
 class MegaTreeProcCopy : public MegaTreeProcessor
 {
 public:
@@ -196,21 +208,150 @@ protected:
     int mLastError = { API_OK };
 };
 
-class MegaFolderUploadController : public MegaRequestListener, public MegaTransferListener, public MegaRecursiveOperation
+class MegaFolderUploadController : public MegaTransferListener, public MegaRecursiveOperation
 {
 public:
     MegaFolderUploadController(MegaApiImpl *megaApi, MegaTransferPrivate *transfer);
     void start(MegaNode* node) override;
     void cancel() override;
 
+    // result of the MegaApiImpl::putNodes() of a FolderTree
+    void onFolderTreeCreated(int tag, error e, NewNode *nn);
+
+    // larger trees are split, the rest of the folders waiting for the ones they go into
+    static const size_t MAX_FOLDERS_PER_PUTNODES = 1000;
+
+    // a file to upload, with what the folder listing said about it
+    struct PlannedUpload
+    {
+        std::string utf8path;
+        m_off_t size = -1;          // -1 if the listing didn't tell
+        handle fsid = UNDEF;
+        bool fsidvalid = false;
+        std::shared_ptr<MegaNode> parent;
+    };
+
+    // files of at least this size keep the bandwidth busy on their own
+    static const m_off_t LARGE_UPLOAD_SIZE = 8 * 1024 * 1024;
+
+    // small files started between two large ones
+    static const size_t SMALL_UPLOADS_PER_LARGE = 32;
+
+    // the order in which the files of a folder upload are started: each large file followed by a batch of
+    // small ones, so that the small files (bound by the latency of their requests) go along with transfers
+    // that fill the bandwidth.  Within each size class, by fsid (the inode, where there is one), to read
+    // them in about the order they are on disk
+    static void planUploads(std::vector<PlannedUpload>& uploads);
+
 protected:
-    void onFolderAvailable(MegaHandle handle);
+    // folders missing in MEGA, created with a single putnodes inside an existing folder
+    struct FolderTree
+    {
+        struct Folder
+        {
+            Folder(const std::string& n, handle p) : name(n), parent(p) { }
+
+            std::string name;
+
+            // temporary handle of the parent folder in this tree, UNDEF for the target
+            handle parent;
+
+            // files to upload once the folder exists (without parent)
+            std::vector<PlannedUpload> files;
+
+            // trees split off to be created inside this folder once it exists
+            std::vector<std::unique_ptr<FolderTree>> subtrees;
+        };
+
+        handle target = UNDEF;
+
+        // parents before children, the temporary handle of each folder is its index + 1
+        std::vector<Folder> folders;
+    };
+
+    void scanExistingFolder(std::string *localPath, MegaNode *remote);
+    void scanNewFolder(std::string *localPath, FolderTree *tree, size_t index);
+    void putFolderTree(std::unique_ptr<FolderTree> tree);
+    void planUpload(const std::string& localPath, const DirEntry& entry, std::shared_ptr<MegaNode> parent, std::vector<PlannedUpload>& uploads);
+    void startUploads();
     void checkCompletion();
 
-    std::list<std::string> pendingFolders;
+    // files found since startUploads() last ran
+    std::vector<PlannedUpload> plannedUploads;
+
+    // trees sent, by the tag of their putnodes
+    std::map<int, std::unique_ptr<FolderTree>> pendingTrees;
+
+public:
+    void onTransferStart(MegaApi *api, MegaTransfer *transfer) override;
+    void onTransferUpdate(MegaApi *api, MegaTransfer *transfer) override;
+    void onTransferFinish(MegaApi* api, MegaTransfer *transfer, MegaError *e) override;
+};
+
+
+// Copy of a large folder in putnodes of at most MAX_NODES_PER_PUTNODES nodes: the parts of the tree left
+// out of a putnodes are sent once the folder they go into exists, so the new nodes of the whole tree are
+// never built at once.  The nodes copied so far are reported as the transferred bytes of the request
+class MegaFolderCopyController
+{
+public:
+    MegaFolderCopyController(MegaApiImpl *megaApi, MegaRequestPrivate *request, Node *source, handle target, const std::string& newName);
+    ~MegaFolderCopyController();
+    void start();
+
+    // smaller trees are copied in a single putnodes
+    static const size_t MAX_NODES_PER_PUTNODES = 1000;
+    static const size_t MAX_PUTNODES_INFLIGHT = 4;
+
+protected:
+    // subtrees to copy into an existing folder
+    struct Part
+    {
+        handle target;
+        std::vector<handle> roots;
+    };
+
+    MegaApiImpl *megaApi;
+    MegaClient *client;
+    MegaRequestPrivate *request;
+    handle source;
+    std::string newName;
+
+    std::deque<Part> ready;
+
+    // subtrees left out of a putnodes, by the folder they go into
+    std::map<handle, std::vector<handle>> waiting;
+
+    // tags of the putnodes sent
+    std::set<int> inflight;
+
+    handle copiedRoot = UNDEF;
+    long long copied = 0;
+    error lastError = API_OK;
+
+    void putPart(Part&& part);
+    void onPartCopied(int putTag, error e, NewNode *nn, int count);
+    void checkCompletion();
+};
+
+
+// Parent transfer of a startUploads()/startDownloads() batch: puts all its files at the front of the
+// transfer queue at once and reports their progress as a whole
+class MegaBulkTransferController : public MegaTransferListener, public MegaRecursiveOperation
+{
+public:
+    // takes ownership of the items (with no tag yet) until start() queues them
+    MegaBulkTransferController(MegaApiImpl *megaApi, MegaTransferPrivate *transfer, std::vector<MegaTransferPrivate*>&& items);
+    ~MegaBulkTransferController();
+    void start(MegaNode* node) override;
+    void cancel() override;
+
+protected:
+    void checkCompletion();
+
+    std::vector<MegaTransferPrivate*> items;
 
 public:
-    void onRequestFinish(MegaApi* api, MegaRequest *request, MegaError *e) override;
     void onTransferStart(MegaApi *api, MegaTransfer *transfer) override;
     void onTransferUpdate(MegaApi *api, MegaTransfer *transfer) override;
     void onTransferFinish(MegaApi* api, MegaTransfer *transfer, MegaError *e) override;
@@ -313,6 +454,27 @@ protected:
     long long totalFiles;
     long long numberFolders;
 
+    // incremental backups: the node last backed up for each file (by utf8 path). Files still matching the
+    // fingerprint of that node are copied from it with batched putnodes instead of being uploaded again
+    std::map<std::string, handle> fileIndex;
+
+    struct UnchangedFile
+    {
+        std::string path;   // utf8
+        std::string name;
+        handle node;
+    };
+
+    // copies sent, with their target folder, by the tag of their putnodes
+    std::map<int, std::pair<handle, std::vector<UnchangedFile>>> pendingCopies;
+
+    static const size_t MAX_COPIES_PER_PUTNODES = 1000;
+
+    static std::string indexKey(std::string utf8path);
+    Node *unchangedNode(const std::string& utf8path, m_off_t size, m_time_t mtime);
+    void copyUnchanged(handle target, std::vector<UnchangedFile>&& files);
+    void onUnchangedCopied(int tag, error e, NewNode *nn);
+    void cancelCopies();
 
     // internal methods
     void onFolderAvailable(MegaHandle handle);
@@ -367,9 +529,32 @@ public:
     void cancel() override;
 
 protected:
-    void downloadFolderNode(MegaNode *node, string *path);
+    // a snapshot of the remote tree is taken first, then all the local folders are created, then all the
+    // files are queued at once
+    struct LocalFolder
+    {
+        string localpath;
+        size_t parent;
+        error e = API_OK;
+    };
+
+    struct RemoteFile
+    {
+        unique_ptr<MegaNode> node;
+        string path;    // utf8
+        size_t folder;
+    };
+
+    static const size_t NO_PARENT = size_t(-1);
+
+    void scanFolderNode(MegaNode *node, string *path, size_t parent);
+    void createLocalFolders();
+    void downloadFiles();
     void checkCompletion();
 
+    std::vector<LocalFolder> folders;
+    std::vector<RemoteFile> files;
+
 public:
     void onTransferStart(MegaApi *, MegaTransfer *t) override;
     void onTransferUpdate(MegaApi *, MegaTransfer *t) override;
@@ -424,6 +609,7 @@ class MegaNodePrivate : public MegaNode, public Cacheable
         bool isRemoved() override;
         bool hasChanged(int changeType) override;
         int getChanges() override;
+        void addChanges(int changes);
         bool hasThumbnail() override;
         bool hasPreview() override;
         bool isPublic() override;
@@ -633,6 +819,8 @@ class MegaTransferPrivate : public MegaTransfer, public Cacheable
         void setNodeHandle(MegaHandle nodeHandle);
         void setParentHandle(MegaHandle parentHandle);
 		void setNumConnections(int connections);
+        void setTimeToFirstByte(int milliseconds);
+        void setSavedBytes(long long bytes);
 		void setStartPos(long long startPos);
 		void setEndPos(long long endPos);
 		void setNumRetry(int retry);
@@ -658,6 +846,10 @@ class MegaTransferPrivate : public MegaTransfer, public Cacheable
         void setNotificationNumber(long long notificationNumber);
         void setListener(MegaTransferListener *listener);
 
+        // for streaming transfers that lend their data (see MegaApi::startStreamingBuffers), 0 otherwise
+        void setMaxHeldBytes(long long maxHeldBytes);
+        long long getMaxHeldBytes() const;
+
         int getType() const override;
         const char * getTransferString() const override;
         const char* toString() const override;
@@ -680,6 +872,9 @@ class MegaTransferPrivate : public MegaTransfer, public Cacheable
         int getTag() const override;
         long long getSpeed() const override;
         long long getMeanSpeed() const override;
+        int getNumConnections() const override;
+        int getTimeToFirstByte() const override;
+        long long getSavedBytes() const override;
         long long getDeltaSize() const override;
         int64_t getUpdateTime() const override;
         virtual MegaNode *getPublicNode() const;
@@ -708,6 +903,11 @@ class MegaTransferPrivate : public MegaTransfer, public Cacheable
 
         void startRecursiveOperation(unique_ptr<MegaRecursiveOperation>, MegaNode* node); // takes ownership of both
 
+        // attaches an operation for sendPendingTransfers() to start once this transfer has its tag
+        void setPendingRecursiveOperation(unique_ptr<MegaRecursiveOperation>);
+        bool hasPendingRecursiveOperation() const;
+        void startPendingRecursiveOperation();
+
     protected:
         int type;
         int tag;
@@ -731,6 +931,9 @@ class MegaTransferPrivate : public MegaTransfer, public Cacheable
         long long totalBytes;
         long long speed;
         long long meanSpeed;
+        int numConnections;
+        int timeToFirstByte;
+        long long savedBytes;
         long long deltaSize;
         long long notificationNumber;
         MegaHandle nodeHandle;
@@ -750,7 +953,23 @@ class MegaTransferPrivate : public MegaTransfer, public Cacheable
         MegaError lastError;
         int folderTransferTag;
         const char* appData;
+        long long maxHeldBytes = 0;
         unique_ptr<MegaRecursiveOperation> recursiveOperation;
+        unique_ptr<MegaRecursiveOperation> pendingRecursiveOperation;
+};
+
+class MegaTransferBufferPrivate : public MegaTransferBuffer
+{
+public:
+    // takes the ownership of the lease
+    MegaTransferBufferPrivate(DirectReadLease* lease);
+
+    const char *getData() const override;
+    size_t getSize() const override;
+    long long getOffset() const override;
+
+private:
+    unique_ptr<DirectReadLease> lease;
 };
 
 class MegaTransferDataPrivate : public MegaTransferData
@@ -1025,6 +1244,37 @@ protected:
     int state; 
 };
 
+class MegaSyncStatsPrivate : public MegaSyncStats
+{
+public:
+    MegaSyncStatsPrivate(int tag, const SyncStats& stats);
+
+    virtual MegaSyncStats *copy() const;
+
+    virtual int getTag() const;
+    virtual long long getQueuedNotifications() const;
+    virtual long long getQueuedRetries() const;
+    virtual long long getQueuedDelayed() const;
+    virtual long long getQueueLag() const;
+    virtual long long getScannedEntries() const;
+    virtual long long getScanRate() const;
+    virtual long long getPendingFolderCreations() const;
+    virtual long long getVanishedNodes() const;
+    virtual long long getQueuedDownloads() const;
+    virtual long long getQueuedUploads() const;
+    virtual long long getStateCacheFlushes() const;
+    virtual long long getStateCacheFlushTime() const;
+    virtual long long getLastStateCacheFlushTime() const;
+    virtual long long getLagSamples() const;
+    virtual long long getLastLag() const;
+    virtual long long getMaxLag() const;
+    virtual long long getAverageLag() const;
+
+protected:
+    int tag;
+    SyncStats stats;
+};
+
 #endif
 
 
@@ -1117,6 +1367,8 @@ class MegaRequestPrivate : public MegaRequest
         void setMegaStringTable(const MegaStringTable *stringTable);
         MegaFolderInfo *getMegaFolderInfo() const override;
         void setMegaFolderInfo(const MegaFolderInfo *);
+        MegaNodeList *getMegaNodeList() const override;
+        void setMegaNodeList(MegaNodeList *);     // takes ownership
         const MegaPushNotificationSettings *getMegaPushNotificationSettings() const override;
         void setMegaPushNotificationSettings(const MegaPushNotificationSettings *settings);
         MegaBackgroundMediaUpload *getMegaBackgroundMediaUploadPtr() const override;
@@ -1177,6 +1429,7 @@ protected:
         MegaStringListMap *mStringListMap;
         MegaStringTable *mStringTable;
         MegaFolderInfo *folderInfo;
+        MegaNodeList *nodeList;
         MegaPushNotificationSettings *settings;
         MegaBackgroundMediaUpload* backgroundMediaUpload;  // non-owned pointer
 };
@@ -1576,6 +1829,7 @@ class MegaNodeListPrivate : public MegaNodeList
         MegaNodeListPrivate();
         MegaNodeListPrivate(node_vector& v);
         MegaNodeListPrivate(Node** newlist, int size);
+        MegaNodeListPrivate(vector<MegaNode*>&& adopted);
         MegaNodeListPrivate(const MegaNodeListPrivate *nodeList, bool copyChildren = false);
         virtual ~MegaNodeListPrivate();
         MegaNodeList *copy() const override;
@@ -1721,21 +1975,39 @@ protected:
     int s;
 };
 
-class EncryptFilePieceByChunks : public EncryptByChunks
+class EncryptFilePieceInParallel
 {
-    // specialisation for encrypting a piece of a file without using too much RAM
-    FileAccess* fain;
-    FileAccess* faout;
-    m_off_t inpos, outpos;
-    string buffer;
-    unsigned lastsize;
-
+    // encrypts a piece of a file into another, chunk by chunk, on several threads.  Each thread has its own
+    // cipher, file handles and one chunk's worth of buffer: the CTR counter and the MAC of a chunk only depend
+    // on its position, and the CRC of the piece is the XOR of the threads' ones
 public:
+    // the input and output are local paths; progress, if any, counts the bytes encrypted
+    EncryptFilePieceInParallel(FileSystemAccess* fsaccess, const string& localinput, const string& localoutput,
+                               const byte* key, uint64_t ctriv, std::atomic<int64_t>* progress = nullptr);
 
-    EncryptFilePieceByChunks(FileAccess* cFain, m_off_t cInPos, FileAccess* cFaout, m_off_t cOutPos,
-                             SymmCipher* cipher, chunkmac_map* chunkmacs, uint64_t ctriv);
+    // encrypt [pos, npos) of the input to the start of the output.  The chunk MACs are added to macs
+    bool encrypt(m_off_t pos, m_off_t npos, unsigned threads, chunkmac_map& macs, string& urlSuffix);
 
-    byte* nextbuffer(unsigned bufsize) override;
+    static const unsigned MAXTHREADS = 4;
+
+private:
+    struct Chunk
+    {
+        m_off_t start, end;
+        byte mac[SymmCipher::BLOCKSIZE];
+    };
+
+    FileSystemAccess* fsaccess;
+    string localinput, localoutput;
+    const byte* key;
+    uint64_t ctriv;
+    std::atomic<int64_t>* progress;
+
+    vector<Chunk> chunks;
+    std::atomic<size_t> nextchunk;
+    std::atomic<bool> failed;
+
+    void work(m_off_t pos, byte* crc);
 };
 
 class MegaBackgroundMediaUploadPrivate : public MegaBackgroundMediaUpload
@@ -1748,6 +2020,7 @@ public:
     bool analyseMediaInfo(const char* inputFilepath) override;
     char *encryptFile(const char* inputFilepath, int64_t startPos, m_off_t* length, const char *outputFilepath,
                      bool adjustsizeonly) override;
+    int64_t getEncryptedBytes() override;
 
     char *getUploadURL() override;
 
@@ -1771,6 +2044,9 @@ public:
     bool unshareableGPS = false;
     handle thumbnailFA = INVALID_HANDLE;
     handle previewFA = INVALID_HANDLE;
+
+    // by the encryptFile call in progress, or the last one
+    std::atomic<int64_t> encryptedbytes{0};
 };
 
 struct MegaFile : public File
@@ -1829,16 +2105,106 @@ class TreeProcessor
         virtual ~TreeProcessor();
 };
 
+// What the name searches look for.  Names are compared case-insensitively, as strcasestr() does (ASCII only)
+struct NodeSearchFilter
+{
+    // lower-cased: a substring of the name or, if glob, a pattern for the whole name ('*' and '?')
+    string pattern;
+    bool glob = false;
+
+    // MegaNode::TYPE_FILE, MegaNode::TYPE_FOLDER or MegaNode::TYPE_UNKNOWN for both.  Negative
+    // bounds don't apply, and any bound leaves out the folders
+    int type = MegaNode::TYPE_UNKNOWN;
+    m_off_t minSize = -1;
+    m_off_t maxSize = -1;
+    m_time_t minMtime = -1;
+    m_time_t maxMtime = -1;
+
+    static string fold(const char*);
+
+    // the longest run of the pattern without wildcards, found in every name that matches
+    string literal() const;
+
+    bool matchesName(const char* folded, size_t length) const;
+
+    // everything but the name
+    bool matchesNode(const Node*) const;
+};
+
+// The lower-cased names of the files and folders, in a single buffer that substring and glob searches scan
+// with memchr/memcmp instead of walking the tree.  Renamed and removed entries leave their bytes behind until
+// they are half of the buffer
+class NodeNameIndex
+{
+    public:
+        void clear();
+        void add(handle h, const char* name);
+        void remove(handle h);
+        size_t size() const;
+
+        // handles of the entries whose name matches the filter (the rest of the filter is not checked)
+        void find(const NodeSearchFilter& filter, vector<handle>& results, MegaCancelToken* cancelToken = nullptr) const;
+
+    protected:
+        struct Entry
+        {
+            handle h;
+            size_t offset;
+            size_t length;
+            bool removed;
+        };
+
+        string names;               // each followed by a '\0'
+        vector<Entry> entries;      // by offset
+        std::unordered_map<handle, size_t> positions;
+        size_t removedBytes = 0;
+
+        void compact();
+};
+
+// The excluded names and paths of the syncs, compiled for the scans: names and paths without wildcards are
+// looked up in hash sets, "*.ext" names are compared by their end, and the other path patterns are only tried
+// in the folders whose path agrees with their literal start (worked out once per folder, as the entries of a
+// folder are checked one after the other).  Same matching as WildcardMatch(): case-sensitive, '*' and '?'
+class SyncExclusionMatcher
+{
+    public:
+        void setNames(const vector<string>& patterns);
+        void setPaths(const vector<string>& patterns);
+        void clear();
+
+        bool excludesName(const char* name) const;
+        bool hasPaths() const;
+
+        // path: full UTF-8 path of the entry, whose first folderLength bytes are its folder and separator
+        bool excludesPath(const string& path, size_t folderLength);
+
+    protected:
+        std::unordered_set<string> exactNames;
+        vector<string> nameSuffixes;
+        vector<string> wildcardNames;
+
+        std::unordered_set<string> exactPaths;
+        vector<string> wildcardPaths;
+
+        // the wildcard paths that may match in the last folder checked
+        string lastFolder;
+        bool lastFolderValid = false;
+        vector<const string*> lastFolderPaths;
+};
+
 class SearchTreeProcessor : public TreeProcessor
 {
     public:
         SearchTreeProcessor(const char *search);
+        SearchTreeProcessor(const NodeSearchFilter& filter);
         virtual bool processNode(Node* node);
         virtual ~SearchTreeProcessor() {}
         vector<Node *> &getResults();
 
     protected:
-        const char *search;
+        NodeSearchFilter filter;
+        bool valid;
         vector<Node *> results;
 };
 
@@ -1899,6 +2265,8 @@ class TreeProcFolderInfo : public TreeProc
     public:
         TreeProcFolderInfo();
         virtual void proc(MegaClient*, Node*);
+        TreeProc* fork() const override;
+        void merge(const TreeProc&) override;
         virtual ~TreeProcFolderInfo() {}
         MegaFolderInfo *getResult();
 
@@ -1910,19 +2278,110 @@ class TreeProcFolderInfo : public TreeProc
         long long versionsSize;
 };
 
-//Thread safe request queue
-class RequestQueue
+// Queue fed by any number of threads and consumed by the SDK thread (or a thread holding sdkMutex).
+// Producers push lock-free onto a stack; the consumer takes everything pushed so far with a single
+// exchange and keeps it, in arrival order, in a deque that producers never touch.
+template <class T>
+class MpscQueue
 {
+    struct Link
+    {
+        T *item;
+        Link *next;
+    };
+
+    std::atomic<Link *> incoming;
+
     protected:
-        std::deque<MegaRequestPrivate *> requests;
-        std::mutex mutex;
+        std::deque<T *> ready;
+
+        // consumer side only: the SDK thread versus removeListener() from app threads
+        std::mutex readyMutex;
 
+        // appends the items pushed since the last drain behind the ones already taken
+        void drain()
+        {
+            Link *l = incoming.exchange(nullptr, std::memory_order_acquire);
+            Link *reversed = nullptr;
+            while (l)
+            {
+                Link *next = l->next;
+                l->next = reversed;
+                reversed = l;
+                l = next;
+            }
+            while (reversed)
+            {
+                Link *next = reversed->next;
+                ready.push_back(reversed->item);
+                delete reversed;
+                reversed = next;
+            }
+        }
+
+    public:
+        MpscQueue() : incoming(nullptr) { }
+
+        ~MpscQueue()
+        {
+            Link *l = incoming.load();
+            while (l)
+            {
+                Link *next = l->next;
+                delete l;
+                l = next;
+            }
+        }
+
+        void push(T *item)
+        {
+            Link *l = new Link{item, incoming.load(std::memory_order_relaxed)};
+            while (!incoming.compare_exchange_weak(l->next, l, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        // consumer only: puts back an item ahead of everything else
+        void push_front(T *item)
+        {
+            std::lock_guard<std::mutex> g(readyMutex);
+            ready.push_front(item);
+        }
+
+        T *pop()
+        {
+            std::lock_guard<std::mutex> g(readyMutex);
+            if (ready.empty())
+            {
+                drain();
+                if (ready.empty())
+                {
+                    return nullptr;
+                }
+            }
+            T *item = ready.front();
+            ready.pop_front();
+            return item;
+        }
+
+        T *front()
+        {
+            std::lock_guard<std::mutex> g(readyMutex);
+            if (ready.empty())
+            {
+                drain();
+                if (ready.empty())
+                {
+                    return nullptr;
+                }
+            }
+            return ready.front();
+        }
+};
+
+//Thread safe request queue
+class RequestQueue : public MpscQueue<MegaRequestPrivate>
+{
     public:
         RequestQueue();
-        void push(MegaRequestPrivate *request);
-        void push_front(MegaRequestPrivate *request);
-        MegaRequestPrivate * pop();
-        MegaRequestPrivate * front();
         void removeListener(MegaRequestListener *listener);
 #ifdef ENABLE_SYNC
         void removeListener(MegaSyncListener *listener);
@@ -1932,21 +2391,179 @@ class RequestQueue
 
 
 //Thread safe transfer queue
-class TransferQueue
+class TransferQueue : public MpscQueue<MegaTransferPrivate>
 {
-    protected:
-        std::deque<MegaTransferPrivate *> transfers;
-        std::mutex mutex;
-
     public:
         TransferQueue();
-        void push(MegaTransferPrivate *transfer);
-        void push_front(MegaTransferPrivate *transfer);
-        MegaTransferPrivate * pop();
         void removeListener(MegaTransferListener *listener);
+
+        // local paths (utf8) of the next uploads waiting, in queue order
+        std::vector<std::string> uploadPaths(size_t max);
+};
+
+// Fingerprints the uploads next in the transfer queue on a worker thread, so that sendPendingTransfers()
+// finds their fingerprints ready instead of reading each file itself. Reading the start of each file
+// also leaves it in the page cache for the first chunks of the upload.
+class UploadFingerprintPrefetcher
+{
+    public:
+        UploadFingerprintPrefetcher(unsigned lookahead, unsigned warmBytes);
+        ~UploadFingerprintPrefetcher();
+
+        unsigned lookahead() const;
+
+        // the paths (utf8) of the uploads next in line. Replaces the previous list, dropping the results of paths not in this one
+        void prefetch(std::vector<std::string>&& paths);
+
+        // the fingerprint computed for that path, if the file still has the same size and mtime.
+        // If the worker is fingerprinting that file right now, waits for it
+        bool take(const std::string& path, m_off_t size, m_time_t mtime, FileFingerprint& fp);
+
+    protected:
+        std::unique_ptr<FileSystemAccess> fsaccess;
+        std::deque<std::string> pending;
+        std::map<std::string, FileFingerprint> ready;
+        std::string current;
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable workAvailable;
+        std::condition_variable fingerprinted;
+        unsigned maxLookahead;
+        unsigned warmBytes;
+        bool stopping = false;
+
+        void workerLoop();
+};
+
+// The recursive mutex of MegaApiImpl, measuring how long lock() waits when it is contended.
+// The counters are updated and read with the mutex held.
+// Getters of plain state (transfer counters and totals, pause flags, speeds, node count, the
+// retry reason) don't take it: that state is atomic. Getters that only read the client take it
+// shared (see SdkReadGuard), so that app threads don't queue up behind each other; the rest
+// lock it exclusively, since their reads page nodes in or fill caches of the client.
+// A shared lock is taken recursively by the thread holding the mutex exclusively, or already
+// holding it shared; a thread holding it shared only must not lock it exclusively.
+// Waiting exclusive lockers keep new readers out, so that the SDK thread is not starved.
+class SdkMutex
+{
+public:
+    void lock();
+    bool try_lock();
+    bool try_lock_for(std::chrono::milliseconds timeout);
+    void unlock();
+
+    void lock_shared();
+    void unlock_shared();
+
+    // exclusive / shared lockers that had to wait
+    unsigned long long contended = 0;
+    unsigned long long waitUs = 0;
+    unsigned long long maxWaitUs = 0;
+    unsigned long long sharedContended = 0;
+    unsigned long long sharedWaitUs = 0;
+
+    std::string report(bool reset);
+
+private:
+    std::mutex mMutex;
+    std::condition_variable mReleased;
+
+    // the exclusive owner and its recursion depth (shared locks it takes included)
+    std::thread::id mOwner;
+    unsigned mDepth = 0;
+
+    // shared locks held, by all threads
+    unsigned mReaders = 0;
+    unsigned mWritersWaiting = 0;
+
+    // the shared locks of this mutex held by the calling thread
+    unsigned& heldShared();
+    void releaseShared();
+};
+
+// sdkMutex for a getter that only reads the client: shared, unless the node lookups may page
+// nodes in (low-memory mode), which needs it exclusive.  A node whose attributes are still
+// serialized would be imported by reading it: relock() before, and look the node up again
+class SdkReadGuard
+{
+public:
+    SdkReadGuard(SdkMutex&, const MegaClient&);
+    ~SdkReadGuard();
+
+    bool exclusive() const { return mExclusive; }
+    void relock();
+
+private:
+    SdkMutex& mMutex;
+    bool mExclusive = false;
+
+    SdkReadGuard(const SdkReadGuard&) = delete;
+    SdkReadGuard& operator=(const SdkReadGuard&) = delete;
+};
+
+#if !defined(_WIN32) && !TARGET_OS_IPHONE
+#define MEGA_SHARED_EVENT_LOOPS 1
+
+// the threads of the shared-runtime mode (MegaApi::setSharedEventLoops): instead of a thread per MegaApi, a fixed
+// set of threads, each waiting on the waiters of many clients at once and running a turn of the loop of each one
+// that woke.  The clients of a loop never run at the same time, so they can share what libcurl doesn't share
+// between threads, such as connections
+class SharedEventLoops
+{
+public:
+    struct Client
+    {
+        // readable when the client must run before its timeout (PosixWaiter::eventfd())
+        virtual int waitfd() = 0;
+
+        // on the thread of add(), before the loop starts on the client
+        virtual void joining(unsigned /*loop*/) { }
+
+        // the first half of a turn, up to the wait: how long the client may wait (NEVER: no timeout)
+        virtual dstime prepareturn() = 0;
+
+        // the rest of it, once waitfd() is readable or the time is up.  false: the client is done and leaves its loop
+        virtual bool turn() = 0;
+
+        virtual ~Client() { }
+    };
+
+    // the loops of the process
+    static SharedEventLoops& get();
+
+    // threads for the clients added from now on, started as they are needed.  0: each client runs its own thread
+    void setthreads(unsigned threads);
+    unsigned threads();
+
+    // drive the client from the loop with the fewest clients.  false if the loops are off, or the client's waiter
+    // can't be waited on from another one
+    bool add(Client*);
+
+    // wait until the client has left its loop
+    void waitdone(Client*);
+
+    SharedEventLoops();
+    ~SharedEventLoops();
+    MEGA_DISABLE_COPY_MOVE(SharedEventLoops)
+
+private:
+    struct Loop;
+
+    std::mutex mutex;
+    std::condition_variable left;
+    std::vector<std::unique_ptr<Loop>> loops;
+    std::unordered_map<Client*, Loop*> members;
+    unsigned wantedthreads = 0;
+    bool stopping = false;
+
+    void run(Loop&);
 };
+#endif
 
 class MegaApiImpl : public MegaApp
+#ifdef MEGA_SHARED_EVENT_LOOPS
+    , private SharedEventLoops::Client
+#endif
 {
     public:
         MegaApiImpl(MegaApi *api, const char *appKey, MegaGfxProcessor* processor, const char *basePath = NULL, const char *userAgent = NULL);
@@ -1962,6 +2579,8 @@ class MegaApiImpl : public MegaApp
         void addTransferListener(MegaTransferListener* listener);
         void addBackupListener(MegaBackupListener* listener);
         void addGlobalListener(MegaGlobalListener* listener);
+        void addNodeListener(MegaGlobalListener* listener, MegaHandle parentHandle, bool recursive);
+        void removeNodeListener(MegaGlobalListener* listener);
 #ifdef ENABLE_SYNC
         void addSyncListener(MegaSyncListener *listener);
         void removeSyncListener(MegaSyncListener *listener);
@@ -2074,6 +2693,8 @@ class MegaApiImpl : public MegaApp
         static void addLoggerClass(MegaLogger *megaLogger);
         static void removeLoggerClass(MegaLogger *megaLogger);
         static void setLogToConsole(bool enable);
+        static void setLogAsync(bool enable, unsigned rateLimit);
+        static bool setBinaryLog(const char* path);
         static void log(int logLevel, const char* message, const char *filename = NULL, int line = -1);
 
         void setLoggingName(const char* loggingName);
@@ -2082,11 +2703,13 @@ class MegaApiImpl : public MegaApp
         bool createLocalFolder(const char *path);
         void moveNode(MegaNode* node, MegaNode* newParent, MegaRequestListener *listener = NULL);
         void moveNode(MegaNode* node, MegaNode* newParent, const char *newName, MegaRequestListener *listener = NULL);
+        void moveNodes(MegaNodeList* nodes, MegaNode* newParent, MegaRequestListener *listener = NULL);
         void copyNode(MegaNode* node, MegaNode *newParent, MegaRequestListener *listener = NULL);
         void copyNode(MegaNode* node, MegaNode *newParent, const char* newName, MegaRequestListener *listener = NULL);
         void renameNode(MegaNode* node, const char* newName, MegaRequestListener *listener = NULL);
         void remove(MegaNode* node, bool keepversions = false, MegaRequestListener *listener = NULL);
         void removeVersions(MegaRequestListener *listener = NULL);
+        void removeNodes(MegaNodeList* nodes, MegaRequestListener *listener = NULL);
         void restoreVersion(MegaNode *version, MegaRequestListener *listener = NULL);
         void cleanRubbishBin(MegaRequestListener *listener = NULL);
         void sendFileToUser(MegaNode *node, MegaUser *user, MegaRequestListener *listener = NULL);
@@ -2094,6 +2717,7 @@ class MegaApiImpl : public MegaApp
         void share(MegaNode *node, MegaUser* user, int level, MegaRequestListener *listener = NULL);
         void share(MegaNode* node, const char* email, int level, MegaRequestListener *listener = NULL);
         void loginToFolder(const char* megaFolderLink, MegaRequestListener *listener = NULL);
+        void loginToFolderSubtree(const char* megaFolderLink, MegaHandle subtree, MegaRequestListener *listener = NULL);
         void importFileLink(const char* megaFileLink, MegaNode* parent, MegaRequestListener *listener = NULL);
         void decryptPasswordProtectedLink(const char* link, const char* password, MegaRequestListener *listener = NULL);
         void encryptLinkWithPassword(const char* link, const char* password, MegaRequestListener *listener = NULL);
@@ -2105,6 +2729,9 @@ class MegaApiImpl : public MegaApp
         void putThumbnail(MegaBackgroundMediaUpload* node, const char *srcFilePath, MegaRequestListener *listener = NULL);
         void setThumbnailByHandle(MegaNode* node, MegaHandle attributehandle, MegaRequestListener *listener = NULL);
         void getPreview(MegaNode* node, const char *dstFilePath, MegaRequestListener *listener = NULL);
+        int prefetchFileAttributes(MegaHandleList *nodes, int type);
+        void setFileAttributeCacheSize(long long bytes);
+        void setBrowsePrefetch(int pageSize);
 		void cancelGetPreview(MegaNode* node, MegaRequestListener *listener = NULL);
         void setPreview(MegaNode* node, const char *srcFilePath, MegaRequestListener *listener = NULL);
         void putPreview(MegaBackgroundMediaUpload* node, const char *srcFilePath, MegaRequestListener *listener = NULL);
@@ -2126,11 +2753,13 @@ class MegaApiImpl : public MegaApp
         void setRubbishBinAutopurgePeriod(int days, MegaRequestListener *listener = NULL);
         void getUserEmail(MegaHandle handle, MegaRequestListener *listener = NULL);
         void setCustomNodeAttribute(MegaNode *node, const char *attrName, const char *value, MegaRequestListener *listener = NULL);
+        void setCustomNodesAttribute(MegaNodeList *nodes, const char *attrName, const char *value, MegaRequestListener *listener = NULL);
         void setNodeDuration(MegaNode *node, int secs, MegaRequestListener *listener = NULL);
         void setNodeCoordinates(MegaNode *node, bool unshareable, double latitude, double longitude, MegaRequestListener *listener = NULL);
         void exportNode(MegaNode *node, int64_t expireTime, MegaRequestListener *listener = NULL);
         void disableExport(MegaNode *node, MegaRequestListener *listener = NULL);
         void fetchNodes(bool resumeSyncs, MegaRequestListener *listener = NULL);
+        void setStagedStartup(bool enable);
         void getPricing(MegaRequestListener *listener = NULL);
         void getPaymentId(handle productHandle, handle lastPublicHandle, int lastPublicHandleType, int64_t lastAccessTimestamp, MegaRequestListener *listener = NULL);
         void upgradeAccount(MegaHandle productHandle, int paymentMethod, MegaRequestListener *listener = NULL);
@@ -2184,8 +2813,26 @@ class MegaApiImpl : public MegaApp
         void startUploadForSupport(const char *localPath, bool isSourceTemporary = false, MegaTransferListener *listener=NULL);
         void startDownload(MegaNode* node, const char* localPath, MegaTransferListener *listener = NULL);
         void startDownload(bool startFirst, MegaNode *node, const char* target, int folderTransferTag, const char *appData, MegaTransferListener *listener);
-        void startStreaming(MegaNode* node, m_off_t startPos, m_off_t size, MegaTransferListener *listener);
+        void startUploads(MegaStringList *localPaths, MegaNode *parent, MegaTransferListener *listener);
+        void startDownloads(MegaNodeList *nodes, const char *localFolder, MegaTransferListener *listener);
+
+        // the transfer objects startUpload()/startDownload() queue
+        MegaTransferPrivate *createUploadTransfer(bool startFirst, const char *localPath, MegaNode *parent, const char *fileName, const char *targetUser, int64_t mtime, int folderTransferTag, bool isBackup, const char *appData, bool isSourceFileTemporary, bool forceNewUpload, MegaTransferListener *listener);
+        MegaTransferPrivate *createDownloadTransfer(bool startFirst, MegaNode *node, const char* localPath, int folderTransferTag, const char *appData, MegaTransferListener *listener);
+
+        // SDK thread: puts transfers ahead of everything else in the transfer queue, keeping their order
+        void queueTransfersFirst(const std::vector<MegaTransferPrivate*>& transfers);
+
+        // SDK thread: adds nodes (new ones linked through their temporary handles) under target in a single
+        // putnodes issued on behalf of a controller, which gets the result with the NewNodes, before they are
+        // deleted, instead of the usual callbacks. Returns the tag of the putnodes
+        int putNodes(handle target, NewNode *nn, int count, std::function<void(int, error, NewNode*)> result);
+        void cancelPutNodes(int tag);
+        void startStreaming(MegaNode* node, m_off_t startPos, m_off_t size, MegaTransferListener *listener, m_off_t maxHeldBytes = 0);
         void setStreamingMinimumRate(int bytesPerSecond);
+        void setStreamingReadahead(long long bytes);
+        void setStreamingDiskCache(const char *localFolder, long long maxBytes);
+        long long getStreamingCacheStat(int stat);
         void retryTransfer(MegaTransfer *transfer, MegaTransferListener *listener = NULL);
         void cancelTransfer(MegaTransfer *transfer, MegaRequestListener *listener=NULL);
         void cancelTransferByTag(int transferTag, MegaRequestListener *listener = NULL);
@@ -2208,6 +2855,11 @@ class MegaApiImpl : public MegaApp
         bool setMaxUploadSpeed(m_off_t bpslimit);
         int getMaxDownloadSpeed();
         int getMaxUploadSpeed();
+        bool setHttp2(bool enable);
+        long long getConnectionStat(int stat);
+        char* getStorageServerHealth();
+        void probeNetwork();
+        char* getNetworkProfile();
         int getCurrentDownloadSpeed();
         int getCurrentUploadSpeed();
         int getCurrentSpeed(int type);
@@ -2238,6 +2890,15 @@ class MegaApiImpl : public MegaApp
         void setExcludedPaths(vector<string> *excludedPaths);
         void setExclusionLowerSizeLimit(long long limit);
         void setExclusionUpperSizeLimit(long long limit);
+        void setSyncContentCheck(long long minSize);
+        void setSyncScanThreads(int threads);
+        void setSyncDebrisThreads(int threads);
+        void setSyncFingerprintPrefetch(int files);
+        void setSyncMaxVersionsPerHour(int versions);
+        void setSyncDirtySubtreesOnly(bool enable);
+        void setNetworkSyncPolling(bool enable);
+        bool setFilesystemWideNotifications(bool enable);
+        long long getNumNotifyWatches();
         bool moveToLocalDebris(const char *path);
         string getLocalPath(MegaNode *node);
         long long getNumLocalNodes();
@@ -2252,6 +2913,7 @@ class MegaApiImpl : public MegaApp
         MegaSync *getSyncByTag(int tag);
         MegaSync *getSyncByNode(MegaNode *node);
         MegaSync *getSyncByPath(const char * localPath);
+        MegaSyncStats *getSyncStats(int tag);
         char *getBlockedPath();
         void setExcludedRegularExpressions(MegaSync *sync, MegaRegExp *regExp);
 #endif
@@ -2277,16 +2939,25 @@ class MegaApiImpl : public MegaApp
         long long getTotalUploadedBytes();
         long long getTotalDownloadBytes();
         long long getTotalUploadBytes();
+        void setPerformanceStatsEnabled(bool enable);
+        MegaStringMap *getPerformanceSnapshot(bool reset);
+        void setEventLoopStallThreshold(unsigned thresholdMs);
+        MegaStringList *getEventLoopStalls(bool reset);
+        bool startTrace(const char* outputPath);
+        bool stopTrace();
+        string getOpenMetrics();
 
         //Filesystem
 		int getNumChildren(MegaNode* parent);
 		int getNumChildFiles(MegaNode* parent);
 		int getNumChildFolders(MegaNode* parent);
         MegaNodeList* getChildren(MegaNode *parent, int order=1);
+        MegaNodeList* getChildrenPage(MegaNode *parent, int order, int offset, int limit);
         MegaNodeList* getVersions(MegaNode *node);
         int getNumVersions(MegaNode *node);
         bool hasVersions(MegaNode *node);
         void getFolderInfo(MegaNode *node, MegaRequestListener *listener);
+        void searchInPages(MegaNode *node, const char *searchString, int pageSize, MegaRequestListener *listener);
         MegaChildrenLists* getFileFolderChildren(MegaNode *parent, int order=1);
         bool hasChildren(MegaNode *parent);
         int getIndex(MegaNode* node, int order=1);
@@ -2299,6 +2970,7 @@ class MegaApiImpl : public MegaApp
         MegaUserList* getContacts();
         MegaUser* getContact(const char* uid);
         MegaUserAlertList* getUserAlerts();
+        MegaUserAlertList* getUserAlerts(int start, int count);
         int getNumUnreadUserAlerts();
         MegaNodeList *getInShares(MegaUser* user, int order);
         MegaNodeList *getInShares(int order);
@@ -2357,6 +3029,8 @@ class MegaApiImpl : public MegaApp
         MegaNodeList* search(MegaNode* node, const char* searchString, MegaCancelToken *cancelToken, bool recursive = 1, int order = MegaApi::ORDER_NONE);
         bool processMegaTree(MegaNode* node, MegaTreeProcessor* processor, bool recursive = 1);
         MegaNodeList* search(const char* searchString, MegaCancelToken *cancelToken, int order = MegaApi::ORDER_NONE);
+        MegaNodeList* searchByPattern(MegaNode* node, const char* pattern, int type, long long minSize, long long maxSize,
+                                      long long minMtime, long long maxMtime, MegaCancelToken *cancelToken, int order);
 
         MegaNode *createForeignFileNode(MegaHandle handle, const char *key, const char *name, m_off_t size, m_off_t mtime,
                                        MegaHandle parentHandle, const char *privateauth, const char *publicauth, const char *chatauth);
@@ -2387,8 +3061,50 @@ class MegaApiImpl : public MegaApp
         void getPSA(MegaRequestListener *listener = NULL);
         void setPSA(int id, MegaRequestListener *listener = NULL);
 
+        void setDatabaseProfile(int profile);
+        void setDatabaseTuning(int synchronous, int cacheSizeKiB, long long mmapSize, int tempStore, int pageSize, int walAutocheckpoint);
+        int getDatabaseProfile();
+        void setDatabaseWriteBehind(bool enable);
+        void setSharedNodeView(const char *path, const char *base64Key);
+        void setNodeMemoryBudget(int megabytes);
+        void setCompactVersions(bool enable);
+        void setMemoryBudget(long long bytes);
+        long long getMemoryUsage(int subsystem);
+        int getMemoryPressure();
+        void setCallbackIntervals(int nodesMs, int transfersMs);
+        void setFolderDownloadOrder(int order);
+        int getFolderDownloadOrder();
+        void setDownloadPreallocation(bool enable);
+        void setPartialDownloadResumption(bool enable);
+        void setMobileEfficiency(bool enable);
+        long long getRadioWakeupsSaved();
+        static void setWorkerThreads(int threads);
+        static void setWorkerClassLimit(int workerClass, int maxThreads);
+        static void setWorkerAffinity(long long cpuMask);
+        static void setSharedEventLoops(int threads);
+        void setDownloadWriteCoalescing(int bytes);
+        void setUploadReadahead(int bytes);
+        void setNodeScope(MegaHandleList *folders);
+        void pinNode(MegaNode *node, bool pin);
+        void setApiPipelining(int connections);
+        void setRequestCompression(long long minBatchSize);
+        void setAutoConnections(int direction, bool enable, int budget);
+        void setFairTransferScheduling(bool enable);
+        void setTransferGroupWeight(int folderTransferTag, int weight);
+        void setTransferGroupMinSpeed(int folderTransferTag, long long bytesPerSecond);
+        void setSmallFileFastLane(long long maxFileSize, int slots);
+        void setTotalBandwidthLimit(long long bytesPerSecond);
+        void setTransferGroupBandwidthLimit(int folderTransferTag, long long bytesPerSecond);
+        bool addBandwidthSchedule(const char* cronExpression, long long durationSeconds,
+                                  long long downloadBytesPerSecond, long long uploadBytesPerSecond);
+        void clearBandwidthSchedules();
+        void setUploadCompletionBatching(int maxFiles);
+        void setTransferBufferPoolLimit(long long bytes);
+        void setUploadFingerprintLookahead(int uploads);
         void disableGfxFeatures(bool disable);
         bool areGfxFeaturesDisabled();
+        void setGfxIsolation(bool enable);
+        bool isGfxIsolated();
 
         void changeApiUrl(const char *apiURL, bool disablepkp = false);
 
@@ -2462,6 +3178,9 @@ class MegaApiImpl : public MegaApp
         int httpServerGetMaxBufferSize();
         void httpServerSetMaxOutputSize(int outputSize);
         int httpServerGetMaxOutputSize();
+        void httpServerSetEventLoops(int loops);
+        int httpServerGetEventLoops();
+        bool getLocalCopy(MegaNode *node, string *localpath);
 
         // permissions
         void httpServerEnableFileServer(bool enable);
@@ -2475,6 +3194,10 @@ class MegaApiImpl : public MegaApp
         void httpServerEnableOfflineAttribute(bool enable);
         void httpServerEnableSubtitlesSupport(bool enable);
         bool httpServerIsSubtitlesSupportEnabled();
+        void httpServerEnableHLSSupport(bool enable);
+        bool httpServerIsHLSSupportEnabled();
+        void httpServerEnableMetrics(bool enable);
+        bool httpServerIsMetricsEnabled();
 
         void httpServerAddListener(MegaTransferListener *listener);
         void httpServerRemoveListener(MegaTransferListener *listener);
@@ -2520,6 +3243,8 @@ class MegaApiImpl : public MegaApp
         void getUrlChat(MegaHandle chatid, MegaRequestListener *listener = NULL);
         void grantAccessInChat(MegaHandle chatid, MegaNode *n, MegaHandle uh,  MegaRequestListener *listener = NULL);
         void removeAccessInChat(MegaHandle chatid, MegaNode *n, MegaHandle uh,  MegaRequestListener *listener = NULL);
+        void grantAccessToNodesInChat(MegaHandle chatid, MegaNodeList *nodes, MegaHandle uh, MegaRequestListener *listener = NULL);
+        void removeAccessToNodesInChat(MegaHandle chatid, MegaNodeList *nodes, MegaHandle uh, MegaRequestListener *listener = NULL);
         void updateChatPermissions(MegaHandle chatid, MegaHandle uh, int privilege, MegaRequestListener *listener = NULL);
         void truncateChat(MegaHandle chatid, MegaHandle messageid, MegaRequestListener *listener = NULL);
         void setChatTitle(MegaHandle chatid, const char *title, MegaRequestListener *listener = NULL);
@@ -2531,6 +3256,7 @@ class MegaApiImpl : public MegaApp
         MegaTextChatList *getChatList();
         MegaHandleList *getAttachmentAccess(MegaHandle chatid, MegaHandle h);
         bool hasAccessToAttachment(MegaHandle chatid, MegaHandle h, MegaHandle uh);
+        MegaHandleList *getAttachmentChats(MegaHandle h);
         const char* getFileAttribute(MegaHandle h);
         void archiveChat(MegaHandle chatid, int archive, MegaRequestListener *listener = NULL);
         void requestRichPreview(const char *url, MegaRequestListener *listener = NULL);
@@ -2608,12 +3334,18 @@ protected:
         static ExternalLogger externalLogger;
 
         MegaTransferPrivate* getMegaTransferPrivate(int tag);
+        FairTransferScheduler* fairTransferScheduler();
 
         void fireOnRequestStart(MegaRequestPrivate *request);
         void fireOnRequestFinish(MegaRequestPrivate *request, MegaError e);
         void fireOnRequestUpdate(MegaRequestPrivate *request);
         void fireOnRequestTemporaryError(MegaRequestPrivate *request, MegaError e);
+
+        // the requests on many nodes (TYPE_MOVE_NODES, ...) keep a result per node, and finish with the last one
+        static MegaStringMap* bulkNodeHandles(MegaNodeList* nodes);
+        void bulkNodeResult(MegaRequestPrivate *request, handle h, error e);
         bool fireOnTransferData(MegaTransferPrivate *transfer);
+        bool fireOnTransferBuffer(MegaTransferPrivate *transfer, MegaTransferBuffer *buffer);
         void fireOnUsersUpdate(MegaUserList *users);
         void fireOnUserAlertsUpdate(MegaUserAlertList *alerts);
         void fireOnNodesUpdate(MegaNodeList *nodes);
@@ -2650,15 +3382,21 @@ protected:
         string basePath;
         bool nocache;
 
+        // where stopTrace() writes the timeline started by startTrace()
+        string tracePath;
+
 #ifdef HAVE_LIBUV
         MegaHTTPServer *httpServer;
         int httpServerMaxBufferSize;
         int httpServerMaxOutputSize;
+        int httpServerEventLoops;
         bool httpServerEnableFiles;
         bool httpServerEnableFolders;
         bool httpServerOfflineAttributeEnabled;
         int httpServerRestrictedMode;
         bool httpServerSubtitlesSupportEnabled;
+        bool httpServerHLSSupportEnabled;
+        bool httpServerMetricsEnabled;
         set<MegaTransferListener *> httpServerListeners;
 
         MegaFTPServer *ftpServer;
@@ -2670,8 +3408,13 @@ protected:
 		
         map<int, MegaBackupController *> backupsMap;
 
+        // large folders being copied, by the tag of their request
+        map<int, unique_ptr<MegaFolderCopyController>> folderCopies;
+
         RequestQueue requestQueue;
         TransferQueue transferQueue;
+
+        std::unique_ptr<UploadFingerprintPrefetcher> fingerprintPrefetcher;
         map<int, MegaRequestPrivate *> requestMap;
 
         // sc requests to close existing wsc and immediately retrieve pending actionpackets
@@ -2681,15 +3424,78 @@ protected:
         map<int, MegaSyncPrivate *> syncMap;
 #endif
 
-        int pendingUploads;
-        int pendingDownloads;
-        int totalUploads;
-        int totalDownloads;
-        long long totalDownloadedBytes;
-        long long totalUploadedBytes;
-        long long totalDownloadBytes;
-        long long totalUploadBytes;
+        // children of recently listed folders, sorted by order and valid while the folder's
+        // Node::childrenseq stays the same.  The least recently used views go first
+        struct SortedChildren
+        {
+            uint64_t childrenSeq = 0;
+            uint64_t lastUse = 0;
+            node_vector nodes;
+        };
+        map<pair<handle, int>, SortedChildren> sortedChildren;
+        uint64_t sortedChildrenUse = 0;
+        static const size_t SORTED_CHILDREN_VIEWS = 32;
+
+        // prefetch-on-browse: the last view listed by the app, whose thumbnails (from the nodes listed to the end
+        // of the next page) and first subfolders the SDK thread warms up after exec()
+        struct BrowsePrefetch
+        {
+            size_t pageSize = 0;    // 0: disabled
+            handle parent = UNDEF;
+            int order = 0;
+            size_t first = 0;
+            size_t last = 0;
+            bool pending = false;
+
+            // queued for the view, and cancelled when the app lists another one
+            vector<handle> thumbnails;
+        };
+        BrowsePrefetch browsePrefetch;
+        static const size_t BROWSE_PREFETCH_FOLDERS = 4;
+        void noteBrowse(Node* parent, int order, size_t offset, size_t count);
+        void prefetchBrowse();
+
+        // node updates held back until nodesUpdateIntervalDs has passed since the last delivery, one per node
+        dstime nodesUpdateIntervalDs = 0;
+        dstime nodesUpdateDs = 0;
+        vector<std::unique_ptr<MegaNodePrivate>> pendingNodeUpdates;
+        std::unordered_map<MegaHandle, size_t> pendingNodeUpdateIndex;
+        void fireOnPendingNodesUpdate();
+
+        // progress-only transfer updates are skipped within this interval of the previous one
+        dstime transferUpdateIntervalDs = 1;
+
+        // order in which folder downloads queue their files (MegaApi::ORDER_NONE keeps the tree order)
+        int folderDownloadOrder = MegaApi::ORDER_NONE;
+
+        // names of all files and folders, built by the first search and kept up to date by nodes_updated()
+        NodeNameIndex nodeNameIndex;
+        bool nodeNameIndexValid = false;
+
+        // with sdkMutex locked: the files and folders matching the filter below ancestor or, without one, in
+        // the cloud drive, inbox, rubbish bin and inshares.  False if the index can't be used (nodes paged out, see setNodeMemoryBudget)
+        bool searchNodeNameIndex(const NodeSearchFilter& filter, Node* ancestor, MegaCancelToken* cancelToken, node_vector& result);
+
+        // walks the tree instead, as above
+        void searchTree(const NodeSearchFilter& filter, Node* ancestor, MegaCancelToken* cancelToken, node_vector& result);
+
+        // with sdkMutex locked and the children paged in
+        const node_vector& getSortedChildren(Node* parent, int order, const std::function<bool(Node*, Node*)>& comparatorFunction);
+
+        // updated by the SDK thread, read by the getters of any thread without sdkMutex
+        std::atomic<int> pendingUploads;
+        std::atomic<int> pendingDownloads;
+        std::atomic<int> totalUploads;
+        std::atomic<int> totalDownloads;
+        std::atomic<long long> totalDownloadedBytes;
+        std::atomic<long long> totalUploadedBytes;
+        std::atomic<long long> totalDownloadBytes;
+        std::atomic<long long> totalUploadBytes;
         long long notificationNumber;
+
+        // set while MegaApi::cancelTransfers stops all the files of a direction
+        bool cancellingTransfers = false;
+
         set<MegaRequestListener *> requestListeners;
         set<MegaTransferListener *> transferListeners;
         set<MegaBackupListener *> backupListeners;
@@ -2700,13 +3506,28 @@ protected:
 
         set<MegaGlobalListener *> globalListeners;
         set<MegaListener *> listeners;
-        retryreason_t waitingRequest;
-        vector<string> excludedNames;
-        vector<string> excludedPaths;
+
+        // listeners of the node updates of a folder (and, if recursive, of all the folders below it)
+        struct NodeSubscription
+        {
+            handle parent;
+            bool recursive;
+        };
+        map<MegaGlobalListener *, NodeSubscription> nodeListeners;
+
+        // whether the updated node is the subscribed folder or below it.  parents: the parent handles of the
+        // updated nodes, which are used before the node tree for the nodes that are gone; memo: the folders
+        // already known to be in the subtree or not
+        bool isNodeInSubscription(MegaNode* node, const NodeSubscription&, const map<handle, handle>& parents, map<handle, bool>& memo);
+
+        std::atomic<retryreason_t> waitingRequest;
+        SyncExclusionMatcher syncExclusions;
         long long syncLowerSizeLimit;
         long long syncUpperSizeLimit;
-        std::recursive_timed_mutex sdkMutex;
-        using SdkMutexGuard = std::unique_lock<std::recursive_timed_mutex>;   // (equivalent to typedef)
+        SdkMutex sdkMutex;
+        using SdkMutexGuard = std::unique_lock<SdkMutex>;   // (equivalent to typedef)
+        dstime sdkMutexReportDs = 0;
+        static const dstime SDK_MUTEX_REPORT_INTERVAL_DS = 1200;
         std::atomic<bool> syncPathStateLockTimeout{ false };
         MegaTransferPrivate *currentTransfer;
         MegaRequestPrivate *activeRequest;
@@ -2724,6 +3545,24 @@ protected:
         int threadExit;
         void loop();
 
+        // handle what woke the waiter: exec() and the queues of the app.  false once the client is to be deleted
+        bool execturn(int waitresult);
+
+#ifdef MEGA_SHARED_EVENT_LOOPS
+        // run by SharedEventLoops instead of thread
+        bool sharedLoop = false;
+        int preparedWait = 0;
+
+        int waitfd() override;
+        void joining(unsigned loop) override;
+        dstime prepareturn() override;
+        bool turn() override;
+
+        // the connection cache of each loop, while a client of the loop uses it
+        static std::mutex loopSharesMutex;
+        static std::vector<std::weak_ptr<CurlHttpIO::ConnectionShare>> loopShares;
+#endif
+
         int maxRetries;
 
         // a request-level error occurred
@@ -2813,9 +3652,13 @@ protected:
         void fetchnodes_result(error) override;
         void putnodes_result(error, targettype_t, NewNode*) override;
 
+        // results of putNodes(), by the tag of their putnodes
+        std::map<int, std::function<void(int, error, NewNode*)>> putNodesResults;
+
         // share update result
         void share_result(error) override;
         void share_result(int, error) override;
+        void share_progress(int, int) override;
 
         // contact request results
         void setpcr_result(handle, error, opcactions_t) override;
@@ -2884,6 +3727,7 @@ protected:
 
         dstime pread_failure(error, int, void*, dstime) override;
         bool pread_data(byte*, m_off_t, m_off_t, m_off_t, m_off_t, void*) override;
+        bool pread_lease(DirectReadLease*, m_off_t, m_off_t, void*) override;
 
         void reportevent_result(error) override;
         void sessions_killed(handle sessionid, error e) override;
@@ -2914,8 +3758,8 @@ protected:
         void chatinvite_result(error) override;
         void chatremove_result(error) override;
         void chaturl_result(string*, error) override;
-        void chatgrantaccess_result(error) override;
-        void chatremoveaccess_result(error) override;
+        void chatgrantaccess_result(handle, error) override;
+        void chatremoveaccess_result(handle, error) override;
         void chatupdatepermissions_result(error) override;
         void chattruncate_result(error) override;
         void chatsettitle_result(error) override;
@@ -2992,6 +3836,10 @@ protected:
         // notify about a business account status change
         void notify_business_status(BizStatus status) override;
 
+        // notify about a change of memory pressure
+        void memory_pressure(mempressure_t pressure) override;
+        void startup_stage(startupstage_t stage) override;
+
         // notify about a finished timer
         void timer_result(error) override;
 
@@ -3006,6 +3854,7 @@ protected:
         Node *getNodeByFingerprintInternal(const char *fingerprint, Node *parent);
 
         bool processTree(Node* node, TreeProcessor* processor, bool recursive = 1, MegaCancelToken* cancelToken = nullptr);
+        static const unsigned PROCESSTREE_CANCELBATCH = 1024;
         void getNodeAttribute(MegaNode* node, int type, const char *dstFilePath, MegaRequestListener *listener = NULL);
 		    void cancelGetNodeAttribute(MegaNode *node, int type, MegaRequestListener *listener = NULL);
         void setNodeAttribute(MegaNode* node, int type, const char *srcFilePath, MegaHandle attributehandle, MegaRequestListener *listener = NULL);
@@ -3023,6 +3872,7 @@ protected:
         bool hasToForceUpload(const Node &node, const MegaTransferPrivate &transfer) const;
 
         friend class MegaBackgroundMediaUploadPrivate;
+        friend class MegaFolderCopyController;
 };
 
 class MegaHashSignatureImpl
@@ -3039,6 +3889,25 @@ class MegaHashSignatureImpl
 		AsymmCipher* asymmCypher;
 };
 
+class MegaSharedNodeViewImpl
+{
+    public:
+        MegaSharedNodeViewImpl(const char *path, const char *base64Key);
+
+        bool isValid() const;
+        long long getGeneration() const;
+        bool refresh();
+        MegaHandle getRootNode(int i) const;
+        MegaNode *getNodeByHandle(MegaHandle handle) const;
+        MegaNodeList *getChildren(MegaHandle parentHandle) const;
+
+    protected:
+        SharedNodeView view;
+        bool valid = false;
+
+        static MegaNode *node(const SharedNodeView::Record&, const string& name);
+};
+
 class ExternalInputStream : public InputStreamAccess
 {
     MegaInputStream *inputStream;
@@ -3073,7 +3942,11 @@ public:
     unsigned int availableSpace();
     unsigned int availableCapacity();
     uv_buf_t nextBuffer();
+    // gathers up to the maximum output size in one or two buffers, as the data
+    // can wrap around the end of the ring. Returns the number of buffers filled
+    int nextBuffers(uv_buf_t bufs[2]);
     void freeData(unsigned int len);
+    void reset();
     void setMaxBufferSize(unsigned int bufferSize);
     void setMaxOutputSize(unsigned int outputSize);
 
@@ -3092,6 +3965,25 @@ protected:
 };
 
 class MegaTCPServer;
+class MegaTCPContext;
+
+// Additional event loop of a MegaTCPServer. It accepts connections on its own listener, bound
+// to the same port as the main one with SO_REUSEPORT, and serves them on its own thread
+struct MegaTCPWorker
+{
+    MegaTCPServer *tcpServer;
+    uv_loop_t uv_loop;
+    uv_async_t exit_handle;
+    uv_tcp_t server;
+    list<MegaTCPContext*> connections;
+    MegaThread thread;
+
+#ifdef ENABLE_EVT_TLS
+    // evt_tls keeps the live connections in its context, so it can't be shared between loops
+    evt_ctx_t evtctx;
+#endif
+};
+
 class MegaTCPContext : public MegaTransferListener, public MegaRequestListener
 {
 public:
@@ -3100,6 +3992,7 @@ public:
 
     // Connection management
     MegaTCPServer *server;
+    MegaTCPWorker *worker; // loop serving the connection, NULL for the main one
     uv_tcp_t tcphandle;
     uv_async_t asynchandle;
     uv_mutex_t mutex;
@@ -3162,12 +4055,20 @@ protected:
     bool closing;
     int remainingcloseevents;
 
+    // additional event loops, only available where the kernel balances SO_REUSEPORT listeners
+    int workerloops;
+    vector<MegaTCPWorker*> workers;
+
 #ifdef ENABLE_EVT_TLS
     // TLS
     bool evtrequirescleaning;
     evt_ctx_t evtctx;
     std::string certificatepath;
     std::string keypath;
+
+    // shared by the contexts of every loop and kept across restarts, so that sessions resume anywhere
+    unsigned char ticketkeys[EVT_TLS_TICKET_KEYS_SIZE];
+    bool initTLSContext(evt_ctx_t *ctx);
 #endif
 
     // libuv callbacks
@@ -3193,6 +4094,8 @@ protected:
     static void onExitHandleClose(uv_handle_t* handle);
 
     static void onCloseRequested(uv_async_t* handle);
+    static void onWorkerCloseRequested(uv_async_t* handle);
+    static void *workerEntryPoint(void *param);
 
     static void onWriteFinished(uv_write_t* req, int status); //This might need to go to HTTPServer
 #ifdef ENABLE_EVT_TLS
@@ -3200,9 +4103,13 @@ protected:
 #endif
     static void closeConnection(MegaTCPContext *tcpctx);
     static void closeTCPConnection(MegaTCPContext *tcpctx);
+    static list<MegaTCPContext*> &connectionsOf(MegaTCPContext *tcpctx);
 
     void run();
     void initializeAndStartListening();
+    bool listenOn(uv_loop_t *loop, uv_tcp_t *listener, bool reuseport);
+    void startWorkerLoops();
+    void joinWorkerLoops();
 
     void answer(MegaTCPContext* tcpctx, const char *rsp, size_t rlen);
 
@@ -3233,8 +4140,11 @@ public:
     void setMaxOutputSize(int outputSize);
     int getMaxBufferSize();
     int getMaxOutputSize();
+    int getMaxOutputSize(MegaTCPContext *tcpctx);
     void setRestrictedMode(int mode);
     int getRestrictedMode();
+    void setEventLoops(int loops);
+    int getEventLoops();
     bool isHandleAllowed(handle h);
     void clearAllowedHandles();
     char* getLink(MegaNode *node, std::string protocol = "http");
@@ -3248,6 +4158,25 @@ public:
 
 class MegaTCServer;
 class MegaHTTPServer;
+class MegaHTTPContext;
+
+// files available locally can be sent by the kernel straight from the disk to the socket
+#if defined(__linux__) || defined(__APPLE__)
+#define HAVE_SENDFILE
+#endif
+
+#ifdef HAVE_SENDFILE
+struct MegaHTTPLocalCopy
+{
+    MegaHTTPContext *httpctx; // NULL once the connection is gone
+    uv_poll_t poll;
+    int filefd;
+    int socketfd; // dup of the socket of the connection, so it outlives the uv_tcp_t
+    m_off_t offset;
+    m_off_t remaining;
+};
+#endif
+
 class MegaHTTPContext : public MegaTCPContext
 {
 
@@ -3290,6 +4219,7 @@ public:
     size_t messageBodySize;
     std::string host;
     std::string destination;
+    std::string ifnonematch;
     bool overwrite;
     std::unique_ptr<FileAccess> tmpFileAccess;
     std::string tmpFileName;
@@ -3300,6 +4230,16 @@ public:
     uv_mutex_t mutex_responses;
     std::list<std::string> responses;
 
+#ifdef HAVE_SENDFILE
+    MegaHTTPLocalCopy *localcopy;
+#endif
+
+    // keep-alive: the connection is kept open for the next request once the response
+    // has been sent, and data received meanwhile waits here with the parser paused
+    bool keepalive;
+    std::string pipelined;
+    void resetRequest();
+
     virtual void onTransferStart(MegaApi *, MegaTransfer *transfer);
     virtual bool onTransferData(MegaApi *, MegaTransfer *transfer, char *buffer, size_t size);
     virtual void onTransferFinish(MegaApi* api, MegaTransfer *transfer, MegaError *e);
@@ -3311,10 +4251,26 @@ class MegaHTTPServer: public MegaTCPServer
 protected:
     set<handle> allowedWebDavHandles;
 
+    // PROPFIND listings of folders, by URL, reused until a node in them changes
+    struct WebDavListing
+    {
+        handle folder;
+        set<handle> children;
+        std::string etag;
+        std::string body;
+    };
+    static const size_t MAX_WEBDAV_LISTINGS = 64;
+    std::mutex webDavListingsMutex;
+    map<string, WebDavListing> webDavListings;
+    unsigned webDavListingsVersion;
+    unsigned lastWebDavEtag;
+
     bool fileServerEnabled;
     bool folderServerEnabled;
     bool offlineAttribute;
     bool subtitlesSupportEnabled;
+    bool hlsSupportEnabled;
+    bool metricsEnabled;
 
     //virtual methods:
     virtual void processReceivedData(MegaTCPContext *ftpctx, ssize_t nread, const uv_buf_t * buf);
@@ -3339,6 +4295,17 @@ protected:
     static void sendNextBytes(MegaHTTPContext *httpctx);
     static int streamNode(MegaHTTPContext *httpctx);
 
+    static void keepAlive(MegaHTTPContext *httpctx);
+
+#ifdef HAVE_SENDFILE
+    // serving of local copies
+    static bool openLocalCopy(MegaHTTPContext *httpctx, MegaNode *node, m_off_t start, m_off_t len);
+    static void sendLocalCopy(MegaHTTPContext *httpctx);
+    static void closeLocalCopy(MegaHTTPContext *httpctx);
+    static void onLocalCopyWritable(uv_poll_t *handle, int status, int events);
+    static void onLocalCopyClose(uv_handle_t *handle);
+#endif
+
     //Utility funcitons
     static std::string getHTTPMethodName(int httpmethod);
     static std::string getHTTPErrorString(int errorcode);
@@ -3346,6 +4313,7 @@ protected:
 
     // WEBDAV related
     static std::string getWebDavPropFindResponseForNode(std::string baseURL, std::string subnodepath, MegaNode *node, MegaHTTPContext* httpctx);
+    static std::string getWebDavPropFindResponseForFolder(std::string baseURL, std::string subnodepath, MegaNode *node, MegaHTTPContext* httpctx);
     static std::string getWebDavProfFindNodeContents(MegaNode *node, std::string baseURL, bool offlineAttribute);
 
     static void returnHttpCodeBasedOnRequestError(MegaHTTPContext* httpctx, MegaError *e, bool synchronous = true);
@@ -3364,6 +4332,7 @@ public:
     bool isHandleWebDavAllowed(handle h);
     set<handle> getAllowedWebDavHandles();
     void removeAllowedWebDavHandle(MegaHandle handle);
+    void invalidateWebDavListings(Node **nodes, int count);
     void enableFileServer(bool enable);
     void enableFolderServer(bool enable);
     bool isFileServerEnabled();
@@ -3372,6 +4341,18 @@ public:
     bool isOfflineAttributeEnabled();
     bool isSubtitlesSupportEnabled();
     void enableSubtitlesSupport(bool enable);
+    bool isHLSSupportEnabled();
+    void enableHLSSupport(bool enable);
+    bool isMetricsEnabled();
+    void enableMetrics(bool enable);
+
+    // segment length aimed at by the HLS playlists (seconds)
+    static const int HLS_SEGMENT_SECONDS = 6;
+
+    // HLS playlist splitting an MPEG-TS file into byte ranges of about HLS_SEGMENT_SECONDS of media, which playback,
+    // seeks and the streaming readahead go through as they do for progressive ranges.  Empty if the node is not
+    // an MPEG-TS file with a known duration
+    static string getHLSPlaylist(MegaNode *node);
 
 };
 
@@ -3469,6 +4450,10 @@ protected:
     int dataportBegin;
     int dataPortEnd;
 
+    // passive ports held by the data servers of the open sessions (only used from the loop thread)
+    std::set<int> dataPortsInUse;
+    MegaFTPDataServer *startDataServer(MegaFTPContext *ftpctx);
+
     std::string getListingLineFromNode(MegaNode *child, std::string nameToShow = string());
 
     MegaNode *getBaseFolderNode(std::string path);
@@ -3492,6 +4477,8 @@ public:
     MegaFTPServer(MegaApiImpl *megaApi, string basePath, int dataportBegin, int dataPortEnd, bool useTLS = false, std::string certificatepath = std::string(), std::string keypath = std::string());
     virtual ~MegaFTPServer();
 
+    void releaseDataPort(int port);
+
     static std::string getFTPErrorString(int errorcode, std::string argument = string());
 
     static void returnFtpCodeBasedOnRequestError(MegaFTPContext* ftpctx, MegaError *e);
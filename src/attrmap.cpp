@@ -91,24 +91,87 @@ nameid AttrMap::string2nameid(const char *a)
 
 // generate binary serialize of attr_map name-value pairs
 void AttrMap::serialize(string* d) const
+{
+    for (attr_map::const_iterator it = map.begin(); it != map.end(); it++)
+    {
+        serialize(d, it->first, it->second);
+    }
+
+    d->append("", 1);
+}
+
+bool AttrMap::serialize(string* d, nameid name, const string& value)
 {
     char buf[8];
     unsigned char l;
     unsigned short ll;
 
-    for (attr_map::const_iterator it = map.begin(); it != map.end(); it++)
+    if (value.size() > 0xFFFF)
     {
-        if ((l = (unsigned char)nameid2string(it->first, buf)))
+        return false;
+    }
+
+    if ((l = (unsigned char)nameid2string(name, buf)))
+    {
+        d->append((char*)&l, sizeof l);
+        d->append(buf, l);
+        ll = (unsigned short)value.size();
+        d->append((char*)&ll, sizeof ll);
+        d->append(value.data(), ll);
+    }
+
+    return true;
+}
+
+const char* AttrMap::scan(const char* ptr, const char* end, nameid name, string* value, bool* found)
+{
+    unsigned char l;
+    unsigned short ll;
+    nameid id;
+
+    if (found)
+    {
+        *found = false;
+    }
+
+    while ((ptr < end) && (l = *ptr++))
+    {
+        id = 0;
+
+        if (ptr + l + sizeof ll > end)
+        {
+            return NULL;
+        }
+
+        while (l--)
+        {
+            id = (id << 8) + (unsigned char)*ptr++;
+        }
+
+        ll = MemAccess::get<short>(ptr);
+        ptr += sizeof ll;
+
+        if (ptr + ll > end)
         {
-            d->append((char*)&l, sizeof l);
-            d->append(buf, l);
-            ll = (unsigned short)it->second.size();
-            d->append((char*)&ll, sizeof ll);
-            d->append(it->second.data(), ll);
+            return NULL;
         }
+
+        if (name && id == name)
+        {
+            // the last one wins, as when importing
+            if (value)
+            {
+                value->assign(ptr, ll);
+            }
+            if (found)
+            {
+                *found = true;
+            }
+        }
+        ptr += ll;
     }
 
-    d->append("", 1);
+    return ptr;
 }
 
 // read binary serialize, return final offset
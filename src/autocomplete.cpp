@@ -683,6 +683,65 @@ MegaFS::MegaFS(bool files, bool folders, MegaClient* c, ::mega::handle* curDirHa
 {
 }
 
+MegaFS::SortedChildren& MegaFS::sortedChildren(Node* n)
+{
+    auto it = sorted.find(n->nodehandle);
+    if (it == sorted.end())
+    {
+        if (sorted.size() >= MAX_SORTED_FOLDERS)
+        {
+            sorted.clear();
+        }
+        it = sorted.emplace(n->nodehandle, SortedChildren()).first;
+    }
+
+    SortedChildren& sc = it->second;
+    if (!sc.built || sc.childrenseq != n->childrenseq)
+    {
+        sc.byname.clear();
+        sc.byname.reserve(n->children.size());
+        for (Node* c : n->children)
+        {
+            sc.byname.emplace_back(c->displayname(), c);
+        }
+        std::sort(sc.byname.begin(), sc.byname.end(), [](const std::pair<std::string, Node*>& a, const std::pair<std::string, Node*>& b)
+        {
+            return a.first < b.first;
+        });
+
+        sc.built = true;
+        sc.childrenseq = n->childrenseq;
+        sc.lastprefix.clear();
+        sc.first = 0;
+        sc.last = sc.byname.size();
+    }
+    return sc;
+}
+
+void MegaFS::SortedChildren::range(const std::string& prefix)
+{
+    // a prefix that extends the last one only narrows its range
+    auto from = byname.begin(), to = byname.end();
+    if (prefix.size() >= lastprefix.size() && !prefix.compare(0, lastprefix.size(), lastprefix))
+    {
+        from += first;
+        to = byname.begin() + last;
+    }
+
+    auto lo = std::lower_bound(from, to, prefix, [](const std::pair<std::string, Node*>& e, const std::string& p)
+    {
+        return e.first < p;
+    });
+    auto hi = std::partition_point(lo, to, [&prefix](const std::pair<std::string, Node*>& e)
+    {
+        return !e.first.compare(0, prefix.size(), prefix);
+    });
+
+    lastprefix = prefix;
+    first = size_t(lo - byname.begin());
+    last = size_t(hi - byname.begin());
+}
+
 Node* addShareRootCompletions(ACState& s, MegaClient* client, string& pathprefix)
 {
     const string& path = s.word().s;
@@ -784,11 +843,13 @@ bool MegaFS::addCompletions(ACState& s)
                 else
                 {
                     Node* nodematch = NULL;
-                    for (Node* subnode : n->children)
+                    SortedChildren& sc = sortedChildren(n);
+                    sc.range(folderName);
+                    for (size_t i = sc.first; i < sc.last && sc.byname[i].first == folderName; i++)
                     {
-                        if (subnode->type == FOLDERNODE && subnode->displayname() == folderName)
+                        if (sc.byname[i].second->type == FOLDERNODE)
                         {
-                            nodematch = subnode;
+                            nodematch = sc.byname[i].second;
                             break;
                         }
                     }
@@ -803,15 +864,18 @@ bool MegaFS::addCompletions(ACState& s)
             }
             else
             {
-                // iterate specified folder
+                // the children of the specified folder that start with the leaf
                 if (n)
                 {
-                    for (Node* subnode : n->children)
+                    SortedChildren& sc = sortedChildren(n);
+                    sc.range(leaf);
+                    for (size_t i = sc.first; i < sc.last; i++)
                     {
+                        Node* subnode = sc.byname[i].second;
                         if ((reportFolders && subnode->type == FOLDERNODE) ||
                             (reportFiles && subnode->type == FILENODE))
                         {
-                            s.addPathCompletion(pathprefix + subnode->displayname(), "", subnode->type == FOLDERNODE, '/', false);
+                            s.addPathCompletion(pathprefix + sc.byname[i].first, "", subnode->type == FOLDERNODE, '/', false);
                         }
                     }
                 }
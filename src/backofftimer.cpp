@@ -174,6 +174,8 @@ void BackoffTimerGroupTracker::update(dstime* waituntil, bool transfers)
             }
             else
             {
+                // the soonest of the rest, as update() on each of them would
+                *waituntil = std::min(*waituntil, t.first);
                 break;
             }
         }
@@ -210,6 +212,7 @@ void BackoffTimerGroupTracker::update(dstime* waituntil, bool transfers)
             }
             if (t.first > Waiter::ds)
             {
+                *waituntil = std::min(*waituntil, t.first);
                 break;
             }
         }
@@ -20,97 +20,234 @@
  */
 
 #include "mega/base64.h"
+#include "mega/utils.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || (defined(_M_IX86) && !defined(_M_ARM))
+#define BASE64_SSSE3 1
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#define BASE64_TARGET_SSSE3
+#else
+#define BASE64_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define BASE64_NEON 1
+#include <arm_neon.h>
+#endif
 
 namespace mega {
-// modified base64 conversion (no trailing '=' and '-_' instead of '+/')
-unsigned char Base64::to64(byte c)
-{
-    c &= 63;
- 
-    if (c < 26)
-    {
-        return c + 'A';
-    }
- 
-    if (c < 52)
-    {
-        return c - 26 + 'a';
-    }
 
-    if (c < 62)
-    {
-        return c - 52 + '0';
-    }
+namespace {
+
+const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// the value of each character, 255 if it isn't one ('+' and '/' are accepted as well)
+const byte values[256] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  62, 255,  62, 255,  63,
+     52,  53,  54,  55,  56,  57,  58,  59,  60,  61, 255, 255, 255, 255, 255, 255,
+    255,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+     15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25, 255, 255, 255, 255,  63,
+    255,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+     41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+};
+
+#ifdef BASE64_SSSE3
+// 12 bytes to 16 characters per iteration, for as long as 16 bytes can be loaded.  Returns the bytes encoded
+BASE64_TARGET_SSSE3 int encodeSsse3(const byte* b, int blen, char* a)
+{
+    // the indexes of ranges A-Z, a-z, 0-9, '-' and '_' to their offsets to ASCII
+    const __m128i offsets = _mm_setr_epi8(71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -17, 32, 65, 0, 0);
+    int done = 0;
 
-    if (c == 62)
+    for (; blen - done >= 16; done += 12, a += 16)
     {
-        return '-';
+        // each 3 bytes [s0 s1 s2] to 32 bits [s1 s0 s2 s1], from which the 4 sextets are multiplied into place
+        __m128i in = _mm_loadu_si128((const __m128i*)(b + done));
+        in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        __m128i sextets = _mm_or_si128(t0, t1);
+
+        // 0 for a-z, 1-12 for the rest above, 13 for A-Z
+        __m128i range = _mm_subs_epu8(sextets, _mm_set1_epi8(51));
+        range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), sextets), _mm_set1_epi8(13)));
+
+        _mm_storeu_si128((__m128i*)a, _mm_add_epi8(sextets, _mm_shuffle_epi8(offsets, range)));
     }
+    return done;
+}
 
-    return '_';
+inline __m128i inrange(__m128i v, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(char(lo - 1))), _mm_cmpgt_epi8(_mm_set1_epi8(char(hi + 1)), v));
 }
 
-unsigned char Base64::from64(byte c)
+// 16 characters to 12 bytes per iteration, until one isn't valid or fewer than 16 bytes of output are left.
+// Returns the characters decoded
+BASE64_TARGET_SSSE3 size_t decodeSsse3(const char* a, size_t alen, byte* b, int blen)
 {
-    if ((c >= 'A') && (c <= 'Z'))
-    {
-        return c - 'A';
-    }
+    size_t done = 0;
 
-    if ((c >= 'a') && (c <= 'z'))
+    for (; alen - done >= 16 && blen >= 16; done += 16, b += 12, blen -= 12)
     {
-        return c - 'a' + 26;
-    }
+        __m128i v = _mm_loadu_si128((const __m128i*)(a + done));
+        __m128i upper = inrange(v, 'A', 'Z');
+        __m128i lower = inrange(v, 'a', 'z');
+        __m128i digit = inrange(v, '0', '9');
+        __m128i s62 = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('-')), _mm_cmpeq_epi8(v, _mm_set1_epi8('+')));
+        __m128i s63 = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')), _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+
+        // characters >= 0x80 compare as negative and match none
+        __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, s62), s63));
+        if (_mm_movemask_epi8(valid) != 0xffff)
+        {
+            break;
+        }
 
-    if ((c >= '0') && (c <= '9'))
-    {
-        return c - '0' + 52;
+        __m128i sextets = _mm_and_si128(upper, _mm_sub_epi8(v, _mm_set1_epi8(65)));
+        sextets = _mm_or_si128(sextets, _mm_and_si128(lower, _mm_sub_epi8(v, _mm_set1_epi8(71))));
+        sextets = _mm_or_si128(sextets, _mm_and_si128(digit, _mm_add_epi8(v, _mm_set1_epi8(4))));
+        sextets = _mm_or_si128(sextets, _mm_and_si128(s62, _mm_set1_epi8(62)));
+        sextets = _mm_or_si128(sextets, _mm_and_si128(s63, _mm_set1_epi8(63)));
+
+        // 4 sextets to 24 bits per 32-bit lane, then the 3 bytes of each lane in order
+        __m128i merged = _mm_maddubs_epi16(sextets, _mm_set1_epi32(0x01400140));
+        merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+        merged = _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        _mm_storeu_si128((__m128i*)b, merged);
     }
+    return done;
+}
+#endif
 
-    if (c == '-' || c == '+')
+#ifdef BASE64_NEON
+// 48 bytes to 64 characters per iteration
+int encodeNeon(const byte* b, int blen, char* a)
+{
+    uint8x16x4_t table;
+    for (int i = 0; i < 4; i++)
     {
-        return 62;
+        table.val[i] = vld1q_u8((const uint8_t*)alphabet + 16 * i);
     }
 
-    if (c == '_' || c == '/')
+    int done = 0;
+    for (; blen - done >= 48; done += 48, a += 64)
     {
-        return 63;
+        uint8x16x3_t in = vld3q_u8(b + done);
+        uint8x16x4_t out;
+        out.val[0] = vshrq_n_u8(in.val[0], 2);
+        out.val[1] = vorrq_u8(vshlq_n_u8(vandq_u8(in.val[0], vdupq_n_u8(3)), 4), vshrq_n_u8(in.val[1], 4));
+        out.val[2] = vorrq_u8(vshlq_n_u8(vandq_u8(in.val[1], vdupq_n_u8(15)), 2), vshrq_n_u8(in.val[2], 6));
+        out.val[3] = vandq_u8(in.val[2], vdupq_n_u8(63));
+        for (int i = 0; i < 4; i++)
+        {
+            out.val[i] = vqtbl4q_u8(table, out.val[i]);
+        }
+        vst4q_u8((uint8_t*)a, out);
     }
-
-    return 255;
+    return done;
 }
 
+inline uint8x16_t sextetsNeon(uint8x16_t v, uint8x16_t& invalid)
+{
+    uint8x16_t upper = vandq_u8(vcgeq_u8(v, vdupq_n_u8('A')), vcleq_u8(v, vdupq_n_u8('Z')));
+    uint8x16_t lower = vandq_u8(vcgeq_u8(v, vdupq_n_u8('a')), vcleq_u8(v, vdupq_n_u8('z')));
+    uint8x16_t digit = vandq_u8(vcgeq_u8(v, vdupq_n_u8('0')), vcleq_u8(v, vdupq_n_u8('9')));
+    uint8x16_t s62 = vorrq_u8(vceqq_u8(v, vdupq_n_u8('-')), vceqq_u8(v, vdupq_n_u8('+')));
+    uint8x16_t s63 = vorrq_u8(vceqq_u8(v, vdupq_n_u8('_')), vceqq_u8(v, vdupq_n_u8('/')));
+
+    uint8x16_t valid = vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(vorrq_u8(digit, s62), s63));
+    invalid = vorrq_u8(invalid, vmvnq_u8(valid));
+
+    uint8x16_t sextets = vandq_u8(upper, vsubq_u8(v, vdupq_n_u8(65)));
+    sextets = vorrq_u8(sextets, vandq_u8(lower, vsubq_u8(v, vdupq_n_u8(71))));
+    sextets = vorrq_u8(sextets, vandq_u8(digit, vaddq_u8(v, vdupq_n_u8(4))));
+    sextets = vorrq_u8(sextets, vandq_u8(s62, vdupq_n_u8(62)));
+    return vorrq_u8(sextets, vandq_u8(s63, vdupq_n_u8(63)));
+}
 
-int Base64::atob(const string &in, string &out)
+// 64 characters to 48 bytes per iteration, until one isn't valid or the output is full
+size_t decodeNeon(const char* a, size_t alen, byte* b, int blen)
 {
-    out.resize(in.size() * 3 / 4 + 3);
-    out.resize(Base64::atob(in.data(), (byte *) out.data(), (int)out.size()));
+    size_t done = 0;
+    for (; alen - done >= 64 && blen >= 48; done += 64, b += 48, blen -= 48)
+    {
+        uint8x16x4_t in = vld4q_u8((const uint8_t*)a + done);
+        uint8x16_t invalid = vdupq_n_u8(0);
+        for (int i = 0; i < 4; i++)
+        {
+            in.val[i] = sextetsNeon(in.val[i], invalid);
+        }
+        if (vmaxvq_u8(invalid))
+        {
+            break;
+        }
 
-    return (int)out.size();
+        uint8x16x3_t out;
+        out.val[0] = vorrq_u8(vshlq_n_u8(in.val[0], 2), vshrq_n_u8(in.val[1], 4));
+        out.val[1] = vorrq_u8(vshlq_n_u8(in.val[1], 4), vshrq_n_u8(in.val[2], 2));
+        out.val[2] = vorrq_u8(vshlq_n_u8(in.val[2], 6), in.val[3]);
+        vst3q_u8(b, out);
+    }
+    return done;
 }
+#endif
 
-std::string Base64::atob(const std::string &in)
+// bulk encoding of the longer inputs, returns the bytes encoded (a multiple of 3)
+int encodeBulk(const byte* b, int blen, char* a)
 {
-    string out;
-    out.resize(in.size() * 3 / 4 + 3);
-    out.resize(Base64::atob(in.data(), (byte *) out.data(), (int)out.size()));
+#if defined(BASE64_SSSE3)
+    static const bool ssse3 = CpuFeatures::get().ssse3;
+    return ssse3 ? encodeSsse3(b, blen, a) : 0;
+#elif defined(BASE64_NEON)
+    return encodeNeon(b, blen, a);
+#else
+    return 0;
+#endif
+}
 
-    return out;
+// bulk decoding from a known number of characters, returns how many were decoded (a multiple of 4)
+size_t decodeBulk(const char* a, size_t alen, byte* b, int blen)
+{
+#if defined(BASE64_SSSE3)
+    static const bool ssse3 = CpuFeatures::get().ssse3;
+    return ssse3 ? decodeSsse3(a, alen, b, blen) : 0;
+#elif defined(BASE64_NEON)
+    return decodeNeon(a, alen, b, blen);
+#else
+    return 0;
+#endif
 }
 
-int Base64::atob(const char* a, byte* b, int blen)
+// the characters from a are decoded until one isn't valid (which the input must end with), and those up to alen
+// are known to be there
+int decode(const char* a, size_t alen, byte* b, int blen)
 {
     byte c[4];
     int i;
     int p = 0;
 
+    size_t bulk = decodeBulk(a, alen, b, blen);
+    a += bulk;
+    p = int(bulk / 4 * 3);
+
     c[3] = 0;
 
     for (;;)
     {
         for (i = 0; i < 4; i++)
         {
-            if ((c[i] = from64(*a++)) == 255)
+            if ((c[i] = values[byte(*a++)]) == 255)
             {
                 break;
             }
@@ -139,6 +276,46 @@ int Base64::atob(const char* a, byte* b, int blen)
     }
 }
 
+} // anonymous
+
+// modified base64 conversion (no trailing '=' and '-_' instead of '+/')
+unsigned char Base64::to64(byte c)
+{
+    return alphabet[c & 63];
+}
+
+unsigned char Base64::from64(byte c)
+{
+    return values[c];
+}
+
+int Base64::atob(const string &in, string &out)
+{
+    out.resize(in.size() * 3 / 4 + 3);
+    out.resize(decode(in.data(), in.size(), (byte *) out.data(), (int)out.size()));
+
+    return (int)out.size();
+}
+
+std::string Base64::atob(const std::string &in)
+{
+    string out;
+    out.resize(in.size() * 3 / 4 + 3);
+    out.resize(decode(in.data(), in.size(), (byte *) out.data(), (int)out.size()));
+    return out;
+}
+
+int Base64::atob(const char* a, byte* b, int blen)
+{
+    // the length is unknown: no bulk decoding
+    return decode(a, 0, b, blen);
+}
+
+int Base64::atob(const char* a, size_t alen, byte* b, int blen)
+{
+    return decode(a, alen, b, blen);
+}
+
 void Base64::itoa(int64_t val, string *result)
 {
     byte c;
@@ -222,34 +399,31 @@ std::string Base64::btoa(const string &in)
 
 int Base64::btoa(const byte* b, int blen, char* a)
 {
-    int p = 0;
+    int p = encodeBulk(b, blen, a);
+    b += p;
+    blen -= p;
+    p = p / 3 * 4;
 
-    for (;;)
+    for (; blen >= 3; blen -= 3, b += 3)
     {
-        if (blen <= 0)
-        {
-            break;
-        }
-
-        a[p++] = to64(*b >> 2);
-        a[p++] = to64((*b << 4) | (((blen > 1) ? b[1] : 0) >> 4));
+        a[p++] = alphabet[b[0] >> 2];
+        a[p++] = alphabet[((b[0] & 3) << 4) | (b[1] >> 4)];
+        a[p++] = alphabet[((b[1] & 15) << 2) | (b[2] >> 6)];
+        a[p++] = alphabet[b[2] & 63];
+    }
 
-        if (blen < 2)
+    if (blen > 0)
+    {
+        a[p++] = alphabet[b[0] >> 2];
+        if (blen > 1)
         {
-            break;
+            a[p++] = alphabet[((b[0] & 3) << 4) | (b[1] >> 4)];
+            a[p++] = alphabet[(b[1] & 15) << 2];
         }
-
-        a[p++] = to64(b[1] << 2 | (((blen > 2) ? b[2] : 0) >> 6));
-
-        if (blen < 3)
+        else
         {
-            break;
+            a[p++] = alphabet[(b[0] & 3) << 4];
         }
-
-        a[p++] = to64(b[2]);
-
-        blen -= 3;
-        b += 3;
     }
 
     a[p] = 0;
@@ -34,6 +34,10 @@ Command::Command()
     tag = 0;
     batchSeparately = false;
     suppressSID = false;
+    streamResponse = false;
+    latencySensitive = false;
+    orderIndependent = false;
+    deferrable = false;
 }
 
 void Command::cancel()
@@ -47,6 +51,11 @@ const char* Command::getstring() const
     return json.c_str();
 }
 
+size_t Command::jsonlength() const
+{
+    return json.size();
+}
+
 // add opcode
 void Command::cmd(const char* cmd)
 {
@@ -88,13 +97,12 @@ void Command::arg(const char* name, const char* value, int quotes)
 // binary data
 void Command::arg(const char* name, const byte* value, int len)
 {
-    char* buf = new char[len * 4 / 3 + 4];
-
-    Base64::btoa(value, len, buf);
-
-    arg(name, buf);
-
-    delete[] buf;
+    addcomma();
+    json.append("\"");
+    json.append(name);
+    json.append("\":\"");
+    appendbase64(value, len);
+    json.append("\"");
 }
 
 // 64-bit signed integer
@@ -119,6 +127,18 @@ void Command::appendraw(const char* s, int len)
     json.append(s, len);
 }
 
+void Command::appendbase64(const byte* data, int len)
+{
+    size_t pos = json.size();
+    json.resize(pos + len * 4 / 3 + 4);
+    json.resize(pos + Base64::btoa(data, len, &json[pos]));
+}
+
+void Command::reserve(size_t bytes)
+{
+    json.reserve(json.size() + bytes);
+}
+
 // begin array
 void Command::beginarray()
 {
@@ -182,27 +202,14 @@ void Command::element(int n)
 // add handle (with size specifier)
 void Command::element(handle h, int len)
 {
-    char buf[16];
-
-    Base64::btoa((const byte*)&h, len, buf);
-
-    json.append(elements() ? ",\"" : "\"");
-    json.append(buf);
-    json.append("\"");
+    element((const byte*)&h, len);
 }
 
 // add binary data
 void Command::element(const byte* data, int len)
 {
-    char* buf = new char[len * 4 / 3 + 4];
-
-    len = Base64::btoa(data, len, buf);
-
     json.append(elements() ? ",\"" : "\"");
-    json.append(buf, len);
-
-    delete[] buf;
-
+    appendbase64(data, len);
     json.append("\"");
 }
 
@@ -84,10 +84,10 @@ void HttpReqCommandPutFA::procresult()
                 Base64::btoa((const byte*)&client->me, MegaClient::USERHANDLE, me64);
 
                 if (n && client->checkaccess(n, FULL) &&
-                        (n->attrs.map.find('f') == n->attrs.map.end() || n->attrs.map['f'] != me64) )
+                        (n->attrs().map.find('f') == n->attrs().map.end() || n->attrs().map['f'] != me64) )
                 {
                     LOG_debug << "Restoration of file attributes is not allowed for current user (" << me64 << ").";
-                    n->attrs.map['f'] = me64;
+                    n->attrs().map['f'] = me64;
 
                     int creqtag = client->reqtag;
                     client->reqtag = 0;
@@ -412,6 +412,7 @@ void CommandPutFile::procresult()
                     tslot->transfer->tempurls = tempurls;
                     tslot->transferbuf.setIsRaid(tslot->transfer, tempurls, tslot->transfer->pos, tslot->maxRequestSize);
                     tslot->starttime = tslot->lastdata = client->waiter->ds;
+                    tslot->tempurlsready();
                     return tslot->progress();
                 }
                 else
@@ -869,7 +870,7 @@ void CommandGetFile::procresult()
                                                 Node *n = client->nodebyhandle(ph);
                                                 if (n)
                                                 {
-                                                    n->size = s;
+                                                    n->setsize(s);
                                                     client->notifynode(n);
                                                 }
                                             }
@@ -886,6 +887,7 @@ void CommandGetFile::procresult()
                                         {
                                             tslot->transfer->tempurls = tempurls;
                                             tslot->transferbuf.setIsRaid(tslot->transfer, tempurls, tslot->transfer->pos, tslot->maxRequestSize);
+                                            tslot->tempurlsready();
                                             return tslot->progress();
                                         }
 
@@ -961,7 +963,7 @@ CommandSetAttr::CommandSetAttr(MegaClient* client, Node* n, SymmCipher* cipher,
 
     string at;
 
-    n->attrs.getjson(&at);
+    n->attrs().getjson(&at);
     client->makeattr(cipher, &at, at.c_str(), int(at.size()));
 
     arg("n", (byte*)&n->nodehandle, MegaClient::NODEHANDLE);
@@ -1050,6 +1052,14 @@ CommandPutNodes::CommandPutNodes(MegaClient* client, handle th,
         arg("cauth", cauth);
     }
 
+    // the attributes and keys (in Base64) are most of it, then the names and handles around them
+    size_t estimate = 0;
+    for (i = 0; i < numnodes; i++)
+    {
+        estimate += (nn[i].attrstring->size() + nn[i].nodekey.size()) * 4 / 3 + 96;
+    }
+    reserve(estimate);
+
     beginarray("n");
 
     for (i = 0; i < numnodes; i++)
@@ -1158,32 +1168,35 @@ void CommandPutNodes::procresult()
 {
     error e;
 
-    pendingdbid_map::iterator it = client->pendingtcids.find(tag);
-    if (it != client->pendingtcids.end())
+    for (int t : batchtags.empty() ? vector<int>(1, tag) : batchtags)
     {
-        if (client->tctable)
+        pendingdbid_map::iterator it = client->pendingtcids.find(t);
+        if (it != client->pendingtcids.end())
         {
-            client->mTctableRequestCommitter->beginOnce();
-            vector<uint32_t> &ids = it->second;
-            for (unsigned int i = 0; i < ids.size(); i++)
+            if (client->tctable)
             {
-                if (ids[i])
+                client->mTctableRequestCommitter->beginOnce();
+                vector<uint32_t> &ids = it->second;
+                for (unsigned int i = 0; i < ids.size(); i++)
                 {
-                    client->tctable->del(ids[i]);
+                    if (ids[i])
+                    {
+                        client->tctable->del(ids[i]);
+                    }
                 }
             }
+            client->pendingtcids.erase(it);
         }
-        client->pendingtcids.erase(it);
-    }
-    pendingfiles_map::iterator pit = client->pendingfiles.find(tag);
-    if (pit != client->pendingfiles.end())
-    {
-        vector<string> &pfs = pit->second;
-        for (unsigned int i = 0; i < pfs.size(); i++)
+        pendingfiles_map::iterator pit = client->pendingfiles.find(t);
+        if (pit != client->pendingfiles.end())
         {
-            client->fsaccess->unlinklocal(&pfs[i]);
+            vector<string> &pfs = pit->second;
+            for (unsigned int i = 0; i < pfs.size(); i++)
+            {
+                client->fsaccess->unlinklocal(&pfs[i]);
+            }
+            client->pendingfiles.erase(pit);
         }
-        client->pendingfiles.erase(pit);
     }
 
     if (client->json.isnumeric())
@@ -1243,7 +1256,11 @@ void CommandPutNodes::procresult()
         else
         {
 #endif
-            if (source == PUTNODES_APP)
+            if (!batchtags.empty())
+            {
+                return batchresult(e);
+            }
+            else if (source == PUTNODES_APP)
             {
                 return client->app->putnodes_result(e, type, nn);
             }
@@ -1328,6 +1345,10 @@ void CommandPutNodes::procresult()
             }
         }
 #endif
+        if (!batchtags.empty())
+        {
+            return batchresult(e);
+        }
         client->app->putnodes_result((!e && empty) ? API_ENOENT : e, type, nn);
     }
 #ifdef ENABLE_SYNC
@@ -1338,6 +1359,24 @@ void CommandPutNodes::procresult()
 #endif
 }
 
+// report each upload of a batch on its own, with its tag, as if it had been sent alone
+void CommandPutNodes::batchresult(error e)
+{
+    int creqtag = client->restag;
+    for (int i = 0; i < nnsize; i++)
+    {
+        NewNode* one = new NewNode[1];
+        one->take(nn[i]);
+
+        client->restag = batchtags[i];
+        client->app->putnodes_result((!e && !one->added) ? API_ENOENT : e, type, one);
+    }
+    client->restag = creqtag;
+
+    delete [] nn;
+    nn = NULL;
+}
+
 CommandMoveNode::CommandMoveNode(MegaClient* client, Node* n, Node* t, syncdel_t csyncdel, handle prevparent)
 {
     h = n->nodehandle;
@@ -2092,9 +2131,22 @@ CommandSetShare::CommandSetShare(MegaClient* client, Node* n, User* u, accesslev
     if (newshare)
     {
         // the new share's nodekeys for this user: generate node list
-        TreeProcShareKeys tpsk(n);
+        TreeProcShareKeys tpsk(n, MegaClient::KEYCR_MAXBYTES);
         client->proctree(n, &tpsk);
         tpsk.get(this);
+
+        // a large tree: the first part goes with the share, the others after it
+        if (tpsk.parts() > 1)
+        {
+            shareparts = std::make_shared<CommandKeyCR::ShareParts>();
+            shareparts->total = int(tpsk.parts());
+            shareparts->done = 1;
+
+            for (size_t i = 1; i < tpsk.parts(); i++)
+            {
+                keyparts.emplace_back(new CommandKeyCR(client, tpsk, i, shareparts));
+            }
+        }
     }
 }
 
@@ -2208,6 +2260,19 @@ void CommandSetShare::procresult()
                 break;
 
             case EOO:
+                if (keyparts.size())
+                {
+                    LOG_debug << "Sending the node keys of the new share in " << shareparts->total << " parts";
+                    client->app->share_progress(shareparts->done, shareparts->total);
+
+                    for (auto& c : keyparts)
+                    {
+                        client->reqs.add(c.release());
+                    }
+                    keyparts.clear();
+                    return;
+                }
+
                 client->app->share_result(API_OK);
                 return;
 
@@ -3033,6 +3098,8 @@ CommandGetUA::CommandGetUA(MegaClient* /*client*/, const char* uid, attr_t at, c
     this->uid = uid;
     this->at = at;
     this->ph = ph ? string(ph) : "";
+    latencySensitive = true;
+    orderIndependent = true;
 
     if (ph && ph[0])
     {
@@ -3058,7 +3125,15 @@ void CommandGetUA::procresult()
     {
         error e = (error)client->json.getint();
 
-        if (e == API_ENOENT && u)
+        if (e == API_ENOENT && u && u->userhandle != client->me && !isFromChatPreview())
+        {
+            // a contact's missing attribute (no name, no avatar...) is not requested again
+            // until an action packet reports it
+            u->setnonexistentattr(at);
+            u->setTag(tag ? tag : -1);
+            client->notifyuser(u);
+        }
+        else if (e == API_ENOENT && u)
         {
             u->removeattr(at);
         }
@@ -3102,7 +3177,10 @@ void CommandGetUA::procresult()
     {
         const char* ptr;
         const char* end;
-        string value, version, buf;
+        string value, version;
+
+        // the Base64 value is decoded straight from the response
+        JSONView buf;
 
         //If we are in preview mode, we only can retrieve atributes with mcuga and the response format is different
         if (isFromChatPreview())
@@ -3115,9 +3193,8 @@ void CommandGetUA::procresult()
             else
             {
                 // convert from ASCII to binary the received data
-                buf.assign(ptr, (end-ptr));
-                value.resize(buf.size() / 4 * 3 + 3);
-                value.resize(Base64::atob(buf.data(), (byte *)value.data(), int(value.size())));
+                value.resize((end - ptr) / 4 * 3 + 3);
+                value.resize(Base64::atob(ptr, (byte *)value.data(), int(value.size())));
                 client->app->getua_result((byte*) value.data(), unsigned(value.size()), at);
             }
             return;
@@ -3129,7 +3206,7 @@ void CommandGetUA::procresult()
             {
                 case MAKENAMEID2('a','v'):
                 {
-                    if (!(ptr = client->json.getvalue()) || !(end = strchr(ptr, '"')))
+                    if (!(buf = client->json.getvalueView()).data)
                     {
                         client->app->getua_result(API_EINTERNAL);
                         if (client->fetchingkeys && at == ATTR_SIG_RSA_PUBK && u && u->userhandle == client->me)
@@ -3138,7 +3215,6 @@ void CommandGetUA::procresult()
                         }
                         return;
                     }
-                    buf.assign(ptr, (end-ptr));
                     break;
                 }
                 case 'v':
@@ -3158,9 +3234,16 @@ void CommandGetUA::procresult()
                 case EOO:
                 {
                     // if there's no avatar, the value is "none" (not Base64 encoded)
-                    if (u && at == ATTR_AVATAR && buf == "none")
+                    if (u && at == ATTR_AVATAR && buf.equals("none"))
                     {
-                        u->setattr(at, NULL, &version);
+                        if (u->userhandle != client->me)
+                        {
+                            u->setnonexistentattr(at);
+                        }
+                        else
+                        {
+                            u->setattr(at, NULL, &version);
+                        }
                         u->setTag(tag ? tag : -1);
                         client->app->getua_result(API_ENOENT);
                         client->notifyuser(u);
@@ -3168,8 +3251,8 @@ void CommandGetUA::procresult()
                     }
 
                     // convert from ASCII to binary the received data
-                    value.resize(buf.size() / 4 * 3 + 3);
-                    value.resize(Base64::atob(buf.data(), (byte *)value.data(), int(value.size())));
+                    value.resize(buf.size / 4 * 3 + 3);
+                    value.resize(buf.data ? Base64::atob(buf.data, (byte *)value.data(), int(value.size())) : 0);
 
                     // Some attributes don't keep historic records, ie. *!authring or *!lstint
                     // (none of those attributes are used by the SDK yet)
@@ -3180,7 +3263,7 @@ void CommandGetUA::procresult()
 
                     if (!u) // retrieval of attributes without contact-relationship
                     {
-                        if (at == ATTR_AVATAR && buf == "none")
+                        if (at == ATTR_AVATAR && buf.equals("none"))
                         {
                             client->app->getua_result(API_ENOENT);
                         }
@@ -3568,6 +3651,44 @@ CommandKeyCR::CommandKeyCR(MegaClient* /*client*/, node_vector* rshares, node_ve
     endarray();
 }
 
+CommandKeyCR::CommandKeyCR(MegaClient* client, TreeProcShareKeys& tpsk, size_t part, std::shared_ptr<ShareParts> parts)
+{
+    cmd("k");
+    tpsk.get(this, part);
+
+    shareparts = std::move(parts);
+    tag = client->restag;
+}
+
+void CommandKeyCR::procresult()
+{
+    if (!shareparts)
+    {
+        return Command::procresult();
+    }
+
+    if (!client->json.isnumeric())
+    {
+        Command::procresult();
+    }
+    else if (error e = error(client->json.getint()))
+    {
+        LOG_warn << "Unable to send part of the keys of a new share: " << e;
+        if (!shareparts->e)
+        {
+            shareparts->e = e;
+        }
+    }
+
+    if (++shareparts->done < shareparts->total)
+    {
+        return client->app->share_progress(shareparts->done, shareparts->total);
+    }
+
+    // the share exists regardless: missing keys are requested back by the server later (cr)
+    client->app->share_result(shareparts->e);
+}
+
 // a == ACCESS_UNKNOWN: request public key for user handle and respond with
 // share key for sn
 // otherwise: request public key for user handle and continue share creation
@@ -3579,6 +3700,8 @@ CommandPubKeyRequest::CommandPubKeyRequest(MegaClient* client, User* user)
 
     u = user;
     tag = client->reqtag;
+    latencySensitive = true;
+    orderIndependent = true;
 }
 
 void CommandPubKeyRequest::procresult()
@@ -4952,6 +5075,7 @@ CommandFetchNodes::CommandFetchNodes(MegaClient* client, bool nocache)
 
     // The servers are more efficient with this command when it's the only one in the batch
     batchSeparately = true;
+    streamResponse = true;
 
     tag = client->reqtag;
 }
@@ -4962,7 +5086,12 @@ void CommandFetchNodes::procresult()
     WAIT_CLASS::bumpds();
     client->fnstats.timeToLastByte = Waiter::ds - client->fnstats.startTime;
 
-    client->purgenodesusersabortsc();
+    // nodes already parsed while the response was being received are kept
+    if (client->fnstream != MegaClient::FNSTREAM_DONE)
+    {
+        client->purgenodesusersabortsc();
+    }
+    client->fnstream = MegaClient::FNSTREAM_OFF;
 
     if (client->json.isnumeric())
     {
@@ -4976,6 +5105,9 @@ void CommandFetchNodes::procresult()
         {
             case 'f':
                 // nodes
+                // pre-size the node table from the remaining response size to avoid rehashing while it fills up
+                client->nodes.reserve(strlen(client->json.pos) / MegaClient::FETCHNODES_RECORD_SIZE);
+
                 if (!client->readnodes(&client->json, 0))
                 {
                     client->fetchingnodes = false;
@@ -5069,6 +5201,7 @@ void CommandFetchNodes::procresult()
 
                 client->mergenewshares(0);
                 client->applykeys();
+                client->prunenodescope();
                 client->initsc();
                 client->pendingsccommit = false;
                 client->fetchnodestag = tag;
@@ -5076,6 +5209,7 @@ void CommandFetchNodes::procresult()
                 WAIT_CLASS::bumpds();
                 client->fnstats.timeToCached = Waiter::ds - client->fnstats.startTime;
                 client->fnstats.nodesCached = client->nodes.size();
+                client->fnstats.bytesPerNode = client->bytespernode();
                 return;
             }
             default:
@@ -5368,6 +5502,7 @@ CommandSendEvent::CommandSendEvent(MegaClient *client, int type, const char *des
     cmd("log");
     arg("e", type);
     arg("m", desc);
+    deferrable = true;
 
     tag = client->reqtag;
 }
@@ -6225,23 +6360,23 @@ void CommandChatGrantAccess::procresult()
             if (client->chats.find(chatid) == client->chats.end())
             {
                 // the action succeed for a non-existing chatroom??
-                client->app->chatgrantaccess_result(API_EINTERNAL);
+                client->app->chatgrantaccess_result(h, API_EINTERNAL);
                 return;
             }
 
             TextChat *chat = client->chats[chatid];
-            chat->setNodeUserAccess(h, uh);
+            client->setattachmentaccess(chat, h, uh);
 
             chat->setTag(tag ? tag : -1);
             client->notifychat(chat);
         }
 
-        client->app->chatgrantaccess_result(e);
+        client->app->chatgrantaccess_result(h, e);
     }
     else
     {
         client->json.storeobject();
-        client->app->chatgrantaccess_result(API_EINTERNAL);
+        client->app->chatgrantaccess_result(h, API_EINTERNAL);
     }
 }
 
@@ -6273,23 +6408,23 @@ void CommandChatRemoveAccess::procresult()
             if (client->chats.find(chatid) == client->chats.end())
             {
                 // the action succeed for a non-existing chatroom??
-                client->app->chatremoveaccess_result(API_EINTERNAL);
+                client->app->chatremoveaccess_result(h, API_EINTERNAL);
                 return;
             }
 
             TextChat *chat = client->chats[chatid];
-            chat->setNodeUserAccess(h, uh, true);
+            client->setattachmentaccess(chat, h, uh, true);
 
             chat->setTag(tag ? tag : -1);
             client->notifychat(chat);
         }
 
-        client->app->chatremoveaccess_result(e);
+        client->app->chatremoveaccess_result(h, e);
     }
     else
     {
         client->json.storeobject();
-        client->app->chatremoveaccess_result(API_EINTERNAL);
+        client->app->chatremoveaccess_result(h, API_EINTERNAL);
     }
 }
 
@@ -21,6 +21,19 @@
 
 #include "mega.h"
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || (defined(_M_IX86) && !defined(_M_ARM))
+#define CRC32_PCLMUL 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define CRC32_TARGET_PCLMUL
+#else
+#define CRC32_TARGET_PCLMUL __attribute__((target("pclmul,sse4.1")))
+#endif
+#elif defined(__ARM_FEATURE_CRC32)
+#define CRC32_ARMV8 1
+#include <arm_acle.h>
+#endif
+
 namespace mega {
 #ifndef htobe64
 #define htobe64(x) (((uint64_t)htonl((uint32_t)((x) >> 32))) | (((uint64_t)htonl((uint32_t)x)) << 32))
@@ -60,20 +73,38 @@ void SymmCipher::setkey(const byte* newkey, int type)
         xorblock(newkey + KEYLENGTH, key);
     }
 
-    aesecb_e.SetKey(key, KEYLENGTH);
-    aesecb_d.SetKey(key, KEYLENGTH);
+    // the modes are keyed when they are used
+    keyedmodes = 0;
+}
 
-    aescbc_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
-    aescbc_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+// mode, with its key schedule done for the current key
+template<class Mode>
+Mode& SymmCipher::keyed(Mode& mode, unsigned bit)
+{
+    if (!(keyedmodes & bit))
+    {
+        if (bit & (ECB_E | ECB_D))
+        {
+            mode.SetKey(key, KEYLENGTH);
+        }
+        else
+        {
+            mode.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+        }
+        keyedmodes |= bit;
+    }
 
-    aesccm8_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
-    aesccm8_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+    return mode;
+}
 
-    aesccm16_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
-    aesccm16_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+SymmCipher::AuthModes& SymmCipher::auth()
+{
+    if (!authmodes)
+    {
+        authmodes.reset(new AuthModes);
+    }
 
-    aesgcm_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
-    aesgcm_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+    return *authmodes;
 }
 
 bool SymmCipher::setkey(const string* key)
@@ -90,19 +121,19 @@ bool SymmCipher::setkey(const string* key)
 
 void SymmCipher::cbc_encrypt(byte* data, size_t len, const byte* iv)
 {
-    aescbc_e.Resynchronize(iv ? iv : zeroiv);
+    keyed(aescbc_e, CBC_E).Resynchronize(iv ? iv : zeroiv);
     aescbc_e.ProcessData(data, data, len);
 }
 
 void SymmCipher::cbc_decrypt(byte* data, size_t len, const byte* iv)
 {
-    aescbc_d.Resynchronize(iv ? iv : zeroiv);
+    keyed(aescbc_d, CBC_D).Resynchronize(iv ? iv : zeroiv);
     aescbc_d.ProcessData(data, data, len);
 }
 
 void SymmCipher::cbc_encrypt_pkcs_padding(const string *data, const byte *iv, string *result)
 {
-    aescbc_e.Resynchronize(iv ? iv : zeroiv);
+    keyed(aescbc_e, CBC_E).Resynchronize(iv ? iv : zeroiv);
     StringSource(*data, true,
            new StreamTransformationFilter( aescbc_e, new StringSink( *result ),
                                                      StreamTransformationFilter::PKCS_PADDING));
@@ -110,7 +141,7 @@ void SymmCipher::cbc_encrypt_pkcs_padding(const string *data, const byte *iv, st
 
 void SymmCipher::cbc_decrypt_pkcs_padding(const std::string *data, const byte *iv, string *result)
 {
-    aescbc_d.Resynchronize(iv ? iv : zeroiv);
+    keyed(aescbc_d, CBC_D).Resynchronize(iv ? iv : zeroiv);
     StringSource(*data, true,
            new StreamTransformationFilter( aescbc_d, new StringSink( *result ),
                                                      StreamTransformationFilter::PKCS_PADDING));
@@ -118,27 +149,27 @@ void SymmCipher::cbc_decrypt_pkcs_padding(const std::string *data, const byte *i
 
 void SymmCipher::ecb_encrypt(byte* data, byte* dst, size_t len)
 {
-    aesecb_e.ProcessData(dst ? dst : data, data, len);
+    keyed(aesecb_e, ECB_E).ProcessData(dst ? dst : data, data, len);
 }
 
 void SymmCipher::ecb_decrypt(byte* data, size_t len)
 {
-    aesecb_d.ProcessData(data, data, len);
+    keyed(aesecb_d, ECB_D).ProcessData(data, data, len);
 }
 
 void SymmCipher::ccm_encrypt(const string *data, const byte *iv, unsigned ivlen, unsigned taglen, string *result)
 {
     if (taglen == 16)
     {
-        aesccm16_e.Resynchronize(iv, ivlen);
-        aesccm16_e.SpecifyDataLengths(0, data->size(), 0);
-        StringSource(*data, true, new AuthenticatedEncryptionFilter(aesccm16_e, new StringSink(*result)));
+        keyed(auth().aesccm16_e, CCM16_E).Resynchronize(iv, ivlen);
+        authmodes->aesccm16_e.SpecifyDataLengths(0, data->size(), 0);
+        StringSource(*data, true, new AuthenticatedEncryptionFilter(authmodes->aesccm16_e, new StringSink(*result)));
     }
     else if (taglen == 8)
     {
-        aesccm8_e.Resynchronize(iv, ivlen);
-        aesccm8_e.SpecifyDataLengths(0, data->size(), 0);
-        StringSource(*data, true, new AuthenticatedEncryptionFilter(aesccm8_e, new StringSink(*result)));
+        keyed(auth().aesccm8_e, CCM8_E).Resynchronize(iv, ivlen);
+        authmodes->aesccm8_e.SpecifyDataLengths(0, data->size(), 0);
+        StringSource(*data, true, new AuthenticatedEncryptionFilter(authmodes->aesccm8_e, new StringSink(*result)));
     }
 }
 
@@ -147,15 +178,15 @@ bool SymmCipher::ccm_decrypt(const string *data, const byte *iv, unsigned ivlen,
     try {
         if (taglen == 16)
         {
-            aesccm16_d.Resynchronize(iv, ivlen);
-            aesccm16_d.SpecifyDataLengths(0, data->size() - taglen, 0);
-            StringSource(*data, true, new AuthenticatedDecryptionFilter(aesccm16_d, new StringSink(*result)));
+            keyed(auth().aesccm16_d, CCM16_D).Resynchronize(iv, ivlen);
+            authmodes->aesccm16_d.SpecifyDataLengths(0, data->size() - taglen, 0);
+            StringSource(*data, true, new AuthenticatedDecryptionFilter(authmodes->aesccm16_d, new StringSink(*result)));
         }
         else if (taglen == 8)
         {
-            aesccm8_d.Resynchronize(iv, ivlen);
-            aesccm8_d.SpecifyDataLengths(0, data->size() - taglen, 0);
-            StringSource(*data, true, new AuthenticatedDecryptionFilter(aesccm8_d, new StringSink(*result)));
+            keyed(auth().aesccm8_d, CCM8_D).Resynchronize(iv, ivlen);
+            authmodes->aesccm8_d.SpecifyDataLengths(0, data->size() - taglen, 0);
+            StringSource(*data, true, new AuthenticatedDecryptionFilter(authmodes->aesccm8_d, new StringSink(*result)));
         }
     } catch (HashVerificationFilter::HashVerificationFailed e)
     {
@@ -168,15 +199,15 @@ bool SymmCipher::ccm_decrypt(const string *data, const byte *iv, unsigned ivlen,
 
 void SymmCipher::gcm_encrypt(const string *data, const byte *iv, unsigned ivlen, unsigned taglen, string *result)
 {
-    aesgcm_e.Resynchronize(iv, ivlen);
-    StringSource(*data, true, new AuthenticatedEncryptionFilter(aesgcm_e, new StringSink(*result), false, taglen));
+    keyed(auth().aesgcm_e, GCM_E).Resynchronize(iv, ivlen);
+    StringSource(*data, true, new AuthenticatedEncryptionFilter(authmodes->aesgcm_e, new StringSink(*result), false, taglen));
 }
 
 bool SymmCipher::gcm_decrypt(const string *data, const byte *iv, unsigned ivlen, unsigned taglen, string *result)
 {
-    aesgcm_d.Resynchronize(iv, ivlen);
+    keyed(auth().aesgcm_d, GCM_D).Resynchronize(iv, ivlen);
     try {
-        StringSource(*data, true, new AuthenticatedDecryptionFilter(aesgcm_d, new StringSink(*result), taglen));
+        StringSource(*data, true, new AuthenticatedDecryptionFilter(authmodes->aesgcm_d, new StringSink(*result), taglen));
     } catch (HashVerificationFilter::HashVerificationFailed e)
     {
         result->clear();
@@ -263,14 +294,58 @@ SymmCipher& SymmCipher::operator=(const SymmCipher& ref)
     return *this;
 }
 
+SymmCipher* SymmCipherCache::get(const byte* newkey, int type)
+{
+    byte k[SymmCipher::KEYLENGTH];
+    memcpy(k, newkey, sizeof k);
+    if (!type)
+    {
+        SymmCipher::xorblock(newkey + SymmCipher::KEYLENGTH, k);
+    }
+
+    for (int i = used; i--; )
+    {
+        if (!memcmp(ciphers[i].key, k, sizeof k))
+        {
+            hits++;
+            return &ciphers[i];
+        }
+    }
+
+    // the oldest one makes room
+    misses++;
+    SymmCipher* c = &ciphers[next];
+    c->setkey(k);
+    next = (next + 1) % SIZE;
+    if (used < SIZE)
+    {
+        used++;
+    }
+    return c;
+}
+
+SymmCipher* SymmCipherCache::get(const string* nodekey)
+{
+    if (nodekey->size() == FILENODEKEYLENGTH || nodekey->size() == FOLDERNODEKEYLENGTH)
+    {
+        return get((const byte*)nodekey->data(), (nodekey->size() == FOLDERNODEKEYLENGTH) ? FOLDERNODE : FILENODE);
+    }
+
+    return NULL;
+}
+
 // encryption: data must be NUL-padded to BLOCKSIZE
 // decryption: data must be padded to BLOCKSIZE
 // len must be < 2^31
+// the counter blocks are encrypted in batches and the CBC-MAC of each batch is computed in a single CBC pass,
+// so that Crypto++ dispatches whole batches to its pipelined AES-NI/ARMv8 code (selected at runtime)
 void SymmCipher::ctr_crypt(byte* data, unsigned len, m_off_t pos, ctr_iv ctriv, byte* mac, bool encrypt, bool initmac)
 {
     assert(!(pos & (KEYLENGTH - 1)));
 
-    byte ctr[BLOCKSIZE], tmp[BLOCKSIZE];
+    byte ctr[BLOCKSIZE];
+    byte keystream[CTRBATCHSIZE];
+    byte macbuf[CTRBATCHSIZE];
 
     MemAccess::set<int64_t>(ctr,ctriv);
     setint64(pos / BLOCKSIZE, ctr + sizeof ctriv);
@@ -283,44 +358,50 @@ void SymmCipher::ctr_crypt(byte* data, unsigned len, m_off_t pos, ctr_iv ctriv,
 
     while ((int)len > 0)
     {
-        if (encrypt)
-        {
-            if(mac)
-            {
-                xorblock(data, mac);
-                ecb_encrypt(mac);
-            }
+        unsigned batchlen = len < CTRBATCHSIZE ? len : CTRBATCHSIZE;
+        unsigned batchsize = (batchlen + BLOCKSIZE - 1) & -BLOCKSIZE;
 
-            ecb_encrypt(ctr, tmp);
-            xorblock(tmp, data);
+        for (unsigned i = 0; i < batchsize; i += BLOCKSIZE)
+        {
+            memcpy(keystream + i, ctr, BLOCKSIZE);
+            incblock(ctr);
         }
-        else
+
+        keyed(aesecb_e, ECB_E).ProcessData(keystream, keystream, batchsize);
+
+        if (mac && encrypt)
         {
-            ecb_encrypt(ctr, tmp);
-            xorblock(tmp, data);
+            cbc_mac(data, batchsize, batchsize, mac, macbuf);
+        }
 
-            if (mac)
-            {
-                if (len >= (unsigned)BLOCKSIZE)
-                {
-                    xorblock(data, mac);
-                }
-                else
-                {
-                    xorblock(data, mac, len);
-                }
-
-                ecb_encrypt(mac);
-            }
+        for (unsigned i = 0; i < batchsize; i += BLOCKSIZE)
+        {
+            xorblock(keystream + i, data + i);
         }
 
-        len -= BLOCKSIZE;
-        data += BLOCKSIZE;
+        if (mac && !encrypt)
+        {
+            // the padding of a trailing partial block does not contribute to the MAC
+            cbc_mac(data, batchlen, batchsize, mac, macbuf);
+        }
 
-        incblock(ctr);
+        len -= batchsize;
+        data += batchsize;
     }
 }
 
+// update mac with the CBC-MAC of len bytes of data, zero-padded to size (a multiple of BLOCKSIZE)
+void SymmCipher::cbc_mac(const byte* data, unsigned len, unsigned size, byte* mac, byte* scratch)
+{
+    memcpy(scratch, data, len);
+    memset(scratch + len, 0, size - len);
+
+    keyed(aescbc_e, CBC_E).Resynchronize(mac);
+    aescbc_e.ProcessData(scratch, scratch, size);
+
+    memcpy(mac, scratch + size - BLOCKSIZE, BLOCKSIZE);
+}
+
 static void rsaencrypt(Integer* key, Integer* m)
 {
     *m = a_exp_b_mod_c(*m, key[AsymmCipher::PUB_E], key[AsymmCipher::PUB_PQ]);
@@ -641,14 +722,209 @@ void HashSHA256::get(std::string *retStr)
     hash.Final((byte*)retStr->data());
 }
 
+namespace {
+
+// byte-at-a-time tables, slicing by 4
+struct CRC32Tables
+{
+    uint32_t t[4][256];
+
+    CRC32Tables()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+            {
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            t[0][i] = c;
+        }
+
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            for (int k = 1; k < 4; k++)
+            {
+                t[k][i] = t[0][t[k - 1][i] & 0xFF] ^ (t[k - 1][i] >> 8);
+            }
+        }
+    }
+};
+
+uint32_t crc32Tables(uint32_t crc, const byte* data, size_t len)
+{
+    static const CRC32Tables tables;
+    const uint32_t (&t)[4][256] = tables.t;
+
+    while (len >= 4)
+    {
+        crc ^= uint32_t(data[0]) | uint32_t(data[1]) << 8 | uint32_t(data[2]) << 16 | uint32_t(data[3]) << 24;
+        crc = t[3][crc & 0xFF] ^ t[2][(crc >> 8) & 0xFF] ^ t[1][(crc >> 16) & 0xFF] ^ t[0][crc >> 24];
+        data += 4;
+        len -= 4;
+    }
+
+    while (len--)
+    {
+        crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef CRC32_PCLMUL
+// folds 64 byte blocks with carry-less multiplications, as in Intel's
+// "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+// len must be at least 64 and a multiple of 16
+CRC32_TARGET_PCLMUL uint32_t crc32Pclmul(uint32_t crc, const byte* data, size_t len)
+{
+    // bit-reflected folding constants and polynomials
+    alignas(16) static const uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+    alignas(16) static const uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+    alignas(16) static const uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+    alignas(16) static const uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(int(crc)));
+    x0 = _mm_load_si128((const __m128i*)k1k2);
+    data += 64;
+    len -= 64;
+
+    // four blocks of 16 folded in parallel
+    while (len >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+        y6 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+        y7 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+        y8 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        data += 64;
+        len -= 64;
+    }
+
+    // fold into 128 bits
+    x0 = _mm_load_si128((const __m128i*)k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // remaining blocks of 16
+    while (len >= 16)
+    {
+        x2 = _mm_loadu_si128((const __m128i*)data);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        data += 16;
+        len -= 16;
+    }
+
+    // fold 128 bits to 64
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128((const __m128i*)poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return uint32_t(_mm_extract_epi32(x1, 1));
+}
+#endif
+
+#ifdef CRC32_ARMV8
+uint32_t crc32Armv8(uint32_t crc, const byte* data, size_t len)
+{
+    while (len >= 4)
+    {
+        uint32_t w;
+        memcpy(&w, data, sizeof w);
+        crc = __crc32w(crc, w);
+        data += 4;
+        len -= 4;
+    }
+
+    while (len--)
+    {
+        crc = __crc32b(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+} // anonymous
+
 void HashCRC32::add(const byte* data, unsigned len)
 {
-    hash.Update(data, len);
+#if defined(CRC32_PCLMUL)
+    static const bool pclmul = CpuFeatures::get().pclmul && CpuFeatures::get().sse41;
+    if (pclmul && len >= 64)
+    {
+        unsigned folded = len & ~15u;
+        crc = crc32Pclmul(crc, data, folded);
+        data += folded;
+        len -= folded;
+    }
+#elif defined(CRC32_ARMV8)
+    crc = crc32Armv8(crc, data, len);
+    return;
+#endif
+
+    crc = crc32Tables(crc, data, len);
 }
 
 void HashCRC32::get(byte* out)
 {
-    hash.Final(out);
+    // same byte order as CryptoPP::CRC32::Final
+    uint32_t value = ~crc;
+    for (int i = 0; i < 4; i++)
+    {
+        out[i] = byte(value >> (8 * i));
+    }
+    crc = 0xFFFFFFFF;
 }
 
 HMACSHA256::HMACSHA256(const byte *key, size_t length)
@@ -671,22 +947,98 @@ PBKDF2_HMAC_SHA512::PBKDF2_HMAC_SHA512()
 }
 
 void PBKDF2_HMAC_SHA512::deriveKey(byte* derivedkey, size_t derivedkeyLen,
-                                   byte* pwd, size_t pwdLen,
-                                   byte* salt, size_t saltLen, unsigned int iterations)
-{
-    pbkdf2.DeriveKey(
-            // buffer that holds the derived key
-            derivedkey, derivedkeyLen,
-            // purpose byte. unused by this PBKDF implementation.
-            0x00,
-            // password bytes. careful to be consistent with encoding...
-            pwd, pwdLen,
-            // salt bytes
-            salt, saltLen,
-            // iteration count. See SP 800-132 for details. You want this as large as you can tolerate.
-            // make sure to use the same iteration count on both sides...
-            iterations
-            );
+                                   const byte* pwd, size_t pwdLen,
+                                   const byte* salt, size_t saltLen, unsigned int iterations)
+{
+    using CryptoPP::word64;
+    using CryptoPP::SHA512;
+
+    const unsigned WORDS = SHA512::DIGESTSIZE / sizeof(word64);
+    const unsigned BLOCKWORDS = SHA512::BLOCKSIZE / sizeof(word64);
+
+    // the key pad, hashing keys longer than a block as HMAC does
+    byte pad[SHA512::BLOCKSIZE] = {};
+    if (pwdLen > sizeof pad)
+    {
+        SHA512().CalculateDigest(pad, pwd, pwdLen);
+    }
+    else if (pwdLen)
+    {
+        memcpy(pad, pwd, pwdLen);
+    }
+
+    // the hash states after the inner and outer key pads
+    word64 istate[WORDS], ostate[WORDS];
+    word64 block[BLOCKWORDS];
+    for (int outer = 0; outer < 2; outer++)
+    {
+        word64* state = outer ? ostate : istate;
+        for (unsigned i = 0; i < BLOCKWORDS; i++)
+        {
+            block[i] = 0;
+            for (unsigned j = 0; j < sizeof(word64); j++)
+            {
+                block[i] = (block[i] << 8) | byte(pad[i * sizeof(word64) + j] ^ (outer ? 0x5c : 0x36));
+            }
+        }
+        SHA512::InitState(state);
+        SHA512::Transform(state, block);
+    }
+
+    CryptoPP::HMAC<SHA512> hmac(pwd, pwdLen);
+    byte u[SHA512::DIGESTSIZE];
+
+    for (uint32_t blockindex = 1; derivedkeyLen; blockindex++)
+    {
+        // U1 = HMAC(salt || INT(blockindex))
+        byte index[4] = { byte(blockindex >> 24), byte(blockindex >> 16), byte(blockindex >> 8), byte(blockindex) };
+        hmac.Update(salt, saltLen);
+        hmac.Update(index, sizeof index);
+        hmac.Final(u);
+
+        word64 t[WORDS], h[WORDS];
+        for (unsigned i = 0; i < WORDS; i++)
+        {
+            h[i] = 0;
+            for (unsigned j = 0; j < sizeof(word64); j++)
+            {
+                h[i] = (h[i] << 8) | u[i * sizeof(word64) + j];
+            }
+            t[i] = h[i];
+        }
+
+        // later Us hash a digest, which takes a single block after the key pad: the digest, the
+        // padding bit and the length of both blocks in bits
+        for (unsigned i = WORDS; i < BLOCKWORDS; i++)
+        {
+            block[i] = 0;
+        }
+        block[WORDS] = word64(1) << 63;
+        block[BLOCKWORDS - 1] = (SHA512::BLOCKSIZE + SHA512::DIGESTSIZE) * 8;
+
+        for (unsigned iteration = 1; iteration < iterations; iteration++)
+        {
+            memcpy(block, h, sizeof h);
+            memcpy(h, istate, sizeof h);
+            SHA512::Transform(h, block);
+
+            memcpy(block, h, sizeof h);
+            memcpy(h, ostate, sizeof h);
+            SHA512::Transform(h, block);
+
+            for (unsigned i = 0; i < WORDS; i++)
+            {
+                t[i] ^= h[i];
+            }
+        }
+
+        size_t len = std::min<size_t>(derivedkeyLen, SHA512::DIGESTSIZE);
+        for (size_t i = 0; i < len; i++)
+        {
+            *derivedkey++ = byte(t[i / sizeof(word64)] >> (56 - 8 * (i % sizeof(word64))));
+        }
+        derivedkeyLen -= len;
+    }
 }
 
 } // namespace
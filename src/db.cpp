@@ -19,6 +19,8 @@
  * program.
  */
 
+#include <iterator>
+
 #include "mega/db.h"
 #include "mega/utils.h"
 #include "mega/logging.h"
@@ -39,7 +41,8 @@ bool DbTable::put(uint32_t index, string* data)
 // add or update record with padding and encryption
 bool DbTable::put(uint32_t type, Cacheable* record, SymmCipher* key)
 {
-    string data;
+    string& data = recordbuf;
+    data.clear();
 
     if (!record->serialize(&data))
     {
@@ -49,6 +52,13 @@ bool DbTable::put(uint32_t type, Cacheable* record, SymmCipher* key)
         return true;
     }
 
+    // room for the padding, which is then added and encrypted in place
+    // (a smaller reserve() may shrink the buffer with some libraries)
+    size_t padded = (data.size() + key->BLOCKSIZE) & - key->BLOCKSIZE;
+    if (data.capacity() < padded)
+    {
+        data.reserve(padded);
+    }
     PaddedCBC::encrypt(rng, &data, key);
 
     if (!record->dbid)
@@ -59,6 +69,28 @@ bool DbTable::put(uint32_t type, Cacheable* record, SymmCipher* key)
     return put(record->dbid, &data);
 }
 
+bool DbTable::putBatch(uint32_t type, const vector<Cacheable*>& records, SymmCipher* key)
+{
+    for (Cacheable* record : records)
+    {
+        if (!put(type, record, key))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DbTable::delBatch(const vector<uint32_t>& ids)
+{
+    bool result = true;
+    for (uint32_t id : ids)
+    {
+        result = del(id) && result;
+    }
+    return result;
+}
+
 // get next record, decrypt and unpad
 bool DbTable::next(uint32_t* type, string* data, SymmCipher* key)
 {
@@ -80,6 +112,29 @@ bool DbTable::next(uint32_t* type, string* data, SymmCipher* key)
     return false;
 }
 
+bool DbTable::next(uint32_t* type, string* data, SymmCipher* key, uint32_t skiptype)
+{
+    while (next(type, data))
+    {
+        if (!*type)
+        {
+            return true;
+        }
+
+        if (*type > nextid)
+        {
+            nextid = *type & - IDSPACING;
+        }
+
+        if ((*type & (IDSPACING - 1)) != skiptype)
+        {
+            return PaddedCBC::decrypt(data, key);
+        }
+    }
+
+    return false;
+}
+
 void DbTable::checkTransaction()
 {
     if (mCheckAlwaysTransacted)
@@ -107,6 +162,424 @@ void DbTable::checkCommitter(DBTableTransactionCommitter* committer)
     assert(!committer || committer == mTransactionCommitter);
 }
 
+DbProfile DbProfile::byid(int id)
+{
+    DbProfile p;
+
+    switch (id)
+    {
+        case PROFILE_PERFORMANCE:
+            p.synchronous = 1;
+            p.walAutocheckpoint = 4000;
+            break;
+
+        case PROFILE_RECONSTRUCTIBLE:
+            p.synchronous = 0;
+            p.walAutocheckpoint = 10000;
+            break;
+
+        default:
+            return p;
+    }
+
+    p.id = id;
+    p.cacheSizeKiB = 64 * 1024;
+    p.mmapSize = 256ll << 20;
+    p.tempStore = 2;
+    return p;
+}
+
+WriteBehindDbTable::WriteBehindDbTable(PrnGen& rng, DbTable* t, bool checkAlwaysTransacted)
+    : DbTable(rng, checkAlwaysTransacted)
+    , table(t)
+{
+    nextid = table->nextid;
+
+    try
+    {
+        thread = std::thread(&WriteBehindDbTable::loop, this);
+    }
+    catch (std::system_error& e)
+    {
+        LOG_warn << "Failed to start the write-behind DB thread, writing inline: " << e.what();
+    }
+}
+
+WriteBehindDbTable::~WriteBehindDbTable()
+{
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        uncommitted.clear();
+        intransaction = false;
+        stopping = true;
+    }
+    changed.notify_all();
+
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+
+    resetCommitter();
+}
+
+void WriteBehindDbTable::note(const Op& op)
+{
+    switch (op.kind)
+    {
+        case Op::PUT:
+        case Op::DEL:
+        {
+            Overlay& o = overlay[op.id];
+            o.deleted = op.kind == Op::DEL;
+            o.data = op.data;
+            o.seq = op.seq;
+            break;
+        }
+
+        case Op::TRUNCATE:
+            overlay.clear();
+            truncating++;
+            break;
+
+        default:
+            break;
+    }
+}
+
+void WriteBehindDbTable::add(Op&& op)
+{
+    op.seq = ++seq;
+    note(op);
+
+    if (intransaction)
+    {
+        uncommitted.push_back(std::move(op));
+    }
+    else
+    {
+        vector<Op> ops;
+        ops.push_back(std::move(op));
+        queue(ops);
+    }
+}
+
+// with the mutex held
+void WriteBehindDbTable::queue(vector<Op>& ops)
+{
+    if (ops.empty())
+    {
+        return;
+    }
+
+    if (!thread.joinable())
+    {
+        write(ops);
+        written(ops);
+        ops.clear();
+        return;
+    }
+
+    if (queued.empty())
+    {
+        queued.swap(ops);
+    }
+    else
+    {
+        std::move(ops.begin(), ops.end(), std::back_inserter(queued));
+        ops.clear();
+    }
+    changed.notify_all();
+}
+
+void WriteBehindDbTable::write(vector<Op>& ops)
+{
+    std::lock_guard<std::mutex> g(tablemutex);
+    DBTableTransactionCommitter committer(table.get());
+    committer.beginOnce();
+
+    for (Op& op : ops)
+    {
+        bool ok = true;
+
+        switch (op.kind)
+        {
+            case Op::PUT: ok = table->put(op.id, &op.data); break;
+            case Op::DEL: ok = table->del(op.id); break;
+            case Op::TRUNCATE: table->truncate(); break;
+            case Op::PUTINDEX: ok = table->putnodeindex(op.id, op.entry); break;
+            case Op::DELINDEX: ok = table->delnodeindex(op.id); break;
+            case Op::DROPINDEX: table->dropnodeindex(); break;
+        }
+
+        if (!ok)
+        {
+            LOG_warn << "Write-behind DB operation " << int(op.kind) << " failed for record " << op.id;
+        }
+    }
+
+    committer.commitNow();
+}
+
+// with the mutex held: the records are in the table, and the overlay is only needed for later writes
+void WriteBehindDbTable::written(const vector<Op>& ops)
+{
+    for (const Op& op : ops)
+    {
+        if (op.kind == Op::PUT || op.kind == Op::DEL)
+        {
+            auto it = overlay.find(op.id);
+            if (it != overlay.end() && it->second.seq == op.seq)
+            {
+                overlay.erase(it);
+            }
+        }
+        else if (op.kind == Op::TRUNCATE && truncating)
+        {
+            truncating--;
+        }
+    }
+}
+
+void WriteBehindDbTable::loop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;)
+    {
+        changed.wait(lock, [this]() { return stopping || !queued.empty(); });
+
+        if (queued.empty())
+        {
+            return;
+        }
+
+        // everything committed since the previous transaction goes in this one
+        inflight.swap(queued);
+        lock.unlock();
+
+        write(inflight);
+
+        lock.lock();
+        written(inflight);
+        inflight.clear();
+        changed.notify_all();
+    }
+}
+
+void WriteBehindDbTable::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (!uncommitted.empty())
+    {
+        LOG_debug << "Flushing " << uncommitted.size() << " uncommitted DB operations";
+        queue(uncommitted);
+    }
+
+    changed.wait(lock, [this]() { return queued.empty() && inflight.empty(); });
+}
+
+void WriteBehindDbTable::rewind()
+{
+    flush();
+
+    std::lock_guard<std::mutex> g(tablemutex);
+    table->rewind();
+}
+
+bool WriteBehindDbTable::next(uint32_t* id, string* data)
+{
+    std::lock_guard<std::mutex> g(tablemutex);
+    return table->next(id, data);
+}
+
+bool WriteBehindDbTable::get(uint32_t id, string* data)
+{
+    {
+        std::lock_guard<std::mutex> g(mutex);
+
+        auto it = overlay.find(id);
+        if (it != overlay.end())
+        {
+            if (it->second.deleted)
+            {
+                return false;
+            }
+
+            *data = it->second.data;
+            return true;
+        }
+
+        if (truncating)
+        {
+            return false;
+        }
+    }
+
+    // no write of this record is pending, and only this thread writes
+    std::lock_guard<std::mutex> g(tablemutex);
+    return table->get(id, data);
+}
+
+bool WriteBehindDbTable::put(uint32_t id, char* data, unsigned len)
+{
+    checkTransaction();
+
+    Op op;
+    op.kind = Op::PUT;
+    op.id = id;
+    op.data.assign(data, len);
+
+    std::lock_guard<std::mutex> g(mutex);
+    add(std::move(op));
+    return true;
+}
+
+bool WriteBehindDbTable::del(uint32_t id)
+{
+    checkTransaction();
+
+    Op op;
+    op.kind = Op::DEL;
+    op.id = id;
+
+    std::lock_guard<std::mutex> g(mutex);
+    add(std::move(op));
+    return true;
+}
+
+void WriteBehindDbTable::truncate()
+{
+    checkTransaction();
+
+    Op op;
+    op.kind = Op::TRUNCATE;
+    op.id = 0;
+
+    std::lock_guard<std::mutex> g(mutex);
+    add(std::move(op));
+}
+
+void WriteBehindDbTable::begin()
+{
+    std::lock_guard<std::mutex> g(mutex);
+    intransaction = true;
+}
+
+void WriteBehindDbTable::commit()
+{
+    std::lock_guard<std::mutex> g(mutex);
+    intransaction = false;
+    queue(uncommitted);
+}
+
+void WriteBehindDbTable::abort()
+{
+    std::lock_guard<std::mutex> g(mutex);
+    intransaction = false;
+    uncommitted.clear();
+
+    // what's left to write is what was committed
+    overlay.clear();
+    truncating = 0;
+    for (const Op& op : inflight)
+    {
+        note(op);
+    }
+    for (const Op& op : queued)
+    {
+        note(op);
+    }
+}
+
+void WriteBehindDbTable::remove()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    uncommitted.clear();
+    queued.clear();
+    changed.wait(lock, [this]() { return inflight.empty(); });
+    overlay.clear();
+    truncating = 0;
+
+    std::lock_guard<std::mutex> g(tablemutex);
+    table->remove();
+}
+
+bool WriteBehindDbTable::putsnapshot(const string& snapshot)
+{
+    // after the records it was taken from
+    flush();
+
+    std::lock_guard<std::mutex> g(tablemutex);
+    return table->putsnapshot(snapshot);
+}
+
+bool WriteBehindDbTable::getsnapshot(string* snapshot)
+{
+    std::lock_guard<std::mutex> g(tablemutex);
+    return table->getsnapshot(snapshot);
+}
+
+void WriteBehindDbTable::delsnapshot()
+{
+    std::lock_guard<std::mutex> g(tablemutex);
+    table->delsnapshot();
+}
+
+bool WriteBehindDbTable::putnodeindex(uint32_t id, const NodeIndexEntry& entry)
+{
+    checkTransaction();
+
+    Op op;
+    op.kind = Op::PUTINDEX;
+    op.id = id;
+    op.entry = entry;
+
+    std::lock_guard<std::mutex> g(mutex);
+    add(std::move(op));
+    return true;
+}
+
+bool WriteBehindDbTable::delnodeindex(uint32_t id)
+{
+    checkTransaction();
+
+    Op op;
+    op.kind = Op::DELINDEX;
+    op.id = id;
+
+    std::lock_guard<std::mutex> g(mutex);
+    add(std::move(op));
+    return true;
+}
+
+void WriteBehindDbTable::dropnodeindex()
+{
+    Op op;
+    op.kind = Op::DROPINDEX;
+    op.id = 0;
+
+    std::lock_guard<std::mutex> g(mutex);
+    add(std::move(op));
+}
+
+bool WriteBehindDbTable::querynodeindex(NodeIndexColumn column, uint64_t value, vector<handle>* handles)
+{
+    flush();
+
+    std::lock_guard<std::mutex> g(tablemutex);
+    return table->querynodeindex(column, value, handles);
+}
+
+bool WriteBehindDbTable::nodeindexrecord(handle h, uint32_t* id)
+{
+    flush();
+
+    std::lock_guard<std::mutex> g(tablemutex);
+    return table->nodeindexrecord(h, id);
+}
+
 DbAccess::DbAccess()
 {
     currentDbVersion = LEGACY_DB_VERSION;
@@ -35,6 +35,16 @@ SqliteDbAccess::~SqliteDbAccess()
 {
 }
 
+void SqliteDbAccess::pragma(sqlite3* db, const char* name, long long value)
+{
+    std::ostringstream sql;
+    sql << "PRAGMA " << name << "=" << value << ";";
+    if (sqlite3_exec(db, sql.str().c_str(), NULL, NULL, NULL) != SQLITE_OK)
+    {
+        LOG_warn << "Unable to set " << name << ": " << sqlite3_errmsg(db);
+    }
+}
+
 DbTable* SqliteDbAccess::open(PrnGen &rng, FileSystemAccess* fsaccess, string* name, bool recycleLegacyDB, bool checkAlwaysTransacted)
 {
     //Each table will use its own database object and its own file
@@ -121,10 +131,38 @@ DbTable* SqliteDbAccess::open(PrnGen &rng, FileSystemAccess* fsaccess, string* n
         return NULL;
     }
 
+    // page_size must come before the database is first written to, and is ignored afterwards
+    if (profile.pageSize > 0)
+    {
+        pragma(db, "page_size", profile.pageSize);
+    }
+
 #if !(TARGET_OS_IPHONE)
     sqlite3_exec(db, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL);
 #endif
 
+    if (profile.synchronous >= 0)
+    {
+        pragma(db, "synchronous", profile.synchronous);
+    }
+    if (profile.cacheSizeKiB >= 0)
+    {
+        // negative cache_size values are in KiB rather than pages
+        pragma(db, "cache_size", -(long long)profile.cacheSizeKiB);
+    }
+    if (profile.mmapSize >= 0)
+    {
+        pragma(db, "mmap_size", profile.mmapSize);
+    }
+    if (profile.tempStore >= 0)
+    {
+        pragma(db, "temp_store", profile.tempStore);
+    }
+    if (profile.walAutocheckpoint >= 0)
+    {
+        pragma(db, "wal_autocheckpoint", profile.walAutocheckpoint);
+    }
+
     const char *sql = "CREATE TABLE IF NOT EXISTS statecache (id INTEGER PRIMARY KEY ASC NOT NULL, content BLOB NOT NULL)";
 
     rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
@@ -142,6 +180,7 @@ SqliteDbTable::SqliteDbTable(PrnGen &rng, sqlite3* cdb, FileSystemAccess *fs, st
 {
     db = cdb;
     pStmt = NULL;
+    pStmtDone = false;
     fsaccess = fs;
     dbfile = *filepath;
 }
@@ -155,15 +194,37 @@ SqliteDbTable::~SqliteDbTable()
         return;
     }
 
-    if (pStmt)
-    {
-        sqlite3_finalize(pStmt);
-    }
+    finalizestatements();
     abort();
     sqlite3_close(db);
     LOG_debug << "Database closed " << dbfile;
 }
 
+void SqliteDbTable::finalizestatements()
+{
+    for (sqlite3_stmt** stmt : { &pStmt, &getStmt, &putStmt, &delStmt, &putIndexStmt, &delIndexStmt,
+                                 &queryIndexStmts[0], &queryIndexStmts[1], &queryIndexStmts[2], &recordIndexStmt })
+    {
+        if (*stmt)
+        {
+            sqlite3_finalize(*stmt);
+            *stmt = NULL;
+        }
+    }
+}
+
+// statements are compiled once per table and reset after each use
+sqlite3_stmt* SqliteDbTable::prepared(sqlite3_stmt*& stmt, const char* sql)
+{
+    if (!stmt && sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    {
+        LOG_err << "Unable to prepare statement: " << sqlite3_errmsg(db);
+        sqlite3_finalize(stmt);
+        stmt = NULL;
+    }
+    return stmt;
+}
+
 // set cursor to first record
 void SqliteDbTable::rewind()
 {
@@ -178,8 +239,9 @@ void SqliteDbTable::rewind()
     }
     else
     {
-        sqlite3_prepare(db, "SELECT id, content FROM statecache", -1, &pStmt, NULL);
+        prepared(pStmt, "SELECT id, content FROM statecache");
     }
+    pStmtDone = false;
 }
 
 // retrieve next record through cursor
@@ -190,7 +252,7 @@ bool SqliteDbTable::next(uint32_t* index, string* data)
         return false;
     }
 
-    if (!pStmt)
+    if (!pStmt || pStmtDone)
     {
         return false;
     }
@@ -199,8 +261,9 @@ bool SqliteDbTable::next(uint32_t* index, string* data)
 
     if (rc != SQLITE_ROW)
     {
-        sqlite3_finalize(pStmt);
-        pStmt = NULL;
+        // kept for the next rewind(), but releasing the read lock
+        sqlite3_reset(pStmt);
+        pStmtDone = true;
         return false;
     }
 
@@ -221,10 +284,10 @@ bool SqliteDbTable::get(uint32_t index, string* data)
 
     checkTransaction();
 
-    sqlite3_stmt *stmt;
+    sqlite3_stmt *stmt = prepared(getStmt, "SELECT content FROM statecache WHERE id = ?");
     bool result = false;
 
-    if (sqlite3_prepare(db, "SELECT content FROM statecache WHERE id = ?", -1, &stmt, NULL) == SQLITE_OK)
+    if (stmt)
     {
         if (sqlite3_bind_int(stmt, 1, index) == SQLITE_OK)
         {
@@ -235,9 +298,9 @@ bool SqliteDbTable::get(uint32_t index, string* data)
                 result = true;
             }
         }
+        sqlite3_reset(stmt);
     }
 
-    sqlite3_finalize(stmt);
     return result;
 }
 
@@ -251,10 +314,10 @@ bool SqliteDbTable::put(uint32_t index, char* data, unsigned len)
 
     checkTransaction();
 
-    sqlite3_stmt *stmt;
+    sqlite3_stmt *stmt = prepared(putStmt, "INSERT OR REPLACE INTO statecache (id, content) VALUES (?, ?)");
     bool result = false;
 
-    if (sqlite3_prepare(db, "INSERT OR REPLACE INTO statecache (id, content) VALUES (?, ?)", -1, &stmt, NULL) == SQLITE_OK)
+    if (stmt)
     {
         if (sqlite3_bind_int(stmt, 1, index) == SQLITE_OK)
         {
@@ -266,9 +329,36 @@ bool SqliteDbTable::put(uint32_t index, char* data, unsigned len)
                 }
             }
         }
+
+        // data is bound without a copy: drop it along with the reset
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+    }
+
+    return result;
+}
+
+// outside a transaction, a batch gets one of its own instead of one per record
+bool SqliteDbTable::putBatch(uint32_t type, const vector<Cacheable*>& records, SymmCipher* key)
+{
+    if (!db)
+    {
+        return false;
+    }
+
+    bool transacted = !sqlite3_get_autocommit(db);
+    if (!transacted)
+    {
+        sqlite3_exec(db, "BEGIN", 0, 0, NULL);
+    }
+
+    bool result = DbTable::putBatch(type, records, key);
+
+    if (!transacted)
+    {
+        sqlite3_exec(db, result ? "COMMIT" : "ROLLBACK", 0, 0, NULL);
     }
 
-    sqlite3_finalize(stmt);
     return result;
 }
 
@@ -282,11 +372,39 @@ bool SqliteDbTable::del(uint32_t index)
 
     checkTransaction();
 
-    char buf[64];
+    sqlite3_stmt *stmt = prepared(delStmt, "DELETE FROM statecache WHERE id = ?");
+    bool result = false;
+
+    if (stmt)
+    {
+        result = sqlite3_bind_int(stmt, 1, index) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+    }
+
+    return result;
+}
+
+bool SqliteDbTable::delBatch(const vector<uint32_t>& ids)
+{
+    if (!db)
+    {
+        return false;
+    }
+
+    bool transacted = !sqlite3_get_autocommit(db);
+    if (!transacted)
+    {
+        sqlite3_exec(db, "BEGIN", 0, 0, NULL);
+    }
+
+    bool result = DbTable::delBatch(ids);
 
-    sprintf(buf, "DELETE FROM statecache WHERE id = %" PRIu32, index);
+    if (!transacted)
+    {
+        sqlite3_exec(db, "COMMIT", 0, 0, NULL);
+    }
 
-    return !sqlite3_exec(db, buf, 0, 0, NULL);
+    return result;
 }
 
 // truncate table
@@ -300,6 +418,8 @@ void SqliteDbTable::truncate()
     checkTransaction();
 
     sqlite3_exec(db, "DELETE FROM statecache", 0, 0, NULL);
+    delsnapshot();
+    dropnodeindex();
 }
 
 // begin transaction
@@ -345,10 +465,7 @@ void SqliteDbTable::remove()
         return;
     }
 
-    if (pStmt)
-    {
-        sqlite3_finalize(pStmt);
-    }
+    finalizestatements();
     abort();
     sqlite3_close(db);
 
@@ -357,6 +474,213 @@ void SqliteDbTable::remove()
     string localpath;
     fsaccess->path2local(&dbfile, &localpath);
     fsaccess->unlinklocal(&localpath);
+
+    delsnapshot();
+}
+
+// one row per node record, sharing its id
+bool SqliteDbTable::createnodeindex()
+{
+    if (!nodeIndexCreated)
+    {
+        nodeIndexCreated = !sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS nodeindex (id INTEGER PRIMARY KEY ASC NOT NULL, "
+                                             "nodehandle INTEGER NOT NULL, parenthandle INTEGER NOT NULL, namehash INTEGER NOT NULL, "
+                                             "fingerprinthash INTEGER NOT NULL, size INTEGER NOT NULL, mtime INTEGER NOT NULL, type INTEGER NOT NULL);"
+                                             "CREATE INDEX IF NOT EXISTS nodeindex_parent ON nodeindex (parenthandle);"
+                                             "CREATE INDEX IF NOT EXISTS nodeindex_name ON nodeindex (namehash);"
+                                             "CREATE INDEX IF NOT EXISTS nodeindex_fingerprint ON nodeindex (fingerprinthash);"
+                                             "CREATE INDEX IF NOT EXISTS nodeindex_handle ON nodeindex (nodehandle);",
+                                         NULL, NULL, NULL);
+        if (!nodeIndexCreated)
+        {
+            LOG_err << "Unable to create the node index: " << sqlite3_errmsg(db);
+        }
+    }
+    return nodeIndexCreated;
+}
+
+bool SqliteDbTable::putnodeindex(uint32_t index, const NodeIndexEntry& e)
+{
+    if (!db || !createnodeindex())
+    {
+        return false;
+    }
+
+    checkTransaction();
+
+    sqlite3_stmt *stmt = prepared(putIndexStmt, "INSERT OR REPLACE INTO nodeindex (id, nodehandle, parenthandle, namehash, fingerprinthash, size, mtime, type) "
+                                                "VALUES (?, ?, ?, ?, ?, ?, ?, ?)");
+    bool result = false;
+
+    if (stmt)
+    {
+        // handles and hashes are stored as their bit pattern
+        result = sqlite3_bind_int(stmt, 1, index) == SQLITE_OK
+              && sqlite3_bind_int64(stmt, 2, sqlite3_int64(e.nodehandle)) == SQLITE_OK
+              && sqlite3_bind_int64(stmt, 3, sqlite3_int64(e.parenthandle)) == SQLITE_OK
+              && sqlite3_bind_int64(stmt, 4, sqlite3_int64(e.namehash)) == SQLITE_OK
+              && sqlite3_bind_int64(stmt, 5, sqlite3_int64(e.fingerprinthash)) == SQLITE_OK
+              && sqlite3_bind_int64(stmt, 6, e.size) == SQLITE_OK
+              && sqlite3_bind_int64(stmt, 7, e.mtime) == SQLITE_OK
+              && sqlite3_bind_int(stmt, 8, e.type) == SQLITE_OK
+              && sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+    }
+
+    return result;
+}
+
+bool SqliteDbTable::delnodeindex(uint32_t index)
+{
+    if (!db || !createnodeindex())
+    {
+        return false;
+    }
+
+    checkTransaction();
+
+    sqlite3_stmt *stmt = prepared(delIndexStmt, "DELETE FROM nodeindex WHERE id = ?");
+    bool result = false;
+
+    if (stmt)
+    {
+        result = sqlite3_bind_int(stmt, 1, index) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+    }
+
+    return result;
+}
+
+void SqliteDbTable::dropnodeindex()
+{
+    if (!db)
+    {
+        return;
+    }
+
+    // statements compiled against the dropped table can't be reused
+    for (sqlite3_stmt** stmt : { &putIndexStmt, &delIndexStmt, &queryIndexStmts[0], &queryIndexStmts[1], &queryIndexStmts[2], &recordIndexStmt })
+    {
+        sqlite3_finalize(*stmt);
+        *stmt = NULL;
+    }
+
+    sqlite3_exec(db, "DROP TABLE IF EXISTS nodeindex", 0, 0, NULL);
+    nodeIndexCreated = false;
+}
+
+bool SqliteDbTable::querynodeindex(NodeIndexColumn column, uint64_t value, vector<handle>* result)
+{
+    if (!db || !createnodeindex() || column < INDEX_PARENT || column > INDEX_FINGERPRINTHASH)
+    {
+        return false;
+    }
+
+    static const char* queries[] = {
+        "SELECT nodehandle FROM nodeindex WHERE parenthandle = ?",
+        "SELECT nodehandle FROM nodeindex WHERE namehash = ?",
+        "SELECT nodehandle FROM nodeindex WHERE fingerprinthash = ?"
+    };
+
+    sqlite3_stmt *stmt = prepared(queryIndexStmts[column], queries[column]);
+    if (!stmt || sqlite3_bind_int64(stmt, 1, sqlite3_int64(value)) != SQLITE_OK)
+    {
+        return false;
+    }
+
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        result->push_back(handle(sqlite3_column_int64(stmt, 0)));
+    }
+    sqlite3_reset(stmt);
+
+    return rc == SQLITE_DONE;
+}
+
+bool SqliteDbTable::nodeindexrecord(handle h, uint32_t* index)
+{
+    if (!db || !createnodeindex())
+    {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = prepared(recordIndexStmt, "SELECT id FROM nodeindex WHERE nodehandle = ?");
+    bool result = false;
+
+    if (stmt && sqlite3_bind_int64(stmt, 1, sqlite3_int64(h)) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        *index = uint32_t(sqlite3_column_int(stmt, 0));
+        result = true;
+    }
+    if (stmt)
+    {
+        sqlite3_reset(stmt);
+    }
+
+    return result;
+}
+
+// the snapshot lives in a file next to the database
+string SqliteDbTable::snapshotpath() const
+{
+    string path = dbfile + ".nodes";
+    string localpath;
+    fsaccess->path2local(&path, &localpath);
+    return localpath;
+}
+
+// written to a temporary file and renamed into place, so a crash never leaves a partial snapshot
+bool SqliteDbTable::putsnapshot(const string& data)
+{
+    if (!db || data.size() > UINT_MAX)
+    {
+        return false;
+    }
+
+    string localpath = snapshotpath();
+    string tmp = dbfile + ".nodes.tmp";
+    string localtmp;
+    fsaccess->path2local(&tmp, &localtmp);
+    fsaccess->unlinklocal(&localtmp);
+
+    bool written = false;
+    {
+        auto fa = fsaccess->newfileaccess();
+        written = fa->fopen(&localtmp, false, true) && fa->fwrite((const byte*)data.data(), unsigned(data.size()), 0);
+    }
+
+    if (!written || !fsaccess->renamelocal(&localtmp, &localpath, true))
+    {
+        LOG_err << "Unable to write node snapshot " << tmp;
+        fsaccess->unlinklocal(&localtmp);
+        return false;
+    }
+
+    return true;
+}
+
+bool SqliteDbTable::getsnapshot(string* data)
+{
+    if (!db)
+    {
+        return false;
+    }
+
+    string localpath = snapshotpath();
+    auto fa = fsaccess->newfileaccess();
+    if (!fa->fopen(&localpath, true, false) || fa->size <= 0 || fa->size > UINT_MAX)
+    {
+        return false;
+    }
+
+    return fa->fread(data, unsigned(fa->size), 0, 0);
+}
+
+void SqliteDbTable::delsnapshot()
+{
+    string localpath = snapshotpath();
+    fsaccess->unlinklocal(&localpath);
 }
 } // namespace
 
@@ -38,6 +38,7 @@ File::File()
     temporaryfile = false;
     h = UNDEF;
     tag = 0;
+    schedulinggroup = 0;
 }
 
 File::~File()
@@ -367,6 +368,12 @@ void File::completed(Transfer* t, LocalNode* l)
                 newnode->ovhandle = t->client->getovhandle(t->client->nodebyhandle(th), &name);
             }
 
+            // synced files keep their own putnodes, as the sync tracks each one
+            if (!l && t->client->putnodesbatch() > 1)
+            {
+                return t->client->putnodesbatched(th, newnode, tag);
+            }
+
             t->client->reqs.add(new CommandPutNodes(t->client,
                                                                   th, NULL,
                                                                   newnode, 1,
@@ -568,7 +575,7 @@ void SyncFileGet::updatelocalname()
 {
     attr_map::iterator ait;
 
-    if ((ait = n->attrs.map.find('n')) != n->attrs.map.end())
+    if ((ait = n->attrs().map.find('n')) != n->attrs().map.end())
     {
         if (n->parent && n->parent->localnode)
         {
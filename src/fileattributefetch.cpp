@@ -23,6 +23,9 @@
 #include "mega/megaclient.h"
 #include "mega/megaapp.h"
 #include "mega/logging.h"
+#include "mega/base64.h"
+#include "mega/db.h"
+#include "mega/utils.h"
 
 namespace mega {
 FileAttributeFetchChannel::FileAttributeFetchChannel(MegaClient* client)
@@ -137,9 +140,15 @@ void FileAttributeFetchChannel::parse(int /*fac*/, bool final)
 
             if (!(falen & (SymmCipher::BLOCKSIZE - 1)))
             {
-                if (client->tmpnodecipher.setkey(&it->second->nodekey))
+                if (SymmCipher* cipher = client->nodeciphers.get(&it->second->nodekey))
                 {
-                    client->tmpnodecipher.cbc_decrypt((byte*)ptr, falen);
+                    cipher->cbc_decrypt((byte*)ptr, falen);
+
+                    if (client->facache)
+                    {
+                        client->facache->put(it->second->nodehandle, it->second->type, it->first, ptr, falen);
+                    }
+
                     client->app->fa_complete(it->second->nodehandle, it->second->type, ptr, falen);
                 }
 
@@ -177,4 +186,226 @@ void FileAttributeFetchChannel::failed()
         }
     }
 }
+
+FileAttributeCache::FileAttributeCache(DbTable* t, SymmCipher* k, PrnGen& r, size_t max)
+    : table(t), key(k), rng(r), maxbytes(max), totalbytes(0)
+{
+    // only the metadata is read, the attributes stay on disk until requested
+    uint32_t id;
+    string data;
+    vector<uint32_t> stale;
+
+    table->rewind();
+    while (table->next(&id, &data, key, RECORD_DATA))
+    {
+        Entry e;
+        if ((id & 15) != RECORD_META || !e.unserialize(data)
+                || index.count(std::make_pair(e.nodehandle, e.type)))
+        {
+            stale.push_back(id);
+            continue;
+        }
+
+        entries[id] = e;
+        index[std::make_pair(e.nodehandle, e.type)] = id;
+        lru.insert(std::make_pair(e.lastused, id));
+        totalbytes += e.bytes;
+    }
+
+    DBTableTransactionCommitter committer(table.get());
+    committer.beginOnce();
+    for (uint32_t sid : stale)
+    {
+        table->del(sid);
+    }
+    evict();
+
+    LOG_debug << "File attribute cache: " << entries.size() << " attributes, " << totalbytes << " bytes";
+}
+
+FileAttributeCache::~FileAttributeCache()
+{
+}
+
+bool FileAttributeCache::get(handle nodehandle, fatype type, handle fah, string* data)
+{
+    auto it = index.find(std::make_pair(nodehandle, type));
+    if (it == index.end())
+    {
+        return false;
+    }
+
+    uint32_t id = it->second;
+    Entry& e = entries[id];
+    if (e.fah != fah)
+    {
+        // the node has got another attribute of this type
+        DBTableTransactionCommitter committer(table.get());
+        erase(id);
+        return false;
+    }
+
+    if (!table->get((id & ~15u) | RECORD_DATA, data) || !PaddedCBC::decrypt(data, key) || data->size() != e.bytes)
+    {
+        LOG_warn << "Unreadable cached file attribute: " << Base64Str<MegaClient::NODEHANDLE>(nodehandle);
+        DBTableTransactionCommitter committer(table.get());
+        erase(id);
+        return false;
+    }
+
+    lru.erase(std::make_pair(e.lastused, id));
+    e.lastused = m_time();
+    lru.insert(std::make_pair(e.lastused, id));
+
+    if (e.lastused - e.storedlastused >= LASTUSED_GRANULARITY)
+    {
+        DBTableTransactionCommitter committer(table.get());
+        putmeta(id, e);
+    }
+
+    return true;
+}
+
+bool FileAttributeCache::contains(handle nodehandle, fatype type, handle fah) const
+{
+    auto it = index.find(std::make_pair(nodehandle, type));
+    return it != index.end() && entries.at(it->second).fah == fah;
+}
+
+void FileAttributeCache::put(handle nodehandle, fatype type, handle fah, const char* data, size_t len)
+{
+    if (!len || len > maxbytes / 4)
+    {
+        return;
+    }
+
+    DBTableTransactionCommitter committer(table.get());
+    committer.beginOnce();
+
+    auto it = index.find(std::make_pair(nodehandle, type));
+    if (it != index.end())
+    {
+        erase(it->second);
+    }
+
+    Entry e;
+    e.nodehandle = nodehandle;
+    e.type = type;
+    e.fah = fah;
+    e.bytes = uint32_t(len);
+    e.lastused = m_time();
+
+    uint32_t id = (table->nextid += 16) | RECORD_META;
+
+    string record(data, len);
+    PaddedCBC::encrypt(rng, &record, key);
+    if (!table->put((id & ~15u) | RECORD_DATA, &record) || !putmeta(id, e))
+    {
+        LOG_warn << "Unable to cache file attribute: " << Base64Str<MegaClient::NODEHANDLE>(nodehandle);
+        table->del((id & ~15u) | RECORD_DATA);
+        table->del(id);
+        return;
+    }
+
+    entries[id] = e;
+    index[std::make_pair(nodehandle, type)] = id;
+    lru.insert(std::make_pair(e.lastused, id));
+    totalbytes += len;
+
+    evict();
+}
+
+void FileAttributeCache::setmaxbytes(size_t max)
+{
+    maxbytes = max;
+
+    DBTableTransactionCommitter committer(table.get());
+    evict();
+}
+
+size_t FileAttributeCache::bytes() const
+{
+    return totalbytes;
+}
+
+size_t FileAttributeCache::count() const
+{
+    return entries.size();
+}
+
+void FileAttributeCache::remove()
+{
+    table->remove();
+    entries.clear();
+    index.clear();
+    lru.clear();
+    totalbytes = 0;
+}
+
+bool FileAttributeCache::putmeta(uint32_t id, Entry& e)
+{
+    string record;
+    e.storedlastused = e.lastused;
+    e.serialize(&record);
+    PaddedCBC::encrypt(rng, &record, key);
+    return table->put(id, &record);
+}
+
+void FileAttributeCache::erase(uint32_t id)
+{
+    auto it = entries.find(id);
+    if (it == entries.end())
+    {
+        return;
+    }
+
+    table->del((id & ~15u) | RECORD_DATA);
+    table->del(id);
+
+    totalbytes -= it->second.bytes;
+    lru.erase(std::make_pair(it->second.lastused, id));
+    index.erase(std::make_pair(it->second.nodehandle, it->second.type));
+    entries.erase(it);
+}
+
+void FileAttributeCache::evict()
+{
+    while (totalbytes > maxbytes && !lru.empty())
+    {
+        erase(lru.begin()->second);
+    }
+}
+
+void FileAttributeCache::Entry::serialize(string* d) const
+{
+    CacheableWriter w(*d);
+    w.serializehandle(nodehandle);
+    w.serializeu32(type);
+    w.serializehandle(fah);
+    w.serializeu32(bytes);
+    w.serializei64(lastused);
+    w.serializeexpansionflags();
+}
+
+bool FileAttributeCache::Entry::unserialize(const string& d)
+{
+    CacheableReader r(d);
+    uint32_t t;
+    unsigned char expansions[8];
+    int64_t used;
+
+    if (!r.unserializehandle(nodehandle)
+            || !r.unserializeu32(t)
+            || !r.unserializehandle(fah)
+            || !r.unserializeu32(bytes)
+            || !r.unserializei64(used)
+            || !r.unserializeexpansionflags(expansions, 0))
+    {
+        return false;
+    }
+
+    type = fatype(t);
+    lastused = storedlastused = used;
+    return true;
+}
 } // namespace
@@ -24,6 +24,11 @@
 #include "mega/base64.h"
 #include "mega/logging.h"
 #include "mega/utils.h"
+#include "mega/db.h"
+#include "mega/workerpool.h"
+
+#include <atomic>
+#include <thread>
 
 namespace {
 
@@ -187,27 +192,28 @@ bool FileFingerprint::genfingerprint(FileAccess* fa, bool ignoremtime)
     else
     {
         // large file: sparse coverage, four sparse CRC32s
+        // all the blocks are read in one go, then each CRC32 runs over its blocks at once
         HashCRC32 crc32;
-        byte block[4 * sizeof crc];
-        const unsigned blocks = MAXFULL / unsigned(sizeof block * crc.size());
+        const unsigned blocksize = 4 * sizeof crc;
+        const unsigned blocks = MAXFULL / unsigned(blocksize * crc.size());
+        byte buf[MAXFULL];
 
-        for (unsigned i = 0; i < crc.size(); i++)
+        vector<m_off_t> offsets;
+        for (unsigned i = 0; i < crc.size() * blocks; i++)
         {
-            for (unsigned j = 0; j < blocks; j++)
-            {
-                if (!fa->frawread(block, sizeof block,
-                                  (size - sizeof block)
-                                  * (i * blocks + j)
-                                  / (crc.size() * blocks - 1), true))
-                {
-                    size = -1;
-                    fa->closef();
-                    return true;
-                }
+            offsets.push_back((size - m_off_t(blocksize)) * i / m_off_t(crc.size() * blocks - 1));
+        }
 
-                crc32.add(block, sizeof block);
-            }
+        if (!fa->fsparseread(buf, blocksize, offsets))
+        {
+            size = -1;
+            fa->closef();
+            return true;
+        }
 
+        for (unsigned i = 0; i < crc.size(); i++)
+        {
+            crc32.add(buf + i * blocks * blocksize, blocks * blocksize);
             crc32.get((byte*)&crcval);
             newcrc[i] = htonl(crcval);
         }
@@ -229,6 +235,30 @@ bool FileFingerprint::genfingerprint(FileAccess* fa, bool ignoremtime)
     return changed;
 }
 
+vector<bool> FileFingerprint::genfingerprints(const vector<std::pair<FileFingerprint*, FileAccess*>>& files, unsigned threads, bool ignoremtime)
+{
+    if (!threads)
+    {
+        threads = std::min(WorkerPool::get().parallelism(WorkerPool::WORK_FILES), unsigned(MAX_FINGERPRINT_THREADS));
+    }
+    threads = unsigned(std::min<size_t>(threads, files.size()));
+
+    // not vector<bool>: its elements can't be written from several threads
+    vector<char> changed(files.size());
+    std::atomic<size_t> next(0);
+    auto work = [&]()
+    {
+        for (size_t i; (i = next++) < files.size(); )
+        {
+            changed[i] = files[i].first->genfingerprint(files[i].second, ignoremtime);
+        }
+    };
+
+    WorkerPool::get().run(WorkerPool::WORK_FILES, threads, [&work](size_t) { work(); });
+
+    return vector<bool>(changed.begin(), changed.end());
+}
+
 bool FileFingerprint::genfingerprint(InputStreamAccess *is, m_time_t cmtime, bool ignoremtime)
 {
     bool changed = false;
@@ -414,6 +444,21 @@ bool FileFingerprintCmp::operator()(const FileFingerprint* a, const FileFingerpr
     return memcmp(a->crc.data(), b->crc.data(), sizeof a->crc) < 0;
 }
 
+size_t FileFingerprintHash::operator()(const FileFingerprint* fp) const
+{
+    // the CRCs are well mixed already, size and mtime are folded in
+    uint64_t h = uint64_t(uint32_t(fp->crc[0])) << 32 | uint32_t(fp->crc[1]);
+    h ^= uint64_t(uint32_t(fp->crc[2])) << 32 | uint32_t(fp->crc[3]);
+    h ^= uint64_t(fp->size) * 0x9E3779B97F4A7C15ull;
+    h ^= uint64_t(fp->mtime) * 0xC2B2AE3D27D4EB4Full;
+    return size_t(h ^ (h >> 32));
+}
+
+bool FileFingerprintEqual::operator()(const FileFingerprint* a, const FileFingerprint* b) const
+{
+    return a->size == b->size && a->mtime == b->mtime && a->crc == b->crc;
+}
+
 bool LightFileFingerprint::genfingerprint(const m_off_t filesize, const m_time_t filemtime)
 {
     bool changed = false;
@@ -445,4 +490,187 @@ bool operator==(const LightFileFingerprint& lhs, const LightFileFingerprint& rhs
     return std::tie(lhs.mtime, lhs.size) == std::tie(rhs.mtime, rhs.size);
 }
 
+FileFingerprintCache::FileFingerprintCache(DbTable* t, SymmCipher* k, PrnGen& r, size_t max)
+    : table(t), key(k), rng(r), maxentries(max)
+{
+    uint32_t id;
+    string data;
+    vector<uint32_t> stale;
+
+    table->rewind();
+    while (table->next(&id, &data, key))
+    {
+        Entry e;
+        if (!e.unserialize(data))
+        {
+            stale.push_back(id);
+            continue;
+        }
+
+        auto it = index.find(e.fsid);
+        if (it != index.end())
+        {
+            // only the latest record of a file counts
+            stale.push_back(std::min(id, it->second));
+            if (id < it->second)
+            {
+                continue;
+            }
+            entries.erase(it->second);
+        }
+
+        index[e.fsid] = id;
+        entries[id] = std::move(e);
+    }
+
+    DBTableTransactionCommitter committer(table.get());
+    committer.beginOnce();
+    for (uint32_t sid : stale)
+    {
+        table->del(sid);
+    }
+    while (entries.size() > maxentries)
+    {
+        erase(entries.begin()->first);
+    }
+
+    LOG_debug << "Fingerprint cache: " << entries.size() << " files";
+}
+
+FileFingerprintCache::~FileFingerprintCache()
+{
+}
+
+bool FileFingerprintCache::get(handle fsid, const string& localpath, m_off_t size, m_time_t mtime, FileFingerprint* fp) const
+{
+    auto it = index.find(fsid);
+    if (it == index.end())
+    {
+        return false;
+    }
+
+    const Entry& e = entries.at(it->second);
+    if (e.fp.size != size || e.fp.mtime != mtime || e.localpath != localpath)
+    {
+        return false;
+    }
+
+    *fp = e.fp;
+    return true;
+}
+
+void FileFingerprintCache::put(handle fsid, const string& localpath, const FileFingerprint& fp)
+{
+    if (!fp.isvalid || fp.size < 0 || !maxentries)
+    {
+        return;
+    }
+
+    DBTableTransactionCommitter committer(table.get());
+    committer.beginOnce();
+
+    auto it = index.find(fsid);
+    if (it != index.end())
+    {
+        const Entry& e = entries[it->second];
+        if (e.localpath == localpath && e.fp.size == fp.size && e.fp.mtime == fp.mtime && e.fp.crc == fp.crc)
+        {
+            return;
+        }
+        erase(it->second);
+    }
+
+    Entry e;
+    e.fsid = fsid;
+    e.localpath = localpath;
+    e.fp = fp;
+
+    uint32_t id = (table->nextid += 16);
+
+    string record;
+    e.serialize(&record);
+    PaddedCBC::encrypt(rng, &record, key);
+    if (!table->put(id, &record))
+    {
+        LOG_warn << "Unable to cache fingerprint";
+        return;
+    }
+
+    index[fsid] = id;
+    entries[id] = std::move(e);
+
+    while (entries.size() > maxentries)
+    {
+        erase(entries.begin()->first);
+    }
+}
+
+void FileFingerprintCache::invalidate(handle fsid)
+{
+    auto it = index.find(fsid);
+    if (it != index.end())
+    {
+        DBTableTransactionCommitter committer(table.get());
+        erase(it->second);
+    }
+}
+
+size_t FileFingerprintCache::count() const
+{
+    return entries.size();
+}
+
+void FileFingerprintCache::remove()
+{
+    table->remove();
+    entries.clear();
+    index.clear();
+}
+
+void FileFingerprintCache::erase(uint32_t id)
+{
+    auto it = entries.find(id);
+    if (it == entries.end())
+    {
+        return;
+    }
+
+    table->del(id);
+    index.erase(it->second.fsid);
+    entries.erase(it);
+}
+
+void FileFingerprintCache::Entry::serialize(string* d) const
+{
+    CacheableWriter w(*d);
+    w.serializehandle(fsid);
+    w.serializestring(localpath);
+    w.serializei64(fp.size);
+    w.serializei64(fp.mtime);
+    w.serializebinary((byte*)fp.crc.data(), sizeof fp.crc);
+    w.serializeexpansionflags();
+}
+
+bool FileFingerprintCache::Entry::unserialize(const string& d)
+{
+    CacheableReader r(d);
+    int64_t s, m;
+    unsigned char expansions[8];
+
+    if (!r.unserializehandle(fsid)
+            || !r.unserializestring(localpath)
+            || !r.unserializei64(s)
+            || !r.unserializei64(m)
+            || !r.unserializebinary((byte*)fp.crc.data(), sizeof fp.crc)
+            || !r.unserializeexpansionflags(expansions, 0))
+    {
+        return false;
+    }
+
+    fp.size = s;
+    fp.mtime = m;
+    fp.isvalid = true;
+    return true;
+}
+
 } // mega
@@ -24,7 +24,74 @@
 #include "mega/logging.h"
 #include "mega/mega_utf8proc.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FILESYSTEM_SSE2 1
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define FILESYSTEM_NEON 1
+#include <arm_neon.h>
+#endif
+
 namespace mega {
+
+namespace {
+
+// whether the len bytes at s are all ASCII, which NFC leaves as they are
+bool allascii(const char* s, size_t len)
+{
+    size_t i = 0;
+#if defined(FILESYSTEM_SSE2)
+    for (; i + 16 <= len; i += 16)
+    {
+        if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(s + i))))
+        {
+            return false;
+        }
+    }
+#elif defined(FILESYSTEM_NEON)
+    for (; i + 16 <= len; i += 16)
+    {
+        if (vmaxvq_u8(vld1q_u8((const uint8_t*)s + i)) & 0x80)
+        {
+            return false;
+        }
+    }
+#endif
+    for (; i < len; i++)
+    {
+        if ((unsigned char)s[i] & 0x80)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the NFC of the len bytes at s (no NULs), as utf8proc_NFC, in a buffer kept by the thread rather than
+// allocated per call.  nullptr if it is not valid UTF-8
+const char* nfc(const char* s, size_t len, size_t& nfclen)
+{
+    static thread_local std::vector<utf8proc_int32_t> buffer(256);
+    const utf8proc_option_t options = utf8proc_option_t(UTF8PROC_STABLE | UTF8PROC_COMPOSE);
+
+    // the UTF-8 result is written over the code points, followed by a NUL
+    utf8proc_ssize_t n = utf8proc_decompose((const utf8proc_uint8_t*)s, utf8proc_ssize_t(len), buffer.data(), utf8proc_ssize_t(buffer.size()) - 1, options);
+    if (n >= utf8proc_ssize_t(buffer.size()))
+    {
+        buffer.resize(size_t(n) + 1);
+        n = utf8proc_decompose((const utf8proc_uint8_t*)s, utf8proc_ssize_t(len), buffer.data(), n, options);
+    }
+    if (n < 0 || (n = utf8proc_reencode(buffer.data(), n, options)) < 0)
+    {
+        return nullptr;
+    }
+
+    nfclen = size_t(n);
+    return (const char*)buffer.data();
+}
+
+} // anonymous
+
 FileSystemAccess::FileSystemAccess()
     : waiter(NULL)
     , skip_errorreport(false)
@@ -125,9 +192,13 @@ void FileSystemAccess::normalize(string* filename) const
 {
     if (!filename) return;
 
+    // most names are ASCII (NUL bytes included), which are NFC already
+    if (allascii(filename->data(), filename->size())) return;
+
     const char* cfilename = filename->c_str();
     size_t fnsize = filename->size();
     string result;
+    bool changed = false;
 
     for (size_t i = 0; i < fnsize; )
     {
@@ -140,21 +211,34 @@ void FileSystemAccess::normalize(string* filename) const
         }
 
         const char* substring = cfilename + i;
-        char* normalized = (char*)utf8proc_NFC((uint8_t*)substring);
+        size_t len = strlen(substring);
 
-        if (!normalized)
+        if (allascii(substring, len))
         {
-            filename->clear();
-            return;
+            result.append(substring, len);
         }
+        else
+        {
+            size_t nlen;
+            const char* normalized = nfc(substring, len, nlen);
 
-        result.append(normalized);
-        free(normalized);
+            if (!normalized)
+            {
+                filename->clear();
+                return;
+            }
+
+            changed = changed || nlen != len || memcmp(normalized, substring, len);
+            result.append(normalized, nlen);
+        }
 
-        i += strlen(substring);
+        i += len;
     }
 
-    *filename = result;
+    if (changed)
+    {
+        filename->swap(result);
+    }
 }
 
 // convert from local encoding, then unescape escaped forbidden characters
@@ -176,11 +260,12 @@ DirNotify::DirNotify(string* clocalbasepath, string* cignore)
     failed = 1;
     failreason = "Not initialized";
     error = 0;
+    overflows = 0;
     sync = NULL;
 }
 
 // notify base LocalNode + relative path/filename
-void DirNotify::notify(notifyqueue q, LocalNode* l, const char* localpath, size_t len, bool immediate)
+void DirNotify::notify(notifyqueue q, LocalNode* l, const char* localpath, size_t len, bool immediate, bool closewrite)
 {
     string path;
     path.assign(localpath, len);
@@ -195,6 +280,7 @@ void DirNotify::notify(notifyqueue q, LocalNode* l, const char* localpath, size_
         {
             notifyq[q].back().timestamp = immediate ? 0 : Waiter::ds;
         }
+        notifyq[q].back().closewrite = closewrite;
         LOG_debug << "Repeated notification skipped";
         return;
     }
@@ -223,7 +309,7 @@ void DirNotify::notify(notifyqueue q, LocalNode* l, const char* localpath, size_
         if ((!ll && !success && !fa->retry) // deleted file
             || (ll && success && ll->node && ll->node->localnode == ll
                 && (ll->type != FILENODE || (*(FileFingerprint *)ll) == (*(FileFingerprint *)ll->node))
-                && (ait = ll->node->attrs.map.find('n')) != ll->node->attrs.map.end()
+                && (ait = ll->node->attrs().map.find('n')) != ll->node->attrs().map.end()
                 && ait->second == ll->name
                 && fa->fsidvalid && fa->fsid == ll->fsid && fa->type == ll->type
                 && (ll->type != FILENODE || (ll->mtime == fa->mtime && ll->size == fa->size))))
@@ -243,6 +329,7 @@ void DirNotify::notify(notifyqueue q, LocalNode* l, const char* localpath, size_
     notifyq[q].back().timestamp = immediate ? 0 : Waiter::ds;
     notifyq[q].back().localnode = l;
     notifyq[q].back().path = path;
+    notifyq[q].back().closewrite = closewrite;
 }
 
 // default: no fingerprint
@@ -353,6 +440,7 @@ AsyncIOContext *FileAccess::asyncfopen(string *f)
     context->userData = waiter;
     context->pos = size;
     context->fa = this;
+    context->tracebegin();
 
     context->failed = !sysstat(&mtime, &size);
     context->retry = this->retry;
@@ -432,6 +520,7 @@ AsyncIOContext *FileAccess::asyncfopen(string *f, bool read, bool write, m_off_t
     context->userData = waiter;
     context->pos = pos;
     context->fa = this;
+    context->tracebegin();
 
     asyncsysopen(context);
     return context;
@@ -450,19 +539,25 @@ void FileAccess::asyncsysopen(AsyncIOContext *context)
 
 AsyncIOContext *FileAccess::asyncfread(string *dst, unsigned len, unsigned pad, m_off_t pos)
 {
-    LOG_verbose << "Async read start";
     dst->resize(len + pad);
+    return asyncfread((byte *)dst->data(), len, pad, pos);
+}
+
+AsyncIOContext *FileAccess::asyncfread(byte *dst, unsigned len, unsigned pad, m_off_t pos)
+{
+    LOG_verbose << "Async read start";
 
     AsyncIOContext *context = newasynccontext();
     context->op = AsyncIOContext::READ;
     context->pos = pos;
     context->len = len;
     context->pad = pad;
-    context->buffer = (byte *)dst->data();
+    context->buffer = dst;
     context->waiter = waiter;
     context->userCallback = asyncopfinished;
     context->userData = waiter;
     context->fa = this;
+    context->tracebegin();
 
     if (!asyncopenf())
     {
@@ -502,6 +597,7 @@ AsyncIOContext *FileAccess::asyncfwrite(const byte* data, unsigned len, m_off_t
     context->userCallback = asyncopfinished;
     context->userData = waiter;
     context->fa = this;
+    context->tracebegin();
 
     asyncsyswrite(context);
     return context;
@@ -561,6 +657,79 @@ bool FileAccess::frawread(byte* dst, unsigned len, m_off_t pos, bool caller_open
     return r;
 }
 
+bool FileAccess::fsparseread(byte* dst, unsigned len, const vector<m_off_t>& offsets)
+{
+    // merge the blocks into spans of [first, last) blocks
+    vector<std::pair<size_t, size_t>> spans;
+    size_t scratchlen = 0;
+    for (size_t i = 0; i < offsets.size(); )
+    {
+        size_t j = i + 1;
+        while (j < offsets.size() && offsets[j] >= offsets[j - 1]
+               && offsets[j] + len - offsets[i] <= SPARSEREAD_MAXSPAN)
+        {
+            j++;
+        }
+
+        if (j - i > 1)
+        {
+            scratchlen += size_t(offsets[j - 1] + len - offsets[i]);
+        }
+        spans.push_back(std::make_pair(i, j));
+        i = j;
+    }
+
+    // single blocks go straight to dst, spans through a scratch buffer
+    std::unique_ptr<byte[]> scratch(new byte[scratchlen ? scratchlen : 1]);
+    byte* next = scratch.get();
+    vector<RawRead> reads;
+    for (auto& span : spans)
+    {
+        RawRead r;
+        r.pos = offsets[span.first];
+        r.len = unsigned(offsets[span.second - 1] + len - r.pos);
+        if (span.second - span.first > 1)
+        {
+            r.dst = next;
+            next += r.len;
+        }
+        else
+        {
+            r.dst = dst + span.first * len;
+        }
+        reads.push_back(r);
+    }
+
+    if (!sysreadbatch(reads))
+    {
+        return false;
+    }
+
+    for (size_t k = 0; k < spans.size(); k++)
+    {
+        if (spans[k].second - spans[k].first > 1)
+        {
+            for (size_t b = spans[k].first; b < spans[k].second; b++)
+            {
+                memcpy(dst + b * len, reads[k].dst + (offsets[b] - reads[k].pos), len);
+            }
+        }
+    }
+    return true;
+}
+
+bool FileAccess::sysreadbatch(const vector<RawRead>& reads)
+{
+    for (const RawRead& r : reads)
+    {
+        if (!sysread(r.dst, r.len, r.pos))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
 AsyncIOContext::AsyncIOContext()
 {
     op = NONE;
@@ -576,12 +745,33 @@ AsyncIOContext::AsyncIOContext()
     finished = false;
     failed = false;
     retry = false;
+    traced = false;
+}
+
+const char* AsyncIOContext::tracename() const
+{
+    return op == READ ? "disk read" : op == WRITE ? "disk write" : "disk open";
+}
+
+void AsyncIOContext::tracebegin()
+{
+    if (CodeCounter::tracing())
+    {
+        CodeCounter::traceAsync("disk", tracename(), 'b', uint64_t(uintptr_t(this)));
+        traced = true;
+    }
 }
 
 AsyncIOContext::~AsyncIOContext()
 {
     finish();
 
+    if (traced)
+    {
+        // the span lasts until the result is collected
+        CodeCounter::traceAsync("disk", tracename(), 'e', uint64_t(uintptr_t(this)));
+    }
+
     // AsyncIOContext objects must be deleted before the FileAccess object
     if (op == AsyncIOContext::READ)
     {
@@ -604,4 +794,160 @@ void AsyncIOContext::finish()
     }
 }
 
+bool DirAccess::dnextstat(string* localpath, DirEntry* entry, bool followsymlinks)
+{
+    entry->statvalid = false;
+    return dnext(localpath, &entry->localname, followsymlinks, &entry->type);
+}
+
+ParallelDirScanner::ParallelDirScanner(FileSystemAccess* fs, unsigned threads, bool follow, Waiter* w)
+    : fsaccess(fs)
+    , followsymlinks(follow)
+    , waiter(w)
+{
+    try
+    {
+        while (workers.size() < threads)
+        {
+            workers.emplace_back(&ParallelDirScanner::workerLoop, this);
+        }
+    }
+    catch (std::system_error& e)
+    {
+        LOG_warn << "Started " << workers.size() << " of " << threads << " folder scanning threads: " << e.what();
+    }
+}
+
+ParallelDirScanner::~ParallelDirScanner()
+{
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+
+    for (auto& t : workers)
+    {
+        t.join();
+    }
+}
+
+unsigned ParallelDirScanner::threads() const
+{
+    return unsigned(workers.size());
+}
+
+void ParallelDirScanner::add(const string& localpath)
+{
+    if (workers.empty())
+    {
+        // no threads could be started: read it right here
+        Batch batch;
+        batch.localpath = localpath;
+        read(batch);
+        std::lock_guard<std::mutex> g(mutex);
+        finished.push_back(std::move(batch));
+        return;
+    }
+
+    std::lock_guard<std::mutex> g(mutex);
+    queued.push_back(localpath);
+    workAvailable.notify_one();
+}
+
+bool ParallelDirScanner::next(Batch& batch)
+{
+    std::lock_guard<std::mutex> g(mutex);
+    if (finished.empty())
+    {
+        return false;
+    }
+    batch = std::move(finished.front());
+    finished.pop_front();
+    return true;
+}
+
+bool ParallelDirScanner::done()
+{
+    std::lock_guard<std::mutex> g(mutex);
+    return queued.empty() && finished.empty() && !reading;
+}
+
+void ParallelDirScanner::workerLoop()
+{
+    for (;;)
+    {
+        Batch batch;
+        {
+            std::unique_lock<std::mutex> g(mutex);
+            workAvailable.wait(g, [this]() { return stopping || !queued.empty(); });
+            if (stopping)
+            {
+                return;
+            }
+
+            // depth first, so that the batches come back in about the order a recursive walk would produce them
+            batch.localpath = std::move(queued.back());
+            queued.pop_back();
+            reading++;
+        }
+
+        read(batch);
+
+        {
+            std::lock_guard<std::mutex> g(mutex);
+            finished.push_back(std::move(batch));
+            reading--;
+        }
+
+        if (waiter)
+        {
+            waiter->notify();
+        }
+    }
+}
+
+void ParallelDirScanner::read(Batch& batch)
+{
+    string localpath = batch.localpath;
+
+    // opened the way Sync::checkpath() opens them
+    auto fa = fsaccess->newfileaccess(false);
+    std::unique_ptr<DirAccess> da(fsaccess->newdiraccess());
+    if (!fa->fopen(&localpath, false, false) || fa->type != FOLDERNODE || !da->dopen(&localpath, fa.get(), false))
+    {
+        return;
+    }
+    batch.success = true;
+
+    size_t t = localpath.size();
+    Entry e;
+    while (da->dnextstat(&localpath, &e, followsymlinks))
+    {
+        if (!e.statvalid)
+        {
+            if (t)
+            {
+                localpath.append(fsaccess->localseparator);
+            }
+            localpath.append(e.localname);
+
+            auto efa = fsaccess->newfileaccess(false);
+            if ((e.statvalid = efa->fopen(&localpath, false, false)))
+            {
+                e.type = efa->type;
+                e.size = efa->size;
+                e.mtime = efa->mtime;
+                e.fsid = efa->fsid;
+                e.fsidvalid = efa->fsidvalid;
+            }
+
+            localpath.resize(t);
+        }
+
+        batch.entries.push_back(std::move(e));
+        e = Entry();
+    }
+}
+
 } // namespace
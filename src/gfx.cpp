@@ -22,6 +22,18 @@
 #include "mega.h"
 #include "mega/gfx.h"
 
+#include <chrono>
+#include <thread>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 namespace mega {
 const int GfxProc::dimensions[][2] = {
     { 200, 0 },     // THUMBNAIL: square thumbnail, cropped from near center
@@ -90,6 +102,16 @@ const char* GfxProc::supportedvideoformats()
     return NULL;
 }
 
+GfxProc* GfxProc::newworker()
+{
+    return NULL;
+}
+
+bool GfxProc::forkable()
+{
+    return true;
+}
+
 void *GfxProc::threadEntryPoint(void *param)
 {
     GfxProc* gfxProcessor = (GfxProc*)param;
@@ -104,54 +126,27 @@ void GfxProc::loop()
     {
         waiter.init(NEVER);
         waiter.wait();
-        while ((job = requests.pop()))
+
+        while (!finished && requests.size())
         {
-            if (finished)
+            // a backlog (eg. a photo library import) is shared out among more instances of the backend, on as many
+            // threads of the worker pool as it grants the class, this one included
+            unsigned wanted = unsigned(std::min<size_t>(requests.size(), std::min(workerlimit(), WorkerPool::get().parallelism(WorkerPool::WORK_GFX))));
+            while (workers.size() + 1 > workerlimit())
             {
-                delete job;
-                break;
+                delete workers.back();
+                workers.pop_back();
             }
+            while (workers.size() + 1 < wanted && startworker()) { }
+            workercount = unsigned(workers.size() + 1);
 
-            mutex.lock();
-            LOG_debug << "Processing media file: " << job->h;
-
-            // (this assumes that the width of the largest dimension is max)
-            if (readbitmap(NULL, &job->localfilename, dimensions[sizeof dimensions/sizeof dimensions[0]-1][0]))
-            {
-                for (unsigned i = 0; i < job->imagetypes.size(); i++)
-                {
-                    // successively downscale the original image
-                    string* jpeg = new string();
-                    int w = dimensions[job->imagetypes[i]][0];
-                    int h = dimensions[job->imagetypes[i]][1];
-
-                    if (job->imagetypes[i] == PREVIEW && this->w < w && this->h < h )
-                    {
-                        LOG_debug << "Skipping upsizing of preview";
-                        w = this->w;
-                        h = this->h;
-                    }
-
-                    if (!resizebitmap(w, h, jpeg))
-                    {
-                        delete jpeg;
-                        jpeg = NULL;
-                    }
-                    job->images.push_back(jpeg);
-                }
-                freebitmap();
-            }
-            else
+            // the jobs queued meanwhile go in the next round, which may take more threads for them
+            size_t batch = requests.size();
+            std::atomic<size_t> claimed(0);
+            WorkerPool::get().run(WorkerPool::WORK_GFX, std::min<size_t>(wanted, workers.size() + 1), [this, batch, &claimed](size_t i)
             {
-                for (unsigned i = 0; i < job->imagetypes.size(); i++)
-                {
-                    job->images.push_back(NULL);
-                }
-            }
-
-            mutex.unlock();
-            responses.push(job);
-            client->waiter->notify();
+                (i ? workers[i - 1] : this)->processjobs(this, batch, claimed);
+            });
         }
     }
 
@@ -170,6 +165,121 @@ void GfxProc::loop()
     }
 }
 
+void GfxProc::processjobs(GfxProc* queues, size_t batch, std::atomic<size_t>& claimed)
+{
+    if (queues != this)
+    {
+        // the settings of the main instance, as of this round
+        isolatedtimeoutms = int(queues->isolatedtimeoutms);
+        isolated = bool(queues->isolated);
+    }
+
+    GfxJob *job = NULL;
+    while (claimed++ < batch && (job = queues->requests.pop()))
+    {
+        if (queues->finished)
+        {
+            // the main instance drops it once the round is over
+            queues->requests.push(job);
+            break;
+        }
+
+#ifdef USE_MEDIAINFO
+        if (job->mediainfo)
+        {
+            // no bitmap involved, so the backend isn't locked
+            LOG_debug << "Extracting media properties: " << job->h;
+            CodeCounter::TraceSpan span("gfx", "media properties");
+            if (job->fa)
+            {
+                job->vp.extractMediaPropertyFileAttributes(job->fa.get(), job->localfilename);
+                job->fa.reset();
+            }
+
+            queues->responses.push(job);
+            client->waiter->notify();
+            continue;
+        }
+#endif
+
+        mutex.lock();
+        LOG_debug << "Processing media file: " << job->h;
+        CodeCounter::TraceSpan span("gfx", "gfx job");
+
+        // decode for the largest requested image only: a thumbnail-only job lets
+        // the backend read the image at a much smaller scale
+        int size = 0;
+        for (unsigned i = 0; i < job->imagetypes.size(); i++)
+        {
+            size = std::max(size, dimensions[job->imagetypes[i]][0]);
+        }
+
+        using clock = std::chrono::steady_clock;
+        GfxProcStats jobstats;
+        clock::time_point start = clock::now();
+
+        if (decode(&job->localfilename, size))
+        {
+            jobstats.images = 1;
+            jobstats.decodeus = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+
+            for (unsigned i = 0; i < job->imagetypes.size(); i++)
+            {
+                // successively downscale the original image
+                string* jpeg = new string();
+                int w = dimensions[job->imagetypes[i]][0];
+                int h = dimensions[job->imagetypes[i]][1];
+
+                if (job->imagetypes[i] == PREVIEW && this->w < w && this->h < h )
+                {
+                    LOG_debug << "Skipping upsizing of preview";
+                    w = this->w;
+                    h = this->h;
+                }
+
+                start = clock::now();
+                if (!resize(w, h, jpeg))
+                {
+                    delete jpeg;
+                    jpeg = NULL;
+                }
+                else if (job->imagetypes[i] < sizeof jobstats.resized / sizeof *jobstats.resized)
+                {
+                    jobstats.resized[job->imagetypes[i]]++;
+                    jobstats.resizeus[job->imagetypes[i]] += std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+                }
+                job->images.push_back(jpeg);
+            }
+            release();
+        }
+        else
+        {
+            jobstats.failed = 1;
+            for (unsigned i = 0; i < job->imagetypes.size(); i++)
+            {
+                job->images.push_back(NULL);
+            }
+        }
+
+        mutex.unlock();
+
+        {
+            std::lock_guard<std::mutex> g(queues->statsmutex);
+            queues->stats.images += jobstats.images;
+            queues->stats.failed += jobstats.failed;
+            queues->stats.decodeus += jobstats.decodeus;
+            for (unsigned i = 0; i < sizeof stats.resized / sizeof *stats.resized; i++)
+            {
+                queues->stats.resized[i] += jobstats.resized[i];
+                queues->stats.resizeus[i] += jobstats.resizeus[i];
+            }
+        }
+
+        queues->responses.push(job);
+        client->waiter->notify();
+    }
+}
+
 int GfxProc::checkevents(Waiter *)
 {
     if (!client)
@@ -181,6 +291,16 @@ int GfxProc::checkevents(Waiter *)
     bool needexec = false;
     while ((job = responses.pop()))
     {
+#ifdef USE_MEDIAINFO
+        if (job->mediainfo)
+        {
+            mediapropertiesready(job);
+            delete job;
+            needexec = true;
+            continue;
+        }
+#endif
+
         for (unsigned i = 0; i < job->images.size(); i++)
         {
             if (job->images[i])
@@ -200,26 +320,7 @@ int GfxProc::checkevents(Waiter *)
             {
                 LOG_debug << "Unable to process media file: " << job->h;
 
-                Transfer *transfer = NULL;
-                handletransfer_map::iterator htit = client->faputcompletion.find(job->h);
-                if (htit != client->faputcompletion.end())
-                {
-                    transfer = htit->second;
-                }
-                else
-                {
-                    // check if the failed attribute belongs to an active upload
-                    for (transfer_map::iterator it = client->transfers[PUT].begin(); it != client->transfers[PUT].end(); it++)
-                    {
-                        if (it->second->uploadhandle == job->h)
-                        {
-                            transfer = it->second;
-                            break;
-                        }
-                    }
-                }
-
-                if (transfer)
+                if (Transfer* transfer = uploadtransfer(job->h))
                 {
                     // reduce the number of required attributes to let the upload continue
                     transfer->minfa--;
@@ -238,6 +339,74 @@ int GfxProc::checkevents(Waiter *)
     return needexec ? Waiter::NEEDEXEC : 0;
 }
 
+Transfer* GfxProc::uploadtransfer(handle th)
+{
+    handletransfer_map::iterator htit = client->faputcompletion.find(th);
+    if (htit != client->faputcompletion.end())
+    {
+        return htit->second;
+    }
+
+    // check if the attribute belongs to an active upload
+    for (transfer_map::iterator it = client->transfers[PUT].begin(); it != client->transfers[PUT].end(); it++)
+    {
+        if (it->second->uploadhandle == th)
+        {
+            return it->second;
+        }
+    }
+    return NULL;
+}
+
+#ifdef USE_MEDIAINFO
+void GfxProc::mediapropertiesready(GfxJob* job)
+{
+    if (!job->flag)
+    {
+        client->mediaFileInfo.sendOrQueueMediaPropertiesFileAttributesForExistingFile(job->vp, job->fakey, client, job->h);
+        return;
+    }
+
+    Transfer* transfer = uploadtransfer(job->h);
+    if (!transfer)
+    {
+        LOG_debug << "Transfer related to media file not found: " << job->h;
+        return;
+    }
+
+    if (!client->mediaFileInfo.queueMediaPropertiesFileAttributesForUpload(job->vp, job->fakey, client, job->h))
+    {
+        // the attribute won't come: let the upload complete without it
+        transfer->minfa--;
+    }
+    client->checkfacompletion(job->h);
+}
+
+void GfxProc::genmediaproperties(string* localfilename, handle h, uint32_t fakey[4], bool upload)
+{
+    GfxJob *job = new GfxJob();
+    job->mediainfo = true;
+    job->h = h;
+    job->flag = upload;
+    memcpy(job->fakey, fakey, sizeof job->fakey);
+
+    job->fa = client->fsaccess->newfileaccess();
+    if (!job->fa->fopen(localfilename, true, false))
+    {
+        // the job still completes, with empty properties, like a file MediaInfo can't interpret
+        LOG_err << "could not open local file for mediainfo";
+        job->fa.reset();
+    }
+    else if (SimpleLogger::logCurrentLevel >= logDebug)
+    {
+        // only used for logging: the file is read through the open FileAccess
+        client->fsaccess->local2path(localfilename, &job->localfilename);
+    }
+
+    queuejob(job);
+}
+#endif
+
 void GfxProc::transform(int& w, int& h, int& rw, int& rh, int& px, int& py)
 {
     if (rh)
@@ -311,9 +480,480 @@ int GfxProc::gendimensionsputfa(FileAccess* /*fa*/, string* localfilename, handl
         return 0;
     }
 
+    int count = int(job->imagetypes.size());
+    queuejob(job);
+    return count;
+}
+
+void GfxProc::queuejob(GfxJob* job)
+{
+    if (!threadstarted)
+    {
+        threadstarted = true;
+        thread.start(threadEntryPoint, this);
+    }
+
     requests.push(job);
     waiter.notify();
-    return int(job->imagetypes.size());
+}
+
+GfxProcStats GfxProc::getstats()
+{
+    std::lock_guard<std::mutex> g(statsmutex);
+    return stats;
+}
+
+void GfxProc::resetstats()
+{
+    std::lock_guard<std::mutex> g(statsmutex);
+    stats = GfxProcStats();
+}
+
+unsigned GfxProc::workerlimit()
+{
+    if (maxworkers)
+    {
+        return maxworkers;
+    }
+
+    // image decoding must not starve the client thread nor the transfer crypto threads
+    unsigned reserved = 1;
+    if (client && client->transferCryptoPool)
+    {
+        reserved += client->transferCryptoPool->threads();
+    }
+
+    unsigned cores = std::thread::hardware_concurrency();
+    unsigned limit = cores > reserved ? cores - reserved : 1;
+    if (limit > MAX_WORKERS)
+    {
+        limit = MAX_WORKERS;
+    }
+    return limit;
+}
+
+bool GfxProc::startworker()
+{
+    GfxProc* worker = newworker();
+    if (!worker)
+    {
+        LOG_debug << "The gfx backend doesn't support parallel processing";
+        maxworkers = 1;
+        return false;
+    }
+
+    worker->client = client;
+    worker->owner = this;
+    workers.push_back(worker);
+    LOG_debug << "Created gfx worker. Total: " << workers.size() + 1;
+    return true;
+}
+
+void GfxProc::setmaxworkers(unsigned count)
+{
+    // the extra instances go between two rounds of jobs
+    maxworkers = count;
+    waiter.notify();
+}
+
+unsigned GfxProc::getworkers()
+{
+    return workercount;
+}
+
+void GfxProc::setisolated(bool enable, int steptimeoutms)
+{
+    // the running instances pick it up with their next round of files
+    isolatedtimeoutms = steptimeoutms;
+    isolated = enable;
+}
+
+bool GfxProc::getisolated()
+{
+    return isolated;
+}
+
+bool GfxProc::decode(string* localname, int size)
+{
+    bitmapprocess = nullptr;
+    if (!isolated || !forkable())
+    {
+        process.reset();
+        return readbitmap(NULL, localname, size);
+    }
+
+    if (!process)
+    {
+        process.reset(new GfxWorkerProcess(this, isolatedtimeoutms));
+    }
+    if (!process->start())
+    {
+        // can't isolate here: decode in this process rather than not at all
+        LOG_warn << "Unable to start a gfx worker process";
+        isolated = false;
+        process.reset();
+        return readbitmap(NULL, localname, size);
+    }
+
+    bitmapprocess = process.get();
+    return bitmapprocess->readbitmap(localname, size);
+}
+
+bool GfxProc::resize(int rw, int rh, string* jpeg)
+{
+    return bitmapprocess ? bitmapprocess->resizebitmap(rw, rh, jpeg) : resizebitmap(rw, rh, jpeg);
+}
+
+void GfxProc::release()
+{
+    if (bitmapprocess)
+    {
+        bitmapprocess->freebitmap();
+        bitmapprocess = nullptr;
+    }
+    else
+    {
+        freebitmap();
+    }
+}
+
+void GfxProc::processfailed()
+{
+    GfxProc* queues = owner ? owner.load() : this;
+    std::lock_guard<std::mutex> g(queues->statsmutex);
+    queues->stats.restarted++;
+}
+
+GfxWorkerProcess::GfxWorkerProcess(GfxProc* b, int timeoutms)
+    : backend(b)
+    , steptimeoutms(timeoutms)
+{
+}
+
+GfxWorkerProcess::~GfxWorkerProcess()
+{
+    stop(false);
+}
+
+#ifndef _WIN32
+
+namespace {
+
+// false on EOF, errors or the deadline (NEVER steady time: none)
+bool readall(int fd, void* data, size_t len, std::chrono::steady_clock::time_point deadline)
+{
+    char* p = (char*)data;
+    while (len)
+    {
+        int timeout = -1;
+        if (deadline != std::chrono::steady_clock::time_point::max())
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0)
+            {
+                return false;
+            }
+            timeout = int(left);
+        }
+
+        pollfd pfd = { fd, POLLIN, 0 };
+        int r = poll(&pfd, 1, timeout);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r <= 0)
+        {
+            return false;
+        }
+
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        len -= size_t(n);
+    }
+    return true;
+}
+
+bool writeall(int fd, const void* data, size_t len)
+{
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;    // SO_NOSIGPIPE is set on the socket
+#endif
+    const char* p = (const char*)data;
+    while (len)
+    {
+        ssize_t n = send(fd, p, len, flags);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        len -= size_t(n);
+    }
+    return true;
+}
+
+} // anonymous
+
+bool GfxWorkerProcess::start()
+{
+    if (pid > 0)
+    {
+        return true;
+    }
+
+    if (!shared)
+    {
+        shared = mmap(nullptr, SHARED_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+        if (shared == MAP_FAILED)
+        {
+            shared = nullptr;
+            return false;
+        }
+    }
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+    {
+        return false;
+    }
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fds[0], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on);
+    setsockopt(fds[1], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on);
+#endif
+
+    pid_t child = fork();
+    if (child < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (!child)
+    {
+        // only this thread exists in the child, and the app's logger may be locked by another one
+        SimpleLogger::setLogLevel(logFatal);
+        signal(SIGPIPE, SIG_IGN);
+        sock = fds[1];
+
+        // nothing of the app stays open in the child, which may outlive its connections and files
+        long maxfd = sysconf(_SC_OPEN_MAX);
+        for (int fd = 3; fd < (maxfd > 0 && maxfd < 65536 ? maxfd : 65536); fd++)
+        {
+            if (fd != sock)
+            {
+                close(fd);
+            }
+        }
+
+        serve();
+        _exit(0);
+    }
+
+    close(fds[1]);
+    sock = fds[0];
+    pid = child;
+    LOG_debug << "Started gfx worker process " << pid;
+    return true;
+}
+
+void GfxWorkerProcess::stop(bool failed)
+{
+    if (sock >= 0)
+    {
+        // a healthy child exits once it reads the end of its requests
+        close(sock);
+        sock = -1;
+    }
+
+    if (pid > 0)
+    {
+        if (failed)
+        {
+            LOG_warn << "Gfx worker process " << pid << " crashed or hung. Restarting it for the next file";
+            kill(pid, SIGKILL);
+            backend->processfailed();
+        }
+        else
+        {
+            // give it a moment, then make sure
+            for (int i = 0; i < 100 && waitpid(pid, nullptr, WNOHANG) == 0; i++)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            kill(pid, SIGKILL);
+        }
+        waitpid(pid, nullptr, 0);
+        pid = -1;
+    }
+
+    if (!failed && shared)
+    {
+        munmap(shared, SHARED_SIZE);
+        shared = nullptr;
+    }
+}
+
+bool GfxWorkerProcess::call(const Request& request, const string* path, Reply* reply)
+{
+    if (!start())
+    {
+        return false;
+    }
+
+    if (!writeall(sock, &request, sizeof request)
+            || (request.pathlen && !writeall(sock, path->data(), request.pathlen)))
+    {
+        stop(true);
+        return false;
+    }
+
+    if (reply && !readall(sock, reply, sizeof *reply, std::chrono::steady_clock::now() + std::chrono::milliseconds(steptimeoutms)))
+    {
+        stop(true);
+        return false;
+    }
+    return true;
+}
+
+bool GfxWorkerProcess::readbitmap(string* localname, int size)
+{
+    Request request = { READ, size, 0, uint32_t(localname->size()) };
+    Reply reply;
+    if (!call(request, localname, &reply) || !reply.ok)
+    {
+        return false;
+    }
+
+    backend->w = reply.w;
+    backend->h = reply.h;
+    return true;
+}
+
+bool GfxWorkerProcess::resizebitmap(int w, int h, string* jpeg)
+{
+    Request request = { RESIZE, w, h, 0 };
+    Reply reply;
+    if (!call(request, nullptr, &reply) || !reply.ok || reply.jpeglen > SHARED_SIZE)
+    {
+        return false;
+    }
+
+    jpeg->assign((const char*)shared, reply.jpeglen);
+    return true;
+}
+
+void GfxWorkerProcess::freebitmap()
+{
+    // the child doesn't reply: the next request waits behind it
+    if (pid > 0)
+    {
+        Request request = { FREE, 0, 0, 0 };
+        call(request, nullptr, nullptr);
+    }
+}
+
+void GfxWorkerProcess::serve()
+{
+    Request request;
+    string path;
+    string jpeg;
+    auto forever = std::chrono::steady_clock::time_point::max();
+
+    while (readall(sock, &request, sizeof request, forever))
+    {
+        path.resize(request.pathlen);
+        if (request.pathlen && !readall(sock, &path[0], request.pathlen, forever))
+        {
+            return;
+        }
+
+        Reply reply = { 0, 0, 0, 0 };
+        switch (request.op)
+        {
+            case READ:
+                reply.ok = backend->readbitmap(NULL, &path, request.a);
+                reply.w = backend->w;
+                reply.h = backend->h;
+                break;
+
+            case RESIZE:
+                jpeg.clear();
+                if (backend->resizebitmap(request.a, request.b, &jpeg) && jpeg.size() <= SHARED_SIZE)
+                {
+                    memcpy(shared, jpeg.data(), jpeg.size());
+                    reply.ok = 1;
+                    reply.jpeglen = uint32_t(jpeg.size());
+                }
+                break;
+
+            case FREE:
+                backend->freebitmap();
+                continue;
+
+            default:
+                return;
+        }
+
+        if (!writeall(sock, &reply, sizeof reply))
+        {
+            return;
+        }
+    }
+}
+
+#else
+
+bool GfxWorkerProcess::start()
+{
+    return false;
+}
+
+void GfxWorkerProcess::stop(bool)
+{
+}
+
+bool GfxWorkerProcess::readbitmap(string*, int)
+{
+    return false;
+}
+
+bool GfxWorkerProcess::resizebitmap(int, int, string*)
+{
+    return false;
+}
+
+void GfxWorkerProcess::freebitmap()
+{
+}
+
+#endif
+
+void GfxProc::stopthread()
+{
+    if (threadstarted && !threadstopped)
+    {
+        finished = true;
+        waiter.notify();
+        thread.join();
+        threadstopped = true;
+    }
 }
 
 bool GfxProc::savefa(string *localfilepath, int width, int height, string *localdstpath)
@@ -324,7 +964,7 @@ bool GfxProc::savefa(string *localfilepath, int width, int height, string *local
     }
 
     mutex.lock();
-    if (!readbitmap(NULL, localfilepath, width > height ? width : height))
+    if (!decode(localfilepath, width > height ? width : height))
     {
         mutex.unlock();
         return false;
@@ -340,8 +980,8 @@ bool GfxProc::savefa(string *localfilepath, int width, int height, string *local
     }
 
     string jpeg;
-    bool success = resizebitmap(w, h, &jpeg);
-    freebitmap();
+    bool success = resize(w, h, &jpeg);
+    release();
     mutex.unlock();
 
     if (!success)
@@ -365,17 +1005,28 @@ bool GfxProc::savefa(string *localfilepath, int width, int height, string *local
 }
 
 GfxProc::GfxProc()
+    : owner(nullptr)
+    , isolated(false)
+    , isolatedtimeoutms(ISOLATED_STEP_TIMEOUT_MS)
 {
     client = NULL;
     finished = false;
-    thread.start(threadEntryPoint, this);
+    threadstarted = false;
+    threadstopped = false;
+    maxworkers = 0;
+    workercount = 1;
 }
 
 GfxProc::~GfxProc()
 {
-    finished = true;
-    waiter.notify();
-    thread.join();
+    // the workers have no thread: they are done once this one's has stopped
+    stopthread();
+
+    for (unsigned i = 0; i < workers.size(); i++)
+    {
+        delete workers[i];
+    }
+    workers.clear();
 }
 
 GfxJobQueue::GfxJobQueue()
@@ -390,6 +1041,12 @@ void GfxJobQueue::push(GfxJob *job)
     mutex.unlock();
 }
 
+size_t GfxJobQueue::size()
+{
+    std::lock_guard<std::mutex> g(mutex);
+    return jobs.size();
+}
+
 GfxJob *GfxJobQueue::pop()
 {
     mutex.lock();
@@ -406,7 +1063,9 @@ GfxJob *GfxJobQueue::pop()
 
 GfxJob::GfxJob()
 {
-
+#ifdef USE_MEDIAINFO
+    mediainfo = false;
+#endif
 }
 
 } // namespace
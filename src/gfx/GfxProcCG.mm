@@ -62,6 +62,15 @@ const char* GfxProcCG::supportedformats() {
     return ".bmp.cr2.crw.cur.dng.gif.heic.ico.j2c.jp2.jpf.jpeg.jpg.nef.orf.pbm.pdf.pgm.png.pnm.ppm.psd.raf.rw2.rwl.tga.tif.tiff.3g2.3gp.avi.m4v.mov.mp4.mqv.qt.";
 }
 
+mega::GfxProc* GfxProcCG::newworker() {
+    return new GfxProcCG();
+}
+
+bool GfxProcCG::forkable() {
+    // apps can't fork on iOS
+    return false;
+}
+
 bool GfxProcCG::readbitmap(FileAccess* fa, string* name, int size) {
     string absolutename;
     if (PosixFileSystemAccess::appbasepath) {
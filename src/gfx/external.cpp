@@ -34,6 +34,11 @@ void GfxProcExternal::setProcessor(MegaGfxProcessor *processor)
 	this->processor = processor;
 }
 
+bool GfxProcExternal::forkable()
+{
+    return false;
+}
+
 bool GfxProcExternal::isgfx(string* name)
 {
 	if(!processor) return false;
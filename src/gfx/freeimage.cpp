@@ -40,6 +40,8 @@ typedef const char freeimage_filename_char_t;
 
 
 #ifdef HAVE_FFMPEG
+#include <chrono>
+
 extern "C" {
 #ifdef _WIN32
 #pragma warning(disable:4996)
@@ -94,6 +96,12 @@ GfxProcFreeImage::GfxProcFreeImage()
 #define CAP_TRUNCATED CODEC_CAP_TRUNCATED
 #endif
 
+// aborts blocking ffmpeg I/O once the video has used up its time budget
+static int ffmpegInterrupt(void* deadline)
+{
+    return std::chrono::steady_clock::now() > *static_cast<std::chrono::steady_clock::time_point*>(deadline);
+}
+
 const char *GfxProcFreeImage::supportedformatsFfmpeg()
 {
     return  ".264.265.3g2.3gp.3gpa.3gpp.3gpp2.mp3"
@@ -109,8 +117,12 @@ bool GfxProcFreeImage::readbitmapFfmpeg(FileAccess* fa, string* imagePath, int s
     av_log_set_level(AV_LOG_PANIC);
 #endif
 
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(int(VIDEO_FRAME_TIME_BUDGET));
+
     // Open video file
     AVFormatContext* formatContext = avformat_alloc_context();
+    formatContext->interrupt_callback.callback = ffmpegInterrupt;
+    formatContext->interrupt_callback.opaque = &deadline;
     if (avformat_open_input(&formatContext, imagePath->data(), NULL, NULL))
     {
         LOG_warn << "Error opening video: " << imagePath;
@@ -163,18 +175,22 @@ bool GfxProcFreeImage::readbitmapFfmpeg(FileAccess* fa, string* imagePath, int s
         return NULL;
     }
 
-    AVPixelFormat sourcePixelFormat = codecContext.pix_fmt;
-    AVPixelFormat targetPixelFormat = AV_PIX_FMT_BGR24; //raw data expected by freeimage is in this format
-    SwsContext* swsContext = sws_getContext(width, height, sourcePixelFormat,
-                                            width, height, targetPixelFormat,
-                                            SWS_FAST_BILINEAR, NULL, NULL, NULL);
-    if (!swsContext)
+    // the frame only needs to be large enough for the biggest image requested
+    int targetWidth = width;
+    int targetHeight = height;
+    int shortSide = std::min(width, height);
+    if (size > 0 && shortSide > size)
     {
-        LOG_warn << "SWS Context not found: " << sourcePixelFormat;
-        avformat_close_input(&formatContext);
-        return NULL;
+        targetWidth = int(int64_t(width) * size / shortSide);
+        targetHeight = int(int64_t(height) * size / shortSide);
     }
 
+    AVPixelFormat sourcePixelFormat = codecContext.pix_fmt;
+    AVPixelFormat targetPixelFormat = AV_PIX_FMT_BGR24; //raw data expected by freeimage is in this format
+
+    // created for the size of the decoded frame, which depends on lowres
+    SwsContext* swsContext = NULL;
+
     // Find decoder for video stream
     AVCodecID codecId = codecContext.codec_id;
     AVCodec* decoder = avcodec_find_decoder(codecId);
@@ -194,6 +210,16 @@ bool GfxProcFreeImage::readbitmapFfmpeg(FileAccess* fa, string* imagePath, int s
         codecContext.flags |= CAP_TRUNCATED;
     }
 
+    // decode only the keyframe reached by seeking, at a reduced resolution if the codec can
+    codecContext.skip_frame = AVDISCARD_NONKEY;
+    codecContext.skip_loop_filter = AVDISCARD_ALL;
+    int lowres = 0;
+    while (size > 0 && lowres < decoder->max_lowres && (shortSide >> (lowres + 1)) >= size)
+    {
+        lowres++;
+    }
+    codecContext.lowres = lowres;
+
     // Open codec
     if (avcodec_open2(&codecContext, decoder, NULL) < 0)
     {
@@ -223,8 +249,8 @@ bool GfxProcFreeImage::readbitmapFfmpeg(FileAccess* fa, string* imagePath, int s
     }
 
     targetFrame->format = targetPixelFormat;
-    targetFrame->width = width;
-    targetFrame->height = height;
+    targetFrame->width = targetWidth;
+    targetFrame->height = targetHeight;
     if (av_image_alloc(targetFrame->data, targetFrame->linesize, targetFrame->width, targetFrame->height, targetPixelFormat, 32) < 0)
     {
         LOG_warn << "Error allocating frame";
@@ -240,14 +266,15 @@ bool GfxProcFreeImage::readbitmapFfmpeg(FileAccess* fa, string* imagePath, int s
     // Timestamp in streams are measured in frames rather than seconds
     //int64_t frametimestamp = (int64_t)(5 * AV_TIME_BASE);  // Seek five seconds from the beginning
 
+    // the keyframe at or before 10% of the duration, found through the container index
     int64_t seek_target = 0;
     if (videoStream->duration != AV_NOPTS_VALUE)
     {
-        seek_target = videoStream->duration / 5;
+        seek_target = videoStream->duration / 10;
     }
     else
     {
-        seek_target = av_rescale_q(formatContext->duration / 5, av_get_time_base_q(), videoStream->time_base);
+        seek_target = av_rescale_q(formatContext->duration / 10, av_get_time_base_q(), videoStream->time_base);
     }
 
     char ext[8];
@@ -297,18 +324,33 @@ bool GfxProcFreeImage::readbitmapFfmpeg(FileAccess* fa, string* imagePath, int s
                     return NULL;
                 }
 
+                swsContext = sws_getCachedContext(swsContext, videoFrame->width, videoFrame->height, sourcePixelFormat,
+                                                  targetWidth, targetHeight, targetPixelFormat,
+                                                  SWS_FAST_BILINEAR, NULL, NULL, NULL);
+                if (!swsContext)
+                {
+                    LOG_warn << "SWS Context not found: " << sourcePixelFormat;
+                    av_packet_unref(&packet);
+                    av_frame_free(&videoFrame);
+                    avcodec_close(&codecContext);
+                    av_freep(&targetFrame->data[0]);
+                    av_frame_free(&targetFrame);
+                    avformat_close_input(&formatContext);
+                    return NULL;
+                }
+
                 scalingResult = sws_scale(swsContext, videoFrame->data, videoFrame->linesize,
-                                     0, codecContext.height, targetFrame->data, targetFrame->linesize);
+                                     0, videoFrame->height, targetFrame->data, targetFrame->linesize);
 
                 if (scalingResult > 0)
                 {
                     int fav = targetPixelFormat;
-                    int imagesize = avpicture_get_size((enum AVPixelFormat)fav, width, height);
+                    int imagesize = avpicture_get_size((enum AVPixelFormat)fav, targetWidth, targetHeight);
                     FIMEMORY fmemory;
                     fmemory.data = malloc(imagesize);
 
                     if (avpicture_layout((AVPicture *)targetFrame, (enum AVPixelFormat)fav,
-                                    width, height, (unsigned char*)fmemory.data, imagesize) <= 0)
+                                    targetWidth, targetHeight, (unsigned char*)fmemory.data, imagesize) <= 0)
                     {
                         LOG_warn << "Error copying frame";
                         av_packet_unref(&packet);
@@ -323,9 +365,9 @@ bool GfxProcFreeImage::readbitmapFfmpeg(FileAccess* fa, string* imagePath, int s
                     }
 
                     //int pitch = imagesize/height;
-                    int pitch = width*3;
+                    int pitch = targetWidth*3;
 
-                    if (!(dib = FreeImage_ConvertFromRawBits((BYTE*)fmemory.data,width,height,
+                    if (!(dib = FreeImage_ConvertFromRawBits((BYTE*)fmemory.data,targetWidth,targetHeight,
                                                              pitch, 24, FI_RGBA_RED_SHIFT, FI_RGBA_GREEN_MASK,
                                                              FI_RGBA_BLUE_MASK | 0xFFFF, TRUE) ) )
                     {
@@ -380,6 +422,95 @@ bool GfxProcFreeImage::readbitmapFfmpeg(FileAccess* fa, string* imagePath, int s
 
 #endif
 
+#ifndef OLD_FREEIMAGE
+#ifdef FIF_LOAD_NOPIXELS
+// the EXIF thumbnail is stored as shot, JPEG_EXIFROTATE only applies to the main image
+static FIBITMAP* exifrotated(FIBITMAP* image, FIBITMAP* header)
+{
+    FITAG* tag = NULL;
+    int orientation = 1;
+    if (FreeImage_GetMetadata(FIMD_EXIF_MAIN, header, "Orientation", &tag)
+            && FreeImage_GetTagType(tag) == FIDT_SHORT)
+    {
+        orientation = *(const WORD*)FreeImage_GetTagValue(tag);
+    }
+
+    switch (orientation)
+    {
+        case 1:
+            return FreeImage_Clone(image);
+        case 3:
+            return FreeImage_Rotate(image, 180);
+        case 6:
+            return FreeImage_Rotate(image, -90);
+        case 8:
+            return FreeImage_Rotate(image, 90);
+        default:
+            // mirrored, the image is decoded instead
+            return NULL;
+    }
+}
+#endif
+
+// load a JPEG no larger than required: libjpeg scales the DCT blocks down by 1/2, 1/4 or 1/8
+// while decoding, keeping the longer side at least the requested one. The header is read first
+// so that the square thumbnail isn't upscaled, and to use the EXIF thumbnail when it is enough
+static FIBITMAP* loadjpeg(freeimage_filename_char_t* name, int size)
+{
+    int thumbside = GfxProc::dimensions[GfxProc::THUMBNAIL][0];
+
+#ifdef FIF_LOAD_NOPIXELS
+    FIBITMAP* header = FreeImage_LoadX(FIF_JPEG, name, FIF_LOAD_NOPIXELS);
+    if (!header)
+    {
+        return NULL;
+    }
+
+    long long iw = FreeImage_GetWidth(header);
+    long long ih = FreeImage_GetHeight(header);
+    if (!iw || !ih)
+    {
+        FreeImage_Unload(header);
+        return NULL;
+    }
+
+    // the thumbnail is cropped from the shorter side
+    long long longside = std::max(iw, ih);
+    long long shortside = std::min(iw, ih);
+    long long needed = std::max<long long>(size, (thumbside * longside + shortside - 1) / shortside);
+    if (needed > 0xFFFF)
+    {
+        needed = 0xFFFF;
+    }
+
+    FIBITMAP* dib = NULL;
+    if (FIBITMAP* thumbnail = FreeImage_GetThumbnail(header))
+    {
+        long long tw = FreeImage_GetWidth(thumbnail);
+        long long th = FreeImage_GetHeight(thumbnail);
+
+        // letterboxed thumbnails (another aspect ratio) would leave their bars in the crop
+        if (tw && th && std::max(tw, th) >= needed
+                && std::abs(tw * ih - th * iw) * 100 <= th * iw)
+        {
+            dib = exifrotated(thumbnail, header);
+        }
+    }
+    FreeImage_Unload(header);
+
+    if (dib)
+    {
+        LOG_debug << "Using the EXIF thumbnail: " << FreeImage_GetWidth(dib) << "x" << FreeImage_GetHeight(dib);
+        return dib;
+    }
+#else
+    // without the size of the image, decode for the preview as the thumbnail may need it
+    int needed = std::max(size, GfxProc::dimensions[GfxProc::PREVIEW][0]);
+#endif
+
+    return FreeImage_LoadX(FIF_JPEG, name, JPEG_EXIFROTATE | JPEG_FAST | (int(needed) << 16));
+}
+#endif
 
 const char* GfxProcFreeImage::supportedformats()
 {
@@ -398,6 +529,11 @@ const char* GfxProcFreeImage::supportedformats()
     return sformats.c_str();
 }
 
+GfxProc* GfxProcFreeImage::newworker()
+{
+    return new GfxProcFreeImage();
+}
+
 bool GfxProcFreeImage::readbitmap(FileAccess* fa, string* localname, int size)
 {
 #ifdef _WIN32
@@ -444,8 +580,7 @@ bool GfxProcFreeImage::readbitmap(FileAccess* fa, string* localname, int size)
     if (fif == FIF_JPEG)
     {
         // load JPEG (scale & EXIF-rotate)
-        if (!(dib = FreeImage_LoadX(fif, (freeimage_filename_char_t*) localname->data(),
-                                    JPEG_EXIFROTATE | JPEG_FAST | (size << 16))))
+        if (!(dib = loadjpeg((freeimage_filename_char_t*) localname->data(), size)))
         {
 #ifdef _WIN32
             localname->resize(localname->size()-1);
@@ -38,6 +38,8 @@
 #include <QPainter>
 
 #ifdef HAVE_FFMPEG
+#include <chrono>
+
 extern "C" {
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
@@ -1123,6 +1125,12 @@ QImageReader *GfxProcQT::readbitmapPdf(int &w, int &h, int &orientation, QString
 #define CAP_TRUNCATED CODEC_CAP_TRUNCATED
 #endif
 
+// aborts blocking ffmpeg I/O once the video has used up its time budget
+static int ffmpegInterrupt(void* deadline)
+{
+    return std::chrono::steady_clock::now() > *static_cast<std::chrono::steady_clock::time_point*>(deadline);
+}
+
 const char *GfxProcQT::supportedformatsFfmpeg()
 {
     return  ".264.265.3g2.3gp.3gpa.3gpp.3gpp2.mp3"
@@ -1134,8 +1142,12 @@ const char *GfxProcQT::supportedformatsFfmpeg()
 
 QImageReader *GfxProcQT::readbitmapFfmpeg(int &w, int &h, int &orientation, QString imagePath)
 {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(int(VIDEO_FRAME_TIME_BUDGET));
+
     // Open video file
     AVFormatContext* formatContext = avformat_alloc_context();
+    formatContext->interrupt_callback.callback = ffmpegInterrupt;
+    formatContext->interrupt_callback.opaque = &deadline;
     if (avformat_open_input(&formatContext, imagePath.toUtf8().constData(), NULL, NULL))
     {
         LOG_warn << "Error opening video: " << imagePath.toUtf8().constData();
@@ -1219,6 +1231,10 @@ QImageReader *GfxProcQT::readbitmapFfmpeg(int &w, int &h, int &orientation, QStr
         codecContext.flags |= CAP_TRUNCATED;
     }
 
+    // decode only the keyframe reached by seeking
+    codecContext.skip_frame = AVDISCARD_NONKEY;
+    codecContext.skip_loop_filter = AVDISCARD_ALL;
+
     // Open codec
     if (avcodec_open2(&codecContext, decoder, NULL) < 0)
     {
@@ -1265,14 +1281,15 @@ QImageReader *GfxProcQT::readbitmapFfmpeg(int &w, int &h, int &orientation, QStr
     // Timestamp in streams are measured in frames rather than seconds
     //int64_t frametimestamp = (int64_t)(5 * AV_TIME_BASE);  // Seek five seconds from the beginning
 
+    // the keyframe at or before 10% of the duration, found through the container index
     int64_t seek_target = 0;
     if (videoStream->duration != AV_NOPTS_VALUE)
     {
-        seek_target = videoStream->duration / 5;
+        seek_target = videoStream->duration / 10;
     }
     else
     {
-        seek_target = av_rescale_q(formatContext->duration / 5, av_get_time_base_q(), videoStream->time_base);
+        seek_target = av_rescale_q(formatContext->duration / 10, av_get_time_base_q(), videoStream->time_base);
     }
 
     if (!imagePath.endsWith(QString::fromUtf8(".mp3"), Qt::CaseInsensitive) && seek_target > 0
@@ -1438,4 +1455,14 @@ const char *GfxProcQT::supportedvideoformats()
 #endif
 }
 
+GfxProc *GfxProcQT::newworker()
+{
+#ifdef HAVE_PDFIUM
+    // each instance initializes PDFium and destroys it for all of them when deleted
+    return NULL;
+#else
+    return new GfxProcQT();
+#endif
+}
+
 } // namespace
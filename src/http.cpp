@@ -316,6 +316,206 @@ void HttpIO::getMEGADNSservers(string *dnsservers, bool getfromnetwork)
     }
 }
 
+void TokenBucket::setrate(m_off_t bps, dstime now)
+{
+    if (bps != rate)
+    {
+        rate = bps;
+        tokens = bps;
+        refilled = now;
+    }
+}
+
+void TokenBucket::refill(dstime now)
+{
+    if (rate)
+    {
+        tokens = std::min(tokens + rate * m_off_t(now - refilled) / 10, rate);
+    }
+    refilled = now;
+}
+
+void BandwidthShaper::setlimit(m_off_t bps)
+{
+    limits[API] = bps;
+    applylimits();
+}
+
+void BandwidthShaper::setlimit(direction_t d, m_off_t bps)
+{
+    if (d == GET || d == PUT)
+    {
+        limits[d] = bps;
+        applylimits();
+    }
+}
+
+void BandwidthShaper::setgrouplimit(int group, m_off_t bps)
+{
+    if (bps > 0)
+    {
+        grouplimits[group] = bps;
+    }
+    else
+    {
+        grouplimits.erase(group);
+    }
+    applylimits();
+}
+
+void BandwidthShaper::setbackgroundlimit(m_off_t bps)
+{
+    background.setrate(std::max<m_off_t>(bps, 0), lastds);
+}
+
+bool BandwidthShaper::addschedule(const char* cron, m_time_t duration, m_off_t getbps, m_off_t putbps)
+{
+    Schedule schedule;
+    const char* error = nullptr;
+    memset(&schedule.expr, 0, sizeof(schedule.expr));
+    cron_parse_expr(cron, &schedule.expr, &error);
+    if (error || duration <= 0)
+    {
+        LOG_err << "Invalid bandwidth schedule " << cron << ": " << (error ? error : "no duration");
+        return false;
+    }
+
+    schedule.duration = duration;
+    schedule.limits[GET] = getbps;
+    schedule.limits[PUT] = putbps;
+    schedules.push_back(schedule);
+    evaluated = -1;
+    return true;
+}
+
+void BandwidthShaper::clearschedules()
+{
+    schedules.clear();
+    scheduled = -1;
+    applylimits();
+}
+
+void BandwidthShaper::update(dstime ds, m_time_t now)
+{
+    lastds = ds;
+
+    if (now != evaluated)
+    {
+        evaluated = now;
+
+        // in force if it matched less than `duration` seconds ago
+        int found = -1;
+        for (size_t i = 0; i < schedules.size() && found < 0; i++)
+        {
+            time_t start = cron_next(&schedules[i].expr, time_t(now - schedules[i].duration));
+            if (start != time_t(-1) && start <= time_t(now))
+            {
+                found = int(i);
+            }
+        }
+
+        if (found != scheduled)
+        {
+            LOG_debug << "Bandwidth schedule " << found << " in force (was " << scheduled << ")";
+            scheduled = found;
+            applylimits();
+        }
+    }
+
+    for (auto& bucket : buckets)
+    {
+        bucket.refill(ds);
+    }
+    for (auto& it : groupbuckets)
+    {
+        it.second.refill(ds);
+    }
+    background.refill(ds);
+}
+
+void BandwidthShaper::applylimits()
+{
+    if (scheduled >= 0)
+    {
+        buckets[GET].setrate(schedules[scheduled].limits[GET], lastds);
+        buckets[PUT].setrate(schedules[scheduled].limits[PUT], lastds);
+        buckets[API].setrate(0, lastds);
+        groupbuckets.clear();
+        return;
+    }
+
+    for (int i = GET; i <= API; i++)
+    {
+        buckets[i].setrate(limits[i], lastds);
+    }
+
+    for (auto it = groupbuckets.begin(); it != groupbuckets.end(); )
+    {
+        if (grouplimits.count(it->first))
+        {
+            it++;
+        }
+        else
+        {
+            groupbuckets.erase(it++);
+        }
+    }
+    for (auto& it : grouplimits)
+    {
+        groupbuckets[it.first].setrate(it.second, lastds);
+    }
+}
+
+const TokenBucket* BandwidthShaper::groupbucket(int group) const
+{
+    auto it = groupbuckets.find(group);
+    return it == groupbuckets.end() ? nullptr : &it->second;
+}
+
+int BandwidthShaper::blocked(direction_t d, int group) const
+{
+    if (buckets[API].empty() || buckets[d].empty())
+    {
+        return DIRECTION_LIMITED;
+    }
+
+    const TokenBucket* bucket = groupbucket(group);
+    if (d == GET && group != STREAMING_GROUP && background.empty())
+    {
+        // the streams go on, as the paused requests of a group do
+        return GROUP_LIMITED;
+    }
+    return bucket && bucket->empty() ? GROUP_LIMITED : FREE;
+}
+
+m_off_t BandwidthShaper::available(direction_t d, int group) const
+{
+    m_off_t bytes = -1;
+    const TokenBucket* bucket = groupbucket(group);
+    const TokenBucket* bg = (d == GET && group != STREAMING_GROUP) ? &background : nullptr;
+    for (const TokenBucket* b : { &buckets[API], &buckets[d], bucket, bg })
+    {
+        if (b && b->rate && (bytes < 0 || b->tokens < bytes))
+        {
+            bytes = std::max<m_off_t>(b->tokens, 0);
+        }
+    }
+    return bytes;
+}
+
+void BandwidthShaper::consume(direction_t d, int group, m_off_t bytes)
+{
+    auto it = groupbuckets.find(group);
+    TokenBucket* bg = (d == GET && group != STREAMING_GROUP) ? &background : nullptr;
+    for (TokenBucket* b : { &buckets[API], &buckets[d], it == groupbuckets.end() ? nullptr : &it->second, bg })
+    {
+        if (b && b->rate)
+        {
+            b->tokens -= bytes;
+        }
+    }
+}
+
 bool HttpIO::setmaxdownloadspeed(m_off_t)
 {
     return false;
@@ -336,6 +536,81 @@ m_off_t HttpIO::getmaxuploadspeed()
     return 0;
 }
 
+bool HttpIO::sethttp2(bool)
+{
+    return false;
+}
+
+bool HttpIO::multiplexes() const
+{
+    return false;
+}
+
+void HttpIO::exportsslsessions(string* data)
+{
+    data->clear();
+}
+
+void HttpIO::importsslsessions(const string&)
+{
+}
+
+void HttpIO::exportdnscache(string* data)
+{
+    data->clear();
+}
+
+void HttpIO::importdnscache(const string&)
+{
+}
+
+static unsigned countlastminute(const std::deque<dstime>& times)
+{
+    unsigned count = 0;
+    for (auto it = times.rbegin(); it != times.rend() && Waiter::ds - *it < 600; it++)
+    {
+        count++;
+    }
+    return count;
+}
+
+void HttpIO::countrequest(bool newconnection, bool handshake, bool http2)
+{
+    connectionstats.requests++;
+    if (http2)
+    {
+        connectionstats.http2requests++;
+    }
+
+    if (newconnection)
+    {
+        connectionstats.connections++;
+        recentconnections.push_back(Waiter::ds);
+    }
+    if (newconnection && handshake)
+    {
+        connectionstats.handshakes++;
+        recenthandshakes.push_back(Waiter::ds);
+    }
+
+    while (recentconnections.size() && Waiter::ds - recentconnections.front() >= 600)
+    {
+        recentconnections.pop_front();
+    }
+    while (recenthandshakes.size() && Waiter::ds - recenthandshakes.front() >= 600)
+    {
+        recenthandshakes.pop_front();
+    }
+}
+
+HttpIO::ConnectionStats HttpIO::getconnectionstats() const
+{
+    ConnectionStats stats = connectionstats;
+    stats.connectionsPerMinute = countlastminute(recentconnections);
+    stats.handshakesPerMinute = countlastminute(recenthandshakes);
+    return stats;
+}
+
 void HttpReq::post(MegaClient* client, const char* data, unsigned len)
 {
     if (httpio)
@@ -350,10 +625,17 @@ void HttpReq::post(MegaClient* client, const char* data, unsigned len)
     outpos = 0;
     notifiedbufpos = 0;
     inpurge = 0;
+    indiscarded = 0;
     method = METHOD_POST;
     contentlength = -1;
     lastdata = Waiter::ds;
 
+    if (CodeCounter::tracing())
+    {
+        CodeCounter::traceAsync("http", tracename, 'b', uint64_t(uintptr_t(this)));
+        traced = true;
+    }
+
     DEBUG_TEST_HOOK_HTTPREQ_POST(this)
 
     httpio->post(this, data, len);
@@ -373,10 +655,17 @@ void HttpReq::get(MegaClient *client)
     outpos = 0;
     notifiedbufpos = 0;
     inpurge = 0;
+    indiscarded = 0;
     method = METHOD_GET;
     contentlength = -1;
     lastdata = Waiter::ds;
 
+    if (CodeCounter::tracing())
+    {
+        CodeCounter::traceAsync("http", tracename, 'b', uint64_t(uintptr_t(this)));
+        traced = true;
+    }
+
     httpio->post(this);
 }
 
@@ -394,9 +683,16 @@ void HttpReq::dns(MegaClient *client)
     outpos = 0;
     notifiedbufpos = 0;
     inpurge = 0;
+    indiscarded = 0;
     method = METHOD_NONE;
     contentlength = -1;
     lastdata = Waiter::ds;
+
+    if (CodeCounter::tracing())
+    {
+        CodeCounter::traceAsync("http", tracename, 'b', uint64_t(uintptr_t(this)));
+        traced = true;
+    }
     
     httpio->post(this);
 }
@@ -411,11 +707,147 @@ void HttpReq::disconnect()
     }
 }
 
+string StorageHealth::hostof(const string& url)
+{
+    size_t n = url.find("://");
+    if (n == string::npos)
+    {
+        return string();
+    }
+    n += 3;
+    return url.substr(n, url.find('/', n) - n);
+}
+
+void StorageHealth::average(double& value, double sample, unsigned samples)
+{
+    value = samples > 1 ? value + (sample - value) * EWMA_WEIGHT / 100 : sample;
+}
+
+bool StorageHealth::success(const string& url, m_off_t bytes, int ttfbms, int elapsedms, dstime now)
+{
+    string host = hostof(url);
+    if (host.empty())
+    {
+        return false;
+    }
+
+    Host& h = hostmap[host];
+    average(h.errorrate, 0, ++h.samples);
+
+    if (ttfbms >= 0)
+    {
+        average(h.ttfbms, ttfbms, ++h.ttfbsamples);
+    }
+
+    int transferms = elapsedms - std::max(ttfbms, 0);
+    if (bytes >= MIN_THROUGHPUT_BYTES && transferms > 0)
+    {
+        average(h.throughput, bytes * 1000.0 / transferms, ++h.throughputsamples);
+    }
+
+    return sampled(host, h, now);
+}
+
+bool StorageHealth::failure(const string& url, dstime now)
+{
+    string host = hostof(url);
+    if (host.empty())
+    {
+        return false;
+    }
+
+    Host& h = hostmap[host];
+    average(h.errorrate, 1, ++h.samples);
+    return sampled(host, h, now);
+}
+
+bool StorageHealth::sampled(const string& host, Host& h, dstime now)
+{
+    if (h.avoided || h.samples < MIN_SAMPLES || score(host) * 100 >= POOR_SCORE_PERCENT)
+    {
+        return false;
+    }
+
+    LOG_warn << "Storage server " << host << " is performing poorly (score " << score(host)
+             << "), avoiding it for " << COOLDOWN_DS / 10 << " seconds";
+    h.avoided = true;
+    h.avoidedsince = now;
+    return true;
+}
+
+double StorageHealth::score(const string& host) const
+{
+    auto it = hostmap.find(host);
+    if (it == hostmap.end())
+    {
+        return 1;
+    }
+    const Host& h = it->second;
+
+    // compared to the best of the other hosts, so that a slow line doesn't make them all poor
+    double besttput = 0;
+    double bestttfb = 0;
+    for (auto& o : hostmap)
+    {
+        if (o.second.throughputsamples)
+        {
+            besttput = std::max(besttput, o.second.throughput);
+        }
+        if (o.second.ttfbsamples && (!bestttfb || o.second.ttfbms < bestttfb))
+        {
+            bestttfb = o.second.ttfbms;
+        }
+    }
+
+    double s = 1 - h.errorrate;
+    if (h.throughputsamples && besttput > 0)
+    {
+        s *= std::min(1.0, h.throughput / besttput);
+    }
+    if (h.ttfbsamples && h.ttfbms > 0)
+    {
+        s *= std::min(1.0, bestttfb / h.ttfbms);
+    }
+    return s;
+}
+
+bool StorageHealth::avoided(const string& url, dstime now)
+{
+    auto it = hostmap.find(hostof(url));
+    if (it == hostmap.end() || !it->second.avoided)
+    {
+        return false;
+    }
+
+    if (now - it->second.avoidedsince < COOLDOWN_DS)
+    {
+        return true;
+    }
+
+    // the cooldown is over: judged afresh from new samples
+    hostmap.erase(it);
+    return false;
+}
+
+// back to the pool it came from, if any
+static void releasebuffer(const std::shared_ptr<BufferPool>& pool, byte* buf, size_t capacity)
+{
+    if (pool && buf)
+    {
+        pool->put(buf, capacity);
+    }
+    else
+    {
+        delete[] buf;
+    }
+}
+
 HttpReq::HttpReq(bool b)
 {
     binary = b;
     status = REQ_READY;
     buf = NULL;
+    bufcapacity = 0;
     httpio = NULL;
     httpiohandle = NULL;
     out = &outbuf;
@@ -425,6 +857,13 @@ HttpReq::HttpReq(bool b)
     buflen = 0;
     protect = false;
     minspeed = false;
+    streamed = false;
+    preconnect = NONE;
+    shapinggroup = 0;
+    ttfbms = -1;
+    elapsedms = -1;
+    tracename = "http";
+    traced = false;
 
     init();
 }
@@ -435,14 +874,17 @@ HttpReq::~HttpReq()
     {
         httpio->cancel(this);
     }
+    traceend();
 
-    delete[] buf;
+    releasebuffer(bufferpool, buf, bufcapacity);
 }
 
 void HttpReq::init()
 {
+    traceend();
     httpstatus = 0;
     inpurge = 0;
+    indiscarded = 0;
     sslcheckfailed = false;
     bufpos = 0;
     notifiedbufpos = 0;
@@ -454,6 +896,15 @@ void HttpReq::init()
     contenttype.clear();
 }
 
+void HttpReq::traceend()
+{
+    if (traced)
+    {
+        CodeCounter::traceAsync("http", tracename, 'e', uint64_t(uintptr_t(this)));
+        traced = false;
+    }
+}
+
 void HttpReq::setreq(const char* u, contenttype_t t)
 {
     if (u)
@@ -481,6 +932,7 @@ void HttpReq::put(void* data, unsigned len, bool purge)
         if (inpurge && purge)
         {
             in.erase(0, inpurge);
+            indiscarded += inpurge;
             inpurge = 0;
         }
 
@@ -492,13 +944,18 @@ void HttpReq::put(void* data, unsigned len, bool purge)
 
 
 HttpReq::http_buf_t::http_buf_t(byte* b, size_t s, size_t e)
-    : start(s), end(e), buf(b)
+    : start(s), end(e), buf(b), capacity(0)
+{
+}
+
+HttpReq::http_buf_t::http_buf_t(byte* b, size_t s, size_t e, std::shared_ptr<BufferPool> p, size_t c)
+    : start(s), end(e), buf(b), pool(std::move(p)), capacity(c)
 {
 }
 
 HttpReq::http_buf_t::~http_buf_t()
 {
-    delete[] buf;
+    releasebuffer(pool, buf, capacity);
 }
 
 void HttpReq::http_buf_t::swap(http_buf_t& other)
@@ -506,6 +963,8 @@ void HttpReq::http_buf_t::swap(http_buf_t& other)
     byte* tb = buf; buf = other.buf; other.buf = tb;
     size_t ts = start; start = other.start; other.start = ts;
     size_t te = end; end = other.end; other.end = te;
+    pool.swap(other.pool);
+    size_t tc = capacity; capacity = other.capacity; other.capacity = tc;
 }
 
 bool HttpReq::http_buf_t::isNull()
@@ -527,9 +986,11 @@ size_t HttpReq::http_buf_t::datalen()
 // give up ownership of the buffer for client to use.  
 struct HttpReq::http_buf_t* HttpReq::release_buf()
 {
-    HttpReq::http_buf_t* result = new HttpReq::http_buf_t(buf, inpurge, (size_t)bufpos);
+    HttpReq::http_buf_t* result = new HttpReq::http_buf_t(buf, inpurge, (size_t)bufpos, bufferpool, bufcapacity);
     buf = NULL;
+    bufcapacity = 0;
     inpurge = 0;
+    indiscarded = 0;
     buflen = 0;
     bufpos = 0;
     outpos = 0;
@@ -550,6 +1011,11 @@ size_t HttpReq::size()
     return in.size() - inpurge;
 }
 
+m_off_t HttpReq::received() const
+{
+    return buf ? bufpos : m_off_t(in.size()) + indiscarded;
+}
+
 // set amount of purgeable in data at 0
 void HttpReq::purge(size_t numbytes)
 {
@@ -559,7 +1025,7 @@ void HttpReq::purge(size_t numbytes)
 // set total response size
 void HttpReq::setcontentlength(m_off_t len)
 {
-    if (!buf && type != REQ_BINARY)
+    if (!buf && type != REQ_BINARY && !streamed)
     {
         in.reserve(static_cast<size_t>(len));
     }
@@ -586,6 +1052,7 @@ byte* HttpReq::reserveput(unsigned* len)
             // FIXME: optimize erase()/resize() -> single copy/resize()
             in.erase(0, inpurge);
             bufpos -= inpurge;
+            indiscarded += inpurge;
             inpurge = 0;
         }
 
@@ -617,6 +1084,7 @@ HttpReqDL::HttpReqDL()
     : dlpos(0)
     , buffer_released(false)
 {
+    tracename = "download chunk";
 }
 
 // prepare file chunk download
@@ -633,21 +1101,30 @@ void HttpReqDL::prepare(const char* tempurl, SymmCipher* /*key*/,
     size = (unsigned)(npos - pos);
     buffer_released = false;
 
-    if (!buf || buflen != size)
+    // padded for SymmCipher::ctr_crypt
+    size_t needed = (size + SymmCipher::BLOCKSIZE - 1) & - SymmCipher::BLOCKSIZE;
+
+    if (!buf || bufcapacity < needed)
     {
         // (re)allocate buffer
-        if (buf)
-        {
-            delete[] buf;
-            buf = NULL;
-        }
+        releasebuffer(bufferpool, buf, bufcapacity);
+        buf = NULL;
+        bufcapacity = 0;
 
         if (size)
         {
-            buf = new byte[(size + SymmCipher::BLOCKSIZE - 1) & - SymmCipher::BLOCKSIZE];
+            if (bufferpool)
+            {
+                buf = bufferpool->get(needed, bufcapacity);
+            }
+            else
+            {
+                buf = new byte[needed];
+                bufcapacity = needed;
+            }
         }
-        buflen = size;
     }
+    buflen = size;
 }
 
 
@@ -657,7 +1134,7 @@ EncryptByChunks::EncryptByChunks(SymmCipher* k, chunkmac_map* m, uint64_t iv) :
     memset(crc, 0, CRCSIZE);
 }
 
-void EncryptByChunks::updateCRC(byte* data, unsigned size, unsigned offset)
+void EncryptByChunks::updateCRC(byte* crc, const byte* data, unsigned size, unsigned offset)
 {
     uint32_t *intc = (uint32_t *)crc;
 
@@ -672,7 +1149,7 @@ void EncryptByChunks::updateCRC(byte* data, unsigned size, unsigned offset)
         }
     }
 
-    uint32_t *intdata = (uint32_t *)data;
+    const uint32_t *intdata = (const uint32_t *)data;
     int ll = size % CRCSIZE;
     int l = size / CRCSIZE;
     if (l)
@@ -713,7 +1190,7 @@ bool EncryptByChunks::encrypt(m_off_t pos, m_off_t npos, string& urlSuffix)
         (*macs)[startpos].finished = false;
         LOG_debug << "Encrypted chunk: " << startpos << " - " << endpos << "   Size: " << chunksize;
 
-        updateCRC(buf, unsigned(chunksize), unsigned(startpos - pos));
+        updateCRC(crc, buf, unsigned(chunksize), unsigned(startpos - pos));
 
         startpos = endpos;
         endpos = ChunkedHash::chunkceil(startpos, finalpos);
@@ -722,13 +1199,18 @@ bool EncryptByChunks::encrypt(m_off_t pos, m_off_t npos, string& urlSuffix)
     assert(endpos == finalpos);
     buf = nextbuffer(0);   // last call in case caller does buffer post-processing (such as write to file as we go)
 
-    ostringstream s;
-    s << "/" << pos << "?c=" << Base64Str<EncryptByChunks::CRCSIZE>(crc);
-    urlSuffix = s.str();
+    urlSuffix = EncryptByChunks::urlSuffix(pos, crc);
 
     return !!buf;
 }
 
+string EncryptByChunks::urlSuffix(m_off_t pos, const byte* crc)
+{
+    ostringstream s;
+    s << "/" << pos << "?c=" << Base64Str<EncryptByChunks::CRCSIZE>(crc);
+    return s.str();
+}
+
 
 EncryptBufferByChunks::EncryptBufferByChunks(byte* b, SymmCipher* k, chunkmac_map* m, uint64_t iv)
     : EncryptByChunks(k, m, iv)
@@ -744,20 +1226,113 @@ byte* EncryptBufferByChunks::nextbuffer(unsigned bufsize)
 }
 
 // prepare chunk for uploading: mac and encrypt
+HttpReqUL::~HttpReqUL()
+{
+    // curl must be done reading the body
+    disconnect();
+    releasebody();
+}
+
+byte* HttpReqUL::bodybuffer(unsigned size, unsigned pad)
+{
+    size_t needed = size + pad;
+    if (!body || bodycapacity < needed)
+    {
+        releasebody();
+
+        if (needed)
+        {
+            if (bufferpool)
+            {
+                body = bufferpool->get(needed, bodycapacity);
+            }
+            else
+            {
+                body = new byte[needed];
+                bodycapacity = needed;
+            }
+        }
+    }
+    return body;
+}
+
+void HttpReqUL::releasebody()
+{
+    releasebuffer(bufferpool, body, bodycapacity);
+    body = nullptr;
+    bodycapacity = 0;
+    bodyend = bodypos = 0;
+    bodymacs.clear();
+}
+
 void HttpReqUL::prepare(const char* tempurl, SymmCipher* key,
                         chunkmac_map* macs, uint64_t ctriv, m_off_t pos,
                         m_off_t npos)
 {
-    EncryptBufferByChunks eb((byte*)out->data(), key, macs, ctriv);
+    EncryptBufferByChunks eb(body, key, macs, ctriv);
 
-    string urlSuffix;
-    eb.encrypt(pos, npos, urlSuffix);
+    eb.encrypt(pos, npos, urlsuffix);
 
-    // unpad for POSTing
+    prepared(tempurl, macs, pos, npos);
+}
+
+void HttpReqUL::prepared(const char* tempurl, chunkmac_map* macs, m_off_t pos, m_off_t npos)
+{
+    bodypos = pos;
+    bodyend = npos;
+    bodymacs.clear();
+    for (chunkmac_map::iterator it = macs->lower_bound(pos); it != macs->end() && it->first < npos; it++)
+    {
+        bodymacs.push_back(*it);
+    }
+
+    // the padding is not POSTed
     size = (unsigned)(npos - pos);
-    out->resize(size);
 
-    setreq((tempurl + urlSuffix).c_str(), REQ_BINARY);
+    setreq((tempurl + urlsuffix).c_str(), REQ_BINARY);
+}
+
+byte* HttpReqUL::detachbody(size_t* capacity)
+{
+    byte* b = body;
+    *capacity = bodycapacity;
+    body = nullptr;
+    bodycapacity = 0;
+    return b;
+}
+
+void HttpReqUL::attachbody(byte* b, size_t capacity)
+{
+    releasebody();
+    body = b;
+    bodycapacity = capacity;
+}
+
+void HttpReqUL::swapbody(HttpReqUL& other)
+{
+    std::swap(body, other.body);
+    std::swap(bodycapacity, other.bodycapacity);
+    std::swap(bodypos, other.bodypos);
+    std::swap(bodyend, other.bodyend);
+    urlsuffix.swap(other.urlsuffix);
+    bodymacs.swap(other.bodymacs);
+}
+
+void HttpReqUL::resend(const char* tempurl, chunkmac_map* macs)
+{
+    for (auto& it : bodymacs)
+    {
+        (*macs)[it.first] = it.second;
+    }
+
+    size = (unsigned)(bodyend - bodypos);
+
+    setreq((tempurl + urlsuffix).c_str(), REQ_BINARY);
+}
+
+void HttpReqUL::post(MegaClient* client)
+{
+    HttpReq::post(client, size ? (const char*)body : NULL, size);
 }
 
 // number of bytes sent in this request
@@ -771,6 +1346,151 @@ m_off_t HttpReqUL::transferred(MegaClient* client)
     return 0;
 }
 
+BufferPool::BufferPool(size_t maxIdleBytes)
+{
+    counters.maxIdleBytes = maxIdleBytes;
+}
+
+BufferPool::~BufferPool()
+{
+    setlimit(0);
+}
+
+size_t BufferPool::classsize(size_t size)
+{
+    if (size < MIN_POOLED || size > MAX_POOLED)
+    {
+        return size;
+    }
+
+    // round up to the next quarter of a power of two: at most 25% over
+    size_t base = MIN_POOLED;
+    while (base * 2 < size)
+    {
+        base *= 2;
+    }
+    size_t step = base / 4;
+    return (size + step - 1) / step * step;
+}
+
+byte* BufferPool::get(size_t size, size_t& capacity)
+{
+    capacity = classsize(size);
+    bool pooled = size >= MIN_POOLED && size <= MAX_POOLED;
+
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        counters.busyBytes += capacity;
+        auto it = pooled ? idle.find(capacity) : idle.end();
+        if (it != idle.end() && !it->second.empty())
+        {
+            byte* buf = it->second.back();
+            it->second.pop_back();
+            counters.idleBytes -= capacity;
+            counters.hits++;
+            return buf;
+        }
+        if (pooled)
+        {
+            counters.misses++;
+        }
+    }
+
+    return new byte[capacity];
+}
+
+void BufferPool::put(byte* buf, size_t capacity)
+{
+    bool pooled = capacity >= MIN_POOLED && capacity <= MAX_POOLED;
+
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        counters.busyBytes -= capacity;
+        if (pooled && counters.idleBytes + capacity <= counters.maxIdleBytes)
+        {
+            idle[capacity].push_back(buf);
+            counters.idleBytes += capacity;
+            return;
+        }
+        if (pooled)
+        {
+            counters.dropped++;
+        }
+    }
+
+    delete[] buf;
+}
+
+void BufferPool::setlimit(size_t maxIdleBytes)
+{
+    std::lock_guard<std::mutex> g(mutex);
+    counters.maxIdleBytes = maxIdleBytes;
+
+    // free the largest first
+    for (auto it = idle.rbegin(); it != idle.rend() && counters.idleBytes > maxIdleBytes; ++it)
+    {
+        while (!it->second.empty() && counters.idleBytes > maxIdleBytes)
+        {
+            delete[] it->second.back();
+            it->second.pop_back();
+            counters.idleBytes -= it->first;
+        }
+    }
+}
+
+BufferPool::Stats BufferPool::stats() const
+{
+    std::lock_guard<std::mutex> g(mutex);
+    return counters;
+}
+
+AdaptiveConcurrency::AdaptiveConcurrency(int min, int max, int initial)
+    : minimum(min)
+    , maximum(max)
+    , current(std::max(min, std::min(max, initial)))
+{
+}
+
+void AdaptiveConcurrency::completed(dstime latency)
+{
+    best = std::min(best, latency);
+    windowbest = std::min(windowbest, latency);
+    if (++seen >= LATENCY_WINDOW)
+    {
+        best = windowbest;
+        windowbest = NEVER;
+        seen = 0;
+    }
+
+    // the response time is counted in ds, so allow a little more than twice the best.  It shrinks
+    // at most once per round, as the requests in flight when it slowed down are all late
+    sincedecrease++;
+    if (latency <= 2 * best + 2)
+    {
+        if (++fastenough >= unsigned(current) && current < maximum)
+        {
+            current++;
+            fastenough = 0;
+        }
+    }
+    else if (latency > 4 * best + 5 && sincedecrease >= unsigned(current))
+    {
+        current = std::max(minimum, current - std::max(current / 4, 1));
+        fastenough = 0;
+        sincedecrease = 0;
+    }
+}
+
+void AdaptiveConcurrency::refused()
+{
+    fastenough = 0;
+    if (++sincedecrease >= unsigned(current))
+    {
+        current = std::max(minimum, current / 2);
+        sincedecrease = 0;
+    }
+}
+
 SpeedController::SpeedController()
 {
     partialBytes = 0;
@@ -835,4 +1555,177 @@ GenericHttpReq::GenericHttpReq(PrnGen &rng, bool binary)
     isbtactive = false;
 }
 
+NetworkProbe::NetworkProbe()
+{
+    current = 0;
+    sentds = 0;
+}
+
+NetworkProbe::~NetworkProbe()
+{
+    stop();
+}
+
+void NetworkProbe::start(const vector<string>& urls)
+{
+    stop();
+    targets.clear();
+    for (const string& url : urls)
+    {
+        targets.push_back(Endpoint());
+        targets.back().url = url;
+    }
+    current = 0;
+}
+
+void NetworkProbe::stop()
+{
+    if (req)
+    {
+        req->disconnect();
+        req.reset();
+    }
+    current = targets.size();
+}
+
+bool NetworkProbe::exec(MegaClient* client)
+{
+    if (!running())
+    {
+        return false;
+    }
+
+    Endpoint& e = targets[current];
+
+    if (req)
+    {
+        if (req->status == REQ_INFLIGHT && Waiter::ds - sentds < PING_TIMEOUT_DS)
+        {
+            return false;
+        }
+
+        // any reply will do, only its timing matters
+        if (req->status != REQ_INFLIGHT && req->httpstatus)
+        {
+            double rtt = req->ttfbms >= 0 ? req->ttfbms : (Waiter::ds - sentds) * 100.0;
+            unsigned replies = e.sent - e.lost;
+            e.rttms += (rtt - e.rttms) / replies;
+        }
+        else
+        {
+            e.lost++;
+        }
+
+        req->disconnect();
+        req.reset();
+
+        if (e.sent == PINGS)
+        {
+            LOG_debug << "Network probe of " << e.url << ": " << e.lost << "/" << e.sent << " lost, " << e.rttms << " ms";
+            if (++current == targets.size())
+            {
+                return true;
+            }
+            return exec(client);
+        }
+    }
+
+    req.reset(new HttpReq());
+    req->logname = client->clientname + "probe ";
+    req->posturl = targets[current].url;
+    req->out->assign("[]");
+    req->type = REQ_JSON;
+    req->post(client);
+    targets[current].sent++;
+    sentds = Waiter::ds;
+    return false;
+}
+
+NetworkProbe::Profile NetworkProbe::tune(double rttms, double loss, double bandwidth, bool altportonly, unsigned maxtransfers)
+{
+    Profile p;
+    p.rttms = rttms;
+    p.loss = loss;
+    p.bandwidth = bandwidth;
+    p.measured = m_time();
+    p.altport = altportonly;
+
+    // what one TCP connection sustains (Mathis et al.), assuming a floor of loss that real links always have
+    double perconnection = 1460 * 1.22 / (std::max(rttms, 1.0) / 1000 * std::sqrt(std::max(loss, 0.0001)));
+
+    if (bandwidth > 0)
+    {
+        p.connections = unsigned(std::min<double>(MegaClient::MAX_NUM_CONNECTIONS, std::max(1.0, std::ceil(bandwidth / perconnection))));
+
+        // about two seconds of data per request: fewer round trips without long stalls after an error
+        m_off_t size = 1048576;
+        while (size < 16777216 && size * 2 <= 2 * bandwidth / p.connections)
+        {
+            size *= 2;
+        }
+        p.requestsize = size;
+    }
+    else if (rttms >= 150 || loss >= 0.01)
+    {
+        p.connections = MegaClient::MAX_NUM_CONNECTIONS;
+    }
+
+    if (bandwidth > 0 && bandwidth < 1048576)
+    {
+        // a slow link is better spent finishing files than spreading over many
+        p.transfers = 8;
+    }
+    else if (rttms >= 200)
+    {
+        // every file costs several round trips to the API: overlap them
+        p.transfers = maxtransfers;
+    }
+
+    return p;
+}
+
+void NetworkProbe::Profile::serialize(string* data) const
+{
+    data->clear();
+    CacheableWriter w(*data);
+    w.serializeu32(connections);
+    w.serializeu32(transfers);
+    w.serializei64(requestsize);
+    w.serializebool(altport);
+    w.serializedouble(rttms);
+    w.serializedouble(loss);
+    w.serializedouble(bandwidth);
+    w.serializei64(measured);
+    w.serializeexpansionflags();
+}
+
+bool NetworkProbe::Profile::unserialize(const string& data)
+{
+    CacheableReader r(data);
+    unsigned char expansions[8];
+    return r.unserializeu32(connections)
+        && r.unserializeu32(transfers)
+        && r.unserializei64(requestsize)
+        && r.unserializebool(altport)
+        && r.unserializedouble(rttms)
+        && r.unserializedouble(loss)
+        && r.unserializedouble(bandwidth)
+        && r.unserializei64(measured)
+        && r.unserializeexpansionflags(expansions, 0);
+}
+
+string NetworkProbe::Profile::json() const
+{
+    ostringstream s;
+    s << "{\"connections\":" << connections
+      << ",\"transfers\":" << transfers
+      << ",\"requestSize\":" << requestsize
+      << ",\"altPort\":" << (altport ? "true" : "false")
+      << ",\"rttMs\":" << int(rttms)
+      << ",\"lossPercent\":" << int(loss * 100)
+      << ",\"bandwidth\":" << m_off_t(bandwidth)
+      << ",\"measured\":" << measured << "}";
+    return s.str();
+}
+
 } // namespace
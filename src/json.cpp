@@ -28,10 +28,28 @@ namespace mega {
 // store array or object in string s
 // reposition after object
 bool JSON::storeobject(string* s)
+{
+    JSONView v;
+
+    if (!storeobjectView(&v))
+    {
+        return false;
+    }
+
+    if (s)
+    {
+        s->assign(v.data, v.size);
+    }
+
+    return true;
+}
+
+// delimit array or object in v
+// reposition after object
+bool JSON::storeobjectView(JSONView* v)
 {
     int openobject[2] = { 0 };
     const char* ptr;
-    bool escaped = false;
 
     while (*(const signed char*)pos > 0 && *pos <= ' ')
     {
@@ -66,18 +84,28 @@ bool JSON::storeobject(string* s)
         }
         else if (*ptr == '"')
         {
-            ptr++;
+            // hop from quote to quote (strchr scans far faster than a byte-at-a-time loop),
+            // until one is not escaped by an odd number of backslashes
+            const char* open = ptr;
 
-            while (*ptr && (escaped || *ptr != '"'))
+            for (;;)
             {
-                escaped = *ptr == '\\' && !escaped;
-                ptr++;
-            }
+                if (!(ptr = strchr(ptr + 1, '"')))
+                {
+                    LOG_err << "Parse error (\")";
+                    return false;
+                }
 
-            if (!*ptr)
-            {
-                LOG_err << "Parse error (\")";
-                return false;
+                const char* backslash = ptr;
+                while (backslash - 1 > open && backslash[-1] == '\\')
+                {
+                    backslash--;
+                }
+
+                if (!((ptr - backslash) & 1))
+                {
+                    break;
+                }
             }
         }
         else if ((*ptr >= '0' && *ptr <= '9') || *ptr == '-' || *ptr == '.')
@@ -101,15 +129,17 @@ bool JSON::storeobject(string* s)
 
         if (!openobject[0] && !openobject[1])
         {
-            if (s)
+            if (v)
             {
                 if (*pos == '"')
                 {
-                    s->assign(pos + 1, ptr - pos - 2);
+                    v->data = pos + 1;
+                    v->size = ptr - pos - 2;
                 }
                 else
                 {
-                    s->assign(pos, ptr - pos);
+                    v->data = pos;
+                    v->size = ptr - pos;
                 }
             }
 
@@ -149,9 +179,14 @@ nameid JSON::getnameid(const char* ptr) const
 }
 
 std::string JSON::getname()
+{
+    return getnameView().str();
+}
+
+JSONView JSON::getnameView()
 {
     const char* ptr = pos;
-    string name;
+    JSONView name;
 
     if (*ptr == ',' || *ptr == ':')
     {
@@ -160,12 +195,14 @@ std::string JSON::getname()
 
     if (*ptr++ == '"')
     {
+        name.data = ptr;
+
         while (*ptr && *ptr != '"')
         {
-            name += *ptr;
             ptr++;
         }
 
+        name.size = ptr - name.data;
         pos = ptr + 2;
     }
 
@@ -270,7 +307,7 @@ bool JSON::storebinary(string* dst)
         }
 
         dst->resize((ptr - pos - 1) / 4 * 3 + 3);
-        dst->resize(Base64::atob(pos + 1, (byte*)dst->data(), int(dst->size())));
+        dst->resize(Base64::atob(pos + 1, size_t(ptr - pos - 1), (byte*)dst->data(), int(dst->size())));
 
         // skip string
         storeobject();
@@ -397,6 +434,20 @@ const char* JSON::getvalue()
     return r;
 }
 
+JSONView JSON::getvalueView()
+{
+    JSONView v;
+
+    if (*pos == ':')
+    {
+        pos++;
+    }
+
+    storeobjectView(&v);
+
+    return v;
+}
+
 // try to to enter array
 bool JSON::enterarray()
 {
@@ -567,4 +618,84 @@ void JSON::begin(const char* json)
 {
     pos = json;
 }
+
+void JSONArrayScanner::reset()
+{
+    mScanned = 0;
+    mDepth = 0;
+    mInString = false;
+    mEscape = false;
+    mFinished = false;
+    mFailed = false;
+}
+
+size_t JSONArrayScanner::feed(const char* data, size_t len, const std::function<bool(const char*, size_t)>& element)
+{
+    size_t consumed = 0;
+    size_t i = mScanned;
+
+    for (; i < len && !mFinished && !mFailed; i++)
+    {
+        char c = data[i];
+
+        if (mInString)
+        {
+            if (mEscape)
+            {
+                mEscape = false;
+            }
+            else if (c == '\\')
+            {
+                mEscape = true;
+            }
+            else if (c == '"')
+            {
+                mInString = false;
+            }
+        }
+        else if (c == '"')
+        {
+            mInString = true;
+        }
+        else if (c == '{' || c == '[')
+        {
+            mDepth++;
+        }
+        else if (mDepth)
+        {
+            if ((c == '}' || c == ']') && !--mDepth)
+            {
+                // objects and arrays are complete at their end, without waiting for the separator
+                if (!element(data + consumed, i + 1 - consumed))
+                {
+                    mFailed = true;
+                    break;
+                }
+
+                consumed = i + 1;
+            }
+        }
+        else if (c == ',' || c == ']')
+        {
+            // an element ends at the next separator at array level
+            if (i > consumed && !element(data + consumed, i - consumed))
+            {
+                mFailed = true;
+                break;
+            }
+
+            consumed = i + 1;
+            mFinished = c == ']';
+        }
+        else if (c == '}')
+        {
+            LOG_err << "Parse error (unbalanced '}' in array)";
+            mFailed = true;
+        }
+    }
+
+    mScanned = i - consumed;
+    return consumed;
+}
+
 } // namespace
@@ -28,6 +28,7 @@
 
 #include "mega/logging.h"
 
+#include <chrono>
 #include <ctime>
 
 #if defined(WINDOWS_PHONE)
@@ -102,4 +103,626 @@ void SimpleLogger::setAllOutputs(std::ostream *os)
 }
 #endif
 
+namespace {
+std::atomic<unsigned> nextLogThread(1);
+thread_local unsigned logThread = 0;
+
+// set while an AsyncLogger delivers a message
+thread_local const LogOrigin* deliveredOrigin = nullptr;
+}
+
+LogOrigin LogOrigin::current()
+{
+    if (deliveredOrigin)
+    {
+        return *deliveredOrigin;
+    }
+
+    if (!logThread)
+    {
+        logThread = nextLogThread++;
+    }
+
+    LogOrigin origin;
+    origin.thread = logThread;
+    origin.timeus = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    return origin;
+}
+
+AsyncLogger::AsyncLogger(Logger* t, unsigned limit, size_t capacity)
+    : target(t)
+    , ratelimit(limit)
+{
+    size_t size = 2;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    mask = size - 1;
+
+    cells.reset(new Cell[size]);
+    for (size_t i = 0; i < size; i++)
+    {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    for (auto& site : sites)
+    {
+        site.store(0, std::memory_order_relaxed);
+    }
+
+    start();
+}
+
+AsyncLogger::~AsyncLogger()
+{
+    stop();
+}
+
+void AsyncLogger::start()
+{
+    std::lock_guard<std::mutex> g(mutex);
+    if (!thread.joinable())
+    {
+        running = true;
+        thread = std::thread(&AsyncLogger::loop, this);
+    }
+}
+
+void AsyncLogger::stop()
+{
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        running = false;
+        cv.notify_one();
+    }
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+
+    // messages queued by threads that saw it running
+    Record r;
+    while (pop(r))
+    {
+        deliver(r);
+    }
+}
+
+void AsyncLogger::setratelimit(unsigned perSecond)
+{
+    ratelimit = perSecond;
+}
+
+AsyncLogger::Stats AsyncLogger::stats() const
+{
+    Stats s;
+    s.delivered = delivered;
+    s.ratelimited = ratelimited;
+    s.queuefull = queuefull;
+    return s;
+}
+
+void AsyncLogger::log(const char *time, int loglevel, const char *source, const char *message
+#ifdef ENABLE_LOG_PERFORMANCE
+                      , const char **directMessages, size_t *directMessagesSizes, int numberMessages
+#endif
+                      )
+{
+    if (!running)
+    {
+        target->log(time, loglevel, source, message
+#ifdef ENABLE_LOG_PERFORMANCE
+                    , directMessages, directMessagesSizes, numberMessages
+#endif
+                    );
+        return;
+    }
+
+    Record r;
+    r.level = loglevel;
+    r.origin = LogOrigin::current();
+    r.message = message ? message : "";
+#ifdef ENABLE_LOG_PERFORMANCE
+    for (int i = 0; i < numberMessages; i++)
+    {
+        r.message.append(directMessages[i], directMessagesSizes[i]);
+    }
+#endif
+
+    if (!allowed(loglevel, source, r.message.c_str()))
+    {
+        ratelimited++;
+        return;
+    }
+
+    strncpy(r.time, time ? time : "", sizeof r.time - 1);
+    r.time[sizeof r.time - 1] = '\0';
+    strncpy(r.source, source ? source : "", sizeof r.source - 1);
+    r.source[sizeof r.source - 1] = '\0';
+
+    if (!push(std::move(r)))
+    {
+        queuefull++;
+        return;
+    }
+
+    // under load the background thread doesn't sleep, and this costs no lock
+    if (sleeping.load(std::memory_order_relaxed) && sleeping.exchange(false))
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        cv.notify_one();
+    }
+
+    if (loglevel == logFatal)
+    {
+        flush();
+    }
+}
+
+bool AsyncLogger::allowed(int loglevel, const char* source, const char* message)
+{
+    unsigned limit = ratelimit.load(std::memory_order_relaxed);
+    if (loglevel <= logWarning || !limit)
+    {
+        return true;
+    }
+
+    // the call site is the "file:line" source, which performance mode appends to the message as " [file:line]"
+    const char* site = source && *source ? source : strrchr(message, '[');
+    uint32_t hash = 2166136261u;
+    for (const char* c = site ? site : ""; *c; c++)
+    {
+        hash = (hash ^ uint8_t(*c)) * 16777619u;
+    }
+
+    uint64_t second = uint64_t(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count()) & 0xFFFFFFFF;
+    std::atomic<uint64_t>& slot = sites[hash % SITES];
+    uint64_t value = slot.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        uint64_t updated;
+        if (value >> 32 != second)
+        {
+            updated = second << 32 | 1;
+        }
+        else if ((value & 0xFFFFFFFF) >= limit)
+        {
+            return false;
+        }
+        else
+        {
+            updated = value + 1;
+        }
+
+        if (slot.compare_exchange_weak(value, updated, std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+}
+
+// bounded multi-producer queue with a sequence number per cell (D. Vyukov); single consumer
+bool AsyncLogger::push(Record&& r)
+{
+    size_t pos = enqueuepos.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;)
+    {
+        cell = &cells[pos & mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+        if (!diff)
+        {
+            if (enqueuepos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = enqueuepos.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->record = std::move(r);
+    pushed++;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool AsyncLogger::pop(Record& r)
+{
+    Cell& cell = cells[dequeuepos & mask];
+    if (cell.sequence.load(std::memory_order_acquire) != dequeuepos + 1)
+    {
+        return false;
+    }
+
+    r = std::move(cell.record);
+    cell.sequence.store(dequeuepos + mask + 1, std::memory_order_release);
+    dequeuepos++;
+    return true;
+}
+
+bool AsyncLogger::empty() const
+{
+    return cells[dequeuepos & mask].sequence.load(std::memory_order_acquire) != dequeuepos + 1;
+}
+
+void AsyncLogger::deliver(const Record& r)
+{
+    deliveredOrigin = &r.origin;
+    target->log(r.time[0] ? r.time : nullptr, r.level, r.source[0] ? r.source : nullptr, r.message.c_str());
+    deliveredOrigin = nullptr;
+    delivered++;
+}
+
+void AsyncLogger::flush()
+{
+    if (std::this_thread::get_id() == thread.get_id())
+    {
+        return;
+    }
+
+    uint64_t target = pushed.load();
+    std::unique_lock<std::mutex> g(mutex);
+    while (delivered.load() < target && running)
+    {
+        cv.notify_one();
+        drained.wait_for(g, std::chrono::milliseconds(10));
+    }
+}
+
+void AsyncLogger::loop()
+{
+    auto lastreport = std::chrono::steady_clock::now();
+    Record r;
+
+    for (;;)
+    {
+        while (pop(r))
+        {
+            deliver(r);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastreport >= std::chrono::seconds(1)
+                && (ratelimited != reportedratelimited || queuefull != reportedqueuefull))
+        {
+            uint64_t limited = ratelimited, full = queuefull;
+            Record report;
+            report.level = logWarning;
+            report.origin = LogOrigin::current();
+            report.message = "Async logging dropped " + std::to_string(limited - reportedratelimited) + " rate limited and "
+                           + std::to_string(full - reportedqueuefull) + " overflowing messages";
+            report.source[0] = '\0';
+            time_t t = std::time(NULL);
+            if (!std::strftime(report.time, sizeof report.time, "%H:%M:%S", std::gmtime(&t)))
+            {
+                report.time[0] = '\0';
+            }
+            deliver(report);
+            reportedratelimited = limited;
+            reportedqueuefull = full;
+            lastreport = now;
+        }
+
+        std::unique_lock<std::mutex> g(mutex);
+        drained.notify_all();
+        if (!running)
+        {
+            break;
+        }
+
+        sleeping = true;
+        if (empty())
+        {
+            cv.wait_for(g, std::chrono::milliseconds(100));
+        }
+        sleeping = false;
+    }
+}
+
+namespace {
+
+// binary log records
+enum : char { BINLOG_SOURCE = 1, BINLOG_TEMPLATE = 2, BINLOG_ENTRY = 3 };
+
+// arguments of a template, which marks their places with '\x01'
+enum : char { BINLOG_NUMBER = 0, BINLOG_WORD = 1 };
+
+void putvarint(std::string& s, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        s.push_back(char(v | 0x80));
+        v >>= 7;
+    }
+    s.push_back(char(v));
+}
+
+void putstring(std::string& s, const char* data, size_t len)
+{
+    putvarint(s, len);
+    s.append(data, len);
+}
+
+bool getvarint(std::istream& in, uint64_t& v)
+{
+    v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        int c = in.get();
+        if (c == EOF)
+        {
+            return false;
+        }
+        v |= uint64_t(c & 0x7F) << shift;
+        if (!(c & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool getstring(std::istream& in, std::string& s)
+{
+    uint64_t len;
+    if (!getvarint(in, len) || len > (1u << 30))
+    {
+        return false;
+    }
+    s.resize(size_t(len));
+    return len == 0 || bool(in.read(&s[0], std::streamsize(len)));
+}
+
+bool wordchar(char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '-';
+}
+
+uint64_t zigzag(int64_t v)
+{
+    return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+
+int64_t unzigzag(uint64_t v)
+{
+    return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
+
+} // anonymous
+
+const char BinaryLogger::MAGIC[8] = { 'M', 'E', 'G', 'A', 'B', 'L', 'G', '1' };
+
+BinaryLogger::BinaryLogger(std::ostream& o)
+    : out(o)
+{
+    out.write(MAGIC, sizeof MAGIC);
+}
+
+uint64_t BinaryLogger::intern(std::unordered_map<std::string, uint64_t>& table, const std::string& s, char tag)
+{
+    auto it = table.find(s);
+    if (it != table.end())
+    {
+        return it->second;
+    }
+
+    // 0 means none
+    uint64_t id = table.size() + 1;
+    table.emplace(s, id);
+    record.push_back(tag);
+    putvarint(record, id);
+    putstring(record, s.data(), s.size());
+    return id;
+}
+
+void BinaryLogger::log(const char *, int loglevel, const char *source, const char *message
+#ifdef ENABLE_LOG_PERFORMANCE
+                       , const char **directMessages, size_t *directMessagesSizes, int numberMessages
+#endif
+                       )
+{
+    std::string text = message ? message : "";
+#ifdef ENABLE_LOG_PERFORMANCE
+    for (int i = 0; i < numberMessages; i++)
+    {
+        text.append(directMessages[i], directMessagesSizes[i]);
+    }
+#endif
+
+    // performance mode appends the source as " [file:line]"
+    std::string site = source ? source : "";
+    if (site.empty() && !text.empty() && text.back() == ']')
+    {
+        size_t open = text.rfind(" [");
+        if (open != std::string::npos)
+        {
+            site = text.substr(open + 2, text.size() - open - 3);
+            text.resize(open);
+        }
+    }
+
+    LogOrigin origin = LogOrigin::current();
+
+    std::lock_guard<std::mutex> g(mutex);
+    record.clear();
+
+    uint64_t sourceid = site.empty() ? 0 : intern(sources, site, BINLOG_SOURCE);
+
+    pattern.clear();
+    args.clear();
+    bool templated = text.size() <= MAXTEMPLATELENGTH && text.find('\x01') == std::string::npos;
+    for (size_t i = 0; templated && i < text.size(); )
+    {
+        if (!wordchar(text[i]))
+        {
+            pattern.push_back(text[i++]);
+            continue;
+        }
+
+        size_t end = i;
+        bool digits = false, numeric = true;
+        while (end < text.size() && wordchar(text[end]))
+        {
+            bool digit = text[end] >= '0' && text[end] <= '9';
+            digits |= digit;
+            numeric &= digit;
+            end++;
+        }
+
+        if (!digits)
+        {
+            pattern.append(text, i, end - i);
+        }
+        else if (numeric && end - i <= 18 && (text[i] != '0' || end - i == 1))
+        {
+            pattern.push_back('\x01');
+            args.push_back(BINLOG_NUMBER);
+            putvarint(args, std::stoull(text.substr(i, end - i)));
+        }
+        else
+        {
+            pattern.push_back('\x01');
+            args.push_back(BINLOG_WORD);
+            putstring(args, text.data() + i, end - i);
+        }
+        i = end;
+    }
+    templated &= templates.size() < MAXTEMPLATES || templates.count(pattern);
+
+    uint64_t templateid = templated ? intern(templates, pattern, BINLOG_TEMPLATE) : 0;
+
+    record.push_back(BINLOG_ENTRY);
+    putvarint(record, zigzag(origin.timeus - lasttimeus));
+    lasttimeus = origin.timeus;
+    putvarint(record, origin.thread);
+    putvarint(record, uint64_t(loglevel));
+    putvarint(record, sourceid);
+    putvarint(record, templateid);
+    if (templated)
+    {
+        record.append(args);
+    }
+    else
+    {
+        putstring(record, text.data(), text.size());
+    }
+
+    out.write(record.data(), std::streamsize(record.size()));
+}
+
+BinaryLogReader::BinaryLogReader(std::istream& i)
+    : in(i)
+{
+    char magic[sizeof BinaryLogger::MAGIC];
+    header = in.read(magic, sizeof magic) && !memcmp(magic, BinaryLogger::MAGIC, sizeof magic);
+}
+
+bool BinaryLogReader::valid() const
+{
+    return header;
+}
+
+bool BinaryLogReader::next(Entry& e)
+{
+    if (!header)
+    {
+        return false;
+    }
+
+    for (;;)
+    {
+        int tag = in.get();
+        uint64_t id;
+        std::string s;
+
+        if (tag == BINLOG_SOURCE || tag == BINLOG_TEMPLATE)
+        {
+            std::vector<std::string>& table = tag == BINLOG_SOURCE ? sources : templates;
+            if (!getvarint(in, id) || id != table.size() + 1 || !getstring(in, s))
+            {
+                return false;
+            }
+            table.push_back(std::move(s));
+            continue;
+        }
+
+        if (tag != BINLOG_ENTRY)
+        {
+            return false;
+        }
+
+        uint64_t delta, thread, level, sourceid, templateid;
+        if (!getvarint(in, delta) || !getvarint(in, thread) || !getvarint(in, level)
+                || !getvarint(in, sourceid) || !getvarint(in, templateid)
+                || sourceid > sources.size() || templateid > templates.size())
+        {
+            return false;
+        }
+
+        lasttimeus += unzigzag(delta);
+        e.timeus = lasttimeus;
+        e.thread = unsigned(thread);
+        e.level = int(level);
+        e.source = sourceid ? sources[sourceid - 1] : std::string();
+        e.message.clear();
+
+        if (!templateid)
+        {
+            return getstring(in, e.message);
+        }
+
+        for (char c : templates[templateid - 1])
+        {
+            if (c != '\x01')
+            {
+                e.message.push_back(c);
+                continue;
+            }
+
+            int type = in.get();
+            if (type == BINLOG_NUMBER && getvarint(in, id))
+            {
+                e.message += std::to_string(id);
+            }
+            else if (type == BINLOG_WORD && getstring(in, s))
+            {
+                e.message += s;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+std::string BinaryLogReader::Entry::render() const
+{
+    time_t seconds = time_t(timeus / 1000000);
+    char ts[16];
+    if (!std::strftime(ts, sizeof ts, "%H:%M:%S", std::gmtime(&seconds)))
+    {
+        ts[0] = '\0';
+    }
+    char us[8];
+    snprintf(us, sizeof us, ".%06d", int(timeus % 1000000));
+
+    std::string s = std::string(ts) + us + " t" + std::to_string(thread) + " "
+                  + SimpleLogger::toStr(LogLevel(level < 0 || level > logMax ? logMax : level)) + " " + message;
+    if (!source.empty())
+    {
+        s += " [" + source + "]";
+    }
+    return s;
+}
+
 } // namespace
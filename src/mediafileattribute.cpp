@@ -638,14 +638,10 @@ bool MediaFileInfo::timeToRetryMediaPropertyExtraction(const std::string& fileat
     return false;
 }
 
-bool mediaInfoOpenFileWithLimits(MediaInfoLib::MediaInfo& mi, std::string filename, FileAccess* fa, unsigned maxBytesToRead, unsigned maxSeconds)
+// feed MediaInfo from a file already open for reading, following its requests to seek
+// (eg. to an index at the end of the file) rather than reading everything in between
+static bool mediaInfoReadWithLimits(MediaInfoLib::MediaInfo& mi, FileAccess* fa, unsigned maxBytesToRead, unsigned maxSeconds)
 {
-    if (!fa->fopen(&filename, true, false))
-    {
-        LOG_err << "could not open local file for mediainfo";
-        return false;
-    }
-
     m_off_t filesize = fa->size; 
     size_t totalBytesRead = 0, jumps = 0;
     mi.Open_Buffer_Init(filesize, 0);
@@ -666,7 +662,6 @@ bool mediaInfoOpenFileWithLimits(MediaInfoLib::MediaInfo& mi, std::string filena
         {
             LOG_warn << "could not extract mediainfo data within reasonable limits";
             mi.Open_Buffer_Finalize();
-            fa->closef();
             return false;
         }
 
@@ -674,7 +669,6 @@ bool mediaInfoOpenFileWithLimits(MediaInfoLib::MediaInfo& mi, std::string filena
         {
             LOG_err << "could not read local file";
             mi.Open_Buffer_Finalize();
-            fa->closef();
             return false;
         }
         readpos += n;
@@ -718,102 +712,130 @@ bool mediaInfoOpenFileWithLimits(MediaInfoLib::MediaInfo& mi, std::string filena
     }
 
     mi.Open_Buffer_Finalize();
-    fa->closef();
     return true;
 }
 
+bool mediaInfoOpenFileWithLimits(MediaInfoLib::MediaInfo& mi, std::string filename, FileAccess* fa, unsigned maxBytesToRead, unsigned maxSeconds)
+{
+    if (!fa->fopen(&filename, true, false))
+    {
+        LOG_err << "could not open local file for mediainfo";
+        return false;
+    }
+
+    bool read = mediaInfoReadWithLimits(mi, fa, maxBytesToRead, maxSeconds);
+    fa->closef();
+    return read;
+}
+
 void MediaProperties::extractMediaPropertyFileAttributes(const std::string& localFilename, FileSystemAccess* fsa)
 {
     if (auto tmpfa = fsa->newfileaccess())
     {
-        try
+        string local = localFilename;
+        if (!tmpfa->fopen(&local, true, false))
+        {
+            LOG_err << "could not open local file for mediainfo";
+            return;
+        }
+
+        string path;
+        if (SimpleLogger::logCurrentLevel >= logDebug)
         {
-            MediaInfoLib::MediaInfo minfo;
+            fsa->local2path(&local, &path);
+        }
+
+        extractMediaPropertyFileAttributes(tmpfa.get(), path);
+    }
+}
+
+void MediaProperties::extractMediaPropertyFileAttributes(FileAccess* fa, const std::string& path)
+{
+    try
+    {
+        MediaInfoLib::MediaInfo minfo;
 
-            if (mediaInfoOpenFileWithLimits(minfo, localFilename, tmpfa.get(), 10485760, 3))  // we can read more off local disk
+        if (mediaInfoReadWithLimits(minfo, fa, 10485760, 3))  // we can read more off local disk
+        {
+            if (!minfo.Count_Get(MediaInfoLib::Stream_General, 0))
             {
-                if (!minfo.Count_Get(MediaInfoLib::Stream_General, 0))
-                {
-                    LOG_warn << "mediainfo: no general information found in file";
-                }
-                if (!minfo.Count_Get(MediaInfoLib::Stream_Video, 0))
-                {
-                    LOG_warn << "mediainfo: no video information found in file";
-                }
-                if (!minfo.Count_Get(MediaInfoLib::Stream_Audio, 0))
-                {
-                    LOG_warn << "mediainfo: no audio information found in file";
-                    no_audio = true;
-                }
+                LOG_warn << "mediainfo: no general information found in file";
+            }
+            if (!minfo.Count_Get(MediaInfoLib::Stream_Video, 0))
+            {
+                LOG_warn << "mediainfo: no video information found in file";
+            }
+            if (!minfo.Count_Get(MediaInfoLib::Stream_Audio, 0))
+            {
+                LOG_warn << "mediainfo: no audio information found in file";
+                no_audio = true;
+            }
 
-                ZenLib::Ztring gci = minfo.Get(MediaInfoLib::Stream_General, 0, __T("CodecID"), MediaInfoLib::Info_Text);
-                ZenLib::Ztring gf = minfo.Get(MediaInfoLib::Stream_General, 0, __T("Format"), MediaInfoLib::Info_Text);
-                ZenLib::Ztring gd = minfo.Get(MediaInfoLib::Stream_General, 0, __T("Duration"), MediaInfoLib::Info_Text);
-                ZenLib::Ztring vw = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("Width"), MediaInfoLib::Info_Text);
-                ZenLib::Ztring vh = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("Height"), MediaInfoLib::Info_Text);
-                ZenLib::Ztring vd = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("Duration"), MediaInfoLib::Info_Text);
-                ZenLib::Ztring vfr = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("FrameRate"), MediaInfoLib::Info_Text);
-                ZenLib::Ztring vrm = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("FrameRate_Mode"), MediaInfoLib::Info_Text);
-                ZenLib::Ztring vci = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("CodecID"), MediaInfoLib::Info_Text);
-                ZenLib::Ztring vcf = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("Format"), MediaInfoLib::Info_Text);
-                ZenLib::Ztring vr = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("Rotation"), MediaInfoLib::Info_Text);
-                ZenLib::Ztring aci = minfo.Get(MediaInfoLib::Stream_Audio, 0, __T("CodecID"), MediaInfoLib::Info_Text);
-                ZenLib::Ztring acf = minfo.Get(MediaInfoLib::Stream_Audio, 0, __T("Format"), MediaInfoLib::Info_Text);
-                ZenLib::Ztring ad = minfo.Get(MediaInfoLib::Stream_Audio, 0, __T("Duration"), MediaInfoLib::Info_Text);
-
-                if (vr.To_int32u() == 90 || vr.To_int32u() == 270)
-                {
-                    width = vh.To_int32u();
-                    height = vw.To_int32u();
-                }
-                else
-                {
-                    width = vw.To_int32u();
-                    height = vh.To_int32u();
-                }
-                
-                fps = vfr.To_int32u();
-                playtime = (coalesce(gd.To_int32u(), coalesce(vd.To_int32u(), ad.To_int32u()))) / 1000;
-                videocodecNames = vci.To_Local();
-                videocodecFormat = vcf.To_Local();
-                audiocodecNames = aci.To_Local();
-                audiocodecFormat = acf.To_Local();
-                containerName = gci.To_Local(); 
-                containerFormat = gf.To_Local();
-                is_VFR = vrm.To_Local() == "VFR"; // variable frame rate - send through as 0 in fps field
-                if (!fps)
-                {
-                    ZenLib::Ztring vrn = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("FrameRate_Num"), MediaInfoLib::Info_Text);
-                    ZenLib::Ztring vrd = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("FrameRate_Den"), MediaInfoLib::Info_Text);
-                    uint32_t num = vrn.To_int32u();
-                    uint32_t den = vrd.To_int32u();
-                    if (num > 0 && den > 0)
-                    {
-                        fps = (num + den / 2) / den;
-                    }
-                }
-                if (!fps)
+            ZenLib::Ztring gci = minfo.Get(MediaInfoLib::Stream_General, 0, __T("CodecID"), MediaInfoLib::Info_Text);
+            ZenLib::Ztring gf = minfo.Get(MediaInfoLib::Stream_General, 0, __T("Format"), MediaInfoLib::Info_Text);
+            ZenLib::Ztring gd = minfo.Get(MediaInfoLib::Stream_General, 0, __T("Duration"), MediaInfoLib::Info_Text);
+            ZenLib::Ztring vw = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("Width"), MediaInfoLib::Info_Text);
+            ZenLib::Ztring vh = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("Height"), MediaInfoLib::Info_Text);
+            ZenLib::Ztring vd = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("Duration"), MediaInfoLib::Info_Text);
+            ZenLib::Ztring vfr = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("FrameRate"), MediaInfoLib::Info_Text);
+            ZenLib::Ztring vrm = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("FrameRate_Mode"), MediaInfoLib::Info_Text);
+            ZenLib::Ztring vci = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("CodecID"), MediaInfoLib::Info_Text);
+            ZenLib::Ztring vcf = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("Format"), MediaInfoLib::Info_Text);
+            ZenLib::Ztring vr = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("Rotation"), MediaInfoLib::Info_Text);
+            ZenLib::Ztring aci = minfo.Get(MediaInfoLib::Stream_Audio, 0, __T("CodecID"), MediaInfoLib::Info_Text);
+            ZenLib::Ztring acf = minfo.Get(MediaInfoLib::Stream_Audio, 0, __T("Format"), MediaInfoLib::Info_Text);
+            ZenLib::Ztring ad = minfo.Get(MediaInfoLib::Stream_Audio, 0, __T("Duration"), MediaInfoLib::Info_Text);
+
+            if (vr.To_int32u() == 90 || vr.To_int32u() == 270)
+            {
+                width = vh.To_int32u();
+                height = vw.To_int32u();
+            }
+            else
+            {
+                width = vw.To_int32u();
+                height = vh.To_int32u();
+            }
+            
+            fps = vfr.To_int32u();
+            playtime = (coalesce(gd.To_int32u(), coalesce(vd.To_int32u(), ad.To_int32u()))) / 1000;
+            videocodecNames = vci.To_Local();
+            videocodecFormat = vcf.To_Local();
+            audiocodecNames = aci.To_Local();
+            audiocodecFormat = acf.To_Local();
+            containerName = gci.To_Local(); 
+            containerFormat = gf.To_Local();
+            is_VFR = vrm.To_Local() == "VFR"; // variable frame rate - send through as 0 in fps field
+            if (!fps)
+            {
+                ZenLib::Ztring vrn = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("FrameRate_Num"), MediaInfoLib::Info_Text);
+                ZenLib::Ztring vrd = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("FrameRate_Den"), MediaInfoLib::Info_Text);
+                uint32_t num = vrn.To_int32u();
+                uint32_t den = vrd.To_int32u();
+                if (num > 0 && den > 0)
                 {
-                    ZenLib::Ztring vro = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("FrameRate_Original"), MediaInfoLib::Info_Text);
-                    fps = vro.To_int32u();
+                    fps = (num + den / 2) / den;
                 }
+            }
+            if (!fps)
+            {
+                ZenLib::Ztring vro = minfo.Get(MediaInfoLib::Stream_Video, 0, __T("FrameRate_Original"), MediaInfoLib::Info_Text);
+                fps = vro.To_int32u();
+            }
 
-                if (SimpleLogger::logCurrentLevel >= logDebug)
-                {
-                    string path, local = localFilename;
-                    fsa->local2path(&local, &path);
-                    LOG_debug << "MediaInfo on " << path << " | " << vw.To_Local() << " " << vh.To_Local() << " " << vd.To_Local() << " " << vr.To_Local() << " |\"" << gci.To_Local() << "\",\"" << gf.To_Local() << "\",\"" << vci.To_Local() << "\",\"" << vcf.To_Local() << "\",\"" << aci.To_Local() << "\",\"" << acf.To_Local() << "\"";
-                }
+            if (SimpleLogger::logCurrentLevel >= logDebug)
+            {
+                LOG_debug << "MediaInfo on " << path << " | " << vw.To_Local() << " " << vh.To_Local() << " " << vd.To_Local() << " " << vr.To_Local() << " |\"" << gci.To_Local() << "\",\"" << gf.To_Local() << "\",\"" << vci.To_Local() << "\",\"" << vcf.To_Local() << "\",\"" << aci.To_Local() << "\",\"" << acf.To_Local() << "\"";
             }
         }
-        catch (std::exception& e)
-        {
-            LOG_err << "exception caught reading media file attibutes: " << e.what();
-        }
-        catch (...)
-        {
-            LOG_err << "unknown excption caught reading media file attributes";
-        }
+    }
+    catch (std::exception& e)
+    {
+        LOG_err << "exception caught reading media file attibutes: " << e.what();
+    }
+    catch (...)
+    {
+        LOG_err << "unknown excption caught reading media file attributes";
     }
 }
 
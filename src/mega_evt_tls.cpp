@@ -85,8 +85,7 @@ evt_tls_t *evt_ctx_get_tls(evt_ctx_t *d_eng)
     }
     con->ssl = ssl;
 
-    //use default buf size for now.
-    r = BIO_new_bio_pair(&(con->ssl_bio), 0, &(con->app_bio), 0);
+    r = BIO_new_bio_pair(&(con->ssl_bio), EVT_TLS_BIO_SIZE, &(con->app_bio), EVT_TLS_BIO_SIZE);
     if (r != 1) {
         //order is important
         SSL_free(ssl);
@@ -192,6 +191,13 @@ int evt_ctx_init(evt_ctx_t *tls)
         | SSL_MODE_ENABLE_PARTIAL_WRITE );
 #endif
 
+    //resumption skips the key exchange of the many short connections of media players:
+    //from the session cache of this context, or from tickets (see evt_ctx_set_ticket_keys)
+    static const unsigned char sid_ctx[] = "mega_evt_tls";
+    SSL_CTX_set_session_cache_mode(tls->ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(tls->ctx, sid_ctx, sizeof(sid_ctx) - 1);
+    SSL_CTX_set_timeout(tls->ctx, EVT_TLS_SESSION_TIMEOUT);
+
     tls->cert_set = 0;
     tls->key_set = 0;
     tls->ssl_err_ = 0;
@@ -210,6 +216,16 @@ int evt_ctx_init_ex(evt_ctx_t *tls, const char *crtf, const char *key)
     return evt_ctx_set_crt_key(tls, crtf, key);
 }
 
+int evt_ctx_set_ticket_keys(evt_ctx_t *tls, const unsigned char *keys)
+{
+    //the length of the keys depends on the OpenSSL version
+    long len = SSL_CTX_get_tlsext_ticket_keys(tls->ctx, NULL, 0);
+    if (len <= 0 || len > EVT_TLS_TICKET_KEYS_SIZE) {
+        return 0;
+    }
+    return SSL_CTX_set_tlsext_ticket_keys(tls->ctx, (void *)keys, len) == 1 ? 1 : 0;
+}
+
 int evt_ctx_is_crtf_set(evt_ctx_t *t)
 {
     return t->cert_set;
@@ -280,13 +296,28 @@ static int evt__tls__op(evt_tls_t *conn, enum tls_op_type op, void *buf, int sz)
 
         case EVT_TLS_OP_WRITE: {
             assert( sz > 0 && "number of bytes to write should be positive");
-            r = SSL_write(conn->ssl, buf, sz);
-            if ( 0 == r) goto handle_shutdown;
+            //records pile up in the BIO pair until it is full or all the data is in,
+            //then they go to the network in a single write
+            int written = 0;
+            do {
+                r = SSL_write(conn->ssl, (char *)buf + written, sz - written);
+                if (r > 0) {
+                    written += r;
+                }
+                else if (SSL_get_error(conn->ssl, r) != SSL_ERROR_WANT_WRITE) {
+                    break;
+                }
+                bytes = evt__send_pending(conn);
+            } while (written < sz && (r > 0 || bytes > 0));
+            if ( 0 == r && !written) goto handle_shutdown;
             do {
                 bytes = evt__send_pending(conn);
             } while ( bytes > 0 );
-            if ( r > 0 && conn->write_cb) {
-                conn->write_cb(conn, r);
+            if (written > 0) {
+                r = written;
+                if (conn->write_cb) {
+                    conn->write_cb(conn, r);
+                }
             }
             break;
         }
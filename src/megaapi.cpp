@@ -1019,6 +1019,11 @@ MegaFolderInfo *MegaRequest::getMegaFolderInfo() const
     return NULL;
 }
 
+MegaNodeList *MegaRequest::getMegaNodeList() const
+{
+    return NULL;
+}
+
 const MegaPushNotificationSettings *MegaRequest::getMegaPushNotificationSettings() const
 {
     return NULL;
@@ -1141,6 +1146,21 @@ long long MegaTransfer::getMeanSpeed() const
     return 0;
 }
 
+int MegaTransfer::getNumConnections() const
+{
+    return 0;
+}
+
+int MegaTransfer::getTimeToFirstByte() const
+{
+    return -1;
+}
+
+long long MegaTransfer::getSavedBytes() const
+{
+    return 0;
+}
+
 long long MegaTransfer::getDeltaSize() const
 {
 	return 0;
@@ -1527,6 +1547,12 @@ void MegaTransferListener::onTransferUpdate(MegaApi *, MegaTransfer *)
 { }
 bool MegaTransferListener::onTransferData(MegaApi *, MegaTransfer *, char *, size_t)
 { return true; }
+bool MegaTransferListener::onTransferBuffer(MegaApi *api, MegaTransfer *transfer, MegaTransferBuffer *buffer)
+{
+    bool result = onTransferData(api, transfer, const_cast<char*>(buffer->getData()), buffer->getSize());
+    delete buffer;
+    return result;
+}
 void MegaTransferListener::onTransferTemporaryError(MegaApi *, MegaTransfer *, MegaError*)
 { }
 MegaTransferListener::~MegaTransferListener()
@@ -1834,6 +1860,16 @@ void MegaApi::setLogToConsole(bool enable)
     MegaApiImpl::setLogToConsole(enable);
 }
 
+void MegaApi::setLogAsync(bool enable, unsigned rateLimit)
+{
+    MegaApiImpl::setLogAsync(enable, rateLimit);
+}
+
+bool MegaApi::setBinaryLog(const char* path)
+{
+    return MegaApiImpl::setBinaryLog(path);
+}
+
 void MegaApi::addLoggerObject(MegaLogger *megaLogger)
 {
     MegaApiImpl::addLoggerClass(megaLogger);
@@ -2186,6 +2222,11 @@ void MegaApi::moveNode(MegaNode *node, MegaNode *newParent, const char *newName,
     pImpl->moveNode(node, newParent, newName, listener);
 }
 
+void MegaApi::moveNodes(MegaNodeList *nodes, MegaNode *newParent, MegaRequestListener *listener)
+{
+    pImpl->moveNodes(nodes, newParent, listener);
+}
+
 void MegaApi::copyNode(MegaNode *node, MegaNode* target, MegaRequestListener *listener)
 {
     pImpl->copyNode(node, target, listener);
@@ -2206,6 +2247,11 @@ void MegaApi::remove(MegaNode *node, MegaRequestListener *listener)
     pImpl->remove(node, false, listener);
 }
 
+void MegaApi::removeNodes(MegaNodeList *nodes, MegaRequestListener *listener)
+{
+    pImpl->removeNodes(nodes, listener);
+}
+
 void MegaApi::removeVersions(MegaRequestListener *listener)
 {
     pImpl->removeVersions(listener);
@@ -2251,6 +2297,11 @@ void MegaApi::loginToFolder(const char* megaFolderLink, MegaRequestListener *lis
     pImpl->loginToFolder(megaFolderLink, listener);
 }
 
+void MegaApi::loginToFolderSubtree(const char* megaFolderLink, MegaHandle subtree, MegaRequestListener *listener)
+{
+    pImpl->loginToFolderSubtree(megaFolderLink, subtree, listener);
+}
+
 void MegaApi::importFileLink(const char* megaFileLink, MegaNode *parent, MegaRequestListener *listener)
 {
     pImpl->importFileLink(megaFileLink, parent, listener);
@@ -2306,6 +2357,26 @@ void MegaApi::getPreview(MegaNode* node, const char *dstFilePath, MegaRequestLis
     pImpl->getPreview(node, dstFilePath, listener);
 }
 
+int MegaApi::prefetchThumbnails(MegaHandleList *nodes)
+{
+    return pImpl->prefetchFileAttributes(nodes, ATTR_TYPE_THUMBNAIL);
+}
+
+int MegaApi::prefetchPreviews(MegaHandleList *nodes)
+{
+    return pImpl->prefetchFileAttributes(nodes, ATTR_TYPE_PREVIEW);
+}
+
+void MegaApi::setFileAttributeCacheSize(long long bytes)
+{
+    pImpl->setFileAttributeCacheSize(bytes);
+}
+
+void MegaApi::setBrowsePrefetch(int pageSize)
+{
+    pImpl->setBrowsePrefetch(pageSize);
+}
+
 void MegaApi::cancelGetPreview(MegaNode* node, MegaRequestListener *listener)
 {
 	pImpl->cancelGetPreview(node, listener);
@@ -2416,6 +2487,11 @@ void MegaApi::setCustomNodeAttribute(MegaNode *node, const char *attrName, const
     pImpl->setCustomNodeAttribute(node, attrName, value, listener);
 }
 
+void MegaApi::setCustomNodesAttribute(MegaNodeList *nodes, const char *attrName, const char *value, MegaRequestListener *listener)
+{
+    pImpl->setCustomNodesAttribute(nodes, attrName, value, listener);
+}
+
 void MegaApi::setNodeDuration(MegaNode *node, int secs, MegaRequestListener *listener)
 {
     pImpl->setNodeDuration(node, secs, listener);
@@ -2456,6 +2532,11 @@ void MegaApi::fetchNodesAndResumeSyncs(MegaRequestListener *listener)
     pImpl->fetchNodes(true, listener);
 }
 
+void MegaApi::setStagedStartup(bool enable)
+{
+    pImpl->setStagedStartup(enable);
+}
+
 void MegaApi::getCloudStorageUsed(MegaRequestListener *listener)
 {
     pImpl->getCloudStorageUsed(listener);
@@ -2834,6 +2915,31 @@ bool MegaApi::setMaxUploadSpeed(long long bpslimit)
     return pImpl->setMaxUploadSpeed(bpslimit);
 }
 
+bool MegaApi::setHttp2(bool enable)
+{
+    return pImpl->setHttp2(enable);
+}
+
+long long MegaApi::getConnectionStat(int stat)
+{
+    return pImpl->getConnectionStat(stat);
+}
+
+char* MegaApi::getStorageServerHealth()
+{
+    return pImpl->getStorageServerHealth();
+}
+
+void MegaApi::probeNetwork()
+{
+    pImpl->probeNetwork();
+}
+
+char* MegaApi::getNetworkProfile()
+{
+    return pImpl->getNetworkProfile();
+}
+
 int MegaApi::getCurrentDownloadSpeed()
 {
     return pImpl->getCurrentDownloadSpeed();
@@ -2994,6 +3100,16 @@ void MegaApi::startDownloadWithTopPriority(MegaNode *node, const char *localPath
     pImpl->startDownload(true, node, localPath, 0, appData, listener);
 }
 
+void MegaApi::startUploads(MegaStringList *localPaths, MegaNode *parent, MegaTransferListener *listener)
+{
+    pImpl->startUploads(localPaths, parent, listener);
+}
+
+void MegaApi::startDownloads(MegaNodeList *nodes, const char *localFolder, MegaTransferListener *listener)
+{
+    pImpl->startDownloads(nodes, localFolder, listener);
+}
+
 void MegaApi::cancelTransfer(MegaTransfer *t, MegaRequestListener *listener)
 {
     pImpl->cancelTransfer(t, listener);
@@ -3069,11 +3185,31 @@ void MegaApi::startStreaming(MegaNode* node, int64_t startPos, int64_t size, Meg
     pImpl->startStreaming(node, startPos, size, listener);
 }
 
+void MegaApi::startStreamingBuffers(MegaNode* node, int64_t startPos, int64_t size, int64_t maxHeldBytes, MegaTransferListener *listener)
+{
+    pImpl->startStreaming(node, startPos, size, listener, maxHeldBytes);
+}
+
 void MegaApi::setStreamingMinimumRate(int bytesPerSecond)
 {
     pImpl->setStreamingMinimumRate(bytesPerSecond);
 }
 
+void MegaApi::setStreamingReadahead(long long bytes)
+{
+    pImpl->setStreamingReadahead(bytes);
+}
+
+void MegaApi::setStreamingDiskCache(const char *localFolder, long long maxBytes)
+{
+    pImpl->setStreamingDiskCache(localFolder, maxBytes);
+}
+
+long long MegaApi::getStreamingCacheStat(int stat)
+{
+    return pImpl->getStreamingCacheStat(stat);
+}
+
 #ifdef ENABLE_SYNC
 
 //Move local files inside synced folders to the "Rubbish" folder.
@@ -3174,6 +3310,11 @@ MegaSync *MegaApi::getSyncByPath(const char *localPath)
     return pImpl->getSyncByPath(localPath);
 }
 
+MegaSyncStats *MegaApi::getSyncStats(int tag)
+{
+    return pImpl->getSyncStats(tag);
+}
+
 bool MegaApi::isScanning()
 {
     return pImpl->isIndexing();
@@ -3224,6 +3365,51 @@ void MegaApi::setExclusionUpperSizeLimit(long long limit)
     pImpl->setExclusionUpperSizeLimit(limit);
 }
 
+void MegaApi::setSyncContentCheck(long long minSize)
+{
+    pImpl->setSyncContentCheck(minSize);
+}
+
+void MegaApi::setSyncScanThreads(int threads)
+{
+    pImpl->setSyncScanThreads(threads);
+}
+
+void MegaApi::setSyncDebrisThreads(int threads)
+{
+    pImpl->setSyncDebrisThreads(threads);
+}
+
+void MegaApi::setSyncFingerprintPrefetch(int files)
+{
+    pImpl->setSyncFingerprintPrefetch(files);
+}
+
+void MegaApi::setSyncMaxVersionsPerHour(int versions)
+{
+    pImpl->setSyncMaxVersionsPerHour(versions);
+}
+
+void MegaApi::setSyncDirtySubtreesOnly(bool enable)
+{
+    pImpl->setSyncDirtySubtreesOnly(enable);
+}
+
+void MegaApi::setNetworkSyncPolling(bool enable)
+{
+    pImpl->setNetworkSyncPolling(enable);
+}
+
+bool MegaApi::setFilesystemWideNotifications(bool enable)
+{
+    return pImpl->setFilesystemWideNotifications(enable);
+}
+
+long long MegaApi::getNumNotifyWatches()
+{
+    return pImpl->getNumNotifyWatches();
+}
+
 #ifdef USE_PCRE
 void MegaApi::setExcludedRegularExpressions(MegaSync *sync, MegaRegExp *regExp)
 {
@@ -3353,6 +3539,11 @@ MegaUserAlertList* MegaApi::getUserAlerts()
     return pImpl->getUserAlerts();
 }
 
+MegaUserAlertList* MegaApi::getUserAlerts(int start, int count)
+{
+    return pImpl->getUserAlerts(start, count);
+}
+
 int MegaApi::getNumUnreadUserAlerts()
 {
     return pImpl->getNumUnreadUserAlerts();
@@ -3537,6 +3728,197 @@ const char *MegaApi::getBasePath()
     return pImpl->getBasePath();
 }
 
+void MegaApi::setDatabaseProfile(int profile)
+{
+    pImpl->setDatabaseProfile(profile);
+}
+
+void MegaApi::setDatabaseTuning(int synchronous, int cacheSizeKiB, long long mmapSize, int tempStore, int pageSize, int walAutocheckpoint)
+{
+    pImpl->setDatabaseTuning(synchronous, cacheSizeKiB, mmapSize, tempStore, pageSize, walAutocheckpoint);
+}
+
+int MegaApi::getDatabaseProfile()
+{
+    return pImpl->getDatabaseProfile();
+}
+
+void MegaApi::setDatabaseWriteBehind(bool enable)
+{
+    pImpl->setDatabaseWriteBehind(enable);
+}
+
+void MegaApi::setSharedNodeView(const char *path, const char *base64Key)
+{
+    pImpl->setSharedNodeView(path, base64Key);
+}
+
+void MegaApi::setNodeMemoryBudget(int megabytes)
+{
+    pImpl->setNodeMemoryBudget(megabytes);
+}
+
+void MegaApi::setCompactVersions(bool enable)
+{
+    pImpl->setCompactVersions(enable);
+}
+
+void MegaApi::setMemoryBudget(long long bytes)
+{
+    pImpl->setMemoryBudget(bytes);
+}
+
+long long MegaApi::getMemoryUsage(int subsystem)
+{
+    return pImpl->getMemoryUsage(subsystem);
+}
+
+int MegaApi::getMemoryPressure()
+{
+    return pImpl->getMemoryPressure();
+}
+
+void MegaApi::setCallbackIntervals(int nodesMs, int transfersMs)
+{
+    pImpl->setCallbackIntervals(nodesMs, transfersMs);
+}
+
+void MegaApi::setFolderDownloadOrder(int order)
+{
+    pImpl->setFolderDownloadOrder(order);
+}
+
+void MegaApi::setDownloadPreallocation(bool enable)
+{
+    pImpl->setDownloadPreallocation(enable);
+}
+
+void MegaApi::setPartialDownloadResumption(bool enable)
+{
+    pImpl->setPartialDownloadResumption(enable);
+}
+
+void MegaApi::setMobileEfficiency(bool enable)
+{
+    pImpl->setMobileEfficiency(enable);
+}
+
+long long MegaApi::getRadioWakeupsSaved()
+{
+    return pImpl->getRadioWakeupsSaved();
+}
+
+void MegaApi::setWorkerThreads(int threads)
+{
+    MegaApiImpl::setWorkerThreads(threads);
+}
+
+void MegaApi::setWorkerClassLimit(int workerClass, int maxThreads)
+{
+    MegaApiImpl::setWorkerClassLimit(workerClass, maxThreads);
+}
+
+void MegaApi::setWorkerAffinity(long long cpuMask)
+{
+    MegaApiImpl::setWorkerAffinity(cpuMask);
+}
+
+void MegaApi::setSharedEventLoops(int threads)
+{
+    MegaApiImpl::setSharedEventLoops(threads);
+}
+
+void MegaApi::setDownloadWriteCoalescing(int bytes)
+{
+    pImpl->setDownloadWriteCoalescing(bytes);
+}
+
+void MegaApi::setUploadReadahead(int bytes)
+{
+    pImpl->setUploadReadahead(bytes);
+}
+
+void MegaApi::setNodeScope(MegaHandleList *folders)
+{
+    pImpl->setNodeScope(folders);
+}
+
+void MegaApi::pinNode(MegaNode *node, bool pin)
+{
+    pImpl->pinNode(node, pin);
+}
+
+void MegaApi::setAutoConnections(int direction, bool enable, int budget)
+{
+    pImpl->setAutoConnections(direction, enable, budget);
+}
+
+void MegaApi::setFairTransferScheduling(bool enable)
+{
+    pImpl->setFairTransferScheduling(enable);
+}
+
+void MegaApi::setTransferGroupWeight(int folderTransferTag, int weight)
+{
+    pImpl->setTransferGroupWeight(folderTransferTag, weight);
+}
+
+void MegaApi::setTransferGroupMinSpeed(int folderTransferTag, long long bytesPerSecond)
+{
+    pImpl->setTransferGroupMinSpeed(folderTransferTag, bytesPerSecond);
+}
+
+void MegaApi::setSmallFileFastLane(long long maxFileSize, int slots)
+{
+    pImpl->setSmallFileFastLane(maxFileSize, slots);
+}
+
+void MegaApi::setTotalBandwidthLimit(long long bytesPerSecond)
+{
+    pImpl->setTotalBandwidthLimit(bytesPerSecond);
+}
+
+void MegaApi::setTransferGroupBandwidthLimit(int folderTransferTag, long long bytesPerSecond)
+{
+    pImpl->setTransferGroupBandwidthLimit(folderTransferTag, bytesPerSecond);
+}
+
+bool MegaApi::addBandwidthSchedule(const char* cronExpression, long long durationSeconds,
+                                   long long downloadBytesPerSecond, long long uploadBytesPerSecond)
+{
+    return pImpl->addBandwidthSchedule(cronExpression, durationSeconds, downloadBytesPerSecond, uploadBytesPerSecond);
+}
+
+void MegaApi::clearBandwidthSchedules()
+{
+    pImpl->clearBandwidthSchedules();
+}
+
+void MegaApi::setUploadCompletionBatching(int maxFiles)
+{
+    pImpl->setUploadCompletionBatching(maxFiles);
+}
+
+void MegaApi::setTransferBufferPoolLimit(long long bytes)
+{
+    pImpl->setTransferBufferPoolLimit(bytes);
+}
+
+void MegaApi::setUploadFingerprintLookahead(int uploads)
+{
+    pImpl->setUploadFingerprintLookahead(uploads);
+}
+
+void MegaApi::setApiPipelining(int connections)
+{
+    pImpl->setApiPipelining(connections);
+}
+
+void MegaApi::setRequestCompression(long long minBatchSize)
+{
+    pImpl->setRequestCompression(minBatchSize);
+}
+
 void MegaApi::disableGfxFeatures(bool disable)
 {
     pImpl->disableGfxFeatures(disable);
@@ -3547,6 +3929,16 @@ bool MegaApi::areGfxFeaturesDisabled()
     return pImpl->areGfxFeaturesDisabled();
 }
 
+void MegaApi::setGfxIsolation(bool enable)
+{
+    pImpl->setGfxIsolation(enable);
+}
+
+bool MegaApi::isGfxIsolated()
+{
+    return pImpl->isGfxIsolated();
+}
+
 void MegaApi::changeApiUrl(const char *apiURL, bool disablepkp)
 {
     pImpl->changeApiUrl(apiURL, disablepkp);
@@ -3663,6 +4055,17 @@ MegaNodeList *MegaApi::search(const char *searchString, MegaCancelToken *cancelT
     return pImpl->search(searchString, cancelToken, order);
 }
 
+MegaNodeList *MegaApi::searchByPattern(MegaNode *n, const char *pattern, int type, long long minSize, long long maxSize,
+                                       long long minMtime, long long maxMtime, MegaCancelToken *cancelToken, int order)
+{
+    return pImpl->searchByPattern(n, pattern, type, minSize, maxSize, minMtime, maxMtime, cancelToken, order);
+}
+
+void MegaApi::searchInPages(MegaNode *node, const char *searchString, int pageSize, MegaRequestListener *listener)
+{
+    pImpl->searchInPages(node, searchString, pageSize, listener);
+}
+
 long long MegaApi::getSize(MegaNode *n)
 {
     return pImpl->getSize(n);
@@ -3795,6 +4198,16 @@ void MegaApi::removeGlobalListener(MegaGlobalListener* listener)
     pImpl->removeGlobalListener(listener);
 }
 
+void MegaApi::addNodeListener(MegaGlobalListener* listener, MegaHandle parentHandle, bool recursive)
+{
+    pImpl->addNodeListener(listener, parentHandle, recursive);
+}
+
+void MegaApi::removeNodeListener(MegaGlobalListener* listener)
+{
+    pImpl->removeNodeListener(listener);
+}
+
 MegaRequest *MegaApi::getCurrentRequest()
 {
     return pImpl->getCurrentRequest();
@@ -3855,6 +4268,11 @@ MegaNodeList *MegaApi::getChildren(MegaNode* p, int order)
     return pImpl->getChildren(p, order);
 }
 
+MegaNodeList *MegaApi::getChildrenPage(MegaNode* p, int order, int offset, int limit)
+{
+    return pImpl->getChildrenPage(p, order, offset, limit);
+}
+
 MegaNodeList *MegaApi::getVersions(MegaNode *node)
 {
     return pImpl->getVersions(node);
@@ -3950,6 +4368,36 @@ long long MegaApi::getTotalUploadBytes()
     return pImpl->getTotalUploadBytes();
 }
 
+void MegaApi::setPerformanceStatsEnabled(bool enable)
+{
+    pImpl->setPerformanceStatsEnabled(enable);
+}
+
+MegaStringMap *MegaApi::getPerformanceSnapshot(bool reset)
+{
+    return pImpl->getPerformanceSnapshot(reset);
+}
+
+void MegaApi::setEventLoopStallThreshold(unsigned thresholdMs)
+{
+    pImpl->setEventLoopStallThreshold(thresholdMs);
+}
+
+MegaStringList *MegaApi::getEventLoopStalls(bool reset)
+{
+    return pImpl->getEventLoopStalls(reset);
+}
+
+bool MegaApi::startTrace(const char* outputPath)
+{
+    return pImpl->startTrace(outputPath);
+}
+
+bool MegaApi::stopTrace()
+{
+    return pImpl->stopTrace();
+}
+
 void MegaApi::update()
 {
    pImpl->update();
@@ -4092,6 +4540,26 @@ bool MegaApi::httpServerIsSubtitlesSupportEnabled()
     return pImpl->httpServerIsSubtitlesSupportEnabled();
 }
 
+void MegaApi::httpServerEnableHLSSupport(bool enable)
+{
+    pImpl->httpServerEnableHLSSupport(enable);
+}
+
+bool MegaApi::httpServerIsHLSSupportEnabled()
+{
+    return pImpl->httpServerIsHLSSupportEnabled();
+}
+
+void MegaApi::httpServerEnableMetrics(bool enable)
+{
+    pImpl->httpServerEnableMetrics(enable);
+}
+
+bool MegaApi::httpServerIsMetricsEnabled()
+{
+    return pImpl->httpServerIsMetricsEnabled();
+}
+
 void MegaApi::httpServerAddListener(MegaTransferListener *listener)
 {
     pImpl->httpServerAddListener(listener);
@@ -4152,6 +4620,16 @@ int MegaApi::httpServerGetMaxOutputSize()
     return pImpl->httpServerGetMaxOutputSize();
 }
 
+void MegaApi::httpServerSetEventLoops(int loops)
+{
+    pImpl->httpServerSetEventLoops(loops);
+}
+
+int MegaApi::httpServerGetEventLoops()
+{
+    return pImpl->httpServerGetEventLoops();
+}
+
 //FTP Server:
 bool MegaApi::ftpServerStart(bool localOnly, int port, int dataportBegin, int dataPortEnd, bool useTLS, const char * certificatepath, const char * keypath)
 {
@@ -4863,6 +5341,16 @@ void MegaApi::removeAccessInChat(MegaHandle chatid, MegaNode *n, MegaHandle uh,
     pImpl->removeAccessInChat(chatid, n, uh, listener);
 }
 
+void MegaApi::grantAccessToNodesInChat(MegaHandle chatid, MegaNodeList *nodes, MegaHandle uh, MegaRequestListener *listener)
+{
+    pImpl->grantAccessToNodesInChat(chatid, nodes, uh, listener);
+}
+
+void MegaApi::removeAccessToNodesInChat(MegaHandle chatid, MegaNodeList *nodes, MegaHandle uh, MegaRequestListener *listener)
+{
+    pImpl->removeAccessToNodesInChat(chatid, nodes, uh, listener);
+}
+
 void MegaApi::updateChatPermissions(MegaHandle chatid, MegaHandle uh, int privilege, MegaRequestListener *listener)
 {
     pImpl->updateChatPermissions(chatid, uh, privilege, listener);
@@ -4913,6 +5401,11 @@ bool MegaApi::hasAccessToAttachment(MegaHandle chatid, MegaHandle h, MegaHandle
     return pImpl->hasAccessToAttachment(chatid, h, uh);
 }
 
+MegaHandleList* MegaApi::getAttachmentChats(MegaHandle h)
+{
+    return pImpl->getAttachmentChats(h);
+}
+
 const char* MegaApi::getFileAttribute(MegaHandle h)
 {
     return pImpl->getFileAttribute(h);
@@ -5105,6 +5598,56 @@ bool MegaHashSignature::checkSignature(const char *base64Signature)
     return pImpl->checkSignature(base64Signature);
 }
 
+MegaSharedNodeView::MegaSharedNodeView(const char *path, const char *base64Key)
+{
+    pImpl = new MegaSharedNodeViewImpl(path, base64Key);
+}
+
+MegaSharedNodeView::~MegaSharedNodeView()
+{
+    delete pImpl;
+}
+
+bool MegaSharedNodeView::isValid()
+{
+    return pImpl->isValid();
+}
+
+long long MegaSharedNodeView::getGeneration()
+{
+    return pImpl->getGeneration();
+}
+
+bool MegaSharedNodeView::refresh()
+{
+    return pImpl->refresh();
+}
+
+MegaHandle MegaSharedNodeView::getRootNode()
+{
+    return pImpl->getRootNode(0);
+}
+
+MegaHandle MegaSharedNodeView::getInboxNode()
+{
+    return pImpl->getRootNode(1);
+}
+
+MegaHandle MegaSharedNodeView::getRubbishNode()
+{
+    return pImpl->getRootNode(2);
+}
+
+MegaNode *MegaSharedNodeView::getNodeByHandle(MegaHandle handle)
+{
+    return pImpl->getNodeByHandle(handle);
+}
+
+MegaNodeList *MegaSharedNodeView::getChildren(MegaHandle parentHandle)
+{
+    return pImpl->getChildren(parentHandle);
+}
+
 MegaAccountDetails::~MegaAccountDetails() { }
 
 int MegaAccountDetails::getProLevel()
@@ -5404,6 +5947,103 @@ int MegaSync::getState() const
     return MegaSync::SYNC_FAILED;
 }
 
+MegaSyncStats::~MegaSyncStats() { }
+
+MegaSyncStats *MegaSyncStats::copy() const
+{
+    return NULL;
+}
+
+int MegaSyncStats::getTag() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getQueuedNotifications() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getQueuedRetries() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getQueuedDelayed() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getQueueLag() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getScannedEntries() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getScanRate() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getPendingFolderCreations() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getVanishedNodes() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getQueuedDownloads() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getQueuedUploads() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getStateCacheFlushes() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getStateCacheFlushTime() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getLastStateCacheFlushTime() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getLagSamples() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getLastLag() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getMaxLag() const
+{
+    return 0;
+}
+
+long long MegaSyncStats::getAverageLag() const
+{
+    return 0;
+}
+
 
 void MegaSyncListener::onSyncFileStateChanged(MegaApi *, MegaSync *, string *, int)
 { }
@@ -5755,6 +6395,11 @@ char *MegaBackgroundMediaUpload::encryptFile(const char* inputFilepath, int64_t
     return NULL;
 }
 
+int64_t MegaBackgroundMediaUpload::getEncryptedBytes()
+{
+    return 0;
+}
+
 char *MegaBackgroundMediaUpload::getUploadURL()
 {
     return NULL;
@@ -6036,6 +6681,26 @@ MegaTransferData::~MegaTransferData()
 
 }
 
+MegaTransferBuffer::~MegaTransferBuffer()
+{
+
+}
+
+const char *MegaTransferBuffer::getData() const
+{
+    return NULL;
+}
+
+size_t MegaTransferBuffer::getSize() const
+{
+    return 0;
+}
+
+long long MegaTransferBuffer::getOffset() const
+{
+    return 0;
+}
+
 MegaTransferData *MegaTransferData::copy() const
 {
     return NULL;
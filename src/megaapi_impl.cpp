@@ -36,6 +36,7 @@
 #include <cctype>
 #include <locale>
 #include <thread>
+#include <array>
 
 #ifndef _WIN32
 #ifndef _LARGEFILE64_SOURCE
@@ -44,6 +45,19 @@
 #include <signal.h>
 #endif
 
+#ifdef HAVE_LIBUV
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#endif
+
 
 #ifdef __APPLE__
     #include <xlocale.h>
@@ -283,9 +297,9 @@ MegaNodePrivate::MegaNodePrivate(Node *node)
     this->restorehandle = UNDEF;
 
     char buf[10];
-    for (attr_map::iterator it = node->attrs.map.begin(); it != node->attrs.map.end(); it++)
+    for (attr_map::iterator it = node->attrs().map.begin(); it != node->attrs().map.end(); it++)
     {
-        int attrlen = node->attrs.nameid2string(it->first, buf);
+        int attrlen = node->attrs().nameid2string(it->first, buf);
         buf[attrlen] = '\0';
         if (buf[0] == '_')
         {
@@ -327,7 +341,16 @@ MegaNodePrivate::MegaNodePrivate(Node *node)
                                 byte data[SymmCipher::BLOCKSIZE] = { 0 };
                                 Base64::atob(coords.data(), data, Base64Str<SymmCipher::BLOCKSIZE>::STRLEN);
 
-                                node->client->setkey(&c, node->client->unshareablekey.data());
+                                // as MegaClient::setkey(), with a master cipher of its own: the getters
+                                // may build nodes concurrently, with sdkMutex shared
+                                byte unshareable[SymmCipher::KEYLENGTH];
+                                if (Base64::atob(node->client->unshareablekey.data(), unshareable, sizeof unshareable) == sizeof unshareable)
+                                {
+                                    SymmCipher master;
+                                    master.setkey(node->client->key.key);
+                                    master.ecb_decrypt(unshareable);
+                                    c.setkey(unshareable);
+                                }
                                 c.ctr_crypt(data, SymmCipher::BLOCKSIZE, 0, 0, NULL, false);
                                 ok = !memcmp(data, "unshare/", 8);
                                 if (ok)
@@ -945,6 +968,11 @@ int MegaNodePrivate::getChanges()
     return changed;
 }
 
+void MegaNodePrivate::addChanges(int changes)
+{
+    changed |= changes;
+}
+
 MegaHandle MegaNodePrivate::getOwner() const
 {
     return owner;
@@ -1104,20 +1132,20 @@ char *MegaBackgroundMediaUploadPrivate::encryptFile(const char* inputFilepath, i
                 string localencryptedfilename, outputFilepathtmp(outputFilepath);
                 api->fsAccess->path2local(&outputFilepathtmp, &localencryptedfilename);
 
-                std::unique_ptr<FileAccess> faout(api->fsAccess->newfileaccess());
-                if (faout->fopen(&localencryptedfilename, false, true))
+                fain.reset();
+                encryptedbytes = 0;
+
+                uint64_t ctriv = MemAccess::get<uint64_t>((const char*)filekey + SymmCipher::KEYLENGTH);
+                unsigned threads = std::min(WorkerPool::get().parallelism(WorkerPool::WORK_FILES), EncryptFilePieceInParallel::MAXTHREADS);
+
+                EncryptFilePieceInParallel ef(api->fsAccess, localfilename, localencryptedfilename, filekey, ctriv, &encryptedbytes);
+                string urlSuffix;
+                if (ef.encrypt(startPos, endPos, threads, chunkmacs, urlSuffix))
                 {
                     SymmCipher cipher;
                     cipher.setkey(filekey);
-                    uint64_t ctriv = MemAccess::get<uint64_t>((const char*)filekey + SymmCipher::KEYLENGTH);
-
-                    EncryptFilePieceByChunks ef(fain.get(), startPos, faout.get(), 0, &cipher, &chunkmacs, ctriv);
-                    string urlSuffix;
-                    if (ef.encrypt(startPos, endPos, urlSuffix))
-                    {
-                        ((int64_t*)filekey)[3] = chunkmacs.macsmac(&cipher);
-                        return MegaApi::strdup(urlSuffix.c_str());
-                    }
+                    ((int64_t*)filekey)[3] = chunkmacs.macsmac(&cipher);
+                    return MegaApi::strdup(urlSuffix.c_str());
                 }
             }
         }
@@ -1125,41 +1153,120 @@ char *MegaBackgroundMediaUploadPrivate::encryptFile(const char* inputFilepath, i
     return nullptr; 
 }
 
+int64_t MegaBackgroundMediaUploadPrivate::getEncryptedBytes()
+{
+    return encryptedbytes;
+}
+
 char *MegaBackgroundMediaUploadPrivate::getUploadURL()
 {
     return url.empty() ? nullptr : MegaApi::strdup(url.c_str());
 }
 
-EncryptFilePieceByChunks::EncryptFilePieceByChunks(FileAccess *cFain, m_off_t cInPos, FileAccess *cFaout, m_off_t cOutPos,
-                                                   SymmCipher *cipher, chunkmac_map *chunkmacs, uint64_t ctriv)
-    : EncryptByChunks(cipher, chunkmacs, ctriv)
-    , fain(cFain), faout(cFaout)
-    , inpos(cInPos), outpos(cOutPos)
-    , lastsize(0)
+EncryptFilePieceInParallel::EncryptFilePieceInParallel(FileSystemAccess* cFsaccess, const string& cLocalinput, const string& cLocaloutput,
+                                                       const byte* cKey, uint64_t cCtriv, std::atomic<int64_t>* cProgress)
+    : fsaccess(cFsaccess)
+    , localinput(cLocalinput), localoutput(cLocaloutput)
+    , key(cKey), ctriv(cCtriv)
+    , progress(cProgress)
+    , nextchunk(0)
+    , failed(false)
 {
 }
 
-byte *EncryptFilePieceByChunks::nextbuffer(unsigned bufsize)
+bool EncryptFilePieceInParallel::encrypt(m_off_t pos, m_off_t npos, unsigned threads, chunkmac_map& macs, string& urlSuffix)
 {
-    if (lastsize)
+    chunks.clear();
+    for (m_off_t start = pos; start < npos; )
     {
-        // write the last encrypted chunk
-        if (!faout->fwrite((byte*)buffer.data(), lastsize, outpos))
-        {
-            return NULL;
-        }
-        outpos += lastsize;
+        m_off_t end = ChunkedHash::chunkceil(start, npos);
+        chunks.push_back(Chunk{ start, end, { 0 } });
+        start = end;
     }
+    nextchunk = 0;
+    failed = false;
 
-    buffer.resize(bufsize + SymmCipher::BLOCKSIZE);
-    memset((void*)(buffer.data() + bufsize), 0, SymmCipher::BLOCKSIZE);
-    if (!fain->frawread((byte*)buffer.data(), bufsize, inpos))
+    // the calling thread is one of them
+    threads = std::max(1u, std::min(threads, unsigned(chunks.size())));
+    vector<std::array<byte, EncryptByChunks::CRCSIZE>> crcs(threads);
+    for (auto& crc : crcs)
     {
-        return NULL;
+        crc.fill(0);
+    }
+    WorkerPool::get().run(WorkerPool::WORK_FILES, threads, [this, pos, &crcs](size_t i)
+    {
+        work(pos, crcs[i].data());
+    });
+
+    if (failed)
+    {
+        return false;
+    }
+
+    for (const Chunk& c : chunks)
+    {
+        memcpy(macs[c.start].mac, c.mac, sizeof c.mac);
+        macs[c.start].finished = false;
+    }
+
+    byte crc[EncryptByChunks::CRCSIZE] = { 0 };
+    for (auto& t : crcs)
+    {
+        SymmCipher::xorblock(t.data(), crc, EncryptByChunks::CRCSIZE);
+    }
+    urlSuffix = EncryptByChunks::urlSuffix(pos, crc);
+    return true;
+}
+
+void EncryptFilePieceInParallel::work(m_off_t pos, byte* crc)
+{
+    std::unique_ptr<FileAccess> fain(fsaccess->newfileaccess());
+    std::unique_ptr<FileAccess> faout(fsaccess->newfileaccess());
+    string inname(localinput), outname(localoutput);
+    if (!fain->fopen(&inname, true, false) || !faout->fopen(&outname, false, true))
+    {
+        LOG_err << "Unable to open the files to encrypt";
+        failed = true;
+        return;
+    }
+
+    SymmCipher cipher;
+    cipher.setkey(key);
+    string buffer;
+
+    size_t i;
+    while (!failed && (i = nextchunk++) < chunks.size())
+    {
+        Chunk& c = chunks[i];
+        unsigned size = unsigned(c.end - c.start);
+
+        // the cipher works on whole blocks: pad with zeroes
+        buffer.resize(size + SymmCipher::BLOCKSIZE);
+        byte* data = (byte*)buffer.data();
+        memset(data + size, 0, SymmCipher::BLOCKSIZE);
+
+        if (!fain->frawread(data, size, c.start))
+        {
+            LOG_err << "Unable to read the chunk to encrypt at " << c.start;
+            failed = true;
+            return;
+        }
+
+        cipher.ctr_crypt(data, size, c.start, ctriv, c.mac, 1);
+        EncryptByChunks::updateCRC(crc, data, size, unsigned(c.start - pos));
+
+        if (!faout->fwrite(data, size, c.start - pos))
+        {
+            LOG_err << "Unable to write the encrypted chunk at " << c.start;
+            failed = true;
+            return;
+        }
+
+        if (progress)
+        {
+            *progress += size;
+        }
     }
-    lastsize = bufsize;
-    inpos += bufsize;
-    return (byte*)buffer.data();
 }
 
 #ifdef ENABLE_SYNC
@@ -1219,6 +1326,128 @@ bool WildcardMatch(const char *pszString, const char *pszMatch)
     return !*pszMatch;
 }
 
+void SyncExclusionMatcher::setNames(const vector<string>& patterns)
+{
+    exactNames.clear();
+    nameSuffixes.clear();
+    wildcardNames.clear();
+
+    for (const string& p : patterns)
+    {
+        size_t wildcard = p.find_first_of("*?");
+        if (wildcard == string::npos)
+        {
+            exactNames.insert(p);
+        }
+        else if (p[0] == '*' && p.find_first_of("*?", 1) == string::npos)
+        {
+            nameSuffixes.push_back(p.substr(1));
+        }
+        else
+        {
+            wildcardNames.push_back(p);
+        }
+    }
+}
+
+void SyncExclusionMatcher::setPaths(const vector<string>& patterns)
+{
+    exactPaths.clear();
+    wildcardPaths.clear();
+    lastFolderValid = false;
+    lastFolderPaths.clear();
+
+    for (const string& p : patterns)
+    {
+        if (p.find_first_of("*?") == string::npos)
+        {
+            exactPaths.insert(p);
+        }
+        else
+        {
+            wildcardPaths.push_back(p);
+        }
+    }
+}
+
+void SyncExclusionMatcher::clear()
+{
+    setNames(vector<string>());
+    setPaths(vector<string>());
+}
+
+bool SyncExclusionMatcher::excludesName(const char* name) const
+{
+    if (!exactNames.empty() && exactNames.count(name))
+    {
+        return true;
+    }
+
+    if (!nameSuffixes.empty())
+    {
+        size_t length = strlen(name);
+        for (const string& s : nameSuffixes)
+        {
+            if (length >= s.size() && !memcmp(name + length - s.size(), s.data(), s.size()))
+            {
+                return true;
+            }
+        }
+    }
+
+    for (const string& p : wildcardNames)
+    {
+        if (WildcardMatch(name, p.c_str()))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SyncExclusionMatcher::hasPaths() const
+{
+    return !exactPaths.empty() || !wildcardPaths.empty();
+}
+
+bool SyncExclusionMatcher::excludesPath(const string& path, size_t folderLength)
+{
+    if (!exactPaths.empty() && exactPaths.count(path))
+    {
+        return true;
+    }
+
+    if (wildcardPaths.empty())
+    {
+        return false;
+    }
+
+    if (!lastFolderValid || lastFolder.size() != folderLength || path.compare(0, folderLength, lastFolder))
+    {
+        // a pattern can only match below this folder if one of them begins with the other
+        lastFolder.assign(path, 0, folderLength);
+        lastFolderValid = true;
+        lastFolderPaths.clear();
+        for (const string& p : wildcardPaths)
+        {
+            size_t literal = std::min(p.find_first_of("*?"), folderLength);
+            if (!p.compare(0, literal, lastFolder, 0, literal))
+            {
+                lastFolderPaths.push_back(&p);
+            }
+        }
+    }
+
+    for (const string* p : lastFolderPaths)
+    {
+        if (WildcardMatch(path.c_str(), p->c_str()))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool MegaApiImpl::is_syncable(Sync *sync, const char *name, string *localpath)
 {
     // Don't sync these system files from OS X
@@ -1227,12 +1456,9 @@ bool MegaApiImpl::is_syncable(Sync *sync, const char *name, string *localpath)
         return false;
     }
 
-    for (unsigned int i = 0; i < excludedNames.size(); i++)
+    if (syncExclusions.excludesName(name))
     {
-        if (WildcardMatch(name, excludedNames[i].c_str()))
-        {
-            return false;
-        }
+        return false;
     }
 
     MegaRegExp *regExp = NULL;
@@ -1244,22 +1470,23 @@ bool MegaApiImpl::is_syncable(Sync *sync, const char *name, string *localpath)
     }
 #endif
 
-    if (regExp || excludedPaths.size())
+    if (regExp || syncExclusions.hasPaths())
     {             
         string utf8path;
         fsAccess->local2path(localpath, &utf8path);
-        const char* path = utf8path.c_str();
 
-        for (unsigned int i = 0; i < excludedPaths.size(); i++)
+#ifdef _WIN32
+        size_t separator = utf8path.find_last_of('\\');
+#else
+        size_t separator = utf8path.find_last_of('/');
+#endif
+        if (syncExclusions.excludesPath(utf8path, separator == string::npos ? 0 : separator + 1))
         {
-            if (WildcardMatch(path, excludedPaths[i].c_str()))
-            {
-                return false;
-            }
+            return false;
         }
 
 #ifdef USE_PCRE
-        if (regExp && regExp->match(path))
+        if (regExp && regExp->match(utf8path.c_str()))
         {
             return false;
         }
@@ -1446,6 +1673,23 @@ MegaSync *MegaApiImpl::getSyncByPath(const char *localPath)
     return result;
 }
 
+MegaSyncStats *MegaApiImpl::getSyncStats(int tag)
+{
+    SdkMutexGuard g(sdkMutex);
+
+    for (Sync* sync : client->syncs)
+    {
+        if (sync->tag == tag)
+        {
+            SyncStats stats;
+            sync->getstats(stats);
+            return new MegaSyncStatsPrivate(tag, stats);
+        }
+    }
+
+    return NULL;
+}
+
 char *MegaApiImpl::getBlockedPath()
 {
     char *path = NULL;
@@ -2207,6 +2451,9 @@ MegaTransferPrivate::MegaTransferPrivate(int type, MegaTransferListener *listene
     this->state = STATE_NONE;
     this->priority = 0;
     this->meanSpeed = 0;
+    this->numConnections = 0;
+    this->timeToFirstByte = -1;
+    this->savedBytes = 0;
     this->notificationNumber = 0;
 }
 
@@ -2240,12 +2487,16 @@ MegaTransferPrivate::MegaTransferPrivate(const MegaTransferPrivate *transfer)
     this->setFileName(transfer->getFileName());
     this->setSpeed(transfer->getSpeed());
     this->setMeanSpeed(transfer->getMeanSpeed());
+    this->setNumConnections(transfer->getNumConnections());
+    this->setTimeToFirstByte(transfer->getTimeToFirstByte());
+    this->setSavedBytes(transfer->getSavedBytes());
     this->setDeltaSize(transfer->getDeltaSize());
     this->setUpdateTime(transfer->getUpdateTime());
     this->setPublicNode(transfer->getPublicNode());
     this->setTransfer(transfer->getTransfer());
     this->setSyncTransfer(transfer->isSyncTransfer());
     this->setStreamingTransfer(transfer->isStreamingTransfer());
+    this->setMaxHeldBytes(transfer->getMaxHeldBytes());
     this->setSourceFileTemporary(transfer->isSourceFileTemporary());
     this->setStartFirst(transfer->shouldStartFirst());
     this->setBackupTransfer(transfer->isBackupTransfer());
@@ -2286,6 +2537,21 @@ long long MegaTransferPrivate::getMeanSpeed() const
     return meanSpeed;
 }
 
+int MegaTransferPrivate::getNumConnections() const
+{
+    return numConnections;
+}
+
+int MegaTransferPrivate::getTimeToFirstByte() const
+{
+    return timeToFirstByte;
+}
+
+long long MegaTransferPrivate::getSavedBytes() const
+{
+    return savedBytes;
+}
+
 long long MegaTransferPrivate::getDeltaSize() const
 {
     return deltaSize;
@@ -2684,6 +2950,21 @@ void MegaTransferPrivate::setMeanSpeed(long long meanSpeed)
     this->meanSpeed = meanSpeed;
 }
 
+void MegaTransferPrivate::setNumConnections(int numConnections)
+{
+    this->numConnections = numConnections;
+}
+
+void MegaTransferPrivate::setTimeToFirstByte(int milliseconds)
+{
+    this->timeToFirstByte = milliseconds;
+}
+
+void MegaTransferPrivate::setSavedBytes(long long bytes)
+{
+    this->savedBytes = bytes;
+}
+
 void MegaTransferPrivate::setDeltaSize(long long deltaSize)
 {
     this->deltaSize = deltaSize;
@@ -2746,6 +3027,36 @@ void MegaTransferPrivate::setStreamingTransfer(bool streamingTransfer)
     this->streamingTransfer = streamingTransfer;
 }
 
+void MegaTransferPrivate::setMaxHeldBytes(long long maxHeldBytes)
+{
+    this->maxHeldBytes = maxHeldBytes;
+}
+
+long long MegaTransferPrivate::getMaxHeldBytes() const
+{
+    return maxHeldBytes;
+}
+
+MegaTransferBufferPrivate::MegaTransferBufferPrivate(DirectReadLease* lease)
+    : lease(lease)
+{
+}
+
+const char *MegaTransferBufferPrivate::getData() const
+{
+    return (const char*)lease->buf.datastart();
+}
+
+size_t MegaTransferBufferPrivate::getSize() const
+{
+    return lease->buf.datalen();
+}
+
+long long MegaTransferBufferPrivate::getOffset() const
+{
+    return lease->pos;
+}
+
 void MegaTransferPrivate::setStartTime(int64_t startTime)
 {
     if (!this->startTime)
@@ -2796,6 +3107,22 @@ void MegaTransferPrivate::startRecursiveOperation(unique_ptr<MegaRecursiveOperat
     recursiveOperation->start(node);
 }
 
+void MegaTransferPrivate::setPendingRecursiveOperation(unique_ptr<MegaRecursiveOperation> op)
+{
+    assert(op && !recursiveOperation && !pendingRecursiveOperation);
+    pendingRecursiveOperation = move(op);
+}
+
+bool MegaTransferPrivate::hasPendingRecursiveOperation() const
+{
+    return bool(pendingRecursiveOperation);
+}
+
+void MegaTransferPrivate::startPendingRecursiveOperation()
+{
+    startRecursiveOperation(move(pendingRecursiveOperation), nullptr);
+}
+
 void MegaTransferPrivate::setPath(const char* path)
 {
     if(this->path) delete [] this->path;
@@ -3127,6 +3454,7 @@ MegaRequestPrivate::MegaRequestPrivate(int type, MegaRequestListener *listener)
     mStringListMap = NULL;
     mStringTable = NULL;
     folderInfo = NULL;
+    nodeList = NULL;
     settings = NULL;
     backgroundMediaUpload = NULL;
 }
@@ -3202,6 +3530,7 @@ MegaRequestPrivate::MegaRequestPrivate(MegaRequestPrivate *request)
     this->mStringListMap = request->getMegaStringListMap() ? request->mStringListMap->copy() : NULL;
     this->mStringTable = request->getMegaStringTable() ? request->mStringTable->copy() : NULL;
     this->folderInfo = request->getMegaFolderInfo() ? request->folderInfo->copy() : NULL;
+    this->nodeList = request->getMegaNodeList() ? request->nodeList->copy() : NULL;
     this->settings = request->getMegaPushNotificationSettings() ? request->settings->copy() : NULL;
     this->backgroundMediaUpload = NULL;
 }
@@ -3316,6 +3645,17 @@ void MegaRequestPrivate::setMegaFolderInfo(const MegaFolderInfo *folderInfo)
     this->folderInfo = folderInfo ? folderInfo->copy() : NULL;
 }
 
+MegaNodeList *MegaRequestPrivate::getMegaNodeList() const
+{
+    return nodeList;
+}
+
+void MegaRequestPrivate::setMegaNodeList(MegaNodeList *nodeList)
+{
+    delete this->nodeList;
+    this->nodeList = nodeList;
+}
+
 const MegaPushNotificationSettings *MegaRequestPrivate::getMegaPushNotificationSettings() const
 {
     return settings;
@@ -3415,6 +3755,7 @@ MegaRequestPrivate::~MegaRequestPrivate()
     delete mStringListMap;
     delete mStringTable;
     delete folderInfo;
+    delete nodeList;
     delete timeZoneDetails;
     delete settings;
 
@@ -3856,6 +4197,12 @@ const char *MegaRequestPrivate::getRequestString() const
         case TYPE_GET_MISC_FLAGS: return "GET_MISC_FLAGS";
         case TYPE_RESEND_VERIFICATION_EMAIL: return "RESEND_VERIFICATION_EMAIL";
         case TYPE_SUPPORT_TICKET: return "SUPPORT_TICKET";
+        case TYPE_MOVE_NODES: return "MOVE_NODES";
+        case TYPE_REMOVE_NODES: return "REMOVE_NODES";
+        case TYPE_SET_ATTR_NODES: return "SET_ATTR_NODES";
+        case TYPE_CHAT_GRANT_ACCESS_NODES: return "CHAT_GRANT_ACCESS_NODES";
+        case TYPE_CHAT_REMOVE_ACCESS_NODES: return "CHAT_REMOVE_ACCESS_NODES";
+        case TYPE_SEARCH: return "SEARCH";
     }
     return "UNKNOWN";
 }
@@ -4164,6 +4511,16 @@ MegaNodeListPrivate::MegaNodeListPrivate(Node** newlist, int size)
         list[i] = MegaNodePrivate::fromNode(newlist[i]);
 }
 
+MegaNodeListPrivate::MegaNodeListPrivate(vector<MegaNode*>&& adopted)
+{
+    list = NULL; s = int(adopted.size());
+    if(!s) return;
+
+    list = new MegaNode*[s];
+    std::copy(adopted.begin(), adopted.end(), list);
+    adopted.clear();
+}
+
 MegaNodeListPrivate::MegaNodeListPrivate(const MegaNodeListPrivate *nodeList, bool copyChildren)
 {
     s = nodeList->size();
@@ -4863,7 +5220,10 @@ void MegaFileGet::prepare()
         }
 
         string suffix;
-        transfer->client->fsaccess->tmpnamelocal(&suffix);
+        if (!transfer->client->partialdownloadname(transfer, &suffix))
+        {
+            transfer->client->fsaccess->tmpnamelocal(&suffix);
+        }
         transfer->localfilename.append(suffix);
     }
 }
@@ -5074,11 +5434,14 @@ void MegaApiImpl::init(MegaApi *api, const char *appKey, MegaGfxProcessor* proce
     httpServer = NULL;
     httpServerMaxBufferSize = 0;
     httpServerMaxOutputSize = 0;
+    httpServerEventLoops = 1;
     httpServerEnableFiles = true;
     httpServerEnableFolders = false;
     httpServerOfflineAttributeEnabled = false;
     httpServerRestrictedMode = MegaApi::TCP_SERVER_ALLOW_CREATED_LOCAL_LINKS;
     httpServerSubtitlesSupportEnabled = false;
+    httpServerHLSSupportEnabled = false;
+    httpServerMetricsEnabled = false;
 
     ftpServer = NULL;
     ftpServerMaxBufferSize = 0;
@@ -5098,6 +5461,7 @@ void MegaApiImpl::init(MegaApi *api, const char *appKey, MegaGfxProcessor* proce
 #else
     fsAccess = new MegaFileSystemAccess(fseventsfd);
 #endif
+    fingerprintPrefetcher.reset(new UploadFingerprintPrefetcher(8, 1 << 20));
 
     if (basePath)
     {
@@ -5145,6 +5509,13 @@ void MegaApiImpl::init(MegaApi *api, const char *appKey, MegaGfxProcessor* proce
 
     //Start blocking thread
     threadExit = 0;
+#ifdef MEGA_SHARED_EVENT_LOOPS
+    sharedLoop = SharedEventLoops::get().add(this);
+    if (sharedLoop)
+    {
+        return;
+    }
+#endif
     thread.start(threadEntryPoint, this);
 }
 
@@ -5153,7 +5524,16 @@ MegaApiImpl::~MegaApiImpl()
     MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_DELETE);
     requestQueue.push(request);
     waiter->notify();
-    thread.join();
+#ifdef MEGA_SHARED_EVENT_LOOPS
+    if (sharedLoop)
+    {
+        SharedEventLoops::get().waitdone(this);
+    }
+    else
+#endif
+    {
+        thread.join();
+    }
 
     delete mPushSettings;
     delete mTimezones;    
@@ -5181,10 +5561,8 @@ MegaApiImpl* MegaApiImpl::ImplOf(MegaApi* api)
 
 int MegaApiImpl::isLoggedIn()
 {
-    sdkMutex.lock();
-    int result = client->loggedin();
-    sdkMutex.unlock();
-    return result;
+    SdkReadGuard g(sdkMutex, *client);
+    return client->loggedin();
 }
 
 void MegaApiImpl::whyAmIBlocked(bool logout, MegaRequestListener *listener)
@@ -5212,27 +5590,21 @@ char* MegaApiImpl::getMyEmail()
 
 char *MegaApiImpl::getMyUserHandle()
 {
-    sdkMutex.lock();
+    SdkReadGuard g(sdkMutex, *client);
     if (ISUNDEF(client->me))
     {
-        sdkMutex.unlock();
         return NULL;
     }
 
     char buf[12];
     Base64::btoa((const byte*)&client->me, MegaClient::USERHANDLE, buf);
-    char *result = MegaApi::strdup(buf);
-    sdkMutex.unlock();
-    return result;
+    return MegaApi::strdup(buf);
 }
 
 MegaHandle MegaApiImpl::getMyUserHandleBinary()
 {
-    MegaHandle me;
-    sdkMutex.lock();
-    me = client->me;
-    sdkMutex.unlock();
-    return me;
+    SdkReadGuard g(sdkMutex, *client);
+    return client->me;
 }
 
 MegaUser *MegaApiImpl::getMyUser()
@@ -5322,8 +5694,8 @@ bool MegaApiImpl::checkPassword(const char *password)
         }
 
         byte derivedKey[2 * SymmCipher::KEYLENGTH];
-        CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA512> pbkdf2;
-        pbkdf2.DeriveKey(derivedKey, sizeof(derivedKey), 0, (byte *)password, strlen(password),
+        PBKDF2_HMAC_SHA512 pbkdf2;
+        pbkdf2.deriveKey(derivedKey, sizeof(derivedKey), (byte *)password, strlen(password),
                          (const byte *)client->accountsalt.data(), client->accountsalt.size(), 100000);
 
         SymmCipher cipher(derivedKey);
@@ -5431,6 +5803,16 @@ void MegaApiImpl::setLogToConsole(bool enable)
     externalLogger.setLogToConsole(enable);
 }
 
+void MegaApiImpl::setLogAsync(bool enable, unsigned rateLimit)
+{
+    externalLogger.setAsync(enable, rateLimit);
+}
+
+bool MegaApiImpl::setBinaryLog(const char* path)
+{
+    return externalLogger.setBinaryLog(path);
+}
+
 void MegaApiImpl::log(int logLevel, const char *message, const char *filename, int line)
 {
     externalLogger.postLog(logLevel, message, filename, line);
@@ -6219,24 +6601,9 @@ void MegaApiImpl::loop()
             sdkMutex.unlock();
         }
 
-        if (r & Waiter::NEEDEXEC)
+        if (!execturn(r))
         {
-            WAIT_CLASS::bumpds();
-            updateBackups();
-            if (sendPendingTransfers())
-            {
-                yield();
-            }
-            sendPendingRequests();
-            sendPendingScRequest();
-            if (threadExit)
-            {
-                break;
-            }
-
-            sdkMutex.lock();
-            client->exec();
-            sdkMutex.unlock();
+            break;
         }
     }
 
@@ -6245,11 +6612,117 @@ void MegaApiImpl::loop()
     sdkMutex.unlock();
 }
 
-
-void MegaApiImpl::createFolder(const char *name, MegaNode *parent, MegaRequestListener *listener)
+bool MegaApiImpl::execturn(int r)
 {
-    MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_CREATE_FOLDER, listener);
-    if(parent) request->setParentHandle(parent->getHandle());
+    if (r & Waiter::NEEDEXEC)
+    {
+        WAIT_CLASS::bumpds();
+        updateBackups();
+        if (sendPendingTransfers())
+        {
+            yield();
+        }
+        sendPendingRequests();
+        sendPendingScRequest();
+        if (threadExit)
+        {
+            return false;
+        }
+
+        sdkMutex.lock();
+        client->exec();
+
+        if (pendingNodeUpdates.size() && Waiter::ds >= nodesUpdateDs + nodesUpdateIntervalDs)
+        {
+            fireOnPendingNodesUpdate();
+        }
+
+        prefetchBrowse();
+
+        // app threads blocked behind exec(), or the SDK thread behind them
+        if (sdkMutex.contended && Waiter::ds >= sdkMutexReportDs + SDK_MUTEX_REPORT_INTERVAL_DS)
+        {
+            LOG_info << "sdkMutex waits: " << sdkMutex.report(true);
+            sdkMutexReportDs = Waiter::ds;
+        }
+        sdkMutex.unlock();
+    }
+
+    return true;
+}
+
+#ifdef MEGA_SHARED_EVENT_LOOPS
+std::mutex MegaApiImpl::loopSharesMutex;
+std::vector<std::weak_ptr<CurlHttpIO::ConnectionShare>> MegaApiImpl::loopShares;
+
+int MegaApiImpl::waitfd()
+{
+    return waiter->eventfd();
+}
+
+void MegaApiImpl::joining(unsigned loop)
+{
+    std::shared_ptr<CurlHttpIO::ConnectionShare> share;
+    {
+        std::lock_guard<std::mutex> g(loopSharesMutex);
+        if (loopShares.size() <= loop)
+        {
+            loopShares.resize(loop + 1);
+        }
+        share = loopShares[loop].lock();
+        if (!share)
+        {
+            share = std::make_shared<CurlHttpIO::ConnectionShare>();
+            loopShares[loop] = share;
+        }
+    }
+    httpio->setconnectionshare(std::move(share));
+}
+
+// loop(), in two halves around the wait, which the loop does for all its clients at once
+dstime MegaApiImpl::prepareturn()
+{
+    sdkMutex.lock();
+    preparedWait = client->preparewait();
+    sdkMutex.unlock();
+
+    if (preparedWait)
+    {
+        return 0;
+    }
+
+    int timeoutms = waiter->arm();
+    return timeoutms < 0 ? NEVER : dstime(timeoutms / 100);
+}
+
+bool MegaApiImpl::turn()
+{
+    int r = preparedWait;
+    if (!r)
+    {
+        r = waiter->collect(0);
+        sdkMutex.lock();
+        r |= client->checkevents();
+        sdkMutex.unlock();
+    }
+
+    if (execturn(r))
+    {
+        return true;
+    }
+
+    sdkMutex.lock();
+    delete client;
+    sdkMutex.unlock();
+    return false;
+}
+#endif
+
+
+void MegaApiImpl::createFolder(const char *name, MegaNode *parent, MegaRequestListener *listener)
+{
+    MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_CREATE_FOLDER, listener);
+    if(parent) request->setParentHandle(parent->getHandle());
     request->setName(name);
     requestQueue.push(request);
     waiter->notify();
@@ -6289,6 +6762,16 @@ void MegaApiImpl::moveNode(MegaNode *node, MegaNode *newParent, const char *newN
     waiter->notify();
 }
 
+void MegaApiImpl::moveNodes(MegaNodeList *nodes, MegaNode *newParent, MegaRequestListener *listener)
+{
+    MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_MOVE_NODES, listener);
+    unique_ptr<MegaStringMap> handles(bulkNodeHandles(nodes));
+    request->setMegaStringMap(handles.get());
+    if(newParent) request->setParentHandle(newParent->getHandle());
+    requestQueue.push(request);
+    waiter->notify();
+}
+
 void MegaApiImpl::moveNode(MegaNode *node, MegaNode *newParent, MegaRequestListener *listener)
 {
     moveNode(node, newParent, nullptr, listener);
@@ -6339,6 +6822,15 @@ void MegaApiImpl::remove(MegaNode *node, bool keepversions, MegaRequestListener
     waiter->notify();
 }
 
+void MegaApiImpl::removeNodes(MegaNodeList *nodes, MegaRequestListener *listener)
+{
+    MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_REMOVE_NODES, listener);
+    unique_ptr<MegaStringMap> handles(bulkNodeHandles(nodes));
+    request->setMegaStringMap(handles.get());
+    requestQueue.push(request);
+    waiter->notify();
+}
+
 void MegaApiImpl::removeVersions(MegaRequestListener *listener)
 {
     MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_REMOVE_VERSIONS, listener);
@@ -6406,6 +6898,16 @@ void MegaApiImpl::loginToFolder(const char* megaFolderLink, MegaRequestListener
     waiter->notify();
 }
 
+void MegaApiImpl::loginToFolderSubtree(const char* megaFolderLink, MegaHandle subtree, MegaRequestListener *listener)
+{
+    MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_LOGIN, listener);
+    request->setLink(megaFolderLink);
+    request->setEmail("FOLDER");
+    request->setNodeHandle(subtree);
+    requestQueue.push(request);
+    waiter->notify();
+}
+
 void MegaApiImpl::importFileLink(const char* megaFileLink, MegaNode *parent, MegaRequestListener *listener)
 {
     MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_IMPORT_LINK, listener);
@@ -6627,6 +7129,17 @@ void MegaApiImpl::setCustomNodeAttribute(MegaNode *node, const char *attrName, c
     waiter->notify();
 }
 
+void MegaApiImpl::setCustomNodesAttribute(MegaNodeList *nodes, const char *attrName, const char *value, MegaRequestListener *listener)
+{
+    MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_SET_ATTR_NODES, listener);
+    unique_ptr<MegaStringMap> handles(bulkNodeHandles(nodes));
+    request->setMegaStringMap(handles.get());
+    request->setName(attrName);
+    request->setText(value);
+    requestQueue.push(request);
+    waiter->notify();
+}
+
 void MegaApiImpl::setNodeDuration(MegaNode *node, int secs, MegaRequestListener *listener)
 {
     MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_SET_ATTR_NODE, listener);
@@ -6701,6 +7214,12 @@ void MegaApiImpl::fetchNodes(bool resumeSyncs, MegaRequestListener *listener)
     waiter->notify();
 }
 
+void MegaApiImpl::setStagedStartup(bool enable)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->stagedstartup = enable;
+}
+
 void MegaApiImpl::getPricing(MegaRequestListener *listener)
 {
     MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_GET_PRICING, listener);
@@ -7080,6 +7599,129 @@ void MegaApiImpl::getNodeAttribute(MegaNode *node, int type, const char *dstFile
     waiter->notify();
 }
 
+int MegaApiImpl::prefetchFileAttributes(MegaHandleList *nodes, int type)
+{
+    if (!nodes)
+    {
+        return 0;
+    }
+
+    vector<handle> handles;
+    for (unsigned i = 0; i < nodes->size(); i++)
+    {
+        handles.push_back(nodes->get(i));
+    }
+
+    SdkMutexGuard g(sdkMutex);
+    int queued = client->prefetchfa(handles, fatype(type));
+    if (queued)
+    {
+        waiter->notify();
+    }
+    return queued;
+}
+
+void MegaApiImpl::setFileAttributeCacheSize(long long bytes)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->setfacachesize(bytes > 0 ? size_t(bytes) : 0);
+}
+
+void MegaApiImpl::setBrowsePrefetch(int pageSize)
+{
+    SdkMutexGuard g(sdkMutex);
+    if (!browsePrefetch.thumbnails.empty())
+    {
+        client->cancelprefetchfa(browsePrefetch.thumbnails, GfxProc::THUMBNAIL);
+    }
+    browsePrefetch = BrowsePrefetch();
+    browsePrefetch.pageSize = pageSize > 0 ? size_t(pageSize) : 0;
+}
+
+void MegaApiImpl::noteBrowse(Node* parent, int order, size_t offset, size_t count)
+{
+    if (!browsePrefetch.pageSize)
+    {
+        return;
+    }
+
+    if (parent->nodehandle != browsePrefetch.parent || order != browsePrefetch.order)
+    {
+        // navigated away: what's still queued for the previous view isn't needed soon
+        if (!browsePrefetch.thumbnails.empty())
+        {
+            client->cancelprefetchfa(browsePrefetch.thumbnails, GfxProc::THUMBNAIL);
+            browsePrefetch.thumbnails.clear();
+        }
+        browsePrefetch.parent = parent->nodehandle;
+        browsePrefetch.order = order;
+    }
+
+    // the nodes listed, as many as are shown at once, and the next page
+    browsePrefetch.first = offset;
+    browsePrefetch.last = offset + std::min(count, browsePrefetch.pageSize) + browsePrefetch.pageSize;
+    browsePrefetch.pending = true;
+    waiter->notify();
+}
+
+void MegaApiImpl::prefetchBrowse()
+{
+    if (!browsePrefetch.pending)
+    {
+        return;
+    }
+    browsePrefetch.pending = false;
+
+    Node* parent = client->nodebyhandle(browsePrefetch.parent);
+    if (!parent || parent->type == FILENODE)
+    {
+        return;
+    }
+
+    node_vector unsortedNodes;
+    const node_vector* view = &unsortedNodes;
+    std::function<bool(Node*, Node*)> comparatorFunction = getComparatorFunction(browsePrefetch.order, *client);
+    if (comparatorFunction)
+    {
+        view = &getSortedChildren(parent, browsePrefetch.order, comparatorFunction);
+    }
+    else
+    {
+        unsortedNodes.assign(parent->children.begin(), parent->children.end());
+    }
+
+    vector<handle> files;
+    for (size_t i = browsePrefetch.first; i < browsePrefetch.last && i < view->size(); i++)
+    {
+        if ((*view)[i]->type == FILENODE)
+        {
+            files.push_back((*view)[i]->nodehandle);
+        }
+    }
+    if (client->prefetchfa(files, GfxProc::THUMBNAIL))
+    {
+        browsePrefetch.thumbnails.insert(browsePrefetch.thumbnails.end(), files.begin(), files.end());
+    }
+
+    // the folders at the top of the view are the likely next ones
+    vector<Node*> folders;
+    for (size_t i = 0; i < view->size() && folders.size() < BROWSE_PREFETCH_FOLDERS; i++)
+    {
+        if ((*view)[i]->type == FOLDERNODE)
+        {
+            folders.push_back((*view)[i]);
+        }
+    }
+    for (Node* folder : folders)
+    {
+        client->pageinchildren(folder);
+        if (comparatorFunction)
+        {
+            getSortedChildren(folder, browsePrefetch.order, comparatorFunction);
+        }
+    }
+}
+
 void MegaApiImpl::cancelGetNodeAttribute(MegaNode *node, int type, MegaRequestListener *listener)
 {
     MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_CANCEL_ATTR_FILE, listener);
@@ -7310,6 +7952,9 @@ void MegaApiImpl::abortPendingActions(error preverror)
     }
     backupsMap.clear();
 
+    // their requests are finished below
+    folderCopies.clear();
+
     // -- CS Requests in progress --
     deque<MegaRequestPrivate*> requests;
     for (auto requestPair : requestMap)
@@ -7493,18 +8138,7 @@ bool MegaApiImpl::areTransfersPaused(int direction)
         return false;
     }
 
-    bool result;
-    sdkMutex.lock();
-    if(direction == MegaTransfer::TYPE_DOWNLOAD)
-    {
-        result = client->xferpaused[GET];
-    }
-    else
-    {
-        result = client->xferpaused[PUT];
-    }
-    sdkMutex.unlock();
-    return result;
+    return client->xferpaused[direction == MegaTransfer::TYPE_DOWNLOAD ? GET : PUT];
 }
 
 //-1 -> AUTO, 0 -> NONE, >0 -> b/s
@@ -7594,6 +8228,69 @@ bool MegaApiImpl::setMaxUploadSpeed(m_off_t bpslimit)
     return result;
 }
 
+bool MegaApiImpl::setHttp2(bool enable)
+{
+    SdkMutexGuard g(sdkMutex);
+    return client->httpio->sethttp2(enable);
+}
+
+long long MegaApiImpl::getConnectionStat(int stat)
+{
+    SdkMutexGuard g(sdkMutex);
+    HttpIO::ConnectionStats s = client->httpio->getconnectionstats();
+    switch (stat)
+    {
+        case MegaApi::CONNECTION_STAT_REQUESTS:
+            return s.requests;
+        case MegaApi::CONNECTION_STAT_HTTP2_REQUESTS:
+            return s.http2requests;
+        case MegaApi::CONNECTION_STAT_CONNECTIONS:
+            return s.connections;
+        case MegaApi::CONNECTION_STAT_HANDSHAKES:
+            return s.handshakes;
+        case MegaApi::CONNECTION_STAT_CONNECTIONS_PER_MINUTE:
+            return s.connectionsPerMinute;
+        case MegaApi::CONNECTION_STAT_HANDSHAKES_PER_MINUTE:
+            return s.handshakesPerMinute;
+        default:
+            return -1;
+    }
+}
+
+char* MegaApiImpl::getStorageServerHealth()
+{
+    SdkMutexGuard g(sdkMutex);
+    std::ostringstream json;
+    json << "[";
+    for (auto& it : client->storagehealth.hosts())
+    {
+        const StorageHealth::Host& h = it.second;
+        json << (json.tellp() > 1 ? "," : "")
+             << "{\"host\":\"" << it.first << "\""
+             << ",\"score\":" << client->storagehealth.score(it.first)
+             << ",\"throughput\":" << m_off_t(h.throughput)
+             << ",\"ttfb\":" << int(h.ttfbms)
+             << ",\"errorrate\":" << h.errorrate
+             << ",\"samples\":" << h.samples
+             << ",\"avoided\":" << (h.avoided && Waiter::ds - h.avoidedsince < StorageHealth::COOLDOWN_DS ? "true" : "false") << "}";
+    }
+    json << "]";
+    return MegaApi::strdup(json.str().c_str());
+}
+
+void MegaApiImpl::probeNetwork()
+{
+    SdkMutexGuard g(sdkMutex);
+    client->probenetwork();
+    waiter->notify();
+}
+
+char* MegaApiImpl::getNetworkProfile()
+{
+    SdkMutexGuard g(sdkMutex);
+    return MegaApi::strdup(client->netprofile.json().c_str());
+}
+
 int MegaApiImpl::getMaxDownloadSpeed()
 {
     return int(client->getmaxdownloadspeed());
@@ -7975,7 +8672,7 @@ void MegaApiImpl::startTimer( int64_t period, MegaRequestListener *listener)
     waiter->notify();
 }
 
-void MegaApiImpl::startUpload(bool startFirst, const char *localPath, MegaNode *parent, const char *fileName, const char *targetUser, int64_t mtime, int folderTransferTag, bool isBackup, const char *appData, bool isSourceFileTemporary, bool forceNewUpload, MegaTransferListener *listener)
+MegaTransferPrivate *MegaApiImpl::createUploadTransfer(bool startFirst, const char *localPath, MegaNode *parent, const char *fileName, const char *targetUser, int64_t mtime, int folderTransferTag, bool isBackup, const char *appData, bool isSourceFileTemporary, bool forceNewUpload, MegaTransferListener *listener)
 {
     MegaTransferPrivate* transfer = new MegaTransferPrivate(MegaTransfer::TYPE_UPLOAD, listener);
     if(localPath)
@@ -8018,8 +8715,12 @@ void MegaApiImpl::startUpload(bool startFirst, const char *localPath, MegaNode *
     }
 
     transfer->setStreamingTransfer(forceNewUpload);
+    return transfer;
+}
 
-    transferQueue.push(transfer);
+void MegaApiImpl::startUpload(bool startFirst, const char *localPath, MegaNode *parent, const char *fileName, const char *targetUser, int64_t mtime, int folderTransferTag, bool isBackup, const char *appData, bool isSourceFileTemporary, bool forceNewUpload, MegaTransferListener *listener)
+{
+    transferQueue.push(createUploadTransfer(startFirst, localPath, parent, fileName, targetUser, mtime, folderTransferTag, isBackup, appData, isSourceFileTemporary, forceNewUpload, listener));
     waiter->notify();
 }
 
@@ -8040,7 +8741,7 @@ void MegaApiImpl::startUploadForSupport(const char *localPath, bool isSourceTemp
     return startUpload(true, localPath, nullptr, nullptr, "pGTOqu7_Fek", -1, 0, false, nullptr, isSourceTemporary, false, listener);
 }
 
-void MegaApiImpl::startDownload(bool startFirst, MegaNode *node, const char* localPath, int folderTransferTag, const char *appData, MegaTransferListener *listener)
+MegaTransferPrivate *MegaApiImpl::createDownloadTransfer(bool startFirst, MegaNode *node, const char* localPath, int folderTransferTag, const char *appData, MegaTransferListener *listener)
 {
     MegaTransferPrivate* transfer = new MegaTransferPrivate(MegaTransfer::TYPE_DOWNLOAD, listener);
 
@@ -8075,14 +8776,80 @@ void MegaApiImpl::startDownload(bool startFirst, MegaNode *node, const char* loc
     {
         transfer->setFolderTransferTag(folderTransferTag);
     }
+    return transfer;
+}
 
-    transferQueue.push(transfer);
+void MegaApiImpl::startDownload(bool startFirst, MegaNode *node, const char* localPath, int folderTransferTag, const char *appData, MegaTransferListener *listener)
+{
+    transferQueue.push(createDownloadTransfer(startFirst, node, localPath, folderTransferTag, appData, listener));
     waiter->notify();
 }
 
 void MegaApiImpl::startDownload(MegaNode *node, const char* localFolder, MegaTransferListener *listener)
 { startDownload(false, node, localFolder, 0, NULL, listener); }
 
+void MegaApiImpl::startUploads(MegaStringList *localPaths, MegaNode *parent, MegaTransferListener *listener)
+{
+    MegaTransferPrivate* transfer = new MegaTransferPrivate(MegaTransfer::TYPE_UPLOAD, listener);
+    if (parent)
+    {
+        transfer->setParentHandle(parent->getHandle());
+    }
+    transfer->setMaxRetries(maxRetries);
+
+    std::vector<MegaTransferPrivate*> items;
+    for (int i = 0; localPaths && i < localPaths->size(); i++)
+    {
+        items.push_back(createUploadTransfer(false, localPaths->get(i), parent, nullptr, nullptr, -1, 0, false, nullptr, false, false, nullptr));
+    }
+    transfer->setPendingRecursiveOperation(make_unique<MegaBulkTransferController>(this, transfer, std::move(items)));
+
+    transferQueue.push(transfer);
+    waiter->notify();
+}
+
+void MegaApiImpl::startDownloads(MegaNodeList *nodes, const char *localFolder, MegaTransferListener *listener)
+{
+    MegaTransferPrivate* transfer = new MegaTransferPrivate(MegaTransfer::TYPE_DOWNLOAD, listener);
+    if (localFolder)
+    {
+        transfer->setParentPath(localFolder);
+    }
+    transfer->setMaxRetries(maxRetries);
+
+    std::vector<MegaTransferPrivate*> items;
+    for (int i = 0; nodes && i < nodes->size(); i++)
+    {
+        items.push_back(createDownloadTransfer(false, nodes->get(i), localFolder, 0, nullptr, nullptr));
+    }
+    transfer->setPendingRecursiveOperation(make_unique<MegaBulkTransferController>(this, transfer, std::move(items)));
+
+    transferQueue.push(transfer);
+    waiter->notify();
+}
+
+void MegaApiImpl::queueTransfersFirst(const std::vector<MegaTransferPrivate*>& transfers)
+{
+    for (auto it = transfers.rbegin(); it != transfers.rend(); ++it)
+    {
+        transferQueue.push_front(*it);
+    }
+    waiter->notify();
+}
+
+int MegaApiImpl::putNodes(handle target, NewNode *nn, int count, std::function<void(int, error, NewNode*)> result)
+{
+    int tag = client->nextreqtag();
+    putNodesResults[tag] = std::move(result);
+    client->putnodes(target, nn, count);
+    return tag;
+}
+
+void MegaApiImpl::cancelPutNodes(int tag)
+{
+    putNodesResults.erase(tag);
+}
+
 void MegaApiImpl::cancelTransfer(MegaTransfer *t, MegaRequestListener *listener)
 {
     MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_CANCEL_TRANSFER, listener);
@@ -8110,7 +8877,7 @@ void MegaApiImpl::cancelTransfers(int direction, MegaRequestListener *listener)
     waiter->notify();
 }
 
-void MegaApiImpl::startStreaming(MegaNode* node, m_off_t startPos, m_off_t size, MegaTransferListener *listener)
+void MegaApiImpl::startStreaming(MegaNode* node, m_off_t startPos, m_off_t size, MegaTransferListener *listener, m_off_t maxHeldBytes)
 {
     MegaTransferPrivate* transfer = new MegaTransferPrivate(MegaTransfer::TYPE_DOWNLOAD, listener);
     
@@ -8124,6 +8891,7 @@ void MegaApiImpl::startStreaming(MegaNode* node, m_off_t startPos, m_off_t size,
     }
 
     transfer->setStreamingTransfer(true);
+    transfer->setMaxHeldBytes(maxHeldBytes > 0 ? maxHeldBytes : 0);
     transfer->setStartPos(startPos);
     transfer->setEndPos(startPos + size - 1);
     transfer->setMaxRetries(maxRetries);
@@ -8137,6 +8905,51 @@ void MegaApiImpl::setStreamingMinimumRate(int bytesPerSecond)
     client->minstreamingrate = bytesPerSecond;
 }
 
+void MegaApiImpl::setStreamingReadahead(long long bytes)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->directreadcachelimit = bytes > 0 ? size_t(bytes) : 0;
+}
+
+void MegaApiImpl::setStreamingDiskCache(const char *localFolder, long long maxBytes)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->streamingblockcache.reset();
+    if (localFolder && maxBytes > 0)
+    {
+        string path = localFolder;
+        string localPath;
+        client->fsaccess->path2local(&path, &localPath);
+        client->streamingblockcache.reset(new StreamingBlockCache(*client->fsaccess, localPath, maxBytes));
+    }
+}
+
+long long MegaApiImpl::getStreamingCacheStat(int stat)
+{
+    SdkMutexGuard g(sdkMutex);
+    if (!client->streamingblockcache)
+    {
+        return -1;
+    }
+
+    StreamingBlockCache::Stats s = client->streamingblockcache->stats();
+    switch (stat)
+    {
+        case MegaApi::STREAMING_CACHE_HITS:
+            return s.hits;
+        case MegaApi::STREAMING_CACHE_MISSES:
+            return s.misses;
+        case MegaApi::STREAMING_CACHE_BYTES_SAVED:
+            return s.bytesSaved;
+        case MegaApi::STREAMING_CACHE_BYTES_STORED:
+            return s.bytesStored;
+        case MegaApi::STREAMING_CACHE_BLOCKS:
+            return s.blocks;
+        default:
+            return -1;
+    }
+}
+
 void MegaApiImpl::retryTransfer(MegaTransfer *transfer, MegaTransferListener *listener)
 {
     MegaTransferPrivate *t = dynamic_cast<MegaTransferPrivate*>(transfer);
@@ -8399,21 +9212,14 @@ bool MegaApiImpl::isSynced(MegaNode *n)
 void MegaApiImpl::setExcludedNames(vector<string> *excludedNames)
 {
     sdkMutex.lock();
-    if (!excludedNames)
-    {
-        this->excludedNames.clear();
-        sdkMutex.unlock();
-        return;
-    }
-
-    this->excludedNames.clear();
-    for (unsigned int i = 0; i < excludedNames->size(); i++)
+    vector<string> names;
+    for (unsigned int i = 0; excludedNames && i < excludedNames->size(); i++)
     {
         string name = excludedNames->at(i);
         fsAccess->normalize(&name);
         if (name.size())
         {
-            this->excludedNames.push_back(name);
+            names.push_back(name);
             LOG_debug << "Excluded name: " << name;
         }
         else
@@ -8421,21 +9227,15 @@ void MegaApiImpl::setExcludedNames(vector<string> *excludedNames)
             LOG_warn << "Invalid excluded name: " << excludedNames->at(i);
         }
     }
+    syncExclusions.setNames(names);
     sdkMutex.unlock();
 }
 
 void MegaApiImpl::setExcludedPaths(vector<string> *excludedPaths)
 {
     sdkMutex.lock();
-    if (!excludedPaths)
-    {
-        this->excludedPaths.clear();
-        sdkMutex.unlock();
-        return;
-    }
-
-    this->excludedPaths.clear();
-    for (unsigned int i = 0; i < excludedPaths->size(); i++)
+    vector<string> paths;
+    for (unsigned int i = 0; excludedPaths && i < excludedPaths->size(); i++)
     {
         string path = excludedPaths->at(i);
         fsAccess->normalize(&path);
@@ -8447,7 +9247,7 @@ void MegaApiImpl::setExcludedPaths(vector<string> *excludedPaths)
                 path.insert(0, "\\\\?\\");
             }
     #endif
-            this->excludedPaths.push_back(path);
+            paths.push_back(path);
             LOG_debug << "Excluded path: " << path;
         }
         else
@@ -8455,6 +9255,7 @@ void MegaApiImpl::setExcludedPaths(vector<string> *excludedPaths)
             LOG_warn << "Invalid excluded path: " << excludedPaths->at(i);
         }
     }
+    syncExclusions.setPaths(paths);
     sdkMutex.unlock();
 }
 
@@ -8468,6 +9269,60 @@ void MegaApiImpl::setExclusionUpperSizeLimit(long long limit)
     syncUpperSizeLimit = limit;
 }
 
+void MegaApiImpl::setSyncContentCheck(long long minSize)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->synccontenthashminsize = minSize > 0 ? minSize : 0;
+}
+
+void MegaApiImpl::setSyncScanThreads(int threads)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->setsyncscanthreads(threads > 0 ? unsigned(threads) : 0);
+}
+
+void MegaApiImpl::setSyncDebrisThreads(int threads)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->setsyncdebristhreads(threads > 0 ? unsigned(threads) : 0, []() -> FileSystemAccess* { return new MegaFileSystemAccess; });
+}
+
+void MegaApiImpl::setSyncFingerprintPrefetch(int files)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->setsyncprefetch(files > 0 ? size_t(files) : 0, []() -> FileSystemAccess* { return new MegaFileSystemAccess; });
+}
+
+void MegaApiImpl::setSyncMaxVersionsPerHour(int versions)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->syncmaxversionsperhour = versions > 0 ? unsigned(versions) : 0;
+}
+
+void MegaApiImpl::setSyncDirtySubtreesOnly(bool enable)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->syncdirtysubtrees = enable;
+}
+
+void MegaApiImpl::setNetworkSyncPolling(bool enable)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->syncnetworkpoll = enable;
+}
+
+bool MegaApiImpl::setFilesystemWideNotifications(bool enable)
+{
+    SdkMutexGuard g(sdkMutex);
+    return client->fsaccess->setfswidenotify(enable);
+}
+
+long long MegaApiImpl::getNumNotifyWatches()
+{
+    SdkMutexGuard g(sdkMutex);
+    return (long long)client->fsaccess->notifywatches();
+}
+
 void MegaApiImpl::setExcludedRegularExpressions(MegaSync *sync, MegaRegExp *regExp)
 {
     if (!sync)
@@ -8901,11 +9756,13 @@ bool MegaApiImpl::httpServerStart(bool localOnly, int port, bool useTLS, const c
     httpServer = new MegaHTTPServer(this, basePath, useTLS, certificatepath ? certificatepath : string(), keypath ? keypath : string(), useIPv6);
     httpServer->setMaxBufferSize(httpServerMaxBufferSize);
     httpServer->setMaxOutputSize(httpServerMaxOutputSize);
+    httpServer->setEventLoops(httpServerEventLoops);
     httpServer->enableFileServer(httpServerEnableFiles);
     httpServer->enableOfflineAttribute(httpServerOfflineAttributeEnabled);
     httpServer->enableFolderServer(httpServerEnableFolders);
     httpServer->setRestrictedMode(httpServerRestrictedMode);
     httpServer->enableSubtitlesSupport(httpServerRestrictedMode);
+    httpServer->enableHLSSupport(httpServerHLSSupportEnabled);
 
     bool result = httpServer->start(port, localOnly);
     if (!result)
@@ -9126,6 +9983,46 @@ int MegaApiImpl::httpServerGetMaxOutputSize()
     return value;
 }
 
+void MegaApiImpl::httpServerSetEventLoops(int loops)
+{
+    sdkMutex.lock();
+    httpServerEventLoops = loops <= 1 ? 1 : loops;
+    sdkMutex.unlock();
+}
+
+int MegaApiImpl::httpServerGetEventLoops()
+{
+    sdkMutex.lock();
+    int value = httpServerEventLoops;
+    sdkMutex.unlock();
+    return value;
+}
+
+bool MegaApiImpl::getLocalCopy(MegaNode *n, string *localpath)
+{
+    if (!n)
+    {
+        return false;
+    }
+
+#ifdef ENABLE_SYNC
+    SdkMutexGuard g(sdkMutex);
+    Node *node = client->nodebyhandle(n->getHandle());
+
+    // only synced files known to match the cloud version
+    if (!node || node->type != FILENODE || !node->localnode || node->localnode->node != node
+            || !(static_cast<const FileFingerprint&>(*node->localnode) == *node))
+    {
+        return false;
+    }
+
+    node->localnode->getlocalpath(localpath, true);
+    return true;
+#else
+    return false;
+#endif
+}
+
 void MegaApiImpl::httpServerEnableFileServer(bool enable)
 {
     sdkMutex.lock();
@@ -9214,6 +10111,38 @@ bool MegaApiImpl::httpServerIsSubtitlesSupportEnabled()
     return httpServerSubtitlesSupportEnabled;
 }
 
+void MegaApiImpl::httpServerEnableHLSSupport(bool enable)
+{
+    sdkMutex.lock();
+    httpServerHLSSupportEnabled = enable;
+    if (httpServer)
+    {
+        httpServer->enableHLSSupport(httpServerHLSSupportEnabled);
+    }
+    sdkMutex.unlock();
+}
+
+bool MegaApiImpl::httpServerIsHLSSupportEnabled()
+{
+    return httpServerHLSSupportEnabled;
+}
+
+void MegaApiImpl::httpServerEnableMetrics(bool enable)
+{
+    sdkMutex.lock();
+    httpServerMetricsEnabled = enable;
+    if (httpServer)
+    {
+        httpServer->enableMetrics(httpServerMetricsEnabled);
+    }
+    sdkMutex.unlock();
+}
+
+bool MegaApiImpl::httpServerIsMetricsEnabled()
+{
+    return httpServerMetricsEnabled;
+}
+
 bool MegaApiImpl::httpServerIsLocalOnly()
 {
     bool localOnly = true;
@@ -9673,6 +10602,28 @@ void MegaApiImpl::removeAccessInChat(MegaHandle chatid, MegaNode *n, MegaHandle
     waiter->notify();
 }
 
+void MegaApiImpl::grantAccessToNodesInChat(MegaHandle chatid, MegaNodeList *nodes, MegaHandle uh, MegaRequestListener *listener)
+{
+    MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_CHAT_GRANT_ACCESS_NODES, listener);
+    unique_ptr<MegaStringMap> handles(bulkNodeHandles(nodes));
+    request->setMegaStringMap(handles.get());
+    request->setParentHandle(chatid);
+    request->setEmail(Base64Str<MegaClient::USERHANDLE>(uh));
+    requestQueue.push(request);
+    waiter->notify();
+}
+
+void MegaApiImpl::removeAccessToNodesInChat(MegaHandle chatid, MegaNodeList *nodes, MegaHandle uh, MegaRequestListener *listener)
+{
+    MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_CHAT_REMOVE_ACCESS_NODES, listener);
+    unique_ptr<MegaStringMap> handles(bulkNodeHandles(nodes));
+    request->setMegaStringMap(handles.get());
+    request->setParentHandle(chatid);
+    request->setEmail(Base64Str<MegaClient::USERHANDLE>(uh));
+    requestQueue.push(request);
+    waiter->notify();
+}
+
 void MegaApiImpl::updateChatPermissions(MegaHandle chatid, MegaHandle uh, int privilege, MegaRequestListener *listener)
 {
     MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_CHAT_UPDATE_PERMISSIONS, listener);
@@ -9766,11 +10717,9 @@ MegaHandleList *MegaApiImpl::getAttachmentAccess(MegaHandle chatid, MegaHandle h
         attachments_map::iterator ita = itc->second->attachedNodes.find(h);
         if (ita != itc->second->attachedNodes.end())
         {
-            set<handle> userList = ita->second;
-            set<handle>::iterator ituh;
-            for (ituh = userList.begin(); ituh != userList.end(); ituh++)
+            for (handle uh : ita->second)
             {
-                uhList->addMegaHandle(*ituh);
+                uhList->addMegaHandle(uh);
             }
         }
     }
@@ -9797,8 +10746,7 @@ bool MegaApiImpl::hasAccessToAttachment(MegaHandle chatid, MegaHandle h, MegaHan
         attachments_map::iterator ita = itc->second->attachedNodes.find(h);
         if (ita != itc->second->attachedNodes.end())
         {
-            set<handle> userList = ita->second;
-            ret = (userList.find(uh) != userList.end());
+            ret = (ita->second.find(uh) != ita->second.end());
         }
     }
 
@@ -9807,6 +10755,31 @@ bool MegaApiImpl::hasAccessToAttachment(MegaHandle chatid, MegaHandle h, MegaHan
     return ret;
 }
 
+MegaHandleList *MegaApiImpl::getAttachmentChats(MegaHandle h)
+{
+    MegaHandleList *chatList = new MegaHandleListPrivate();
+
+    if (h == INVALID_HANDLE)
+    {
+        return chatList;
+    }
+
+    sdkMutex.lock();
+
+    auto it = client->attachmentchats.find(h);
+    if (it != client->attachmentchats.end())
+    {
+        for (handle chatid : it->second)
+        {
+            chatList->addMegaHandle(chatid);
+        }
+    }
+
+    sdkMutex.unlock();
+
+    return chatList;
+}
+
 const char* MegaApiImpl::getFileAttribute(MegaHandle h)
 {
     char* fileAttributes = NULL;
@@ -10143,14 +11116,20 @@ MegaUser* MegaApiImpl::getContact(const char *uid)
 }
 
 MegaUserAlertList* MegaApiImpl::getUserAlerts()
+{
+    return getUserAlerts(0, INT_MAX);
+}
+
+MegaUserAlertList* MegaApiImpl::getUserAlerts(int start, int count)
 {
     sdkMutex.lock();
 
+    const UserAlerts::Alerts& alerts = client->useralerts.alerts;
     vector<UserAlert::Base*> v;
-    v.reserve(client->useralerts.alerts.size());
-    for (UserAlerts::Alerts::iterator it = client->useralerts.alerts.begin(); it != client->useralerts.alerts.end(); ++it)
+    if (start >= 0 && count > 0 && size_t(start) < alerts.size())
     {
-        v.push_back(*it);
+        size_t end = std::min(alerts.size(), size_t(start) + size_t(count));
+        v.assign(alerts.begin() + start, alerts.begin() + end);
     }
     MegaUserAlertList *alertList = new MegaUserAlertListPrivate(v.data(), int(v.size()), client);
 
@@ -10575,6 +11554,7 @@ bool MegaApiImpl::processMegaTree(MegaNode* n, MegaTreeProcessor* processor, boo
 
     if (node->type != FILENODE)
     {
+        client->pageinchildren(node);
         for (node_list::iterator it = node->children.begin(); it != node->children.end(); )
         {
             MegaNode *megaNode = MegaNodePrivate::fromNode(*it++);
@@ -10624,34 +11604,13 @@ MegaNodeList *MegaApiImpl::search(const char *searchString, MegaCancelToken *can
     }
 
     node_vector result;
-    Node *node;
-
-    // rootnodes
-    for (unsigned int i = 0; i < (sizeof client->rootnodes / sizeof *client->rootnodes)
-          && !(cancelToken && cancelToken->isCancelled()); i++)
-    {
-        node = client->nodebyhandle(client->rootnodes[i]);
+    NodeSearchFilter filter;
+    filter.pattern = NodeSearchFilter::fold(searchString);
 
-        SearchTreeProcessor searchProcessor(searchString);
-        processTree(node, &searchProcessor, true, cancelToken);
-        node_vector& vNodes = searchProcessor.getResults();
-
-        result.insert(result.end(), vNodes.begin(), vNodes.end());
-    }
-
-    // inshares
-    MegaShareList *shares = getInSharesList(MegaApi::ORDER_NONE);
-    for (int i = 0; i < shares->size() && !(cancelToken && cancelToken->isCancelled()); i++)
+    if (!searchNodeNameIndex(filter, NULL, cancelToken, result))
     {
-        node = client->nodebyhandle(shares->get(i)->getNodeHandle());
-
-        SearchTreeProcessor searchProcessor(searchString);
-        processTree(node, &searchProcessor, true, cancelToken);
-        vector<Node *>& vNodes  = searchProcessor.getResults();
-
-        result.insert(result.end(), vNodes.begin(), vNodes.end());
+        searchTree(filter, NULL, cancelToken, result);
     }
-    delete shares;
 
     sortByComparatorFunction(result, order, *client);
     MegaNodeList *nodeList = new MegaNodeListPrivate(result.data(), int(result.size()));
@@ -10861,76 +11820,422 @@ void MegaApiImpl::acknowledgeUserAlerts(MegaRequestListener *listener)
     waiter->notify();
 }
 
-void MegaApiImpl::disableGfxFeatures(bool disable)
+void MegaApiImpl::setDatabaseProfile(int profile)
 {
-    client->gfxdisabled = disable;
+    SdkMutexGuard g(sdkMutex);
+    if (dbAccess)
+    {
+        dbAccess->profile = DbProfile::byid(profile);
+    }
 }
 
-bool MegaApiImpl::areGfxFeaturesDisabled()
+void MegaApiImpl::setDatabaseTuning(int synchronous, int cacheSizeKiB, long long mmapSize, int tempStore, int pageSize, int walAutocheckpoint)
 {
-    return !client->gfx || client->gfxdisabled;
+    SdkMutexGuard g(sdkMutex);
+    if (dbAccess)
+    {
+        DbProfile& p = dbAccess->profile;
+        p.id = DbProfile::PROFILE_CUSTOM;
+        p.synchronous = synchronous;
+        p.cacheSizeKiB = cacheSizeKiB;
+        p.mmapSize = mmapSize;
+        p.tempStore = tempStore;
+        p.pageSize = pageSize;
+        p.walAutocheckpoint = walAutocheckpoint;
+    }
 }
 
-const char *MegaApiImpl::getUserAgent()
+int MegaApiImpl::getDatabaseProfile()
 {
-    return client->useragent.c_str();
+    SdkMutexGuard g(sdkMutex);
+    return dbAccess ? dbAccess->profile.id : int(DbProfile::PROFILE_DEFAULT);
 }
 
-const char *MegaApiImpl::getBasePath()
+void MegaApiImpl::setDatabaseWriteBehind(bool enable)
 {
-    return basePath.c_str();
+    SdkMutexGuard g(sdkMutex);
+    client->dbwritebehind = enable;
 }
 
-void MegaApiImpl::changeApiUrl(const char *apiURL, bool disablepkp)
+void MegaApiImpl::setSharedNodeView(const char *path, const char *base64Key)
 {
-    sdkMutex.lock();
-    MegaClient::APIURL = apiURL;
-    if(disablepkp)
+    string key;
+    if (path && base64Key)
     {
-        MegaClient::disablepkp = true;
+        key.resize(SymmCipher::KEYLENGTH);
+        if (Base64::atob(base64Key, (byte*)key.data(), int(key.size())) != int(key.size()))
+        {
+            LOG_err << "Invalid key for the shared node view";
+            return;
+        }
     }
 
-    client->abortbackoff();
-    client->disconnect();
-    sdkMutex.unlock();
+    SdkMutexGuard g(sdkMutex);
+    client->setsharednodeview(path && base64Key ? path : "", key);
 }
 
-bool MegaApiImpl::setLanguage(const char *languageCode)
+void MegaApiImpl::setNodeMemoryBudget(int megabytes)
 {
-    string code;
-    if (!getLanguageCode(languageCode, &code))
-    {
-        return false;
-    }
+    SdkMutexGuard g(sdkMutex);
+    client->setlowmemory(megabytes > 0 ? size_t(megabytes) << 20 : 0);
+}
 
-    bool val;
-    sdkMutex.lock();
-    val = client->setlang(&code);
-    sdkMutex.unlock();
-    return val;
+void MegaApiImpl::setCompactVersions(bool enable)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->setcompactversions(enable);
 }
 
-void MegaApiImpl::setLanguagePreference(const char *languageCode, MegaRequestListener *listener)
+void MegaApiImpl::setMemoryBudget(long long bytes)
 {
-    setUserAttr(MegaApi::USER_ATTR_LANGUAGE, languageCode, listener);
+    SdkMutexGuard g(sdkMutex);
+    client->setmemorybudget(bytes > 0 ? size_t(bytes) : 0);
 }
 
-void MegaApiImpl::getLanguagePreference(MegaRequestListener *listener)
+long long MegaApiImpl::getMemoryUsage(int subsystem)
 {
-    getUserAttr(NULL, MegaApi::USER_ATTR_LANGUAGE, NULL, 0, listener);
+    SdkMutexGuard g(sdkMutex);
+    return (long long)client->memoryusage(memsubsystem_t(subsystem));
 }
 
-bool MegaApiImpl::getLanguageCode(const char *languageCode, string *code)
+int MegaApiImpl::getMemoryPressure()
 {
-    if (!languageCode || !code)
+    SdkMutexGuard g(sdkMutex);
+    return client->memorypressure;
+}
+
+void MegaApiImpl::setCallbackIntervals(int nodesMs, int transfersMs)
+{
+    SdkMutexGuard g(sdkMutex);
+    nodesUpdateIntervalDs = nodesMs > 0 ? dstime(nodesMs) / 100 : 0;
+    transferUpdateIntervalDs = std::max<dstime>(1, transfersMs > 0 ? dstime(transfersMs) / 100 : 0);
+
+    // anything held back goes out at the next turn of the loop
+    if (pendingNodeUpdates.size())
     {
-        return false;
+        client->appwakeupds = std::min(client->appwakeupds, nodesUpdateDs + nodesUpdateIntervalDs);
+        waiter->notify();
     }
+}
 
-    size_t len = strlen(languageCode);
-    if (len < 2 || len > 7)
+void MegaApiImpl::setFolderDownloadOrder(int order)
+{
+    SdkMutexGuard g(sdkMutex);
+    folderDownloadOrder = order;
+}
+
+int MegaApiImpl::getFolderDownloadOrder()
+{
+    SdkMutexGuard g(sdkMutex);
+    return folderDownloadOrder;
+}
+
+void MegaApiImpl::setDownloadPreallocation(bool enable)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->preallocatedownloads = enable;
+}
+
+void MegaApiImpl::setPartialDownloadResumption(bool enable)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->resumepartialdownloads = enable;
+}
+
+void MegaApiImpl::setMobileEfficiency(bool enable)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->setmobileefficiency(enable);
+    waiter->notify();
+}
+
+long long MegaApiImpl::getRadioWakeupsSaved()
+{
+    SdkMutexGuard g(sdkMutex);
+    return (long long)client->reqs.csDeferredRidealongs;
+}
+
+void MegaApiImpl::setWorkerThreads(int threads)
+{
+    WorkerPool::get().setthreads(threads < 0 ? -1 : threads);
+}
+
+void MegaApiImpl::setWorkerClassLimit(int workerClass, int maxThreads)
+{
+    if (workerClass < 0 || workerClass >= WorkerPool::WORK_CLASSES)
     {
-        return false;
+        return;
+    }
+    WorkerPool::get().setclasslimit(WorkerPool::workclass_t(workerClass), maxThreads > 0 ? unsigned(maxThreads) : 0);
+}
+
+void MegaApiImpl::setWorkerAffinity(long long cpuMask)
+{
+    WorkerPool::get().setaffinity(uint64_t(cpuMask));
+}
+
+void MegaApiImpl::setSharedEventLoops(int threads)
+{
+#ifdef MEGA_SHARED_EVENT_LOOPS
+    SharedEventLoops::get().setthreads(threads > 0 ? unsigned(threads) : 0);
+#else
+    if (threads > 0)
+    {
+        LOG_warn << "Shared event loops are not supported on this platform";
+    }
+#endif
+}
+
+void MegaApiImpl::setDownloadWriteCoalescing(int bytes)
+{
+    size_t size = 0;
+    if (bytes > 0)
+    {
+        size = std::max<size_t>(size_t(bytes), 1 << 20);
+        if (size > MegaClient::MAX_COALESCED_DOWNLOAD_WRITE)
+        {
+            size = MegaClient::MAX_COALESCED_DOWNLOAD_WRITE;
+        }
+    }
+
+    SdkMutexGuard g(sdkMutex);
+    client->coalesceddownloadwrites = size;
+}
+
+void MegaApiImpl::setUploadReadahead(int bytes)
+{
+    size_t size = bytes > 0 ? size_t(bytes) : 0;
+    if (size > MegaClient::MAX_UPLOAD_READAHEAD)
+    {
+        size = MegaClient::MAX_UPLOAD_READAHEAD;
+    }
+
+    SdkMutexGuard g(sdkMutex);
+    client->uploadreadahead = size;
+}
+
+void MegaApiImpl::setNodeScope(MegaHandleList *folders)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->nodescope.clear();
+    for (unsigned i = 0; folders && i < folders->size(); i++)
+    {
+        client->nodescope.insert(folders->get(i));
+    }
+}
+
+void MegaApiImpl::pinNode(MegaNode *node, bool pin)
+{
+    if (node)
+    {
+        SdkMutexGuard g(sdkMutex);
+        client->pinnode(node->getHandle(), pin);
+    }
+}
+
+void MegaApiImpl::setApiPipelining(int connections)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->reqs.setpipelinedepth(connections > 0 ? unsigned(connections) : 0);
+}
+
+void MegaApiImpl::setRequestCompression(long long minBatchSize)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->reqs.setcompression(minBatchSize > 0 ? size_t(minBatchSize) : 0);
+}
+
+void MegaApiImpl::setAutoConnections(int direction, bool enable, int budget)
+{
+    if (direction != PUT && direction != GET)
+    {
+        return;
+    }
+
+    SdkMutexGuard g(sdkMutex);
+    client->setconnectionbudget(budget > 0 ? unsigned(budget) : 1);
+    client->setautoconnections(direction_t(direction), enable);
+}
+
+// the fair scheduler, installed if not yet.  Requires sdkMutex
+FairTransferScheduler* MegaApiImpl::fairTransferScheduler()
+{
+    FairTransferScheduler* scheduler = dynamic_cast<FairTransferScheduler*>(client->transferscheduler.get());
+    if (!scheduler)
+    {
+        scheduler = new FairTransferScheduler;
+        client->transferscheduler.reset(scheduler);
+    }
+    return scheduler;
+}
+
+void MegaApiImpl::setFairTransferScheduling(bool enable)
+{
+    SdkMutexGuard g(sdkMutex);
+    if (enable)
+    {
+        fairTransferScheduler();
+    }
+    else
+    {
+        client->transferscheduler.reset();
+    }
+}
+
+void MegaApiImpl::setTransferGroupWeight(int folderTransferTag, int weight)
+{
+    SdkMutexGuard g(sdkMutex);
+    fairTransferScheduler()->setweight(folderTransferTag, weight > 0 ? unsigned(weight) : 1);
+}
+
+void MegaApiImpl::setTransferGroupMinSpeed(int folderTransferTag, long long bytesPerSecond)
+{
+    SdkMutexGuard g(sdkMutex);
+    fairTransferScheduler()->setminspeed(folderTransferTag, bytesPerSecond);
+}
+
+void MegaApiImpl::setSmallFileFastLane(long long maxFileSize, int slots)
+{
+    SdkMutexGuard g(sdkMutex);
+    fairTransferScheduler()->setfastlane(maxFileSize, slots > 0 ? unsigned(slots) : 0);
+}
+
+void MegaApiImpl::setTotalBandwidthLimit(long long bytesPerSecond)
+{
+    SdkMutexGuard g(sdkMutex);
+    httpio->shaper.setlimit(bytesPerSecond > 0 ? bytesPerSecond : 0);
+}
+
+void MegaApiImpl::setTransferGroupBandwidthLimit(int folderTransferTag, long long bytesPerSecond)
+{
+    SdkMutexGuard g(sdkMutex);
+    httpio->shaper.setgrouplimit(folderTransferTag, bytesPerSecond);
+}
+
+bool MegaApiImpl::addBandwidthSchedule(const char* cronExpression, long long durationSeconds,
+                                       long long downloadBytesPerSecond, long long uploadBytesPerSecond)
+{
+    if (!cronExpression)
+    {
+        return false;
+    }
+
+    SdkMutexGuard g(sdkMutex);
+    return httpio->shaper.addschedule(cronExpression, durationSeconds,
+                                      std::max(downloadBytesPerSecond, 0ll), std::max(uploadBytesPerSecond, 0ll));
+}
+
+void MegaApiImpl::clearBandwidthSchedules()
+{
+    SdkMutexGuard g(sdkMutex);
+    httpio->shaper.clearschedules();
+}
+
+void MegaApiImpl::setUploadCompletionBatching(int maxFiles)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->setputnodesbatch(maxFiles > 0 ? unsigned(maxFiles) : 1);
+}
+
+void MegaApiImpl::setTransferBufferPoolLimit(long long bytes)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->setbufferpoollimit(bytes > 0 ? size_t(bytes) : 0);
+}
+
+void MegaApiImpl::setUploadFingerprintLookahead(int uploads)
+{
+    SdkMutexGuard g(sdkMutex);
+    fingerprintPrefetcher.reset();
+    if (uploads > 0)
+    {
+        fingerprintPrefetcher.reset(new UploadFingerprintPrefetcher(unsigned(uploads), 1 << 20));
+    }
+}
+
+void MegaApiImpl::disableGfxFeatures(bool disable)
+{
+    client->gfxdisabled = disable;
+}
+
+bool MegaApiImpl::areGfxFeaturesDisabled()
+{
+    return !client->gfx || client->gfxdisabled;
+}
+
+void MegaApiImpl::setGfxIsolation(bool enable)
+{
+    if (gfxAccess)
+    {
+        gfxAccess->setisolated(enable);
+    }
+}
+
+bool MegaApiImpl::isGfxIsolated()
+{
+    return gfxAccess && gfxAccess->getisolated();
+}
+
+const char *MegaApiImpl::getUserAgent()
+{
+    return client->useragent.c_str();
+}
+
+const char *MegaApiImpl::getBasePath()
+{
+    return basePath.c_str();
+}
+
+void MegaApiImpl::changeApiUrl(const char *apiURL, bool disablepkp)
+{
+    sdkMutex.lock();
+    MegaClient::APIURL = apiURL;
+    if(disablepkp)
+    {
+        MegaClient::disablepkp = true;
+    }
+
+    client->abortbackoff();
+    client->disconnect();
+    sdkMutex.unlock();
+}
+
+bool MegaApiImpl::setLanguage(const char *languageCode)
+{
+    string code;
+    if (!getLanguageCode(languageCode, &code))
+    {
+        return false;
+    }
+
+    bool val;
+    sdkMutex.lock();
+    val = client->setlang(&code);
+    sdkMutex.unlock();
+    return val;
+}
+
+void MegaApiImpl::setLanguagePreference(const char *languageCode, MegaRequestListener *listener)
+{
+    setUserAttr(MegaApi::USER_ATTR_LANGUAGE, languageCode, listener);
+}
+
+void MegaApiImpl::getLanguagePreference(MegaRequestListener *listener)
+{
+    getUserAttr(NULL, MegaApi::USER_ATTR_LANGUAGE, NULL, 0, listener);
+}
+
+bool MegaApiImpl::getLanguageCode(const char *languageCode, string *code)
+{
+    if (!languageCode || !code)
+    {
+        return false;
+    }
+
+    size_t len = strlen(languageCode);
+    if (len < 2 || len > 7)
+    {
+        return false;
     }
 
     code->clear();
@@ -11132,19 +12437,53 @@ bool MegaApiImpl::processTree(Node* node, TreeProcessor* processor, bool recursi
         return 1;
     }
 
-    if (recursive && node->type != FILENODE)
+    // children before their parent, with an explicit stack, and the cancel token checked in batches
+    struct Pending
     {
-        for (node_list::iterator it = node->children.begin(); it != node->children.end(); )
+        Node* node;
+        node_list::iterator next;
+    };
+    vector<Pending> stack;
+    unsigned processed = 0;
+
+    auto push = [&](Node* n)
+    {
+        if (recursive && n->type != FILENODE)
         {
-            if (!processTree(*it++, processor, recursive, cancelToken))
-            {
-                return 0;
-            }
+            client->pageinchildren(n);
+            stack.push_back({ n, n->children.begin() });
+        }
+        else
+        {
+            stack.push_back({ n, n->children.end() });
+        }
+    };
+
+    push(node);
+    while (!stack.empty())
+    {
+        Pending& top = stack.back();
+        if (top.next != top.node->children.end())
+        {
+            push(*top.next++);
+            continue;
+        }
+
+        Node* done = top.node;
+        stack.pop_back();
+
+        if (!processor->processNode(done))
+        {
+            return 0;
+        }
+
+        if (!(++processed % PROCESSTREE_CANCELBATCH) && cancelToken && cancelToken->isCancelled())
+        {
+            return 0;
         }
     }
 
-    bool result = processor->processNode(node);
-    return result;
+    return 1;
 }
 
 MegaNodeList* MegaApiImpl::search(MegaNode* n, const char* searchString, MegaCancelToken *cancelToken, bool recursive, int order)
@@ -11172,7 +12511,19 @@ MegaNodeList* MegaApiImpl::search(MegaNode* n, const char* searchString, MegaCan
         return new MegaNodeListPrivate();
     }
 
-    SearchTreeProcessor searchProcessor(searchString);
+    node_vector result;
+    NodeSearchFilter filter;
+    filter.pattern = NodeSearchFilter::fold(searchString);
+
+    // a single folder is quicker to walk than the whole index
+    if (recursive && searchNodeNameIndex(filter, node, cancelToken, result))
+    {
+        sortByComparatorFunction(result, order, *client);
+        return new MegaNodeListPrivate(result.data(), int(result.size()));
+    }
+
+    SearchTreeProcessor searchProcessor(filter);
+    client->pageinchildren(node);
     for (node_list::iterator it = node->children.begin(); it != node->children.end()
          && !(cancelToken && cancelToken->isCancelled()); )
     {
@@ -11186,6 +12537,41 @@ MegaNodeList* MegaApiImpl::search(MegaNode* n, const char* searchString, MegaCan
     return nodeList;
 }
 
+MegaNodeList* MegaApiImpl::searchByPattern(MegaNode* n, const char* pattern, int type, long long minSize, long long maxSize,
+                                           long long minMtime, long long maxMtime, MegaCancelToken *cancelToken, int order)
+{
+    if (!pattern || (cancelToken && cancelToken->isCancelled()))
+    {
+        return new MegaNodeListPrivate();
+    }
+
+    SdkMutexGuard g(sdkMutex);
+
+    Node *node = NULL;
+    if (n && !(node = client->nodebyhandle(n->getHandle())))
+    {
+        return new MegaNodeListPrivate();
+    }
+
+    NodeSearchFilter filter;
+    filter.pattern = NodeSearchFilter::fold(pattern);
+    filter.glob = true;
+    filter.type = type;
+    filter.minSize = minSize;
+    filter.maxSize = maxSize;
+    filter.minMtime = minMtime;
+    filter.maxMtime = maxMtime;
+
+    node_vector result;
+    if (!searchNodeNameIndex(filter, node, cancelToken, result))
+    {
+        searchTree(filter, node, cancelToken, result);
+    }
+
+    sortByComparatorFunction(result, order, *client);
+    return new MegaNodeListPrivate(result.data(), int(result.size()));
+}
+
 long long MegaApiImpl::getSize(MegaNode *n)
 {
     if(!n) return 0;
@@ -11491,6 +12877,7 @@ MegaNode *MegaApiImpl::getNodeByCRC(const char *crc, MegaNode *parent)
     byte binarycrc[sizeof(node->crc)];
     Base64::atob(crc, binarycrc, sizeof(binarycrc));
 
+    client->pageinchildren(node);
     for (node_list::iterator it = node->children.begin(); it != node->children.end(); it++)
     {
         Node *child = (*it);
@@ -11506,13 +12893,328 @@ MegaNode *MegaApiImpl::getNodeByCRC(const char *crc, MegaNode *parent)
     return NULL;
 }
 
-SearchTreeProcessor::SearchTreeProcessor(const char *search) { this->search = search; }
+SearchTreeProcessor::SearchTreeProcessor(const char *search)
+    : valid(search != NULL)
+{
+    if (search)
+    {
+        filter.pattern = NodeSearchFilter::fold(search);
+    }
+}
 
-#if defined(_WIN32) || defined(__APPLE__)
+SearchTreeProcessor::SearchTreeProcessor(const NodeSearchFilter& filter)
+    : filter(filter), valid(true)
+{
+}
 
-char *strcasestr(const char *string, const char *substring)
+string NodeSearchFilter::fold(const char* name)
 {
-    int i, j;
+    string folded(name);
+    for (char& c : folded)
+    {
+        c = char(tolower((unsigned char)c));
+    }
+    return folded;
+}
+
+string NodeSearchFilter::literal() const
+{
+    if (!glob)
+    {
+        return pattern;
+    }
+
+    size_t best = 0, bestLength = 0;
+    for (size_t i = 0; i < pattern.size(); )
+    {
+        size_t j = pattern.find_first_of("*?", i);
+        if (j == string::npos)
+        {
+            j = pattern.size();
+        }
+
+        if (j - i > bestLength)
+        {
+            best = i;
+            bestLength = j - i;
+        }
+        i = j + 1;
+    }
+    return pattern.substr(best, bestLength);
+}
+
+bool NodeSearchFilter::matchesName(const char* folded, size_t length) const
+{
+    if (!glob)
+    {
+        return pattern.empty() || std::search(folded, folded + length, pattern.begin(), pattern.end()) != folded + length;
+    }
+
+    // '*' backtracks to its last occurrence; '?' takes a whole UTF-8 sequence
+    const char *p = pattern.data(), *pend = p + pattern.size();
+    const char *s = folded, *send = folded + length;
+    const char *star = NULL, *starS = NULL;
+
+    while (s < send)
+    {
+        if (p < pend && *p == '*')
+        {
+            star = p++;
+            starS = s;
+        }
+        else if (p < pend && (*p == '?' || *p == *s))
+        {
+            if (*p++ == '?')
+            {
+                while (++s < send && (*s & 0xC0) == 0x80);
+            }
+            else
+            {
+                s++;
+            }
+        }
+        else if (star)
+        {
+            p = star + 1;
+            s = ++starS;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (p < pend && *p == '*')
+    {
+        p++;
+    }
+    return p == pend;
+}
+
+bool NodeSearchFilter::matchesNode(const Node* n) const
+{
+    if (n->type > FOLDERNODE
+            || (type == MegaNode::TYPE_FILE && n->type != FILENODE)
+            || (type == MegaNode::TYPE_FOLDER && n->type != FOLDERNODE))
+    {
+        return false;
+    }
+
+    if (minSize >= 0 || maxSize >= 0 || minMtime >= 0 || maxMtime >= 0)
+    {
+        return n->type == FILENODE
+                && (minSize < 0 || n->size >= minSize) && (maxSize < 0 || n->size <= maxSize)
+                && (minMtime < 0 || n->mtime >= minMtime) && (maxMtime < 0 || n->mtime <= maxMtime);
+    }
+    return true;
+}
+
+void NodeNameIndex::clear()
+{
+    names.clear();
+    entries.clear();
+    positions.clear();
+    removedBytes = 0;
+}
+
+size_t NodeNameIndex::size() const
+{
+    return positions.size();
+}
+
+void NodeNameIndex::add(handle h, const char* name)
+{
+    string folded = NodeSearchFilter::fold(name);
+
+    auto it = positions.find(h);
+    if (it != positions.end())
+    {
+        const Entry& e = entries[it->second];
+        if (e.length == folded.size() && !names.compare(e.offset, e.length, folded))
+        {
+            return;
+        }
+        remove(h);
+    }
+
+    positions[h] = entries.size();
+    entries.push_back(Entry{ h, names.size(), folded.size(), false });
+    names.append(folded);
+    names.push_back('\0');
+}
+
+void NodeNameIndex::remove(handle h)
+{
+    auto it = positions.find(h);
+    if (it == positions.end())
+    {
+        return;
+    }
+
+    Entry& e = entries[it->second];
+    e.removed = true;
+    removedBytes += e.length + 1;
+    positions.erase(it);
+
+    if (removedBytes > names.size() / 2)
+    {
+        compact();
+    }
+}
+
+void NodeNameIndex::compact()
+{
+    string liveNames;
+    liveNames.reserve(names.size() - removedBytes);
+    size_t live = 0;
+
+    for (const Entry& e : entries)
+    {
+        if (!e.removed)
+        {
+            positions[e.h] = live;
+            entries[live++] = Entry{ e.h, liveNames.size(), e.length, false };
+            liveNames.append(names, e.offset, e.length + 1);
+        }
+    }
+
+    entries.resize(live);
+    names.swap(liveNames);
+    removedBytes = 0;
+}
+
+void NodeNameIndex::find(const NodeSearchFilter& filter, vector<handle>& results, MegaCancelToken* cancelToken) const
+{
+    const string needle = filter.literal();
+    const char* base = names.data();
+    const size_t total = names.size();
+    unsigned steps = 0;
+
+    size_t pos = 0;
+    while (pos < total)
+    {
+        if (!(++steps & 4095) && cancelToken && cancelToken->isCancelled())
+        {
+            return;
+        }
+
+        // the entry where the next candidate is
+        size_t at = pos;
+        if (!needle.empty())
+        {
+            const char* p = (const char*)memchr(base + pos, needle[0], total - pos);
+            if (!p)
+            {
+                return;
+            }
+
+            at = size_t(p - base);
+            if (total - at < needle.size() || memcmp(p, needle.data(), needle.size()))
+            {
+                pos = at + 1;
+                continue;
+            }
+        }
+
+        auto e = std::upper_bound(entries.begin(), entries.end(), at, [](size_t offset, const Entry& entry) { return offset < entry.offset; });
+        --e;
+
+        if (!e->removed && filter.matchesName(base + e->offset, e->length))
+        {
+            results.push_back(e->h);
+        }
+        pos = e->offset + e->length + 1;
+    }
+}
+
+void MegaApiImpl::searchTree(const NodeSearchFilter& filter, Node* ancestor, MegaCancelToken* cancelToken, node_vector& result)
+{
+    SearchTreeProcessor searchProcessor(filter);
+
+    if (ancestor)
+    {
+        client->pageinchildren(ancestor);
+        for (node_list::iterator it = ancestor->children.begin(); it != ancestor->children.end()
+             && !(cancelToken && cancelToken->isCancelled()); )
+        {
+            processTree(*it++, &searchProcessor, true, cancelToken);
+        }
+    }
+    else
+    {
+        // rootnodes
+        for (unsigned int i = 0; i < (sizeof client->rootnodes / sizeof *client->rootnodes)
+              && !(cancelToken && cancelToken->isCancelled()); i++)
+        {
+            processTree(client->nodebyhandle(client->rootnodes[i]), &searchProcessor, true, cancelToken);
+        }
+
+        // inshares
+        MegaShareList *shares = getInSharesList(MegaApi::ORDER_NONE);
+        for (int i = 0; i < shares->size() && !(cancelToken && cancelToken->isCancelled()); i++)
+        {
+            processTree(client->nodebyhandle(shares->get(i)->getNodeHandle()), &searchProcessor, true, cancelToken);
+        }
+        delete shares;
+    }
+
+    node_vector& vNodes = searchProcessor.getResults();
+    result.insert(result.end(), vNodes.begin(), vNodes.end());
+}
+
+bool MegaApiImpl::searchNodeNameIndex(const NodeSearchFilter& filter, Node* ancestor, MegaCancelToken* cancelToken, node_vector& result)
+{
+    if (client->pagedoutnodes)
+    {
+        return false;
+    }
+
+    if (!nodeNameIndexValid)
+    {
+        nodeNameIndex.clear();
+        client->importattrs();
+        for (node_map::iterator it = client->nodes.begin(); it != client->nodes.end(); it++)
+        {
+            if (it->second->type <= FOLDERNODE)
+            {
+                nodeNameIndex.add(it->second->nodehandle, it->second->displayname());
+            }
+        }
+        nodeNameIndexValid = true;
+        LOG_debug << "Node name index built: " << nodeNameIndex.size() << " names";
+    }
+
+    vector<handle> handles;
+    nodeNameIndex.find(filter, handles, cancelToken);
+
+    for (handle h : handles)
+    {
+        Node* n = client->nodebyhandle(h);
+        if (!n || !filter.matchesNode(n))
+        {
+            continue;
+        }
+
+        Node* top = n;
+        while (top->parent && top != ancestor)
+        {
+            top = top->parent;
+        }
+
+        if (ancestor ? (top == ancestor && n != ancestor)
+                     : (top->type == ROOTNODE || top->type == INCOMINGNODE || top->type == RUBBISHNODE || top->inshare))
+        {
+            result.push_back(n);
+        }
+    }
+    return true;
+}
+
+#if defined(_WIN32) || defined(__APPLE__)
+
+char *strcasestr(const char *string, const char *substring)
+{
+    int i, j;
     for (i = 0; string[i]; i++)
     {
         for (j = 0; substring[j]; j++)
@@ -11541,14 +13243,18 @@ bool SearchTreeProcessor::processNode(Node* node)
         return true;
     }
 
-    if (!search)
+    if (!valid)
     {
         return false;
     }
 
-    if (node->type <= FOLDERNODE && strcasestr(node->displayname(), search) != NULL)
+    if (filter.matchesNode(node))
     {
-        results.push_back(node);
+        string name = NodeSearchFilter::fold(node->displayname());
+        if (filter.matchesName(name.data(), name.size()))
+        {
+            results.push_back(node);
+        }
     }
 
     return true;
@@ -11701,14 +13407,14 @@ void MegaApiImpl::transfer_update(Transfer *t)
         }
 
         if (it == t->files.begin()
-                && transfer->getUpdateTime() == Waiter::ds
+                && Waiter::ds < transfer->getUpdateTime() + transferUpdateIntervalDs
                 && transfer->getState() == t->state
                 && transfer->getPriority() == t->priority
                 && (!t->slot
                     || (t->slot->progressreported
                         && t->slot->progressreported != t->size)))
         {
-            // don't send more than one callback per decisecond
+            // don't send more than one callback per decisecond (or transferUpdateIntervalDs)
             // if the state doesn't change, the priority doesn't change
             // and there isn't anything new or it's not the first
             // nor the last callback
@@ -11839,6 +13545,32 @@ bool MegaApiImpl::pread_data(byte *buffer, m_off_t len, m_off_t, m_off_t speed,
     return true;
 }
 
+bool MegaApiImpl::pread_lease(DirectReadLease* lease, m_off_t speed, m_off_t meanSpeed, void* param)
+{
+    MegaTransferPrivate *transfer = (MegaTransferPrivate *)param;
+    m_off_t len = m_off_t(lease->buf.datalen());
+    dstime currentTime = Waiter::ds;
+    transfer->setStartTime(currentTime);
+    transfer->setState(MegaTransfer::STATE_ACTIVE);
+    transfer->setUpdateTime(currentTime);
+    transfer->setDeltaSize(len);
+    transfer->setLastBytes((char *)lease->buf.datastart());
+    transfer->setTransferredBytes(transfer->getTransferredBytes() + len);
+    transfer->setSpeed(speed);
+    transfer->setMeanSpeed(meanSpeed);
+
+    bool end = (transfer->getTransferredBytes() == transfer->getTotalBytes());
+    fireOnTransferUpdate(transfer);
+    if (!fireOnTransferBuffer(transfer, new MegaTransferBufferPrivate(lease)) || end)
+    {
+        transfer->setState(end ? MegaTransfer::STATE_COMPLETED : MegaTransfer::STATE_CANCELLED);
+        DBTableTransactionCommitter committer(client->tctable);
+        fireOnTransferFinish(transfer, end ? MegaError(API_OK) : MegaError(API_EINCOMPLETE), committer);
+        return end;
+    }
+    return true;
+}
+
 void MegaApiImpl::reportevent_result(error e)
 {
     MegaError megaError(e);
@@ -12281,21 +14013,31 @@ void MegaApiImpl::chaturl_result(string *url, error e)
     fireOnRequestFinish(request, megaError);
 }
 
-void MegaApiImpl::chatgrantaccess_result(error e)
+void MegaApiImpl::chatgrantaccess_result(handle h, error e)
 {
     MegaError megaError(e);
     if(requestMap.find(client->restag) == requestMap.end()) return;
     MegaRequestPrivate* request = requestMap.at(client->restag);
+    if (request && request->getType() == MegaRequest::TYPE_CHAT_GRANT_ACCESS_NODES)
+    {
+        return bulkNodeResult(request, h, e);
+    }
+
     if(!request || (request->getType() != MegaRequest::TYPE_CHAT_GRANT_ACCESS)) return;
 
     fireOnRequestFinish(request, megaError);
 }
 
-void MegaApiImpl::chatremoveaccess_result(error e)
+void MegaApiImpl::chatremoveaccess_result(handle h, error e)
 {
     MegaError megaError(e);
     if(requestMap.find(client->restag) == requestMap.end()) return;
     MegaRequestPrivate* request = requestMap.at(client->restag);
+    if (request && request->getType() == MegaRequest::TYPE_CHAT_REMOVE_ACCESS_NODES)
+    {
+        return bulkNodeResult(request, h, e);
+    }
+
     if(!request || (request->getType() != MegaRequest::TYPE_CHAT_REMOVE_ACCESS)) return;
 
     fireOnRequestFinish(request, megaError);
@@ -12774,10 +14516,8 @@ bool MegaApiImpl::sync_syncable(Sync *sync, const char *name, string *localpath,
         return false;
     }
 
-    sdkMutex.unlock();
-    bool result = is_syncable(sync, name, localpath);
-    sdkMutex.lock();
-    return result;
+    // the compiled rules are checked in the SDK thread, without letting the app in between entries
+    return is_syncable(sync, name, localpath);
 }
 
 bool MegaApiImpl::sync_syncable(Sync *sync, const char *name, string *localpath)
@@ -12796,10 +14536,8 @@ bool MegaApiImpl::sync_syncable(Sync *sync, const char *name, string *localpath)
         }
     }
 
-    sdkMutex.unlock();
-    bool result = is_syncable(sync, name, localpath);
-    sdkMutex.lock();
-    return result;
+    // the compiled rules are checked in the SDK thread, without letting the app in between entries
+    return is_syncable(sync, name, localpath);
 }
 
 void MegaApiImpl::sync_auto_resumed(const string& localPath, const handle remoteNode, const long long localFp, const std::vector<std::string>& regExp)
@@ -12903,6 +14641,11 @@ void MegaApiImpl::setattr_result(handle h, error e)
     MegaError megaError(e);
     if(requestMap.find(client->restag) == requestMap.end()) return;
     MegaRequestPrivate* request = requestMap.at(client->restag);
+    if (request && request->getType() == MegaRequest::TYPE_SET_ATTR_NODES)
+    {
+        return bulkNodeResult(request, h, e);
+    }
+
     if (!request || ((request->getType() != MegaRequest::TYPE_RENAME)
             && request->getType() != MegaRequest::TYPE_SET_ATTR_NODE))
     {
@@ -12918,12 +14661,18 @@ void MegaApiImpl::rename_result(handle h, error e)
     MegaError megaError(e);
     if(requestMap.find(client->restag) == requestMap.end()) return;
     MegaRequestPrivate* request = requestMap.at(client->restag);
-    if(!request || (request->getType() != MegaRequest::TYPE_MOVE)) return;
+    if(!request || (request->getType() != MegaRequest::TYPE_MOVE
+                    && request->getType() != MegaRequest::TYPE_MOVE_NODES)) return;
 
 #ifdef ENABLE_SYNC
     client->syncdownrequired = true;
 #endif
 
+    if (request->getType() == MegaRequest::TYPE_MOVE_NODES)
+    {
+        return bulkNodeResult(request, h, e);
+    }
+
     request->setNodeHandle(h);
     fireOnRequestFinish(request, megaError);
 }
@@ -12934,7 +14683,8 @@ void MegaApiImpl::unlink_result(handle h, error e)
     if(requestMap.find(client->restag) == requestMap.end()) return;
     MegaRequestPrivate* request = requestMap.at(client->restag);
     if(!request || ((request->getType() != MegaRequest::TYPE_REMOVE) &&
-                    (request->getType() != MegaRequest::TYPE_MOVE)))
+                    (request->getType() != MegaRequest::TYPE_MOVE) &&
+                    (request->getType() != MegaRequest::TYPE_REMOVE_NODES)))
     {
         return;
     }
@@ -12943,6 +14693,11 @@ void MegaApiImpl::unlink_result(handle h, error e)
     client->syncdownrequired = true;
 #endif
 
+    if (request->getType() == MegaRequest::TYPE_REMOVE_NODES)
+    {
+        return bulkNodeResult(request, h, e);
+    }
+
     if (request->getType() != MegaRequest::TYPE_MOVE)
     {
         request->setNodeHandle(h);
@@ -12951,6 +14706,32 @@ void MegaApiImpl::unlink_result(handle h, error e)
     fireOnRequestFinish(request, megaError);
 }
 
+MegaStringMap* MegaApiImpl::bulkNodeHandles(MegaNodeList *nodes)
+{
+    MegaStringMap *handles = new MegaStringMapPrivate();
+    for (int i = 0; nodes && i < nodes->size(); i++)
+    {
+        MegaHandle h = nodes->get(i)->getHandle();
+        handles->set(Base64Str<MegaClient::NODEHANDLE>(h), "");
+    }
+    return handles;
+}
+
+void MegaApiImpl::bulkNodeResult(MegaRequestPrivate *request, handle h, error e)
+{
+    request->getMegaStringMap()->set(Base64Str<MegaClient::NODEHANDLE>(h), std::to_string(e).c_str());
+    request->setTransferredBytes(request->getTransferredBytes() + 1);
+    if (e)
+    {
+        request->setNumDetails(request->getNumDetails() + 1);
+    }
+
+    if (request->getTransferredBytes() == request->getTotalBytes())
+    {
+        fireOnRequestFinish(request, MegaError(request->getNumDetails() ? API_EINCOMPLETE : API_OK));
+    }
+}
+
 void MegaApiImpl::unlinkversions_result(error e)
 {
     if (requestMap.find(client->restag) == requestMap.end())
@@ -12994,7 +14775,7 @@ void MegaApiImpl::fetchnodes_result(error e)
             {
                 request->setNodeHandle(client->getpublicfolderhandle());
                 Node *n = client->nodebyhandle(h);
-                if (n && (n->attrs.map.find('n') == n->attrs.map.end()))
+                if (n && (n->attrs().map.find('n') == n->attrs().map.end()))
                 {
                     request->setFlag(true);
                 }
@@ -13032,7 +14813,7 @@ void MegaApiImpl::fetchnodes_result(error e)
             {
                 request->setNodeHandle(client->getpublicfolderhandle());
                 Node *n = client->nodebyhandle(h);
-                if (n && (n->attrs.map.find('n') == n->attrs.map.end()))
+                if (n && (n->attrs().map.find('n') == n->attrs().map.end()))
                 {
                     request->setFlag(true);
                 }
@@ -13116,12 +14897,28 @@ void MegaApiImpl::fetchnodes_result(error e)
 
 void MegaApiImpl::putnodes_result(error e, targettype_t t, NewNode* nn)
 {
+    auto internal = putNodesResults.find(client->restag);
+    if (internal != putNodesResults.end())
+    {
+        int tag = internal->first;
+        std::function<void(int, error, NewNode*)> result = std::move(internal->second);
+        putNodesResults.erase(internal);
+        result(tag, e, nn);
+        delete [] nn;
+        return;
+    }
+
     handle h = UNDEF;
     Node *n = NULL;
 
     if (!e && t != USER_HANDLE)
     {
-        if (client->nodenotify.size())
+        if (nn && !ISUNDEF(nn->addedhandle))
+        {
+            // the last node added may belong to another upload of the same putnodes
+            n = client->nodebyhandle(nn->addedhandle);
+        }
+        else if (client->nodenotify.size())
         {
             n = client->nodenotify.back();
         }
@@ -13292,6 +15089,19 @@ void MegaApiImpl::share_result(int, error)
     //The other callback will be called at the end of the request
 }
 
+void MegaApiImpl::share_progress(int done, int total)
+{
+    if(requestMap.find(client->restag) == requestMap.end()) return;
+    MegaRequestPrivate* request = requestMap.at(client->restag);
+    if(!request || ((request->getType() != MegaRequest::TYPE_EXPORT) &&
+                    (request->getType() != MegaRequest::TYPE_SHARE))) return;
+
+    // the parts of the node keys sent so far
+    request->setTransferredBytes(done);
+    request->setTotalBytes(total);
+    fireOnRequestUpdate(request);
+}
+
 void MegaApiImpl::setpcr_result(handle h, error e, opcactions_t action)
 {
     MegaError megaError(e);
@@ -13717,6 +15527,20 @@ void MegaApiImpl::notify_business_status(BizStatus status)
     fireOnEvent(event);
 }
 
+void MegaApiImpl::memory_pressure(mempressure_t pressure)
+{
+    MegaEventPrivate *event = new MegaEventPrivate(MegaEvent::EVENT_MEMORY_PRESSURE);
+    event->setNumber(pressure);
+    fireOnEvent(event);
+}
+
+void MegaApiImpl::startup_stage(startupstage_t stage)
+{
+    MegaEventPrivate *event = new MegaEventPrivate(MegaEvent::EVENT_STARTUP_STAGE);
+    event->setNumber(stage);
+    fireOnEvent(event);
+}
+
 void MegaApiImpl::http_result(error e, int httpCode, byte *data, int size)
 {
     if (requestMap.find(client->restag) == requestMap.end())
@@ -14010,8 +15834,7 @@ void MegaApiImpl::logout_result(error e)
         totalUploads = 0;
         totalDownloads = 0;
         waitingRequest = RETRY_NONE;
-        excludedNames.clear();
-        excludedPaths.clear();
+        syncExclusions.clear();
         syncLowerSizeLimit = 0;
         syncUpperSizeLimit = 0;
 
@@ -14313,17 +16136,96 @@ void MegaApiImpl::nodes_updated(Node** n, int count)
         return;
     }
 
-    MegaNodeList *nodeList = NULL;
-    if (n != NULL)
+    if (!n)
     {
-        nodeList = new MegaNodeListPrivate(n, count);
-        fireOnNodesUpdate(nodeList);
+        // everything was (re)loaded
+        nodeNameIndex.clear();
+        nodeNameIndexValid = false;
+        pendingNodeUpdates.clear();
+        pendingNodeUpdateIndex.clear();
+        client->appwakeupds = NEVER;
     }
-    else
+    else if (nodeNameIndexValid)
     {
-        fireOnNodesUpdate(NULL);
-    }
-    delete nodeList;
+        for (int i = 0; i < count; i++)
+        {
+            if (n[i]->changed.removed)
+            {
+                nodeNameIndex.remove(n[i]->nodehandle);
+            }
+            else if (n[i]->type <= FOLDERNODE)
+            {
+                nodeNameIndex.add(n[i]->nodehandle, n[i]->displayname());
+            }
+        }
+    }
+
+#ifdef HAVE_LIBUV
+    if (httpServer)
+    {
+        httpServer->invalidateWebDavListings(n, count);
+    }
+#endif
+
+    if (n != NULL && (nodesUpdateIntervalDs || pendingNodeUpdates.size()))
+    {
+        for (int i = 0; i < count; i++)
+        {
+            std::unique_ptr<MegaNodePrivate> node(static_cast<MegaNodePrivate*>(MegaNodePrivate::fromNode(n[i])));
+
+            auto it = pendingNodeUpdateIndex.find(n[i]->nodehandle);
+            if (it == pendingNodeUpdateIndex.end())
+            {
+                pendingNodeUpdateIndex[n[i]->nodehandle] = pendingNodeUpdates.size();
+                pendingNodeUpdates.push_back(std::move(node));
+            }
+            else
+            {
+                node->addChanges(pendingNodeUpdates[it->second]->getChanges());
+                pendingNodeUpdates[it->second] = std::move(node);
+            }
+        }
+
+        if (Waiter::ds >= nodesUpdateDs + nodesUpdateIntervalDs)
+        {
+            fireOnPendingNodesUpdate();
+        }
+        else
+        {
+            client->appwakeupds = nodesUpdateDs + nodesUpdateIntervalDs;
+        }
+        return;
+    }
+
+    MegaNodeList *nodeList = NULL;
+    if (n != NULL)
+    {
+        nodeList = new MegaNodeListPrivate(n, count);
+        fireOnNodesUpdate(nodeList);
+    }
+    else
+    {
+        fireOnNodesUpdate(NULL);
+    }
+    delete nodeList;
+    nodesUpdateDs = Waiter::ds;
+}
+
+void MegaApiImpl::fireOnPendingNodesUpdate()
+{
+    vector<MegaNode*> nodes;
+    nodes.reserve(pendingNodeUpdates.size());
+    for (auto& node : pendingNodeUpdates)
+    {
+        nodes.push_back(node.release());
+    }
+    pendingNodeUpdates.clear();
+    pendingNodeUpdateIndex.clear();
+    client->appwakeupds = NEVER;
+
+    MegaNodeListPrivate nodeList(std::move(nodes));
+    fireOnNodesUpdate(&nodeList);
+    nodesUpdateDs = Waiter::ds;
 }
 
 void MegaApiImpl::account_details(AccountDetails*, bool, bool, bool, bool, bool, bool)
@@ -15578,9 +17480,26 @@ void MegaApiImpl::removeGlobalListener(MegaGlobalListener* listener)
 
     sdkMutex.lock();
     globalListeners.erase(listener);
+    nodeListeners.erase(listener);
     sdkMutex.unlock();
 }
 
+void MegaApiImpl::addNodeListener(MegaGlobalListener* listener, MegaHandle parentHandle, bool recursive)
+{
+    if (!listener) return;
+
+    SdkMutexGuard g(sdkMutex);
+    nodeListeners[listener] = NodeSubscription{ parentHandle, recursive };
+}
+
+void MegaApiImpl::removeNodeListener(MegaGlobalListener* listener)
+{
+    if (!listener) return;
+
+    SdkMutexGuard g(sdkMutex);
+    nodeListeners.erase(listener);
+}
+
 MegaRequest *MegaApiImpl::getCurrentRequest()
 {
     return activeRequest;
@@ -15764,14 +17683,17 @@ void MegaApiImpl::fireOnTransferFinish(MegaTransferPrivate *transfer, MegaError
         LOG_info << "Transfer (" << transfer->getTransferString() << ") finished. File: " << transfer->getFileName();
     }
 
-    for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
+    if (!cancellingTransfers || transfer->getFolderTransferTag() <= 0)
     {
-        (*it++)->onTransferFinish(api, transfer, megaError);
-    }
+        for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
+        {
+            (*it++)->onTransferFinish(api, transfer, megaError);
+        }
 
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
-    {
-        (*it++)->onTransferFinish(api, transfer, megaError);
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onTransferFinish(api, transfer, megaError);
+        }
     }
 
     MegaTransferListener* listener = transfer->getListener();
@@ -15826,6 +17748,12 @@ MegaClient *MegaApiImpl::getMegaClient()
 
 void MegaApiImpl::fireOnTransferUpdate(MegaTransferPrivate *transfer)
 {
+    if (cancellingTransfers && transfer->isFolderTransfer())
+    {
+        // the folder transfer finishes with the last of its files
+        return;
+    }
+
     activeTransfer = transfer;
     notificationNumber++;
     transfer->setNotificationNumber(notificationNumber);
@@ -15866,6 +17794,27 @@ bool MegaApiImpl::fireOnTransferData(MegaTransferPrivate *transfer)
     return result;
 }
 
+bool MegaApiImpl::fireOnTransferBuffer(MegaTransferPrivate *transfer, MegaTransferBuffer *buffer)
+{
+    activeTransfer = transfer;
+    notificationNumber++;
+    transfer->setNotificationNumber(notificationNumber);
+
+    bool result = false;
+    MegaTransferListener* listener = transfer->getListener();
+    if(listener)
+    {
+        result = listener->onTransferBuffer(api, transfer, buffer);
+    }
+    else
+    {
+        delete buffer;
+    }
+
+    activeTransfer = NULL;
+    return result;
+}
+
 void MegaApiImpl::fireOnUsersUpdate(MegaUserList *users)
 {
     activeUsers = users;
@@ -15927,9 +17876,104 @@ void MegaApiImpl::fireOnNodesUpdate(MegaNodeList *nodes)
         (*it++)->onNodesUpdate(api, nodes);
     }
 
+    if (!nodeListeners.empty())
+    {
+        map<handle, handle> parents;
+        for (int i = 0; nodes && i < nodes->size(); i++)
+        {
+            parents[nodes->get(i)->getHandle()] = nodes->get(i)->getParentHandle();
+        }
+
+        for (auto it = nodeListeners.begin(); it != nodeListeners.end(); )
+        {
+            // the listener may remove itself
+            MegaGlobalListener* listener = it->first;
+            NodeSubscription subscription = it++->second;
+
+            if (!nodes)
+            {
+                listener->onNodesUpdate(api, NULL);
+                continue;
+            }
+
+            map<handle, bool> memo;
+            vector<MegaNode*> relevant;
+            for (int i = 0; i < nodes->size(); i++)
+            {
+                if (isNodeInSubscription(nodes->get(i), subscription, parents, memo))
+                {
+                    relevant.push_back(nodes->get(i)->copy());
+                }
+            }
+
+            if (!relevant.empty())
+            {
+                MegaNodeListPrivate nodeList(std::move(relevant));
+                activeNodes = &nodeList;
+                listener->onNodesUpdate(api, &nodeList);
+            }
+        }
+    }
+
     activeNodes = NULL;
 }
 
+bool MegaApiImpl::isNodeInSubscription(MegaNode* node, const NodeSubscription& subscription, const map<handle, handle>& parents, map<handle, bool>& memo)
+{
+    if (node->getHandle() == subscription.parent || node->getParentHandle() == subscription.parent)
+    {
+        return true;
+    }
+
+    // the folder a node was moved from isn't known: it may have left the subtree
+    if (node->hasChanged(MegaNode::CHANGE_TYPE_PARENT))
+    {
+        return true;
+    }
+
+    if (!subscription.recursive)
+    {
+        return false;
+    }
+
+    // up the parent chain, until the subscribed folder, a folder already seen or the top
+    vector<handle> path;
+    bool found = false;
+    for (handle h = node->getParentHandle(); !ISUNDEF(h); )
+    {
+        if (h == subscription.parent)
+        {
+            found = true;
+            break;
+        }
+
+        auto m = memo.find(h);
+        if (m != memo.end())
+        {
+            found = m->second;
+            break;
+        }
+        path.push_back(h);
+
+        auto p = parents.find(h);
+        if (p != parents.end())
+        {
+            h = p->second;
+        }
+        else
+        {
+            Node* n = client->nodebyhandle(h);
+            h = (n && n->parent) ? n->parent->nodehandle : UNDEF;
+        }
+    }
+
+    for (handle h : path)
+    {
+        memo[h] = found;
+    }
+    return found;
+}
+
 void MegaApiImpl::fireOnAccountUpdate()
 {
     for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
@@ -16189,6 +18233,8 @@ void MegaApiImpl::processTransferUpdate(Transfer *tr, MegaTransferPrivate *trans
         transfer->setDeltaSize(deltaSize);
         transfer->setSpeed(tr->slot->speed);
         transfer->setMeanSpeed(tr->slot->meanSpeed);
+        transfer->setNumConnections(tr->slot->connections);
+        transfer->setTimeToFirstByte(tr->slot->ttfbms);
 
         if (tr->type == GET)
         {
@@ -16204,6 +18250,7 @@ void MegaApiImpl::processTransferUpdate(Transfer *tr, MegaTransferPrivate *trans
         transfer->setDeltaSize(0);
         transfer->setSpeed(0);
         transfer->setMeanSpeed(0);
+        transfer->setNumConnections(0);
     }
 
     transfer->setState(tr->state);
@@ -16223,6 +18270,11 @@ void MegaApiImpl::processTransferComplete(Transfer *tr, MegaTransferPrivate *tra
     transfer->setDeltaSize(deltaSize);
     transfer->setSpeed(tr->slot ? tr->slot->speed : 0);
     transfer->setMeanSpeed(tr->slot ? tr->slot->meanSpeed : 0);
+    transfer->setNumConnections(tr->slot ? tr->slot->connections : 0);
+    if (tr->slot)
+    {
+        transfer->setTimeToFirstByte(tr->slot->ttfbms);
+    }
 
     if (tr->type == GET)
     {
@@ -16838,16 +18890,14 @@ int MegaApiImpl::getNumChildren(MegaNode* p)
         return 0;
     }
 
-    sdkMutex.lock();
+    SdkReadGuard g(sdkMutex, *client);
     Node *parent = client->nodebyhandle(p->getHandle());
     if (!parent || parent->type == FILENODE)
     {
-        sdkMutex.unlock();
         return 0;
     }
 
-    int numChildren = int(parent->children.size());
-    sdkMutex.unlock();
+    int numChildren = int(parent->children.size() + client->pagedchildren(parent->nodehandle));
 
     return numChildren;
 }
@@ -16859,21 +18909,20 @@ int MegaApiImpl::getNumChildFiles(MegaNode* p)
         return 0;
     }
 
-    sdkMutex.lock();
+    SdkReadGuard g(sdkMutex, *client);
     Node *parent = client->nodebyhandle(p->getHandle());
     if (!parent || parent->type == FILENODE)
     {
-        sdkMutex.unlock();
         return 0;
     }
 
-    int numFiles = 0;
+    // paged-out children are all files
+    int numFiles = int(client->pagedchildren(parent->nodehandle));
     for (node_list::iterator it = parent->children.begin(); it != parent->children.end(); it++)
     {
         if ((*it)->type == FILENODE)
             numFiles++;
     }
-    sdkMutex.unlock();
 
     return numFiles;
 }
@@ -16885,11 +18934,10 @@ int MegaApiImpl::getNumChildFolders(MegaNode* p)
         return 0;
     }
 
-    sdkMutex.lock();
+    SdkReadGuard g(sdkMutex, *client);
     Node *parent = client->nodebyhandle(p->getHandle());
     if (!parent || parent->type == FILENODE)
     {
-        sdkMutex.unlock();
         return 0;
     }
 
@@ -16899,7 +18947,6 @@ int MegaApiImpl::getNumChildFolders(MegaNode* p)
         if ((*it)->type != FILENODE)
             numFolders++;
     }
-    sdkMutex.unlock();
 
     return numFolders;
 }
@@ -16920,36 +18967,106 @@ MegaNodeList *MegaApiImpl::getChildren(MegaNode* p, int order)
         return new MegaNodeListPrivate();
     }
 
-    node_vector childrenNodes;
+    client->pageinchildren(parent);
+    node_vector unsortedNodes;
+    const node_vector* childrenNodes = &unsortedNodes;
 
     if (std::function<bool(Node*, Node*)> comparatorFunction = getComparatorFunction(order, *client))
     {
-        for (node_list::iterator it = parent->children.begin(); it != parent->children.end(); )
-        {
-            Node *n = *it++;
-            const node_vector::iterator i = std::lower_bound(childrenNodes.begin(), childrenNodes.end(), n, comparatorFunction);
-            childrenNodes.insert(i, n);
-        }
+        childrenNodes = &getSortedChildren(parent, order, comparatorFunction);
     }
     else
     {
-        for (node_list::iterator it = parent->children.begin(); it != parent->children.end(); )
-            childrenNodes.push_back(*it++);
+        unsortedNodes.assign(parent->children.begin(), parent->children.end());
     }
 
     MegaNodeListPrivate *result = NULL;
-    if (childrenNodes.size())
+    if (childrenNodes->size())
     {
-        result = new MegaNodeListPrivate(childrenNodes.data(), int(childrenNodes.size()));
+        result = new MegaNodeListPrivate(const_cast<Node**>(childrenNodes->data()), int(childrenNodes->size()));
     }
     else
     {
         result = new MegaNodeListPrivate();
     }
+    noteBrowse(parent, order, 0, childrenNodes->size());
     sdkMutex.unlock();
     return result;
 }
 
+const node_vector& MegaApiImpl::getSortedChildren(Node* parent, int order, const std::function<bool(Node*, Node*)>& comparatorFunction)
+{
+    SortedChildren& sorted = sortedChildren[std::make_pair(parent->nodehandle, order)];
+    sorted.lastUse = ++sortedChildrenUse;
+
+    if (sorted.childrenSeq != parent->childrenseq)
+    {
+        // sorting by insertion (std::lower_bound) left each child before its equals: keep that for ties
+        sorted.nodes.assign(parent->children.rbegin(), parent->children.rend());
+        std::stable_sort(sorted.nodes.begin(), sorted.nodes.end(), comparatorFunction);
+        sorted.childrenSeq = parent->childrenseq;
+    }
+
+    if (sortedChildren.size() > SORTED_CHILDREN_VIEWS)
+    {
+        auto oldest = sortedChildren.begin();
+        for (auto it = sortedChildren.begin(); it != sortedChildren.end(); it++)
+        {
+            if (it->second.lastUse < oldest->second.lastUse)
+            {
+                oldest = it;
+            }
+        }
+        sortedChildren.erase(oldest);
+    }
+
+    return sorted.nodes;
+}
+
+MegaNodeList *MegaApiImpl::getChildrenPage(MegaNode* p, int order, int offset, int limit)
+{
+    if (!p || p->getType() == MegaNode::TYPE_FILE || offset < 0 || limit <= 0)
+    {
+        return new MegaNodeListPrivate();
+    }
+
+    SdkMutexGuard g(sdkMutex);
+    Node *parent = client->nodebyhandle(p->getHandle());
+    if (!parent || parent->type == FILENODE)
+    {
+        return new MegaNodeListPrivate();
+    }
+
+    client->pageinchildren(parent);
+    node_vector page;
+
+    if (std::function<bool(Node*, Node*)> comparatorFunction = getComparatorFunction(order, *client))
+    {
+        const node_vector& childrenNodes = getSortedChildren(parent, order, comparatorFunction);
+        if (size_t(offset) < childrenNodes.size())
+        {
+            auto first = childrenNodes.begin() + offset;
+            page.assign(first, first + std::min<size_t>(size_t(limit), size_t(childrenNodes.end() - first)));
+        }
+    }
+    else
+    {
+        node_list::iterator it = parent->children.begin();
+        for (int i = 0; i < offset && it != parent->children.end(); i++, it++);
+        for ( ; it != parent->children.end() && page.size() < size_t(limit); it++)
+        {
+            page.push_back(*it);
+        }
+    }
+
+    noteBrowse(parent, order, size_t(offset), page.size());
+    if (page.empty())
+    {
+        return new MegaNodeListPrivate();
+    }
+    return new MegaNodeListPrivate(page.data(), int(page.size()));
+}
+
 MegaNodeList *MegaApiImpl::getVersions(MegaNode *node)
 {
     if (!node || node->getType() != MegaNode::TYPE_FILE)
@@ -16967,12 +19084,14 @@ MegaNodeList *MegaApiImpl::getVersions(MegaNode *node)
 
     vector<Node*> versions;
     versions.push_back(current);
+    client->pageinchildren(current);
     while (current->children.size())
     {
         assert(current->children.back()->parent == current);
         current = current->children.back();
         assert(current->type == FILENODE);
         versions.push_back(current);
+        client->pageinchildren(current);
     }
 
     MegaNodeListPrivate *result = new MegaNodeListPrivate(versions.data(), int(versions.size()));
@@ -16996,12 +19115,14 @@ int MegaApiImpl::getNumVersions(MegaNode *node)
     }
 
     int numVersions = 1;
+    client->pageinchildren(current);
     while (current->children.size())
     {
         assert(current->children.back()->parent == current);
         current = current->children.back();
         assert(current->type == FILENODE);
         numVersions++;
+        client->pageinchildren(current);
     }
     sdkMutex.unlock();
     return numVersions;
@@ -17026,11 +19147,24 @@ bool MegaApiImpl::hasVersions(MegaNode *node)
            || (current->children.back()->parent == current
                && current->children.back()->type == FILENODE));
 
-    bool result = current->children.size() != 0;
+    bool result = current->children.size() != 0 || client->pagedchildren(current->nodehandle);
     sdkMutex.unlock();
     return result;
 }
 
+void MegaApiImpl::searchInPages(MegaNode *node, const char *searchString, int pageSize, MegaRequestListener *listener)
+{
+    MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_SEARCH, listener);
+    if (node)
+    {
+        request->setNodeHandle(node->getHandle());
+    }
+    request->setText(searchString);
+    request->setNumber(pageSize);
+    requestQueue.push(request);
+    waiter->notify();
+}
+
 void MegaApiImpl::getFolderInfo(MegaNode *node, MegaRequestListener *listener)
 {
     MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_FOLDER_INFO, listener);
@@ -17057,23 +19191,22 @@ MegaChildrenLists *MegaApiImpl::getFileFolderChildren(MegaNode *p, int order)
         return new MegaChildrenListsPrivate();
     }
 
+    client->pageinchildren(parent);
     node_vector files;
     node_vector folders;
 
     if (std::function<bool(Node*, Node*)> comparatorFunction = getComparatorFunction(order, *client))
     {
-        for (node_list::iterator it = parent->children.begin(); it != parent->children.end(); )
+        // each type keeps its relative order from the sorted view
+        for (Node* n : getSortedChildren(parent, order, comparatorFunction))
         {
-            Node *n = *it++;
             if (n->type == FILENODE)
             {
-                const node_vector::iterator i = std::lower_bound(files.begin(), files.end(), n, comparatorFunction);
-                files.insert(i, n);
+                files.push_back(n);
             }
             else // if (n->type == FOLDERNODE)
             {
-                const node_vector::iterator i = std::lower_bound(folders.begin(), folders.end(), n, comparatorFunction);
-                folders.insert(i, n);
+                folders.push_back(n);
             }
         }
     }
@@ -17132,7 +19265,7 @@ bool MegaApiImpl::hasChildren(MegaNode *parent)
         return false;
     }
 
-    bool ret = p->children.size();
+    bool ret = p->children.size() || client->pagedchildren(p->nodehandle);
     sdkMutex.unlock();
 
     return ret;
@@ -17158,17 +19291,12 @@ int MegaApiImpl::getIndex(MegaNode *n, int order)
         return -1;
     }
 
+    client->pageinchildren(parent);
+
     if (std::function<bool(Node*, Node*)> comparatorFunction = getComparatorFunction(order, *client))
     {
-        node_vector childrenNodes;
-        for (node_list::iterator it = parent->children.begin(); it != parent->children.end(); )
-        {
-            Node *temp = *it++;
-            const node_vector::iterator i = std::lower_bound(childrenNodes.begin(), childrenNodes.end(), temp, comparatorFunction);
-            childrenNodes.insert(i, temp);
-        }
-
-        const node_vector::iterator i = std::lower_bound(childrenNodes.begin(), childrenNodes.end(), node, comparatorFunction);
+        const node_vector& childrenNodes = getSortedChildren(parent, order, comparatorFunction);
+        const node_vector::const_iterator i = std::lower_bound(childrenNodes.begin(), childrenNodes.end(), node, comparatorFunction);
 
         return int(i - childrenNodes.begin());
     }
@@ -17341,18 +19469,19 @@ MegaNode* MegaApiImpl::getParentNode(MegaNode* n)
 {
     if(!n) return NULL;
 
-    sdkMutex.lock();
+    SdkReadGuard g(sdkMutex, *client);
     Node *node = client->nodebyhandle(n->getHandle());
+    if (node && node->parent && node->parent->attrspending() && !g.exclusive())
+    {
+        g.relock();
+        node = client->nodebyhandle(n->getHandle());
+    }
     if(!node)
     {
-        sdkMutex.unlock();
         return NULL;
     }
 
-    MegaNode *result = MegaNodePrivate::fromNode(node->parent);
-    sdkMutex.unlock();
-
-    return result;
+    return MegaNodePrivate::fromNode(node->parent);
 }
 
 char* MegaApiImpl::getNodePath(MegaNode *node)
@@ -17585,10 +19714,14 @@ MegaNode* MegaApiImpl::getNodeByPath(const char *path, MegaNode* node)
 MegaNode* MegaApiImpl::getNodeByHandle(handle handle)
 {
     if(handle == UNDEF) return NULL;
-    sdkMutex.lock();
-    MegaNode *result = MegaNodePrivate::fromNode(client->nodebyhandle(handle));
-    sdkMutex.unlock();
-    return result;
+    SdkReadGuard g(sdkMutex, *client);
+    Node* n = client->nodebyhandle(handle);
+    if (n && n->attrspending() && !g.exclusive())
+    {
+        g.relock();
+        n = client->nodebyhandle(handle);
+    }
+    return MegaNodePrivate::fromNode(n);
 }
 
 MegaContactRequest *MegaApiImpl::getContactRequestByHandle(MegaHandle handle)
@@ -17621,12 +19754,32 @@ unsigned MegaApiImpl::sendPendingTransfers()
     SdkMutexGuard guard(sdkMutex);
     DBTableTransactionCommitter committer(client->tctable);
 
-    while(MegaTransferPrivate *transfer = transferQueue.pop())
+    for (;;)
     {
+        if (fingerprintPrefetcher)
+        {
+            fingerprintPrefetcher->prefetch(transferQueue.uploadPaths(fingerprintPrefetcher->lookahead()));
+        }
+
+        MegaTransferPrivate *transfer = transferQueue.pop();
+        if (!transfer)
+        {
+            break;
+        }
+
         error e = API_OK;
         int nextTag = client->nextreqtag();
         transfer->setState(MegaTransfer::STATE_QUEUED);
 
+        if (transfer->hasPendingRecursiveOperation())
+        {
+            // startUploads()/startDownloads(): the batch goes to the front of the queue, to be taken by this loop
+            transferMap[nextTag] = transfer;
+            transfer->setTag(nextTag);
+            transfer->startPendingRecursiveOperation();
+            continue;
+        }
+
         switch(transfer->getType())
         {
             case MegaTransfer::TYPE_UPLOAD:
@@ -17672,7 +19825,18 @@ unsigned MegaApiImpl::sendPendingTransfers()
                 FileFingerprint fp;
                 if (type == FILENODE)
                 {
-                    fp.genfingerprint(fa.get());
+                    if (fingerprintPrefetcher && fingerprintPrefetcher->take(tmpString, size, fa->mtime, fp))
+                    {
+                        if (client->fpcache && fa->fsidvalid)
+                        {
+                            client->fpcache->put(fa->fsid, wLocalPath, fp);
+                        }
+                    }
+                    else
+                    {
+                        // folder uploads and backups send the same files over and over
+                        client->genfingerprint(&fp, fa.get(), wLocalPath);
+                    }
                 }
                 fa.reset();
 
@@ -17699,6 +19863,7 @@ unsigned MegaApiImpl::sendPendingTransfers()
                                 transfer->setUpdateTime(Waiter::ds);
                                 fireOnTransferStart(transfer);
                                 transfer->setNodeHandle(previousNode->nodehandle);
+                                transfer->setSavedBytes(size);
                                 transfer->setDeltaSize(size);
                                 transfer->setSpeed(0);
                                 transfer->setMeanSpeed(0);
@@ -17713,8 +19878,9 @@ unsigned MegaApiImpl::sendPendingTransfers()
                     // If has been found by name and it's necessary force upload, it isn't necessary look for it again
                     if (!forceToUpload)
                     {
-                        Node *samenode = client->nodebyfingerprint(&fp);
-                        if (samenode && samenode->nodekey().size() && !hasToForceUpload(*samenode, *transfer))
+                        // only a node whose key could be decrypted can be copied with it
+                        Node *samenode = fp.isvalid ? client->nodebyfingerprint(&fp) : nullptr;
+                        if (samenode && samenode->keyApplied() && !hasToForceUpload(*samenode, *transfer))
                         {
                             pendingUploads++;
                             totalUploads++;
@@ -17738,7 +19904,7 @@ unsigned MegaApiImpl::sendPendingTransfers()
                             AttrMap attrs;
                             string attrstring;
                             key.setkey((const byte*)tc.nn[0].nodekey.data(), samenode->type);
-                            attrs = samenode->attrs;
+                            attrs = samenode->attrs();
                             string sname = fileName;
                             fsAccess->normalize(&sname);
                             attrs.map['n'] = sname;
@@ -17758,6 +19924,7 @@ unsigned MegaApiImpl::sendPendingTransfers()
                                 client->putnodes(parent->nodehandle, tc.nn, nc);
                             }
 
+                            transfer->setSavedBytes(size);
                             transfer->setDeltaSize(size);
                             transfer->setSpeed(0);
                             transfer->setMeanSpeed(0);
@@ -17773,6 +19940,7 @@ unsigned MegaApiImpl::sendPendingTransfers()
                     MegaFilePut *f = new MegaFilePut(client, &wLocalPath, &wFileName, transfer->getParentHandle(), uploadToInbox ? inboxTarget : "", mtime, isSourceTemporary);
                     *static_cast<FileFingerprint*>(f) = fp;  // deliberate slicing - startxfer would re-fingerprint if we don't supply this info
                     f->setTransfer(transfer);
+                    f->schedulinggroup = transfer->getFolderTransferTag();
                     bool started = client->startxfer(PUT, f, committer, true, startFirst, transfer->isBackupTransfer());
                     if (!started)
                     {
@@ -17893,8 +20061,8 @@ unsigned MegaApiImpl::sendPendingTransfers()
                     {
                         if (!fileName)
                         {
-                            attr_map::iterator ait = node->attrs.map.find('n');
-                            if (ait == node->attrs.map.end())
+                            attr_map::iterator ait = node->attrs().map.find('n');
+                            if (ait == node->attrs().map.end())
                             {
                                 name = "CRYPTO_ERROR";
                             }
@@ -18009,6 +20177,7 @@ unsigned MegaApiImpl::sendPendingTransfers()
 
                     transfer->setPath(path.c_str());
                     f->setTransfer(transfer);
+                    f->schedulinggroup = transfer->getFolderTransferTag();
                     bool ok = client->startxfer(GET, f, committer, true, startFirst);
                     if (!ok)
                     {
@@ -18057,7 +20226,7 @@ unsigned MegaApiImpl::sendPendingTransfers()
                         transfer->setState(MegaTransfer::STATE_QUEUED);
 
                         fireOnTransferStart(transfer);
-                        client->pread(node, startPos, totalBytes, transfer);
+                        client->pread(node, startPos, totalBytes, transfer, transfer->getMaxHeldBytes());
                         waiter->notify();
                     }
                     else
@@ -18082,8 +20251,13 @@ unsigned MegaApiImpl::sendPendingTransfers()
                                       startPos, totalBytes, transfer, publicNode->isForeign(),
                                       publicNode->getPrivateAuth()->c_str(),
                                       publicNode->getPublicAuth()->c_str(),
-                                      publicNode->getChatAuth());
-                        waiter->notify();
+                                      publicNode->getChatAuth(), transfer->getMaxHeldBytes());
+                        if (publicNode->getDuration() > 0)
+                        {
+                            client->setstreamingbitrate(publicNode->getHandle(), publicNode->isForeign(),
+                                                        StreamingScheduler::bitrateof(publicNode->getSize(), uint32_t(publicNode->getDuration())));
+                        }
+                        waiter->notify();
                     }
                 }
 
@@ -18364,7 +20538,7 @@ void MegaApiImpl::sendPendingRequests()
             }
             else
             {
-                e = client->folderaccess(megaFolderLink);
+                e = client->folderaccess(megaFolderLink, request->getNodeHandle());
                 if(e == API_OK)
                 {
                     fireOnRequestFinish(request, MegaError(e));
@@ -18546,8 +20720,8 @@ void MegaApiImpl::sendPendingRequests()
                     }
                     else
                     {
-                        attr_map::iterator it = node->attrs.map.find('n');
-                        if (it != node->attrs.map.end())
+                        attr_map::iterator it = node->attrs().map.find('n');
+                        if (it != node->attrs().map.end())
                         {
                             newName = it->second;
                         }
@@ -18595,7 +20769,7 @@ void MegaApiImpl::sendPendingRequests()
                     string newName(name);
                     client->fsaccess->normalize(&newName);
 
-                    AttrMap attrs = node->attrs;
+                    AttrMap attrs = node->attrs();
                     attrs.map['n'] = newName;
 
                     string attrstring;
@@ -18743,8 +20917,8 @@ void MegaApiImpl::sendPendingRequests()
                 }
                 else
                 {
-                    attr_map::iterator it = node->attrs.map.find('n');
-                    if (it != node->attrs.map.end())
+                    attr_map::iterator it = node->attrs().map.find('n');
+                    if (it != node->attrs().map.end())
                     {
                         sname = it->second;
                     }
@@ -18769,6 +20943,17 @@ void MegaApiImpl::sendPendingRequests()
                     }
                 }
 
+                NodeCounter counts = node->subnodeCounts();
+                if (target && node->type == FOLDERNODE && counts.files + counts.folders + counts.versions > MegaFolderCopyController::MAX_NODES_PER_PUTNODES)
+                {
+                    unique_ptr<MegaFolderCopyController> folderCopy(new MegaFolderCopyController(this, request, node, target->nodehandle, newName ? sname : string()));
+                    request->setTotalBytes(counts.files + counts.folders + counts.versions);
+                    MegaFolderCopyController* started = folderCopy.get();
+                    folderCopies[request->getTag()] = std::move(folderCopy);
+                    started->start();
+                    break;
+                }
+
                 // determine number of nodes to be copied
                 client->proctree(node, &tc, false, ovhandle != UNDEF);
                 tc.allocnodes();
@@ -18786,7 +20971,7 @@ void MegaApiImpl::sendPendingRequests()
                     string attrstring;
 
                     key.setkey((const byte*)tc.nn->nodekey.data(), node->type);
-                    attrs = node->attrs;
+                    attrs = node->attrs();
 
                     attrs.map['n'] = sname;
 
@@ -18846,7 +21031,7 @@ void MegaApiImpl::sendPendingRequests()
             if (newnode->nodekey.size())
             {
                 key.setkey((const byte*)version->nodekey().data(), version->type);
-                version->attrs.getjson(&attrstring);
+                version->attrs().getjson(&attrstring);
                 client->makeattr(&key, newnode->attrstring, attrstring.c_str());
             }
 
@@ -18863,7 +21048,7 @@ void MegaApiImpl::sendPendingRequests()
 
             string sname = newName;
             fsAccess->normalize(&sname);
-            node->attrs.map['n'] = sname;
+            node->attrs().map['n'] = sname;
             e = client->setattr(node);
             break;
         }
@@ -18900,6 +21085,124 @@ void MegaApiImpl::sendPendingRequests()
             client->unlinkversions();
             break;
         }
+        case MegaRequest::TYPE_MOVE_NODES:
+        case MegaRequest::TYPE_REMOVE_NODES:
+        case MegaRequest::TYPE_SET_ATTR_NODES:
+        {
+            int type = request->getType();
+            MegaStringMap *results = request->getMegaStringMap();
+            Node *newParent = client->nodebyhandle(request->getParentHandle());
+            const char *attrName = request->getName();
+            const char *attrValue = request->getText();
+            if (!results || !results->size()
+                    || (type == MegaRequest::TYPE_MOVE_NODES && !newParent)
+                    || (type == MegaRequest::TYPE_SET_ATTR_NODES && (!attrName || !attrName[0] || strlen(attrName) > 7)))
+            {
+                e = API_EARGS;
+                break;
+            }
+
+            if (type == MegaRequest::TYPE_MOVE_NODES
+                    && (newParent->type == FILENODE || !client->checkaccess(newParent, RDWR)))
+            {
+                e = API_EACCESS;
+                break;
+            }
+
+            nameid attr = 0;
+            string svalue;
+            if (type == MegaRequest::TYPE_SET_ATTR_NODES)
+            {
+                string sname = attrName;
+                fsAccess->normalize(&sname);
+                sname.insert(0, "_");
+                attr = AttrMap::string2nameid(sname.c_str());
+                if (attrValue)
+                {
+                    svalue = attrValue;
+                    fsAccess->normalize(&svalue);
+                }
+            }
+
+            request->setTotalBytes(results->size());
+            request->setTransferredBytes(0);
+            request->setNumDetails(0);
+
+            // the commands of every node go in the same batch, and their local changes are applied
+            // (and notified) together.  The nodes that fail here are answered at once, and the last
+            // one may finish the request when no command was sent
+            unique_ptr<MegaStringList> keys(results->getKeys());
+            for (int i = 0; i < keys->size(); i++)
+            {
+                handle h = 0;
+                Base64::atob(keys->get(i), (byte*)&h, MegaClient::NODEHANDLE);
+                Node *node = client->nodebyhandle(h);
+
+                error ne = API_OK;
+                bool sent = false;
+                if (!node)
+                {
+                    ne = API_ENOENT;
+                }
+                else if (node->changed.removed)
+                {
+                    // deleted with a folder of the same request
+                }
+                else if (type == MegaRequest::TYPE_MOVE_NODES)
+                {
+                    if (node->type == ROOTNODE
+                            || node->type == INCOMINGNODE
+                            || node->type == RUBBISHNODE
+                            || !node->parent
+                            || node->parent->type == FILENODE)
+                    {
+                        ne = API_EACCESS;
+                    }
+                    else if (node->parent != newParent)
+                    {
+                        ne = client->rename(node, newParent);
+                        sent = !ne;
+                    }
+                }
+                else if (type == MegaRequest::TYPE_REMOVE_NODES)
+                {
+                    if (node->type == ROOTNODE
+                            || node->type == INCOMINGNODE
+                            || node->type == RUBBISHNODE)
+                    {
+                        ne = API_EACCESS;
+                    }
+                    else
+                    {
+                        ne = client->unlink(node);
+                        sent = !ne;
+                    }
+                }
+                else if (!client->checkaccess(node, FULL))
+                {
+                    ne = API_EACCESS;
+                }
+                else
+                {
+                    if (attrValue)
+                    {
+                        node->attrs().map[attr] = svalue;
+                    }
+                    else
+                    {
+                        node->attrs().map.erase(attr);
+                    }
+                    ne = client->setattr(node);
+                    sent = !ne;
+                }
+
+                if (!sent)
+                {
+                    bulkNodeResult(request, h, ne);
+                }
+            }
+            break;
+        }
         case MegaRequest::TYPE_SHARE:
         {
             Node *node = client->nodebyhandle(request->getNodeHandle());
@@ -19534,7 +21837,7 @@ void MegaApiImpl::sendPendingRequests()
 
                     if (secs == MegaNode::INVALID_DURATION)
                     {
-                        node->attrs.map.erase('d');
+                        node->attrs().map.erase('d');
                     }
                     else
                     {
@@ -19542,7 +21845,7 @@ void MegaApiImpl::sendPendingRequests()
                         Base64::itoa(secs, &attrVal);
                         if (attrVal.size())
                         {
-                            node->attrs.map['d'] = attrVal;
+                            node->attrs().map['d'] = attrVal;
                         }
                     }
                 }
@@ -19558,7 +21861,7 @@ void MegaApiImpl::sendPendingRequests()
                     int latitude = request->getTransferTag();
                     int unshareable = request->getAccess();
 
-                    e = updateAttributesMapWithCoordinates(node->attrs, latitude, longitude, !!unshareable, client);
+                    e = updateAttributesMapWithCoordinates(node->attrs(), latitude, longitude, !!unshareable, client);
                     if (e != API_OK)
                     {
                         break;
@@ -19571,11 +21874,11 @@ void MegaApiImpl::sendPendingRequests()
                     string tattrstring;
                     if (!request->getText())
                     {
-                        node->attrs.map.erase(nid);
+                        node->attrs().map.erase(nid);
                     }
                     else
                     {
-                        node->attrs.map[nid] = request->getText();
+                        node->attrs().map[nid] = request->getText();
                     }
                 }
                 else
@@ -19604,11 +21907,11 @@ void MegaApiImpl::sendPendingRequests()
                 {
                     string svalue = attrValue;
                     fsAccess->normalize(&svalue);
-                    node->attrs.map[attr] = svalue;
+                    node->attrs().map[attr] = svalue;
                 }
                 else
                 {
-                    node->attrs.map.erase(attr);
+                    node->attrs().map.erase(attr);
                 }
             }
 
@@ -20428,24 +22731,12 @@ void MegaApiImpl::sendPendingRequests()
 
             if (!flag)
             {
-                for (transfer_map::iterator it = client->transfers[direction].begin() ; it != client->transfers[direction].end() ; it++)
-                {
-                    Transfer *t = it->second;
-                    for (file_list::iterator it2 = t->files.begin(); it2 != t->files.end(); it2++)
-                    {
-                        if (!(*it2)->syncxfer)
-                        {
-                            cancelTransferByTag((*it2)->tag);
-                        }
-                    }
-                }
-                request->setFlag(true);
-                requestQueue.push(request);
-            }
-            else
-            {
-                fireOnRequestFinish(request, MegaError(API_OK));
+                // the files of folder transfers only finish to their folder transfer, which finishes once
+                cancellingTransfers = true;
+                client->stopxfers(direction_t(direction), [](File* f) { return !f->syncxfer; }, committer);
+                cancellingTransfers = false;
             }
+            fireOnRequestFinish(request, MegaError(API_OK));
             break;
         }
         case MegaRequest::TYPE_ADD_BACKUP:
@@ -21171,6 +23462,54 @@ void MegaApiImpl::sendPendingRequests()
             client->removeAccessInChat(chatid, h, uid);
             break;
         }
+        case MegaRequest::TYPE_CHAT_GRANT_ACCESS_NODES:
+        case MegaRequest::TYPE_CHAT_REMOVE_ACCESS_NODES:
+        {
+            handle chatid = request->getParentHandle();
+            const char *uid = request->getEmail();
+            MegaStringMap *results = request->getMegaStringMap();
+            if (chatid == INVALID_HANDLE || !uid || !results || !results->size())
+            {
+                e = API_EARGS;
+                break;
+            }
+
+            if (client->chats.find(chatid) == client->chats.end())
+            {
+                e = API_ENOENT;
+                break;
+            }
+
+            request->setTotalBytes(results->size());
+            request->setTransferredBytes(0);
+            request->setNumDetails(0);
+
+            // the commands of every node go in the same batch.  A node to grant access to that doesn't
+            // exist is answered at once (and the last one may finish the request), while access to a
+            // removed node can still be revoked
+            unique_ptr<MegaStringList> keys(results->getKeys());
+            for (int i = 0; i < keys->size(); i++)
+            {
+                handle h = 0;
+                Base64::atob(keys->get(i), (byte*)&h, MegaClient::NODEHANDLE);
+                if (request->getType() == MegaRequest::TYPE_CHAT_GRANT_ACCESS_NODES)
+                {
+                    if (client->nodebyhandle(h))
+                    {
+                        client->grantAccessInChat(chatid, h, uid);
+                    }
+                    else
+                    {
+                        bulkNodeResult(request, h, API_ENOENT);
+                    }
+                }
+                else
+                {
+                    client->removeAccessInChat(chatid, h, uid);
+                }
+            }
+            break;
+        }
         case MegaRequest::TYPE_CHAT_UPDATE_PERMISSIONS:
         {
             handle chatid = request->getNodeHandle();
@@ -21507,12 +23846,70 @@ void MegaApiImpl::sendPendingRequests()
                 break;
             }
 
-            TreeProcFolderInfo folderProcessor;
-            client->proctree(node, &folderProcessor, false, false);
-            MegaFolderInfo *folderInfo = folderProcessor.getResult();
-            request->setMegaFolderInfo(folderInfo);
-            delete folderInfo;
+            // the counters kept for each folder already add up the whole subtree.  Versions count as files there
+            NodeCounter nc = node->subnodeCounts();
+            MegaFolderInfoPrivate folderInfo(int(nc.files - nc.versions), int(nc.folders) - (node->type == FOLDERNODE),
+                                             int(nc.versions), nc.storage - nc.versionStorage, nc.versionStorage);
+            request->setMegaFolderInfo(&folderInfo);
+
+            fireOnRequestFinish(request, MegaError(API_OK));
+            break;
+        }
+        case MegaRequest::TYPE_SEARCH:
+        {
+            const char *searchString = request->getText();
+            long long pageSize = request->getNumber();
+            MegaHandle h = request->getNodeHandle();
+            Node *ancestor = NULL;
+            if (!searchString || pageSize < 1)
+            {
+                e = API_EARGS;
+                break;
+            }
+
+            if (!ISUNDEF(h) && !(ancestor = client->nodebyhandle(h)))
+            {
+                e = API_ENOENT;
+                break;
+            }
+
+            NodeSearchFilter filter;
+            filter.pattern = NodeSearchFilter::fold(searchString);
+
+            node_vector result;
+            if (!searchNodeNameIndex(filter, ancestor, NULL, result))
+            {
+                searchTree(filter, ancestor, NULL, result);
+            }
+
+            // the app may change the nodes from the callbacks: each page looks its own up again
+            vector<handle> handles;
+            handles.reserve(result.size());
+            for (Node *n : result)
+            {
+                handles.push_back(n->nodehandle);
+            }
+            result.clear();
+
+            request->setTotalBytes(handles.size());
+            request->setTransferredBytes(0);
+            for (size_t i = 0; i < handles.size(); )
+            {
+                node_vector page;
+                for (size_t end = i + size_t(std::min<long long>(pageSize, handles.size() - i)); i < end; i++)
+                {
+                    if (Node *n = client->nodebyhandle(handles[i]))
+                    {
+                        page.push_back(n);
+                    }
+                }
+
+                request->setMegaNodeList(new MegaNodeListPrivate(page.data(), int(page.size())));
+                request->setTransferredBytes(i);
+                fireOnRequestUpdate(request);
+            }
 
+            request->setMegaNodeList(NULL);
             fireOnRequestFinish(request, MegaError(API_OK));
             break;
         }
@@ -21789,6 +24186,189 @@ long long MegaApiImpl::getTotalUploadBytes()
     return totalUploadBytes;
 }
 
+void MegaApiImpl::setPerformanceStatsEnabled(bool enable)
+{
+    CodeCounter::setEnabled(enable);
+}
+
+MegaStringMap *MegaApiImpl::getPerformanceSnapshot(bool reset)
+{
+    SdkMutexGuard g(sdkMutex);
+
+    std::map<string, int64_t> values;
+    client->performanceStats.snapshot(values, client->httpio, client->reqs, *client->bufferpool);
+    if (reset)
+    {
+        client->performanceStats.reset(client->httpio);
+    }
+
+    MegaStringMap *snapshot = new MegaStringMapPrivate();
+    for (auto& value : values)
+    {
+        snapshot->set(value.first.c_str(), std::to_string(value.second).c_str());
+    }
+    return snapshot;
+}
+
+void MegaApiImpl::setEventLoopStallThreshold(unsigned thresholdMs)
+{
+    client->execTracer.setthreshold(thresholdMs);
+}
+
+MegaStringList *MegaApiImpl::getEventLoopStalls(bool reset)
+{
+    SdkMutexGuard g(sdkMutex);
+
+    vector<char*> stalls;
+    for (const MegaClient::ExecTracer::Iteration& iteration : client->execTracer.slowest())
+    {
+        stalls.push_back(MegaApi::strdup((std::to_string(iteration.when) + " " + iteration.report()).c_str()));
+    }
+    if (reset)
+    {
+        client->execTracer.clear();
+    }
+    return new MegaStringListPrivate(stalls.data(), int(stalls.size()));
+}
+
+bool MegaApiImpl::startTrace(const char* outputPath)
+{
+    SdkMutexGuard g(sdkMutex);
+
+    if (!outputPath || CodeCounter::tracing())
+    {
+        return false;
+    }
+
+    tracePath = outputPath;
+    CodeCounter::startTrace();
+    return true;
+}
+
+bool MegaApiImpl::stopTrace()
+{
+    SdkMutexGuard g(sdkMutex);
+
+    if (tracePath.empty() || !CodeCounter::tracing())
+    {
+        return false;
+    }
+
+    string trace = CodeCounter::stopTrace();
+    string localpath;
+    fsAccess->path2local(&tracePath, &localpath);
+    tracePath.clear();
+
+    fsAccess->unlinklocal(&localpath);
+    std::unique_ptr<FileAccess> fa(fsAccess->newfileaccess());
+    if (!fa->fopen(&localpath, false, true) || !fa->fwrite((const byte*)trace.data(), unsigned(trace.size()), 0))
+    {
+        LOG_err << "Unable to write the trace";
+        return false;
+    }
+
+    LOG_info << "Trace written: " << trace.size() << " bytes";
+    return true;
+}
+
+string MegaApiImpl::getOpenMetrics()
+{
+    SdkMutexGuard g(sdkMutex);
+
+    // OpenMetrics text format: every label has a fixed set of values, so the series don't grow
+    std::ostringstream s;
+    s.imbue(std::locale::classic());
+    auto family = [&s](const char* name, const char* type, const char* help)
+    {
+        s << "# TYPE " << name << " " << type << "\n# HELP " << name << " " << help << "\n";
+    };
+    auto seconds = [](std::chrono::high_resolution_clock::duration d) { return std::chrono::duration<double>(d).count(); };
+
+    MegaClient::PerformanceStats& stats = client->performanceStats;
+
+    family("mega_transfer_bytes", "counter", "Bytes transferred since the MegaApi was created.");
+    s << "mega_transfer_bytes_total{direction=\"download\"} " << totalDownloadedBytes << "\n";
+    s << "mega_transfer_bytes_total{direction=\"upload\"} " << totalUploadedBytes << "\n";
+
+    family("mega_transfer_speed_bytes_per_second", "gauge", "Current transfer speed.");
+    s << "mega_transfer_speed_bytes_per_second{direction=\"download\"} " << client->httpio->downloadSpeed << "\n";
+    s << "mega_transfer_speed_bytes_per_second{direction=\"upload\"} " << client->httpio->uploadSpeed << "\n";
+
+    size_t active[2] = {};
+    for (TransferSlot* slot : client->tslots)
+    {
+        active[slot->transfer->type == PUT]++;
+    }
+    family("mega_transfers_queued", "gauge", "Transfers waiting or in progress.");
+    s << "mega_transfers_queued{direction=\"download\"} " << client->transfers[GET].size() << "\n";
+    s << "mega_transfers_queued{direction=\"upload\"} " << client->transfers[PUT].size() << "\n";
+    family("mega_transfers_active", "gauge", "Transfers with a transfer slot.");
+    s << "mega_transfers_active{direction=\"download\"} " << active[GET] << "\n";
+    s << "mega_transfers_active{direction=\"upload\"} " << active[PUT] << "\n";
+
+    family("mega_cs_requests", "counter", "API requests sent and answered.");
+    s << "mega_cs_requests_total{state=\"sent\"} " << client->reqs.csRequestsSent << "\n";
+    s << "mega_cs_requests_total{state=\"completed\"} " << client->reqs.csRequestsCompleted << "\n";
+    family("mega_cs_deferred_commands", "counter", "Background API requests held for other traffic, and the radio wakeups that saved.");
+    s << "mega_cs_deferred_commands_total " << client->reqs.csDeferredCommands << "\n";
+    s << "mega_cs_radio_wakeups_saved_total " << client->reqs.csDeferredRidealongs << "\n";
+    family("mega_cs_batches_in_flight", "gauge", "Batches of API requests sent and not answered yet.");
+    s << "mega_cs_batches_in_flight " << (client->reqs.csBatchesSent > client->reqs.csBatchesReceived
+                                          ? client->reqs.csBatchesSent - client->reqs.csBatchesReceived : 0) << "\n";
+
+    family("mega_worker_tasks", "counter", "Tasks of parallel work, and those of them run by a worker thread.");
+    for (int c = 0; c < WorkerPool::WORK_CLASSES; c++)
+    {
+        WorkerPool::ClassStats ws = WorkerPool::get().stats(WorkerPool::workclass_t(c));
+        const char* name = WorkerPool::classname(WorkerPool::workclass_t(c));
+        s << "mega_worker_tasks_total{class=\"" << name << "\"} " << ws.tasks << "\n";
+        s << "mega_worker_tasks_total{class=\"" << name << "\",thread=\"worker\"} " << ws.queuedtasks << "\n";
+    }
+    family("mega_worker_queue_seconds", "summary", "Time from the start of a parallel job to a worker thread taking one of its tasks.");
+    for (int c = 0; c < WorkerPool::WORK_CLASSES; c++)
+    {
+        WorkerPool::ClassStats ws = WorkerPool::get().stats(WorkerPool::workclass_t(c));
+        const char* name = WorkerPool::classname(WorkerPool::workclass_t(c));
+        s << "mega_worker_queue_seconds_sum{class=\"" << name << "\"} " << ws.totalqueueseconds << "\n";
+        s << "mega_worker_queue_seconds_count{class=\"" << name << "\"} " << ws.queuedtasks << "\n";
+    }
+
+    family("mega_sc_packets", "counter", "Action packets processed.");
+    s << "mega_sc_packets_total " << stats.scPackets << "\n";
+    family("mega_sc_propagation_seconds", "summary", "Time from an own change to its action packet.");
+    s << "mega_sc_propagation_seconds_sum " << seconds(stats.scPropagationTime.sum) << "\n";
+    s << "mega_sc_propagation_seconds_count " << stats.scPropagations << "\n";
+
+#ifdef ENABLE_SYNC
+    size_t queued[DirNotify::NUMQUEUES] = {};
+    for (Sync* sync : client->syncs)
+    {
+        for (int q = 0; q < DirNotify::NUMQUEUES; q++)
+        {
+            queued[q] += sync->dirnotify->notifyq[q].size();
+        }
+    }
+    family("mega_sync_queue_depth", "gauge", "Filesystem notifications waiting to be processed, for all syncs.");
+    s << "mega_sync_queue_depth{queue=\"extra\"} " << queued[DirNotify::EXTRA] << "\n";
+    s << "mega_sync_queue_depth{queue=\"direvents\"} " << queued[DirNotify::DIREVENTS] << "\n";
+    s << "mega_sync_queue_depth{queue=\"retry\"} " << queued[DirNotify::RETRY] << "\n";
+#endif
+
+    // includes the commits to the local cache ("state_cache_commit"); only counted while enabled
+    family("mega_scope_duration_seconds", "summary", "Duration of the timed sections of the SDK (see MegaApi::setPerformanceStatsEnabled).");
+    for (const CodeCounter::ScopeStats* scope : stats.scopes(client->httpio))
+    {
+        string label = "scope=\"" + MegaClient::PerformanceStats::scopename(*scope) + "\"";
+        s << "mega_scope_duration_seconds{" << label << ",quantile=\"0.5\"} " << scope->latency.percentile(0.5) / 1e6 << "\n";
+        s << "mega_scope_duration_seconds{" << label << ",quantile=\"0.99\"} " << scope->latency.percentile(0.99) / 1e6 << "\n";
+        s << "mega_scope_duration_seconds_sum{" << label << "} " << seconds(scope->timeSpent) << "\n";
+        s << "mega_scope_duration_seconds_count{" << label << "} " << scope->count << "\n";
+    }
+
+    s << "# EOF\n";
+    return s.str();
+}
+
 void MegaApiImpl::update()
 {
 #ifdef ENABLE_SYNC
@@ -21843,51 +24423,434 @@ void MegaApiImpl::lockMutex()
     sdkMutex.lock();
 }
 
-void MegaApiImpl::unlockMutex()
+void SdkMutex::lock()
 {
-    sdkMutex.unlock();
-}
+    std::unique_lock<std::mutex> g(mMutex);
 
-bool MegaApiImpl::tryLockMutexFor(long long time)
-{
-    if (time <= 0)
+    if (mOwner == std::this_thread::get_id())
     {
-        return sdkMutex.try_lock();
+        mDepth++;
+        return;
     }
-    else
+
+    // it would wait for its own shared lock
+    assert(!heldShared());
+
+    if (mDepth || mReaders)
     {
-        return sdkMutex.try_lock_for(std::chrono::milliseconds(time));
+        auto started = std::chrono::steady_clock::now();
+        mWritersWaiting++;
+        mReleased.wait(g, [this]() { return !mDepth && !mReaders; });
+        mWritersWaiting--;
+        auto us = (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+
+        contended++;
+        waitUs += us;
+        maxWaitUs = std::max(maxWaitUs, us);
     }
-}
 
-TreeProcCopy::TreeProcCopy()
-{
-    nn = NULL;
-    nc = 0;
+    mOwner = std::this_thread::get_id();
+    mDepth = 1;
 }
 
-void TreeProcCopy::allocnodes()
+bool SdkMutex::try_lock()
 {
-    if(nc) nn = new NewNode[nc];
+    return try_lock_for(std::chrono::milliseconds(0));
 }
 
-TreeProcCopy::~TreeProcCopy()
+bool SdkMutex::try_lock_for(std::chrono::milliseconds timeout)
 {
-    //Will be deleted in putnodes_result
-    //delete[] nn;
-}
+    std::unique_lock<std::mutex> g(mMutex);
 
-// determine node tree size (nn = NULL) or write node tree to new nodes array
-void TreeProcCopy::proc(MegaClient* client, Node* n)
-{
-    if (nn)
+    if (mOwner == std::this_thread::get_id())
     {
-        string attrstring;
-        SymmCipher key;
-        NewNode* t = nn+--nc;
+        mDepth++;
+        return true;
+    }
 
-        // copy node
-        t->source = NEW_NODE;
+    if (mDepth || mReaders)
+    {
+        mWritersWaiting++;
+        bool acquired = mReleased.wait_for(g, timeout, [this]() { return !mDepth && !mReaders; });
+        mWritersWaiting--;
+
+        if (!acquired)
+        {
+            // readers held back by this one may go now
+            mReleased.notify_all();
+            return false;
+        }
+    }
+
+    mOwner = std::this_thread::get_id();
+    mDepth = 1;
+    return true;
+}
+
+void SdkMutex::unlock()
+{
+    std::lock_guard<std::mutex> g(mMutex);
+
+    assert(mOwner == std::this_thread::get_id() && mDepth);
+    if (!--mDepth)
+    {
+        mOwner = std::thread::id();
+        mReleased.notify_all();
+    }
+}
+
+void SdkMutex::lock_shared()
+{
+    std::unique_lock<std::mutex> g(mMutex);
+
+    if (mOwner == std::this_thread::get_id())
+    {
+        mDepth++;
+        return;
+    }
+
+    unsigned& held = heldShared();
+    if (!held && (mDepth || mWritersWaiting))
+    {
+        auto started = std::chrono::steady_clock::now();
+        mReleased.wait(g, [this]() { return !mDepth && !mWritersWaiting; });
+
+        sharedContended++;
+        sharedWaitUs += (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+    }
+
+    held++;
+    mReaders++;
+}
+
+void SdkMutex::unlock_shared()
+{
+    std::lock_guard<std::mutex> g(mMutex);
+
+    if (mOwner == std::this_thread::get_id())
+    {
+        assert(mDepth > 1);
+        mDepth--;
+        return;
+    }
+
+    assert(mReaders && heldShared());
+    releaseShared();
+    if (!--mReaders)
+    {
+        mReleased.notify_all();
+    }
+}
+
+namespace {
+// the shared locks held by this thread, per mutex (in practice one at a time)
+thread_local std::vector<std::pair<const SdkMutex*, unsigned>> sharedLocksHeld;
+}
+
+unsigned& SdkMutex::heldShared()
+{
+    for (auto& h : sharedLocksHeld)
+    {
+        if (h.first == this)
+        {
+            return h.second;
+        }
+    }
+
+    sharedLocksHeld.emplace_back(this, 0);
+    return sharedLocksHeld.back().second;
+}
+
+void SdkMutex::releaseShared()
+{
+    for (auto it = sharedLocksHeld.begin(); it != sharedLocksHeld.end(); it++)
+    {
+        if (it->first == this)
+        {
+            if (!--it->second)
+            {
+                sharedLocksHeld.erase(it);
+            }
+            return;
+        }
+    }
+}
+
+std::string SdkMutex::report(bool reset)
+{
+    std::ostringstream s;
+    s << contended << " contended, " << waitUs / 1000 << " ms waited, longest " << maxWaitUs / 1000 << " ms; shared "
+      << sharedContended << " contended, " << sharedWaitUs / 1000 << " ms waited";
+
+    if (reset)
+    {
+        contended = waitUs = maxWaitUs = 0;
+        sharedContended = sharedWaitUs = 0;
+    }
+    return s.str();
+}
+
+SdkReadGuard::SdkReadGuard(SdkMutex& m, const MegaClient& client)
+    : mMutex(m)
+{
+    mMutex.lock_shared();
+
+    // only changed with the mutex held exclusively
+    if (client.lowmemorybudget || client.pagedoutnodes)
+    {
+        relock();
+    }
+}
+
+SdkReadGuard::~SdkReadGuard()
+{
+    if (mExclusive)
+    {
+        mMutex.unlock();
+    }
+    else
+    {
+        mMutex.unlock_shared();
+    }
+}
+
+void SdkReadGuard::relock()
+{
+    if (!mExclusive)
+    {
+        mMutex.unlock_shared();
+        mMutex.lock();
+        mExclusive = true;
+    }
+}
+
+#ifdef MEGA_SHARED_EVENT_LOOPS
+struct SharedEventLoops::Loop
+{
+    // wakes on the waiters of the clients, and on add()
+    PosixWaiter waiter;
+
+    // handed over by add(), and the clients in all.  With the mutex
+    std::vector<Client*> added;
+    unsigned count = 0;
+
+    std::thread thread;
+};
+
+SharedEventLoops& SharedEventLoops::get()
+{
+    static SharedEventLoops eventLoops;
+    return eventLoops;
+}
+
+SharedEventLoops::SharedEventLoops() = default;
+
+SharedEventLoops::~SharedEventLoops()
+{
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        stopping = true;
+
+        // the clients still running are abandoned with their loops
+        members.clear();
+        left.notify_all();
+    }
+
+    for (auto& loop : loops)
+    {
+        loop->waiter.notify();
+        loop->thread.join();
+    }
+}
+
+void SharedEventLoops::setthreads(unsigned threads)
+{
+    std::lock_guard<std::mutex> g(mutex);
+    wantedthreads = threads;
+}
+
+unsigned SharedEventLoops::threads()
+{
+    std::lock_guard<std::mutex> g(mutex);
+    return wantedthreads;
+}
+
+bool SharedEventLoops::add(Client* client)
+{
+    if (client->waitfd() < 0)
+    {
+        return false;
+    }
+
+    Loop* loop = nullptr;
+    unsigned index = 0;
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        if (!wantedthreads || stopping)
+        {
+            return false;
+        }
+
+        while (loops.size() < wantedthreads)
+        {
+            loops.emplace_back(new Loop);
+            Loop* l = loops.back().get();
+            l->thread = std::thread([this, l]() { run(*l); });
+        }
+
+        // loops beyond a smaller number set later keep their clients, and get no new ones
+        for (unsigned i = 0; i < wantedthreads; i++)
+        {
+            if (!loop || loops[i]->count < loop->count)
+            {
+                loop = loops[i].get();
+                index = i;
+            }
+        }
+        loop->count++;
+        members[client] = loop;
+    }
+
+    client->joining(index);
+
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        loop->added.push_back(client);
+    }
+    loop->waiter.notify();
+    return true;
+}
+
+void SharedEventLoops::waitdone(Client* client)
+{
+    std::unique_lock<std::mutex> g(mutex);
+    left.wait(g, [this, client]() { return !members.count(client); });
+}
+
+void SharedEventLoops::run(Loop& loop)
+{
+    struct sigaction noaction;
+    memset(&noaction, 0, sizeof(noaction));
+    noaction.sa_handler = SIG_IGN;
+    ::sigaction(SIGPIPE, &noaction, 0);
+
+    struct Member
+    {
+        Client* client;
+        int fd;
+        dstime deadline;
+
+        // prepareturn() was called, and its wait is pending
+        bool armed;
+    };
+    std::vector<Member> clients;
+
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> g(mutex);
+            if (stopping)
+            {
+                return;
+            }
+            for (Client* c : loop.added)
+            {
+                clients.push_back(Member{ c, c->waitfd(), 0, false });
+            }
+            loop.added.clear();
+        }
+
+        // a turn for each client whose waiter woke or whose time is up, then the first half of the next one
+        Waiter::bumpds();
+        for (size_t i = 0; i < clients.size(); )
+        {
+            Member& m = clients[i];
+            if (m.armed && (m.deadline <= Waiter::ds || loop.waiter.isready(m.fd, PosixWaiter::WATCH_READ)))
+            {
+                if (!m.client->turn())
+                {
+                    Client* done = m.client;
+                    loop.waiter.forgetfd(m.fd);
+                    clients.erase(clients.begin() + long(i));
+
+                    std::lock_guard<std::mutex> g(mutex);
+                    loop.count--;
+                    members.erase(done);
+                    left.notify_all();
+                    continue;
+                }
+                m.armed = false;
+            }
+
+            if (!m.armed)
+            {
+                dstime timeout = m.client->prepareturn();
+                m.deadline = timeout >= NEVER - Waiter::ds ? NEVER : Waiter::ds + timeout;
+                m.armed = true;
+            }
+            i++;
+        }
+
+        loop.waiter.init(NEVER);
+        Waiter::bumpds();
+        for (Member& m : clients)
+        {
+            loop.waiter.watchfd(m.fd, PosixWaiter::WATCH_READ);
+            if (m.deadline != NEVER)
+            {
+                loop.waiter.maxds = std::min(loop.waiter.maxds, m.deadline > Waiter::ds ? m.deadline - Waiter::ds : 0);
+            }
+        }
+        loop.waiter.wait();
+    }
+}
+#endif
+
+void MegaApiImpl::unlockMutex()
+{
+    sdkMutex.unlock();
+}
+
+bool MegaApiImpl::tryLockMutexFor(long long time)
+{
+    if (time <= 0)
+    {
+        return sdkMutex.try_lock();
+    }
+    else
+    {
+        return sdkMutex.try_lock_for(std::chrono::milliseconds(time));
+    }
+}
+
+TreeProcCopy::TreeProcCopy()
+{
+    nn = NULL;
+    nc = 0;
+}
+
+void TreeProcCopy::allocnodes()
+{
+    if(nc) nn = new NewNode[nc];
+}
+
+TreeProcCopy::~TreeProcCopy()
+{
+    //Will be deleted in putnodes_result
+    //delete[] nn;
+}
+
+// determine node tree size (nn = NULL) or write node tree to new nodes array
+void TreeProcCopy::proc(MegaClient* client, Node* n)
+{
+    if (nn)
+    {
+        string attrstring;
+        SymmCipher key;
+        NewNode* t = nn+--nc;
+
+        // copy node
+        t->source = NEW_NODE;
         t->type = n->type;
         t->nodehandle = n->nodehandle;
         t->parenthandle = n->parent ? n->parent->nodehandle : UNDEF;
@@ -21907,7 +24870,7 @@ void TreeProcCopy::proc(MegaClient* client, Node* n)
             key.setkey((const byte*)t->nodekey.data(),n->type);
 
             AttrMap tattrs;
-            tattrs.map = n->attrs.map;
+            tattrs.map = n->attrs().map;
             nameid rrname = AttrMap::string2nameid("rr");
             attr_map::iterator it = tattrs.map.find(rrname);
             if (it != tattrs.map.end())
@@ -21927,143 +24890,210 @@ TransferQueue::TransferQueue()
 {
 }
 
-void TransferQueue::push(MegaTransferPrivate *transfer)
+void TransferQueue::removeListener(MegaTransferListener *listener)
 {
-    mutex.lock();
-    transfers.push_back(transfer);
-    mutex.unlock();
-}
+    std::lock_guard<std::mutex> g(readyMutex);
+    drain();
 
-void TransferQueue::push_front(MegaTransferPrivate *transfer)
-{
-    mutex.lock();
-    transfers.push_front(transfer);
-    mutex.unlock();
+    std::deque<MegaTransferPrivate *>::iterator it = ready.begin();
+    while(it != ready.end())
+    {
+        MegaTransferPrivate *transfer = (*it);
+        if(transfer->getListener() == listener)
+            transfer->setListener(NULL);
+        it++;
+    }
 }
 
-MegaTransferPrivate *TransferQueue::pop()
+std::vector<std::string> TransferQueue::uploadPaths(size_t max)
 {
-    mutex.lock();
-    if(transfers.empty())
+    std::vector<std::string> paths;
+    std::lock_guard<std::mutex> g(readyMutex);
+    drain();
+
+    // don't walk a long run of downloads to find uploads behind it
+    size_t scanned = 0;
+    for (auto it = ready.begin(); it != ready.end() && paths.size() < max && scanned < 4 * max; ++it, ++scanned)
     {
-        mutex.unlock();
-        return NULL;
+        MegaTransferPrivate *transfer = *it;
+        if (transfer->getType() == MegaTransfer::TYPE_UPLOAD && transfer->getPath())
+        {
+            paths.push_back(transfer->getPath());
+        }
     }
-    MegaTransferPrivate *transfer = transfers.front();
-    transfers.pop_front();
-    mutex.unlock();
-    return transfer;
+    return paths;
 }
 
-void TransferQueue::removeListener(MegaTransferListener *listener)
+UploadFingerprintPrefetcher::UploadFingerprintPrefetcher(unsigned lookahead, unsigned warm)
+    : fsaccess(new MegaFileSystemAccess())
+    , maxLookahead(lookahead)
+    , warmBytes(warm)
 {
-    mutex.lock();
+    worker = std::thread(&UploadFingerprintPrefetcher::workerLoop, this);
+}
 
-    std::deque<MegaTransferPrivate *>::iterator it = transfers.begin();
-    while(it != transfers.end())
+UploadFingerprintPrefetcher::~UploadFingerprintPrefetcher()
+{
     {
-        MegaTransferPrivate *transfer = (*it);
-        if(transfer->getListener() == listener)
-            transfer->setListener(NULL);
-        it++;
+        std::lock_guard<std::mutex> g(mutex);
+        stopping = true;
     }
-
-    mutex.unlock();
+    workAvailable.notify_all();
+    worker.join();
 }
 
-RequestQueue::RequestQueue()
+unsigned UploadFingerprintPrefetcher::lookahead() const
 {
+    return maxLookahead;
 }
 
-void RequestQueue::push(MegaRequestPrivate *request)
+void UploadFingerprintPrefetcher::prefetch(std::vector<std::string>&& paths)
 {
-    mutex.lock();
-    requests.push_back(request);
-    mutex.unlock();
+    std::lock_guard<std::mutex> g(mutex);
+
+    std::map<std::string, FileFingerprint> kept;
+    pending.clear();
+    for (auto& path : paths)
+    {
+        auto it = ready.find(path);
+        if (it != ready.end())
+        {
+            kept[path] = it->second;
+        }
+        else if (path != current)
+        {
+            pending.push_back(std::move(path));
+        }
+    }
+    ready.swap(kept);
+
+    if (!pending.empty())
+    {
+        workAvailable.notify_one();
+    }
 }
 
-void RequestQueue::push_front(MegaRequestPrivate *request)
+bool UploadFingerprintPrefetcher::take(const std::string& path, m_off_t size, m_time_t mtime, FileFingerprint& fp)
 {
-    mutex.lock();
-    requests.push_front(request);
-    mutex.unlock();
+    std::unique_lock<std::mutex> g(mutex);
+
+    // no point reading the file a second time while the worker is half way through it
+    fingerprinted.wait(g, [&]() { return current != path; });
+
+    auto it = ready.find(path);
+    if (it == ready.end())
+    {
+        return false;
+    }
+
+    bool valid = it->second.size == size && it->second.mtime == mtime;
+    if (valid)
+    {
+        fp = it->second;
+    }
+    ready.erase(it);
+    return valid;
 }
 
-MegaRequestPrivate *RequestQueue::pop()
+void UploadFingerprintPrefetcher::workerLoop()
 {
-    mutex.lock();
-    if(requests.empty())
+    std::vector<byte> buffer;
+
+    for (;;)
     {
-        mutex.unlock();
-        return NULL;
+        std::string path;
+        {
+            std::unique_lock<std::mutex> g(mutex);
+            workAvailable.wait(g, [this]() { return stopping || !pending.empty(); });
+            if (stopping)
+            {
+                return;
+            }
+            path = current = std::move(pending.front());
+            pending.pop_front();
+        }
+
+        string localPath;
+        string utf8Path = path;
+        fsaccess->path2local(&utf8Path, &localPath);
+
+        FileFingerprint fp;
+        auto fa = fsaccess->newfileaccess();
+        if (fa->fopen(&localPath, true, false) && fa->type == FILENODE)
+        {
+            fp.genfingerprint(fa.get());
+
+            // the first chunks are read again by the upload, out of the page cache by then
+            unsigned warm = unsigned(std::min<m_off_t>(fa->size, warmBytes));
+            if (fp.isvalid && warm)
+            {
+                buffer.resize(warm);
+                fa->frawread(buffer.data(), warm, 0, true);
+            }
+        }
+        fa.reset();
+
+        {
+            std::lock_guard<std::mutex> g(mutex);
+            if (fp.isvalid)
+            {
+                ready[path] = fp;
+            }
+            current.clear();
+        }
+        fingerprinted.notify_all();
     }
-    MegaRequestPrivate *request = requests.front();
-    requests.pop_front();
-    mutex.unlock();
-    return request;
 }
 
-MegaRequestPrivate *RequestQueue::front()
+RequestQueue::RequestQueue()
 {
-    mutex.lock();
-    if(requests.empty())
-    {
-        mutex.unlock();
-        return NULL;
-    }
-    MegaRequestPrivate *request = requests.front();
-    mutex.unlock();
-    return request;
 }
 
 void RequestQueue::removeListener(MegaRequestListener *listener)
 {
-    mutex.lock();
+    std::lock_guard<std::mutex> g(readyMutex);
+    drain();
 
-    std::deque<MegaRequestPrivate *>::iterator it = requests.begin();
-    while(it != requests.end())
+    std::deque<MegaRequestPrivate *>::iterator it = ready.begin();
+    while(it != ready.end())
     {
         MegaRequestPrivate *request = (*it);
         if(request->getListener()==listener)
             request->setListener(NULL);
         it++;
     }
-
-    mutex.unlock();
 }
 
 #ifdef ENABLE_SYNC
 void RequestQueue::removeListener(MegaSyncListener *listener)
 {
-    mutex.lock();
+    std::lock_guard<std::mutex> g(readyMutex);
+    drain();
 
-    std::deque<MegaRequestPrivate *>::iterator it = requests.begin();
-    while(it != requests.end())
+    std::deque<MegaRequestPrivate *>::iterator it = ready.begin();
+    while(it != ready.end())
     {
         MegaRequestPrivate *request = (*it);
         if(request->getSyncListener()==listener)
             request->setSyncListener(NULL);
         it++;
     }
-
-    mutex.unlock();
 }
 #endif
 
 void RequestQueue::removeListener(MegaBackupListener *listener)
 {
-    mutex.lock();
+    std::lock_guard<std::mutex> g(readyMutex);
+    drain();
 
-    std::deque<MegaRequestPrivate *>::iterator it = requests.begin();
-    while(it != requests.end())
+    std::deque<MegaRequestPrivate *>::iterator it = ready.begin();
+    while(it != ready.end())
     {
         MegaRequestPrivate *request = (*it);
         if(request->getBackupListener()==listener)
             request->setBackupListener(NULL);
         it++;
     }
-
-    mutex.unlock();
 }
 
 MegaHashSignatureImpl::MegaHashSignatureImpl(const char *base64Key)
@@ -22094,6 +25124,77 @@ void MegaHashSignatureImpl::add(const char *data, unsigned size)
     hashSignature->add((const byte *)data, size);
 }
 
+MegaSharedNodeViewImpl::MegaSharedNodeViewImpl(const char *path, const char *base64Key)
+{
+    string key(SymmCipher::KEYLENGTH, '\0');
+    if (path && base64Key && Base64::atob(base64Key, (byte*)key.data(), int(key.size())) == int(key.size()))
+    {
+        valid = view.open(path, key);
+    }
+}
+
+bool MegaSharedNodeViewImpl::isValid() const
+{
+    return valid;
+}
+
+long long MegaSharedNodeViewImpl::getGeneration() const
+{
+    return (long long)view.generation();
+}
+
+bool MegaSharedNodeViewImpl::refresh()
+{
+    if (!valid)
+    {
+        return false;
+    }
+
+    bool refreshed = view.refresh();
+    valid = view.generation() != 0;
+    return refreshed;
+}
+
+MegaHandle MegaSharedNodeViewImpl::getRootNode(int i) const
+{
+    return valid ? view.rootnode(i) : INVALID_HANDLE;
+}
+
+MegaNode *MegaSharedNodeViewImpl::getNodeByHandle(MegaHandle handle) const
+{
+    SharedNodeView::Record r;
+    string name;
+    if (!valid || !view.find(handle, &r, &name))
+    {
+        return NULL;
+    }
+    return node(r, name);
+}
+
+MegaNodeList *MegaSharedNodeViewImpl::getChildren(MegaHandle parentHandle) const
+{
+    vector<SharedNodeView::Record> rs;
+    vector<string> names;
+    vector<MegaNode*> children;
+    if (valid && view.children(parentHandle, &rs, &names))
+    {
+        children.reserve(rs.size());
+        for (size_t i = 0; i < rs.size(); i++)
+        {
+            children.push_back(node(rs[i], names[i]));
+        }
+    }
+    return new MegaNodeListPrivate(std::move(children));
+}
+
+MegaNode *MegaSharedNodeViewImpl::node(const SharedNodeView::Record& r, const string& name)
+{
+    string nodekey, attrstring, fileattrstring;
+    return new MegaNodePrivate(name.c_str(), r.type, r.type == FILENODE ? r.size : 0, r.ctime, r.mtime, r.nodehandle,
+                               &nodekey, &attrstring, &fileattrstring, NULL, NULL, INVALID_HANDLE, r.parenthandle,
+                               NULL, NULL, false);
+}
+
 bool MegaHashSignatureImpl::checkSignature(const char *base64Signature)
 {
     char signature[512];
@@ -22352,6 +25453,11 @@ ExternalLogger::ExternalLogger()
 
 ExternalLogger::~ExternalLogger()
 {
+    if (asyncLogger)
+    {
+        asyncLogger->stop();
+    }
+
 #ifndef ENABLE_LOG_PERFORMANCE
     mutex.lock();
 #endif
@@ -22399,6 +25505,52 @@ void ExternalLogger::setLogToConsole(bool enable)
     this->logToConsole = enable;
 }
 
+bool ExternalLogger::setBinaryLog(const char* path)
+{
+    std::unique_ptr<std::ofstream> file;
+    if (path)
+    {
+        file.reset(new std::ofstream(path, std::ios::binary | std::ios::trunc));
+        if (!*file)
+        {
+            return false;
+        }
+    }
+
+#ifndef ENABLE_LOG_PERFORMANCE
+    mutex.lock();
+#endif
+    binaryLogger.reset(file ? new BinaryLogger(*file) : nullptr);
+    binaryLogFile = std::move(file);
+#ifndef ENABLE_LOG_PERFORMANCE
+    mutex.unlock();
+#endif
+    return true;
+}
+
+void ExternalLogger::setAsync(bool enable, unsigned rateLimit)
+{
+    // not under the mutex: stopping delivers the queued messages through log()
+    if (enable)
+    {
+        if (!asyncLogger)
+        {
+            asyncLogger.reset(new AsyncLogger(this, rateLimit));
+        }
+        else
+        {
+            asyncLogger->setratelimit(rateLimit);
+            asyncLogger->start();
+        }
+        SimpleLogger::setOutputClass(asyncLogger.get());
+    }
+    else if (asyncLogger)
+    {
+        SimpleLogger::setOutputClass(this);
+        asyncLogger->stop();
+    }
+}
+
 void ExternalLogger::postLog(int logLevel, const char *message, const char *filename, int line)
 {
     if (SimpleLogger::logCurrentLevel < logLevel)
@@ -22459,6 +25611,15 @@ void ExternalLogger::log(const char *time, int loglevel, const char *source, con
                     );
     }
 
+    if (binaryLogger)
+    {
+        binaryLogger->log(time, loglevel, source, message
+#ifdef ENABLE_LOG_PERFORMANCE
+                          , directMessages, directMessagesSizes, numberMessages
+#endif
+                          );
+    }
+
     if (logToConsole)
     {
 #ifdef ENABLE_LOG_PERFORMANCE
@@ -22821,6 +25982,106 @@ void MegaSyncPrivate::setState(int state)
     this->state = state;
 }
 
+MegaSyncStatsPrivate::MegaSyncStatsPrivate(int tag, const SyncStats& stats)
+    : tag(tag), stats(stats)
+{
+}
+
+MegaSyncStats *MegaSyncStatsPrivate::copy() const
+{
+    return new MegaSyncStatsPrivate(tag, stats);
+}
+
+int MegaSyncStatsPrivate::getTag() const
+{
+    return tag;
+}
+
+long long MegaSyncStatsPrivate::getQueuedNotifications() const
+{
+    return (long long)stats.queued[DirNotify::DIREVENTS];
+}
+
+long long MegaSyncStatsPrivate::getQueuedRetries() const
+{
+    return (long long)stats.queued[DirNotify::RETRY];
+}
+
+long long MegaSyncStatsPrivate::getQueuedDelayed() const
+{
+    return (long long)stats.queued[DirNotify::EXTRA];
+}
+
+long long MegaSyncStatsPrivate::getQueueLag() const
+{
+    return (long long)stats.queuelagds * 100;
+}
+
+long long MegaSyncStatsPrivate::getScannedEntries() const
+{
+    return (long long)stats.scanentries;
+}
+
+long long MegaSyncStatsPrivate::getScanRate() const
+{
+    return (long long)stats.scanrate;
+}
+
+long long MegaSyncStatsPrivate::getPendingFolderCreations() const
+{
+    return (long long)stats.synccreate;
+}
+
+long long MegaSyncStatsPrivate::getVanishedNodes() const
+{
+    return (long long)stats.notseen;
+}
+
+long long MegaSyncStatsPrivate::getQueuedDownloads() const
+{
+    return (long long)stats.gets;
+}
+
+long long MegaSyncStatsPrivate::getQueuedUploads() const
+{
+    return (long long)stats.puts;
+}
+
+long long MegaSyncStatsPrivate::getStateCacheFlushes() const
+{
+    return (long long)stats.statecacheflushes;
+}
+
+long long MegaSyncStatsPrivate::getStateCacheFlushTime() const
+{
+    return (long long)stats.statecacheflushms;
+}
+
+long long MegaSyncStatsPrivate::getLastStateCacheFlushTime() const
+{
+    return (long long)stats.statecachelastflushms;
+}
+
+long long MegaSyncStatsPrivate::getLagSamples() const
+{
+    return (long long)stats.lagsamples;
+}
+
+long long MegaSyncStatsPrivate::getLastLag() const
+{
+    return (long long)stats.lastlagds * 100;
+}
+
+long long MegaSyncStatsPrivate::getMaxLag() const
+{
+    return (long long)stats.maxlagds * 100;
+}
+
+long long MegaSyncStatsPrivate::getAverageLag() const
+{
+    return (long long)stats.avglagds * 100;
+}
+
 MegaRegExpPrivate::MegaRegExpPrivate()
 {
     patternUpdated = false;
@@ -23459,7 +26720,7 @@ void MegaFolderUploadController::start(MegaNode*)
     megaApi->fireOnTransferStart(transfer);
 
     const char *name = transfer->getFileName();
-    MegaNode *parent = megaApi->getNodeByHandle(transfer->getParentHandle());
+    unique_ptr<MegaNode> parent(megaApi->getNodeByHandle(transfer->getParentHandle()));
     if(!parent)
     {
         transfer->setState(MegaTransfer::STATE_FAILED);
@@ -23472,21 +26733,25 @@ void MegaFolderUploadController::start(MegaNode*)
         string localpath;
         client->fsaccess->path2local(&path, &localpath);
 
-        MegaNode *child = megaApi->getChildNode(parent, name);
+        recursive++;
 
-        if(!child || !child->isFolder())
+        unique_ptr<MegaNode> child(megaApi->getChildNode(parent.get(), name));
+        if (child && child->isFolder())
         {
-            pendingFolders.push_back(localpath);
-            megaApi->createFolder(name, parent, this);
+            scanExistingFolder(&localpath, child.get());
         }
         else
         {
-            pendingFolders.push_front(localpath);
-            onFolderAvailable(child->getHandle());
+            unique_ptr<FolderTree> tree(new FolderTree);
+            tree->target = parent->getHandle();
+            tree->folders.emplace_back(name, UNDEF);
+            scanNewFolder(&localpath, tree.get(), 0);
+            putFolderTree(move(tree));
         }
+        startUploads();
 
-        delete child;
-        delete parent;
+        recursive--;
+        checkCompletion();
     }
 }
 
@@ -23501,98 +26766,249 @@ void MegaFolderUploadController::cancel()
         DBTableTransactionCommitter committer(client->tctable);
         megaApi->fireOnTransferFinish(subTransfer, MegaError(API_EINCOMPLETE), committer);
     }
+
+    for (auto& tree : pendingTrees)
+    {
+        megaApi->cancelPutNodes(tree.first);
+    }
+    megaApi->removeTransferListener(this);
 }
 
-void MegaFolderUploadController::onFolderAvailable(MegaHandle handle)
+// uploads the files of a folder that exists in MEGA right away, collecting its missing subfolders into one tree
+void MegaFolderUploadController::scanExistingFolder(string *localPath, MegaNode *remote)
 {
-    recursive++;
-    string localPath = pendingFolders.front();
-    pendingFolders.pop_front();
+    unique_ptr<FolderTree> tree;
+    std::shared_ptr<MegaNode> parent(remote->copy());
+    DirEntry entry;
+    unique_ptr<DirAccess> da(client->fsaccess->newdiraccess());
+    if (da->dopen(localPath, NULL, false))
+    {
+        size_t t = localPath->size();
 
-    MegaNode *parent = megaApi->getNodeByHandle(handle);
+        while (da->dnextstat(localPath, &entry, client->followsymlinks))
+        {
+            if (t)
+            {
+                localPath->append(client->fsaccess->localseparator);
+            }
+
+            localPath->append(entry.localname);
+
+            string name = entry.localname;
+            client->fsaccess->local2name(&name);
+            if (entry.type == FILENODE)
+            {
+                planUpload(*localPath, entry, parent, plannedUploads);
+            }
+            else if (entry.type == FOLDERNODE)
+            {
+                unique_ptr<MegaNode> child(megaApi->getChildNode(remote, name.c_str()));
+                if (child && child->isFolder())
+                {
+                    scanExistingFolder(localPath, child.get());
+                }
+                else
+                {
+                    if (tree && tree->folders.size() >= MAX_FOLDERS_PER_PUTNODES)
+                    {
+                        putFolderTree(move(tree));
+                    }
+                    if (!tree)
+                    {
+                        tree.reset(new FolderTree);
+                        tree->target = remote->getHandle();
+                    }
+                    tree->folders.emplace_back(name, UNDEF);
+                    scanNewFolder(localPath, tree.get(), tree->folders.size() - 1);
+                }
+            }
+            localPath->resize(t);
+        }
+    }
+
+    if (tree)
+    {
+        putFolderTree(move(tree));
+    }
+}
 
-    string localname;
-    DirAccess* da;
-    da = client->fsaccess->newdiraccess();
-    if (da->dopen(&localPath, NULL, false))
+// adds the contents of a folder missing in MEGA (already in the tree at index) to the tree
+void MegaFolderUploadController::scanNewFolder(string *localPath, FolderTree *tree, size_t index)
+{
+    DirEntry entry;
+    unique_ptr<DirAccess> da(client->fsaccess->newdiraccess());
+    if (da->dopen(localPath, NULL, false))
     {
-        size_t t = localPath.size();
+        size_t t = localPath->size();
 
-        nodetype_t dirEntryType;
-        while (da->dnext(&localPath, &localname, client->followsymlinks, &dirEntryType))
+        while (da->dnextstat(localPath, &entry, client->followsymlinks))
         {
             if (t)
             {
-                localPath.append(client->fsaccess->localseparator);
+                localPath->append(client->fsaccess->localseparator);
             }
 
-            localPath.append(localname);
+            localPath->append(entry.localname);
 
-            string name = localname;
+            string name = entry.localname;
             client->fsaccess->local2name(&name);
-            if (dirEntryType == FILENODE)
+            if (entry.type == FILENODE)
             {
-                pendingTransfers++;
-                string utf8path;
-                client->fsaccess->local2path(&localPath, &utf8path);
-                    megaApi->startUpload(false, utf8path.c_str(), parent, (const char *)NULL, -1, tag, false, NULL, false, false, this);
+                planUpload(*localPath, entry, nullptr, tree->folders[index].files);
             }
-            else if (dirEntryType == FOLDERNODE)
+            else if (entry.type == FOLDERNODE)
             {
-                MegaNode *child = megaApi->getChildNode(parent, name.c_str());
-                if(!child || !child->isFolder())
+                if (tree->folders.size() >= MAX_FOLDERS_PER_PUTNODES)
                 {
-                    pendingFolders.push_back(localPath);
-                    megaApi->createFolder(name.c_str(), parent, this);
+                    FolderTree *subtree = new FolderTree;
+                    tree->folders[index].subtrees.emplace_back(subtree);
+                    subtree->folders.emplace_back(name, UNDEF);
+                    scanNewFolder(localPath, subtree, 0);
                 }
                 else
                 {
-                    pendingFolders.push_front(localPath);
-                    onFolderAvailable(child->getHandle());
+                    tree->folders.emplace_back(name, handle(index + 1));
+                    scanNewFolder(localPath, tree, tree->folders.size() - 1);
                 }
-                delete child;
             }
-            localPath.resize(t);
+            localPath->resize(t);
         }
     }
+}
 
-    delete da;
-    delete parent;
-    recursive--;
+void MegaFolderUploadController::putFolderTree(unique_ptr<FolderTree> tree)
+{
+    int count = int(tree->folders.size());
+    NewNode *nn = new NewNode[count];
+    for (int i = 0; i < count; i++)
+    {
+        client->putnodes_prepareOneFolder(&nn[i], tree->folders[i].name);
+        nn[i].nodehandle = handle(i + 1);
+        nn[i].parenthandle = tree->folders[i].parent;
+    }
 
-    checkCompletion();
+    int putTag = megaApi->putNodes(tree->target, nn, count, [this](int t, error e, NewNode *created)
+    {
+        onFolderTreeCreated(t, e, created);
+    });
+    pendingTrees[putTag] = move(tree);
 }
 
-void MegaFolderUploadController::checkCompletion()
+void MegaFolderUploadController::planUpload(const string& localPath, const DirEntry& entry, std::shared_ptr<MegaNode> parent, vector<PlannedUpload>& uploads)
 {
-    if (!recursive && !pendingFolders.size() && !pendingTransfers)
+    PlannedUpload upload;
+    string path = localPath;
+    client->fsaccess->local2path(&path, &upload.utf8path);
+    if (entry.statvalid)
     {
-        LOG_debug << "Folder transfer finished - " << transfer->getTransferredBytes() << " of " << transfer->getTotalBytes();
-        transfer->setState(MegaTransfer::STATE_COMPLETED);
-        transfer->setLastError(mLastError);
-        DBTableTransactionCommitter committer(client->tctable);
-        megaApi->fireOnTransferFinish(transfer, !mIncompleteTransfers ? MegaError(API_OK) : MegaError(API_EINCOMPLETE), committer);
+        upload.size = entry.size;
+        upload.fsid = entry.fsid;
+        upload.fsidvalid = entry.fsidvalid;
     }
+    upload.parent = std::move(parent);
+    uploads.push_back(std::move(upload));
 }
 
-void MegaFolderUploadController::onRequestFinish(MegaApi *, MegaRequest *request, MegaError *e)
+void MegaFolderUploadController::planUploads(vector<PlannedUpload>& uploads)
 {
-    int type = request->getType();
-    int errorCode = e->getErrorCode();
+    vector<PlannedUpload> large, small;
+    for (auto& upload : uploads)
+    {
+        (upload.size >= LARGE_UPLOAD_SIZE ? large : small).push_back(std::move(upload));
+    }
+
+    // the files without an fsid stay in the order they were listed, before the others
+    auto bydisk = [](const PlannedUpload& a, const PlannedUpload& b)
+    {
+        return (a.fsidvalid && b.fsidvalid) ? a.fsid < b.fsid : a.fsidvalid < b.fsidvalid;
+    };
+    std::stable_sort(large.begin(), large.end(), bydisk);
+    std::stable_sort(small.begin(), small.end(), bydisk);
 
-    if (type == MegaRequest::TYPE_CREATE_FOLDER)
+    uploads.clear();
+    size_t l = 0, s = 0;
+    while (l < large.size() || s < small.size())
     {
-        if (!errorCode)
+        if (l < large.size())
         {
-            onFolderAvailable(request->getNodeHandle());
+            uploads.push_back(std::move(large[l++]));
         }
-        else
+        for (size_t n = 0; s < small.size() && (n < SMALL_UPLOADS_PER_LARGE || l >= large.size()); n++)
         {
-            pendingFolders.pop_front();
-            mLastError = e->getErrorCode();
+            uploads.push_back(std::move(small[s++]));
+        }
+    }
+}
+
+void MegaFolderUploadController::startUploads()
+{
+    vector<PlannedUpload> uploads;
+    uploads.swap(plannedUploads);
+    planUploads(uploads);
+
+    for (auto& upload : uploads)
+    {
+        pendingTransfers++;
+        megaApi->startUpload(false, upload.utf8path.c_str(), upload.parent.get(), (const char *)NULL, -1, tag, false, NULL, false, false, this);
+    }
+}
+
+void MegaFolderUploadController::onFolderTreeCreated(int putTag, error e, NewNode *nn)
+{
+    auto it = pendingTrees.find(putTag);
+    if (it == pendingTrees.end())
+    {
+        return;
+    }
+    unique_ptr<FolderTree> tree = move(it->second);
+    pendingTrees.erase(it);
+
+    recursive++;
+    for (size_t i = 0; i < tree->folders.size(); i++)
+    {
+        FolderTree::Folder& folder = tree->folders[i];
+        unique_ptr<MegaNode> created;
+        if (!e && nn[i].added)
+        {
+            created.reset(megaApi->getNodeByHandle(nn[i].addedhandle));
+        }
+
+        if (!created)
+        {
+            // the files inside and any folders below are not uploaded
+            mLastError = e ? e : API_ENOENT;
             mIncompleteTransfers++;
-            checkCompletion();
+            continue;
+        }
+
+        std::shared_ptr<MegaNode> parent(std::move(created));
+        for (auto& file : folder.files)
+        {
+            file.parent = parent;
+            plannedUploads.push_back(std::move(file));
         }
+
+        for (auto& subtree : folder.subtrees)
+        {
+            subtree->target = parent->getHandle();
+            putFolderTree(move(subtree));
+        }
+    }
+    startUploads();
+    recursive--;
+
+    checkCompletion();
+}
+
+void MegaFolderUploadController::checkCompletion()
+{
+    if (!recursive && pendingTrees.empty() && !pendingTransfers)
+    {
+        LOG_debug << "Folder transfer finished - " << transfer->getTransferredBytes() << " of " << transfer->getTotalBytes();
+        transfer->setState(MegaTransfer::STATE_COMPLETED);
+        transfer->setLastError(mLastError);
+        DBTableTransactionCommitter committer(client->tctable);
+        megaApi->fireOnTransferFinish(transfer, !mIncompleteTransfers ? MegaError(API_OK) : MegaError(API_EINCOMPLETE), committer);
     }
 }
 
@@ -24189,6 +27605,7 @@ void MegaBackupController::clearCurrentBackupData()
     this->recursive = 0;
     this->pendingTransfers = 0;
     this->pendingFolders.clear();
+    cancelCopies();
     for (std::vector<MegaTransfer *>::iterator it = failedTransfers.begin(); it != failedTransfers.end(); it++)
     {
         delete *it;
@@ -24306,6 +27723,7 @@ void MegaBackupController::onFolderAvailable(MegaHandle handle)
         {
             size_t t = localPath.size();
 
+            std::vector<UnchangedFile> unchanged;
             while (da->dnext(&localPath, &localname, client->followsymlinks))
             {
                 if (t)
@@ -24324,12 +27742,19 @@ void MegaBackupController::onFolderAvailable(MegaHandle handle)
                     client->fsaccess->local2name(&name);
                     if(fa->type == FILENODE)
                     {
-                        pendingTransfers++;
                         string utf8path;
                         client->fsaccess->local2path(&localPath, &utf8path);
 
                         totalFiles++;
-                        megaApi->startUpload(false, utf8path.c_str(), parent, (const char *)NULL, -1, folderTransferTag, true, NULL, false, false, this);
+                        if (Node *previous = unchangedNode(utf8path, fa->size, fa->mtime))
+                        {
+                            unchanged.push_back(UnchangedFile{utf8path, name, previous->nodehandle});
+                        }
+                        else
+                        {
+                            pendingTransfers++;
+                            megaApi->startUpload(false, utf8path.c_str(), parent, (const char *)NULL, -1, folderTransferTag, true, NULL, false, false, this);
+                        }
                     }
                     else
                     {
@@ -24350,6 +27775,11 @@ void MegaBackupController::onFolderAvailable(MegaHandle handle)
 
                 localPath.resize(t);
             }
+
+            if (!unchanged.empty())
+            {
+                copyUnchanged(handle, std::move(unchanged));
+            }
         }
 
         delete da;
@@ -24369,9 +27799,140 @@ void MegaBackupController::onFolderAvailable(MegaHandle handle)
     checkCompletion();
 }
 
+string MegaBackupController::indexKey(string utf8path)
+{
+#if defined(_WIN32) && !defined(WINDOWS_PHONE)
+    // uploads may report the path with the prefix for long paths
+    if (!utf8path.compare(0, 4, "\\\\?\\"))
+    {
+        utf8path.erase(0, 4);
+    }
+#endif
+    return utf8path;
+}
+
+// the node of a previous backup with the same file, if the file hasn't changed since
+Node *MegaBackupController::unchangedNode(const string& utf8path, m_off_t size, m_time_t mtime)
+{
+    auto it = fileIndex.find(indexKey(utf8path));
+    if (it == fileIndex.end())
+    {
+        return nullptr;
+    }
+
+    Node *n = client->nodebyhandle(it->second);
+    if (!n || n->type != FILENODE || !n->isvalid || n->size != size || n->mtime != mtime || !n->nodekey().size())
+    {
+        fileIndex.erase(it);
+        return nullptr;
+    }
+    return n;
+}
+
+void MegaBackupController::copyUnchanged(handle target, std::vector<UnchangedFile>&& files)
+{
+    nameid rrname = AttrMap::string2nameid("rr");
+    for (size_t first = 0; first < files.size(); first += MAX_COPIES_PER_PUTNODES)
+    {
+        size_t last = std::min(files.size(), first + MAX_COPIES_PER_PUTNODES);
+        std::vector<UnchangedFile> batch(std::make_move_iterator(files.begin() + first), std::make_move_iterator(files.begin() + last));
+
+        NewNode *nn = new NewNode[batch.size()];
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            // checked by unchangedNode() in this same pass
+            Node *n = client->nodebyhandle(batch[i].node);
+            NewNode *t = &nn[i];
+
+            t->source = NEW_NODE;
+            t->type = FILENODE;
+            t->nodehandle = n->nodehandle;
+            t->parenthandle = UNDEF;
+            t->nodekey = n->nodekey();
+
+            SymmCipher key;
+            key.setkey((const byte*)t->nodekey.data(), FILENODE);
+
+            AttrMap attrs;
+            attrs.map = n->attrs().map;
+            attrs.map.erase(rrname);
+            string sname = batch[i].name;
+            client->fsaccess->normalize(&sname);
+            attrs.map['n'] = sname;
+
+            string attrstring;
+            attrs.getjson(&attrstring);
+            t->attrstring.reset(new string);
+            client->makeattr(&key, t->attrstring, attrstring.c_str());
+        }
+
+        int count = int(batch.size());
+        int putTag = megaApi->putNodes(target, nn, count, [this](int tag, error e, NewNode *copied)
+        {
+            onUnchangedCopied(tag, e, copied);
+        });
+        pendingCopies[putTag] = std::make_pair(target, std::move(batch));
+    }
+}
+
+void MegaBackupController::onUnchangedCopied(int putTag, error e, NewNode *nn)
+{
+    auto it = pendingCopies.find(putTag);
+    if (it == pendingCopies.end())
+    {
+        return;
+    }
+    handle target = it->second.first;
+    std::vector<UnchangedFile> files = std::move(it->second.second);
+    pendingCopies.erase(it);
+
+    unique_ptr<MegaNode> parent;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        Node *copied = (!e && nn[i].added) ? client->nodebyhandle(nn[i].addedhandle) : nullptr;
+        if (copied)
+        {
+            fileIndex[indexKey(files[i].path)] = copied->nodehandle;
+            numberFiles++;
+            totalBytes += copied->size;
+            transferredBytes += copied->size;
+            continue;
+        }
+
+        // upload it after all
+        fileIndex.erase(indexKey(files[i].path));
+        if (!parent)
+        {
+            parent.reset(megaApi->getNodeByHandle(target));
+        }
+        if (parent)
+        {
+            pendingTransfers++;
+            megaApi->startUpload(false, files[i].path.c_str(), parent.get(), (const char *)NULL, -1, folderTransferTag, true, NULL, false, false, this);
+        }
+        else
+        {
+            LOG_err << "Backup folder not found for: " << files[i].path;
+        }
+    }
+
+    setUpdateTime(Waiter::ds);
+    megaApi->fireOnBackupUpdate(this);
+    checkCompletion();
+}
+
+void MegaBackupController::cancelCopies()
+{
+    for (auto& copies : pendingCopies)
+    {
+        megaApi->cancelPutNodes(copies.first);
+    }
+    pendingCopies.clear();
+}
+
 bool MegaBackupController::checkCompletion()
 {
-    if(!recursive && !pendingFolders.size() && !pendingTransfers && !pendingTags)
+    if(!recursive && !pendingFolders.size() && !pendingTransfers && !pendingTags && pendingCopies.empty())
     {
         error e = API_OK;
         LOG_debug << "Folder transfer finished - " << this->getTransferredBytes() << " of " << this->getTotalBytes();
@@ -24561,6 +28122,10 @@ void MegaBackupController::onTransferFinish(MegaApi *, MegaTransfer *t, MegaErro
     else
     {
         numberFiles++;
+        if (t->getPath() && !ISUNDEF(t->getNodeHandle()))
+        {
+            fileIndex[indexKey(t->getPath())] = t->getNodeHandle();
+        }
     }
 
     megaApi->fireOnBackupUpdate(this);
@@ -24681,59 +28246,363 @@ void MegaBackupController::setPeriodstring(const string &value)
     }
 }
 
-int64_t MegaBackupController::getStartTime() const
+int64_t MegaBackupController::getStartTime() const
+{
+    return startTime;
+}
+
+void MegaBackupController::setStartTime(const int64_t &value)
+{
+    startTime = value;
+}
+
+int MegaBackupController::getTag() const
+{
+    return this->tag;
+}
+
+void MegaBackupController::setTag(int value)
+{
+    tag = value;
+}
+
+MegaHandle MegaBackupController::getMegaHandle() const
+{
+    return this->parenthandle;
+}
+
+void MegaBackupController::setMegaHandle(const MegaHandle &value)
+{
+    parenthandle = value;
+}
+
+const char *MegaBackupController::getLocalFolder() const
+{
+    return this->basepath.c_str();
+}
+
+void MegaBackupController::setLocalFolder(const string &value)
+{
+    basepath = value;
+}
+
+int MegaBackupController::getState() const
+{
+    return state;
+}
+
+MegaBackupController::~MegaBackupController()
+{
+    cancelCopies();
+    megaApi->removeRequestListener(this);
+    megaApi->removeTransferListener(this);
+
+    for (std::vector<MegaTransfer *>::iterator it = failedTransfers.begin(); it != failedTransfers.end(); it++)
+    {
+        delete *it;
+    }
+}
+
+MegaFolderCopyController::MegaFolderCopyController(MegaApiImpl *megaApi, MegaRequestPrivate *request, Node *source, handle target, const string& newName)
+    : megaApi(megaApi)
+    , client(megaApi->getMegaClient())
+    , request(request)
+    , source(source->nodehandle)
+    , newName(newName)
+{
+    ready.push_back(Part{ target, { source->nodehandle } });
+}
+
+MegaFolderCopyController::~MegaFolderCopyController()
+{
+    for (int putTag : inflight)
+    {
+        megaApi->cancelPutNodes(putTag);
+    }
+}
+
+void MegaFolderCopyController::start()
+{
+    while (!ready.empty() && inflight.size() < MAX_PUTNODES_INFLIGHT)
+    {
+        Part part = std::move(ready.front());
+        ready.pop_front();
+        putPart(std::move(part));
+    }
+    checkCompletion();
+}
+
+void MegaFolderCopyController::putPart(Part&& part)
+{
+    // parents before their children, up to the limit: the rest of the roots stay for another putnodes
+    // into the same folder, and the subtrees cut off here wait for their folder (versions go with their file)
+    node_vector nodes;
+    size_t root = 0;
+    for (; root < part.roots.size() && nodes.size() < MAX_NODES_PER_PUTNODES; root++)
+    {
+        Node* n = client->nodebyhandle(part.roots[root]);
+        node_vector stack;
+        if (n)
+        {
+            stack.push_back(n);
+        }
+
+        while (!stack.empty())
+        {
+            n = stack.back();
+            stack.pop_back();
+
+            if (nodes.size() >= MAX_NODES_PER_PUTNODES && n->parent->type != FILENODE && n->nodehandle != part.roots[root])
+            {
+                waiting[n->parent->nodehandle].push_back(n->nodehandle);
+                continue;
+            }
+
+            nodes.push_back(n);
+            client->pageinchildren(n);
+            stack.insert(stack.end(), n->children.rbegin(), n->children.rend());
+        }
+    }
+
+    if (root < part.roots.size())
+    {
+        ready.push_back(Part{ part.target, std::vector<handle>(part.roots.begin() + root, part.roots.end()) });
+    }
+
+    if (nodes.empty())
+    {
+        return;
+    }
+
+    std::set<handle> included;
+    nameid rrname = AttrMap::string2nameid("rr");
+    NewNode *nn = new NewNode[nodes.size()];
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        Node *n = nodes[i];
+        NewNode *t = &nn[i];
+        included.insert(n->nodehandle);
+
+        t->source = NEW_NODE;
+        t->type = n->type;
+        t->nodehandle = n->nodehandle;
+        t->parenthandle = (n->parent && included.count(n->parent->nodehandle)) ? n->parent->nodehandle : UNDEF;
+
+        // the key of a file is kept, a folder gets a new one
+        if (n->type == FILENODE)
+        {
+            t->nodekey = n->nodekey();
+        }
+        else
+        {
+            byte buf[FOLDERNODEKEYLENGTH];
+            client->rng.genblock(buf, sizeof buf);
+            t->nodekey.assign((char*)buf, FOLDERNODEKEYLENGTH);
+        }
+
+        t->attrstring.reset(new string);
+        if (t->nodekey.size())
+        {
+            SymmCipher key;
+            key.setkey((const byte*)t->nodekey.data(), n->type);
+
+            AttrMap attrs;
+            attrs.map = n->attrs().map;
+            attrs.map.erase(rrname);
+            if (n->nodehandle == source && !newName.empty())
+            {
+                attrs.map['n'] = newName;
+            }
+
+            string attrstring;
+            attrs.getjson(&attrstring);
+            client->makeattr(&key, t->attrstring, attrstring.c_str());
+        }
+    }
+
+    int count = int(nodes.size());
+    int putTag = megaApi->putNodes(part.target, nn, count, [this, count](int t, error e, NewNode *created)
+    {
+        onPartCopied(t, e, created, count);
+    });
+    inflight.insert(putTag);
+}
+
+void MegaFolderCopyController::onPartCopied(int putTag, error e, NewNode *nn, int count)
+{
+    if (!inflight.erase(putTag))
+    {
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        auto it = waiting.find(nn[i].nodehandle);
+        if (e || !nn[i].added)
+        {
+            // and nothing below is copied
+            lastError = e ? e : API_EINCOMPLETE;
+            if (it != waiting.end())
+            {
+                waiting.erase(it);
+            }
+            continue;
+        }
+
+        copied++;
+        if (nn[i].nodehandle == source)
+        {
+            copiedRoot = nn[i].addedhandle;
+        }
+
+        if (it != waiting.end())
+        {
+            ready.push_back(Part{ nn[i].addedhandle, std::move(it->second) });
+            waiting.erase(it);
+        }
+    }
+
+    request->setTransferredBytes(copied);
+    megaApi->fireOnRequestUpdate(request);
+
+    start();
+}
+
+void MegaFolderCopyController::checkCompletion()
+{
+    if (!inflight.empty() || !ready.empty())
+    {
+        return;
+    }
+
+    LOG_debug << "Folder copy finished - " << copied << " of " << request->getTotalBytes() << " nodes";
+    request->setNodeHandle(copiedRoot);
+    error e = ISUNDEF(copiedRoot) ? (lastError ? lastError : API_EINTERNAL) : lastError;
+    int requestTag = request->getTag();
+    MegaApiImpl *api = megaApi;
+    api->fireOnRequestFinish(request, MegaError(e));
+    api->folderCopies.erase(requestTag);     // deletes this
+}
+
+MegaBulkTransferController::MegaBulkTransferController(MegaApiImpl *megaApi, MegaTransferPrivate *transfer, std::vector<MegaTransferPrivate*>&& items)
+    : items(std::move(items))
+{
+    this->megaApi = megaApi;
+    this->client = megaApi->getMegaClient();
+    this->transfer = transfer;
+    this->listener = transfer->getListener();
+    this->recursive = 0;
+    this->pendingTransfers = 0;
+    this->tag = 0;
+
+    for (MegaTransferPrivate *t : this->items)
+    {
+        t->setListener(this);
+    }
+}
+
+MegaBulkTransferController::~MegaBulkTransferController()
 {
-    return startTime;
+    // never queued
+    for (MegaTransferPrivate *t : items)
+    {
+        delete t;
+    }
 }
 
-void MegaBackupController::setStartTime(const int64_t &value)
+void MegaBulkTransferController::start(MegaNode*)
 {
-    startTime = value;
-}
+    tag = transfer->getTag();
+    transfer->setFolderTransferTag(-1);
+    transfer->setStartTime(Waiter::ds);
+    transfer->setState(MegaTransfer::STATE_QUEUED);
+    megaApi->fireOnTransferStart(transfer);
 
-int MegaBackupController::getTag() const
-{
-    return this->tag;
-}
+    for (MegaTransferPrivate *t : items)
+    {
+        t->setFolderTransferTag(tag);
+    }
+    pendingTransfers = int(items.size());
+    megaApi->queueTransfersFirst(items);
+    items.clear();
 
-void MegaBackupController::setTag(int value)
-{
-    tag = value;
+    checkCompletion();
 }
 
-MegaHandle MegaBackupController::getMegaHandle() const
+void MegaBulkTransferController::cancel()
 {
-    return this->parenthandle;
-}
+    transfer = nullptr;  // no final callback for this one since it is being destroyed now
 
-void MegaBackupController::setMegaHandle(const MegaHandle &value)
-{
-    parenthandle = value;
+    while (!subTransfers.empty())
+    {
+        auto subTransfer = *subTransfers.begin();
+        subTransfer->setState(MegaTransfer::STATE_COMPLETED);
+        DBTableTransactionCommitter committer(client->tctable);
+        megaApi->fireOnTransferFinish(subTransfer, MegaError(API_EINCOMPLETE), committer);
+    }
+
+    // the files still in the queue go on as plain transfers
+    megaApi->removeTransferListener(this);
 }
 
-const char *MegaBackupController::getLocalFolder() const
+void MegaBulkTransferController::checkCompletion()
 {
-    return this->basepath.c_str();
+    if (!pendingTransfers && transfer)
+    {
+        LOG_debug << "Bulk transfer finished - " << transfer->getTransferredBytes() << " of " << transfer->getTotalBytes();
+        transfer->setState(MegaTransfer::STATE_COMPLETED);
+        transfer->setLastError(mLastError);
+        DBTableTransactionCommitter committer(client->tctable);
+        megaApi->fireOnTransferFinish(transfer, !mIncompleteTransfers ? MegaError(API_OK) : MegaError(API_EINCOMPLETE), committer);
+    }
 }
 
-void MegaBackupController::setLocalFolder(const string &value)
+void MegaBulkTransferController::onTransferStart(MegaApi *, MegaTransfer *t)
 {
-    basepath = value;
+    subTransfers.insert(static_cast<MegaTransferPrivate*>(t));
+    if (transfer)
+    {
+        transfer->setState(t->getState());
+        transfer->setPriority(t->getPriority());
+        transfer->setTotalBytes(transfer->getTotalBytes() + t->getTotalBytes());
+        transfer->setUpdateTime(Waiter::ds);
+        megaApi->fireOnTransferUpdate(transfer);
+    }
 }
 
-int MegaBackupController::getState() const
+void MegaBulkTransferController::onTransferUpdate(MegaApi *, MegaTransfer *t)
 {
-    return state;
+    if (transfer)
+    {
+        transfer->setState(t->getState());
+        transfer->setPriority(t->getPriority());
+        transfer->setTransferredBytes(transfer->getTransferredBytes() + t->getDeltaSize());
+        transfer->setUpdateTime(Waiter::ds);
+        transfer->setSpeed(t->getSpeed());
+        transfer->setMeanSpeed(t->getMeanSpeed());
+        megaApi->fireOnTransferUpdate(transfer);
+    }
 }
 
-MegaBackupController::~MegaBackupController()
+void MegaBulkTransferController::onTransferFinish(MegaApi *, MegaTransfer *t, MegaError *e)
 {
-    megaApi->removeRequestListener(this);
-    megaApi->removeTransferListener(this);
-
-    for (std::vector<MegaTransfer *>::iterator it = failedTransfers.begin(); it != failedTransfers.end(); it++)
+    subTransfers.erase(static_cast<MegaTransferPrivate*>(t));
+    pendingTransfers--;
+    if (transfer)
     {
-        delete *it;
+        transfer->setState(MegaTransfer::STATE_ACTIVE);
+        transfer->setPriority(t->getPriority());
+        transfer->setTransferredBytes(transfer->getTransferredBytes() + t->getDeltaSize());
+        transfer->setUpdateTime(Waiter::ds);
+        transfer->setSpeed(t->getSpeed());
+        transfer->setMeanSpeed(t->getMeanSpeed());
+        megaApi->fireOnTransferUpdate(transfer);
+        if (e->getErrorCode() != API_OK)
+        {
+            mLastError = e->getErrorCode();
+            mIncompleteTransfers++;
+        }
+        checkCompletion();
     }
 }
 
@@ -24807,12 +28676,18 @@ void MegaFolderDownloadController::start(MegaNode *node)
 #endif
 
     transfer->setPath(path.c_str());
-    downloadFolderNode(node, &path);
 
+    recursive++;
+    scanFolderNode(node, &path, NO_PARENT);
     if (deleteNode)
     {
         delete node;
     }
+    createLocalFolders();
+    downloadFiles();
+    recursive--;
+
+    checkCompletion();
 }
 
 void MegaFolderDownloadController::cancel()
@@ -24829,45 +28704,13 @@ void MegaFolderDownloadController::cancel()
 }
 
 
-void MegaFolderDownloadController::downloadFolderNode(MegaNode *node, string *path)
+void MegaFolderDownloadController::scanFolderNode(MegaNode *node, string *path, size_t parent)
 {
-    recursive++;
+    size_t index = folders.size();
+    folders.emplace_back();
+    folders[index].parent = parent;
+    client->fsaccess->path2local(path, &folders[index].localpath);
 
-    string localpath;
-    client->fsaccess->path2local(path, &localpath);
-    auto da = client->fsaccess->newfileaccess();
-    if (!da->fopen(&localpath, true, false))
-    {
-        if (!client->fsaccess->mkdirlocal(&localpath))
-        {
-            da.reset();
-            LOG_err << "Unable to create folder: " << *path;
-
-            recursive--;
-            mLastError = API_EWRITE;
-            mIncompleteTransfers++;
-            checkCompletion();
-            return;
-        }
-    }
-    else if (da->type != FILENODE)
-    {
-        LOG_debug << "Already existing folder detected: " << *path;
-    }
-    else
-    {
-        da.reset();
-        LOG_err << "Local file detected where there should be a folder: " << *path;
-
-        recursive--;
-        mLastError = API_EEXIST;
-        mIncompleteTransfers++;
-        checkCompletion();
-        return;
-    }
-    da.reset();
-
-    localpath.append(client->fsaccess->localseparator);
     MegaNodeList *children = NULL;
     bool deleteChildren = false;
     if (node->isForeign())
@@ -24883,13 +28726,13 @@ void MegaFolderDownloadController::downloadFolderNode(MegaNode *node, string *pa
     if (!children)
     {
         LOG_err << "Child nodes not found: " << *path;
-        recursive--;
         mLastError = API_ENOENT;
         mIncompleteTransfers++;
-        checkCompletion();
         return;
     }
 
+    string localpath = folders[index].localpath;
+    localpath.append(client->fsaccess->localseparator);
     for (int i = 0; i < children->size(); i++)
     {
         MegaNode *child = children->get(i);
@@ -24904,23 +28747,88 @@ void MegaFolderDownloadController::downloadFolderNode(MegaNode *node, string *pa
 
         if (child->getType() == MegaNode::TYPE_FILE)
         {
-            pendingTransfers++;
-            megaApi->startDownload(false, child, utf8path.c_str(), tag, transfer->getAppData(), this);
+            files.push_back(RemoteFile{unique_ptr<MegaNode>(child->copy()), utf8path, index});
         }
         else
         {
-            downloadFolderNode(child, &utf8path);
+            scanFolderNode(child, &utf8path, index);
         }
 
         localpath.resize(l);
     }
 
-    recursive--;
-    checkCompletion();
     if (deleteChildren)
     {
         delete children;
-    } 
+    }
+}
+
+// parents come before their children in folders
+void MegaFolderDownloadController::createLocalFolders()
+{
+    for (LocalFolder& folder : folders)
+    {
+        if (folder.parent != NO_PARENT && folders[folder.parent].e)
+        {
+            // reported with the parent
+            folder.e = folders[folder.parent].e;
+            continue;
+        }
+
+        auto da = client->fsaccess->newfileaccess();
+        if (!da->fopen(&folder.localpath, true, false))
+        {
+            if (!client->fsaccess->mkdirlocal(&folder.localpath))
+            {
+                LOG_err << "Unable to create folder: " << folder.localpath;
+                folder.e = API_EWRITE;
+            }
+        }
+        else if (da->type != FILENODE)
+        {
+            LOG_debug << "Already existing folder detected: " << folder.localpath;
+        }
+        else
+        {
+            LOG_err << "Local file detected where there should be a folder: " << folder.localpath;
+            folder.e = API_EEXIST;
+        }
+
+        if (folder.e)
+        {
+            mLastError = folder.e;
+            mIncompleteTransfers++;
+        }
+    }
+}
+
+void MegaFolderDownloadController::downloadFiles()
+{
+    int order = megaApi->getFolderDownloadOrder();
+    if (order == MegaApi::ORDER_SIZE_ASC || order == MegaApi::ORDER_SIZE_DESC)
+    {
+        // same size: files of the same folder stay together
+        std::stable_sort(files.begin(), files.end(), [order](const RemoteFile& a, const RemoteFile& b)
+        {
+            return order == MegaApi::ORDER_SIZE_ASC ? a.node->getSize() < b.node->getSize()
+                                                    : a.node->getSize() > b.node->getSize();
+        });
+    }
+
+    std::vector<MegaTransferPrivate*> items;
+    items.reserve(files.size());
+    for (RemoteFile& file : files)
+    {
+        if (!folders[file.folder].e)
+        {
+            items.push_back(megaApi->createDownloadTransfer(false, file.node.get(), file.path.c_str(), tag, transfer->getAppData(), this));
+        }
+    }
+    files.clear();
+    folders.clear();
+
+    pendingTransfers += int(items.size());
+    megaApi->queueTransfersFirst(items);
 }
 
 void MegaFolderDownloadController::checkCompletion()
@@ -25007,6 +28915,7 @@ void StreamingBuffer::init(m_off_t capacity)
         capacity = maxBufferSize;
     }
 
+    delete [] buffer;
     this->capacity = static_cast<unsigned>(capacity);
     this->buffer = new char[this->capacity];
     this->inpos = 0;
@@ -25092,12 +29001,43 @@ uv_buf_t StreamingBuffer::nextBuffer()
     return uv_buf_init(outbuf, len);
 }
 
+int StreamingBuffer::nextBuffers(uv_buf_t bufs[2])
+{
+    unsigned int remaining = size < maxOutputSize ? size : maxOutputSize;
+    int count = 0;
+    while (remaining && count < 2)
+    {
+        char *outbuf = buffer + outpos;
+        unsigned int len = outpos + remaining > capacity ? capacity - outpos : remaining;
+
+        // update the internal state
+        size -= len;
+        outpos += len;
+        outpos %= capacity;
+        remaining -= len;
+
+        bufs[count++] = uv_buf_init(outbuf, len);
+    }
+    return count;
+}
+
 void StreamingBuffer::freeData(unsigned int len)
 {
     // update the internal state
     free += len;
 }
 
+void StreamingBuffer::reset()
+{
+    delete [] buffer;
+    buffer = NULL;
+    capacity = 0;
+    inpos = 0;
+    outpos = 0;
+    size = 0;
+    free = 0;
+}
+
 void StreamingBuffer::setMaxBufferSize(unsigned int bufferSize)
 {
     if (bufferSize)
@@ -25143,6 +29083,7 @@ MegaTCPServer::MegaTCPServer(MegaApiImpl *megaApi, string basePath, bool tls, st
     this->lastHandle = INVALID_HANDLE;
     this->remainingcloseevents = 0;
     this->closing = false;
+    this->workerloops = 0;
     this->thread = new MegaThread();
 #ifdef ENABLE_EVT_TLS
     this->certificatepath = certificatepath;
@@ -25150,6 +29091,11 @@ MegaTCPServer::MegaTCPServer(MegaApiImpl *megaApi, string basePath, bool tls, st
     this->closing = false;
     this->remainingcloseevents = 0;
     this->evtrequirescleaning = false;
+    if (RAND_bytes(ticketkeys, sizeof(ticketkeys)) != 1)
+    {
+        LOG_warn << "Unable to generate the TLS session ticket keys";
+        memset(ticketkeys, 0, sizeof(ticketkeys));
+    }
 #endif
     fsAccess = new MegaFileSystemAccess();
 
@@ -25180,6 +29126,7 @@ MegaTCPServer::~MegaTCPServer()
 
     LOG_verbose << " MegaTCPServer::~MegaTCPServer joining uv thread";
     thread->join();
+    joinWorkerLoops();
     LOG_verbose << " MegaTCPServer::~MegaTCPServer deleting uv thread";
     delete thread;
 }
@@ -25207,6 +29154,21 @@ bool MegaTCPServer::start(int port, bool localOnly)
 }
 
 #ifdef ENABLE_EVT_TLS
+bool MegaTCPServer::initTLSContext(evt_ctx_t *ctx)
+{
+    if (evt_ctx_init_ex(ctx, certificatepath.c_str(), keypath.c_str()) != 1)
+    {
+        return false;
+    }
+    evt_ctx_set_nio(ctx, NULL, uv_tls_writer);
+
+    if (evt_ctx_set_ticket_keys(ctx, ticketkeys) != 1)
+    {
+        LOG_warn << "Unable to set the TLS session ticket keys. Sessions resume with the loop that created them only";
+    }
+    return true;
+}
+
 int MegaTCPServer::uv_tls_writer(evt_tls_t *evt_tls, void *bfr, int sz)
 {
     int rv = 0;
@@ -25232,92 +29194,44 @@ int MegaTCPServer::uv_tls_writer(evt_tls_t *evt_tls, void *bfr, int sz)
 
             closeTCPConnection(tcpctx);
         }
-        rv = sz; //writer should return the written size
-    }
-    else
-    {
-        delete [] (char*)bfr;
-        LOG_debug << " uv_is_writable returned false";
-    }
-
-    return rv;
-}
-#endif
-
-// todo: a lot of this function is the same as initializeAndStartListening, we should factor them (maybe call that one from this one?)
-void MegaTCPServer::run()
-{
-    LOG_debug << " Running tcp server: " << port << " TLS=" << useTLS;
-
-#ifdef ENABLE_EVT_TLS
-    if (useTLS)
-    {
-        if (evt_ctx_init_ex(&evtctx, certificatepath.c_str(), keypath.c_str()) != 1 )
-        {
-            LOG_err << "Unable to init evt ctx";
-            port = 0;
-            uv_sem_post(&semaphoreStartup);
-            uv_sem_post(&semaphoreEnd);
-            return;
-        }
-        evt_ctx_set_nio(&evtctx, NULL, uv_tls_writer);
-    }
-#endif
-
-    uv_loop_init(&uv_loop);
-
-    uv_async_init(&uv_loop, &exit_handle, onCloseRequested);
-    exit_handle.data = this;
-
-    uv_tcp_init(&uv_loop, &server);
-    server.data = this;
-
-    uv_tcp_keepalive(&server, 0, 0);
-
-    union {
-        struct sockaddr_in6 ipv6;
-        struct sockaddr_in ipv4;
-    } address;
-
-    if (useIPv6)
-    {
-        if (localOnly)
-        {
-            uv_ip6_addr("::1", port, &address.ipv6);
-        }
-        else
-        {
-            uv_ip6_addr("::", port, &address.ipv6);
-        }
-    }
-    else
-    {
-        if (localOnly)
-        {
-            uv_ip4_addr("127.0.0.1", port, &address.ipv4);
-        }
-        else
-        {
-            uv_ip4_addr("0.0.0.0", port, &address.ipv4);
-        }
-    }
-
-    uv_connection_cb onNewClientCB;
-#ifdef ENABLE_EVT_TLS
-    if (useTLS)
-    {
-         onNewClientCB = onNewClient_tls;
+        rv = sz; //writer should return the written size
     }
     else
     {
+        delete [] (char*)bfr;
+        LOG_debug << " uv_is_writable returned false";
+    }
+
+    return rv;
+}
 #endif
-        onNewClientCB = onNewClient;
+
+// todo: a lot of this function is the same as initializeAndStartListening, we should factor them (maybe call that one from this one?)
+void MegaTCPServer::run()
+{
+    LOG_debug << " Running tcp server: " << port << " TLS=" << useTLS;
+
 #ifdef ENABLE_EVT_TLS
+    if (useTLS)
+    {
+        if (!initTLSContext(&evtctx))
+        {
+            LOG_err << "Unable to init evt ctx";
+            port = 0;
+            uv_sem_post(&semaphoreStartup);
+            uv_sem_post(&semaphoreEnd);
+            return;
+        }
     }
 #endif
 
-    if(uv_tcp_bind(&server, (const struct sockaddr*)&address, 0)
-        || uv_listen((uv_stream_t*)&server, 32, onNewClientCB))
+    uv_loop_init(&uv_loop);
+    uv_loop.data = NULL; // connections accepted here aren't served by a worker loop
+
+    uv_async_init(&uv_loop, &exit_handle, onCloseRequested);
+    exit_handle.data = this;
+
+    if (!listenOn(&uv_loop, &server, workerloops > 0))
     {
         LOG_err << "TCP failed to bind/listen port = " << port;
         port = 0;
@@ -25330,7 +29244,9 @@ void MegaTCPServer::run()
         return;
     }
 
-    LOG_info << "TCP" << (useTLS ? "(tls)" : "") << " server started on port " << port;
+    startWorkerLoops();
+
+    LOG_info << "TCP" << (useTLS ? "(tls)" : "") << " server started on port " << port << " loops = " << (workers.size() + 1);
     started = true;
     uv_sem_post(&semaphoreStartup);
 
@@ -25356,7 +29272,7 @@ void MegaTCPServer::initializeAndStartListening()
 #ifdef ENABLE_EVT_TLS
     if (useTLS)
     {
-        if (evt_ctx_init_ex(&evtctx, certificatepath.c_str(), keypath.c_str()) != 1 )
+        if (!initTLSContext(&evtctx))
         {
             LOG_err << "Unable to init evt ctx";
             port = 0;
@@ -25365,7 +29281,6 @@ void MegaTCPServer::initializeAndStartListening()
             return;
         }
         evtrequirescleaning = true;
-        evt_ctx_set_nio(&evtctx, NULL, uv_tls_writer);
     }
 #endif
 
@@ -25452,11 +29367,185 @@ void MegaTCPServer::stop(bool doNotWait)
     {
         LOG_verbose << "Waiting for sempahoreEnd to conclude server stop port = " << port;
         uv_sem_wait(&semaphoreEnd); //this is signaled when closed my last connection
+        joinWorkerLoops();
     }
     LOG_debug << "Stopped MegaTCPServer port = " << port;
     started = false;
 }
 
+bool MegaTCPServer::listenOn(uv_loop_t *loop, uv_tcp_t *listener, bool reuseport)
+{
+    union {
+        struct sockaddr_in6 ipv6;
+        struct sockaddr_in ipv4;
+    } address;
+
+    if (useIPv6)
+    {
+        if (localOnly)
+        {
+            uv_ip6_addr("::1", port, &address.ipv6);
+        }
+        else
+        {
+            uv_ip6_addr("::", port, &address.ipv6);
+        }
+    }
+    else
+    {
+        if (localOnly)
+        {
+            uv_ip4_addr("127.0.0.1", port, &address.ipv4);
+        }
+        else
+        {
+            uv_ip4_addr("0.0.0.0", port, &address.ipv4);
+        }
+    }
+
+    // the socket must exist before binding to set SO_REUSEPORT on it
+    uv_tcp_init_ex(loop, listener, useIPv6 ? AF_INET6 : AF_INET);
+    listener->data = this;
+
+    uv_tcp_keepalive(listener, 0, 0);
+
+#ifdef __linux__
+    if (reuseport)
+    {
+        uv_os_fd_t fd;
+        int enable = 1;
+        if (uv_fileno((uv_handle_t *)listener, &fd)
+                || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)))
+        {
+            LOG_err << "Unable to set SO_REUSEPORT on port = " << port;
+            return false;
+        }
+    }
+#endif
+
+    uv_connection_cb onNewClientCB;
+#ifdef ENABLE_EVT_TLS
+    if (useTLS)
+    {
+         onNewClientCB = onNewClient_tls;
+    }
+    else
+    {
+#endif
+        onNewClientCB = onNewClient;
+#ifdef ENABLE_EVT_TLS
+    }
+#endif
+
+    return !uv_tcp_bind(listener, (const struct sockaddr*)&address, 0)
+            && !uv_listen((uv_stream_t*)listener, 32, onNewClientCB);
+}
+
+void MegaTCPServer::startWorkerLoops()
+{
+    // the loops aren't running yet, so their handles can be set up from this thread
+    for (int i = 0; i < workerloops; i++)
+    {
+        MegaTCPWorker *worker = new MegaTCPWorker();
+        worker->tcpServer = this;
+
+        uv_loop_init(&worker->uv_loop);
+        worker->uv_loop.data = worker;
+
+        uv_async_init(&worker->uv_loop, &worker->exit_handle, onWorkerCloseRequested);
+        worker->exit_handle.data = worker;
+
+#ifdef ENABLE_EVT_TLS
+        if (useTLS)
+        {
+            if (!initTLSContext(&worker->evtctx))
+            {
+                LOG_err << "Unable to init evt ctx for a worker loop";
+                uv_close((uv_handle_t *)&worker->exit_handle, NULL);
+                uv_run(&worker->uv_loop, UV_RUN_ONCE);
+                uv_loop_close(&worker->uv_loop);
+                delete worker;
+                break;
+            }
+        }
+#endif
+
+        if (!listenOn(&worker->uv_loop, &worker->server, true))
+        {
+            LOG_err << "TCP failed to bind/listen a worker loop on port = " << port;
+#ifdef ENABLE_EVT_TLS
+            if (useTLS)
+            {
+                SSL_CTX_free(worker->evtctx.ctx);
+            }
+#endif
+            uv_close((uv_handle_t *)&worker->exit_handle, NULL);
+            uv_close((uv_handle_t *)&worker->server, NULL);
+            uv_run(&worker->uv_loop, UV_RUN_ONCE); // so that resources are cleaned peacefully
+            uv_loop_close(&worker->uv_loop);
+            delete worker;
+            break;
+        }
+
+        workers.push_back(worker);
+        worker->thread.start(workerEntryPoint, worker);
+    }
+}
+
+void MegaTCPServer::joinWorkerLoops()
+{
+    // onCloseRequested has already asked them to close their connections
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i]->thread.join();
+        delete workers[i];
+    }
+    workers.clear();
+}
+
+void *MegaTCPServer::workerEntryPoint(void *param)
+{
+#ifndef _WIN32
+    struct sigaction noaction;
+    memset(&noaction, 0, sizeof(noaction));
+    noaction.sa_handler = SIG_IGN;
+    ::sigaction(SIGPIPE, &noaction, 0);
+#endif
+
+    MegaTCPWorker *worker = (MegaTCPWorker *)param;
+    uv_run(&worker->uv_loop, UV_RUN_DEFAULT);
+
+#ifdef ENABLE_EVT_TLS
+    if (worker->tcpServer->useTLS)
+    {
+        SSL_CTX_free(worker->evtctx.ctx);
+    }
+#endif
+    uv_loop_close(&worker->uv_loop);
+    LOG_debug << "UV worker loop thread exit";
+    return NULL;
+}
+
+void MegaTCPServer::onWorkerCloseRequested(uv_async_t *handle)
+{
+    MegaTCPWorker *worker = (MegaTCPWorker *)handle->data;
+    LOG_debug << "TCP worker loop stopping port=" << worker->tcpServer->port;
+
+    for (list<MegaTCPContext*>::iterator it = worker->connections.begin(); it != worker->connections.end(); it++)
+    {
+        closeTCPConnection(*it);
+    }
+
+    // the loop ends as soon as the last connection is deleted
+    uv_close((uv_handle_t *)&worker->server, NULL);
+    uv_close((uv_handle_t *)&worker->exit_handle, NULL);
+}
+
+list<MegaTCPContext*> &MegaTCPServer::connectionsOf(MegaTCPContext *tcpctx)
+{
+    return tcpctx->worker ? tcpctx->worker->connections : tcpctx->server->connections;
+}
+
 int MegaTCPServer::getPort()
 {
     return port;
@@ -25497,6 +29586,25 @@ int MegaTCPServer::getMaxOutputSize()
     return StreamingBuffer::MAX_OUTPUT_SIZE;
 }
 
+int MegaTCPServer::getMaxOutputSize(MegaTCPContext *tcpctx)
+{
+    if (maxOutputSize)
+    {
+        return maxOutputSize;
+    }
+
+    // by default, each write tries to fill the send buffer of the socket
+    int sndbuf = 0;
+    if (uv_send_buffer_size((uv_handle_t *)&tcpctx->tcphandle, &sndbuf)
+            || sndbuf <= int(StreamingBuffer::MAX_OUTPUT_SIZE))
+    {
+        return StreamingBuffer::MAX_OUTPUT_SIZE;
+    }
+
+    int limit = getMaxBufferSize() / 4;
+    return sndbuf < limit ? sndbuf : limit;
+}
+
 void MegaTCPServer::setRestrictedMode(int mode)
 {
     this->restrictedMode = mode;
@@ -25507,6 +29615,24 @@ int MegaTCPServer::getRestrictedMode()
     return restrictedMode;
 }
 
+void MegaTCPServer::setEventLoops(int loops)
+{
+#ifdef __linux__
+    this->workerloops = loops > 1 ? loops - 1 : 0;
+#else
+    if (loops > 1)
+    {
+        LOG_warn << "Several event loops require SO_REUSEPORT balancing. Using a single one";
+    }
+    this->workerloops = 0;
+#endif
+}
+
+int MegaTCPServer::getEventLoops()
+{
+    return workerloops + 1;
+}
+
 bool MegaTCPServer::isHandleAllowed(handle h)
 {
     return restrictedMode == MegaApi::TCP_SERVER_ALLOW_ALL
@@ -25666,17 +29792,19 @@ void MegaTCPServer::onNewClient_tls(uv_stream_t *server_handle, int status)
 
     // Create an object to save context information
     MegaTCPContext* tcpctx = ((MegaTCPServer *)server_handle->data)->initializeContext(server_handle);
+    tcpctx->worker = (MegaTCPWorker *)server_handle->loop->data;
 
-    LOG_debug << "Connection received at port " << tcpctx->server->port << " ! " << tcpctx->server->connections.size();
+    LOG_debug << "Connection received at port " << tcpctx->server->port << " ! " << connectionsOf(tcpctx).size();
 
     // Mutex to protect the data buffer
     uv_mutex_init(&tcpctx->mutex);
 
+    // Both handles live in the loop that accepted the connection
     // Async handle to perform writes
-    uv_async_init(&tcpctx->server->uv_loop, &tcpctx->asynchandle, onAsyncEvent);
+    uv_async_init(server_handle->loop, &tcpctx->asynchandle, onAsyncEvent);
 
     // Accept the connection
-    uv_tcp_init(&tcpctx->server->uv_loop, &tcpctx->tcphandle);
+    uv_tcp_init(server_handle->loop, &tcpctx->tcphandle);
     if (uv_accept(server_handle, (uv_stream_t*)&tcpctx->tcphandle))
     {
         LOG_err << "uv_accept failed";
@@ -25684,7 +29812,7 @@ void MegaTCPServer::onNewClient_tls(uv_stream_t *server_handle, int status)
         return;
     }
 
-    tcpctx->evt_tls = evt_ctx_get_tls(&tcpctx->server->evtctx);
+    tcpctx->evt_tls = evt_ctx_get_tls(tcpctx->worker ? &tcpctx->worker->evtctx : &tcpctx->server->evtctx);
     assert(tcpctx->evt_tls != NULL);
     tcpctx->evt_tls->data = tcpctx;
     if (evt_tls_accept(tcpctx->evt_tls, on_hd_complete))
@@ -25694,7 +29822,7 @@ void MegaTCPServer::onNewClient_tls(uv_stream_t *server_handle, int status)
         return;
     }
 
-    tcpctx->server->connections.push_back(tcpctx);
+    connectionsOf(tcpctx).push_back(tcpctx);
 
     tcpctx->server->readData(tcpctx);
 }
@@ -25725,17 +29853,19 @@ void MegaTCPServer::onNewClient(uv_stream_t* server_handle, int status)
 
     // Create an object to save context information
     MegaTCPContext* tcpctx = ((MegaTCPServer *)server_handle->data)->initializeContext(server_handle);
+    tcpctx->worker = (MegaTCPWorker *)server_handle->loop->data;
 
-    LOG_debug << "Connection received at port " << tcpctx->server->port << "! " << tcpctx->server->connections.size() << " tcpctx = " << tcpctx;
+    LOG_debug << "Connection received at port " << tcpctx->server->port << "! " << connectionsOf(tcpctx).size() << " tcpctx = " << tcpctx;
 
     // Mutex to protect the data buffer
     uv_mutex_init(&tcpctx->mutex);
 
+    // Both handles live in the loop that accepted the connection
     // Async handle to perform writes
-    uv_async_init(&tcpctx->server->uv_loop, &tcpctx->asynchandle, onAsyncEvent);
+    uv_async_init(server_handle->loop, &tcpctx->asynchandle, onAsyncEvent);
 
     // Accept the connection
-    uv_tcp_init(&tcpctx->server->uv_loop, &tcpctx->tcphandle);
+    uv_tcp_init(server_handle->loop, &tcpctx->tcphandle);
     if (uv_accept(server_handle, (uv_stream_t*)&tcpctx->tcphandle))
     {
         LOG_err << "uv_accept failed";
@@ -25743,7 +29873,7 @@ void MegaTCPServer::onNewClient(uv_stream_t* server_handle, int status)
         return;
     }
 
-    tcpctx->server->connections.push_back(tcpctx);
+    connectionsOf(tcpctx).push_back(tcpctx);
     if (tcpctx->server->respondNewConnection(tcpctx))
     {
         // Start reading
@@ -25803,11 +29933,14 @@ void MegaTCPServer::onClose(uv_handle_t* handle)
     MegaTCPContext* tcpctx = (MegaTCPContext*) handle->data;
 
     // streaming transfers are automatically stopped when their listener is removed
-    tcpctx->megaApi->removeTransferListener(tcpctx);
-    tcpctx->megaApi->removeRequestListener(tcpctx);
+    if (tcpctx->megaApi)
+    {
+        tcpctx->megaApi->removeTransferListener(tcpctx);
+        tcpctx->megaApi->removeRequestListener(tcpctx);
+    }
 
-    tcpctx->server->connections.remove(tcpctx);
-    LOG_debug << "Connection closed: " << tcpctx->server->connections.size() << " port = " << tcpctx->server->port << " closing async handle";
+    connectionsOf(tcpctx).remove(tcpctx);
+    LOG_debug << "Connection closed: " << connectionsOf(tcpctx).size() << " port = " << tcpctx->server->port << " closing async handle";
     uv_close((uv_handle_t *)&tcpctx->asynchandle, onAsyncEventClose);
 }
 
@@ -25818,12 +29951,20 @@ void MegaTCPServer::onAsyncEventClose(uv_handle_t *handle)
 
     int port = tcpctx->server->port;
 
-    tcpctx->server->remainingcloseevents--;
-    tcpctx->server->processOnAsyncEventClose(tcpctx);
+    if (tcpctx->worker)
+    {
+        // worker loops end by themselves once all their handles are closed
+        tcpctx->server->processOnAsyncEventClose(tcpctx);
+    }
+    else
+    {
+        tcpctx->server->remainingcloseevents--;
+        tcpctx->server->processOnAsyncEventClose(tcpctx);
 
-    LOG_verbose << "At onAsyncEventClose port = " << tcpctx->server->port << " remaining=" << tcpctx->server->remainingcloseevents;
+        LOG_verbose << "At onAsyncEventClose port = " << tcpctx->server->port << " remaining=" << tcpctx->server->remainingcloseevents;
+    }
 
-    if (!tcpctx->server->remainingcloseevents && tcpctx->server->closing && !tcpctx->server->semaphoresdestroyed)
+    if (!tcpctx->worker && !tcpctx->server->remainingcloseevents && tcpctx->server->closing && !tcpctx->server->semaphoresdestroyed)
     {
         uv_sem_post(&tcpctx->server->semaphoreStartup);
         uv_sem_post(&tcpctx->server->semaphoreEnd);
@@ -25918,6 +30059,7 @@ MegaTCPContext::MegaTCPContext()
     invalid = false;
 #endif
     server = NULL;
+    worker = NULL;
     megaApi = NULL;
 }
 
@@ -25970,6 +30112,11 @@ void MegaTCPServer::onCloseRequested(uv_async_t *handle)
 
     tcpServer->closing = true;
 
+    for (size_t i = 0; i < tcpServer->workers.size(); i++)
+    {
+        uv_async_send(&tcpServer->workers[i]->exit_handle);
+    }
+
     for (list<MegaTCPContext*>::iterator it = tcpServer->connections.begin(); it != tcpServer->connections.end(); it++)
     {
         MegaTCPContext *tcpctx = (*it);
@@ -26007,8 +30154,11 @@ void MegaTCPServer::closeTCPConnection(MegaTCPContext *tcpctx)
     tcpctx->finished = true;
     if (!uv_is_closing((uv_handle_t*)&tcpctx->tcphandle))
     {
-        tcpctx->server->remainingcloseevents++;
-        LOG_verbose << "At closeTCPConnection port = " << tcpctx->server->port << " remainingcloseevent = " << tcpctx->server->remainingcloseevents;
+        if (!tcpctx->worker)
+        {
+            tcpctx->server->remainingcloseevents++;
+            LOG_verbose << "At closeTCPConnection port = " << tcpctx->server->port << " remainingcloseevent = " << tcpctx->server->remainingcloseevents;
+        }
         uv_close((uv_handle_t*)&tcpctx->tcphandle, onClose);
     }
 }
@@ -26051,8 +30201,11 @@ MegaHTTPServer::MegaHTTPServer(MegaApiImpl *megaApi, string basePath, bool useTL
 
     this->fileServerEnabled = true;
     this->folderServerEnabled = true;
+    this->webDavListingsVersion = 0;
+    this->lastWebDavEtag = 0;
     this->offlineAttribute = false;
     this->subtitlesSupportEnabled = false;
+    this->hlsSupportEnabled = false;
 }
 
 MegaTCPContext * MegaHTTPServer::initializeContext(uv_stream_t *server_handle)
@@ -26083,6 +30236,13 @@ void MegaHTTPServer::processReceivedData(MegaTCPContext *tcpctx, ssize_t nread,
     ssize_t parsed = -1;
     if (nread >= 0)
     {
+        if (HTTP_PARSER_ERRNO(&httpctx->parser) == HPE_PAUSED)
+        {
+            // pipelined request, it will be parsed once the current response is sent
+            httpctx->pipelined.append(buf->base, nread);
+            return;
+        }
+
         if (nread == 0 && httpctx->parser.method == HTTP_PUT) //otherwise it will fail for files >65k in GVFS-DAV
         {
             LOG_debug << " Skipping parsing 0 length data for HTTP_PUT";
@@ -26092,6 +30252,12 @@ void MegaHTTPServer::processReceivedData(MegaTCPContext *tcpctx, ssize_t nread,
         {
             parsed = http_parser_execute(&httpctx->parser, &parsercfg, buf->base, nread);
         }
+
+        if (parsed < nread && HTTP_PARSER_ERRNO(&httpctx->parser) == HPE_PAUSED)
+        {
+            httpctx->pipelined.append(buf->base + parsed, nread - parsed);
+            parsed = nread;
+        }
     }
 
     LOG_verbose << " at onDataReceived, received " << nread << " parsed = " << parsed;
@@ -26129,6 +30295,12 @@ void MegaHTTPServer::processWriteFinished(MegaTCPContext* tcpctx, int status)
             {
                 httpctx->resultCode = API_OK;
             }
+
+            if (httpctx->keepalive)
+            {
+                keepAlive(httpctx);
+                return;
+            }
         }
 
         closeConnection(httpctx);
@@ -26178,6 +30350,10 @@ void MegaHTTPServer::processOnAsyncEventClose(MegaTCPContext* tcpctx)
 
     delete httpctx->node;
     httpctx->node = NULL;
+
+#ifdef HAVE_SENDFILE
+    closeLocalCopy(httpctx);
+#endif
 }
 
 bool MegaHTTPServer::respondNewConnection(MegaTCPContext* tcpctx)
@@ -26257,6 +30433,56 @@ void MegaHTTPServer::enableSubtitlesSupport(bool enable)
     this->subtitlesSupportEnabled = enable;
 }
 
+bool MegaHTTPServer::isHLSSupportEnabled()
+{
+    return hlsSupportEnabled;
+}
+
+void MegaHTTPServer::enableHLSSupport(bool enable)
+{
+    this->hlsSupportEnabled = enable;
+}
+
+string MegaHTTPServer::getHLSPlaylist(MegaNode *node)
+{
+    // segments are cut at packet boundaries, without remuxing, so only transport streams can be split
+    static const int TS_PACKET_SIZE = 188;
+
+    const char *name = node->getName();
+    size_t namelen = name ? strlen(name) : 0;
+    if (node->getType() != MegaNode::TYPE_FILE || namelen < 3 || strcasecmp(name + namelen - 3, ".ts")
+            || node->getDuration() <= 0 || node->getSize() < TS_PACKET_SIZE)
+    {
+        return string();
+    }
+
+    m_off_t size = node->getSize();
+    double bitrate = double(size) / node->getDuration();
+    m_off_t segmentsize = m_off_t(bitrate * HLS_SEGMENT_SECONDS) / TS_PACKET_SIZE * TS_PACKET_SIZE;
+    segmentsize = std::max<m_off_t>(segmentsize, TS_PACKET_SIZE);
+
+    string uri;
+    string sname = name;
+    URLCodec::escape(&sname, &uri);
+
+    std::ostringstream playlist;
+    playlist << "#EXTM3U\n"
+                "#EXT-X-VERSION:4\n"
+                "#EXT-X-TARGETDURATION:" << int(ceil(segmentsize / bitrate)) << "\n"
+                "#EXT-X-MEDIA-SEQUENCE:0\n"
+                "#EXT-X-PLAYLIST-TYPE:VOD\n";
+    playlist << std::fixed << std::setprecision(3);
+    for (m_off_t offset = 0; offset < size; offset += segmentsize)
+    {
+        m_off_t len = std::min(segmentsize, size - offset);
+        playlist << "#EXTINF:" << len / bitrate << ",\n"
+                    "#EXT-X-BYTERANGE:" << len << "@" << offset << "\n"
+                 << uri << "\n";
+    }
+    playlist << "#EXT-X-ENDLIST\n";
+    return playlist.str();
+}
+
 char *MegaHTTPServer::getWebDavLink(MegaNode *node)
 {
     allowedWebDavHandles.insert(node->getHandle());
@@ -26413,6 +30639,10 @@ int MegaHTTPServer::onHeaderValue(http_parser *parser, const char *at, size_t le
     {
         httpctx->overwrite = (value == "T");
     }
+    else if (httpctx->lastheader == "if-none-match")
+    {
+        httpctx->ifnonematch = value;
+    }
     else if (httpctx->range)
     {
         LOG_debug << "Range header value: " << value;
@@ -26567,15 +30797,142 @@ string MegaHTTPServer::getWebDavPropFindResponseForNode(string baseURL, string s
 
     string sweb = web.str();
     response << "HTTP/1.1 207 Multi-Status\r\n"
-                "content-length: " << sweb.size() << "\r\n"
-                                                     "content-type: application/xml; charset=utf-8\r\n"
-                                                     "server: MEGAsdk\r\n"
-                                                     "\r\n";
-    response << sweb;
+                "content-length: " << sweb.size() << "\r\n"
+                                                     "content-type: application/xml; charset=utf-8\r\n"
+                                                     "server: MEGAsdk\r\n"
+                                                     "\r\n";
+    response << sweb;
+    httpctx->resultCode = API_OK;
+    return response.str();
+}
+
+string MegaHTTPServer::getWebDavPropFindResponseForFolder(string baseURL, string subnodepath, MegaNode *node, MegaHTTPContext* httpctx)
+{
+    MegaHTTPServer* httpserver = dynamic_cast<MegaHTTPServer *>(httpctx->server);
+    bool offlineAttribute = httpserver->isOfflineAttributeEnabled();
+
+    string subbaseURL = baseURL + subnodepath;
+    if (subbaseURL.size() && subbaseURL.at(subbaseURL.size() - 1) != '/')
+    {
+        subbaseURL.append("/");
+    }
+    string key = subbaseURL + (offlineAttribute ? "\n1" : "\n0");
+
+    string etag;
+    string body;
+    unsigned version;
+    {
+        std::lock_guard<std::mutex> g(httpserver->webDavListingsMutex);
+        map<string, WebDavListing>::iterator it = httpserver->webDavListings.find(key);
+        if (it != httpserver->webDavListings.end() && it->second.folder == node->getHandle())
+        {
+            etag = it->second.etag;
+            body = it->second.body;
+        }
+        version = httpserver->webDavListingsVersion;
+    }
+
+    if (etag.size() && etag == httpctx->ifnonematch)
+    {
+        LOG_debug << "PROPFIND listing not modified";
+        httpctx->resultCode = API_OK;
+        return "HTTP/1.1 304 Not Modified\r\n"
+               "etag: " + etag + "\r\n"
+               "server: MEGAsdk\r\n"
+               "\r\n";
+    }
+
+    if (body.empty())
+    {
+        WebDavListing listing;
+        listing.folder = node->getHandle();
+
+        std::ostringstream web;
+        web << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n"
+               "<d:multistatus xmlns:d=\"DAV:\" xmlns:Z=\"urn:schemas-microsoft-com::\">\r\n";
+        web << getWebDavProfFindNodeContents(node, subbaseURL, offlineAttribute);
+
+        MegaNodeList *children = httpctx->megaApi->getChildren(node);
+        for (int i = 0; i < children->size(); i++)
+        {
+            MegaNode *child = children->get(i);
+            string childURL = subbaseURL + child->getName();
+            web << getWebDavProfFindNodeContents(child, childURL, offlineAttribute);
+            listing.children.insert(child->getHandle());
+        }
+        delete children;
+
+        web << "</d:multistatus>"
+               "\r\n";
+        body = web.str();
+
+        std::lock_guard<std::mutex> g(httpserver->webDavListingsMutex);
+
+        // a change after the snapshot of the children could be missing from it
+        if (version == httpserver->webDavListingsVersion)
+        {
+            if (httpserver->webDavListings.size() >= MAX_WEBDAV_LISTINGS)
+            {
+                httpserver->webDavListings.erase(httpserver->webDavListings.begin());
+            }
+
+            std::ostringstream oss;
+            oss << "\"" << ++httpserver->lastWebDavEtag << "\"";
+            etag = oss.str();
+            listing.etag = etag;
+            listing.body = body;
+            httpserver->webDavListings[key] = std::move(listing);
+        }
+    }
+
+    std::ostringstream response;
+    response << "HTTP/1.1 207 Multi-Status\r\n"
+                "content-length: " << body.size() << "\r\n"
+                "content-type: application/xml; charset=utf-8\r\n";
+    if (etag.size())
+    {
+        response << "etag: " << etag << "\r\n";
+    }
+    response << "server: MEGAsdk\r\n"
+                "\r\n";
+    response << body;
     httpctx->resultCode = API_OK;
     return response.str();
 }
 
+void MegaHTTPServer::invalidateWebDavListings(Node **nodes, int count)
+{
+    std::lock_guard<std::mutex> g(webDavListingsMutex);
+    webDavListingsVersion++;
+    if (!nodes)
+    {
+        webDavListings.clear();
+        return;
+    }
+
+    for (map<string, WebDavListing>::iterator it = webDavListings.begin(); it != webDavListings.end(); )
+    {
+        // the folder itself, a new or moved child, or a child that changed or left
+        bool stale = false;
+        for (int i = 0; i < count && !stale; i++)
+        {
+            Node *n = nodes[i];
+            stale = it->second.folder == n->nodehandle
+                    || (n->parent && it->second.folder == n->parent->nodehandle)
+                    || it->second.children.count(n->nodehandle);
+        }
+
+        if (stale)
+        {
+            webDavListings.erase(it++);
+        }
+        else
+        {
+            it++;
+        }
+    }
+}
+
 string MegaHTTPServer::getResponseForNode(MegaNode *node, MegaHTTPContext* httpctx)
 {
     MegaNode *parent = httpctx->megaApi->getParentNode(node);
@@ -26931,8 +31288,12 @@ int MegaHTTPServer::onMessageComplete(http_parser *parser)
     MegaHTTPContext* httpctx = (MegaHTTPContext*) parser->data;
     httpctx->bytesWritten = 0;
     httpctx->size = 0;
+
+    // one request at a time: the next one stays unparsed until this one is answered
+    http_parser_pause(parser, 1);
+
     httpctx->streamingBuffer.setMaxBufferSize(httpctx->server->getMaxBufferSize());
-    httpctx->streamingBuffer.setMaxOutputSize(httpctx->server->getMaxOutputSize());
+    httpctx->streamingBuffer.setMaxOutputSize(httpctx->server->getMaxOutputSize(httpctx));
 
     MegaHTTPServer* httpserver = dynamic_cast<MegaHTTPServer *>(httpctx->server);
 
@@ -26979,6 +31340,27 @@ int MegaHTTPServer::onMessageComplete(http_parser *parser)
         return 0;
     }
 
+    if (httpctx->path == "/metrics" && httpserver && httpserver->isMetricsEnabled()
+            && (parser->method == HTTP_GET || parser->method == HTTP_HEAD))
+    {
+        LOG_debug << "Metrics requested";
+        string metrics = httpctx->megaApi->getOpenMetrics();
+        response << "HTTP/1.1 200 OK\r\n"
+                    "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                    "Content-Length: " << metrics.size() << "\r\n"
+                    "Connection: close\r\n"
+                    "\r\n";
+        if (parser->method == HTTP_GET)
+        {
+            response << metrics;
+        }
+
+        httpctx->resultCode = API_OK;
+        string resstr = response.str();
+        sendHeaders(httpctx, &resstr);
+        return 0;
+    }
+
     if (httpctx->path == "/")
     {
         node = httpctx->megaApi->getRootNode();
@@ -27108,6 +31490,35 @@ int MegaHTTPServer::onMessageComplete(http_parser *parser)
             delete node;
             return 0;
         }
+        else if (httpserver->isHLSSupportEnabled() && (parser->method == HTTP_GET || parser->method == HTTP_HEAD)
+                 && httpctx->nodename == string(node->getName()) + ".m3u8")
+        {
+            string playlist = getHLSPlaylist(node);
+            if (playlist.empty())
+            {
+                LOG_debug << "No HLS playlist for " << node->getName();
+                returnHttpCode(httpctx, 404);
+                delete node;
+                return 0;
+            }
+
+            LOG_debug << "Sending HLS playlist for " << node->getName();
+            response << "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: application/vnd.apple.mpegurl\r\n"
+                        "Content-Length: " << playlist.size() << "\r\n"
+                        "Connection: close\r\n"
+                        "\r\n";
+            if (parser->method == HTTP_GET)
+            {
+                response << playlist;
+            }
+
+            httpctx->resultCode = API_OK;
+            string resstr = response.str();
+            sendHeaders(httpctx, &resstr);
+            delete node;
+            return 0;
+        }
         else
         {
             //Subtitles support
@@ -27187,7 +31598,9 @@ int MegaHTTPServer::onMessageComplete(http_parser *parser)
     {
         string baseURL = string("http") + (httpctx->server->useTLS ? "s" : "") + "://"
                 + httpctx->host + "/" + httpctx->nodehandle + "/" + httpctx->nodename + "/";
-        string resstr = getWebDavPropFindResponseForNode(baseURL, httpctx->subpathrelative, node, httpctx);
+        string resstr = (node->isFolder() && httpctx->depth != 0)
+                ? getWebDavPropFindResponseForFolder(baseURL, httpctx->subpathrelative, node, httpctx)
+                : getWebDavPropFindResponseForNode(baseURL, httpctx->subpathrelative, node, httpctx);
         sendHeaders(httpctx, &resstr);
         delete node;
         delete baseNode;
@@ -27706,17 +32119,21 @@ int MegaHTTPServer::onMessageComplete(http_parser *parser)
             return 0;
         }
 
-        httpctx->transfer.reset(new MegaTransferPrivate(MegaTransfer::TYPE_LOCAL_TCP_DOWNLOAD));
-        httpctx->transfer->setPath(httpctx->path.c_str());
-        if (httpctx->nodename.size())
-        {
-            httpctx->transfer->setFileName(httpctx->nodename.c_str());
-        }
-        if (httpctx->nodehandle.size())
+        // HEAD is answered from the metadata of the node, it doesn't stream anything
+        if (parser->method != HTTP_HEAD)
         {
-            httpctx->transfer->setNodeHandle(MegaApi::base64ToHandle(httpctx->nodehandle.c_str()));
+            httpctx->transfer.reset(new MegaTransferPrivate(MegaTransfer::TYPE_LOCAL_TCP_DOWNLOAD));
+            httpctx->transfer->setPath(httpctx->path.c_str());
+            if (httpctx->nodename.size())
+            {
+                httpctx->transfer->setFileName(httpctx->nodename.c_str());
+            }
+            if (httpctx->nodehandle.size())
+            {
+                httpctx->transfer->setNodeHandle(MegaApi::base64ToHandle(httpctx->nodehandle.c_str()));
+            }
+            httpctx->transfer->setStartTime(Waiter::ds);
         }
-        httpctx->transfer->setStartTime(Waiter::ds);
 
         delete httpctx->node;
         httpctx->node = node;
@@ -27731,6 +32148,9 @@ int MegaHTTPServer::streamNode(MegaHTTPContext *httpctx)
     std::ostringstream response;
     MegaNode *node = httpctx->node;
 
+    // only file responses, which have a known length, keep the connection open
+    httpctx->keepalive = http_should_keep_alive(&httpctx->parser) != 0;
+
     string name;
     const char *extension = NULL;
     const char *nodeName = httpctx->node->getName();
@@ -27773,7 +32193,7 @@ int MegaHTTPServer::streamNode(MegaHTTPContext *httpctx)
     {
         response << "HTTP/1.1 416 Requested Range Not Satisfiable\r\n"
             << "Content-Type: " << mimeType << "\r\n"
-            << "Connection: close\r\n"
+            << (httpctx->keepalive ? "Connection: keep-alive\r\n" : "Connection: close\r\n")
             << "Access-Control-Allow-Origin: *\r\n"
             << "Accept-Ranges: bytes\r\n"
             << "Content-Range: bytes 0-0/" << totalSize << "\r\n"
@@ -27797,7 +32217,7 @@ int MegaHTTPServer::streamNode(MegaHTTPContext *httpctx)
     }
 
     response << "Content-Type: " << mimeType << "\r\n"
-        << "Connection: close\r\n"
+        << (httpctx->keepalive ? "Connection: keep-alive\r\n" : "Connection: close\r\n")
         << "Content-Length: " << len << "\r\n"
         << "Access-Control-Allow-Origin: *\r\n"
         << "Accept-Ranges: bytes\r\n"
@@ -27814,9 +32234,14 @@ int MegaHTTPServer::streamNode(MegaHTTPContext *httpctx)
     }
 
     string resstr = response.str();
+    bool localcopy = false;
     if (httpctx->parser.method != HTTP_HEAD)
     {
-        httpctx->streamingBuffer.init(len + resstr.size());
+#ifdef HAVE_SENDFILE
+        // plaintext only, evt_tls encrypts in user space
+        localcopy = len && !httpctx->server->useTLS && openLocalCopy(httpctx, node, start, len);
+#endif
+        httpctx->streamingBuffer.init(localcopy ? resstr.size() : len + resstr.size());
         httpctx->size = len;
     }
 
@@ -27826,8 +32251,14 @@ int MegaHTTPServer::streamNode(MegaHTTPContext *httpctx)
         return 0;
     }
 
-    LOG_debug << "Requesting range. From " << start << "  size " << len;
     httpctx->rangeWritten = 0;
+    if (localcopy)
+    {
+        LOG_debug << "Sending range from the local copy. From " << start << "  size " << len;
+        return 0;
+    }
+
+    LOG_debug << "Requesting range. From " << start << "  size " << len;
     if (start || len)
     {
         httpctx->megaApi->startStreaming(node, start, len, httpctx);
@@ -27841,6 +32272,183 @@ int MegaHTTPServer::streamNode(MegaHTTPContext *httpctx)
     return 0;
 }
 
+void MegaHTTPServer::keepAlive(MegaHTTPContext *httpctx)
+{
+    LOG_debug << "Keeping the connection alive for the next request";
+
+    // the streaming transfer stops when its listener is removed. A new request
+    // for the same node finds its DirectReadNode, with its temporary URLs and
+    // cached pieces, while it's still alive
+    httpctx->megaApi->removeTransferListener(httpctx);
+    if (httpctx->transfer)
+    {
+        httpctx->megaApi->cancelTransfer(httpctx->transfer.get());
+        httpctx->megaApi->fireOnStreamingFinish(httpctx->transfer.release(), MegaError(httpctx->resultCode)); // transfer will be deleted in fireOnStreamingFinish
+    }
+
+#ifdef HAVE_SENDFILE
+    closeLocalCopy(httpctx);
+#endif
+
+    uv_mutex_lock(&httpctx->mutex);
+    httpctx->resetRequest();
+    uv_mutex_unlock(&httpctx->mutex);
+
+    http_parser_pause(&httpctx->parser, 0);
+    if (httpctx->pipelined.size())
+    {
+        string pipelined;
+        pipelined.swap(httpctx->pipelined);
+        uv_buf_t buf = uv_buf_init((char *)pipelined.data(), static_cast<unsigned>(pipelined.size()));
+        ((MegaHTTPServer *)httpctx->server)->processReceivedData(httpctx, pipelined.size(), &buf);
+    }
+}
+
+#ifdef HAVE_SENDFILE
+bool MegaHTTPServer::openLocalCopy(MegaHTTPContext *httpctx, MegaNode *node, m_off_t start, m_off_t len)
+{
+    string localpath;
+    if (!httpctx->megaApi->getLocalCopy(node, &localpath))
+    {
+        return false;
+    }
+
+    int filefd = open(localpath.c_str(), O_RDONLY);
+    if (filefd < 0)
+    {
+        LOG_debug << "Unable to open the local copy, streaming it";
+        return false;
+    }
+
+    // the file could have changed since the last scan of the sync
+    struct stat st;
+    if (fstat(filefd, &st) || st.st_size != node->getSize() || st.st_mtime != node->getModificationTime())
+    {
+        LOG_debug << "The local copy doesn't match the node, streaming it";
+        close(filefd);
+        return false;
+    }
+
+    uv_os_fd_t tcpfd;
+    int socketfd = -1;
+    if (uv_fileno((uv_handle_t *)&httpctx->tcphandle, &tcpfd) || (socketfd = dup(tcpfd)) < 0)
+    {
+        close(filefd);
+        return false;
+    }
+
+    MegaHTTPLocalCopy *localcopy = new MegaHTTPLocalCopy();
+    localcopy->httpctx = httpctx;
+    localcopy->filefd = filefd;
+    localcopy->socketfd = socketfd;
+    localcopy->offset = start;
+    localcopy->remaining = len;
+    if (uv_poll_init(httpctx->tcphandle.loop, &localcopy->poll, socketfd))
+    {
+        close(socketfd);
+        close(filefd);
+        delete localcopy;
+        return false;
+    }
+    localcopy->poll.data = localcopy;
+
+    httpctx->localcopy = localcopy;
+    return true;
+}
+
+void MegaHTTPServer::sendLocalCopy(MegaHTTPContext *httpctx)
+{
+    uv_poll_start(&httpctx->localcopy->poll, UV_WRITABLE, onLocalCopyWritable);
+}
+
+void MegaHTTPServer::onLocalCopyWritable(uv_poll_t *handle, int status, int events)
+{
+    MegaHTTPLocalCopy *localcopy = (MegaHTTPLocalCopy *)handle->data;
+    MegaHTTPContext *httpctx = localcopy->httpctx;
+    if (!httpctx || httpctx->finished)
+    {
+        uv_poll_stop(handle);
+        return;
+    }
+
+    if (status < 0)
+    {
+        LOG_warn << "Finishing request. Socket error while sending the local copy: " << status;
+        uv_poll_stop(handle);
+        closeConnection(httpctx);
+        return;
+    }
+
+    // one chunk per event, so that other connections of the loop can progress
+    m_off_t chunk = httpctx->server->getMaxBufferSize();
+    size_t count = size_t(localcopy->remaining < chunk ? localcopy->remaining : chunk);
+    m_off_t sent;
+    bool failed;
+
+#ifdef __APPLE__
+    off_t written = count;
+    failed = sendfile(localcopy->filefd, localcopy->socketfd, localcopy->offset, &written, NULL, 0) < 0 && errno != EAGAIN;
+    sent = written;
+#else
+    off_t offset = localcopy->offset;
+    ssize_t written = sendfile(localcopy->socketfd, localcopy->filefd, &offset, count);
+    failed = written == 0 || (written < 0 && errno != EAGAIN);
+    sent = written > 0 ? written : 0;
+#endif
+
+    if (failed)
+    {
+        // a zero-length result means that the file was truncated
+        LOG_warn << "Finishing request. sendfile failed: " << errno;
+        uv_poll_stop(handle);
+        closeConnection(httpctx);
+        return;
+    }
+
+    localcopy->offset += sent;
+    localcopy->remaining -= sent;
+    httpctx->rangeWritten += sent;
+    httpctx->bytesWritten += sent;
+
+    if (!localcopy->remaining)
+    {
+        LOG_debug << "Finishing request. Local copy sent";
+        uv_poll_stop(handle);
+        if (httpctx->resultCode == API_EINTERNAL)
+        {
+            httpctx->resultCode = API_OK;
+        }
+
+        if (httpctx->keepalive)
+        {
+            keepAlive(httpctx);
+            return;
+        }
+        closeConnection(httpctx);
+    }
+}
+
+void MegaHTTPServer::closeLocalCopy(MegaHTTPContext *httpctx)
+{
+    if (!httpctx->localcopy)
+    {
+        return;
+    }
+
+    httpctx->localcopy->httpctx = NULL;
+    uv_close((uv_handle_t *)&httpctx->localcopy->poll, onLocalCopyClose);
+    httpctx->localcopy = NULL;
+}
+
+void MegaHTTPServer::onLocalCopyClose(uv_handle_t *handle)
+{
+    MegaHTTPLocalCopy *localcopy = (MegaHTTPLocalCopy *)handle->data;
+    close(localcopy->socketfd);
+    close(localcopy->filefd);
+    delete localcopy;
+}
+#endif
+
 void MegaHTTPServer::sendHeaders(MegaHTTPContext *httpctx, string *headers)
 {
     LOG_debug << "Response headers: " << *headers;
@@ -27949,6 +32557,15 @@ void MegaHTTPServer::sendNextBytes(MegaHTTPContext *httpctx)
         return;
     }
 
+#ifdef HAVE_SENDFILE
+    if (httpctx->localcopy)
+    {
+        // the headers have been written already
+        sendLocalCopy(httpctx);
+        return;
+    }
+#endif
+
     uv_mutex_lock(&httpctx->mutex);
     if (httpctx->lastBufferLen)
     {
@@ -27963,25 +32580,46 @@ void MegaHTTPServer::sendNextBytes(MegaHTTPContext *httpctx)
         return;
     }
 
-    uv_buf_t resbuf = httpctx->streamingBuffer.nextBuffer();
+    uv_buf_t resbufs[2];
+    int numbufs;
+#ifdef ENABLE_EVT_TLS
+    if (httpctx->server->useTLS)
+    {
+        // evt_tls_write takes a single buffer
+        resbufs[0] = httpctx->streamingBuffer.nextBuffer();
+        numbufs = resbufs[0].len ? 1 : 0;
+    }
+    else
+    {
+#endif
+        numbufs = httpctx->streamingBuffer.nextBuffers(resbufs);
+#ifdef ENABLE_EVT_TLS
+    }
+#endif
     uv_mutex_unlock(&httpctx->mutex);
 
-    if (!resbuf.len)
+    if (!numbufs)
     {
         LOG_verbose << "Skipping write. No data available";
         return;
     }
 
-    LOG_verbose << "Writing " << resbuf.len << " bytes";
-    httpctx->rangeWritten += resbuf.len;
-    httpctx->lastBuffer = resbuf.base;
-    httpctx->lastBufferLen = resbuf.len;
+    int len = int(resbufs[0].len);
+    if (numbufs > 1)
+    {
+        len += int(resbufs[1].len);
+    }
+
+    LOG_verbose << "Writing " << len << " bytes in " << numbufs << " buffers";
+    httpctx->rangeWritten += len;
+    httpctx->lastBuffer = resbufs[0].base;
+    httpctx->lastBufferLen = len;
 
 #ifdef ENABLE_EVT_TLS
     if (httpctx->server->useTLS)
     {
         //notice this, contrary to !useTLS is synchronous
-        int err = evt_tls_write(httpctx->evt_tls, resbuf.base, resbuf.len, onWriteFinished_tls);
+        int err = evt_tls_write(httpctx->evt_tls, resbufs[0].base, int(resbufs[0].len), onWriteFinished_tls);
         if (err <= 0)
         {
             LOG_warn << "Finishing due to an error sending the response: " << err;
@@ -27994,7 +32632,7 @@ void MegaHTTPServer::sendNextBytes(MegaHTTPContext *httpctx)
         uv_write_t *req = new uv_write_t();
         req->data = httpctx;
 
-        if (int err = uv_write(req, (uv_stream_t*)&httpctx->tcphandle, &resbuf, 1, onWriteFinished))
+        if (int err = uv_write(req, (uv_stream_t*)&httpctx->tcphandle, resbufs, numbufs, onWriteFinished))
         {
             delete req;
             LOG_warn << "Finishing due to an error in uv_write: " << err;
@@ -28030,11 +32668,50 @@ MegaHTTPContext::MegaHTTPContext()
     overwrite = true; //GVFS-DAV via command line does not include this header (assumed true)
     lastBuffer = NULL;
     lastBufferLen = 0;
+#ifdef HAVE_SENDFILE
+    localcopy = NULL;
+#endif
+    keepalive = false;
 
     // Mutex to protect the data buffer
     uv_mutex_init(&mutex_responses);
 }
 
+void MegaHTTPContext::resetRequest()
+{
+    range = false;
+    rangeStart = -1;
+    rangeEnd = -1;
+    rangeWritten = -1;
+    delete node;
+    node = NULL;
+    path.clear();
+    nodehandle.clear();
+    nodekey.clear();
+    nodename.clear();
+    nodesize = -1;
+    nodepubauth.clear();
+    nodeprivauth.clear();
+    nodechatauth.clear();
+    resultCode = API_EINTERNAL;
+    failed = false;
+    pause = false;
+    nodereceived = false;
+    keepalive = false;
+    bytesWritten = 0;
+    size = -1;
+    lastBuffer = NULL;
+    lastBufferLen = 0;
+    depth = -1;
+    lastheader.clear();
+    subpathrelative.clear();
+    host.clear();
+    destination.clear();
+    ifnonematch.clear();
+    overwrite = true;
+    streamingBuffer.reset();
+}
+
 MegaHTTPContext::~MegaHTTPContext()
 {
     delete node;
@@ -28290,6 +32967,49 @@ void MegaFTPServer::processWriteFinished(MegaTCPContext *tcpctx, int status)
     LOG_verbose << "MegaFTPServer::processWriteFinished. status=" << status;
 }
 
+MegaFTPDataServer *MegaFTPServer::startDataServer(MegaFTPContext *ftpctx)
+{
+    // walk the whole passive range once, skipping the ports of the other sessions
+    // and those that some other process holds, instead of failing on the first collision
+    int numports = (dataPortEnd >= dataportBegin) ? (dataPortEnd - dataportBegin + 1) : 1;
+    for (int i = 0; i < numports; i++)
+    {
+        if (pport > dataPortEnd || pport < dataportBegin)
+        {
+            pport = dataportBegin;
+        }
+        int port = pport++;
+        if (dataPortsInUse.find(port) != dataPortsInUse.end())
+        {
+            continue;
+        }
+
+        LOG_debug << "Creating new MegaFTPDataServer on port " << port;
+#ifdef ENABLE_EVT_TLS
+        MegaFTPDataServer *fds = new MegaFTPDataServer(megaApi, basePath, ftpctx, useTLS, certificatepath, keypath);
+#else
+        MegaFTPDataServer *fds = new MegaFTPDataServer(megaApi, basePath, ftpctx, useTLS, string(), string());
+#endif
+        if (fds->start(port, localOnly))
+        {
+            dataPortsInUse.insert(port);
+            ftpctx->pasiveport = port;
+            return fds;
+        }
+
+        LOG_debug << "Unable to listen on passive port " << port << ". Trying the next one";
+        delete fds;
+    }
+
+    LOG_warn << "No free passive port in range " << dataportBegin << "-" << dataPortEnd;
+    return NULL;
+}
+
+void MegaFTPServer::releaseDataPort(int port)
+{
+    dataPortsInUse.erase(port);
+}
+
 string MegaFTPServer::getListingLineFromNode(MegaNode *child, string nameToShow)
 {
     char perms[10];
@@ -29181,24 +33901,8 @@ void MegaFTPServer::processReceivedData(MegaTCPContext *tcpctx, ssize_t nread, c
         {
             if (!ftpctx->ftpDataServer)
             {
-                if (pport > (dataPortEnd))
-                {
-                    pport = dataportBegin;
-                }
-                ftpctx->pasiveport = pport++;
-
-                LOG_debug << "Creating new MegaFTPDataServer on port " << ftpctx->pasiveport;
-#ifdef ENABLE_EVT_TLS
-                MegaFTPDataServer *fds = new MegaFTPDataServer(megaApi, basePath, ftpctx, useTLS, certificatepath, keypath);
-#else
-                MegaFTPDataServer *fds = new MegaFTPDataServer(megaApi, basePath, ftpctx, useTLS, string(), string());
-#endif
-                bool result = fds->start(ftpctx->pasiveport, localOnly);
-                if (result)
-                {
-                    ftpctx->ftpDataServer = fds;
-                }
-                else
+                ftpctx->ftpDataServer = startDataServer(ftpctx);
+                if (!ftpctx->ftpDataServer)
                 {
                     response = "421 Failed to initialize data channel";
                     break;
@@ -29869,6 +34573,7 @@ MegaFTPContext::~MegaFTPContext()
     {
         LOG_verbose << "Deleting ftpDataServer associated with ftp context";
         delete ftpDataServer;
+        ((MegaFTPServer *)server)->releaseDataPort(pasiveport);
     }
     if (tmpFileName.size())
     {
@@ -30352,7 +35057,7 @@ void MegaFTPDataServer::processAsyncEvent(MegaTCPContext *tcpctx)
             ftpdatactx->bytesWritten = 0;
             ftpdatactx->size = 0;
             ftpdatactx->streamingBuffer.setMaxBufferSize(ftpdatactx->server->getMaxBufferSize());
-            ftpdatactx->streamingBuffer.setMaxOutputSize(ftpdatactx->server->getMaxOutputSize());
+            ftpdatactx->streamingBuffer.setMaxOutputSize(ftpdatactx->server->getMaxOutputSize(ftpdatactx));
 
             ftpdatactx->transfer = new MegaTransferPrivate(MegaTransfer::TYPE_LOCAL_TCP_DOWNLOAD);
 
@@ -30497,25 +35202,46 @@ void MegaFTPDataServer::sendNextBytes(MegaFTPDataContext *ftpdatactx)
         return;
     }
 
-    uv_buf_t resbuf = ftpdatactx->streamingBuffer.nextBuffer();
+    uv_buf_t resbufs[2];
+    int numbufs;
+#ifdef ENABLE_EVT_TLS
+    if (ftpdatactx->server->useTLS)
+    {
+        // evt_tls_write takes a single buffer
+        resbufs[0] = ftpdatactx->streamingBuffer.nextBuffer();
+        numbufs = resbufs[0].len ? 1 : 0;
+    }
+    else
+    {
+#endif
+        numbufs = ftpdatactx->streamingBuffer.nextBuffers(resbufs);
+#ifdef ENABLE_EVT_TLS
+    }
+#endif
     uv_mutex_unlock(&ftpdatactx->mutex);
 
-    if (!resbuf.len)
+    if (!numbufs)
     {
         LOG_verbose << "Skipping write. No data available." << " buffered = " << ftpdatactx->streamingBuffer.availableData();
         return;
     }
 
-    LOG_verbose << "Writing " << resbuf.len << " bytes" << " buffered = " << ftpdatactx->streamingBuffer.availableData();
-    ftpdatactx->rangeWritten += resbuf.len;
-    ftpdatactx->lastBuffer = resbuf.base;
-    ftpdatactx->lastBufferLen = resbuf.len;
+    int len = int(resbufs[0].len);
+    if (numbufs > 1)
+    {
+        len += int(resbufs[1].len);
+    }
+
+    LOG_verbose << "Writing " << len << " bytes in " << numbufs << " buffers" << " buffered = " << ftpdatactx->streamingBuffer.availableData();
+    ftpdatactx->rangeWritten += len;
+    ftpdatactx->lastBuffer = resbufs[0].base;
+    ftpdatactx->lastBufferLen = len;
 
 #ifdef ENABLE_EVT_TLS
     if (ftpdatactx->server->useTLS)
     {
         //notice this, contrary to !useTLS is synchronous
-        int err = evt_tls_write(ftpdatactx->evt_tls, resbuf.base, resbuf.len, onWriteFinished_tls);
+        int err = evt_tls_write(ftpdatactx->evt_tls, resbufs[0].base, int(resbufs[0].len), onWriteFinished_tls);
         if (err <= 0)
         {
             LOG_warn << "Finishing due to an error sending the response: " << err;
@@ -30528,7 +35254,7 @@ void MegaFTPDataServer::sendNextBytes(MegaFTPDataContext *ftpdatactx)
         uv_write_t *req = new uv_write_t();
         req->data = ftpdatactx;
 
-        if (int err = uv_write(req, (uv_stream_t*)&ftpdatactx->tcphandle, &resbuf, 1, onWriteFinished))
+        if (int err = uv_write(req, (uv_stream_t*)&ftpdatactx->tcphandle, resbufs, numbufs, onWriteFinished))
         {
             delete req;
             LOG_warn << "Finishing due to an error in uv_write: " << err;
@@ -31144,6 +35870,8 @@ const char *MegaEventPrivate::getEventString(int type)
         case MegaEvent::EVENT_BUSINESS_STATUS: return "BUSINESS_STATUS";
         case MegaEvent::EVENT_KEY_MODIFIED: return "KEY_MODIFIED";
         case MegaEvent::EVENT_MISC_FLAGS_READY: return "MISC_FLAGS_READY";
+        case MegaEvent::EVENT_MEMORY_PRESSURE: return "MEMORY_PRESSURE";
+        case MegaEvent::EVENT_STARTUP_STAGE: return "STARTUP_STAGE";
     }
 
     return "UNKNOWN";
@@ -31577,6 +36305,21 @@ TreeProcFolderInfo::TreeProcFolderInfo()
     versionsSize = 0;
 }
 
+TreeProc* TreeProcFolderInfo::fork() const
+{
+    return new TreeProcFolderInfo();
+}
+
+void TreeProcFolderInfo::merge(const TreeProc& other)
+{
+    const TreeProcFolderInfo& info = static_cast<const TreeProcFolderInfo&>(other);
+    numFiles += info.numFiles;
+    numFolders += info.numFolders;
+    numVersions += info.numVersions;
+    currentSize += info.currentSize;
+    versionsSize += info.versionsSize;
+}
+
 void TreeProcFolderInfo::proc(MegaClient *, Node *node)
 {
     if (node->parent && node->parent->type == FILENODE)
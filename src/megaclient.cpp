@@ -23,6 +23,7 @@
 #include "mega/mediafileattribute.h"
 #include <cctype>
 #include <algorithm>
+#include <thread>
 
 #undef min // avoid issues with std::min and std::max
 #undef max
@@ -34,6 +35,24 @@ namespace mega {
 // FIXME: instead of copying nodes, move if the source is in the rubbish to reduce node creation load on the servers
 // FIXME: prevent synced folder from being moved into another synced folder
 
+namespace {
+
+// run fn over [0, count) in contiguous shards of at least minshard items, on up to
+// KEYAPPLY_MAXTHREADS threads of the worker pool (this one included)
+void runshards(size_t count, size_t minshard, const std::function<void(size_t, size_t)>& fn)
+{
+    WorkerPool& pool = WorkerPool::get();
+    size_t threads = std::min<size_t>(pool.parallelism(WorkerPool::WORK_NODES), MegaClient::KEYAPPLY_MAXTHREADS);
+    threads = std::max<size_t>(1, std::min<size_t>(threads, count / minshard));
+
+    pool.run(WorkerPool::WORK_NODES, threads, [count, threads, &fn](size_t i)
+    {
+        fn(count * i / threads, count * (i + 1) / threads);
+    });
+}
+
+} // anonymous
+
 bool MegaClient::disablepkp = false;
 
 // root URL for API access
@@ -51,11 +70,12 @@ const unsigned MegaClient::MAXTOTALTRANSFERS = 48;
 // maximum number of concurrent transfers (uploads or downloads)
 const unsigned MegaClient::MAXTRANSFERS = 32;
 
-// maximum number of queued putfa before halting the upload queue
-const int MegaClient::MAXQUEUEDFA = 30;
+// bytes of queued putfa data before halting the upload queue (a few hundred previews)
+const size_t MegaClient::MAXQUEUEDFABYTES = 64 * 1024 * 1024;
 
-// maximum number of concurrent putfa
-const int MegaClient::MAXPUTFA = 10;
+// bounds of the number of concurrent putfa
+const int MegaClient::MINPUTFA = 4;
+const int MegaClient::MAXPUTFA = 32;
 
 #ifdef ENABLE_SYNC
 // //bin/SyncDebris/yyyy-mm-dd base folder name
@@ -745,8 +765,8 @@ void MegaClient::confirmrecoverylink(const char *code, const char *email, const
         hasher.get(&salt);
 
         byte derivedKey[2 * SymmCipher::KEYLENGTH];
-        CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA512> pbkdf2;
-        pbkdf2.DeriveKey(derivedKey, sizeof(derivedKey), 0, (byte *)password, strlen(password),
+        PBKDF2_HMAC_SHA512 pbkdf2;
+        pbkdf2.deriveKey(derivedKey, sizeof(derivedKey), (byte *)password, strlen(password),
                          (const byte *)salt.data(), salt.size(), 100000);
 
         string hashedauthkey;
@@ -978,6 +998,7 @@ Node* MegaClient::childnodebyname(Node* p, const char* name, bool skipfolders)
     }
 
     fsaccess->normalize(&nname);
+    pageinchildren(p);
 
     for (node_list::iterator it = p->children.begin(); it != p->children.end(); it++)
     {
@@ -1067,9 +1088,12 @@ void MegaClient::init()
 
     delete pendingsc;
     pendingsc = NULL;
+    closescstream(true);
+    scstreamurl.clear();
     stopsc = false;
 
     btcs.reset();
+    btpipelined.reset();
     btsc.reset();
     btpfa.reset();
     btbadhost.reset();
@@ -1088,16 +1112,18 @@ void MegaClient::init()
 }
 
 MegaClient::MegaClient(MegaApp* a, Waiter* w, HttpIO* h, FileSystemAccess* f, DbAccess* d, GfxProc* g, const char* k, const char* u)
-    : useralerts(*this), btugexpiration(rng), btcs(rng), btbadhost(rng), btworkinglock(rng), btsc(rng), btpfa(rng)
+    : useralerts(*this), btugexpiration(rng), btcs(rng), btbadhost(rng), btworkinglock(rng), btpipelined(rng), btsc(rng), btpfa(rng)
 #ifdef ENABLE_SYNC
-    ,syncfslockretrybt(rng), syncdownbt(rng), syncnaglebt(rng), syncextrabt(rng), syncscanbt(rng)
+    ,syncfslockretrybt(rng), syncdownbt(rng), syncnaglebt(rng), syncextrabt(rng), syncscanbt(rng), syncpollbt(rng)
 #endif
 {
     sctable = NULL;
     pendingsccommit = false;
     tctable = NULL;
+    facachemaxbytes = FileAttributeCache::DEFAULT_MAX_BYTES;
     me = UNDEF;
     publichandle = UNDEF;
+    folderlinksubtree = UNDEF;
     followsymlinks = false;
     usealtdownport = false;
     usealtupport = false;
@@ -1191,6 +1217,11 @@ MegaClient::MegaClient(MegaApp* a, Waiter* w, HttpIO* h, FileSystemAccess* f, Db
 
     connections[PUT] = 3;
     connections[GET] = 4;
+    maxtransfers = MAXTRANSFERS;
+    maxrequestsize = 0;
+    autoconnections[PUT] = autoconnections[GET] = false;
+    connectionbudget = 32;
+    bufferpool = std::make_shared<BufferPool>(bufferpoollimit);
 
     int i;
 
@@ -1233,6 +1264,13 @@ MegaClient::MegaClient(MegaApp* a, Waiter* w, HttpIO* h, FileSystemAccess* f, Db
     h->setuseragent(&useragent);
     h->setmaxdownloadspeed(0);
     h->setmaxuploadspeed(0);
+
+    if (dbaccess)
+    {
+        string dbname = "netcache";
+        nctable.reset(dbaccess->open(rng, fsaccess, &dbname, false, false));
+        loadnetcache();
+    }
 }
 
 MegaClient::~MegaClient()
@@ -1245,6 +1283,8 @@ MegaClient::~MegaClient()
     delete workinglockcs;
     delete sctable;
     delete tctable;
+    savenetcache();
+    nctable.reset();
     delete dbaccess;
 }
 
@@ -1291,6 +1331,7 @@ std::string MegaClient::getPublicLink(bool newLinkFormat, nodetype_t type, handl
 void MegaClient::exec()
 {
     CodeCounter::ScopeTimer ccst(performanceStats.execFunction);
+    ExecTracer::Cycle cycle(execTracer);
 
     WAIT_CLASS::bumpds();
 
@@ -1327,24 +1368,7 @@ void MegaClient::exec()
         requestLock = true;
     }
 
-    // successful network operation with a failed transfer chunk: increment error count
-    // and continue transfers
-    if (httpio->success && chunkfailed)
-    {
-        chunkfailed = false;
-
-        for (transferslot_list::iterator it = tslots.begin(); it != tslots.end(); it++)
-        {
-            if ((*it)->failure)
-            {
-                (*it)->lasterror = API_EFAILED;
-                (*it)->errorcount++;
-                (*it)->failure = false;
-                (*it)->lastdata = Waiter::ds;
-                LOG_warn << "Transfer error count raised: " << (*it)->errorcount;
-            }
-        }
-    }
+    retryfailedchunks();
 
     bool first = true;
     do
@@ -1360,7 +1384,7 @@ void MegaClient::exec()
         if (cachedug && btugexpiration.armed())
         {
             LOG_debug << "Cached user data expired";
-            getuserdata();
+            getuserdata(true);
             fetchtimezone();
         }
 
@@ -1386,6 +1410,11 @@ void MegaClient::exec()
                     }
                     // no retry -> fall through
                 case REQ_SUCCESS:
+                    if (req->gelbservice.size() && req->status == REQ_SUCCESS && req->httpstatus == 200)
+                    {
+                        cachegelb(req->gelbservice, req->in);
+                    }
+
                     restag = it->first;
                     app->http_result(req->httpstatus ? API_OK : API_EFAILED,
                                      req->httpstatus,
@@ -1431,6 +1460,35 @@ void MegaClient::exec()
             }
         }
 
+        for (auto it = gelbrefreshes.begin(); it != gelbrefreshes.end(); )
+        {
+            GenericHttpReq* req = it->second.get();
+            if (req->status == REQ_SUCCESS || req->status == REQ_FAILURE)
+            {
+                if (req->status == REQ_SUCCESS && req->httpstatus == 200)
+                {
+                    cachegelb(it->first, req->in);
+                }
+                gelbrefreshes.erase(it++);
+            }
+            else
+            {
+                it++;
+            }
+        }
+
+        for (auto it = preconnects.begin(); it != preconnects.end(); )
+        {
+            if ((*it)->status == REQ_SUCCESS || (*it)->status == REQ_FAILURE)
+            {
+                it = preconnects.erase(it);
+            }
+            else
+            {
+                it++;
+            }
+        }
+
         // file attribute puts (handled sequentially as a FIFO)
         if (activefa.size())
         {
@@ -1451,6 +1509,7 @@ void MegaClient::exec()
                         if (fa->in.size() == sizeof(handle))
                         {
                             LOG_debug << "File attribute uploaded OK - " << fa->th;
+                            putfaconcurrency.completed(Waiter::ds - fa->sent);
 
                             // successfully wrote file attribute - store handle &
                             // remove from list
@@ -1542,6 +1601,8 @@ void MegaClient::exec()
                         curfa = activefa.erase(curfa);
                         fa->status = REQ_READY;
                         queuedfa.push_back(fa);
+                        queuedfabytes += fa->datasize();
+                        putfaconcurrency.refused();
                         btpfa.backoff();
                         faretrying = true;
                         break;
@@ -1555,18 +1616,30 @@ void MegaClient::exec()
         if (btpfa.armed())
         {
             faretrying = false;
-            while (queuedfa.size() && activefa.size() < MAXPUTFA)
-            {
-                // dispatch most recent file attribute put
-                putfa_list::iterator curfa = queuedfa.begin();
-                HttpReqCommandPutFA* fa = *curfa;
-                queuedfa.erase(curfa);
-                activefa.push_back(fa);
+            dispatchputfa();
+        }
 
-                LOG_debug << "Adding file attribute to the request queue";
-                fa->status = REQ_INFLIGHT;
-                reqs.add(fa);
-            }
+        // file attributes found in the local cache
+        while (!cachedfas.empty())
+        {
+            auto fa = std::move(cachedfas.front());
+            cachedfas.pop_front();
+
+            restag = fa.first.tag;
+            app->fa_complete(fa.first.nodehandle, fa.first.type, fa.second.data(), uint32_t(fa.second.size()));
+        }
+
+        // RSA-wrapped node keys left over by applykeys()
+        if (!rsakeypending.empty() && !fetchingnodes)
+        {
+            applyrsakeys(true);
+            sendkeyrewrites();
+        }
+
+        // signatures of contact keys received in the last responses
+        if (!mPendingSignatures.empty())
+        {
+            verifysignatures();
         }
 
         if (fafcs.size())
@@ -1693,6 +1766,11 @@ void MegaClient::exec()
                         break;
 
                     case REQ_INFLIGHT:
+                        if (fnstream == FNSTREAM_PREFIX || fnstream == FNSTREAM_NODES)
+                        {
+                            procfetchnodesstream();
+                        }
+
                         if (pendingcs->contentlength > 0)
                         {
                             if (fetchingnodes && fnstats.timeToFirstByte == NEVER
@@ -1715,6 +1793,11 @@ void MegaClient::exec()
                         abortlockrequest();
                         app->request_response_progress(pendingcs->bufpos, -1);
 
+                        if (fnstream != FNSTREAM_OFF)
+                        {
+                            finishfetchnodesstream();
+                        }
+
                         if (pendingcs->in != "-3" && pendingcs->in != "-4")
                         {
                             if (*pendingcs->in.c_str() == '[')
@@ -1743,7 +1826,11 @@ void MegaClient::exec()
                                 if (sctable && pendingsccommit && !reqs.cmdspending())
                                 {
                                     LOG_debug << "Executing postponed DB commit";
-                                    sctable->commit();
+                                    {
+                                        CodeCounter::ScopeTimer ccst(performanceStats.dbCommit);
+                                        ExecTracer::Phase etp(execTracer, ExecTracer::DBCOMMIT);
+                                        sctable->commit();
+                                    }
                                     sctable->begin();
                                     app->notify_dbcommit();
                                     pendingsccommit = false;
@@ -1808,6 +1895,14 @@ void MegaClient::exec()
 
                     // fall through
                     case REQ_FAILURE:
+                        if (pendingcs->contentencoding.size()
+                         && (pendingcs->httpstatus == 400 || pendingcs->httpstatus == 415))
+                        {
+                            // the server doesn't take compressed requests: resend uncompressed from now on
+                            LOG_warn << "Compressed request rejected with HTTP status " << pendingcs->httpstatus << ". Disabling request compression";
+                            reqs.setcompression(0);
+                        }
+
                         if (!reason && pendingcs->httpstatus != 200)
                         {
                             if (pendingcs->httpstatus == 500)
@@ -1876,6 +1971,17 @@ void MegaClient::exec()
                 }
             }
 
+            if (reqs.deferredpending())
+            {
+                // the radio is up anyway while other commands go, or for a while after data came in
+                bool ridealong = reqs.cmdspending() || pendingcs
+                        || (httpio->lastdata != NEVER && Waiter::ds - httpio->lastdata < RADIO_TAIL_DS);
+                if (ridealong || Waiter::ds >= reqs.deferreduntil())
+                {
+                    reqs.releasedeferred(ridealong);
+                }
+            }
+
             if (btcs.armed())
             {
                 if (reqs.cmdspending())
@@ -1883,9 +1989,15 @@ void MegaClient::exec()
                     pendingcs = new HttpReq();
                     pendingcs->protect = true;
                     pendingcs->logname = clientname + "cs ";
+                    pendingcs->tracename = "cs batch";
 
                     bool suppressSID = true;
-                    reqs.serverrequest(pendingcs->out, suppressSID);
+                    bool compressed = false;
+                    reqs.serverrequest(pendingcs->out, suppressSID, &compressed);
+                    if (compressed)
+                    {
+                        pendingcs->contentencoding = "gzip";
+                    }
 
                     pendingcs->posturl = APIURL;
 
@@ -1902,6 +2014,11 @@ void MegaClient::exec()
                     }
                     pendingcs->type = REQ_JSON;
 
+                    // a batch made of a fetchnodes command is parsed as it arrives
+                    fnstream = reqs.inflightstreamingcommand() && httpio->incrementalinput() ? FNSTREAM_PREFIX : FNSTREAM_OFF;
+                    fnorphans.clear();
+                    pendingcs->streamed = fnstream != FNSTREAM_OFF;
+
                     performanceStats.csRequestWaitTime.start();
                     pendingcs->post(this);
                     continue;
@@ -1914,6 +2031,29 @@ void MegaClient::exec()
             break;
         }
 
+        execpipelinedcs();
+
+        if (netprobe.running())
+        {
+            execnetprobe();
+        }
+
+        // action packets streamed over the persistent channel
+        if (scstream && !loggingout)
+        {
+            procscstream();
+        }
+
+        if (!jsonsc.pos && !pendingsc && scstreambatches.size() && !loggingout)
+        {
+            scstreambatch = std::move(scstreambatches.front());
+            scstreambatches.pop_front();
+            insca = false;
+            insca_notlast = false;
+            jsonsc.begin(scstreambatch.c_str());
+            jsonsc.enterobject();
+        }
+
         // handle API server-client requests
         if (!jsonsc.pos && pendingsc && !loggingout)
         {
@@ -1925,6 +2065,11 @@ void MegaClient::exec()
                         && pendingsc->in[0] == '0')
                 {
                     LOG_debug << "SC keep-alive received";
+                    if (pendingsc->posturl.compare(0, scnotifyurl.size(), scnotifyurl) == 0)
+                    {
+                        // the wait request returned: there are new action packets to fetch
+                        performanceStats.scPropagationTime.start();
+                    }
                     delete pendingsc;
                     pendingsc = NULL;
                     btsc.reset();
@@ -1933,6 +2078,16 @@ void MegaClient::exec()
 
                 if (*pendingsc->in.c_str() == '{')
                 {
+                    if (catchupbyreload(pendingsc->in.size()))
+                    {
+                        LOG_warn << "Action packet backlog larger than the tree - reloading local state";
+                        int creqtag = reqtag;
+                        reqtag = fetchnodestag;
+                        fetchnodes(true);
+                        reqtag = creqtag;
+                        break;
+                    }
+
                     insca = false;
                     insca_notlast = false;
                     jsonsc.begin(pendingsc->in.c_str());
@@ -1976,6 +2131,7 @@ void MegaClient::exec()
                         {
                             useralerts.begincatchup = false;
                             useralerts.catchupdone = true;
+                            useralertsloaded();
                         }
                         stopsc = true;
                     }
@@ -2047,7 +2203,7 @@ void MegaClient::exec()
 
         // do not process the SC result until all preconfigured syncs are up and running
         // except if SC packets are required to complete a fetchnodes
-        if (!scpaused && jsonsc.pos && (syncsup || !statecurrent) && !syncdownrequired && !syncdownretry)
+        if (!scpaused && jsonsc.pos && (syncsup || !statecurrent) && !syncdownrequired && !syncdowndirty && !syncdownretry)
 #else
         if (!scpaused && jsonsc.pos)
 #endif
@@ -2061,6 +2217,7 @@ void MegaClient::exec()
                 {
                     // NULL vector: "notify all elements"
                     app->useralerts_updated(NULL, int(useralerts.alerts.size()));
+                    useralertsloaded();
                 }
             }
             else
@@ -2080,16 +2237,33 @@ void MegaClient::exec()
             else
             {
                 // remote changes require immediate attention of syncdown()
-                syncdownrequired = true;
+                if (syncdirtysubtrees)
+                {
+                    syncdowndirty = true;
+                }
+                else
+                {
+                    syncdownrequired = true;
+                }
                 syncactivity = true;
             }
 #endif
         }
 
-        if (!pendingsc && *scsn && btsc.armed() && !stopsc)
+        // streamed batches still to be processed come before anything from the current sn
+        bool scidle = !pendingsc && !scstream && !jsonsc.pos && scstreambatches.empty();
+
+        if (scidle && *scsn && btsc.armed() && !stopsc
+                && scstreamurl.size() && !useralerts.begincatchup && httpio->incrementalinput())
+        {
+            openscstream();
+        }
+
+        if (scidle && !scstream && *scsn && btsc.armed() && !stopsc)
         {
             pendingsc = new HttpReq();
             pendingsc->logname = clientname + "sc ";
+            pendingsc->tracename = "sc";
 
             if (scnotifyurl.size() && !useralerts.begincatchup)
             {
@@ -2280,6 +2454,20 @@ void MegaClient::exec()
             syncops = true;
         }
 
+        // sync timer: polling of network folders
+        if (syncnetworkpoll && syncpollbt.armed())
+        {
+            syncpollbt.backoff(Sync::POLL_TICK_DS);
+
+            for (it = syncs.begin(); it != syncs.end(); it++)
+            {
+                if ((*it)->isnetwork && (*it)->state == SYNC_ACTIVE && (*it)->pollfolders())
+                {
+                    syncactivity = true;
+                }
+            }
+        }
+
         // sync timer: read lock retry
         if (syncfslockretry && syncfslockretrybt.armed())
         {
@@ -2289,11 +2477,26 @@ void MegaClient::exec()
         // halt all syncing while the local filesystem is pending a lock-blocked operation
         // or while we are fetching nodes
         // FIXME: indicate by callback
-        if (!syncdownretry && !syncadding && statecurrent && !syncdownrequired && !fetchingnodes)
+        if (!syncdownretry && !syncadding && statecurrent && !syncdownrequired && !syncdowndirty && !fetchingnodes)
         {
             // process active syncs, stop doing so while transient local fs ops are pending
             if (syncs.size() || syncactivity)
             {
+                for (it = syncs.begin(); it != syncs.end(); )
+                {
+                    Sync* sync = *it++;
+                    if (sync->dirscanner && !sync->procdirscan())
+                    {
+                        sync->changestate(SYNC_FAILED);
+                    }
+                    else if (sync->dirnotify->overflows && sync->state == SYNC_ACTIVE)
+                    {
+                        sync->procoverflow();
+                    }
+
+                    sync->prefetchfingerprints();
+                }
+
                 bool prevpending = false;
                 for (int q = syncfslockretry ? DirNotify::RETRY : DirNotify::DIREVENTS; q >= DirNotify::DIREVENTS; q--)
                 {
@@ -2368,7 +2571,7 @@ void MegaClient::exec()
                                 delete sync;
                                 continue;
                             }
-                            else if (sync->state == SYNC_ACTIVE || sync->state == SYNC_INITIALSCAN)
+                            else if ((sync->state == SYNC_ACTIVE || sync->state == SYNC_INITIALSCAN) && !sync->dirscanner)
                             {
                                 // process items from the notifyq until depleted
                                 if (sync->dirnotify->notifyq[q].size())
@@ -2410,7 +2613,10 @@ void MegaClient::exec()
                                         if (!syncadding)
                                         {
                                             LOG_debug << "Running syncup to create missing folders";
-                                            syncup(sync->localroot.get(), &nds);
+                                            {
+                                                ExecTracer::Phase etp(execTracer, ExecTracer::SYNCUP);
+                                                syncup(sync->localroot.get(), &nds);
+                                            }
                                             sync->cachenodes();
                                         }
 
@@ -2506,7 +2712,14 @@ void MegaClient::exec()
                 if (prevpending && !totalpending)
                 {
                     LOG_debug << "Scan queue processed, triggering a scan";
-                    syncdownrequired = true;
+                    if (syncdirtysubtrees)
+                    {
+                        syncdowndirty = true;
+                    }
+                    else
+                    {
+                        syncdownrequired = true;
+                    }
                 }
 
                 notifypurge();
@@ -2576,12 +2789,19 @@ void MegaClient::exec()
                                  && !syncadding && syncuprequired && !syncnagleretry)
                                 {
                                     LOG_debug << "Running syncup on demand";
-                                    repeatsyncup |= !syncup((*it)->localroot.get(), &nds);
+                                    {
+                                        ExecTracer::Phase etp(execTracer, ExecTracer::SYNCUP);
+                                        repeatsyncup |= !syncup((*it)->localroot.get(), &nds);
+                                    }
                                     syncupdone = true;
                                     (*it)->cachenodes();
                                 }
                             }
                             syncuprequired = !syncupdone || repeatsyncup;
+                            if (syncupdone && !repeatsyncup)
+                            {
+                                syncupfull = !syncdirtysubtrees;
+                            }
 
                             if (EVER(nds))
                             {
@@ -2638,7 +2858,9 @@ void MegaClient::exec()
 
                                             if (syncscanbt.armed()
                                                     && (sync->dirnotify->failed || fsaccess->notifyfailed
-                                                        || sync->dirnotify->error || fsaccess->notifyerr))
+                                                        || sync->dirnotify->error || fsaccess->notifyerr)
+                                                    && !(syncnetworkpoll && sync->isnetwork
+                                                         && Waiter::ds - sync->fullscands < Sync::POLL_FULLSCAN_INTERVAL_DS))
                                             {
                                                 LOG_warn << "Sync scan failed " << sync->dirnotify->failed
                                                          << " " << fsaccess->notifyfailed
@@ -2654,6 +2876,12 @@ void MegaClient::exec()
                                                 sync->dirnotify->error = 0;
                                                 sync->fullscan = true;
                                                 sync->scanseqno++;
+                                                sync->fullscands = Waiter::ds;
+                                            }
+                                            else if (!(sync->dirnotify->failed || fsaccess->notifyfailed
+                                                        || sync->dirnotify->error || fsaccess->notifyerr))
+                                            {
+                                                sync->updatejournalcursor();
                                             }
                                         }
                                     }
@@ -2686,6 +2914,8 @@ void MegaClient::exec()
         {
             notifypurge();
 
+            syncdebriscompleted();
+
             // sync timer: retry syncdown() ops in case of local filesystem lock clashes
             if (syncdownretry && syncdownbt.armed())
             {
@@ -2693,12 +2923,14 @@ void MegaClient::exec()
                 syncdownrequired = true;
             }
 
-            if (syncdownrequired)
+            if (syncdownrequired || syncdowndirty)
             {
+                syncdownfull = syncdownrequired || !syncdirtysubtrees;
                 syncdownrequired = false;
+                syncdowndirty = false;
                 if (!fetchingnodes)
                 {
-                    LOG_verbose << "Running syncdown";
+                    LOG_verbose << "Running syncdown" << (syncdownfull ? "" : " on dirty subtrees");
                     bool success = true;
                     for (it = syncs.begin(); it != syncs.end(); it++)
                     {
@@ -2715,7 +2947,12 @@ void MegaClient::exec()
                             if ((*it)->state == SYNC_ACTIVE || (*it)->state == SYNC_INITIALSCAN)
                             {
                                 LOG_debug << "Running syncdown on demand";
-                                if (!syncdown((*it)->localroot.get(), &localpath, true))
+                                bool syncdownsucceeded;
+                                {
+                                    ExecTracer::Phase etp(execTracer, ExecTracer::SYNCDOWN);
+                                    syncdownsucceeded = syncdown((*it)->localroot.get(), &localpath, true);
+                                }
+                                if (!syncdownsucceeded)
                                 {
                                     // a local filesystem item was locked - schedule periodic retry
                                     // and force a full rescan afterwards as the local item may
@@ -2733,6 +2970,7 @@ void MegaClient::exec()
                     if (success)
                     {
                         syncuprequired = true;
+                        syncupfull = syncupfull || syncdownfull;
                         syncdownretry = false;
                         syncactivity = true;
 
@@ -2764,6 +3002,11 @@ void MegaClient::exec()
 
         notifypurge();
 
+        if (sharednodeviewdirty)
+        {
+            writesharednodeview();
+        }
+
         if (!badhostcs && badhosts.size() && btbadhost.armed())
         {
             // report hosts affected by failed requests
@@ -2790,26 +3033,59 @@ void MegaClient::exec()
         }
 
 
-        for (vector<TimerWithBackoff *>::iterator it = bttimers.begin(); it != bttimers.end(); )
+        while (!bttimers.empty() && bttimers.begin()->second->armed())
         {
-            TimerWithBackoff *bttimer = *it;
-            if (bttimer->armed())
-            {
-                restag = bttimer->tag;
-                app->timer_result(API_OK);
-                delete bttimer;
-                it = bttimers.erase(it);
-            }
-            else
-            {
-                ++it;
-            }
+            TimerWithBackoff *bttimer = bttimers.begin()->second;
+            bttimers.erase(bttimers.begin());
+            restag = bttimer->tag;
+            app->timer_result(API_OK);
+            delete bttimer;
         }
 
         httpio->updatedownloadspeed();
         httpio->updateuploadspeed();
-    } while (httpio->doio() || execdirectreads() || (!pendingcs && reqs.cmdspending() && btcs.armed()) || looprequested);
+    } while (httpio->doio() || execdirectreads() || (!pendingcs && reqs.cmdspending() && btcs.armed())
+             || (pipelinedcs.size() < reqs.pipelinedepth() && reqs.pipelinedpending() && btpipelined.armed()) || looprequested);
 
+    if (lowmemorybudget && nodes.size() > lowmemorybudget / LOWMEMORY_NODEBYTES && Waiter::ds >= lowmemoryds + LOWMEMORY_INTERVAL)
+    {
+        lowmemoryds = Waiter::ds;
+        pageoutnodes();
+    }
+
+    if (memorybudget && Waiter::ds >= memoryds + MEMORY_INTERVAL)
+    {
+        memoryds = Waiter::ds;
+        measurememory();
+    }
+
+    if (!newversions.empty() && Waiter::ds >= versionsds + LOWMEMORY_INTERVAL)
+    {
+        versionsds = Waiter::ds;
+        pageoutversions();
+    }
+
+    if (!putnodesbatches.empty())
+    {
+        sendputnodesbatches();
+    }
+
+    if (cachedfilesresuming)
+    {
+        resumecachedfiles();
+    }
+
+    if (!tcdirty.empty() && Waiter::ds >= tcdirtyds + TRANSFERCACHE_FLUSH_INTERVAL)
+    {
+        DBTableTransactionCommitter committer(tctable);
+        transfercacheflush(&committer);
+    }
+
+    if ((autoconnections[PUT] || autoconnections[GET]) && Waiter::ds >= rebalanceds + REBALANCE_INTERVAL)
+    {
+        rebalanceds = Waiter::ds;
+        rebalanceconnections();
+    }
 
     NodeCounter storagesum;
     for (auto& nc : mNodeCounters)
@@ -2825,15 +3101,15 @@ void MegaClient::exec()
         app->storagesum_changed(mNotifiedSumSize);
     }
 
-#ifdef MEGA_MEASURE_CODE
     performanceStats.transfersActiveTime.start(!tslots.empty() && !performanceStats.transfersActiveTime.inprogress());
     performanceStats.transfersActiveTime.stop(tslots.empty() && performanceStats.transfersActiveTime.inprogress());
 
+#ifdef MEGA_MEASURE_CODE
     static auto lasttime = Waiter::ds;
     if (Waiter::ds > lasttime + 1200)
     {
         lasttime = Waiter::ds;
-        LOG_info << performanceStats.report(false, httpio, waiter, reqs);
+        LOG_info << performanceStats.report(false, httpio, waiter, reqs, *bufferpool);
     }
 #endif
 }
@@ -2864,7 +3140,7 @@ int MegaClient::preparewait()
 #ifdef ENABLE_SYNC
     // sync directory scans in progress or still processing sc packet without having
     // encountered a locally locked item? don't wait.
-    if (syncactivity || syncdownrequired || (!scpaused && jsonsc.pos && (syncsup || !statecurrent) && !syncdownretry))
+    if (syncactivity || syncdownrequired || syncdowndirty || (!scpaused && jsonsc.pos && (syncsup || !statecurrent) && !syncdownretry))
     {
         nds = Waiter::ds;
     }
@@ -2880,6 +3156,45 @@ int MegaClient::preparewait()
             nds = Waiter::ds;
         }
 
+        if (!cachedfas.empty())
+        {
+            // file attributes served from the local cache, don't wait
+            nds = Waiter::ds;
+        }
+
+        if (cachedfilesresuming)
+        {
+            // cached files still to be resumed, don't wait
+            nds = Waiter::ds;
+        }
+
+        if (!rsakeypending.empty() && !fetchingnodes)
+        {
+            // node keys still to be decrypted, don't wait
+            nds = Waiter::ds;
+        }
+
+        if (!mPendingSignatures.empty())
+        {
+            // contact key signatures still to be verified, don't wait
+            nds = Waiter::ds;
+        }
+
+        if (sharednodeviewdirty && statecurrent)
+        {
+            dstime next = sharednodeviewds + SHAREDNODEVIEW_INTERVAL;
+            if (next < nds)
+            {
+                nds = next;
+            }
+        }
+
+        if (partialchecks && Waiter::ds + 1 < nds)
+        {
+            // the downloads waiting for their partial files are started by the next dispatch
+            nds = Waiter::ds + 1;
+        }
+
         nexttransferretry(PUT, &nds);
         nexttransferretry(GET, &nds);
 
@@ -2905,8 +3220,33 @@ int MegaClient::preparewait()
             btcs.update(&nds);
         }
 
+        if (reqs.deferredpending() && reqs.deferreduntil() < nds)
+        {
+            // deferrable commands go on their own once they waited long enough
+            nds = reqs.deferreduntil();
+        }
+        btpipelined.update(&nds);
+
+        if (netprobe.running())
+        {
+            nds = std::min(nds, netprobe.deadline());
+        }
+
+        nds = std::min(nds, appwakeupds);
+
+        // send waiting putnodes batches in time
+        for (auto& batch : putnodesbatches)
+        {
+            nds = std::min(nds, batch.second.since + PUTNODES_BATCH_DELAY);
+        }
+
+        if (!tcdirty.empty())
+        {
+            nds = std::min(nds, tcdirtyds + TRANSFERCACHE_FLUSH_INTERVAL);
+        }
+
         // retry failed server-client requests
-        if (!pendingsc && *scsn && !stopsc)
+        if (!pendingsc && !scstream && *scsn && !stopsc)
         {
             btsc.update(&nds);
         }
@@ -2922,9 +3262,9 @@ int MegaClient::preparewait()
             btworkinglock.update(&nds);
         }
 
-        for (vector<TimerWithBackoff *>::iterator cit = bttimers.begin(); cit != bttimers.end(); cit++)
+        if (!bttimers.empty())
         {
-            (*cit)->update(&nds);
+            nds = std::min(nds, bttimers.begin()->first);
         }
 
         // retry failed file attribute puts
@@ -2998,6 +3338,11 @@ int MegaClient::preparewait()
         {
             syncextrabt.update(&nds);
         }
+
+        if (syncnetworkpoll && syncs.size())
+        {
+            syncpollbt.update(&nds);
+        }
 #endif
 
         // detect stuck network
@@ -3070,9 +3415,10 @@ int MegaClient::preparewait()
             }
         }
 
-        if (!jsonsc.pos && pendingsc && pendingsc->status == REQ_INFLIGHT)
+        HttpReq* screq = scstream ? scstream.get() : pendingsc;
+        if (!jsonsc.pos && screq && screq->status == REQ_INFLIGHT)
         {
-            dstime timeout = pendingsc->lastdata + HttpIO::SCREQUESTTIMEOUT;
+            dstime timeout = screq->lastdata + HttpIO::SCREQUESTTIMEOUT;
             if (timeout > Waiter::ds && timeout < nds)
             {
                 nds = timeout;
@@ -3097,31 +3443,26 @@ int MegaClient::preparewait()
         nds -= Waiter::ds;
     }
 
-#ifdef MEGA_MEASURE_CODE
     bool reasonGiven = false;
     if (nds == 0)
     {
         ++performanceStats.prepwaitZero;
         reasonGiven = true;
     }
-#endif
 
     waiter->init(nds);
 
     // set subsystem wakeup criteria (WinWaiter assumes httpio to be set first!)
     waiter->wakeupby(httpio, Waiter::NEEDEXEC);
 
-#ifdef MEGA_MEASURE_CODE
     if (waiter->maxds == 0 && !reasonGiven)
     {
         ++performanceStats.prepwaitHttpio;
         reasonGiven = true;
     }
-#endif
 
     waiter->wakeupby(fsaccess, Waiter::NEEDEXEC);
 
-#ifdef MEGA_MEASURE_CODE
     if (waiter->maxds == 0 && !reasonGiven)
     {
         ++performanceStats.prepwaitFsaccess;
@@ -3131,7 +3472,6 @@ int MegaClient::preparewait()
     {
         ++performanceStats.nonzeroWait;
     }
-#endif
 
     return 0;
 }
@@ -3205,6 +3545,11 @@ bool MegaClient::abortbackoff(bool includexfers)
         r = true;
     }
 
+    if (btpipelined.arm())
+    {
+        r = true;
+    }
+
     if (btbadhost.arm())
     {
         r = true;
@@ -3215,12 +3560,12 @@ bool MegaClient::abortbackoff(bool includexfers)
         r = true;
     }
 
-    if (!pendingsc && btsc.arm())
+    if (!pendingsc && !scstream && btsc.arm())
     {
         r = true;
     }
 
-    if (activefa.size() < MAXPUTFA && btpfa.arm())
+    if (int(activefa.size()) < putfaconcurrency.limit() && btpfa.arm())
     {
         r = true;
     }
@@ -3247,6 +3592,7 @@ void MegaClient::dispatchTransfers()
     }
 
     CodeCounter::ScopeTimer ccst(performanceStats.dispatchTransfers);
+    ExecTracer::Phase etp(execTracer, ExecTracer::DISPATCH);
 
     struct counter 
     { 
@@ -3286,13 +3632,13 @@ void MegaClient::dispatchTransfers()
             TransferCategory tc(t);
 
             // hard limit on puts/gets
-            if (counters[tc.directionIndex()].total >= MAXTRANSFERS)
+            if (counters[tc.directionIndex()].total >= maxtransfers)
             {
                 return false;
             }
 
             // only request half the max at most, to get a quicker response from the API and get overlap with transfers going
-            if (counters[tc.directionIndex()].added >= MAXTRANSFERS/2)
+            if (counters[tc.directionIndex()].added >= maxtransfers/2)
             {
                 return false;
             }
@@ -3341,10 +3687,10 @@ void MegaClient::dispatchTransfers()
                 return;
             }
 
-            if (category.direction == PUT && queuedfa.size() > MAXQUEUEDFA)
+            if (category.direction == PUT && queuedfabytes > MAXQUEUEDFABYTES)
             {
-                // file attribute jam? halt uploads.
-                LOG_warn << "Attribute queue full: " << queuedfa.size();
+                // file attribute jam? halt uploads until their data fits in memory again.
+                LOG_warn << "Attribute queue full: " << queuedfa.size() << " (" << queuedfabytes << " bytes)";
                 break;
             }
 
@@ -3424,6 +3770,14 @@ void MegaClient::dispatchTransfers()
                 app->transfer_prepare(nexttransfer);
             }
 
+            if (nexttransfer->type == GET && resumepartialdownloads && !nexttransfer->partialchecked
+                    && nexttransfer->chunkmacs.empty() && nexttransfer->size && nexttransfer->localfilename.size()
+                    && !resumepartialdownload(nexttransfer))
+            {
+                // reading its partial file
+                continue;
+            }
+
             bool openok = false;
             bool openfinished = false;
 
@@ -3487,6 +3841,12 @@ void MegaClient::dispatchTransfers()
 
                 if (openfinished && openok)
                 {
+                    if (nexttransfer->type == GET && preallocatedownloads && nexttransfer->chunkmacs.empty()
+                            && !ts->fa->fpreallocate(nexttransfer->size))
+                    {
+                        LOG_debug << "Unable to preallocate " << nexttransfer->size << " bytes for download";
+                    }
+
                     handle h = UNDEF;
                     bool hprivate = true;
                     const char *privauth = NULL;
@@ -3538,11 +3898,12 @@ void MegaClient::dispatchTransfers()
                         if (nexttransfer->localfilename.size() && !nexttransfer->uploadhandle)
                         {
                             nexttransfer->uploadhandle = getuploadhandle();
+                            int missing = takefileattributes(nexttransfer, ts->fa);
 
-                            if (!gfxdisabled && gfx && gfx->isgfx(&nexttransfer->localfilename))
+                            if (missing && !gfxdisabled && gfx && gfx->isgfx(&nexttransfer->localfilename))
                             {
                                 // we want all imagery to be safely tucked away before completing the upload, so we bump minfa
-                                nexttransfer->minfa += gfx->gendimensionsputfa(ts->fa, &nexttransfer->localfilename, nexttransfer->uploadhandle, nexttransfer->transfercipher(), -1, false);
+                                nexttransfer->minfa += gfx->gendimensionsputfa(ts->fa, &nexttransfer->localfilename, nexttransfer->uploadhandle, nexttransfer->transfercipher(), missing, false);
                             }
                         }
                     }
@@ -3591,6 +3952,11 @@ void MegaClient::dispatchTransfers()
                     }
                     app->transfer_update(nexttransfer);
 
+                    if (transferscheduler)
+                    {
+                        transferscheduler->started(nexttransfer);
+                    }
+
                     performanceStats.transferStarts += 1;
                 }
                 else if (openfinished)
@@ -3701,6 +4067,11 @@ void MegaClient::checkfacompletion(handle th, Transfer* t)
 void MegaClient::freeq(direction_t d)
 {
     DBTableTransactionCommitter committer(tctable);
+    transfercacheflush(&committer);
+
+    // all of them go: spare each one the search and erase in the middle of the priority list
+    transferlist.transfers[d].clear();
+
     for (transfer_map::iterator it = transfers[d].begin(); it != transfers[d].end(); )
     {
         delete it++->second;
@@ -3748,10 +4119,18 @@ void MegaClient::disconnect()
         pendingcs->disconnect();
     }
 
+    // the pipelined batches are simply sent again
+    for (auto& p : pipelinedcs)
+    {
+        reqs.requeuepipelined(p.first);
+    }
+    pipelinedcs.clear();
+
     if (pendingsc)
     {
         pendingsc->disconnect();
     }
+    closescstream(false);
 
     abortlockrequest();
 
@@ -3807,17 +4186,133 @@ void MegaClient::catchup()
         delete pendingsc;
         pendingsc = NULL;
     }
+    closescstream(false);
     btcs.reset();
     scnotifyurl.clear();
 }
 
-void MegaClient::abortlockrequest()
+// open the persistent server-client channel from the current sn
+void MegaClient::openscstream()
 {
-    delete workinglockcs;
-    workinglockcs = NULL;
-    btworkinglock.reset();
-    requestLock = false;
-    disconnecttimestamp = NEVER;
+    LOG_debug << "Opening the sc channel";
+
+    scstream.reset(new HttpReq());
+    scstream->logname = clientname + "scs ";
+    scstream->posturl = scstreamurl;
+    scstream->posturl.append(scstreamurl.find('?') == string::npos ? "?sn=" : "&sn=");
+    scstream->posturl.append(scsn);
+    scstream->posturl.append(auth);
+    scstream->protect = true;
+    scstream->streamed = true;
+    scstream->type = REQ_JSON;
+    scstream->post(this);
+
+    scstreamscanner.reset();
+    scstreamopen = false;
+}
+
+// queue the batches received on the persistent channel so far, and handle its end
+void MegaClient::procscstream()
+{
+    bool failed = false;
+
+    httpio->lock();
+
+    const char* data = scstream->data();
+    size_t len = scstream->size();
+    size_t consumed = 0;
+
+    if (!scstreamopen)
+    {
+        while (consumed < len && isspace(static_cast<unsigned char>(data[consumed])))
+        {
+            consumed++;
+        }
+
+        if (consumed < len)
+        {
+            if (data[consumed] == '[')
+            {
+                consumed++;
+                scstreamopen = true;
+            }
+            else
+            {
+                // an error, or no channel after all: the long poll will report it
+                failed = true;
+            }
+        }
+    }
+
+    if (scstreamopen)
+    {
+        consumed += scstreamscanner.feed(data + consumed, len - consumed, [this](const char* element, size_t size)
+        {
+            while (size && isspace(static_cast<unsigned char>(*element)))
+            {
+                element++;
+                size--;
+            }
+
+            if (size && *element == '{')
+            {
+                scstreambatches.emplace_back(element, size);
+                performanceStats.scPropagationTime.start();
+                performanceStats.scStreamedBatches++;
+                return true;
+            }
+            return size == 1 && *element == '0';    // keep-alive
+        });
+
+        failed = scstreamscanner.failed();
+    }
+
+    scstream->purge(consumed);
+
+    httpio->unlock();
+
+    if (failed || scstream->status == REQ_FAILURE)
+    {
+        LOG_warn << "sc channel failed, back to long polling";
+        closescstream(true);
+        btsc.backoff();
+    }
+    else if (scstream->status == REQ_SUCCESS || scstreamscanner.finished())
+    {
+        LOG_debug << "sc channel closed by the server";
+        closescstream(false);
+        btsc.reset();
+    }
+    else if (scstream->status == REQ_INFLIGHT && Waiter::ds >= scstream->lastdata + HttpIO::SCREQUESTTIMEOUT)
+    {
+        LOG_debug << "sc channel timeout expired";
+        closescstream(false);
+        btsc.reset();
+    }
+}
+
+// the batches already received are still processed.  Without `fallback`, the channel is opened again
+void MegaClient::closescstream(bool fallback)
+{
+    if (scstream)
+    {
+        scstream->disconnect();
+        scstream.reset();
+    }
+
+    if (fallback)
+    {
+        scstreamurl.clear();
+    }
+}
+
+void MegaClient::abortlockrequest()
+{
+    delete workinglockcs;
+    workinglockcs = NULL;
+    btworkinglock.reset();
+    requestLock = false;
+    disconnecttimestamp = NEVER;
 }
 
 void MegaClient::logout()
@@ -3837,19 +4332,32 @@ void MegaClient::logout()
 
 void MegaClient::locallogout(bool removecaches)
 {
+    LOG_info << "Session request stats: " << reqs.statsReport();
+
     if (removecaches)
     {
         removeCaches();
     }
 
+    // a write-behind table writes what was committed before it's gone
     delete sctable;
     sctable = NULL;
     pendingsccommit = false;
+    facache.reset();
+    fpcache.reset();
+    cachedfas.clear();
+    rsakeypending.clear();
+    nodesnapshotcurrent = false;
+    nodesnapshotds = 0;
+    nodeindexkey.clear();
+    pinnednodes.clear();
 
     me = UNDEF;
     uid.clear();
     unshareablekey.clear();
     publichandle = UNDEF;
+    folderlinksubtree = UNDEF;
+    nodescope.clear();
     cachedscsn = UNDEF;
     achievements_enabled = false;
     isNewSession = false;
@@ -3883,6 +4391,8 @@ void MegaClient::locallogout(bool removecaches)
 
     delete pendingcs;
     pendingcs = NULL;
+    pipelinedcs.clear();
+    clearputnodesbatches();
     stopsc = false;
 
     for (putfa_list::iterator it = queuedfa.begin(); it != queuedfa.end(); it++)
@@ -3900,12 +4410,13 @@ void MegaClient::locallogout(bool removecaches)
         delete it->second;
     }
 
-    for (vector<TimerWithBackoff *>::iterator it = bttimers.begin(); it != bttimers.end();  it++)
+    for (auto& it : bttimers)
     {
-        delete *it;
+        delete it.second;
     }
 
     queuedfa.clear();
+    queuedfabytes = 0;
     activefa.clear();
     pendinghttp.clear();
     bttimers.clear();
@@ -3954,6 +4465,8 @@ void MegaClient::locallogout(bool removecaches)
 
     mAuthRings.clear();
     mAuthRingsTemp.clear();
+    mAuthRingsTempUntracked.clear();
+    mPendingSignatures.clear();
     mFetchingAuthrings = false;
 
     init();
@@ -3975,12 +4488,31 @@ void MegaClient::removeCaches()
 {
     if (sctable)
     {
+        pageinall();
         sctable->remove();
         delete sctable;
         sctable = NULL;
         pendingsccommit = false;
     }
 
+    if (facache)
+    {
+        facache->remove();
+        facache.reset();
+    }
+
+    if (fpcache)
+    {
+        fpcache->remove();
+        fpcache.reset();
+    }
+
+    if (!sharednodeviewpath.empty())
+    {
+        ::remove(sharednodeviewpath.c_str());
+        sharednodeviewdirty = false;
+    }
+
 #ifdef ENABLE_SYNC
     for (sync_list::iterator it = syncs.begin(); it != syncs.end(); it++)
     {
@@ -4031,12 +4563,43 @@ void MegaClient::gelbrequest(const char *service, int timeoutds, int retries)
 {
     GenericHttpReq *req = new GenericHttpReq(rng);
     req->tag = reqtag;
-    req->maxretries = retries;
-    if (timeoutds > 0)
+    pendinghttp[reqtag] = req;
+
+    auto cached = gelbcache.find(service);
+    m_time_t age = GELB_CACHE_TTL;
+    if (cached != gelbcache.end())
     {
-        req->maxbt.backoff(timeoutds);
+        age = m_time() - cached->second.ts;
     }
-    pendinghttp[reqtag] = req;
+
+    if (age < GELB_CACHE_TTL)
+    {
+        // answered by the next exec()
+        LOG_debug << "Cached GeLB response for " << service;
+        req->status = REQ_SUCCESS;
+        req->httpstatus = 200;
+        req->in = cached->second.response;
+
+        if (age < GELB_CACHE_TTL / 2 || gelbrefreshes.find(service) != gelbrefreshes.end())
+        {
+            return;
+        }
+
+        // the response of a refresh only goes to the cache
+        req = new GenericHttpReq(rng);
+        req->maxretries = 1;
+        gelbrefreshes[service].reset(req);
+    }
+    else
+    {
+        req->maxretries = retries;
+        if (timeoutds > 0)
+        {
+            req->maxbt.backoff(timeoutds);
+        }
+    }
+
+    req->gelbservice = service;
     req->posturl = GELBURL;
     req->posturl.append("?service=");
     req->posturl.append(service);
@@ -4044,6 +4607,196 @@ void MegaClient::gelbrequest(const char *service, int timeoutds, int retries)
     req->get(this);
 }
 
+void MegaClient::cachegelb(const string& service, const string& response)
+{
+    GelbCacheEntry& entry = gelbcache[service];
+    entry.response = response;
+    entry.ts = m_time();
+}
+
+void MegaClient::loadnetcache()
+{
+    string data;
+    if (!nctable)
+    {
+        return;
+    }
+
+    if (nctable->get(NETCACHE_DNS, &data))
+    {
+        httpio->importdnscache(data);
+    }
+
+    if (nctable->get(NETCACHE_TLS, &data))
+    {
+        httpio->importsslsessions(data);
+    }
+
+    NetworkProbe::Profile profile;
+    if (nctable->get(NETCACHE_PROFILE, &data) && profile.unserialize(data))
+    {
+        LOG_debug << "Network profile from " << profile.measured << ": " << profile.json();
+        applynetprofile(profile);
+    }
+
+    if (nctable->get(NETCACHE_GELB, &data))
+    {
+        CacheableReader r(data);
+        uint32_t count = 0;
+        r.unserializeu32(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            string service;
+            GelbCacheEntry entry;
+            if (!r.unserializestring(service) || !r.unserializestring(entry.response) || !r.unserializei64(entry.ts))
+            {
+                LOG_warn << "Invalid GeLB cache";
+                break;
+            }
+
+            if (m_time() - entry.ts < GELB_CACHE_TTL)
+            {
+                gelbcache[service] = entry;
+            }
+        }
+    }
+}
+
+void MegaClient::probenetwork()
+{
+    vector<string> urls;
+
+    // an empty batch, which the API answers at once
+    string id;
+    for (int i = 10; i--; )
+    {
+        id.push_back(static_cast<char>('a' + rng.genuint32(26)));
+    }
+    urls.push_back(APIURL + "cs?id=" + id + appkey);
+
+    // the storage servers used the most, on the default and the alternative port
+    vector<std::pair<unsigned, string>> hosts;
+    for (auto& it : storagehealth.hosts())
+    {
+        hosts.push_back(std::make_pair(it.second.samples, it.first.substr(0, it.first.find(':'))));
+    }
+    std::sort(hosts.rbegin(), hosts.rend());
+    for (size_t i = 0; i < hosts.size() && i < 2; i++)
+    {
+        urls.push_back("http://" + hosts[i].second + "/");
+        urls.push_back("http://" + hosts[i].second + ":8080/");
+    }
+
+    LOG_info << "Probing the network with " << urls.size() << " endpoints";
+    netprobe.start(urls);
+}
+
+void MegaClient::execnetprobe()
+{
+    if (!netprobe.exec(this))
+    {
+        return;
+    }
+
+    const vector<NetworkProbe::Endpoint>& endpoints = netprobe.endpoints();
+
+    // the API, then pairs of default and alternative port for each storage server
+    unsigned sent = endpoints[0].sent;
+    unsigned lost = endpoints[0].lost;
+    double apirtt = endpoints[0].rttms;
+    double storagertt = 0;
+    unsigned storagereplies = 0;
+    bool defaultport = false;
+    bool altport = false;
+    for (size_t i = 1; i + 1 < endpoints.size(); i += 2)
+    {
+        const NetworkProbe::Endpoint& e = endpoints[i];
+        sent += e.sent;
+        lost += e.lost;
+        if (e.sent > e.lost)
+        {
+            storagertt += e.rttms * (e.sent - e.lost);
+            storagereplies += e.sent - e.lost;
+            defaultport = true;
+        }
+        altport |= endpoints[i + 1].sent > endpoints[i + 1].lost;
+    }
+
+    // the throughput comes from the transfers themselves
+    double bandwidth = 0;
+    for (auto& it : storagehealth.hosts())
+    {
+        if (it.second.throughputsamples)
+        {
+            bandwidth = std::max(bandwidth, it.second.throughput);
+        }
+    }
+
+    netprofile = NetworkProbe::tune(storagereplies ? storagertt / storagereplies : apirtt,
+                                    sent ? double(lost) / sent : 0, bandwidth, altport && !defaultport, MAXTRANSFERS);
+    LOG_info << "Network profile: " << netprofile.json();
+    applynetprofile(netprofile);
+
+    if (nctable)
+    {
+        string data;
+        netprofile.serialize(&data);
+        nctable->put(NETCACHE_PROFILE, &data);
+    }
+}
+
+void MegaClient::applynetprofile(const NetworkProbe::Profile& profile)
+{
+    netprofile = profile;
+
+    if (profile.connections)
+    {
+        setmaxconnections(PUT, int(profile.connections));
+        setmaxconnections(GET, int(profile.connections));
+    }
+
+    maxtransfers = profile.transfers ? profile.transfers : MAXTRANSFERS;
+    maxrequestsize = profile.requestsize;
+    usealtdownport = usealtupport = profile.altport;
+}
+
+void MegaClient::savenetcache()
+{
+    if (!nctable)
+    {
+        return;
+    }
+
+    string data;
+    nctable->begin();
+
+    httpio->exportdnscache(&data);
+    nctable->put(NETCACHE_DNS, &data);
+
+    httpio->exportsslsessions(&data);
+    nctable->put(NETCACHE_TLS, &data);
+
+    if (netprofile.measured)
+    {
+        netprofile.serialize(&data);
+        nctable->put(NETCACHE_PROFILE, &data);
+    }
+
+    data.clear();
+    CacheableWriter w(data);
+    w.serializeu32(uint32_t(gelbcache.size()));
+    for (auto& entry : gelbcache)
+    {
+        w.serializestring(entry.first);
+        w.serializestring(entry.second.response);
+        w.serializei64(entry.second.ts);
+    }
+    w.serializeexpansionflags();
+    nctable->put(NETCACHE_GELB, &data);
+
+    nctable->commit();
+}
+
 void MegaClient::sendchatstats(const char *json, int port)
 {
     GenericHttpReq *req = new GenericHttpReq(rng);
@@ -4108,10 +4861,26 @@ void MegaClient::httprequest(const char *url, int method, bool binary, const cha
     }
 }
 
+bool MegaClient::catchupbyreload(size_t bytes)
+{
+    if (statecurrent || fetchingnodes || !catchupreloadpercent || fnstats.mode != FetchNodesStats::MODE_DB)
+    {
+        return false;
+    }
+
+    // replaying a packet costs more than reading a node, so equal sizes favour the reload
+    catchupbytes += bytes;
+    m_off_t reloadbytes = m_off_t(nodes.size() + pagedoutnodes) * FETCHNODES_RECORD_SIZE * catchupreloadpercent / 100;
+    LOG_debug << "Catching up: " << catchupbytes << " bytes of action packets, reload at " << reloadbytes;
+
+    return catchupbytes > reloadbytes;
+}
+
 // process server-client request
 bool MegaClient::procsc()
 {
     CodeCounter::ScopeTimer ccst(performanceStats.scProcessingTime);
+    ExecTracer::Phase etp(execTracer, ExecTracer::SC);
 
     nameid name;
 
@@ -4133,6 +4902,10 @@ bool MegaClient::procsc()
                     jsonsc.storeobject(&scnotifyurl);
                     break;
 
+                case MAKENAMEID2('w', 's'):
+                    jsonsc.storeobject(&scstreamurl);
+                    break;
+
                 case MAKENAMEID2('i', 'r'):
                     // when spoonfeeding is in action, there may still be more actionpackets to be delivered.
                     insca_notlast = jsonsc.getint() == 1;
@@ -4142,11 +4915,21 @@ bool MegaClient::procsc()
                     // the sn element is guaranteed to be the last in sequence (except for notification requests (c=50))
                     setscsn(&jsonsc);
                     notifypurge();
+                    performanceStats.scBatchTime.stop();
+                    if (performanceStats.scPropagationTime.inprogress())
+                    {
+                        performanceStats.scPropagations++;
+                        performanceStats.scPropagationTime.stop();
+                    }
                     if (sctable)
                     {
                         if (!pendingcs && !csretrying && !reqs.cmdspending())
                         {
-                            sctable->commit();
+                            {
+                                CodeCounter::ScopeTimer ccst(performanceStats.dbCommit);
+                                ExecTracer::Phase etp(execTracer, ExecTracer::DBCOMMIT);
+                                sctable->commit();
+                            }
                             sctable->begin();
                             app->notify_dbcommit();
                             pendingsccommit = false;
@@ -4171,7 +4954,11 @@ bool MegaClient::procsc()
                             notifypurge();
                             if (sctable)
                             {
-                                sctable->commit();
+                                {
+                                    CodeCounter::ScopeTimer ccst(performanceStats.dbCommit);
+                                    ExecTracer::Phase etp(execTracer, ExecTracer::DBCOMMIT);
+                                    sctable->commit();
+                                }
                                 sctable->begin();
                                 pendingsccommit = false;
                             }
@@ -4190,6 +4977,11 @@ bool MegaClient::procsc()
                             app->fetchnodes_result(API_OK);
                             app->notify_dbcommit();
 
+                            if (stagedstartup)
+                            {
+                                startsecondarystage(false);
+                            }
+
                             WAIT_CLASS::bumpds();
                             fnstats.timeToSyncsResumed = Waiter::ds - fnstats.startTime;
                         }
@@ -4201,6 +4993,7 @@ bool MegaClient::procsc()
                         fnstats.nodesCurrent = nodes.size();
 
                         statecurrent = true;
+                        sharednodeviewdirty = !sharednodeviewpath.empty();
                         app->nodes_current();
                         LOG_debug << "Local filesystem up to date";
 
@@ -4212,35 +5005,21 @@ bool MegaClient::procsc()
 
                         if (tctable && cachedfiles.size())
                         {
-                            DBTableTransactionCommitter committer(tctable);
-                            for (unsigned int i = 0; i < cachedfiles.size(); i++)
-                            {
-                                direction_t type = NONE;
-                                File *file = app->file_resume(&cachedfiles.at(i), &type);
-                                if (!file || (type != GET && type != PUT))
-                                {
-                                    tctable->del(cachedfilesdbids.at(i));
-                                    continue;
-                                }
-                                nextreqtag();
-                                file->dbid = cachedfilesdbids.at(i);
-                                if (!startxfer(type, file, committer))
-                                {
-                                    tctable->del(cachedfilesdbids.at(i));
-                                    continue;
-                                }
-                            }
-                            cachedfiles.clear();
-                            cachedfilesdbids.clear();
+                            cachedfilesresuming = true;
+                            resumecachedfiles();
                         }
 
                         WAIT_CLASS::bumpds();
                         fnstats.timeToTransfersResumed = Waiter::ds - fnstats.startTime;
 
-                        string report;
-                        fnstats.toJsonArray(&report);
+                        // a staged startup reports once every stage is done
+                        if (startupstage != STARTUP_SECONDARY)
+                        {
+                            string report;
+                            fnstats.toJsonArray(&report);
 
-                        sendevent(99426, report.c_str(), 0);    // Treeproc performance log
+                            sendevent(99426, report.c_str(), 0);    // Treeproc performance log
+                        }
 
                         // NULL vector: "notify all elements"
                         app->nodes_updated(NULL, int(nodes.size()));
@@ -4261,6 +5040,10 @@ bool MegaClient::procsc()
                             // (or just fetched everything if there was no cache), our next sc request can be for useralerts
                             useralerts.begincatchup = true;
                         }
+                        else
+                        {
+                            checkstartupdone();
+                        }
                     }
 
                     if (!insca_notlast)
@@ -4274,6 +5057,8 @@ bool MegaClient::procsc()
                     {
                         LOG_debug << "Processing action packets";
                         insca = true;
+                        performanceStats.scBatches++;
+                        performanceStats.scBatchTime.start();
                         break;
                     }
                     // fall through
@@ -4297,6 +5082,7 @@ bool MegaClient::procsc()
                     {
                         fnstats.actionPackets++;
                     }
+                    performanceStats.scPackets++;
 
                     name = jsonsc.getnameid();
 
@@ -4314,11 +5100,12 @@ bool MegaClient::procsc()
                         {
                             case 'u':
                                 // node update
-                                sc_updatenode();
+                                dn = sc_updatenode();
 #ifdef ENABLE_SYNC
-                                if (!fetchingnodes)
+                                if (!fetchingnodes && affectssync(dn))
                                 {
                                     // run syncdown() before continuing
+                                    performanceStats.scSyncdownYields++;
                                     applykeys();
                                     return false;
                                 }
@@ -4327,7 +5114,8 @@ bool MegaClient::procsc()
 
                             case 't':
 #ifdef ENABLE_SYNC
-                                if (!fetchingnodes && !stop)
+                                // new folders are created locally before the next packet, if there is a sync to create them in
+                                if (!fetchingnodes && !stop && !syncs.empty())
                                 {
                                     for (int i=4; jsonsc.pos[i] && jsonsc.pos[i] != ']'; i++)
                                     {
@@ -4354,6 +5142,7 @@ bool MegaClient::procsc()
                                     if (stop)
                                     {
                                         // run syncdown() before continuing
+                                        performanceStats.scSyncdownYields++;
                                         applykeys();
                                         return false;
                                     }
@@ -4370,12 +5159,13 @@ bool MegaClient::procsc()
                                 dn = sc_deltree();
 
 #ifdef ENABLE_SYNC
-                                if (fetchingnodes)
+                                // deletions outside the syncs are applied along with the rest of the batch
+                                if (fetchingnodes || !affectssync(dn))
                                 {
                                     break;
                                 }
 
-                                if (dn && !memcmp(jsonsc.pos, test, 16))
+                                if (!memcmp(jsonsc.pos, test, 16))
                                 {
                                     Base64::btoa((byte *)&dn->nodehandle, sizeof(dn->nodehandle), &test2[18]);
                                     if (!memcmp(&jsonsc.pos[26], test2, 26))
@@ -4387,6 +5177,7 @@ bool MegaClient::procsc()
                                 }
 
                                 // run syncdown() to process the deletion before continuing
+                                performanceStats.scSyncdownYields++;
                                 applykeys();
                                 return false;
 #endif
@@ -4514,6 +5305,7 @@ bool MegaClient::procsc()
 #ifdef ENABLE_SYNC
                 if (!fetchingnodes && newnodes)
                 {
+                    performanceStats.scSyncdownYields++;
                     applykeys();
                     return false;
                 }
@@ -4538,6 +5330,8 @@ void MegaClient::initsc()
 
         sctable->begin();
         sctable->truncate();
+        nodesnapshotcurrent = false;
+        nodesnapshotds = 0;
 
         // 1. write current scsn
         handle tscsn;
@@ -4568,6 +5362,19 @@ void MegaClient::initsc()
             }
         }
 
+        if (complete && usenodeindex)
+        {
+            // the index was dropped along with the records
+            string t("1");
+            PaddedCBC::encrypt(rng, &t, &key);
+            complete = sctable->put(CACHEDNODEINDEX, &t);
+
+            for (node_map::iterator it = nodes.begin(); complete && it != nodes.end(); it++)
+            {
+                complete = indexnode(it->second);
+            }
+        }
+
         if (complete)
         {
             // 4. write new or modified pcrs, purge deleted pcrs
@@ -4654,9 +5461,17 @@ void MegaClient::updatesc()
             }
         }
 
+        if (complete && nodesnapshotcurrent && !nodenotify.empty())
+        {
+            // the node records are about to diverge from the snapshot
+            complete = sctable->del(CACHEDNODESNAPSHOT);
+            nodesnapshotcurrent = false;
+        }
+
         if (complete)
         {
             // 3. write new or modified nodes, purge deleted nodes
+            vector<Cacheable*> added;
             for (node_vector::iterator it = nodenotify.begin(); it != nodenotify.end(); it++)
             {
                 char base64[12];
@@ -4665,7 +5480,8 @@ void MegaClient::updatesc()
                     if ((*it)->dbid)
                     {
                         LOG_verbose << "Removing node from database: " << (Base64::btoa((byte*)&((*it)->nodehandle),MegaClient::NODEHANDLE,base64) ? base64 : "");
-                        if (!(complete = sctable->del((*it)->dbid)))
+                        if (!(complete = sctable->del((*it)->dbid))
+                                || (usenodeindex && !(complete = sctable->delnodeindex((*it)->dbid))))
                         {
                             break;
                         }
@@ -4674,12 +5490,19 @@ void MegaClient::updatesc()
                 else
                 {
                     LOG_verbose << "Adding node to database: " << (Base64::btoa((byte*)&((*it)->nodehandle),MegaClient::NODEHANDLE,base64) ? base64 : "");
-                    if (!(complete = sctable->put(CACHEDNODE, *it, &key)))
-                    {
-                        break;
-                    }
+                    added.push_back(*it);
                 }
             }
+
+            if (complete)
+            {
+                complete = sctable->putBatch(CACHEDNODE, added, &key);
+            }
+
+            for (size_t i = 0; complete && usenodeindex && i < added.size(); i++)
+            {
+                complete = indexnode(static_cast<Node*>(added[i]));
+            }
         }
 
         if (complete)
@@ -4738,9 +5561,18 @@ void MegaClient::finalizesc(bool complete)
     if (complete)
     {
         Base64::atob(scsn, (byte*)&cachedscsn, sizeof cachedscsn);
+
+        // with nodes paged out, the resident ones are not all the records
+        if (usenodesnapshot && !nodesnapshotcurrent && !pagedoutnodes
+                && (!nodesnapshotds || Waiter::ds >= nodesnapshotds + NODESNAPSHOT_INTERVAL))
+        {
+            writenodesnapshot();
+        }
     }
     else
     {
+        // what can still be read back stays in memory
+        pageinall();
         sctable->remove();
 
         LOG_err << "Cache update DB write error - disabling caching";
@@ -4751,29 +5583,735 @@ void MegaClient::finalizesc(bool complete)
     }
 }
 
-// queue node file attribute for retrieval or cancel retrieval
-error MegaClient::getfa(handle h, string *fileattrstring, const string &nodekey, fatype t, int cancel)
+// write all node records as a single blob, committed along with the other records.  The token ties it to
+// the records: if they change before the next commit, or the commit never happens, it won't be used
+bool MegaClient::writenodesnapshot()
 {
-    // locate this file attribute type in the nodes's attribute string
-    handle fah;
-    int p, pp;
+    assert(!pagedoutnodes);
 
-    // find position of file attribute or 0 if not present
-    if (!(p = Node::hasfileattribute(fileattrstring, t)))
+    handle token;
+    rng.genblock((byte*)&token, sizeof token);
+
+    string snapshot;
+    CacheableWriter w(snapshot);
+    w.serializeu32(NODESNAPSHOT_VERSION);
+    w.serializehandle(token);
+
+    string data;
+    for (node_map::iterator it = nodes.begin(); it != nodes.end(); it++)
     {
-        return API_ENOENT;
+        // same as the records: nodes that could not be serialized were not stored
+        if (it->second->dbid && it->second->serialize(&data))
+        {
+            w.serializeu32(it->second->dbid);
+            w.serializeu32(uint32_t(data.size()));
+            w.serializebinary((byte*)data.data(), data.size());
+        }
+        data.clear();
     }
 
-    pp = p - 1;
+    PaddedCBC::encrypt(rng, &snapshot, &key);
 
-    while (pp && fileattrstring->at(pp - 1) >= '0' && fileattrstring->at(pp - 1) <= '9')
+    nodesnapshotds = std::max<dstime>(Waiter::ds, 1);
+
+    string t((char*)&token, sizeof token);
+    PaddedCBC::encrypt(rng, &t, &key);
+
+    if (!sctable->putsnapshot(snapshot) || !sctable->put(CACHEDNODESNAPSHOT, &t))
     {
-        pp--;
+        sctable->del(CACHEDNODESNAPSHOT);
+        return false;
     }
 
-    if (p == pp)
+    LOG_debug << "Node snapshot written: " << nodes.size() << " nodes, " << snapshot.size() << " bytes";
+    nodesnapshotcurrent = true;
+    return true;
+}
+
+// materialise the nodes from the snapshot if it matches the node records
+bool MegaClient::readnodesnapshot(node_vector* dp)
+{
+    string t, snapshot;
+    if (pagedoutnodes || !sctable->get(CACHEDNODESNAPSHOT, &t) || !PaddedCBC::decrypt(&t, &key) || t.size() != sizeof(handle)
+            || !sctable->getsnapshot(&snapshot) || !PaddedCBC::decrypt(&snapshot, &key))
     {
-        return API_ENOENT;
+        return false;
+    }
+
+    CacheableReader r(snapshot);
+    uint32_t version;
+    handle token;
+    if (!r.unserializeu32(version) || version != NODESNAPSHOT_VERSION
+            || !r.unserializehandle(token) || token != MemAccess::get<handle>(t.data()))
+    {
+        LOG_warn << "Node snapshot does not match the node records";
+        return false;
+    }
+
+    // check the framing before creating any node, so a damaged snapshot leaves the records to be read instead
+    const char* records = r.ptr;
+    uint32_t dbid, len;
+    while (r.ptr < r.end)
+    {
+        if (!r.unserializeu32(dbid) || !r.unserializeu32(len) || len > size_t(r.end - r.ptr))
+        {
+            LOG_err << "Node snapshot is damaged";
+            return false;
+        }
+        r.ptr += len;
+    }
+
+    for (r.ptr = records; r.ptr < r.end; r.ptr += len)
+    {
+        r.unserializeu32(dbid);
+        r.unserializeu32(len);
+
+        Node* n = Node::unserialize(this, r.ptr, len, dp);
+        if (!n)
+        {
+            LOG_err << "Failed - node snapshot record read error";
+            return false;
+        }
+        n->dbid = dbid;
+    }
+
+    return true;
+}
+
+void MegaClient::setnodesnapshot(bool enable)
+{
+    usenodesnapshot = enable;
+
+    if (!enable && sctable)
+    {
+        sctable->delsnapshot();
+        nodesnapshotcurrent = false;
+    }
+}
+
+void MegaClient::setnodeindex(bool enable)
+{
+    usenodeindex = enable;
+
+    if (sctable && !fetchingnodes && !nodes.empty())
+    {
+        checknodeindex();
+    }
+}
+
+// keyed, so that the index reveals no names or fingerprints
+uint64_t MegaClient::nodeindexhash(char field, const string& value)
+{
+    if (nodeindexkey.empty())
+    {
+        static const char label[] = "node index";
+        HMACSHA256 hmac(key.key, SymmCipher::KEYLENGTH);
+        hmac.add((const byte*)label, sizeof label - 1);
+        nodeindexkey.resize(32);
+        hmac.get((byte*)nodeindexkey.data());
+    }
+
+    byte mac[32];
+    HMACSHA256 hmac((const byte*)nodeindexkey.data(), nodeindexkey.size());
+    hmac.add((const byte*)&field, 1);
+    hmac.add((const byte*)value.data(), value.size());
+    hmac.get(mac);
+
+    return MemAccess::get<uint64_t>((const char*)mac);
+}
+
+bool MegaClient::indexnode(Node* n)
+{
+    if (!n->dbid)
+    {
+        // not stored, so not indexed either
+        return true;
+    }
+
+    DbTable::NodeIndexEntry e;
+    e.nodehandle = n->nodehandle;
+    e.parenthandle = n->parent ? n->parent->nodehandle : UNDEF;
+
+    attr_map::const_iterator it = n->attrs().map.find('n');
+    e.namehash = nodeindexhash('n', it != n->attrs().map.end() ? it->second : string());
+
+    e.fingerprinthash = 0;
+    if (n->type == FILENODE && n->isvalid)
+    {
+        string fp;
+        n->serializefingerprint(&fp);
+        e.fingerprinthash = nodeindexhash('f', fp);
+    }
+
+    e.size = n->size;
+    e.mtime = n->mtime;
+    e.type = n->type;
+    return sctable->putnodeindex(n->dbid, e);
+}
+
+void MegaClient::checknodeindex()
+{
+    string t;
+    bool present = sctable->get(CACHEDNODEINDEX, &t);
+
+    if (present != usenodeindex)
+    {
+        // an index left by a session that had it enabled would miss later changes
+        sctable->dropnodeindex();
+        sctable->del(CACHEDNODEINDEX);
+
+        if (usenodeindex)
+        {
+            LOG_debug << "Building node index for " << nodes.size() << " nodes";
+            bool complete = true;
+            for (node_map::iterator it = nodes.begin(); complete && it != nodes.end(); it++)
+            {
+                complete = indexnode(it->second);
+            }
+
+            t = "1";
+            PaddedCBC::encrypt(rng, &t, &key);
+            if (!complete || !sctable->put(CACHEDNODEINDEX, &t))
+            {
+                LOG_err << "Unable to build node index";
+                sctable->dropnodeindex();
+                sctable->del(CACHEDNODEINDEX);
+                usenodeindex = false;
+            }
+        }
+    }
+}
+
+bool MegaClient::indexedchildren(handle parent, vector<handle>* result)
+{
+    return sctable && usenodeindex && sctable->querynodeindex(DbTable::INDEX_PARENT, parent, result);
+}
+
+bool MegaClient::indexedbyname(const string& name, vector<handle>* result)
+{
+    return sctable && usenodeindex && sctable->querynodeindex(DbTable::INDEX_NAMEHASH, nodeindexhash('n', name), result);
+}
+
+bool MegaClient::indexedbyfingerprint(const FileFingerprint& fingerprint, vector<handle>* result)
+{
+    if (!sctable || !usenodeindex || !fingerprint.isvalid)
+    {
+        return false;
+    }
+
+    string fp;
+    fingerprint.serializefingerprint(&fp);
+    return sctable->querynodeindex(DbTable::INDEX_FINGERPRINTHASH, nodeindexhash('f', fp), result);
+}
+
+void MegaClient::setlowmemory(size_t budgetbytes)
+{
+    lowmemorybudget = budgetbytes;
+
+    if (budgetbytes)
+    {
+        // paged-out nodes are found through the index
+        setnodeindex(true);
+    }
+    else
+    {
+        pageinall();
+        queueversions();
+    }
+}
+
+void MegaClient::setcompactversions(bool enable)
+{
+    compactversions = enable;
+    newversions.clear();
+
+    if (enable)
+    {
+        setnodeindex(true);
+        queueversions();
+    }
+    else if (!lowmemorybudget)
+    {
+        pageinall();
+    }
+}
+
+void MegaClient::queueversions()
+{
+    if (!compactversions)
+    {
+        return;
+    }
+
+    for (auto& it : nodes)
+    {
+        if (it.second->parent && it.second->parent->type == FILENODE)
+        {
+            newversions.push_back(it.first);
+        }
+    }
+}
+
+void MegaClient::setmemorybudget(size_t bytes)
+{
+    memorybudget = bytes;
+    measurememory();
+}
+
+size_t MegaClient::memoryusage(memsubsystem_t subsystem) const
+{
+    return subsystem >= 0 && subsystem < MEMORY_SUBSYSTEMS ? memoryused[subsystem] : 0;
+}
+
+void MegaClient::measurememory()
+{
+    memoryused[MEMORY_NODES] = nodes.size() * LOWMEMORY_NODEBYTES;
+
+    BufferPool::Stats pool = bufferpool->stats();
+    memoryused[MEMORY_TRANSFERBUFFERS] = pool.busyBytes + pool.idleBytes;
+
+    size_t cached = 0;
+    for (auto& it : hdrns)
+    {
+        cached += it.second->cachedbytes;
+    }
+    memoryused[MEMORY_DIRECTREADS] = cached;
+
+    // the API responses being received
+    size_t responses = 0;
+    if (pendingcs)
+    {
+        responses += pendingcs->in.capacity();
+    }
+    if (pendingsc)
+    {
+        responses += pendingsc->in.capacity();
+    }
+    for (auto& it : pipelinedcs)
+    {
+        responses += it.second->in.capacity();
+    }
+    memoryused[MEMORY_RESPONSES] = responses;
+
+    size_t total = 0;
+    for (size_t used : memoryused)
+    {
+        total += used;
+    }
+
+    mempressure_t pressure = MEMORY_PRESSURE_NONE;
+    if (memorybudget && total > memorybudget)
+    {
+        pressure = MEMORY_PRESSURE_CRITICAL;
+    }
+    else if (memorybudget && total >= memorybudget / 100 * MEMORY_MODERATE_PERCENT)
+    {
+        pressure = MEMORY_PRESSURE_MODERATE;
+    }
+
+    if (pressure != memorypressure)
+    {
+        LOG_info << "Memory pressure " << memorypressure << " -> " << pressure << ": " << total << " of " << memorybudget << " bytes";
+        memorypressure = pressure;
+        applymemorypressure();
+        app->memory_pressure(pressure);
+    }
+}
+
+void MegaClient::applymemorypressure()
+{
+    setbufferpoollimit(bufferpoollimit);
+
+    size_t limit = directreadlimit();
+    for (auto& it : hdrns)
+    {
+        it.second->trimcache(limit);
+    }
+
+    if (memorypressure == MEMORY_PRESSURE_CRITICAL)
+    {
+        // the connections close as their requests finish.  Raid downloads need all their parts
+        for (TransferSlot* slot : tslots)
+        {
+            if (slot->autoconnectable())
+            {
+                slot->targetconnections = 1;
+            }
+        }
+
+        // the uploads read and encrypt their chunks again to retry them
+        for (auto& it : transfers[PUT])
+        {
+            it.second->dropunackedchunks();
+        }
+
+        if (lowmemorybudget)
+        {
+            lowmemoryds = Waiter::ds;
+            pageoutnodes();
+        }
+    }
+}
+
+size_t MegaClient::directreadlimit() const
+{
+    return memorypressure == MEMORY_PRESSURE_NONE ? directreadcachelimit : memorypressure == MEMORY_PRESSURE_MODERATE ? directreadcachelimit / 2 : 0;
+}
+
+m_off_t MegaClient::pressurerequestsize(m_off_t requestsize) const
+{
+    return memorypressure == MEMORY_PRESSURE_NONE ? requestsize
+                : std::min(requestsize, memorypressure == MEMORY_PRESSURE_MODERATE ? MEMORY_MODERATE_REQSIZE : MEMORY_CRITICAL_REQSIZE);
+}
+
+void MegaClient::pinnode(handle h, bool pin)
+{
+    if (!pin)
+    {
+        pinnednodes.erase(h);
+        return;
+    }
+
+    pinnednodes.insert(h);
+    pageinchildren(nodebyhandle(h));
+}
+
+// only files (or versions) whose records are current and whose versions are paged out already, and nothing that
+// holds pointers to them
+bool MegaClient::pageable(Node* n)
+{
+    if (n->type != FILENODE || !n->children.empty() || !n->parent
+            || !n->dbid || n->notified || n->attrstring
+            || n->inshare || n->outshares || n->pendingshares || n->sharekey
+            || hdrns.find(n->nodehandle) != hdrns.end())
+    {
+        return false;
+    }
+
+#ifdef ENABLE_SYNC
+    if (n->localnode || n->syncget || (n->parent->type != FILENODE && n->parent->localnode)
+            || n->todebris_it != todebris.end() || n->tounlink_it != tounlink.end())
+    {
+        return false;
+    }
+
+    // syncdown() and syncup() compare whole children lists: nothing below a sync root goes
+    if (!syncs.empty())
+    {
+        for (Node* p = n->parent; p; p = p->parent)
+        {
+            if (p->localnode)
+            {
+                return false;
+            }
+        }
+    }
+#endif
+
+    if (!pinnednodes.empty())
+    {
+        for (Node* p = n; p; p = p->parent)
+        {
+            if (pinnednodes.find(p->nodehandle) != pinnednodes.end())
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// evict the least recently looked up nodes until the rest fit the budget with some room
+void MegaClient::pageoutnodes()
+{
+    if (!sctable || !usenodeindex || fetchingnodes)
+    {
+        return;
+    }
+
+    size_t keep = lowmemorybudget / LOWMEMORY_NODEBYTES * LOWMEMORY_TRIMPERCENT / 100;
+
+    vector<Node*> candidates;
+    for (node_map::iterator it = nodes.begin(); it != nodes.end(); it++)
+    {
+        if (pageable(it->second))
+        {
+            candidates.push_back(it->second);
+        }
+    }
+
+    size_t count = std::min(nodes.size() > keep ? nodes.size() - keep : 0, candidates.size());
+    if (!count)
+    {
+        return;
+    }
+
+    // oldest first, measured from the current tick so that the counter may wrap
+    uint32_t tick = nodeaccesstick;
+    std::nth_element(candidates.begin(), candidates.begin() + (count - 1), candidates.end(), [tick](const Node* a, const Node* b)
+    {
+        return uint32_t(tick - a->lastaccess) > uint32_t(tick - b->lastaccess);
+    });
+
+    pagingnodes = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        pageout(candidates[i]);
+    }
+    pagingnodes = false;
+
+    LOG_debug << "Paged out " << count << " nodes, " << nodes.size() << " resident, " << pagedoutnodes << " paged out";
+}
+
+// the node keeps counting towards its ancestors, and its paged-out versions towards it, while pagingnodes is set
+void MegaClient::pageout(Node* n)
+{
+    if (!pagedoutnodes)
+    {
+        // the snapshot is not written while nodes are paged out, and one written before would be
+        // trusted at the next start over the records: drop it rather than leave it to go stale
+        sctable->del(CACHEDNODESNAPSHOT);
+        sctable->delsnapshot();
+        nodesnapshotcurrent = false;
+    }
+
+    if (pagedcounts.find(n->nodehandle) != pagedcounts.end())
+    {
+        pagedsubtrees[n->nodehandle] = n->descendantcounts();
+    }
+
+    pagedcounts[n->parent->nodehandle]++;
+    pagedoutnodes++;
+    nodes.erase(n->nodehandle);
+    delete n;
+}
+
+// every version since the last pass, from the oldest of each chain up
+void MegaClient::pageoutversions()
+{
+    if (!sctable || !usenodeindex || fetchingnodes)
+    {
+        return;
+    }
+
+    vector<handle> queued;
+    queued.swap(newversions);
+
+    size_t count = 0;
+    pagingnodes = true;
+    for (handle h : queued)
+    {
+        node_map::iterator it = nodes.find(h);
+        if (it == nodes.end())
+        {
+            continue;
+        }
+
+        Node* n = it->second;
+        while (!n->children.empty())
+        {
+            n = n->children.back();
+        }
+
+        while (n->parent && n->parent->type == FILENODE && pageable(n))
+        {
+            Node* p = n->parent;
+            pageout(n);
+            count++;
+            n = p;
+        }
+
+        // not stored or notified yet: next time
+        if (n->parent && n->parent->type == FILENODE && (!n->dbid || n->notified))
+        {
+            newversions.push_back(n->nodehandle);
+        }
+    }
+    pagingnodes = false;
+
+    if (count)
+    {
+        LOG_debug << "Paged out " << count << " versions, " << nodes.size() << " resident, " << pagedoutnodes << " paged out";
+    }
+}
+
+Node* MegaClient::pageinnode(handle h)
+{
+    uint32_t dbid;
+    string data;
+
+    if (!sctable || !sctable->nodeindexrecord(h, &dbid))
+    {
+        return NULL;
+    }
+
+    if (!sctable->get(dbid, &data) || !PaddedCBC::decrypt(&data, &key))
+    {
+        LOG_err << "Unable to read paged-out node " << LOG_NODEHANDLE(h);
+        return NULL;
+    }
+
+    node_vector dp;
+    pagingnodes = true;
+    Node* n = Node::unserialize(this, &data, &dp);
+
+    if (n && !n->parent && nodes.find(n->parenthandle) == nodes.end() && pagedcounts.find(n->parenthandle) != pagedcounts.end())
+    {
+        // an older version below a paged-out one: the newer one comes back first
+        handle ph = n->parenthandle;
+        nodes.erase(h);
+        delete n;
+        pagingnodes = false;
+        return pageinnode(ph) ? pageinnode(h) : NULL;
+    }
+
+    // its parent stayed resident and accounts for it
+    map<handle, size_t>::iterator it = pagedcounts.end();
+    if (n && n->parent)
+    {
+        it = pagedcounts.find(n->parent->nodehandle);
+    }
+
+    if (it == pagedcounts.end())
+    {
+        LOG_err << "Paged-out node " << LOG_NODEHANDLE(h) << " can't be restored";
+        if (n)
+        {
+            nodes.erase(h);
+            delete n;
+        }
+        pagingnodes = false;
+        return NULL;
+    }
+
+    pagingnodes = false;
+
+    n->dbid = dbid;
+    n->lastaccess = ++nodeaccesstick;
+
+    auto below = pagedsubtrees.find(h);
+    if (below != pagedsubtrees.end())
+    {
+        n->restoredescendantcounts(below->second);
+        pagedsubtrees.erase(below);
+    }
+
+    if (!--it->second)
+    {
+        pagedcounts.erase(it);
+    }
+    pagedoutnodes--;
+
+    return n;
+}
+
+void MegaClient::pageinchildren(Node* p)
+{
+    if (!pagedoutnodes || !p || pagedcounts.find(p->nodehandle) == pagedcounts.end())
+    {
+        return;
+    }
+
+    vector<handle> children;
+    if (!indexedchildren(p->nodehandle, &children))
+    {
+        LOG_err << "Unable to page in the children of " << LOG_NODEHANDLE(p->nodehandle);
+        return;
+    }
+
+    for (handle h : children)
+    {
+        if (nodes.find(h) == nodes.end())
+        {
+            pageinnode(h);
+        }
+    }
+}
+
+void MegaClient::pageinsubtree(Node* p)
+{
+    if (!pagedoutnodes || !p)
+    {
+        return;
+    }
+
+    vector<Node*> folders(1, p);
+    while (!folders.empty() && pagedoutnodes)
+    {
+        Node* n = folders.back();
+        folders.pop_back();
+
+        pageinchildren(n);
+        for (Node* child : n->children)
+        {
+            if (child->type != FILENODE)
+            {
+                folders.push_back(child);
+            }
+        }
+    }
+}
+
+size_t MegaClient::pagedchildren(handle h) const
+{
+    map<handle, size_t>::const_iterator it = pagedcounts.find(h);
+    return it == pagedcounts.end() ? 0 : it->second;
+}
+
+void MegaClient::pageinall()
+{
+    // versions below paged-out versions come back in later rounds
+    size_t before;
+    do
+    {
+        before = pagedoutnodes;
+
+        vector<handle> parents;
+        for (auto& it : pagedcounts)
+        {
+            parents.push_back(it.first);
+        }
+
+        for (handle h : parents)
+        {
+            node_map::iterator it = nodes.find(h);
+            if (it != nodes.end())
+            {
+                pageinchildren(it->second);
+            }
+        }
+    } while (pagedoutnodes && pagedoutnodes < before);
+
+    if (pagedoutnodes)
+    {
+        LOG_err << pagedoutnodes << " nodes could not be paged in";
+    }
+}
+
+// queue node file attribute for retrieval or cancel retrieval
+error MegaClient::getfa(handle h, string *fileattrstring, const string &nodekey, fatype t, int cancel)
+{
+    // locate this file attribute type in the nodes's attribute string
+    handle fah;
+    int p, pp;
+
+    // find position of file attribute or 0 if not present
+    if (!(p = Node::hasfileattribute(fileattrstring, t)))
+    {
+        return API_ENOENT;
+    }
+
+    pp = p - 1;
+
+    while (pp && fileattrstring->at(pp - 1) >= '0' && fileattrstring->at(pp - 1) <= '9')
+    {
+        pp--;
+    }
+
+    if (p == pp)
+    {
+        return API_ENOENT;
     }
 
     if (Base64::atob(strchr(fileattrstring->c_str() + p, '*') + 1, (byte*)&fah, sizeof(fah)) != sizeof(fah))
@@ -4786,6 +6324,15 @@ error MegaClient::getfa(handle h, string *fileattrstring, const string &nodekey,
     if (cancel)
     {
         // cancel pending request
+        for (auto it = cachedfas.begin(); it != cachedfas.end(); it++)
+        {
+            if (it->first.nodehandle == h && it->first.type == t)
+            {
+                cachedfas.erase(it);
+                return API_OK;
+            }
+        }
+
         fafc_map::iterator cit;
 
         if ((cit = fafcs.find(c)) != fafcs.end())
@@ -4814,6 +6361,24 @@ error MegaClient::getfa(handle h, string *fileattrstring, const string &nodekey,
     }
     else
     {
+        if (facache)
+        {
+            string data;
+            if (!reqtag)
+            {
+                // prefetching: nothing to do if it's cached already
+                if (facache->contains(h, t, fah))
+                {
+                    return API_EEXIST;
+                }
+            }
+            else if (facache->get(h, t, fah, &data))
+            {
+                cachedfas.push_back(std::make_pair(FileAttributeFetch(h, nodekey, t, reqtag), std::move(data)));
+                return API_OK;
+            }
+        }
+
         // add file attribute cluster channel and set cluster reference node handle
         FileAttributeFetchChannel** fafcp = &fafcs[c];
 
@@ -4833,6 +6398,11 @@ error MegaClient::getfa(handle h, string *fileattrstring, const string &nodekey,
             {
                 *fafp = new FileAttributeFetch(h, nodekey, t, reqtag);
             }
+            else if (!(*fafp)->tag)
+            {
+                // prefetched: the request takes it over
+                (*fafp)->tag = reqtag;
+            }
             else
             {
                 restag = (*fafp)->tag;
@@ -4842,6 +6412,12 @@ error MegaClient::getfa(handle h, string *fileattrstring, const string &nodekey,
         else
         {
             FileAttributeFetch** fafp = &(*fafcp)->fafs[1][fah];
+            if (!(*fafp)->tag)
+            {
+                (*fafp)->tag = reqtag;
+                return API_OK;
+            }
+
             restag = (*fafp)->tag;
             return API_EEXIST;
         }
@@ -4850,7 +6426,159 @@ error MegaClient::getfa(handle h, string *fileattrstring, const string &nodekey,
     }
 }
 
+int MegaClient::prefetchfa(const vector<handle>& handles, fatype t)
+{
+    if (!facache)
+    {
+        return 0;
+    }
+
+    int queued = 0;
+    int creqtag = reqtag;
+    reqtag = 0;
+
+    for (handle h : handles)
+    {
+        Node* n = nodebyhandle(h);
+        if (!n || n->type != FILENODE || !Node::hasfileattribute(&n->fileattrstring, t))
+        {
+            continue;
+        }
+
+        if (getfa(h, &n->fileattrstring, n->nodekey(), t) == API_OK)
+        {
+            queued++;
+        }
+    }
+
+    reqtag = creqtag;
+    return queued;
+}
+
+int MegaClient::cancelprefetchfa(const vector<handle>& handles, fatype t)
+{
+    handle_set cancelled(handles.begin(), handles.end());
+    int dropped = 0;
+
+    for (auto& channel : fafcs)
+    {
+        faf_map& fresh = channel.second->fafs[0];
+        for (faf_map::iterator it = fresh.begin(); it != fresh.end(); )
+        {
+            if (!it->second->tag && it->second->type == t && cancelled.count(it->second->nodehandle))
+            {
+                delete it->second;
+                fresh.erase(it++);
+                dropped++;
+            }
+            else
+            {
+                it++;
+            }
+        }
+    }
+
+    return dropped;
+}
+
 // build pending attribute string for this handle and remove
+int MegaClient::takefileattributes(Transfer* t, FileAccess* fa)
+{
+    if (!reusefileattributes || !t->isvalid || !t->size || t->size > MAXFAREUSESIZE || !t->chunkmacs.empty())
+    {
+        return -1;
+    }
+
+    Node* same = nullptr;
+    std::unique_ptr<node_vector> nodes(nodesbyfingerprint(t));
+    for (Node* n : *nodes)
+    {
+        if (n->type == FILENODE && n->keyApplied() && n->nodekey().size() == FILENODEKEYLENGTH && n->fileattrstring.size())
+        {
+            same = n;
+            break;
+        }
+    }
+
+    if (!same)
+    {
+        return -1;
+    }
+
+    // the fingerprint samples the file: it's the same content if it has the MAC of the node, with its key
+    const byte* k = (const byte*)same->nodekey().data();
+    byte key[SymmCipher::KEYLENGTH];
+    memcpy(key, k, sizeof key);
+    SymmCipher::xorblock(k + SymmCipher::KEYLENGTH, key);
+    int64_t ctriv = MemAccess::get<int64_t>((const char*)k + SymmCipher::KEYLENGTH);
+    int64_t metamac = MemAccess::get<int64_t>((const char*)k + SymmCipher::KEYLENGTH + sizeof(int64_t));
+
+    if (!fa->openf())
+    {
+        return -1;
+    }
+
+    SymmCipher cipher;
+    cipher.setkey(key);
+    chunkmac_map macs;
+    std::vector<byte> buf;
+    bool read = true;
+    for (m_off_t pos = 0; read && pos < t->size; pos = ChunkedHash::chunkceil(pos, t->size))
+    {
+        unsigned len = unsigned(ChunkedHash::chunkceil(pos, t->size) - pos);
+        buf.assign((len + SymmCipher::BLOCKSIZE - 1) & -SymmCipher::BLOCKSIZE, 0);
+        read = fa->frawread(buf.data(), len, pos, true);
+
+        ChunkMAC& chunkmac = macs[pos];
+        chunkmac.finished = true;
+        cipher.ctr_crypt(buf.data(), len, pos, ctriv, chunkmac.mac, true);
+    }
+    fa->closef();
+
+    if (!read)
+    {
+        return -1;
+    }
+
+    if (macs.macsmac(&cipher) != metamac)
+    {
+        LOG_debug << "Upload with the fingerprint of a node, but not its content";
+        return -1;
+    }
+
+    memcpy(t->transferkey, key, sizeof key);
+    t->ctriv = ctriv;
+
+    // the attributes are in the clusters they were stored in: putnodes only takes their types and handles
+    string& reused = reusedfa[t->uploadhandle];
+    reused.clear();
+    for (size_t pos = 0; pos < same->fileattrstring.size(); )
+    {
+        size_t end = same->fileattrstring.find('/', pos);
+        if (end == string::npos)
+        {
+            end = same->fileattrstring.size();
+        }
+
+        size_t colon = same->fileattrstring.find(':', pos);
+        if (colon < end)
+        {
+            if (reused.size())
+            {
+                reused.append("/");
+            }
+            reused.append(same->fileattrstring, colon + 1, end - colon - 1);
+        }
+        pos = end + 1;
+    }
+
+    t->reusedmedia = same->hasfileattribute(fa_media) != 0;
+    LOG_debug << "Upload takes the key and the file attributes of " << Base64Str<MegaClient::NODEHANDLE>(same->nodehandle) << ": " << reused;
+
+    return (same->hasfileattribute(GfxProc::THUMBNAIL) ? 0 : 1 << GfxProc::THUMBNAIL)
+         | (same->hasfileattribute(GfxProc::PREVIEW) ? 0 : 1 << GfxProc::PREVIEW);
+}
+
 void MegaClient::pendingattrstring(handle h, string* fa)
 {
     char buf[128];
@@ -4867,6 +6595,17 @@ void MegaClient::pendingattrstring(handle h, string* fa)
         }
         pendingfa.erase(it++);
     }
+
+    auto it = reusedfa.find(h);
+    if (it != reusedfa.end())
+    {
+        if (fa->size() && it->second.size())
+        {
+            fa->append("/");
+        }
+        fa->append(it->second);
+        reusedfa.erase(it);
+    }
 }
 
 // attach file attribute to a file (th can be upload or node handle)
@@ -4878,20 +6617,79 @@ void MegaClient::putfa(handle th, fatype t, SymmCipher* key, std::unique_ptr<str
     key->cbc_encrypt((byte*)data->data(), data->size());
 
     queuedfa.push_back(new HttpReqCommandPutFA(this, th, t, std::move(data), checkAccess));
+    queuedfabytes += queuedfa.back()->datasize();
     LOG_debug << "File attribute added to queue - " << th << " : " << queuedfa.size() << " queued, " << activefa.size() << " active";
 
-    // no other file attribute storage request currently in progress? POST this one.
-    while (activefa.size() < MAXPUTFA && queuedfa.size())
+    // room for more file attribute storage requests? POST this one.
+    dispatchputfa();
+}
+
+// the ufa commands go out in the same batch, then each attribute is posted to its server
+// independently of the file uploads
+void MegaClient::dispatchputfa()
+{
+    while (queuedfa.size() && int(activefa.size()) < putfaconcurrency.limit())
     {
         putfa_list::iterator curfa = queuedfa.begin();
         HttpReqCommandPutFA *fa = *curfa;
         queuedfa.erase(curfa);
+        queuedfabytes -= fa->datasize();
         activefa.push_back(fa);
+
+        LOG_debug << "Adding file attribute to the request queue";
         fa->status = REQ_INFLIGHT;
+        fa->sent = Waiter::ds;
         reqs.add(fa);
     }
 }
 
+bool MegaClient::partialdownloadname(Transfer* t, string* localname)
+{
+    if (!resumepartialdownloads || t->type != GET || t->files.empty() || ISUNDEF(t->files.front()->h))
+    {
+        return false;
+    }
+
+    char buf[12];
+    Base64::btoa((byte*)&t->files.front()->h, NODEHANDLE, buf);
+    *localname = string(".getxfer.") + buf + "." + std::to_string(t->size) + ".mega";
+    fsaccess->name2local(localname);
+    return true;
+}
+
+bool MegaClient::resumepartialdownload(Transfer* t)
+{
+    if (!t->partialcheck)
+    {
+        // most downloads have nothing to resume: the threads are only for a file with a chunk at least
+        auto fa = fsaccess->newfileaccess();
+        if (!fa->fopen(&t->localfilename, true, false) || fa->size < ChunkedHash::chunkceil(0, t->size))
+        {
+            t->partialchecked = true;
+            return true;
+        }
+
+        unsigned threads = std::min(WorkerPool::get().parallelism(WorkerPool::WORK_FILES), PARTIALCHECK_THREADS);
+        LOG_debug << "Checking the partial file of a download: " << fa->size << " of " << t->size << " bytes";
+        t->partialcheck = new PartialDownloadCheck(fsaccess, t->localfilename, t->size, t->transferkey, t->ctriv, threads, waiter);
+        partialchecks++;
+    }
+
+    if (!t->partialcheck->finished())
+    {
+        return false;
+    }
+
+    m_off_t end = t->partialcheck->take(&t->chunkmacs);
+    delete t->partialcheck;
+    t->partialcheck = nullptr;
+    t->partialchecked = true;
+    partialchecks--;
+
+    LOG_debug << "Resuming a download from its partial file at " << end;
+    return true;
+}
+
 // has the limit of concurrent transfer tslots been reached?
 bool MegaClient::slotavail() const
 {
@@ -4948,12 +6746,13 @@ error MegaClient::smsverificationcheck(const std::string &verificationCode)
 }
 
 // server-client node update processing
-void MegaClient::sc_updatenode()
+Node* MegaClient::sc_updatenode()
 {
     handle h = UNDEF;
     handle u = 0;
     const char* a = NULL;
     m_time_t ts = -1;
+    Node* n = NULL;
 
     for (;;)
     {
@@ -4978,7 +6777,6 @@ void MegaClient::sc_updatenode()
             case EOO:
                 if (!ISUNDEF(h))
                 {
-                    Node* n;
                     bool notify = false;
 
                     if ((n = nodebyhandle(h)))
@@ -5003,7 +6801,7 @@ void MegaClient::sc_updatenode()
 
                         if (ts != -1 && n->ctime != ts)
                         {
-                            n->ctime = ts;
+                            n->setctime(ts);
                             n->changed.ctime = true;
                             notify = true;
                         }
@@ -5017,12 +6815,12 @@ void MegaClient::sc_updatenode()
                         }
                     }
                 }
-                return;
+                return n;
 
             default:
                 if (!jsonsc.storeobject())
                 {
-                    return;
+                    return NULL;
                 }
         }
     }
@@ -5467,10 +7265,11 @@ void MegaClient::sc_userattr()
     handle uh = UNDEF;
     User *u = NULL;
 
-    string ua, uav;
-    string_vector ualist;    // stores attribute names
-    string_vector uavlist;   // stores attribute versions
-    string_vector::const_iterator itua, ituav;
+    // both point into the action packet, which outlives them
+    JSONView ua, uav;
+    vector<JSONView> ualist;    // stores attribute names
+    vector<JSONView> uavlist;   // stores attribute versions
+    vector<JSONView>::const_iterator itua, ituav;
 
     for (;;)
     {
@@ -5483,7 +7282,7 @@ void MegaClient::sc_userattr()
             case MAKENAMEID2('u', 'a'):
                 if (jsonsc.enterarray())
                 {
-                    while (jsonsc.storeobject(&ua))
+                    while (jsonsc.storeobjectView(&ua))
                     {
                         ualist.push_back(ua);
                     }
@@ -5494,7 +7293,7 @@ void MegaClient::sc_userattr()
             case 'v':
                 if (jsonsc.enterarray())
                 {
-                    while (jsonsc.storeobject(&uav))
+                    while (jsonsc.storeobjectView(&uav))
                     {
                         uavlist.push_back(uav);
                     }
@@ -5520,11 +7319,11 @@ void MegaClient::sc_userattr()
                          itua != ualist.end();
                          itua++, ituav++)
                     {
-                        attr_t type = User::string2attr(itua->c_str());
+                        attr_t type = User::string2attr(itua->str().c_str());
                         const string *cacheduav = u->getattrversion(type);
                         if (cacheduav)
                         {
-                            if (*cacheduav != *ituav)
+                            if (!ituav->equals(*cacheduav))
                             {
                                 u->invalidateattr(type);
                                 switch(type)
@@ -6335,14 +8134,14 @@ void MegaClient::sc_chatnode()
                     TextChat *chat = it->second;
                     if (r)  // access revoked
                     {
-                        if(!chat->setNodeUserAccess(h, uh, true))
+                        if(!setattachmentaccess(chat, h, uh, true))
                         {
                             LOG_err << "Unknown user/node at revoke access to attachment";
                         }
                     }
                     else    // access granted
                     {
-                        chat->setNodeUserAccess(h, uh);
+                        setattachmentaccess(chat, h, uh);
                     }
 
                     chat->setTag(0);    // external change
@@ -6551,13 +8350,15 @@ void MegaClient::notifypurge(void)
         // update LocalNode <-> Node associations
         for (sync_list::iterator it = syncs.begin(); it != syncs.end(); it++)
         {
-            (*it)->cachenodes();
+            (*it)->cachenodes(true);
         }
 #endif
     }
 
     if ((t = int(nodenotify.size())))
     {
+        sharednodeviewdirty = !sharednodeviewpath.empty();
+
 #ifdef ENABLE_SYNC
         // check for deleted syncs
         for (sync_list::iterator it = syncs.begin(); it != syncs.end(); it++)
@@ -6571,7 +8372,8 @@ void MegaClient::notifypurge(void)
 #endif
         applykeys();
 
-        if (!fetchingnodes)
+        // catching up from the cache, every node is notified once current
+        if (!fetchingnodes && statecurrent)
         {
             app->nodes_updated(&nodenotify[0], t);
         }
@@ -6715,6 +8517,20 @@ void MegaClient::notifypurge(void)
     totalNodes = nodes.size();
 }
 
+long long MegaClient::bytespernode() const
+{
+    if (nodes.empty())
+    {
+        return 0;
+    }
+
+    // the pools serve the nodes of every client in the process, so charge each node with their
+    // process-wide average, plus this client's own node table
+    size_t pooled = std::max(Node::pooledNodes(), nodes.size());
+    size_t bytes = Node::poolBytes() / pooled + nodes.capacity() * sizeof(node_map::value_type) / nodes.size();
+    return (long long)bytes;
+}
+
 // return node pointer derived from node handle
 Node* MegaClient::nodebyhandle(handle h)
 {
@@ -6722,12 +8538,28 @@ Node* MegaClient::nodebyhandle(handle h)
 
     if ((it = nodes.find(h)) != nodes.end())
     {
+        if (lowmemorybudget)
+        {
+            it->second->lastaccess = ++nodeaccesstick;
+        }
         return it->second;
     }
 
+    // low-memory mode: the node may be in the state cache only
+    if (pagedoutnodes && !pagingnodes)
+    {
+        return pageinnode(h);
+    }
+
     return NULL;
 }
 
+Node* MegaClient::residentnodebyhandle(handle h) const
+{
+    auto it = nodes.find(h);
+    return it != nodes.end() ? it->second : NULL;
+}
+
 // server-client deletion
 Node* MegaClient::sc_deltree()
 {
@@ -6857,13 +8689,81 @@ void MegaClient::putnodes_prepareOneFolder(NewNode* newnode, std::string foldern
     fsaccess->normalize(&foldername);
     attrs.map['n'] = foldername;
 
-    // JSON-encode object and encrypt attribute string
-    attrs.getjson(&attrstring);
-    newnode->attrstring.reset(new string);
-    makeattr(&tmpnodecipher, newnode->attrstring, attrstring.c_str());
+    // JSON-encode object and encrypt attribute string
+    attrs.getjson(&attrstring);
+    newnode->attrstring.reset(new string);
+    makeattr(&tmpnodecipher, newnode->attrstring, attrstring.c_str());
+}
+
+// send new nodes to API for processing
+void MegaClient::setputnodesbatch(unsigned maxfiles)
+{
+    // pending batches were sized for the previous limit
+    while (!putnodesbatches.empty())
+    {
+        sendputnodesbatch(putnodesbatches.begin()->first);
+    }
+    putnodesbatchsize = std::max(maxfiles, 1u);
+}
+
+void MegaClient::putnodesbatched(handle th, NewNode* newnode, int tag)
+{
+    PutnodesBatch& batch = putnodesbatches[th];
+    if (!batch.nodes)
+    {
+        batch.nodes = new NewNode[putnodesbatchsize];
+        batch.since = Waiter::ds;
+    }
+
+    batch.nodes[batch.tags.size()].take(*newnode);
+    batch.tags.push_back(tag);
+    delete [] newnode;
+
+    if (batch.tags.size() >= putnodesbatchsize)
+    {
+        sendputnodesbatch(th);
+    }
+}
+
+void MegaClient::sendputnodesbatch(handle th)
+{
+    auto it = putnodesbatches.find(th);
+    PutnodesBatch& batch = it->second;
+
+    LOG_debug << "Sending putnodes for " << batch.tags.size() << " uploads";
+    CommandPutNodes* command = new CommandPutNodes(this, th, NULL, batch.nodes, int(batch.tags.size()), batch.tags.front(), PUTNODES_APP);
+    command->batchtags.swap(batch.tags);
+    putnodesbatches.erase(it);
+    reqs.add(command);
+}
+
+void MegaClient::sendputnodesbatches()
+{
+    // with no upload left that could join them, batches are not kept waiting
+    bool uploading = !transfers[PUT].empty() || !faputcompletion.empty();
+
+    for (auto it = putnodesbatches.begin(); it != putnodesbatches.end(); )
+    {
+        handle th = it->first;
+        bool due = !uploading || Waiter::ds >= it->second.since + PUTNODES_BATCH_DELAY;
+        ++it;
+
+        if (due)
+        {
+            sendputnodesbatch(th);
+        }
+    }
+}
+
+void MegaClient::clearputnodesbatches()
+{
+    for (auto& batch : putnodesbatches)
+    {
+        delete [] batch.second.nodes;
+    }
+    putnodesbatches.clear();
 }
 
-// send new nodes to API for processing
 void MegaClient::putnodes(handle h, NewNode* newnodes, int numnodes, const char *cauth, Transfer *t)
 {
     reqs.add(new CommandPutNodes(this, h, NULL, newnodes, numnodes, reqtag, PUTNODES_APP, cauth, t));
@@ -7022,10 +8922,10 @@ error MegaClient::rename(Node* n, Node* p, syncdel_t syncdel, handle prevparent,
                 // deleted node
                 char base64Handle[12];
                 Base64::btoa((byte*)&prevParent->nodehandle, MegaClient::NODEHANDLE, base64Handle);
-                if (strcmp(base64Handle, n->attrs.map[rrname].c_str()))
+                if (strcmp(base64Handle, n->attrs().map[rrname].c_str()))
                 {
                     LOG_debug << "Adding rr attribute";
-                    n->attrs.map[rrname] = base64Handle;
+                    n->attrs().map[rrname] = base64Handle;
                     updateNodeAttributes = true;
                 }
             }
@@ -7033,11 +8933,11 @@ error MegaClient::rename(Node* n, Node* p, syncdel_t syncdel, handle prevparent,
                      && newRoot->nodehandle != rubbishHandle)
             {
                 // undeleted node
-                attr_map::iterator it = n->attrs.map.find(rrname);
-                if (it != n->attrs.map.end())
+                attr_map::iterator it = n->attrs().map.find(rrname);
+                if (it != n->attrs().map.end())
                 {
                     LOG_debug << "Removing rr attribute";
-                    n->attrs.map.erase(it);
+                    n->attrs().map.erase(it);
                     updateNodeAttributes = true;
                 }
             }
@@ -7047,7 +8947,7 @@ error MegaClient::rename(Node* n, Node* p, syncdel_t syncdel, handle prevparent,
         {
             string name(newName);
             fsaccess->normalize(&name);
-            n->attrs.map['n'] = name;
+            n->attrs().map['n'] = name;
             updateNodeAttributes = true;
         }
 
@@ -7084,6 +8984,7 @@ error MegaClient::unlink(Node* n, bool keepversions)
     if (kv)
     {
         Node *newerversion = n->parent;
+        pageinchildren(n);
         if (n->children.size())
         {
             Node *olderversion = n->children.back();
@@ -7275,311 +9176,586 @@ int MegaClient::readnodes(JSON* j, int notify, putsource_t source, NewNode* nn,
     }
 
     node_vector dp;
-    Node* n;
 
     while (j->enterobject())
     {
-        handle h = UNDEF, ph = UNDEF;
-        handle u = 0, su = UNDEF;
-        nodetype_t t = TYPE_UNKNOWN;
-        const char* a = NULL;
-        const char* k = NULL;
-        const char* fa = NULL;
-        const char *sk = NULL;
-        accesslevel_t rl = ACCESS_UNKNOWN;
-        m_off_t s = NEVER;
-        m_time_t ts = -1, sts = -1;
-        nameid name;
-        int nni = -1;
+        if (!readnode(j, notify, source, nn, nnsize, tag, applykeys, &dp))
+        {
+            return 0;
+        }
+    }
 
-        while ((name = j->getnameid()) != EOO)
+    setorphanparents(&dp);
+
+    return j->leavearray();
+}
+
+// read a single (already entered) node object - child nodes that arrive before their parent are added to dp
+bool MegaClient::readnode(JSON* j, int notify, putsource_t source, NewNode* nn, int nnsize, int tag, bool applykeys, node_vector* dp)
+{
+    Node* n;
+
+    handle h = UNDEF, ph = UNDEF;
+    handle u = 0, su = UNDEF;
+    nodetype_t t = TYPE_UNKNOWN;
+    JSONView a, fa;
+    const char* k = NULL;
+    const char *sk = NULL;
+    accesslevel_t rl = ACCESS_UNKNOWN;
+    m_off_t s = NEVER;
+    m_time_t ts = -1, sts = -1;
+    nameid name;
+    int nni = -1;
+
+    while ((name = j->getnameid()) != EOO)
+    {
+        switch (name)
         {
-            switch (name)
-            {
-                case 'h':   // new node: handle
-                    h = j->gethandle();
-                    break;
+            case 'h':   // new node: handle
+                h = j->gethandle();
+                break;
 
-                case 'p':   // parent node
-                    ph = j->gethandle();
-                    break;
+            case 'p':   // parent node
+                ph = j->gethandle();
+                break;
 
-                case 'u':   // owner user
-                    u = j->gethandle(USERHANDLE);
-                    break;
+            case 'u':   // owner user
+                u = j->gethandle(USERHANDLE);
+                break;
 
-                case 't':   // type
-                    t = (nodetype_t)j->getint();
-                    break;
+            case 't':   // type
+                t = (nodetype_t)j->getint();
+                break;
 
-                case 'a':   // attributes
-                    a = j->getvalue();
-                    break;
+            case 'a':   // attributes
+                a = j->getvalueView();
+                break;
 
-                case 'k':   // key(s)
-                    k = j->getvalue();
-                    break;
+            case 'k':   // key(s)
+                k = j->getvalue();
+                break;
 
-                case 's':   // file size
-                    s = j->getint();
-                    break;
+            case 's':   // file size
+                s = j->getint();
+                break;
 
-                case 'i':   // related source NewNode index
-                    nni = int(j->getint());
-                    break;
+            case 'i':   // related source NewNode index
+                nni = int(j->getint());
+                break;
 
-                case MAKENAMEID2('t', 's'):  // actual creation timestamp
-                    ts = j->getint();
-                    break;
+            case MAKENAMEID2('t', 's'):  // actual creation timestamp
+                ts = j->getint();
+                break;
 
-                case MAKENAMEID2('f', 'a'):  // file attributes
-                    fa = j->getvalue();
-                    break;
+            case MAKENAMEID2('f', 'a'):  // file attributes
+                fa = j->getvalueView();
+                break;
 
-                    // inbound share attributes
-                case 'r':   // share access level
-                    rl = (accesslevel_t)j->getint();
-                    break;
+                // inbound share attributes
+            case 'r':   // share access level
+                rl = (accesslevel_t)j->getint();
+                break;
 
-                case MAKENAMEID2('s', 'k'):  // share key
-                    sk = j->getvalue();
-                    break;
+            case MAKENAMEID2('s', 'k'):  // share key
+                sk = j->getvalue();
+                break;
 
-                case MAKENAMEID2('s', 'u'):  // sharing user
-                    su = j->gethandle(USERHANDLE);
-                    break;
+            case MAKENAMEID2('s', 'u'):  // sharing user
+                su = j->gethandle(USERHANDLE);
+                break;
 
-                case MAKENAMEID3('s', 't', 's'):  // share timestamp
-                    sts = j->getint();
-                    break;
+            case MAKENAMEID3('s', 't', 's'):  // share timestamp
+                sts = j->getint();
+                break;
 
-                default:
-                    if (!j->storeobject())
-                    {
-                        return 0;
-                    }
-            }
+            default:
+                if (!j->storeobject())
+                {
+                    return false;
+                }
         }
+    }
 
-        if (ISUNDEF(h))
+    if (ISUNDEF(h))
+    {
+        warn("Missing node handle");
+    }
+    else
+    {
+        if (t == TYPE_UNKNOWN)
         {
-            warn("Missing node handle");
+            warn("Unknown node type");
         }
-        else
+        else if (t == FILENODE || t == FOLDERNODE)
+        {
+            if (ISUNDEF(ph))
+            {
+                warn("Missing parent");
+            }
+            else if (!a.data)
+            {
+                warn("Missing node attributes");
+            }
+            else if (!k)
+            {
+                warn("Missing node key");
+            }
+
+            if (t == FILENODE && ISUNDEF(s))
+            {
+                warn("File node without file size");
+            }
+        }
+    }
+
+    if (fa.data && t != FILENODE)
+    {
+        warn("Spurious file attributes");
+    }
+
+    if (!warnlevel())
+    {
+        if ((n = nodebyhandle(h)))
         {
-            if (t == TYPE_UNKNOWN)
+            Node* p = NULL;
+            if (!ISUNDEF(ph))
             {
-                warn("Unknown node type");
+                p = nodebyhandle(ph);
             }
-            else if (t == FILENODE || t == FOLDERNODE)
+
+            if (n->changed.removed)
             {
-                if (ISUNDEF(ph))
+                if (!nodescope.empty() && !fetchingnodes && !ISUNDEF(ph) && (!p || p->changed.removed || !innodescope(p)))
                 {
-                    warn("Missing parent");
+                    // moved out of the scope of the session: let it go
+                    return true;
                 }
-                else if (!a)
+
+                // node marked for deletion is being resurrected, possibly
+                // with a new parent (server-client move operation)
+                n->changed.removed = false;
+            }
+            else
+            {
+                // node already present - check for race condition
+                if ((n->parent && ph != n->parent->nodehandle && p &&  p->type != FILENODE) || n->type != t)
                 {
-                    warn("Missing node attributes");
+                    app->reload("Node inconsistency");
+
+                    static bool reloadnotified = false;
+                    if (!reloadnotified)
+                    {
+                        sendevent(99437, "Node inconsistency", 0);
+                        reloadnotified = true;
+                    }
                 }
-                else if (!k)
+            }
+
+            if (!ISUNDEF(ph))
+            {
+                if (p)
                 {
-                    warn("Missing node key");
+                    n->setparent(p);
+                    n->changed.parent = true;
                 }
-
-                if (t == FILENODE && ISUNDEF(s))
+                else
                 {
-                    warn("File node without file size");
+                    n->setparent(NULL);
+                    n->parenthandle = ph;
+                    dp->push_back(n);
                 }
             }
-        }
 
-        if (fa && t != FILENODE)
+            if (a.data && k && n->attrstring)
+            {
+                LOG_warn << "Updating the key of a NO_KEY node";
+                n->attrstring->assign(a.data, a.size);
+                n->setkeyfromjson(k);
+            }
+        }
+        else if (!ISUNDEF(folderlinksubtree) && h != folderlinksubtree && !nodebyhandle(ph))
         {
-            warn("Spurious file attributes");
+            // outside of the requested folder of the link: never materialised
+            return true;
         }
-
-        if (!warnlevel())
+        else if (!nodescope.empty() && !nn && !readnodeinscope(h, ph, t, su))
         {
-            if ((n = nodebyhandle(h)))
+            // outside of the scope of the session
+            return true;
+        }
+        else
+        {
+            byte buf[SymmCipher::KEYLENGTH];
+
+            if (!ISUNDEF(su))
             {
-                Node* p = NULL;
-                if (!ISUNDEF(ph))
+                if (t != FOLDERNODE)
                 {
-                    p = nodebyhandle(ph);
+                    warn("Invalid share node type");
                 }
 
-                if (n->changed.removed)
+                if (rl == ACCESS_UNKNOWN)
                 {
-                    // node marked for deletion is being resurrected, possibly
-                    // with a new parent (server-client move operation)
-                    n->changed.removed = false;
+                    warn("Missing access level");
                 }
-                else
-                {
-                    // node already present - check for race condition
-                    if ((n->parent && ph != n->parent->nodehandle && p &&  p->type != FILENODE) || n->type != t)
-                    {
-                        app->reload("Node inconsistency");
 
-                        static bool reloadnotified = false;
-                        if (!reloadnotified)
-                        {
-                            sendevent(99437, "Node inconsistency", 0);
-                            reloadnotified = true;
-                        }
-                    }
+                if (!sk)
+                {
+                    LOG_warn << "Missing share key for inbound share";
                 }
 
-                if (!ISUNDEF(ph))
+                if (warnlevel())
                 {
-                    if (p)
-                    {
-                        n->setparent(p);
-                        n->changed.parent = true;
-                    }
-                    else
+                    su = UNDEF;
+                }
+                else
+                {
+                    if (sk)
                     {
-                        n->setparent(NULL);
-                        n->parenthandle = ph;
-                        dp.push_back(n);
+                        decryptkey(sk, buf, sizeof buf, &key, 1, h);
                     }
                 }
+            }
 
-                if (a && k && n->attrstring)
-                {
-                    LOG_warn << "Updating the key of a NO_KEY node";
-                    Node::copystring(n->attrstring.get(), a);
-                    n->setkeyfromjson(k);
-                }
+            // fallback timestamps
+            if (!(ts + 1))
+            {
+                ts = m_time();
             }
-            else
+
+            if (!(sts + 1))
+            {
+                sts = ts;
+            }
+
+            n = new Node(this, dp, h, ph, t, s, u, NULL, ts);
+            n->fileattrstring.assign(fa.data ? fa.data : "", fa.size);
+            n->changed.newnode = true;
+
+            n->tag = tag;
+
+            n->attrstring.reset(new string(a.data ? a.data : "", a.size));
+            n->setkeyfromjson(k);
+
+            if (!ISUNDEF(su))
+            {
+                newshares.push_back(new NewShare(h, 0, su, rl, sts, sk ? buf : NULL));
+            }
+
+            if (u != me && !ISUNDEF(u) && !fetchingnodes)
+            {
+                useralerts.noteSharedNode(u, t, ts, n);
+            }
+
+            if (nn && nni >= 0 && nni < nnsize)
             {
-                byte buf[SymmCipher::KEYLENGTH];
+                nn[nni].added = true;
+                nn[nni].addedhandle = h;
 
-                if (!ISUNDEF(su))
+#ifdef ENABLE_SYNC
+                if (source == PUTNODES_SYNC)
                 {
-                    if (t != FOLDERNODE)
+                    if (nn[nni].localnode)
                     {
-                        warn("Invalid share node type");
-                    }
+                        // overwrites/updates: associate LocalNode with newly created Node
+                        nn[nni].localnode->setnode(n);
+                        nn[nni].localnode->treestate(TREESTATE_SYNCED);
 
-                    if (rl == ACCESS_UNKNOWN)
-                    {
-                        warn("Missing access level");
+                        // updates cache with the new node associated
+                        nn[nni].localnode->sync->statecacheadd(nn[nni].localnode);
+                        nn[nni].localnode->newnode.reset(); // localnode ptr now null also
                     }
+                }
+#endif
+
+                if (nn[nni].source == NEW_UPLOAD)
+                {
+                    handle uh = nn[nni].uploadhandle;
 
-                    if (!sk)
+                    // do we have pending file attributes for this upload? set them.
+                    for (fa_map::iterator it = pendingfa.lower_bound(pair<handle, fatype>(uh, fatype(0)));
+                         it != pendingfa.end() && it->first.first == uh; )
                     {
-                        LOG_warn << "Missing share key for inbound share";
+                        reqs.add(new CommandAttachFA(this, h, it->first.second, it->second.first, it->second.second));
+                        pendingfa.erase(it++);
                     }
 
-                    if (warnlevel())
+                    // FIXME: only do this for in-flight FA writes
+                    uhnh.insert(pair<handle, handle>(uh, h));
+                }
+            }
+        }
+
+        if (notify)
+        {
+            notifynode(n);
+        }
+
+        if (applykeys)
+        {
+            n->applykey();
+        }
+    }
+
+    return true;
+}
+
+// whether a node read from the API belongs to the scope of the session (nodes created by this
+// client are kept regardless)
+bool MegaClient::readnodeinscope(handle h, handle ph, nodetype_t t, handle su)
+{
+    if ((t != FILENODE && t != FOLDERNODE) || nodescope.count(h))
+    {
+        return true;
+    }
+
+    if (!ISUNDEF(su))
+    {
+        if (fetchingnodes)
+        {
+            nodescopeshares.insert(h);
+        }
+        return true;
+    }
+
+    Node* p = nodebyhandle(ph);
+    if (fetchingnodes)
+    {
+        // any folder may lead to the scope, and orphans are not placed yet: prunenodescope()
+        // decides on them once all nodes are in
+        return t == FOLDERNODE || !p || innodescope(p);
+    }
+
+    return p && innodescope(p);
+}
+
+bool MegaClient::innodescope(const Node* n) const
+{
+    for (; n; n = n->parent)
+    {
+        if (n->inshare || nodescope.count(n->nodehandle) || nodescopeshares.count(n->nodehandle))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// keep the nodes in the scope, the folders above them up to their root, the roots, and the
+// folders of the sync debris (so that they are not created again)
+void MegaClient::prunenodescope()
+{
+    if (nodescope.empty())
+    {
+        return;
+    }
+
+    handle_set ancestors;
+    for (handle h : nodescope)
+    {
+        Node* n = nodebyhandle(h);
+        if (!n)
+        {
+            LOG_warn << "Node scope: folder not found: " << Base64Str<MegaClient::NODEHANDLE>(h);
+        }
+        for (n = n ? n->parent : NULL; n && ancestors.insert(n->nodehandle).second; n = n->parent);
+    }
+
+    std::function<void(Node*)> deltree = [this, &deltree](Node* n)
+    {
+        while (!n->children.empty())
+        {
+            deltree(n->children.back());
+        }
+        nodes.erase(n->nodehandle);
+        delete n;
+    };
+
+    std::function<void(Node*)> prune = [&](Node* n)
+    {
+        node_list children = n->children;
+        for (Node* c : children)
+        {
+            if (innodescope(c))
+            {
+                continue;
+            }
+
+            if (ancestors.count(c->nodehandle))
+            {
+                prune(c);
+            }
+#ifdef ENABLE_SYNC
+            else if (n->type == RUBBISHNODE && c->type == FOLDERNODE && !strcmp(c->displayname(), SYNCDEBRISFOLDERNAME))
+            {
+                node_list days = c->children;
+                for (Node* d : days)
+                {
+                    if (d->type == FOLDERNODE)
                     {
-                        su = UNDEF;
+                        while (!d->children.empty())
+                        {
+                            deltree(d->children.back());
+                        }
                     }
                     else
                     {
-                        if (sk)
-                        {
-                            decryptkey(sk, buf, sizeof buf, &key, 1, h);
-                        }
+                        deltree(d);
                     }
                 }
+            }
+#endif
+            else
+            {
+                deltree(c);
+            }
+        }
+    };
 
-                string fas;
-
-                Node::copystring(&fas, fa);
+    size_t total = nodes.size();
 
-                // fallback timestamps
-                if (!(ts + 1))
-                {
-                    ts = m_time();
-                }
+    node_vector tops;
+    for (node_map::iterator it = nodes.begin(); it != nodes.end(); it++)
+    {
+        if (!it->second->parent)
+        {
+            tops.push_back(it->second);
+        }
+    }
 
-                if (!(sts + 1))
-                {
-                    sts = ts;
-                }
+    for (Node* n : tops)
+    {
+        if ((n->type != FILENODE && n->type != FOLDERNODE) || ancestors.count(n->nodehandle))
+        {
+            prune(n);
+        }
+        else if (!innodescope(n))
+        {
+            // orphan outside of the scope
+            deltree(n);
+        }
+    }
 
-                n = new Node(this, &dp, h, ph, t, s, u, fas.c_str(), ts);
-                n->changed.newnode = true;
+    LOG_debug << "Node scope: " << nodes.size() << " of " << total << " nodes kept";
+}
 
-                n->tag = tag;
+// any child nodes that arrived before their parents?
+void MegaClient::setorphanparents(node_vector* dp)
+{
+    Node* n;
 
-                n->attrstring.reset(new string);
-                Node::copystring(n->attrstring.get(), a);
-                n->setkeyfromjson(k);
+    for (size_t i = dp->size(); i--; )
+    {
+        if ((n = nodebyhandle((*dp)[i]->parenthandle)))
+        {
+            (*dp)[i]->setparent(n);
+        }
+    }
+}
 
-                if (!ISUNDEF(su))
-                {
-                    newshares.push_back(new NewShare(h, 0, su, rl, sts, sk ? buf : NULL));
-                }
+// parse and materialise the nodes of the in-flight fetchnodes response received so far,
+// so that the whole response is never buffered and key application overlaps the download
+void MegaClient::procfetchnodesstream()
+{
+    static const char prefix[] = "[{\"f\":[";
+    const size_t prefixlen = sizeof prefix - 1;
 
-                if (u != me && !ISUNDEF(u) && !fetchingnodes)
-                {
-                    useralerts.noteSharedNode(u, t, ts, n);
-                }
+    httpio->lock();
 
-                if (nn && nni >= 0 && nni < nnsize)
-                {
-                    nn[nni].added = true;
+    const char* data = pendingcs->data();
+    size_t len = pendingcs->size();
+    size_t consumed = 0;
 
-#ifdef ENABLE_SYNC
-                    if (source == PUTNODES_SYNC)
-                    {
-                        if (nn[nni].localnode)
-                        {
-                            // overwrites/updates: associate LocalNode with newly created Node
-                            nn[nni].localnode->setnode(n);
-                            nn[nni].localnode->treestate(TREESTATE_SYNCED);
+    if (fnstream == FNSTREAM_PREFIX && len)
+    {
+        if (memcmp(data, prefix, std::min(len, prefixlen)))
+        {
+            // error or unexpected layout: leave it to the regular response processing
+            fnstream = FNSTREAM_OFF;
+        }
+        else if (len >= prefixlen)
+        {
+            LOG_debug << "Processing fetchnodes response while it is received";
 
-                            // updates cache with the new node associated
-                            nn[nni].localnode->sync->statecacheadd(nn[nni].localnode);
-                            nn[nni].localnode->newnode.reset(); // localnode ptr now null also
-                        }
-                    }
-#endif
+            purgenodesusersabortsc();
+            fnorphans.clear();
+            fnscanner.reset();
 
-                    if (nn[nni].source == NEW_UPLOAD)
-                    {
-                        handle uh = nn[nni].uploadhandle;
+            if (pendingcs->contentlength > 0)
+            {
+                nodes.reserve(size_t(pendingcs->contentlength / FETCHNODES_RECORD_SIZE));
+            }
 
-                        // do we have pending file attributes for this upload? set them.
-                        for (fa_map::iterator it = pendingfa.lower_bound(pair<handle, fatype>(uh, fatype(0)));
-                             it != pendingfa.end() && it->first.first == uh; )
-                        {
-                            reqs.add(new CommandAttachFA(this, h, it->first.second, it->second.first, it->second.second));
-                            pendingfa.erase(it++);
-                        }
+            consumed = prefixlen;
+            fnstream = FNSTREAM_NODES;
+        }
+    }
 
-                        // FIXME: only do this for in-flight FA writes
-                        uhnh.insert(pair<handle, handle>(uh, h));
-                    }
-                }
-            }
+    if (fnstream == FNSTREAM_NODES)
+    {
+        consumed += fnscanner.feed(data + consumed, len - consumed, [this](const char* element, size_t)
+        {
+            JSON j;
+            j.begin(element);
 
-            if (notify)
+            if (!j.enterobject() || !readnode(&j, 0, PUTNODES_APP, NULL, 0, 0, true, &fnorphans))
             {
-                notifynode(n);
+                return false;
             }
 
-            if (applykeys)
+            if (fnstats.timeToFirstNode == NEVER)
             {
-                n->applykey();
+                WAIT_CLASS::bumpds();
+                fnstats.timeToFirstNode = WAIT_CLASS::ds - fnstats.startTime;
             }
+
+            return true;
+        });
+
+        if (fnscanner.finished())
+        {
+            setorphanparents(&fnorphans);
+            fnorphans.clear();
+            fnstream = FNSTREAM_DONE;
+        }
+        else if (fnscanner.failed())
+        {
+            fnstream = FNSTREAM_FAILED;
         }
     }
 
-    // any child nodes that arrived before their parents?
-    for (size_t i = dp.size(); i--; )
+    pendingcs->purge(consumed);
+
+    httpio->unlock();
+}
+
+// the in-flight fetchnodes response is complete: leave the rest of the response for CommandFetchNodes,
+// with an empty nodes array in place of the nodes already processed
+void MegaClient::finishfetchnodesstream()
+{
+    if (fnstream == FNSTREAM_PREFIX || fnstream == FNSTREAM_NODES)
     {
-        if ((n = nodebyhandle(dp[i]->parenthandle)))
-        {
-            dp[i]->setparent(n);
-        }
+        procfetchnodesstream();
     }
 
-    return j->leavearray();
+    switch (fnstream)
+    {
+        case FNSTREAM_DONE:
+            pendingcs->in.replace(0, pendingcs->inpurge, "[{\"f\":[]");
+            pendingcs->inpurge = 0;
+            break;
+
+        case FNSTREAM_NODES:
+        case FNSTREAM_FAILED:
+            LOG_err << "Invalid fetchnodes response";
+            fnstream = FNSTREAM_FAILED;
+            pendingcs->in = "[" + std::to_string(API_EINTERNAL) + "]";
+            pendingcs->inpurge = 0;
+            break;
+
+        default:
+            fnstream = FNSTREAM_OFF;
+    }
 }
 
 // decrypt and set encrypted sharekey
@@ -8031,28 +10207,216 @@ void MegaClient::applykeys()
 
     if (nodes.size() > size_t(mAppliedKeyNodeCount + noKeyExpected))
     {
+        size_t pending = nodes.size() - size_t(mAppliedKeyNodeCount + noKeyExpected);
+
+        if (pending >= size_t(2 * KEYAPPLY_MINSHARD))
+        {
+            node_vector v;
+            v.reserve(pending);
+
+            for (auto& it : nodes)
+            {
+                if (!it.second->keyApplied())
+                {
+                    v.push_back(it.second);
+                }
+            }
+
+            applykeysparallel(v);
+        }
+
+        // the rest (root nodes, or everything on small trees), but for the RSA-wrapped keys
         for (auto& it : nodes)
         {
-            it.second->applykey();
+            if (it.second->rsawrappedkey())
+            {
+                rsakeypending.insert(it.first);
+            }
+            else
+            {
+                it.second->applykey();
+            }
         }
+
+        applyrsakeys(false);
     }
 
     sendkeyrewrites();
 }
 
+// each thread works on a contiguous shard of the nodes with its own ciphers, and the shared
+// state (applied key count, fingerprints) is updated afterwards in node order
+void MegaClient::applykeysparallel(const node_vector& v)
+{
+    WorkerPool& pool = WorkerPool::get();
+    size_t threads = std::min<size_t>(pool.parallelism(WorkerPool::WORK_NODES), KEYAPPLY_MAXTHREADS);
+    threads = std::min<size_t>(threads, v.size() / KEYAPPLY_MINSHARD);
+
+    if (threads < 2)
+    {
+        return;
+    }
+
+    // per node: 0 = left for applykey(), 1 = key applied, 2 = key applied and attributes decrypted
+    vector<char> results(v.size());
+    handle self = loggedin() ? me : *rootnodes;
+
+    auto shard = [this, &v, &results, threads, self](size_t i)
+    {
+        Node::KeyApplyContext ctx;
+        ctx.me = self;
+        ctx.master.setkey(key.key);
+
+        bool attrsdecrypted;
+        for (size_t j = v.size() * i / threads, end = v.size() * (i + 1) / threads; j < end; j++)
+        {
+            if (v[j]->applysymmetrickey(ctx, attrsdecrypted))
+            {
+                results[j] = char(attrsdecrypted ? 2 : 1);
+            }
+        }
+    };
+
+    pool.run(WorkerPool::WORK_NODES, threads, shard);
+
+    for (size_t j = 0; j < v.size(); j++)
+    {
+        if (results[j])
+        {
+            mAppliedKeyNodeCount++;
+
+            if (results[j] == 2)
+            {
+                v[j]->setfingerprint();
+            }
+        }
+    }
+
+    LOG_debug << "Applied " << std::count_if(results.begin(), results.end(), [](char r) { return r != 0; })
+              << " of " << v.size() << " node keys on " << threads << " threads";
+}
+
+void MegaClient::importattrs()
+{
+    node_vector v;
+
+    for (auto& it : nodes)
+    {
+        if (it.second->attrspending())
+        {
+            v.push_back(it.second);
+        }
+    }
+
+    // nodes only import their own attributes (and normalize their names, which is stateless)
+    runshards(v.size(), KEYAPPLY_MINSHARD, [&v](size_t begin, size_t end)
+    {
+        for (size_t j = begin; j < end; j++)
+        {
+            v[j]->attrs();
+        }
+    });
+
+    if (v.size())
+    {
+        LOG_debug << "Imported the attributes of " << v.size() << " nodes";
+    }
+}
+
+void MegaClient::applyrsakeys(bool notify)
+{
+    struct RsaKey
+    {
+        Node* node;
+        string ciphertext;
+        byte key[FILENODEKEYLENGTH];
+        bool decrypted = false;
+    };
+
+    WorkerPool& pool = WorkerPool::get();
+    size_t maxthreads = std::max<size_t>(1, std::min<size_t>(pool.parallelism(WorkerPool::WORK_NODES), KEYAPPLY_MAXTHREADS));
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(RSAKEY_MAXBLOCKMS);
+    size_t applied = 0;
+
+    while (!rsakeypending.empty())
+    {
+        // a round: a shard for each thread, in handle order
+        vector<RsaKey> round;
+        while (!rsakeypending.empty() && round.size() < maxthreads * RSAKEY_SHARD)
+        {
+            Node* n = nodebyhandle(*rsakeypending.begin());
+            rsakeypending.erase(rsakeypending.begin());
+
+            RsaKey k;
+            if (n && n->rsawrappedkey(&k.ciphertext))
+            {
+                k.node = n;
+                round.push_back(std::move(k));
+            }
+        }
+
+        // the big integers of a cipher are not shared between threads
+        size_t threads = std::min(maxthreads, (round.size() + RSAKEY_SHARD - 1) / RSAKEY_SHARD);
+        vector<AsymmCipher> ciphers(threads, asymkey);
+        auto shard = [&round, &ciphers, threads](size_t i)
+        {
+            for (size_t j = round.size() * i / threads, end = round.size() * (i + 1) / threads; j < end; j++)
+            {
+                RsaKey& k = round[j];
+                size_t keylength = k.node->type == FILENODE ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH;
+                k.decrypted = ciphers[i].decrypt((const byte*)k.ciphertext.data(), k.ciphertext.size(), k.key, keylength) != 0;
+            }
+        };
+
+        pool.run(WorkerPool::WORK_NODES, threads, shard);
+
+        for (RsaKey& k : round)
+        {
+            if (!k.decrypted)
+            {
+                LOG_warn << "Corrupt or invalid RSA node key";
+                continue;
+            }
+
+            k.node->applyrsakey(k.key);
+            applied++;
+
+            if (notify && !fetchingnodes)
+            {
+                // the app has seen the node without its key already
+                k.node->changed.attrs = true;
+                notifynode(k.node);
+            }
+        }
+
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            break;
+        }
+    }
+
+    if (applied)
+    {
+        LOG_debug << "Applied " << applied << " RSA-wrapped node keys, " << rsakeypending.size() << " left";
+    }
+}
+
 void MegaClient::sendkeyrewrites()
 {
-    if (sharekeyrewrite.size())
+    // in commands of KEYREWRITE_MAXHANDLES at most
+    for (size_t i = 0; i < sharekeyrewrite.size(); i += KEYREWRITE_MAXHANDLES)
     {
-        reqs.add(new CommandShareKeyUpdate(this, &sharekeyrewrite));
-        sharekeyrewrite.clear();
+        handle_vector part(sharekeyrewrite.begin() + i, sharekeyrewrite.begin() + std::min(sharekeyrewrite.size(), i + KEYREWRITE_MAXHANDLES));
+        reqs.add(new CommandShareKeyUpdate(this, &part));
     }
+    sharekeyrewrite.clear();
 
-    if (nodekeyrewrite.size())
+    for (size_t i = 0; i < nodekeyrewrite.size(); i += KEYREWRITE_MAXHANDLES)
     {
-        reqs.add(new CommandNodeKeyUpdate(this, &nodekeyrewrite));
-        nodekeyrewrite.clear();
+        handle_vector part(nodekeyrewrite.begin() + i, nodekeyrewrite.begin() + std::min(nodekeyrewrite.size(), i + KEYREWRITE_MAXHANDLES));
+        reqs.add(new CommandNodeKeyUpdate(this, &part));
     }
+    nodekeyrewrite.clear();
 }
 
 // user/contact list
@@ -8238,7 +10602,7 @@ error MegaClient::parsepubliclink(const char* link, handle& ph, byte* key, bool
     return API_EARGS;
 }
 
-error MegaClient::folderaccess(const char *folderlink)
+error MegaClient::folderaccess(const char *folderlink, handle subtree)
 {
     handle h = UNDEF;
     byte folderkey[FOLDERNODEKEYLENGTH];
@@ -8248,6 +10612,7 @@ error MegaClient::folderaccess(const char *folderlink)
     {
         setrootnode(h);
         key.setkey(folderkey);
+        folderlinksubtree = subtree;
     }
 
     return e;
@@ -8280,8 +10645,8 @@ void MegaClient::login2(const char *email, const char *password, string *salt, c
     Base64::atob(*salt, bsalt);
 
     byte derivedKey[2 * SymmCipher::KEYLENGTH];
-    CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA512> pbkdf2;
-    pbkdf2.DeriveKey(derivedKey, sizeof(derivedKey), 0, (byte *)password, strlen(password),
+    PBKDF2_HMAC_SHA512 pbkdf2;
+    pbkdf2.deriveKey(derivedKey, sizeof(derivedKey), (byte *)password, strlen(password),
                      (const byte *)bsalt.data(), bsalt.size(), 100000);
 
     login2(email, derivedKey, pin);
@@ -8308,10 +10673,22 @@ void MegaClient::fastlogin(const char* email, const byte* pwkey, uint64_t emailh
     reqs.add(new CommandLogin(this, email, (byte*)&emailhash, sizeof(emailhash), sek));
 }
 
-void MegaClient::getuserdata()
+void MegaClient::setmobileefficiency(bool enable)
+{
+    reqs.policy.maxDeferral = enable ? MOBILE_MAX_DEFERRAL : 0;
+    if (!enable)
+    {
+        reqs.releasedeferred(false);
+    }
+}
+
+void MegaClient::getuserdata(bool deferrable)
 {
     cachedug = false;
-    reqs.add(new CommandGetUserData(this));
+
+    Command* c = new CommandGetUserData(this);
+    c->deferrable = deferrable;
+    reqs.add(c);
 }
 
 void MegaClient::getmiscflags()
@@ -8511,17 +10888,137 @@ void MegaClient::opensctable()
         {
             dbname.resize((SIDLEN - sizeof key.key) * 4 / 3 + 3);
             dbname.resize(Base64::btoa((const byte*)sid.data() + sizeof key.key, SIDLEN - sizeof key.key, (char*)dbname.c_str()));
+
+            // neither is a partial tree the cache of the whole account
+            for (handle h : nodescope)
+            {
+                dbname.append("_").append(Base64Str<NODEHANDLE>(h).chars);
+            }
         }
         else if (loggedinfolderlink())
         {
             dbname.resize(NODEHANDLE * 4 / 3 + 3);
             dbname.resize(Base64::btoa((const byte*)&publichandle, NODEHANDLE, (char*)dbname.c_str()));
+
+            if (!ISUNDEF(folderlinksubtree))
+            {
+                // a partial tree is not the cache of the whole link
+                dbname.append("_").append(Base64Str<NODEHANDLE>(folderlinksubtree).chars);
+            }
         }
 
         if (dbname.size())
         {
-            sctable = dbaccess->open(rng, fsaccess, &dbname, false, false);
+            sctable = opencachetable(&dbname, false, false);
             pendingsccommit = false;
+            openfacache(dbname);
+            openfpcache(dbname);
+        }
+    }
+}
+
+DbTable* MegaClient::opencachetable(string* dbname, bool recycleLegacyDB, bool checkAlwaysTransacted)
+{
+    if (!dbwritebehind)
+    {
+        return dbaccess->open(rng, fsaccess, dbname, recycleLegacyDB, checkAlwaysTransacted);
+    }
+
+    // the transactions of the table are the thread's, the wrapper checks the client's
+    DbTable* table = dbaccess->open(rng, fsaccess, dbname, recycleLegacyDB, false);
+    return table ? new WriteBehindDbTable(rng, table, checkAlwaysTransacted) : nullptr;
+}
+
+void MegaClient::setsharednodeview(const string& path, const string& key)
+{
+    sharednodeviewpath = path;
+    sharednodeviewkey = key;
+    sharednodeviewdirty = !path.empty();
+    sharednodeviewds = 0;
+}
+
+void MegaClient::writesharednodeview()
+{
+    if (!statecurrent || Waiter::ds < sharednodeviewds + SHAREDNODEVIEW_INTERVAL)
+    {
+        return;
+    }
+
+    // readers only notice a generation that grows, also over one left by an earlier instance
+    uint64_t generation = std::max(SharedNodeView::generationof(sharednodeviewpath), sharednodeviewgeneration) + 1;
+
+    // nodes paged out of memory are not in the view
+    if (SharedNodeView::write(sharednodeviewpath, sharednodeviewkey, rng, nodes, rootnodes, generation))
+    {
+        sharednodeviewgeneration = generation;
+    }
+
+    sharednodeviewds = Waiter::ds;
+    sharednodeviewdirty = false;
+}
+
+void MegaClient::openfacache(const string& dbname)
+{
+    if (facache || !facachemaxbytes)
+    {
+        return;
+    }
+
+    string name = "fa_" + dbname;
+    if (DbTable* table = dbaccess->open(rng, fsaccess, &name, false, false))
+    {
+        facache.reset(new FileAttributeCache(table, &key, rng, facachemaxbytes));
+    }
+}
+
+void MegaClient::openfpcache(const string& dbname)
+{
+    if (fpcache)
+    {
+        return;
+    }
+
+    string name = "fp_" + dbname;
+    if (DbTable* table = dbaccess->open(rng, fsaccess, &name, false, false))
+    {
+        fpcache.reset(new FileFingerprintCache(table, &key, rng));
+    }
+}
+
+bool MegaClient::genfingerprint(FileFingerprint* fp, FileAccess* fa, const string& localpath, bool usecache)
+{
+    if (fpcache && fa->fsidvalid)
+    {
+        FileFingerprint cached;
+        if (usecache && fpcache->get(fa->fsid, localpath, fa->size, fa->mtime, &cached))
+        {
+            bool changed = !fp->isvalid || fp->size != cached.size || fp->mtime != cached.mtime || fp->crc != cached.crc;
+            *fp = cached;
+            return changed;
+        }
+
+        bool changed = fp->genfingerprint(fa);
+        fpcache->put(fa->fsid, localpath, *fp);
+        return changed;
+    }
+
+    return fp->genfingerprint(fa);
+}
+
+void MegaClient::setfacachesize(size_t bytes)
+{
+    facachemaxbytes = bytes;
+
+    if (facache)
+    {
+        if (bytes)
+        {
+            facache->setmaxbytes(bytes);
+        }
+        else
+        {
+            facache->remove();
+            facache.reset();
         }
     }
 }
@@ -8843,26 +11340,88 @@ void MegaClient::resetKeyring()
     delete signkey;
     signkey = NULL;
 
-    delete chatkey;
-    chatkey = NULL;
-}
+    delete chatkey;
+    chatkey = NULL;
+}
+
+// process node tree (bottom up)
+void MegaClient::proctree(Node* n, TreeProc* tp, bool skipinshares, bool skipversions)
+{
+    // forks only read the nodes, which are gathered first (paging them in is left to this thread)
+    std::unique_ptr<TreeProc> forked(tp->fork());
+    node_vector gathered;
+
+    // a node leaves the stack once its children have: the next one is taken before the
+    // current one is processed, which may remove it from its parent
+    struct Pending
+    {
+        Node* node;
+        node_list::iterator next;
+    };
+    vector<Pending> stack;
+
+    pageinchildren(n);
+    stack.push_back({ n, (skipversions && n->type == FILENODE) ? n->children.end() : n->children.begin() });
+
+    while (!stack.empty())
+    {
+        Pending& top = stack.back();
+        if (top.next != top.node->children.end())
+        {
+            Node* child = *top.next++;
+            if (!(skipinshares && child->inshare))
+            {
+                pageinchildren(child);
+                stack.push_back({ child, child->children.begin() });
+            }
+            continue;
+        }
+
+        Node* done = top.node;
+        stack.pop_back();
+
+        if (forked)
+        {
+            gathered.push_back(done);
+        }
+        else
+        {
+            tp->proc(this, done);
+        }
+    }
+
+    if (!forked)
+    {
+        return;
+    }
 
-// process node tree (bottom up)
-void MegaClient::proctree(Node* n, TreeProc* tp, bool skipinshares, bool skipversions)
-{
-    if (!skipversions || n->type != FILENODE)
+    if (gathered.size() < 2 * PROCTREE_MINSHARD)
     {
-        for (node_list::iterator it = n->children.begin(); it != n->children.end(); )
+        for (Node* g : gathered)
         {
-            Node *child = *it++;
-            if (!(skipinshares && child->inshare))
-            {
-                proctree(child, tp, skipinshares);
-            }
+            tp->proc(this, g);
         }
+        return;
     }
 
-    tp->proc(this, n);
+    std::mutex forksmutex;
+    std::map<size_t, std::unique_ptr<TreeProc>> forks;
+    runshards(gathered.size(), PROCTREE_MINSHARD, [&](size_t begin, size_t end)
+    {
+        std::unique_ptr<TreeProc> f(tp->fork());
+        for (size_t i = begin; i < end; i++)
+        {
+            f->proc(this, gathered[i]);
+        }
+
+        std::lock_guard<std::mutex> g(forksmutex);
+        forks[begin] = std::move(f);
+    });
+
+    for (auto& f : forks)
+    {
+        tp->merge(*f.second);
+    }
 }
 
 // queue PubKeyAction request to be triggered upon availability of the user's
@@ -8924,11 +11483,7 @@ void MegaClient::rewriteforeignkeys(Node* n)
     TreeProcForeignKeys rewrite;
     proctree(n, &rewrite);
 
-    if (nodekeyrewrite.size())
-    {
-        reqs.add(new CommandNodeKeyUpdate(this, &nodekeyrewrite));
-        nodekeyrewrite.clear();
-    }
+    sendkeyrewrites();
 }
 
 // if user has a known public key, complete instantly
@@ -9240,7 +11795,13 @@ void MegaClient::getua(User* u, const attr_t at, int ctag)
         const string *cachedav = u->getattr(at);
         int tag = (ctag != -1) ? ctag : reqtag;
 
-        if (!fetchingkeys && cachedav && u->isattrvalid(at))
+        if (!fetchingkeys && u->userhandle != me && u->isattrnonexistent(at))
+        {
+            restag = tag;
+            app->getua_result(API_ENOENT);
+            return;
+        }
+        else if (!fetchingkeys && cachedav && u->isattrvalid(at))
         {
             if (User::scope(at) == '*') // private attribute, TLV encoding
             {
@@ -9292,6 +11853,12 @@ void MegaClient::notifynode(Node* n)
 {
     n->applykey();
 
+    // its attributes may change its place among its siblings
+    if (n->parent)
+    {
+        n->parent->childrenchanged();
+    }
+
     if (!fetchingnodes)
     {
         if (n->tag && !n->changed.removed && n->attrstring)
@@ -9330,6 +11897,24 @@ void MegaClient::notifynode(Node* n)
         }
 
 #ifdef ENABLE_SYNC
+        // syncdown() has to look where the node was and where it is now
+        if (syncs.size())
+        {
+            if (n->localnode && n->localnode != (LocalNode*)~0)
+            {
+                n->localnode->setsyncdirty();
+            }
+
+            for (Node* p = n->parent; p; p = p->parent)
+            {
+                if (p->localnode && p->localnode != (LocalNode*)~0)
+                {
+                    p->localnode->setsyncdirty();
+                    break;
+                }
+            }
+        }
+
         // is this a synced node that was moved to a non-synced location? queue for
         // deletion from LocalNodes.
         if (n->localnode && n->localnode->parent && n->parent && !n->parent->localnode)
@@ -9347,6 +11932,7 @@ void MegaClient::notifynode(Node* n)
             }
 
             n->localnode->deleted = true;
+            n->localnode->setmovecandidate(true);
             n->localnode->node = NULL;
             n->localnode = NULL;
         }
@@ -9358,6 +11944,11 @@ void MegaClient::notifynode(Node* n)
             if (n->localnode && n->localnode->parent)
             {
                 n->localnode->deleted = n->changed.removed;
+
+                if (n->changed.removed)
+                {
+                    n->localnode->setmovecandidate(true);
+                }
             }
 
             if (n->parent && n->parent->localnode && (!n->localnode || (n->localnode->parent != n->parent->localnode)))
@@ -9404,6 +11995,7 @@ void MegaClient::notifynode(Node* n)
 
 void MegaClient::transfercacheadd(Transfer *transfer, DBTableTransactionCommitter* committer)
 {
+    tcdirty.erase(transfer);
     if (tctable && !transfer->skipserialization)
     {
         LOG_debug << "Caching transfer";
@@ -9412,8 +12004,40 @@ void MegaClient::transfercacheadd(Transfer *transfer, DBTableTransactionCommitte
     }
 }
 
+void MegaClient::transfercachedirty(Transfer *transfer)
+{
+    if (tctable && !transfer->skipserialization)
+    {
+        if (tcdirty.empty())
+        {
+            tcdirtyds = Waiter::ds;
+        }
+        tcdirty.insert(transfer);
+    }
+}
+
+void MegaClient::transfercacheflush(DBTableTransactionCommitter* committer)
+{
+    if (tctable && !tcdirty.empty())
+    {
+        LOG_debug << "Caching transfers: " << tcdirty.size();
+        vector<Cacheable*> records;
+        for (Transfer* transfer : tcdirty)
+        {
+            if (!transfer->skipserialization)
+            {
+                records.push_back(transfer);
+            }
+        }
+        tctable->checkCommitter(committer);
+        tctable->putBatch(MegaClient::CACHEDTRANSFER, records, &tckey);
+    }
+    tcdirty.clear();
+}
+
 void MegaClient::transfercachedel(Transfer *transfer, DBTableTransactionCommitter* committer)
 {
+    tcdirty.erase(transfer);
     if (tctable && transfer->dbid)
     {
         LOG_debug << "Removing cached transfer";
@@ -9432,13 +12056,20 @@ void MegaClient::filecacheadd(File *file, DBTableTransactionCommitter& committer
     }
 }
 
-void MegaClient::filecachedel(File *file, DBTableTransactionCommitter* committer)
+void MegaClient::filecachedel(File *file, DBTableTransactionCommitter* committer, vector<uint32_t>* batch)
 {
     if (tctable && !file->syncxfer)
     {
-        LOG_debug << "Removing cached file";
-        tctable->checkCommitter(committer);
-        tctable->del(file->dbid);
+        if (batch)
+        {
+            batch->push_back(file->dbid);
+        }
+        else
+        {
+            LOG_debug << "Removing cached file";
+            tctable->checkCommitter(committer);
+            tctable->del(file->dbid);
+        }
     }
 
     if (file->temporaryfile)
@@ -9907,7 +12538,7 @@ void MegaClient::procmcna(JSON *j)
                         }
                         else
                         {
-                            it->second->setNodeUserAccess(h, uh);
+                            setattachmentaccess(it->second, h, uh);
                         }
                     }
                     else
@@ -9988,7 +12619,7 @@ void MegaClient::cr_response(node_vector* shares, node_vector* nodes, JSON* sele
 
     // estimate required size for requested keys
     // for each node: ",<index>,<index>,"<nodekey>
-    crkeys.reserve(nodes->size() * ((5 + 4 * 2) + (FILENODEKEYLENGTH * 4 / 3 + 4)) + 1);
+    crkeys.reserve(std::min(nodes->size() * ((5 + 4 * 2) + (FILENODEKEYLENGTH * 4 / 3 + 4)) + 1, KEYCR_MAXBYTES + sizeof buf));
     // we reserve for indexes up to 4 digits per index
 
     for (;;)
@@ -10069,6 +12700,16 @@ void MegaClient::cr_response(node_vector* shares, node_vector* nodes, JSON* sele
                         sn->sharekey->ecb_encrypt((byte*)n->nodekey().data(), keybuf, size_t(keysize));
                         Base64::btoa(keybuf, keysize, strchr(buf + 7, 0));
                         crkeys.append(buf);
+
+                        // in parts of KEYCR_MAXBYTES, each with its own share and node indexes
+                        if (crkeys.size() >= KEYCR_MAXBYTES)
+                        {
+                            crkeys.append("\"");
+                            reqs.add(new CommandKeyCR(this, &rshares, &rnodes, crkeys.c_str() + 2));
+                            rshares.clear();
+                            rnodes.clear();
+                            crkeys.clear();
+                        }
                     }
                     else
                     {
@@ -10475,8 +13116,8 @@ error MegaClient::changepw(const char* password, const char *pin)
     hasher.get(&salt);
 
     byte derivedKey[2 * SymmCipher::KEYLENGTH];
-    CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA512> pbkdf2;
-    pbkdf2.DeriveKey(derivedKey, sizeof(derivedKey), 0, (byte *)password, strlen(password),
+    PBKDF2_HMAC_SHA512 pbkdf2;
+    pbkdf2.deriveKey(derivedKey, sizeof(derivedKey), (byte *)password, strlen(password),
                      (const byte *)salt.data(), salt.size(), 100000);
 
     byte encmasterkey[SymmCipher::KEYLENGTH];
@@ -10554,8 +13195,8 @@ string MegaClient::sendsignuplink2(const char *email, const char *password, cons
     hasher.get(&salt);
 
     byte derivedKey[2 * SymmCipher::KEYLENGTH];
-    CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA512> pbkdf2;
-    pbkdf2.DeriveKey(derivedKey, sizeof(derivedKey), 0, (byte *)password, strlen(password),
+    PBKDF2_HMAC_SHA512 pbkdf2;
+    pbkdf2.deriveKey(derivedKey, sizeof(derivedKey), (byte *)password, strlen(password),
                      (const byte *)salt.data(), salt.size(), 100000);
 
     byte encmasterkey[SymmCipher::KEYLENGTH];
@@ -10635,9 +13276,21 @@ bool MegaClient::fetchsc(DbTable* sctable)
 
     LOG_info << "Loading session from local cache";
 
+    // with a current snapshot, the node records need not be decrypted one by one
+    bool fromsnapshot = usenodesnapshot && readnodesnapshot(&dp);
+    if (fromsnapshot)
+    {
+        LOG_info << "Loaded " << nodes.size() << " nodes from snapshot";
+    }
+    else if (!nodes.empty())
+    {
+        // a snapshot record failed after some nodes were created
+        return false;
+    }
+
     sctable->rewind();
 
-    bool hasNext = sctable->next(&id, &data, &key);
+    bool hasNext = fromsnapshot ? sctable->next(&id, &data, &key, CACHEDNODE) : sctable->next(&id, &data, &key);
     WAIT_CLASS::bumpds();
     fnstats.timeToFirstByte = Waiter::ds - fnstats.startTime;
 
@@ -10706,9 +13359,13 @@ bool MegaClient::fetchsc(DbTable* sctable)
 #endif
                 break;
         }
-        hasNext = sctable->next(&id, &data, &key);
+        hasNext = fromsnapshot ? sctable->next(&id, &data, &key, CACHEDNODE) : sctable->next(&id, &data, &key);
     }
 
+    // a snapshot just read is not rewritten for an interval after it goes stale, a missing one at the next update
+    nodesnapshotcurrent = fromsnapshot;
+    nodesnapshotds = fromsnapshot ? std::max<dstime>(Waiter::ds, 1) : 0;
+
     WAIT_CLASS::bumpds();
     fnstats.timeToLastByte = Waiter::ds - fnstats.startTime;
 
@@ -10728,7 +13385,8 @@ bool MegaClient::fetchsc(DbTable* sctable)
 
 void MegaClient::closetc(bool remove)
 {
-    bool purgeOrphanTransfers = statecurrent;
+    // the transfers of files still to be resumed are not orphans
+    bool purgeOrphanTransfers = statecurrent && !cachedfilesresuming;
 
 #ifdef ENABLE_SYNC
     if (purgeOrphanTransfers && !remove)
@@ -10771,6 +13429,9 @@ void MegaClient::closetc(bool remove)
     pendingtcids.clear();
     cachedfiles.clear();
     cachedfilesdbids.clear();
+    cachedfilespos = 0;
+    cachedfilesresuming = false;
+    tcdirty.clear();
 
     if (remove && tctable)
     {
@@ -10813,7 +13474,7 @@ void MegaClient::enabletransferresumption(const char *loggedoutid)
 
     dbname.insert(0, "transfers_");
 
-    tctable = dbaccess->open(rng, fsaccess, &dbname, true, true);
+    tctable = opencachetable(&dbname, true, true);
     if (!tctable)
     {
         return;
@@ -10856,28 +13517,47 @@ void MegaClient::enabletransferresumption(const char *loggedoutid)
     // if we are logged in but the filesystem is not current yet
     // postpone the resumption until the filesystem is updated
     if ((!sid.size() && !loggedinfolderlink()) || statecurrent)
+    {
+        cachedfilesresuming = true;
+        resumecachedfiles();
+    }
+}
+
+void MegaClient::resumecachedfiles()
+{
+    if (tctable)
     {
         DBTableTransactionCommitter committer(tctable);
-        for (unsigned int i = 0; i < cachedfiles.size(); i++)
+        size_t end = std::min(cachedfiles.size(), cachedfilespos + TRANSFERRESUME_BATCH);
+        for ( ; cachedfilespos < end; cachedfilespos++)
         {
             direction_t type = NONE;
-            File *file = app->file_resume(&cachedfiles.at(i), &type);
+            File *file = app->file_resume(&cachedfiles.at(cachedfilespos), &type);
             if (!file || (type != GET && type != PUT))
             {
-                tctable->del(cachedfilesdbids.at(i));
+                tctable->del(cachedfilesdbids.at(cachedfilespos));
                 continue;
             }
             nextreqtag();
-            file->dbid = cachedfilesdbids.at(i);
+            file->dbid = cachedfilesdbids.at(cachedfilespos);
             if (!startxfer(type, file, committer))
             {
-                tctable->del(cachedfilesdbids.at(i));
+                tctable->del(cachedfilesdbids.at(cachedfilespos));
                 continue;
             }
         }
-        cachedfiles.clear();
-        cachedfilesdbids.clear();
+
+        if (cachedfilespos < cachedfiles.size())
+        {
+            LOG_debug << "Cached files resumed: " << cachedfilespos << " of " << cachedfiles.size();
+            return;
+        }
     }
+
+    cachedfiles.clear();
+    cachedfilesdbids.clear();
+    cachedfilespos = 0;
+    cachedfilesresuming = false;
 }
 
 void MegaClient::disabletransferresumption(const char *loggedoutid)
@@ -10906,7 +13586,7 @@ void MegaClient::disabletransferresumption(const char *loggedoutid)
     }
     dbname.insert(0, "transfers_");
 
-    tctable = dbaccess->open(rng, fsaccess, &dbname, true, true);
+    tctable = opencachetable(&dbname, true, true);
     if (!tctable)
     {
         return;
@@ -10924,6 +13604,7 @@ void MegaClient::fetchnodes(bool nocache)
 
     WAIT_CLASS::bumpds();
     fnstats.init();
+    startupstage = STARTUP_NODES;
     if (sid.size() >= SIDLEN)
     {
         fnstats.type = FetchNodesStats::TYPE_ACCOUNT;
@@ -10932,6 +13613,10 @@ void MegaClient::fetchnodes(bool nocache)
     {
         fnstats.type = FetchNodesStats::TYPE_FOLDER;
     }
+    if (dbaccess)
+    {
+        fnstats.dbProfile = dbaccess->profile.id;
+    }
 
     opensctable();
 
@@ -10947,14 +13632,17 @@ void MegaClient::fetchnodes(bool nocache)
         fnstats.mode = FetchNodesStats::MODE_DB;
         fnstats.cache = FetchNodesStats::API_NO_CACHE;
         fnstats.nodesCached = nodes.size();
+        fnstats.bytesPerNode = bytespernode();
         fnstats.timeToCached = Waiter::ds - fnstats.startTime;
         fnstats.timeToResult = fnstats.timeToCached;
 
         restag = reqtag;
         statecurrent = false;
+        catchupbytes = 0;
 
         sctable->begin();
         pendingsccommit = false;
+        checknodeindex();
 
         Base64::btoa((byte*)&cachedscsn, sizeof cachedscsn, scsn);
         LOG_info << "Session loaded from local cache. SCSN: " << scsn;
@@ -10994,12 +13682,19 @@ void MegaClient::fetchnodes(bool nocache)
             versions_disabled = false;
         }
 
-        av = ownUser->getattr(ATTR_PUSH_SETTINGS);
-        if (av && !ownUser->isattrvalid(ATTR_PUSH_SETTINGS))
+        if (stagedstartup)
         {
-            getua(ownUser, ATTR_PUSH_SETTINGS);
+            startsecondarystage(true);
+        }
+        else
+        {
+            av = ownUser->getattr(ATTR_PUSH_SETTINGS);
+            if (av && !ownUser->isattrvalid(ATTR_PUSH_SETTINGS))
+            {
+                getua(ownUser, ATTR_PUSH_SETTINGS);
+            }
+            loadAuthrings();
         }
-        loadAuthrings();
 
         WAIT_CLASS::bumpds();
         fnstats.timeToSyncsResumed = Waiter::ds - fnstats.startTime;
@@ -11032,10 +13727,14 @@ void MegaClient::fetchnodes(bool nocache)
 
         if (!loggedinfolderlink())
         {
+            // the own keys go first: fetchkeys() rebuilds the own user, which the nodes then refer to
             if (loggedin() == FULLACCOUNT)
             {
                 fetchkeys();
-                loadAuthrings();
+                if (!stagedstartup)
+                {
+                    loadAuthrings();
+                }
             }
             if (!k.size())
             {
@@ -11044,14 +13743,87 @@ void MegaClient::fetchnodes(bool nocache)
 
             reqs.add(new CommandGetUA(this, uid.c_str(), ATTR_DISABLE_VERSIONS, NULL, 0));
 
-            fetchtimezone();
-            reqs.add(new CommandGetUA(this, uid.c_str(), ATTR_PUSH_SETTINGS, NULL, 0));
+            if (!stagedstartup)
+            {
+                fetchtimezone();
+                reqs.add(new CommandGetUA(this, uid.c_str(), ATTR_PUSH_SETTINGS, NULL, 0));
+            }
         }
 
         reqs.add(new CommandFetchNodes(this, nocache));
     }
 }
 
+void MegaClient::startsecondarystage(bool cached)
+{
+    startupstage = STARTUP_SECONDARY;
+    WAIT_CLASS::bumpds();
+    fnstats.timeToSecondaryStage = Waiter::ds - fnstats.startTime;
+    LOG_debug << "Nodes ready, loading the secondary data";
+    app->startup_stage(STARTUP_SECONDARY);
+
+    if (!loggedinfolderlink())
+    {
+        if (loggedin() == FULLACCOUNT)
+        {
+            loadAuthrings();
+        }
+
+        fetchtimezone();
+
+        // a session resumed from the cache only refreshes what it knows to be stale
+        User* ownUser = finduser(me);
+        const string* av = ownUser ? ownUser->getattr(ATTR_PUSH_SETTINGS) : nullptr;
+        if (!cached)
+        {
+            reqs.add(new CommandGetUA(this, uid.c_str(), ATTR_PUSH_SETTINGS, NULL, 0));
+        }
+        else if (av && !ownUser->isattrvalid(ATTR_PUSH_SETTINGS))
+        {
+            getua(ownUser, ATTR_PUSH_SETTINGS);
+        }
+    }
+
+    checkstartupdone();
+}
+
+void MegaClient::useralertsloaded()
+{
+    if (useralerts.catchupdone && fnstats.timeToUserAlerts == NEVER && startupstage == STARTUP_SECONDARY)
+    {
+        WAIT_CLASS::bumpds();
+        fnstats.timeToUserAlerts = Waiter::ds - fnstats.startTime;
+        checkstartupdone();
+    }
+}
+
+void MegaClient::checkstartupdone()
+{
+    if (startupstage != STARTUP_SECONDARY || !statecurrent)
+    {
+        return;
+    }
+
+    // the contacts' keys are requested once the authrings are in, which a folder link or an account without
+    // keys (no FULLACCOUNT) doesn't wait for
+    bool keys = loggedin() != FULLACCOUNT || fnstats.timeToContactsKeys != NEVER;
+    bool alerts = loggedinfolderlink() || fnstats.timeToUserAlerts != NEVER;
+    if (!keys || !alerts)
+    {
+        return;
+    }
+
+    startupstage = STARTUP_DONE;
+    WAIT_CLASS::bumpds();
+    fnstats.timeToStartupDone = Waiter::ds - fnstats.startTime;
+    LOG_debug << "Startup done";
+    app->startup_stage(STARTUP_DONE);
+
+    string report;
+    fnstats.toJsonArray(&report);
+    sendevent(99426, report.c_str(), 0);    // Treeproc performance log
+}
+
 void MegaClient::fetchkeys()
 {
     fetchingkeys = true;
@@ -11350,8 +14122,31 @@ void MegaClient::loadAuthrings()
 
 void MegaClient::fetchContactsKeys()
 {
+    if (fnstats.timeToContactsKeys == NEVER && startupstage == STARTUP_SECONDARY)
+    {
+        WAIT_CLASS::bumpds();
+        fnstats.timeToContactsKeys = Waiter::ds - fnstats.startTime;
+        checkstartupdone();
+    }
+
     assert(mAuthRings.size() == 3);
     mAuthRingsTemp = mAuthRings;
+    mAuthRingsTempUntracked.clear();
+
+    for (auto &it : users)
+    {
+        User *user = &it.second;
+        if (user->userhandle != me)
+        {
+            for (auto& ar : mAuthRingsTemp)
+            {
+                if (!ar.second.isTracked(user->userhandle))
+                {
+                    mAuthRingsTempUntracked[ar.first].insert(user->userhandle);
+                }
+            }
+        }
+    }
 
     for (auto &it : users)
     {
@@ -11363,6 +14158,52 @@ void MegaClient::fetchContactsKeys()
     }
 }
 
+AuthRing* MegaClient::trackingauthring(attr_t authringType, std::unique_ptr<AuthRing>& aux, bool& temporal)
+{
+    // If checking authrings for all contacts (new session), accumulate updates for all contacts first
+    // in temporal authrings to put them all at once. Otherwise, update authring immediately
+    auto it = mAuthRingsTemp.find(authringType);
+    temporal = it != mAuthRingsTemp.end();
+    if (temporal)
+    {
+        return &it->second;  // modify the temporal authring directly
+    }
+
+    it = mAuthRings.find(authringType);
+    if (it == mAuthRings.end())
+    {
+        return nullptr;
+    }
+    aux = make_unique<AuthRing>(it->second);    // make a copy, once saved in API, it is updated
+    return aux.get();
+}
+
+bool MegaClient::authringtempcomplete(attr_t authringType, const AuthRing& authring)
+{
+    // drop the contacts tracked since (or gone), stopping at the first one still untracked
+    handle_set& untracked = mAuthRingsTempUntracked[authringType];
+    while (!untracked.empty())
+    {
+        handle uh = *untracked.begin();
+        if (finduser(uh) && !authring.isTracked(uh))
+        {
+            return false;
+        }
+        untracked.erase(untracked.begin());
+    }
+
+    // and confirm with the current contacts, as new ones may have appeared
+    for (auto &it : users)
+    {
+        User *user = &it.second;
+        if (user->userhandle != me && !authring.isTracked(user->userhandle))
+        {
+            untracked.insert(user->userhandle);
+        }
+    }
+    return untracked.empty();
+}
+
 void MegaClient::fetchContactKeys(User *user)
 {
     getua(user, ATTR_ED25519_PUBK, 0);
@@ -11392,27 +14233,14 @@ error MegaClient::trackKey(attr_t keyType, handle uh, const std::string &pubKey)
         return API_EARGS;
     }
 
-    // If checking authrings for all contacts (new session), accumulate updates for all contacts first
-    // in temporal authrings to put them all at once. Otherwise, update authring immediately
-    AuthRing *authring = nullptr;
     unique_ptr<AuthRing> aux;
-    auto it = mAuthRingsTemp.find(authringType);
-    bool temporalAuthring = it != mAuthRingsTemp.end();
-    if (temporalAuthring)
+    bool temporalAuthring;
+    AuthRing *authring = trackingauthring(authringType, aux, temporalAuthring);
+    if (!authring)
     {
-        authring = &it->second;  // modify the temporal authring directly
-    }
-    else
-    {
-        it = mAuthRings.find(authringType);
-        if (it == mAuthRings.end())
-        {
-            LOG_warn << "Failed to track public key in " << User::attr2string(authringType) << " for user " << uid << ": authring not available";
-            assert(false);
-            return API_ETEMPUNAVAIL;
-        }
-        aux = make_unique<AuthRing>(it->second);    // make a copy, once saved in API, it is updated
-        authring = aux.get();
+        LOG_warn << "Failed to track public key in " << User::attr2string(authringType) << " for user " << uid << ": authring not available";
+        assert(false);
+        return API_ETEMPUNAVAIL;
     }
 
     // compute key's fingerprint
@@ -11462,21 +14290,7 @@ error MegaClient::trackKey(attr_t keyType, handle uh, const std::string &pubKey)
         authring->add(uh, keyFingerprint, AUTH_METHOD_SEEN);
 
         // if checking authrings for all contacts, accumulate updates for all contacts first
-        bool finished = true;
-        if (temporalAuthring)
-        {
-            for (auto &it : users)
-            {
-                User *user = &it.second;
-                if (user->userhandle != me && !authring->isTracked(user->userhandle))
-                {
-                    // if only a current user is not tracked yet, update temporal authring
-                    finished = false;
-                    break;
-                }
-            }
-        }
-        if (finished)
+        if (!temporalAuthring || authringtempcomplete(authringType, *authring))
         {
             std::unique_ptr<string> newAuthring(authring->serialize(rng, key));
             putua(authringType, reinterpret_cast<const byte *>(newAuthring->data()), static_cast<unsigned>(newAuthring->size()), 0);
@@ -11505,27 +14319,11 @@ error MegaClient::trackSignature(attr_t signatureType, handle uh, const std::str
         return API_EARGS;
     }
 
-    // If checking authrings for all contacts (new session), accumulate updates for all contacts first
-    // in temporal authrings to put them all at once. Otherwise, send the update immediately
-    AuthRing *authring = nullptr;
-    unique_ptr<AuthRing> aux;
-    auto it = mAuthRingsTemp.find(authringType);
-    bool temporalAuthring = it != mAuthRingsTemp.end();
-    if (temporalAuthring)
+    if (!mAuthRingsTemp.count(authringType) && !mAuthRings.count(authringType))
     {
-        authring = &it->second;  // modify the temporal authring directly
-    }
-    else
-    {
-        it = mAuthRings.find(authringType);
-        if (it == mAuthRings.end())
-        {
-            LOG_warn << "Failed to track signature of public key in " << User::attr2string(authringType) << " for user " << uid << ": authring not available";
-            assert(false);
-            return API_ETEMPUNAVAIL;
-        }
-        aux = make_unique<AuthRing>(it->second);    // make a copy, once saved in API, it is updated
-        authring = aux.get();
+        LOG_warn << "Failed to track signature of public key in " << User::attr2string(authringType) << " for user " << uid << ": authring not available";
+        assert(false);
+        return API_ETEMPUNAVAIL;
     }
 
     const string *pubKey;
@@ -11543,38 +14341,94 @@ error MegaClient::trackSignature(attr_t signatureType, handle uh, const std::str
     }
     else if (signatureType == ATTR_SIG_RSA_PUBK)
     {
-        if (!user->pubk.isvalid())
+        if (!user->pubk.isvalid())
+        {
+            LOG_warn << "Failed to verify signature " << User::attr2string(signatureType) << " for user " << uid << ": RSA public key is not available";
+            assert(false);
+            return API_EINTERNAL;
+        }
+        user->pubk.serializekeyforjs(pubKeyBuf);
+        pubKey = &pubKeyBuf;
+    }
+    else
+    {
+        LOG_err << "Attempt to track an unknown type of signature: " <<  User::attr2string(signatureType);
+        assert(false);
+        return API_EINTERNAL;
+    }
+
+    // retrieve signing key from cache
+    if (!user->isattrvalid(ATTR_ED25519_PUBK))
+    {
+        LOG_warn << "Failed to verify signature " << User::attr2string(signatureType) << " for user " << uid << ": signing public key is not available";
+        assert(false);
+        return API_ETEMPUNAVAIL;
+    }
+    const string *signingPubKey = user->getattr(ATTR_ED25519_PUBK);
+
+    if (mAuthRingsTemp.count(authringType))
+    {
+        // checking all contacts: verify their signatures together
+        mPendingSignatures.push_back({ signatureType, uh, *pubKey, signature, *signingPubKey });
+        return API_OK;
+    }
+
+    // check signature for the public key
+    bool signatureVerified = EdDSA::verifyKey((unsigned char*) pubKey->data(), pubKey->size(), (string*)&signature, (unsigned char*) signingPubKey->data());
+    return applysignature(signatureType, uh, *pubKey, signatureVerified);
+}
+
+void MegaClient::verifysignatures()
+{
+    vector<PendingSignature> pending;
+    pending.swap(mPendingSignatures);
+    vector<char> verified(pending.size());
+
+    // libsodium's verification is stateless
+    runshards(pending.size(), SIGVERIFY_MINSHARD, [&pending, &verified](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
         {
-            LOG_warn << "Failed to verify signature " << User::attr2string(signatureType) << " for user " << uid << ": RSA public key is not available";
-            assert(false);
-            return API_EINTERNAL;
+            PendingSignature& p = pending[i];
+            verified[i] = EdDSA::verifyKey((unsigned char*) p.pubKey.data(), p.pubKey.size(), &p.signature, (unsigned char*) p.signingPubKey.data());
         }
-        user->pubk.serializekeyforjs(pubKeyBuf);
-        pubKey = &pubKeyBuf;
+    });
+
+    for (size_t i = 0; i < pending.size(); i++)
+    {
+        applysignature(pending[i].signatureType, pending[i].uh, pending[i].pubKey, verified[i] != 0);
     }
-    else
+
+    LOG_debug << "Verified " << pending.size() << " signatures of contact keys";
+}
+
+error MegaClient::applysignature(attr_t signatureType, handle uh, const string& pubKey, bool signatureVerified)
+{
+    User *user = finduser(uh);
+    if (!user)
     {
-        LOG_err << "Attempt to track an unknown type of signature: " <<  User::attr2string(signatureType);
-        assert(false);
-        return API_EINTERNAL;
+        LOG_warn << "Signature of a key verified for a user no longer known: " << Base64Str<MegaClient::USERHANDLE>(uh);
+        return API_ENOENT;
     }
+    const char *uid = user->uid.c_str();
+    attr_t authringType = AuthRing::signatureTypeToAuthringType(signatureType);
 
-    // retrieve signing key from cache
-    if (!user->isattrvalid(ATTR_ED25519_PUBK))
+    // If checking authrings for all contacts (new session), accumulate updates for all contacts first
+    // in temporal authrings to put them all at once. Otherwise, send the update immediately
+    unique_ptr<AuthRing> aux;
+    bool temporalAuthring;
+    AuthRing *authring = trackingauthring(authringType, aux, temporalAuthring);
+    if (!authring)
     {
-        LOG_warn << "Failed to verify signature " << User::attr2string(signatureType) << " for user " << uid << ": signing public key is not available";
-        assert(false);
+        LOG_warn << "Failed to track signature of public key in " << User::attr2string(authringType) << " for user " << uid << ": authring not available";
         return API_ETEMPUNAVAIL;
     }
-    const string *signingPubKey = user->getattr(ATTR_ED25519_PUBK);
 
     // compute key's fingerprint
-    string keyFingerprint = AuthRing::fingerprint(*pubKey);
+    string keyFingerprint = AuthRing::fingerprint(pubKey);
     bool fingerprintMatch = false;
     bool keyTracked = authring->isTracked(uh);
 
-    // check signature for the public key
-    bool signatureVerified = EdDSA::verifyKey((unsigned char*) pubKey->data(), pubKey->size(), (string*)&signature, (unsigned char*) signingPubKey->data());
     if (signatureVerified)
     {
         LOG_debug << "Signature " << User::attr2string(signatureType) << " succesfully verified for user " << user->uid;
@@ -11611,21 +14465,7 @@ error MegaClient::trackSignature(attr_t signatureType, handle uh, const std::str
         }
 
         // if checking authrings for all contacts, accumulate updates for all contacts first
-        bool finished = true;
-        if (temporalAuthring)
-        {
-            for (auto &it : users)
-            {
-                User *user = &it.second;
-                if (user->userhandle != me && !authring->isTracked(user->userhandle))
-                {
-                    // if only a current user is not tracked yet, update temporal authring
-                    finished = false;
-                    break;
-                }
-            }
-        }
-        if (finished)
+        if (!temporalAuthring || authringtempcomplete(authringType, *authring))
         {
             std::unique_ptr<string> newAuthring(authring->serialize(rng, key));
             putua(authringType, reinterpret_cast<const byte *>(newAuthring->data()), static_cast<unsigned>(newAuthring->size()), 0);
@@ -11761,19 +14601,31 @@ void MegaClient::purgenodesusersabortsc()
     }
 
     syncs.clear();
+
+    // waits for the move in progress, if any
+    syncdebrisqueue.reset();
 #endif
 
+    discardingnodes = true;
     for (node_map::iterator it = nodes.begin(); it != nodes.end(); it++)
     {
         delete it->second;
     }
+    discardingnodes = false;
 
     nodes.clear();
+    mFingerprints.clear();
+    filesbyctime.clear();
+    mNodeCounters.clear();
+    pagedcounts.clear();
+    pagedsubtrees.clear();
+    pagedoutnodes = 0;
+    newversions.clear();
+    nodescopeshares.clear();
 
 #ifdef ENABLE_SYNC
     todebris.clear();
     tounlink.clear();
-    mFingerprints.clear();
 #endif
 
     for (fafc_map::iterator cit = fafcs.begin(); cit != fafcs.end(); cit++)
@@ -11807,6 +14659,7 @@ void MegaClient::purgenodesusersabortsc()
         delete it->second;
         chats.erase(it++);
     }
+    attachmentchats.clear();
     chatnotify.clear();
 #endif
 
@@ -11847,15 +14700,52 @@ void MegaClient::purgenodesusersabortsc()
 }
 
 // request direct read by node pointer
-void MegaClient::pread(Node* n, m_off_t count, m_off_t offset, void* appdata)
+void MegaClient::pread(Node* n, m_off_t count, m_off_t offset, void* appdata, m_off_t maxleased)
+{
+    queueread(n->nodehandle, true, n->nodecipher(), MemAccess::get<int64_t>((const char*)n->nodekey().data() + SymmCipher::KEYLENGTH), count, offset, appdata, NULL, NULL, NULL, maxleased);
+
+    if (n->hasfileattribute(fa_media) && n->nodekey().size() == FILENODEKEYLENGTH)
+    {
+        MediaProperties mp = MediaProperties::decodeMediaPropertiesAttributes(n->fileattrstring, (uint32_t*)(n->nodekey().data() + FILENODEKEYLENGTH / 2));
+        setstreamingbitrate(n->nodehandle, true, StreamingScheduler::bitrateof(n->size, mp.playtime));
+    }
+}
+
+void MegaClient::setstreamingbitrate(handle h, bool p, m_off_t bitrate)
+{
+    encodehandletype(&h, p);
+
+    handledrn_map::iterator it = hdrns.find(h);
+    if (it != hdrns.end())
+    {
+        it->second->bitrate = bitrate;
+    }
+}
+
+// share the link between the streams and the downloads that don't stream
+void MegaClient::schedulestreaming()
 {
-    queueread(n->nodehandle, true, n->nodecipher(), MemAccess::get<int64_t>((const char*)n->nodekey().data() + SymmCipher::KEYLENGTH), count, offset, appdata);
+    size_t streams = 0;
+    m_off_t bitrate = 0;
+    bool behind = false;
+    for (auto& it : hdrns)
+    {
+        DirectReadNode* drn = it.second;
+        if (drn->bitrate && !drn->reads.empty())
+        {
+            streams++;
+            bitrate += drn->bitrate;
+            behind = behind || drn->streamingbehind(Waiter::ds);
+        }
+    }
+
+    streamingscheduler.update(httpio->shaper, httpio->downloadSpeed, streams, bitrate, behind, Waiter::ds);
 }
 
 // request direct read by exported handle / key
-void MegaClient::pread(handle ph, SymmCipher* key, int64_t ctriv, m_off_t count, m_off_t offset, void* appdata, bool isforeign, const char *privauth, const char *pubauth, const char *cauth)
+void MegaClient::pread(handle ph, SymmCipher* key, int64_t ctriv, m_off_t count, m_off_t offset, void* appdata, bool isforeign, const char *privauth, const char *pubauth, const char *cauth, m_off_t maxleased)
 {
-    queueread(ph, isforeign, key, ctriv, count, offset, appdata, privauth, pubauth, cauth);
+    queueread(ph, isforeign, key, ctriv, count, offset, appdata, privauth, pubauth, cauth, maxleased);
 }
 
 // since only the first six bytes of a handle are in use, we use the seventh to encode its type
@@ -11872,7 +14762,7 @@ bool MegaClient::isprivatehandle(handle* hp)
     return ((char*)hp)[NODEHANDLE] != 0;
 }
 
-void MegaClient::queueread(handle h, bool p, SymmCipher* key, int64_t ctriv, m_off_t offset, m_off_t count, void* appdata, const char* privauth, const char *pubauth, const char *cauth)
+void MegaClient::queueread(handle h, bool p, SymmCipher* key, int64_t ctriv, m_off_t offset, m_off_t count, void* appdata, const char* privauth, const char *pubauth, const char *cauth, m_off_t maxleased)
 {
     handledrn_map::iterator it;
 
@@ -11885,7 +14775,7 @@ void MegaClient::queueread(handle h, bool p, SymmCipher* key, int64_t ctriv, m_o
         // this handle is not being accessed yet: insert
         it = hdrns.insert(hdrns.end(), pair<handle, DirectReadNode*>(h, new DirectReadNode(this, h, p, key, ctriv, privauth, pubauth, cauth)));
         it->second->hdrn_it = it;
-        it->second->enqueue(offset, count, reqtag, appdata);
+        it->second->enqueue(offset, count, reqtag, appdata, maxleased);
 
         if (overquotauntil && overquotauntil > Waiter::ds)
         {
@@ -11900,7 +14790,7 @@ void MegaClient::queueread(handle h, bool p, SymmCipher* key, int64_t ctriv, m_o
     }
     else
     {
-        it->second->enqueue(offset, count, reqtag, appdata);
+        it->second->enqueue(offset, count, reqtag, appdata, maxleased);
         if (overquotauntil && overquotauntil > Waiter::ds)
         {
             dstime timeleft = dstime(overquotauntil - Waiter::ds);
@@ -11935,7 +14825,12 @@ void MegaClient::abortreads(handle h, bool p, m_off_t offset, m_off_t count)
 
         for (dr_list::iterator it = drn->reads.begin(); it != drn->reads.end(); )
         {
-            if ((offset < 0 || offset == (*it)->offset) && (count < 0 || count == (*it)->count))
+            if ((*it)->prefetch)
+            {
+                // goes with the node, or with the next retry
+                it++;
+            }
+            else if ((offset < 0 || offset == (*it)->offset) && (count < 0 || count == (*it)->count))
             {
                 app->pread_failure(API_EINCOMPLETE, (*it)->drn->retries, (*it)->appdata, 0);
 
@@ -11946,10 +14841,85 @@ void MegaClient::abortreads(handle h, bool p, m_off_t offset, m_off_t count)
     }
 }
 
+void MegaClient::execpipelinedcs()
+{
+    // one response at a time, from the start: processing it can log out and drop the others
+    for (bool completed = true; completed; )
+    {
+        completed = false;
+        for (auto it = pipelinedcs.begin(); it != pipelinedcs.end(); it++)
+        {
+            HttpReq* req = it->second.get();
+            if (req->status != REQ_SUCCESS && req->status != REQ_FAILURE)
+            {
+                continue;
+            }
+
+            uint64_t seq = it->first;
+            string in = std::move(req->in);
+            bool failed = req->status == REQ_FAILURE || in == "-3" || in == "-4";
+            pipelinedcs.erase(it);
+            completed = true;
+
+            if (failed)
+            {
+                LOG_debug << "Pipelined request failed, retrying";
+                reqs.requeuepipelined(seq);
+                btpipelined.backoff();
+            }
+            else if (*in.c_str() == '[')
+            {
+                btpipelined.reset();
+                reqs.pipelinedresponse(seq, std::move(in), this);
+            }
+            else
+            {
+                error e = (error)atoi(in.c_str());
+                reqs.pipelinederror(seq, e ? e : API_EINTERNAL, this);
+            }
+            break;
+        }
+    }
+
+    while (pipelinedcs.size() < reqs.pipelinedepth() && reqs.pipelinedpending() && btpipelined.armed())
+    {
+        unique_ptr<HttpReq> req(new HttpReq());
+        req->protect = true;
+        req->logname = clientname + "csp ";
+
+        bool suppressSID = true;
+        uint64_t seq = reqs.sendpipelined(req->out, suppressSID);
+
+        // these commands only read, so a retry can safely carry a fresh request ID
+        char id[sizeof reqid];
+        for (size_t i = sizeof id; i--; )
+        {
+            id[i] = static_cast<char>('a' + rng.genuint32(26));
+        }
+
+        req->posturl = APIURL;
+        req->posturl.append("cs?id=");
+        req->posturl.append(id, sizeof id);
+        if (!suppressSID)
+        {
+            req->posturl.append(auth);
+        }
+        req->posturl.append(appkey);
+        if (lang.size())
+        {
+            req->posturl.append(lang);
+        }
+        req->type = REQ_JSON;
+        req->post(this);
+        pipelinedcs[seq] = std::move(req);
+    }
+}
+
 // execute pending directreads
 bool MegaClient::execdirectreads()
 {
     CodeCounter::ScopeTimer ccst(performanceStats.execdirectreads);
+    ExecTracer::Phase etp(execTracer, ExecTracer::DIRECTREADS);
 
     bool r = false;
     DirectReadSlot* drs;
@@ -11957,12 +14927,30 @@ bool MegaClient::execdirectreads()
     if (drq.size() < MAXDRSLOTS)
     {
         // fill slots
-        for (dr_list::iterator it = drq.begin(); it != drq.end(); it++)
+        for (dr_list::iterator it = drq.begin(); it != drq.end(); )
         {
-            if (!(*it)->drs)
+            DirectRead* dr = *(it++);
+            if (!dr->drs)
             {
-                drs = new DirectReadSlot(*it);
-                (*it)->drs = drs;
+                if (dr->drbuf.tempUrlVector().empty())
+                {
+                    // DirectRead starting: from what the node has cached, then from the read ahead in flight, then from the server
+                    if (!dr->prefetch && dr->servecached())
+                    {
+                        r = true;
+                        break;
+                    }
+
+                    if (!dr->prefetch && dr->drn->prefetching(dr->offset + dr->progress))
+                    {
+                        continue;
+                    }
+
+                    dr->drbuf.setIsRaid(dr->drn->tempurls, dr->offset + dr->progress, dr->offset + dr->count, dr->drn->size, 2097152);  // 2 MB max buffer usage approx for streaming
+                }
+
+                drs = new DirectReadSlot(dr);
+                dr->drs = drs;
                 r = true;
 
                 if (drq.size() >= MAXDRSLOTS) break;
@@ -11970,6 +14958,8 @@ bool MegaClient::execdirectreads()
         }
     }
 
+    schedulestreaming();
+
     // perform slot I/O
     for (drs_list::iterator it = drss.begin(); it != drss.end(); )
     {
@@ -12099,7 +15089,7 @@ error MegaClient::isnodesyncable(Node *remotenode, bool *isinshare)
 
 error MegaClient::addtimer(TimerWithBackoff *twb)
 {
-    bttimers.push_back(twb);
+    bttimers.emplace(twb->nextset(), twb);
     return API_OK;
 }
 
@@ -12143,6 +15133,10 @@ error MegaClient::addsync(SyncConfig syncConfig, const char* debris, string* loc
         {
             LOG_debug << "Adding sync: " << syncConfig.getLocalPath();
 
+            // the files paged out below it would look missing to syncdown() and syncup(), and
+            // pageable() keeps them resident from here on
+            pageinsubtree(remotenode);
+
             Sync* sync = new Sync(this, std::move(syncConfig), debris, localdebris, remotenode, inshare, tag, appData);
             sync->isnetwork = isnetwork;
 
@@ -12158,7 +15152,20 @@ error MegaClient::addsync(SyncConfig syncConfig, const char* debris, string* loc
                 }
             }
 
-            if (sync->scan(&rootpath, fa.get()))
+            if (sync->resumefromjournal())
+            {
+                syncsup = false;
+                e = API_OK;
+                sync->initializing = false;
+            }
+            else if (syncscanthreads)
+            {
+                // the sync stays in initializing until procdirscan() has merged the last folder
+                sync->startdirscan(rootpath, syncscanthreads);
+                syncsup = false;
+                e = API_OK;
+            }
+            else if (sync->scan(&rootpath, fa.get()))
             {
                 syncsup = false;
                 e = API_OK;
@@ -12251,6 +15258,53 @@ void MegaClient::addchild(remotenode_map* nchildren, string* name, Node* n, list
     }
 }
 
+// synced nodes, new children of synced folders and ancestors of sync roots
+bool MegaClient::affectssync(Node* n)
+{
+    if (!n || syncs.empty())
+    {
+        return false;
+    }
+
+    if (n->localnode || (n->parent && n->parent->localnode))
+    {
+        return true;
+    }
+
+    for (sync_list::iterator it = syncs.begin(); it != syncs.end(); it++)
+    {
+        if ((*it)->localroot->node && (*it)->localroot->node->isbelow(n))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+LocalNode* MegaClient::findmovedlocalnode(Sync* sync, const FileFingerprint& fp, bool remotelydeleted)
+{
+    auto range = localsyncmovecandidates.equal_range(std::make_pair(fp.size, fp.mtime));
+
+    for (auto it = range.first; it != range.second; it++)
+    {
+        LocalNode* ll = it->second;
+
+        if (ll->sync != sync || ll->type != FILENODE || !ll->isvalid || !fp.isvalid
+                || memcmp(ll->crc.data(), fp.crc.data(), sizeof ll->crc))
+        {
+            continue;
+        }
+
+        if (remotelydeleted ? ll->deleted : (ll->notseen && ll->node && !ll->deleted))
+        {
+            return ll;
+        }
+    }
+
+    return NULL;
+}
+
 // downward sync - recursively scan for tree differences and execute them locally
 // this is first called after the local node tree is complete
 // actions taken:
@@ -12268,6 +15322,18 @@ bool MegaClient::syncdown(LocalNode* l, string* localpath, bool rubbish)
         return true;
     }
 
+    // nothing changed in here since the last look
+    if (!syncdownfull && !l->syncdowndirty)
+    {
+        return true;
+    }
+
+    l->syncdowndirty = false;
+
+    // resident already, unless paged out before the sync was there
+    pageinchildren(l->node);
+    assert(!pagedchildren(l->node->nodehandle));
+
     list<string> strings;
     remotenode_map nchildren;
     remotenode_map::iterator rit;
@@ -12287,7 +15353,7 @@ bool MegaClient::syncdown(LocalNode* l, string* localpath, bool rubbish)
         // be considered - also, prevent clashes with the local debris folder
         if (((*it)->syncdeleted == SYNCDEL_NONE
              && !(*it)->attrstring
-             && (ait = (*it)->attrs.map.find('n')) != (*it)->attrs.map.end()
+             && (ait = (*it)->attrs().map.find('n')) != (*it)->attrs().map.end()
              && ait->second.size())
          && (l->parent || l->sync->debris != ait->second))
         {
@@ -12411,6 +15477,27 @@ bool MegaClient::syncdown(LocalNode* l, string* localpath, bool rubbish)
 
             lit++;
         }
+        else if (rubbish && ll->deleted && ll->debrispending)
+        {
+            // being moved to the local debris (see syncdebriscompleted())
+            lit++;
+        }
+        else if (rubbish && ll->deleted && syncdebristhreads)
+        {
+            // the fingerprint check and the move are done by the queue's threads
+            if (!syncdebrisqueue)
+            {
+                syncdebrisqueue.reset(new SyncDebrisQueue(syncdebrisfsaccess, syncdebristhreads, waiter));
+            }
+
+            string tmplocalpath;
+            ll->getlocalpath(&tmplocalpath);
+
+            ll->treestate(TREESTATE_SYNCING);
+            syncdebrisqueue->add(ll, tmplocalpath, l->sync->localdebris, ll->type == FILENODE ? (FileFingerprint*)ll : nullptr);
+            ll->debrispending = true;
+            lit++;
+        }
         else if (rubbish && ll->deleted)    // no corresponding remote node: delete local item
         {
             if (ll->type == FILENODE)
@@ -12465,7 +15552,7 @@ bool MegaClient::syncdown(LocalNode* l, string* localpath, bool rubbish)
     {
         size_t t = localpath->size();
 
-        localname = rit->second->attrs.map.find('n')->second;
+        localname = rit->second->attrs().map.find('n')->second;
 
         fsaccess->name2local(&localname);
         localpath->append(fsaccess->localseparator);
@@ -12544,6 +15631,37 @@ bool MegaClient::syncdown(LocalNode* l, string* localpath, bool rubbish)
                 f.reset();
                 rit->second->localnode = NULL;
 
+                // the same content deleted remotely from elsewhere in this sync (a remote move
+                // seen as deletion + new node): move the local file instead of downloading it
+                LocalNode* moved;
+                if (download && !rit->second->syncget && rit->second->isvalid
+                        && (moved = findmovedlocalnode(l->sync, *rit->second, true)))
+                {
+                    string curpath;
+                    moved->getlocalpath(&curpath);
+
+                    f = fsaccess->newfileaccess(false);
+                    bool unchanged = f->fopen(&curpath) && f->type == FILENODE
+                            && f->size == moved->size && f->mtime == moved->mtime;
+                    f.reset();
+
+                    if (unchanged && fsaccess->renamelocal(&curpath, localpath))
+                    {
+                        LOG_debug << "Moving a remotely deleted copy instead of downloading the file node";
+                        fsaccess->local2path(localpath, &localname);
+                        app->syncupdate_local_move(l->sync, moved, localname.c_str());
+
+                        moved->setnode(rit->second);
+                        moved->setnameparent(l, localpath);
+                        moved->setmovecandidate(false);
+                        l->sync->statecacheadd(moved);
+
+                        updateputs();
+                        syncactivity = true;
+                        download = false;
+                    }
+                }
+
                 // start fetching this node, unless fetch is already in progress
                 // FIXME: to cover renames that occur during the
                 // download, reconstruct localname in complete()
@@ -12607,6 +15725,12 @@ bool MegaClient::syncdown(LocalNode* l, string* localpath, bool rubbish)
         localpath->resize(t);
     }
 
+    if (!success)
+    {
+        // to be retried
+        l->setsyncdirty();
+    }
+
     return success;
 }
 
@@ -12620,6 +15744,14 @@ bool MegaClient::syncdown(LocalNode* l, string* localpath, bool rubbish)
 // for creation
 bool MegaClient::syncup(LocalNode* l, dstime* nds)
 {
+    // nothing changed in here since the last look
+    if (!syncupfull && !l->syncupdirty)
+    {
+        return true;
+    }
+
+    l->syncupdirty = false;
+
     bool insync = true;
 
     list<string> strings;
@@ -12634,6 +15766,9 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
 
     if (l->node)
     {
+        pageinchildren(l->node);
+        assert(!pagedchildren(l->node->nodehandle));
+
         // corresponding remote node present: build child hash - nameclash
         // resolution: use newest version
         for (node_list::iterator it = l->node->children.begin(); it != l->node->children.end(); it++)
@@ -12669,7 +15804,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
                 }
 
                 // ...or a node name attribute missing
-                if ((ait = (*it)->attrs.map.find('n')) == (*it)->attrs.map.end())
+                if ((ait = (*it)->attrs().map.find('n')) == (*it)->attrs().map.end())
                 {
                     LOG_warn << "Node name missing, not syncing subtree: " << l->name.c_str();
 
@@ -12757,6 +15892,15 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
                     {
                         // files have the same size and the same mtime (or the
                         // same fingerprint, if available): no action needed
+                        if (synccontenthashminsize && ll->size >= synccontenthashminsize && ll->contenthash.empty() && !ll->transfer)
+                        {
+                            // read once, to tell a later change of mtime alone from a change of content
+                            if (ll->gencontenthash(&ll->contenthash))
+                            {
+                                ll->sync->statecacheadd(ll);
+                            }
+                        }
+
                         if (!ll->checked)
                         {
                             if (!gfxdisabled && gfx && gfx->isgfx(&ll->localname))
@@ -12779,7 +15923,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
                                 {
                                     char me64[12];
                                     Base64::btoa((const byte*)&me, MegaClient::USERHANDLE, me64);
-                                    if (ll->node->attrs.map.find('f') == ll->node->attrs.map.end() || ll->node->attrs.map['f'] != me64)
+                                    if (ll->node->attrs().map.find('f') == ll->node->attrs().map.end() || ll->node->attrs().map['f'] != me64)
                                     {
                                         LOG_debug << "Restoring missing attributes: " << ll->name;
                                         string localpath;
@@ -12840,6 +15984,28 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
                         }
                     }
 
+                    if (!ll->contenthash.empty())
+                    {
+                        string hash;
+                        if (ll->size == rit->second->size && !memcmp(ll->crc.data(), rit->second->crc.data(), sizeof ll->crc)
+                                && checkaccess(rit->second, FULL) && rit->second->nodecipher()
+                                && ll->gencontenthash(&hash) && hash == ll->contenthash)
+                        {
+                            // same content: update the fingerprint of the node instead of uploading a new version
+                            LOG_debug << "Modification time changed only, content unchanged: " << ll->name << " LNmtime: " << ll->mtime;
+                            Node* n = rit->second;
+                            ll->serializefingerprint(&n->attrs().map['c']);
+                            n->setfingerprint();
+                            setattr(n);
+                            ll->treestate(TREESTATE_SYNCED);
+                            continue;
+                        }
+
+                        // the hash no longer matches the file
+                        ll->contenthash.clear();
+                        ll->sync->statecacheadd(ll);
+                    }
+
                     LOG_debug << "LocalNode change detected on syncupload: " << ll->name << " LNsize: " << ll->size << " LNmtime: " << ll->mtime
                               << " NSize: " << rit->second->size << " Nmtime: " << rit->second->mtime << " Nhandle: " << LOG_NODEHANDLE(rit->second->nodehandle);
 
@@ -12909,6 +16075,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
                     // recurse into directories of equal name
                     if (!syncup(ll, nds))
                     {
+                        l->setsyncdirty();
                         return false;
                     }
                     continue;
@@ -12925,6 +16092,9 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
             // do not begin transfer until the file size / mtime has stabilized
             insync = false;
 
+            // to be looked at again until it is
+            ll->setsyncdirty();
+
             if (ll->transfer)
             {
                 continue;
@@ -12949,6 +16119,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
                 if (currentVersion)
                 {
                     m_time_t delay = 0;
+                    m_time_t capnext = 0;
                     m_time_t currentTime = m_time();
                     if (currentVersion->ctime > currentTime + 30)
                     {
@@ -12969,6 +16140,15 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
                             }
 
                             recentVersions++;
+
+                            // with the cap reached, the next version waits for this one to be an hour old
+                            if (syncmaxversionsperhour && unsigned(recentVersions) == syncmaxversionsperhour
+                                    && version->ctime > currentTime - 3600)
+                            {
+                                capnext = version->ctime + 3600;
+                            }
+
+                            pageinchildren(version);
                             if (!version->children.size())
                             {
                                 break;
@@ -12987,9 +16167,9 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
                                   << " prev: " << currentVersion->ctime << " current: " << currentTime;
                     }
 
-                    if (delay)
+                    if (delay || capnext)
                     {
-                        m_time_t next = currentVersion->ctime + delay;
+                        m_time_t next = std::max(delay ? currentVersion->ctime + delay : 0, capnext);
                         if (next > currentTime)
                         {
                             dstime backoffds = dstime((next - currentTime) * 10);
@@ -13042,11 +16222,13 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
                 }
                 
                 ll->created = false;
+                ll->nagleinitialds = 0;
             }
         }
         else
         {
             LOG_verbose << "Unsynced LocalNode (folder): " << ll->name;
+            ll->setsyncdirty();
         }
 
         if (ll->created)
@@ -13079,7 +16261,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
                 {
                     int namelen;
 
-                    if ((ait = ll->node->attrs.map.find('n')) != ll->node->attrs.map.end())
+                    if ((ait = ll->node->attrs().map.find('n')) != ll->node->attrs().map.end())
                     {
                         namelen = int(ait->second.size());
                     }
@@ -13114,6 +16296,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
             if (synccreate.size() >= MAX_NEWNODES)
             {
                 LOG_warn << "Stopping syncup due to MAX_NEWNODES";
+                l->setsyncdirty();
                 return false;
             }
         }
@@ -13122,6 +16305,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
         {
             if (!syncup(ll, nds))
             {
+                l->setsyncdirty();
                 return false;
             }
         }
@@ -13205,7 +16389,7 @@ void MegaClient::syncupdate()
                     // FIXME: move instead of creating a copy if it is in
                     // rubbish to reduce node creation load
                     nnp->nodekey = n->nodekey();
-                    tattrs.map = n->attrs.map;
+                    tattrs.map = n->attrs().map;
 
                     nameid rrname = AttrMap::string2nameid("rr");
                     attr_map::iterator it = tattrs.map.find(rrname);
@@ -13296,6 +16480,13 @@ void MegaClient::putnodes_sync_result(error e, NewNode* nn, int nni)
         }
         else if (nn[nni].localnode && (n = nn[nni].localnode->node))
         {
+            LocalNode* l = nn[nni].localnode;
+            if (l->notifiedds && l->sync)
+            {
+                l->sync->addlag(Waiter::ds - l->notifiedds);
+                l->notifiedds = 0;
+            }
+
             if (n->type == FOLDERNODE)
             {
                 app->syncupdate_remote_folder_addition(nn[nni].localnode->sync, n);
@@ -13489,7 +16680,7 @@ void MegaClient::execmovetosyncdebris()
     // in order to reduce the API load, we move
     // - SYNCDEL_DELETED nodes to any available target
     // - SYNCDEL_BIN/SYNCDEL_DEBRIS nodes to SYNCDEL_DEBRISDAY
-    // (move top-level nodes only)
+    // (move top-level nodes only: the others go with them)
     for (it = todebris.begin(); it != todebris.end(); )
     {
         n = *it;
@@ -13500,7 +16691,16 @@ void MegaClient::execmovetosyncdebris()
         {
             while ((n = n->parent) && n->syncdeleted == SYNCDEL_NONE);
 
-            if (!n)
+            if (n)
+            {
+                // a local folder deletion queues its children first (see ~LocalNode()).  Dropped here, they
+                // are not moved one by one once their ancestor is in the debris and back to SYNCDEL_NONE
+                n = *it;
+                n->syncdeleted = SYNCDEL_NONE;
+                n->todebris_it = todebris.end();
+                todebris.erase(it++);
+            }
+            else
             {
                 n = *it;
 
@@ -13525,10 +16725,6 @@ void MegaClient::execmovetosyncdebris()
                     todebris.erase(it++);
                 }
             }
-            else
-            {
-                it++;
-            }
         }
         else if (n->syncdeleted == SYNCDEL_DEBRISDAY
                  || n->syncdeleted == SYNCDEL_FAILED)
@@ -13879,6 +17075,81 @@ void MegaClient::stopxfer(File* f, DBTableTransactionCommitter* committer)
     }
 }
 
+void MegaClient::stopxfers(direction_t d, const std::function<bool(File*)>& match, DBTableTransactionCommitter& committer)
+{
+    vector<uint32_t> dbids;
+    size_t stopped = 0, removed = 0;
+
+    auto stop = [&](Transfer* transfer)
+    {
+        bool changed = false;
+        for (file_list::iterator it = transfer->files.begin(); it != transfer->files.end(); )
+        {
+            File* f = *it++;
+            if (match(f))
+            {
+                transfer->removeTransferFile(API_EINCOMPLETE, f, &committer, &dbids);
+                changed = true;
+                stopped++;
+            }
+        }
+
+        if (transfer->files.empty())
+        {
+            looprequested = true;
+            transfer->finished = true;
+            transfer->state = TRANSFERSTATE_CANCELLED;
+            app->transfer_removed(transfer);
+
+            // its record goes with the batch, not from the destructor
+            if (tctable && transfer->dbid)
+            {
+                dbids.push_back(transfer->dbid);
+                transfer->dbid = 0;
+            }
+
+            delete transfer;
+            removed++;
+        }
+        else if (changed && transfer->type == PUT && transfer->localfilename.size())
+        {
+            transfer->files.front()->prepare();
+        }
+    };
+
+    // from the back of the queue, so that erasing a transfer from it moves only the ones left after it
+    transfer_list& queue = transferlist.transfers[d];
+    for (size_t i = queue.size(); i--; )
+    {
+        if (i < queue.size())
+        {
+            stop(queue[i]);
+        }
+    }
+
+    // and those no longer queued
+    vector<Transfer*> unqueued;
+    for (auto& it : transfers[d])
+    {
+        if (std::any_of(it.second->files.begin(), it.second->files.end(), match))
+        {
+            unqueued.push_back(it.second);
+        }
+    }
+    for (Transfer* transfer : unqueued)
+    {
+        stop(transfer);
+    }
+
+    if (!dbids.empty())
+    {
+        tctable->checkCommitter(&committer);
+        tctable->delBatch(dbids);
+    }
+
+    LOG_debug << "Stopped " << stopped << " files and " << removed << " transfers";
+}
+
 // pause/unpause transfers
 void MegaClient::pausexfers(direction_t d, bool pause, bool hard, DBTableTransactionCommitter& committer)
 {
@@ -13942,20 +17213,205 @@ void MegaClient::setmaxconnections(direction_t d, int num)
     }
 }
 
+void MegaClient::setautoconnections(direction_t d, bool enable)
+{
+    autoconnections[d] = enable;
+
+    if (!enable)
+    {
+        // back to the fixed number; surplus connections close as they finish
+        for (TransferSlot* slot : tslots)
+        {
+            if (slot->transfer->type == d && slot->autoconnectable())
+            {
+                slot->targetconnections = connections[d];
+                slot->probespeed = -1;
+            }
+        }
+    }
+}
+
+void MegaClient::setconnectionbudget(unsigned budget)
+{
+    connectionbudget = std::max(budget, 1u);
+}
+
+void MegaClient::rebalanceconnections()
+{
+    unsigned used = 0;
+    TransferSlot* best = NULL;
+    TransferSlot* worst = NULL;
+
+    for (TransferSlot* slot : tslots)
+    {
+        used += unsigned(slot->targetconnections);
+
+        if (!autoconnections[slot->transfer->type] || !slot->autoconnectable())
+        {
+            continue;
+        }
+
+        m_off_t speed = slot->speedController.calculateSpeed(0);
+
+        if (slot->probespeed >= 0)
+        {
+            // the connection added last time stays if it brought at least half of what the others bring on average
+            slot->connectiongain = speed - slot->probespeed;
+            if (slot->connectiongain * 2 * (slot->targetconnections - 1) < slot->probespeed)
+            {
+                LOG_debug << "Connection probe rejected: " << slot->probespeed << " -> " << speed << " B/s with "
+                          << slot->targetconnections << " connections";
+                slot->targetconnections--;
+                used--;
+            }
+            slot->probespeed = -1;
+            continue;
+        }
+
+        if (slot->targetconnections < int(MAX_NUM_CONNECTIONS) && (!best || slot->connectiongain > best->connectiongain))
+        {
+            best = slot;
+        }
+
+        if (slot->targetconnections > 1 && (!worst || slot->connectiongain < worst->connectiongain))
+        {
+            worst = slot;
+        }
+    }
+
+    if (!best || best->connectiongain <= 0)
+    {
+        return;
+    }
+
+    if (used >= connectionbudget && worst && worst != best && worst->connectiongain < best->connectiongain / 2)
+    {
+        // move a connection from the transfer that gains least from it
+        worst->targetconnections--;
+        used--;
+    }
+
+    if (used < connectionbudget && memorypressure != MEMORY_PRESSURE_CRITICAL)
+    {
+        best->probespeed = best->speedController.calculateSpeed(0);
+        best->targetconnections++;
+    }
+}
+
+void MegaClient::setbufferpoollimit(size_t bytes)
+{
+    bufferpoollimit = bytes;
+    bufferpool->setlimit(memorypressure == MEMORY_PRESSURE_NONE ? bytes : memorypressure == MEMORY_PRESSURE_MODERATE ? bytes / 2 : 0);
+}
+
+#ifdef ENABLE_SYNC
+void MegaClient::setsyncscanthreads(unsigned threads)
+{
+    // scans already running keep their threads
+    syncscanthreads = std::min(threads, 64u);
+}
+
+void MegaClient::setsyncprefetch(size_t depth, std::function<FileSystemAccess*()> newfsaccess)
+{
+    syncprefetchdepth = newfsaccess ? std::min(depth, size_t(1024)) : 0;
+    syncprefetchfsaccess = std::move(newfsaccess);
+
+    // the syncs start new prefetchers when they next run
+    for (Sync* sync : syncs)
+    {
+        sync->prefetcher.reset();
+    }
+}
+
+void MegaClient::setsyncdebristhreads(unsigned threads, std::function<FileSystemAccess*()> newfsaccess)
+{
+    // moves already queued finish on the current threads, and the queue is replaced when it next runs dry
+    syncdebristhreads = newfsaccess ? std::min(threads, 64u) : 0;
+    syncdebrisfsaccess = std::move(newfsaccess);
+    if (syncdebrisqueue && syncdebrisqueue->idle())
+    {
+        syncdebrisqueue.reset();
+    }
+}
+
+void MegaClient::syncdebriscompleted()
+{
+    if (!syncdebrisqueue)
+    {
+        return;
+    }
+
+    bool transient = false;
+    SyncDebrisQueue::Result result;
+    while (syncdebrisqueue->next(result))
+    {
+        LocalNode* l = result.localnode;
+        l->debrispending = false;
+        syncactivity = true;
+
+        if (result.result == SyncDebrisQueue::CHANGED)
+        {
+            l->deleted = false;
+        }
+        else if (result.result == SyncDebrisQueue::TRANSIENT)
+        {
+            // retried by the next syncdown()
+            fsaccess->local2path(&result.localpath, &blockedfile);
+            LOG_warn << "Transient error deleting " << blockedfile;
+            transient = true;
+        }
+        else if (l->deleted)
+        {
+            delete l;
+        }
+    }
+
+    if (transient)
+    {
+        if (!syncfsopsfailed)
+        {
+            syncfsopsfailed = true;
+            app->syncupdate_local_lockretry(true);
+        }
+        syncdownretry = true;
+        syncdownbt.backoff(50);
+    }
+}
+#endif
+
+void MegaClient::settransfercryptothreads(unsigned threads, size_t maxInFlightBytes)
+{
+    // a replaced pool finishes its queued jobs before going away, so no transfer is left waiting on it
+    transferCryptoPool.reset(threads ? new TransferCryptoPool(threads, maxInFlightBytes, waiter) : nullptr);
+    if (transferCryptoPool && !transferCryptoPool->threads())
+    {
+        transferCryptoPool.reset();
+    }
+}
+
 Node* MegaClient::nodebyfingerprint(FileFingerprint* fingerprint)
 {
+    pageinbyfingerprint(fingerprint);
     return mFingerprints.nodebyfingerprint(fingerprint);
 }
 
 node_vector *MegaClient::nodesbyfingerprint(FileFingerprint* fingerprint)
 {
+    pageinbyfingerprint(fingerprint);
     return mFingerprints.nodesbyfingerprint(fingerprint);
 }
 
-static bool nodes_ctime_less(const Node* a, const Node* b)
+// paged-out nodes are only in mFingerprints once they are back
+void MegaClient::pageinbyfingerprint(FileFingerprint* fingerprint)
 {
-    // heaps return the largest element
-    return a->ctime < b->ctime;
+    vector<handle> found;
+    if (pagedoutnodes && indexedbyfingerprint(*fingerprint, &found))
+    {
+        for (handle h : found)
+        {
+            nodebyhandle(h);
+        }
+    }
 }
 
 static bool nodes_ctime_greater(const Node* a, const Node* b)
@@ -13965,36 +17421,18 @@ static bool nodes_ctime_greater(const Node* a, const Node* b)
 
 node_vector MegaClient::getRecentNodes(unsigned maxcount, m_time_t since, bool includerubbishbin)
 {
-    // 1. Get nodes added/modified not older than `since`
+    // the files not older than `since`, most recent first, up to `maxcount`
     node_vector v;
-    v.reserve(nodes.size());
-    for (node_map::iterator i = nodes.begin(); i != nodes.end(); ++i)
+    for (auto it = filesbyctime.rbegin(); it != filesbyctime.rend() && it->first >= since && v.size() < maxcount; ++it)
     {
-        if (i->second->type == FILENODE && i->second->ctime >= since &&  // recent files only 
-            (!i->second->parent || i->second->parent->type != FILENODE)) // excluding versions
+        Node* n = it->second;
+        if ((!n->parent || n->parent->type != FILENODE) &&  // excluding versions
+            (includerubbishbin || n->firstancestor()->type != RUBBISHNODE))
         {
-            v.push_back(i->second);
+            v.push_back(n);
         }
     }
-
-    // heaps use a 'less' function, and pop_heap returns the largest item stored.
-    std::make_heap(v.begin(), v.end(), nodes_ctime_less);
-
-    // 2. Order them chronologically and restrict them to a maximum of `maxcount`
-    node_vector v2;
-    unsigned maxItems = std::min(maxcount, unsigned(v.size()));
-    v2.reserve(maxItems);
-    while (v2.size() < maxItems && !v.empty())
-    {
-        std::pop_heap(v.begin(), v.end(), nodes_ctime_less);
-        Node* n = v.back();
-        v.pop_back();
-        if (includerubbishbin || n->firstancestor()->type != RUBBISHNODE)
-        {
-            v2.push_back(n);
-        }
-    }
-    return v2;
+    return v;
 }
 
 
@@ -14161,8 +17599,8 @@ void MegaClient::nodesbyoriginalfingerprint(const char* originalfingerprint, Nod
         {
             if ((*i)->type == FILENODE)
             {
-                attr_map::const_iterator a = (*i)->attrs.map.find(MAKENAMEID2('c', '0'));
-                if (a != (*i)->attrs.map.end() && !a->second.compare(originalfingerprint))
+                attr_map::const_iterator a = (*i)->attrs().map.find(MAKENAMEID2('c', '0'));
+                if (a != (*i)->attrs().map.end() && !a->second.compare(originalfingerprint))
                 {
                     nv->push_back(*i);
                 }
@@ -14179,8 +17617,8 @@ void MegaClient::nodesbyoriginalfingerprint(const char* originalfingerprint, Nod
         {
             if (i->second->type == FILENODE)
             {
-                attr_map::const_iterator a = i->second->attrs.map.find(MAKENAMEID2('c', '0'));
-                if (a != i->second->attrs.map.end() && !a->second.compare(originalfingerprint))
+                attr_map::const_iterator a = i->second->attrs().map.find(MAKENAMEID2('c', '0'));
+                if (a != i->second->attrs().map.end() && !a->second.compare(originalfingerprint))
                 {
                     nv->push_back(i->second);
                 }
@@ -14189,6 +17627,28 @@ void MegaClient::nodesbyoriginalfingerprint(const char* originalfingerprint, Nod
     }
 }
 
+// successful network operation with a failed transfer chunk: increment error count
+// and continue transfers
+void MegaClient::retryfailedchunks()
+{
+    if (httpio->success && chunkfailed)
+    {
+        chunkfailed = false;
+
+        for (transferslot_list::iterator it = tslots.begin(); it != tslots.end(); it++)
+        {
+            if ((*it)->failure)
+            {
+                (*it)->lasterror = API_EFAILED;
+                (*it)->errorcount++;
+                (*it)->failure = false;
+                (*it)->lastdata = Waiter::ds;
+                LOG_warn << "Transfer error count raised: " << (*it)->errorcount;
+            }
+        }
+    }
+}
+
 // a chunk transfer request failed: record failed protocol & host
 void MegaClient::setchunkfailed(string* url)
 {
@@ -14242,6 +17702,42 @@ void MegaClient::reportevent(const char* event, const char* details, int tag)
     reqtag = creqtag;
 }
 
+void MegaClient::preconnect(const string& url, direction_t d)
+{
+    size_t scheme = url.find("://");
+    if (scheme == string::npos)
+    {
+        return;
+    }
+
+    string host = url.substr(0, url.find('/', scheme + 3));
+    host.append(d == PUT ? " PUT" : " GET");
+
+    for (auto it = preconnected.begin(); it != preconnected.end(); )
+    {
+        if (Waiter::ds - it->second >= PRECONNECT_INTERVAL_DS)
+        {
+            preconnected.erase(it++);
+        }
+        else
+        {
+            it++;
+        }
+    }
+
+    if (!preconnected.emplace(host, Waiter::ds).second)
+    {
+        return;
+    }
+
+    LOG_debug << "Opening a connection for " << host;
+    std::unique_ptr<HttpReq> req(new HttpReq(true));
+    req->posturl = url;
+    req->preconnect = d;
+    req->dns(this);
+    preconnects.push_back(std::move(req));
+}
+
 bool MegaClient::setmaxdownloadspeed(m_off_t bpslimit)
 {
     return httpio->setmaxdownloadspeed(bpslimit >= 0 ? bpslimit : 0);
@@ -14392,6 +17888,44 @@ userpriv_vector *MegaClient::readuserpriv(JSON *j)
     return userpriv;
 }
 
+bool MegaClient::setattachmentaccess(TextChat* chat, handle h, handle uh, bool revoke)
+{
+    bool result = chat->setNodeUserAccess(h, uh, revoke);
+
+    if (chat->attachedNodes.find(h) != chat->attachedNodes.end())
+    {
+        attachmentchats[h].insert(chat->id);
+    }
+    else
+    {
+        auto it = attachmentchats.find(h);
+        if (it != attachmentchats.end() && it->second.erase(chat->id) && it->second.empty())
+        {
+            attachmentchats.erase(it);
+        }
+    }
+
+    return result;
+}
+
+void MegaClient::indexattachments(TextChat* chat, bool add)
+{
+    for (const auto& a : chat->attachedNodes)
+    {
+        if (add)
+        {
+            attachmentchats[a.first].insert(chat->id);
+            continue;
+        }
+
+        auto it = attachmentchats.find(a.first);
+        if (it != attachmentchats.end() && it->second.erase(chat->id) && it->second.empty())
+        {
+            attachmentchats.erase(it);
+        }
+    }
+}
+
 void MegaClient::grantAccessInChat(handle chatid, handle h, const char *uid)
 {
     reqs.add(new CommandChatGrantAccess(this, chatid, h, uid));
@@ -14473,9 +18007,9 @@ void MegaClient::getwelcomepdf()
     reqs.add(new CommandGetWelcomePDF(this));
 }
 
-#ifdef MEGA_MEASURE_CODE
-std::string MegaClient::PerformanceStats::report(bool reset, HttpIO* httpio, Waiter* waiter, const RequestDispatcher& reqs)
+std::string MegaClient::PerformanceStats::report(bool reset, HttpIO* httpio, Waiter* waiter, const RequestDispatcher& reqs, const BufferPool& bufferpool)
 {
+    BufferPool::Stats pool = bufferpool.stats();
     std::ostringstream s;
     s << prepareWait.report(reset) << "\n"
         << doWait.report(reset) << "\n"
@@ -14487,12 +18021,17 @@ std::string MegaClient::PerformanceStats::report(bool reset, HttpIO* httpio, Wai
         << dispatchTransfers.report(reset) << "\n"
         << applyKeys.report(reset) << "\n"
         << scProcessingTime.report(reset) << "\n"
+        << dbCommit.report(reset) << "\n"
         << csResponseProcessingTime.report(reset) << "\n"
         << " cs Request waiting time: " << csRequestWaitTime.report(reset) << "\n"
-        << " cs requests sent/received: " << reqs.csRequestsSent << "/" << reqs.csRequestsCompleted << " batches: " << reqs.csBatchesSent << "/" << reqs.csBatchesReceived << "\n"
+        << " sc batches/packets/syncdown yields: " << scBatches << "/" << scPackets << "/" << scSyncdownYields << " time: " << scBatchTime.report(reset) << "\n"
+        << " sc propagations: " << scPropagations << " time: " << scPropagationTime.report(reset) << " streamed batches: " << scStreamedBatches << "\n"
+        << " " << reqs.statsReport() << "\n"
         << " transfers active time: " << transfersActiveTime.report(reset) << "\n"
         << " transfer starts/finishes: " << transferStarts << " " << transferFinishes << "\n"
         << " transfer temperror/fails: " << transferTempErrors << " " << transferFails << "\n"
+        << " sync notification overflows: " << syncNotifyOverflows << " from journal/rescans: " << syncOverflowJournalRecoveries << "/" << syncOverflowRescans << "\n"
+        << " buffer pool hits/misses/dropped: " << pool.hits << "/" << pool.misses << "/" << pool.dropped << " idle: " << pool.idleBytes << "/" << pool.maxIdleBytes << "\n"
         << " nowait reason: immedate: " << prepwaitImmediate << " zero: " << prepwaitZero << " httpio: " << prepwaitHttpio << " fsaccess: " << prepwaitFsaccess << " nonzero waits: " << nonzeroWait << "\n";
 #ifdef USE_CURL
     if (auto curlhttpio = dynamic_cast<CurlHttpIO*>(httpio))
@@ -14504,7 +18043,8 @@ std::string MegaClient::PerformanceStats::report(bool reset, HttpIO* httpio, Wai
             << curlhttpio->countProcessCurlEventsCode.report(reset) << "\n";
     }
 #endif
-#ifdef WIN32
+    (void)waiter;
+#if defined(WIN32) && defined(MEGA_MEASURE_CODE)
     s << " waiter nonzero timeout: " << static_cast<WinWaiter*>(waiter)->performanceStats.waitTimedoutNonzero 
       << " zero timeout: " << static_cast<WinWaiter*>(waiter)->performanceStats.waitTimedoutZero
       << " io trigger: " << static_cast<WinWaiter*>(waiter)->performanceStats.waitIOCompleted 
@@ -14513,11 +18053,208 @@ std::string MegaClient::PerformanceStats::report(bool reset, HttpIO* httpio, Wai
     if (reset)
     {
         transferStarts = transferFinishes = transferTempErrors = transferFails = 0;
+        scBatches = scPackets = scSyncdownYields = 0;
+        scPropagations = scStreamedBatches = 0;
         prepwaitImmediate = prepwaitZero = prepwaitHttpio = prepwaitFsaccess = nonzeroWait = 0;
     }
     return s.str();
 }
+
+vector<CodeCounter::ScopeStats*> MegaClient::PerformanceStats::scopes(HttpIO* httpio)
+{
+    vector<CodeCounter::ScopeStats*> v = { &execFunction, &transferslotDoio, &execdirectreads, &transferComplete,
+                                           &prepareWait, &doWait, &checkEvents, &applyKeys, &dispatchTransfers,
+                                           &csResponseProcessingTime, &scProcessingTime, &dbCommit };
+#ifdef USE_CURL
+    if (auto curlhttpio = dynamic_cast<CurlHttpIO*>(httpio))
+    {
+        v.insert(v.end(), { &curlhttpio->countCurlHttpIOAddevents, &curlhttpio->countAddAresEventsCode,
+                            &curlhttpio->countAddCurlEventsCode, &curlhttpio->countProcessAresEventsCode,
+                            &curlhttpio->countProcessCurlEventsCode });
+    }
 #endif
+    return v;
+}
+
+string MegaClient::PerformanceStats::scopename(const CodeCounter::ScopeStats& scope)
+{
+    string name = scope.name;
+    std::replace(name.begin(), name.end(), ' ', '_');
+    std::replace(name.begin(), name.end(), '-', '_');
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    return name;
+}
+
+void MegaClient::PerformanceStats::reset(HttpIO* httpio)
+{
+    for (CodeCounter::ScopeStats* scope : scopes(httpio))
+    {
+        scope->reset();
+    }
+    for (CodeCounter::DurationSum* sum : { &csRequestWaitTime, &scBatchTime, &scPropagationTime, &transfersActiveTime })
+    {
+        sum->sum = std::chrono::high_resolution_clock::duration{ 0 };
+    }
+    transferStarts = transferFinishes = transferTempErrors = transferFails = 0;
+    scBatches = scPackets = scSyncdownYields = 0;
+    scPropagations = scStreamedBatches = 0;
+    syncNotifyOverflows = syncOverflowJournalRecoveries = syncOverflowRescans = 0;
+    prepwaitImmediate = prepwaitZero = prepwaitHttpio = prepwaitFsaccess = nonzeroWait = 0;
+}
+
+void MegaClient::PerformanceStats::snapshot(std::map<string, int64_t>& values, HttpIO* httpio, const RequestDispatcher& reqs, const BufferPool& bufferpool)
+{
+    auto ms = [](std::chrono::high_resolution_clock::duration d) { return int64_t(std::chrono::duration_cast<std::chrono::milliseconds>(d).count()); };
+
+    for (const CodeCounter::ScopeStats* scope : scopes(httpio))
+    {
+        string name = scopename(*scope);
+        values[name + ".count"] = int64_t(scope->count);
+        values[name + ".ms"] = ms(scope->timeSpent);
+        values[name + ".p50us"] = int64_t(scope->latency.percentile(0.5));
+        values[name + ".p99us"] = int64_t(scope->latency.percentile(0.99));
+    }
+
+    values["cs.wait_ms"] = ms(csRequestWaitTime.sum);
+    values["cs.requests_sent"] = int64_t(reqs.csRequestsSent);
+    values["cs.requests_received"] = int64_t(reqs.csRequestsCompleted);
+    values["cs.batches_sent"] = int64_t(reqs.csBatchesSent);
+    values["cs.batches_received"] = int64_t(reqs.csBatchesReceived);
+    values["cs.bytes_saved_by_compression"] = int64_t(reqs.csBytesBeforeCompression - reqs.csBytesAfterCompression);
+    values["cs.deferred_commands"] = int64_t(reqs.csDeferredCommands);
+    values["cs.radio_wakeups_saved"] = int64_t(reqs.csDeferredRidealongs);
+    values["sc.batches"] = int64_t(scBatches);
+    values["sc.packets"] = int64_t(scPackets);
+    values["sc.syncdown_yields"] = int64_t(scSyncdownYields);
+    values["sc.batch_ms"] = ms(scBatchTime.sum);
+    values["sc.propagations"] = int64_t(scPropagations);
+    values["sc.propagation_ms"] = ms(scPropagationTime.sum);
+    values["sc.streamed_batches"] = int64_t(scStreamedBatches);
+    values["transfers.active_ms"] = ms(transfersActiveTime.sum);
+    values["transfers.starts"] = int64_t(transferStarts);
+    values["transfers.finishes"] = int64_t(transferFinishes);
+    values["transfers.temporary_errors"] = int64_t(transferTempErrors);
+    values["transfers.failures"] = int64_t(transferFails);
+    values["sync.notify_overflows"] = int64_t(syncNotifyOverflows);
+    values["sync.overflow_journal_recoveries"] = int64_t(syncOverflowJournalRecoveries);
+    values["sync.overflow_rescans"] = int64_t(syncOverflowRescans);
+    values["wait.immediate"] = int64_t(prepwaitImmediate);
+    values["wait.zero"] = int64_t(prepwaitZero);
+    values["wait.httpio"] = int64_t(prepwaitHttpio);
+    values["wait.fsaccess"] = int64_t(prepwaitFsaccess);
+    values["wait.nonzero"] = int64_t(nonzeroWait);
+
+    BufferPool::Stats pool = bufferpool.stats();
+    values["bufferpool.hits"] = int64_t(pool.hits);
+    values["bufferpool.misses"] = int64_t(pool.misses);
+    values["bufferpool.dropped"] = int64_t(pool.dropped);
+    values["bufferpool.idle_bytes"] = int64_t(pool.idleBytes);
+}
+
+const char* MegaClient::ExecTracer::phasename(int phase)
+{
+    static const char* names[NUMPHASES] = { "other", "cs", "sc", "dispatchtransfers", "doio",
+                                            "syncdown", "syncup", "execdirectreads", "dbcommit" };
+    return phase >= 0 && phase < NUMPHASES ? names[phase] : "unknown";
+}
+
+string MegaClient::ExecTracer::Iteration::report() const
+{
+    auto ms = [](clock::duration d) { return std::chrono::duration_cast<std::chrono::milliseconds>(d).count(); };
+
+    vector<int> order;
+    for (int i = 0; i < NUMPHASES; i++)
+    {
+        if (ms(phases[i]))
+        {
+            order.push_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b) { return phases[a] > phases[b]; });
+
+    std::ostringstream s;
+    s << ms(total) << " ms";
+    const char* separator = ": ";
+    for (int i : order)
+    {
+        s << separator << phasename(i) << " " << ms(phases[i]) << " ms";
+        separator = ", ";
+    }
+    return s.str();
+}
+
+void MegaClient::ExecTracer::setthreshold(unsigned ms)
+{
+    thresholdms = ms;
+}
+
+unsigned MegaClient::ExecTracer::getthreshold() const
+{
+    return thresholdms;
+}
+
+const vector<MegaClient::ExecTracer::Iteration>& MegaClient::ExecTracer::slowest() const
+{
+    return slowestiterations;
+}
+
+void MegaClient::ExecTracer::clear()
+{
+    slowestiterations.clear();
+}
+
+void MegaClient::ExecTracer::begin()
+{
+    tracing = thresholdms != 0;
+    if (tracing)
+    {
+        iteration = Iteration();
+        iteration.when = m_time();
+        current = OTHER;
+        start = mark = clock::now();
+    }
+}
+
+void MegaClient::ExecTracer::end()
+{
+    if (!tracing)
+    {
+        return;
+    }
+
+    enter(OTHER);
+    tracing = false;
+    iteration.total = mark - start;
+
+    if (iteration.total < std::chrono::milliseconds(thresholdms))
+    {
+        return;
+    }
+
+    LOG_warn << "Slow exec iteration: " << iteration.report();
+
+    auto it = std::upper_bound(slowestiterations.begin(), slowestiterations.end(), iteration,
+                               [](const Iteration& a, const Iteration& b) { return a.total > b.total; });
+    if (it - slowestiterations.begin() < ptrdiff_t(SLOWEST))
+    {
+        slowestiterations.insert(it, iteration);
+        if (slowestiterations.size() > SLOWEST)
+        {
+            slowestiterations.pop_back();
+        }
+    }
+}
+
+MegaClient::ExecTracer::phase_t MegaClient::ExecTracer::enter(phase_t phase)
+{
+    clock::time_point now = clock::now();
+    iteration.phases[current] += now - mark;
+    mark = now;
+
+    phase_t previous = current;
+    current = phase;
+    return previous;
+}
 
 FetchNodesStats::FetchNodesStats()
 {
@@ -14540,11 +18277,18 @@ void FetchNodesStats::init()
     startTime = Waiter::ds;
     timeToFirstByte = NEVER;
     timeToLastByte = NEVER;
+    timeToFirstNode = NEVER;
     timeToCached = NEVER;
     timeToResult = NEVER;
     timeToSyncsResumed = NEVER;
     timeToCurrent = NEVER;
     timeToTransfersResumed = NEVER;
+    bytesPerNode = 0;
+    dbProfile = -1;
+    timeToSecondaryStage = NEVER;
+    timeToContactsKeys = NEVER;
+    timeToUserAlerts = NEVER;
+    timeToStartupDone = NEVER;
 }
 
 void FetchNodesStats::toJsonArray(string *json)
@@ -14561,7 +18305,11 @@ void FetchNodesStats::toJsonArray(string *json)
         << timeToFirstByte << "," << timeToLastByte << ","
         << timeToCached << "," << timeToResult << ","
         << timeToSyncsResumed << "," << timeToCurrent << ","
-        << timeToTransfersResumed << "," << cache << "]";
+        << timeToTransfersResumed << "," << cache << ","
+        << bytesPerNode << "," << timeToFirstNode << ","
+        << dbProfile << "," << timeToSecondaryStage << ","
+        << timeToContactsKeys << "," << timeToUserAlerts << ","
+        << timeToStartupDone << "]";
     json->append(oss.str());
 }
 
@@ -32,6 +32,30 @@
 
 namespace mega {
 
+void NewNode::take(NewNode& other)
+{
+    nodehandle = other.nodehandle;
+    parenthandle = other.parenthandle;
+    type = other.type;
+    attrstring = std::move(other.attrstring);
+    nodekey.swap(other.nodekey);
+    source = other.source;
+    ovhandle = other.ovhandle;
+    uploadhandle = other.uploadhandle;
+    memcpy(uploadtoken, other.uploadtoken, sizeof uploadtoken);
+    syncid = other.syncid;
+    fileattributes = std::move(other.fileattributes);
+    added = other.added;
+    addedhandle = other.addedhandle;
+}
+
+// mNodeCounters has an entry for each root and inshare
+static bool countedinroot(MegaClient* client, Node* ancestor)
+{
+    handle h = ancestor->nodehandle;
+    return h == client->rootnodes[0] || h == client->rootnodes[1] || h == client->rootnodes[2] || ancestor->inshare;
+}
+
 Node::Node(MegaClient* cclient, node_vector* dp, handle h, handle ph,
            nodetype_t t, m_off_t s, handle u, const char* fa, m_time_t ts)
 {
@@ -45,6 +69,7 @@ Node::Node(MegaClient* cclient, node_vector* dp, handle h, handle ph,
     parenthandle = ph;
 
     parent = NULL;
+    childrenseq = ++client->childrenseq;
 
 #ifdef ENABLE_SYNC
     localnode = NULL;
@@ -72,6 +97,8 @@ Node::Node(MegaClient* cclient, node_vector* dp, handle h, handle ph,
 
     memset(&changed, 0, sizeof changed);
 
+    subtreecounts = selfcounts();
+
     Node* p;
 
     client->nodes[h] = this;
@@ -99,6 +126,11 @@ Node::Node(MegaClient* cclient, node_vector* dp, handle h, handle ph,
         dp->push_back(this);
     }
 
+    if (type == FILENODE)
+    {
+        ctime_it = client->filesbyctime.emplace(ctime, this);
+    }
+
     client->mFingerprints.newnode(this);
 }
 
@@ -110,25 +142,36 @@ Node::~Node()
         assert(client->mAppliedKeyNodeCount >= 0);
     }
 
-    // abort pending direct reads
-    client->preadabort(this);
+    // the whole graph goes: the indexes and counters are cleared after it, and the relatives may be gone already
+    bool discarding = client->discardingnodes;
 
-    // remove node's fingerprint from hash
-    client->mFingerprints.remove(this);
+    if (!discarding)
+    {
+        // abort pending direct reads
+        client->preadabort(this);
+
+        // remove node's fingerprint from hash
+        client->mFingerprints.remove(this);
+
+        if (type == FILENODE)
+        {
+            client->filesbyctime.erase(ctime_it);
+        }
 
 #ifdef ENABLE_SYNC
-    // remove from todebris node_set
-    if (todebris_it != client->todebris.end())
-    {
-        client->todebris.erase(todebris_it);
-    }
+        // remove from todebris node_set
+        if (todebris_it != client->todebris.end())
+        {
+            client->todebris.erase(todebris_it);
+        }
 
-    // remove from tounlink node_set
-    if (tounlink_it != client->tounlink.end())
-    {
-        client->tounlink.erase(tounlink_it);
-    }
+        // remove from tounlink node_set
+        if (tounlink_it != client->tounlink.end())
+        {
+            client->tounlink.erase(tounlink_it);
+        }
 #endif
+    }
 
     if (outshares)
     {
@@ -152,28 +195,40 @@ Node::~Node()
 
 
     // remove from parent's children
-    if (parent)
+    if (parent && !discarding)
     {
         parent->children.erase(child_it);
+        parent->childrenchanged();
     }
 
-    Node* fa = firstancestor();
-    handle ancestor = fa->nodehandle;
-    if (ancestor == client->rootnodes[0] || ancestor == client->rootnodes[1] || ancestor == client->rootnodes[2] || fa->inshare)
+    // a node being paged out keeps counting towards its ancestors and root
+    if (!client->pagingnodes && !discarding)
     {
-        client->mNodeCounters[firstancestor()->nodehandle] -= subnodeCounts();
+        for (Node* a = parent; a; a = a->parent)
+        {
+            a->subtreecounts -= subtreecounts;
+        }
+
+        Node* fa = firstancestor();
+        if (countedinroot(client, fa))
+        {
+            client->mNodeCounters[fa->nodehandle] -= subtreecounts;
+        }
     }
 
-    if (inshare)
+    if (inshare && !discarding)
     {
         client->mNodeCounters.erase(nodehandle);
     }
 
     // delete child-parent associations (normally not used, as nodes are
     // deleted bottom-up)
-    for (node_list::iterator it = children.begin(); it != children.end(); it++)
+    if (!discarding)
     {
-        (*it)->parent = NULL;
+        for (node_list::iterator it = children.begin(); it != children.end(); it++)
+        {
+            (*it)->parent = NULL;
+        }
     }
 
     delete plink;
@@ -193,6 +248,48 @@ Node::~Node()
 #endif
 }
 
+void* Node::operator new(size_t size)
+{
+    if (size != sizeof(Node))
+    {
+        return ::operator new(size);
+    }
+
+    return PoolAllocator<Node>::pool().allocate();
+}
+
+void Node::operator delete(void* p, size_t size)
+{
+    if (size != sizeof(Node))
+    {
+        return ::operator delete(p);
+    }
+
+    PoolAllocator<Node>::pool().deallocate(p);
+}
+
+size_t Node::poolBytes()
+{
+    // all the pooled containers are node storage at present
+    return FixedSizePool::totalBytesReserved();
+}
+
+size_t Node::pooledNodes()
+{
+    return PoolAllocator<Node>::pool().blocksInUse();
+}
+
+void Node::setctime(m_time_t ts)
+{
+    ctime = ts;
+
+    if (type == FILENODE)
+    {
+        client->filesbyctime.erase(ctime_it);
+        ctime_it = client->filesbyctime.emplace(ctime, this);
+    }
+}
+
 void Node::setkeyfromjson(const char* k)
 {
     if (keyApplied()) --client->mAppliedKeyNodeCount;
@@ -218,6 +315,12 @@ void Node::setkey(const byte* newkey)
 // parse serialized node and return Node object - updates nodes hash and parent
 // mismatch vector
 Node* Node::unserialize(MegaClient* client, const string* d, node_vector* dp)
+{
+    return unserialize(client, d->data(), d->size(), dp);
+}
+
+// as above, reading the record where it lies
+Node* Node::unserialize(MegaClient* client, const char* data, size_t len, node_vector* dp)
 {
     handle h, ph;
     nodetype_t t;
@@ -227,8 +330,8 @@ Node* Node::unserialize(MegaClient* client, const string* d, node_vector* dp)
     const char* fa;
     m_time_t ts;
     const byte* skey;
-    const char* ptr = d->data();
-    const char* end = ptr + d->size();
+    const char* ptr = data;
+    const char* end = ptr + len;
     unsigned short ll;
     Node* n;
     int i;
@@ -377,22 +480,19 @@ Node* Node::unserialize(MegaClient* client, const string* d, node_vector* dp)
         }
     }
 
-    ptr = n->attrs.unserialize(ptr, end);
-    if (!ptr)
+    // kept as they are until used (importattrs() renormalizes the name, as the updated version
+    // of utf8proc doesn't provide exactly the same output as the previous one that we were using)
+    const char* attrsend = AttrMap::scan(ptr, end);
+    if (!attrsend)
     {
         delete n;
         return NULL;
     }
-
-    // It's needed to re-normalize node names because
-    // the updated version of utf8proc doesn't provide
-    // exactly the same output as the previous one that
-    // we were using
-    attr_map::iterator it = n->attrs.map.find('n');
-    if (it != n->attrs.map.end())
+    if (attrsend - ptr > 1)
     {
-        client->fsaccess->normalize(&(it->second));
+        n->pendingattrs.reset(new string(ptr, attrsend - ptr));
     }
+    ptr = attrsend;
 
     PublicLink *plink = NULL;
     if (isExported)
@@ -568,7 +668,14 @@ bool Node::serialize(string* d)
         }
     }
 
-    attrs.serialize(d);
+    if (pendingattrs)
+    {
+        d->append(*pendingattrs);
+    }
+    else
+    {
+        attrmap.serialize(d);
+    }
 
     if (isExported)
     {
@@ -680,30 +787,58 @@ void Node::parseattr(byte *bufattr, AttrMap &attrs, m_off_t size, m_time_t &mtim
 // return temporary SymmCipher for this nodekey
 SymmCipher* Node::nodecipher()
 {
-    if (client->tmpnodecipher.setkey(&nodekeydata))
-    {
-        return &client->tmpnodecipher;
-    }
-
-    return NULL;
+    return client->nodeciphers.get(&nodekeydata);
 }
 
 // decrypt attributes and build attribute hash
 void Node::setattr()
 {
-    byte* buf;
     SymmCipher* cipher;
 
-    if (attrstring && (cipher = nodecipher()) && (buf = decryptattr(cipher, attrstring->c_str(), attrstring->size())))
+    if (attrstring && (cipher = nodecipher()) && decryptattrs(cipher))
     {
-        JSON json;
-        nameid name;
-        string* t;
+        setfingerprint();
+    }
+}
+
+bool Node::decryptattrs(SymmCipher* cipher)
+{
+    byte* buf = decryptattr(cipher, attrstring->c_str(), attrstring->size());
+
+    if (!buf)
+    {
+        return false;
+    }
+
+    JSON json;
+    nameid name;
+    string value;
+    std::unique_ptr<string> serialized(new string);
+    bool fits = true;
 
-        attrs.map.clear();
+    serialized->reserve(attrstring->size());
+    json.begin((char*)buf + 5);
+
+    while (fits && (name = json.getnameid()) != EOO && json.storeobject(&value))
+    {
+        JSON::unescape(&value);
+        fits = AttrMap::serialize(serialized.get(), name, value);
+    }
+
+    attrmap.map.clear();
+    pendingattrs.reset();
+    if (fits)
+    {
+        serialized->append("", 1);
+        pendingattrs = std::move(serialized);
+    }
+    else
+    {
+        // too large for a serialize: into the map right away
+        string* t;
         json.begin((char*)buf + 5);
 
-        while ((name = json.getnameid()) != EOO && json.storeobject((t = &attrs.map[name])))
+        while ((name = json.getnameid()) != EOO && json.storeobject((t = &attrmap.map[name])))
         {
             JSON::unescape(t);
 
@@ -712,12 +847,75 @@ void Node::setattr()
                 client->fsaccess->normalize(t);
             }
         }
+    }
 
-        setfingerprint();
+    delete[] buf;
 
-        delete[] buf;
+    attrstring.reset();
+    return true;
+}
 
-        attrstring.reset();
+AttrMap& Node::attrs()
+{
+    if (pendingattrs)
+    {
+        importattrs();
+    }
+
+    return attrmap;
+}
+
+const AttrMap& Node::attrs() const
+{
+    if (pendingattrs)
+    {
+        importattrs();
+    }
+
+    return attrmap;
+}
+
+bool Node::getattr(nameid name, string* value) const
+{
+    if (pendingattrs)
+    {
+        bool found;
+        AttrMap::scan(pendingattrs->data(), pendingattrs->data() + pendingattrs->size(), name, value, &found);
+        return found;
+    }
+
+    attr_map::const_iterator it = attrmap.map.find(name);
+    if (it == attrmap.map.end())
+    {
+        return false;
+    }
+
+    if (value)
+    {
+        *value = it->second;
+    }
+    return true;
+}
+
+bool Node::attrspending() const
+{
+    return bool(pendingattrs);
+}
+
+void Node::importattrs() const
+{
+    std::unique_ptr<string> serialized = std::move(pendingattrs);
+
+    attrmap.map.clear();
+    if (!attrmap.unserialize(serialized->data(), serialized->data() + serialized->size()))
+    {
+        LOG_err << "Invalid attributes of node " << Base64Str<MegaClient::NODEHANDLE>(nodehandle);
+    }
+
+    attr_map::iterator it = attrmap.map.find('n');
+    if (it != attrmap.map.end())
+    {
+        client->fsaccess->normalize(&it->second);
     }
 }
 
@@ -729,11 +927,10 @@ void Node::setfingerprint()
     {
         client->mFingerprints.remove(this);
 
-        attr_map::iterator it = attrs.map.find('c');
-
-        if (it != attrs.map.end())
+        string c;
+        if (getattr('c', &c))
         {
-            if (!unserializefingerprint(&it->second))
+            if (!unserializefingerprint(&c))
             {
                 LOG_warn << "Invalid fingerprint";
             }
@@ -769,9 +966,9 @@ const char* Node::displayname() const
 
     attr_map::const_iterator it;
 
-    it = attrs.map.find('n');
+    it = attrs().map.find('n');
 
-    if (it == attrs.map.end())
+    if (it == attrmap.map.end())
     {
         if (type < ROOTNODE || type > RUBBISHNODE)
         {
@@ -876,12 +1073,131 @@ bool Node::applykey()
         return false;
     }
 
+    SymmCipher* sc;
+    const char* k = wrappedkey(client->loggedin() ? client->me : *client->rootnodes, sc);
+
+    // no suitable key available yet - bail (it might arrive soon)
+    if (!k)
+    {
+        return false;
+    }
+
+    byte key[FILENODEKEYLENGTH];
+    unsigned keylength = (type == FILENODE) ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH;
+
+    if (client->decryptkey(k, key, keylength, sc, 0, nodehandle))
+    {
+        client->mAppliedKeyNodeCount++;
+        nodekeydata.assign((const char*)key, keylength);
+        setattr();
+    }
+
+    assert(keyApplied());
+    return true;
+}
+
+bool Node::rsawrappedkey(string* ciphertext)
+{
+    if (type > FOLDERNODE || keyApplied() || !nodekeydata.size())
+    {
+        return false;
+    }
+
+    SymmCipher* sc;
+    const char* k = wrappedkey(client->loggedin() ? client->me : *client->rootnodes, sc);
+    if (!k)
+    {
+        return false;
+    }
+
+    // as MegaClient::decryptkey() tells them apart
+    size_t kl = strcspn(k, "\"/");
+    size_t sl = kl / 4 * 3 + 3;
+    if (kl <= 4 * FILENODEKEYLENGTH / 3 + 1 || sl > 4096)
+    {
+        return false;
+    }
+
+    if (ciphertext)
+    {
+        ciphertext->resize(sl);
+        ciphertext->resize(size_t(Base64::atob(k, (byte*)ciphertext->data(), int(sl))));
+    }
+    return true;
+}
+
+void Node::applyrsakey(const byte* key)
+{
+    client->mAppliedKeyNodeCount++;
+    nodekeydata.assign((const char*)key, (type == FILENODE) ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH);
+    setattr();
+
+    // to be rewritten as a symmetric key, as decryptkey() does
+    client->nodekeyrewrite.push_back(nodehandle);
+}
+
+bool Node::applysymmetrickey(KeyApplyContext& ctx, bool& attrsdecrypted)
+{
+    attrsdecrypted = false;
+
+    if (type > FOLDERNODE || keyApplied() || !nodekeydata.size())
+    {
+        return false;
+    }
+
+    SymmCipher* sc;
+    // a share node that is paged out leaves the key for applykey() on the client thread
+    const char* k = wrappedkey(ctx.me, sc, true);
+
+    if (!k)
+    {
+        return false;
+    }
+
+    // RSA-encrypted keys need the client's asymmetric key and trigger key rewrites
+    size_t kl = strcspn(k, "\"/");
+    if (kl > 4 * FILENODEKEYLENGTH / 3 + 1)
+    {
+        return false;
+    }
+
+    byte key[FILENODEKEYLENGTH];
+    int keylength = (type == FILENODE) ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH;
+
+    if (Base64::atob(k, key, keylength) != keylength)
+    {
+        return false;
+    }
+
+    if (sc == &client->key)
+    {
+        sc = &ctx.master;
+    }
+    else
+    {
+        if (ctx.sharesource != sc)
+        {
+            ctx.share.setkey(sc->key);
+            ctx.sharesource = sc;
+        }
+        sc = &ctx.share;
+    }
+
+    sc->ecb_decrypt(key, keylength);
+    nodekeydata.assign((const char*)key, keylength);
+
+    attrsdecrypted = attrstring && ctx.node.setkey(&nodekeydata) && decryptattrs(&ctx.node);
+    return true;
+}
+
+const char* Node::wrappedkey(handle me, SymmCipher*& sc, bool resident)
+{
     int l = -1;
     size_t t = 0;
     handle h;
     const char* k = NULL;
-    SymmCipher* sc = &client->key;
-    handle me = client->loggedin() ? client->me : *client->rootnodes;
+
+    sc = &client->key;
 
     while ((t = nodekeydata.find_first_of(':', t)) != string::npos)
     {
@@ -908,7 +1224,7 @@ bool Node::applykey()
 
                 // this is a share node handle - check if we have node and the
                 // share key
-                if (!(n = client->nodebyhandle(h)) || !n->sharekey)
+                if (!(n = resident ? client->residentnodebyhandle(h) : client->nodebyhandle(h)) || !n->sharekey)
                 {
                     continue;
                 }
@@ -925,40 +1241,34 @@ bool Node::applykey()
     }
 
     // no: found => personal key, use directly
-    // otherwise, no suitable key available yet - bail (it might arrive soon)
-    if (!k)
+    if (!k && l < 0)
     {
-        if (l < 0)
-        {
-            k = nodekeydata.c_str();
-        }
-        else
-        {
-            return false;
-        }
+        k = nodekeydata.c_str();
     }
 
-    byte key[FILENODEKEYLENGTH];
-    unsigned keylength = (type == FILENODE) ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH;
+    return k;
+}
 
-    if (client->decryptkey(k, key, keylength, sc, 0, nodehandle))
-    {
-        client->mAppliedKeyNodeCount++;
-        nodekeydata.assign((const char*)key, keylength);
-        setattr();
-    }
+NodeCounter Node::subnodeCounts() const
+{
+    return subtreecounts;
+}
 
-    assert(keyApplied());
-    return true;
+NodeCounter Node::descendantcounts() const
+{
+    NodeCounter below = subtreecounts;
+    below -= selfcounts();
+    return below;
 }
 
-NodeCounter Node::subnodeCounts() const
+void Node::restoredescendantcounts(const NodeCounter& below)
+{
+    subtreecounts += below;
+}
+
+NodeCounter Node::selfcounts() const
 {
     NodeCounter nc;
-    for (Node *child : children)
-    {
-        nc += child->subnodeCounts();
-    }
     if (type == FILENODE)
     {
         nc.files += 1;
@@ -976,7 +1286,41 @@ NodeCounter Node::subnodeCounts() const
     return nc;
 }
 
+void Node::setsize(m_off_t s)
+{
+    // the size is part of the fingerprint the node is hashed by
+    bool indexed = infingerprints;
+    client->mFingerprints.remove(this);
+
+    NodeCounter before = selfcounts();
+    size = s;
+    NodeCounter after = selfcounts();
+
+    if (indexed)
+    {
+        client->mFingerprints.add(this);
+    }
+
+    for (Node* n = this; n; n = n->parent)
+    {
+        n->subtreecounts -= before;
+        n->subtreecounts += after;
+    }
+
+    Node* fa = firstancestor();
+    if (countedinroot(client, fa))
+    {
+        client->mNodeCounters[fa->nodehandle] -= before;
+        client->mNodeCounters[fa->nodehandle] += after;
+    }
+}
+
 // returns whether node was moved
+void Node::childrenchanged()
+{
+    childrenseq = ++client->childrenseq;
+}
+
 bool Node::setparent(Node* p)
 {
     if (p == parent)
@@ -984,46 +1328,60 @@ bool Node::setparent(Node* p)
         return false;
     }
 
-    NodeCounter nc;
-    bool gotnc = false;
-
-    Node *originalancestor = firstancestor();
-    handle oah = originalancestor->nodehandle;
-    if (oah == client->rootnodes[0] || oah == client->rootnodes[1] || oah == client->rootnodes[2] || originalancestor->inshare)
+    // the subtree's counters move from the old ancestors to the new ones, in O(depth).  Nodes being paged in
+    // or out are still counted by their ancestors
+    if (!client->pagingnodes)
     {
-        nc = subnodeCounts();
-        gotnc = true;
+        for (Node* a = parent; a; a = a->parent)
+        {
+            a->subtreecounts -= subtreecounts;
+        }
 
         // nodes moving from cloud drive to rubbish for example, or between inshares from the same user.
-        client->mNodeCounters[oah] -= nc;
+        Node *originalancestor = firstancestor();
+        if (countedinroot(client, originalancestor))
+        {
+            client->mNodeCounters[originalancestor->nodehandle] -= subtreecounts;
+        }
     }
 
     if (parent)
     {
         parent->children.erase(child_it);
+        parent->childrenchanged();
     }
 
 #ifdef ENABLE_SYNC
     Node *oldparent = parent;
 #endif
 
+    subtreecounts -= selfcounts();
     parent = p;
+    subtreecounts += selfcounts();
 
     if (parent)
     {
         child_it = parent->children.insert(parent->children.end(), this);
+        parent->childrenchanged();
+
+        if (parent->type == FILENODE && client->compactversions)
+        {
+            client->newversions.push_back(nodehandle);
+        }
     }
 
-    Node* newancestor = firstancestor();
-    handle nah = newancestor->nodehandle;
-    if (nah == client->rootnodes[0] || nah == client->rootnodes[1] || nah == client->rootnodes[2] || newancestor->inshare)
+    if (!client->pagingnodes)
     {
-        if (!gotnc)
+        for (Node* a = parent; a; a = a->parent)
         {
-            nc = subnodeCounts();
+            a->subtreecounts += subtreecounts;
         }
 
-        client->mNodeCounters[nah] += nc;
+        Node* newancestor = firstancestor();
+        if (countedinroot(client, newancestor))
+        {
+            client->mNodeCounters[newancestor->nodehandle] += subtreecounts;
+        }
     }
 
 #ifdef ENABLE_SYNC
@@ -1148,7 +1506,17 @@ void LocalNode::setnameparent(LocalNode* newparent, string* newlocalpath)
 
     if (parent)
     {
+        // the paths cached below this node change
+        sync->client->localpathgeneration++;
+
         // remove existing child linkage
+        parent->setsyncdirty();
+
+        if (parent->childindex)
+        {
+            parent->unindexchild(this);
+        }
+
         parent->children.erase(&localname);
 
         if (slocalname)
@@ -1187,7 +1555,7 @@ void LocalNode::setnameparent(LocalNode* newparent, string* newlocalpath)
 
             if (node)
             {
-                if (name != node->attrs.map['n'])
+                if (name != node->attrs().map['n'])
                 {
                     if (node->type == FILENODE)
                     {
@@ -1198,11 +1566,11 @@ void LocalNode::setnameparent(LocalNode* newparent, string* newlocalpath)
                         sync->client->app->syncupdate_treestate(this);
                     }
 
-                    string prevname = node->attrs.map['n'];
+                    string prevname = node->attrs().map['n'];
                     int creqtag = sync->client->reqtag;
 
                     // set new name
-                    node->attrs.map['n'] = name;
+                    node->attrs().map['n'] = name;
                     sync->client->reqtag = sync->tag;
                     sync->client->setattr(node, prevname.c_str());
                     sync->client->reqtag = creqtag;
@@ -1262,6 +1630,7 @@ void LocalNode::setnameparent(LocalNode* newparent, string* newlocalpath)
 
         // (we don't construct a UTF-8 or sname for the root path)
         parent->children[&localname] = this;
+        namehash = std::hash<string>()(localname);
 
         if (!slocalname)
         {
@@ -1277,6 +1646,23 @@ void LocalNode::setnameparent(LocalNode* newparent, string* newlocalpath)
             slocalname = NULL;
         }
 
+        setsyncdirty();
+
+        if (parent->childindex)
+        {
+            parent->indexchild(this);
+        }
+        else if (parent->children.size() >= CHILDINDEX_THRESHOLD)
+        {
+            parent->childindex.reset(new localnodehash_map);
+            parent->childindex->reserve(parent->children.size() * 2);
+
+            for (auto& child : parent->children)
+            {
+                parent->indexchild(child.second);
+            }
+        }
+
         treestate(TREESTATE_NONE);
 
         if (todelete)
@@ -1311,6 +1697,16 @@ void LocalNode::setnameparent(LocalNode* newparent, string* newlocalpath)
 }
 
 // delay uploads by 1.1 s to prevent server flooding while a file is still being written
+void LocalNode::setsyncdirty()
+{
+    // all the way up: an ancestor's flag may have been cleared by a pass that didn't get down here
+    for (LocalNode* l = this; l; l = l->parent)
+    {
+        l->syncdowndirty = true;
+        l->syncupdirty = true;
+    }
+}
+
 void LocalNode::bumpnagleds()
 {
     if (!sync)
@@ -1320,7 +1716,66 @@ void LocalNode::bumpnagleds()
         return;
     }
 
-    nagleds = sync->client->waiter->ds + 11;
+    dstime now = sync->client->waiter->ds;
+    if (lastchangeds && now - lastchangeds < Sync::FILE_CADENCE_WINDOW_DS)
+    {
+        dstime interval = now - lastchangeds;
+        changeintervalds = changeintervalds ? (3 * changeintervalds + interval) / 4 : interval;
+    }
+    else
+    {
+        changeintervalds = 0;
+    }
+    lastchangeds = now;
+
+    if (!nagleinitialds)
+    {
+        nagleinitialds = now;
+    }
+
+    dstime delay = std::max(Sync::FILE_NAGLE_DS, changeintervalds);
+    if (now - nagleinitialds >= Sync::FILE_NAGLE_MAX_DS)
+    {
+        delay = Sync::FILE_NAGLE_DS;
+    }
+    nagleds = now + delay;
+}
+
+void LocalNode::closewritten()
+{
+    dstime now = sync->client->waiter->ds;
+    if (nagleds > now && (!changeintervalds || now - nagleinitialds >= Sync::FILE_NAGLE_MAX_DS))
+    {
+        nagleds = now;
+    }
+}
+
+bool LocalNode::gencontenthash(string* hash) const
+{
+    string localpath;
+    getlocalpath(&localpath);
+
+    auto fa = sync->client->fsaccess->newfileaccess();
+    if (!fa->fopen(&localpath, true, false) || fa->type != FILENODE || fa->size != size)
+    {
+        return false;
+    }
+
+    HashSHA256 hasher;
+    std::vector<byte> buffer(1 << 20);
+    for (m_off_t pos = 0; pos < fa->size; )
+    {
+        unsigned len = unsigned(std::min<m_off_t>(buffer.size(), fa->size - pos));
+        if (!fa->frawread(buffer.data(), len, pos, true))
+        {
+            return false;
+        }
+        hasher.add(buffer.data(), len);
+        pos += len;
+    }
+
+    hasher.get(hash);
+    return true;
 }
 
 LocalNode::LocalNode()
@@ -1340,6 +1795,7 @@ void LocalNode::init(Sync* csync, nodetype_t ctype, LocalNode* cparent, string*
     deleted = false;
     created = false;
     reported = false;
+    debrispending = false;
     syncxfer = true;
     newnode.reset();
     parent_dbid = 0;
@@ -1475,6 +1931,7 @@ void LocalNode::setnotseen(int newnotseen)
         if (notseen)
         {
             sync->client->localsyncnotseen.erase(notseen_it);
+            setmovecandidate(deleted);
         }
 
         notseen = 0;
@@ -1485,12 +1942,28 @@ void LocalNode::setnotseen(int newnotseen)
         if (!notseen)
         {
             notseen_it = sync->client->localsyncnotseen.insert(this).first;
+            setmovecandidate(true);
         }
 
         notseen = newnotseen;
     }
 }
 
+void LocalNode::setmovecandidate(bool candidate)
+{
+    if (movecandidate)
+    {
+        sync->client->localsyncmovecandidates.erase(movecandidate_it);
+        movecandidate = false;
+    }
+
+    if (candidate && type == FILENODE && isvalid)
+    {
+        movecandidate_it = sync->client->localsyncmovecandidates.emplace(std::make_pair(size, mtime), this);
+        movecandidate = true;
+    }
+}
+
 // set fsid - assume that an existing assignment of the same fsid is no longer current and revoke
 void LocalNode::setfsid(handle newfsid, handlelocalnode_map& fsidnodes)
 {
@@ -1549,10 +2022,16 @@ LocalNode::~LocalNode()
     }
 
     setnotseen(0);
+    setmovecandidate(false);
 
     newnode.reset();
 
-    if (sync->dirnotify.get())
+    if (debrispending && sync->client->syncdebrisqueue)
+    {
+        sync->client->syncdebrisqueue->forget(this);
+    }
+
+    if (sync->dirnotify.get() && !sync->discardinglocalnodes)
     {
         // deactivate corresponding notifyq records
         for (int q = DirNotify::RETRY; q >= DirNotify::EXTRA; q--)
@@ -1590,11 +2069,14 @@ LocalNode::~LocalNode()
     }
 
     // remove parent association
-    if (parent)
+    if (parent && !sync->discardinglocalnodes)
     {
         setnameparent(NULL, NULL);
     }
 
+    // (not maintained while the children go)
+    childindex.reset();
+
     for (localnode_map::iterator it = children.begin(); it != children.end(); )
     {
         delete it++->second;
@@ -1630,6 +2112,16 @@ void LocalNode::getlocalpath(string* path, bool sdisable, const std::string* loc
         return;
     }
 
+    const string& separator = localseparator ? *localseparator : sync->client->fsaccess->localseparator;
+    if (parent && separator == sync->client->fsaccess->localseparator)
+    {
+        // the parent's cached path, and this node's name
+        *path = parent->folderpath();
+        path->append(separator);
+        path->append(!sdisable && slocalname ? *slocalname : localname);
+        return;
+    }
+
     const LocalNode* l = this;
 
     path->erase();
@@ -1649,7 +2141,7 @@ void LocalNode::getlocalpath(string* path, bool sdisable, const std::string* loc
 
         if ((l = l->parent))
         {
-            path->insert(0, localseparator ? *localseparator : sync->client->fsaccess->localseparator);
+            path->insert(0, separator);
         }
 
         if (sdisable)
@@ -1659,6 +2151,26 @@ void LocalNode::getlocalpath(string* path, bool sdisable, const std::string* loc
     }
 }
 
+const string& LocalNode::folderpath() const
+{
+    uint64_t generation = sync->client->localpathgeneration;
+    if (cachedpathgeneration != generation)
+    {
+        if (parent)
+        {
+            cachedpath = parent->folderpath();
+            cachedpath.append(sync->client->fsaccess->localseparator);
+            cachedpath.append(slocalname ? *slocalname : localname);
+        }
+        else
+        {
+            cachedpath = localname;
+        }
+        cachedpathgeneration = generation;
+    }
+    return cachedpath;
+}
+
 string LocalNode::localnodedisplaypath(FileSystemAccess& fsa) const
 {
     string local;
@@ -1697,6 +2209,30 @@ void LocalNode::getlocalsubpath(string* path) const
 // locate child by localname or slocalname
 LocalNode* LocalNode::childbyname(string* localname)
 {
+    if (localname && childindex)
+    {
+        // as below, a match on the name takes precedence over one on a short name
+        LocalNode* shortmatch = NULL;
+        auto range = childindex->equal_range(std::hash<string>()(*localname));
+
+        for (auto it = range.first; it != range.second; it++)
+        {
+            LocalNode* l = it->second;
+
+            if (l->localname == *localname)
+            {
+                return l;
+            }
+
+            if (!shortmatch && l->slocalname && *l->slocalname == *localname)
+            {
+                shortmatch = l;
+            }
+        }
+
+        return shortmatch;
+    }
+
     localnode_map::iterator it;
 
     if (!localname || ((it = children.find(localname)) == children.end() && (it = schildren.find(localname)) == schildren.end()))
@@ -1707,6 +2243,38 @@ LocalNode* LocalNode::childbyname(string* localname)
     return it->second;
 }
 
+void LocalNode::indexchild(LocalNode* l)
+{
+    childindex->emplace(l->namehash, l);
+
+    if (l->slocalname)
+    {
+        childindex->emplace(std::hash<string>()(*l->slocalname), l);
+    }
+}
+
+void LocalNode::unindexchild(LocalNode* l)
+{
+    size_t hashes[2] = { l->namehash, l->slocalname ? std::hash<string>()(*l->slocalname) : l->namehash };
+
+    for (size_t hash : hashes)
+    {
+        auto range = childindex->equal_range(hash);
+
+        for (auto it = range.first; it != range.second; )
+        {
+            if (it->second == l)
+            {
+                childindex->erase(it++);
+            }
+            else
+            {
+                it++;
+            }
+        }
+    }
+}
+
 void LocalNode::prepare()
 {
     getlocalpath(&transfer->localfilename, true);
@@ -1747,6 +2315,7 @@ void LocalNode::completed(Transfer* t, LocalNode*)
 // - corresponding Node handle
 // - local name
 // - fingerprint crc/mtime (filenodes only)
+// - content hash, in the first extension slot (filenodes only, if any)
 bool LocalNode::serialize(string* d)
 {
     m_off_t s = type ? -type : size;
@@ -1780,7 +2349,17 @@ bool LocalNode::serialize(string* d)
     const char syncable = mSyncable ? 1 : 0;
     d->append(&syncable, sizeof(syncable));
 
-    d->append("\0\0\0\0\0\0\0", 8); // Use these bytes for extensions
+    // extension slots: a length byte followed by that many bytes
+    if (type == FILENODE && !contenthash.empty() && contenthash.size() < 256)
+    {
+        d->append(1, (char)contenthash.size());
+        d->append(contenthash);
+        d->append("\0\0\0\0\0\0", 7);
+    }
+    else
+    {
+        d->append("\0\0\0\0\0\0\0", 8); // Use these bytes for extensions
+    }
 
     return true;
 }
@@ -1864,6 +2443,7 @@ LocalNode* LocalNode::unserialize(Sync* sync, const string* d)
     }
 
     char syncable = 1;
+    string contenthash;
     if (ptr < end)
     {
         if (ptr + sizeof(syncable) + 8 > end)
@@ -1875,6 +2455,11 @@ LocalNode* LocalNode::unserialize(Sync* sync, const string* d)
         syncable = MemAccess::get<char>(ptr);
         ptr += sizeof(syncable);
 
+        if (type == FILENODE && *ptr && ptr + (unsigned char)*ptr < end)
+        {
+            contenthash.assign(ptr + 1, (unsigned char)*ptr);
+        }
+
         // skip extension bytes
         for (int i = 8; i--;)
         {
@@ -1905,6 +2490,7 @@ LocalNode* LocalNode::unserialize(Sync* sync, const string* d)
     memcpy(l->crc.data(), crc, sizeof crc);
     l->mtime = mtime;
     l->isvalid = true;
+    l->contenthash = std::move(contenthash);
 
     l->node = sync->client->nodebyhandle(h);
     l->parent = nullptr;
@@ -1914,6 +2500,7 @@ LocalNode* LocalNode::unserialize(Sync* sync, const string* d)
     // FIXME: serialize/unserialize
     l->created = false;
     l->reported = false;
+    l->debrispending = false;
     l->checked = h != UNDEF; // TODO: Is this a bug? h will never be UNDEF
 
     return l;
@@ -1923,28 +2510,55 @@ LocalNode* LocalNode::unserialize(Sync* sync, const string* d)
 
 void Fingerprints::newnode(Node* n)
 {
-    if (n->type == FILENODE)
-    {
-        n->fingerprint_it = mFingerprints.end();
-    }
+    n->infingerprints = false;
 }
 
 void Fingerprints::add(Node* n)
 {
-    if (n->type == FILENODE)
+    if (n->type == FILENODE && !n->infingerprints)
     {
-        n->fingerprint_it = mFingerprints.insert(n);
+        mFingerprints.insert(n);
+        n->infingerprints = true;
         mSumSizes += n->size;
     }
 }
 
 void Fingerprints::remove(Node* n)
 {
-    if (n->type == FILENODE && n->fingerprint_it != mFingerprints.end())
+    if (n->type == FILENODE && n->infingerprints)
     {
+        // usually alone in its range, the same file uploaded twice at most
+        bool found = false;
+        auto p = mFingerprints.equal_range(n);
+        for (iterator it = p.first; it != p.second; ++it)
+        {
+            if (*it == n)
+            {
+                mFingerprints.erase(it);
+                found = true;
+                break;
+            }
+        }
+
+        if (!found)
+        {
+            // its fingerprint was changed without taking it out first: it is in the
+            // bucket of the old one, and must not be left there to dangle
+            LOG_err << "Node not found by its fingerprint: " << toNodeHandle(n->nodehandle);
+            assert(false);
+
+            for (iterator it = mFingerprints.begin(); it != mFingerprints.end(); ++it)
+            {
+                if (*it == n)
+                {
+                    mFingerprints.erase(it);
+                    break;
+                }
+            }
+        }
+
         mSumSizes -= n->size;
-        mFingerprints.erase(n->fingerprint_it);
-        n->fingerprint_it = mFingerprints.end();
+        n->infingerprints = false;
     }
 }
 
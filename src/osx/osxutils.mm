@@ -20,6 +20,23 @@ void path2localMac(string* path, string* local)
         *local = "";
         return;
     }
+
+    // ASCII has no other representation: spare the NSString
+    bool ascii = true;
+    for (unsigned char c : *path)
+    {
+        if (c >= 0x80)
+        {
+            ascii = false;
+            break;
+        }
+    }
+    if (ascii)
+    {
+        *local = *path;
+        return;
+    }
+
     // Compatibility with new APFS filesystem
     // Use the fileSystemRepresentation property of NSString objects when creating and opening
     // files with lower-level filesystem APIs such as POSIX open(2), or when storing filenames externally from the filesystem`
@@ -27,15 +27,12 @@ int PosixConsoleWaiter::wait()
     int r;
 
     // application's own wakeup criteria: wake up upon user input
-    FD_SET(STDIN_FILENO, &rfds);
-    FD_SET(STDIN_FILENO, &ignorefds);
-    
-    bumpmaxfd(STDIN_FILENO);
+    watchfd(STDIN_FILENO, WATCH_READ | WATCH_IGNORED);
 
     r = PosixWaiter::wait();
 
     // application's own event processing: user interaction from stdin?
-    if (FD_ISSET(STDIN_FILENO, &rfds))
+    if (isready(STDIN_FILENO, WATCH_READ))
     {
         r |= HAVESTDIN;
     }
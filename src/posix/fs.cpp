@@ -26,6 +26,11 @@
 #include "mega.h"
 #include <sys/utsname.h>
 #include <sys/ioctl.h>
+#ifdef USE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#endif
 #ifdef TARGET_OS_MAC
 #include "mega/osx/osxutils.h"
 #endif
@@ -50,6 +55,11 @@ using namespace std;
 PosixAsyncIOContext::PosixAsyncIOContext() : AsyncIOContext()
 {
     aiocb = NULL;
+#ifdef USE_IO_URING
+    filefd = -1;
+    iov.iov_base = NULL;
+    iov.iov_len = 0;
+#endif
 }
 
 PosixAsyncIOContext::~PosixAsyncIOContext()
@@ -60,6 +70,18 @@ PosixAsyncIOContext::~PosixAsyncIOContext()
 
 void PosixAsyncIOContext::finish()
 {
+#ifdef USE_IO_URING
+    if (iouring)
+    {
+        if (!finished)
+        {
+            LOG_debug << "Synchronously waiting for io_uring operation";
+            iouring->wait(this);
+        }
+        iouring.reset();
+    }
+#endif
+
     if (aiocb)
     {
         if (!finished)
@@ -74,6 +96,338 @@ void PosixAsyncIOContext::finish()
 }
 #endif
 
+#ifdef USE_IO_URING
+PosixIoUring::PosixIoUring()
+    : ringfd(-1)
+    , sqring(MAP_FAILED)
+    , sqringsize(0)
+    , cqring(MAP_FAILED)
+    , cqringsize(0)
+    , sqes((io_uring_sqe*)MAP_FAILED)
+    , sqessize(0)
+    , queued(0)
+    , inflight(0)
+    , broken(false)
+{
+}
+
+std::shared_ptr<PosixIoUring> PosixIoUring::create(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof params);
+
+    std::shared_ptr<PosixIoUring> ring(new PosixIoUring());
+    ring->ringfd = int(syscall(__NR_io_uring_setup, entries, &params));
+    if (ring->ringfd < 0)
+    {
+        LOG_debug << "io_uring not available, using aio: " << errno;
+        return nullptr;
+    }
+
+    ring->sqringsize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqringsize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->sqringsize = ring->cqringsize = std::max(ring->sqringsize, ring->cqringsize);
+    }
+
+    ring->sqring = mmap(NULL, ring->sqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringfd, IORING_OFF_SQ_RING);
+    if (ring->sqring != MAP_FAILED)
+    {
+        ring->cqring = (params.features & IORING_FEAT_SINGLE_MMAP)
+                ? ring->sqring
+                : mmap(NULL, ring->cqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringfd, IORING_OFF_CQ_RING);
+    }
+    if (ring->cqring != MAP_FAILED)
+    {
+        ring->sqessize = params.sq_entries * sizeof(io_uring_sqe);
+        ring->sqes = (io_uring_sqe*)mmap(NULL, ring->sqessize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringfd, IORING_OFF_SQES);
+    }
+    if (ring->sqes == MAP_FAILED)
+    {
+        LOG_warn << "io_uring mapping failed, using aio: " << errno;
+        return nullptr;
+    }
+
+    char* sq = (char*)ring->sqring;
+    ring->sqhead = (unsigned*)(sq + params.sq_off.head);
+    ring->sqtail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sqarray = (unsigned*)(sq + params.sq_off.array);
+    ring->sqmask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqentries = params.sq_entries;
+
+    char* cq = (char*)ring->cqring;
+    ring->cqhead = (unsigned*)(cq + params.cq_off.head);
+    ring->cqtail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    ring->cqmask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqentries = params.cq_entries;
+
+    LOG_debug << "Using io_uring for async file IO, " << ring->sqentries << " entries";
+    return ring;
+}
+
+PosixIoUring::~PosixIoUring()
+{
+    // every context holds a reference until it finishes, so nothing is in flight here
+    assert(!inflight);
+
+    if (sqes != MAP_FAILED)
+    {
+        munmap(sqes, sqessize);
+    }
+    if (cqring != MAP_FAILED && cqring != sqring)
+    {
+        munmap(cqring, cqringsize);
+    }
+    if (sqring != MAP_FAILED)
+    {
+        munmap(sqring, sqringsize);
+    }
+    if (ringfd >= 0)
+    {
+        close(ringfd);
+    }
+}
+
+int PosixIoUring::fd() const
+{
+    return ringfd;
+}
+
+bool PosixIoUring::queue(PosixAsyncIOContext* context, int filefd)
+{
+    context->filefd = filefd;
+    context->iov.iov_base = context->buffer;
+    context->iov.iov_len = context->len;
+
+    std::lock_guard<std::mutex> g(mutex);
+    return queueLocked(context);
+}
+
+bool PosixIoUring::queueLocked(PosixAsyncIOContext* context)
+{
+    // stay within the completion queue, so no completion can be dropped
+    if (broken || inflight + queued >= cqentries)
+    {
+        return false;
+    }
+
+    unsigned tail = *sqtail;
+    if (tail - __atomic_load_n(sqhead, __ATOMIC_ACQUIRE) >= sqentries)
+    {
+        submitLocked();
+        if (tail - __atomic_load_n(sqhead, __ATOMIC_ACQUIRE) >= sqentries)
+        {
+            return false;
+        }
+    }
+
+    unsigned index = tail & sqmask;
+    io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = context->op == AsyncIOContext::READ ? IORING_OP_READV : IORING_OP_WRITEV;
+    sqe->fd = context->filefd;
+    sqe->addr = (uint64_t)(uintptr_t)&context->iov;
+    sqe->len = 1;
+    sqe->off = uint64_t(context->pos + ((byte*)context->iov.iov_base - context->buffer));
+    sqe->user_data = (uint64_t)(uintptr_t)context;
+    sqarray[index] = index;
+
+    __atomic_store_n(sqtail, tail + 1, __ATOMIC_RELEASE);
+    queued++;
+    return true;
+}
+
+void PosixIoUring::submit()
+{
+    std::lock_guard<std::mutex> g(mutex);
+    submitLocked();
+}
+
+void PosixIoUring::submitLocked()
+{
+    while (queued)
+    {
+        int n = int(syscall(__NR_io_uring_enter, ringfd, queued, 0, 0, NULL, 0));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            // EAGAIN/EBUSY: the kernel is short of resources, the entries stay queued for the next attempt
+            LOG_warn << "io_uring submission failed: " << errno;
+            return;
+        }
+
+        queued -= unsigned(n);
+        inflight += unsigned(n);
+    }
+}
+
+int PosixIoUring::reap()
+{
+    std::vector<std::pair<PosixAsyncIOContext*, int>> completed;
+
+    {
+        std::lock_guard<std::mutex> g(mutex);
+
+        unsigned head = *cqhead;
+        unsigned tail = __atomic_load_n(cqtail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            io_uring_cqe* cqe = &cqes[head & cqmask];
+            PosixAsyncIOContext* context = (PosixAsyncIOContext*)(uintptr_t)cqe->user_data;
+            int res = cqe->res;
+            inflight--;
+
+            if (!context)
+            {
+                // a cancellation from abandon(), or an operation it took back
+                continue;
+            }
+
+            if (res > 0 && size_t(res) < context->iov.iov_len)
+            {
+                // short read or write: carry on with the rest
+                context->iov.iov_base = (byte*)context->iov.iov_base + res;
+                context->iov.iov_len -= size_t(res);
+                if (queueLocked(context))
+                {
+                    continue;
+                }
+                res = -EIO;
+            }
+
+            context->retry = (res == -EAGAIN);
+            context->failed = res < 0 || (!res && context->iov.iov_len);
+            completed.emplace_back(context, res);
+        }
+
+        __atomic_store_n(cqhead, head, __ATOMIC_RELEASE);
+        submitLocked();
+    }
+
+    for (auto& c : completed)
+    {
+        PosixAsyncIOContext* context = c.first;
+        if (!context->failed)
+        {
+            if (context->op == AsyncIOContext::READ && context->pad)
+            {
+                memset(context->buffer + context->len, 0, context->pad);
+                LOG_verbose << "Async read finished OK";
+            }
+            else
+            {
+                LOG_verbose << "Async write finished OK";
+            }
+        }
+        else
+        {
+            LOG_warn << "Async operation finished with error: " << -c.second;
+        }
+
+        // the context may be deleted as soon as it is finished
+        asyncfscallback userCallback = context->userCallback;
+        void *userData = context->userData;
+        context->finished = true;
+        if (userCallback)
+        {
+            userCallback(userData);
+        }
+    }
+
+    return int(completed.size());
+}
+
+void PosixIoUring::wait(PosixAsyncIOContext* context)
+{
+    while (!context->finished)
+    {
+        submit();
+        if (!reap() && !context->finished)
+        {
+            int e = int(syscall(__NR_io_uring_enter, ringfd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0));
+            if (e < 0 && errno != EINTR)
+            {
+                LOG_err << "io_uring wait failed, cancelling the operation: " << errno;
+                abandon(context);
+                return;
+            }
+        }
+    }
+}
+
+void PosixIoUring::abandon(PosixAsyncIOContext* context)
+{
+    // the caller frees the buffer (and the context) as soon as this returns, so the
+    // kernel must be done with both: nothing else is queued on this ring from now on
+    bool taken = false;
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        broken = true;
+
+        // not handed to the kernel yet: turned into a no-op that touches nothing
+        for (unsigned pos = __atomic_load_n(sqhead, __ATOMIC_ACQUIRE); pos != *sqtail; pos++)
+        {
+            io_uring_sqe* sqe = &sqes[sqarray[pos & sqmask]];
+            if (sqe->user_data == (uint64_t)(uintptr_t)context)
+            {
+                memset(sqe, 0, sizeof *sqe);
+                sqe->opcode = IORING_OP_NOP;
+                taken = true;
+            }
+        }
+
+        if (!taken)
+        {
+            // in flight: ask the kernel to cancel it, its completion arrives either way
+            unsigned tail = *sqtail;
+            if (tail - __atomic_load_n(sqhead, __ATOMIC_ACQUIRE) < sqentries)
+            {
+                unsigned index = tail & sqmask;
+                io_uring_sqe* sqe = &sqes[index];
+                memset(sqe, 0, sizeof *sqe);
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = -1;
+                sqe->addr = (uint64_t)(uintptr_t)context;
+                sqarray[index] = index;
+                __atomic_store_n(sqtail, tail + 1, __ATOMIC_RELEASE);
+                queued++;
+            }
+        }
+        submitLocked();
+    }
+
+    if (taken)
+    {
+        LOG_warn << "Async operation abandoned before it started";
+        asyncfscallback userCallback = context->userCallback;
+        void *userData = context->userData;
+        context->failed = true;
+        context->finished = true;
+        if (userCallback)
+        {
+            userCallback(userData);
+        }
+        return;
+    }
+
+    // the completion ring is mapped: if the kernel can't be waited on, poll it
+    while (!context->finished)
+    {
+        if (!reap() && !context->finished)
+        {
+            pollfd pfd = { ringfd, POLLIN, 0 };
+            poll(&pfd, 1, 100);
+        }
+    }
+}
+#endif
+
 PosixFileAccess::PosixFileAccess(Waiter *w, int defaultfilepermissions, bool followSymLinks) : FileAccess(w)
 {
     fd = -1;
@@ -269,6 +623,18 @@ void PosixFileAccess::asyncsysread(AsyncIOContext *context)
         return;
     }
 
+#ifdef USE_IO_URING
+    if (iouring)
+    {
+        posixContext->iouring = iouring;
+        if (iouring->queue(posixContext, fd))
+        {
+            return;
+        }
+        posixContext->iouring.reset();
+    }
+#endif
+
     struct aiocb *aiocbp = new struct aiocb;
     memset(aiocbp, 0, sizeof (struct aiocb));
 
@@ -318,6 +684,18 @@ void PosixFileAccess::asyncsyswrite(AsyncIOContext *context)
         return;
     }
 
+#ifdef USE_IO_URING
+    if (iouring)
+    {
+        posixContext->iouring = iouring;
+        if (iouring->queue(posixContext, fd))
+        {
+            return;
+        }
+        posixContext->iouring.reset();
+    }
+#endif
+
     struct aiocb *aiocbp = new struct aiocb;
     memset(aiocbp, 0, sizeof (struct aiocb));
 
@@ -367,6 +745,53 @@ bool PosixFileAccess::sysread(byte* dst, unsigned len, m_off_t pos)
 #endif
 }
 
+#ifdef USE_IO_URING
+bool PosixFileAccess::sysreadbatch(const vector<RawRead>& reads)
+{
+    if (!iouring || reads.size() < 2)
+    {
+        return FileAccess::sysreadbatch(reads);
+    }
+
+    vector<PosixAsyncIOContext> contexts(reads.size());
+    vector<bool> queued(reads.size());
+    for (size_t i = 0; i < reads.size(); i++)
+    {
+        PosixAsyncIOContext& context = contexts[i];
+        context.op = AsyncIOContext::READ;
+        context.buffer = reads[i].dst;
+        context.len = reads[i].len;
+        context.pos = reads[i].pos;
+        context.iouring = iouring;
+        queued[i] = iouring->queue(&context, fd);
+        if (!queued[i])
+        {
+            context.iouring.reset();
+            context.finished = true;
+        }
+    }
+    iouring->submit();
+
+    bool ok = true;
+    for (size_t i = 0; i < reads.size(); i++)
+    {
+        if (queued[i])
+        {
+            iouring->wait(&contexts[i]);
+            ok = ok && !contexts[i].failed;
+        }
+        else
+        {
+            // the ring is full: read this one directly
+            ok = ok && sysread(reads[i].dst, reads[i].len, reads[i].pos);
+        }
+    }
+
+    retry = false;
+    return ok;
+}
+#endif
+
 bool PosixFileAccess::fwrite(const byte* data, unsigned len, m_off_t pos)
 {
     retry = false;
@@ -378,6 +803,47 @@ bool PosixFileAccess::fwrite(const byte* data, unsigned len, m_off_t pos)
 #endif
 }
 
+bool PosixFileAccess::fpreallocate(m_off_t size)
+{
+    if (fd < 0 || size <= 0)
+    {
+        return false;
+    }
+
+#if defined(__linux__) && !defined(__ANDROID__)
+    return !fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size);
+#elif defined(__MACH__)
+    fstore_t store = { F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, size, 0 };
+    if (fcntl(fd, F_PREALLOCATE, &store) == -1)
+    {
+        // no contiguous space left, any will do
+        store.fst_flags = F_ALLOCATEALL;
+        return fcntl(fd, F_PREALLOCATE, &store) != -1;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void PosixFileAccess::freadahead(m_off_t pos, m_off_t len)
+{
+    if (fd < 0 || len <= 0)
+    {
+        return;
+    }
+
+#if defined(POSIX_FADV_SEQUENTIAL) && !defined(__ANDROID__)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, pos, len, POSIX_FADV_WILLNEED);
+#elif defined(__MACH__)
+    struct radvisory advice;
+    advice.ra_offset = pos;
+    advice.ra_count = int(std::min<m_off_t>(len, INT_MAX));
+    fcntl(fd, F_RDADVISE, &advice);
+#endif
+}
+
 int PosixFileAccess::stealFileDescriptor()
 {
     int toret = fd;
@@ -569,6 +1035,10 @@ PosixFileSystemAccess::PosixFileSystemAccess(int fseventsfd)
     }
 #endif
 
+#ifdef USE_IO_URING
+    iouring = PosixIoUring::create();
+#endif
+
 #ifdef USE_INOTIFY
     lastcookie = 0;
     lastlocalnode = NULL;
@@ -578,6 +1048,10 @@ PosixFileSystemAccess::PosixFileSystemAccess(int fseventsfd)
     }
 #endif
 
+#ifdef USE_FANOTIFY
+    fanotifyfd = -1;
+#endif
+
 #ifdef __MACH__
 #if __LP64__
     typedef struct fsevent_clone_args {
@@ -618,9 +1092,16 @@ PosixFileSystemAccess::PosixFileSystemAccess(int fseventsfd)
                               FSE_IGNORE,  // FSE_XATTR_REMOVED,
                           };
 
+#ifdef USE_FSEVENTS
+    // FSEventStreams need no privileges: use the device only if an open fd is passed
+    notifyfailed = false;
+    fseventslatency = FSEVENTS_LATENCY;
+    if ((fd = fseventsfd) >= 0)
+#else
     // for this to succeed, geteuid() must be 0, or an existing /dev/fsevents fd must have
     // been passed to the constructor
     if ((fd = fseventsfd) >= 0 || (fd = open("/dev/fsevents", O_RDONLY)) >= 0)
+#endif
     {
         fca.event_list = (int8_t*)event_list;
         fca.num_events = sizeof event_list/sizeof(int8_t);
@@ -656,37 +1137,222 @@ PosixFileSystemAccess::~PosixFileSystemAccess()
     {
         close(notifyfd);
     }
+
+#ifdef USE_FANOTIFY
+    if (fanotifyfd >= 0)
+    {
+        close(fanotifyfd);
+    }
+#endif
 }
 
-// wake up from filesystem updates
-void PosixFileSystemAccess::addevents(Waiter* w, int /*flags*/)
+bool PosixFileSystemAccess::setfswidenotify(bool enable)
 {
-    if (notifyfd >= 0)
+#if defined(USE_FANOTIFY) && defined(ENABLE_SYNC)
+    if (!enable)
     {
-        PosixWaiter* pw = (PosixWaiter*)w;
+        // the folders watched through the marks would go unwatched
+        if (!fhnodes.empty())
+        {
+            return false;
+        }
 
-        FD_SET(notifyfd, &pw->rfds);
-        FD_SET(notifyfd, &pw->ignorefds);
+        if (fanotifyfd >= 0)
+        {
+            close(fanotifyfd);
+            fanotifyfd = -1;
+            fanotifymarks.clear();
+            fanotifyunmarkable.clear();
+        }
+        return true;
+    }
 
-        pw->bumpmaxfd(notifyfd);
+    if (fanotifyfd < 0)
+    {
+        fanotifyfd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC, O_RDONLY | O_LARGEFILE);
+        if (fanotifyfd < 0)
+        {
+            LOG_warn << "fanotify not available, watching each folder with inotify. Error code: " << errno;
+            return false;
+        }
+        LOG_info << "Watching whole filesystems with fanotify";
     }
+    return true;
+#else
+    return !enable;
+#endif
 }
 
-// read all pending inotify events and queue them for processing
-int PosixFileSystemAccess::checkevents(Waiter* w)
+size_t PosixFileSystemAccess::notifywatches() const
 {
-    int r = 0;
-    if (notifyfd < 0)
-    {
-        return r;
-    }
-#ifdef ENABLE_SYNC
+    size_t watches = 0;
 #ifdef USE_INOTIFY
-    PosixWaiter* pw = (PosixWaiter*)w;
-    string *ignore;
+    watches += wdnodes.size();
+#endif
+#ifdef USE_FANOTIFY
+    watches += fanotifymarks.size();
+#endif
+    return watches;
+}
 
-    if (FD_ISSET(notifyfd, &pw->rfds))
-    {
+#ifdef USE_FANOTIFY
+bool PosixFileSystemAccess::fanotifykey(const string* path, string* fsid, string* key)
+{
+    struct statfs statfsbuf;
+    union
+    {
+        struct file_handle fh;
+        char buf[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+    } h;
+    int mountid;
+
+    h.fh.handle_bytes = MAX_HANDLE_SZ;
+
+    if (statfs(path->c_str(), &statfsbuf) || name_to_handle_at(AT_FDCWD, path->c_str(), &h.fh, &mountid, 0))
+    {
+        return false;
+    }
+
+    fsid->assign((const char*)&statfsbuf.f_fsid, sizeof statfsbuf.f_fsid);
+    *key = *fsid;
+    key->append((const char*)&h.fh.handle_type, sizeof h.fh.handle_type);
+    key->append((const char*)h.fh.f_handle, h.fh.handle_bytes);
+    return true;
+}
+#endif
+
+// wake up from filesystem updates
+void PosixFileSystemAccess::addevents(Waiter* w, int /*flags*/)
+{
+#ifdef USE_IO_URING
+    if (iouring)
+    {
+        // the batch of operations started since the last wait
+        iouring->submit();
+
+        ((PosixWaiter*)w)->watchfd(iouring->fd(), PosixWaiter::WATCH_READ);
+    }
+#endif
+
+    if (notifyfd >= 0)
+    {
+        ((PosixWaiter*)w)->watchfd(notifyfd, PosixWaiter::WATCH_READ | PosixWaiter::WATCH_IGNORED);
+    }
+
+#ifdef USE_FANOTIFY
+    if (fanotifyfd >= 0)
+    {
+        ((PosixWaiter*)w)->watchfd(fanotifyfd, PosixWaiter::WATCH_READ | PosixWaiter::WATCH_IGNORED);
+    }
+#endif
+}
+
+// read all pending inotify events and queue them for processing
+int PosixFileSystemAccess::checkevents(Waiter* w)
+{
+    int r = 0;
+
+#ifdef USE_IO_URING
+    if (iouring && iouring->reap())
+    {
+        r |= Waiter::NEEDEXEC;
+    }
+#endif
+
+#if defined(USE_FANOTIFY) && defined(ENABLE_SYNC)
+    if (fanotifyfd >= 0 && ((PosixWaiter*)w)->isready(fanotifyfd, PosixWaiter::WATCH_READ))
+    {
+        union
+        {
+            struct fanotify_event_metadata m;
+            char buf[8192];
+        } events;
+        ssize_t l;
+        string key;
+
+        while ((l = read(fanotifyfd, events.buf, sizeof events.buf)) > 0)
+        {
+            for (fanotify_event_metadata* m = &events.m; FAN_EVENT_OK(m, l); m = FAN_EVENT_NEXT(m, l))
+            {
+                if (m->vers != FANOTIFY_METADATA_VERSION)
+                {
+                    LOG_err << "Unexpected fanotify version: " << int(m->vers);
+                    notifyerr = true;
+                    break;
+                }
+
+                if (m->fd >= 0)
+                {
+                    close(m->fd);
+                }
+
+                if (m->mask & FAN_Q_OVERFLOW)
+                {
+                    notifyerr = true;
+                    continue;
+                }
+
+                // with FAN_REPORT_DFID_NAME, the folder where it happened and the name in it
+                fanotify_event_info_fid* fid = (fanotify_event_info_fid*)((char*)m + m->metadata_len);
+                if ((char*)fid + sizeof(*fid) > (char*)m + m->event_len
+                        || fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+                {
+                    continue;
+                }
+
+                file_handle* fh = (file_handle*)fid->handle;
+                key.assign((const char*)&fid->fsid, sizeof fid->fsid);
+                key.append((const char*)&fh->handle_type, sizeof fh->handle_type);
+                key.append((const char*)fh->f_handle, fh->handle_bytes);
+
+                fhlocalnode_map::iterator it = fhnodes.find(key);
+                if (it == fhnodes.end())
+                {
+                    continue;   // elsewhere in the filesystem
+                }
+
+                const char* name = (const char*)fh->f_handle + fh->handle_bytes;
+                size_t namesize = strlen(name);
+                string* ignore = &it->second->sync->dirnotify->ignore;
+
+                if (namesize && strcmp(name, ".")
+                 && (namesize < ignore->size()
+                  || memcmp(name, ignore->data(), ignore->size())
+                  || (namesize > ignore->size()
+                   && memcmp(name + ignore->size(), localseparator.c_str(), localseparator.size()))))
+                {
+                    // a move comes as FAN_MOVED_FROM and FAN_MOVED_TO, both paths get checked
+                    LOG_debug << "Filesystem notification. Root: " << it->second->name << "   Path: " << name;
+                    it->second->sync->dirnotify->notify(DirNotify::DIREVENTS, it->second, name, namesize);
+
+                    r |= Waiter::NEEDEXEC;
+                }
+            }
+        }
+    }
+#endif
+
+#ifdef USE_FSEVENTS
+    for (PosixDirNotify* dirnotify : fseventnotifys)
+    {
+        if (dirnotify->procevents())
+        {
+            r |= Waiter::NEEDEXEC;
+        }
+    }
+#endif
+
+    if (notifyfd < 0)
+    {
+        return r;
+    }
+#ifdef ENABLE_SYNC
+#ifdef USE_INOTIFY
+    PosixWaiter* pw = (PosixWaiter*)w;
+    string *ignore;
+
+    if (pw->isready(notifyfd, PosixWaiter::WATCH_READ))
+    {
         char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
         int p, l;
         inotify_event* in;
@@ -760,7 +1426,8 @@ int PosixFileSystemAccess::checkevents(Waiter* w)
                                     LOG_debug << "Filesystem notification. Root: " << it->second->name << "   Path: " << in->name;
                                     it->second->sync->dirnotify->notify(DirNotify::DIREVENTS,
                                                                         it->second, in->name,
-                                                                        insize);
+                                                                        insize, false,
+                                                                        (in->mask & (IN_CLOSE_WRITE | IN_ISDIR)) == IN_CLOSE_WRITE);
 
                                     r |= Waiter::NEEDEXEC;
                                 }
@@ -1745,12 +2412,61 @@ PosixDirNotify::PosixDirNotify(string* localbasepath, string* ignore) : DirNotif
     failed = 0;
 #endif
 
+#ifdef USE_FSEVENTS
+    stream = NULL;
+    queue = NULL;
+    lastid = kFSEventStreamEventIdSinceNow;
+    lostsince = 0;
+#endif
+
     fsaccess = NULL;
 }
 
 void PosixDirNotify::addnotify(LocalNode* l, string* path)
 {
 #ifdef ENABLE_SYNC
+#ifdef USE_FSEVENTS
+    // one stream for the whole tree, from the root
+    if (fsaccess->notifyfd < 0 && !stream && sync && l == sync->localroot.get())
+    {
+        startstream();
+    }
+#endif
+
+#ifdef USE_FANOTIFY
+    string fsid, key;
+    if (fsaccess->fanotifyfd >= 0 && fsaccess->fanotifykey(path, &fsid, &key)
+            && !fsaccess->fanotifyunmarkable.count(fsid))
+    {
+        if (!fsaccess->fanotifymarks.count(fsid))
+        {
+            if (!fanotify_mark(fsaccess->fanotifyfd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+                               FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_CLOSE_WRITE | FAN_ONDIR,
+                               AT_FDCWD, path->c_str()))
+            {
+                LOG_info << "Watching the filesystem of " << path->c_str() << " with fanotify";
+                fsaccess->fanotifymarks.insert(fsid);
+            }
+            else
+            {
+                // e.g. without CAP_SYS_ADMIN, or not supported by the filesystem
+                LOG_warn << "Unable to watch the filesystem of " << path->c_str() << " with fanotify. Error code: " << errno;
+                fsaccess->fanotifyunmarkable.insert(fsid);
+            }
+        }
+
+        if (fsaccess->fanotifymarks.count(fsid))
+        {
+            // a folder that was watched by inotify before fanotify was enabled
+            delnotify(l);
+
+            fsaccess->fhnodes[key] = l;
+            fsaccess->nodefhs[l] = key;
+            return;
+        }
+    }
+#endif
+
 #ifdef USE_INOTIFY
     int wd;
 
@@ -1763,6 +2479,11 @@ void PosixDirNotify::addnotify(LocalNode* l, string* path)
         l->dirnotifytag = (handle)wd;
         fsaccess->wdnodes[wd] = l;
     }
+    else if (errno == ENOSPC)
+    {
+        LOG_warn << "Unable to addnotify path: " <<  path->c_str() << ". inotify watch limit (max_user_watches) reached with "
+                 << fsaccess->wdnodes.size() << " watches";
+    }
     else
     {
         LOG_warn << "Unable to addnotify path: " <<  path->c_str() << ". Error code: " << errno;
@@ -1774,6 +2495,21 @@ void PosixDirNotify::addnotify(LocalNode* l, string* path)
 void PosixDirNotify::delnotify(LocalNode* l)
 {
 #ifdef ENABLE_SYNC
+#ifdef USE_FANOTIFY
+    map<LocalNode*, string>::iterator it = fsaccess->nodefhs.find(l);
+    if (it != fsaccess->nodefhs.end())
+    {
+        // the mark stays for the rest of the filesystem
+        PosixFileSystemAccess::fhlocalnode_map::iterator fit = fsaccess->fhnodes.find(it->second);
+        if (fit != fsaccess->fhnodes.end() && fit->second == l)
+        {
+            fsaccess->fhnodes.erase(fit);
+        }
+        fsaccess->nodefhs.erase(it);
+        return;
+    }
+#endif
+
 #ifdef USE_INOTIFY
     if (fsaccess->wdnodes.erase((int)(long)l->dirnotifytag))
     {
@@ -1814,9 +2550,355 @@ bool PosixDirNotify::fsstableids() const
 #endif
 }
 
+#ifdef USE_FSEVENTS
+namespace {
+
+const FSEventStreamEventFlags FSEVENTS_LOST = kFSEventStreamEventFlagUserDropped
+                                            | kFSEventStreamEventFlagKernelDropped
+                                            | kFSEventStreamEventFlagEventIdsWrapped;
+
+FSEventStreamRef createstream(const string& path, FSEventStreamCallback callback, void* info,
+                              FSEventStreamEventId since, CFTimeInterval latency)
+{
+    CFStringRef cfpath = CFStringCreateWithFileSystemRepresentation(NULL, path.c_str());
+    if (!cfpath)
+    {
+        return NULL;
+    }
+
+    CFArrayRef paths = CFArrayCreate(NULL, (const void**)&cfpath, 1, &kCFTypeArrayCallBacks);
+    FSEventStreamContext context = { 0, info, NULL, NULL, NULL };
+    FSEventStreamRef stream = FSEventStreamCreate(NULL, callback, &context, paths, since, latency,
+                                                  kFSEventStreamCreateFlagFileEvents
+                                                | kFSEventStreamCreateFlagNoDefer
+                                                | kFSEventStreamCreateFlagWatchRoot);
+    CFRelease(paths);
+    CFRelease(cfpath);
+    return stream;
+}
+
+void nothing(void*) { }
+
+// no callback runs once this returns
+void releasestream(FSEventStreamRef stream, dispatch_queue_t queue)
+{
+    FSEventStreamStop(stream);
+    FSEventStreamInvalidate(stream);
+    dispatch_sync_f(queue, NULL, nothing);
+    FSEventStreamRelease(stream);
+}
+
+// the path relative to the watched root ("" for the root itself), false if outside it
+bool relativepath(const string& root, const char* path, string* relative)
+{
+    size_t len = strlen(path);
+    if (len < root.size() || memcmp(path, root.data(), root.size())
+            || (len > root.size() && path[root.size()] != '/'))
+    {
+        return false;
+    }
+
+    relative->assign(len > root.size() ? path + root.size() + 1 : "");
+    return true;
+}
+
+void streamcallback(ConstFSEventStreamRef, void* info, size_t n, void* eventpaths,
+                    const FSEventStreamEventFlags flags[], const FSEventStreamEventId ids[])
+{
+    PosixDirNotify* dirnotify = (PosixDirNotify*)info;
+    char** paths = (char**)eventpaths;
+    string relative;
+
+    {
+        std::lock_guard<std::mutex> g(dirnotify->pendingmutex);
+        for (size_t i = 0; i < n; i++)
+        {
+            if (flags[i] & FSEVENTS_LOST)
+            {
+                // the history has what was dropped since the last event delivered
+                if (!dirnotify->lostsince)
+                {
+                    dirnotify->lostsince = dirnotify->lastid;
+                }
+                dirnotify->pending.emplace_back(string(), flags[i]);
+            }
+            else if (relativepath(dirnotify->streampath, paths[i], &relative))
+            {
+                dirnotify->pending.emplace_back(relative, flags[i]);
+            }
+            dirnotify->lastid = ids[i];
+        }
+    }
+
+    dirnotify->fsaccess->waiter->notify();
+}
+
+struct StreamHistory
+{
+    string root;
+    vector<string> paths;
+    bool lost = false;
+    dispatch_semaphore_t done;
+};
+
+void historycallback(ConstFSEventStreamRef, void* info, size_t n, void* eventpaths,
+                     const FSEventStreamEventFlags flags[], const FSEventStreamEventId[])
+{
+    StreamHistory* history = (StreamHistory*)info;
+    char** paths = (char**)eventpaths;
+    string relative;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (flags[i] & kFSEventStreamEventFlagHistoryDone)
+        {
+            dispatch_semaphore_signal(history->done);
+            return;
+        }
+
+        if (flags[i] & (FSEVENTS_LOST | kFSEventStreamEventFlagRootChanged))
+        {
+            history->lost = true;
+        }
+        else if (relativepath(history->root, paths[i], &relative))
+        {
+            history->paths.push_back(relative);
+        }
+    }
+}
+
+} // anonymous
+
+void PosixDirNotify::startstream()
+{
+    streampath = sync->mFsEventsPath.size() ? sync->mFsEventsPath : localbasepath;
+    lastid = FSEventsGetCurrentEventId();
+    queue = dispatch_queue_create("nz.mega.sdk.fsevents", DISPATCH_QUEUE_SERIAL);
+    stream = createstream(streampath, streamcallback, this, kFSEventStreamEventIdSinceNow, fsaccess->fseventslatency);
+    if (stream)
+    {
+        FSEventStreamSetDispatchQueue(stream, queue);
+    }
+
+    if (!stream || !FSEventStreamStart(stream))
+    {
+        LOG_err << "Unable to start the FSEventStream on " << streampath;
+        stopstream();
+        failed = 1;
+        failreason = "Unable to start the FSEventStream";
+        return;
+    }
+
+    LOG_info << "Watching " << streampath << " with FSEvents";
+    fsaccess->fseventnotifys.insert(this);
+}
+
+void PosixDirNotify::stopstream()
+{
+    if (stream)
+    {
+        releasestream(stream, queue);
+        stream = NULL;
+    }
+    if (queue)
+    {
+        dispatch_release(queue);
+        queue = NULL;
+    }
+    fsaccess->fseventnotifys.erase(this);
+}
+
+bool PosixDirNotify::procevents()
+{
+    vector<pair<string, FSEventStreamEventFlags>> events;
+    FSEventStreamEventId since;
+    {
+        std::lock_guard<std::mutex> g(pendingmutex);
+        events.swap(pending);
+        since = lostsince;
+        lostsince = 0;
+    }
+
+    if (events.empty())
+    {
+        return false;
+    }
+
+    static const char rsrc[] = "/..namedfork/rsrc";
+    set<string> queued;
+    string abspath;
+    struct stat statbuf;
+
+    for (const auto& event : events)
+    {
+        const string& path = event.first;
+
+        if (event.second & FSEVENTS_LOST)
+        {
+            // the sync queues what the event database has since, or rescans everything without it
+            LOG_warn << "FSEvents dropped events on " << streampath << " flags: " << event.second;
+            overflows++;
+            if (overflowcursor.empty())
+            {
+                if (cursorprefix(&overflowcursor))
+                {
+                    overflowcursor.append((const char*)&since, sizeof since);
+                }
+                else
+                {
+                    error++;
+                }
+            }
+            continue;
+        }
+
+        if (event.second & kFSEventStreamEventFlagRootChanged)
+        {
+            // the root was moved or deleted
+            LOG_warn << "Sync root changed: " << streampath;
+            error++;
+            continue;
+        }
+
+        // the same path changed several times in this batch, the debris and resource forks
+        if (!queued.insert(path).second
+                || (path.size() >= ignore.size() && !memcmp(path.data(), ignore.data(), ignore.size())
+                    && (path.size() == ignore.size() || path[ignore.size()] == '/'))
+                || (path.size() >= sizeof rsrc - 1 && !memcmp(path.data() + path.size() - (sizeof rsrc - 1), rsrc, sizeof rsrc - 1)))
+        {
+            continue;
+        }
+
+        abspath = localbasepath;
+        if (path.size())
+        {
+            abspath.append("/").append(path);
+        }
+        if (!lstat(abspath.c_str(), &statbuf) && S_ISLNK(statbuf.st_mode))
+        {
+            LOG_debug << "Link skipped:  " << abspath;
+            continue;
+        }
+
+        // kFSEventStreamEventFlagMustScanSubDirs comes with the folder to rescan
+        LOG_debug << "Filesystem notification. Root: " << sync->localroot->name << "   Path: " << path;
+        notify(DIREVENTS, sync->localroot.get(), path.data(), path.size());
+    }
+
+    return true;
+}
+
+bool PosixDirNotify::cursorprefix(string* cursor) const
+{
+    struct stat statbuf;
+    if (stat(localbasepath.c_str(), &statbuf))
+    {
+        return false;
+    }
+
+    CFUUIDRef uuid = FSEventsCopyUUIDForDevice(statbuf.st_dev);
+    if (!uuid)
+    {
+        // no event database on this volume (e.g. read-only or network)
+        return false;
+    }
+
+    CFUUIDBytes bytes = CFUUIDGetUUIDBytes(uuid);
+    CFRelease(uuid);
+    cursor->assign((const char*)&bytes, sizeof bytes);
+    return true;
+}
+
+bool PosixDirNotify::journalcursor(string* cursor)
+{
+    if (!cursorprefix(cursor))
+    {
+        return false;
+    }
+
+    FSEventStreamEventId id = FSEventsGetCurrentEventId();
+    cursor->append((const char*)&id, sizeof id);
+    return true;
+}
+
+bool PosixDirNotify::journalchanges(const string& cursor, const journalchange_callback& callback)
+{
+    string prefix;
+    FSEventStreamEventId id;
+    if (cursor.size() != sizeof(CFUUIDBytes) + sizeof id || !cursorprefix(&prefix)
+            || cursor.compare(0, prefix.size(), prefix))
+    {
+        // the event database was recreated since
+        return false;
+    }
+    memcpy(&id, cursor.data() + prefix.size(), sizeof id);
+
+    StreamHistory history;
+    history.root = streampath.size() ? streampath : (sync && sync->mFsEventsPath.size() ? sync->mFsEventsPath : localbasepath);
+    history.done = dispatch_semaphore_create(0);
+
+    dispatch_queue_t historyqueue = dispatch_queue_create("nz.mega.sdk.fsevents.history", DISPATCH_QUEUE_SERIAL);
+    FSEventStreamRef historystream = createstream(history.root, historycallback, &history, id, 0);
+    bool success = false;
+    if (historystream)
+    {
+        FSEventStreamSetDispatchQueue(historystream, historyqueue);
+        success = FSEventStreamStart(historystream)
+               && !dispatch_semaphore_wait(history.done, dispatch_time(DISPATCH_TIME_NOW, 60 * NSEC_PER_SEC));
+        releasestream(historystream, historyqueue);
+    }
+    dispatch_release(historyqueue);
+    dispatch_release(history.done);
+
+    if (!success || history.lost)
+    {
+        LOG_debug << "Unable to replay the FSEvents history of " << history.root;
+        return false;
+    }
+
+    // (fsid, parent folder fsid, name) from what is there now: a deleted entry comes with its folder only
+    string abspath;
+    struct stat statbuf;
+    for (const string& path : history.paths)
+    {
+        abspath = localbasepath;
+        if (path.size())
+        {
+            abspath.append("/").append(path);
+        }
+
+        size_t last = abspath.rfind('/');
+        if (last == string::npos || abspath.size() == localbasepath.size())
+        {
+            continue;
+        }
+
+        handle fsid = lstat(abspath.c_str(), &statbuf) ? UNDEF : (handle)statbuf.st_ino;
+        if (stat(abspath.substr(0, last).c_str(), &statbuf))
+        {
+            continue;
+        }
+        callback(fsid, (handle)statbuf.st_ino, abspath.substr(last + 1));
+    }
+    return true;
+}
+
+PosixDirNotify::~PosixDirNotify()
+{
+    if (stream || queue)
+    {
+        stopstream();
+    }
+}
+#endif
+
 std::unique_ptr<FileAccess> PosixFileSystemAccess::newfileaccess(bool followSymLinks)
 {
-    return std::unique_ptr<FileAccess>{new PosixFileAccess{waiter, defaultfilepermissions, followSymLinks}};
+    auto fa = new PosixFileAccess{waiter, defaultfilepermissions, followSymLinks};
+#ifdef USE_IO_URING
+    fa->iouring = iouring;
+#endif
+    return std::unique_ptr<FileAccess>{fa};
 }
 
 DirAccess* PosixFileSystemAccess::newdiraccess()
@@ -1880,19 +2962,6 @@ bool PosixDirAccess::dopen(string* path, FileAccess* f, bool doglob)
 
 bool PosixDirAccess::dnext(string* path, string* name, bool followsymlinks, nodetype_t* type)
 {
-#ifdef USE_IOS
-    string absolutepath;
-    if (PosixFileSystemAccess::appbasepath)
-    {
-        if (path->size() && path->at(0) != '/')
-        {
-            absolutepath = PosixFileSystemAccess::appbasepath;
-            absolutepath.append(*path);
-            path = &absolutepath;
-        }
-    }
-#endif
-
     if (globbing)
     {
         struct stat statbuf;
@@ -1914,35 +2983,107 @@ bool PosixDirAccess::dnext(string* path, string* name, bool followsymlinks, node
         return false;
     }
 
+    struct stat statbuf;
+    bool islink;
+
+    if (!readentry(path, name, followsymlinks, &statbuf, &islink))
+    {
+        return false;
+    }
+
+    if (type)
+    {
+        *type = S_ISREG(statbuf.st_mode) ? FILENODE : FOLDERNODE;
+    }
+
+    return true;
+}
+
+bool PosixDirAccess::dnextstat(string* path, DirEntry* entry, bool followsymlinks)
+{
+    if (globbing)
+    {
+        return DirAccess::dnextstat(path, entry, followsymlinks);
+    }
+
+    struct stat statbuf;
+    bool islink;
+
+    if (!readentry(path, &entry->localname, followsymlinks, &statbuf, &islink))
+    {
+        return false;
+    }
+
+    entry->type = S_ISREG(statbuf.st_mode) ? FILENODE : FOLDERNODE;
+
+    // a followed symlink is stat'ed differently by PosixFileAccess, and busy files must be retried by it
+    entry->statvalid = !islink;
+#ifdef __MACH__
+    if (statbuf.st_birthtimespec.tv_sec == -2082844800)
+    {
+        entry->statvalid = false;
+    }
+#endif
+
+    if (entry->statvalid)
+    {
+        entry->size = entry->type == FILENODE ? statbuf.st_size : 0;
+        entry->mtime = statbuf.st_mtime;
+        entry->fsid = (handle)statbuf.st_ino;
+        entry->fsidvalid = true;
+
+        FileSystemAccess::captimestamp(&entry->mtime);
+    }
+
+    return true;
+}
+
+// readdir() fetches the records in bulk (getdents64() on Linux), and fstatat() relative to the open
+// folder spares the kernel the lookup of the whole path for every entry
+bool PosixDirAccess::readentry(string* path, string* name, bool followsymlinks, struct stat* statbuf, bool* islink)
+{
+#ifdef USE_IOS
+    string absolutepath;
+    if (PosixFileSystemAccess::appbasepath)
+    {
+        if (path->size() && path->at(0) != '/')
+        {
+            absolutepath = PosixFileSystemAccess::appbasepath;
+            absolutepath.append(*path);
+            path = &absolutepath;
+        }
+    }
+#endif
+
     dirent* d;
     size_t pathsize = path->size();
-    struct stat statbuf;
 
+#ifndef AT_SYMLINK_NOFOLLOW
     path->append("/");
+#endif
 
     while ((d = readdir(dp)))
     {
         if (*d->d_name != '.' || (d->d_name[1] && (d->d_name[1] != '.' || d->d_name[2])))
         {
+#ifdef AT_SYMLINK_NOFOLLOW
+            bool statok = !fstatat(dirfd(dp), d->d_name, statbuf, followsymlinks ? 0 : AT_SYMLINK_NOFOLLOW);
+#else
             path->append(d->d_name);
-
-            if (followsymlinks ? !stat(path->c_str(), &statbuf) : !lstat(path->c_str(), &statbuf))
+            bool statok = followsymlinks ? !stat(path->c_str(), statbuf) : !lstat(path->c_str(), statbuf);
+            path->resize(pathsize + 1);
+#endif
+            if (statok && (S_ISREG(statbuf->st_mode) || S_ISDIR(statbuf->st_mode)))
             {
-                if (S_ISREG(statbuf.st_mode) || S_ISDIR(statbuf.st_mode))
-                {
-                    path->resize(pathsize);
-                    *name = d->d_name;
-
-                    if (type)
-                    {
-                        *type = S_ISREG(statbuf.st_mode) ? FILENODE : FOLDERNODE;
-                    }
-
-                    return true;
-                }
+                path->resize(pathsize);
+                *name = d->d_name;
+#ifdef DT_LNK
+                *islink = d->d_type == DT_LNK || d->d_type == DT_UNKNOWN;
+#else
+                *islink = true;
+#endif
+                return true;
             }
-
-            path->resize(pathsize+1);
         }
     }
 
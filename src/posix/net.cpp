@@ -31,6 +31,9 @@ extern JavaVM *MEGAjvm;
 #define IPV6_RETRY_INTERVAL_DS 72000
 #define DNS_CACHE_TIMEOUT_DS 18000
 #define DNS_CACHE_EXPIRES 0
+
+// persisted addresses older than this (seconds) are not used after a restart
+#define DNS_CACHE_PERSISTED_TTL 86400
 #define MAX_SPEED_CONTROL_TIMEOUT_MS 500
 
 namespace mega {
@@ -239,6 +242,14 @@ CurlHttpIO::CurlHttpIO()
     curlipv6 = data->features & CURL_VERSION_IPV6;
     LOG_debug << "IPv6 enabled: " << curlipv6;
 
+#if LIBCURL_VERSION_NUM >= 0x072f00 // At least cURL 7.47.0 (CURL_HTTP_VERSION_2TLS)
+    curlhttp2 = data->features & CURL_VERSION_HTTP2;
+#else
+    curlhttp2 = false;
+#endif
+    LOG_debug << "HTTP/2 available: " << curlhttp2;
+    http2 = false;
+
     dnsok = false;
     reset = false;
     statechange = false;
@@ -279,7 +290,15 @@ CurlHttpIO::CurlHttpIO()
     {
         curl_global_init(CURL_GLOBAL_DEFAULT);
         ares_library_init(ARES_LIB_INIT_ALL);
+
+        sharedcurlsh = curl_share_init();
+        curl_share_setopt(sharedcurlsh, CURLSHOPT_LOCKFUNC, sharelock);
+        curl_share_setopt(sharedcurlsh, CURLSHOPT_UNLOCKFUNC, shareunlock);
+        curl_share_setopt(sharedcurlsh, CURLSHOPT_USERDATA, sharemutexes);
+        curl_share_setopt(sharedcurlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(sharedcurlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
     }
+    curlsh = sharedcurlsh;
 
 #if defined(__ANDROID__) && ARES_VERSION >= 0x010F00
     initialize_android();
@@ -328,10 +347,7 @@ CurlHttpIO::CurlHttpIO()
 
     curltimeoutreset[PUT] = -1;
     arerequestspaused[PUT] = false;
-
-    curlsh = curl_share_init();
-    curl_share_setopt(curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
-    curl_share_setopt(curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    setmultiplexing();
 
     contenttypejson = curl_slist_append(NULL, "Content-Type: application/json");
     contenttypejson = curl_slist_append(contenttypejson, "Expect:");
@@ -507,26 +523,23 @@ void CurlHttpIO::addaresevents(Waiter *waiter)
                 ((WinWaiter *)waiter)->addhandle(info.eventHandle(), Waiter::NEEDEXEC);
             }
 #else
-            if (readable)
-            {
-                FD_SET(info.fd, &((PosixWaiter *)waiter)->rfds);
-                ((PosixWaiter *)waiter)->bumpmaxfd(info.fd);
-            }
-            if (writeable)
-            {
-                FD_SET(info.fd, &((PosixWaiter *)waiter)->wfds);
-                ((PosixWaiter *)waiter)->bumpmaxfd(info.fd);
-            }
+            ((PosixWaiter *)waiter)->watchfd(info.fd, (readable ? PosixWaiter::WATCH_READ : 0) | (writeable ? PosixWaiter::WATCH_WRITE : 0));
 #endif
         }
     }
 
-#if defined(_WIN32)
     for (auto& mapPair : prevAressockets)
     {
+#if defined(_WIN32)
         mapPair.second.closeEvent();
-    }
+#else
+        // c-ares closes its sockets without telling us
+        if (waiter)
+        {
+            ((PosixWaiter *)waiter)->forgetfd(mapPair.first);
+        }
 #endif
+    }
 }
 
 void CurlHttpIO::addcurlevents(Waiter *waiter, direction_t d)
@@ -555,18 +568,8 @@ void CurlHttpIO::addcurlevents(Waiter *waiter, direction_t d)
             ((WinWaiter *)waiter)->addhandle(info.eventHandle(), Waiter::NEEDEXEC);
         }
 #else
-
-        if (info.mode & SockInfo::READ)
-        {
-            FD_SET(info.fd, &((PosixWaiter *)waiter)->rfds);
-            ((PosixWaiter *)waiter)->bumpmaxfd(info.fd);
-        }
-
-        if (info.mode & SockInfo::WRITE)
-        {
-            FD_SET(info.fd, &((PosixWaiter *)waiter)->wfds);
-            ((PosixWaiter *)waiter)->bumpmaxfd(info.fd);
-        }
+        ((PosixWaiter *)waiter)->watchfd(info.fd, ((info.mode & SockInfo::READ) ? PosixWaiter::WATCH_READ : 0)
+                                                | ((info.mode & SockInfo::WRITE) ? PosixWaiter::WATCH_WRITE : 0));
 #endif
    }
 
@@ -607,8 +610,7 @@ void CurlHttpIO::processaresevents()
     CodeCounter::ScopeTimer ccst(countProcessAresEventsCode);
 
 #ifndef _WIN32
-    fd_set *rfds = &((PosixWaiter *)waiter)->rfds;
-    fd_set *wfds = &((PosixWaiter *)waiter)->wfds;
+    PosixWaiter* pw = (PosixWaiter *)waiter;
 #endif
 
     for (auto& mapPair : aressockets)
@@ -626,11 +628,11 @@ void CurlHttpIO::processaresevents()
             ares_process_fd(ares, read ? info.fd : ARES_SOCKET_BAD, write ? info.fd : ARES_SOCKET_BAD);
         }
 #else
-        if (((info.mode & SockInfo::READ) && FD_ISSET(info.fd, rfds)) || ((info.mode & SockInfo::WRITE) && FD_ISSET(info.fd, wfds)))
+        bool read = (info.mode & SockInfo::READ) && pw->isready(info.fd, PosixWaiter::WATCH_READ);
+        bool write = (info.mode & SockInfo::WRITE) && pw->isready(info.fd, PosixWaiter::WATCH_WRITE);
+        if (read || write)
         {
-            ares_process_fd(ares,
-                            ((info.mode & SockInfo::READ) && FD_ISSET(info.fd, rfds)) ? info.fd : ARES_SOCKET_BAD,
-                            ((info.mode & SockInfo::WRITE) && FD_ISSET(info.fd, wfds)) ? info.fd : ARES_SOCKET_BAD);
+            ares_process_fd(ares, read ? info.fd : ARES_SOCKET_BAD, write ? info.fd : ARES_SOCKET_BAD);
         }
 #endif
     }
@@ -647,8 +649,7 @@ void CurlHttpIO::processcurlevents(direction_t d)
     CodeCounter::ScopeTimer ccst(countProcessCurlEventsCode);
 
 #ifndef _WIN32
-    fd_set *rfds = &((PosixWaiter *)waiter)->rfds;
-    fd_set *wfds = &((PosixWaiter *)waiter)->wfds;
+    PosixWaiter* pw = (PosixWaiter *)waiter;
 #endif
 
     int dummy = 0;
@@ -673,12 +674,13 @@ void CurlHttpIO::processcurlevents(direction_t d)
                                    | (write ? CURL_CSELECT_OUT : 0), &dummy);
         }
 #else
-        if (((info.mode & SockInfo::READ) && FD_ISSET(info.fd, rfds)) || ((info.mode & SockInfo::WRITE) && FD_ISSET(info.fd, wfds)))
+        bool read = (info.mode & SockInfo::READ) && pw->isready(info.fd, PosixWaiter::WATCH_READ);
+        bool write = (info.mode & SockInfo::WRITE) && pw->isready(info.fd, PosixWaiter::WATCH_WRITE);
+        if (read || write)
         {
             curl_multi_socket_action(curlm[d], info.fd,
-                                     (((info.mode & SockInfo::READ) && FD_ISSET(info.fd, rfds)) ? CURL_CSELECT_IN : 0)
-                                     | (((info.mode & SockInfo::WRITE) && FD_ISSET(info.fd, wfds)) ? CURL_CSELECT_OUT : 0),
-                                     &dummy);
+                                     (read ? CURL_CSELECT_IN : 0)
+                                   | (write ? CURL_CSELECT_OUT : 0), &dummy);
         }
 #endif
     }
@@ -712,7 +714,6 @@ CurlHttpIO::~CurlHttpIO()
     curl_multi_cleanup(curlm[API]);
     curl_multi_cleanup(curlm[GET]);
     curl_multi_cleanup(curlm[PUT]);
-    curl_share_cleanup(curlsh);
 
     closearesevents();
     closecurlevents(API);
@@ -720,8 +721,11 @@ CurlHttpIO::~CurlHttpIO()
     closecurlevents(PUT);
 
     curlMutex.lock();
+    connectionshare.reset();
     if (--instanceCount == 0)
     {
+        curl_share_cleanup(sharedcurlsh);
+        sharedcurlsh = NULL;
         ares_library_cleanup();
         curl_global_cleanup();
     }
@@ -732,6 +736,43 @@ CurlHttpIO::~CurlHttpIO()
 }
 
 int CurlHttpIO::instanceCount = 0;
+CURLSH* CurlHttpIO::sharedcurlsh = NULL;
+std::mutex CurlHttpIO::sharemutexes[CURL_LOCK_DATA_LAST];
+
+// each instance runs on its own thread, or the instances of a ConnectionShare are deleted from other threads
+void CurlHttpIO::sharelock(CURL*, curl_lock_data data, curl_lock_access, void* mutexes)
+{
+    static_cast<std::mutex*>(mutexes)[data].lock();
+}
+
+void CurlHttpIO::shareunlock(CURL*, curl_lock_data data, void* mutexes)
+{
+    static_cast<std::mutex*>(mutexes)[data].unlock();
+}
+
+CurlHttpIO::ConnectionShare::ConnectionShare()
+{
+    sh = curl_share_init();
+    curl_share_setopt(sh, CURLSHOPT_LOCKFUNC, sharelock);
+    curl_share_setopt(sh, CURLSHOPT_UNLOCKFUNC, shareunlock);
+    curl_share_setopt(sh, CURLSHOPT_USERDATA, mutexes);
+    curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900 // At least cURL 7.57.0
+    curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+CurlHttpIO::ConnectionShare::~ConnectionShare()
+{
+    curl_share_cleanup(sh);
+}
+
+void CurlHttpIO::setconnectionshare(std::shared_ptr<ConnectionShare> share)
+{
+    connectionshare = std::move(share);
+    curlsh = connectionshare ? connectionshare->sh : sharedcurlsh;
+}
 
 void CurlHttpIO::setuseragent(string* u)
 {
@@ -827,6 +868,7 @@ void CurlHttpIO::disconnect()
 #endif
     curltimeoutreset[PUT] = -1;
     arerequestspaused[PUT] = false;
+    setmultiplexing();
 
     disconnecting = false;
     if (dnsservers.size())
@@ -849,12 +891,14 @@ void CurlHttpIO::disconnect()
 bool CurlHttpIO::setmaxdownloadspeed(m_off_t bpslimit)
 {
     maxspeed[GET] = bpslimit;
+    shaper.setlimit(GET, bpslimit);
     return true;
 }
 
 bool CurlHttpIO::setmaxuploadspeed(m_off_t bpslimit)
 {
     maxspeed[PUT] = bpslimit;
+    shaper.setlimit(PUT, bpslimit);
     return true;
 }
 
@@ -863,6 +907,191 @@ m_off_t CurlHttpIO::getmaxdownloadspeed()
     return maxspeed[GET];
 }
 
+bool CurlHttpIO::sethttp2(bool enable)
+{
+    if (enable && !curlhttp2)
+    {
+        LOG_warn << "cURL built without HTTP/2 support";
+        return false;
+    }
+
+    http2 = enable;
+    setmultiplexing();
+    return true;
+}
+
+bool CurlHttpIO::multiplexes() const
+{
+    return http2;
+}
+
+#if LIBCURL_VERSION_NUM >= 0x080c00 // At least cURL 8.12.0
+static CURLcode export_ssl_session(CURL*, void* userptr, const char* sessionkey,
+                                   const unsigned char* shmac, size_t shmaclen,
+                                   const unsigned char* sdata, size_t sdatalen,
+                                   curl_off_t validuntil, int, const char*, size_t)
+{
+    vector<string>* sessions = static_cast<vector<string>*>(userptr);
+
+    sessions->emplace_back();
+    CacheableWriter w(sessions->back());
+    w.serializecstr(sessionkey, false);
+    w.serializestring(string((const char*)shmac, shmaclen));
+    w.serializestring(string((const char*)sdata, sdatalen));
+    w.serializei64(validuntil);
+    return CURLE_OK;
+}
+#endif
+
+void CurlHttpIO::exportsslsessions(string* data)
+{
+    data->clear();
+
+#if LIBCURL_VERSION_NUM >= 0x080c00 // At least cURL 8.12.0
+    CURL* curl = curl_easy_init();
+    if (!curl)
+    {
+        return;
+    }
+
+    vector<string> sessions;
+    curl_easy_setopt(curl, CURLOPT_SHARE, curlsh);
+    CURLcode e = curl_easy_ssls_export(curl, export_ssl_session, &sessions);
+    curl_easy_cleanup(curl);
+
+    if (e != CURLE_OK)
+    {
+        LOG_warn << "Unable to export the TLS sessions: " << curl_easy_strerror(e);
+        return;
+    }
+
+    CacheableWriter w(*data);
+    w.serializeu32(uint32_t(sessions.size()));
+    for (auto& s : sessions)
+    {
+        w.serializestring(s);
+    }
+    w.serializeexpansionflags();
+    LOG_debug << "Exported " << sessions.size() << " TLS sessions";
+#endif
+}
+
+void CurlHttpIO::importsslsessions(const string& data)
+{
+#if LIBCURL_VERSION_NUM >= 0x080c00 // At least cURL 8.12.0
+    CURL* curl = curl_easy_init();
+    if (!curl)
+    {
+        return;
+    }
+    curl_easy_setopt(curl, CURLOPT_SHARE, curlsh);
+
+    CacheableReader r(data);
+    uint32_t count = 0;
+    unsigned imported = 0;
+    r.unserializeu32(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        string session, key, shmac, sdata;
+        int64_t validuntil;
+        if (!r.unserializestring(session))
+        {
+            break;
+        }
+
+        CacheableReader sr(session);
+        if (!sr.unserializecstr(key, false) || !sr.unserializestring(shmac)
+                || !sr.unserializestring(sdata) || !sr.unserializei64(validuntil))
+        {
+            LOG_warn << "Invalid TLS session";
+            continue;
+        }
+
+        if (validuntil > m_time() && curl_easy_ssls_import(curl, key.size() ? key.c_str() : nullptr,
+                                                           (const unsigned char*)shmac.data(), shmac.size(),
+                                                           (const unsigned char*)sdata.data(), sdata.size()) == CURLE_OK)
+        {
+            imported++;
+        }
+    }
+    curl_easy_cleanup(curl);
+    LOG_debug << "Imported " << imported << " of " << count << " TLS sessions";
+#else
+    (void)data;
+#endif
+}
+
+void CurlHttpIO::exportdnscache(string* data)
+{
+    data->clear();
+
+    vector<const std::pair<const string, CurlDNSEntry>*> entries;
+    for (auto& entry : dnscache)
+    {
+        if (entry.second.resolvedat && (entry.second.ipv4.size() || entry.second.ipv6.size()))
+        {
+            entries.push_back(&entry);
+        }
+    }
+
+    CacheableWriter w(*data);
+    w.serializeu32(uint32_t(entries.size()));
+    for (auto entry : entries)
+    {
+        w.serializestring(entry->first);
+        w.serializestring(entry->second.ipv4);
+        w.serializestring(entry->second.ipv6);
+        w.serializei64(entry->second.resolvedat);
+    }
+    w.serializeexpansionflags();
+}
+
+void CurlHttpIO::importdnscache(const string& data)
+{
+    CacheableReader r(data);
+    uint32_t count = 0;
+    unsigned imported = 0;
+    r.unserializeu32(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        string hostname, ipv4, ipv6;
+        int64_t resolvedat;
+        if (!r.unserializestring(hostname) || !r.unserializestring(ipv4)
+                || !r.unserializestring(ipv6) || !r.unserializei64(resolvedat))
+        {
+            LOG_warn << "Invalid DNS cache";
+            break;
+        }
+
+        if (m_time() - resolvedat > DNS_CACHE_PERSISTED_TTL || dnscache.find(hostname) != dnscache.end())
+        {
+            continue;
+        }
+
+        // used right away, and resolved again during the first connection
+        CurlDNSEntry& entry = dnscache[hostname];
+        entry.ipv4 = ipv4;
+        entry.ipv4timestamp = ipv4.size() ? Waiter::ds : 0;
+        entry.ipv6 = ipv6;
+        entry.ipv6timestamp = ipv6.size() ? Waiter::ds : 0;
+        entry.resolvedat = resolvedat;
+        entry.mNeedsResolvingAgain = true;
+        imported++;
+    }
+    LOG_debug << "Imported " << imported << " of " << count << " DNS cache records";
+}
+
+// new requests join an HTTP/2 connection to the same host, already open or being opened
+void CurlHttpIO::setmultiplexing()
+{
+#if LIBCURL_VERSION_NUM >= 0x072b00 // At least cURL 7.43.0
+    for (int d = GET; d <= API; d++)
+    {
+        curl_multi_setopt(curlm[d], CURLMOPT_PIPELINING, http2 ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+    }
+#endif
+}
+
 m_off_t CurlHttpIO::getmaxuploadspeed()
 {
     return maxspeed[PUT];
@@ -896,14 +1125,15 @@ void CurlHttpIO::addevents(Waiter* w, int)
 
     for (int d = GET; d == GET || d == PUT; d += PUT - GET)
     {
-        if (arerequestspaused[d])
+        if (arerequestspaused[d] || !pausedrequests[d].empty())
         {
             if (curltimeoutms < 0 || curltimeoutms > 100)
             {
                 curltimeoutms = 100;
             }
         }
-        else
+
+        if (!arerequestspaused[d])
         {
             addcurlevents(waiter, (direction_t)d);
             if (curltimeoutreset[d] >= 0)
@@ -1142,6 +1372,7 @@ void CurlHttpIO::ares_completed_callback(void* arg, int status, int, struct host
             LOG_warn << "The current DNS cache record is invalid";
         }
 
+        dnsEntry.resolvedat = m_time();
         if (host->h_addrtype == PF_INET6)
         {
             if (!incache)
@@ -1333,7 +1564,7 @@ void CurlHttpIO::send_request(CurlHttpContext* httpctx)
         LOG_debug << httpctx->req->logname << "POST target URL: " << safeurl;
     }
 
-    if (req->binary)
+    if (req->binary || req->contentencoding.size())
     {
         LOG_debug << httpctx->req->logname << "[sending " << (data ? len : req->out->size()) << " bytes of raw data]";
     }
@@ -1353,12 +1584,26 @@ void CurlHttpIO::send_request(CurlHttpContext* httpctx)
     }
 
     httpctx->headers = clone_curl_slist(req->type == REQ_JSON ? httpio->contenttypejson : httpio->contenttypebinary);
+    if (req->contentencoding.size())
+    {
+        httpctx->headers = curl_slist_append(httpctx->headers, ("Content-Encoding: " + req->contentencoding).c_str());
+    }
     httpctx->posturl = req->posturl;
+    curl_slist_free_all(httpctx->resolve);
+    httpctx->resolve = NULL;
 
     if(httpio->proxyip.size())
     {
         LOG_debug << "Using the hostname instead of the IP";
     }
+    else if (httpctx->racingipv4.size())
+    {
+        // cURL connects to the IPv6 address and, if it's slow to answer, to the IPv4 one too (happy eyeballs)
+        std::ostringstream oss;
+        oss << httpctx->hostname << ":" << httpctx->port << ":" << httpctx->hostip << "," << httpctx->racingipv4;
+        LOG_debug << "Racing the IPs of the hostname: " << oss.str();
+        httpctx->resolve = curl_slist_append(NULL, oss.str().c_str());
+    }
     else if(httpctx->hostip.size())
     {
         LOG_debug << "Using the IP of the hostname: " << httpctx->hostip;
@@ -1412,6 +1657,10 @@ void CurlHttpIO::send_request(CurlHttpContext* httpctx)
         curl_easy_setopt(curl, CURLOPT_HTTPHEADER, httpctx->headers);
         curl_easy_setopt(curl, CURLOPT_ENCODING, "");
         curl_easy_setopt(curl, CURLOPT_SHARE, httpio->curlsh);
+        if (httpctx->resolve)
+        {
+            curl_easy_setopt(curl, CURLOPT_RESOLVE, httpctx->resolve);
+        }
         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
         curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)req);
         curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, check_header);
@@ -1426,6 +1675,20 @@ void CurlHttpIO::send_request(CurlHttpContext* httpctx)
         curl_easy_setopt(curl, CURLOPT_SOCKOPTFUNCTION, sockopt_callback);
         curl_easy_setopt(curl, CURLOPT_SOCKOPTDATA, (void*)req);
 
+    #if LIBCURL_VERSION_NUM >= 0x072f00 // At least cURL 7.47.0
+        if (httpio->http2)
+        {
+            // ALPN falls back to HTTP/1.1 for servers without HTTP/2.  Wait for a connection
+            // being set up to the same host instead of opening another one
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+            curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+        }
+        else
+        {
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+        }
+    #endif
+
         if (httpio->maxspeed[GET] && httpio->maxspeed[GET] <= 102400)
         {
             curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 4096L);
@@ -1726,7 +1989,8 @@ void CurlHttpIO::post(HttpReq* req, const char* data, unsigned len)
     httpctx->isIPv6 = false;
     httpctx->isCachedIp = false;
     httpctx->ares_pending = 0;
-    httpctx->d = (req->type == REQ_JSON || req->method == METHOD_NONE) ? API : ((data ? len : req->out->size()) ? PUT : GET);
+    httpctx->d = (req->preconnect != NONE) ? req->preconnect
+               : (req->type == REQ_JSON || req->method == METHOD_NONE) ? API : ((data ? len : req->out->size()) ? PUT : GET);
     req->httpiohandle = (void*)httpctx;    
 
     bool validrequest = true;
@@ -1844,6 +2108,12 @@ void CurlHttpIO::post(HttpReq* req, const char* data, unsigned len)
     if (it != dnscache.end())
     {
         dnsEntry = &it->second;
+
+        // refresh records in use, in the background of the next connection, before they get old
+        if (dnsEntry->resolvedat && m_time() - dnsEntry->resolvedat > DNS_CACHE_TIMEOUT_DS / 10)
+        {
+            dnsEntry->mNeedsResolvingAgain = true;
+        }
     }
 
     if (ipv6requestsenabled)
@@ -1857,6 +2127,13 @@ void CurlHttpIO::post(HttpReq* req, const char* data, unsigned len)
             oss << "[" << dnsEntry->ipv6 << "]";
             httpctx->hostip = oss.str();
             httpctx->ares_pending = 0;
+
+        #if LIBCURL_VERSION_NUM >= 0x073b00 // At least cURL 7.59.0 (several addresses per host in CURLOPT_RESOLVE)
+            if (dnsEntry->ipv4.size() && !dnsEntry->isIPv4Expired() && !proxyurl.size() && req->method != METHOD_NONE)
+            {
+                httpctx->racingipv4 = dnsEntry->ipv4;
+            }
+        #endif
             send_request(httpctx);
             return;
         }
@@ -1997,16 +2274,25 @@ bool CurlHttpIO::doio()
     processcurlevents(API);
     result |= multidoio(curlm[API]);
 
+    shaper.update(Waiter::ds, m_time());
+
     for (int d = GET; d == GET || d == PUT; d += PUT - GET)
     {
-        partialdata[d] = 0;
-        if (arerequestspaused[d])
+        if (!pausedrequests[d].empty())
         {
+            // requests paused by their group only don't hold up the rest of the direction
             arerequestspaused[d] = false;
             set<CURL *>::iterator it = pausedrequests[d].begin();
             while (!arerequestspaused[d] && it != pausedrequests[d].end())
             {
                 CURL *easy_handle = *it;
+                HttpReq* req = nullptr;
+                curl_easy_getinfo(easy_handle, CURLINFO_PRIVATE, (char**)&req);
+                if (req && shaper.blocked(direction_t(d), req->shapinggroup) == BandwidthShaper::GROUP_LIMITED)
+                {
+                    it++;
+                    continue;
+                }
                 pausedrequests[d].erase(it++);
                 curl_easy_pause(easy_handle, CURLPAUSE_CONT);
             }
@@ -2111,6 +2397,34 @@ bool CurlHttpIO::multidoio(CURLM *curlmhandle)
                 curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &httpstatus);
                 req->httpstatus = int(httpstatus);
 
+                long numconnects = 0;
+                double appconnect = 0;
+                long httpversion = 0;
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_NUM_CONNECTS, &numconnects);
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_APPCONNECT_TIME, &appconnect);
+            #if LIBCURL_VERSION_NUM >= 0x073200 // At least cURL 7.50.0
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_HTTP_VERSION, &httpversion);
+            #endif
+                countrequest(numconnects > 0, appconnect > 0, httpversion == CURL_HTTP_VERSION_2_0);
+
+                double starttransfer = 0;
+                double totaltime = 0;
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_STARTTRANSFER_TIME, &starttransfer);
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_TOTAL_TIME, &totaltime);
+                req->ttfbms = starttransfer > 0 ? int(starttransfer * 1000) : -1;
+                req->elapsedms = totaltime > 0 ? int(totaltime * 1000) : -1;
+
+                CurlHttpContext* racedctx = (CurlHttpContext*)req->httpiohandle;
+                char* racedip = NULL;
+                if (racedctx && racedctx->racingipv4.size()
+                        && curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIMARY_IP, &racedip) == CURLE_OK && racedip && *racedip)
+                {
+                    // the address that won, for the handling of errors below
+                    racedctx->isIPv6 = strchr(racedip, ':') != NULL;
+                    racedctx->hostip = racedctx->isIPv6 ? (string("[") + racedip + "]") : string(racedip);
+                    LOG_debug << "Connected to " << racedctx->hostip;
+                }
+
                 LOG_debug << "CURLMSG_DONE with HTTP status: " << req->httpstatus << " from "
                           << (req->httpiohandle ? (((CurlHttpContext*)req->httpiohandle)->hostname + " - " + ((CurlHttpContext*)req->httpiohandle)->hostip) : "(unknown) ");
                 if (req->httpstatus)
@@ -2155,7 +2469,7 @@ bool CurlHttpIO::multidoio(CURLM *curlmhandle)
                 // check httpstatus and response length
                 req->status = (req->httpstatus == 200
                                && (req->contentlength < 0
-                                   || req->contentlength == (req->buf ? req->bufpos : (int)req->in.size())))
+                                   || req->contentlength == req->received()))
                         ? REQ_SUCCESS : REQ_FAILURE;
 
                 if (req->status == REQ_SUCCESS)
@@ -2167,7 +2481,7 @@ bool CurlHttpIO::multidoio(CURLM *curlmhandle)
                 else
                 {
                     LOG_warn << "REQ_FAILURE. Status: " << req->httpstatus << "  Content-Length: " << req->contentlength
-                             << "  buffer? " << (req->buf != NULL) << "  bufferSize: " << (req->buf ? req->bufpos : (int)req->in.size());
+                             << "  buffer? " << (req->buf != NULL) << "  bufferSize: " << req->received();
                 }
 
                 if (req->httpstatus)
@@ -2180,6 +2494,7 @@ bool CurlHttpIO::multidoio(CURLM *curlmhandle)
                 req->status = REQ_FAILURE;
             }
 
+            req->traceend();
             statechange = true;
 
             if (req->status == REQ_FAILURE && !req->httpstatus)
@@ -2230,6 +2545,7 @@ bool CurlHttpIO::multidoio(CURLM *curlmhandle)
                             req->in.clear();
                             req->status = REQ_INFLIGHT;
 
+                            httpctx->racingipv4.clear();
                             if (dnsEntry.ipv4.size() && !dnsEntry.isIPv4Expired())
                             {
                                 LOG_debug << "Retrying using IPv4 from cache";
@@ -2355,27 +2671,29 @@ size_t CurlHttpIO::read_data(void* ptr, size_t size, size_t nmemb, void* source)
         return 0;
     }
 
-    if (httpio->maxspeed[PUT])
+    if (req->type != REQ_JSON)
     {
-        bool isApi = (req->type == REQ_JSON);
-        if (!isApi)
+        BandwidthShaper& shaper = httpio->shaper;
+        int blocked = shaper.blocked(PUT, req->shapinggroup);
+        if (blocked != BandwidthShaper::FREE)
         {
-            long maxbytes = long( (httpio->maxspeed[PUT] - httpio->uploadSpeed) * (SpeedController::SPEED_MEAN_INTERVAL_DS / 10) - httpio->partialdata[PUT] );
-            if (maxbytes <= 0)
+            httpio->pausedrequests[PUT].insert(httpctx->curl);
+            if (blocked == BandwidthShaper::DIRECTION_LIMITED)
             {
-                httpio->pausedrequests[PUT].insert(httpctx->curl);
                 httpio->arerequestspaused[PUT] = true;
-                return CURL_READFUNC_PAUSE;
             }
+            return CURL_READFUNC_PAUSE;
+        }
 
-            if (nread > (size_t)maxbytes)
-            {
-                nread = maxbytes;
-            }
-            httpio->partialdata[PUT] += nread;
+        m_off_t maxbytes = shaper.available(PUT, req->shapinggroup);
+        if (maxbytes >= 0 && nread > size_t(maxbytes))
+        {
+            nread = size_t(maxbytes);
         }
+        shaper.consume(PUT, req->shapinggroup, nread);
     }
-    
+
+
     memcpy(ptr, buf, nread);
     req->outpos += nread;
     return nread;
@@ -2388,22 +2706,22 @@ size_t CurlHttpIO::write_data(void* ptr, size_t size, size_t nmemb, void* target
     CurlHttpIO* httpio = (CurlHttpIO*)req->httpio;
     if (httpio)
     {
-        if (httpio->maxspeed[GET])
+        CurlHttpContext* httpctx = (CurlHttpContext*)req->httpiohandle;
+        bool isUpload = httpctx->data ? httpctx->len : req->out->size();
+        bool isApi = (req->type == REQ_JSON);
+        if (!isApi && !isUpload)
         {
-            CurlHttpContext* httpctx = (CurlHttpContext*)req->httpiohandle;
-            bool isUpload = httpctx->data ? httpctx->len : req->out->size();
-            bool isApi = (req->type == REQ_JSON);
-            if (!isApi && !isUpload)
+            int blocked = httpio->shaper.blocked(GET, req->shapinggroup);
+            if (blocked != BandwidthShaper::FREE)
             {
-                if ((httpio->downloadSpeed + 10 * (httpio->partialdata[GET] + len) / SpeedController::SPEED_MEAN_INTERVAL_DS) > httpio->maxspeed[GET])
+                httpio->pausedrequests[GET].insert(httpctx->curl);
+                if (blocked == BandwidthShaper::DIRECTION_LIMITED)
                 {
-                    CurlHttpContext* httpctx = (CurlHttpContext*)req->httpiohandle;
-                    httpio->pausedrequests[GET].insert(httpctx->curl);
                     httpio->arerequestspaused[GET] = true;
-                    return CURL_WRITEFUNC_PAUSE;
                 }
-                httpio->partialdata[GET] += len;
+                return CURL_WRITEFUNC_PAUSE;
             }
+            httpio->shaper.consume(GET, req->shapinggroup, len);
         }
 
         if (len)
@@ -2528,6 +2846,12 @@ int CurlHttpIO::socket_callback(CURL *, curl_socket_t s, int what, void *userp,
 
 #if defined(_WIN32)
         socketmap[s].closeEvent();
+#else
+        // curl may close it right after this, and the number be reused
+        if (httpio->waiter)
+        {
+            ((PosixWaiter *)httpio->waiter)->forgetfd(s);
+        }
 #endif
         socketmap[s].mode = 0;
     }
@@ -2751,6 +3075,11 @@ int CurlHttpIO::cert_verify_callback(X509_STORE_CTX* ctx, void* req)
 }
 #endif
 
+CurlHttpContext::~CurlHttpContext()
+{
+    curl_slist_free_all(resolve);
+}
+
 CurlDNSEntry::CurlDNSEntry()
 {
     ipv4timestamp = 0;
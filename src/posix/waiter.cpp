@@ -20,13 +20,24 @@
  */
 
 #include "mega.h"
+#include <climits>
+
+#if defined(__linux__)
+#define MEGA_WAITER_EPOLL 1
+#include <sys/epoll.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__)
+#define MEGA_WAITER_KQUEUE 1
+#include <sys/event.h>
+#else
+#include <poll.h>
+#endif
 
 namespace mega {
 dstime Waiter::ds;
 
 PosixWaiter::PosixWaiter()
 {
-    // pipe to be able to leave the select() call
+    // pipe to be able to leave the wait
     if (pipe(m_pipe) < 0)
     {
         LOG_fatal << "Error creating pipe";
@@ -38,11 +49,31 @@ PosixWaiter::PosixWaiter()
         LOG_err << "fcntl error";
     }
 
-    maxfd = -1;
+#if defined(MEGA_WAITER_EPOLL)
+    pollfd = epoll_create1(EPOLL_CLOEXEC);
+#elif defined(MEGA_WAITER_KQUEUE)
+    pollfd = kqueue();
+#else
+    pollfd = -1;
+#endif
+
+#if defined(MEGA_WAITER_EPOLL) || defined(MEGA_WAITER_KQUEUE)
+    if (pollfd < 0)
+    {
+        LOG_fatal << "Error creating event queue: " << errno;
+        close(m_pipe[0]);
+        close(m_pipe[1]);
+        throw std::runtime_error("Error creating event queue");
+    }
+#endif
 }
 
 PosixWaiter::~PosixWaiter()
 {
+    if (pollfd >= 0)
+    {
+        close(pollfd);
+    }
     close(m_pipe[0]);
     close(m_pipe[1]);
 }
@@ -51,12 +82,8 @@ void PosixWaiter::init(dstime ds)
 {
     Waiter::init(ds);
 
-    maxfd = -1;
-
-    FD_ZERO(&rfds);
-    FD_ZERO(&wfds);
-    FD_ZERO(&efds);
-    FD_ZERO(&ignorefds);
+    // watches from the previous loop lapse unless they are made again before wait()
+    loop++;
 }
 
 // update monotonously increasing timestamp in deciseconds
@@ -69,25 +96,214 @@ void Waiter::bumpds()
     ds = ts.tv_sec * 10 + ts.tv_nsec / 100000000;
 }
 
-// update maxfd for select()
-void PosixWaiter::bumpmaxfd(int fd)
+void PosixWaiter::watchfd(int fd, int what)
+{
+    WatchedFd& w = fds[fd];
+    if (w.loop != loop)
+    {
+        w.loop = loop;
+        w.want = 0;
+    }
+    w.want |= what;
+}
+
+void PosixWaiter::forgetfd(int fd)
+{
+    auto it = fds.find(fd);
+    if (it != fds.end())
+    {
+        it->second.stale = true;
+        it->second.ready = 0;
+    }
+}
+
+bool PosixWaiter::isready(int fd, int what) const
 {
-    if (fd > maxfd)
+    auto it = fds.find(fd);
+    return it != fds.end() && (it->second.ready & what);
+}
+
+// bring the kernel's registration of fd in line with what it is watched for in this loop
+void PosixWaiter::updateregistration(int fd, WatchedFd& w)
+{
+    int want = w.want & (WATCH_READ | WATCH_WRITE);
+
+    if (w.stale)
+    {
+#if defined(MEGA_WAITER_EPOLL)
+        if (w.registered && !w.always)
+        {
+            // fails harmlessly if the file was closed already: that removed it
+            epoll_ctl(pollfd, EPOLL_CTL_DEL, fd, NULL);
+        }
+#elif defined(MEGA_WAITER_KQUEUE)
+        struct kevent changes[2];
+        int n = 0;
+        if ((w.registered & WATCH_READ) && !w.always)
+        {
+            EV_SET(&changes[n++], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+        }
+        if ((w.registered & WATCH_WRITE) && !w.always)
+        {
+            EV_SET(&changes[n++], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+        }
+        if (n)
+        {
+            kevent(pollfd, changes, n, NULL, 0, NULL);
+        }
+#endif
+        w.registered = 0;
+        w.always = false;
+        w.stale = false;
+    }
+
+    if (want == w.registered)
+    {
+        return;
+    }
+
+    if (w.always)
+    {
+        w.registered = want;
+        return;
+    }
+
+#if defined(MEGA_WAITER_EPOLL)
+    int op = !want ? EPOLL_CTL_DEL : (w.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD);
+    epoll_event ev;
+    memset(&ev, 0, sizeof ev);
+    ev.events = ((want & WATCH_READ) ? uint32_t(EPOLLIN) : 0u) | ((want & WATCH_WRITE) ? uint32_t(EPOLLOUT) : 0u);
+    ev.data.fd = fd;
+
+    int r = epoll_ctl(pollfd, op, fd, &ev);
+    if (r < 0 && op != EPOLL_CTL_DEL && (errno == ENOENT || errno == EEXIST))
+    {
+        // the number was closed and reused without forgetfd(), or registered already under a previous file
+        r = epoll_ctl(pollfd, errno == ENOENT ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    if (r < 0 && op != EPOLL_CTL_DEL)
+    {
+        if (errno == EPERM)
+        {
+            w.always = true;
+        }
+        else
+        {
+            LOG_err << "Unable to wait on fd " << fd << ": " << errno;
+        }
+    }
+#elif defined(MEGA_WAITER_KQUEUE)
+    struct kevent changes[2];
+    int n = 0;
+    if ((want ^ w.registered) & WATCH_READ)
+    {
+        EV_SET(&changes[n++], fd, EVFILT_READ, (want & WATCH_READ) ? EV_ADD : EV_DELETE, 0, 0, NULL);
+    }
+    if ((want ^ w.registered) & WATCH_WRITE)
+    {
+        EV_SET(&changes[n++], fd, EVFILT_WRITE, (want & WATCH_WRITE) ? EV_ADD : EV_DELETE, 0, 0, NULL);
+    }
+
+    // EV_RECEIPT reports each change separately, so a stale delete does not hide a failed add
+    for (int i = n; i--; )
+    {
+        changes[i].flags |= EV_RECEIPT;
+    }
+    struct kevent results[2];
+    int m = kevent(pollfd, changes, n, results, n, NULL);
+    for (int i = 0; i < m; i++)
     {
-        maxfd = fd;
+        if ((results[i].flags & EV_ERROR) && results[i].data && results[i].data != ENOENT)
+        {
+            LOG_err << "Unable to wait on fd " << fd << ": " << results[i].data;
+        }
     }
+#endif
+
+    w.registered = want;
 }
 
-// checks if an unfiltered fd is set
-// FIXME: use bitwise & instead of scanning
-bool PosixWaiter::fd_filter(int nfds, fd_set* fds, fd_set* ignorefds) const
+// wait for the watched fds or the timeout, and record which fds are ready.  Returns the number of ready fds, or -1 on error
+int PosixWaiter::waitevents(int timeoutms, bool& triggered)
 {
-    while (nfds--)
+    int numfd;
+
+#if defined(MEGA_WAITER_EPOLL)
+    std::vector<epoll_event> events(fds.size());
+    numfd = epoll_wait(pollfd, events.data(), int(events.size()), timeoutms);
+
+    for (int i = 0; i < numfd; i++)
+    {
+        auto it = fds.find(events[i].data.fd);
+        if (it != fds.end())
+        {
+            // hangups and errors count as readable and writable, like select() does
+            uint32_t ev = events[i].events;
+            it->second.ready = (((ev & (EPOLLIN | EPOLLHUP | EPOLLERR)) ? WATCH_READ : 0)
+                              | ((ev & (EPOLLOUT | EPOLLHUP | EPOLLERR)) ? WATCH_WRITE : 0)) & it->second.want;
+        }
+    }
+#elif defined(MEGA_WAITER_KQUEUE)
+    std::vector<struct kevent> events(2 * fds.size());
+    timespec ts;
+    ts.tv_sec = timeoutms / 1000;
+    ts.tv_nsec = (timeoutms % 1000) * 1000000;
+    numfd = kevent(pollfd, NULL, 0, events.data(), int(events.size()), timeoutms < 0 ? NULL : &ts);
+
+    for (int i = 0; i < numfd; i++)
+    {
+        auto it = fds.find(int(events[i].ident));
+        if (it != fds.end())
+        {
+            it->second.ready |= (events[i].filter == EVFILT_READ ? WATCH_READ : WATCH_WRITE) & it->second.want;
+        }
+    }
+#else
+    std::vector<struct pollfd> pollfds;
+    pollfds.reserve(fds.size());
+    for (auto& f : fds)
+    {
+        if (f.second.want & (WATCH_READ | WATCH_WRITE))
+        {
+            struct pollfd p;
+            p.fd = f.first;
+            p.events = short(((f.second.want & WATCH_READ) ? POLLIN : 0) | ((f.second.want & WATCH_WRITE) ? POLLOUT : 0));
+            p.revents = 0;
+            pollfds.push_back(p);
+        }
+    }
+
+    numfd = poll(pollfds.data(), nfds_t(pollfds.size()), timeoutms);
+
+    for (int i = numfd > 0 ? int(pollfds.size()) : 0; i--; )
     {
-        if (FD_ISSET(nfds, fds) && !FD_ISSET(nfds, ignorefds)) return true;    
+        if (pollfds[i].revents)
+        {
+            WatchedFd& w = fds[pollfds[i].fd];
+            short ev = pollfds[i].revents;
+            w.ready = (((ev & (POLLIN | POLLHUP | POLLERR | POLLNVAL)) ? WATCH_READ : 0)
+                     | ((ev & (POLLOUT | POLLHUP | POLLERR | POLLNVAL)) ? WATCH_WRITE : 0)) & w.want;
+        }
     }
+#endif
 
-    return false;
+    triggered = false;
+    for (auto& f : fds)
+    {
+        WatchedFd& w = f.second;
+        if (w.always && numfd >= 0)
+        {
+            w.ready = w.want & (WATCH_READ | WATCH_WRITE);
+            numfd += !!w.ready;
+        }
+        if (w.ready && !(w.want & WATCH_IGNORED))
+        {
+            triggered = true;
+        }
+    }
+
+    return numfd;
 }
 
 // wait for supplied events (sockets, filesystem changes), plus timeout + application events
@@ -95,22 +311,57 @@ bool PosixWaiter::fd_filter(int nfds, fd_set* fds, fd_set* ignorefds) const
 // returns application-specific bitmask. bit 0 set indicates that exec() needs to be called.
 int PosixWaiter::wait()
 {
-    int numfd;
-    timeval tv;
+    return collect(arm());
+}
+
+int PosixWaiter::arm()
+{
+    // pipe watched to be able to leave the wait when needed
+    watchfd(m_pipe[0], WATCH_READ);
 
-    //Pipe added to rfds to be able to leave select() when needed
-    FD_SET(m_pipe[0], &rfds);
-    bumpmaxfd(m_pipe[0]);
+    // only fds whose interest changed since the last loop cost a system call
+    for (auto it = fds.begin(); it != fds.end(); )
+    {
+        WatchedFd& w = it->second;
+        if (w.loop != loop)
+        {
+            w.want = 0;
+        }
+        w.ready = 0;
+
+        updateregistration(it->first, w);
 
+        if (!w.want && !w.registered)
+        {
+            it = fds.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    int timeoutms = -1;
     if (maxds + 1)
     {
-        dstime us = 1000000 / 10 * maxds;
+        timeoutms = int(std::min<dstime>(maxds, INT_MAX / 100) * 100);
+    }
 
-        tv.tv_sec = us / 1000000;
-        tv.tv_usec = us - tv.tv_sec * 1000000;
+    for (auto& f : fds)
+    {
+        if (f.second.always && f.second.want)
+        {
+            timeoutms = 0;
+        }
     }
 
-    numfd = select(maxfd + 1, &rfds, &wfds, &efds, maxds + 1 ? &tv : NULL);
+    return timeoutms;
+}
+
+int PosixWaiter::collect(int timeoutms)
+{
+    bool triggered;
+    int numfd = waitevents(timeoutms, triggered);
 
     // empty pipe
     uint8_t buf;
@@ -132,9 +383,12 @@ int PosixWaiter::wait()
     }
 
     // request exec() to be run only if a non-ignored fd was triggered
-    return (fd_filter(maxfd + 1, &rfds, &ignorefds)
-         || fd_filter(maxfd + 1, &wfds, &ignorefds)
-         || fd_filter(maxfd + 1, &efds, &ignorefds)) ? NEEDEXEC : 0;
+    return triggered ? NEEDEXEC : 0;
+}
+
+int PosixWaiter::eventfd() const
+{
+    return pollfd;
 }
 
 void PosixWaiter::notify()
@@ -27,6 +27,23 @@
 
 #undef min //avoids issues with std::min
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || (defined(_M_IX86) && !defined(_M_ARM))
+#define MEGA_RAID_AVX2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define RAID_TARGET_AVX2
+#else
+#define RAID_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MEGA_RAID_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define MEGA_RAID_NEON 1
+#include <arm_neon.h>
+#endif
+
 namespace mega
 {
 
@@ -112,10 +129,15 @@ RaidBufferManager::FilePiece::FilePiece()
 {
 }
 
-RaidBufferManager::FilePiece::FilePiece(m_off_t p, size_t len)
+RaidBufferManager::FilePiece::FilePiece(m_off_t p, size_t len, const std::shared_ptr<BufferPool>& pool)
     : pos(p)
-    , buf(new byte[len + std::min<size_t>(SymmCipher::BLOCKSIZE, RAIDSECTOR)], 0, len)   // SymmCipher::ctr_crypt requirement: decryption: data must be padded to BLOCKSIZE.  Also make sure we can xor up to RAIDSECTOR more for convenience
+    , buf(NULL, 0, 0)
 {
+    // SymmCipher::ctr_crypt requirement: decryption: data must be padded to BLOCKSIZE.  Also make sure we can xor up to RAIDSECTOR more for convenience
+    size_t padded = len + std::min<size_t>(SymmCipher::BLOCKSIZE, RAIDSECTOR);
+    size_t capacity = padded;
+    byte* b = pool ? pool->get(padded, capacity) : new byte[padded];
+    HttpReq::http_buf_t(b, 0, len, pool, capacity).swap(buf);
 }
 
 
@@ -290,18 +312,42 @@ void RaidBufferManager::submitBuffer(unsigned connectionNum, FilePiece* piece)
     }
     else
     {
-        finalize(*piece);
-        assert(asyncoutputbuffers.find(connectionNum) == asyncoutputbuffers.end() || !asyncoutputbuffers[connectionNum]);
-        asyncoutputbuffers[connectionNum] = piece;
+        finalizeOutput(connectionNum, piece);
     }
 }
 
+void RaidBufferManager::finalizeOutput(unsigned connectionNum, FilePiece* piece)
+{
+    finalize(*piece);
+    setAsyncOutputBuffer(connectionNum, piece);
+}
+
+void RaidBufferManager::setAsyncOutputBuffer(unsigned connectionNum, FilePiece* piece)
+{
+    assert(asyncoutputbuffers.find(connectionNum) == asyncoutputbuffers.end() || !asyncoutputbuffers[connectionNum]);
+    asyncoutputbuffers[connectionNum] = piece;
+}
+
+bool RaidBufferManager::outputPending(unsigned)
+{
+    return false;
+}
+
 RaidBufferManager::FilePiece* RaidBufferManager::getAsyncOutputBufferPointer(unsigned connectionNum)
 {
+    if (outputPending(connectionNum))
+    {
+        return NULL;
+    }
+
     std::map<unsigned, FilePiece*>::iterator i = asyncoutputbuffers.find(connectionNum);
     if (isRaid() && (i == asyncoutputbuffers.end() || !i->second))
     {
         combineRaidParts(connectionNum);
+        if (outputPending(connectionNum))
+        {
+            return NULL;
+        }
         i = asyncoutputbuffers.find(connectionNum);
     }
     return (i == asyncoutputbuffers.end()) ? NULL : i->second;
@@ -505,8 +551,7 @@ void RaidBufferManager::combineRaidParts(unsigned connectionNum)
         // store the result in a place that can be read out async
         if (outputrec->buf.datalen() > 0)
         {
-            finalize(*outputrec);
-            asyncoutputbuffers[connectionNum] = outputrec;
+            finalizeOutput(connectionNum, outputrec);
         }
         else
         {
@@ -520,7 +565,7 @@ RaidBufferManager::FilePiece* RaidBufferManager::combineRaidParts(size_t partsle
     assert(prevleftoverchunk.buf.datalen() == 0 || prevleftoverchunk.pos == filepos);
 
     // add a bit of extra space and copy prev chunk to the front
-    FilePiece* result = new FilePiece(filepos, bufflen + prevleftoverchunk.buf.datalen());
+    FilePiece* result = new FilePiece(filepos, bufflen + prevleftoverchunk.buf.datalen(), bufferpool);
     if (prevleftoverchunk.buf.datalen() > 0)
     {
         memcpy(result->buf.datastart(), prevleftoverchunk.buf.datastart(), prevleftoverchunk.buf.datalen());
@@ -536,47 +581,134 @@ RaidBufferManager::FilePiece* RaidBufferManager::combineRaidParts(size_t partsle
             inputbufs[i] = inputPiece->buf.isNull() ? NULL : inputPiece->buf.datastart();
         }
 
-        byte* b = result->buf.datastart() + prevleftoverchunk.buf.datalen();
-        byte* endpos = b + partslen * (RAIDPARTS-1);
+        combineRaidLines(result->buf.datastart() + prevleftoverchunk.buf.datalen(), inputbufs, 0, partslen / RAIDSECTOR);
+    }
+    return result;
+}
+
+namespace {
+
+inline void copySector(byte* dest, const byte* src)
+{
+#if defined(MEGA_RAID_SSE2)
+    _mm_storeu_si128((__m128i*)dest, _mm_loadu_si128((const __m128i*)src));
+#elif defined(MEGA_RAID_NEON)
+    vst1q_u8(dest, vld1q_u8(src));
+#else
+    memcpy(dest, src, RAIDSECTOR);
+#endif
+}
+
+// dest = xor of the sectors at `offset` of the n source buffers
+inline void xorSectors(byte* dest, const byte* const* srcs, unsigned n, size_t offset)
+{
+#if defined(MEGA_RAID_SSE2)
+    __m128i v = _mm_loadu_si128((const __m128i*)(srcs[0] + offset));
+    for (unsigned i = 1; i < n; i++)
+    {
+        v = _mm_xor_si128(v, _mm_loadu_si128((const __m128i*)(srcs[i] + offset)));
+    }
+    _mm_storeu_si128((__m128i*)dest, v);
+#elif defined(MEGA_RAID_NEON)
+    uint8x16_t v = vld1q_u8(srcs[0] + offset);
+    for (unsigned i = 1; i < n; i++)
+    {
+        v = veorq_u8(v, vld1q_u8(srcs[i] + offset));
+    }
+    vst1q_u8(dest, v);
+#else
+    uint64_t v[2];
+    memcpy(v, srcs[0] + offset, RAIDSECTOR);
+    for (unsigned i = 1; i < n; i++)
+    {
+        uint64_t t[2];
+        memcpy(t, srcs[i] + offset, RAIDSECTOR);
+        v[0] ^= t[0];
+        v[1] ^= t[1];
+    }
+    memcpy(dest, v, RAIDSECTOR);
+#endif
+}
+
+#if defined(MEGA_RAID_AVX2)
+// two raid lines per iteration: 32 bytes from each part, split into the sector of each line.
+// Returns the lines combined (an even number), offset and dest advanced past them
+RAID_TARGET_AVX2 size_t combineRaidLinesAvx2(byte*& dest, byte* const inputbufs[RAIDPARTS], const byte* const* srcs,
+                                             unsigned nsrcs, unsigned missing, size_t& offset, size_t lines)
+{
+    size_t line = 0;
 
-        for (unsigned i = 0; b < endpos; i += RAIDSECTOR)
+    for (; line + 2 <= lines; line += 2, offset += 2 * RAIDSECTOR, dest += 2 * RAIDLINE)
+    {
+        for (unsigned j = 1; j < RAIDPARTS; ++j)
         {
-            for (unsigned j = 1; j < RAIDPARTS; ++j)
+            __m256i v;
+
+            if (j == missing)
             {
-                assert(b + RAIDSECTOR <= result->buf.datastart() + result->buf.datalen());
-                if (inputbufs[j])
+                v = _mm256_loadu_si256((const __m256i*)(srcs[0] + offset));
+                for (unsigned i = 1; i < nsrcs; i++)
                 {
-                    memcpy(b, inputbufs[j] + i, RAIDSECTOR);
+                    v = _mm256_xor_si256(v, _mm256_loadu_si256((const __m256i*)(srcs[i] + offset)));
                 }
-                else
-                {
-                    recoverSectorFromParity(b, inputbufs, i);
-                }
-                b += RAIDSECTOR;
             }
+            else
+            {
+                v = _mm256_loadu_si256((const __m256i*)(inputbufs[j] + offset));
+            }
+
+            byte* d = dest + (j - 1) * RAIDSECTOR;
+            _mm_storeu_si128((__m128i*)d, _mm256_castsi256_si128(v));
+            _mm_storeu_si128((__m128i*)(d + RAIDLINE), _mm256_extracti128_si256(v, 1));
         }
-        assert(b == endpos);
     }
-    return result;
+
+    return line;
 }
+#endif
+
+} // namespace
 
-void RaidBufferManager::recoverSectorFromParity(byte* dest, byte* inputbufs[], unsigned offset)
+void RaidBufferManager::combineRaidLines(byte* dest, byte* const inputbufs[RAIDPARTS], size_t offset, size_t lines)
 {
-    assert(sizeof(m_off_t)*2 == RAIDSECTOR);
-    bool set = false;
-    for (unsigned i = RAIDPARTS; i--; )
+    // 0 when all data parts are present
+    unsigned missing = 0;
+    const byte* srcs[RAIDPARTS];
+    unsigned nsrcs = 0;
+
+    for (unsigned j = 0; j < RAIDPARTS; ++j)
     {
-        if (inputbufs[i])
+        if (inputbufs[j])
         {
-            if (!set)
+            srcs[nsrcs++] = inputbufs[j];
+        }
+        else if (j)
+        {
+            missing = j;
+        }
+    }
+
+    size_t line = 0;
+
+#if defined(MEGA_RAID_AVX2)
+    static const bool avx2 = CpuFeatures::get().avx2;
+    if (avx2)
+    {
+        line = combineRaidLinesAvx2(dest, inputbufs, srcs, nsrcs, missing, offset, lines);
+    }
+#endif
+
+    for (; line < lines; ++line, offset += RAIDSECTOR, dest += RAIDLINE)
+    {
+        for (unsigned j = 1; j < RAIDPARTS; ++j)
+        {
+            if (j == missing)
             {
-                memcpy(dest, inputbufs[i] + offset, RAIDSECTOR);
-                set = true;
+                xorSectors(dest + (j - 1) * RAIDSECTOR, srcs, nsrcs, offset);
             }
             else
             {
-                *(m_off_t*)dest ^= *(m_off_t*)(inputbufs[i] + offset);
-                *(m_off_t*)(dest + sizeof(m_off_t)) ^= *(m_off_t*)(inputbufs[i] + offset + sizeof(m_off_t));
+                copySector(dest + (j - 1) * RAIDSECTOR, inputbufs[j] + offset);
             }
         }
     }
@@ -642,28 +774,32 @@ m_off_t TransferBufferManager::calcOutputChunkPos(m_off_t acquiredpos)
 
 // decrypt, mac downloaded chunk
 void TransferBufferManager::finalize(FilePiece& r)
+{
+    finalizePiece(r, *transfer->transfercipher(), transfer->ctriv, transfer->size, transfer->chunkmacs);
+}
+
+void TransferBufferManager::finalizePiece(FilePiece& r, SymmCipher& cipher, int64_t ctriv, m_off_t transfersize, chunkmac_map& transfermacs)
 {
     byte *chunkstart = r.buf.datastart();
     m_off_t startpos = r.pos;
     m_off_t finalpos = startpos + r.buf.datalen();
-    assert(finalpos <= transfer->size);
-    if (finalpos != transfer->size)
+    assert(finalpos <= transfersize);
+    if (finalpos != transfersize)
     {
         finalpos &= -SymmCipher::BLOCKSIZE;
     }
 
     m_off_t endpos = ChunkedHash::chunkceil(startpos, finalpos);
     unsigned chunksize = static_cast<unsigned>(endpos - startpos);
-    SymmCipher *cipher = transfer->transfercipher();
     while (chunksize)
     {
         m_off_t chunkid = ChunkedHash::chunkfloor(startpos);
         ChunkMAC &chunkmac = r.chunkmacs[chunkid];
         if (!chunkmac.finished)
         {
-            chunkmac = transfer->chunkmacs[chunkid];
-            cipher->ctr_crypt(chunkstart, chunksize, startpos, transfer->ctriv, chunkmac.mac, false, !chunkmac.finished && !chunkmac.offset);
-            if (endpos == ChunkedHash::chunkceil(chunkid, transfer->size))
+            chunkmac = transfermacs[chunkid];
+            cipher.ctr_crypt(chunkstart, chunksize, startpos, ctriv, chunkmac.mac, false, !chunkmac.finished && !chunkmac.offset);
+            if (endpos == ChunkedHash::chunkceil(chunkid, transfersize))
             {
                 LOG_debug << "Finished chunk: " << startpos << " - " << endpos << "   Size: " << chunksize;
                 chunkmac.finished = true;
@@ -793,12 +929,33 @@ m_off_t RaidBufferManager::progress() const
     return reportPos;
 }
 
+unsigned RaidBufferManager::unusedRaidPart() const
+{
+    return unusedRaidConnection;
+}
+
+void RaidBufferManager::setUnusedRaidPart(unsigned part)
+{
+    assert(isRaid() && part < RAIDPARTS);
+    unusedRaidConnection = part;
+    raidrequestpartpos[part] = raidpartspos;
+}
+
 
 TransferBufferManager::TransferBufferManager()
     : transfer(NULL)
 {
 }
 
+TransferBufferManager::~TransferBufferManager()
+{
+    if ((!finalizejobs.empty() || !encryptjobs.empty()) && transfer->client->transferCryptoPool)
+    {
+        // the jobs own their pieces, so one that is already running can just finish and be discarded
+        transfer->client->transferCryptoPool->cancel(this);
+    }
+}
+
 void TransferBufferManager::setIsRaid(Transfer* t, std::vector<std::string>& tempUrls, m_off_t resumepos, m_off_t maxRequestSize)
 {
     RaidBufferManager::setIsRaid(tempUrls, resumepos, t->size, t->size, maxRequestSize);
@@ -872,6 +1029,410 @@ void TransferBufferManager::bufferWriteCompletedAction(FilePiece& r)
     LOG_debug << "Cached data at: " << r.pos << "   Size: " << r.buf.datalen();
 }
 
+void TransferBufferManager::finalizeOutput(unsigned connectionNum, FilePiece* piece)
+{
+    if (!transfer->client->transferCryptoPool)
+    {
+        RaidBufferManager::finalizeOutput(connectionNum, piece);
+        return;
+    }
+
+    assert(finalizejobs.find(connectionNum) == finalizejobs.end());
+
+    auto job = std::make_shared<FinalizeJob>();
+    job->bytes = piece->buf.datalen();
+    memcpy(job->transferkey, transfer->transferkey, sizeof job->transferkey);
+    job->ctriv = transfer->ctriv;
+    job->transfersize = transfer->size;
+
+    // the worker must not touch transfer->chunkmacs, so copy the entries it will start from
+    m_off_t endpos = piece->pos + m_off_t(piece->buf.datalen());
+    job->transfermacs.insert(transfer->chunkmacs.lower_bound(ChunkedHash::chunkfloor(piece->pos)), transfer->chunkmacs.lower_bound(endpos));
+    job->piece.reset(piece);
+
+    finalizejobs[connectionNum] = job;
+    unsubmittedjobs.push_back(job);
+    submitFinalizeJobs();
+}
+
+void TransferBufferManager::submitFinalizeJobs()
+{
+    TransferCryptoPool* pool = transfer->client->transferCryptoPool.get();
+    while (!unsubmittedjobs.empty())
+    {
+        if (pool)
+        {
+            if (!pool->submit(this, unsubmittedjobs.front()))
+            {
+                break;
+            }
+        }
+        else
+        {
+            // the pool was switched off meanwhile
+            unsubmittedjobs.front()->run(*transfer->transfercipher());
+            unsubmittedjobs.front()->done = true;
+        }
+        unsubmittedjobs.pop_front();
+    }
+}
+
+bool TransferBufferManager::outputPending(unsigned connectionNum)
+{
+    auto it = finalizejobs.find(connectionNum);
+    if (it == finalizejobs.end())
+    {
+        return false;
+    }
+
+    submitFinalizeJobs();
+    if (!it->second->done)
+    {
+        return true;
+    }
+
+    setAsyncOutputBuffer(connectionNum, it->second->piece.release());
+    finalizejobs.erase(it);
+    return false;
+}
+
+void TransferBufferManager::waitForPendingOutput()
+{
+    for (auto& j : finalizejobs)
+    {
+        if (j.second->submitted && !j.second->done)
+        {
+            // a submitted job that has not run is always in the current pool: replaced pools finish their queue
+            transfer->client->transferCryptoPool->wait(*j.second);
+        }
+    }
+
+    // these go after the submitted ones, to keep the transfer's order
+    for (auto& job : unsubmittedjobs)
+    {
+        job->run(*transfer->transfercipher());
+        job->done = true;
+    }
+    unsubmittedjobs.clear();
+
+    vector<unsigned> connections;
+    for (auto& j : finalizejobs)
+    {
+        connections.push_back(j.first);
+    }
+    for (unsigned connectionNum : connections)
+    {
+        outputPending(connectionNum);
+    }
+}
+
+bool TransferBufferManager::encryptInput(unsigned connectionNum, HttpReqUL* req, const string& tempurl, m_off_t pos, m_off_t npos)
+{
+    TransferCryptoPool* pool = transfer->client->transferCryptoPool.get();
+    if (!pool)
+    {
+        return false;
+    }
+
+    assert(encryptjobs.find(connectionNum) == encryptjobs.end());
+
+    auto job = std::make_shared<EncryptJob>();
+    job->bytes = size_t(npos - pos);
+    memcpy(job->transferkey, transfer->transferkey, sizeof job->transferkey);
+    job->ctriv = transfer->ctriv;
+    job->pos = pos;
+    job->npos = npos;
+    job->tempurl = tempurl;
+    job->bufferpool = req->bufferpool;
+    job->body = req->detachbody(&job->capacity);
+
+    if (!pool->submit(this, job))
+    {
+        // the budget is taken by other transfers: this one goes on inline rather than waiting
+        req->attachbody(job->body, job->capacity);
+        job->body = nullptr;
+        return false;
+    }
+
+    encryptjobs[connectionNum] = std::move(job);
+    return true;
+}
+
+bool TransferBufferManager::inputPending(unsigned connectionNum, HttpReqUL* req)
+{
+    auto it = encryptjobs.find(connectionNum);
+    if (it == encryptjobs.end())
+    {
+        return false;
+    }
+
+    EncryptJob& job = *it->second;
+    if (!job.done)
+    {
+        return true;
+    }
+
+    req->attachbody(job.body, job.capacity);
+    job.body = nullptr;
+    for (auto& m : job.macs)
+    {
+        transfer->chunkmacs[m.first] = m.second;
+    }
+    req->urlsuffix = std::move(job.urlsuffix);
+    req->prepared(job.tempurl.c_str(), &transfer->chunkmacs, job.pos, job.npos);
+
+    encryptjobs.erase(it);
+    return false;
+}
+
+void TransferBufferManager::EncryptJob::run(SymmCipher& cipher)
+{
+    cipher.setkey(transferkey);
+    EncryptBufferByChunks eb(body, &cipher, &macs, ctriv);
+    eb.encrypt(pos, npos, urlsuffix);
+}
+
+TransferBufferManager::EncryptJob::~EncryptJob()
+{
+    if (body)
+    {
+        if (bufferpool)
+        {
+            bufferpool->put(body, capacity);
+        }
+        else
+        {
+            delete[] body;
+        }
+    }
+}
+
+bool TransferBufferManager::coalesceOutput(unsigned connectionNum, size_t limit, bool& waitForFlush)
+{
+    waitForFlush = false;
+    FilePiece* piece = getAsyncOutputBufferPointer(connectionNum);
+    if (!piece)
+    {
+        return false;
+    }
+
+    size_t len = piece->buf.datalen();
+    if (gathering && (piece->pos != gathering->pos + m_off_t(gathering->buf.datalen())
+                      || gathering->buf.datalen() + len > limit))
+    {
+        if (flushing)
+        {
+            // keep the writes in order, and large
+            waitForFlush = true;
+            return false;
+        }
+        flushCoalescedOutput();
+    }
+
+    if (len >= limit)
+    {
+        return false;
+    }
+
+    if (!gathering)
+    {
+        gathering.reset(new FilePiece(piece->pos, limit, bufferpool));
+        gathering->buf.end = gathering->buf.start;
+    }
+
+    memcpy(gathering->buf.datastart() + gathering->buf.datalen(), piece->buf.datastart(), len);
+    gathering->buf.end += len;
+    for (chunkmac_map::iterator it = piece->chunkmacs.begin(); it != piece->chunkmacs.end(); it++)
+    {
+        gathering->chunkmacs[it->first] = it->second;
+    }
+
+    bufferWriteCompleted(connectionNum, false);  // the connection is done with it, its data is accounted for by the gathered piece
+
+    if (gathering->buf.datalen() == limit || gathering->pos + m_off_t(gathering->buf.datalen()) == transfer->size)
+    {
+        // nothing more fits, or comes after it
+        flushCoalescedOutput();
+    }
+    return true;
+}
+
+void TransferBufferManager::flushCoalescedOutput()
+{
+    if (gathering && !flushing)
+    {
+        flushing = std::move(gathering);
+    }
+}
+
+RaidBufferManager::FilePiece* TransferBufferManager::getCoalescedOutputPointer()
+{
+    return flushing.get();
+}
+
+void TransferBufferManager::coalescedWriteCompleted(bool succeeded)
+{
+    if (flushing && succeeded)
+    {
+        bufferWriteCompletedAction(*flushing);
+    }
+    flushing.reset();
+}
+
+bool TransferBufferManager::gatheringOutput() const
+{
+    return gathering != nullptr;
+}
+
+m_off_t TransferBufferManager::coalescedBytes() const
+{
+    return (gathering ? m_off_t(gathering->buf.datalen()) : 0) + (flushing ? m_off_t(flushing->buf.datalen()) : 0);
+}
+
+void TransferBufferManager::FinalizeJob::run(SymmCipher& cipher)
+{
+    cipher.setkey(transferkey);
+    finalizePiece(*piece, cipher, ctriv, transfersize, transfermacs);
+}
+
+TransferCryptoPool::TransferCryptoPool(unsigned threads, size_t maxInFlight, Waiter* w)
+    : maxInFlightBytes(maxInFlight)
+    , waiter(w)
+{
+    try
+    {
+        while (workers.size() < threads)
+        {
+            workers.emplace_back(&TransferCryptoPool::workerLoop, this);
+        }
+    }
+    catch (std::system_error& e)
+    {
+        LOG_warn << "Started " << workers.size() << " of " << threads << " transfer crypto threads: " << e.what();
+    }
+}
+
+TransferCryptoPool::~TransferCryptoPool()
+{
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+
+    for (auto& t : workers)
+    {
+        t.join();
+    }
+}
+
+unsigned TransferCryptoPool::threads() const
+{
+    return unsigned(workers.size());
+}
+
+bool TransferCryptoPool::submit(const void* owner, std::shared_ptr<Job> job)
+{
+    std::lock_guard<std::mutex> g(mutex);
+
+    // a single job larger than the budget still goes through, on its own
+    if (inFlightBytes && inFlightBytes + job->bytes > maxInFlightBytes)
+    {
+        return false;
+    }
+
+    inFlightBytes += job->bytes;
+    job->submitted = true;
+
+    OwnerQueue& q = queues[owner];
+    if (!q.running && q.jobs.empty())
+    {
+        ready.push_back(owner);
+    }
+    q.jobs.push_back(std::move(job));
+
+    workAvailable.notify_one();
+    return true;
+}
+
+void TransferCryptoPool::cancel(const void* owner)
+{
+    std::lock_guard<std::mutex> g(mutex);
+
+    auto it = queues.find(owner);
+    if (it == queues.end())
+    {
+        return;
+    }
+
+    for (auto& job : it->second.jobs)
+    {
+        inFlightBytes -= job->bytes;
+    }
+    it->second.jobs.clear();
+
+    if (!it->second.running)
+    {
+        queues.erase(it);
+        ready.erase(std::remove(ready.begin(), ready.end(), owner), ready.end());
+    }
+}
+
+void TransferCryptoPool::wait(const Job& job)
+{
+    std::unique_lock<std::mutex> g(mutex);
+    jobFinished.wait(g, [&job]() { return job.done.load(); });
+}
+
+void TransferCryptoPool::workerLoop()
+{
+    // each worker has its own: SymmCipher keeps state between calls
+    SymmCipher cipher;
+
+    std::unique_lock<std::mutex> g(mutex);
+    for (;;)
+    {
+        workAvailable.wait(g, [this]() { return stopping || !ready.empty(); });
+        if (ready.empty())
+        {
+            // stopping, and the queues are drained.  An owner still running is requeued by the worker running it
+            return;
+        }
+
+        const void* owner = ready.front();
+        ready.pop_front();
+
+        OwnerQueue& q = queues[owner];
+        std::shared_ptr<Job> job = std::move(q.jobs.front());
+        q.jobs.pop_front();
+        q.running = true;
+
+        g.unlock();
+        job->run(cipher);
+        g.lock();
+
+        inFlightBytes -= job->bytes;
+        job->done = true;
+
+        q.running = false;
+        if (q.jobs.empty())
+        {
+            queues.erase(owner);
+        }
+        else
+        {
+            ready.push_back(owner);
+            workAvailable.notify_one();
+        }
+
+        jobFinished.notify_all();
+        if (waiter)
+        {
+            waiter->notify();
+        }
+    }
+}
+
 
 DirectReadBufferManager::DirectReadBufferManager(DirectRead* dr)
 {
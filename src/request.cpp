@@ -24,11 +24,20 @@
 #include "mega/logging.h"
 #include "mega/megaclient.h"
 
+#include <zlib.h>
+
 namespace mega {
 
 void Request::add(Command* c)
 {
+    if (cmds.empty())
+    {
+        queuedds = Waiter::ds;
+    }
     cmds.push_back(c);
+
+    // plus the enclosing braces and separator added by get()
+    bytes += c->jsonlength() + 3;
 }
 
 size_t Request::size() const
@@ -36,10 +45,23 @@ size_t Request::size() const
     return cmds.size();
 }
 
+size_t Request::jsonbytes() const
+{
+    return bytes;
+}
+
+dstime Request::queuedsince() const
+{
+    return queuedds;
+}
+
 void Request::get(string* req, bool& suppressSID) const
 {
     // concatenate all command objects, resulting in an API request
-    *req = "[";
+    // (bytes counts them with their braces and separators, so it takes a single allocation)
+    req->clear();
+    req->reserve(bytes + 2);
+    req->append("[");
 
     for (int i = 0; i < (int)cmds.size(); i++)
     {
@@ -112,6 +134,11 @@ void Request::serverresponse(std::string&& movestring, MegaClient* client)
 }
 
 void Request::servererror(error e, MegaClient* client)
+{
+    serverresponse(errorresponse(e), client);
+}
+
+string Request::errorresponse(error e) const
 {
     ostringstream s;
     s << "[";
@@ -120,7 +147,7 @@ void Request::servererror(error e, MegaClient* client)
         s << e << (i ? "," : "");
     }
     s << "]";
-    serverresponse(s.str(), client);
+    return s.str();
 }
 
 void Request::clear()
@@ -137,6 +164,8 @@ void Request::clear()
     json.pos = NULL;
     processindex = 0;
     stopProcessing = false;
+    bytes = 0;
+    queuedds = 0;
 }
 
 bool Request::empty() const
@@ -144,10 +173,17 @@ bool Request::empty() const
     return cmds.empty();
 }
 
+Command* Request::streamingcommand() const
+{
+    return cmds.size() == 1 && cmds[0]->streamResponse ? cmds[0] : nullptr;
+}
+
 void Request::swap(Request& r)
 {
     // we use swap to move between queues, but process only after it gets into the completedreqs
     cmds.swap(r.cmds);
+    std::swap(bytes, r.bytes);
+    std::swap(queuedds, r.queuedds);
     assert(jsonresponse.empty() && r.jsonresponse.empty());
     assert(json.pos == NULL && r.json.pos == NULL);
     assert(processindex == 0 && r.processindex == 0);
@@ -169,6 +205,21 @@ void RequestDispatcher::sendDeferred()
 }
 #endif
 
+bool RequestDispatcher::full(const Request& r, const Command* c) const
+{
+    if (r.size() >= MAX_COMMANDS)
+    {
+        LOG_debug << "Starting an additional Request due to MAX_COMMANDS";
+        return true;
+    }
+    if (!r.empty() && r.jsonbytes() + c->jsonlength() > policy.maxBytes)
+    {
+        LOG_debug << "Starting an additional Request due to the batch size limit";
+        return true;
+    }
+    return false;
+}
+
 void RequestDispatcher::add(Command *c)
 {
 #ifdef MEGA_MEASURE_CODE
@@ -179,9 +230,31 @@ void RequestDispatcher::add(Command *c)
     }
 #endif
 
-    if (nextreqs.back().size() >= MAX_COMMANDS)
+    if (policy.maxDeferral && c->deferrable && !c->batchSeparately)
+    {
+        deferredreq.add(c);
+        csDeferredCommands++;
+        return;
+    }
+
+    if (maxpipelined && c->orderIndependent && !c->batchSeparately)
+    {
+        if (pipelinedreqs.empty() || full(pipelinedreqs.back(), c))
+        {
+            pipelinedreqs.push_back(Request());
+        }
+        pipelinedreqs.back().add(c);
+        return;
+    }
+
+    if (c->latencySensitive && !c->batchSeparately && !full(priorityreq, c))
+    {
+        priorityreq.add(c);
+        return;
+    }
+
+    if (full(nextreqs.back(), c))
     {
-        LOG_debug << "Starting an additional Request due to MAX_COMMANDS";
         nextreqs.push_back(Request());
     }
     if (c->batchSeparately && !nextreqs.back().empty())
@@ -198,31 +271,127 @@ void RequestDispatcher::add(Command *c)
 
 bool RequestDispatcher::cmdspending() const
 {
-    return !nextreqs.front().empty();
+    return !priorityreq.empty() || !nextreqs.front().empty();
 }
 
-void RequestDispatcher::serverrequest(string *out, bool& suppressSID)
+bool RequestDispatcher::deferredpending() const
 {
-    assert(inflightreq.empty());
-    inflightreq.swap(nextreqs.front());
-    nextreqs.pop_front();
-    if (nextreqs.empty())
+    return !deferredreq.empty();
+}
+
+dstime RequestDispatcher::deferreduntil() const
+{
+    return deferredreq.queuedsince() + policy.maxDeferral;
+}
+
+void RequestDispatcher::releasedeferred(bool ridealong)
+{
+    if (deferredreq.empty())
+    {
+        return;
+    }
+
+    if (!nextreqs.back().empty())
     {
         nextreqs.push_back(Request());
     }
+    nextreqs.back().swap(deferredreq);
+    (ridealong ? csDeferredRidealongs : csDeferredExpirations)++;
+}
+
+Command* RequestDispatcher::inflightstreamingcommand() const
+{
+    return inflightreq.streamingcommand();
+}
+
+void RequestDispatcher::serverrequest(string *out, bool& suppressSID, bool* compressed)
+{
+    assert(inflightreq.empty());
+
+    // the priority lane goes first, unless the oldest normal batch has already waited too long
+    const Request& front = nextreqs.front();
+    if (!priorityreq.empty() && (front.empty() || Waiter::ds - front.queuedsince() < policy.maxDelay))
+    {
+        inflightreq.swap(priorityreq);
+        inflightlane = LANE_PRIORITY;
+    }
+    else
+    {
+        inflightreq.swap(nextreqs.front());
+        inflightlane = LANE_NORMAL;
+        nextreqs.pop_front();
+        if (nextreqs.empty())
+        {
+            nextreqs.push_back(Request());
+        }
+    }
     inflightreq.get(out, suppressSID);
-#ifdef MEGA_MEASURE_CODE
     csRequestsSent += inflightreq.size();
     csBatchesSent += 1;
-#endif
+
+    if (compressed)
+    {
+        *compressed = compress(out);
+    }
+}
+
+void RequestDispatcher::setcompression(size_t threshold)
+{
+    compressthreshold = threshold;
+}
+
+size_t RequestDispatcher::compression() const
+{
+    return compressthreshold;
+}
+
+bool RequestDispatcher::compress(string* out)
+{
+    if (!compressthreshold || out->size() < compressthreshold)
+    {
+        return false;
+    }
+
+    z_stream z;
+    memset(&z, 0, sizeof z);
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return false;
+    }
+
+    string gz;
+    gz.resize(deflateBound(&z, uLong(out->size())));
+    z.next_in = (Bytef*)out->data();
+    z.avail_in = uInt(out->size());
+    z.next_out = (Bytef*)gz.data();
+    z.avail_out = uInt(gz.size());
+    int t = deflate(&z, Z_FINISH);
+    gz.resize(z.total_out);
+    deflateEnd(&z);
+
+    // JSON always shrinks, but don't pay the server's inflate for nothing
+    if (t != Z_STREAM_END || gz.size() >= out->size())
+    {
+        return false;
+    }
+
+    csCompressedBatches += 1;
+    csBytesBeforeCompression += out->size();
+    csBytesAfterCompression += gz.size();
+    LOG_debug << "Request batch of " << out->size() << " bytes compressed to " << gz.size();
+    out->swap(gz);
+    return true;
 }
 
 void RequestDispatcher::requeuerequest()
 {
-#ifdef MEGA_MEASURE_CODE
     csBatchesReceived += 1;
-#endif
     assert(!inflightreq.empty());
+    if (inflightlane == LANE_PRIORITY && priorityreq.empty())
+    {
+        priorityreq.swap(inflightreq);
+        return;
+    }
     if (!nextreqs.front().empty())
     {
         nextreqs.push_front(Request());
@@ -230,14 +399,24 @@ void RequestDispatcher::requeuerequest()
     nextreqs.front().swap(inflightreq);
 }
 
+void RequestDispatcher::recordresponse(const Request& r, Lane lane)
+{
+    LaneStats& stats = laneStats[lane];
+    dstime latency = Waiter::ds - r.queuedsince();
+    stats.batches += 1;
+    stats.commands += r.size();
+    stats.totalLatency += latency;
+    stats.maxLatency = std::max(stats.maxLatency, latency);
+}
+
 void RequestDispatcher::serverresponse(std::string&& movestring, MegaClient *client)
 {
     CodeCounter::ScopeTimer ccst(client->performanceStats.csResponseProcessingTime);
+    MegaClient::ExecTracer::Phase etp(client->execTracer, MegaClient::ExecTracer::CS);
 
-#ifdef MEGA_MEASURE_CODE
     csBatchesReceived += 1;
     csRequestsCompleted += inflightreq.size();
-#endif
+    recordresponse(inflightreq, inflightlane);
     processing = true;
     inflightreq.serverresponse(std::move(movestring), client);
     inflightreq.process(client);
@@ -253,6 +432,7 @@ void RequestDispatcher::servererror(error e, MegaClient *client)
 {
     // notify all the commands in the batch of the failure
     // so that they can deallocate memory, take corrective action etc.
+    recordresponse(inflightreq, inflightlane);
     processing = true;
     inflightreq.servererror(e, client);
     inflightreq.process(client);
@@ -271,10 +451,25 @@ void RequestDispatcher::clear()
         // we are being called from a command that is in progress (eg. logout) - delay wiping the data structure until that call ends.
         clearWhenSafe = true;
         inflightreq.stopProcessing = true;
+        pipelinedprocessing.stopProcessing = true;
     }
     else
     {
         inflightreq.clear();
+        priorityreq.clear();
+        deferredreq.clear();
+        pipelinedprocessing.clear();
+        for (auto& r : pipelinedreqs)
+        {
+            r.clear();
+        }
+        pipelinedreqs.clear();
+        for (auto& r : pipelinedinflight)
+        {
+            r.second.clear();
+        }
+        pipelinedinflight.clear();
+        pipelinedresponses.clear();
         for (auto& r : nextreqs)
         {
             r.clear();
@@ -286,4 +481,129 @@ void RequestDispatcher::clear()
     }
 }
 
+void RequestDispatcher::setpipelinedepth(unsigned batches)
+{
+    maxpipelined = batches;
+
+    if (!maxpipelined)
+    {
+        // whatever was waiting for a pipelined connection goes back to the ordered channel
+        for (auto& r : pipelinedreqs)
+        {
+            if (!nextreqs.back().empty())
+            {
+                nextreqs.push_back(Request());
+            }
+            nextreqs.back().swap(r);
+        }
+        pipelinedreqs.clear();
+    }
+}
+
+unsigned RequestDispatcher::pipelinedepth() const
+{
+    return maxpipelined;
+}
+
+bool RequestDispatcher::pipelinedpending() const
+{
+    return !pipelinedreqs.empty();
+}
+
+uint64_t RequestDispatcher::sendpipelined(string* out, bool& suppressSID)
+{
+    assert(!pipelinedreqs.empty());
+    uint64_t seq = ++pipelinedseq;
+    Request& r = pipelinedinflight[seq];
+    r.swap(pipelinedreqs.front());
+    pipelinedreqs.pop_front();
+    r.get(out, suppressSID);
+    csRequestsSent += r.size();
+    csBatchesSent += 1;
+    return seq;
+}
+
+void RequestDispatcher::requeuepipelined(uint64_t seq)
+{
+    auto it = pipelinedinflight.find(seq);
+    if (it == pipelinedinflight.end())
+    {
+        return;
+    }
+    csBatchesReceived += 1;
+    pipelinedreqs.push_front(Request());
+    pipelinedreqs.front().swap(it->second);
+    pipelinedinflight.erase(it);
+}
+
+void RequestDispatcher::pipelinedresponse(uint64_t seq, string&& movestring, MegaClient* client)
+{
+    if (!pipelinedinflight.count(seq))
+    {
+        // cleared while it was in flight
+        return;
+    }
+    csBatchesReceived += 1;
+    pipelinedresponses[seq] = std::move(movestring);
+
+    // deliver in sequence: stop at the first batch still waiting for its response
+    while (!pipelinedinflight.empty())
+    {
+        auto it = pipelinedinflight.begin();
+        auto rit = pipelinedresponses.find(it->first);
+        if (rit == pipelinedresponses.end())
+        {
+            break;
+        }
+
+        string response = std::move(rit->second);
+        pipelinedresponses.erase(rit);
+        pipelinedprocessing.swap(it->second);
+        pipelinedinflight.erase(it);
+
+        CodeCounter::ScopeTimer ccst(client->performanceStats.csResponseProcessingTime);
+        MegaClient::ExecTracer::Phase etp(client->execTracer, MegaClient::ExecTracer::CS);
+        csRequestsCompleted += pipelinedprocessing.size();
+        recordresponse(pipelinedprocessing, LANE_PIPELINED);
+        processing = true;
+        pipelinedprocessing.serverresponse(std::move(response), client);
+        pipelinedprocessing.process(client);
+        assert(pipelinedprocessing.empty());
+        processing = false;
+        if (clearWhenSafe)
+        {
+            clear();
+        }
+    }
+}
+
+void RequestDispatcher::pipelinederror(uint64_t seq, error e, MegaClient* client)
+{
+    auto it = pipelinedinflight.find(seq);
+    if (it != pipelinedinflight.end())
+    {
+        pipelinedresponse(seq, it->second.errorresponse(e), client);
+    }
+}
+
+string RequestDispatcher::statsReport() const
+{
+    static const char* const names[LANE_COUNT] = { "normal", "priority", "pipelined" };
+
+    ostringstream s;
+    s << "cs requests sent/received: " << csRequestsSent << "/" << csRequestsCompleted
+      << " batches: " << csBatchesSent << "/" << csBatchesReceived;
+    for (int i = 0; i < LANE_COUNT; i++)
+    {
+        const LaneStats& stats = laneStats[i];
+        s << " " << names[i] << " lane batches: " << stats.batches << " commands: " << stats.commands
+          << " latency avg/max ms: " << (stats.batches ? stats.totalLatency * 100 / stats.batches : 0) << "/" << stats.maxLatency * 100;
+    }
+    s << " compressed batches: " << csCompressedBatches
+      << " bytes saved: " << csBytesBeforeCompression - csBytesAfterCompression
+      << " deferred commands: " << csDeferredCommands
+      << " wakeups saved: " << csDeferredRidealongs << " expired: " << csDeferredExpirations;
+    return s.str();
+}
+
 } // namespace
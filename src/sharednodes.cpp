@@ -0,0 +1,442 @@
+/**
+ * @file sharednodes.cpp
+ * @brief Read-only view of the nodes, shared with other processes
+ *
+ * (c) 2013-2020 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <algorithm>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mega/sharednodes.h"
+#include "mega/node.h"
+#include "mega/logging.h"
+#include "mega/utils.h"
+
+namespace mega {
+const char SharedNodeView::MAGIC[8] = { 'M', 'E', 'G', 'A', 'S', 'N', 'V', 0 };
+
+namespace {
+
+// header fields
+const size_t H_VERSION = 8, H_COUNT = 12, H_GENERATION = 16, H_ROOTS = 24, H_IV = 48, H_NAMESOFFSET = 56,
+             H_NAMESLENGTH = 64, H_CHECK = 72;
+
+// record fields
+const size_t R_HANDLE = 0, R_PARENT = 8, R_SIZE = 16, R_CTIME = 24, R_MTIME = 32, R_TYPE = 40, R_NAMEOFFSET = 44,
+             R_NAMELENGTH = 48;
+
+size_t padded(size_t len)
+{
+    return (len + SymmCipher::BLOCKSIZE - 1) & -SymmCipher::BLOCKSIZE;
+}
+
+// the block that tells a view whether it has the right key
+void checkblock(SymmCipher& cipher, int64_t iv, uint64_t generation, byte* block)
+{
+    MemAccess::set<int64_t>(block, iv);
+    MemAccess::set<uint64_t>(block + 8, generation);
+    cipher.ecb_encrypt(block);
+}
+
+template<typename T> void append(string& s, T value)
+{
+    s.append((const char*)&value, sizeof value);
+}
+
+} // anonymous
+
+bool SharedNodeView::write(const string& path, const string& key, PrnGen& rng, const node_map& nodes, const handle* rootnodes, uint64_t generation)
+{
+    if (key.size() != SymmCipher::KEYLENGTH)
+    {
+        return false;
+    }
+
+    SymmCipher cipher;
+    cipher.setkey((const byte*)key.data());
+
+    vector<Node*> sorted;
+    sorted.reserve(nodes.size());
+    for (auto& it : nodes)
+    {
+        sorted.push_back(it.second);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](Node* a, Node* b) { return a->nodehandle < b->nodehandle; });
+
+    vector<uint32_t> byparent(sorted.size());
+    for (uint32_t i = 0; i < byparent.size(); i++)
+    {
+        byparent[i] = i;
+    }
+    std::sort(byparent.begin(), byparent.end(), [&sorted](uint32_t a, uint32_t b)
+    {
+        handle pa = sorted[a]->parenthandle, pb = sorted[b]->parenthandle;
+        return pa != pb ? pa < pb : a < b;
+    });
+
+    int64_t iv;
+    rng.genblock((byte*)&iv, sizeof iv);
+
+    string records;
+    records.reserve(sorted.size() * RECORDSIZE);
+    uint64_t nameslength = 0;
+    for (Node* n : sorted)
+    {
+        size_t len = strlen(n->displayname());
+
+        append<handle>(records, n->nodehandle);
+        append<handle>(records, n->parenthandle);
+        append<int64_t>(records, n->type == FILENODE ? n->size : -1);
+        append<int64_t>(records, n->ctime);
+        append<int64_t>(records, n->type == FILENODE ? n->mtime : 0);
+        append<int32_t>(records, n->type);
+        append<uint32_t>(records, uint32_t(nameslength));
+        append<uint32_t>(records, uint32_t(len));
+        append<uint32_t>(records, 0);
+        nameslength += padded(len);
+    }
+
+    uint64_t namesoffset = HEADERSIZE + records.size() + byparent.size() * sizeof(uint32_t);
+    if (nameslength > UINT32_MAX)
+    {
+        LOG_err << "Too many names for the shared node view";
+        return false;
+    }
+
+    string header;
+    header.append(MAGIC, sizeof MAGIC);
+    append<uint32_t>(header, VERSION);
+    append<uint32_t>(header, uint32_t(sorted.size()));
+    append<uint64_t>(header, generation);
+    for (int i = 0; i < 3; i++)
+    {
+        append<handle>(header, rootnodes[i]);
+    }
+    append<int64_t>(header, iv);
+    append<uint64_t>(header, namesoffset);
+    append<uint64_t>(header, nameslength);
+    byte check[SymmCipher::BLOCKSIZE];
+    checkblock(cipher, iv, generation, check);
+    header.append((const char*)check, sizeof check);
+    assert(header.size() == HEADERSIZE);
+
+    // readers keep the file they mapped: the new one takes its place in one go
+    string tmppath = path + ".tmp";
+    FILE* f = fopen(tmppath.c_str(), "wb");
+    if (!f)
+    {
+        LOG_err << "Unable to write the shared node view: " << tmppath;
+        return false;
+    }
+
+    bool ok = fwrite(header.data(), header.size(), 1, f) == 1
+           && (records.empty() || fwrite(records.data(), records.size(), 1, f) == 1)
+           && (byparent.empty() || fwrite(byparent.data(), byparent.size() * sizeof(uint32_t), 1, f) == 1);
+
+    string name;
+    uint64_t pos = 0;
+    for (size_t i = 0; ok && i < sorted.size(); i++)
+    {
+        name.assign(sorted[i]->displayname());
+        size_t len = name.size();
+        name.resize(padded(len));
+        if (name.size())
+        {
+            cipher.ctr_crypt((byte*)name.data(), unsigned(name.size()), m_off_t(pos), iv, nullptr, true);
+            ok = fwrite(name.data(), name.size(), 1, f) == 1;
+        }
+        pos += name.size();
+    }
+
+    ok = !fclose(f) && ok;
+
+#ifdef _WIN32
+    if (ok)
+    {
+        ::remove(path.c_str());
+    }
+#endif
+
+    if (!ok || ::rename(tmppath.c_str(), path.c_str()))
+    {
+        LOG_err << "Unable to write the shared node view: " << path;
+        ::remove(tmppath.c_str());
+        return false;
+    }
+
+    LOG_debug << "Shared node view written: " << sorted.size() << " nodes, generation " << generation;
+    return true;
+}
+
+uint64_t SharedNodeView::generationof(const string& path)
+{
+    char header[H_ROOTS];
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f)
+    {
+        return 0;
+    }
+
+    bool ok = fread(header, sizeof header, 1, f) == 1;
+    fclose(f);
+
+    if (!ok || memcmp(header, MAGIC, sizeof MAGIC))
+    {
+        return 0;
+    }
+    return MemAccess::get<uint64_t>(header + H_GENERATION);
+}
+
+bool SharedNodeView::open(const string& path, const string& key)
+{
+    close();
+
+    if (key.size() != SymmCipher::KEYLENGTH)
+    {
+        return false;
+    }
+
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (!fstat(fd, &st) && st.st_size >= off_t(HEADERSIZE))
+    {
+        void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            mData = (const char*)p;
+            mLength = size_t(st.st_size);
+            mMapped = true;
+        }
+    }
+    ::close(fd);
+#else
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f)
+    {
+        return false;
+    }
+
+    char buf[65536];
+    size_t r;
+    while ((r = fread(buf, 1, sizeof buf, f)) > 0)
+    {
+        mCopy.append(buf, r);
+    }
+    fclose(f);
+
+    mData = mCopy.data();
+    mLength = mCopy.size();
+#endif
+
+    if (!mData || mLength < HEADERSIZE || memcmp(mData, MAGIC, sizeof MAGIC)
+            || MemAccess::get<uint32_t>(mData + H_VERSION) != VERSION)
+    {
+        close();
+        return false;
+    }
+
+    mGeneration = MemAccess::get<uint64_t>(mData + H_GENERATION);
+    mCount = MemAccess::get<uint32_t>(mData + H_COUNT);
+    for (int i = 0; i < 3; i++)
+    {
+        mRootNodes[i] = MemAccess::get<handle>(mData + H_ROOTS + i * sizeof(handle));
+    }
+    mIv = MemAccess::get<int64_t>(mData + H_IV);
+    uint64_t namesoffset = MemAccess::get<uint64_t>(mData + H_NAMESOFFSET);
+    mNamesLength = size_t(MemAccess::get<uint64_t>(mData + H_NAMESLENGTH));
+
+    SymmCipher cipher;
+    cipher.setkey((const byte*)key.data());
+    byte check[SymmCipher::BLOCKSIZE];
+    checkblock(cipher, mIv, mGeneration, check);
+
+    if (namesoffset != HEADERSIZE + uint64_t(mCount) * (RECORDSIZE + sizeof(uint32_t))
+            || namesoffset + mNamesLength != mLength)
+    {
+        LOG_err << "Shared node view is damaged: " << path;
+        close();
+        return false;
+    }
+
+    if (memcmp(check, mData + H_CHECK, sizeof check))
+    {
+        LOG_err << "Shared node view of another key: " << path;
+        close();
+        return false;
+    }
+
+    mRecords = mData + HEADERSIZE;
+    mByParent = mRecords + size_t(mCount) * RECORDSIZE;
+    mNames = mData + namesoffset;
+    mPath = path;
+    mKey = key;
+    return true;
+}
+
+void SharedNodeView::close()
+{
+#ifndef _WIN32
+    if (mMapped)
+    {
+        munmap((void*)mData, mLength);
+    }
+#endif
+    mCopy.clear();
+    mData = nullptr;
+    mLength = 0;
+    mMapped = false;
+    mGeneration = 0;
+    mCount = 0;
+    mRecords = mByParent = mNames = nullptr;
+    mNamesLength = 0;
+}
+
+SharedNodeView::~SharedNodeView()
+{
+    close();
+}
+
+bool SharedNodeView::refresh()
+{
+    uint64_t generation = generationof(mPath);
+    if (!generation || generation == mGeneration)
+    {
+        return false;
+    }
+
+    string path = mPath, key = mKey;
+    return open(path, key);
+}
+
+SharedNodeView::Record SharedNodeView::record(uint32_t index) const
+{
+    const char* p = mRecords + size_t(index) * RECORDSIZE;
+    Record r;
+    r.nodehandle = MemAccess::get<handle>(p + R_HANDLE);
+    r.parenthandle = MemAccess::get<handle>(p + R_PARENT);
+    r.size = MemAccess::get<int64_t>(p + R_SIZE);
+    r.ctime = MemAccess::get<int64_t>(p + R_CTIME);
+    r.mtime = MemAccess::get<int64_t>(p + R_MTIME);
+    r.type = nodetype_t(MemAccess::get<int32_t>(p + R_TYPE));
+    return r;
+}
+
+bool SharedNodeView::name(uint32_t index, string* name) const
+{
+    const char* p = mRecords + size_t(index) * RECORDSIZE;
+    size_t offset = MemAccess::get<uint32_t>(p + R_NAMEOFFSET);
+    size_t len = MemAccess::get<uint32_t>(p + R_NAMELENGTH);
+    if (offset % SymmCipher::BLOCKSIZE || offset + padded(len) > mNamesLength)
+    {
+        return false;
+    }
+
+    SymmCipher cipher;
+    cipher.setkey((const byte*)mKey.data());
+    name->assign(mNames + offset, padded(len));
+    if (name->size())
+    {
+        cipher.ctr_crypt((byte*)name->data(), unsigned(name->size()), m_off_t(offset), mIv, nullptr, false);
+    }
+    name->resize(len);
+    return true;
+}
+
+bool SharedNodeView::find(handle h, Record* r, string* n) const
+{
+    uint32_t lo = 0, hi = mCount;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        handle mh = MemAccess::get<handle>(mRecords + size_t(mid) * RECORDSIZE + R_HANDLE);
+        if (mh == h)
+        {
+            *r = record(mid);
+            return !n || name(mid, n);
+        }
+
+        if (mh < h)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+bool SharedNodeView::children(handle parent, vector<Record>* rs, vector<string>* names) const
+{
+    auto parentof = [this](uint32_t i)
+    {
+        uint32_t index = MemAccess::get<uint32_t>(mByParent + size_t(i) * sizeof(uint32_t));
+        return index < mCount ? MemAccess::get<handle>(mRecords + size_t(index) * RECORDSIZE + R_PARENT) : UNDEF;
+    };
+
+    // first entry of the parent
+    uint32_t lo = 0, hi = mCount;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (parentof(mid) < parent)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    for (uint32_t i = lo; i < mCount && parentof(i) == parent; i++)
+    {
+        uint32_t index = MemAccess::get<uint32_t>(mByParent + size_t(i) * sizeof(uint32_t));
+        if (index >= mCount)
+        {
+            return false;
+        }
+
+        rs->push_back(record(index));
+        if (names)
+        {
+            names->emplace_back();
+            if (!name(index, &names->back()))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace
@@ -26,8 +26,13 @@
 #include "mega/command.h"
 
 namespace mega {
+ShareNodeKeys::ShareNodeKeys(size_t maxbytes)
+    : parts(1), maxbytes(maxbytes)
+{
+}
+
 // add share node and return its index
-int ShareNodeKeys::addshare(Node* sn)
+int ShareNodeKeys::Part::addshare(Node* sn)
 {
     for (int i = static_cast<int>(shares.size()); i--;)
     {
@@ -38,6 +43,7 @@ int ShareNodeKeys::addshare(Node* sn)
     }
 
     shares.push_back(sn);
+    bytes += MegaClient::NODEHANDLE * 4 / 3 + 4;
 
     return static_cast<int>(shares.size() - 1);
 }
@@ -61,11 +67,19 @@ void ShareNodeKeys::add(const string& nodekey, handle nodehandle, Node* sn, int
 
     int addnode = 0;
 
+    // a node's keys all go in the same part
+    if (maxbytes && parts.back().bytes >= maxbytes)
+    {
+        parts.emplace_back();
+    }
+    Part& part = parts.back();
+    size_t keysize = part.keys.size();
+
     // emit all share nodekeys for known shares
     do {
         if (sn->sharekey)
         {
-            sprintf(buf, ",%d,%d,\"", addshare(sn), (int)items.size());
+            sprintf(buf, ",%d,%d,\"", part.addshare(sn), (int)part.items.size());
 
             sn->sharekey->ecb_encrypt((byte*)nodekey.data(), key, nodekey.size());
 
@@ -73,37 +87,60 @@ void ShareNodeKeys::add(const string& nodekey, handle nodehandle, Node* sn, int
             ptr += Base64::btoa(key, int(nodekey.size()), ptr);
             *ptr++ = '"';
 
-            keys.append(buf, ptr - buf);
+            part.keys.append(buf, ptr - buf);
             addnode = 1;
         }
     } while (!specific && (sn = sn->parent));
 
     if (addnode)
     {
-        items.resize(items.size() + 1);
+        part.items.resize(part.items.size() + 1);
 
         if (item)
         {
-            items[items.size() - 1].assign((const char*)item, itemlen);
+            part.items[part.items.size() - 1].assign((const char*)item, itemlen);
         }
         else
         {
-            items[items.size() - 1].assign((const char*)&nodehandle, MegaClient::NODEHANDLE);
+            part.items[part.items.size() - 1].assign((const char*)&nodehandle, MegaClient::NODEHANDLE);
         }
+
+        part.bytes += part.keys.size() - keysize + part.items.back().size() * 4 / 3 + 4;
     }
 }
 
-void ShareNodeKeys::get(Command* c, bool skiphandles)
+size_t ShareNodeKeys::size() const
+{
+    return parts.back().keys.size() ? parts.size() : parts.size() - 1;
+}
+
+void ShareNodeKeys::get(Command* c, bool skiphandles, size_t index)
 {
-    if (keys.size())
+    if (index >= parts.size())
     {
+        return;
+    }
+
+    const Part& part = parts[index];
+    if (part.keys.size())
+    {
+        size_t estimate = part.keys.size() + part.shares.size() * 12 + 16;
+        if (!skiphandles)
+        {
+            for (const string& item : part.items)
+            {
+                estimate += item.size() * 4 / 3 + 4;
+            }
+        }
+        c->reserve(estimate);
+
         c->beginarray("cr");
 
         // emit share node handles
         c->beginarray();
-        for (unsigned i = 0; i < shares.size(); i++)
+        for (unsigned i = 0; i < part.shares.size(); i++)
         {
-            c->element((const byte*)&shares[i]->nodehandle, MegaClient::NODEHANDLE);
+            c->element((const byte*)&part.shares[i]->nodehandle, MegaClient::NODEHANDLE);
         }
 
         c->endarray();
@@ -113,9 +150,9 @@ void ShareNodeKeys::get(Command* c, bool skiphandles)
 
         if (!skiphandles)
         {
-            for (unsigned i = 0; i < items.size(); i++)
+            for (unsigned i = 0; i < part.items.size(); i++)
             {
-                c->element((const byte*)items[i].c_str(), int(items[i].size()));
+                c->element((const byte*)part.items[i].c_str(), int(part.items[i].size()));
             }
         }
 
@@ -123,7 +160,7 @@ void ShareNodeKeys::get(Command* c, bool skiphandles)
 
         // emit linkage/keys
         c->beginarray();
-        c->appendraw(keys.c_str() + 1, int(keys.size() - 1));
+        c->appendraw(part.keys.c_str() + 1, int(part.keys.size() - 1));
         c->endarray();
 
         c->endarray();
@@ -19,6 +19,7 @@
  * program.
  */
 
+#include <chrono>
 #include <type_traits>
 #include <unordered_set>
 
@@ -38,6 +39,14 @@ const int Sync::EXTRA_SCANNING_DELAY_DS = 150;
 const int Sync::FILE_UPDATE_DELAY_DS = 30;
 const int Sync::FILE_UPDATE_MAX_DELAY_SECS = 60;
 const dstime Sync::RECENT_VERSION_INTERVAL_SECS = 10800;
+const dstime Sync::FILE_NAGLE_DS = 11;
+const dstime Sync::FILE_CADENCE_WINDOW_DS = 600;
+const dstime Sync::FILE_NAGLE_MAX_DS = 3000;
+const dstime Sync::POLL_TICK_DS = 50;
+const dstime Sync::POLL_MIN_INTERVAL_DS = 300;
+const dstime Sync::POLL_MAX_INTERVAL_DS = 36000;
+const unsigned Sync::POLL_FOLDERS_PER_CALL = 128;
+const dstime Sync::POLL_FULLSCAN_INTERVAL_DS = 216000;
 
 namespace {
 
@@ -657,6 +666,8 @@ Sync::Sync(MegaClient* cclient, SyncConfig config, const char* cdebris,
     inshare = cinshare;
     appData = cappdata;
     errorcode = API_OK;
+    statecachestats.since = Waiter::ds;
+    fullscands = Waiter::ds;
     tmpfa = NULL;
     initializing = true;
     updatedfilesize = ~0;
@@ -763,7 +774,7 @@ Sync::Sync(MegaClient* cclient, SyncConfig config, const char* cdebris,
             dbname.resize(sizeof tableid * 4 / 3 + 3);
             dbname.resize(Base64::btoa((byte*)tableid, sizeof tableid, (char*)dbname.c_str()));
 
-            statecachetable = client->dbaccess->open(client->rng, client->fsaccess, &dbname, false, false);
+            statecachetable = client->opencachetable(&dbname, false, false);
 
             readstatecache();
         }
@@ -780,6 +791,9 @@ Sync::~Sync()
     // must be set to prevent remote mass deletion while rootlocal destructor runs
     assert(state == SYNC_CANCELED || state == SYNC_FAILED);
 
+    dirscanner.reset();
+    prefetcher.reset();
+
     if (!statecachetable && client->syncConfigs)
     {
         // if there's no localnode cache then remove the sync config
@@ -808,6 +822,16 @@ Sync::~Sync()
         // Create a committer and recursively delete all the associated LocalNodes, and their associated transfer and file objects.
         // If any have transactions in progress, the committer will ensure we update the transfer database in an efficient single commit.
         DBTableTransactionCommitter committer(client->tctable);
+
+        if (dirnotify)
+        {
+            for (int q = DirNotify::RETRY; q >= DirNotify::EXTRA; q--)
+            {
+                dirnotify->notifyq[q].clear();
+            }
+        }
+
+        discardinglocalnodes = true;
         localroot.reset();
     }
 }
@@ -867,9 +891,16 @@ bool Sync::readstatecache()
         // bulk-load cached nodes into tmap
         while (statecachetable->next(&cid, &cachedata, &client->key))
         {
+            if (!cid)
+            {
+                journalcursor = cachedata;
+                continue;
+            }
+
             if ((l = LocalNode::unserialize(this, &cachedata)))
             {
                 l->dbid = cid;
+                l->statecachehash = std::hash<string>()(cachedata);
                 tmap.insert(pair<int32_t,LocalNode*>(l->parent_dbid,l));
             }
         }
@@ -939,10 +970,21 @@ void Sync::statecacheadd(LocalNode* l)
     insertq.insert(l);
 }
 
-void Sync::cachenodes()
+void Sync::cachenodes(bool force)
 {
     if (statecachetable && (state == SYNC_ACTIVE || (state == SYNC_INITIALSCAN && insertq.size() > 100)) && (deleteq.size() || insertq.size()))
     {
+        if (!force && state == SYNC_ACTIVE && dirnotify && dirnotify->notifyq[DirNotify::DIREVENTS].size()
+                && insertq.size() + deleteq.size() < STATECACHE_FLUSH_THRESHOLD
+                && Waiter::ds - statecacheflushds < STATECACHE_FLUSH_INTERVAL_DS)
+        {
+            // more changes are on their way: write them together
+            return;
+        }
+
+        auto started = std::chrono::steady_clock::now();
+        statecacheflushds = Waiter::ds;
+
         LOG_debug << "Saving LocalNode database with " << insertq.size() << " additions and " << deleteq.size() << " deletions";
         statecachetable->begin();
 
@@ -952,28 +994,65 @@ void Sync::cachenodes()
             statecachetable->del(*it);
         }
 
+        statecachestats.deleted += deleteq.size();
         deleteq.clear();
 
         // additions - we iterate until completion or until we get stuck
         bool added;
 
+        vector<Cacheable*> batch;
+        vector<size_t> hashes;
+        string record;
+
         do {
+            // children of nodes in this batch get their parent's dbid once it is written, and go in the next one
+            batch.clear();
+            hashes.clear();
             added = false;
 
             for (set<LocalNode*>::iterator it = insertq.begin(); it != insertq.end(); )
             {
-                if ((*it)->parent->dbid || (*it)->parent == localroot.get())
+                LocalNode* l = *it;
+
+                if (l->parent->dbid || l->parent == localroot.get())
                 {
-                    statecachetable->put(MegaClient::CACHEDLOCALNODE, *it, &client->key);
                     insertq.erase(it++);
                     added = true;
+
+                    // most updates leave the record as it was (a rescan touching every node, say)
+                    record.clear();
+                    size_t hash = l->serialize(&record) ? std::hash<string>()(record) : 0;
+
+                    if (l->dbid && hash && hash == l->statecachehash)
+                    {
+                        statecachestats.unchanged++;
+                        continue;
+                    }
+
+                    batch.push_back(l);
+                    hashes.push_back(hash);
                 }
                 else it++;
             }
+
+            if (statecachetable->putBatch(MegaClient::CACHEDLOCALNODE, batch, &client->key))
+            {
+                for (size_t i = batch.size(); i--; )
+                {
+                    static_cast<LocalNode*>(batch[i])->statecachehash = hashes[i];
+                }
+            }
+
+            statecachestats.written += batch.size();
         } while (added);
 
         statecachetable->commit();
 
+        statecachestats.lastflushms = unsigned(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count());
+        statecachestats.flushes++;
+        statecachestats.flushms += statecachestats.lastflushms;
+        LOG_debug << "LocalNode database: " << statecachereport();
+
         if (insertq.size())
         {
             LOG_err << "LocalNode caching did not complete";
@@ -981,12 +1060,29 @@ void Sync::cachenodes()
     }
 }
 
+string Sync::statecachereport() const
+{
+    dstime elapsedds = Waiter::ds > statecachestats.since ? Waiter::ds - statecachestats.since : 1;
+
+    std::ostringstream oss;
+    oss << statecachestats.flushes << " flushes, " << statecachestats.written << " written, "
+        << statecachestats.unchanged << " unchanged, " << statecachestats.deleted << " deleted, "
+        << statecachestats.flushms << " ms (" << (statecachestats.flushms * 10 / elapsedds) << " ms/s)";
+    return oss.str();
+}
+
 void Sync::changestate(syncstate_t newstate)
 {
     if (newstate != state)
     {
         client->app->syncupdate_state(this, newstate);
 
+        if (newstate == SYNC_CANCELED)
+        {
+            // write what cachenodes() was holding back, the cache is kept for resumption
+            cachenodes(true);
+        }
+
         if (newstate == SYNC_FAILED && statecachetable)
         {
             statecachetable->remove();
@@ -1036,7 +1132,6 @@ LocalNode* Sync::localnodebypath(LocalNode* l, string* localpath, LocalNode** pa
     }
 
     const char* nptr = ptr;
-    localnode_map::iterator it;
     string t;
 
     for (;;)
@@ -1063,8 +1158,8 @@ LocalNode* Sync::localnodebypath(LocalNode* l, string* localpath, LocalNode** pa
             }
 
             t.assign(ptr, nptr - ptr);
-            if ((it = l->children.find(&t)) == l->children.end()
-             && (it = l->schildren.find(&t)) == l->schildren.end())
+            LocalNode* child = l->childbyname(&t);
+            if (!child)
             {
                 // no full match: store residual path, return NULL with the
                 // matching component LocalNode in parent
@@ -1076,7 +1171,7 @@ LocalNode* Sync::localnodebypath(LocalNode* l, string* localpath, LocalNode** pa
                 return NULL;
             }
 
-            l = it->second;
+            l = child;
 
             if (nptr == end)
             {
@@ -1107,8 +1202,10 @@ bool Sync::assignfsids()
 
 // scan localpath, add or update child nodes, call recursively for folder nodes
 // localpath must be prefixed with Sync
-bool Sync::scan(string* localpath, FileAccess* fa)
+bool Sync::scan(string* localpath, FileAccess* fa, set<string>* seen)
 {
+    CodeCounter::TraceSpan span("sync", "sync scan");
+
     if (fa)
     {
         assert(fa->type == FOLDERNODE);
@@ -1116,7 +1213,8 @@ bool Sync::scan(string* localpath, FileAccess* fa)
     if (isPathSyncable(*localpath, localdebris, client->fsaccess->localseparator))
     {
         DirAccess* da;
-        string localname, name;
+        DirEntry entry;
+        string name;
         bool success;
 
         string utf8path;
@@ -1133,9 +1231,23 @@ bool Sync::scan(string* localpath, FileAccess* fa)
         {
             size_t t = localpath->size();
 
-            while (da->dnext(localpath, &localname, client->followsymlinks))
+            // the folder's LocalNode, for matching files against the cache without opening them
+            LocalNode* parent = NULL;
+            if (initializing)
             {
-                name = localname;
+                parent = *localpath == localroot->localname ? localroot.get() : localnodebypath(NULL, localpath);
+            }
+
+            while (da->dnextstat(localpath, &entry, client->followsymlinks))
+            {
+                scanentries++;
+
+                if (seen)
+                {
+                    seen->insert(entry.localname);
+                }
+
+                name = entry.localname;
                 client->fsaccess->local2name(&name);
 
                 if (t)
@@ -1143,7 +1255,7 @@ bool Sync::scan(string* localpath, FileAccess* fa)
                     localpath->append(client->fsaccess->localseparator);
                 }
 
-                localpath->append(localname);
+                localpath->append(entry.localname);
 
                 // check if this record is to be ignored
                 if (client->app->sync_syncable(this, name.c_str(), localpath))
@@ -1154,8 +1266,25 @@ bool Sync::scan(string* localpath, FileAccess* fa)
                         LocalNode *l = NULL;
                         if (initializing)
                         {
-                            // preload all cached LocalNodes
-                            l = checkpath(NULL, localpath);
+                            LocalNode* cl;
+                            if (parent && parent->node && entry.statvalid && entry.type == FILENODE && entry.fsidvalid
+                                    && (cl = parent->childbyname(&entry.localname))
+                                    && cl->type == FILENODE && cl->fsid == entry.fsid
+                                    && cl->size == entry.size && cl->mtime == entry.mtime)
+                            {
+                                // what checkpath() concludes for an unchanged cached file
+                                LOG_verbose << "Cached localnode is still valid. Type: " << cl->type << "  Size: " << cl->size << "  Mtime: " << cl->mtime;
+                                cl->deleted = false;
+                                cl->setnotseen(0);
+                                cl->scanseqno = scanseqno;
+                                localbytes += cl->size;
+                                l = cl;
+                            }
+                            else
+                            {
+                                // preload all cached LocalNodes
+                                l = checkpath(NULL, localpath);
+                            }
                         }
 
                         if (!l || l == (LocalNode*)~0)
@@ -1171,7 +1300,10 @@ bool Sync::scan(string* localpath, FileAccess* fa)
                 }
 
                 localpath->resize(t);
+                entry = DirEntry();
             }
+
+            updatescanrate();
         }
 
         delete da;
@@ -1181,182 +1313,608 @@ bool Sync::scan(string* localpath, FileAccess* fa)
     else return false;
 }
 
-// check local path - if !localname, localpath is relative to l, with l == NULL
-// being the root of the sync
-// if localname is set, localpath is absolute and localname its last component
-// path references a new FOLDERNODE: returns created node
-// path references a existing FILENODE: returns node
-// otherwise, returns NULL
-LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, dstime *backoffds, bool wejustcreatedthisfolder)
+void Sync::updatescanrate()
 {
-    LocalNode* ll = l;
-    bool newnode = false, changed = false;
-    bool isroot;
+    if (Waiter::ds >= scanrateds + 10)
+    {
+        scanrate = unsigned((scanentries - scanratebase) * 10 / (Waiter::ds - scanrateds));
+        scanratebase = scanentries;
+        scanrateds = Waiter::ds;
+    }
+}
 
-    LocalNode* parent;
-    string path;        // UTF-8 representation of tmppath
-    string tmppath;     // full path represented by l + localpath
-    string newname;     // portion of tmppath not covered by the existing
-                        // LocalNode structure (always the last path component
-                        // that does not have a corresponding LocalNode yet)
+void Sync::addlag(dstime lagds)
+{
+    lagsamples++;
+    totallagds += lagds;
+    lastlagds = lagds;
+    maxlagds = std::max(maxlagds, lagds);
+}
 
-    if (localname)
+void Sync::getstats(SyncStats& stats) const
+{
+    stats = SyncStats();
+
+    if (dirnotify)
     {
-        // shortcut case (from within syncdown())
-        isroot = false;
-        parent = l;
-        l = NULL;
+        for (int q = 0; q < DirNotify::NUMQUEUES; q++)
+        {
+            const notify_deque& queue = dirnotify->notifyq[q];
+            stats.queued[q] = queue.size();
 
-        client->fsaccess->local2path(localpath, &path);
-        assert(path.size());
+            if (queue.size() && Waiter::ds > queue.front().timestamp)
+            {
+                stats.queuelagds = std::max(stats.queuelagds, Waiter::ds - queue.front().timestamp);
+            }
+        }
     }
-    else
+
+    stats.scanentries = scanentries;
+    // a window that is over but not yet rolled is more current: no scan is running
+    stats.scanrate = Waiter::ds >= scanrateds + 10
+            ? unsigned((scanentries - scanratebase) * 10 / (Waiter::ds - scanrateds))
+            : scanrate;
+
+    for (LocalNode* l : client->synccreate)
     {
-        // construct full filesystem path in tmppath
-        if (l)
+        if (l->sync == this)
         {
-            l->getlocalpath(&tmppath);
+            stats.synccreate++;
         }
+    }
 
-        if (localpath->size())
+    for (LocalNode* l : client->localsyncnotseen)
+    {
+        if (l->sync == this)
         {
-            if (tmppath.size())
+            stats.notseen++;
+        }
+    }
+
+    for (direction_t d : { GET, PUT })
+    {
+        for (auto& t : client->transfers[d])
+        {
+            for (File* f : t.second->files)
             {
-                tmppath.append(client->fsaccess->localseparator);
+                if (f->syncxfer && (d == PUT ? static_cast<LocalNode*>(f)->sync : static_cast<SyncFileGet*>(f)->sync) == this)
+                {
+                    (d == PUT ? stats.puts : stats.gets)++;
+                }
             }
-
-            tmppath.append(*localpath);
         }
+    }
 
-        // look up deepest existing LocalNode by path, store remainder (if any)
-        // in newname
-        LocalNode *tmp = localnodebypath(l, localpath, &parent, &newname);
+    stats.statecacheflushes = statecachestats.flushes;
+    stats.statecacheflushms = statecachestats.flushms;
+    stats.statecachelastflushms = statecachestats.lastflushms;
 
-        size_t index = 0;
-        while ((index = newname.find(client->fsaccess->localseparator, index)) != string::npos)
+    stats.lagsamples = lagsamples;
+    stats.lastlagds = lastlagds;
+    stats.maxlagds = maxlagds;
+    stats.avglagds = lagsamples ? dstime(totallagds / lagsamples) : 0;
+}
+
+bool Sync::pollfolders()
+{
+    bool changed = false;
+    unsigned polled = 0;
+    string path;
+    vector<LocalNode*> folders(1, localroot.get());
+
+    while (folders.size() && polled < POLL_FOLDERS_PER_CALL)
+    {
+        LocalNode* l = folders.back();
+        folders.pop_back();
+
+        for (localnode_map::iterator it = l->children.begin(); it != l->children.end(); it++)
         {
-            if(!(index % client->fsaccess->localseparator.size()))
+            if (it->second->type == FOLDERNODE)
             {
-                string utf8newname;
-                client->fsaccess->local2path(&newname, &utf8newname);
-                LOG_warn << "Parent not detected yet. Unknown reminder: " << utf8newname;
-                string parentpath = localpath->substr(0, localpath->size() - newname.size() + index);
-                dirnotify->notify(DirNotify::DIREVENTS, l, parentpath.data(), parentpath.size(), true);
-                return NULL;
+                folders.push_back(it->second);
             }
-
-            LOG_debug << "Skipping invalid separator detection";
-            index++;
         }
 
-        l = tmp;
+        if (l->pollds > Waiter::ds)
+        {
+            continue;
+        }
 
-        client->fsaccess->local2path(&tmppath, &path);
+        polled++;
+        l->getlocalpath(&path);
 
-        // path invalid?
-        if ( ( !l && !newname.size() ) || !path.size())
+        auto fa = client->fsaccess->newfileaccess(false);
+        if (!fa->fopen(&path, false, false) || fa->type != FOLDERNODE)
         {
-            LOG_warn << "Invalid path: " << path;
-            return NULL;
+            // gone: its parent's mtime tells
+            l->pollintervalds = POLL_MAX_INTERVAL_DS;
+        }
+        else if (!l->pollmtime)
+        {
+            l->pollmtime = fa->mtime;
+            l->pollintervalds = POLL_MIN_INTERVAL_DS;
         }
+        else if (fa->mtime != l->pollmtime)
+        {
+            LOG_debug << "Folder changed, rescanning: " << l->name;
 
-        string name = newname.size() ? newname : l->name;
-        client->fsaccess->local2name(&name);
+            // a change later within the same second would not show
+            l->pollmtime = fa->mtime >= m_time() - 1 ? -1 : fa->mtime;
 
-        if (!client->app->sync_syncable(this, name.c_str(), &tmppath))
+            set<string> seen;
+            if (scan(&path, fa.get(), &seen))
+            {
+                // and what was there but isn't anymore
+                for (localnode_map::iterator it = l->children.begin(); it != l->children.end(); it++)
+                {
+                    if (!seen.count(it->second->localname))
+                    {
+                        dirnotify->notify(DirNotify::DIREVENTS, l, it->second->localname.data(), it->second->localname.size(), true);
+                    }
+                }
+            }
+
+            l->pollintervalds = POLL_MIN_INTERVAL_DS;
+
+            // with changes here, more are likely around
+            for (LocalNode* p = l->parent; p; p = p->parent)
+            {
+                p->pollintervalds = std::max(POLL_MIN_INTERVAL_DS, p->pollintervalds / 2);
+                p->pollds = std::min(p->pollds, Waiter::ds + p->pollintervalds);
+            }
+
+            changed = true;
+        }
+        else
         {
-            LOG_debug << "Excluded: " << path;
-            return NULL;
+            l->pollintervalds = std::min(POLL_MAX_INTERVAL_DS, std::max(POLL_MIN_INTERVAL_DS, l->pollintervalds * 2));
         }
 
-        isroot = l == localroot.get() && !newname.size();
+        l->pollds = Waiter::ds + l->pollintervalds;
     }
 
-    LOG_verbose << "Scanning: " << path;
+    return changed;
+}
 
-    // postpone moving nodes into nonexistent parents
-    if (parent && !parent->node)
+void Sync::updatejournalcursor()
+{
+    if (!statecachetable || state != SYNC_ACTIVE || fullscan || !fsstableids
+            || Waiter::ds - journalcursords < JOURNAL_CURSOR_INTERVAL_DS)
     {
-        LOG_warn << "Parent doesn't exist yet: " << path;
-        return (LocalNode*)~0;
+        return;
     }
 
-    // attempt to open/type this file
-    auto fa = client->fsaccess->newfileaccess(false);
-
-    if (initializing || fullscan)
+    cachenodes(true);
+    for (int q = DirNotify::EXTRA; q < DirNotify::NUMQUEUES; q++)
     {
-        // find corresponding LocalNode by file-/foldername
-        size_t lastpart = client->fsaccess->lastpartlocal(localname ? localpath : &tmppath);
-
-        string fname(localname ? *localpath : tmppath,
-                     lastpart,
-                     (localname ? *localpath : tmppath).size() - lastpart);
-
-        LocalNode* cl = (parent ? parent : localroot.get())->childbyname(&fname);
-        if (initializing && cl)
+        if (dirnotify->notifyq[q].size())
         {
-            // the file seems to be still in the folder
-            // mark as present to prevent deletions if the file is not accesible
-            // in that case, the file would be checked again after the initialization
-            cl->deleted = false;
-            cl->setnotseen(0);
-            l->scanseqno = scanseqno;
+            return;
         }
+    }
+    if (insertq.size() || deleteq.size())
+    {
+        return;
+    }
 
-        // match cached LocalNode state during initial/rescan to prevent costly re-fingerprinting
-        // (just compare the fsids, sizes and mtimes to detect changes)
-        if (fa->fopen(localname ? localpath : &tmppath, false, false))
-        {
-            if (cl && fa->fsidvalid && fa->fsid == cl->fsid)
-            {
-                // node found and same file
-                l = cl;
-                l->deleted = false;
-                l->setnotseen(0);
-
-                // if it's a file, size and mtime must match to qualify
-                if (l->type != FILENODE || (l->size == fa->size && l->mtime == fa->mtime))
-                {
-                    LOG_verbose << "Cached localnode is still valid. Type: " << l->type << "  Size: " << l->size << "  Mtime: " << l->mtime;
-                    l->scanseqno = scanseqno;
-
-                    if (l->type == FOLDERNODE)
-                    {
-                        scan(localname ? localpath : &tmppath, fa.get());
-                    }
-                    else
-                    {
-                        localbytes += l->size;
-                    }
+    journalcursords = Waiter::ds;
 
-                    return l;
-                }
-            }
+    if (pendingjournalcursor.size() && pendingjournalcursor != journalcursor)
+    {
+        statecachetable->begin();
+        if (statecachetable->put(0, &pendingjournalcursor))
+        {
+            statecachetable->commit();
+            journalcursor = pendingjournalcursor;
         }
         else
         {
-            LOG_warn << "Error opening file during the initialization: " << path;
+            statecachetable->abort();
         }
+    }
 
-        if (initializing)
+    if (!dirnotify->journalcursor(&pendingjournalcursor))
+    {
+        pendingjournalcursor.clear();
+    }
+}
+
+bool Sync::resumefromjournal()
+{
+    if (journalcursor.empty() || !fsstableids)
+    {
+        return false;
+    }
+
+    if (!queuejournalchanges(journalcursor))
+    {
+        LOG_info << "Change journal not usable, scanning the whole sync";
+        return false;
+    }
+
+    // the cached tree stands: mark it as present, as the initial scan would have
+    vector<LocalNode*> pending(1, localroot.get());
+    while (pending.size())
+    {
+        LocalNode* l = pending.back();
+        pending.pop_back();
+
+        for (localnode_map::iterator it = l->children.begin(); it != l->children.end(); it++)
         {
-            if (cl)
+            LocalNode* child = it->second;
+            child->deleted = false;
+            child->setnotseen(0);
+            child->scanseqno = scanseqno;
+
+            if (child->type == FOLDERNODE)
             {
-                LOG_verbose << "Outdated localnode. Type: " << cl->type << "  Size: " << cl->size << "  Mtime: " << cl->mtime
-                            << "    FaType: " << fa->type << "  FaSize: " << fa->size << "  FaMtime: " << fa->mtime;
+                pending.push_back(child);
             }
             else
             {
-                LOG_verbose << "New file. FaType: " << fa->type << "  FaSize: " << fa->size << "  FaMtime: " << fa->mtime;
+                localbytes += child->size;
             }
-            return NULL;
         }
+    }
 
-        fa = client->fsaccess->newfileaccess(false);
+    LOG_info << "Resumed from the change journal. Changed paths: " << dirnotify->notifyq[DirNotify::DIREVENTS].size();
+    return true;
+}
+
+void Sync::procoverflow()
+{
+    MegaClient::PerformanceStats& stats = client->performanceStats;
+    stats.syncNotifyOverflows += dirnotify->overflows;
+    dirnotify->overflows = 0;
+
+    string cursor;
+    cursor.swap(dirnotify->overflowcursor);
+    if (cursor.size() && fsstableids && queuejournalchanges(cursor))
+    {
+        LOG_info << "Recovered from a notification overflow with the change journal. Queued paths: "
+                 << dirnotify->notifyq[DirNotify::DIREVENTS].size();
+        stats.syncOverflowJournalRecoveries++;
+        return;
     }
 
-    if (fa->fopen(localname ? localpath : &tmppath, true, false))
+    // the journal was unavailable, reset or overwritten since
+    LOG_warn << "Notification overflow without a usable change journal, scanning the whole sync";
+    dirnotify->error++;
+    stats.syncOverflowRescans++;
+}
+
+bool Sync::queuejournalchanges(const string& cursor)
+{
+    const string& separator = client->fsaccess->localseparator;
+    set<string> changed;
+    string localpath;
+
+    auto addpath = [&](LocalNode* l, const string* localname)
+    {
+        localpath.clear();
+        l->getlocalpath(&localpath);
+        if (localname)
+        {
+            localpath.append(separator);
+            localpath.append(*localname);
+        }
+        changed.insert(localpath);
+    };
+
+    bool success = dirnotify->journalchanges(cursor, [&](handle fsid, handle parentfsid, const string& localname)
+    {
+        // the record's folder, if it is in this sync: new names, changed and deleted files
+        handlelocalnode_map::iterator it = client->fsidnode.find(parentfsid);
+        if (it != client->fsidnode.end() && it->second->sync == this && it->second->type == FOLDERNODE)
+        {
+            addpath(it->second, &localname);
+        }
+
+        // and where the LocalNode is now, if it was moved elsewhere
+        it = client->fsidnode.find(fsid);
+        if (it != client->fsidnode.end() && it->second->sync == this && it->second != localroot.get())
+        {
+            addpath(it->second, NULL);
+        }
+    });
+
+    if (!success)
+    {
+        return false;
+    }
+
+    for (const string& path : changed)
+    {
+        if (isPathSyncable(path, localdebris, separator))
+        {
+            dirnotify->notify(DirNotify::DIREVENTS, NULL, path.data(), path.size(), true);
+        }
+    }
+    return true;
+}
+
+void Sync::startdirscan(const string& rootpath, unsigned threads)
+{
+    dirscanner.reset(new ParallelDirScanner(client->fsaccess, threads, client->followsymlinks, client->waiter));
+    dirscanner->add(rootpath);
+    LOG_debug << "Initial scan started on " << dirscanner->threads() << " threads";
+}
+
+bool Sync::procdirscan()
+{
+    ParallelDirScanner::Batch batch;
+    const string& separator = client->fsaccess->localseparator;
+
+    unsigned n = 0;
+    while (n++ < DIRSCAN_BATCHES_PER_CALL && dirscanner->next(batch))
+    {
+        string& localpath = batch.localpath;
+        bool isroot = localpath == localroot->localname;
+
+        if (!batch.success)
+        {
+            if (isroot)
+            {
+                LOG_err << "Initial scan failed";
+                dirscanner.reset();
+                return false;
+            }
+
+            // let the regular scan have a go at it
+            dirnotify->notify(DirNotify::DIREVENTS, NULL, localpath.data(), localpath.size(), true);
+            continue;
+        }
+
+        LocalNode* parent = isroot ? localroot.get() : localnodebypath(NULL, &localpath);
+        if (!parent)
+        {
+            continue;
+        }
+
+        size_t t = localpath.size();
+        for (ParallelDirScanner::Entry& e : batch.entries)
+        {
+            string name = e.localname;
+            client->fsaccess->local2name(&name);
+
+            if (t)
+            {
+                localpath.append(separator);
+            }
+            localpath.append(e.localname);
+
+            if (!client->app->sync_syncable(this, name.c_str(), &localpath))
+            {
+                LOG_debug << "Excluded: " << name;
+            }
+            else if (isPathSyncable(localpath, localdebris, separator))
+            {
+                // what checkpath() does during the initialization, with what the worker read
+                LocalNode* l = parent->childbyname(&e.localname);
+                if (l)
+                {
+                    l->deleted = false;
+                    l->setnotseen(0);
+                }
+
+                if (l && e.statvalid && e.fsidvalid && e.fsid == l->fsid
+                        && (l->type != FILENODE || (l->size == e.size && l->mtime == e.mtime)))
+                {
+                    LOG_verbose << "Cached localnode is still valid. Type: " << l->type << "  Size: " << l->size << "  Mtime: " << l->mtime;
+                    l->scanseqno = scanseqno;
+
+                    if (l->type == FOLDERNODE)
+                    {
+                        dirscanner->add(localpath);
+                    }
+                    else
+                    {
+                        localbytes += l->size;
+                    }
+                }
+                else
+                {
+                    // new or changed record: place in notification queue
+                    dirnotify->notify(DirNotify::DIREVENTS, NULL, localpath.data(), localpath.size(), true);
+                }
+            }
+
+            localpath.resize(t);
+        }
+    }
+
+    if (dirscanner->done())
+    {
+        dirscanner.reset();
+        initializing = false;
+        LOG_debug << "Initial scan finished. New / modified files: " << dirnotify->notifyq[DirNotify::DIREVENTS].size();
+    }
+    else if (n > DIRSCAN_BATCHES_PER_CALL)
+    {
+        // the workers won't wake us up for the batches left over
+        client->waiter->notify();
+    }
+    return true;
+}
+
+// check local path - if !localname, localpath is relative to l, with l == NULL
+// being the root of the sync
+// if localname is set, localpath is absolute and localname its last component
+// path references a new FOLDERNODE: returns created node
+// path references a existing FILENODE: returns node
+// otherwise, returns NULL
+LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, dstime *backoffds, bool wejustcreatedthisfolder)
+{
+    LocalNode* ll = l;
+    bool newnode = false, changed = false;
+    bool isroot;
+
+    LocalNode* parent;
+    string path;        // UTF-8 representation of tmppath
+    string tmppath;     // full path represented by l + localpath
+    string newname;     // portion of tmppath not covered by the existing
+                        // LocalNode structure (always the last path component
+                        // that does not have a corresponding LocalNode yet)
+    FileFingerprint movefp;
+    LocalNode* moved;
+
+    if (localname)
+    {
+        // shortcut case (from within syncdown())
+        isroot = false;
+        parent = l;
+        l = NULL;
+
+        client->fsaccess->local2path(localpath, &path);
+        assert(path.size());
+    }
+    else
+    {
+        // construct full filesystem path in tmppath
+        if (l)
+        {
+            l->getlocalpath(&tmppath);
+        }
+
+        if (localpath->size())
+        {
+            if (tmppath.size())
+            {
+                tmppath.append(client->fsaccess->localseparator);
+            }
+
+            tmppath.append(*localpath);
+        }
+
+        // look up deepest existing LocalNode by path, store remainder (if any)
+        // in newname
+        LocalNode *tmp = localnodebypath(l, localpath, &parent, &newname);
+
+        size_t index = 0;
+        while ((index = newname.find(client->fsaccess->localseparator, index)) != string::npos)
+        {
+            if(!(index % client->fsaccess->localseparator.size()))
+            {
+                string utf8newname;
+                client->fsaccess->local2path(&newname, &utf8newname);
+                LOG_warn << "Parent not detected yet. Unknown reminder: " << utf8newname;
+                string parentpath = localpath->substr(0, localpath->size() - newname.size() + index);
+                dirnotify->notify(DirNotify::DIREVENTS, l, parentpath.data(), parentpath.size(), true);
+                return NULL;
+            }
+
+            LOG_debug << "Skipping invalid separator detection";
+            index++;
+        }
+
+        l = tmp;
+
+        client->fsaccess->local2path(&tmppath, &path);
+
+        // path invalid?
+        if ( ( !l && !newname.size() ) || !path.size())
+        {
+            LOG_warn << "Invalid path: " << path;
+            return NULL;
+        }
+
+        string name = newname.size() ? newname : l->name;
+        client->fsaccess->local2name(&name);
+
+        if (!client->app->sync_syncable(this, name.c_str(), &tmppath))
+        {
+            LOG_debug << "Excluded: " << path;
+            return NULL;
+        }
+
+        isroot = l == localroot.get() && !newname.size();
+    }
+
+    LOG_verbose << "Scanning: " << path;
+
+    // postpone moving nodes into nonexistent parents
+    if (parent && !parent->node)
+    {
+        LOG_warn << "Parent doesn't exist yet: " << path;
+        return (LocalNode*)~0;
+    }
+
+    // attempt to open/type this file
+    auto fa = client->fsaccess->newfileaccess(false);
+
+    if (initializing || fullscan)
+    {
+        // find corresponding LocalNode by file-/foldername
+        size_t lastpart = client->fsaccess->lastpartlocal(localname ? localpath : &tmppath);
+
+        string fname(localname ? *localpath : tmppath,
+                     lastpart,
+                     (localname ? *localpath : tmppath).size() - lastpart);
+
+        LocalNode* cl = (parent ? parent : localroot.get())->childbyname(&fname);
+        if (initializing && cl)
+        {
+            // the file seems to be still in the folder
+            // mark as present to prevent deletions if the file is not accesible
+            // in that case, the file would be checked again after the initialization
+            cl->deleted = false;
+            cl->setnotseen(0);
+            l->scanseqno = scanseqno;
+        }
+
+        // match cached LocalNode state during initial/rescan to prevent costly re-fingerprinting
+        // (just compare the fsids, sizes and mtimes to detect changes)
+        if (fa->fopen(localname ? localpath : &tmppath, false, false))
+        {
+            if (cl && fa->fsidvalid && fa->fsid == cl->fsid)
+            {
+                // node found and same file
+                l = cl;
+                l->deleted = false;
+                l->setnotseen(0);
+
+                // if it's a file, size and mtime must match to qualify
+                if (l->type != FILENODE || (l->size == fa->size && l->mtime == fa->mtime))
+                {
+                    LOG_verbose << "Cached localnode is still valid. Type: " << l->type << "  Size: " << l->size << "  Mtime: " << l->mtime;
+                    l->scanseqno = scanseqno;
+
+                    if (l->type == FOLDERNODE)
+                    {
+                        scan(localname ? localpath : &tmppath, fa.get());
+                    }
+                    else
+                    {
+                        localbytes += l->size;
+                    }
+
+                    return l;
+                }
+            }
+        }
+        else
+        {
+            LOG_warn << "Error opening file during the initialization: " << path;
+        }
+
+        if (initializing)
+        {
+            if (cl)
+            {
+                LOG_verbose << "Outdated localnode. Type: " << cl->type << "  Size: " << cl->size << "  Mtime: " << cl->mtime
+                            << "    FaType: " << fa->type << "  FaSize: " << fa->size << "  FaMtime: " << fa->mtime;
+            }
+            else
+            {
+                LOG_verbose << "New file. FaType: " << fa->type << "  FaSize: " << fa->size << "  FaMtime: " << fa->mtime;
+            }
+            return NULL;
+        }
+
+        fa = client->fsaccess->newfileaccess(false);
+    }
+
+    if (fa->fopen(localname ? localpath : &tmppath, true, false))
     {
         if (!isroot)
         {
@@ -1449,7 +2007,8 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, d
 
                             m_off_t dsize = l->size > 0 ? l->size : 0;
 
-                            if (l->genfingerprint(fa.get()) && l->size >= 0)
+                            // notified as changed: read it again, which refreshes the fingerprint cache
+                            if (genfingerprint(l, fa.get(), localname ? *localpath : tmppath, false) && l->size >= 0)
                             {
                                 localbytes -= dsize - l->size;
                             }
@@ -1661,6 +2220,30 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, d
                     LOG_debug << "checked path is a symlink.  Parent: " << (parent ? parent->name : "NO");
                     //doing nothing for the moment
                 }
+                else if (fa->type == FILENODE
+                         && client->localsyncmovecandidates.count(std::make_pair(fa->size, fa->mtime))
+                         && (client->genfingerprint(&movefp, fa.get(), localname ? *localpath : tmppath), movefp.isvalid)
+                         && (moved = client->findmovedlocalnode(this, movefp, false)))
+                {
+                    // no fsid match (or no stable fsids at all), but the content of a file
+                    // that vanished from this sync: re-link it rather than uploading it again
+                    LOG_debug << client->clientname << "Move detected by fingerprint in checkpath. New path: " << path << " old localnode: " << moved->localnodedisplaypath(*client->fsaccess);
+
+                    client->app->syncupdate_local_move(this, moved, path.c_str());
+
+                    moved->setnameparent(parent, localname ? localpath : &tmppath);
+
+                    if (fa->fsidvalid)
+                    {
+                        moved->setfsid(fa->fsid, client->fsidnode);
+                    }
+
+                    client->updateputs();
+
+                    statecacheadd(moved);
+
+                    moved->setnotseen(0);
+                }
                 else
                 {
                     // this is a new node: add
@@ -1719,7 +2302,7 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, d
                         localbytes -= l->size;
                     }
 
-                    if (l->genfingerprint(fa.get()))
+                    if (genfingerprint(l, fa.get(), localname ? *localpath : tmppath))
                     {
                         changed = true;
                         l->bumpnagleds();
@@ -1801,11 +2384,85 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, d
     return l;
 }
 
+// queue the files of the pending notifications for fingerprinting on the prefetcher thread
+void Sync::prefetchfingerprints()
+{
+    if (!client->syncprefetchdepth || (state != SYNC_ACTIVE && state != SYNC_INITIALSCAN))
+    {
+        prefetcher.reset();
+        return;
+    }
+
+    if (!prefetcher)
+    {
+        prefetcher.reset(new SyncFingerprintPrefetcher(client->syncprefetchfsaccess, client->syncprefetchdepth, client->waiter));
+    }
+
+    // only what procscanq() would scan now: the files of later notifications may still be being written
+    dstime dsmin = Waiter::ds - SCANNING_DELAY_DS;
+    size_t n = 0;
+    string localpath;
+    for (const Notification& notification : dirnotify->notifyq[DirNotify::DIREVENTS])
+    {
+        if (notification.timestamp > dsmin || n++ >= client->syncprefetchdepth)
+        {
+            break;
+        }
+
+        if (notification.localnode == (LocalNode*)~0)
+        {
+            continue;
+        }
+
+        // the path checkpath() builds
+        localpath.clear();
+        if (notification.localnode)
+        {
+            notification.localnode->getlocalpath(&localpath);
+        }
+        if (notification.path.size())
+        {
+            if (localpath.size())
+            {
+                localpath.append(client->fsaccess->localseparator);
+            }
+            localpath.append(notification.path);
+        }
+
+        if (!prefetcher->add(localpath))
+        {
+            break;
+        }
+    }
+}
+
+// fingerprint a file, taking the prefetched result if there is one
+bool Sync::genfingerprint(FileFingerprint* fp, FileAccess* fa, const string& localpath, bool usecache)
+{
+    FileFingerprint prefetched;
+    if (prefetcher && prefetcher->take(localpath, *fa, &prefetched))
+    {
+        prefetchedfingerprints++;
+
+        bool changed = !fp->isvalid || fp->size != prefetched.size || fp->mtime != prefetched.mtime || fp->crc != prefetched.crc;
+        *fp = prefetched;
+        if (client->fpcache && fa->fsidvalid)
+        {
+            client->fpcache->put(fa->fsid, localpath, *fp);
+        }
+        return changed;
+    }
+
+    return client->genfingerprint(fp, fa, localpath, usecache);
+}
+
 // add or refresh local filesystem item from scan stack, add items to scan stack
 // returns 0 if a parent node is missing, ~0 if control should be yielded, or the time
 // until a retry should be made (500 ms minimum latency).
 dstime Sync::procscanq(int q)
 {
+    CodeCounter::TraceSpan span("sync", "sync procscanq");
+
     size_t t = dirnotify->notifyq[q].size();
     dstime dsmin = Waiter::ds - SCANNING_DELAY_DS;
     LocalNode* l;
@@ -1822,7 +2479,14 @@ dstime Sync::procscanq(int q)
 
         if ((l = dirnotify->notifyq[q].front().localnode) != (LocalNode*)~0)
         {
+            if (l)
+            {
+                l->setsyncdirty();
+            }
+
             dstime backoffds = 0;
+            dstime notifiedds = dirnotify->notifyq[q].front().timestamp;
+            bool closewrite = dirnotify->notifyq[q].front().closewrite;
             l = checkpath(l, &dirnotify->notifyq[q].front().path, NULL, &backoffds);
             if (backoffds)
             {
@@ -1840,6 +2504,21 @@ dstime Sync::procscanq(int q)
                 LOG_verbose << "Scanning deferred";
                 return 0;
             }
+
+            if (l)
+            {
+                l->setsyncdirty();
+
+                if (l->type == FILENODE)
+                {
+                    l->notifiedds = notifiedds;
+
+                    if (closewrite)
+                    {
+                        l->closewritten();
+                    }
+                }
+            }
         }
         else
         {
@@ -1900,6 +2579,11 @@ void Sync::deletemissing(LocalNode* l)
 }
 
 bool Sync::movetolocaldebris(string* localpath)
+{
+    return moveToLocalDebris(*client->fsaccess, localdebris, localpath);
+}
+
+bool moveToLocalDebris(FileSystemAccess& fsaccess, string localdebris, string* localpath)
 {
     size_t t = localdebris.size();
     char buf[32];
@@ -1913,7 +2597,7 @@ bool Sync::movetolocaldebris(string* localpath)
         if (i == -2 || i > 95)
         {
             LOG_verbose << "Creating local debris folder";
-            client->fsaccess->mkdirlocal(&localdebris, true);
+            fsaccess.mkdirlocal(&localdebris, true);
         }
 
         sprintf(buf, "%04d-%02d-%02d", ptm->tm_year + 1900, ptm->tm_mon + 1, ptm->tm_mday);
@@ -1924,37 +2608,37 @@ bool Sync::movetolocaldebris(string* localpath)
         }
 
         day = buf;
-        client->fsaccess->path2local(&day, &localday);
+        fsaccess.path2local(&day, &localday);
 
-        localdebris.append(client->fsaccess->localseparator);
+        localdebris.append(fsaccess.localseparator);
         localdebris.append(localday);
 
         if (i > -3)
         {
             LOG_verbose << "Creating daily local debris folder";
-            havedir = client->fsaccess->mkdirlocal(&localdebris, false) || client->fsaccess->target_exists;
+            havedir = fsaccess.mkdirlocal(&localdebris, false) || fsaccess.target_exists;
         }
 
-        localdebris.append(client->fsaccess->localseparator);
-        localdebris.append(*localpath, client->fsaccess->lastpartlocal(localpath), string::npos);
+        localdebris.append(fsaccess.localseparator);
+        localdebris.append(*localpath, fsaccess.lastpartlocal(localpath), string::npos);
 
-        client->fsaccess->skip_errorreport = i == -3;  // we expect a problem on the first one when the debris folders or debris day folders don't exist yet
-        if (client->fsaccess->renamelocal(localpath, &localdebris, false))
+        fsaccess.skip_errorreport = i == -3;  // we expect a problem on the first one when the debris folders or debris day folders don't exist yet
+        if (fsaccess.renamelocal(localpath, &localdebris, false))
         {
-            client->fsaccess->skip_errorreport = false;
+            fsaccess.skip_errorreport = false;
             localdebris.resize(t);
             return true;
         }
-        client->fsaccess->skip_errorreport = false;
+        fsaccess.skip_errorreport = false;
 
         localdebris.resize(t);
 
-        if (client->fsaccess->transient_error)
+        if (fsaccess.transient_error)
         {
             return false;
         }
 
-        if (havedir && !client->fsaccess->target_exists)
+        if (havedir && !fsaccess.target_exists)
         {
             return false;
         }
@@ -1962,5 +2646,370 @@ bool Sync::movetolocaldebris(string* localpath)
 
     return false;
 }
+
+SyncDebrisQueue::SyncDebrisQueue(std::function<FileSystemAccess*()> newfsaccess, unsigned threads, Waiter* w)
+    : waiter(w)
+{
+    try
+    {
+        while (workers.size() < threads)
+        {
+            std::unique_ptr<Worker> worker(new Worker);
+            worker->fsaccess.reset(newfsaccess());
+            worker->thread = std::thread(&SyncDebrisQueue::workerLoop, this, worker.get());
+            workers.push_back(std::move(worker));
+        }
+    }
+    catch (std::system_error& e)
+    {
+        LOG_warn << "Started " << workers.size() << " of " << threads << " local debris threads: " << e.what();
+    }
+
+    if (workers.empty())
+    {
+        inlinefsaccess.reset(newfsaccess());
+    }
+}
+
+SyncDebrisQueue::~SyncDebrisQueue()
+{
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+
+    for (auto& worker : workers)
+    {
+        worker->thread.join();
+    }
+}
+
+unsigned SyncDebrisQueue::threads() const
+{
+    return unsigned(workers.size());
+}
+
+void SyncDebrisQueue::add(LocalNode* localnode, const string& localpath, const string& localdebris, const FileFingerprint* fingerprint)
+{
+    Op op;
+    op.localnode = localnode;
+    op.localpath = localpath;
+    op.localdebris = localdebris;
+    op.isfile = fingerprint != nullptr;
+    if (fingerprint)
+    {
+        op.fingerprint = *fingerprint;
+    }
+
+    if (workers.empty())
+    {
+        // no threads could be started: move it right here
+        Result result{ localnode, localpath, move(*inlinefsaccess, op) };
+        std::lock_guard<std::mutex> g(mutex);
+        finished.push_back(std::move(result));
+        return;
+    }
+
+    // the same path always goes to the same thread
+    Worker* worker = workers[std::hash<string>()(localpath) % workers.size()].get();
+
+    std::lock_guard<std::mutex> g(mutex);
+    worker->queued.push_back(std::move(op));
+    pending++;
+    workAvailable.notify_all();
+}
+
+void SyncDebrisQueue::forget(LocalNode* localnode)
+{
+    std::lock_guard<std::mutex> g(mutex);
+    for (auto& worker : workers)
+    {
+        if (worker->current == localnode)
+        {
+            worker->current = nullptr;
+        }
+        for (auto& op : worker->queued)
+        {
+            if (op.localnode == localnode)
+            {
+                op.localnode = nullptr;
+            }
+        }
+    }
+    for (auto& result : finished)
+    {
+        if (result.localnode == localnode)
+        {
+            result.localnode = nullptr;
+        }
+    }
+}
+
+bool SyncDebrisQueue::next(Result& result)
+{
+    std::lock_guard<std::mutex> g(mutex);
+    while (!finished.empty())
+    {
+        result = std::move(finished.front());
+        finished.pop_front();
+        if (result.localnode)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SyncDebrisQueue::idle()
+{
+    std::lock_guard<std::mutex> g(mutex);
+    return !pending && finished.empty();
+}
+
+void SyncDebrisQueue::workerLoop(Worker* worker)
+{
+    for (;;)
+    {
+        Op op;
+        {
+            std::unique_lock<std::mutex> g(mutex);
+            workAvailable.wait(g, [this, worker]() { return stopping || !worker->queued.empty(); });
+            if (stopping)
+            {
+                return;
+            }
+
+            op = std::move(worker->queued.front());
+            worker->queued.pop_front();
+            worker->current = op.localnode;
+        }
+
+        result_t r = move(*worker->fsaccess, op);
+
+        {
+            std::lock_guard<std::mutex> g(mutex);
+            if (worker->current)
+            {
+                finished.push_back(Result{ worker->current, std::move(op.localpath), r });
+            }
+            worker->current = nullptr;
+            pending--;
+        }
+
+        if (waiter)
+        {
+            waiter->notify();
+        }
+    }
+}
+
+SyncDebrisQueue::result_t SyncDebrisQueue::move(FileSystemAccess& fsaccess, Op& op)
+{
+    if (op.isfile)
+    {
+        // only delete the file if it is unchanged
+        auto fa = fsaccess.newfileaccess(false);
+        if (fa->fopen(&op.localpath, true, false))
+        {
+            FileFingerprint fp;
+            fp.genfingerprint(fa.get());
+
+            if (!(fp == op.fingerprint))
+            {
+                return CHANGED;
+            }
+        }
+    }
+
+    string localpath = op.localpath;
+    if (moveToLocalDebris(fsaccess, op.localdebris, &localpath))
+    {
+        return MOVED;
+    }
+    return fsaccess.transient_error ? TRANSIENT : FAILED;
+}
+
+SyncFingerprintPrefetcher::SyncFingerprintPrefetcher(std::function<FileSystemAccess*()> newfsaccess, size_t d, Waiter* w)
+    : depth(d)
+    , waiter(w)
+    , fsaccess(newfsaccess())
+{
+    try
+    {
+        thread = std::thread(&SyncFingerprintPrefetcher::workerLoop, this);
+    }
+    catch (std::system_error& e)
+    {
+        LOG_warn << "Could not start the fingerprint prefetching thread: " << e.what();
+    }
+}
+
+SyncFingerprintPrefetcher::~SyncFingerprintPrefetcher()
+{
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+bool SyncFingerprintPrefetcher::threaded() const
+{
+    return thread.joinable();
+}
+
+size_t SyncFingerprintPrefetcher::size()
+{
+    std::lock_guard<std::mutex> g(mutex);
+    return results.size();
+}
+
+bool SyncFingerprintPrefetcher::idle()
+{
+    std::lock_guard<std::mutex> g(mutex);
+    for (auto& r : results)
+    {
+        if (!r.second.done)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SyncFingerprintPrefetcher::add(const string& localpath)
+{
+    std::lock_guard<std::mutex> g(mutex);
+    if (!thread.joinable())
+    {
+        return false;
+    }
+
+    if (results.count(localpath))
+    {
+        return true;
+    }
+
+    if (results.size() >= depth)
+    {
+        // make room by dropping the oldest fingerprint that nobody took (the paths that were taken are skipped)
+        while (!resultorder.empty())
+        {
+            auto it = results.find(resultorder.front());
+            if (it != results.end() && !it->second.done)
+            {
+                // the oldest one is still queued or being read: so are the others
+                return false;
+            }
+
+            resultorder.pop_front();
+            if (it != results.end())
+            {
+                results.erase(it);
+                break;
+            }
+        }
+
+        if (results.size() >= depth)
+        {
+            return false;
+        }
+    }
+
+    results[localpath];
+    resultorder.push_back(localpath);
+    queued.push_back(localpath);
+    workAvailable.notify_one();
+    return true;
+}
+
+bool SyncFingerprintPrefetcher::take(const string& localpath, const FileAccess& fa, FileFingerprint* fingerprint)
+{
+    std::lock_guard<std::mutex> g(mutex);
+    auto it = results.find(localpath);
+    if (it == results.end())
+    {
+        return false;
+    }
+
+    // not read yet: the caller reads it now, and the thread drops what it reads
+    Result r = std::move(it->second);
+    results.erase(it);
+
+    if (!r.done || !r.isfile || fa.type != FILENODE
+            || r.size != fa.size || r.mtime != fa.mtime
+            || r.fsidvalid != fa.fsidvalid || (fa.fsidvalid && r.fsid != fa.fsid)
+            || !r.fingerprint.isvalid)
+    {
+        return false;
+    }
+
+    *fingerprint = r.fingerprint;
+    return true;
+}
+
+void SyncFingerprintPrefetcher::workerLoop()
+{
+    for (;;)
+    {
+        string localpath;
+        {
+            std::unique_lock<std::mutex> g(mutex);
+            workAvailable.wait(g, [this]() { return stopping || !queued.empty(); });
+            if (stopping)
+            {
+                return;
+            }
+
+            localpath = std::move(queued.front());
+            queued.pop_front();
+            if (!results.count(localpath))
+            {
+                // taken or dropped before it was read
+                continue;
+            }
+        }
+
+        Result result;
+        read(localpath, &result);
+
+        {
+            std::lock_guard<std::mutex> g(mutex);
+            auto it = results.find(localpath);
+            if (it != results.end() && !it->second.done)
+            {
+                it->second = std::move(result);
+            }
+        }
+
+        if (waiter)
+        {
+            waiter->notify();
+        }
+    }
+}
+
+void SyncFingerprintPrefetcher::read(const string& localpath, Result* result)
+{
+    // opened the way Sync::checkpath() opens them
+    string path = localpath;
+    auto fa = fsaccess->newfileaccess(false);
+    if (fa->fopen(&path, true, false) && fa->type == FILENODE)
+    {
+        result->isfile = true;
+        result->size = fa->size;
+        result->mtime = fa->mtime;
+        result->fsid = fa->fsid;
+        result->fsidvalid = fa->fsidvalid;
+        result->fingerprint.genfingerprint(fa.get());
+    }
+    result->done = true;
+}
 } // namespace
 #endif
@@ -29,6 +29,7 @@
 #include "mega/mediafileattribute.h"
 #include "megawaiter.h"
 #include "mega/utils.h"
+#include <cmath>
 
 namespace mega {
 
@@ -91,6 +92,8 @@ Transfer::Transfer(MegaClient* cclient, direction_t ctype)
 // delete transfer with underlying slot, notify files
 Transfer::~Transfer()
 {
+    client->tcdirty.erase(this);
+
     if (faputcompletion_it != client->faputcompletion.end())
     {
         client->faputcompletion.erase(faputcompletion_it);
@@ -118,6 +121,18 @@ Transfer::~Transfer()
         delete slot;
     }
 
+    dropunackedchunks();
+    if (uploadhandle)
+    {
+        client->reusedfa.erase(uploadhandle);
+    }
+
+    if (partialcheck)
+    {
+        delete partialcheck;
+        client->partialchecks--;
+    }
+
     if (asyncopencontext)
     {
         delete asyncopencontext;
@@ -199,6 +214,12 @@ bool Transfer::serialize(string *d)
     d->append((const char*)&s, sizeof(s));
     d->append((const char*)&priority, sizeof(priority));
     d->append("", 1);
+
+    // after the version byte, so that older versions still read the record (and download the folded chunks again)
+    if (chunkmacs.foldedpos)
+    {
+        chunkmacs.serializefolded(*d);
+    }
     return true;
 }
 
@@ -351,6 +372,13 @@ Transfer *Transfer::unserialize(MegaClient *client, string *d, transfer_map* tra
     }
     ptr++;
 
+    if (ptr < end && !t->chunkmacs.unserializefolded(ptr, end))
+    {
+        LOG_err << "Transfer unserialization failed - invalid chunk mac checkpoint";
+        delete t;
+        return NULL;
+    }
+
     t->chunkmacs.calcprogress(t->size, t->pos, t->progresscompleted);
 
     transfers[type].insert(pair<FileFingerprint*, Transfer*>(t, t));
@@ -363,16 +391,75 @@ SymmCipher *Transfer::transfercipher()
     return &client->tmptransfercipher;
 }
 
-void Transfer::removeTransferFile(error e, File* f, DBTableTransactionCommitter* committer)
+void Transfer::removeTransferFile(error e, File* f, DBTableTransactionCommitter* committer, vector<uint32_t>* batch)
 {
     Transfer *transfer = f->transfer;
-    client->filecachedel(f, committer);
+    client->filecachedel(f, committer, batch);
     transfer->files.erase(f->file_it);
     client->app->file_removed(f, e);
     f->transfer = NULL;
     f->terminated();
 }
 
+void Transfer::keepunackedchunk(HttpReqUL* req, m_time_t mtime)
+{
+    bool unacked = req->status == REQ_PREPARED || req->status == REQ_INFLIGHT || req->status == REQ_FAILURE;
+    if (!unacked || !req->body || req->bodyend <= req->bodypos
+            || client->memorypressure != MEMORY_PRESSURE_NONE)
+    {
+        return;
+    }
+
+    if (mtime != unackedmtime)
+    {
+        dropunackedchunks();
+        unackedmtime = mtime;
+    }
+
+    size_t bytes = req->bodycapacity;
+    if (client->unackedchunkbytes + bytes > client->maxunackedchunkbytes || unackedchunks.count(req->bodypos))
+    {
+        return;
+    }
+
+    // curl must be done reading the body
+    req->disconnect();
+
+    unique_ptr<HttpReqUL> kept(new HttpReqUL);
+    kept->bufferpool = req->bufferpool;
+    kept->swapbody(*req);
+    unackedchunks[kept->bodypos] = std::move(kept);
+    unackedbytes += bytes;
+    client->unackedchunkbytes += bytes;
+}
+
+unique_ptr<HttpReqUL> Transfer::takeunackedchunk(m_off_t pos, m_off_t npos, m_time_t mtime)
+{
+    unique_ptr<HttpReqUL> req;
+    if (mtime != unackedmtime)
+    {
+        dropunackedchunks();
+        return req;
+    }
+
+    auto it = unackedchunks.find(pos);
+    if (it != unackedchunks.end() && it->second->bodyend == npos)
+    {
+        req = std::move(it->second);
+        unackedchunks.erase(it);
+        unackedbytes -= req->bodycapacity;
+        client->unackedchunkbytes -= req->bodycapacity;
+    }
+    return req;
+}
+
+void Transfer::dropunackedchunks()
+{
+    client->unackedchunkbytes -= unackedbytes;
+    unackedbytes = 0;
+    unackedchunks.clear();
+}
+
 bool Transfer::isForeign()
 {
     if (files.empty())
@@ -573,6 +660,17 @@ void Transfer::addAnyMissingMediaFileAttributes(Node* node, /*const*/ std::strin
             // if we don't have the codec id mappings yet, send the request
             client->mediaFileInfo.requestCodecMappingsOneTime(client, NULL);
 
+            if (client->gfx)
+            {
+                // extracted on the gfx threads, which queue or send the result like below
+                client->gfx->genmediaproperties(&localpath, (type == PUT) ? uploadhandle : node->nodehandle, attrKey, type == PUT);
+                if (type == PUT)
+                {
+                    minfa++;
+                }
+                return;
+            }
+
             // always get the attribute string; it may indicate this version of the mediaInfo library was unable to interpret the file
             MediaProperties vp;
             vp.extractMediaPropertyFileAttributes(localpath, client->fsaccess);
@@ -720,9 +818,13 @@ void Transfer::complete(DBTableTransactionCommitter& committer)
                                 && fingerprint.size == this->size)
                         {
                             LOG_debug << "Fixing fingerprint";
+
+                            // the fingerprint is the key the node is hashed by
+                            client->mFingerprints.remove(n);
                             *(FileFingerprint*)n = fingerprint;
+                            client->mFingerprints.add(n);
 
-                            n->serializefingerprint(&n->attrs.map['c']);
+                            n->serializefingerprint(&n->attrs().map['c']);
                             client->setattr(n);
                         }
                     }
@@ -903,7 +1005,7 @@ void Transfer::complete(DBTableTransactionCommitter& committer)
                             keys.insert(n->nodekey());
 
                             // check if restoration of missing attributes failed in the past (no access)
-                            if (n->attrs.map.find('f') == n->attrs.map.end() || n->attrs.map['f'] != me64)
+                            if (n->attrs().map.find('f') == n->attrs().map.end() || n->attrs().map['f'] != me64)
                             {
                                 // check for missing imagery
                                 int missingattr = 0;
@@ -1068,7 +1170,7 @@ void Transfer::complete(DBTableTransactionCommitter& committer)
         }
 
 
-        if (!client->gfxdisabled)
+        if (!client->gfxdisabled && !reusedmedia)
         {
             // prepare file attributes for video/audio files if the file is suitable
             addAnyMissingMediaFileAttributes(NULL, localfilename);
@@ -1107,6 +1209,56 @@ void Transfer::completefiles()
     ids.push_back(dbid);
 }
 
+m_off_t StreamingScheduler::bitrateof(m_off_t size, uint32_t playtime)
+{
+    return (size > 0 && playtime) ? size / playtime : 0;
+}
+
+void StreamingScheduler::update(BandwidthShaper& shaper, m_off_t downloadspeed, size_t streams, m_off_t bitrate, bool behind, dstime now)
+{
+    // the best recent speed, forgotten by half in about half a minute
+    if (measured && now > measured)
+    {
+        linkcapacity *= pow(0.98, (now - measured) / 10.0);
+    }
+    measured = now;
+    linkcapacity = std::max(linkcapacity, double(downloadspeed));
+    activestreams = streams;
+
+    m_off_t wanted = 0;
+    if (behind && linkcapacity > 0)
+    {
+        // a quarter over the bitrates lets the streams catch up
+        wanted = std::max(m_off_t(linkcapacity) - bitrate - bitrate / 4, m_off_t(MIN_BACKGROUND_SPEED));
+    }
+
+    // the bucket starts over on every change: follow the capacity only once it moved by an eighth
+    m_off_t delta = wanted > limit ? wanted - limit : limit - wanted;
+    if (!wanted != !limit || delta > limit / 8)
+    {
+        LOG_debug << "Background download limit for streaming: " << wanted << " (streams: " << streams
+                  << " bitrate: " << bitrate << " capacity: " << m_off_t(linkcapacity) << ")";
+        limit = wanted;
+        shaper.setbackgroundlimit(limit);
+    }
+}
+
+m_off_t StreamingScheduler::minspeed(m_off_t bitrate) const
+{
+    m_off_t speed = DirectReadSlot::MIN_BYTES_PER_SECOND;
+    if (bitrate)
+    {
+        // a slot this slow on a link that can do better is worth another try
+        speed = std::max(speed, std::min(bitrate / 2, m_off_t(linkcapacity) / 2));
+    }
+    if (activestreams > 1 && linkcapacity > 0)
+    {
+        // streams sharing the link don't retry each other below their fair share of it
+        speed = std::min(speed, m_off_t(linkcapacity) / m_off_t(2 * activestreams));
+    }
+    return speed;
+}
+
 DirectReadNode::DirectReadNode(MegaClient* cclient, handle ch, bool cp, SymmCipher* csymmcipher, int64_t cctriv, const char *privauth, const char *pubauth, const char *cauth)
 {
     client = cclient;
@@ -1184,6 +1336,9 @@ void DirectReadNode::dispatch()
 // abort all active reads, remove pending reads and reschedule with app-supplied backoff
 void DirectReadNode::retry(error e, dstime timeleft)
 {
+    // the read ahead has no app to report to
+    delete prefetchread;
+
     if (reads.empty())
     {
         LOG_warn << "Removing DirectReadNode. No reads to retry.";
@@ -1262,12 +1417,7 @@ void DirectReadNode::cmdresult(error e, dstime timeleft)
             DirectRead* dr = *it;
             assert(dr->drq_it == client->drq.end());
 
-            if (dr->drbuf.tempUrlVector().empty())
-            {
-                // DirectRead starting
-                dr->drbuf.setIsRaid(dr->drn->tempurls, dr->offset, dr->offset + dr->count, dr->drn->size, 2097152);  // 2 MB max buffer usage approx for streaming
-            }
-            else
+            if (!dr->drbuf.tempUrlVector().empty())
             {
                 // URLs have been re-requested, eg. due to temp URL expiry.  Keep any parts downloaded already
                 dr->drbuf.updateUrlsAndResetPos(dr->drn->tempurls);
@@ -1302,9 +1452,120 @@ void DirectReadNode::schedule(dstime deltads)
     }
 }
 
-void DirectReadNode::enqueue(m_off_t offset, m_off_t count, int reqtag, void* appdata)
+bool DirectReadNode::streamingbehind(dstime now) const
+{
+    return bitrate && streambytes < bitrate * (m_off_t(now - streamstart) / 10 + StreamingScheduler::BUFFER_SECONDS);
+}
+
+void DirectReadNode::enqueue(m_off_t offset, m_off_t count, int reqtag, void* appdata, m_off_t maxleased)
+{
+    if (offset != streampos)
+    {
+        // playback (re)starts here
+        streamstart = Waiter::ds;
+        streambytes = 0;
+    }
+    streampos = offset + count;
+
+    DirectRead* dr = new DirectRead(this, count, offset, reqtag, appdata);
+    if (maxleased > 0)
+    {
+        dr->leases = std::make_shared<DirectReadLeases>(maxleased, client->waiter);
+    }
+    readahead(offset, count);
+}
+
+void DirectReadNode::readahead(m_off_t offset, m_off_t count)
 {
-    new DirectRead(this, count, offset, reqtag, appdata);
+    size_t limit = client->directreadlimit();
+    if (!limit)
+    {
+        return;
+    }
+
+    bool sequential = offset == lastreadend;
+    readaheadwindow = sequential ? std::min(std::max(readaheadwindow * 2, 2 * READAHEAD_BURST), READAHEAD_MAX) : READAHEAD_BURST;
+    readaheadwindow = std::min<m_off_t>(readaheadwindow, limit / 2);
+    lastreadend = offset + count;
+
+    if (prefetchread && !sequential && !prefetching(offset))
+    {
+        // the app went elsewhere
+        delete prefetchread;
+    }
+
+    // the size is known once the first read got its URLs
+    if (prefetchread || !size)
+    {
+        return;
+    }
+
+    m_off_t start = lastreadend;
+    for (auto it = cached.upper_bound(start); it != cached.begin() && (--it)->first + m_off_t(it->second.size()) > start; it = cached.upper_bound(start))
+    {
+        start = it->first + m_off_t(it->second.size());
+    }
+
+    m_off_t end = std::min(lastreadend + readaheadwindow, size);
+    if (start < end)
+    {
+        LOG_debug << "Streaming readahead from " << start << " to " << end;
+        prefetchread = new DirectRead(this, end - start, start, 0, nullptr);
+        prefetchread->prefetch = true;
+    }
+}
+
+bool DirectReadNode::prefetching(m_off_t pos) const
+{
+    return prefetchread && pos >= prefetchread->offset + prefetchread->progress && pos < prefetchread->offset + prefetchread->count;
+}
+
+void DirectReadNode::cachepiece(m_off_t pos, const byte* data, size_t len)
+{
+    size_t limit = client->directreadlimit();
+    if (len > limit)
+    {
+        return;
+    }
+
+    // keep what is there already, and store only the part in front of it
+    auto it = cached.upper_bound(pos);
+    if (it != cached.begin())
+    {
+        auto prev = std::prev(it);
+        if (prev->first + m_off_t(prev->second.size()) > pos)
+        {
+            return;
+        }
+    }
+    if (it != cached.end() && it->first < pos + m_off_t(len))
+    {
+        len = size_t(it->first - pos);
+    }
+    if (!len)
+    {
+        return;
+    }
+
+    cached[pos].assign((const char*)data, len);
+    cachedbytes += len;
+    trimcache(limit, pos);
+}
+
+// drop the pieces furthest from where the reads are now
+void DirectReadNode::trimcache(size_t limit, m_off_t pos)
+{
+    if (pos < 0)
+    {
+        pos = std::max<m_off_t>(streampos, 0);
+    }
+
+    while (cachedbytes > limit)
+    {
+        auto victim = pos - cached.begin()->first > cached.rbegin()->first - pos ? cached.begin() : std::prev(cached.end());
+        cachedbytes -= victim->second.size();
+        cached.erase(victim);
+    }
 }
 
 bool DirectReadSlot::processAnyOutputPieces()
@@ -1317,7 +1578,26 @@ bool DirectReadSlot::processAnyOutputPieces()
         speed = speedController.calculateSpeed();
         meanSpeed = speedController.getMeanSpeed();
         dr->drn->client->httpio->updatedownloadspeed(len);
-        continueDirectRead = dr->drn->client->app->pread_data(outputPiece->buf.datastart(), len, pos, speed, meanSpeed, dr->appdata);
+        if (dr->drn->client->directreadlimit())
+        {
+            dr->drn->cachepiece(pos, outputPiece->buf.datastart(), len);
+        }
+        if (dr->drn->client->streamingblockcache)
+        {
+            dr->cacheblocks(pos, outputPiece->buf.datastart(), len);
+        }
+        if (dr->prefetch)
+        {
+            continueDirectRead = true;
+        }
+        else if (dr->leases)
+        {
+            continueDirectRead = dr->lend(outputPiece->buf, pos, speed, meanSpeed);
+        }
+        else
+        {
+            continueDirectRead = dr->drn->client->app->pread_data(outputPiece->buf.datastart(), len, pos, speed, meanSpeed, dr->appdata);
+        }
 
         dr->drbuf.bufferWriteCompleted(0, true);
 
@@ -1325,6 +1605,7 @@ bool DirectReadSlot::processAnyOutputPieces()
         {
             pos += len;
             dr->drn->partiallen += len;
+            dr->drn->streambytes += len;
             dr->progress += len;
         }
     }
@@ -1333,6 +1614,15 @@ bool DirectReadSlot::processAnyOutputPieces()
 
 bool DirectReadSlot::doio()
 {
+    if (dr->held())
+    {
+        // leave the data with the connections until the app gives some back, without counting it as a stall
+        dr->drn->partiallen = 0;
+        dr->drn->partialstarttime = Waiter::ds;
+        dr->drn->schedule(DirectReadSlot::TIMEOUT_DS);
+        return false;
+    }
+
     for (unsigned connectionNum = unsigned(reqs.size()); connectionNum--; )
     {
         HttpReq* req = reqs[connectionNum];
@@ -1352,7 +1642,7 @@ bool DirectReadSlot::doio()
                 if (n)
                 {
 
-                    RaidBufferManager::FilePiece* np = new RaidBufferManager::FilePiece(req->pos, n);
+                    RaidBufferManager::FilePiece* np = new RaidBufferManager::FilePiece(req->pos, n, dr->drbuf.bufferpool);
                     memcpy(np->buf.datastart(), req->in.data(), n);
 
                     req->in.erase(0, n);
@@ -1476,10 +1766,10 @@ bool DirectReadSlot::doio()
             m_off_t meanspeed = (10 * dr->drn->partiallen) / (Waiter::ds - dr->drn->partialstarttime);
 
             LOG_debug << "Mean speed (B/s): " << meanspeed;
-            int minspeed = dr->drn->client->minstreamingrate;
+            m_off_t minspeed = dr->drn->client->minstreamingrate;
             if (minspeed < 0)
             {
-                minspeed = MIN_BYTES_PER_SECOND;
+                minspeed = dr->drn->client->streamingscheduler.minspeed(dr->drn->bitrate);
             }
             if (minspeed != 0 && meanspeed < minspeed)
             {
@@ -1511,6 +1801,80 @@ void DirectRead::abort()
     }
 }
 
+bool DirectRead::servecached()
+{
+    StreamingBlockCache* blockcache = drn->client->streamingblockcache.get();
+    string block;
+
+    while (progress < count)
+    {
+        m_off_t pos = offset + progress;
+        const byte* data;
+        m_off_t len;
+
+        auto it = drn->cached.upper_bound(pos);
+        if (it != drn->cached.begin() && (--it)->first + m_off_t(it->second.size()) > pos)
+        {
+            data = (const byte*)it->second.data() + (pos - it->first);
+            len = it->first + m_off_t(it->second.size()) - pos;
+        }
+        else if (blockcache && blockcache->get(drn->h, pos / StreamingBlockCache::BLOCKSIZE, drn->symmcipher, drn->ctriv, block))
+        {
+            m_off_t blockstart = pos - pos % StreamingBlockCache::BLOCKSIZE;
+            if (blockstart + m_off_t(block.size()) <= pos)
+            {
+                break;
+            }
+            data = (const byte*)block.data() + (pos - blockstart);
+            len = blockstart + m_off_t(block.size()) - pos;
+        }
+        else
+        {
+            break;
+        }
+
+        if (held())
+        {
+            break;
+        }
+
+        len = std::min(len, count - progress);
+        if (blockcache)
+        {
+            blockcache->served(len);
+        }
+
+        bool delivered;
+        if (leases)
+        {
+            // the cache keeps its copy
+            RaidBufferManager::FilePiece piece(pos, size_t(len), drn->client->bufferpool);
+            memcpy(piece.buf.datastart(), data, size_t(len));
+            delivered = lend(piece.buf, pos, 0, 0);
+        }
+        else
+        {
+            delivered = drn->client->app->pread_data((byte*)data, len, pos, 0, 0, appdata);
+        }
+
+        if (!delivered)
+        {
+            delete this;
+            return true;
+        }
+        progress += len;
+    }
+
+    if (count && progress >= count)
+    {
+        LOG_debug << "Streaming read served from cache: " << offset << " - " << offset + count;
+        drn->schedule(DirectReadSlot::TEMPURL_TIMEOUT_DS);
+        delete this;
+        return true;
+    }
+    return false;
+}
+
 DirectRead::DirectRead(DirectReadNode* cdrn, m_off_t ccount, m_off_t coffset, int creqtag, void* cappdata)
     : drbuf(this)
 {
@@ -1525,11 +1889,11 @@ DirectRead::DirectRead(DirectReadNode* cdrn, m_off_t ccount, m_off_t coffset, in
     drs = NULL;
 
     reads_it = drn->reads.insert(drn->reads.end(), this);
-    
+    drbuf.bufferpool = drn->client->bufferpool;
+
     if (!drn->tempurls.empty())
     {
         // we already have tempurl(s): queue for immediate fetching
-        drbuf.setIsRaid(drn->tempurls, offset, offset + count, drn->size, 2097152);  // 2 MB max buffer usage approx
         drq_it = drn->client->drq.insert(drn->client->drq.end(), this);
     }
     else
@@ -1543,12 +1907,226 @@ DirectRead::~DirectRead()
 {
     abort();
 
+    if (leases)
+    {
+        // pieces still lent outlive the read
+        std::lock_guard<std::mutex> g(leases->mutex);
+        leases->waiter = nullptr;
+    }
+
+    if (drn->prefetchread == this)
+    {
+        drn->prefetchread = nullptr;
+    }
+
     if (reads_it != drn->reads.end())
     {
         drn->reads.erase(reads_it);
     }
 }
 
+bool DirectRead::held() const
+{
+    return leases && leases->bytes >= leases->limit;
+}
+
+bool DirectRead::lend(HttpReq::http_buf_t& buf, m_off_t pos, m_off_t speed, m_off_t meanSpeed)
+{
+    DirectReadLease* lease = new DirectReadLease(pos, leases);
+    lease->buf.swap(buf);
+    leases->bytes += m_off_t(lease->buf.datalen());
+    return drn->client->app->pread_lease(lease, speed, meanSpeed, appdata);
+}
+
+DirectReadLeases::DirectReadLeases(m_off_t l, Waiter* w)
+    : bytes(0)
+    , limit(l)
+    , waiter(w)
+{
+}
+
+DirectReadLease::DirectReadLease(m_off_t p, std::shared_ptr<DirectReadLeases> l)
+    : pos(p)
+    , buf(NULL, 0, 0)
+    , leases(std::move(l))
+{
+}
+
+DirectReadLease::~DirectReadLease()
+{
+    leases->bytes -= m_off_t(buf.datalen());
+
+    std::lock_guard<std::mutex> g(leases->mutex);
+    if (leases->waiter)
+    {
+        leases->waiter->notify();
+    }
+}
+
+void DirectRead::cacheblocks(m_off_t pos, const byte* data, size_t len)
+{
+    const m_off_t bs = StreamingBlockCache::BLOCKSIZE;
+
+    if (blockpos < 0 || pos != blockpos + m_off_t(blockdata.size()))
+    {
+        // start over at the next block boundary
+        m_off_t next = (pos + bs - 1) / bs * bs;
+        blockdata.clear();
+        blockpos = -1;
+        if (next >= pos + m_off_t(len))
+        {
+            return;
+        }
+        data += next - pos;
+        len -= size_t(next - pos);
+        blockpos = next;
+    }
+
+    blockdata.append((const char*)data, len);
+
+    for (;;)
+    {
+        size_t blocklen = size_t(std::min(blockpos + bs, drn->size) - blockpos);
+        if (!blocklen || blockdata.size() < blocklen)
+        {
+            break;
+        }
+        drn->client->streamingblockcache->put(drn->h, blockpos / bs, drn->symmcipher, drn->ctriv, (const byte*)blockdata.data(), blocklen);
+        blockdata.erase(0, blocklen);
+        blockpos += blocklen;
+    }
+}
+
+StreamingBlockCache::StreamingBlockCache(FileSystemAccess& fs, const string& localfolder, m_off_t max)
+    : fsaccess(fs)
+    , folder(localfolder)
+    , maxbytes(max)
+{
+    fsaccess.mkdirlocal(&folder);
+
+    // the blocks of an earlier cache are not indexed: delete them
+    std::unique_ptr<DirAccess> da(fsaccess.newdiraccess());
+    string localpath = folder;
+    string localname;
+    std::vector<string> stale;
+    if (da->dopen(&localpath, NULL, false))
+    {
+        while (da->dnext(&localpath, &localname, false))
+        {
+            stale.push_back(folder + fsaccess.localseparator + localname);
+        }
+    }
+    for (auto& path : stale)
+    {
+        fsaccess.unlinklocal(&path);
+    }
+}
+
+StreamingBlockCache::~StreamingBlockCache()
+{
+    while (!blocks.empty())
+    {
+        remove(blocks.begin());
+    }
+}
+
+void StreamingBlockCache::blockpath(const BlockKey& key, string& localpath) const
+{
+    char name[64];
+    sprintf(name, "%016" PRIx64 "_%" PRIu64, key.first, uint64_t(key.second));
+
+    string utf8name = name;
+    string localname;
+    fsaccess.path2local(&utf8name, &localname);
+    localpath = folder + fsaccess.localseparator + localname;
+}
+
+bool StreamingBlockCache::get(handle h, m_off_t block, SymmCipher& key, int64_t ctriv, string& data)
+{
+    auto it = blocks.find(BlockKey(h, block));
+    string localpath;
+    if (it != blocks.end())
+    {
+        blockpath(it->first, localpath);
+        auto fa = fsaccess.newfileaccess();
+
+        // room for the padding of the last cipher block
+        data.resize(it->second.size + SymmCipher::BLOCKSIZE);
+        if (fa->fopen(&localpath, true, false) && fa->size == m_off_t(it->second.size)
+                && fa->frawread((byte*)data.data(), unsigned(it->second.size), 0, true))
+        {
+            key.ctr_crypt((byte*)data.data(), unsigned(it->second.size), block * BLOCKSIZE, ctriv, NULL, false);
+            data.resize(it->second.size);
+            lru.splice(lru.begin(), lru, it->second.lru);
+            counters.hits++;
+            return true;
+        }
+
+        LOG_warn << "Unreadable streaming cache block: " << localpath;
+        remove(it);
+    }
+
+    counters.misses++;
+    return false;
+}
+
+void StreamingBlockCache::put(handle h, m_off_t block, SymmCipher& key, int64_t ctriv, const byte* data, size_t len)
+{
+    BlockKey bk(h, block);
+    if (!len || m_off_t(len) > maxbytes || blocks.find(bk) != blocks.end())
+    {
+        return;
+    }
+
+    string encrypted((const char*)data, len);
+    encrypted.resize(len + SymmCipher::BLOCKSIZE);
+    key.ctr_crypt((byte*)encrypted.data(), unsigned(len), block * BLOCKSIZE, ctriv, NULL, true);
+
+    string localpath;
+    blockpath(bk, localpath);
+    auto fa = fsaccess.newfileaccess();
+    if (!fa->fopen(&localpath, false, true) || !fa->fwrite((const byte*)encrypted.data(), unsigned(len), 0))
+    {
+        LOG_warn << "Unable to write streaming cache block: " << localpath;
+        fa.reset();
+        fsaccess.unlinklocal(&localpath);
+        return;
+    }
+    fa.reset();
+
+    lru.push_front(bk);
+    blocks[bk] = Entry{ len, lru.begin() };
+    counters.bytesStored += len;
+    counters.blocks++;
+
+    while (m_off_t(counters.bytesStored) > maxbytes)
+    {
+        remove(blocks.find(lru.back()));
+    }
+}
+
+void StreamingBlockCache::remove(std::map<BlockKey, Entry>::iterator it)
+{
+    string localpath;
+    blockpath(it->first, localpath);
+    fsaccess.unlinklocal(&localpath);
+
+    counters.bytesStored -= it->second.size;
+    counters.blocks--;
+    lru.erase(it->second.lru);
+    blocks.erase(it);
+}
+
+void StreamingBlockCache::served(m_off_t bytes)
+{
+    counters.bytesSaved += bytes;
+}
+
+StreamingBlockCache::Stats StreamingBlockCache::stats() const
+{
+    return counters;
+}
+
 std::string DirectReadSlot::adjustURLPort(std::string url)
 {
     if (!memcmp(url.c_str(), "http:", 5))
@@ -1595,6 +2173,7 @@ DirectReadSlot::DirectReadSlot(DirectRead* cdr)
         reqs.push_back(new HttpReq(true));
         reqs.back()->status = REQ_READY;
         reqs.back()->type = REQ_BINARY;
+        reqs.back()->shapinggroup = BandwidthShaper::STREAMING_GROUP;
     }
 
     drs_it = dr->drn->client->drss.insert(dr->drn->client->drss.end(), this);
@@ -1660,6 +2239,11 @@ void TransferList::addtransfer(Transfer *transfer, DBTableTransactionCommitter&
 
 void TransferList::removetransfer(Transfer *transfer)
 {
+    if (transfers[transfer->type].empty())
+    {
+        return;
+    }
+
     transfer_list::iterator it = iterator(transfer);
     if (it != transfers[transfer->type].end())
     {
@@ -1761,19 +2345,8 @@ void TransferList::movetransfer(transfer_list::iterator it, transfer_list::itera
     if (prevpriority == newpriority)
     {
         LOG_warn << "There is no space for the move. Adjusting priorities.";
-        int positions = dstindex;
-        uint64_t fixedPriority = transfers[transfer->type][0]->priority - PRIORITY_STEP * (positions + 1);
-        for (int i = 0; i < positions; i++)
-        {
-            Transfer *t = transfers[transfer->type][i];
-            LOG_debug << "Adjusting priority of transfer " << i << " to " << fixedPriority;
-            t->priority = fixedPriority;
-            client->transfercacheadd(t, &committer);
-            client->app->transfer_update(t);
-            fixedPriority += PRIORITY_STEP;
-        }
-        newpriority = fixedPriority;
-        LOG_debug << "Fixed priority: " << fixedPriority;
+        newpriority = makeroom(transfer, size_t(srcindex), size_t(dstindex), committer);
+        LOG_debug << "Fixed priority: " << newpriority;
     }
 
     transfer->priority = newpriority;
@@ -1940,6 +2513,26 @@ transfer_list::iterator TransferList::iterator(Transfer *transfer)
     return transfers[transfer->type].end();
 }
 
+vector<Transfer*> TransferList::readytransfers(direction_t direction)
+{
+    vector<Transfer*> ready;
+    for (Transfer *transfer : transfers[direction])
+    {
+        if ((!transfer->slot && isReady(transfer))
+            || (transfer->asyncopencontext
+                && transfer->asyncopencontext->finished))
+        {
+            ready.push_back(transfer);
+        }
+    }
+
+    if (client->transferscheduler)
+    {
+        client->transferscheduler->order(direction, ready, client->tslots);
+    }
+    return ready;
+}
+
 std::array<vector<Transfer*>, 6> TransferList::nexttransfers(std::function<bool(Transfer*)>& continuefunction)
 {
     std::array<vector<Transfer*>, 6> chosenTransfers;
@@ -1948,43 +2541,179 @@ std::array<vector<Transfer*>, 6> TransferList::nexttransfers(std::function<bool(
 
     for (direction_t direction : putget)
     {
-        for (Transfer *transfer : transfers[direction])
+        bool continueLarge = true;
+        bool continueSmall = true;
+
+        for (Transfer *transfer : readytransfers(direction))
         {
-            bool continueLarge = true;
-            bool continueSmall = true;
+            TransferCategory tc(transfer);
 
-            if ((!transfer->slot && isReady(transfer))
-                || (transfer->asyncopencontext
-                    && transfer->asyncopencontext->finished))
+            if (tc.sizetype == LARGEFILE && continueLarge)
             {
-                TransferCategory tc(transfer);
-                
-                if (tc.sizetype == LARGEFILE && continueLarge)
+                continueLarge = continuefunction(transfer);
+                if (continueLarge)
                 {
-                    continueLarge = continuefunction(transfer);
-                    if (continueLarge)
-                    {
-                        chosenTransfers[tc.index()].push_back(transfer);
-                    }
-                }
-                else if (tc.sizetype == SMALLFILE && continueSmall)
-                {
-                    continueSmall = continuefunction(transfer);
-                    if (continueSmall)
-                    {
-                        chosenTransfers[tc.index()].push_back(transfer);
-                    }
+                    chosenTransfers[tc.index()].push_back(transfer);
                 }
-                if (!continueLarge && !continueSmall)
+            }
+            else if (tc.sizetype == SMALLFILE && continueSmall)
+            {
+                continueSmall = continuefunction(transfer);
+                if (continueSmall)
                 {
-                    break;
+                    chosenTransfers[tc.index()].push_back(transfer);
                 }
             }
+            if (!continueLarge && !continueSmall)
+            {
+                break;
+            }
         }
     }
     return chosenTransfers;
 }
 
+void FairTransferScheduler::setweight(int group, unsigned weight)
+{
+    configs[group].weight = std::max(weight, 1u);
+}
+
+void FairTransferScheduler::setminspeed(int group, m_off_t speed)
+{
+    configs[group].minspeed = std::max<m_off_t>(speed, 0);
+}
+
+void FairTransferScheduler::setfastlane(m_off_t maxsize, unsigned slots)
+{
+    fastlanesize = maxsize;
+    fastlaneslots = slots;
+}
+
+int FairTransferScheduler::groupof(const Transfer* t)
+{
+    return t->files.empty() ? 0 : t->files.front()->schedulinggroup;
+}
+
+double FairTransferScheduler::cost(const Transfer* t) const
+{
+    auto it = configs.find(groupof(t));
+    return double(t->size - t->progresscompleted + FILE_OVERHEAD) / (it == configs.end() ? 1 : it->second.weight);
+}
+
+void FairTransferScheduler::order(direction_t direction, vector<Transfer*>& transfers, const transferslot_list& active)
+{
+    vector<Transfer*> ordered;
+    ordered.reserve(transfers.size());
+
+    // the fast lane, in priority order; the slots it already uses count
+    unsigned fastlane = fastlaneslots;
+    for (const TransferSlot* ts : active)
+    {
+        if (fastlane && ts->transfer->type == direction && ts->transfer->size <= fastlanesize)
+        {
+            fastlane--;
+        }
+    }
+
+    // queue per group, in priority order
+    std::map<int, std::deque<Transfer*>> queues;
+    for (Transfer* t : transfers)
+    {
+        if (fastlane && t->size <= fastlanesize)
+        {
+            ordered.push_back(t);
+            fastlane--;
+        }
+        else
+        {
+            queues[groupof(t)].push_back(t);
+        }
+    }
+
+    // active groups keep their virtual time even with nothing queued
+    std::map<int, m_off_t> speeds;
+    for (const TransferSlot* ts : active)
+    {
+        if (ts->transfer->type == direction)
+        {
+            speeds[groupof(ts->transfer)] += ts->speed;
+            queues[groupof(ts->transfer)];
+        }
+    }
+
+    // groups that left forget their virtual time, groups that join start at the lowest one of those present
+    std::map<int, double>& vt = virtualtimes[direction];
+    for (auto it = vt.begin(); it != vt.end(); )
+    {
+        it = queues.count(it->first) ? std::next(it) : vt.erase(it);
+    }
+    if (!vt.empty())
+    {
+        systemtime[direction] = std::min_element(vt.begin(), vt.end(), [](const std::pair<const int, double>& a, const std::pair<const int, double>& b)
+            {
+                return a.second < b.second;
+            })->second;
+    }
+    for (auto& q : queues)
+    {
+        vt.emplace(q.first, systemtime[direction]);
+    }
+
+    // groups short of their minimum speed, the furthest behind first: one transfer each
+    vector<std::pair<double, int>> behind;
+    for (auto& q : queues)
+    {
+        auto it = configs.find(q.first);
+        if (!q.second.empty() && it != configs.end() && speeds[q.first] < it->second.minspeed)
+        {
+            behind.emplace_back(double(speeds[q.first]) / it->second.minspeed, q.first);
+        }
+    }
+    std::sort(behind.begin(), behind.end());
+    for (auto& b : behind)
+    {
+        auto& q = queues[b.second];
+        ordered.push_back(q.front());
+        q.pop_front();
+    }
+
+    // the rest by virtual finish time, assuming each one is started (started() makes the charge real)
+    std::map<int, double> finish = vt;
+    typedef std::pair<double, int> Entry;
+    std::priority_queue<Entry, vector<Entry>, std::greater<Entry>> next;
+    for (auto& q : queues)
+    {
+        if (!q.second.empty())
+        {
+            next.emplace(finish[q.first] + cost(q.second.front()), q.first);
+        }
+    }
+    while (!next.empty())
+    {
+        Entry e = next.top();
+        next.pop();
+
+        auto& q = queues[e.second];
+        ordered.push_back(q.front());
+        q.pop_front();
+        finish[e.second] = e.first;
+
+        if (!q.empty())
+        {
+            next.emplace(e.first + cost(q.front()), e.second);
+        }
+    }
+
+    transfers.swap(ordered);
+}
+
+void FairTransferScheduler::started(Transfer* t)
+{
+    std::map<int, double>& vt = virtualtimes[t->type];
+    auto it = vt.emplace(groupof(t), systemtime[t->type]).first;
+    it->second = std::max(it->second, systemtime[t->type]) + cost(t);
+}
+
 Transfer *TransferList::transferat(direction_t direction, unsigned int position)
 {
     if (transfers[direction].size() > position)
@@ -1994,6 +2723,79 @@ Transfer *TransferList::transferat(direction_t direction, unsigned int position)
     return NULL;
 }
 
+// no priority is left between the transfers around dstindex: spread out the priorities of the smallest window
+// of the list around it (aligned, doubling) that is sparse enough, leaving a gap before dstindex, whose priority
+// is returned.  Each doubling halves the spacing required, so that dense windows are spread before they fill up
+// and renumbering costs O(log n) transfers amortised.  The moving transfer (at srcindex) is left as it is
+uint64_t TransferList::makeroom(Transfer *transfer, size_t srcindex, size_t dstindex, DBTableTransactionCommitter& committer)
+{
+    transfer_list& list = transfers[transfer->type];
+    const size_t n = list.size();
+    for (unsigned level = 0; ; level++)
+    {
+        size_t w = size_t(1) << level;
+        size_t lo = dstindex / w * w;
+        size_t hi = std::min(lo + w, n);
+
+        // the transfers of the window, and the gap
+        uint64_t slots = hi - lo + 1 - (srcindex >= lo && srcindex < hi);
+        uint64_t spacing = std::max<uint64_t>(PRIORITY_STEP >> std::min(level, 63u), 2);
+
+        // the ends of the list have all the room needed
+        uint64_t low, high;
+        if (lo && hi < n)
+        {
+            low = list[lo - 1]->priority;
+            high = list[hi]->priority;
+            if ((high - low) / (slots + 1) < spacing)
+            {
+                continue;
+            }
+        }
+        else if (lo)
+        {
+            low = list[lo - 1]->priority;
+            high = low + (slots + 1) * PRIORITY_STEP;
+        }
+        else if (hi < n)
+        {
+            high = list[hi]->priority;
+            low = high - (slots + 1) * PRIORITY_STEP;
+        }
+        else
+        {
+            low = list[0]->priority - PRIORITY_STEP;
+            high = low + (slots + 1) * PRIORITY_STEP;
+        }
+
+        uint64_t step = (high - low) / (slots + 1);
+        uint64_t priority = low;
+        uint64_t gap = 0;
+        LOG_debug << "Adjusting priorities of transfers " << lo << " to " << hi;
+        for (size_t i = lo; i < hi; i++)
+        {
+            if (i == dstindex)
+            {
+                gap = priority += step;
+            }
+
+            if (i != srcindex)
+            {
+                Transfer *t = list[i];
+                t->priority = priority += step;
+                client->transfercacheadd(t, &committer);
+                client->app->transfer_update(t);
+            }
+        }
+
+        if (hi == n && priority > currentpriority)
+        {
+            currentpriority = priority;
+        }
+        return gap;
+    }
+}
+
 void TransferList::prepareIncreasePriority(Transfer *transfer, transfer_list::iterator /*srcit*/, transfer_list::iterator dstit, DBTableTransactionCommitter& committer)
 {
     if (dstit == transfers[transfer->type].end())
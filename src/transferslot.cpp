@@ -29,6 +29,7 @@
 #include "mega/utils.h"
 #include "mega/logging.h"
 #include "mega/raid.h"
+#include "mega/workerpool.h"
 
 namespace mega {
 
@@ -62,17 +63,357 @@ const dstime TransferSlot::PROGRESSTIMEOUT = 10;
 // max request size for downloads
 #if defined(__ANDROID__) || defined(USE_IOS) || defined(WINDOWS_PHONE)
     const m_off_t TransferSlot::MAX_REQ_SIZE = 2097152; // 2 MB
+    const m_off_t TransferSlot::MAX_ADAPTIVE_REQ_SIZE = 2097152; // 2 MB
 #elif defined (_WIN32) || defined(HAVE_AIO_RT)
     const m_off_t TransferSlot::MAX_REQ_SIZE = 16777216; // 16 MB
+    const m_off_t TransferSlot::MAX_ADAPTIVE_REQ_SIZE = 16777216; // 16 MB
 #else
     const m_off_t TransferSlot::MAX_REQ_SIZE = 4194304; // 4 MB
+    // only once a connection has shown a large bandwidth-delay product
+    const m_off_t TransferSlot::MAX_ADAPTIVE_REQ_SIZE = 16777216; // 16 MB
 #endif
 
+const int RequestSizeController::REQUEST_ROUNDTRIPS;
+const size_t RequestSizeController::BANDWIDTH_SAMPLES;
+const size_t RequestSizeController::RTT_SAMPLES;
+
+void RequestSizeController::posted(clock::time_point t)
+{
+    postedAt = t;
+    inflight = true;
+    firstByte = false;
+}
+
+void RequestSizeController::received(clock::time_point t, m_off_t bytes)
+{
+    if (inflight && !firstByte && bytes > 0)
+    {
+        firstByteAt = t;
+        firstByte = true;
+    }
+}
+
+void RequestSizeController::completed(clock::time_point t, m_off_t bytes)
+{
+    if (!inflight)
+    {
+        return;
+    }
+    inflight = false;
+
+    // without progress in between, the whole response counts as transfer time and the round trip is unknown
+    clock::time_point start = firstByte ? firstByteAt : postedAt;
+    int64_t rttus = firstByte ? std::chrono::duration_cast<std::chrono::microseconds>(firstByteAt - postedAt).count() : -1;
+    int64_t transferus = std::chrono::duration_cast<std::chrono::microseconds>(t - start).count();
+    sample(bytes, rttus, transferus);
+}
+
+void RequestSizeController::sample(m_off_t bytes, int64_t rttus, int64_t transferus)
+{
+    if (rttus >= 0)
+    {
+        rtts.push_back(rttus);
+        if (rtts.size() > RTT_SAMPLES)
+        {
+            rtts.pop_front();
+        }
+    }
+
+    if (bytes > 0 && transferus > 0)
+    {
+        bandwidths.push_back(m_off_t(bytes * 1000000 / transferus));
+        if (bandwidths.size() > BANDWIDTH_SAMPLES)
+        {
+            bandwidths.pop_front();
+        }
+    }
+}
+
+m_off_t RequestSizeController::nextRequestSize(m_off_t fallback, m_off_t ceiling) const
+{
+    if (bandwidths.empty() || rtts.empty())
+    {
+        return std::min(fallback, ceiling);
+    }
+
+    m_off_t bandwidth = *std::max_element(bandwidths.begin(), bandwidths.end());
+    int64_t rtt = std::max<int64_t>(*std::min_element(rtts.begin(), rtts.end()), 1000);
+
+    // compare before multiplying out, the product can be huge for a fast link
+    if (double(bandwidth) * rtt * REQUEST_ROUNDTRIPS / 1000000 >= double(ceiling))
+    {
+        return ceiling;
+    }
+    return m_off_t(bandwidth * rtt * REQUEST_ROUNDTRIPS / 1000000);
+}
+
+const unsigned UploadReadahead::BLOCKSIZE;
+
+UploadReadahead::UploadReadahead(FileSystemAccess* fsaccess, const string& localname, m_off_t s, m_time_t mtime, m_off_t pos,
+                                 size_t w, std::shared_ptr<BufferPool> p, Waiter* wr)
+    : size(s)
+    , window(w)
+    , blocksize(unsigned(std::min<size_t>(w, BLOCKSIZE)))
+    , pool(std::move(p))
+    , waiter(wr)
+    , reading(pos)
+    , next(pos)
+{
+    reader = std::thread(&UploadReadahead::readLoop, this, fsaccess, localname, mtime);
+}
+
+UploadReadahead::~UploadReadahead()
+{
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        stopping = true;
+    }
+    moreWanted.notify_one();
+    reader.join();
+
+    while (!blocks.empty())
+    {
+        release(blocks.begin());
+    }
+}
+
+void UploadReadahead::release(std::map<m_off_t, Block>::iterator it)
+{
+    buffered -= it->second.len;
+    pool->put(it->second.buf, it->second.capacity);
+    blocks.erase(it);
+}
+
+void UploadReadahead::readLoop(FileSystemAccess* fsaccess, string localname, m_time_t mtime)
+{
+    std::unique_ptr<FileAccess> fa = fsaccess->newfileaccess();
+    bool opened = fa->fopen(&localname, true, false) && fa->size == size && fa->mtime == mtime;
+
+    std::unique_lock<std::mutex> g(mutex);
+    failed = !opened;
+    while (opened && !stopping)
+    {
+        if (buffered >= window || next >= size)
+        {
+            moreWanted.wait(g);
+            continue;
+        }
+
+        Block b;
+        m_off_t pos = reading = next;
+        b.len = unsigned(std::min<m_off_t>(blocksize, size - pos));
+        b.taken = 0;
+        next = pos + b.len;
+        g.unlock();
+
+        fa->freadahead(pos, m_off_t(window));
+        b.buf = pool->get(b.len, b.capacity);
+        bool ok = fa->frawread(b.buf, b.len, pos, true);
+
+        g.lock();
+        reading = next;
+        if (!ok)
+        {
+            LOG_warn << "Upload readahead failed at " << pos;
+            pool->put(b.buf, b.capacity);
+            failed = true;
+            break;
+        }
+
+        blocks[pos] = b;
+        buffered += b.len;
+        waiter->notify();
+    }
+
+    if (failed)
+    {
+        // the connections waiting for blocks read directly instead
+        waiter->notify();
+    }
+}
+
+UploadReadahead::result_t UploadReadahead::take(byte* dst, unsigned len, m_off_t pos)
+{
+    std::lock_guard<std::mutex> g(mutex);
+    m_off_t end = pos + len;
+
+    // blocks left behind (the ranges of resumed uploads that are sent already, or retried reads) make room for the next ones
+    while (!blocks.empty() && blocks.begin()->first + m_off_t(blocks.begin()->second.len) + m_off_t(window) <= pos)
+    {
+        release(blocks.begin());
+    }
+
+    // how far the blocks from pos on cover the range
+    std::map<m_off_t, Block>::iterator it = blocks.upper_bound(pos);
+    if (it != blocks.begin())
+    {
+        --it;
+    }
+    std::map<m_off_t, Block>::iterator first = it;
+    m_off_t covered = pos;
+    while (covered < end && it != blocks.end() && it->first <= covered && it->first + m_off_t(it->second.len) > covered)
+    {
+        covered = it->first + it->second.len;
+        ++it;
+    }
+
+    if (covered >= end)
+    {
+        for (m_off_t p = pos; p < end; )
+        {
+            Block& b = first->second;
+            unsigned offset = unsigned(p - first->first);
+            unsigned n = unsigned(std::min<m_off_t>(b.len - offset, end - p));
+            memcpy(dst + (p - pos), b.buf + offset, n);
+            b.taken += n;
+            p += n;
+
+            std::map<m_off_t, Block>::iterator done = first++;
+            if (done->second.taken >= done->second.len)
+            {
+                release(done);
+            }
+        }
+        moreWanted.notify_one();
+        return READ;
+    }
+
+    // the reader gets there soon: it's on it, or has room in the window to go on
+    if (!failed && covered >= reading && covered < next + m_off_t(window) && (reading < next || buffered < window))
+    {
+        return PENDING;
+    }
+
+    if (end > next)
+    {
+        // the reader goes on after it
+        next = end;
+        moreWanted.notify_one();
+    }
+    return MISSED;
+}
+
+// lowers an index to i, if it is higher
+static void lowerto(std::atomic<unsigned>& index, unsigned i)
+{
+    unsigned current = index;
+    while (current > i && !index.compare_exchange_weak(current, i))
+    {
+    }
+}
+
+PartialDownloadCheck::PartialDownloadCheck(FileSystemAccess* fsaccess, const string& localname, m_off_t s, const byte* key,
+                                           int64_t iv, unsigned threads, Waiter* w)
+    : size(s)
+    , ctriv(iv)
+    , waiter(w)
+{
+    memcpy(transferkey, key, sizeof transferkey);
+
+    unsigned stride = std::max(threads, 1u);
+    try
+    {
+        checker = std::thread([this, fsaccess, localname, stride]()
+        {
+            WorkerPool::get().run(WorkerPool::WORK_FILES, stride, [&](size_t i)
+            {
+                checkLoop(fsaccess, localname, unsigned(i), stride);
+            });
+
+            done = true;
+            waiter->notify();
+        });
+    }
+    catch (std::system_error& e)
+    {
+        // nothing is taken from the file then
+        LOG_warn << "Unable to start the partial download check: " << e.what();
+        firstmissing = 0;
+        done = true;
+    }
+}
+
+PartialDownloadCheck::~PartialDownloadCheck()
+{
+    firstmissing = 0;
+    if (checker.joinable())
+    {
+        checker.join();
+    }
+}
+
+bool PartialDownloadCheck::finished() const
+{
+    return done;
+}
+
+void PartialDownloadCheck::checkLoop(FileSystemAccess* fsaccess, string localname, unsigned first, unsigned stride)
+{
+    SymmCipher cipher;
+    cipher.setkey(transferkey);
+
+    std::unique_ptr<FileAccess> fa = fsaccess->newfileaccess();
+    m_off_t available = fa->fopen(&localname, true, false) ? std::min(fa->size, size) : 0;
+
+    std::vector<byte> buf;
+    unsigned index = 0;
+    for (m_off_t pos = 0; pos < size && index < firstmissing; pos = ChunkedHash::chunkceil(pos, size), index++)
+    {
+        if (index % stride != first)
+        {
+            continue;
+        }
+
+        m_off_t end = ChunkedHash::chunkceil(pos, size);
+        unsigned len = unsigned(end - pos);
+        bool present = end <= available;
+        if (present)
+        {
+            // zero padding for the MAC of a trailing partial block
+            buf.assign((len + SymmCipher::BLOCKSIZE - 1) & -SymmCipher::BLOCKSIZE, 0);
+            present = fa->frawread(buf.data(), len, pos, true)
+                    && std::any_of(buf.begin(), buf.begin() + len, [](byte b) { return b != 0; });
+        }
+
+        if (!present)
+        {
+            lowerto(firstmissing, index);
+            break;
+        }
+
+        ChunkMAC chunkmac;
+        chunkmac.finished = true;
+        cipher.ctr_crypt(buf.data(), len, pos, ctriv, chunkmac.mac, true);
+
+        std::lock_guard<std::mutex> g(mutex);
+        macs[pos] = chunkmac;
+    }
+}
+
+m_off_t PartialDownloadCheck::take(chunkmac_map* m)
+{
+    std::lock_guard<std::mutex> g(mutex);
+
+    // the chunks another thread read past the first missing one don't count
+    m_off_t end = 0;
+    for (auto& it : macs)
+    {
+        if (it.first != end)
+        {
+            break;
+        }
+        (*m)[end] = it.second;
+        end = ChunkedHash::chunkceil(end, size);
+    }
+    return end;
+}
+
 TransferSlot::TransferSlot(Transfer* ctransfer)
     : fa(ctransfer->client->fsaccess->newfileaccess(), ctransfer)
     , retrybt(ctransfer->client->rng, ctransfer->client->transferSlotsBackoff)
 {
     starttime = 0;
+    ttfbms = -1;
     lastprogressreport = 0;
     progressreported = 0;
     speed = meanSpeed = 0;
@@ -92,13 +433,19 @@ TransferSlot::TransferSlot(Transfer* ctransfer)
     asyncIO = NULL;
     pendingcmd = NULL;
 
+    targetconnections = 0;
+    probespeed = -1;
+    connectiongain = std::numeric_limits<m_off_t>::max();   // untried: worth a probe
+
     transfer = ctransfer;
     transfer->slot = this;
     transfer->state = TRANSFERSTATE_ACTIVE;
 
     slots_it = transfer->client->tslots.end();
+    transferbuf.bufferpool = transfer->client->bufferpool;
 
     maxRequestSize = MAX_REQ_SIZE;
+    maxAdaptiveRequestSize = MAX_ADAPTIVE_REQ_SIZE;
 #if defined(_WIN32) && !defined(WINDOWS_PHONE)
     MEMORYSTATUSEX statex;
     memset(&statex, 0, sizeof (statex));
@@ -131,12 +478,21 @@ TransferSlot::TransferSlot(Transfer* ctransfer)
         {
             maxRequestSize = 16777216; // 16 MB
         }
+
+        // the limit follows from the RAM available
+        maxAdaptiveRequestSize = maxRequestSize;
     }
     else
     {
         LOG_warn << "Error getting RAM usage info";
     }
 #endif
+
+    if (transfer->client->maxrequestsize)
+    {
+        // tuned for the link, within what the memory allows
+        maxRequestSize = std::min(transfer->client->maxrequestsize, maxAdaptiveRequestSize);
+    }
 }
 
 bool TransferSlot::createconnectionsonce()
@@ -153,10 +509,54 @@ bool TransferSlot::createconnectionsonce()
         LOG_debug << "Populating transfer slot with " << connections << " connections, max request size of " << maxRequestSize << " bytes";
         reqs = new HttpReqXfer*[connections]();
         asyncIO = new AsyncIOContext*[connections]();
+        requestSizers.resize(connections);
+        targetconnections = connections;
     }
     return true;
 }
 
+bool TransferSlot::autoconnectable() const
+{
+    return connections && !transferbuf.isRaid() && transfer->size > 131072;
+}
+
+// open connections up to targetconnections, and close the surplus ones that are idle (from the top, so indices stay valid)
+void TransferSlot::resizeconnections()
+{
+    if (targetconnections > connections)
+    {
+        HttpReqXfer** newreqs = new HttpReqXfer*[targetconnections]();
+        AsyncIOContext** newasyncIO = new AsyncIOContext*[targetconnections]();
+        std::copy(reqs, reqs + connections, newreqs);
+        std::copy(asyncIO, asyncIO + connections, newasyncIO);
+        delete[] reqs;
+        delete[] asyncIO;
+        reqs = newreqs;
+        asyncIO = newasyncIO;
+
+        LOG_debug << "Transfer connections: " << connections << " -> " << targetconnections;
+        connections = targetconnections;
+        requestSizers.resize(connections);
+        return;
+    }
+
+    while (connections > targetconnections)
+    {
+        int i = connections - 1;
+        if (asyncIO[i] || (reqs[i] && reqs[i]->status != REQ_READY && reqs[i]->status != REQ_DONE)
+                || transferbuf.getAsyncOutputBufferPointer(i) || transferbuf.outputPending(i))
+        {
+            break;
+        }
+
+        LOG_debug << "Transfer connections: " << connections << " -> " << i;
+        delete reqs[i];
+        reqs[i] = NULL;
+        connections = i;
+        requestSizers.resize(connections);
+    }
+}
+
 // delete slot and associated resources, but keep transfer intact (can be
 // reused on a new slot)
 TransferSlot::~TransferSlot()
@@ -190,6 +590,16 @@ TransferSlot::~TransferSlot()
                 asyncIO[i] = NULL;
             }
 
+            if (coalescedIO)
+            {
+                coalescedIO->finish();
+                LOG_verbose << "Async coalesced write " << (coalescedIO->failed ? "failed" : "succeeded");
+                transferbuf.coalescedWriteCompleted(!coalescedIO->failed);
+                cachetransfer |= !coalescedIO->failed;
+                delete coalescedIO;
+                coalescedIO = NULL;
+            }
+
             // Open the file in synchonous mode
             fa.reset(transfer->client->fsaccess->newfileaccess());
             if (!fa->fopen(&transfer->localfilename, false, true))
@@ -211,6 +621,8 @@ TransferSlot::~TransferSlot()
             }
         }
 
+        transferbuf.waitForPendingOutput();
+
         bool anyData = true;
         while (anyData)
         {
@@ -239,9 +651,23 @@ TransferSlot::~TransferSlot()
             }
         }
 
+        // and what was gathered for coalesced writes
+        transferbuf.flushCoalescedOutput();
+        while (TransferBufferManager::FilePiece* piece = transferbuf.getCoalescedOutputPointer())
+        {
+            bool written = fa && fa->fwrite(piece->buf.datastart(), static_cast<unsigned>(piece->buf.datalen()), piece->pos);
+            if (!written)
+            {
+                LOG_err << "Error caching coalesced data at: " << piece->pos;
+            }
+            cachetransfer |= written;
+            transferbuf.coalescedWriteCompleted(written);
+            transferbuf.flushCoalescedOutput();
+        }
+
         if (cachetransfer)
         {
-            transfer->client->transfercacheadd(transfer, nullptr);
+            transfer->client->transfercachedirty(transfer);
             LOG_debug << "Completed: " << transfer->progresscompleted;
         }
     }
@@ -274,9 +700,17 @@ TransferSlot::~TransferSlot()
 
     while (connections--)
     {
+        if (transfer->type == PUT && reqs[connections] && fa
+                && fa->mtime == transfer->mtime && fa->size == transfer->size)
+        {
+            // the encrypted chunks the server did not acknowledge, for the slot that retries this transfer
+            transfer->keepunackedchunk(static_cast<HttpReqUL*>(reqs[connections]), fa->mtime);
+        }
+
         delete asyncIO[connections];
         delete reqs[connections];
     }
+    delete coalescedIO;
 
     delete[] asyncIO;
     delete[] reqs;
@@ -320,7 +754,8 @@ void TransferSlot::disconnect()
 // coalesce block macs into file mac
 int64_t chunkmac_map::macsmac(SymmCipher *cipher)
 {
-    byte mac[SymmCipher::BLOCKSIZE] = { 0 };
+    byte mac[SymmCipher::BLOCKSIZE];
+    memcpy(mac, foldedmac, sizeof mac);
 
     for (chunkmac_map::iterator it = begin(); it != end(); it++)
     {
@@ -381,6 +816,7 @@ bool TransferSlot::checkTransferFinished(DBTableTransactionCommitter& committer,
 void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committer)
 {
     CodeCounter::ScopeTimer pbt(client->performanceStats.transferslotDoio);
+    MegaClient::ExecTracer::Phase etp(client->execTracer, MegaClient::ExecTracer::DOIO);
 
     if (!fa || (transfer->size && transfer->progresscompleted == transfer->size)
             || (transfer->type == PUT && transfer->ultoken))
@@ -430,6 +866,11 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
         return;
     }
 
+    if (targetconnections != connections)
+    {
+        resizeconnections();
+    }
+
     dstime backoff = 0;
     m_off_t p = 0;
 
@@ -439,6 +880,11 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
         return transfer->failed(lasterror, committer);
     }
 
+    if (transfer->type == GET && coalescedwritten(client, committer, backoff))
+    {
+        return;
+    }
+
     for (int i = connections; i--; )
     {
         if (reqs[i])
@@ -473,11 +919,26 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                 case REQ_INFLIGHT:
                     p += reqs[i]->transferred(client);
 
+                    if (ttfbms < 0 && reqs[i]->transferred(client))
+                    {
+                        firstdata();
+                    }
+
+                    if (transfer->type == GET && !transferbuf.isRaid())
+                    {
+                        requestSizers[i].received(RequestSizeController::clock::now(), reqs[i]->transferred(client));
+                    }
+
                     assert(reqs[i]->lastdata != NEVER);
                     if (transfer->type == GET && transferbuf.isRaid() && 
-                        (Waiter::ds - reqs[i]->lastdata) > (XFERTIMEOUT / 2) &&
+                        ((Waiter::ds - reqs[i]->lastdata) > (XFERTIMEOUT / 2) || client->storagehealth.avoided(reqs[i]->posturl, Waiter::ds)) &&
                         transferbuf.connectionRaidPeersAreAllPaused(i))
                     {
+                        if ((Waiter::ds - reqs[i]->lastdata) > (XFERTIMEOUT / 2))
+                        {
+                            samplehost(i, true);
+                        }
+
                         // switch to 5 channel raid to avoid the slow/delayed connection. (or if already switched, try a different 5).  If we already tried too many times then let the usual timeout occur
                         if (tryRaidRecoveryFromHttpGetError(i))
                         {
@@ -496,7 +957,20 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                     break;
 
                 case REQ_SUCCESS:
-                    if (client->orderdownloadedchunks && transfer->type == GET && !transferbuf.isRaid() && transfer->progresscompleted != static_cast<HttpReqDL*>(reqs[i])->dlpos)
+                    if (ttfbms < 0)
+                    {
+                        firstdata();
+                    }
+
+                    samplehost(i, false);
+
+                    if (transfer->type == GET && !transferbuf.isRaid())
+                    {
+                        // only the first time round counts, not when revisited for a postponed or buffered write
+                        requestSizers[i].completed(RequestSizeController::clock::now(), reqs[i]->size);
+                    }
+
+                    if (client->orderdownloadedchunks && transfer->type == GET && !transferbuf.isRaid() && transfer->progresscompleted + transferbuf.coalescedBytes() != static_cast<HttpReqDL*>(reqs[i])->dlpos)
                     {
                         // postponing unsorted chunk
                         p += reqs[i]->size;
@@ -559,7 +1033,7 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                                     ((int64_t*)transfer->filekey)[3] = macsmac(&transfer->chunkmacs);
                                     SymmCipher::xorblock(transfer->filekey + SymmCipher::KEYLENGTH, transfer->filekey);
 
-                                    client->transfercacheadd(transfer, &committer);
+                                    client->transfercachedirty(transfer);
 
                                     if (transfer->progresscompleted != progressreported)
                                     {
@@ -628,7 +1102,8 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
 
                         errorcount = 0;
                         transfer->failcount = 0;
-                        client->transfercacheadd(transfer, &committer);
+                        client->transfercachedirty(transfer);
+                        static_cast<HttpReqUL*>(reqs[i])->releasebody();
                         reqs[i]->status = REQ_READY;
                     }
                     else   // GET
@@ -644,7 +1119,28 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                             }
 
                             TransferBufferManager::FilePiece* outputPiece = transferbuf.getAsyncOutputBufferPointer(i);
-                            if (outputPiece)
+                            bool waitForFlush = false;
+                            if (outputPiece && client->coalesceddownloadwrites && !asyncIO[i]
+                                    && transferbuf.coalesceOutput(i, client->coalesceddownloadwrites, waitForFlush))
+                            {
+                                // gathered into a larger write, see writecoalesced()
+                                errorcount = 0;
+                                transfer->failcount = 0;
+                                reqs[i]->status = REQ_READY;
+
+                                if (client->orderdownloadedchunks && !transferbuf.isRaid())
+                                {
+                                    // Check connections again looking for postponed chunks
+                                    i = connections;
+                                    continue;
+                                }
+                            }
+                            else if (waitForFlush)
+                            {
+                                // this stays REQ_SUCCESS until the gathered data before it is written
+                                p += outputPiece->buf.datalen();
+                            }
+                            else if (outputPiece)
                             {
 
                                 if (fa->asyncavailable())
@@ -690,10 +1186,14 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                                         return;
                                     }
 
-                                    client->transfercacheadd(transfer, &committer);
+                                    client->transfercachedirty(transfer);
                                     reqs[i]->status = REQ_READY;
                                 }
                             }
+                            else if (transferbuf.outputPending(i))
+                            {
+                                // still being decrypted on the crypto pool.  This stays REQ_SUCCESS and the write starts once it's done
+                            }
                             else if (transferbuf.isRaid())
                             {
                                 reqs[i]->status = REQ_READY;  // this connection has retrieved a part of the file, but we don't have enough to combine yet for full file output.   This connection can start fetching the next piece of that part.
@@ -728,6 +1228,13 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                     }
                     break;
 
+                case REQ_ENCRYPTING:
+                    if (!transferbuf.inputPending(i, static_cast<HttpReqUL*>(reqs[i])))
+                    {
+                        reqs[i]->status = REQ_PREPARED;
+                    }
+                    break;
+
                 case REQ_ASYNCIO:
                     if (asyncIO[i]->finished)
                     {
@@ -748,12 +1255,18 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                                     }
                                 }
 
-                                reqs[i]->prepare(finaltempurl.c_str(), transfer->transfercipher(),
-                                         &transfer->chunkmacs, transfer->ctriv,
-                                         asyncIO[i]->pos, npos);
-
                                 reqs[i]->pos = ChunkedHash::chunkfloor(asyncIO[i]->pos);
-                                reqs[i]->status = REQ_PREPARED;
+                                if (transferbuf.encryptInput(i, static_cast<HttpReqUL*>(reqs[i]), finaltempurl, asyncIO[i]->pos, npos))
+                                {
+                                    reqs[i]->status = REQ_ENCRYPTING;
+                                }
+                                else
+                                {
+                                    reqs[i]->prepare(finaltempurl.c_str(), transfer->transfercipher(),
+                                             &transfer->chunkmacs, transfer->ctriv,
+                                             asyncIO[i]->pos, npos);
+                                    reqs[i]->status = REQ_PREPARED;
+                                }
                             }
                             else
                             {
@@ -769,7 +1282,7 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                                     return;
                                 }
 
-                                client->transfercacheadd(transfer, &committer);
+                                client->transfercachedirty(transfer);
                                 reqs[i]->status = REQ_READY;
 
                                 if (client->orderdownloadedchunks && !transferbuf.isRaid())
@@ -829,6 +1342,15 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                         return transfer->failed(API_EAGAIN, committer);
                     }
 
+                    if (reqs[i]->httpstatus != 509 && reqs[i]->httpstatus != 403 && reqs[i]->httpstatus != 404
+                            && samplehost(i, true) && transfer->type == GET && !transferbuf.isRaid())
+                    {
+                        // the other parts of a raid file make up for it, but here the only way out is another server
+                        LOG_warn << "Requesting new tempurls, the storage server is performing poorly";
+                        client->setchunkfailed(&reqs[i]->posturl);
+                        return transfer->failed(API_EAGAIN, committer);
+                    }
+
                     if (reqs[i]->httpstatus == 509)
                     {
                         if (reqs[i]->timeleft < 0)
@@ -898,18 +1420,28 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
             }
         }
 
-        if (!failure)
+        if (!failure && i >= targetconnections)
+        {
+            // being closed: no new requests
+        }
+        else if (!failure)
         {
             if (!reqs[i] || (reqs[i]->status == REQ_READY))
             {
                 bool newInputBufferSupplied = false;
                 bool pauseConnectionInputForRaid = false;
-                std::pair<m_off_t, m_off_t> posrange = transferbuf.nextNPosForConnection(i, maxRequestSize, connections, newInputBufferSupplied, pauseConnectionInputForRaid);
+                m_off_t requestSize = maxRequestSize;
+                if (transfer->type == GET && !transferbuf.isRaid())
+                {
+                    requestSize = requestSizers[i].nextRequestSize(maxRequestSize, maxAdaptiveRequestSize);
+                }
+                requestSize = transfer->client->pressurerequestsize(requestSize);
+                std::pair<m_off_t, m_off_t> posrange = transferbuf.nextNPosForConnection(i, requestSize, connections, newInputBufferSupplied, pauseConnectionInputForRaid);
 
                 // we might have a raid-reassembled block to write, or a previously loaded block, or a skip block to process.
                 bool newOutputBufferSupplied = false;
                 TransferBufferManager::FilePiece* outputPiece = transferbuf.getAsyncOutputBufferPointer(i);
-                if (outputPiece && reqs[i])
+                if ((outputPiece || transferbuf.outputPending(i)) && reqs[i])
                 {
                     // set up to do the actual write on the next loop, as if it was a retry
                     reqs[i]->status = REQ_SUCCESS;
@@ -928,15 +1460,52 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                     if (!reqs[i])
                     {
                         reqs[i] = transfer->type == PUT ? (HttpReqXfer*)new HttpReqUL() : (HttpReqXfer*)new HttpReqDL();
+                        reqs[i]->bufferpool = client->bufferpool;
+                        reqs[i]->shapinggroup = FairTransferScheduler::groupof(transfer);
                     }
 
                     bool prepare = true;
+                    unique_ptr<HttpReqUL> kept;
                     if (transfer->type == PUT)
                     {
                         m_off_t pos = posrange.first;
                         unsigned size = (unsigned)(posrange.second - pos);
 
-                        if (fa->asyncavailable())
+                        if (!asyncIO[i])
+                        {
+                            // sent by a previous slot, but not acknowledged: it goes again as it was encrypted
+                            kept = transfer->takeunackedchunk(posrange.first, posrange.second, fa->mtime);
+                        }
+
+                        if (!kept && !readahead && client->uploadreadahead && transfer->size > m_off_t(UploadReadahead::BLOCKSIZE))
+                        {
+                            readahead.reset(new UploadReadahead(client->fsaccess, transfer->localfilename, transfer->size, fa->mtime,
+                                                                pos, client->uploadreadahead, client->bufferpool, client->waiter));
+                        }
+
+                        UploadReadahead::result_t readahead_result = UploadReadahead::MISSED;
+                        if (!kept && readahead && !asyncIO[i])
+                        {
+                            unsigned pad = (-(int)size) & (SymmCipher::BLOCKSIZE - 1);
+                            byte* body = static_cast<HttpReqUL*>(reqs[i])->bodybuffer(size, pad);
+                            readahead_result = readahead->take(body, size, pos);
+                            if (readahead_result == UploadReadahead::READ && pad)
+                            {
+                                memset(body + size, 0, pad);
+                            }
+                            else if (readahead_result == UploadReadahead::PENDING)
+                            {
+                                // the range is left for the next round, to this connection or another one
+                                posrange.second = transfer->pos;
+                                prepare = false;
+                            }
+                        }
+
+                        if (kept || readahead_result != UploadReadahead::MISSED)
+                        {
+                            // read ahead already, or soon
+                        }
+                        else if (fa->asyncavailable())
                         {
                             if (asyncIO[i])
                             {
@@ -948,13 +1517,23 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                                 asyncIO[i] = NULL;
                             }
 
-                            asyncIO[i] = fa->asyncfread(reqs[i]->out, size, (-(int)size) & (SymmCipher::BLOCKSIZE - 1), pos);
+                            unsigned pad = (-(int)size) & (SymmCipher::BLOCKSIZE - 1);
+                            asyncIO[i] = fa->asyncfread(static_cast<HttpReqUL*>(reqs[i])->bodybuffer(size, pad), size, pad, pos);
                             reqs[i]->status = REQ_ASYNCIO;
                             prepare = false;
                         }
                         else
                         {
-                            if (!fa->fread(reqs[i]->out, size, (-(int)size) & (SymmCipher::BLOCKSIZE - 1), transfer->pos))
+                            unsigned pad = (-(int)size) & (SymmCipher::BLOCKSIZE - 1);
+                            byte* body = static_cast<HttpReqUL*>(reqs[i])->bodybuffer(size, pad);
+                            if (fa->frawread(body, size, transfer->pos))
+                            {
+                                if (pad)
+                                {
+                                    memset(body + size, 0, pad);
+                                }
+                            }
+                            else
                             {
                                 LOG_warn << "Error preparing transfer: " << fa->retry;
                                 if (!fa->retry)
@@ -1002,11 +1581,24 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                             return transfer->failed(API_EINTERNAL, committer);
                         }
 
-                        reqs[i]->prepare(finaltempurl.c_str(), transfer->transfercipher(),
-                                                               &transfer->chunkmacs, transfer->ctriv,
-                                                               posrange.first, posrange.second);
                         reqs[i]->pos = ChunkedHash::chunkfloor(posrange.first);
                         reqs[i]->status = REQ_PREPARED;
+                        if (kept)
+                        {
+                            static_cast<HttpReqUL*>(reqs[i])->swapbody(*kept);
+                            static_cast<HttpReqUL*>(reqs[i])->resend(finaltempurl.c_str(), &transfer->chunkmacs);
+                        }
+                        else if (transfer->type == PUT
+                                 && transferbuf.encryptInput(i, static_cast<HttpReqUL*>(reqs[i]), finaltempurl, posrange.first, posrange.second))
+                        {
+                            reqs[i]->status = REQ_ENCRYPTING;
+                        }
+                        else
+                        {
+                            reqs[i]->prepare(finaltempurl.c_str(), transfer->transfercipher(),
+                                                                   &transfer->chunkmacs, transfer->ctriv,
+                                                                   posrange.first, posrange.second);
+                        }
                     }
 
                     transferbuf.transferPos(i) = std::max<m_off_t>(transferbuf.transferPos(i), posrange.second);
@@ -1032,17 +1624,34 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
             if (reqs[i] && (reqs[i]->status == REQ_PREPARED))
             {
                 reqs[i]->minspeed = true;
-                reqs[i]->post(client);
+                if (transfer->type == GET && !transferbuf.isRaid())
+                {
+                    requestSizers[i].posted(RequestSizeController::clock::now());
+                }
+
+                if (transfer->type == PUT)
+                {
+                    static_cast<HttpReqUL*>(reqs[i])->post(client);
+                }
+                else
+                {
+                    reqs[i]->post(client);
+                }
             }
         }
     }
 
+    if (transfer->type == GET && writecoalesced(client, committer, backoff))
+    {
+        return;
+    }
+
     if (transfer->type == GET && transferbuf.isRaid())
     {
         // for Raid, additionally we need the raid data that's waiting to be recombined
         p += transferbuf.progress();
     }
-    p += transfer->progresscompleted;
+    p += transfer->progresscompleted + transferbuf.coalescedBytes();
     
     if (p != progressreported || (Waiter::ds - lastprogressreport) > PROGRESSTIMEOUT)
     {
@@ -1093,6 +1702,7 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
             if (reqs[i] && reqs[i]->status == REQ_INFLIGHT)
             {
                 chunkfailed = true;
+                samplehost(i, true);
                 client->setchunkfailed(&reqs[i]->posturl);
                 reqs[i]->disconnect();
 
@@ -1163,10 +1773,187 @@ void TransferSlot::progress()
     }
 }
 
+void TransferSlot::tempurlsready()
+{
+    if (ttfbms < 0)
+    {
+        tempurlstime = std::chrono::steady_clock::now();
+    }
+
+    MegaClient* client = transfer->client;
+    const vector<string>& urls = transfer->tempurls;
+
+    if (transferbuf.isRaid() && transferbuf.unusedRaidPart() == RAIDPARTS)
+    {
+        // rather than finding out which of the six is slowest, leave out the one known to be poor, if any
+        unsigned worst = RAIDPARTS;
+        for (unsigned i = 0; i < urls.size(); i++)
+        {
+            if (client->storagehealth.avoided(urls[i], Waiter::ds)
+                    && (worst == RAIDPARTS || client->storagehealth.score(StorageHealth::hostof(urls[i]))
+                                              < client->storagehealth.score(StorageHealth::hostof(urls[worst]))))
+            {
+                worst = i;
+            }
+        }
+
+        if (worst < RAIDPARTS)
+        {
+            LOG_debug << "Starting the raid download without part " << worst << ", its storage server is performing poorly";
+            transferbuf.setUnusedRaidPart(worst);
+        }
+    }
+
+    for (unsigned i = 0; i < urls.size(); i++)
+    {
+        // the requests of the next doio() would only race a warm-up of their own host, unless they
+        // can wait for its connection.  The spare raid part is only requested if another one fails
+        if (client->httpio->multiplexes()
+                || (transferbuf.isRaid() && i == transferbuf.unusedRaidPart()))
+        {
+            client->preconnect(urls[i], transfer->type);
+        }
+    }
+}
+
+// account the response of connection i in the health of its storage server.  True if the server just turned poor
+bool TransferSlot::samplehost(unsigned i, bool failed)
+{
+    StorageHealth& health = transfer->client->storagehealth;
+    if (failed)
+    {
+        return health.failure(reqs[i]->posturl, Waiter::ds);
+    }
+
+    if (reqs[i]->elapsedms < 0)
+    {
+        return false;   // already accounted, revisited for a postponed or buffered write
+    }
+
+    bool poor = health.success(reqs[i]->posturl, reqs[i]->size, reqs[i]->ttfbms, reqs[i]->elapsedms, Waiter::ds);
+    reqs[i]->elapsedms = -1;
+    return poor;
+}
+
+void TransferSlot::firstdata()
+{
+    if (tempurlstime != std::chrono::steady_clock::time_point())
+    {
+        ttfbms = int(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tempurlstime).count());
+        LOG_debug << "Time to first byte: " << ttfbms << " ms";
+    }
+}
+
+bool TransferSlot::coalescedwritten(MegaClient* client, DBTableTransactionCommitter& committer, dstime& backoff)
+{
+    if (coalescedIO && coalescedIO->finished)
+    {
+        bool failed = coalescedIO->failed;
+        bool retry = coalescedIO->retry;
+        delete coalescedIO;
+        coalescedIO = NULL;
+
+        if (failed)
+        {
+            LOG_warn << "Async coalesced write failed: " << retry;
+            if (!retry)
+            {
+                transferbuf.coalescedWriteCompleted(false);
+                transfer->failed(API_EWRITE, committer);
+                return true;
+            }
+
+            // retry shortly
+            lasterror = API_EWRITE;
+            backoff = 2;
+            return false;
+        }
+
+        LOG_verbose << "Async coalesced write succeeded";
+        transferbuf.coalescedWriteCompleted(true);
+        updatecontiguousprogress();
+        if (checkTransferFinished(committer, client))
+        {
+            return true;
+        }
+        client->transfercachedirty(transfer);
+    }
+    return false;
+}
+
+bool TransferSlot::writecoalesced(MegaClient* client, DBTableTransactionCommitter& committer, dstime& backoff)
+{
+    if (coalescedIO)
+    {
+        return false;
+    }
+
+    if (transferbuf.gatheringOutput())
+    {
+        // write what was gathered unless another connection may still continue it
+        bool continuing = false;
+        for (int i = connections; i-- && !continuing; )
+        {
+            continuing = reqs[i] && (reqs[i]->status == REQ_PREPARED || reqs[i]->status == REQ_INFLIGHT
+                                     || reqs[i]->status == REQ_SUCCESS || reqs[i]->status == REQ_FAILURE);
+        }
+
+        if (!continuing)
+        {
+            transferbuf.flushCoalescedOutput();
+        }
+    }
+
+    TransferBufferManager::FilePiece* piece = transferbuf.getCoalescedOutputPointer();
+    if (!piece || backoff)
+    {
+        return false;
+    }
+
+    LOG_debug << "Writing coalesced data at " << piece->pos << " to " << (piece->pos + piece->buf.datalen());
+    if (fa->asyncavailable())
+    {
+        coalescedIO = fa->asyncfwrite(piece->buf.datastart(), static_cast<unsigned>(piece->buf.datalen()), piece->pos);
+        return false;
+    }
+
+    if (!fa->fwrite(piece->buf.datastart(), static_cast<unsigned>(piece->buf.datalen()), piece->pos))
+    {
+        LOG_err << "Error saving coalesced data";
+        if (!fa->retry)
+        {
+            transferbuf.coalescedWriteCompleted(false);
+            transfer->failed(API_EWRITE, committer);
+            return true;
+        }
+        lasterror = API_EWRITE;
+        backoff = 2;
+        return false;
+    }
+
+    LOG_verbose << "Sync coalesced write succeeded";
+    transferbuf.coalescedWriteCompleted(true);
+    updatecontiguousprogress();
+    if (checkTransferFinished(committer, client))
+    {
+        return true;
+    }
+    client->transfercachedirty(transfer);
+    return false;
+}
+
 void TransferSlot::updatecontiguousprogress()
 {
     chunkmac_map::iterator pcit;
     chunkmac_map &pcchunkmacs = transfer->chunkmacs;
+
+    if (transfer->type == GET)
+    {
+        // checkpoint the contiguous prefix: the next cache write and the final mac only need the chunks after it
+        pcchunkmacs.foldfinished(transfer->transfercipher(), transfer->size);
+    }
+
+    progresscontiguous = std::max(progresscontiguous, pcchunkmacs.foldedpos);
     while ((pcit = pcchunkmacs.find(progresscontiguous)) != pcchunkmacs.end()
            && pcit->second.finished)
     {
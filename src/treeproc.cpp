@@ -25,7 +25,8 @@
 
 namespace mega {
 // create share keys
-TreeProcShareKeys::TreeProcShareKeys(Node* n)
+TreeProcShareKeys::TreeProcShareKeys(Node* n, size_t maxbytes)
+    : snk(maxbytes)
 {
     sn = n;
 }
@@ -35,9 +36,14 @@ void TreeProcShareKeys::proc(MegaClient*, Node* n)
     snk.add(n, sn, sn != NULL);
 }
 
-void TreeProcShareKeys::get(Command* c)
+void TreeProcShareKeys::get(Command* c, size_t part)
 {
-    snk.get(c);
+    snk.get(c, false, part);
+}
+
+size_t TreeProcShareKeys::parts() const
+{
+    return snk.size();
 }
 
 void TreeProcForeignKeys::proc(MegaClient* client, Node* n)
@@ -71,6 +77,19 @@ void TreeProcDU::proc(MegaClient*, Node* n)
     }
 }
 
+TreeProc* TreeProcDU::fork() const
+{
+    return new TreeProcDU();
+}
+
+void TreeProcDU::merge(const TreeProc& other)
+{
+    const TreeProcDU& du = static_cast<const TreeProcDU&>(other);
+    numbytes += du.numbytes;
+    numfiles += du.numfiles;
+    numfolders += du.numfolders;
+}
+
 // mark node as removed and notify
 void TreeProcDel::proc(MegaClient* client, Node* n)
 {
@@ -314,6 +314,10 @@ void User::setattr(attr_t at, string *av, string *v)
     {
         attrs[at] = *av;
     }
+    else
+    {
+        attrs.erase(at);    // it may have been nonexistent
+    }
 
     attrsv[at] = v ? *v : "N";
 }
@@ -355,6 +359,21 @@ bool User::isattrvalid(attr_t at)
     return attrs.count(at) && attrsv.count(at);
 }
 
+static const char NONEXISTENTATTRVERSION[] = "-";
+
+void User::setnonexistentattr(attr_t at)
+{
+    setChanged(at);
+    attrs[at].clear();
+    attrsv[at] = NONEXISTENTATTRVERSION;
+}
+
+bool User::isattrnonexistent(attr_t at)
+{
+    userattr_map::iterator it = attrsv.find(at);
+    return it != attrsv.end() && it->second == NONEXISTENTATTRVERSION && isattrvalid(at);
+}
+
 string User::attr2string(attr_t type)
 {
     string attrname;
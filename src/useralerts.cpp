@@ -823,47 +823,49 @@ void UserAlerts::add(UserAlert::Base* unb)
         return;
     }
 
-    if (!alerts.empty() && unb->type == UserAlert::type_put && alerts.back()->type == UserAlert::type_put)
+    UserAlert::NewSharedNodes* np = unb->type == UserAlert::type_put ? dynamic_cast<UserAlert::NewSharedNodes*>(unb) : NULL;
+    if (np && !ISUNDEF(np->parentHandle))
     {
-        // If it's file/folders added, and the prior one is for the same user and within 5 mins then we can combine instead
-        UserAlert::NewSharedNodes* np = dynamic_cast<UserAlert::NewSharedNodes*>(unb);
-        UserAlert::NewSharedNodes* op = dynamic_cast<UserAlert::NewSharedNodes*>(alerts.back());
-        if (np && op)
+        // If it's file/folders added, and the latest one for the same user and folder is within 5 mins then we can combine instead
+        UserAlert::NewSharedNodes*& op = lastSharedNodes[std::make_pair(np->userHandle, np->parentHandle)];
+        if (op && np->timestamp - op->timestamp < 300)
         {
-            if (np->userHandle == op->userHandle && np->timestamp - op->timestamp < 300 && 
-                np->parentHandle == op->parentHandle && !ISUNDEF(np->parentHandle))
-            {
-                op->fileCount += np->fileCount;
-                op->folderCount += np->folderCount;
-                LOG_debug << "Merged user alert, type " << np->type << " ts " << np->timestamp;
+            op->fileCount += np->fileCount;
+            op->folderCount += np->folderCount;
+            LOG_debug << "Merged user alert, type " << np->type << " ts " << np->timestamp;
 
-                if (catchupdone && (useralertnotify.empty() || useralertnotify.back() != alerts.back()))
-                {
-                    alerts.back()->seen = false;
-                    alerts.back()->tag = 0;
-                    useralertnotify.push_back(alerts.back());
-                    LOG_debug << "Updated user alert added to notify queue";
-                }
-                delete unb;
-                return;
+            if (catchupdone && (useralertnotify.empty() || useralertnotify.back() != op))
+            {
+                op->seen = false;
+                op->tag = 0;
+                useralertnotify.push_back(op);
+                LOG_debug << "Updated user alert added to notify queue";
             }
+            delete unb;
+            return;
         }
+        op = np;
     }
 
-    if (!alerts.empty() && unb->type == UserAlert::type_psts && static_cast<UserAlert::Payment*>(unb)->success)
+    if (unb->type == UserAlert::type_psts && static_cast<UserAlert::Payment*>(unb)->success)
     {
         // if a successful payment is made then hide/remove any reminders received
-        for (Alerts::iterator i = alerts.begin(); i != alerts.end(); ++i)
+        for (UserAlert::Base* reminder : relevantReminders)
         {
-            if ((*i)->type == UserAlert::type_pses && (*i)->relevant)
+            if (reminder->relevant)
             {
-                (*i)->relevant = false;
+                reminder->relevant = false;
                 if (catchupdone)
                 {
-                    useralertnotify.push_back(*i);
+                    useralertnotify.push_back(reminder);
                 }
             }
         }
+        relevantReminders.clear();
+    }
+    else if (unb->type == UserAlert::type_pses && unb->relevant)
+    {
+        relevantReminders.push_back(unb);
     }
 
     unb->updateEmail(&mc);
@@ -1158,6 +1160,8 @@ void UserAlerts::clear()
         delete *i;
     }
     alerts.clear();
+    lastSharedNodes.clear();
+    relevantReminders.clear();
     useralertnotify.clear();
     begincatchup = false;
     catchupdone = false;
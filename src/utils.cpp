@@ -30,6 +30,10 @@
 #include <sys/timeb.h>
 #endif
 
+#if defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86) && !defined(_M_ARM)))
+#include <intrin.h>
+#endif
+
 #ifdef __APPLE__
 #include <sys/sysctl.h>
 #endif
@@ -136,6 +140,13 @@ CacheableReader::CacheableReader(const string& d)
 {
 }
 
+CacheableReader::CacheableReader(const char* data, size_t len)
+    : ptr(data)
+    , end(data + len)
+    , fieldnum(0)
+{
+}
+
 void CacheableReader::eraseused(string& d)
 {
     assert(end == d.data() + d.size());
@@ -237,10 +248,57 @@ bool chunkmac_map::unserialize(const char*& ptr, const char* end)
     return true;
 }
 
+void chunkmac_map::serializefolded(string& d) const
+{
+    d.append((const char*)&foldedpos, sizeof(foldedpos));
+    d.append((const char*)foldedmac, sizeof(foldedmac));
+}
+
+bool chunkmac_map::unserializefolded(const char*& ptr, const char* end)
+{
+    if (ptr + sizeof(foldedpos) + sizeof(foldedmac) > end)
+    {
+        return false;
+    }
+
+    foldedpos = MemAccess::get<m_off_t>(ptr);
+    ptr += sizeof(foldedpos);
+    memcpy(foldedmac, ptr, sizeof(foldedmac));
+    ptr += sizeof(foldedmac);
+    return foldedpos >= 0;
+}
+
+// chain the macs of the finished chunks at foldedpos into foldedmac, the same way macsmac() does, and drop them
+void chunkmac_map::foldfinished(SymmCipher *cipher, m_off_t fileSize)
+{
+    iterator it;
+    while (foldedpos < fileSize && (it = begin()) != end() && it->first == foldedpos && it->second.finished)
+    {
+        SymmCipher::xorblock(it->second.mac, foldedmac);
+        cipher->ecb_encrypt(foldedmac);
+        foldedpos = ChunkedHash::chunkceil(foldedpos, fileSize);
+        erase(it);
+    }
+}
+
+void chunkmac_map::clear()
+{
+    map<m_off_t, ChunkMAC>::clear();
+    foldedpos = 0;
+    memset(foldedmac, 0, sizeof(foldedmac));
+}
+
+void chunkmac_map::swap(chunkmac_map& other)
+{
+    map<m_off_t, ChunkMAC>::swap(other);
+    std::swap(foldedpos, other.foldedpos);
+    std::swap_ranges(foldedmac, foldedmac + sizeof(foldedmac), other.foldedmac);
+}
+
 void chunkmac_map::calcprogress(m_off_t size, m_off_t& chunkpos, m_off_t& progresscompleted, m_off_t* lastblockprogress)
 {
-    chunkpos = 0;
-    progresscompleted = 0;
+    chunkpos = foldedpos;
+    progresscompleted = foldedpos;
 
     for (chunkmac_map::iterator it = begin(); it != end(); ++it)
     {
@@ -269,6 +327,7 @@ void chunkmac_map::calcprogress(m_off_t size, m_off_t& chunkpos, m_off_t& progre
 
 m_off_t chunkmac_map::nextUnprocessedPosFrom(m_off_t pos)
 {
+    pos = std::max(pos, foldedpos);
     for (const_iterator it = find(ChunkedHash::chunkfloor(pos));
         it != end();
         it = find(ChunkedHash::chunkfloor(pos)))
@@ -303,6 +362,7 @@ void chunkmac_map::finishedUploadChunks(m_off_t pos, m_off_t size)
     m_off_t finalpos = startpos + size;
     while (startpos < finalpos)
     {
+        assert(startpos >= foldedpos);
         (*this)[startpos].finished = true;
         LOG_verbose << "Upload chunk completed: " << startpos;
         startpos = ChunkedHash::chunkceil(startpos, finalpos);
@@ -733,7 +793,9 @@ TextChat* TextChat::unserialize(class MegaClient *client, string *d)
     chat->resetTag();
     chat->ts = ts;
     chat->flags = flags;
+    client->indexattachments(chat, false);
     chat->attachedNodes = attachedNodes;
+    client->indexattachments(chat, true);
     chat->publicchat = publicchat;
     chat->unifiedKey = unifiedKey;
 
@@ -2238,4 +2300,546 @@ bool operator==(const SyncConfig& lhs, const SyncConfig& rhs)
     return lhs.tie() == rhs.tie();
 }
 
+namespace {
+// blocks a thread keeps aside per pool, and how many at a time it trades with the shared free list
+const size_t THREADCACHEBLOCKS = 64;
+const size_t THREADCACHEBATCH = 32;
+
+// the caching pools are a handful of block sizes; any beyond this go straight to the shared list
+const int THREADCACHES = 8;
+}
+
+struct FixedSizePool::ThreadCache
+{
+    FixedSizePool* pool;
+    FreeBlock* head;
+    size_t count;
+};
+
+FixedSizePool::FixedSizePool(size_t blocksize, size_t alignment, size_t slabblocks, bool threadcache)
+    : mBlockSize(((std::max(blocksize, sizeof(FreeBlock)) + alignment - 1) / alignment) * alignment)
+    , mSlabBlocks(slabblocks)
+    , mThreadCache(threadcache)
+    , mSlabUsed(slabblocks)
+{
+    assert(alignment && alignment <= alignof(std::max_align_t));
+    assert(slabblocks >= THREADCACHEBATCH || !threadcache);
+}
+
+FixedSizePool::~FixedSizePool()
+{
+    for (char* slab : mSlabs)
+    {
+        ::operator delete(slab);
+    }
+}
+
+FixedSizePool::ThreadCache* FixedSizePool::threadCache()
+{
+    // trivially destructible, so that blocks released during thread or static teardown, once the
+    // flusher below has run, still find valid storage (and go to the shared list)
+    static thread_local ThreadCache caches[THREADCACHES];
+    static thread_local bool flushed = false;
+
+    // give the blocks kept aside back to their pools when the thread ends
+    struct Flusher
+    {
+        ~Flusher()
+        {
+            flushed = true;
+
+            for (ThreadCache& c : caches)
+            {
+                if (c.count)
+                {
+                    FreeBlock* tail = c.head;
+                    while (tail->next)
+                    {
+                        tail = tail->next;
+                    }
+
+                    c.pool->release(c.head, tail, c.count);
+                    c.head = nullptr;
+                    c.count = 0;
+                }
+            }
+        }
+    };
+    static thread_local Flusher flusher;
+
+    if (flushed)
+    {
+        return nullptr;
+    }
+
+    for (ThreadCache& c : caches)
+    {
+        if (c.pool == this)
+        {
+            return &c;
+        }
+
+        if (!c.pool)
+        {
+            c.pool = this;
+            return &c;
+        }
+    }
+
+    return nullptr;
+}
+
+FixedSizePool::FreeBlock* FixedSizePool::acquire(size_t count)
+{
+    std::lock_guard<std::mutex> g(mMutex);
+
+    mBlocksInUse += count;
+
+    FreeBlock* head = nullptr;
+
+    while (count--)
+    {
+        FreeBlock* b;
+
+        if (mFreeList)
+        {
+            b = mFreeList;
+            mFreeList = b->next;
+        }
+        else
+        {
+            if (mSlabUsed == mSlabBlocks)
+            {
+                mSlabs.push_back(static_cast<char*>(::operator new(mBlockSize * mSlabBlocks)));
+                mSlabUsed = 0;
+            }
+
+            b = reinterpret_cast<FreeBlock*>(mSlabs.back() + mBlockSize * mSlabUsed++);
+        }
+
+        b->next = head;
+        head = b;
+    }
+
+    return head;
+}
+
+void FixedSizePool::release(FreeBlock* head, FreeBlock* tail, size_t count)
+{
+    std::lock_guard<std::mutex> g(mMutex);
+
+    assert(mBlocksInUse >= count);
+
+    mBlocksInUse -= count;
+
+    if (!mBlocksInUse)
+    {
+        // everything was released (eg. logout): give the slabs back to the heap, but keep one so
+        // that a few short-lived objects allocated and freed in turn don't go to the heap each time
+        for (size_t i = 1; i < mSlabs.size(); i++)
+        {
+            ::operator delete(mSlabs[i]);
+        }
+
+        mSlabs.resize(1);
+        mFreeList = nullptr;
+        mSlabUsed = 0;
+        return;
+    }
+
+    tail->next = mFreeList;
+    mFreeList = head;
+}
+
+void* FixedSizePool::allocate()
+{
+    ThreadCache* c = mThreadCache ? threadCache() : nullptr;
+
+    if (!c)
+    {
+        return acquire(1);
+    }
+
+    if (!c->count)
+    {
+        c->head = acquire(THREADCACHEBATCH);
+        c->count = THREADCACHEBATCH;
+    }
+
+    FreeBlock* b = c->head;
+    c->head = b->next;
+    c->count--;
+    return b;
+}
+
+void FixedSizePool::deallocate(void* p)
+{
+    FreeBlock* b = static_cast<FreeBlock*>(p);
+    ThreadCache* c = mThreadCache ? threadCache() : nullptr;
+
+    if (!c)
+    {
+        release(b, b, 1);
+        return;
+    }
+
+    b->next = c->head;
+    c->head = b;
+
+    if (++c->count > THREADCACHEBLOCKS)
+    {
+        // hand the surplus back, for other threads to use (or for the slabs to be released)
+        size_t surplus = c->count - THREADCACHEBATCH;
+        FreeBlock* tail = c->head;
+        for (size_t i = 1; i < surplus; i++)
+        {
+            tail = tail->next;
+        }
+
+        FreeBlock* head = c->head;
+        c->head = tail->next;
+        c->count = THREADCACHEBATCH;
+        release(head, tail, surplus);
+    }
+}
+
+size_t FixedSizePool::blocksInUse() const
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    return mBlocksInUse;
+}
+
+size_t FixedSizePool::bytesInUse() const
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    return mBlocksInUse * mBlockSize;
+}
+
+size_t FixedSizePool::bytesReserved() const
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    return mSlabs.size() * mSlabBlocks * mBlockSize;
+}
+
+namespace {
+std::mutex poolsMutex;
+
+map<pair<size_t, size_t>, FixedSizePool*>& pools()
+{
+    // intentionally leaked, so that objects destroyed during static destruction can still release blocks
+    static auto p = new map<pair<size_t, size_t>, FixedSizePool*>;
+    return *p;
+}
+}
+
+FixedSizePool& FixedSizePool::forSize(size_t blocksize, size_t alignment)
+{
+    std::lock_guard<std::mutex> g(poolsMutex);
+
+    FixedSizePool*& p = pools()[std::make_pair(blocksize, alignment)];
+    if (!p)
+    {
+        p = new FixedSizePool(blocksize, alignment, 4096, true);
+    }
+    return *p;
+}
+
+size_t FixedSizePool::totalBytesReserved()
+{
+    std::lock_guard<std::mutex> g(poolsMutex);
+
+    size_t total = 0;
+    for (auto& p : pools())
+    {
+        total += p.second->bytesReserved();
+    }
+    return total;
+}
+
+const CpuFeatures& CpuFeatures::get()
+{
+    static const CpuFeatures features = []()
+    {
+        CpuFeatures f;
+#if defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86) && !defined(_M_ARM)))
+        int info[4];
+        __cpuid(info, 0);
+        int maxleaf = info[0];
+
+        __cpuid(info, 1);
+        f.ssse3 = !!(info[2] & (1 << 9));
+        f.sse41 = !!(info[2] & (1 << 19));
+        f.pclmul = !!(info[2] & (1 << 1));
+
+        // AVX2 also needs the OS to save the ymm registers (OSXSAVE, and XCR0 enabling them)
+        bool ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+        if (ymm && maxleaf >= 7)
+        {
+            __cpuidex(info, 7, 0);
+            f.avx2 = !!(info[1] & (1 << 5));
+        }
+#elif defined(__x86_64__) || defined(__i386__)
+        // these check that the OS saves the registers as well
+        __builtin_cpu_init();
+        f.ssse3 = __builtin_cpu_supports("ssse3");
+        f.sse41 = __builtin_cpu_supports("sse4.1");
+        f.pclmul = __builtin_cpu_supports("pclmul");
+        f.avx2 = __builtin_cpu_supports("avx2");
+#endif
+        return f;
+    }();
+
+    return features;
+}
+
+namespace CodeCounter
+{
+#ifdef MEGA_MEASURE_CODE
+std::atomic<bool> gEnabled(true);
+#else
+std::atomic<bool> gEnabled(false);
+#endif
+
+void setEnabled(bool enable)
+{
+    gEnabled = enable;
+}
+
+unsigned Histogram::bucket(uint64_t us)
+{
+    if (us < 4)
+    {
+        return unsigned(us);
+    }
+
+    unsigned msb = 2;
+    while (us >> (msb + 1))
+    {
+        msb++;
+    }
+
+    // the two bits below the top one pick the linear bucket
+    unsigned b = (msb - 1) * 4 + unsigned((us >> (msb - 2)) & 3);
+    return std::min(b, BUCKETS - 1);
+}
+
+uint64_t Histogram::upperbound(unsigned b)
+{
+    if (b < 4)
+    {
+        return b;
+    }
+
+    unsigned msb = b / 4 + 1;
+    return ((uint64_t(4 + b % 4 + 1)) << (msb - 2)) - 1;
+}
+
+uint64_t Histogram::percentile(double fraction) const
+{
+    uint64_t total = 0;
+    for (unsigned i = 0; i < BUCKETS; i++)
+    {
+        total += counts[i];
+    }
+    if (!total)
+    {
+        return 0;
+    }
+
+    uint64_t target = std::max<uint64_t>(1, uint64_t(fraction * double(total) + 0.5));
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < BUCKETS; i++)
+    {
+        seen += counts[i];
+        if (seen >= target)
+        {
+            return upperbound(i);
+        }
+    }
+    return upperbound(BUCKETS - 1);
+}
+
+void Histogram::reset()
+{
+    std::fill(counts, counts + BUCKETS, 0);
+}
+
+string ScopeStats::report(bool reset)
+{
+    string s = " " + name + ": " + std::to_string(count) + " " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(timeSpent).count())
+             + " p50/p99 us: " + std::to_string(latency.percentile(0.5)) + "/" + std::to_string(latency.percentile(0.99));
+    if (reset)
+    {
+        this->reset();
+    }
+    return s;
+}
+
+void ScopeStats::reset()
+{
+    count = 0;
+    starts -= finishes;
+    finishes = 0;
+    timeSpent = high_resolution_clock::duration{};
+    latency.reset();
+}
+
+std::atomic<bool> gTracing(false);
+
+namespace {
+
+// written only by its thread, read by stopTrace() up to the published head
+struct TraceRing
+{
+    static const uint64_t CAPACITY = 1 << 14;
+
+    std::unique_ptr<TraceEvent[]> events{ new TraceEvent[CAPACITY] };
+    std::atomic<uint64_t> head{ 0 };
+    std::atomic<uint64_t> generation{ 0 };
+    unsigned tid = 0;
+};
+
+std::mutex traceMutex;
+std::vector<std::shared_ptr<TraceRing>> traceRings;
+std::atomic<uint64_t> traceGeneration(0);
+high_resolution_clock::time_point traceStart;
+
+TraceRing* threadTraceRing()
+{
+    static thread_local std::shared_ptr<TraceRing> ring;
+    if (!ring)
+    {
+        ring = std::make_shared<TraceRing>();
+        std::lock_guard<std::mutex> g(traceMutex);
+        ring->tid = traceRings.empty() ? 1 : traceRings.back()->tid + 1;
+        traceRings.push_back(ring);
+    }
+
+    // the first event of the thread in this trace drops those of the previous one
+    uint64_t generation = traceGeneration.load(std::memory_order_acquire);
+    if (ring->generation.load(std::memory_order_relaxed) != generation)
+    {
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->generation.store(generation, std::memory_order_release);
+    }
+    return ring.get();
+}
+
+void traceRecord(const char* category, const char* name, char phase, high_resolution_clock::time_point start, high_resolution_clock::duration d, uint64_t id)
+{
+    TraceRing* ring = threadTraceRing();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+
+    TraceEvent& e = ring->events[head % TraceRing::CAPACITY];
+    strncpy(e.name, name, TraceEvent::NAMELENGTH - 1);
+    e.name[TraceEvent::NAMELENGTH - 1] = '\0';
+    e.category = category;
+    e.phase = phase;
+    e.ts = start > traceStart ? uint64_t(duration_cast<microseconds>(start - traceStart).count()) : 0;
+    e.dur = uint64_t(duration_cast<microseconds>(d).count());
+    e.id = id;
+
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+void traceString(std::ostringstream& s, const char* value)
+{
+    s << '"';
+    for (const char* c = value; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            s << '\\' << *c;
+        }
+        else if ((unsigned char)*c < 0x20)
+        {
+            s << ' ';
+        }
+        else
+        {
+            s << *c;
+        }
+    }
+    s << '"';
+}
+
+} // anonymous
+
+void startTrace()
+{
+    std::lock_guard<std::mutex> g(traceMutex);
+
+    // forget the buffers of the threads that have ended
+    traceRings.erase(std::remove_if(traceRings.begin(), traceRings.end(),
+                                    [](const std::shared_ptr<TraceRing>& ring) { return ring.use_count() == 1; }),
+                     traceRings.end());
+
+    traceStart = high_resolution_clock::now();
+    traceGeneration++;
+    gTracing = true;
+}
+
+string stopTrace()
+{
+    std::lock_guard<std::mutex> g(traceMutex);
+    gTracing = false;
+
+    std::ostringstream s;
+    s.imbue(std::locale::classic());
+    s << "{\"traceEvents\":[";
+    const char* separator = "\n";
+
+    uint64_t generation = traceGeneration.load();
+    for (const std::shared_ptr<TraceRing>& ring : traceRings)
+    {
+        if (ring->generation.load(std::memory_order_acquire) != generation)
+        {
+            continue;
+        }
+
+        // once wrapped, the oldest slot may be getting the last span of a thread that checked tracing() just before it stopped
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > TraceRing::CAPACITY ? head - TraceRing::CAPACITY + 1 : 0;
+        for (uint64_t i = first; i < head; i++)
+        {
+            const TraceEvent& e = ring->events[i % TraceRing::CAPACITY];
+            s << separator << "{\"name\":";
+            traceString(s, e.name);
+            s << ",\"cat\":";
+            traceString(s, e.category);
+            s << ",\"ph\":\"" << e.phase << "\",\"ts\":" << e.ts << ",\"pid\":1,\"tid\":" << ring->tid;
+            if (e.phase == 'X')
+            {
+                s << ",\"dur\":" << e.dur;
+            }
+            else
+            {
+                s << ",\"id\":\"0x" << std::hex << e.id << std::dec << "\"";
+            }
+            s << "}";
+            separator = ",\n";
+        }
+    }
+
+    s << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return s.str();
+}
+
+void traceComplete(const char* category, const char* name, high_resolution_clock::time_point start, high_resolution_clock::duration d)
+{
+    if (tracing())
+    {
+        traceRecord(category, name, 'X', start, d, 0);
+    }
+}
+
+void traceAsync(const char* category, const char* name, char phase, uint64_t id)
+{
+    if (tracing())
+    {
+        traceRecord(category, name, phase, high_resolution_clock::now(), high_resolution_clock::duration{}, id);
+    }
+}
+} // namespace CodeCounter
+
 } // namespace
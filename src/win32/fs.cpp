@@ -73,6 +73,23 @@ bool WinFileAccess::sysread(byte* dst, unsigned len, m_off_t pos)
     return true;
 }
 
+bool WinFileAccess::fpreallocate(m_off_t size)
+{
+#ifndef WINDOWS_PHONE
+    if (hFile == INVALID_HANDLE_VALUE || size <= 0)
+    {
+        return false;
+    }
+
+    // the allocation, unlike SetEndOfFile(), leaves the end of the file where it is
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = size;
+    return SetFileInformationByHandle(hFile, FileAllocationInfo, &info, sizeof info) != 0;
+#else
+    return false;
+#endif
+}
+
 bool WinFileAccess::fwrite(const byte* data, unsigned len, m_off_t pos)
 {
     DWORD dwWritten;
@@ -649,6 +666,7 @@ WinFileSystemAccess::WinFileSystemAccess()
 {
     notifyerr = false;
     notifyfailed = false;
+    notifybuffersize = NOTIFY_BUFFER_SIZE;
 
     localseparator.assign((const char*)(const wchar_t*)L"\\", sizeof(wchar_t));
 }
@@ -1269,6 +1287,162 @@ fsfp_t WinDirNotify::fsfingerprint() const
 #endif
 }
 
+// Windows 10 1709 and later let processes without admin rights read the journal of volumes they can list
+#ifndef FSCTL_READ_UNPRIVILEGED_USN_JOURNAL
+#define FSCTL_READ_UNPRIVILEGED_USN_JOURNAL CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 234, METHOD_NEITHER, FILE_ANY_ACCESS)
+#endif
+
+HANDLE WinDirNotify::openvolume() const
+{
+#ifdef WINDOWS_PHONE
+    return INVALID_HANDLE_VALUE;
+#else
+    string path = localbasepath;
+    path.append("", 1);
+
+    WCHAR volume[MAX_PATH + 1];
+    if (!GetVolumePathNameW((LPCWSTR)path.data(), volume, MAX_PATH + 1))
+    {
+        return INVALID_HANDLE_VALUE;
+    }
+
+    // "C:\" or "\\?\Volume{...}\" to "\\.\C:" or "\\?\Volume{...}"
+    std::wstring device = volume;
+    if (device.size() && device.back() == L'\')
+    {
+        device.pop_back();
+    }
+    if (device.size() == 2 && device[1] == L':')
+    {
+        device.insert(0, L"\\.\");
+    }
+
+    HANDLE h = CreateFileW(device.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+    {
+        // enough for FSCTL_READ_UNPRIVILEGED_USN_JOURNAL
+        h = CreateFileW(device.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    }
+    return h;
+#endif
+}
+
+bool WinDirNotify::journalcursor(string* cursor)
+{
+    HANDLE h = hVolume != INVALID_HANDLE_VALUE ? hVolume : openvolume();
+    if (h == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    USN_JOURNAL_DATA_V0 journal;
+    DWORD dwBytes;
+    bool success = !!DeviceIoControl(h, FSCTL_QUERY_USN_JOURNAL, NULL, 0, &journal, sizeof journal, &dwBytes, NULL);
+    if (h != hVolume)
+    {
+        CloseHandle(h);
+    }
+
+    if (!success)
+    {
+        LOG_debug << "No USN journal. Error code: " << GetLastError();
+        return false;
+    }
+
+    cursor->assign((const char*)&journal.UsnJournalID, sizeof journal.UsnJournalID);
+    cursor->append((const char*)&journal.NextUsn, sizeof journal.NextUsn);
+    return true;
+}
+
+bool WinDirNotify::journalchanges(const string& cursor, const journalchange_callback& callback)
+{
+    DWORDLONG journalid;
+    USN usn;
+    if (cursor.size() != sizeof journalid + sizeof usn)
+    {
+        return false;
+    }
+    memcpy(&journalid, cursor.data(), sizeof journalid);
+    memcpy(&usn, cursor.data() + sizeof journalid, sizeof usn);
+
+    HANDLE h = openvolume();
+    if (h == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    USN_JOURNAL_DATA_V0 journal;
+    DWORD dwBytes;
+    if (!DeviceIoControl(h, FSCTL_QUERY_USN_JOURNAL, NULL, 0, &journal, sizeof journal, &dwBytes, NULL)
+            || journal.UsnJournalID != journalid
+            || usn < journal.FirstUsn)
+    {
+        // no journal, or recreated or wrapped around since: records were lost
+        CloseHandle(h);
+        return false;
+    }
+
+    READ_USN_JOURNAL_DATA_V0 read = { 0 };
+    read.StartUsn = usn;
+    read.ReasonMask = 0xFFFFFFFF;
+    read.UsnJournalID = journalid;
+
+    std::vector<LONGLONG> buf(65536 / sizeof(LONGLONG));
+    DWORD ioctl = FSCTL_READ_USN_JOURNAL;
+    bool success = true;
+    string localname;
+
+    // up to where the journal was when we started
+    while (read.StartUsn < journal.NextUsn)
+    {
+        if (!DeviceIoControl(h, ioctl, &read, sizeof read, buf.data(), DWORD(buf.size() * sizeof(LONGLONG)), &dwBytes, NULL))
+        {
+            if (GetLastError() == ERROR_ACCESS_DENIED && ioctl == FSCTL_READ_USN_JOURNAL)
+            {
+                ioctl = FSCTL_READ_UNPRIVILEGED_USN_JOURNAL;
+                continue;
+            }
+            LOG_debug << "Unable to read the USN journal. Error code: " << GetLastError();
+            success = false;
+            break;
+        }
+
+        if (dwBytes <= sizeof(USN))
+        {
+            break;
+        }
+
+        char* ptr = (char*)buf.data() + sizeof(USN);
+        char* end = (char*)buf.data() + dwBytes;
+        while (ptr < end)
+        {
+            USN_RECORD_V2* record = (USN_RECORD_V2*)ptr;
+
+            if (record->MajorVersion != 2)
+            {
+                // 128-bit file IDs (ReFS), which aren't our fsids
+                success = false;
+                break;
+            }
+
+            localname.assign((const char*)record + record->FileNameOffset, record->FileNameLength);
+            callback(handle(record->FileReferenceNumber), handle(record->ParentFileReferenceNumber), localname);
+
+            ptr += record->RecordLength;
+        }
+
+        if (!success)
+        {
+            break;
+        }
+
+        read.StartUsn = *(USN*)buf.data();
+    }
+
+    CloseHandle(h);
+    return success;
+}
+
 bool WinDirNotify::fsstableids() const
 {
 #ifdef WINDOWS_PHONE
@@ -1311,11 +1485,25 @@ void WinDirNotify::process(DWORD dwBytes)
     if (!dwBytes)
     {
 #ifdef ENABLE_SYNC
-        LOG_err << "Empty filesystem notification: " << (localrootnode ? localrootnode->name.c_str() : "NULL")
-                << " errors: " << error;
-        error++;
-        readchanges();
-        notify(DIREVENTS, localrootnode, NULL, 0);
+        // the buffer overflowed: the journal has what was lost since the read was requested, otherwise
+        // the whole sync is rescanned
+        LOG_warn << "Filesystem notification buffer overflow: " << (localrootnode ? localrootnode->name.c_str() : "NULL")
+                 << " overflows: " << overflows + 1 << " journal: " << !readcursor.empty();
+        overflows++;
+        if (readcursor.empty())
+        {
+            error++;
+            readchanges();
+            notify(DIREVENTS, localrootnode, NULL, 0);
+        }
+        else
+        {
+            if (overflowcursor.empty())
+            {
+                overflowcursor = readcursor;
+            }
+            readchanges();
+        }
 #endif
     }
     else
@@ -1394,6 +1582,11 @@ void WinDirNotify::process(DWORD dwBytes)
 void WinDirNotify::readchanges()
 {
 #ifndef WINDOWS_PHONE
+    if (hVolume == INVALID_HANDLE_VALUE || !journalcursor(&readcursor))
+    {
+        readcursor.clear();
+    }
+
     if (ReadDirectoryChangesW(hDirectory, (LPVOID)notifybuf[active].data(),
                               (DWORD)notifybuf[active].size(), TRUE,
                               FILE_NOTIFY_CHANGE_FILE_NAME
@@ -1411,7 +1604,15 @@ void WinDirNotify::readchanges()
         enabled = false;
         DWORD e = GetLastError();
         LOG_warn << "ReadDirectoryChanges not available. Error code: " << e << " errors: " << error;
-        if (e == ERROR_NOTIFY_ENUM_DIR && error < 10)
+        if (e == ERROR_INVALID_PARAMETER && notifybuf[active].size() > WinFileSystemAccess::NOTIFY_NETWORK_BUFFER_SIZE)
+        {
+            // network shares take 64 KB at most
+            LOG_debug << "Using smaller filesystem notification buffers";
+            notifybuf[0].resize(WinFileSystemAccess::NOTIFY_NETWORK_BUFFER_SIZE);
+            notifybuf[1].resize(WinFileSystemAccess::NOTIFY_NETWORK_BUFFER_SIZE);
+            readchanges();
+        }
+        else if (e == ERROR_NOTIFY_ENUM_DIR && error < 10)
         {
             // notification buffer overflow
             error++;
@@ -1427,7 +1628,7 @@ void WinDirNotify::readchanges()
 #endif
 }
 
-WinDirNotify::WinDirNotify(string* localbasepath, string* ignore) : DirNotify(localbasepath, ignore)
+WinDirNotify::WinDirNotify(string* localbasepath, string* ignore, size_t bufsize) : DirNotify(localbasepath, ignore)
 {
 #ifndef WINDOWS_PHONE
     ZeroMemory(&overlapped, sizeof(overlapped));
@@ -1435,9 +1636,14 @@ WinDirNotify::WinDirNotify(string* localbasepath, string* ignore) : DirNotify(lo
     enabled = false;
     exit = false;
     active = 0;
+    hVolume = INVALID_HANDLE_VALUE;
 
-    notifybuf[0].resize(65534);
-    notifybuf[1].resize(65534);
+    notifybuf[0].resize(bufsize);
+    notifybuf[1].resize(bufsize);
+
+#ifdef ENABLE_SYNC
+    hVolume = openvolume();
+#endif
 
     int added = WinFileSystemAccess::sanitizedriveletter(localbasepath);
     localbasepath->append("", 1);
@@ -1482,6 +1688,10 @@ WinDirNotify::~WinDirNotify()
 
         CloseHandle(hDirectory);
     }
+    if (hVolume != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hVolume);
+    }
     fsaccess->dirnotifys.erase(this);
 #endif
 }
@@ -1498,7 +1708,7 @@ DirAccess* WinFileSystemAccess::newdiraccess()
 
 DirNotify* WinFileSystemAccess::newdirnotify(string* localpath, string* ignore)
 {
-    WinDirNotify *dirnotify = new WinDirNotify(localpath, ignore);
+    WinDirNotify *dirnotify = new WinDirNotify(localpath, ignore, notifybuffersize);
     dirnotify->fsaccess = this;
     dirnotifys.insert(dirnotify);
     return dirnotify;
@@ -1544,6 +1754,8 @@ bool WinFileSystemAccess::issyncsupported(string *localpath, bool *isnetwork)
 
 bool WinDirAccess::dopen(string* name, FileAccess* f, bool glob)
 {
+    globbing = glob;
+
     if (f)
     {
         if ((hFind = ((WinFileAccess*)f)->hFind) != INVALID_HANDLE_VALUE)
@@ -1653,10 +1865,91 @@ bool WinDirAccess::dnext(string* /*path*/, string* name, bool /*followsymlinks*/
     }
 }
 
+bool WinDirAccess::dnextstat(string* path, DirEntry* entry, bool followsymlinks)
+{
+#ifdef WINDOWS_PHONE
+    return DirAccess::dnextstat(path, entry, followsymlinks);
+#else
+    if (globbing || bulkfailed)
+    {
+        return DirAccess::dnextstat(path, entry, followsymlinks);
+    }
+
+    if (hDir == INVALID_HANDLE_VALUE)
+    {
+        string dirpath = *path;
+        dirpath.append("", 1);
+
+        hDir = CreateFileW((LPCWSTR)dirpath.data(), FILE_LIST_DIRECTORY,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+
+        if (hDir == INVALID_HANDLE_VALUE)
+        {
+            LOG_debug << "Bulk folder enumeration not available. Error code: " << GetLastError();
+            bulkfailed = true;
+            return DirAccess::dnextstat(path, entry, followsymlinks);
+        }
+
+        bulkbuf.resize(65536 / sizeof(LONGLONG));
+    }
+
+    for (;;)
+    {
+        if (bulkpos >= bulklen)
+        {
+            if (!GetFileInformationByHandleEx(hDir, FileIdBothDirectoryInfo, bulkbuf.data(), DWORD(bulkbuf.size() * sizeof(LONGLONG))))
+            {
+                DWORD e = GetLastError();
+                if (e != ERROR_NO_MORE_FILES)
+                {
+                    LOG_debug << "Unable to enumerate folder. Error code: " << e;
+                }
+                return false;
+            }
+
+            bulkpos = 0;
+            bulklen = bulkbuf.size() * sizeof(LONGLONG);
+        }
+
+        FILE_ID_BOTH_DIR_INFO* info = (FILE_ID_BOTH_DIR_INFO*)((char*)bulkbuf.data() + bulkpos);
+        bulkpos = info->NextEntryOffset ? bulkpos + info->NextEntryOffset : bulklen;
+
+        const WCHAR* fname = info->FileName;
+        size_t fnamelen = info->FileNameLength / sizeof(WCHAR);
+
+        if (WinFileAccess::skipattributes(info->FileAttributes)
+         || (fname[0] == '.' && (fnamelen == 1 || (fnamelen == 2 && fname[1] == '.'))))
+        {
+            continue;
+        }
+
+        entry->localname.assign((const char*)fname, info->FileNameLength);
+        entry->type = (info->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? FOLDERNODE : FILENODE;
+        entry->size = entry->type == FILENODE ? m_off_t(info->EndOfFile.QuadPart) : 0;
+
+        FILETIME ft;
+        ft.dwLowDateTime = info->LastWriteTime.LowPart;
+        ft.dwHighDateTime = DWORD(info->LastWriteTime.HighPart);
+        entry->mtime = FileTime_to_POSIX(&ft);
+
+        entry->fsid = handle(info->FileId.QuadPart);
+        entry->fsidvalid = true;
+        entry->statvalid = true;
+        return true;
+    }
+#endif
+}
+
 WinDirAccess::WinDirAccess()
 {
     ffdvalid = false;
     hFind = INVALID_HANDLE_VALUE;
+    globbing = false;
+    hDir = INVALID_HANDLE_VALUE;
+    bulkfailed = false;
+    bulkpos = 0;
+    bulklen = 0;
 }
 
 WinDirAccess::~WinDirAccess()
@@ -1665,5 +1958,10 @@ WinDirAccess::~WinDirAccess()
     {
         FindClose(hFind);
     }
+
+    if (hDir != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hDir);
+    }
 }
 } // namespace
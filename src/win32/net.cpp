@@ -29,6 +29,12 @@ namespace mega {
 
 extern PGTC pGTC;
 
+// milliseconds, for the request timings
+static ULONGLONG tickms()
+{
+    return pGTC ? pGTC() : GetTickCount();
+}
+
 WinHttpIO::WinHttpIO()
 {
     InitializeCriticalSection(&csHTTP);
@@ -37,10 +43,17 @@ WinHttpIO::WinHttpIO()
     hWakeupEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
 
     waiter = NULL;    
+    hSession = NULL;
+    http2 = false;
 }
 
 WinHttpIO::~WinHttpIO()
 {
+    for (auto& it : connections)
+    {
+        WinHttpCloseHandle(it.second);
+    }
+
     WinHttpCloseHandle(hSession);
     LeaveCriticalSection(&csHTTP);
 }
@@ -68,6 +81,63 @@ void WinHttpIO::setuseragent(string* useragent)
             WINHTTP_FLAG_SECURE_PROTOCOL_TLS1_2;
 
     WinHttpSetOption(hSession, WINHTTP_OPTION_SECURE_PROTOCOLS, &protocols, sizeof (protocols));
+
+    if (http2)
+    {
+        applyhttp2();
+    }
+}
+
+void WinHttpIO::applyhttp2()
+{
+    DWORD flags = http2 ? WINHTTP_PROTOCOL_FLAG_HTTP2 : 0;
+
+    if (!WinHttpSetOption(hSession, WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL, &flags, sizeof flags))
+    {
+        LOG_warn << "Unable to set the HTTP protocol. Code: " << GetLastError();
+    }
+}
+
+bool WinHttpIO::sethttp2(bool enable)
+{
+    http2 = enable;
+
+    // the session is created with the user agent
+    if (hSession)
+    {
+        applyhttp2();
+    }
+    return true;
+}
+
+bool WinHttpIO::multiplexes() const
+{
+    return http2;
+}
+
+HINTERNET WinHttpIO::connect(const WCHAR* host, WORD port, bool https)
+{
+    string key;
+    key.reserve(wcslen(host) + 8);
+    key.append(https ? "s:" : ":");
+    for (const WCHAR* c = host; *c; c++)
+    {
+        key.push_back(char(*c < 128 ? *c : '?'));
+    }
+    key.append(":").append(std::to_string(port));
+
+    auto it = connections.find(key);
+    if (it != connections.end())
+    {
+        return it->second;
+    }
+
+    HINTERNET hConnect = WinHttpConnect(hSession, host, port, 0);
+    if (hConnect)
+    {
+        connections[key] = hConnect;
+    }
+    return hConnect;
 }
 
 
@@ -212,9 +282,18 @@ VOID CALLBACK WinHttpIO::asynccallback(HINTERNET hInternet, DWORD_PTR dwContext,
                 }
 
                 LOG_debug << "Request finished with HTTP status: " << req->httpstatus;
+
+                DWORD protocol = 0;
+                DWORD protocolSize = sizeof(protocol);
+                bool usedhttp2 = WinHttpQueryOption(httpctx->hRequest, WINHTTP_OPTION_HTTP_PROTOCOL_USED, &protocol, &protocolSize)
+                              && (protocol & WINHTTP_PROTOCOL_FLAG_HTTP2);
+                httpio->countrequest(httpctx->newconnection, httpctx->newconnection && httpctx->https, usedhttp2);
+                req->ttfbms = httpctx->ttfbms;
+                req->elapsedms = int(tickms() - httpctx->started);
+
                 req->status = (req->httpstatus == 200
                             && (req->contentlength < 0
-                             || req->contentlength == (req->buf ? req->bufpos : (int)req->in.size())))
+                             || req->contentlength == req->received()))
                              ? REQ_SUCCESS : REQ_FAILURE;
 
                 if (req->status == REQ_SUCCESS)
@@ -323,6 +402,7 @@ VOID CALLBACK WinHttpIO::asynccallback(HINTERNET hInternet, DWORD_PTR dwContext,
                 LOG_verbose << "Headers available";
 
                 req->httpstatus = statusCode;
+                httpctx->ttfbms = int(tickms() - httpctx->started);
 
                 if (req->httpio)
                 {
@@ -458,6 +538,11 @@ VOID CALLBACK WinHttpIO::asynccallback(HINTERNET hInternet, DWORD_PTR dwContext,
             httpio->httpevent();
             break;
 
+        case WINHTTP_CALLBACK_STATUS_CONNECTED_TO_SERVER:
+            // only sent when a connection is opened, not when a pooled one is reused
+            httpctx->newconnection = true;
+            break;
+
         case WINHTTP_CALLBACK_STATUS_SENDING_REQUEST:
         {
             if (MegaClient::disablepkp || !req->protect)
@@ -554,7 +639,7 @@ void WinHttpIO::post(HttpReq* req, const char* data, unsigned len)
         LOG_debug << "POST target URL: " << safeurl;
     }
 
-    if (req->binary)
+    if (req->binary || req->contentencoding.size())
     {
         LOG_debug << req->logname << "[sending " << (data ? len : req->out->size()) << " bytes of raw data]";
     }
@@ -579,6 +664,10 @@ void WinHttpIO::post(HttpReq* req, const char* data, unsigned len)
     httpctx->httpio = this;
     httpctx->req = req;
     httpctx->gzip = false;
+    httpctx->https = false;
+    httpctx->newconnection = false;
+    httpctx->started = tickms();
+    httpctx->ttfbms = -1;
 
     req->httpiohandle = (void*)httpctx;
 
@@ -586,13 +675,15 @@ void WinHttpIO::post(HttpReq* req, const char* data, unsigned len)
                             sizeof szURL / sizeof *szURL)
      && WinHttpCrackUrl(szURL, 0, 0, &urlComp))
     {
-        if ((httpctx->hConnect = WinHttpConnect(hSession, szHost, urlComp.nPort, 0)))
+        httpctx->https = urlComp.nScheme == INTERNET_SCHEME_HTTPS;
+
+        if ((httpctx->hConnect = connect(szHost, urlComp.nPort, httpctx->https)))
         {
             httpctx->hRequest = WinHttpOpenRequest(httpctx->hConnect, L"POST",
                                                    urlComp.lpszUrlPath, NULL,
                                                    WINHTTP_NO_REFERER,
                                                    WINHTTP_DEFAULT_ACCEPT_TYPES,
-                                                   (urlComp.nScheme == INTERNET_SCHEME_HTTPS)
+                                                   httpctx->https
                                                    ? WINHTTP_FLAG_SECURE
                                                    : 0);
 
@@ -617,12 +708,15 @@ void WinHttpIO::post(HttpReq* req, const char* data, unsigned len)
                                        | WINHTTP_CALLBACK_FLAG_SECURE_FAILURE
                                        | WINHTTP_CALLBACK_FLAG_SENDREQUEST_COMPLETE
                                        | WINHTTP_CALLBACK_FLAG_SEND_REQUEST
+                                       | WINHTTP_CALLBACK_FLAG_CONNECTED_TO_SERVER
                                        | WINHTTP_CALLBACK_FLAG_WRITE_COMPLETE
                                        | WINHTTP_CALLBACK_FLAG_HANDLES,
                                          0);
 
                 LPCWSTR pwszHeaders = req->type == REQ_JSON || !req->buf
-                                    ? L"Content-Type: application/json\r\nAccept-Encoding: gzip"
+                                    ? (req->contentencoding == "gzip"
+                                       ? L"Content-Type: application/json\r\nAccept-Encoding: gzip\r\nContent-Encoding: gzip"
+                                       : L"Content-Type: application/json\r\nAccept-Encoding: gzip")
                                     : L"Content-Type: application/octet-stream";
 
                 httpctx->postlen = int(data ? len : req->out->size());
@@ -700,11 +794,7 @@ void WinHttpIO::cancel(HttpReq* req)
         req->status = REQ_FAILURE;
         req->httpiohandle = NULL;
 
-        if (httpctx->hConnect)
-        {
-            WinHttpCloseHandle(httpctx->hConnect);
-        }
-
+        // the connection handle stays with the other requests to the same server
         if (httpctx->hRequest)
         {
             WinHttpCloseHandle(httpctx->hRequest);
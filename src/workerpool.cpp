@@ -0,0 +1,342 @@
+/**
+ * @file workerpool.cpp
+ * @brief Threads shared by the parallel parts of the SDK
+ *
+ * (c) 2013-2020 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__) && !defined(__ANDROID__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "mega/workerpool.h"
+#include "mega/logging.h"
+
+namespace mega {
+
+struct WorkerPool::Job
+{
+    workclass_t workclass;
+    size_t tasks;
+    const std::function<void(size_t)>* fn;
+    std::chrono::steady_clock::time_point queuedat;
+    std::atomic<size_t> next{ 0 };
+
+    // threads of the pool in work(): the caller waits for them once it closes the job
+    std::mutex mutex;
+    std::condition_variable helpersDone;
+    unsigned helpers = 0;
+    bool closed = false;
+};
+
+WorkerPool& WorkerPool::get()
+{
+    static WorkerPool pool;
+    return pool;
+}
+
+WorkerPool::~WorkerPool()
+{
+    std::unique_lock<std::mutex> g(mutex);
+    stopthreads(g);
+}
+
+const char* WorkerPool::classname(workclass_t workclass)
+{
+    switch (workclass)
+    {
+        case WORK_NODES: return "nodes";
+        case WORK_FILES: return "files";
+        case WORK_GFX: return "gfx";
+        default: return "unknown";
+    }
+}
+
+unsigned WorkerPool::parallelism(workclass_t workclass)
+{
+    std::lock_guard<std::mutex> g(mutex);
+    startthreads();
+
+    unsigned n = unsigned(workers.size());
+    if (limits[workclass])
+    {
+        n = std::min(n, limits[workclass]);
+    }
+    return n + 1;
+}
+
+void WorkerPool::run(workclass_t workclass, size_t tasks, const std::function<void(size_t)>& fn)
+{
+    if (!tasks)
+    {
+        return;
+    }
+
+    auto job = std::make_shared<Job>();
+    job->workclass = workclass;
+    job->tasks = tasks;
+    job->fn = &fn;
+    job->queuedat = std::chrono::steady_clock::now();
+
+    bool shared = false;
+    if (tasks > 1)
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        startthreads();
+        if (!workers.empty())
+        {
+            queued[workclass].push_back(job);
+            workAvailable.notify_all();
+            shared = true;
+        }
+    }
+
+    work(*job, nullptr);
+
+    if (shared)
+    {
+        {
+            std::lock_guard<std::mutex> g(mutex);
+            auto& q = queued[workclass];
+            auto it = std::find(q.begin(), q.end(), job);
+            if (it != q.end())
+            {
+                q.erase(it);
+            }
+        }
+
+        // all the tasks are claimed: no more threads join, and fn must outlive the ones that did
+        std::unique_lock<std::mutex> jg(job->mutex);
+        job->closed = true;
+        job->helpersDone.wait(jg, [&job]() { return !job->helpers; });
+    }
+
+    std::lock_guard<std::mutex> g(mutex);
+    classstats[workclass].jobs++;
+    classstats[workclass].tasks += tasks;
+}
+
+void WorkerPool::setthreads(int threads)
+{
+    std::unique_lock<std::mutex> g(mutex);
+    wantedthreads = threads < 0 ? -1 : threads;
+    stopthreads(g);
+}
+
+unsigned WorkerPool::threads()
+{
+    std::lock_guard<std::mutex> g(mutex);
+    return unsigned(workers.size());
+}
+
+void WorkerPool::setclasslimit(workclass_t workclass, unsigned maxthreads)
+{
+    std::lock_guard<std::mutex> g(mutex);
+    limits[workclass] = maxthreads;
+    workAvailable.notify_all();
+}
+
+void WorkerPool::setaffinity(uint64_t cpumask)
+{
+    // the threads are started again, pinned (or not) from the start
+    std::unique_lock<std::mutex> g(mutex);
+    affinity = cpumask;
+    stopthreads(g);
+}
+
+WorkerPool::ClassStats WorkerPool::stats(workclass_t workclass)
+{
+    std::lock_guard<std::mutex> g(mutex);
+    return classstats[workclass];
+}
+
+void WorkerPool::startthreads()
+{
+    if (started)
+    {
+        return;
+    }
+    started = true;
+
+    unsigned threads = wantedthreads >= 0 ? unsigned(wantedthreads) : std::max(1u, std::thread::hardware_concurrency()) - 1;
+    try
+    {
+        while (workers.size() < threads)
+        {
+            workers.emplace_back(&WorkerPool::workerLoop, this, generation);
+            pin(workers.back());
+        }
+    }
+    catch (std::system_error& e)
+    {
+        LOG_warn << "Started " << workers.size() << " of " << threads << " worker threads: " << e.what();
+    }
+}
+
+void WorkerPool::stopthreads(std::unique_lock<std::mutex>& g)
+{
+    generation++;
+    started = false;
+    workAvailable.notify_all();
+
+    std::vector<std::thread> stopping;
+    stopping.swap(workers);
+    g.unlock();
+    for (auto& t : stopping)
+    {
+        t.join();
+    }
+    g.lock();
+}
+
+void WorkerPool::pin(std::thread& t)
+{
+    if (!affinity)
+    {
+        return;
+    }
+
+#ifdef _WIN32
+    if (!SetThreadAffinityMask(t.native_handle(), DWORD_PTR(affinity)))
+    {
+        LOG_warn << "Unable to set the affinity of a worker thread: " << GetLastError();
+    }
+#elif defined(__linux__) && !defined(__ANDROID__)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int i = 0; i < 64; i++)
+    {
+        if (affinity >> i & 1)
+        {
+            CPU_SET(i, &cpus);
+        }
+    }
+    if (int e = pthread_setaffinity_np(t.native_handle(), sizeof cpus, &cpus))
+    {
+        LOG_warn << "Unable to set the affinity of a worker thread: " << e;
+    }
+#else
+    (void)t;
+#endif
+}
+
+std::shared_ptr<WorkerPool::Job> WorkerPool::nextjob(workclass_t* workclass)
+{
+    for (int c = 0; c < WORK_CLASSES; c++)
+    {
+        if (limits[c] && running[c] >= limits[c])
+        {
+            continue;
+        }
+
+        auto& q = queued[c];
+        while (!q.empty())
+        {
+            if (q.front()->next >= q.front()->tasks)
+            {
+                // every task claimed: its caller takes care of it
+                q.pop_front();
+                continue;
+            }
+
+            // left at the front, for other threads to join
+            *workclass = workclass_t(c);
+            return q.front();
+        }
+    }
+    return nullptr;
+}
+
+void WorkerPool::workerLoop(unsigned mygeneration)
+{
+    std::unique_lock<std::mutex> g(mutex);
+    for (;;)
+    {
+        workclass_t workclass = WORK_NODES;
+        std::shared_ptr<Job> job;
+        workAvailable.wait(g, [&]() { return generation != mygeneration || (job = nextjob(&workclass)) != nullptr; });
+        if (generation != mygeneration)
+        {
+            return;
+        }
+
+        running[workclass]++;
+        g.unlock();
+
+        ClassStats taskstats;
+        bool joined;
+        {
+            std::lock_guard<std::mutex> jg(job->mutex);
+            if ((joined = !job->closed))
+            {
+                job->helpers++;
+            }
+        }
+
+        if (joined)
+        {
+            work(*job, &taskstats);
+
+            std::lock_guard<std::mutex> jg(job->mutex);
+            if (!--job->helpers && job->closed)
+            {
+                job->helpersDone.notify_all();
+            }
+        }
+
+        g.lock();
+        running[workclass]--;
+
+        ClassStats& s = classstats[workclass];
+        s.queuedtasks += taskstats.queuedtasks;
+        s.totalqueueseconds += taskstats.totalqueueseconds;
+        s.maxqueueseconds = std::max(s.maxqueueseconds, taskstats.maxqueueseconds);
+
+        // a thread held back by the cap of this class may go on
+        if (limits[workclass] && !queued[workclass].empty())
+        {
+            workAvailable.notify_all();
+        }
+    }
+}
+
+size_t WorkerPool::work(Job& job, ClassStats* queuestats)
+{
+    size_t n = 0;
+    for (size_t i; (i = job.next++) < job.tasks; n++)
+    {
+        if (queuestats)
+        {
+            double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - job.queuedat).count();
+            queuestats->queuedtasks++;
+            queuestats->totalqueueseconds += waited;
+            queuestats->maxqueueseconds = std::max(queuestats->maxqueueseconds, waited);
+        }
+
+        (*job.fn)(i);
+    }
+    return n;
+}
+
+} // namespace
@@ -1372,6 +1372,23 @@ TEST_F(SdkTest, SdkTestNodeOperations)
 
     delete nlist;
 
+    // the same search, in pages of one node
+    struct PageTracker : public RequestTracker
+    {
+        vector<MegaHandle> found;
+        void onRequestUpdate(MegaApi*, MegaRequest *request) override
+        {
+            for (int i = 0; request->getMegaNodeList() && i < request->getMegaNodeList()->size(); i++)
+            {
+                found.push_back(request->getMegaNodeList()->get(i)->getHandle());
+            }
+        }
+    } pages;
+    megaApi[0]->searchInPages(rootnode, "copy", 1, &pages);
+    ASSERT_EQ(MegaError::API_OK, pages.waitForResult());
+    ASSERT_EQ(1u, pages.found.size());
+    EXPECT_EQ(n4->getHandle(), pages.found[0]) << "Search node in pages failed";
+
 
     // --- Move a node ---
 
@@ -2267,8 +2267,8 @@ GTEST_TEST(Sync, CmdChecks_RRAttributeAfterMoveNode)
     // check the restore-from-trash handle got set, and correctly
     nameid rrname = AttrMap::string2nameid("rr");
     ASSERT_EQ(f->nodehandle, original_f_handle);
-    ASSERT_EQ(f->attrs.map[rrname], string(Base64Str<MegaClient::NODEHANDLE>(original_f_parent_handle)));
-    ASSERT_EQ(f->attrs.map[rrname], string(Base64Str<MegaClient::NODEHANDLE>(pclientA1->gettestbasenode()->nodehandle)));
+    ASSERT_EQ(f->attrs().map[rrname], string(Base64Str<MegaClient::NODEHANDLE>(original_f_parent_handle)));
+    ASSERT_EQ(f->attrs().map[rrname], string(Base64Str<MegaClient::NODEHANDLE>(pclientA1->gettestbasenode()->nodehandle)));
 
     // move it back
 
@@ -2283,7 +2283,7 @@ GTEST_TEST(Sync, CmdChecks_RRAttributeAfterMoveNode)
     // check it's back and the rr attribute is gone
     f = pclientA1->drillchildnodebyname(pclientA1->gettestbasenode(), "f");
     ASSERT_TRUE(f != nullptr);
-    ASSERT_EQ(f->attrs.map[rrname], string());
+    ASSERT_EQ(f->attrs().map[rrname], string());
 }
 
 
@@ -0,0 +1,56 @@
+/**
+ * @file tests/tool/binlog_decode.cpp
+ * @brief Renders a binary log (see MegaApi::setBinaryLog) as text
+ *
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+#include <fstream>
+#include <iostream>
+
+#include "mega/logging.h"
+
+using namespace mega;
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <binary log>" << std::endl;
+        return 1;
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    BinaryLogReader reader(in);
+    if (!reader.valid())
+    {
+        std::cerr << argv[1] << " is not a binary log" << std::endl;
+        return 1;
+    }
+
+    BinaryLogReader::Entry entry;
+    while (reader.next(entry))
+    {
+        std::cout << entry.render() << "\n";
+    }
+
+    if (!in.eof())
+    {
+        std::cerr << "The log is truncated or corrupt" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file tests/tool/gen_account.cpp
+ * @brief Generates a synthetic account: its fetchnodes response and the matching state cache
+ *
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "mega.h"
+#include "../unit/AccountGenerator.h"
+
+using namespace mega;
+
+namespace {
+
+// nothing goes to the servers: the client only parses and caches
+struct OfflineHttpIO : HttpIO
+{
+    void addevents(Waiter*, int) override {}
+    void post(struct HttpReq*, const char* = NULL, unsigned = 0) override {}
+    void cancel(HttpReq*) override {}
+    m_off_t postpos(void*) override { return 0; }
+    bool doio(void) override { return false; }
+    void setuseragent(string*) override {}
+};
+
+int usage(const char* name)
+{
+    std::cerr << "Usage: " << name << " <output folder> [--depth N] [--fanout N] [--files N] [--shares N]"
+              << " [--versioned N] [--versions N] [--seed N]" << std::endl
+              << "Writes fetchnodes.json, account and the state cache of the account to the folder." << std::endl
+              << "Run the unit test AccountGenerator.fetchnodes_benchmark with MEGA_ACCOUNT_FIXTURE=<folder> to load it." << std::endl;
+    return 1;
+}
+
+} // anonymous
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || argc % 2)
+    {
+        return usage(argv[0]);
+    }
+
+    mt::AccountShape shape;
+    for (int i = 2; i < argc; i += 2)
+    {
+        unsigned value = unsigned(atoi(argv[i + 1]));
+        if (!strcmp(argv[i], "--depth")) shape.depth = value;
+        else if (!strcmp(argv[i], "--fanout")) shape.fanout = value;
+        else if (!strcmp(argv[i], "--files")) shape.files = value;
+        else if (!strcmp(argv[i], "--shares")) shape.shares = value;
+        else if (!strcmp(argv[i], "--versioned")) shape.versioned = value;
+        else if (!strcmp(argv[i], "--versions")) shape.versions = value;
+        else if (!strcmp(argv[i], "--seed")) shape.seed = value;
+        else return usage(argv[0]);
+    }
+
+    string dir = argv[1];
+    mt::GeneratedAccount account = mt::generateAccount(shape);
+    if (!mt::saveAccount(account, dir))
+    {
+        std::cerr << "Cannot write to " << dir << std::endl;
+        return 1;
+    }
+    std::cout << account.nodes << " nodes (" << account.versions << " versions), "
+              << account.fetchnodes.size() / (1024 * 1024) << " MB of fetchnodes response" << std::endl;
+
+#ifdef USE_SQLITE
+    // the state cache, written by a client that has loaded the response
+    MegaApp app;
+    OfflineHttpIO httpio;
+    FSACCESS_CLASS fsaccess;
+    string dbpath = dir + "/";
+    SqliteDbAccess dbaccess(&dbpath);
+    {
+        MegaClient client(&app, nullptr, &httpio, &fsaccess, nullptr, nullptr, "XXX", "gen_account");
+        mt::loginAs(client, account);
+        if (!mt::readFetchnodes(client, account.fetchnodes))
+        {
+            std::cerr << "The generated response does not parse" << std::endl;
+            return 1;
+        }
+        client.mergenewshares(0);
+        client.applykeys();
+
+        string dbname = "statecache";
+        client.sctable = dbaccess.open(client.rng, &fsaccess, &dbname, false, false);
+        client.initsc();
+        client.sctable->commit();
+    }
+    std::cout << "State cache written" << std::endl;
+#else
+    std::cout << "Built without SQLite: no state cache written" << std::endl;
+#endif
+    return 0;
+}
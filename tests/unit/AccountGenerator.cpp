@@ -0,0 +1,378 @@
+/**
+ * (c) 2019 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "AccountGenerator.h"
+
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+
+#include <mega/base64.h>
+#include <mega/filefingerprint.h>
+#include <mega/json.h>
+
+namespace mt {
+
+namespace {
+
+using mega::byte;
+using mega::handle;
+using mega::MegaClient;
+using mega::SymmCipher;
+
+struct Share
+{
+    handle h;
+    std::unique_ptr<SymmCipher> key;
+};
+
+class Generator
+{
+public:
+    Generator(const AccountShape& shape, GeneratedAccount& account)
+        : mShape(shape)
+        , mAccount(account)
+        , mRng(shape.seed)
+    {
+    }
+
+    void run()
+    {
+        mAccount.masterkey = randomBytes(SymmCipher::KEYLENGTH);
+        mMaster.setkey((const byte*)mAccount.masterkey.data());
+        mAccount.me = userHandle();
+        addUser(mAccount.me, 2, "owner@mega.example");
+
+        mAccount.root = mNext;
+        for (int type = mega::ROOTNODE; type <= mega::RUBBISHNODE; type++)
+        {
+            addRecord("{\"h\":\"" + nodeHandle(mNext++) + "\",\"u\":\"" + userHandle(mAccount.me) + "\",\"t\":" + std::to_string(type)
+                      + ",\"a\":\"\",\"k\":\"\",\"ts\":" + std::to_string(mTime) + "}");
+        }
+        addChildren(mAccount.root, 0, nullptr);
+
+        byte scsn[8];
+        randomBytes(scsn, sizeof scsn);
+
+        mAccount.fetchnodes = "{\"f\":[" + mNodes + "],\"ok\":[" + mOk + "],\"s\":[" + mShares + "],\"u\":[" + mUsers
+                              + "],\"sn\":\"" + mega::Base64::btoa(std::string((const char*)scsn, sizeof scsn)) + "\"}";
+    }
+
+private:
+    const AccountShape& mShape;
+    GeneratedAccount& mAccount;
+    std::mt19937_64 mRng;
+    SymmCipher mMaster;
+    handle mNext = 1;
+    unsigned mFiles = 0;
+    const mega::m_time_t mTime = 1580000000;
+    std::deque<Share> mShareKeys;    // stable, for the subtrees to point at
+    std::string mNodes, mOk, mShares, mUsers;
+
+    void randomBytes(byte* data, size_t n)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            data[i] = byte(mRng());
+        }
+    }
+
+    std::string randomBytes(size_t n)
+    {
+        std::string s(n, '\0');
+        randomBytes((byte*)s.data(), n);
+        return s;
+    }
+
+    handle userHandle()
+    {
+        return handle(mRng());
+    }
+
+    static std::string userHandle(handle h)
+    {
+        return mega::Base64Str<MegaClient::USERHANDLE>(h).chars;
+    }
+
+    static std::string nodeHandle(handle h)
+    {
+        return mega::Base64Str<MegaClient::NODEHANDLE>(h).chars;
+    }
+
+    std::string wrap(SymmCipher& cipher, std::string key)
+    {
+        cipher.ecb_encrypt((byte*)key.data(), nullptr, key.size());
+        return mega::Base64::btoa(key);
+    }
+
+    void addRecord(const std::string& record)
+    {
+        mNodes += mNodes.empty() ? "" : ",";
+        mNodes += record;
+        mAccount.nodes++;
+    }
+
+    void addUser(handle uh, int visibility, const std::string& email)
+    {
+        mUsers += mUsers.empty() ? "" : ",";
+        mUsers += "{\"u\":\"" + userHandle(uh) + "\",\"c\":" + std::to_string(visibility) + ",\"m\":\"" + email + "\"}";
+    }
+
+    void addNode(handle h, handle parent, mega::nodetype_t type, const std::string& name, const Share* share)
+    {
+        std::string key = randomBytes(type == mega::FILENODE ? mega::FILENODEKEYLENGTH : mega::FOLDERNODEKEYLENGTH);
+
+        // the attributes, encrypted the way MegaClient::makeattr() does
+        std::string attrs = "MEGA{\"n\":\"" + name + "\"";
+        m_off_t size = 0;
+        if (type == mega::FILENODE)
+        {
+            mega::FileFingerprint ffp;
+            ffp.size = size = m_off_t(mRng() % (64 << 20));
+            ffp.mtime = mTime - mega::m_time_t(mRng() % 100000000);
+            for (auto& crc : ffp.crc)
+            {
+                crc = int32_t(mRng());
+            }
+            std::string fingerprint;
+            ffp.serializefingerprint(&fingerprint);
+            attrs += ",\"c\":\"" + fingerprint + "\"";
+        }
+        attrs += "}";
+        attrs.resize((attrs.size() + SymmCipher::BLOCKSIZE - 1) & ~size_t(SymmCipher::BLOCKSIZE - 1), '\0');
+        SymmCipher nodecipher;
+        nodecipher.setkey(&key);
+        nodecipher.cbc_encrypt((byte*)attrs.data(), attrs.size());
+
+        std::string k;
+        if (share && mRng() % 4 == 0)
+        {
+            k = nodeHandle(share->h) + ":" + wrap(*share->key, key);
+        }
+        else
+        {
+            k = userHandle(mAccount.me) + ":" + wrap(mMaster, key);
+        }
+
+        std::string record = "{\"h\":\"" + nodeHandle(h) + "\",\"p\":\"" + nodeHandle(parent) + "\",\"u\":\"" + userHandle(mAccount.me)
+                           + "\",\"t\":" + std::to_string(type) + ",\"a\":\"" + mega::Base64::btoa(attrs) + "\",\"k\":\"" + k + "\"";
+        if (type == mega::FILENODE)
+        {
+            record += ",\"s\":" + std::to_string(size);
+        }
+        addRecord(record + ",\"ts\":" + std::to_string(mTime) + "}");
+    }
+
+    const Share* addShare(handle h)
+    {
+        std::string key = randomBytes(SymmCipher::KEYLENGTH);
+        mShareKeys.push_back(Share{h, std::unique_ptr<SymmCipher>(new SymmCipher((const byte*)key.data()))});
+
+        // the share authentication tag, as MegaClient::handleauth() computes it
+        byte auth[SymmCipher::BLOCKSIZE];
+        mega::Base64::btoa((const byte*)&h, MegaClient::NODEHANDLE, (char*)auth);
+        memcpy(auth + sizeof h, auth, sizeof h);
+        mMaster.ecb_encrypt(auth);
+
+        handle contact = userHandle();
+        addUser(contact, 1, "contact" + std::to_string(mShareKeys.size()) + "@mega.example");
+
+        mOk += mOk.empty() ? "" : ",";
+        mOk += "{\"h\":\"" + nodeHandle(h) + "\",\"ha\":\"" + mega::Base64::btoa(std::string((const char*)auth, sizeof auth))
+             + "\",\"k\":\"" + wrap(mMaster, key) + "\"}";
+        mShares += mShares.empty() ? "" : ",";
+        mShares += "{\"h\":\"" + nodeHandle(h) + "\",\"u\":\"" + userHandle(contact) + "\",\"r\":1,\"ts\":" + std::to_string(mTime) + "}";
+
+        return &mShareKeys.back();
+    }
+
+    void addFile(handle parent, const std::string& name, const Share* share)
+    {
+        handle h = mNext++;
+        addNode(h, parent, mega::FILENODE, name, share);
+
+        // older versions are children of the newer one
+        if (mShape.versioned && mFiles++ % mShape.versioned == 0)
+        {
+            for (unsigned v = 0; v < mShape.versions; v++)
+            {
+                handle older = mNext++;
+                addNode(older, h, mega::FILENODE, name, share);
+                mAccount.versions++;
+                h = older;
+            }
+        }
+    }
+
+    void addChildren(handle parent, unsigned level, const Share* share)
+    {
+        for (unsigned i = 0; i < mShape.files; i++)
+        {
+            addFile(parent, "file" + std::to_string(i) + ".jpg", share);
+        }
+
+        if (level < mShape.depth)
+        {
+            for (unsigned i = 0; i < mShape.fanout; i++)
+            {
+                handle h = mNext++;
+                const Share* folderShare = share;
+                if (!level && i < mShape.shares)
+                {
+                    folderShare = addShare(h);
+                }
+                else if (!level && mAccount.syncroot == mega::UNDEF)
+                {
+                    mAccount.syncroot = h;
+                }
+
+                addNode(h, parent, mega::FOLDERNODE, "folder" + std::to_string(i), share);
+                addChildren(h, level + 1, folderShare);
+            }
+        }
+    }
+};
+
+std::string handleToString(handle h)
+{
+    return mega::Base64::btoa(std::string((const char*)&h, sizeof h));
+}
+
+handle stringToHandle(const std::string& s)
+{
+    handle h = mega::UNDEF;
+    std::string binary = mega::Base64::atob(s);
+    if (binary.size() == sizeof h)
+    {
+        memcpy(&h, binary.data(), sizeof h);
+    }
+    return h;
+}
+
+} // anonymous
+
+GeneratedAccount generateAccount(const AccountShape& shape)
+{
+    GeneratedAccount account;
+    Generator(shape, account).run();
+    return account;
+}
+
+bool saveAccount(const GeneratedAccount& account, const std::string& dir)
+{
+    std::ofstream fetchnodes(dir + "/fetchnodes.json", std::ios::binary);
+    fetchnodes << account.fetchnodes;
+
+    std::ofstream fields(dir + "/account");
+    fields << mega::Base64::btoa(account.masterkey) << ' ' << handleToString(account.me) << ' ' << handleToString(account.root)
+           << ' ' << handleToString(account.syncroot) << ' ' << account.nodes << ' ' << account.versions << '\n';
+
+    return fetchnodes.good() && fields.good();
+}
+
+bool loadAccount(GeneratedAccount& account, const std::string& dir)
+{
+    std::ifstream fields(dir + "/account");
+    std::string masterkey, me, root, syncroot;
+    if (!(fields >> masterkey >> me >> root >> syncroot >> account.nodes >> account.versions))
+    {
+        return false;
+    }
+    account.masterkey = mega::Base64::atob(masterkey);
+    account.me = stringToHandle(me);
+    account.root = stringToHandle(root);
+    account.syncroot = stringToHandle(syncroot);
+
+    std::ifstream fetchnodes(dir + "/fetchnodes.json", std::ios::binary);
+    std::ostringstream s;
+    s << fetchnodes.rdbuf();
+    account.fetchnodes = s.str();
+
+    return account.masterkey.size() == SymmCipher::KEYLENGTH && !account.fetchnodes.empty();
+}
+
+void loginAs(mega::MegaClient& client, const GeneratedAccount& account)
+{
+    client.key.setkey((const byte*)account.masterkey.data());
+    client.me = account.me;
+    client.uid = mega::Base64Str<MegaClient::USERHANDLE>(account.me).chars;
+}
+
+bool readFetchnodes(mega::MegaClient& client, const std::string& response)
+{
+    using mega::nameid;
+
+    mega::JSON j;
+    j.begin(response.c_str());
+    if (!j.enterobject())
+    {
+        return false;
+    }
+
+    for (;;)
+    {
+        switch (j.getnameid())
+        {
+            case 'f':
+                client.nodes.reserve(strlen(j.pos) / MegaClient::FETCHNODES_RECORD_SIZE);
+                // fall through
+            case MAKENAMEID2('f', '2'):
+                if (!client.readnodes(&j, 0))
+                {
+                    return false;
+                }
+                break;
+
+            case MAKENAMEID2('o', 'k'):
+                client.readok(&j);
+                break;
+
+            case 's':
+                client.readoutshares(&j);
+                break;
+
+            case 'u':
+                if (!client.readusers(&j, false))
+                {
+                    return false;
+                }
+                break;
+
+            case MAKENAMEID2('s', 'n'):
+                if (!client.setscsn(&j))
+                {
+                    return false;
+                }
+                break;
+
+            case EOO:
+                return j.leaveobject();
+
+            default:
+                if (!j.storeobject())
+                {
+                    return false;
+                }
+        }
+    }
+}
+
+} // mt
@@ -0,0 +1,68 @@
+/**
+ * (c) 2019 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#pragma once
+
+#include <string>
+
+#include <mega/megaclient.h>
+
+namespace mt {
+
+// The shape of a synthetic account: a tree of folders below the cloud drive, some of the
+// top folders shared out to a contact each, and chains of older versions behind some files
+struct AccountShape
+{
+    unsigned depth = 3;         // levels of folders below the cloud drive
+    unsigned fanout = 8;        // subfolders of each folder above the last level
+    unsigned files = 16;        // files in each folder
+    unsigned shares = 2;        // top folders shared out
+    unsigned versioned = 8;     // one file in this many has older versions...
+    unsigned versions = 3;      // ...this many of them
+    unsigned seed = 1;
+};
+
+// The fetchnodes response of a synthetic account, encrypted like the real one: node keys wrapped
+// with the master key (a quarter of those in shares with the share key, as if the contact had
+// added them), share keys with the master key, and attributes with the node keys.
+// The same shape always gives the same account
+struct GeneratedAccount
+{
+    std::string masterkey;
+    mega::handle me = mega::UNDEF;
+    mega::handle root = mega::UNDEF;
+    mega::handle syncroot = mega::UNDEF;    // the first top folder which is not shared
+    size_t nodes = 0;                       // versions and the root nodes included
+    size_t versions = 0;
+    std::string fetchnodes;
+};
+
+GeneratedAccount generateAccount(const AccountShape& shape);
+
+// <dir>/fetchnodes.json and <dir>/account, which holds the rest of the fields
+bool saveAccount(const GeneratedAccount& account, const std::string& dir);
+bool loadAccount(GeneratedAccount& account, const std::string& dir);
+
+// makes the client the owner of the account, logged in offline
+void loginAs(mega::MegaClient& client, const GeneratedAccount& account);
+
+// reads a fetchnodes response into the client the way CommandFetchNodes does, short of merging
+// the shares and applying the keys - left to the caller, to time them apart
+bool readFetchnodes(mega::MegaClient& client, const std::string& response);
+
+} // mt
@@ -0,0 +1,266 @@
+/**
+ * (c) 2019 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+
+#include <gtest/gtest.h>
+
+#include <mega.h>
+
+#include "AccountGenerator.h"
+#include "DefaultedFileSystemAccess.h"
+#include "utils.h"
+
+namespace {
+
+struct MockFileSystemAccess : mt::DefaultedFileSystemAccess
+{
+    void local2path(std::string* local, std::string* path) const override
+    {
+        *path = *local;
+    }
+
+    void path2local(std::string* local, std::string* path) const override
+    {
+        *path = *local;
+    }
+
+    bool getsname(std::string*, std::string*) const override
+    {
+        return false;
+    }
+};
+
+struct MockClient
+{
+    mega::MegaApp app;
+    MockFileSystemAccess fs;
+    std::shared_ptr<mega::MegaClient> cli = mt::makeClient(app, fs);
+};
+
+#ifdef ENABLE_SYNC
+// what the Sync constructor does with the state cache, once it has found the local root
+struct SyncStartup : mega::Sync
+{
+    static bool readcache(mega::Sync& sync)
+    {
+        return (sync.*&SyncStartup::readstatecache)();
+    }
+};
+
+// the state cache of a sync of `remote`, as a finished initial sync leaves it: the folders and
+// files below it (not their versions), with their fingerprints
+size_t addLocalNodes(mega::Sync& sync, mega::LocalNode& parent, mega::Node& remote, mega::DbTable& table)
+{
+    size_t count = 0;
+    for (mega::Node* child : remote.children)
+    {
+        mega::FileFingerprint ffp;
+        if (child->type == mega::FILENODE)
+        {
+            ffp = *child;
+        }
+
+        // owned by the parent from now on
+        mega::LocalNode* l = mt::makeLocalNode(sync, parent, child->type, child->displayname(), ffp).release();
+        l->setnode(child);
+        EXPECT_TRUE(table.put(mega::MegaClient::CACHEDLOCALNODE, l, &sync.client->key));
+        count++;
+
+        if (child->type == mega::FOLDERNODE)
+        {
+            count += addLocalNodes(sync, *l, *child, table);
+        }
+    }
+    return count;
+}
+#endif
+
+}
+
+TEST(AccountGenerator, generatesTheShapeAsked)
+{
+    mt::AccountShape shape;
+    shape.depth = 2;
+    shape.fanout = 3;
+    shape.files = 4;
+    shape.shares = 1;
+    shape.versioned = 2;
+    shape.versions = 2;
+    const auto account = mt::generateAccount(shape);
+
+    // 12 folders, 4 files in each and in the cloud drive, every other file with 2 older versions
+    const size_t folders = 3 + 9, files = (folders + 1) * 4;
+    ASSERT_EQ(files, account.versions);
+    ASSERT_EQ(3 + folders + files + account.versions, account.nodes);
+    ASSERT_EQ(account.fetchnodes, mt::generateAccount(shape).fetchnodes);
+
+    MockClient client;
+    mt::loginAs(*client.cli, account);
+    ASSERT_TRUE(mt::readFetchnodes(*client.cli, account.fetchnodes));
+    client.cli->mergenewshares(0);
+    client.cli->applykeys();
+
+    ASSERT_EQ(account.nodes, client.cli->nodes.size());
+    ASSERT_EQ(account.root, client.cli->rootnodes[0]);
+    ASSERT_STRNE("", client.cli->scsn);
+
+    size_t versions = 0, shares = 0, sharekeys = 0;
+    for (auto& it : client.cli->nodes)
+    {
+        mega::Node* n = it.second;
+        if (n->type > mega::FOLDERNODE)
+        {
+            continue;
+        }
+
+        // every key unwrapped, with the master key or a share key, and every name decrypted
+        ASSERT_TRUE(n->keyApplied()) << mega::toNodeHandle(n->nodehandle);
+        ASSERT_EQ(nullptr, n->attrstring.get());
+        ASSERT_EQ(0u, std::string(n->displayname()).find(n->type == mega::FILENODE ? "file" : "folder"));
+
+        versions += n->type == mega::FILENODE && n->parent && n->parent->type == mega::FILENODE;
+        if (n->outshares)
+        {
+            shares++;
+            sharekeys += n->sharekey != nullptr;
+        }
+    }
+    ASSERT_EQ(account.versions, versions);
+    ASSERT_EQ(1u, shares);
+    ASSERT_EQ(1u, sharekeys);
+
+    mega::Node* syncroot = client.cli->nodebyhandle(account.syncroot);
+    ASSERT_NE(nullptr, syncroot);
+    ASSERT_EQ(nullptr, syncroot->outshares);
+}
+
+#ifdef USE_SQLITE
+// Loads an account offline the way a session does, phase by phase: the fetchnodes response,
+// the share merge and key application, writing the state cache, reading it back into another
+// client, and (with syncs) starting a sync of a top folder from its own state cache.
+// The account is the generator tool's output in MEGA_ACCOUNT_FIXTURE, or about 100000 nodes
+TEST(AccountGenerator, DISABLED_fetchnodes_benchmark)
+{
+    mt::GeneratedAccount account;
+    const char* fixture = getenv("MEGA_ACCOUNT_FIXTURE");
+    if (fixture)
+    {
+        ASSERT_TRUE(mt::loadAccount(account, fixture));
+    }
+    else
+    {
+        mt::AccountShape shape;
+        shape.depth = 4;
+        account = mt::generateAccount(shape);
+    }
+
+    auto phase = [&account](const std::string& name, std::function<void()> f)
+    {
+        double ms = mt::elapsedMs(f);
+        long rss = mt::residentMemoryKB();
+        long peak = mt::peakMemoryKB();
+        mt::recordBenchmark(name + "_ms", ms);
+        mt::recordBenchmark(name + "_rss_kb", double(rss));
+        mt::recordBenchmark(name + "_peak_rss_kb", double(peak));
+    };
+
+    mega::PrnGen rng;
+    mega::FSACCESS_CLASS fsaccess;
+    std::string path = "./";
+    mega::SqliteDbAccess dbaccess{&path};
+    std::string dbname = "fetchnodes_benchmark";
+
+    MockClient fetched;
+    mt::loginAs(*fetched.cli, account);
+    phase("readnodes", [&]()
+    {
+        ASSERT_TRUE(mt::readFetchnodes(*fetched.cli, account.fetchnodes));
+    });
+    ASSERT_EQ(account.nodes, fetched.cli->nodes.size());
+
+    phase("applykeys", [&]()
+    {
+        fetched.cli->mergenewshares(0);
+        fetched.cli->applykeys();
+    });
+
+    phase("initsc", [&]()
+    {
+        fetched.cli->sctable = dbaccess.open(rng, &fsaccess, &dbname, false, false);
+        fetched.cli->initsc();
+        fetched.cli->sctable->commit();
+    });
+
+    {
+        // the tool's own state cache, if there is one
+        std::string fixturepath = fixture ? std::string(fixture) + "/" : path;
+        mega::SqliteDbAccess fixturedb{&fixturepath};
+        std::string fixturename = "statecache";
+        std::unique_ptr<mega::DbTable> table;
+        if (fixture)
+        {
+            table.reset(fixturedb.open(rng, &fsaccess, &fixturename, false, false));
+        }
+        else
+        {
+            table.reset(dbaccess.open(rng, &fsaccess, &dbname, false, false));
+        }
+
+        MockClient cached;
+        mt::loginAs(*cached.cli, account);
+        phase("fetchsc", [&]()
+        {
+            ASSERT_TRUE(cached.cli->fetchsc(table.get()));
+        });
+        ASSERT_EQ(account.nodes, cached.cli->nodes.size());
+    }
+
+#ifdef ENABLE_SYNC
+    mega::Node* syncroot = fetched.cli->nodebyhandle(account.syncroot);
+    ASSERT_NE(nullptr, syncroot);
+    std::string syncdbname = "fetchnodes_benchmark_sync";
+    size_t cachedlocalnodes;
+    {
+        auto writer = mt::makeSync(*fetched.cli, "benchmark_writer");
+        std::unique_ptr<mega::DbTable> table(dbaccess.open(rng, &fsaccess, &syncdbname, false, false));
+        table->begin();
+        cachedlocalnodes = addLocalNodes(*writer, *writer->localroot, *syncroot, *table);
+        table->commit();
+    }
+
+    std::unique_ptr<mega::Sync> sync;
+    phase("sync_startup", [&]()
+    {
+        sync = mt::makeSync(*fetched.cli, "benchmark_reader");
+        sync->statecachetable = dbaccess.open(rng, &fsaccess, &syncdbname, false, false);
+        sync->state = mega::SYNC_INITIALSCAN;
+        ASSERT_TRUE(SyncStartup::readcache(*sync));
+        sync->state = mega::SYNC_CANCELED;
+    });
+    // and the sync root
+    ASSERT_EQ(cachedlocalnodes + 1, size_t(sync->localnodes[mega::FILENODE] + sync->localnodes[mega::FOLDERNODE]));
+    sync->statecachetable->remove();
+    sync.reset();
+#endif
+
+    fetched.cli->sctable->remove();
+}
+#endif
@@ -0,0 +1,292 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "ApiServer.h"
+
+#include <cstring>
+
+#include <zlib.h>
+
+#include <mega/base64.h>
+#include <mega/megaclient.h>
+
+namespace mt {
+
+namespace {
+
+// the body of a batch sent with Content-Encoding: gzip
+std::string gunzip(const std::string& gz)
+{
+    z_stream z;
+    memset(&z, 0, sizeof z);
+    if (inflateInit2(&z, MAX_WBITS + 16) != Z_OK)
+    {
+        return std::string();
+    }
+
+    std::string out;
+    char buf[16384];
+    z.next_in = (Bytef*)gz.data();
+    z.avail_in = uInt(gz.size());
+    int t;
+    do
+    {
+        z.next_out = (Bytef*)buf;
+        z.avail_out = sizeof buf;
+        t = inflate(&z, Z_NO_FLUSH);
+        out.append(buf, sizeof buf - z.avail_out);
+    } while (t == Z_OK);
+    inflateEnd(&z);
+    return t == Z_STREAM_END ? out : std::string();
+}
+
+// a node handle, from its base64 (UNDEF: not one)
+mega::handle handleof(const std::string& b64)
+{
+    std::string binary = mega::Base64::atob(b64);
+    mega::handle h = mega::UNDEF;
+    if (binary.size() == size_t(mega::MegaClient::NODEHANDLE))
+    {
+        h = 0;
+        memcpy(&h, binary.data(), binary.size());
+    }
+    return h;
+}
+
+std::string b64of(mega::handle h)
+{
+    return mega::Base64Str<mega::MegaClient::NODEHANDLE>(h).chars;
+}
+
+} // anonymous
+
+void ApiServer::post(mega::HttpReq* req, const char* data, unsigned len)
+{
+    const std::string& api = mega::MegaClient::APIURL;
+    if (req->posturl.compare(0, api.size(), api))
+    {
+        return StorageServer::post(req, data, len);
+    }
+
+    req->in.clear();
+    req->status = mega::REQ_INFLIGHT;
+    req->httpiohandle = nullptr;
+    if (req->posturl.compare(api.size(), 3, "cs?"))
+    {
+        parked.insert(req);
+        return;
+    }
+
+    std::string batch = data ? std::string(data, len) : *req->out;
+    if (req->contentencoding == "gzip")
+    {
+        batch = gunzip(batch);
+    }
+
+    Reply& r = replies[req];
+    r.due = clock::now() + std::chrono::milliseconds(latencyMs);
+    r.body = answer(batch);
+}
+
+void ApiServer::cancel(mega::HttpReq* req)
+{
+    if (replies.erase(req) || parked.erase(req))
+    {
+        req->httpstatus = 0;
+        req->status = mega::REQ_FAILURE;
+        return;
+    }
+    StorageServer::cancel(req);
+}
+
+bool ApiServer::doio()
+{
+    bool changed = StorageServer::doio();
+    clock::time_point now = clock::now();
+    for (auto it = replies.begin(); it != replies.end(); )
+    {
+        if (it->second.due > now)
+        {
+            ++it;
+            continue;
+        }
+
+        mega::HttpReq* req = it->first;
+        req->in = std::move(it->second.body);
+        req->contentlength = m_off_t(req->in.size());
+        req->bufpos = req->contentlength;
+        req->httpstatus = 200;
+        req->status = mega::REQ_SUCCESS;
+        req->httpio = nullptr;
+        req->lastdata = mega::Waiter::ds;
+        lastdata = mega::Waiter::ds;
+        success = true;
+        changed = true;
+        it = replies.erase(it);
+    }
+    return changed;
+}
+
+std::string ApiServer::answer(const std::string& batch)
+{
+    batches++;
+
+    mega::JSON j;
+    j.begin(batch.c_str());
+    if (!j.enterarray())
+    {
+        return "-2";
+    }
+
+    std::string response = "[";
+    while (j.enterobject())
+    {
+        // the name of a command comes first
+        std::string a;
+        if (j.getnameid() != 'a' || !j.storeobject(&a))
+        {
+            return "-2";
+        }
+        commands[a]++;
+
+        if (response.size() > 1)
+        {
+            response += ",";
+        }
+
+        if (a == "p")
+        {
+            response += putnodes(j);
+        }
+        else if (a == "u")
+        {
+            response += putfile(j);
+        }
+        else
+        {
+            while (j.getnameid() != EOO && j.storeobject());
+            response += "0";
+        }
+        j.leaveobject();
+    }
+    return response + "]";
+}
+
+std::string ApiServer::putnodes(mega::JSON& j)
+{
+    mega::handle target = mega::UNDEF;
+    std::string created;
+    std::map<mega::handle, mega::handle> batchHandles;     // the handles of this batch's nodes, by their temporary ones
+    int index = 0;
+
+    mega::nameid name;
+    while ((name = j.getnameid()) != EOO)
+    {
+        if (name != 'n' || !j.enterarray())
+        {
+            std::string value;
+            j.storeobject(&value);
+            if (name == 't')
+            {
+                target = handleof(value);
+            }
+            continue;
+        }
+
+        while (j.enterobject())
+        {
+            std::string h, p, a, k;
+            int type = mega::TYPE_UNKNOWN;
+            while ((name = j.getnameid()) != EOO)
+            {
+                switch (name)
+                {
+                    case 'h': j.storeobject(&h); break;
+                    case 'p': j.storeobject(&p); break;
+                    case 'a': j.storeobject(&a); break;
+                    case 'k': j.storeobject(&k); break;
+                    case 't': type = int(j.getint()); break;
+                    default: j.storeobject();
+                }
+            }
+            j.leaveobject();
+
+            mega::handle nh = nextHandle++;
+            mega::handle source = handleof(h);
+            if (!ISUNDEF(source))
+            {
+                batchHandles[source] = nh;
+            }
+
+            // the parent is a node of this batch, an existing node or the target
+            mega::handle parent = target;
+            if (p.size())
+            {
+                auto it = batchHandles.find(handleof(p));
+                parent = it != batchHandles.end() ? it->second : handleof(p);
+            }
+
+            std::string node = "{\"h\":\"" + b64of(nh) + "\",\"p\":\"" + b64of(parent) + "\",\"u\":\"" + uid
+                    + "\",\"t\":" + std::to_string(type) + ",\"a\":\"" + a + "\",\"k\":\"" + uid + ":" + k
+                    + "\",\"ts\":" + std::to_string(mega::m_time()) + ",\"i\":" + std::to_string(index++);
+            if (type == mega::FILENODE)
+            {
+                // an upload names its token, a copy its source
+                m_off_t size = ISUNDEF(source) ? tokenSize(mega::Base64::atob(h)) : sizes[source];
+                sizes[nh] = size;
+                node += ",\"s\":" + std::to_string(size);
+            }
+            created += (created.size() ? "," : "") + node + "}";
+            nodesCreated++;
+        }
+        j.leavearray();
+    }
+    return "{\"f\":[" + created + "]}";
+}
+
+std::string ApiServer::putfile(mega::JSON& j)
+{
+    m_off_t size = 0;
+    mega::nameid name;
+    while ((name = j.getnameid()) != EOO)
+    {
+        if (name == 's')
+        {
+            size = j.getint();
+        }
+        else
+        {
+            j.storeobject();
+        }
+    }
+    return "{\"p\":\"" + acceptUpload("u" + std::to_string(nextUpload++), size) + "\"}";
+}
+
+ApiServer::~ApiServer()
+{
+    for (auto& r : replies)
+    {
+        r.first->httpio = nullptr;
+    }
+    for (auto req : parked)
+    {
+        req->httpio = nullptr;
+    }
+}
+
+} // mt
@@ -0,0 +1,84 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+
+#include <mega/json.h>
+
+#include "StorageServer.h"
+
+namespace mt {
+
+// The API in memory, beside the storage servers, for a client that is logged in offline (see
+// loginAs()) and runs exec() as usual: it answers the command batches with what a sync needs,
+// creating the nodes of putnodes (folders, copies of existing files and completed uploads) and
+// handing out upload URLs of its storage servers; every other command succeeds with a 0.
+// Other API requests (the server-client channel) stay open without a reply, as with no action
+// packets to send: the client applies its own changes from the replies, as it does anyway.
+// No versions are kept ("ov" is ignored): clients should disable them
+class ApiServer : public StorageServer
+{
+public:
+    // the owner of the new nodes, as MegaClient::uid
+    std::string uid;
+
+    // before the reply to each batch, on the wall clock
+    int latencyMs = 0;
+
+    // batches and commands answered, by command
+    unsigned batches = 0;
+    std::map<std::string, unsigned> commands;
+    unsigned nodesCreated = 0;
+
+    // whether a batch is waiting for its reply
+    bool answering() const { return !replies.empty(); }
+
+    void post(mega::HttpReq*, const char* = NULL, unsigned = 0) override;
+    void cancel(mega::HttpReq*) override;
+    bool doio(void) override;
+
+    ~ApiServer();
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct Reply
+    {
+        clock::time_point due;
+        std::string body;
+    };
+
+    std::map<mega::HttpReq*, Reply> replies;
+    std::set<mega::HttpReq*> parked;
+
+    // node sizes by handle, for copies
+    std::map<mega::handle, m_off_t> sizes;
+    mega::handle nextHandle = mega::handle(1) << 40;
+    unsigned nextUpload = 0;
+
+    std::string answer(const std::string& batch);
+    std::string putnodes(mega::JSON& j);
+    std::string putfile(mega::JSON& j);
+};
+
+} // mt
@@ -16,10 +16,14 @@
  * program.
  */
 
+#include <iostream>
+
 #include <gtest/gtest.h>
 
 #include <mega/attrmap.h>
 
+#include "utils.h"
+
 TEST(AttrMap, serialize_unserialize)
 {
     mega::AttrMap map;
@@ -57,3 +61,54 @@ TEST(AttrMap, unserialize_32bit)
 
     ASSERT_EQ(expMap.map, newMap.map);
 }
+
+TEST(AttrMap, DISABLED_operations_benchmark)
+{
+    // the attributes of a file node, as decrypted by fetchnodes
+    const int count = 100000;
+    std::vector<mega::AttrMap> maps(count);
+    double build = mt::elapsedMs([&]()
+    {
+        for (int i = 0; i < count; i++)
+        {
+            maps[i].map['n'] = "name of the node " + std::to_string(i);
+            maps[i].map['c'] = "d46NyAmhSuQhla4ELnvPvQQRENnkuAKdHa9oqjdQeE";
+            maps[i].map[mega::AttrMap::string2nameid("lbl")] = "1";
+        }
+    });
+
+    std::string json;
+    double getjson = mt::elapsedMs([&]()
+    {
+        for (const mega::AttrMap& m : maps)
+        {
+            json.clear();
+            m.getjson(&json);
+        }
+    });
+
+    std::vector<std::string> records(count);
+    double serialize = mt::elapsedMs([&]()
+    {
+        for (int i = 0; i < count; i++)
+        {
+            maps[i].serialize(&records[i]);
+        }
+    });
+
+    double unserialize = mt::elapsedMs([&]()
+    {
+        for (int i = 0; i < count; i++)
+        {
+            mega::AttrMap m;
+            m.unserialize(records[i].data(), records[i].data() + records[i].size());
+            ASSERT_EQ(3u, m.map.size());
+        }
+    });
+
+    mt::recordBenchmark("build_ms", build);
+    mt::recordBenchmark("getjson_ms", getjson);
+    mt::recordBenchmark("serialize_ms", serialize);
+    mt::recordBenchmark("unserialize_ms", unserialize);
+
+}
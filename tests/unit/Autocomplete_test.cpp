@@ -0,0 +1,130 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <algorithm>
+#include <iostream>
+
+#include <gtest/gtest.h>
+
+#include <mega.h>
+#include <mega/autocomplete.h>
+
+#include "DefaultedFileSystemAccess.h"
+#include "utils.h"
+
+namespace {
+
+struct Tree
+{
+    mega::MegaApp app;
+    mt::DefaultedFileSystemAccess fs;
+    std::shared_ptr<mega::MegaClient> client = mt::makeClient(app, fs);
+    mega::handle cwd = 1;
+    mega::handle next = 2;
+
+    Tree()
+    {
+        mt::makeNode(*client, mega::FOLDERNODE, 1).attrs().map['n'] = "root";
+    }
+
+    mega::Node& add(mega::handle parent, mega::nodetype_t type, const std::string& name)
+    {
+        mega::Node& n = mt::makeNode(*client, type, next++, client->nodebyhandle(parent));
+        n.attrs().map['n'] = name;
+        return n;
+    }
+};
+
+std::vector<std::string> complete(mega::autocomplete::ACN syntax, const std::string& line)
+{
+    std::vector<std::string> result;
+    for (auto& c : mega::autocomplete::autoComplete(line, line.size(), syntax, true).completions)
+    {
+        result.push_back(c.s);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+}
+
+TEST(Autocomplete, remotePaths_narrowWithTheTypedPrefix)
+{
+    Tree t;
+    mega::Node& sub = t.add(1, mega::FOLDERNODE, "sub");
+    t.add(sub.nodehandle, mega::FILENODE, "inner");
+    t.add(1, mega::FILENODE, "subfile");
+    t.add(1, mega::FILENODE, "other");
+    for (int i = 0; i < 300; i++)
+    {
+        t.add(1, mega::FILENODE, "f" + std::to_string(i));
+    }
+
+    using namespace mega::autocomplete;
+    std::unique_ptr<Either> p(new Either());
+    p->Add(sequence(text("ls"), remoteFSPath(t.client.get(), &t.cwd)));
+    ACN syntax(std::move(p));
+
+    ASSERT_EQ(304u, complete(syntax, "ls ").size());
+    ASSERT_EQ((std::vector<std::string>{"sub/", "subfile"}), complete(syntax, "ls s"));
+    ASSERT_EQ((std::vector<std::string>{"sub/", "subfile"}), complete(syntax, "ls su"));
+    ASSERT_EQ(std::vector<std::string>{"subfile"}, complete(syntax, "ls subf"));
+    ASSERT_EQ(std::vector<std::string>{}, complete(syntax, "ls subx"));
+
+    // going back to a shorter prefix widens the range again
+    ASSERT_EQ(111u, complete(syntax, "ls f1").size());
+    ASSERT_EQ(11u, complete(syntax, "ls f10").size());
+    ASSERT_EQ(300u, complete(syntax, "ls f").size());
+
+    // folders on the way are found by name
+    ASSERT_EQ(std::vector<std::string>{"sub/inner"}, complete(syntax, "ls sub/"));
+    ASSERT_EQ(std::vector<std::string>{}, complete(syntax, "ls subfile/"));
+
+    // children added later are completed
+    t.add(1, mega::FILENODE, "subzero");
+    ASSERT_EQ((std::vector<std::string>{"sub/", "subfile", "subzero"}), complete(syntax, "ls su"));
+}
+
+TEST(Autocomplete, DISABLED_remotePaths_benchmark)
+{
+    Tree t;
+    const int count = 100000;
+    for (int i = 0; i < count; i++)
+    {
+        t.add(1, mega::FILENODE, "file" + std::to_string(i));
+    }
+
+    using namespace mega::autocomplete;
+    std::unique_ptr<Either> p(new Either());
+    p->Add(sequence(text("ls"), remoteFSPath(t.client.get(), &t.cwd)));
+    ACN syntax(std::move(p));
+
+    // the keypresses of a name, the first building the sorted children
+    const std::string line = "ls file12345";
+    size_t found = 0;
+    double ms = mt::elapsedMs([&]()
+    {
+        for (size_t i = 4; i <= line.size(); i++)
+        {
+            found = complete(syntax, line.substr(0, i)).size();
+        }
+    });
+    ASSERT_EQ(1u, found);
+
+    mt::recordBenchmark("remote_completion_ms", ms);
+}
@@ -0,0 +1,132 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include <mega/base64.h>
+
+namespace {
+
+const char encoding[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// one group of 3 bytes at a time, as the conversion was written first
+std::string encodeBytewise(const std::string& in)
+{
+    std::string out;
+    for (size_t i = 0; i < in.size(); i += 3)
+    {
+        uint32_t v = uint32_t(mega::byte(in[i])) << 16;
+        size_t n = std::min<size_t>(3, in.size() - i);
+        if (n > 1) v |= uint32_t(mega::byte(in[i + 1])) << 8;
+        if (n > 2) v |= mega::byte(in[i + 2]);
+        for (size_t j = 0; j <= n; j++)
+        {
+            out += encoding[(v >> (18 - 6 * j)) & 63];
+        }
+    }
+    return out;
+}
+
+std::string randomBytes(std::mt19937& rng, size_t size)
+{
+    std::string bytes(size, 0);
+    for (auto& c : bytes)
+    {
+        c = char(rng());
+    }
+    return bytes;
+}
+
+}
+
+TEST(Base64, btoaAndAtobRoundTripAtEveryLength)
+{
+    std::mt19937 rng(1);
+
+    // long enough for several vector blocks and every remainder after them
+    for (size_t size = 0; size < 300; size++)
+    {
+        std::string bytes = randomBytes(rng, size);
+        std::string encoded = mega::Base64::btoa(bytes);
+        ASSERT_EQ(encodeBytewise(bytes), encoded) << size;
+        ASSERT_EQ(bytes, mega::Base64::atob(encoded)) << size;
+
+        // the same from the deprecated pointer forms
+        std::vector<char> chars(size * 4 / 3 + 4);
+        ASSERT_EQ(int(encoded.size()), mega::Base64::btoa((const mega::byte*)bytes.data(), int(size), chars.data()));
+        ASSERT_STREQ(encoded.c_str(), chars.data());
+
+        std::vector<mega::byte> decoded(size + 3);
+        ASSERT_EQ(int(size), mega::Base64::atob(encoded.c_str(), decoded.data(), int(decoded.size())));
+        ASSERT_EQ(0, memcmp(bytes.data(), decoded.data(), size));
+    }
+}
+
+TEST(Base64, atobStopsAtTheFirstInvalidCharacter)
+{
+    std::mt19937 rng(2);
+    std::string bytes = randomBytes(rng, 120);
+    std::string encoded = mega::Base64::btoa(bytes);
+
+    // wherever it is, inside a vector block or not
+    for (size_t at : {0, 1, 4, 15, 16, 40, 63, 64, 100, 159})
+    {
+        for (char invalid : {'"', '=', '.', '\x80', '\xff', '\0'})
+        {
+            std::string s = encoded;
+            s[at] = invalid;
+            std::string expected = mega::Base64::atob(encoded.substr(0, at));
+            ASSERT_EQ(expected, mega::Base64::atob(s)) << at << " " << int(invalid);
+        }
+    }
+
+    // '+' and '/' are accepted for '-' and '_'
+    ASSERT_EQ(mega::Base64::atob(std::string(40, '-') + std::string(40, '_')),
+              mega::Base64::atob(std::string(40, '+') + std::string(40, '/')));
+}
+
+TEST(Base64, atobTruncatesToTheOutputSize)
+{
+    std::mt19937 rng(3);
+    std::string bytes = randomBytes(rng, 200);
+    std::string encoded = mega::Base64::btoa(bytes);
+
+    for (int blen = 0; blen <= 200; blen += 7)
+    {
+        std::vector<mega::byte> decoded(blen + 16, 0xAA);
+        ASSERT_EQ(blen, mega::Base64::atob(encoded.c_str(), encoded.size(), decoded.data(), blen));
+        ASSERT_EQ(0, memcmp(bytes.data(), decoded.data(), blen));
+
+        // nothing written past it
+        for (int i = blen; i < blen + 16; i++)
+        {
+            ASSERT_EQ(0xAA, decoded[i]);
+        }
+    }
+}
+
+TEST(Base64, base64StrOfHandles)
+{
+    mega::handle h = 0x0123456789abcdefull;
+    mega::Base64Str<8> s8(h);
+    ASSERT_EQ(encodeBytewise(std::string((const char*)&h, 8)), std::string(s8.chars));
+    mega::Base64Str<6> s6(h);
+    ASSERT_EQ(encodeBytewise(std::string((const char*)&h, 6)), std::string(s6.chars));
+}
@@ -16,10 +16,14 @@
  * program.
  */
 
+#include <iostream>
+
 #include <gtest/gtest.h>
 
 #include <mega/utils.h>
 
+#include "utils.h"
+
 namespace mega {
 
 bool operator==(const mega::ChunkMAC& lhs, const mega::ChunkMAC& rhs)
@@ -89,3 +93,106 @@ TEST(ChunkMacMap, unserialize_32bit)
     ASSERT_TRUE(newMap.unserialize(data, d.c_str() + d.size()));
     EXPECT_EQ(map, newMap);
 }
+
+TEST(ChunkMacMap, foldfinished_keepsTheFileMacAndProgress)
+{
+    mega::byte key[mega::SymmCipher::KEYLENGTH] = { 1, 2, 3 };
+    mega::SymmCipher cipher(key);
+
+    const m_off_t fileSize = 5 * 1024 * 1024;
+    mega::chunkmac_map map;
+    m_off_t chunks = 0;
+    for (m_off_t pos = 0; pos < fileSize; pos = mega::ChunkedHash::chunkceil(pos, fileSize), ++chunks)
+    {
+        std::fill(map[pos].mac, map[pos].mac + mega::SymmCipher::BLOCKSIZE, mega::byte('A' + chunks));
+        map[pos].finished = true;
+    }
+    const int64_t fileMac = map.macsmac(&cipher);
+
+    // the third chunk is still in progress: only the first two can be folded
+    const m_off_t third = mega::ChunkedHash::chunkceil(mega::ChunkedHash::chunkceil(0));
+    map[third].finished = false;
+    map[third].offset = 100;
+    mega::chunkmac_map partial = map;
+    partial.foldfinished(&cipher, fileSize);
+    ASSERT_EQ(third, partial.foldedpos);
+    ASSERT_EQ(size_t(chunks - 2), partial.size());
+
+    m_off_t chunkpos, completed;
+    partial.calcprogress(fileSize, chunkpos, completed);
+    ASSERT_EQ(third, chunkpos);
+    ASSERT_EQ(third + 100, partial.nextUnprocessedPosFrom(0));
+
+    // the checkpoint survives the cache, and the rest folds on top of it
+    std::string d;
+    partial.serializefolded(d);
+    mega::chunkmac_map resumed;
+    const char* ptr = d.data();
+    ASSERT_TRUE(resumed.unserializefolded(ptr, d.data() + d.size()));
+    ASSERT_EQ(d.data() + d.size(), ptr);
+    resumed.insert(partial.begin(), partial.end());
+    resumed[third] = map[third];
+    resumed[third].finished = true;
+    ASSERT_EQ(fileMac, resumed.macsmac(&cipher));
+
+    resumed.foldfinished(&cipher, fileSize);
+    ASSERT_TRUE(resumed.empty());
+    ASSERT_EQ(fileSize, resumed.foldedpos);
+    ASSERT_EQ(fileMac, resumed.macsmac(&cipher));
+
+    resumed.clear();
+    ASSERT_EQ(0, resumed.foldedpos);
+}
+
+TEST(ChunkMacMap, DISABLED_operations_benchmark)
+{
+    // the chunks of a 4 GB upload
+    const m_off_t fileSize = m_off_t(4) << 30;
+    mega::byte keybytes[mega::SymmCipher::KEYLENGTH] = {};
+    mega::SymmCipher cipher(keybytes);
+
+    std::vector<m_off_t> positions;
+    for (m_off_t pos = 0; pos < fileSize; pos = mega::ChunkedHash::chunkceil(pos, fileSize))
+    {
+        positions.push_back(pos);
+    }
+
+    mega::chunkmac_map map;
+    double insert = mt::elapsedMs([&]()
+    {
+        for (m_off_t pos : positions)
+        {
+            mega::ChunkMAC& chunk = map[pos];
+            std::fill(chunk.mac, chunk.mac + mega::SymmCipher::BLOCKSIZE, mega::byte(pos >> 17));
+            chunk.finished = true;
+        }
+    });
+
+    m_off_t chunkpos, completed;
+    double progress = mt::elapsedMs([&]() { map.calcprogress(fileSize, chunkpos, completed); });
+    ASSERT_EQ(fileSize, completed);
+
+    int64_t fileMac = 0;
+    double macsmac = mt::elapsedMs([&]() { fileMac = map.macsmac(&cipher); });
+
+    std::string d;
+    double serialize = mt::elapsedMs([&]() { map.serialize(d); });
+    mega::chunkmac_map copy;
+    double unserialize = mt::elapsedMs([&]()
+    {
+        const char* ptr = d.data();
+        ASSERT_TRUE(copy.unserialize(ptr, d.data() + d.size()));
+    });
+
+    double fold = mt::elapsedMs([&]() { copy.foldfinished(&cipher, fileSize); });
+    ASSERT_TRUE(copy.empty());
+    ASSERT_EQ(fileMac, copy.macsmac(&cipher));
+
+    mt::recordBenchmark("insert_ms", insert);
+    mt::recordBenchmark("calcprogress_ms", progress);
+    mt::recordBenchmark("macsmac_ms", macsmac);
+    mt::recordBenchmark("serialize_ms", serialize);
+    mt::recordBenchmark("unserialize_ms", unserialize);
+    mt::recordBenchmark("foldfinished_ms", fold);
+
+}
@@ -20,12 +20,16 @@
 
 #include <gtest/gtest.h>
 
+#include <mega/base64.h>
 #include <mega/command.h>
 #include <mega/json.h>
 #include <mega/megaapp.h>
 #include <mega/megaclient.h>
 #include <mega/types.h>
 
+#include "DefaultedFileSystemAccess.h"
+#include "utils.h"
+
 using namespace std;
 using namespace mega;
 
@@ -287,3 +291,590 @@ TEST(Commands, CommandGetCountryCallingCodes_processResult_errorCodeReceived)
     ASSERT_EQ(nullptr, app.mCountryCallingCodes);
     ASSERT_EQ(ptrdiff_t(jsonLength), std::distance(jsonBegin, json.pos)); // assert json has been parsed all the way
 }
+
+namespace {
+
+Command* makeCommand(const char* name, size_t padding = 0, bool latencySensitive = false)
+{
+    Command* c = new Command;
+    c->cmd(name);
+    if (padding)
+    {
+        c->arg("p", string(padding, 'x').c_str());
+    }
+    c->latencySensitive = latencySensitive;
+    return c;
+}
+
+} // anonymous
+
+TEST(Commands, Command_encodesBinariesInPlaceAndBatchesInOneAllocation)
+{
+    const byte data[] = { 0xfb, 0xff, 0x00, 0x10, 0x83 };
+    handle h = 0;
+    memcpy(&h, "\x01\x02\x03\x04\x05\x06", 6);
+
+    Command* c = new Command;
+    c->cmd("x");
+    c->arg("b", data, int(sizeof data));
+    c->beginarray("e");
+    c->element(h, 6);
+    c->element(data, 2);
+    c->endarray();
+    ASSERT_EQ(string("\"a\":\"x\",\"b\":\"") + Base64::btoa(string((const char*)data, sizeof data))
+              + "\",\"e\":[\"AQIDBAUG\",\"" + Base64::btoa(string((const char*)data, 2)) + "\"]", c->getstring());
+    ASSERT_EQ(strlen(c->getstring()), c->jsonlength());
+
+    RequestDispatcher reqs;
+    reqs.add(c);
+    reqs.add(makeCommand("ug", 100));
+
+    string out;
+    bool suppressSID = true;
+    reqs.serverrequest(&out, suppressSID);
+    ASSERT_EQ('[', out.front());
+    ASSERT_EQ(']', out.back());
+
+    // the batch is sized up front (with room for a separator the first command does not take)
+    ASSERT_LE(out.capacity(), out.size() + 1);
+    reqs.clear();
+}
+
+TEST(Commands, RequestDispatcher_priorityLaneAndByteLimit)
+{
+    MegaApp app;
+    mt::DefaultedFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    RequestDispatcher reqs;
+    reqs.policy.maxBytes = 100;
+    Waiter::ds = 1000;
+
+    reqs.add(makeCommand("p", 60));
+    reqs.add(makeCommand("p", 60)); // would exceed maxBytes: starts a new batch
+    reqs.add(makeCommand("ug", 0, true));
+
+    string out;
+    bool suppressSID = true;
+
+    // the latency-sensitive command overtakes the queued batches
+    reqs.serverrequest(&out, suppressSID);
+    ASSERT_EQ("[{\"a\":\"ug\"}]", out);
+    reqs.servererror(API_EAGAIN, client.get());
+    ASSERT_EQ(1u, reqs.laneStats[RequestDispatcher::LANE_PRIORITY].batches);
+
+    reqs.serverrequest(&out, suppressSID);
+    ASSERT_EQ(1u, std::count(out.begin(), out.end(), '{'));
+    reqs.requeuerequest();
+    ASSERT_TRUE(reqs.cmdspending());
+
+    // once the normal batch has waited longer than maxDelay, it goes ahead of the priority lane
+    reqs.add(makeCommand("uk", 0, true));
+    Waiter::ds += reqs.policy.maxDelay;
+    reqs.serverrequest(&out, suppressSID);
+    ASSERT_NE(string::npos, out.find("\"p\""));
+
+    // ug, then the first p batch twice (sent, requeued, resent)
+    ASSERT_EQ(3u, reqs.csBatchesSent);
+    ASSERT_EQ(3u, reqs.csRequestsSent);
+    reqs.clear();
+}
+
+TEST(Commands, RequestDispatcher_deferrableCommandsWaitForOtherTraffic)
+{
+    MegaApp app;
+    mt::DefaultedFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    RequestDispatcher reqs;
+    Waiter::ds = 1000;
+
+    // not held unless the dispatcher coalesces
+    Command* c = makeCommand("log");
+    c->deferrable = true;
+    reqs.add(c);
+    ASSERT_FALSE(reqs.deferredpending());
+    ASSERT_TRUE(reqs.cmdspending());
+    reqs.clear();
+
+    reqs.policy.maxDeferral = 600;
+    c = makeCommand("log");
+    c->deferrable = true;
+    reqs.add(c);
+    ASSERT_TRUE(reqs.deferredpending());
+    ASSERT_FALSE(reqs.cmdspending());
+    ASSERT_EQ(dstime(1600), reqs.deferreduntil());
+
+    // it goes after the command that wakes the radio up
+    reqs.add(makeCommand("p"));
+    reqs.releasedeferred(true);
+    ASSERT_FALSE(reqs.deferredpending());
+
+    string out;
+    bool suppressSID = true;
+    reqs.serverrequest(&out, suppressSID);
+    ASSERT_EQ("[{\"a\":\"p\"}]", out);
+    reqs.servererror(API_EAGAIN, client.get());
+    reqs.serverrequest(&out, suppressSID);
+    ASSERT_EQ("[{\"a\":\"log\"}]", out);
+    reqs.servererror(API_EAGAIN, client.get());
+
+    ASSERT_EQ(1u, reqs.csDeferredCommands);
+    ASSERT_EQ(1u, reqs.csDeferredRidealongs);
+    ASSERT_EQ(0u, reqs.csDeferredExpirations);
+    ASSERT_NE(string::npos, reqs.statsReport().find("wakeups saved: 1"));
+    reqs.clear();
+}
+
+TEST(Commands, RequestDispatcher_largeBatchesAreCompressed)
+{
+    RequestDispatcher reqs;
+    reqs.setcompression(1000);
+
+    string out;
+    bool suppressSID = true;
+    bool compressed = true;
+
+    // below the threshold: as is
+    reqs.add(makeCommand("p", 100));
+    reqs.serverrequest(&out, suppressSID, &compressed);
+    ASSERT_FALSE(compressed);
+    ASSERT_EQ('[', out[0]);
+    reqs.requeuerequest();
+
+    string plain;
+    reqs.add(makeCommand("p", 5000));
+    reqs.serverrequest(&plain, suppressSID);
+    reqs.requeuerequest();
+    reqs.serverrequest(&out, suppressSID, &compressed);
+    ASSERT_TRUE(compressed);
+    ASSERT_LT(out.size(), plain.size() / 10);
+    ASSERT_EQ('\x1f', out[0]);  // gzip
+    ASSERT_EQ(1u, reqs.csCompressedBatches);
+    ASSERT_EQ(plain.size() - out.size(), reqs.csBytesBeforeCompression - reqs.csBytesAfterCompression);
+    reqs.requeuerequest();
+
+    reqs.setcompression(0);
+    reqs.serverrequest(&out, suppressSID, &compressed);
+    ASSERT_FALSE(compressed);
+    ASSERT_EQ(plain, out);
+    reqs.clear();
+}
+
+namespace {
+
+class OrderRecordingCommand : public Command
+{
+public:
+    OrderRecordingCommand(vector<int>& order, int id)
+        : mOrder(order), mId(id)
+    {
+        cmd("ug");
+        orderIndependent = true;
+    }
+
+    void procresult() override
+    {
+        client->json.getint();
+        mOrder.push_back(mId);
+    }
+
+private:
+    vector<int>& mOrder;
+    int mId;
+};
+
+} // anonymous
+
+TEST(Commands, RequestDispatcher_pipelinedResponsesAreProcessedInSequence)
+{
+    MegaApp app;
+    mt::DefaultedFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    RequestDispatcher reqs;
+    reqs.policy.maxBytes = 1; // one command per batch
+    reqs.setpipelinedepth(3);
+
+    vector<int> order;
+    for (int i = 0; i < 3; i++)
+    {
+        reqs.add(new OrderRecordingCommand(order, i));
+    }
+    reqs.add(makeCommand("p"));
+
+    // the order-dependent command keeps to the ordered channel
+    ASSERT_TRUE(reqs.cmdspending());
+    ASSERT_TRUE(reqs.pipelinedpending());
+
+    string out;
+    bool suppressSID = true;
+    uint64_t s0 = reqs.sendpipelined(&out, suppressSID);
+    uint64_t s1 = reqs.sendpipelined(&out, suppressSID);
+    uint64_t s2 = reqs.sendpipelined(&out, suppressSID);
+    ASSERT_FALSE(reqs.pipelinedpending());
+
+    // later batches answered first wait for the earlier ones
+    reqs.pipelinedresponse(s2, "[0]", client.get());
+    reqs.pipelinedresponse(s1, "[0]", client.get());
+    ASSERT_TRUE(order.empty());
+
+    reqs.pipelinedresponse(s0, "[0]", client.get());
+    ASSERT_EQ(vector<int>({0, 1, 2}), order);
+    ASSERT_EQ(3u, reqs.laneStats[RequestDispatcher::LANE_PIPELINED].batches);
+
+    // a failed batch is requeued, and does not hold back the ones after it
+    reqs.add(new OrderRecordingCommand(order, 3));
+    reqs.add(new OrderRecordingCommand(order, 4));
+    uint64_t s3 = reqs.sendpipelined(&out, suppressSID);
+    uint64_t s4 = reqs.sendpipelined(&out, suppressSID);
+    reqs.requeuepipelined(s3);
+    reqs.pipelinedresponse(s4, "[0]", client.get());
+    ASSERT_EQ(4, order.back());
+    ASSERT_TRUE(reqs.pipelinedpending());
+
+    // disabling pipelining moves the waiting commands to the ordered channel
+    reqs.setpipelinedepth(0);
+    ASSERT_FALSE(reqs.pipelinedpending());
+    reqs.clear();
+}
+
+namespace {
+
+class MockApp_PutnodesResult : public MegaApp
+{
+public:
+    vector<pair<int, error>> mResults;
+
+    void putnodes_result(error e, targettype_t, NewNode* nn) override
+    {
+        mResults.emplace_back(client->restag, e);
+        delete [] nn;
+    }
+};
+
+NewNode* makeUpload(byte token)
+{
+    NewNode* nn = new NewNode[1];
+    nn->source = NEW_UPLOAD;
+    nn->type = FILENODE;
+    std::fill(nn->uploadtoken, nn->uploadtoken + sizeof nn->uploadtoken, token);
+    nn->nodekey.assign(FILENODEKEYLENGTH, 'k');
+    nn->attrstring.reset(new string("attrs"));
+    return nn;
+}
+
+} // anonymous
+
+TEST(Commands, CommandPutNodes_uploadsShareOneCommandAndReportOnTheirOwn)
+{
+    MockApp_PutnodesResult app;
+    mt::DefaultedFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+    client->setputnodesbatch(3);
+
+    const handle target = 0x123456;
+    client->putnodesbatched(target, makeUpload('a'), 7);
+    client->putnodesbatched(target, makeUpload('b'), 8);
+    ASSERT_FALSE(client->reqs.cmdspending());
+
+    // the third fills the batch
+    client->putnodesbatched(target, makeUpload('c'), 9);
+    ASSERT_TRUE(client->reqs.cmdspending());
+
+    string out;
+    bool suppressSID = true;
+    client->reqs.serverrequest(&out, suppressSID);
+
+    // one command, with the three nodes
+    ASSERT_NE(string::npos, out.find("\"a\":\"p\""));
+    ASSERT_EQ(out.find("\"a\":\"p\""), out.rfind("\"a\":\"p\""));
+    ASSERT_EQ(4u, std::count(out.begin(), out.end(), '{'));
+
+    // an error for the command is the error of each upload, reported with its own tag
+    client->reqs.serverresponse("[-11]", client.get());
+    const vector<pair<int, error>> expected{{7, API_EACCESS}, {8, API_EACCESS}, {9, API_EACCESS}};
+    ASSERT_EQ(expected, app.mResults);
+}
+
+TEST(MegaClient, gelbResponsesAreCachedAndRefreshed)
+{
+    MegaApp app;
+    mt::DefaultedFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    client->cachegelb("chat", "{\"ok\":1}");
+    client->reqtag = 1;
+    client->gelbrequest("chat", 0, 1);
+    ASSERT_EQ(REQ_SUCCESS, client->pendinghttp[1]->status);
+    ASSERT_EQ("{\"ok\":1}", client->pendinghttp[1]->in);
+    ASSERT_TRUE(client->gelbrefreshes.empty());
+
+    // after half of the TTL, still answered, and refreshed once
+    client->gelbcache["chat"].ts -= MegaClient::GELB_CACHE_TTL / 2;
+    client->reqtag = 2;
+    client->gelbrequest("chat", 0, 1);
+    client->reqtag = 3;
+    client->gelbrequest("chat", 0, 1);
+    ASSERT_EQ(REQ_SUCCESS, client->pendinghttp[3]->status);
+    ASSERT_EQ(1u, client->gelbrefreshes.size());
+    ASSERT_EQ("chat", client->gelbrefreshes["chat"]->gelbservice);
+
+    // expired: sent, and its response is cached
+    client->gelbcache["chat"].ts -= MegaClient::GELB_CACHE_TTL;
+    client->reqtag = 4;
+    client->gelbrequest("chat", 0, 1);
+    ASSERT_NE(REQ_SUCCESS, client->pendinghttp[4]->status);
+    ASSERT_EQ("chat", client->pendinghttp[4]->gelbservice);
+    ASSERT_NE(string::npos, client->pendinghttp[4]->posturl.find("?service=chat"));
+
+    for (auto& p : client->pendinghttp)
+    {
+        delete p.second;
+    }
+    client->pendinghttp.clear();
+}
+
+TEST(MegaClient, cancelprefetchfa_dropsQueuedPrefetchesOnly)
+{
+    MegaApp app;
+    mt::DefaultedFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    // thumbnails of three nodes on cluster 12: two prefetched, one requested by the app
+    auto fileattrs = [](handle fah)
+    {
+        return string("12:0*") + Base64Str<sizeof(handle)>(fah).chars;
+    };
+    string fa1 = fileattrs(101), fa2 = fileattrs(102), fa3 = fileattrs(103);
+    client->reqtag = 0;
+    ASSERT_EQ(API_OK, client->getfa(1, &fa1, "key", GfxProc::THUMBNAIL));
+    ASSERT_EQ(API_OK, client->getfa(2, &fa2, "key", GfxProc::THUMBNAIL));
+    client->reqtag = 7;
+    ASSERT_EQ(API_OK, client->getfa(3, &fa3, "key", GfxProc::THUMBNAIL));
+
+    // another type, or a request taking a prefetch over, keeps it
+    ASSERT_EQ(0, client->cancelprefetchfa({ 1, 2, 3 }, GfxProc::PREVIEW));
+    client->reqtag = 8;
+    ASSERT_EQ(API_OK, client->getfa(2, &fa2, "key", GfxProc::THUMBNAIL));
+
+    ASSERT_EQ(1, client->cancelprefetchfa({ 1, 2, 3 }, GfxProc::THUMBNAIL));
+    faf_map& fresh = client->fafcs[12]->fafs[0];
+    ASSERT_EQ(2u, fresh.size());
+    ASSERT_EQ(0u, fresh.count(101));
+    ASSERT_EQ(8, fresh[102]->tag);
+    ASSERT_EQ(7, fresh[103]->tag);
+}
+
+TEST(MegaClient, scChannelQueuesStreamedBatchesAndFallsBack)
+{
+    MegaApp app;
+    mt::DefaultedFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    client->scstreamurl = "https://example.invalid/wsc";
+    client->scstream.reset(new HttpReq());
+    client->scstream->status = REQ_INFLIGHT;
+    client->scstream->lastdata = Waiter::ds;
+    client->scstreamscanner.reset();
+
+    string data = "[{\"a\":[],\"sn\":\"x\"},0,{\"a\":[";
+    client->scstream->put((void*)data.data(), unsigned(data.size()));
+    client->procscstream();
+    ASSERT_TRUE(client->scstreamopen);
+    ASSERT_EQ(1u, client->scstreambatches.size());
+    ASSERT_EQ("{\"a\":[],\"sn\":\"x\"}", client->scstreambatches.front());
+
+    data = "],\"sn\":\"y\"}";
+    client->scstream->put((void*)data.data(), unsigned(data.size()));
+    client->procscstream();
+    ASSERT_EQ(2u, client->scstreambatches.size());
+    ASSERT_TRUE(client->scstream);
+
+    // anything else: back to long polling, keeping what was received
+    data = ",-3]";
+    client->scstream->put((void*)data.data(), unsigned(data.size()));
+    client->procscstream();
+    ASSERT_FALSE(client->scstream);
+    ASSERT_TRUE(client->scstreamurl.empty());
+    ASSERT_EQ(2u, client->scstreambatches.size());
+}
+
+TEST(MegaClient, catchupbyreload_reloadsBacklogsLargerThanTheTree)
+{
+    MegaApp app;
+    mt::DefaultedFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+    for (handle h = 1; h <= 10; h++)
+    {
+        mt::makeNode(*client, FOLDERNODE, h);
+    }
+
+    // only when catching up from the cache
+    ASSERT_FALSE(client->catchupbyreload(1 << 20));
+    client->fnstats.mode = FetchNodesStats::MODE_DB;
+    client->statecurrent = false;
+    client->catchupbytes = 0;
+
+    // the whole backlog counts, one response after the other
+    const size_t tree = 10 * MegaClient::FETCHNODES_RECORD_SIZE;
+    ASSERT_FALSE(client->catchupbyreload(tree / 2));
+    ASSERT_FALSE(client->catchupbyreload(tree / 2));
+    ASSERT_TRUE(client->catchupbyreload(1));
+
+    client->catchupbytes = 0;
+    client->catchupreloadpercent = 0;
+    ASSERT_FALSE(client->catchupbyreload(10 * tree));
+}
+
+namespace {
+
+class MockApp_share : public MegaApp
+{
+public:
+    vector<pair<int, int>> mProgress;
+    int mResults = 0;
+    error mLastError = API_EINTERNAL;
+
+    void share_progress(int done, int total) override
+    {
+        mProgress.emplace_back(done, total);
+    }
+
+    void share_result(error e) override
+    {
+        ++mResults;
+        mLastError = e;
+    }
+};
+
+size_t countOf(const string& s, const string& what)
+{
+    size_t n = 0;
+    for (size_t i = s.find(what); i != string::npos; i = s.find(what, i + 1))
+    {
+        n++;
+    }
+    return n;
+}
+
+// the response of a batch of commands that all succeeded
+string successes(size_t commands)
+{
+    string response = "[0";
+    for (size_t i = 1; i < commands; i++)
+    {
+        response += ",0";
+    }
+    return response + "]";
+}
+
+} // anonymous
+
+TEST(Commands, CommandSetShare_sendsTheKeysOfALargeTreeInParts)
+{
+    MockApp_share app;
+    mt::DefaultedFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    const size_t count = 10000;
+    auto& folder = mt::makeNode(*client, FOLDERNODE, 1);
+    folder.sharekey = new SymmCipher((const byte*)string(SymmCipher::KEYLENGTH, 'k').data());
+    for (size_t i = 0; i < count; i++)
+    {
+        mt::makeNode(*client, FILENODE, 2 + i, &folder);
+    }
+
+    client->restag = 7;
+    client->reqs.add(new CommandSetShare(client.get(), &folder, nullptr, RDONLY, 1, nullptr));
+
+    // the share goes with the first part of the keys only
+    string out;
+    bool suppressSID = true;
+    client->reqs.serverrequest(&out, suppressSID);
+    ASSERT_EQ(1u, countOf(out, "\"cr\""));
+    ASSERT_LT(out.size(), 2 * MegaClient::KEYCR_MAXBYTES);
+    client->reqs.serverresponse("[{}]", client.get());
+    ASSERT_EQ(0, app.mResults);
+    ASSERT_EQ(1u, app.mProgress.size());
+    const int parts = app.mProgress[0].second;
+    ASSERT_GE(parts, 3);
+
+    // the others follow in batches of k commands, and the last one completes the share
+    size_t batches = 0;
+    while (client->reqs.cmdspending())
+    {
+        client->reqs.serverrequest(&out, suppressSID);
+        size_t commands = countOf(out, "\"a\":\"k\"");
+        ASSERT_EQ(commands, countOf(out, "\"cr\""));
+        ASSERT_LE(out.size(), client->reqs.policy.maxBytes + MegaClient::KEYCR_MAXBYTES);
+        client->reqs.serverresponse(successes(commands), client.get());
+        batches++;
+    }
+
+    ASSERT_GE(batches, 1u);
+    ASSERT_EQ(1, app.mResults);
+    ASSERT_EQ(API_OK, app.mLastError);
+    ASSERT_EQ(size_t(parts - 1), app.mProgress.size());
+    ASSERT_EQ(make_pair(parts - 1, parts), app.mProgress.back());
+}
+
+TEST(Commands, sendkeyrewrites_splitsLargeRewrites)
+{
+    MegaApp app;
+    mt::DefaultedFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    for (size_t i = 0; i < 2 * MegaClient::KEYREWRITE_MAXHANDLES + 1; i++)
+    {
+        client->nodekeyrewrite.push_back(mt::makeNode(*client, FILENODE, 1 + i).nodehandle);
+    }
+    client->sendkeyrewrites();
+    ASSERT_TRUE(client->nodekeyrewrite.empty());
+
+    string out;
+    bool suppressSID = true;
+    size_t commands = 0;
+    while (client->reqs.cmdspending())
+    {
+        client->reqs.serverrequest(&out, suppressSID);
+        size_t batch = countOf(out, "\"nk\"");
+        ASSERT_EQ(batch, countOf(out, "\"a\":\"k\""));
+        commands += batch;
+        client->reqs.serverresponse(successes(batch), client.get());
+    }
+    ASSERT_EQ(3u, commands);
+}
+
+TEST(MegaClient, stagedStartupIsDoneOnceTheSecondaryDataIsLoaded)
+{
+    struct StageApp : public MegaApp
+    {
+        vector<startupstage_t> stages;
+        void startup_stage(startupstage_t stage) override { stages.push_back(stage); }
+    } app;
+    mt::DefaultedFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+    client->stagedstartup = true;
+
+    // the nodes are usable before the filesystem is current
+    client->startsecondarystage(false);
+    ASSERT_EQ(STARTUP_SECONDARY, client->startupstage);
+    ASSERT_NE(NEVER, client->fnstats.timeToSecondaryStage);
+    ASSERT_EQ(vector<startupstage_t>{STARTUP_SECONDARY}, app.stages);
+
+    client->statecurrent = true;
+    client->checkstartupdone();
+    ASSERT_EQ(STARTUP_SECONDARY, client->startupstage);
+
+    client->useralerts.catchupdone = true;
+    client->useralertsloaded();
+    ASSERT_EQ(STARTUP_DONE, client->startupstage);
+    ASSERT_NE(NEVER, client->fnstats.timeToUserAlerts);
+    ASSERT_NE(NEVER, client->fnstats.timeToStartupDone);
+    ASSERT_EQ((vector<startupstage_t>{STARTUP_SECONDARY, STARTUP_DONE}), app.stages);
+
+    // only once
+    client->useralertsloaded();
+    ASSERT_EQ(2u, app.stages.size());
+}
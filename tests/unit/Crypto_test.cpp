@@ -19,7 +19,11 @@
 #include "mega.h"
 #include "../src/crypto/sodium.cpp"
 #include <math.h>
+#include <chrono>
+#include <iostream>
 #include "gtest/gtest.h"
+#include "DefaultedFileSystemAccess.h"
+#include "utils.h"
 
 using namespace mega;
 
@@ -160,6 +164,432 @@ TEST(Crypto, AES_CCM)
     ASSERT_STREQ(result.data(), plainText.data()) << "CCM decryption: plain text doesn't match the expected value";
 }
 
+namespace {
+
+// block-at-a-time AES-CTR with CBC-MAC, as SymmCipher::ctr_crypt() did before it was batched
+void ctr_crypt_blockwise(SymmCipher& cipher, byte* data, unsigned len, m_off_t pos, SymmCipher::ctr_iv ctriv, byte* mac, bool encrypt, bool initmac)
+{
+    byte ctr[SymmCipher::BLOCKSIZE], tmp[SymmCipher::BLOCKSIZE];
+
+    MemAccess::set<int64_t>(ctr, ctriv);
+    SymmCipher::setint64(pos / SymmCipher::BLOCKSIZE, ctr + sizeof ctriv);
+
+    if (mac && initmac)
+    {
+        memcpy(mac, ctr, sizeof ctriv);
+        memcpy(mac + sizeof ctriv, ctr, sizeof ctriv);
+    }
+
+    for (; (int)len > 0; len -= SymmCipher::BLOCKSIZE, data += SymmCipher::BLOCKSIZE)
+    {
+        if (encrypt && mac)
+        {
+            SymmCipher::xorblock(data, mac);
+            cipher.ecb_encrypt(mac);
+        }
+
+        cipher.ecb_encrypt(ctr, tmp);
+        SymmCipher::xorblock(tmp, data);
+        SymmCipher::incblock(ctr);
+
+        if (!encrypt && mac)
+        {
+            SymmCipher::xorblock(data, mac, std::min<int>(len, SymmCipher::BLOCKSIZE));
+            cipher.ecb_encrypt(mac);
+        }
+    }
+}
+
+}
+
+// The batched ctr_crypt() must produce the same output and chunk MAC as the block-at-a-time version
+TEST(Crypto, AES_CTR_matchesBlockwise)
+{
+    PrnGen rng;
+    byte keyBytes[SymmCipher::KEYLENGTH];
+    rng.genblock(keyBytes, sizeof keyBytes);
+    SymmCipher key(keyBytes);
+
+    // lengths around the batch size, unaligned tails, and a counter that carries into the iv
+    const unsigned lengths[] = { 0, 1, 15, 16, 17, 2047, 2048, 2049, 4096 + 5, 131072, 1048576 + 3 };
+    const m_off_t positions[] = { 0, 16 * 77, 0x7FFFFFFFFFFFFFF0 };
+
+    for (unsigned len : lengths)
+    {
+        for (m_off_t pos : positions)
+        {
+            for (int encrypt = 0; encrypt < 2; encrypt++)
+            {
+                string data(len + SymmCipher::BLOCKSIZE, '\0');
+                rng.genblock((byte*)data.data(), len);
+                string expected = data;
+
+                byte mac[SymmCipher::BLOCKSIZE], expectedmac[SymmCipher::BLOCKSIZE];
+                SymmCipher::ctr_iv ctriv = 0xFFFFFFFFFFFFFFFFull - len;
+
+                key.ctr_crypt((byte*)data.data(), len, pos, ctriv, mac, encrypt != 0);
+                ctr_crypt_blockwise(key, (byte*)expected.data(), len, pos, ctriv, expectedmac, encrypt != 0, true);
+
+                ASSERT_EQ(expected, data) << "len " << len << " pos " << pos << " encrypt " << encrypt;
+                ASSERT_EQ(0, memcmp(mac, expectedmac, sizeof mac)) << "len " << len << " pos " << pos << " encrypt " << encrypt;
+
+                // continuing a MAC across calls
+                key.ctr_crypt((byte*)data.data(), len, pos, ctriv, mac, encrypt != 0, false);
+                ctr_crypt_blockwise(key, (byte*)expected.data(), len, pos, ctriv, expectedmac, encrypt != 0, false);
+                ASSERT_EQ(0, memcmp(mac, expectedmac, sizeof mac));
+            }
+        }
+    }
+}
+
+namespace {
+
+uint32_t crc32_bitwise(const byte* data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    while (len--)
+    {
+        crc ^= *data++;
+        for (int k = 0; k < 8; k++)
+        {
+            crc = (crc & 1) ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+uint32_t crc32_get(HashCRC32& crc)
+{
+    byte out[4];
+    crc.get(out);
+    return uint32_t(out[0]) | uint32_t(out[1]) << 8 | uint32_t(out[2]) << 16 | uint32_t(out[3]) << 24;
+}
+
+}
+
+// HashCRC32 uses CPU instructions for long runs and tables for the rest: both must give the usual CRC-32
+TEST(Crypto, CRC32_matchesReference)
+{
+    HashCRC32 crc;
+    crc.add((const byte*)"123456789", 9);
+    ASSERT_EQ(0xCBF43926u, crc32_get(crc));
+
+    PrnGen rng;
+    std::vector<byte> data(5000);
+    rng.genblock(data.data(), data.size());
+
+    for (unsigned len = 0; len < data.size(); len += (len < 300 ? 1 : 97))
+    {
+        uint32_t expected = crc32_bitwise(data.data(), len);
+
+        crc.add(data.data(), len);
+        ASSERT_EQ(expected, crc32_get(crc)) << "len " << len;
+
+        // in pieces, and get() starts over
+        unsigned split = len / 3;
+        crc.add(data.data(), split);
+        crc.add(data.data() + split, len - split);
+        ASSERT_EQ(expected, crc32_get(crc)) << "len " << len << " split " << split;
+    }
+}
+
+TEST(Crypto, DISABLED_AES_CTR_benchmark)
+{
+    PrnGen rng;
+    byte keyBytes[SymmCipher::KEYLENGTH];
+    rng.genblock(keyBytes, sizeof keyBytes);
+    SymmCipher key(keyBytes);
+
+    const unsigned chunksize = 1024 * 1024;
+    const int rounds = 64;
+    string data(chunksize + SymmCipher::BLOCKSIZE, 'x');
+    byte mac[SymmCipher::BLOCKSIZE];
+
+    auto throughput = [&](std::function<void(m_off_t)> crypt)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++)
+        {
+            crypt(m_off_t(i) * chunksize);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return double(chunksize) * rounds / (1024 * 1024) / seconds;
+    };
+
+    double blockwise = throughput([&](m_off_t pos) { ctr_crypt_blockwise(key, (byte*)data.data(), chunksize, pos, 1, mac, false, true); });
+    double batched = throughput([&](m_off_t pos) { key.ctr_crypt((byte*)data.data(), chunksize, pos, 1, mac, false); });
+
+    mt::recordBenchmark("ctr_blockwise_mb_s", blockwise);
+    mt::recordBenchmark("ctr_batched_mb_s", batched);
+
+}
+
+TEST(Crypto, DISABLED_AES_CCM_GCM_benchmark)
+{
+    PrnGen rng;
+    byte keyBytes[SymmCipher::KEYLENGTH];
+    rng.genblock(keyBytes, sizeof keyBytes);
+    SymmCipher key(keyBytes);
+    byte iv[12];
+    rng.genblock(iv, sizeof iv);
+
+    // the size of chat messages and attributes, which is what these modes encrypt
+    const string plain(4096, 'x');
+    const int rounds = 4096;
+    const double megabytes = double(plain.size()) * rounds / (1024 * 1024);
+    string sealed, opened;
+
+    auto throughput = [&](std::function<void()> crypt)
+    {
+        return megabytes / mt::elapsedMs([&]()
+        {
+            for (int i = 0; i < rounds; i++)
+            {
+                crypt();
+            }
+        }) * 1000;
+    };
+
+    double ccmEncrypt = throughput([&]() { key.ccm_encrypt(&plain, iv, 12, 16, &sealed); });
+    double ccmDecrypt = throughput([&]() { ASSERT_TRUE(key.ccm_decrypt(&sealed, iv, 12, 16, &opened)); });
+    ASSERT_EQ(plain, opened);
+    double gcmEncrypt = throughput([&]() { key.gcm_encrypt(&plain, iv, 12, 16, &sealed); });
+    double gcmDecrypt = throughput([&]() { ASSERT_TRUE(key.gcm_decrypt(&sealed, iv, 12, 16, &opened)); });
+    ASSERT_EQ(plain, opened);
+
+    mt::recordBenchmark("ccm_encrypt_mb_s", ccmEncrypt);
+    mt::recordBenchmark("ccm_decrypt_mb_s", ccmDecrypt);
+    mt::recordBenchmark("gcm_encrypt_mb_s", gcmEncrypt);
+    mt::recordBenchmark("gcm_decrypt_mb_s", gcmDecrypt);
+
+}
+
+// the modes are keyed when first used after setkey(): whatever the order, as a freshly keyed cipher
+TEST(Crypto, SymmCipher_rekeyingMatchesFreshCiphers)
+{
+    PrnGen rng;
+    byte keys[3][FILENODEKEYLENGTH];
+    rng.genblock(keys[0], sizeof keys);
+    byte iv[12];
+    rng.genblock(iv, sizeof iv);
+    const string plain(100, 'p');
+
+    SymmCipher reused;
+    for (int round = 0; round < 6; round++)
+    {
+        const byte* k = keys[round % 3];
+        int type = round % 2;
+        reused.setkey(k, type);
+        SymmCipher fresh;
+        fresh.setkey(k, type);
+        SymmCipher copy = reused;
+
+        // a different mode first each time
+        for (int j = 0; j < 4; j++)
+        {
+            switch ((round + j) % 4)
+            {
+                case 0:
+                {
+                    byte a[32], b[32];
+                    memset(a, round, sizeof a);
+                    memcpy(b, a, sizeof b);
+                    reused.ecb_encrypt(a, nullptr, sizeof a);
+                    fresh.ecb_encrypt(b, nullptr, sizeof b);
+                    ASSERT_EQ(0, memcmp(a, b, sizeof a));
+                    copy.ecb_decrypt(a, sizeof a);
+                    ASSERT_EQ(byte(round), a[31]);
+                    break;
+                }
+                case 1:
+                {
+                    byte a[32], b[32];
+                    memset(a, round, sizeof a);
+                    memcpy(b, a, sizeof b);
+                    reused.cbc_encrypt(a, sizeof a);
+                    fresh.cbc_encrypt(b, sizeof b);
+                    ASSERT_EQ(0, memcmp(a, b, sizeof a));
+                    copy.cbc_decrypt(a, sizeof a);
+                    ASSERT_EQ(byte(round), a[0]);
+                    break;
+                }
+                case 2:
+                {
+                    string a, b, opened;
+                    reused.ccm_encrypt(&plain, iv, sizeof iv, 16, &a);
+                    fresh.ccm_encrypt(&plain, iv, sizeof iv, 16, &b);
+                    ASSERT_EQ(a, b);
+                    ASSERT_TRUE(copy.ccm_decrypt(&a, iv, sizeof iv, 16, &opened));
+                    ASSERT_EQ(plain, opened);
+                    break;
+                }
+                case 3:
+                {
+                    string a, b, opened;
+                    reused.gcm_encrypt(&plain, iv, sizeof iv, 16, &a);
+                    fresh.gcm_encrypt(&plain, iv, sizeof iv, 16, &b);
+                    ASSERT_EQ(a, b);
+                    ASSERT_TRUE(copy.gcm_decrypt(&a, iv, sizeof iv, 16, &opened));
+                    ASSERT_EQ(plain, opened);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+TEST(Crypto, SymmCipherCache_reusesRecentKeys)
+{
+    PrnGen rng;
+    byte keys[SymmCipherCache::SIZE + 1][FILENODEKEYLENGTH];
+    rng.genblock(keys[0], sizeof keys);
+
+    SymmCipherCache cache;
+    string foldernodekey((const char*)keys[0], FOLDERNODEKEYLENGTH);
+    string filenodekey((const char*)keys[0], FILENODEKEYLENGTH);
+    SymmCipher* folder = cache.get(&foldernodekey);
+    SymmCipher* file = cache.get(&filenodekey);
+    ASSERT_NE(folder, file);
+    ASSERT_EQ(folder, cache.get(&foldernodekey));
+    ASSERT_EQ(file, cache.get(keys[0], FILENODE));
+    ASSERT_EQ(2u, cache.misses);
+    ASSERT_EQ(2u, cache.hits);
+
+    string invalid(5, 'x');
+    ASSERT_EQ(nullptr, cache.get(&invalid));
+
+    // the same key as a plain cipher would use
+    byte a[SymmCipher::BLOCKSIZE] = {}, b[SymmCipher::BLOCKSIZE] = {};
+    SymmCipher plain;
+    plain.setkey(&filenodekey);
+    file->ecb_encrypt(a);
+    plain.ecb_encrypt(b);
+    ASSERT_EQ(0, memcmp(a, b, sizeof a));
+
+    // the oldest makes room, the others stay
+    for (int i = 1; i <= SymmCipherCache::SIZE; i++)
+    {
+        cache.get(keys[i], FOLDERNODE);
+    }
+    uint64_t misses = cache.misses;
+    ASSERT_EQ(folder, cache.get(keys[SymmCipherCache::SIZE - 1], FOLDERNODE));
+    ASSERT_EQ(file, cache.get(keys[SymmCipherCache::SIZE], FOLDERNODE));
+    cache.get(keys[2], FOLDERNODE);
+    ASSERT_EQ(misses, cache.misses);
+    cache.get(&filenodekey);
+    ASSERT_EQ(misses + 1, cache.misses);
+}
+
+// per node, what decrypting its attributes costs besides the decryption itself
+TEST(Crypto, DISABLED_SymmCipher_setkey_benchmark)
+{
+    PrnGen rng;
+    const int count = 100000;
+    std::vector<byte> keys(count * FILENODEKEYLENGTH);
+    rng.genblock(keys.data(), keys.size());
+    byte attrs[64] = {};
+
+    SymmCipher cipher;
+    double ms = mt::elapsedMs([&]()
+    {
+        for (int i = 0; i < count; i++)
+        {
+            cipher.setkey(&keys[i * FILENODEKEYLENGTH], FILENODE);
+            cipher.cbc_decrypt(attrs, sizeof attrs);
+        }
+    });
+    double perKeyUs = ms * 1000 / count;
+
+    mt::recordBenchmark("symmcipher_setkey_cbc_us", perKeyUs);
+}
+
+TEST(Crypto, PBKDF2_HMAC_SHA512_matchesCryptoPP)
+{
+    PrnGen rng;
+    const size_t passwordLengths[] = { 0, 8, 128, 129, 300 };
+    const size_t keyLengths[] = { 1, 32, 64, 100, 200 };
+    const unsigned iterationCounts[] = { 1, 2, 1000 };
+
+    for (size_t pwdLen : passwordLengths)
+    {
+        std::vector<byte> pwd(pwdLen + 1), salt(32);
+        rng.genblock(pwd.data(), pwd.size());
+        rng.genblock(salt.data(), salt.size());
+
+        for (size_t keyLen : keyLengths)
+        {
+            for (unsigned iterations : iterationCounts)
+            {
+                std::vector<byte> expected(keyLen), actual(keyLen);
+                CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA512>().DeriveKey(expected.data(), keyLen, 0, pwd.data(), pwdLen,
+                                                                          salt.data(), salt.size(), iterations);
+                PBKDF2_HMAC_SHA512().deriveKey(actual.data(), keyLen, pwd.data(), pwdLen, salt.data(), salt.size(), iterations);
+                ASSERT_EQ(expected, actual) << pwdLen << " byte password, " << keyLen << " byte key, " << iterations << " iterations";
+            }
+        }
+    }
+}
+
+TEST(Crypto, DISABLED_PBKDF2_HMAC_SHA512_benchmark)
+{
+    // as login2() derives the password key
+    const char* password = "correct horse battery staple";
+    byte salt[32] = {};
+    byte derivedKey[2 * SymmCipher::KEYLENGTH];
+
+    double cryptoppMs = mt::elapsedMs([&]()
+    {
+        CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA512>().DeriveKey(derivedKey, sizeof derivedKey, 0, (const byte*)password,
+                                                                  strlen(password), salt, sizeof salt, 100000);
+    });
+    double ms = mt::elapsedMs([&]()
+    {
+        PBKDF2_HMAC_SHA512().deriveKey(derivedKey, sizeof derivedKey, (const byte*)password, strlen(password),
+                                       salt, sizeof salt, 100000);
+    });
+
+    mt::recordBenchmark("pbkdf2_login_ms", ms);
+    mt::recordBenchmark("pbkdf2_cryptopp_ms", cryptoppMs);
+}
+
+TEST(Crypto, DISABLED_Base64_benchmark)
+{
+    PrnGen rng;
+    string binary(4 * 1024 * 1024, '\0');
+    rng.genblock((byte*)binary.data(), binary.size());
+    const double megabytes = double(binary.size()) / (1024 * 1024);
+
+    string encoded, decoded;
+    double encode = megabytes / mt::elapsedMs([&]() { Base64::btoa(binary, encoded); }) * 1000;
+    double decode = megabytes / mt::elapsedMs([&]() { Base64::atob(encoded, decoded); }) * 1000;
+    ASSERT_EQ(binary, decoded);
+
+    // and the many small values of the API traffic: handles and keys
+    const int count = 200000;
+    std::vector<string> handles(count);
+    double handlesEncode = mt::elapsedMs([&]()
+    {
+        for (int i = 0; i < count; i++)
+        {
+            handle h = handle(i) * 0x9E3779B97F4A7C15ull;
+            handles[i] = Base64::btoa(string((const char*)&h, MegaClient::NODEHANDLE));
+        }
+    });
+    double handlesDecode = mt::elapsedMs([&]()
+    {
+        for (const string& h : handles)
+        {
+            ASSERT_EQ(size_t(MegaClient::NODEHANDLE), Base64::atob(h).size());
+        }
+    });
+
+    mt::recordBenchmark("btoa_mb_s", encode);
+    mt::recordBenchmark("atob_mb_s", decode);
+    mt::recordBenchmark("handle_btoa_per_s", count / handlesEncode * 1000);
+    mt::recordBenchmark("handle_atob_per_s", count / handlesDecode * 1000);
+
+}
+
 #ifdef ENABLE_CHAT
 // Test functions of Ed25519:
 // - Binary & Hex fingerprints of public key
@@ -302,3 +732,65 @@ TEST(Crypto, Ed25519_Signing)
 }
 
 #endif
+
+TEST(Crypto, Ed25519_contactSignaturesVerifiedTogether)
+{
+    MegaApp app;
+    mt::DefaultedFileSystemAccess fs;
+    auto client = mt::makeClient(app, fs);
+    client->me = 1;
+    client->finduser(client->me, 1);
+    for (attr_t at : { ATTR_AUTHRING, ATTR_AUTHCU255, ATTR_AUTHRSA })
+    {
+        client->mAuthRings.emplace(at, AuthRing(at, TLVstore()));
+    }
+
+    // contacts whose Cu25519 keys are signed with their Ed25519 keys, the first one badly
+    PrnGen rng;
+    const int contacts = 2 * MegaClient::SIGVERIFY_MINSHARD + 3;
+    std::vector<std::string> cuKeys, signatures;
+    std::string goodSignature;
+    for (int i = 0; i < contacts; i++)
+    {
+        User* u = client->finduser(handle(100 + i), 1);
+        EdDSA signer(rng);
+        std::string edKey((const char*)signer.pubKey, EdDSA::PUBLIC_KEY_LENGTH);
+        std::string cuKey(ECDH::PUBLIC_KEY_LENGTH, char(i));
+        u->setattr(ATTR_ED25519_PUBK, &edKey, nullptr);
+        u->setattr(ATTR_CU25519_PUBK, &cuKey, nullptr);
+
+        std::string signature;
+        signer.signKey((const unsigned char*)cuKey.data(), cuKey.size(), &signature);
+        if (!i)
+        {
+            goodSignature = signature;
+            signature.back() ^= 1;
+        }
+        cuKeys.push_back(cuKey);
+        signatures.push_back(signature);
+    }
+
+    // as a new session checks all contacts
+    client->fetchContactsKeys();
+    for (int i = 0; i < contacts; i++)
+    {
+        ASSERT_EQ(API_OK, client->trackSignature(ATTR_SIG_CU255_PUBK, handle(100 + i), signatures[i]));
+    }
+    ASSERT_EQ(size_t(contacts), client->mPendingSignatures.size());
+    ASSERT_FALSE(client->mAuthRingsTemp.at(ATTR_AUTHCU255).isTracked(101));
+
+    client->verifysignatures();
+    ASSERT_TRUE(client->mPendingSignatures.empty());
+    const AuthRing& authring = client->mAuthRingsTemp.at(ATTR_AUTHCU255);
+    ASSERT_FALSE(authring.isTracked(100));
+    for (int i = 1; i < contacts; i++)
+    {
+        ASSERT_EQ(AUTH_METHOD_SIGNATURE, authring.getAuthMethod(handle(100 + i)));
+        ASSERT_EQ(AuthRing::fingerprint(cuKeys[i]), authring.getFingerprint(handle(100 + i)));
+    }
+
+    // the authring is saved once all contacts are tracked
+    ASSERT_EQ(API_OK, client->trackSignature(ATTR_SIG_CU255_PUBK, 100, goodSignature));
+    client->verifysignatures();
+    ASSERT_FALSE(client->mAuthRingsTemp.count(ATTR_AUTHCU255));
+}
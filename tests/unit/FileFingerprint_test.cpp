@@ -23,6 +23,7 @@
 
 #include <gtest/gtest.h>
 
+#include <mega.h>
 #include <mega/filefingerprint.h>
 
 #include "DefaultedFileAccess.h"
@@ -61,6 +62,7 @@ public:
             return false;
         }
         assert(static_cast<unsigned>(offset) + size <= mContent.size());
+        ++mReads;
         std::copy(mContent.begin() + static_cast<unsigned>(offset), mContent.begin() + static_cast<unsigned>(offset) + size, buffer);
         return true;
     }
@@ -73,9 +75,15 @@ public:
         return mReadFails;
     }
 
+    int getReads() const
+    {
+        return mReads;
+    }
+
 private:
     const std::vector<mega::byte> mContent;
     const bool mReadFails = false;
+    int mReads = 0;
 };
 
 class MockInputStreamAccess : public mega::InputStreamAccess
@@ -188,6 +196,41 @@ TEST(FileFingerprint, FileFingerprintCmp_compareSmallerBecauseOfCrc)
     ASSERT_TRUE(mega::FileFingerprintCmp{}(&ffp, &ffp2));
 }
 
+TEST(FileFingerprint, FileFingerprintHash_equalFingerprintsHashEqual)
+{
+    mega::FileFingerprint ffp;
+    ffp.size = 42;
+    ffp.mtime = 1500000000;
+    ffp.crc = {{1, 2, 3, 4}};
+
+    mega::FileFingerprint copiedFfp{ffp};
+    copiedFfp.isvalid = !ffp.isvalid;
+
+    ASSERT_TRUE(mega::FileFingerprintEqual{}(&ffp, &copiedFfp));
+    ASSERT_EQ(mega::FileFingerprintHash{}(&ffp), mega::FileFingerprintHash{}(&copiedFfp));
+}
+
+TEST(FileFingerprint, FileFingerprintEqual_differsLikeFileFingerprintCmp)
+{
+    mega::FileFingerprint ffp;
+    ffp.size = 42;
+    ffp.mtime = 1500000000;
+
+    mega::FileFingerprint ffp2{ffp};
+    ffp2.size = 43;
+    ASSERT_FALSE(mega::FileFingerprintEqual{}(&ffp, &ffp2));
+
+    // operator== tolerates a couple of seconds, the hashed set can't
+    ffp2 = ffp;
+    ffp2.mtime++;
+    ASSERT_FALSE(mega::FileFingerprintEqual{}(&ffp, &ffp2));
+    ASSERT_TRUE(mega::FileFingerprintCmp{}(&ffp, &ffp2));
+
+    ffp2 = ffp;
+    ffp2.crc[3] = 1;
+    ASSERT_FALSE(mega::FileFingerprintEqual{}(&ffp, &ffp2));
+}
+
 TEST(FileFingerprint, defaultConstructor)
 {
     const mega::FileFingerprint ffp;
@@ -429,6 +472,71 @@ TEST(FileFingerprint, genfingerprint_FileAccess_forLargeFile)
     ASSERT_EQ(true, ffp.isvalid);
 }
 
+TEST(FileFingerprint, genfingerprint_FileAccess_forLargeFile_mergesNearbyReads)
+{
+    mega::FileFingerprint ffp;
+    std::vector<mega::byte> content(20000);
+    std::iota(content.begin(), content.end(), mega::byte{0});
+    MockFileAccess fa{1, std::move(content)};
+    ASSERT_TRUE(ffp.genfingerprint(&fa));
+    ASSERT_EQ(1, fa.getReads());
+
+    // blocks further apart than a span are read separately
+    mega::FileFingerprint ffp2;
+    std::vector<mega::byte> content2(1 << 20);
+    std::iota(content2.begin(), content2.end(), mega::byte{0});
+    MockFileAccess fa2{1, std::move(content2)};
+    ASSERT_TRUE(ffp2.genfingerprint(&fa2));
+    ASSERT_GT(fa2.getReads(), 1);
+    ASSERT_LT(fa2.getReads(), 32);
+
+    // same result as reading block by block
+    std::vector<mega::byte> blocks;
+    for (unsigned i = 0; i < 128; i++)
+    {
+        m_off_t offset = ((1 << 20) - 64) * m_off_t(i) / 127;
+        for (unsigned j = 0; j < 64; j++)
+        {
+            blocks.push_back(mega::byte(offset + j));
+        }
+    }
+    for (unsigned i = 0; i < 4; i++)
+    {
+        mega::HashCRC32 crc;
+        crc.add(blocks.data() + i * 2048, 2048);
+        int32_t crcval;
+        crc.get((mega::byte*)&crcval);
+        ASSERT_EQ(int32_t(htonl(crcval)), ffp2.crc[i]);
+    }
+}
+
+TEST(FileFingerprint, genfingerprints_matchesOneByOne)
+{
+    std::vector<std::unique_ptr<MockFileAccess>> files;
+    std::vector<mega::FileFingerprint> batch(20), single(20);
+    std::vector<std::pair<mega::FileFingerprint*, mega::FileAccess*>> jobs;
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        std::vector<mega::byte> content(i * 1500 + 3);
+        std::iota(content.begin(), content.end(), mega::byte(i));
+        files.emplace_back(new MockFileAccess{mega::m_time_t(i), content});
+        jobs.emplace_back(&batch[i], files.back().get());
+
+        MockFileAccess fa{mega::m_time_t(i), content};
+        single[i].genfingerprint(&fa);
+    }
+
+    std::vector<bool> changed = mega::FileFingerprint::genfingerprints(jobs, 4);
+    ASSERT_EQ(batch.size(), changed.size());
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        ASSERT_TRUE(changed[i]);
+        ASSERT_EQ(single[i].size, batch[i].size);
+        ASSERT_EQ(single[i].crc, batch[i].crc);
+        ASSERT_TRUE(batch[i].isvalid);
+    }
+}
+
 TEST(FileFingerprint, genfingerprint_FileAccess_forLargeFile_butReadFails)
 {
     mega::FileFingerprint ffp;
@@ -56,6 +56,11 @@ public:
         return mMTime;
     }
 
+    void setMTime(const mega::m_time_t mtime)
+    {
+        mMTime = mtime;
+    }
+
     const std::vector<mega::byte>& getContent() const
     {
         return mContent;
@@ -0,0 +1,397 @@
+/**
+ * (c) 2019 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <mega.h>
+#include <mega/gfx.h>
+
+#include "DefaultedFileSystemAccess.h"
+#include "utils.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+using namespace mega;
+
+namespace {
+
+struct GfxStats
+{
+    std::mutex mutex;
+    int active = 0;
+    int maxactive = 0;
+    int processed = 0;
+};
+
+// takes a while on each image, recording how many are being processed at once
+class SlowGfxProc : public GfxProc
+{
+public:
+    SlowGfxProc(std::shared_ptr<GfxStats> s, bool parallel = true)
+        : stats(s)
+        , supportsworkers(parallel)
+    {
+    }
+
+private:
+    std::shared_ptr<GfxStats> stats;
+    bool supportsworkers;
+
+    bool readbitmap(FileAccess*, string*, int) override
+    {
+        {
+            std::lock_guard<std::mutex> g(stats->mutex);
+            stats->maxactive = std::max(stats->maxactive, ++stats->active);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        w = h = 2000;
+        return true;
+    }
+
+    bool resizebitmap(int, int, string* jpeg) override
+    {
+        jpeg->assign("jpeg");
+        return true;
+    }
+
+    void freebitmap() override
+    {
+        std::lock_guard<std::mutex> g(stats->mutex);
+        stats->active--;
+        stats->processed++;
+    }
+
+    GfxProc* newworker() override
+    {
+        return supportsworkers ? new SlowGfxProc(stats) : nullptr;
+    }
+};
+
+int queueImages(GfxProc& gfx, int count)
+{
+    byte keybytes[SymmCipher::KEYLENGTH] = {};
+    SymmCipher key(keybytes);
+    string path = "image.jpg";
+    for (int i = 0; i < count; i++)
+    {
+        gfx.gendimensionsputfa(nullptr, &path, handle(i), &key, 1 << GfxProc::THUMBNAIL);
+    }
+    return count;
+}
+
+void waitForImages(GfxStats& stats, int count)
+{
+    for (int i = 0; i < 500; i++)
+    {
+        {
+            std::lock_guard<std::mutex> g(stats.mutex);
+            if (stats.processed == count)
+            {
+                return;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+} // anonymous
+
+TEST(GfxProc, backlogIsSharedOutAmongWorkers)
+{
+    MegaApp app;
+    mt::DefaultedFileSystemAccess fsaccess;
+    WAIT_CLASS waiter;
+    auto client = mt::makeClient(app, fsaccess);
+    client->waiter = &waiter;
+
+    // the instances run on the threads of the worker pool, whatever the cores of the machine
+    WorkerPool::get().setthreads(3);
+
+    auto stats = std::make_shared<GfxStats>();
+    {
+        SlowGfxProc gfx(stats);
+        gfx.client = client.get();
+        gfx.setmaxworkers(3);
+
+        int images = queueImages(gfx, 12);
+        waitForImages(*stats, images);
+
+        ASSERT_EQ(stats->processed, images);
+        ASSERT_EQ(gfx.getworkers(), 3u);
+        ASSERT_GT(stats->maxactive, 1);
+        ASSERT_LE(stats->maxactive, 3);
+
+        // a smaller limit drops the extra instances before the next images
+        gfx.setmaxworkers(1);
+        images += queueImages(gfx, 2);
+        waitForImages(*stats, images);
+        ASSERT_EQ(gfx.getworkers(), 1u);
+
+        // and so does a cap on the class in the pool
+        gfx.setmaxworkers(3);
+        WorkerPool::get().setclasslimit(WorkerPool::WORK_GFX, 1);
+        {
+            std::lock_guard<std::mutex> g(stats->mutex);
+            stats->maxactive = 0;
+        }
+        images += queueImages(gfx, 6);
+        waitForImages(*stats, images);
+        ASSERT_EQ(stats->processed, images);
+        ASSERT_LE(stats->maxactive, 2);
+        WorkerPool::get().setclasslimit(WorkerPool::WORK_GFX, 0);
+    }
+
+    WorkerPool::get().setthreads(-1);
+}
+
+TEST(GfxProc, backendWithoutWorkersProcessesOneImageAtATime)
+{
+    MegaApp app;
+    mt::DefaultedFileSystemAccess fsaccess;
+    WAIT_CLASS waiter;
+    auto client = mt::makeClient(app, fsaccess);
+    client->waiter = &waiter;
+
+    auto stats = std::make_shared<GfxStats>();
+    {
+        SlowGfxProc gfx(stats, false);
+        gfx.client = client.get();
+        gfx.setmaxworkers(3);
+
+        int images = queueImages(gfx, 4);
+        waitForImages(*stats, images);
+
+        ASSERT_EQ(stats->processed, images);
+        ASSERT_EQ(gfx.getworkers(), 1u);
+        ASSERT_EQ(stats->maxactive, 1);
+    }
+}
+
+#ifndef _WIN32
+
+namespace {
+
+// a decoder that dies on crash.jpg and hangs on hang.jpg, and writes the process it ran in as the JPEG
+class UnsafeGfxProc : public GfxProc
+{
+    bool readbitmap(FileAccess*, string* name, int) override
+    {
+        if (*name == "crash.jpg")
+        {
+            raise(SIGKILL);
+        }
+        while (*name == "hang.jpg")
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+        w = h = 100;
+        return true;
+    }
+
+    bool resizebitmap(int, int, string* jpeg) override
+    {
+        *jpeg = std::to_string(getpid());
+        return true;
+    }
+
+    void freebitmap() override
+    {
+    }
+};
+
+string readFile(const string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+} // anonymous
+
+TEST(GfxProc, isolatedDecodingSurvivesCrashingAndHangingDecoders)
+{
+    MegaApp app;
+    FSACCESS_CLASS fsaccess;
+    WAIT_CLASS waiter;
+    auto client = mt::makeClient(app, fsaccess);
+    client->waiter = &waiter;
+
+    UnsafeGfxProc gfx;
+    gfx.client = client.get();
+    gfx.setisolated(true, 500);
+
+    string good = "good.jpg", crash = "crash.jpg", hang = "hang.jpg", out = "gfx_isolated.jpg";
+    ASSERT_TRUE(gfx.savefa(&good, 200, 0, &out));
+    string child = readFile(out);
+    ASSERT_FALSE(child.empty());
+    ASSERT_NE(std::to_string(getpid()), child);
+
+    // the same child serves the next files, until one takes it down
+    ASSERT_TRUE(gfx.savefa(&good, 200, 0, &out));
+    ASSERT_EQ(child, readFile(out));
+    ASSERT_FALSE(gfx.savefa(&crash, 200, 0, &out));
+    ASSERT_FALSE(gfx.savefa(&hang, 200, 0, &out));
+    ASSERT_EQ(2u, gfx.getstats().restarted);
+
+    ASSERT_TRUE(gfx.savefa(&good, 200, 0, &out));
+    ASSERT_NE(child, readFile(out));
+    ASSERT_TRUE(gfx.getisolated());
+    std::remove(out.c_str());
+}
+
+#endif
+
+#ifdef GFX_CLASS
+
+namespace {
+
+// uncompressed 24-bit BMP with a gradient, which every backend reads
+void writeBitmap(const string& path, int width, int height)
+{
+    unsigned rowbytes = (unsigned(width) * 3 + 3) & ~3u;
+    unsigned datasize = rowbytes * unsigned(height);
+    byte header[54] = { 'B', 'M' };
+    auto put32 = [&header](int offset, uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            header[offset + i] = byte(value >> (8 * i));
+        }
+    };
+    put32(2, 54 + datasize);
+    put32(10, 54);
+    put32(14, 40);
+    put32(18, uint32_t(width));
+    put32(22, uint32_t(height));
+    header[26] = 1;
+    header[28] = 24;
+    put32(34, datasize);
+
+    std::ofstream out(path, std::ios::binary);
+    out.write((const char*)header, sizeof header);
+    std::string row(rowbytes, '\0');
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            row[x * 3] = char(x * 255 / width);
+            row[x * 3 + 1] = char(y * 255 / height);
+            row[x * 3 + 2] = char((x ^ y) & 255);
+        }
+        out.write(row.data(), std::streamsize(row.size()));
+    }
+}
+
+} // anonymous
+
+// Times the backend this SDK is built with (GFX_CLASS) on a corpus of media files: the
+// files listed, one per line, in the file named by MEGA_GFX_BENCH_CORPUS (JPEG, PNG, HEIC,
+// RAW, videos...), or a couple of generated bitmaps. Each file gets a thumbnail and a
+// preview, with 1 to GfxProc::MAX_WORKERS instances of the backend
+TEST(GfxProc, DISABLED_backend_benchmark)
+{
+    MegaApp app;
+    FSACCESS_CLASS fsaccess;
+    WAIT_CLASS waiter;
+    auto client = mt::makeClient(app, fsaccess);
+    client->waiter = &waiter;
+
+    vector<string> corpus;
+    if (const char* list = getenv("MEGA_GFX_BENCH_CORPUS"))
+    {
+        std::ifstream in(list);
+        for (string line; std::getline(in, line); )
+        {
+            if (!line.empty())
+            {
+                corpus.push_back(line);
+            }
+        }
+    }
+    vector<string> generated;
+    if (corpus.empty())
+    {
+        generated = { "gfx_bench_landscape.bmp", "gfx_bench_portrait.bmp" };
+        writeBitmap(generated[0], 3000, 2000);
+        writeBitmap(generated[1], 1500, 2000);
+        corpus = generated;
+    }
+
+    const int rounds = 4;
+    byte keybytes[SymmCipher::KEYLENGTH] = {};
+    SymmCipher key(keybytes);
+
+    for (unsigned workers = 1; workers <= GfxProc::MAX_WORKERS; workers++)
+    {
+        GFX_CLASS gfx;
+        gfx.client = client.get();
+        gfx.setmaxworkers(workers);
+
+        auto start = std::chrono::steady_clock::now();
+        unsigned jobs = 0;
+        for (int r = 0; r < rounds; r++)
+        {
+            for (const string& path : corpus)
+            {
+                string localpath;
+                string utf8path = path;
+                fsaccess.path2local(&utf8path, &localpath);
+                if (gfx.gendimensionsputfa(nullptr, &localpath, handle(jobs), &key, (1 << GfxProc::THUMBNAIL) | (1 << GfxProc::PREVIEW)))
+                {
+                    jobs++;
+                }
+            }
+        }
+
+        GfxProcStats stats;
+        for (int i = 0; i < 60000 && stats.images + stats.failed < jobs; i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            stats = gfx.getstats();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        ASSERT_EQ(stats.images + stats.failed, jobs);
+
+        auto ms = [](int64_t us, unsigned n) { return n ? double(us) / 1000 / n : 0.; };
+        std::string name = "workers_" + std::to_string(workers);
+        mt::recordBenchmark(name + "_images_per_s", jobs / seconds);
+        mt::recordBenchmark(name + "_decode_ms", ms(stats.decodeus, stats.images));
+        mt::recordBenchmark(name + "_thumbnail_ms", ms(stats.resizeus[GfxProc::THUMBNAIL], stats.resized[GfxProc::THUMBNAIL]));
+        mt::recordBenchmark(name + "_preview_ms", ms(stats.resizeus[GfxProc::PREVIEW], stats.resized[GfxProc::PREVIEW]));
+        mt::recordBenchmark(name + "_failed", double(stats.failed));
+        mt::recordBenchmark(name + "_peak_rss_kb", double(mt::peakMemoryKB()));
+    }
+
+    for (const string& path : generated)
+    {
+        std::remove(path.c_str());
+    }
+}
+
+#endif
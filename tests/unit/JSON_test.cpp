@@ -0,0 +1,384 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <chrono>
+#include <iostream>
+
+#include <gtest/gtest.h>
+
+#include <mega/base64.h>
+#include <mega/json.h>
+#include <mega/utils.h>
+
+#include "utils.h"
+
+namespace {
+
+// feed `json` (the contents of an array after its opening bracket) in chunks of `chunksize` bytes,
+// discarding the consumed prefix each time like HttpReq::purge() does
+std::vector<std::string> scanInChunks(const std::string& json, size_t chunksize, mega::JSONArrayScanner& scanner)
+{
+    std::vector<std::string> elements;
+    std::string buffer;
+
+    for (size_t i = 0; i < json.size() && !scanner.finished() && !scanner.failed(); i += chunksize)
+    {
+        buffer.append(json, i, chunksize);
+        size_t consumed = scanner.feed(buffer.data(), buffer.size(), [&elements](const char* element, size_t len)
+        {
+            elements.emplace_back(element, len);
+            return true;
+        });
+        buffer.erase(0, consumed);
+    }
+
+    return elements;
+}
+
+// a fetchnodes-like 'f' array: there is no recorded response in the tree, so this mimics the field mix of one
+std::string fetchnodesPayload(size_t count)
+{
+    std::string json = "[";
+    for (size_t i = 0; i < count; i++)
+    {
+        json += i ? ",{" : "{";
+        json += "\"h\":\"" + std::to_string(10000000 + i).substr(0, 8) + "\",\"p\":\"AbCdEfGh\",\"u\":\"UsErHaNdLe0\",\"t\":" + (i % 10 ? "0" : "1");
+        json += ",\"a\":\"" + std::string(96 + i % 64, 'A') + "\",\"k\":\"UsErHaNdLe0:" + std::string(44, 'k') + "\"";
+        json += ",\"s\":" + std::to_string(i * 4096) + ",\"ts\":1580000000";
+        if (i % 3 == 0)
+        {
+            json += ",\"fa\":\"470:0*" + std::string(11, 'f') + "/471:1*" + std::string(11, 'g') + "\"";
+        }
+        json += "}";
+    }
+    return json + "]";
+}
+
+// skip one value the way storeobject() used to: strings byte by byte, tracking escapes
+const char* skipBytewise(const char* ptr)
+{
+    int depth = 0;
+    do
+    {
+        if (*ptr == '"')
+        {
+            bool escaped = false;
+            while (*++ptr && (escaped || *ptr != '"'))
+            {
+                escaped = *ptr == '\\' && !escaped;
+            }
+        }
+        else if (*ptr == '[' || *ptr == '{')
+        {
+            depth++;
+        }
+        else if (*ptr == ']' || *ptr == '}')
+        {
+            depth--;
+        }
+        ptr++;
+    } while (depth);
+    return ptr;
+}
+
+
+// the decoding Base64::atob() did before its lookup table and vector blocks
+int atobBytewise(const char* a, mega::byte* b, int blen)
+{
+    auto from64 = [](mega::byte c) -> mega::byte
+    {
+        if (c >= 'A' && c <= 'Z') return c - 'A';
+        if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+        if (c >= '0' && c <= '9') return c - '0' + 52;
+        if (c == '-' || c == '+') return 62;
+        if (c == '_' || c == '/') return 63;
+        return 255;
+    };
+
+    mega::byte c[4] = { 0 };
+    int p = 0;
+    for (;;)
+    {
+        int i;
+        for (i = 0; i < 4; i++)
+        {
+            if ((c[i] = from64(mega::byte(*a++))) == 255)
+            {
+                break;
+            }
+        }
+        if (p >= blen || !i) return p;
+        b[p++] = mega::byte((c[0] << 2) | ((c[1] & 0x30) >> 4));
+        if (p >= blen || i < 3) return p;
+        b[p++] = mega::byte((c[1] << 4) | ((c[2] & 0x3c) >> 2));
+        if (p >= blen || i < 4) return p;
+        b[p++] = mega::byte((c[2] << 6) | c[3]);
+    }
+}
+
+}
+
+TEST(JSON, storeobjectHandlesEscapedQuotes)
+{
+    const std::string json = R"("a\"b\\","c\\\"\\"],"x":[])";
+    mega::JSON j;
+    j.begin(json.c_str());
+
+    std::string value;
+    ASSERT_TRUE(j.storeobject(&value));
+    ASSERT_EQ(R"(a\"b\\)", value);
+    ASSERT_TRUE(j.storeobject(&value));
+    ASSERT_EQ(R"(c\\\"\\)", value);
+    ASSERT_FALSE(j.storeobject(&value));
+
+    // an unterminated string is a parse error
+    j.begin("\"abc\\\"");
+    ASSERT_FALSE(j.storeobject(&value));
+}
+
+TEST(JSON, DISABLED_fetchnodes_parse_benchmark)
+{
+    using mega::nameid;
+
+    const size_t count = 100000;
+    const std::string json = fetchnodesPayload(count);
+    const double megabytes = double(json.size()) / (1024 * 1024);
+
+    auto throughput = [&](std::function<void()> parse)
+    {
+        auto start = std::chrono::steady_clock::now();
+        parse();
+        return megabytes / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    double bytewise = throughput([&]()
+    {
+        ASSERT_EQ(json.c_str() + json.size(), skipBytewise(json.c_str()));
+    });
+    double skipped = throughput([&]()
+    {
+        mega::JSON j;
+        j.begin(json.c_str());
+        ASSERT_TRUE(j.storeobject());
+    });
+
+    // roughly what readnode() does with each record
+    size_t nodes = 0;
+    double parsed = throughput([&]()
+    {
+        mega::JSON j;
+        j.begin(json.c_str());
+        ASSERT_TRUE(j.enterarray());
+        while (j.enterobject())
+        {
+            nameid name;
+            while ((name = j.getnameid()) != EOO)
+            {
+                switch (name)
+                {
+                    case 'h':
+                    case 'p':
+                    case 'u':
+                    case 'a':
+                    case 'k':
+                    case MAKENAMEID2('f', 'a'):
+                        ASSERT_NE(nullptr, j.getvalueView().data);
+                        break;
+
+                    case 't':
+                    case 's':
+                    case MAKENAMEID2('t', 's'):
+                        j.getint();
+                        break;
+
+                    default:
+                        ASSERT_TRUE(j.storeobject());
+                }
+            }
+            ASSERT_TRUE(j.leaveobject());
+            nodes++;
+        }
+        ASSERT_TRUE(j.leavearray());
+    });
+    ASSERT_EQ(count, nodes);
+
+    mt::recordBenchmark("bytewise_skip_mb_s", bytewise);
+    mt::recordBenchmark("storeobject_skip_mb_s", skipped);
+    mt::recordBenchmark("field_parse_mb_s", parsed);
+
+}
+
+TEST(JSON, DISABLED_fetchnodes_base64_benchmark)
+{
+    using mega::nameid;
+
+    const size_t count = 100000;
+    const std::string json = fetchnodesPayload(count);
+    const double megabytes = double(json.size()) / (1024 * 1024);
+
+    // the handles and attributes of each node decoded, as readnode() does, with one decoder or the other
+    auto throughput = [&](bool bytewise, size_t& decoded)
+    {
+        std::string attrs;
+        mega::byte buf[512];
+        decoded = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        mega::JSON j;
+        j.begin(json.c_str());
+        EXPECT_TRUE(j.enterarray());
+        while (j.enterobject())
+        {
+            nameid name;
+            while ((name = j.getnameid()) != EOO)
+            {
+                switch (name)
+                {
+                    case 'h':
+                    case 'p':
+                    case 'u':
+                    case 'a':
+                        if (bytewise)
+                        {
+                            mega::JSONView v = j.getvalueView();
+                            decoded += size_t(atobBytewise(v.data, buf, int(sizeof buf)));
+                        }
+                        else if (name == 'a')
+                        {
+                            j.storebinary(&attrs);
+                            decoded += attrs.size();
+                        }
+                        else
+                        {
+                            decoded += name == 'u' ? 8 : 6;
+                            EXPECT_NE(mega::UNDEF, j.gethandle(name == 'u' ? 8 : 6));
+                        }
+                        break;
+
+                    default:
+                        j.storeobject();
+                }
+            }
+            j.leaveobject();
+        }
+        return megabytes / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    size_t bytewiseDecoded, decoded;
+    double bytewise = throughput(true, bytewiseDecoded);
+    double vectorised = throughput(false, decoded);
+    ASSERT_EQ(bytewiseDecoded, decoded);
+
+    mt::recordBenchmark("bytewise_base64_parse_mb_s", bytewise);
+    mt::recordBenchmark("base64_parse_mb_s", vectorised);
+
+}
+
+TEST(JSONArrayScanner, findsElementsAcrossChunkBoundaries)
+{
+    const std::string json = R"({"h":"a","a":"x,}]y"},{"h":"b","k":["1",{"c":"\"]"}]},7,"s\\"],"f2":[]})";
+    const std::vector<std::string> expected = {
+        R"({"h":"a","a":"x,}]y"})",
+        R"({"h":"b","k":["1",{"c":"\"]"}]})",
+        "7",
+        R"("s\\")"
+    };
+
+    for (size_t chunksize = 1; chunksize <= json.size(); ++chunksize)
+    {
+        mega::JSONArrayScanner scanner;
+        ASSERT_EQ(expected, scanInChunks(json, chunksize, scanner)) << "chunk size " << chunksize;
+        ASSERT_TRUE(scanner.finished());
+        ASSERT_FALSE(scanner.failed());
+    }
+}
+
+TEST(JSONArrayScanner, emptyArray)
+{
+    mega::JSONArrayScanner scanner;
+    std::string json = "],\"u\":[]}]";
+    ASSERT_TRUE(scanInChunks(json, 4, scanner).empty());
+    ASSERT_TRUE(scanner.finished());
+}
+
+TEST(JSONArrayScanner, incompleteElementIsNotConsumed)
+{
+    mega::JSONArrayScanner scanner;
+    std::string json = "{\"h\":\"a\"},{\"h\":";
+    size_t found = 0;
+    size_t consumed = scanner.feed(json.data(), json.size(), [&found](const char*, size_t) { return ++found; });
+    ASSERT_EQ(1u, found);
+    ASSERT_EQ(10u, consumed);
+    ASSERT_FALSE(scanner.finished());
+
+    // the remainder arrives: the element is reported once it is closed
+    json = json.substr(consumed) + "\"b\"}]";
+    consumed = scanner.feed(json.data(), json.size(), [&found](const char* element, size_t len)
+    {
+        EXPECT_EQ("{\"h\":\"b\"}", std::string(element, len));
+        return ++found;
+    });
+    ASSERT_EQ(2u, found);
+    ASSERT_EQ(json.size(), consumed);
+    ASSERT_TRUE(scanner.finished());
+}
+
+TEST(JSONArrayScanner, rejectedElementStopsScanning)
+{
+    mega::JSONArrayScanner scanner;
+    std::string json = "{},{},{}]";
+    size_t found = 0;
+    size_t consumed = scanner.feed(json.data(), json.size(), [&found](const char*, size_t) { return ++found < 2; });
+    ASSERT_EQ(2u, found);
+    ASSERT_EQ(3u, consumed);
+    ASSERT_TRUE(scanner.failed());
+
+    scanner.reset();
+    json = "{}},{}]";
+    scanner.feed(json.data(), json.size(), [](const char*, size_t) { return true; });
+    ASSERT_TRUE(scanner.failed());
+}
+
+TEST(JSON, viewsPointIntoTheBuffer)
+{
+    const std::string json = R"("name":"value","o":{"a":[1,"]"]},"n":-12,"e":"")";
+    mega::JSON j;
+    j.begin(json.c_str());
+
+    mega::JSONView v = j.getnameView();
+    ASSERT_TRUE(v.equals("name"));
+    v = j.getvalueView();
+    ASSERT_TRUE(v.equals("value"));
+    ASSERT_EQ(json.c_str() + 8, v.data);
+
+    ASSERT_EQ('o', j.getnameid());
+    ASSERT_TRUE(j.storeobjectView(&v));
+    ASSERT_EQ(R"({"a":[1,"]"]})", v.str());
+
+    ASSERT_EQ('n', j.getnameid());
+    v = j.getvalueView();
+    ASSERT_TRUE(v.equals(std::string("-12")));
+
+    ASSERT_EQ('e', j.getnameid());
+    v = j.getvalueView();
+    ASSERT_NE(nullptr, v.data);
+    ASSERT_TRUE(v.empty());
+
+    // nothing left
+    ASSERT_FALSE(j.storeobjectView(&v));
+}
@@ -15,6 +15,10 @@
  * You should have received a copy of the license along with this
  * program.
  */
+#include <mutex>
+#include <set>
+#include <thread>
+
 #include <gtest/gtest.h>
 
 #include <mega/logging.h>
@@ -505,3 +509,156 @@ TEST(Logging, macroFatal)
         EXPECT_NE(logger.mMessage[0].find(msg), std::string::npos);
     }
 }
+
+namespace {
+
+// collects what the background thread of an AsyncLogger delivers
+class CollectingLogger : public mega::Logger
+{
+public:
+#ifdef ENABLE_LOG_PERFORMANCE
+    void log(const char*, int loglevel, const char*, const char *message, const char **, size_t *, int) override
+#else
+    void log(const char*, int loglevel, const char*, const char *message) override
+#endif
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+        mThreads.insert(std::this_thread::get_id());
+        mMessages.emplace_back(loglevel, message);
+    }
+
+    std::vector<std::pair<int, std::string>> messages()
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+        return mMessages;
+    }
+
+    std::set<std::thread::id> threads()
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+        return mThreads;
+    }
+
+private:
+    std::mutex mMutex;
+    std::vector<std::pair<int, std::string>> mMessages;
+    std::set<std::thread::id> mThreads;
+};
+
+}
+
+TEST(Logging, asyncLogger_deliversInOrderFromItsThread)
+{
+    CollectingLogger target;
+    mega::AsyncLogger async(&target, 0);
+
+    for (int i = 0; i < 100; i++)
+    {
+        async.log("00:00:00", mega::logDebug, "file.cpp:1", std::to_string(i).c_str());
+    }
+    async.flush();
+
+    auto messages = target.messages();
+    ASSERT_EQ(100u, messages.size());
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_EQ(std::to_string(i), messages[i].second);
+    }
+    ASSERT_EQ(1u, target.threads().size());
+    ASSERT_EQ(0u, target.threads().count(std::this_thread::get_id()));
+
+    // once stopped, messages are delivered on the calling thread
+    async.stop();
+    async.log("00:00:00", mega::logInfo, "file.cpp:2", "sync");
+    ASSERT_EQ(101u, target.messages().size());
+    ASSERT_EQ(1u, target.threads().count(std::this_thread::get_id()));
+}
+
+TEST(Logging, asyncLogger_rateLimitsCallSitesAndCountsDrops)
+{
+    CollectingLogger target;
+    mega::AsyncLogger async(&target, 10);
+
+    for (int i = 0; i < 50; i++)
+    {
+        async.log("00:00:00", mega::logDebug, "noisy.cpp:1", "noisy");
+        async.log("00:00:00", mega::logError, "noisy.cpp:2", "error");
+    }
+    async.log("00:00:00", mega::logDebug, "quiet.cpp:1", "quiet");
+    async.flush();
+
+    size_t noisy = 0, errors = 0, quiet = 0;
+    for (auto& m : target.messages())
+    {
+        noisy += m.second == "noisy";
+        errors += m.second == "error";
+        quiet += m.second == "quiet";
+    }
+
+    // the second may have changed in the middle
+    ASSERT_GE(noisy, 10u);
+    ASSERT_LE(noisy, 20u);
+    ASSERT_EQ(50u, errors);
+    ASSERT_EQ(1u, quiet);
+
+    mega::AsyncLogger::Stats stats = async.stats();
+    ASSERT_EQ(50u - noisy, stats.ratelimited);
+    ASSERT_EQ(0u, stats.queuefull);
+}
+
+TEST(Logging, binaryLogger_roundTripsMessagesWithSharedTemplates)
+{
+    std::stringstream stream;
+    mega::BinaryLogger logger(stream);
+
+    std::vector<std::string> messages = {
+        "Sending 1234 bytes to nTU3xYLa",
+        "Sending 99 bytes to Zx0_ab-c",
+        "Leading zeros 007 and -5 and 0 stay as they are",
+        std::string(3000, 'x'),
+        "",
+    };
+    for (size_t i = 0; i < messages.size(); i++)
+    {
+        logger.log("00:00:00", int(i % mega::logMax), i == 2 ? "" : "file.cpp:12", messages[i].c_str());
+    }
+
+    // performance mode appends the source to the message
+    logger.log(nullptr, mega::logDebug, nullptr, "Sending 5 bytes to abc1 [other.cpp:7]");
+
+    size_t size = stream.str().size();
+    for (int i = 0; i < 100; i++)
+    {
+        logger.log(nullptr, mega::logInfo, "file.cpp:12", ("Sending " + std::to_string(i) + " bytes to h" + std::to_string(i)).c_str());
+    }
+    // the template and the source aren't repeated
+    ASSERT_LT(stream.str().size() - size, 100u * 16);
+
+    mega::BinaryLogReader reader(stream);
+    ASSERT_TRUE(reader.valid());
+
+    mega::BinaryLogReader::Entry entry;
+    for (size_t i = 0; i < messages.size(); i++)
+    {
+        ASSERT_TRUE(reader.next(entry));
+        ASSERT_EQ(messages[i], entry.message);
+        ASSERT_EQ(int(i % mega::logMax), entry.level);
+        ASSERT_EQ(i == 2 ? "" : "file.cpp:12", entry.source);
+        ASSERT_EQ(mega::LogOrigin::current().thread, entry.thread);
+    }
+
+    ASSERT_TRUE(reader.next(entry));
+    ASSERT_EQ("Sending 5 bytes to abc1", entry.message);
+    ASSERT_EQ("other.cpp:7", entry.source);
+
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_TRUE(reader.next(entry));
+        ASSERT_EQ("Sending " + std::to_string(i) + " bytes to h" + std::to_string(i), entry.message);
+    }
+    ASSERT_NE(std::string::npos, entry.render().find(" t" + std::to_string(entry.thread) + " info Sending 99 bytes to h99 [file.cpp:12]"));
+    ASSERT_FALSE(reader.next(entry));
+
+    std::stringstream text("not a binary log");
+    ASSERT_FALSE(mega::BinaryLogReader(text).valid());
+}
@@ -17,7 +17,11 @@
  */
 
 #include <atomic>
+#include <cstdio>
+#include <fstream>
 #include <memory>
+#include <random>
+#include <sstream>
 #include <thread>
 
 #include <gtest/gtest.h>
@@ -217,3 +221,486 @@ TEST(MegaApi, getMimeType)
 
     ASSERT_EQ(600, successCount);
 }
+
+TEST(MegaApi, NodeNameIndex_findsSubstringsAndGlobsAfterUpdates)
+{
+    NodeNameIndex index;
+    index.add(1, "Report 2020.pdf");
+    index.add(2, "holiday.JPG");
+    index.add(3, "reports");
+    index.add(4, "notes.txt");
+
+    auto find = [&index](const char* pattern, bool glob)
+    {
+        NodeSearchFilter filter;
+        filter.pattern = NodeSearchFilter::fold(pattern);
+        filter.glob = glob;
+        vector<handle> results;
+        index.find(filter, results);
+        std::sort(results.begin(), results.end());
+        return results;
+    };
+
+    ASSERT_EQ((vector<handle>{1, 3}), find("REPORT", false));
+    ASSERT_EQ((vector<handle>{1, 2, 3, 4}), find("", false));
+    ASSERT_EQ((vector<handle>{2}), find("*.jpg", true));
+    ASSERT_EQ((vector<handle>{3}), find("report?", true));
+    ASSERT_EQ((vector<handle>{1, 3}), find("rep*", true));
+    ASSERT_EQ(vector<handle>{}, find("port", true));
+
+    // a rename and a removal, and enough of them to compact the names
+    index.add(4, "report notes.txt");
+    index.remove(3);
+    ASSERT_EQ((vector<handle>{1, 4}), find("report", false));
+
+    for (handle h = 1; h <= 2; h++)
+    {
+        index.remove(h);
+    }
+    ASSERT_EQ(1u, index.size());
+    ASSERT_EQ((vector<handle>{4}), find("*notes*", true));
+}
+
+TEST(MegaApi, SyncExclusionMatcher_matchesNamesAndPathsByKind)
+{
+    SyncExclusionMatcher matcher;
+    matcher.setNames({"Thumbs.db", "*.tmp", "~*.d?c"});
+    ASSERT_TRUE(matcher.excludesName("Thumbs.db"));
+    ASSERT_FALSE(matcher.excludesName("thumbs.db"));
+    ASSERT_TRUE(matcher.excludesName("a.tmp"));
+    ASSERT_TRUE(matcher.excludesName(".tmp"));
+    ASSERT_FALSE(matcher.excludesName("a.tmp.txt"));
+    ASSERT_TRUE(matcher.excludesName("~letter.doc"));
+    ASSERT_FALSE(matcher.excludesName("letter.doc"));
+    ASSERT_FALSE(matcher.hasPaths());
+
+    matcher.setPaths({"/home/u/sync/build", "/home/u/sync/*/cache", "/other/*"});
+    ASSERT_TRUE(matcher.hasPaths());
+    auto excludes = [&matcher](const string& path)
+    {
+        return matcher.excludesPath(path, path.rfind('/') + 1);
+    };
+
+    ASSERT_TRUE(excludes("/home/u/sync/build"));
+    ASSERT_FALSE(excludes("/home/u/sync/build2"));
+    ASSERT_TRUE(excludes("/home/u/sync/a/cache"));
+    ASSERT_TRUE(excludes("/home/u/sync/a/b/cache"));
+    ASSERT_FALSE(excludes("/home/u/sync/a/b/caches"));
+    ASSERT_FALSE(excludes("/home/u/other/x"));
+
+    // the folder verdicts follow the folder being checked
+    ASSERT_TRUE(excludes("/other/x"));
+    ASSERT_FALSE(excludes("/home/u/sync/a/file"));
+    ASSERT_TRUE(excludes("/other/y"));
+
+    matcher.clear();
+    ASSERT_FALSE(matcher.hasPaths());
+    ASSERT_FALSE(matcher.excludesName("a.tmp"));
+}
+
+TEST(MegaApi, NodeSearchFilter_globTakesWholeUtf8Characters)
+{
+    NodeSearchFilter filter;
+    filter.pattern = "caf?";
+    filter.glob = true;
+
+    string name = "caf\xc3\xa9";
+    ASSERT_TRUE(filter.matchesName(name.data(), name.size()));
+    ASSERT_EQ("caf", filter.literal());
+}
+
+TEST(MegaApi, MpscQueue_keepsEachProducersOrderAcrossDrains)
+{
+    constexpr int producers = 4;
+    constexpr int perProducer = 5000;
+    std::vector<std::vector<int>> items(producers, std::vector<int>(perProducer));
+
+    mega::MpscQueue<int> queue;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&, p]() {
+            for (int i = 0; i < perProducer; ++i)
+            {
+                items[p][i] = p * perProducer + i;
+                queue.push(&items[p][i]);
+            }
+        });
+    }
+
+    std::vector<int> last(producers, -1);
+    int popped = 0;
+    while (popped < producers * perProducer)
+    {
+        if (int *item = queue.pop())
+        {
+            int p = *item / perProducer;
+            ASSERT_GT(*item, last[p]);
+            last[p] = *item;
+            ++popped;
+        }
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    ASSERT_EQ(nullptr, queue.pop());
+
+    int a = 1, b = 2, c = 3;
+    queue.push(&b);
+    queue.push(&c);
+    ASSERT_EQ(&b, queue.front());
+    queue.push_front(&a);
+    ASSERT_EQ(&a, queue.pop());
+    ASSERT_EQ(&b, queue.pop());
+    ASSERT_EQ(&c, queue.pop());
+    ASSERT_EQ(nullptr, queue.front());
+}
+
+#ifdef HAVE_LIBUV
+TEST(MegaApi, StreamingBuffer_gathersDataAcrossTheEndOfTheRing)
+{
+    mega::StreamingBuffer buffer;
+    buffer.setMaxOutputSize(8);
+    buffer.init(10);
+
+    ASSERT_EQ(6u, buffer.append("abcdef", 6));
+    uv_buf_t bufs[2];
+    ASSERT_EQ(1, buffer.nextBuffers(bufs));
+    ASSERT_EQ("abcdef", std::string(bufs[0].base, bufs[0].len));
+    buffer.freeData(6);
+
+    // the ring now wraps after four bytes
+    ASSERT_EQ(9u, buffer.append("ghijklmno", 9));
+    ASSERT_EQ(2, buffer.nextBuffers(bufs));
+    ASSERT_EQ("ghij", std::string(bufs[0].base, bufs[0].len));
+    ASSERT_EQ("klmn", std::string(bufs[1].base, bufs[1].len));
+
+    ASSERT_EQ(1, buffer.nextBuffers(bufs));
+    ASSERT_EQ("o", std::string(bufs[0].base, bufs[0].len));
+    ASSERT_EQ(0, buffer.nextBuffers(bufs));
+}
+
+TEST(MegaApi, MegaHTTPServer_hlsPlaylistCoversTheFileInPacketAlignedRanges)
+{
+    std::string nodekey(FILENODEKEYLENGTH, 'k');
+    MediaProperties vp;
+    vp.shortformat = 1;
+    vp.playtime = 60;
+    std::string fileattrstring = MediaProperties::encodeMediaPropertiesAttributes(vp, (uint32_t*)(nodekey.data() + FILENODEKEYLENGTH / 2));
+    std::string attrstring;
+
+    const int64_t size = 188 * 60000 + 100;
+    MegaNodePrivate ts("My Holidays.ts", MegaNode::TYPE_FILE, size, 0, 0, 1, &nodekey, &attrstring, &fileattrstring, nullptr, nullptr, UNDEF);
+    ASSERT_EQ(60, ts.getDuration());
+
+    std::istringstream playlist(MegaHTTPServer::getHLSPlaylist(&ts));
+    std::string line;
+    ASSERT_TRUE(std::getline(playlist, line));
+    ASSERT_EQ("#EXTM3U", line);
+
+    int64_t next = 0;
+    int segments = 0;
+    bool ended = false;
+    while (std::getline(playlist, line))
+    {
+        if (!line.compare(0, 17, "#EXT-X-BYTERANGE:"))
+        {
+            int64_t len = atoll(line.c_str() + 17);
+            int64_t offset = atoll(line.c_str() + line.find('@') + 1);
+            ASSERT_EQ(next, offset);
+            next += len;
+            segments++;
+
+            // each range points at the original file
+            ASSERT_TRUE(std::getline(playlist, line));
+            ASSERT_EQ("My%20Holidays.ts", line);
+            if (next < size)
+            {
+                ASSERT_EQ(0, len % 188);
+            }
+        }
+        ended = ended || line == "#EXT-X-ENDLIST";
+    }
+    ASSERT_EQ(size, next);
+    ASSERT_EQ(60 / MegaHTTPServer::HLS_SEGMENT_SECONDS + 1, segments);
+    ASSERT_TRUE(ended);
+
+    // other containers can't be split without remuxing
+    MegaNodePrivate mp4("My Holidays.mp4", MegaNode::TYPE_FILE, size, 0, 0, 2, &nodekey, &attrstring, &fileattrstring, nullptr, nullptr, UNDEF);
+    ASSERT_TRUE(MegaHTTPServer::getHLSPlaylist(&mp4).empty());
+}
+#endif
+
+TEST(MegaApi, EncryptFilePieceInParallel_matchesEncryptingTheBufferInOrder)
+{
+    // a piece from a chunk boundary to the (unaligned) end of the file, over many chunks
+    std::mt19937 rng(17);
+    string plain(5 * 1024 * 1024 + 1234, '\0');
+    for (auto& c : plain)
+    {
+        c = char(rng());
+    }
+    {
+        std::ofstream in("encryptpiece_in", std::ios::binary);
+        in << plain;
+    }
+
+    byte key[SymmCipher::KEYLENGTH];
+    for (auto& b : key)
+    {
+        b = byte(rng());
+    }
+    uint64_t ctriv = uint64_t(rng()) << 32 | rng();
+    m_off_t pos = ChunkedHash::chunkfloor(1024 * 1024 + 5);
+    m_off_t npos = m_off_t(plain.size());
+
+    SymmCipher cipher(key);
+    chunkmac_map expectedmacs;
+    string expected = plain.substr(size_t(pos)) + string(SymmCipher::BLOCKSIZE, '\0');
+    EncryptBufferByChunks eb((byte*)expected.data(), &cipher, &expectedmacs, ctriv);
+    string expectedsuffix;
+    ASSERT_TRUE(eb.encrypt(pos, npos, expectedsuffix));
+    expected.resize(size_t(npos - pos));
+
+    FSACCESS_CLASS fsaccess;
+    string input = "encryptpiece_in", output = "encryptpiece_out", localinput, localoutput;
+    fsaccess.path2local(&input, &localinput);
+    fsaccess.path2local(&output, &localoutput);
+
+    std::atomic<int64_t> progress(0);
+    EncryptFilePieceInParallel ef(&fsaccess, localinput, localoutput, key, ctriv, &progress);
+    chunkmac_map macs;
+    string suffix;
+    ASSERT_TRUE(ef.encrypt(pos, npos, 4, macs, suffix));
+
+    std::ostringstream out;
+    out << std::ifstream("encryptpiece_out", std::ios::binary).rdbuf();
+    std::remove("encryptpiece_in");
+    std::remove("encryptpiece_out");
+
+    ASSERT_EQ(expectedsuffix, suffix);
+    ASSERT_EQ(npos - pos, progress);
+    ASSERT_EQ(expected.size(), out.str().size());
+    ASSERT_TRUE(expected == out.str());
+    ASSERT_EQ(expectedmacs.macsmac(&cipher), macs.macsmac(&cipher));
+}
+
+TEST(MegaApi, FolderUploadPlanner_interleavesLargeFilesWithBatchesOfSmallOnesInDiskOrder)
+{
+    using Upload = MegaFolderUploadController::PlannedUpload;
+    const m_off_t large = MegaFolderUploadController::LARGE_UPLOAD_SIZE;
+    const size_t batch = MegaFolderUploadController::SMALL_UPLOADS_PER_LARGE;
+
+    // listed as a walk would: the small files first, then the large ones, in no particular inode order
+    vector<Upload> uploads;
+    auto add = [&uploads](const string& name, m_off_t size, handle fsid, bool fsidvalid)
+    {
+        Upload u;
+        u.utf8path = name;
+        u.size = size;
+        u.fsid = fsid;
+        u.fsidvalid = fsidvalid;
+        uploads.push_back(u);
+    };
+    for (size_t i = 0; i < batch + 5; i++)
+    {
+        add("s" + std::to_string(i), 100, handle(1000 - i), true);
+    }
+    add("unknown", -1, UNDEF, false);
+    add("L2", large * 2, 20, true);
+    add("L1", large, 10, true);
+
+    MegaFolderUploadController::planUploads(uploads);
+    ASSERT_EQ(batch + 8, uploads.size());
+
+    // a large file, a full batch of small ones starting with the one without fsid, the other large file and
+    // the rest of the small ones
+    ASSERT_EQ("L1", uploads[0].utf8path);
+    ASSERT_EQ("unknown", uploads[1].utf8path);
+    ASSERT_EQ("s" + std::to_string(batch + 4), uploads[2].utf8path);
+    ASSERT_EQ("L2", uploads[batch + 1].utf8path);
+    for (size_t i = batch + 2; i < uploads.size(); i++)
+    {
+        ASSERT_LT(uploads[i].size, large);
+        ASSERT_LT(uploads[i - 1].fsid, uploads[i].fsid);
+    }
+    ASSERT_EQ("s0", uploads.back().utf8path);
+}
+
+TEST(MegaApi, SdkMutex_sharedLocksDontWaitForEachOther)
+{
+    SdkMutex m;
+    m.lock_shared();
+
+    // another reader gets in, a writer doesn't
+    std::thread([&]()
+    {
+        m.lock_shared();
+        m.unlock_shared();
+        ASSERT_FALSE(m.try_lock_for(std::chrono::milliseconds(20)));
+    }).join();
+
+    // nor does it keep the readers out once it has given up
+    std::thread([&]()
+    {
+        m.lock_shared();
+        m.unlock_shared();
+    }).join();
+
+    m.unlock_shared();
+
+    std::thread([&]()
+    {
+        ASSERT_TRUE(m.try_lock());
+        m.unlock();
+    }).join();
+}
+
+TEST(MegaApi, SdkMutex_ownerTakesSharedRecursively)
+{
+    SdkMutex m;
+    m.lock();
+    m.lock();
+    m.lock_shared();
+    m.unlock_shared();
+    m.unlock();
+
+    std::thread([&]()
+    {
+        ASSERT_FALSE(m.try_lock());
+    }).join();
+
+    m.unlock();
+
+    std::thread([&]()
+    {
+        ASSERT_TRUE(m.try_lock());
+        m.unlock();
+    }).join();
+}
+
+TEST(MegaApi, SdkMutex_waitingWriterKeepsNewReadersOut)
+{
+    SdkMutex m;
+    std::atomic<bool> written(false), read(false), readAfterWrite(false);
+
+    m.lock_shared();
+
+    std::thread writer([&]()
+    {
+        m.lock();
+        written = true;
+        m.unlock();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::thread reader([&]()
+    {
+        m.lock_shared();
+        readAfterWrite = bool(written);
+        read = true;
+        m.unlock_shared();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_FALSE(read);
+
+    // a nested shared lock of a current reader still goes through
+    m.lock_shared();
+    m.unlock_shared();
+
+    m.unlock_shared();
+    writer.join();
+    reader.join();
+    ASSERT_TRUE(readAfterWrite);
+}
+
+#ifdef MEGA_SHARED_EVENT_LOOPS
+namespace {
+
+struct LoopClient : SharedEventLoops::Client
+{
+    PosixWaiter waiter;
+    dstime timeout = NEVER;
+    std::atomic<bool> quit{false};
+    std::atomic<int> turns{0};
+    std::thread::id thread;
+
+    int waitfd() override
+    {
+        return waiter.eventfd();
+    }
+
+    dstime prepareturn() override
+    {
+        waiter.init(timeout);
+        int timeoutms = waiter.arm();
+        return timeoutms < 0 ? NEVER : dstime(timeoutms / 100);
+    }
+
+    bool turn() override
+    {
+        waiter.collect(0);
+        thread = std::this_thread::get_id();
+        turns++;
+        return !quit;
+    }
+
+    void stop(SharedEventLoops& loops)
+    {
+        quit = true;
+        waiter.notify();
+        loops.waitdone(this);
+    }
+};
+
+bool waitForTurns(const LoopClient& c, int turns)
+{
+    for (int i = 0; i < 500 && c.turns < turns; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return c.turns >= turns;
+}
+
+} // anonymous
+
+TEST(MegaApi, SharedEventLoops_runClientsOnTheirLoopThread)
+{
+    SharedEventLoops loops;
+    LoopClient a, b;
+    ASSERT_FALSE(loops.add(&a));
+
+    loops.setthreads(1);
+    ASSERT_TRUE(loops.add(&a));
+    ASSERT_TRUE(loops.add(&b));
+
+    a.waiter.notify();
+    ASSERT_TRUE(waitForTurns(a, 1));
+    b.waiter.notify();
+    ASSERT_TRUE(waitForTurns(b, 1));
+
+    ASSERT_EQ(a.thread, b.thread);
+    ASSERT_NE(a.thread, std::this_thread::get_id());
+
+    a.stop(loops);
+    b.stop(loops);
+}
+
+TEST(MegaApi, SharedEventLoops_wakeClientsWhenTheirTimeIsUp)
+{
+    SharedEventLoops loops;
+    loops.setthreads(1);
+
+    LoopClient timed, idle;
+    timed.timeout = 1;
+    ASSERT_TRUE(loops.add(&timed));
+    ASSERT_TRUE(loops.add(&idle));
+
+    ASSERT_TRUE(waitForTurns(timed, 3));
+    ASSERT_EQ(idle.turns, 0);
+
+    timed.stop(loops);
+    idle.stop(loops);
+}
+#endif
@@ -0,0 +1,475 @@
+/**
+ * (c) 2019 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <gtest/gtest.h>
+#include <mega/types.h>
+#include <megaapi.h>
+#include <megaapi_impl.h>
+
+#include "utils.h"
+
+#if defined(HAVE_LIBUV) && !defined(_WIN32)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace mega;
+
+namespace {
+
+// Stands in for the DirectRead of a node: the plaintext served is the AES-CTR keystream of an
+// all-zero file, so that producing it costs what decrypting a real download does
+class MockDirectRead
+{
+public:
+    static const m_off_t FILE_SIZE = m_off_t(1) << 30;
+
+    MockDirectRead()
+    {
+        byte key[SymmCipher::KEYLENGTH];
+        for (unsigned i = 0; i < sizeof key; i++)
+        {
+            key[i] = byte(i * 37 + 11);
+        }
+        cipher.setkey(key);
+    }
+
+    void read(m_off_t pos, byte *out, unsigned len)
+    {
+        // ctr_crypt() works on whole blocks
+        m_off_t aligned = pos & ~m_off_t(SymmCipher::BLOCKSIZE - 1);
+        unsigned skip = unsigned(pos - aligned);
+        unsigned padded = (skip + len + SymmCipher::BLOCKSIZE - 1) & ~(SymmCipher::BLOCKSIZE - 1);
+
+        block.assign(padded, 0);
+        cipher.ctr_crypt(block.data(), padded, aligned, 0x0123456789abcdefULL, nullptr, false);
+        memcpy(out, block.data() + skip, len);
+    }
+
+private:
+    SymmCipher cipher;
+    std::vector<byte> block;
+};
+
+// A connection of the benchmark server, answering "GET /<first>-<last>" requests with that range
+// of the mock file, one at a time, and keeping the connection open for the next one
+class BenchmarkContext : public MegaTCPContext
+{
+public:
+    BenchmarkContext()
+    {
+        lastBuffer = NULL;
+        lastBufferLen = 0;
+    }
+
+    StreamingBuffer buffer;
+    std::string request;
+
+    // next byte of the range to be produced and end of the range, guarded by the producer mutex
+    m_off_t next = 0;
+    m_off_t end = 0;
+
+    // bytes of the current response (header included) that haven't been written yet
+    m_off_t unsent = 0;
+};
+
+// The streaming path of MegaHTTPServer without the MegaApi behind it: the producer thread plays
+// the role of the transfer callbacks, appending decrypted data to the StreamingBuffer of each
+// connection and waking its loop up, while the loop writes it out
+class BenchmarkServer : public MegaTCPServer
+{
+public:
+    BenchmarkServer()
+        : MegaTCPServer(nullptr, std::string())
+    {
+        producer = std::thread([this]() { produce(); });
+    }
+
+    ~BenchmarkServer()
+    {
+        // no async handle must be woken up once the connections start closing
+        {
+            std::lock_guard<std::mutex> g(producerMutex);
+            exiting = true;
+        }
+        producerWakeup.notify_one();
+        producer.join();
+        stop();
+    }
+
+protected:
+    static const unsigned PRODUCER_CHUNK = 131072;
+
+    std::thread producer;
+    std::mutex producerMutex;
+    std::condition_variable producerWakeup;
+    std::set<BenchmarkContext *> producing;
+    bool exiting = false;
+
+    MegaTCPContext *initializeContext(uv_stream_t *server_handle) override
+    {
+        BenchmarkContext *ctx = new BenchmarkContext();
+        ctx->server = (MegaTCPServer *)server_handle->data;
+        ctx->tcphandle.data = ctx;
+        ctx->asynchandle.data = ctx;
+        ctx->buffer.init(StreamingBuffer::MAX_BUFFER_SIZE);
+        return ctx;
+    }
+
+    bool respondNewConnection(MegaTCPContext *) override
+    {
+        return true;
+    }
+
+    void processReceivedData(MegaTCPContext *tcpctx, ssize_t nread, const uv_buf_t *buf) override
+    {
+        BenchmarkContext *ctx = static_cast<BenchmarkContext *>(tcpctx);
+        if (nread < 0)
+        {
+            finish(ctx);
+            return;
+        }
+
+        ctx->request.append(buf->base, size_t(nread));
+        if (ctx->request.size() < 4 || ctx->request.compare(ctx->request.size() - 4, 4, "\r\n\r\n"))
+        {
+            return;
+        }
+
+        long long first, last;
+        if (sscanf(ctx->request.c_str(), "GET /%lld-%lld ", &first, &last) != 2
+                || first < 0 || last < first || last >= MockDirectRead::FILE_SIZE)
+        {
+            finish(ctx);
+            return;
+        }
+        ctx->request.clear();
+
+        std::ostringstream header;
+        header << "HTTP/1.1 206 Partial Content\r\n"
+               << "Content-Range: bytes " << first << "-" << last << "/" << MockDirectRead::FILE_SIZE << "\r\n"
+               << "Content-Length: " << (last - first + 1) << "\r\n\r\n";
+        string h = header.str();
+
+        ctx->buffer.setMaxOutputSize(getMaxOutputSize(ctx));
+        uv_mutex_lock(&ctx->mutex);
+        ctx->buffer.append(h.data(), unsigned(h.size()));
+        uv_mutex_unlock(&ctx->mutex);
+        ctx->unsent = m_off_t(h.size()) + last - first + 1;
+
+        {
+            std::lock_guard<std::mutex> g(producerMutex);
+            ctx->next = first;
+            ctx->end = last + 1;
+            producing.insert(ctx);
+        }
+        producerWakeup.notify_one();
+
+        sendNextBytes(ctx);
+    }
+
+    void processAsyncEvent(MegaTCPContext *tcpctx) override
+    {
+        sendNextBytes(static_cast<BenchmarkContext *>(tcpctx));
+    }
+
+    void processWriteFinished(MegaTCPContext *tcpctx, int status) override
+    {
+        BenchmarkContext *ctx = static_cast<BenchmarkContext *>(tcpctx);
+        ctx->lastBuffer = NULL;
+        if (status < 0)
+        {
+            finish(ctx);
+            return;
+        }
+
+        ctx->unsent -= ctx->lastBufferLen;
+        uv_mutex_lock(&ctx->mutex);
+        ctx->buffer.freeData(unsigned(ctx->lastBufferLen));
+        ctx->lastBufferLen = 0;
+        uv_mutex_unlock(&ctx->mutex);
+
+        if (ctx->unsent)
+        {
+            sendNextBytes(ctx);
+        }
+    }
+
+    void sendNextBytes(BenchmarkContext *ctx)
+    {
+        if (ctx->finished || ctx->lastBuffer)
+        {
+            return;
+        }
+
+        uv_buf_t bufs[2];
+        uv_mutex_lock(&ctx->mutex);
+        int numbufs = ctx->buffer.nextBuffers(bufs);
+        uv_mutex_unlock(&ctx->mutex);
+        if (!numbufs)
+        {
+            return;
+        }
+
+        ctx->lastBuffer = bufs[0].base;
+        ctx->lastBufferLen = int(bufs[0].len + (numbufs > 1 ? bufs[1].len : 0));
+
+        uv_write_t *req = new uv_write_t();
+        req->data = ctx;
+        if (uv_write(req, (uv_stream_t *)&ctx->tcphandle, bufs, unsigned(numbufs), onWriteFinished))
+        {
+            delete req;
+            ctx->lastBuffer = NULL;
+            finish(ctx);
+        }
+    }
+
+    void finish(BenchmarkContext *ctx)
+    {
+        {
+            std::lock_guard<std::mutex> g(producerMutex);
+            producing.erase(ctx);
+        }
+        closeConnection(ctx);
+    }
+
+    void produce()
+    {
+        MockDirectRead source;
+        std::vector<byte> chunk(PRODUCER_CHUNK);
+
+        std::unique_lock<std::mutex> g(producerMutex);
+        while (!exiting)
+        {
+            bool progress = false;
+            for (auto it = producing.begin(); it != producing.end(); )
+            {
+                BenchmarkContext *ctx = *it;
+
+                uv_mutex_lock(&ctx->mutex);
+                unsigned len = std::min(ctx->buffer.availableSpace(), unsigned(PRODUCER_CHUNK));
+                len = unsigned(std::min(m_off_t(len), ctx->end - ctx->next));
+                if (len)
+                {
+                    source.read(ctx->next, chunk.data(), len);
+                    ctx->buffer.append((const char *)chunk.data(), len);
+                    ctx->next += len;
+                }
+                uv_mutex_unlock(&ctx->mutex);
+
+                if (len)
+                {
+                    progress = true;
+                    uv_async_send(&ctx->asynchandle);
+                }
+
+                it = (ctx->next == ctx->end) ? producing.erase(it) : std::next(it);
+            }
+
+            if (!progress)
+            {
+                // every buffer is full: wait for the loop to drain them
+                producerWakeup.wait_for(g, std::chrono::milliseconds(1));
+            }
+        }
+    }
+};
+
+int connectTo(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(uint16_t(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof nodelay);
+    if (connect(fd, (sockaddr *)&addr, sizeof addr))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+} // namespace
+
+// Range requests over keep-alive connections from concurrent clients, as a player seeking in a
+// stream does. Reports the request rate, the throughput, the time to the first byte of the
+// responses and the CPU time spent (by the whole process, clients included) per GB served
+TEST(MegaTCPServer, DISABLED_streaming_benchmark)
+{
+    const int clients = 8;
+    const int requestsPerConnection = 16;
+    const m_off_t rangeSize = 1024 * 1024;
+    const unsigned verified = 64;
+
+    BenchmarkServer server;
+    int port = 0;
+    for (int candidate = 52300; !port && candidate < 52316; candidate++)
+    {
+        if (server.start(candidate, true))
+        {
+            port = candidate;
+        }
+    }
+    ASSERT_NE(port, 0) << "No port available for the benchmark server";
+
+    std::mutex resultsMutex;
+    std::vector<double> ttfbs;
+    std::atomic<m_off_t> received(0);
+    std::atomic<int> mismatches(0);
+
+    double cpuStart = mt::cpuSeconds();
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int c = 0; c < clients; c++)
+    {
+        threads.emplace_back([&, c]()
+        {
+            MockDirectRead source;
+            std::vector<double> times;
+            int fd = connectTo(port);
+            if (fd < 0)
+            {
+                mismatches++;
+                return;
+            }
+
+            std::vector<char> buf(65536);
+            byte expected[verified];
+            for (int r = 0; r < requestsPerConnection; r++)
+            {
+                // deterministic, scattered positions, not aligned to anything
+                m_off_t first = (m_off_t(c) * 7919 + m_off_t(r) * 104729) * 4099 % (MockDirectRead::FILE_SIZE - rangeSize);
+                m_off_t last = first + rangeSize - 1;
+
+                std::ostringstream request;
+                request << "GET /" << first << "-" << last << " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+                string req = request.str();
+
+                auto sent = std::chrono::steady_clock::now();
+                if (send(fd, req.data(), req.size(), 0) != ssize_t(req.size()))
+                {
+                    mismatches++;
+                    break;
+                }
+
+                string header;
+                m_off_t body = 0;
+                bool firstbyte = true;
+                bool failed = false;
+                while (body < rangeSize)
+                {
+                    ssize_t n = recv(fd, buf.data(), buf.size(), 0);
+                    if (n <= 0)
+                    {
+                        failed = true;
+                        break;
+                    }
+                    if (firstbyte)
+                    {
+                        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sent).count());
+                        firstbyte = false;
+                    }
+
+                    const char *data = buf.data();
+                    size_t len = size_t(n);
+                    size_t headerEnd = header.find("\r\n\r\n");
+                    if (headerEnd == string::npos)
+                    {
+                        size_t before = header.size();
+                        header.append(data, len);
+                        headerEnd = header.find("\r\n\r\n");
+                        if (headerEnd == string::npos)
+                        {
+                            continue;
+                        }
+                        size_t consumed = headerEnd + 4 - before;
+                        data += consumed;
+                        len -= consumed;
+                    }
+
+                    if (body < m_off_t(verified) && len)
+                    {
+                        unsigned check = unsigned(std::min(m_off_t(len), m_off_t(verified) - body));
+                        source.read(first + body, expected, check);
+                        if (memcmp(expected, data, check))
+                        {
+                            mismatches++;
+                        }
+                    }
+                    body += m_off_t(len);
+                }
+
+                if (failed || body != rangeSize || header.compare(0, 12, "HTTP/1.1 206"))
+                {
+                    mismatches++;
+                    break;
+                }
+                received += body;
+            }
+            close(fd);
+
+            std::lock_guard<std::mutex> g(resultsMutex);
+            ttfbs.insert(ttfbs.end(), times.begin(), times.end());
+        });
+    }
+
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpu = mt::cpuSeconds() - cpuStart;
+
+    ASSERT_EQ(mismatches.load(), 0);
+    ASSERT_EQ(received.load(), m_off_t(clients) * requestsPerConnection * rangeSize);
+    ASSERT_FALSE(ttfbs.empty());
+
+    std::sort(ttfbs.begin(), ttfbs.end());
+    double p50 = ttfbs[ttfbs.size() / 2];
+    double p99 = ttfbs[std::min(ttfbs.size() - 1, ttfbs.size() * 99 / 100)];
+    double gb = double(received.load()) / (1024 * 1024 * 1024);
+
+    mt::recordBenchmark("requests_per_s", ttfbs.size() / seconds);
+    mt::recordBenchmark("mb_s", double(received.load()) / (1024 * 1024) / seconds);
+    mt::recordBenchmark("ttfb_p50_ms", p50);
+    mt::recordBenchmark("ttfb_p99_ms", p99);
+    mt::recordBenchmark("cpu_s_per_gb", cpu / gb);
+
+}
+
+#endif
@@ -0,0 +1,550 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "MemoryFileSystem.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "DefaultedDirAccess.h"
+#include "DefaultedFileAccess.h"
+
+namespace mt {
+
+namespace {
+
+uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+class MemoryFileAccess : public DefaultedFileAccess
+{
+public:
+    explicit MemoryFileAccess(MemoryFileSystem& fs)
+    : mFs{fs}
+    {}
+
+    // reading only: a real open takes the size and content the reads will see
+    bool fopen(std::string* path, bool, bool write) override
+    {
+        mPath = *path;
+        retry = false;
+        return !write && sysopen();
+    }
+
+    void updatelocalname(std::string* name) override
+    {
+        if (nonblocking_localname.size())
+        {
+            nonblocking_localname = *name;
+        }
+        mPath = *name;
+    }
+
+    // as on POSIX: false for folders, with their type
+    bool sysstat(mega::m_time_t* curr_mtime, m_off_t* curr_size) override
+    {
+        retry = false;
+        type = mega::TYPE_UNKNOWN;
+        const MemoryFileSystem::Entry* e = mFs.find(mPath);
+        if (!e)
+        {
+            return false;
+        }
+
+        type = e->type;
+        fsid = e->fsid;
+        fsidvalid = true;
+        if (e->type == mega::FOLDERNODE)
+        {
+            return false;
+        }
+        *curr_mtime = e->mtime;
+        *curr_size = e->size;
+        return true;
+    }
+
+    bool sysopen(bool = false) override
+    {
+        const MemoryFileSystem::Entry* e = mFs.find(mPath);
+        if (!e)
+        {
+            return false;
+        }
+
+        type = e->type;
+        fsid = e->fsid;
+        fsidvalid = true;
+        size = e->type == mega::FILENODE ? e->size : 0;
+        mtime = e->mtime;
+        mContent = e->content;
+        return true;
+    }
+
+    bool sysread(mega::byte* buffer, unsigned len, m_off_t offset) override
+    {
+        if (type != mega::FILENODE || offset + len > size)
+        {
+            return false;
+        }
+        MemoryFileSystem::generate(mContent, offset, buffer, len);
+        return true;
+    }
+
+    void sysclose() override
+    {}
+
+private:
+    MemoryFileSystem& mFs;
+    std::string mPath;
+    uint64_t mContent = 0;
+};
+
+class MemoryDirAccess : public DefaultedDirAccess
+{
+public:
+    explicit MemoryDirAccess(MemoryFileSystem& fs)
+    : mFs{fs}
+    {}
+
+    // the entries as they are now: changes while enumerating don't show
+    bool dopen(std::string* path, mega::FileAccess*, bool glob) override
+    {
+        const MemoryFileSystem::Entry* folder = glob ? nullptr : mFs.find(*path);
+        if (!folder || folder->type != mega::FOLDERNODE)
+        {
+            return false;
+        }
+
+        mEntries.clear();
+        mNext = 0;
+        for (auto& child : folder->children)
+        {
+            mega::DirEntry entry;
+            entry.localname = child.first;
+            entry.type = child.second->type;
+            entry.size = child.second->type == mega::FILENODE ? child.second->size : 0;
+            entry.mtime = child.second->mtime;
+            entry.fsid = child.second->fsid;
+            entry.fsidvalid = true;
+            entry.statvalid = true;
+            mEntries.push_back(std::move(entry));
+        }
+        return true;
+    }
+
+    bool dnext(std::string*, std::string* localname, bool = true, mega::nodetype_t* type = NULL) override
+    {
+        if (mNext == mEntries.size())
+        {
+            return false;
+        }
+        *localname = mEntries[mNext].localname;
+        if (type)
+        {
+            *type = mEntries[mNext].type;
+        }
+        mNext++;
+        return true;
+    }
+
+    bool dnextstat(std::string*, mega::DirEntry* entry, bool = true) override
+    {
+        if (mNext == mEntries.size())
+        {
+            return false;
+        }
+        *entry = mEntries[mNext++];
+        return true;
+    }
+
+private:
+    MemoryFileSystem& mFs;
+    std::vector<mega::DirEntry> mEntries;
+    size_t mNext = 0;
+};
+
+size_t countEntries(const MemoryFileSystem::Entry& folder)
+{
+    size_t n = folder.children.size();
+    for (auto& child : folder.children)
+    {
+        n += countEntries(*child.second);
+    }
+    return n;
+}
+
+} // anonymous
+
+MemoryFileSystem::MemoryFileSystem()
+{
+    notifyfailed = false;
+    mRoot.type = mega::FOLDERNODE;
+    mRoot.fsid = mNextFsId++;
+}
+
+void MemoryFileSystem::generate(uint64_t content, m_off_t pos, mega::byte* data, unsigned len)
+{
+    // eight bytes per block of the file, from the content id and the block's position
+    while (len)
+    {
+        uint64_t block = splitmix64(content ^ splitmix64(uint64_t(pos >> 3)));
+        unsigned skip = unsigned(pos & 7);
+        unsigned n = std::min(len, 8 - skip);
+        for (unsigned i = 0; i < n; i++)
+        {
+            data[i] = mega::byte(block >> ((skip + i) * 8));
+        }
+        data += n;
+        pos += n;
+        len -= n;
+    }
+}
+
+MemoryFileSystem::Entry* MemoryFileSystem::lookup(const std::string& path)
+{
+    if (path.empty() || path[0] != '/')
+    {
+        return nullptr;
+    }
+
+    Entry* e = &mRoot;
+    size_t start = 1;
+    while (start < path.size())
+    {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos)
+        {
+            end = path.size();
+        }
+
+        auto it = e->children.find(path.substr(start, end - start));
+        if (it == e->children.end())
+        {
+            return nullptr;
+        }
+        e = it->second.get();
+        start = end + 1;
+    }
+    return e;
+}
+
+const MemoryFileSystem::Entry* MemoryFileSystem::find(const std::string& path) const
+{
+    return const_cast<MemoryFileSystem*>(this)->lookup(path);
+}
+
+size_t MemoryFileSystem::count(const std::string& path) const
+{
+    const Entry* e = find(path);
+    return e ? countEntries(*e) : 0;
+}
+
+MemoryFileSystem::Entry* MemoryFileSystem::parentof(const std::string& path, std::string& name)
+{
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos || slash + 1 == path.size())
+    {
+        return nullptr;
+    }
+
+    name = path.substr(slash + 1);
+    Entry* parent = lookup(slash ? path.substr(0, slash) : "/");
+    return parent && parent->type == mega::FOLDERNODE ? parent : nullptr;
+}
+
+MemoryFileSystem::Entry* MemoryFileSystem::add(const std::string& path, mega::nodetype_t type)
+{
+    std::string name;
+    Entry* parent = parentof(path, name);
+    if (!parent || parent->children.count(name))
+    {
+        return nullptr;
+    }
+
+    std::unique_ptr<Entry> e{new Entry};
+    e->type = type;
+    e->fsid = mNextFsId++;
+    e->parent = parent;
+    Entry* added = e.get();
+    parent->children[name] = std::move(e);
+    return added;
+}
+
+void MemoryFileSystem::changed(const std::string& path)
+{
+    for (auto notifier : mNotifiers)
+    {
+        events += notifier->changed(path);
+    }
+}
+
+bool MemoryFileSystem::makeFolder(const std::string& path)
+{
+    if (!add(path, mega::FOLDERNODE))
+    {
+        return false;
+    }
+    changed(path);
+    return true;
+}
+
+bool MemoryFileSystem::writeFile(const std::string& path, m_off_t size, mega::m_time_t mtime, uint64_t content)
+{
+    // overwritten in place, keeping the fsid
+    Entry* e = lookup(path);
+    if (e && e->type != mega::FILENODE)
+    {
+        return false;
+    }
+    if (!e && !(e = add(path, mega::FILENODE)))
+    {
+        return false;
+    }
+
+    e->size = size;
+    e->mtime = mtime;
+    e->content = content;
+    changed(path);
+    return true;
+}
+
+bool MemoryFileSystem::move(const std::string& from, const std::string& to)
+{
+    Entry* e = lookup(from);
+    std::string name;
+    Entry* parent = parentof(to, name);
+    if (!e || e == &mRoot || !parent)
+    {
+        return false;
+    }
+
+    // not into itself
+    for (Entry* p = parent; p; p = p->parent)
+    {
+        if (p == e)
+        {
+            return false;
+        }
+    }
+
+    auto existing = parent->children.find(name);
+    if (existing != parent->children.end())
+    {
+        if (existing->second.get() == e)
+        {
+            return true;
+        }
+        if (existing->second->type != mega::FILENODE || e->type != mega::FILENODE)
+        {
+            return false;
+        }
+        parent->children.erase(existing);
+    }
+
+    Entry* oldparent = e->parent;
+    auto it = oldparent->children.find(from.substr(from.rfind('/') + 1));
+    std::unique_ptr<Entry> moved = std::move(it->second);
+    oldparent->children.erase(it);
+    moved->parent = parent;
+    parent->children[name] = std::move(moved);
+
+    changed(from);
+    changed(to);
+    return true;
+}
+
+bool MemoryFileSystem::remove(const std::string& path)
+{
+    Entry* e = lookup(path);
+    if (!e || e == &mRoot)
+    {
+        return false;
+    }
+
+    e->parent->children.erase(path.substr(path.rfind('/') + 1));
+    changed(path);
+    return true;
+}
+
+std::unique_ptr<mega::FileAccess> MemoryFileSystem::newfileaccess(bool)
+{
+    return std::unique_ptr<mega::FileAccess>{new MemoryFileAccess{*this}};
+}
+
+mega::DirAccess* MemoryFileSystem::newdiraccess()
+{
+    return new MemoryDirAccess{*this};
+}
+
+mega::DirNotify* MemoryFileSystem::newdirnotify(std::string* localpath, std::string* ignore)
+{
+    return new MemoryDirNotify{*this, localpath, ignore};
+}
+
+void MemoryFileSystem::path2local(std::string* path, std::string* local) const
+{
+    *local = *path;
+}
+
+void MemoryFileSystem::local2path(std::string* local, std::string* path) const
+{
+    *path = *local;
+}
+
+void MemoryFileSystem::tmpnamelocal(std::string* localname) const
+{
+    *localname = ".getxfer." + std::to_string(mNextTmp++) + ".mega";
+}
+
+bool MemoryFileSystem::getsname(std::string*, std::string*) const
+{
+    return false;
+}
+
+bool MemoryFileSystem::renamelocal(std::string* from, std::string* to, bool replace)
+{
+    transient_error = false;
+    target_exists = !replace && find(*to);
+    return !target_exists && move(*from, *to);
+}
+
+bool MemoryFileSystem::copylocal(std::string* from, std::string* to, mega::m_time_t mtime)
+{
+    transient_error = false;
+    const Entry* e = find(*from);
+    return e && e->type == mega::FILENODE && writeFile(*to, e->size, mtime, e->content);
+}
+
+bool MemoryFileSystem::unlinklocal(std::string* path)
+{
+    const Entry* e = find(*path);
+    return e && e->type == mega::FILENODE && remove(*path);
+}
+
+bool MemoryFileSystem::rmdirlocal(std::string* path)
+{
+    const Entry* e = find(*path);
+    return e && e->type == mega::FOLDERNODE && e->children.empty() && remove(*path);
+}
+
+bool MemoryFileSystem::mkdirlocal(std::string* path, bool)
+{
+    transient_error = false;
+    target_exists = find(*path) != nullptr;
+    return !target_exists && makeFolder(*path);
+}
+
+bool MemoryFileSystem::setmtimelocal(std::string* path, mega::m_time_t mtime)
+{
+    Entry* e = lookup(*path);
+    if (!e)
+    {
+        return false;
+    }
+    e->mtime = mtime;
+    changed(*path);
+    return true;
+}
+
+bool MemoryFileSystem::chdirlocal(std::string*) const
+{
+    return false;
+}
+
+size_t MemoryFileSystem::lastpartlocal(std::string* localname) const
+{
+    size_t slash = localname->rfind('/');
+    return slash == std::string::npos ? 0 : slash + 1;
+}
+
+bool MemoryFileSystem::getextension(std::string* localname, char* extension, size_t size) const
+{
+    size_t dot = localname->rfind('.');
+    if (dot == std::string::npos || localname->find('/', dot) != std::string::npos || localname->size() - dot >= size)
+    {
+        return false;
+    }
+
+    size_t j = 0;
+    for (size_t i = dot; i < localname->size(); i++)
+    {
+        char c = (*localname)[i];
+        if (c < '.' || c > 'z')
+        {
+            return false;
+        }
+        extension[j++] = char(c >= 'A' && c <= 'Z' ? c | ' ' : c);
+    }
+    extension[j] = 0;
+    return true;
+}
+
+bool MemoryFileSystem::expanselocalpath(std::string* path, std::string* absolutepath)
+{
+    *absolutepath = *path;
+    return true;
+}
+
+MemoryDirNotify::MemoryDirNotify(MemoryFileSystem& fs, std::string* localbasepath, std::string* ignore)
+: mega::DirNotify{localbasepath, ignore}
+, mFs{fs}
+{
+    failed = 0;
+    failreason.clear();
+    mFs.mNotifiers.insert(this);
+}
+
+MemoryDirNotify::~MemoryDirNotify()
+{
+    mFs.mNotifiers.erase(this);
+}
+
+fsfp_t MemoryDirNotify::fsfingerprint() const
+{
+    // the same volume, always
+    return 0x4d454d;
+}
+
+bool MemoryDirNotify::changed(const std::string& path)
+{
+    if (path.compare(0, localbasepath.size(), localbasepath)
+            || (path.size() > localbasepath.size() && path[localbasepath.size()] != '/'))
+    {
+        return false;
+    }
+
+    if (ignore.size())
+    {
+        std::string debris = localbasepath + "/" + ignore;
+        if (!path.compare(0, debris.size(), debris) && (path.size() == debris.size() || path[debris.size()] == '/'))
+        {
+            return false;
+        }
+    }
+
+    notify(DIREVENTS, nullptr, path.data(), path.size());
+    return true;
+}
+
+} // mt
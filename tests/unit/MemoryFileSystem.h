@@ -0,0 +1,129 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+#include <mega/filesystem.h>
+
+#include "DefaultedFileSystemAccess.h"
+
+namespace mt {
+
+class MemoryDirNotify;
+
+// A filesystem in memory that holds millions of files cheaply: a file is its size, mtime and a
+// content id from which its bytes are generated on read, so files with the same content id, size
+// and mtime have the same fingerprint.
+// Every change, made by the client or through the methods below (as a user would), is notified
+// as a full path to the DirNotify of each sync that contains it, like fsevents does.
+// Paths are absolute, with '/' separators and UTF-8 names.  Files opened for writing are not
+// supported: the client's downloads fail.  Not thread-safe (no ParallelDirScanner)
+class MemoryFileSystem : public DefaultedFileSystemAccess
+{
+public:
+    struct Entry
+    {
+        mega::nodetype_t type;
+        mega::handle fsid;
+        m_off_t size = 0;
+        mega::m_time_t mtime = 0;
+        uint64_t content = 0;
+        Entry* parent = nullptr;
+        std::map<std::string, std::unique_ptr<Entry>> children;
+    };
+
+    MemoryFileSystem();
+
+    // the changes of a user: false if the parent is missing or (except for overwriting a file) the target exists
+    bool makeFolder(const std::string& path);
+    bool writeFile(const std::string& path, m_off_t size, mega::m_time_t mtime, uint64_t content);
+    bool move(const std::string& from, const std::string& to);
+    bool remove(const std::string& path);   // files, or folders with all they hold
+
+    const Entry* find(const std::string& path) const;
+
+    // entries below the folder at path, at any depth
+    size_t count(const std::string& path) const;
+
+    // notifications delivered so far
+    unsigned long long events = 0;
+
+    std::unique_ptr<mega::FileAccess> newfileaccess(bool followSymLinks = true) override;
+    mega::DirAccess* newdiraccess() override;
+    mega::DirNotify* newdirnotify(std::string* localpath, std::string* ignore) override;
+    void path2local(std::string* path, std::string* local) const override;
+    void local2path(std::string* local, std::string* path) const override;
+    void tmpnamelocal(std::string* localname) const override;
+    bool getsname(std::string*, std::string*) const override;
+    bool renamelocal(std::string* from, std::string* to, bool replace = true) override;
+    bool copylocal(std::string* from, std::string* to, mega::m_time_t mtime) override;
+    bool unlinklocal(std::string* path) override;
+    bool rmdirlocal(std::string* path) override;
+    bool mkdirlocal(std::string* path, bool hidden = false) override;
+    bool setmtimelocal(std::string* path, mega::m_time_t mtime) override;
+    bool chdirlocal(std::string*) const override;
+    size_t lastpartlocal(std::string* localname) const override;
+    bool getextension(std::string* localname, char* extension, size_t size) const override;
+    bool expanselocalpath(std::string* path, std::string* absolutepath) override;
+    void addevents(mega::Waiter*, int) override {}
+
+    // the bytes of a file with this content id, from pos
+    static void generate(uint64_t content, m_off_t pos, mega::byte* data, unsigned len);
+
+private:
+    friend class MemoryDirNotify;
+
+    Entry mRoot;
+    mega::handle mNextFsId = 1;
+    mutable unsigned mNextTmp = 0;
+    std::set<MemoryDirNotify*> mNotifiers;
+
+    Entry* lookup(const std::string& path);
+
+    // the folder that holds path, and the last component of path
+    Entry* parentof(const std::string& path, std::string& name);
+
+    Entry* add(const std::string& path, mega::nodetype_t type);
+    void changed(const std::string& path);
+};
+
+// The notifications of a MemoryFileSystem for the sync rooted at localbasepath: never failing,
+// with stable fsids
+class MemoryDirNotify : public mega::DirNotify
+{
+public:
+    MemoryDirNotify(MemoryFileSystem& fs, std::string* localbasepath, std::string* ignore);
+    ~MemoryDirNotify();
+
+    MEGA_DISABLE_COPY_MOVE(MemoryDirNotify)
+
+    fsfp_t fsfingerprint() const override;
+
+    // queues path if it is within the sync and not in its debris folder
+    bool changed(const std::string& path);
+
+private:
+    MemoryFileSystem& mFs;
+};
+
+} // mt
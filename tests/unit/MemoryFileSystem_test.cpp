@@ -0,0 +1,431 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <mega.h>
+
+#include "ApiServer.h"
+#include "MemoryFileSystem.h"
+#include "utils.h"
+
+TEST(MemoryFileSystem, listsFoldersAndReadsGeneratedContent)
+{
+    mt::MemoryFileSystem fs;
+    ASSERT_TRUE(fs.makeFolder("/sync"));
+    ASSERT_TRUE(fs.writeFile("/sync/a", 1000, 10, 7));
+    ASSERT_TRUE(fs.writeFile("/sync/b", 1000, 10, 7));
+    ASSERT_TRUE(fs.makeFolder("/sync/c"));
+    ASSERT_FALSE(fs.makeFolder("/sync/c"));
+    ASSERT_FALSE(fs.writeFile("/missing/a", 1, 1, 1));
+    ASSERT_EQ(3u, fs.count("/sync"));
+
+    std::string path = "/sync";
+    std::unique_ptr<mega::DirAccess> da{fs.newdiraccess()};
+    ASSERT_TRUE(da->dopen(&path, nullptr, false));
+    mega::DirEntry entry;
+    std::vector<std::string> names;
+    while (da->dnextstat(&path, &entry))
+    {
+        names.push_back(entry.localname);
+    }
+    ASSERT_EQ((std::vector<std::string>{"a", "b", "c"}), names);
+
+    // the same content id, size and mtime: the same bytes and fingerprint
+    mega::FileFingerprint fp[2];
+    std::string paths[2] = {"/sync/a", "/sync/b"};
+    std::string data[2];
+    for (int i = 0; i < 2; i++)
+    {
+        auto fa = fs.newfileaccess();
+        ASSERT_TRUE(fa->fopen(&paths[i], true, false));
+        ASSERT_EQ(mega::FILENODE, fa->type);
+        ASSERT_EQ(1000, fa->size);
+        ASSERT_TRUE(fa->fread(&data[i], 1000, 0, 0));
+        ASSERT_TRUE(fp[i].genfingerprint(fa.get()));
+    }
+    ASSERT_EQ(data[0], data[1]);
+    ASSERT_TRUE(fp[0] == fp[1]);
+
+    mega::byte tail[10];
+    mt::MemoryFileSystem::generate(7, 990, tail, sizeof tail);
+    ASSERT_EQ(data[0].substr(990), std::string((const char*)tail, sizeof tail));
+}
+
+TEST(MemoryFileSystem, notifiesTheSyncsThatHoldAChange)
+{
+    mt::MemoryFileSystem fs;
+    ASSERT_TRUE(fs.makeFolder("/sync"));
+    ASSERT_TRUE(fs.makeFolder("/sync2"));
+
+    std::string root = "/sync";
+    std::string debris = ".debris";
+    std::unique_ptr<mega::DirNotify> notifier{fs.newdirnotify(&root, &debris)};
+    ASSERT_EQ(0, notifier->failed);
+
+    ASSERT_TRUE(fs.writeFile("/sync/a", 1, 1, 1));
+    const mega::handle fsid = fs.find("/sync/a")->fsid;
+    ASSERT_TRUE(fs.makeFolder("/sync/.debris"));
+    ASSERT_TRUE(fs.writeFile("/sync/.debris/a", 1, 1, 1));
+    ASSERT_TRUE(fs.writeFile("/sync2/a", 1, 1, 1));
+    ASSERT_TRUE(fs.move("/sync/a", "/sync/b"));
+    ASSERT_EQ(fsid, fs.find("/sync/b")->fsid);
+    ASSERT_FALSE(fs.move("/sync", "/sync/.debris/sync"));
+    ASSERT_TRUE(fs.remove("/sync/.debris"));
+
+    std::vector<std::string> paths;
+    for (auto& n : notifier->notifyq[mega::DirNotify::DIREVENTS])
+    {
+        ASSERT_EQ(nullptr, n.localnode);
+        paths.push_back(n.path);
+    }
+    // the second /sync/a merges with the first, as DirNotify does with repeats
+    ASSERT_EQ((std::vector<std::string>{"/sync/a", "/sync/b"}), paths);
+    ASSERT_EQ(3u, fs.events);
+}
+
+#ifdef ENABLE_SYNC
+namespace {
+
+// A client syncing a folder of a MemoryFileSystem with the API in memory, run by exec() as an app
+// would, with its state cache in a real database
+struct SyncingClient
+{
+    const mega::handle syncedFolder = 3;
+
+    mega::MegaApp app;
+    mega::WAIT_CLASS waiter;
+    mt::ApiServer server;
+    mt::MemoryFileSystem fs;
+    std::string dbpath = "./";
+    mega::SqliteDbAccess dbaccess{&dbpath};
+    mega::MegaClient client{&app, &waiter, &server, &fs, &dbaccess, nullptr, "XXX", "unit_test"};
+    mega::Sync* sync = nullptr;
+    std::string root = "/sync";
+
+    SyncingClient()
+    {
+        mega::byte masterkey[mega::SymmCipher::KEYLENGTH];
+        client.rng.genblock(masterkey, sizeof masterkey);
+        client.key.setkey(masterkey);
+        client.me = 0x4d454d4f5259;
+        client.uid = mega::Base64Str<mega::MegaClient::USERHANDLE>(client.me).chars;
+        server.uid = client.uid;
+
+        // as after fetchnodes: the root, the rubbish bin for the sync debris, and the synced folder
+        client.rootnodes[0] = 1;
+        client.rootnodes[mega::RUBBISHNODE - mega::ROOTNODE] = 2;
+        mega::Node& cloud = mt::makeNode(client, mega::ROOTNODE, 1);
+        mt::makeNode(client, mega::RUBBISHNODE, 2);
+        mt::makeNode(client, mega::FOLDERNODE, syncedFolder, &cloud);
+        client.statecurrent = true;
+
+        // overwritten files go to the debris, as the API in memory keeps no versions
+        client.versions_disabled = true;
+
+        fs.makeFolder(root);
+    }
+
+    ~SyncingClient()
+    {
+        if (sync)
+        {
+            client.delsync(sync, true);
+            delete sync;
+        }
+
+        // the state cache is on disk, where the MemoryFileSystem can't remove it
+        mega::handle tableid[3] = {fs.find(root)->fsid, syncedFolder, client.me};
+        std::string dbname = mega::Base64Str<sizeof tableid>((const mega::byte*)tableid).chars;
+        std::string dbfile = dbpath + "megaclient_statecache" + std::to_string(mega::DbAccess::DB_VERSION) + "_" + dbname + ".db";
+        for (const char* suffix : {"", "-wal", "-shm"})
+        {
+            std::remove((dbfile + suffix).c_str());
+        }
+    }
+
+    bool addsync()
+    {
+        mega::SyncConfig config{root, syncedFolder, 0};
+        if (client.addsync(std::move(config), DEBRISFOLDER, nullptr) != mega::API_OK)
+        {
+            return false;
+        }
+        sync = client.syncs.back();
+        return true;
+    }
+
+    // nothing left to do, as far as the client can tell
+    bool idle() const
+    {
+        for (auto& q : sync->dirnotify->notifyq)
+        {
+            if (!q.empty())
+            {
+                return false;
+            }
+        }
+        return sync->state == mega::SYNC_ACTIVE && client.synccreate.empty() && !client.syncadding
+                && client.localsyncnotseen.empty() && client.transfers[mega::PUT].empty()
+                && !client.reqs.cmdspending() && !client.pendingcs && !server.answering() && !server.busy()
+                && !client.syncdownrequired;
+    }
+
+    // whether the LocalNodes and the cloud nodes below l match the folder e
+    static bool matches(const mega::LocalNode& l, const mt::MemoryFileSystem::Entry& e, const std::string& ignore)
+    {
+        size_t entries = e.children.size() - (ignore.size() && e.children.count(ignore));
+        if (!l.node || l.children.size() != entries || l.node->children.size() != entries)
+        {
+            return false;
+        }
+
+        for (auto& child : l.children)
+        {
+            const mega::LocalNode& c = *child.second;
+            auto it = e.children.find(c.localname);
+            if (it == e.children.end() || it->second->type != c.type || !c.node || c.node->parent != l.node)
+            {
+                return false;
+            }
+
+            const mt::MemoryFileSystem::Entry& ce = *it->second;
+            if (c.type == mega::FILENODE)
+            {
+                if (c.size != ce.size || c.mtime != ce.mtime
+                        || !(static_cast<const mega::FileFingerprint&>(c) == static_cast<const mega::FileFingerprint&>(*c.node)))
+                {
+                    return false;
+                }
+            }
+            else if (!matches(c, ce, std::string()))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool converged() const
+    {
+        return idle() && matches(*sync->localroot, *fs.find(root), DEBRISFOLDER);
+    }
+
+    // runs the client until the sync has converged (false: not in time)
+    bool converge(std::chrono::seconds timeout)
+    {
+        if (!sync)
+        {
+            return false;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto deadline = now + timeout;
+        auto check = now;
+        for (;;)
+        {
+            mega::Waiter::bumpds();
+            client.exec();
+
+            now = std::chrono::steady_clock::now();
+            if (now >= check && idle())
+            {
+                // walking the trees is slow, for large ones
+                if (converged())
+                {
+                    return true;
+                }
+                check = now + std::chrono::milliseconds(100);
+            }
+            if (now > deadline)
+            {
+                return false;
+            }
+            if (!server.busy())
+            {
+                // waiting on the delays of the sync engine, or the latency of the API
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        }
+    }
+};
+
+} // anonymous
+
+TEST(MemoryFileSystem, syncConvergesOnASmallTree)
+{
+    SyncingClient c;
+    ASSERT_TRUE(c.fs.makeFolder("/sync/d"));
+    for (int i = 0; i < 20; i++)
+    {
+        // five distinct files, each four times
+        ASSERT_TRUE(c.fs.writeFile("/sync/" + std::string(i % 2 ? "d/" : "") + "f" + std::to_string(i), 100 + i % 5, 1000 + i % 5, uint64_t(i % 5)));
+    }
+
+    ASSERT_TRUE(c.addsync());
+    ASSERT_TRUE(c.converge(std::chrono::seconds(60)));
+    ASSERT_EQ(5u, c.server.commands["u"]);
+    ASSERT_EQ(21u, c.server.nodesCreated);
+
+    // a rename, a move, an overwrite with a new content and a deletion
+    ASSERT_TRUE(c.fs.move("/sync/f0", "/sync/g0"));
+    ASSERT_TRUE(c.fs.move("/sync/f2", "/sync/d/f2"));
+    ASSERT_TRUE(c.fs.writeFile("/sync/f4", 200, 2000, 99));
+    ASSERT_TRUE(c.fs.remove("/sync/d/f1"));
+    ASSERT_TRUE(c.converge(std::chrono::seconds(60)));
+    ASSERT_EQ(6u, c.server.commands["u"]);
+    ASSERT_EQ(20u, c.fs.count("/sync"));
+}
+
+// The sync engine against a synthetic tree (16 files a folder, 16 folders a folder, in
+// MEGA_SYNC_BENCHMARK_FILES files, 20000 by default) made of a pool of 64 contents, so most
+// files are copies of others in the cloud: the initial scan and upload, then bursts of user
+// changes to a tenth of the files each (overwrites, renames, moves, creations and deletions),
+// each run until the local, state cache and cloud trees agree again.
+// Reports the notifications a second, the time to converge and the CPU seconds per thousand
+// notifications of each phase, and the state cache writes. The times include the delays of the
+// sync engine (SCANNING_DELAY_DS and the upload nagle), which bound them from below
+TEST(MemoryFileSystem, DISABLED_sync_benchmark)
+{
+    const char* env = getenv("MEGA_SYNC_BENCHMARK_FILES");
+    const int files = env ? std::max(atoi(env), 16) : 20000;
+    const int fanout = 16;
+    const uint64_t pool = 64;
+    auto sizeOf = [](uint64_t content) { return m_off_t(1 + content * 7919 % 65536); };
+    auto mtimeof = [](uint64_t content) { return mega::m_time_t(1600000000 + content); };
+
+    SyncingClient c;
+    c.server.latencyMs = 20;
+
+    std::vector<std::string> folders{c.root};
+    std::vector<std::string> live;
+    for (int i = 0; i < files; i++)
+    {
+        size_t folder = size_t(i / fanout);
+        while (folder >= folders.size())
+        {
+            std::string path = folders[(folders.size() - 1) / fanout] + "/d" + std::to_string(folders.size());
+            ASSERT_TRUE(c.fs.makeFolder(path));
+            folders.push_back(path);
+        }
+        uint64_t content = uint64_t(i) % pool;
+        live.push_back(folders[folder] + "/f" + std::to_string(i));
+        ASSERT_TRUE(c.fs.writeFile(live.back(), sizeOf(content), mtimeof(content), content));
+    }
+
+    auto phase = [&c](const std::string& name, const std::function<void()>& changes)
+    {
+        unsigned long long events = c.fs.events;
+        mega::Sync::StateCacheStats before = c.sync ? c.sync->statecachestats : mega::Sync::StateCacheStats();
+        double cpu = mt::cpuSeconds();
+        bool ok = false;
+        double ms = mt::elapsedMs([&]()
+        {
+            changes();
+            ok = c.converge(std::chrono::minutes(10));
+        });
+        cpu = mt::cpuSeconds() - cpu;
+        ASSERT_TRUE(ok) << name;
+
+        // the initial scan notifies nothing: it counts the entries found instead
+        events = c.fs.events - events;
+        if (!events)
+        {
+            events = c.fs.count(c.root);
+        }
+        const mega::Sync::StateCacheStats& after = c.sync->statecachestats;
+        double perSecond = events / (ms / 1000);
+        double cpuPerThousand = cpu / (events / 1000.0);
+        mt::recordBenchmark(name + "_events", double(events));
+        mt::recordBenchmark(name + "_events_s", perSecond);
+        mt::recordBenchmark(name + "_converge_ms", ms);
+        mt::recordBenchmark(name + "_cpu_s_per_1000_events", cpuPerThousand);
+        mt::recordBenchmark(name + "_statecache_written", double(after.written - before.written));
+        mt::recordBenchmark(name + "_statecache_flush_ms", double(after.flushms - before.flushms));
+        mt::recordBenchmark(name + "_rss_kb", double(mt::residentMemoryKB()));
+    };
+
+    phase("initial", [&c]()
+    {
+        ASSERT_TRUE(c.addsync());
+    });
+
+    std::mt19937 rng(1);
+    int next = files;
+    for (int burst = 0; burst < 5; burst++)
+    {
+        phase("burst" + std::to_string(burst), [&]()
+        {
+            for (int i = files / 10; i--; )
+            {
+                size_t k = rng() % live.size();
+                std::string& path = live[k];
+                std::string folder = folders[rng() % folders.size()];
+                unsigned kind = rng() % 20;
+                if (kind < 10)
+                {
+                    // an overwrite, with a content the cloud has (or will have) already
+                    uint64_t content = rng() % pool;
+                    c.fs.writeFile(path, sizeOf(content), mtimeof(content), content);
+                }
+                else if (kind < 14)
+                {
+                    // a rename, in place
+                    std::string to = path.substr(0, path.rfind('/')) + "/r" + std::to_string(next++);
+                    if (c.fs.move(path, to))
+                    {
+                        path = to;
+                    }
+                }
+                else if (kind < 17)
+                {
+                    std::string to = folder + "/m" + std::to_string(next++);
+                    if (c.fs.move(path, to))
+                    {
+                        path = to;
+                    }
+                }
+                else if (kind < 19)
+                {
+                    uint64_t content = rng() % pool;
+                    live.push_back(folder + "/n" + std::to_string(next++));
+                    c.fs.writeFile(live.back(), sizeOf(content), mtimeof(content), content);
+                }
+                else if (live.size() > 1)
+                {
+                    c.fs.remove(path);
+                    path = live.back();
+                    live.pop_back();
+                }
+            }
+        });
+    }
+
+    mt::recordBenchmark("api_batches", double(c.server.batches));
+    mt::recordBenchmark("api_nodes_created", double(c.server.nodesCreated));
+    mt::recordBenchmark("api_uploads", double(c.server.commands["u"]));
+}
+#endif
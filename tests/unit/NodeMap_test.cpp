@@ -0,0 +1,159 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include <mega/types.h>
+
+#include "utils.h"
+
+namespace {
+
+// node handles are 48 bits wide
+std::vector<mega::handle> randomHandles(size_t count, unsigned seed)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<mega::handle> handles(count);
+    for (auto& h : handles)
+    {
+        h = rng() & 0xFFFFFFFFFFFFull;
+    }
+    return handles;
+}
+
+template<typename F>
+double elapsedMs(F&& f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+TEST(NodeMap, insert_find_erase)
+{
+    mega::handle_hashmap<int> map;
+    ASSERT_TRUE(map.empty());
+    ASSERT_EQ(map.end(), map.find(1));
+    ASSERT_EQ(map.end(), map.find(mega::UNDEF));
+
+    map[1] = 10;
+    map[2] = 20;
+    ASSERT_TRUE(map.insert(std::make_pair(mega::handle(3), 30)).second);
+    ASSERT_FALSE(map.insert(std::make_pair(mega::handle(3), 31)).second);
+
+    ASSERT_EQ(3u, map.size());
+    ASSERT_EQ(10, map.find(1)->second);
+    ASSERT_EQ(30, map.find(3)->second);
+    ASSERT_EQ(mega::handle(2), map.find(2)->first);
+    ASSERT_EQ(map.end(), map.find(mega::UNDEF));
+
+    ASSERT_EQ(1u, map.erase(2));
+    ASSERT_EQ(0u, map.erase(2));
+    ASSERT_EQ(map.end(), map.find(2));
+    ASSERT_EQ(2u, map.size());
+
+    map.clear();
+    ASSERT_TRUE(map.empty());
+    ASSERT_EQ(map.begin(), map.end());
+    ASSERT_EQ(map.end(), map.find(1));
+}
+
+TEST(NodeMap, matches_std_map_under_random_operations)
+{
+    mega::handle_hashmap<size_t> map;
+    std::map<mega::handle, size_t> reference;
+
+    // a small key space forces long probe runs, wrap-around and backward shifts on erase
+    std::mt19937 rng(42);
+    for (size_t i = 0; i < 100000; ++i)
+    {
+        mega::handle h = rng() % 2000;
+        if (rng() % 3)
+        {
+            map[h] = i;
+            reference[h] = i;
+        }
+        else
+        {
+            ASSERT_EQ(reference.erase(h), map.erase(h));
+        }
+    }
+
+    ASSERT_EQ(reference.size(), map.size());
+
+    for (const auto& r : reference)
+    {
+        auto it = map.find(r.first);
+        ASSERT_NE(map.end(), it);
+        ASSERT_EQ(r.second, it->second);
+    }
+
+    size_t iterated = 0;
+    for (mega::handle_hashmap<size_t>::const_iterator it = map.begin(); it != map.end(); ++it)
+    {
+        ASSERT_EQ(1u, reference.count(it->first));
+        ++iterated;
+    }
+    ASSERT_EQ(reference.size(), iterated);
+}
+
+TEST(NodeMap, reserve_avoids_rehash)
+{
+    mega::handle_hashmap<int> map;
+    map.reserve(1000);
+    size_t capacity = map.capacity();
+    ASSERT_GE(capacity * 3, 1000u * 4);
+
+    for (auto h : randomHandles(1000, 1))
+    {
+        map[h] = 1;
+    }
+    ASSERT_EQ(capacity, map.capacity());
+}
+
+TEST(NodeMap, DISABLED_againstStdMap_benchmark)
+{
+    const size_t count = 500000;
+    auto handles = randomHandles(count, 7);
+    auto lookups = handles;
+    std::shuffle(lookups.begin(), lookups.end(), std::mt19937(3));
+
+    std::map<mega::handle, mega::Node*> stdmap;
+    mega::node_map nodemap;
+    size_t stdfound = 0, found = 0;
+
+    double stdinsert = elapsedMs([&]() { for (auto h : handles) stdmap[h] = nullptr; });
+    double insert = elapsedMs([&]() { for (auto h : handles) nodemap[h] = nullptr; });
+    double stdfind = elapsedMs([&]() { for (auto h : lookups) stdfound += stdmap.find(h) != stdmap.end(); });
+    double find = elapsedMs([&]() { for (auto h : lookups) found += nodemap.find(h) != nodemap.end(); });
+
+    ASSERT_EQ(stdmap.size(), nodemap.size());
+    ASSERT_EQ(stdfound, found);
+
+    mt::recordBenchmark("std_map_insert_ms", stdinsert);
+    mt::recordBenchmark("node_map_insert_ms", insert);
+    mt::recordBenchmark("std_map_lookup_ms", stdfind);
+    mt::recordBenchmark("node_map_lookup_ms", find);
+
+}
@@ -0,0 +1,843 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <numeric>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include <mega.h>
+
+#include "DefaultedDbTable.h"
+#include "DefaultedFileSystemAccess.h"
+#include "utils.h"
+
+namespace {
+
+struct MockClient
+{
+    mega::MegaApp app;
+    mt::DefaultedFileSystemAccess fs;
+    std::shared_ptr<mega::MegaClient> cli = mt::makeClient(app, fs);
+};
+
+// a tree of file nodes as fetchnodes leaves it: keys wrapped with the master key, or with the key of
+// the share folder they are in, and encrypted attributes - identical for the same seed
+void addEncryptedNodes(mega::MegaClient& client, size_t count, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    auto randomBytes = [&rng](size_t n)
+    {
+        std::string s(n, 0);
+        for (auto& c : s) c = char(rng());
+        return s;
+    };
+
+    client.key.setkey((const mega::byte*)randomBytes(mega::SymmCipher::KEYLENGTH).data());
+
+    mega::node_vector dp;
+    const mega::handle sharehandle = 1;
+    auto share = new mega::Node(&client, &dp, sharehandle, mega::UNDEF, mega::FOLDERNODE, -1, mega::UNDEF, nullptr, 0);
+    share->sharekey = new mega::SymmCipher((const mega::byte*)randomBytes(mega::SymmCipher::KEYLENGTH).data());
+
+    for (size_t i = 0; i < count; i++)
+    {
+        mega::handle h = sharehandle + 1 + i;
+        auto n = new mega::Node(&client, &dp, h, sharehandle, mega::FILENODE, 100, mega::UNDEF, nullptr, 0);
+
+        std::string key = randomBytes(mega::FILENODEKEYLENGTH);
+        std::string encryptedkey = key;
+        bool inshare = i % 4 == 0;
+        (inshare ? share->sharekey : &client.key)->ecb_encrypt((mega::byte*)encryptedkey.data(), nullptr, encryptedkey.size());
+
+        std::string keyjson = mega::Base64::btoa(encryptedkey);
+        if (inshare)
+        {
+            keyjson = std::string(mega::Base64Str<mega::MegaClient::NODEHANDLE>(sharehandle)) + ":" + keyjson;
+        }
+        n->setkeyfromjson(keyjson.c_str());
+
+        mega::SymmCipher nodecipher;
+        nodecipher.setkey(&key);
+        std::string attrs = "\"n\":\"file" + std::to_string(i) + "\"";
+        std::string encryptedattrs;
+        client.makeattr(&nodecipher, &encryptedattrs, attrs.c_str());
+        n->attrstring.reset(new std::string(mega::Base64::btoa(encryptedattrs)));
+    }
+}
+
+// a state cache kept in memory, surviving the clients that use it
+struct MemoryDbStore
+{
+    std::map<uint32_t, std::string> records;
+    std::string snapshot;
+    bool hasSnapshot = false;
+};
+
+class MemoryDbTable : public mt::DefaultedDbTable
+{
+public:
+    MemoryDbTable(mega::PrnGen& rng, MemoryDbStore& store)
+        : mt::DefaultedDbTable(rng, false)
+        , mStore(store)
+    {
+    }
+
+    void rewind() override
+    {
+        mIt = mStore.records.begin();
+    }
+    bool next(uint32_t* id, std::string* data) override
+    {
+        if (mIt == mStore.records.end())
+        {
+            return false;
+        }
+        *id = mIt->first;
+        *data = mIt->second;
+        ++mIt;
+        return true;
+    }
+    bool get(uint32_t id, std::string* data) override
+    {
+        auto it = mStore.records.find(id);
+        if (it == mStore.records.end())
+        {
+            return false;
+        }
+        *data = it->second;
+        return true;
+    }
+    bool put(uint32_t id, char* data, unsigned len) override
+    {
+        mStore.records[id].assign(data, len);
+        return true;
+    }
+    bool del(uint32_t id) override
+    {
+        mStore.records.erase(id);
+        return true;
+    }
+    void truncate() override
+    {
+        mStore.records.clear();
+        delsnapshot();
+    }
+    void begin() override {}
+    void commit() override {}
+    void abort() override {}
+    bool putsnapshot(const std::string& data) override
+    {
+        mStore.snapshot = data;
+        mStore.hasSnapshot = true;
+        return true;
+    }
+    bool getsnapshot(std::string* data) override
+    {
+        *data = mStore.snapshot;
+        return mStore.hasSnapshot;
+    }
+    void delsnapshot() override
+    {
+        mStore.snapshot.clear();
+        mStore.hasSnapshot = false;
+    }
+
+    using mega::DbTable::next;
+
+private:
+    MemoryDbStore& mStore;
+    std::map<uint32_t, std::string>::iterator mIt;
+};
+
+// a small tree written to the state cache the way initsc() does after fetchnodes
+void writeStateCache(mega::MegaClient& client, MemoryDbStore& store, bool snapshot)
+{
+    client.key.setkey((const mega::byte*)std::string(mega::SymmCipher::KEYLENGTH, 'K').data());
+    auto& root = mt::makeNode(client, mega::FOLDERNODE, 1);
+    for (mega::handle h = 2; h < 50; h++)
+    {
+        mt::makeNode(client, h % 5 ? mega::FILENODE : mega::FOLDERNODE, h, &root);
+    }
+
+    client.setnodesnapshot(snapshot);
+    client.sctable = new MemoryDbTable(client.rng, store);
+    client.initsc();
+}
+
+void expectSameNodes(mega::MegaClient& expected, mega::MegaClient& actual)
+{
+    ASSERT_EQ(expected.nodes.size(), actual.nodes.size());
+    for (auto& it : expected.nodes)
+    {
+        mega::Node* n = actual.nodebyhandle(it.first);
+        ASSERT_NE(nullptr, n);
+        ASSERT_EQ(it.second->type, n->type);
+        ASSERT_EQ(it.second->dbid, n->dbid);
+        ASSERT_EQ(it.second->nodekey(), n->nodekey());
+        ASSERT_EQ(it.second->parent ? it.second->parent->nodehandle : mega::UNDEF, n->parent ? n->parent->nodehandle : mega::UNDEF);
+    }
+}
+
+}
+
+TEST(Node, fetchscFromSnapshotSkipsNodeRecords)
+{
+    MemoryDbStore store;
+    MockClient writer;
+    writeStateCache(*writer.cli, store, true);
+    ASSERT_TRUE(store.hasSnapshot);
+
+    // node records that can't be decrypted are not even looked at when the snapshot is current
+    for (auto& r : store.records)
+    {
+        if ((r.first & 15) == mega::MegaClient::CACHEDNODE)
+        {
+            r.second = "garbage";
+        }
+    }
+
+    MockClient reader;
+    reader.cli->key = writer.cli->key;
+    reader.cli->setnodesnapshot(true);
+    MemoryDbTable table(reader.cli->rng, store);
+    ASSERT_TRUE(reader.cli->fetchsc(&table));
+    expectSameNodes(*writer.cli, *reader.cli);
+    ASSERT_TRUE(reader.cli->nodesnapshotcurrent);
+
+    // whereas reading the records stops at the first one
+    MockClient recordsOnly;
+    recordsOnly.cli->key = writer.cli->key;
+    MemoryDbTable table2(recordsOnly.cli->rng, store);
+    recordsOnly.cli->fetchsc(&table2);
+    ASSERT_TRUE(recordsOnly.cli->nodes.empty());
+}
+
+TEST(Node, fetchscIgnoresStaleSnapshot)
+{
+    MemoryDbStore store;
+    MockClient writer;
+    writeStateCache(*writer.cli, store, true);
+    ASSERT_TRUE(store.hasSnapshot);
+
+    // a node added after the snapshot was written only goes to the records
+    mega::Node& added = mt::makeNode(*writer.cli, mega::FILENODE, 100, writer.cli->nodebyhandle(1));
+    writer.cli->nodenotify.push_back(&added);
+    writer.cli->updatesc();
+    writer.cli->nodenotify.clear();
+    ASSERT_FALSE(writer.cli->nodesnapshotcurrent);
+
+    MockClient reader;
+    reader.cli->key = writer.cli->key;
+    reader.cli->setnodesnapshot(true);
+    MemoryDbTable table(reader.cli->rng, store);
+    ASSERT_TRUE(reader.cli->fetchsc(&table));
+    expectSameNodes(*writer.cli, *reader.cli);
+    ASSERT_FALSE(reader.cli->nodesnapshotcurrent);
+}
+
+namespace {
+
+// the counters as a walk of the subtree finds them
+mega::NodeCounter walkCounts(const mega::Node& n)
+{
+    mega::NodeCounter nc;
+    for (const mega::Node* child : n.children)
+    {
+        nc += walkCounts(*child);
+    }
+    if (n.type == mega::FILENODE)
+    {
+        nc.files += 1;
+        nc.storage += n.size;
+        if (n.parent && n.parent->type == mega::FILENODE)
+        {
+            nc.versions += 1;
+            nc.versionStorage += n.size;
+        }
+    }
+    else if (n.type == mega::FOLDERNODE)
+    {
+        nc.folders += 1;
+    }
+    return nc;
+}
+
+void expectCountsMatchWalk(mega::MegaClient& client)
+{
+    for (auto& it : client.nodes)
+    {
+        mega::NodeCounter expected = walkCounts(*it.second);
+        mega::NodeCounter actual = it.second->subnodeCounts();
+        ASSERT_EQ(expected.files, actual.files) << it.first;
+        ASSERT_EQ(expected.folders, actual.folders) << it.first;
+        ASSERT_EQ(expected.storage, actual.storage) << it.first;
+        ASSERT_EQ(expected.versions, actual.versions) << it.first;
+        ASSERT_EQ(expected.versionStorage, actual.versionStorage) << it.first;
+    }
+    for (mega::handle root : client.rootnodes)
+    {
+        mega::Node* n = root == mega::UNDEF ? nullptr : client.nodebyhandle(root);
+        if (n)
+        {
+            ASSERT_EQ(walkCounts(*n).files, client.mNodeCounters[root].files);
+            ASSERT_EQ(walkCounts(*n).storage, client.mNodeCounters[root].storage);
+            ASSERT_EQ(walkCounts(*n).versions, client.mNodeCounters[root].versions);
+        }
+    }
+}
+
+}
+
+TEST(Node, subnodeCountsFollowMovesSizesAndDeletions)
+{
+    MockClient client;
+    auto& cloud = mt::makeNode(*client.cli, mega::ROOTNODE, 1);
+    auto& rubbish = mt::makeNode(*client.cli, mega::RUBBISHNODE, 2);
+    auto& a = mt::makeNode(*client.cli, mega::FOLDERNODE, 3, &cloud);
+    auto& b = mt::makeNode(*client.cli, mega::FOLDERNODE, 4, &a);
+    for (mega::handle h = 10; h < 20; h++)
+    {
+        mt::makeNode(*client.cli, mega::FILENODE, h, h % 2 ? &a : &b).setsize(h);
+    }
+    auto& version = mt::makeNode(*client.cli, mega::FILENODE, 30, client.cli->nodebyhandle(10));
+    version.setsize(1000);
+    expectCountsMatchWalk(*client.cli);
+    ASSERT_EQ(1u, cloud.subnodeCounts().versions);
+
+    // a folder into the rubbish bin, and back under another folder
+    b.setparent(&rubbish);
+    expectCountsMatchWalk(*client.cli);
+    ASSERT_EQ(6u, rubbish.subnodeCounts().files);
+    b.setparent(client.cli->nodebyhandle(3));
+    expectCountsMatchWalk(*client.cli);
+
+    // a version that becomes a file of its own
+    version.setparent(&b);
+    expectCountsMatchWalk(*client.cli);
+    ASSERT_EQ(0u, cloud.subnodeCounts().versions);
+
+    version.setsize(7);
+    delete client.cli->nodebyhandle(11);
+    client.cli->nodes.erase(11);
+    expectCountsMatchWalk(*client.cli);
+    ASSERT_EQ(2u, cloud.subnodeCounts().folders);
+}
+
+TEST(Node, childrenseqChangesWithChildrenOnly)
+{
+    MockClient client;
+    auto& cloud = mt::makeNode(*client.cli, mega::ROOTNODE, 1);
+    auto& a = mt::makeNode(*client.cli, mega::FOLDERNODE, 2, &cloud);
+    auto& b = mt::makeNode(*client.cli, mega::FOLDERNODE, 3, &cloud);
+    auto& f = mt::makeNode(*client.cli, mega::FILENODE, 4, &a);
+
+    uint64_t seqa = a.childrenseq, seqb = b.childrenseq, seqcloud = cloud.childrenseq;
+    ASSERT_NE(seqa, seqb);
+
+    // a move changes both folders
+    f.setparent(&b);
+    ASSERT_NE(seqa, a.childrenseq);
+    ASSERT_NE(seqb, b.childrenseq);
+    ASSERT_EQ(seqcloud, cloud.childrenseq);
+
+    // an attribute change of a child, and its deletion
+    seqb = b.childrenseq;
+    client.cli->notifynode(&f);
+    ASSERT_NE(seqb, b.childrenseq);
+    client.cli->nodenotify.clear();
+    f.notified = false;
+
+    seqb = b.childrenseq;
+    delete &f;
+    client.cli->nodes.erase(4);
+    ASSERT_NE(seqb, b.childrenseq);
+    ASSERT_EQ(seqcloud, cloud.childrenseq);
+}
+
+TEST(Node, applykeysParallelMatchesSerial)
+{
+    const size_t count = 4 * mega::MegaClient::KEYAPPLY_MAXTHREADS * mega::MegaClient::KEYAPPLY_MINSHARD;
+
+    MockClient parallel, serial;
+    addEncryptedNodes(*parallel.cli, count, 9);
+    addEncryptedNodes(*serial.cli, count, 9);
+
+    parallel.cli->applykeys();
+    for (auto& it : serial.cli->nodes)
+    {
+        it.second->applykey();
+    }
+
+    ASSERT_EQ(serial.cli->mAppliedKeyNodeCount, parallel.cli->mAppliedKeyNodeCount);
+    ASSERT_EQ(static_cast<long long>(count), parallel.cli->mAppliedKeyNodeCount);
+
+    for (auto& it : serial.cli->nodes)
+    {
+        mega::Node* n = parallel.cli->nodebyhandle(it.first);
+        ASSERT_NE(nullptr, n);
+        ASSERT_EQ(it.second->nodekeyUnchecked(), n->nodekeyUnchecked());
+        ASSERT_EQ(it.second->foreignkey, n->foreignkey);
+        ASSERT_STREQ(it.second->displayname(), n->displayname());
+        ASSERT_EQ(it.second->isvalid, n->isvalid);
+    }
+}
+
+TEST(Node, applykeysDecryptsRsaKeysInRounds)
+{
+    const size_t count = 3 * mega::MegaClient::RSAKEY_SHARD + 5;
+
+    MockClient client;
+    mega::AsymmCipher pubk;
+    client.cli->asymkey.genkeypair(client.cli->rng, client.cli->asymkey.key, pubk.key, 1024);
+
+    std::mt19937 rng(5);
+    std::map<mega::handle, std::string> keys;
+    mega::node_vector dp;
+    for (size_t i = 0; i < count; i++)
+    {
+        mega::handle h = i + 1;
+        auto n = new mega::Node(client.cli.get(), &dp, h, mega::UNDEF, mega::FILENODE, 100, mega::UNDEF, nullptr, 0);
+
+        std::string key(mega::FILENODEKEYLENGTH, 0);
+        for (auto& c : key) c = char(rng());
+        keys[h] = key;
+
+        // as a key sent to us encrypted to our public key
+        mega::byte buf[512];
+        int l = pubk.encrypt(client.cli->rng, (const mega::byte*)key.data(), key.size(), buf, sizeof buf);
+        ASSERT_GT(l, 0);
+        n->setkeyfromjson(mega::Base64::btoa(std::string((const char*)buf, size_t(l))).c_str());
+
+        mega::SymmCipher nodecipher;
+        nodecipher.setkey(&key);
+        std::string attrs = "\"n\":\"file" + std::to_string(i) + "\"";
+        std::string encryptedattrs;
+        client.cli->makeattr(&nodecipher, &encryptedattrs, attrs.c_str());
+        n->attrstring.reset(new std::string(mega::Base64::btoa(encryptedattrs)));
+    }
+
+    // whatever one call leaves pending, later ones finish
+    client.cli->applykeys();
+    while (!client.cli->rsakeypending.empty())
+    {
+        client.cli->applyrsakeys(true);
+    }
+
+    ASSERT_EQ(static_cast<long long>(count), client.cli->mAppliedKeyNodeCount);
+    ASSERT_EQ(count, client.cli->nodekeyrewrite.size());
+    for (auto& it : keys)
+    {
+        mega::Node* n = client.cli->nodebyhandle(it.first);
+        ASSERT_NE(nullptr, n);
+        ASSERT_TRUE(n->keyApplied());
+        ASSERT_EQ(it.second, n->nodekeyUnchecked());
+        ASSERT_EQ("file" + std::to_string(it.first - 1), std::string(n->displayname()));
+    }
+}
+
+TEST(Node, attributesAreImportedOnFirstUse)
+{
+    MockClient client;
+    client.cli->key.setkey((const mega::byte*)std::string(mega::SymmCipher::KEYLENGTH, 'K').data());
+
+    mega::FileFingerprint ffp;
+    ffp.size = 100;
+    ffp.mtime = 1600000000;
+    std::iota(ffp.crc.begin(), ffp.crc.end(), 1);
+    ffp.isvalid = true;
+    std::string fingerprint;
+    ffp.serializefingerprint(&fingerprint);
+
+    mega::node_vector dp;
+    auto n = new mega::Node(client.cli.get(), &dp, 2, mega::UNDEF, mega::FILENODE, 100, mega::UNDEF, nullptr, 0);
+    std::string key(mega::FILENODEKEYLENGTH, 'k');
+    std::string encryptedkey = key;
+    client.cli->key.ecb_encrypt((mega::byte*)encryptedkey.data(), nullptr, encryptedkey.size());
+    n->setkeyfromjson(mega::Base64::btoa(encryptedkey).c_str());
+
+    mega::SymmCipher nodecipher;
+    nodecipher.setkey(&key);
+    std::string attrs = "\"n\":\"file\",\"c\":\"" + fingerprint + "\",\"e\":{\"s\":1}";
+    std::string encryptedattrs;
+    client.cli->makeattr(&nodecipher, &encryptedattrs, attrs.c_str());
+    n->attrstring.reset(new std::string(mega::Base64::btoa(encryptedattrs)));
+
+    // decrypted and fingerprinted, but not imported
+    n->applykey();
+    ASSERT_EQ(nullptr, n->attrstring);
+    ASSERT_TRUE(n->attrspending());
+    ASSERT_TRUE(n->isvalid);
+    ASSERT_TRUE(static_cast<const mega::FileFingerprint&>(*n) == ffp);
+    std::string value;
+    ASSERT_TRUE(n->getattr('e', &value));
+    ASSERT_EQ("{\"s\":1}", value);
+    ASSERT_FALSE(n->getattr('x', &value));
+
+    // the state cache keeps them as they are
+    std::string data;
+    ASSERT_TRUE(n->serialize(&data));
+    MockClient other;
+    mega::node_vector dp2;
+    mega::Node* copy = mega::Node::unserialize(other.cli.get(), &data, &dp2);
+    ASSERT_NE(nullptr, copy);
+    ASSERT_TRUE(copy->attrspending());
+    ASSERT_TRUE(static_cast<const mega::FileFingerprint&>(*copy) == ffp);
+
+    std::string again;
+    ASSERT_TRUE(copy->serialize(&again));
+    ASSERT_EQ(data, again);
+
+    // the first use imports them
+    ASSERT_STREQ("file", n->displayname());
+    ASSERT_FALSE(n->attrspending());
+    ASSERT_EQ(3u, n->attrs().map.size());
+    ASSERT_EQ(fingerprint, n->attrs().map['c']);
+
+    // as does a search, all at once
+    other.cli->importattrs();
+    ASSERT_FALSE(copy->attrspending());
+    ASSERT_EQ(n->attrs().map, copy->attrs().map);
+
+    // and serialize in the same format
+    std::string imported;
+    ASSERT_TRUE(copy->serialize(&imported));
+    MockClient third;
+    mega::node_vector dp3;
+    mega::Node* reloaded = mega::Node::unserialize(third.cli.get(), &imported, &dp3);
+    ASSERT_NE(nullptr, reloaded);
+    ASSERT_EQ(n->attrs().map, reloaded->attrs().map);
+}
+
+TEST(Node, folderLinkSubtreeSkipsTheRestOfTheLink)
+{
+    MockClient mc;
+    auto b64 = [](mega::handle h) { return std::string(mega::Base64Str<mega::MegaClient::NODEHANDLE>(h).chars); };
+
+    // /A: B, D / B: C, f / C: g
+    const mega::handle A = 10, B = 11, C = 12, D = 13, f = 14, g = 15;
+    std::string key(mega::FOLDERNODEKEYLENGTH, '\1');
+    std::string link = "https://mega.nz/folder/" + b64(A) + "#" + mega::Base64::btoa(key);
+    ASSERT_EQ(mc.cli->folderaccess(link.c_str(), B), mega::API_OK);
+
+    auto node = [&](mega::handle h, mega::handle p, int t)
+    {
+        return "{\"h\":\"" + b64(h) + "\",\"p\":\"" + b64(p) + "\",\"u\":\"AAAAAAAAAAA\",\"t\":" + std::to_string(t)
+                + ",\"a\":\"xx\",\"k\":\"AAAAAAAAAAA:xx\",\"ts\":1" + (t == mega::FILENODE ? ",\"s\":1}" : "}");
+    };
+    std::string nodes = "[" + node(A, 1, mega::FOLDERNODE) + "," + node(B, A, mega::FOLDERNODE) + ","
+            + node(D, A, mega::FOLDERNODE) + "," + node(C, B, mega::FOLDERNODE) + ","
+            + node(f, B, mega::FILENODE) + "," + node(g, C, mega::FILENODE) + "]";
+
+    mega::JSON j;
+    j.begin(nodes.c_str());
+    ASSERT_TRUE(mc.cli->readnodes(&j, 0));
+
+    ASSERT_EQ(mc.cli->nodes.size(), 4u);
+    ASSERT_FALSE(mc.cli->nodebyhandle(A));
+    ASSERT_FALSE(mc.cli->nodebyhandle(D));
+    ASSERT_EQ(mc.cli->rootnodes[0], B);
+    ASSERT_EQ(mc.cli->nodebyhandle(g)->parent->parent, mc.cli->nodebyhandle(B));
+}
+
+TEST(Node, nodeScopeKeepsTheFoldersAskedAndTheWayToThem)
+{
+    MockClient mc;
+    auto b64 = [](mega::handle h) { return std::string(mega::Base64Str<mega::MegaClient::NODEHANDLE>(h).chars); };
+    auto node = [&](mega::handle h, mega::handle p, int t)
+    {
+        return "{\"h\":\"" + b64(h) + "\",\"p\":\"" + b64(p) + "\",\"u\":\"AAAAAAAAAAA\",\"t\":" + std::to_string(t)
+                + ",\"a\":\"xx\",\"k\":\"AAAAAAAAAAA:xx\",\"ts\":1" + (t == mega::FILENODE ? ",\"s\":1}" : "}");
+    };
+    auto read = [&](const std::string& nodes)
+    {
+        mega::JSON j;
+        j.begin(nodes.c_str());
+        return mc.cli->readnodes(&j, 0);
+    };
+
+    // /cloud: A, x / A: B, D / B: C, f / C: g / D: y
+    const mega::handle cloud = 1, A = 10, B = 11, C = 12, D = 13, f = 14, g = 15, x = 16, y = 17;
+    mt::makeNode(*mc.cli, mega::ROOTNODE, cloud);
+    mc.cli->nodescope.insert(B);
+
+    mc.cli->fetchingnodes = true;
+    ASSERT_TRUE(read("[" + node(A, cloud, mega::FOLDERNODE) + "," + node(x, cloud, mega::FILENODE) + ","
+                     + node(B, A, mega::FOLDERNODE) + "," + node(D, A, mega::FOLDERNODE) + ","
+                     + node(C, B, mega::FOLDERNODE) + "," + node(f, B, mega::FILENODE) + ","
+                     + node(g, C, mega::FILENODE) + "," + node(y, D, mega::FILENODE) + "]"));
+
+    // files out of the scope are dropped as they are read, folders at the end
+    ASSERT_FALSE(mc.cli->nodebyhandle(x));
+    ASSERT_FALSE(mc.cli->nodebyhandle(y));
+    ASSERT_TRUE(mc.cli->nodebyhandle(D));
+    mc.cli->prunenodescope();
+    mc.cli->fetchingnodes = false;
+
+    ASSERT_EQ(mc.cli->nodes.size(), 6u);
+    ASSERT_FALSE(mc.cli->nodebyhandle(D));
+    ASSERT_EQ(mc.cli->nodebyhandle(g)->parent->parent->parent->parent, mc.cli->nodebyhandle(cloud));
+    expectCountsMatchWalk(*mc.cli);
+
+    // later changes out of the scope are skipped too
+    const mega::handle h = 20, i = 21, k = 22;
+    ASSERT_TRUE(read("[" + node(h, C, mega::FILENODE) + "," + node(i, A, mega::FILENODE) + ","
+                     + node(k, D, mega::FOLDERNODE) + "]"));
+    ASSERT_TRUE(mc.cli->nodebyhandle(h));
+    ASSERT_FALSE(mc.cli->nodebyhandle(i));
+    ASSERT_FALSE(mc.cli->nodebyhandle(k));
+    expectCountsMatchWalk(*mc.cli);
+}
+
+TEST(Node, recentNodesFollowTheCtimeIndex)
+{
+    MockClient client;
+    auto& cloud = mt::makeNode(*client.cli, mega::ROOTNODE, 1);
+    auto& rubbish = mt::makeNode(*client.cli, mega::RUBBISHNODE, 2);
+    for (mega::handle h = 10; h < 20; h++)
+    {
+        mt::makeNode(*client.cli, mega::FILENODE, h, &cloud).setctime(mega::m_time_t(h * 100));
+    }
+    mt::makeNode(*client.cli, mega::FILENODE, 30, client.cli->nodebyhandle(19)).setctime(5000);    // a version
+    mt::makeNode(*client.cli, mega::FILENODE, 31, &rubbish).setctime(4000);
+    ASSERT_EQ(client.cli->filesbyctime.size(), 12u);
+
+    auto handles = [](const mega::node_vector& v)
+    {
+        std::vector<mega::handle> hs;
+        for (auto n : v) hs.push_back(n->nodehandle);
+        return hs;
+    };
+    ASSERT_EQ(handles(client.cli->getRecentNodes(3, 0, false)), (std::vector<mega::handle>{19, 18, 17}));
+    ASSERT_EQ(handles(client.cli->getRecentNodes(2, 0, true)), (std::vector<mega::handle>{31, 19}));
+    ASSERT_EQ(handles(client.cli->getRecentNodes(100, 1750, false)), (std::vector<mega::handle>{19, 18}));
+
+    // an action packet updates a timestamp, a file is deleted
+    client.cli->nodebyhandle(10)->setctime(3000);
+    delete client.cli->nodebyhandle(18);
+    client.cli->nodes.erase(18);
+    ASSERT_EQ(handles(client.cli->getRecentNodes(3, 0, false)), (std::vector<mega::handle>{10, 19, 17}));
+}
+
+TEST(Node, proctreeWalksDeepAndWideTrees)
+{
+    MockClient client;
+    auto& cloud = mt::makeNode(*client.cli, mega::ROOTNODE, 1);
+
+    // a deep chain of folders
+    mega::Node* deepest = &cloud;
+    for (mega::handle h = 10; h < 20010; h++)
+    {
+        deepest = &mt::makeNode(*client.cli, mega::FOLDERNODE, h, deepest);
+    }
+
+    // wide enough for the processor to run on several threads
+    auto& wide = mt::makeNode(*client.cli, mega::FOLDERNODE, 2, &cloud);
+    const size_t files = 3 * mega::MegaClient::PROCTREE_MINSHARD;
+    for (mega::handle h = 0; h < files; h++)
+    {
+        mt::makeNode(*client.cli, mega::FILENODE, 200000 + h, &wide).size = 3;
+    }
+
+    mega::TreeProcDU du;
+    client.cli->proctree(&cloud, &du);
+    ASSERT_EQ(du.numfolders, 20000 + 2);
+    ASSERT_EQ(du.numfiles, int(files));
+    ASSERT_EQ(du.numbytes, m_off_t(3 * files));
+
+    // children before their parent
+    struct Order : public mega::TreeProc
+    {
+        std::vector<mega::handle> handles;
+        void proc(mega::MegaClient*, mega::Node* n) override { handles.push_back(n->nodehandle); }
+    } order;
+    client.cli->proctree(client.cli->nodebyhandle(20007), &order);
+    ASSERT_EQ(order.handles, (std::vector<mega::handle>{20009, 20008, 20007}));
+}
+
+TEST(Node, purgenodesDiscardsTheGraphInBulk)
+{
+    MockClient client;
+    auto& cloud = mt::makeNode(*client.cli, mega::ROOTNODE, 1);
+    client.cli->rootnodes[0] = cloud.nodehandle;
+
+    // parents and children in both orders of deletion
+    mega::Node* parent = &cloud;
+    for (mega::handle h = 100; h > 10; h--)
+    {
+        parent = &mt::makeNode(*client.cli, mega::FOLDERNODE, h, parent);
+        mt::makeNode(*client.cli, mega::FILENODE, h + 1000, parent).setctime(mega::m_time_t(h));
+        mt::makeNode(*client.cli, mega::FILENODE, h + 2000, parent).setctime(mega::m_time_t(h));
+    }
+    ASSERT_FALSE(client.cli->filesbyctime.empty());
+
+    client.cli->purgenodesusersabortsc();
+
+    ASSERT_FALSE(client.cli->discardingnodes);
+    ASSERT_TRUE(client.cli->nodes.empty());
+    ASSERT_TRUE(client.cli->filesbyctime.empty());
+    ASSERT_TRUE(client.cli->mNodeCounters.empty());
+    ASSERT_EQ(0, client.cli->mFingerprints.getSumSizes());
+}
+
+TEST(Node, Fingerprints_findTheNodeByItsNewFingerprintOnceChanged)
+{
+    MockClient client;
+    auto& cloud = mt::makeNode(*client.cli, mega::ROOTNODE, 1);
+    auto& n = mt::makeNode(*client.cli, mega::FILENODE, 2, &cloud);
+    n.size = 1000;
+    n.mtime = 2000;
+    n.isvalid = true;
+    client.cli->mFingerprints.add(&n);
+
+    mega::FileFingerprint before = n;
+    ASSERT_EQ(&n, client.cli->mFingerprints.nodebyfingerprint(&before));
+
+    // as the fingerprint of a finished upload is fixed on its node
+    mega::FileFingerprint after = n;
+    after.size += 10;
+    after.mtime += 100;
+    client.cli->mFingerprints.remove(&n);
+    static_cast<mega::FileFingerprint&>(n) = after;
+    client.cli->mFingerprints.add(&n);
+
+    ASSERT_EQ(nullptr, client.cli->mFingerprints.nodebyfingerprint(&before));
+    ASSERT_EQ(&n, client.cli->mFingerprints.nodebyfingerprint(&after));
+    ASSERT_EQ(n.size, client.cli->mFingerprints.getSumSizes());
+
+    n.setsize(n.size + 1);
+    ASSERT_EQ(nullptr, client.cli->mFingerprints.nodebyfingerprint(&after));
+    mega::FileFingerprint resized = n;
+    ASSERT_EQ(&n, client.cli->mFingerprints.nodebyfingerprint(&resized));
+
+    client.cli->mFingerprints.remove(&n);
+    ASSERT_EQ(nullptr, client.cli->mFingerprints.nodebyfingerprint(&resized));
+    ASSERT_EQ(0, client.cli->mFingerprints.getSumSizes());
+}
+
+TEST(Node, SharedNodeView_findsTheNodesAndChildrenWrittenByTheClient)
+{
+    MockClient client;
+    auto& cloud = mt::makeNode(*client.cli, mega::ROOTNODE, 1);
+    auto& rubbish = mt::makeNode(*client.cli, mega::RUBBISHNODE, 2);
+    client.cli->rootnodes[0] = cloud.nodehandle;
+    client.cli->rootnodes[mega::RUBBISHNODE - mega::ROOTNODE] = rubbish.nodehandle;
+
+    auto& folder = mt::makeNode(*client.cli, mega::FOLDERNODE, 50, &cloud);
+    folder.attrs().map['n'] = "folder";
+    for (mega::handle h = 60; h > 40; h -= 2)
+    {
+        auto& file = mt::makeNode(*client.cli, mega::FILENODE, h + 1, &folder);
+        file.attrs().map['n'] = "file of a name longer than a block " + std::to_string(h + 1);
+        file.size = m_off_t(h * 1000);
+        file.mtime = mega::m_time_t(h);
+    }
+
+    const std::string path = "sharednodeview";
+    const std::string key(mega::SymmCipher::KEYLENGTH, 'k');
+    ASSERT_TRUE(mega::SharedNodeView::write(path, key, client.cli->rng, client.cli->nodes, client.cli->rootnodes, 7));
+
+    mega::SharedNodeView view;
+    ASSERT_FALSE(view.open(path, std::string(mega::SymmCipher::KEYLENGTH, 'x')));
+    ASSERT_TRUE(view.open(path, key));
+    ASSERT_EQ(7u, view.generation());
+    ASSERT_EQ(client.cli->nodes.size(), view.size());
+    ASSERT_EQ(cloud.nodehandle, view.rootnode(0));
+    ASSERT_EQ(rubbish.nodehandle, view.rootnode(2));
+
+    mega::SharedNodeView::Record r;
+    std::string name;
+    ASSERT_TRUE(view.find(51, &r, &name));
+    ASSERT_EQ(folder.nodehandle, r.parenthandle);
+    ASSERT_EQ(mega::FILENODE, r.type);
+    ASSERT_EQ(50000, r.size);
+    ASSERT_EQ(50, r.mtime);
+    ASSERT_EQ("file of a name longer than a block 51", name);
+    ASSERT_FALSE(view.find(52, &r));
+
+    std::vector<mega::SharedNodeView::Record> children;
+    std::vector<std::string> names;
+    ASSERT_TRUE(view.children(folder.nodehandle, &children, &names));
+    ASSERT_EQ(10u, children.size());
+    for (size_t i = 0; i < children.size(); i++)
+    {
+        ASSERT_EQ(folder.nodehandle, children[i].parenthandle);
+        ASSERT_EQ("file of a name longer than a block " + std::to_string(children[i].nodehandle), names[i]);
+    }
+
+    children.clear();
+    ASSERT_TRUE(view.children(cloud.nodehandle, &children));
+    ASSERT_EQ(1u, children.size());
+    ASSERT_EQ(folder.nodehandle, children[0].nodehandle);
+
+    // the view keeps its generation until it refreshes
+    ASSERT_FALSE(view.refresh());
+    mt::makeNode(*client.cli, mega::FOLDERNODE, 70, &cloud);
+    ASSERT_TRUE(mega::SharedNodeView::write(path, key, client.cli->rng, client.cli->nodes, client.cli->rootnodes, 8));
+    ASSERT_EQ(8u, mega::SharedNodeView::generationof(path));
+    ASSERT_FALSE(view.find(70, &r));
+    ASSERT_TRUE(view.refresh());
+    ASSERT_EQ(8u, view.generation());
+    ASSERT_TRUE(view.find(70, &r));
+
+    view.close();
+    std::remove(path.c_str());
+}
+
+#ifdef ENABLE_SYNC
+TEST(Node, execmovetosyncdebrisMovesTheTopFolderOnly)
+{
+    MockClient client;
+    auto& cloud = mt::makeNode(*client.cli, mega::ROOTNODE, 1);
+    auto& rubbish = mt::makeNode(*client.cli, mega::RUBBISHNODE, 2);
+    client.cli->rootnodes[0] = cloud.nodehandle;
+    client.cli->rootnodes[mega::RUBBISHNODE - mega::ROOTNODE] = rubbish.nodehandle;
+
+    auto& folder = mt::makeNode(*client.cli, mega::FOLDERNODE, 10, &cloud);
+    auto& subfolder = mt::makeNode(*client.cli, mega::FOLDERNODE, 11, &folder);
+    std::vector<mega::Node*> files;
+    for (mega::handle h = 20; h < 30; h++)
+    {
+        files.push_back(&mt::makeNode(*client.cli, mega::FILENODE, h, h & 1 ? &subfolder : &folder));
+    }
+
+    // as a local folder deletion queues them: children first
+    for (auto f : files)
+    {
+        client.cli->movetosyncdebris(f, false);
+    }
+    client.cli->movetosyncdebris(&subfolder, false);
+    client.cli->movetosyncdebris(&folder, false);
+    ASSERT_EQ(client.cli->todebris.size(), files.size() + 2);
+
+    client.cli->execsyncdeletions();
+    ASSERT_EQ(client.cli->todebris.size(), 1u);
+    ASSERT_EQ(folder.syncdeleted, mega::SYNCDEL_INFLIGHT);
+    ASSERT_EQ(subfolder.syncdeleted, mega::SYNCDEL_NONE);
+    for (auto f : files)
+    {
+        ASSERT_EQ(f->syncdeleted, mega::SYNCDEL_NONE);
+        ASSERT_EQ(f->todebris_it, client.cli->todebris.end());
+    }
+
+    // nothing left to move once the folder's move is done
+    folder.syncdeleted = mega::SYNCDEL_FAILED;
+    client.cli->execsyncdeletions();
+    ASSERT_TRUE(client.cli->todebris.empty());
+}
+#endif
@@ -0,0 +1,455 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <mega.h>
+
+#include "utils.h"
+
+namespace {
+
+struct RaidParts
+{
+    std::vector<std::vector<mega::byte>> parts;
+    mega::byte* bufs[mega::RAIDPARTS];
+
+    RaidParts(size_t lines, unsigned seed)
+    {
+        std::mt19937 rng(seed);
+        parts.assign(mega::RAIDPARTS, std::vector<mega::byte>(lines * mega::RAIDSECTOR));
+        for (unsigned j = 1; j < mega::RAIDPARTS; ++j)
+        {
+            for (size_t i = 0; i < parts[j].size(); ++i)
+            {
+                parts[j][i] = mega::byte(rng());
+                parts[0][i] ^= parts[j][i];
+            }
+        }
+        for (unsigned j = 0; j < mega::RAIDPARTS; ++j)
+        {
+            bufs[j] = parts[j].data();
+        }
+    }
+};
+
+// the file contents: sector by sector from each data part in turn
+std::vector<mega::byte> interleave(const RaidParts& p, size_t lines)
+{
+    std::vector<mega::byte> file;
+    for (size_t line = 0; line < lines; ++line)
+    {
+        for (unsigned j = 1; j < mega::RAIDPARTS; ++j)
+        {
+            auto sector = p.parts[j].begin() + line * mega::RAIDSECTOR;
+            file.insert(file.end(), sector, sector + mega::RAIDSECTOR);
+        }
+    }
+    return file;
+}
+
+struct RecordingJob : public mega::TransferCryptoPool::Job
+{
+    std::vector<int>& order;
+    int index;
+    std::shared_future<void> release;
+    std::atomic<bool> started{false};
+
+    RecordingJob(std::vector<int>& o, int i, size_t b, std::shared_future<void> r = std::shared_future<void>())
+        : order(o), index(i), release(r)
+    {
+        bytes = b;
+    }
+
+    void run(mega::SymmCipher&) override
+    {
+        started = true;
+        if (release.valid())
+        {
+            release.wait();
+        }
+        order.push_back(index);
+    }
+};
+
+double gbPerSecond(size_t bytes, std::chrono::steady_clock::duration elapsed)
+{
+    return bytes / std::chrono::duration<double>(elapsed).count() / 1e9;
+}
+
+}
+
+TEST(Raid, combineRaidLines_matchesReference)
+{
+    // odd line counts exercise the kernels' tail handling
+    for (size_t lines : { 1, 2, 3, 7, 64, 101 })
+    {
+        RaidParts p(lines, unsigned(lines));
+        std::vector<mega::byte> expected = interleave(p, lines);
+
+        for (unsigned missing = 0; missing < mega::RAIDPARTS; ++missing)
+        {
+            mega::byte* bufs[mega::RAIDPARTS];
+            std::copy(p.bufs, p.bufs + mega::RAIDPARTS, bufs);
+            bufs[missing] = nullptr;
+
+            std::vector<mega::byte> out(lines * mega::RAIDLINE);
+            mega::RaidBufferManager::combineRaidLines(out.data(), bufs, 0, lines);
+            ASSERT_EQ(expected, out) << lines << " lines, part " << missing << " missing";
+        }
+
+        // starting part way into the parts
+        if (lines > 1)
+        {
+            std::vector<mega::byte> out((lines - 1) * mega::RAIDLINE);
+            mega::byte* bufs[mega::RAIDPARTS];
+            std::copy(p.bufs, p.bufs + mega::RAIDPARTS, bufs);
+            bufs[3] = nullptr;
+            mega::RaidBufferManager::combineRaidLines(out.data(), bufs, mega::RAIDSECTOR, lines - 1);
+            ASSERT_TRUE(std::equal(out.begin(), out.end(), expected.begin() + mega::RAIDLINE));
+        }
+    }
+}
+
+TEST(Raid, DISABLED_combineRaidLines_benchmark)
+{
+    const size_t lines = (4 << 20) / mega::RAIDSECTOR;
+    const int rounds = 20;
+    RaidParts p(lines, 5);
+    std::vector<mega::byte> out(lines * mega::RAIDLINE);
+
+    auto run = [&](unsigned missing)
+    {
+        mega::byte* bufs[mega::RAIDPARTS];
+        std::copy(p.bufs, p.bufs + mega::RAIDPARTS, bufs);
+        bufs[missing] = nullptr;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = rounds; i--; )
+        {
+            mega::RaidBufferManager::combineRaidLines(out.data(), bufs, 0, lines);
+        }
+        return gbPerSecond(out.size() * rounds, std::chrono::steady_clock::now() - start);
+    };
+
+    double normal = run(0);
+    double degraded = run(2);
+    ASSERT_EQ(interleave(p, lines), out);
+
+    mt::recordBenchmark("interleave_gb_s", normal);
+    mt::recordBenchmark("reconstruction_gb_s", degraded);
+
+}
+
+TEST(TransferCryptoPool, jobsOfOneOwnerRunInOrder)
+{
+    mega::TransferCryptoPool pool(4, 1 << 20, nullptr);
+    ASSERT_EQ(4u, pool.threads());
+
+    std::vector<int> orders[3];
+    std::vector<std::shared_ptr<RecordingJob>> jobs;
+    for (int i = 0; i < 300; ++i)
+    {
+        jobs.push_back(std::make_shared<RecordingJob>(orders[i % 3], i, 1));
+        ASSERT_TRUE(pool.submit(&orders[i % 3], jobs.back()));
+    }
+
+    for (auto& job : jobs)
+    {
+        pool.wait(*job);
+        ASSERT_TRUE(job->done);
+    }
+
+    for (auto& order : orders)
+    {
+        ASSERT_EQ(100u, order.size());
+        ASSERT_TRUE(std::is_sorted(order.begin(), order.end()));
+    }
+}
+
+TEST(TransferCryptoPool, inFlightBudgetAndCancel)
+{
+    std::promise<void> unblock;
+    std::shared_future<void> release = unblock.get_future().share();
+    std::vector<int> order;
+    int owner = 0;
+
+    mega::TransferCryptoPool pool(2, 100, nullptr);
+    auto blocking = std::make_shared<RecordingJob>(order, 0, 60, release);
+    auto queued = std::make_shared<RecordingJob>(order, 1, 30);
+    auto toolarge = std::make_shared<RecordingJob>(order, 2, 20);
+
+    ASSERT_TRUE(pool.submit(&owner, blocking));
+    while (!blocking->started)
+    {
+        std::this_thread::yield();
+    }
+    ASSERT_TRUE(pool.submit(&owner, queued));
+    ASSERT_FALSE(pool.submit(&owner, toolarge));
+    ASSERT_FALSE(toolarge->submitted);
+
+    // the queued job never runs, and its bytes are released
+    pool.cancel(&owner);
+    ASSERT_TRUE(pool.submit(&owner, toolarge));
+
+    unblock.set_value();
+    pool.wait(*toolarge);
+    ASSERT_TRUE(blocking->done);
+    ASSERT_FALSE(queued->done);
+    ASSERT_EQ(std::vector<int>({ 0, 2 }), order);
+}
+
+TEST(BufferPool, recyclesBySizeClassWithinTheLimit)
+{
+    using mega::BufferPool;
+    const size_t MB = 1 << 20;
+
+    // quarter power-of-two classes; small and huge sizes are not rounded
+    ASSERT_EQ(MB, BufferPool::classsize(MB));
+    ASSERT_EQ(MB + MB / 4, BufferPool::classsize(MB + 16));
+    ASSERT_EQ(size_t(1000), BufferPool::classsize(1000));
+
+    auto pool = std::make_shared<BufferPool>(3 * MB);
+    size_t capacity;
+    mega::byte* a = pool->get(MB, capacity);
+    ASSERT_EQ(MB, capacity);
+    mega::byte* b = pool->get(MB - 100, capacity);
+    ASSERT_EQ(MB, capacity);
+    ASSERT_EQ(2u, pool->stats().misses);
+
+    pool->put(a, MB);
+    pool->put(b, MB);
+    ASSERT_EQ(2 * MB, pool->stats().idleBytes);
+
+    // same class: reused
+    ASSERT_TRUE(pool->get(MB - 1000, capacity) == b);
+    ASSERT_EQ(1u, pool->stats().hits);
+
+    // over the limit: freed instead of kept
+    mega::byte* c = pool->get(2 * MB, capacity);
+    pool->put(c, capacity);
+    pool->put(b, MB);
+    ASSERT_EQ(1u, pool->stats().dropped);
+    ASSERT_EQ(3 * MB, pool->stats().idleBytes);
+
+    // lowering the limit frees the largest first
+    pool->setlimit(MB);
+    ASSERT_EQ(MB, pool->stats().idleBytes);
+
+    // pieces give their buffers back when they go
+    {
+        mega::RaidBufferManager::FilePiece piece(0, MB - 16, pool);
+        ASSERT_EQ(MB - 16, piece.buf.datalen());
+    }
+    ASSERT_EQ(2u, pool->stats().hits);
+    ASSERT_EQ(MB, pool->stats().idleBytes);
+
+    pool->setlimit(0);
+    ASSERT_EQ(0u, pool->stats().idleBytes);
+}
+
+TEST(HttpIO, connectionStatsCountTheLastMinute)
+{
+    struct HttpIo : mega::HttpIO
+    {
+        void addevents(mega::Waiter*, int) override {}
+        void post(struct mega::HttpReq*, const char* = NULL, unsigned = 0) override {}
+        void cancel(mega::HttpReq*) override {}
+        m_off_t postpos(void*) override { return {}; }
+        bool doio(void) override { return {}; }
+        void setuseragent(std::string*) override {}
+        using mega::HttpIO::countrequest;
+    } httpio;
+
+    ASSERT_FALSE(httpio.sethttp2(true));
+
+    mega::dstime start = mega::Waiter::ds;
+    httpio.countrequest(true, true, false);
+    httpio.countrequest(false, false, true);    // reused a connection
+    httpio.countrequest(true, false, true);     // plain HTTP
+
+    auto stats = httpio.getconnectionstats();
+    ASSERT_EQ(3u, stats.requests);
+    ASSERT_EQ(2u, stats.http2requests);
+    ASSERT_EQ(2u, stats.connections);
+    ASSERT_EQ(1u, stats.handshakes);
+    ASSERT_EQ(2u, stats.connectionsPerMinute);
+    ASSERT_EQ(1u, stats.handshakesPerMinute);
+
+    mega::Waiter::ds = start + 600;
+    httpio.countrequest(true, true, true);
+    stats = httpio.getconnectionstats();
+    ASSERT_EQ(3u, stats.connections);
+    ASSERT_EQ(1u, stats.connectionsPerMinute);
+    ASSERT_EQ(1u, stats.handshakesPerMinute);
+    mega::Waiter::ds = start;
+}
+
+TEST(HttpIO, bandwidthShaperLimitsByDirectionGroupAndSchedule)
+{
+    mega::BandwidthShaper shaper;
+    const mega::m_time_t night = 1609464600;     // 2021-01-01 01:30 UTC
+    const mega::m_time_t day = night + 6 * 3600;
+
+    shaper.update(100, day);
+    ASSERT_EQ(-1, shaper.available(mega::GET, 0));
+
+    shaper.setlimit(mega::GET, 1000);
+    shaper.setgrouplimit(7, 400);
+    ASSERT_EQ(1000, shaper.available(mega::GET, 0));
+    ASSERT_EQ(400, shaper.available(mega::GET, 7));
+    ASSERT_EQ(400, shaper.available(mega::PUT, 7));
+
+    // a whole buffer may go over the group's budget, which is paid back before the group sends again
+    shaper.consume(mega::GET, 7, 600);
+    ASSERT_EQ(mega::BandwidthShaper::GROUP_LIMITED, shaper.blocked(mega::GET, 7));
+    ASSERT_EQ(mega::BandwidthShaper::FREE, shaper.blocked(mega::GET, 0));
+    ASSERT_EQ(400, shaper.available(mega::GET, 0));
+
+    shaper.update(105, day);    // half a second: +500 for the direction, +200 for the group
+    ASSERT_EQ(mega::BandwidthShaper::GROUP_LIMITED, shaper.blocked(mega::GET, 7));
+    shaper.update(110, day);
+    ASSERT_EQ(mega::BandwidthShaper::FREE, shaper.blocked(mega::GET, 7));
+    ASSERT_EQ(200, shaper.available(mega::GET, 7));
+    ASSERT_EQ(1000, shaper.available(mega::GET, 0));  // never more than a second's worth
+
+    shaper.setlimit(300);
+    shaper.consume(mega::PUT, 0, 300);
+    ASSERT_EQ(mega::BandwidthShaper::DIRECTION_LIMITED, shaper.blocked(mega::GET, 0));
+
+    // unthrottled at night
+    ASSERT_FALSE(shaper.addschedule("not cron", 3600, 0, 0));
+    ASSERT_TRUE(shaper.addschedule("0 0 1 * * *", 3 * 3600, 0, 0));
+    shaper.update(110, day);
+    ASSERT_EQ(-1, shaper.activeschedule());
+    ASSERT_EQ(mega::BandwidthShaper::DIRECTION_LIMITED, shaper.blocked(mega::GET, 0));
+
+    shaper.update(110, night);
+    ASSERT_EQ(0, shaper.activeschedule());
+    ASSERT_EQ(mega::BandwidthShaper::FREE, shaper.blocked(mega::GET, 7));
+    ASSERT_EQ(-1, shaper.available(mega::GET, 7));
+
+    shaper.update(120, day);
+    ASSERT_EQ(-1, shaper.activeschedule());
+    ASSERT_EQ(300, shaper.available(mega::GET, 0));
+    ASSERT_EQ(300, shaper.available(mega::GET, 7));
+}
+
+TEST(StorageHealth, slowOrFailingServersAreAvoidedForACooldown)
+{
+    mega::StorageHealth health;
+    const std::string fast = "https://gfs1.userstorage.mega.co.nz/dl/abc";
+    const std::string slow = "https://gfs2.userstorage.mega.co.nz/dl/def";
+    const std::string flaky = "http://gfs3.userstorage.mega.co.nz:8080/dl/ghi";
+    ASSERT_EQ("gfs3.userstorage.mega.co.nz:8080", mega::StorageHealth::hostof(flaky));
+
+    // 1 MB in 100 ms against 1 MB in 2 s: judged after MIN_SAMPLES responses, and reported once
+    mega::dstime now = 1000;
+    int turnedpoor = 0;
+    for (unsigned i = 0; i < mega::StorageHealth::MIN_SAMPLES + 2; i++)
+    {
+        ASSERT_FALSE(health.success(fast, 1 << 20, 20, 120, now));
+        turnedpoor += health.success(slow, 1 << 20, 20, 2020, now);
+    }
+    ASSERT_EQ(1, turnedpoor);
+    ASSERT_FALSE(health.avoided(fast, now));
+    ASSERT_TRUE(health.avoided(slow, now));
+    ASSERT_DOUBLE_EQ(1, health.score("gfs1.userstorage.mega.co.nz"));
+    ASSERT_LT(health.score("gfs2.userstorage.mega.co.nz"), 0.1);
+
+    // small responses don't count for throughput
+    for (unsigned i = 0; i < mega::StorageHealth::MIN_SAMPLES; i++)
+    {
+        ASSERT_FALSE(health.success(flaky, 100, 20, 2000, now));
+    }
+    ASSERT_DOUBLE_EQ(1, health.score("gfs3.userstorage.mega.co.nz:8080"));
+
+    // errors bring the score down too
+    unsigned failures = 0;
+    while (!health.failure(flaky, now))
+    {
+        ASSERT_LT(++failures, 10u);
+    }
+    ASSERT_GT(failures, 0u);
+    ASSERT_TRUE(health.avoided(flaky, now));
+
+    // judged afresh after the cooldown
+    now += mega::StorageHealth::COOLDOWN_DS;
+    ASSERT_FALSE(health.avoided(slow, now));
+    ASSERT_EQ(0u, health.hosts().count("gfs2.userstorage.mega.co.nz"));
+    ASSERT_FALSE(health.success(slow, 1 << 20, 20, 2020, now));
+}
+
+TEST(HttpReqUL, bodyComesFromThePoolAndGoesBackOnceUploaded)
+{
+    auto pool = std::make_shared<mega::BufferPool>(64 << 20);
+    mega::HttpReqUL req;
+    req.bufferpool = pool;
+
+    mega::byte* body = req.bodybuffer(1 << 20, 0);
+    ASSERT_NE(nullptr, body);
+    size_t capacity = req.bodycapacity;
+    ASSERT_GE(capacity, size_t(1 << 20));
+    ASSERT_EQ(body, req.bodybuffer(1000, 8));   // kept while big enough
+
+    req.releasebody();
+    ASSERT_EQ(nullptr, req.body);
+    ASSERT_EQ(capacity, pool->stats().idleBytes);
+
+    // the next chunk, on any connection, reuses it
+    mega::HttpReqUL other;
+    other.bufferpool = pool;
+    ASSERT_EQ(body, other.bodybuffer(1 << 20, 0));
+    ASSERT_EQ(1u, pool->stats().hits);
+}
+
+TEST(NetworkProbe, profileFollowsLatencyLossAndBandwidth)
+{
+    // short, clean, fast: two connections go a long way, with large requests
+    auto lan = mega::NetworkProbe::tune(20, 0, 10 << 20, false, 32);
+    ASSERT_EQ(2u, lan.connections);
+    ASSERT_EQ(8 << 20, lan.requestsize);
+    ASSERT_EQ(0u, lan.transfers);
+    ASSERT_FALSE(lan.altport);
+
+    // long and lossy, throughput unknown yet: all the connections and transfers
+    auto satellite = mega::NetworkProbe::tune(600, 0.02, 0, false, 32);
+    ASSERT_EQ(6u, satellite.connections);
+    ASSERT_EQ(0, satellite.requestsize);
+    ASSERT_EQ(32u, satellite.transfers);
+
+    // slow: fewer files at a time, small requests, and the port that gets through
+    auto slow = mega::NetworkProbe::tune(100, 0, 512 << 10, true, 32);
+    ASSERT_EQ(1u, slow.connections);
+    ASSERT_EQ(1 << 20, slow.requestsize);
+    ASSERT_EQ(8u, slow.transfers);
+    ASSERT_TRUE(slow.altport);
+
+    std::string data;
+    satellite.serialize(&data);
+    mega::NetworkProbe::Profile restored;
+    ASSERT_TRUE(restored.unserialize(data));
+    ASSERT_EQ(satellite.json(), restored.json());
+    ASSERT_FALSE(restored.unserialize(data.substr(0, data.size() / 2)));
+}
@@ -17,6 +17,7 @@
  */
 
 #include <atomic>
+#include <iostream>
 #include <memory>
 #include <numeric>
 #include <thread>
@@ -353,6 +354,7 @@ void checkDeserializedLocalNode(const mega::LocalNode& dl, const mega::LocalNode
     ASSERT_EQ(nullptr, dl.parent);
     ASSERT_EQ(ref.sync, dl.sync);
     ASSERT_EQ(ref.mSyncable, dl.mSyncable);
+    ASSERT_EQ(ref.contenthash, dl.contenthash);
     ASSERT_EQ(false, dl.created);
     ASSERT_EQ(false, dl.reported);
     ASSERT_EQ(true, dl.checked);
@@ -404,6 +406,25 @@ TEST(Serialization, LocalNode_forFile_withoutNode)
     checkDeserializedLocalNode(*dl, *l);
 }
 
+TEST(Serialization, LocalNode_forFile_withContentHash)
+{
+    MockClient client;
+    auto sync = mt::makeSync(*client.cli, "wicked");
+    auto l = mt::makeLocalNode(*sync, *sync->localroot, mega::FILENODE, "sweet");
+    l->size = 124;
+    l->setfsid(10, client.cli->fsidnode);
+    l->parent->dbid = 13;
+    l->parent_dbid = l->parent->dbid;
+    l->mtime = 124124124;
+    std::iota(l->crc.begin(), l->crc.end(), 1);
+    l->contenthash.assign(32, '\x11');
+    std::string data;
+    ASSERT_TRUE(l->serialize(&data));
+    ASSERT_EQ(63u + 32u, data.size());
+    std::unique_ptr<mega::LocalNode> dl{mega::LocalNode::unserialize(sync.get(), &data)};
+    checkDeserializedLocalNode(*dl, *l);
+}
+
 TEST(Serialization, LocalNode_forFile_withoutNode_withMaxMtime)
 {
     MockClient client;
@@ -596,7 +617,7 @@ void checkDeserializedNode(const mega::Node& dl, const mega::Node& ref, bool ign
     ASSERT_EQ(ref.ctime, dl.ctime);
     ASSERT_EQ(ref.nodekey(), dl.nodekey());
     ASSERT_EQ(ignore_fileattrstring ? "" : ref.fileattrstring, dl.fileattrstring);
-    ASSERT_EQ(ref.attrs.map, dl.attrs.map);
+    ASSERT_EQ(ref.attrs().map, dl.attrs().map);
     if (ref.plink)
     {
         ASSERT_NE(nullptr, dl.plink);
@@ -681,7 +702,7 @@ TEST(Serialization, Node_forFile_withoutShares_withoutFileAttrString_withoutPlin
     n->size = 12;
     n->owner = 88;
     n->ctime = 44;
-    n->attrs.map = {
+    n->attrs().map = {
         {101, "foo"},
         {102, "bar"},
     };
@@ -701,7 +722,7 @@ TEST(Serialization, Node_forFile_withoutShares_withoutPlink)
     n->size = 12;
     n->owner = 88;
     n->ctime = 44;
-    n->attrs.map = {
+    n->attrs().map = {
         {101, "foo"},
         {102, "bar"},
     };
@@ -722,7 +743,7 @@ TEST(Serialization, Node_forFile_withoutShares)
     n->size = 12;
     n->owner = 88;
     n->ctime = 44;
-    n->attrs.map = {
+    n->attrs().map = {
         {101, "foo"},
         {102, "bar"},
     };
@@ -744,7 +765,7 @@ TEST(Serialization, Node_forFile_withoutShares_32bit)
     n->size = 12;
     n->owner = 88;
     n->ctime = 44;
-    n->attrs.map = {
+    n->attrs().map = {
         {101, "foo"},
         {102, "bar"},
     };
@@ -796,7 +817,7 @@ TEST(Serialization, Node_forFolder_withoutShares_withoutFileAttrString_withoutPl
     n->size = -1;
     n->owner = 88;
     n->ctime = 44;
-    n->attrs.map = {
+    n->attrs().map = {
         {101, "foo"},
         {102, "bar"},
     };
@@ -816,7 +837,7 @@ TEST(Serialization, Node_forFolder_withoutShares_withoutPlink)
     n->size = -1;
     n->owner = 88;
     n->ctime = 44;
-    n->attrs.map = {
+    n->attrs().map = {
         {101, "foo"},
         {102, "bar"},
     };
@@ -837,7 +858,7 @@ TEST(Serialization, Node_forFolder_withoutShares)
     n->size = -1;
     n->owner = 88;
     n->ctime = 44;
-    n->attrs.map = {
+    n->attrs().map = {
         {101, "foo"},
         {102, "bar"},
     };
@@ -860,7 +881,7 @@ TEST(Serialization, Node_forFolder_withoutShares_32bit)
     n->size = -1;
     n->owner = 88;
     n->ctime = 44;
-    n->attrs.map = {
+    n->attrs().map = {
         {101, "foo"},
         {102, "bar"},
     };
@@ -887,3 +908,97 @@ TEST(Serialization, Node_forFolder_withoutShares_32bit)
     auto dn = mega::Node::unserialize(client.cli.get(), &data, &dp);
     checkDeserializedNode(*dn, *n, true);
 }
+
+TEST(Serialization, DISABLED_CacheableReaderWriter_benchmark)
+{
+    // records shaped like the cached transfers: a few scalars, strings and the chunk macs
+    const int count = 200000;
+    mega::chunkmac_map macs;
+    for (m_off_t pos = 0; pos < 8 * mega::ChunkedHash::SEGSIZE; pos = mega::ChunkedHash::chunkceil(pos))
+    {
+        macs[pos].finished = true;
+    }
+    const std::string path(60, 'p');
+
+    std::string d;
+    double write = mt::elapsedMs([&]()
+    {
+        mega::CacheableWriter w(d);
+        for (int i = 0; i < count; i++)
+        {
+            w.serializei64(i);
+            w.serializehandle(mega::handle(i));
+            w.serializestring(path);
+            w.serializecstr(path.c_str(), false);
+            w.serializeu32(uint32_t(i));
+            w.serializebool(i & 1);
+            w.serializechunkmacs(macs);
+            w.serializeexpansionflags();
+        }
+    });
+
+    int records = 0;
+    double read = mt::elapsedMs([&]()
+    {
+        mega::CacheableReader r(d);
+        int64_t i64;
+        mega::handle h;
+        std::string s1, s2;
+        uint32_t u32;
+        bool b;
+        mega::chunkmac_map m;
+        unsigned char expansions[8];
+        while (r.ptr < r.end)
+        {
+            m.clear();
+            ASSERT_TRUE(r.unserializei64(i64) && r.unserializehandle(h) && r.unserializestring(s1)
+                        && r.unserializecstr(s2, false) && r.unserializeu32(u32) && r.unserializebool(b)
+                        && r.unserializechunkmacs(m) && r.unserializeexpansionflags(expansions, 0));
+            records++;
+        }
+    });
+    ASSERT_EQ(count, records);
+
+    double megabytes = double(d.size()) / (1024 * 1024);
+    mt::recordBenchmark("write_mb_s", megabytes / write * 1000);
+    mt::recordBenchmark("read_mb_s", megabytes / read * 1000);
+
+}
+
+TEST(Serialization, DISABLED_Node_unserialize_benchmark)
+{
+    // the node records of the local cache, as fetchnodes leaves them
+    const int count = 100000;
+    std::vector<std::string> records;
+    {
+        MockClient source;
+        auto& root = mt::makeNode(*source.cli, mega::FOLDERNODE, 1);
+        for (int i = 0; i < count; i++)
+        {
+            auto& n = mt::makeNode(*source.cli, i % 10 ? mega::FILENODE : mega::FOLDERNODE, mega::handle(i + 2), &root);
+            n.size = i % 10 ? i * 4096 : -1;
+            n.owner = 88;
+            n.ctime = 1580000000;
+            n.attrs().map = {
+                {'n', "name of the node " + std::to_string(i)},
+                {'c', "fingerprint" + std::to_string(i)},
+            };
+            records.emplace_back();
+            ASSERT_TRUE(n.serialize(&records.back()));
+        }
+    }
+
+    MockClient client;
+    mega::node_vector dp;
+    double unserialize = mt::elapsedMs([&]()
+    {
+        for (const std::string& record : records)
+        {
+            ASSERT_NE(nullptr, mega::Node::unserialize(client.cli.get(), &record, &dp));
+        }
+    });
+    ASSERT_EQ(size_t(count), client.cli->nodes.size());
+
+    mt::recordBenchmark("nodes_per_s", count / unserialize * 1000);
+
+}
@@ -0,0 +1,716 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include <gtest/gtest.h>
+
+#include <mega.h>
+
+#include "DefaultedDbTable.h"
+#include "DefaultedFileSystemAccess.h"
+#include "utils.h"
+
+#ifdef USE_SQLITE
+
+namespace {
+
+struct Row : public mega::Cacheable
+{
+    std::string payload;
+
+    bool serialize(std::string* d) override
+    {
+        d->append(payload);
+        return true;
+    }
+};
+
+// keeps where each record was passed from, and a copy of it
+struct CapturingTable : public mt::DefaultedDbTable
+{
+    using mt::DefaultedDbTable::DefaultedDbTable;
+
+    std::vector<const char*> buffers;
+    std::vector<std::string> records;
+
+    bool put(uint32_t, char* data, unsigned len) override
+    {
+        buffers.push_back(data);
+        records.emplace_back(data, len);
+        return true;
+    }
+};
+
+template<typename F>
+double rowsPerSecond(size_t rows, F&& f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return rows / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct TestTable
+{
+    mega::PrnGen rng;
+    mega::FSACCESS_CLASS fsaccess;
+    std::string path = "./";
+    mega::SqliteDbAccess dbaccess{&path};
+    std::unique_ptr<mega::DbTable> table;
+
+    explicit TestTable(std::string name, const mega::DbProfile& profile = mega::DbProfile())
+    {
+        dbaccess.profile = profile;
+        table.reset(dbaccess.open(rng, &fsaccess, &name, false, false));
+    }
+
+    ~TestTable()
+    {
+        if (table)
+        {
+            table->remove();
+        }
+    }
+};
+
+}
+
+TEST(SqliteDbTable, putBatch_get_next_del)
+{
+    TestTable t("unittest_batch");
+    ASSERT_TRUE(t.table);
+
+    mega::SymmCipher key;
+    key.setkey((const mega::byte*)std::string(mega::SymmCipher::KEYLENGTH, 'k').data());
+
+    std::vector<Row> rows(100);
+    std::vector<mega::Cacheable*> batch;
+    for (size_t i = 0; i < rows.size(); i++)
+    {
+        rows[i].payload = "row" + std::to_string(i);
+        batch.push_back(&rows[i]);
+    }
+
+    // outside a transaction the batch commits by itself
+    ASSERT_TRUE(t.table->putBatch(mega::MegaClient::CACHEDNODE, batch, &key));
+
+    uint32_t id;
+    std::string data;
+    size_t found = 0;
+    t.table->rewind();
+    while (t.table->next(&id, &data, &key))
+    {
+        ASSERT_EQ(rows[found].dbid, id);
+        ASSERT_EQ(rows[found].payload, data);
+        found++;
+    }
+    ASSERT_EQ(rows.size(), found);
+
+    // the cursor stays at the end until rewound
+    ASSERT_FALSE(t.table->next(&id, &data, &key));
+
+    ASSERT_TRUE(t.table->get(rows[7].dbid, &data));
+    ASSERT_TRUE(t.table->del(rows[7].dbid));
+    ASSERT_FALSE(t.table->get(rows[7].dbid, &data));
+
+    t.table->rewind();
+    found = 0;
+    while (t.table->next(&id, &data, &key))
+    {
+        found++;
+    }
+    ASSERT_EQ(rows.size() - 1, found);
+}
+
+TEST(DbTable, put_reusesTheRecordBuffer)
+{
+    mega::PrnGen rng;
+    CapturingTable table(rng, false);
+
+    mega::SymmCipher key;
+    key.setkey((const mega::byte*)std::string(mega::SymmCipher::KEYLENGTH, 'k').data());
+
+    // the longest record first, so the buffer never needs to grow again
+    std::vector<Row> rows(4);
+    std::vector<mega::Cacheable*> batch;
+    for (size_t i = 0; i < rows.size(); i++)
+    {
+        rows[i].payload.assign(100 - i * 20, char('a' + i));
+        batch.push_back(&rows[i]);
+    }
+
+    ASSERT_TRUE(table.putBatch(mega::MegaClient::CACHEDNODE, batch, &key));
+    ASSERT_EQ(rows.size(), table.records.size());
+
+    for (size_t i = 0; i < rows.size(); i++)
+    {
+        ASSERT_EQ(table.buffers[0], table.buffers[i]);
+
+        std::string data = table.records[i];
+        ASSERT_EQ(0u, data.size() % mega::SymmCipher::BLOCKSIZE);
+        ASSERT_TRUE(mega::PaddedCBC::decrypt(&data, &key));
+        ASSERT_EQ(rows[i].payload, data);
+    }
+}
+
+TEST(WriteBehindDbTable, readsItsWritesAndWritesWhatWasCommitted)
+{
+    TestTable t("unittest_writebehind");
+    ASSERT_TRUE(t.table);
+    t.table.reset(new mega::WriteBehindDbTable(t.rng, t.table.release(), false));
+    mega::DbTable& table = *t.table;
+
+    std::string a = "a", b = "b", data;
+
+    // an aborted transaction leaves nothing behind
+    table.begin();
+    ASSERT_TRUE(table.put(16, &a));
+    ASSERT_TRUE(table.get(16, &data));
+    ASSERT_EQ(a, data);
+    table.abort();
+    ASSERT_FALSE(table.get(16, &data));
+
+    table.begin();
+    ASSERT_TRUE(table.put(16, &a));
+    ASSERT_TRUE(table.put(32, &b));
+    table.commit();
+
+    // outside a transaction, and maybe before the thread wrote the commit
+    ASSERT_TRUE(table.del(32));
+    ASSERT_FALSE(table.get(32, &data));
+    ASSERT_TRUE(table.get(16, &data));
+    ASSERT_EQ(a, data);
+
+    // a full read is of the table itself
+    uint32_t id;
+    table.rewind();
+    ASSERT_TRUE(table.next(&id, &data));
+    ASSERT_EQ(16u, id);
+    ASSERT_EQ(a, data);
+    ASSERT_FALSE(table.next(&id, &data));
+
+    // a truncation hides the records until it's written
+    table.truncate();
+    ASSERT_FALSE(table.get(16, &data));
+    static_cast<mega::WriteBehindDbTable&>(table).flush();
+    ASSERT_FALSE(table.get(16, &data));
+}
+
+TEST(SqliteDbTable, profileIsApplied)
+{
+    mega::DbProfile profile = mega::DbProfile::byid(mega::DbProfile::PROFILE_RECONSTRUCTIBLE);
+    ASSERT_EQ(mega::DbProfile::PROFILE_RECONSTRUCTIBLE, profile.id);
+    ASSERT_EQ(0, profile.synchronous);
+    ASSERT_EQ(mega::DbProfile::PROFILE_DEFAULT, mega::DbProfile::byid(42).id);
+
+    // page_size is a property of the file, so it can be checked from another connection
+    profile.pageSize = 8192;
+    TestTable t("unittest_profile", profile);
+    ASSERT_TRUE(t.table);
+
+    sqlite3* db;
+    std::string dbfile = "./megaclient_statecache" + std::to_string(mega::DbAccess::DB_VERSION) + "_unittest_profile.db";
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+    sqlite3_stmt* stmt;
+    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "PRAGMA page_size", -1, &stmt, NULL));
+    ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+    ASSERT_EQ(8192, sqlite3_column_int(stmt, 0));
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+}
+
+TEST(SqliteDbTable, nodeIndexFollowsNodeRecords)
+{
+    mega::MegaApp app;
+    mt::DefaultedFileSystemAccess fs;
+    auto client = mt::makeClient(app, fs);
+    client->key.setkey((const mega::byte*)std::string(mega::SymmCipher::KEYLENGTH, 'k').data());
+
+    auto& root = mt::makeNode(*client, mega::FOLDERNODE, 1);
+    auto& folder = mt::makeNode(*client, mega::FOLDERNODE, 2, &root);
+    for (mega::handle h = 3; h < 10; h++)
+    {
+        auto& n = mt::makeNode(*client, mega::FILENODE, h, h % 2 ? &root : &folder);
+        n.attrs().map['n'] = "file" + std::to_string(h % 3);
+        n.setsize(100 + h);
+        n.mtime = 1000;
+        n.isvalid = true;
+    }
+
+    TestTable t("unittest_nodeindex");
+    ASSERT_TRUE(t.table);
+    client->sctable = t.table.release();
+
+    // results come in record order
+    auto sorted = [](std::vector<mega::handle> v)
+    {
+        std::sort(v.begin(), v.end());
+        return v;
+    };
+    client->setnodeindex(true);
+    client->initsc();
+
+    std::vector<mega::handle> found;
+    ASSERT_TRUE(client->indexedchildren(2, &found));
+    ASSERT_EQ((std::vector<mega::handle>{4, 6, 8}), sorted(found));
+
+    found.clear();
+    ASSERT_TRUE(client->indexedbyname("file0", &found));
+    ASSERT_EQ((std::vector<mega::handle>{3, 6, 9}), sorted(found));
+
+    found.clear();
+    ASSERT_TRUE(client->indexedbyfingerprint(*client->nodebyhandle(5), &found));
+    ASSERT_EQ((std::vector<mega::handle>{5}), sorted(found));
+
+    // removal and moves reach the index along with the records
+    mega::Node* removed = client->nodebyhandle(4);
+    removed->changed.removed = true;
+    mega::Node* moved = client->nodebyhandle(5);
+    moved->setparent(&folder);
+    client->nodenotify = {removed, moved};
+    client->updatesc();
+    client->nodenotify.clear();
+    removed->changed.removed = false;
+
+    found.clear();
+    ASSERT_TRUE(client->indexedchildren(2, &found));
+    ASSERT_EQ((std::vector<mega::handle>{5, 6, 8}), sorted(found));
+
+    // an index is not used once a session ran without maintaining it
+    client->setnodeindex(false);
+    ASSERT_FALSE(client->indexedchildren(2, &found));
+    std::string marker;
+    ASSERT_FALSE(client->sctable->get(mega::MegaClient::CACHEDNODEINDEX, &marker));
+
+    client->sctable->remove();
+}
+
+namespace {
+
+void expectSameCounts(const mega::NodeCounter& expected, const mega::NodeCounter& actual)
+{
+    ASSERT_EQ(expected.files, actual.files);
+    ASSERT_EQ(expected.folders, actual.folders);
+    ASSERT_EQ(expected.storage, actual.storage);
+    ASSERT_EQ(expected.versions, actual.versions);
+}
+
+}
+
+TEST(SqliteDbTable, lowMemoryPagesFilesOutAndBack)
+{
+    mega::MegaApp app;
+    mt::DefaultedFileSystemAccess fs;
+    auto client = mt::makeClient(app, fs);
+    client->key.setkey((const mega::byte*)std::string(mega::SymmCipher::KEYLENGTH, 'k').data());
+
+    auto& root = mt::makeNode(*client, mega::ROOTNODE, 1);
+    auto& folder = mt::makeNode(*client, mega::FOLDERNODE, 2, &root);
+    for (mega::handle h = 3; h < 42; h++)
+    {
+        auto& n = mt::makeNode(*client, mega::FILENODE, h, &folder);
+        n.attrs().map['n'] = "file" + std::to_string(h);
+        n.setsize(100 + h);
+    }
+    const mega::NodeCounter counts = client->mNodeCounters[1];
+    expectSameCounts(counts, root.subnodeCounts());
+
+    TestTable t("unittest_lowmemory");
+    ASSERT_TRUE(t.table);
+    client->sctable = t.table.release();
+    client->initsc();
+
+    // room for 9 nodes once trimmed: the folders, a pinned file and the files looked up last stay
+    client->setlowmemory(10 * mega::MegaClient::LOWMEMORY_NODEBYTES);
+    client->pinnode(3, true);
+    client->nodebyhandle(40);
+    client->nodebyhandle(41);
+    client->pageoutnodes();
+
+    ASSERT_EQ(9u, client->nodes.size());
+    ASSERT_EQ(32u, client->pagedoutnodes);
+    ASSERT_EQ(32u, client->pagedchildren(2));
+    for (mega::handle h : {1, 2, 3, 40, 41})
+    {
+        ASSERT_NE(client->nodes.end(), client->nodes.find(h));
+    }
+    expectSameCounts(counts, client->mNodeCounters[1]);
+    expectSameCounts(counts, root.subnodeCounts());
+
+    // the lookups of the key workers leave it where it is
+    ASSERT_EQ(nullptr, client->residentnodebyhandle(10));
+    ASSERT_EQ(32u, client->pagedoutnodes);
+
+    // a lookup by handle brings a node back as it was
+    ASSERT_EQ(client->nodes.end(), client->nodes.find(10));
+    mega::Node* n = client->nodebyhandle(10);
+    ASSERT_NE(nullptr, n);
+    ASSERT_EQ(&folder, n->parent);
+    ASSERT_STREQ("file10", n->displayname());
+    ASSERT_EQ(110, n->size);
+    ASSERT_NE(0u, n->dbid);
+    ASSERT_EQ(31u, client->pagedchildren(2));
+    expectSameCounts(counts, client->mNodeCounters[1]);
+
+    // walking a folder brings back all its children
+    client->pageinchildren(&folder);
+    ASSERT_EQ(41u, client->nodes.size());
+    ASSERT_EQ(0u, client->pagedoutnodes);
+    ASSERT_EQ(39u, folder.children.size());
+    expectSameCounts(counts, client->mNodeCounters[1]);
+    expectSameCounts(counts, root.subnodeCounts());
+
+    client->sctable->remove();
+}
+
+TEST(SqliteDbTable, lowMemoryDropsTheNodeSnapshot)
+{
+    mega::MegaApp app;
+    mt::DefaultedFileSystemAccess fs;
+    auto client = mt::makeClient(app, fs);
+    client->key.setkey((const mega::byte*)std::string(mega::SymmCipher::KEYLENGTH, 'k').data());
+
+    auto& root = mt::makeNode(*client, mega::ROOTNODE, 1);
+    auto& folder = mt::makeNode(*client, mega::FOLDERNODE, 2, &root);
+    for (mega::handle h = 3; h < 30; h++)
+    {
+        mt::makeNode(*client, mega::FILENODE, h, &folder);
+    }
+
+    TestTable t("unittest_lowmemorysnapshot");
+    ASSERT_TRUE(t.table);
+    client->sctable = t.table.release();
+    client->setnodesnapshot(true);
+    client->initsc();
+
+    std::string data;
+    ASSERT_TRUE(client->sctable->getsnapshot(&data));
+    ASSERT_TRUE(client->nodesnapshotcurrent);
+
+    // the next start would trust a snapshot missing the paged-out nodes, or one that goes stale
+    client->setlowmemory(5 * mega::MegaClient::LOWMEMORY_NODEBYTES);
+    client->pageoutnodes();
+    ASSERT_NE(0u, client->pagedoutnodes);
+    ASSERT_FALSE(client->sctable->getsnapshot(&data));
+    ASSERT_FALSE(client->sctable->get(mega::MegaClient::CACHEDNODESNAPSHOT, &data));
+    ASSERT_FALSE(client->nodesnapshotcurrent);
+
+    // nor is it written again until they are all back
+    client->finalizesc(true);
+    ASSERT_FALSE(client->sctable->getsnapshot(&data));
+
+    client->pageinchildren(&folder);
+    ASSERT_EQ(0u, client->pagedoutnodes);
+    client->nodesnapshotds = 0;  // past the rewrite interval
+    client->finalizesc(true);
+    ASSERT_TRUE(client->sctable->getsnapshot(&data));
+
+    client->sctable->remove();
+}
+
+TEST(SqliteDbTable, lowMemoryPagesAWholeSubtreeBackIn)
+{
+    mega::MegaApp app;
+    mt::DefaultedFileSystemAccess fs;
+    auto client = mt::makeClient(app, fs);
+    client->key.setkey((const mega::byte*)std::string(mega::SymmCipher::KEYLENGTH, 'k').data());
+
+    // the files of a folder and of the folders below it, as a sync added over it finds them
+    auto& root = mt::makeNode(*client, mega::ROOTNODE, 1);
+    auto& folder = mt::makeNode(*client, mega::FOLDERNODE, 2, &root);
+    auto& sub = mt::makeNode(*client, mega::FOLDERNODE, 3, &folder);
+    auto& subsub = mt::makeNode(*client, mega::FOLDERNODE, 4, &sub);
+    for (mega::handle h = 10; h < 40; h++)
+    {
+        mega::Node* parent = h < 20 ? &folder : h < 30 ? &sub : &subsub;
+        auto& n = mt::makeNode(*client, mega::FILENODE, h, parent);
+        n.attrs().map['n'] = "file" + std::to_string(h);
+        n.setsize(100 + h);
+    }
+
+    TestTable t("unittest_lowmemorysubtree");
+    ASSERT_TRUE(t.table);
+    client->sctable = t.table.release();
+    client->initsc();
+
+    client->setlowmemory(5 * mega::MegaClient::LOWMEMORY_NODEBYTES);
+    client->pageoutnodes();
+    ASSERT_EQ(30u, client->pagedoutnodes);
+
+    client->pageinsubtree(&folder);
+    ASSERT_EQ(0u, client->pagedoutnodes);
+    ASSERT_EQ(11u, folder.children.size());
+    ASSERT_EQ(11u, sub.children.size());
+    ASSERT_EQ(10u, subsub.children.size());
+
+    client->sctable->remove();
+}
+
+TEST(SqliteDbTable, compactVersionsArePagedOutAndBackByChain)
+{
+    mega::MegaApp app;
+    mt::DefaultedFileSystemAccess fs;
+    auto client = mt::makeClient(app, fs);
+    client->key.setkey((const mega::byte*)std::string(mega::SymmCipher::KEYLENGTH, 'k').data());
+
+    // a file with versions 4 (the newest) to 9 (the oldest) below it
+    auto& root = mt::makeNode(*client, mega::ROOTNODE, 1);
+    auto& folder = mt::makeNode(*client, mega::FOLDERNODE, 2, &root);
+    mega::Node* newer = &mt::makeNode(*client, mega::FILENODE, 3, &folder);
+    newer->setsize(103);
+    for (mega::handle h = 4; h < 10; h++)
+    {
+        newer = &mt::makeNode(*client, mega::FILENODE, h, newer);
+        newer->setsize(100 + h);
+    }
+    const mega::NodeCounter counts = client->mNodeCounters[1];
+    ASSERT_EQ(6u, counts.versions);
+
+    TestTable t("unittest_compactversions");
+    ASSERT_TRUE(t.table);
+    client->sctable = t.table.release();
+    client->initsc();
+
+    client->setcompactversions(true);
+    client->pageoutversions();
+    ASSERT_EQ(3u, client->nodes.size());
+    ASSERT_EQ(6u, client->pagedoutnodes);
+    ASSERT_EQ(1u, client->pagedchildren(3));
+    ASSERT_TRUE(client->newversions.empty());
+    expectSameCounts(counts, client->mNodeCounters[1]);
+    expectSameCounts(counts, root.subnodeCounts());
+
+    // the oldest one brings back the newer ones it hangs from
+    mega::Node* oldest = client->nodebyhandle(9);
+    ASSERT_NE(nullptr, oldest);
+    ASSERT_EQ(9u, client->nodes.size());
+    ASSERT_EQ(0u, client->pagedoutnodes);
+    ASSERT_EQ(mega::handle(8), oldest->parent->nodehandle);
+    expectSameCounts(counts, client->mNodeCounters[1]);
+    expectSameCounts(counts, root.subnodeCounts());
+
+    // out again, then walked from the newest down, one version at a time
+    client->pageoutversions();
+    ASSERT_EQ(6u, client->pagedoutnodes);
+    mega::Node* current = client->nodebyhandle(3);
+    client->pageinchildren(current);
+    ASSERT_EQ(1u, current->children.size());
+    mega::Node* version = current->children.back();
+    ASSERT_EQ(mega::handle(4), version->nodehandle);
+    ASSERT_EQ(1u, client->pagedchildren(4));
+    ASSERT_EQ(6u, version->subnodeCounts().versions);
+    expectSameCounts(counts, root.subnodeCounts());
+
+    client->pageinall();
+    ASSERT_EQ(0u, client->pagedoutnodes);
+    expectSameCounts(counts, client->mNodeCounters[1]);
+    expectSameCounts(counts, root.subnodeCounts());
+
+    client->sctable->remove();
+}
+
+TEST(SqliteDbTable, DISABLED_put_benchmark)
+{
+    const size_t count = 20000;
+
+    mega::SymmCipher key;
+    key.setkey((const mega::byte*)std::string(mega::SymmCipher::KEYLENGTH, 'k').data());
+
+    std::vector<Row> rows(count);
+    std::vector<mega::Cacheable*> batch;
+    for (auto& r : rows)
+    {
+        r.payload.assign(200, 'x');
+        batch.push_back(&r);
+    }
+
+    TestTable baseline("unittest_prepare");
+    TestTable a("unittest_put");
+    TestTable b("unittest_putbatch");
+    ASSERT_TRUE(baseline.table && a.table && b.table);
+
+    // the statement compiled for each record, as put() used to
+    sqlite3* db;
+    std::string dbfile = "./megaclient_statecache" + std::to_string(mega::DbAccess::DB_VERSION) + "_unittest_prepare.db";
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+    double prepared = rowsPerSecond(count, [&]()
+    {
+        sqlite3_exec(db, "BEGIN", 0, 0, NULL);
+        for (size_t i = 0; i < count; i++)
+        {
+            std::string blob = rows[i].payload;
+            mega::PaddedCBC::encrypt(baseline.rng, &blob, &key);
+
+            sqlite3_stmt* stmt;
+            sqlite3_prepare(db, "INSERT OR REPLACE INTO statecache (id, content) VALUES (?, ?)", -1, &stmt, NULL);
+            sqlite3_bind_int(stmt, 1, int(i));
+            sqlite3_bind_blob(stmt, 2, blob.data(), int(blob.size()), SQLITE_STATIC);
+            sqlite3_step(stmt);
+            sqlite3_finalize(stmt);
+        }
+        sqlite3_exec(db, "COMMIT", 0, 0, NULL);
+    });
+    sqlite3_close(db);
+
+    double cached = rowsPerSecond(count, [&]()
+    {
+        a.table->begin();
+        for (auto& r : rows)
+        {
+            a.table->put(mega::MegaClient::CACHEDNODE, &r, &key);
+        }
+        a.table->commit();
+    });
+
+    for (auto& r : rows)
+    {
+        r.dbid = 0;
+    }
+    double batched = rowsPerSecond(count, [&]()
+    {
+        ASSERT_TRUE(b.table->putBatch(mega::MegaClient::CACHEDNODE, batch, &key));
+    });
+
+    std::string data;
+    ASSERT_TRUE(b.table->get(rows.back().dbid, &data));
+
+    mt::recordBenchmark("prepared_rows_per_s", prepared);
+    mt::recordBenchmark("cached_rows_per_s", cached);
+    mt::recordBenchmark("batched_rows_per_s", batched);
+
+}
+
+TEST(FileAttributeCache, put_get_replace_evict_reload)
+{
+    TestTable t("unittest_facache");
+    mega::byte keybytes[mega::SymmCipher::KEYLENGTH] = {};
+    mega::SymmCipher key(keybytes);
+    std::string name = "unittest_facache";
+
+    std::string thumbnail(1000, 't');
+    std::string data;
+    {
+        mega::FileAttributeCache cache(t.table.release(), &key, t.rng, 4000);
+        cache.put(1, 0, 100, thumbnail.data(), thumbnail.size());
+        cache.put(2, 0, 200, thumbnail.data(), thumbnail.size());
+        cache.put(2, 1, 201, thumbnail.data(), thumbnail.size());
+
+        ASSERT_TRUE(cache.get(1, 0, 100, &data));
+        ASSERT_EQ(data, thumbnail);
+        ASSERT_TRUE(cache.contains(2, 1, 201));
+        ASSERT_FALSE(cache.get(3, 0, 300, &data));
+
+        // too large for the cache
+        std::string preview(1001, 'p');
+        cache.put(3, 1, 301, preview.data(), preview.size());
+        ASSERT_FALSE(cache.contains(3, 1, 301));
+
+        // a different attribute handle means the node's attribute changed
+        ASSERT_FALSE(cache.get(2, 1, 202, &data));
+        ASSERT_FALSE(cache.contains(2, 1, 201));
+        ASSERT_EQ(cache.count(), 2u);
+
+        cache.put(3, 0, 300, thumbnail.data(), thumbnail.size());
+        cache.put(4, 0, 400, thumbnail.data(), thumbnail.size());
+        ASSERT_EQ(cache.bytes(), 4000u);
+
+        // going over the limit drops the least recently used
+        cache.put(5, 0, 500, thumbnail.data(), thumbnail.size());
+        ASSERT_EQ(cache.count(), 4u);
+        ASSERT_EQ(cache.bytes(), 4000u);
+        ASSERT_LE(cache.contains(1, 0, 100) + cache.contains(2, 0, 200), 1);
+        ASSERT_TRUE(cache.contains(5, 0, 500));
+    }
+
+    // the attributes survive the session
+    mega::FileAttributeCache cache(t.dbaccess.open(t.rng, &t.fsaccess, &name, false, false), &key, t.rng, 4000);
+    ASSERT_EQ(cache.count(), 4u);
+    ASSERT_TRUE(cache.get(5, 0, 500, &data));
+    ASSERT_EQ(data, thumbnail);
+
+    // new records don't collide with the reloaded ones
+    cache.put(6, 0, 600, thumbnail.data(), thumbnail.size());
+    ASSERT_TRUE(cache.get(5, 0, 500, &data));
+    ASSERT_TRUE(cache.get(6, 0, 600, &data));
+
+    cache.setmaxbytes(0);
+    ASSERT_EQ(cache.count(), 0u);
+    cache.remove();
+}
+
+TEST(FileFingerprintCache, get_put_invalidate_reload)
+{
+    TestTable t("unittest_fpcache");
+    mega::byte keybytes[mega::SymmCipher::KEYLENGTH] = {};
+    mega::SymmCipher key(keybytes);
+    std::string name = "unittest_fpcache";
+
+    mega::FileFingerprint fp;
+    fp.size = 1000;
+    fp.mtime = 1500000000;
+    fp.crc = {{1, 2, 3, 4}};
+    fp.isvalid = true;
+
+    mega::FileFingerprint out;
+    {
+        mega::FileFingerprintCache cache(t.table.release(), &key, t.rng, 3);
+        cache.put(10, "a", fp);
+        ASSERT_TRUE(cache.get(10, "a", 1000, 1500000000, &out));
+        ASSERT_EQ(out.crc, fp.crc);
+        ASSERT_TRUE(out.isvalid);
+
+        // any change of size, mtime or path misses
+        ASSERT_FALSE(cache.get(10, "a", 1001, 1500000000, &out));
+        ASSERT_FALSE(cache.get(10, "a", 1000, 1500000001, &out));
+        ASSERT_FALSE(cache.get(10, "b", 1000, 1500000000, &out));
+        ASSERT_FALSE(cache.get(11, "a", 1000, 1500000000, &out));
+
+        // unreadable files aren't cached
+        mega::FileFingerprint bad;
+        cache.put(11, "b", bad);
+        ASSERT_EQ(cache.count(), 1u);
+
+        cache.invalidate(10);
+        ASSERT_FALSE(cache.get(10, "a", 1000, 1500000000, &out));
+
+        // over the limit, the oldest goes
+        for (mega::handle fsid = 1; fsid <= 4; fsid++)
+        {
+            cache.put(fsid, "f", fp);
+        }
+        ASSERT_EQ(cache.count(), 3u);
+        ASSERT_FALSE(cache.get(1, "f", 1000, 1500000000, &out));
+
+        // a new fingerprint replaces the old one
+        fp.crc[0] = 5;
+        cache.put(2, "f", fp);
+        ASSERT_EQ(cache.count(), 3u);
+    }
+
+    // the fingerprints survive the session
+    mega::FileFingerprintCache cache(t.dbaccess.open(t.rng, &t.fsaccess, &name, false, false), &key, t.rng, 3);
+    ASSERT_EQ(cache.count(), 3u);
+    ASSERT_TRUE(cache.get(2, "f", 1000, 1500000000, &out));
+    ASSERT_EQ(out.crc[0], 5);
+    ASSERT_TRUE(cache.get(4, "f", 1000, 1500000000, &out));
+    cache.remove();
+}
+
+#endif
@@ -0,0 +1,327 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "StorageServer.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#include <mega/megaclient.h>
+
+namespace mt {
+
+namespace {
+
+const std::string STORAGE_URL = "http://storage.mega.example/";
+
+// the URL a request was made for, without its range or upload position
+std::string baseof(const std::string& url)
+{
+    return url.substr(0, url.rfind('/'));
+}
+
+} // anonymous
+
+EncryptedFile encryptFile(const std::string& plain, unsigned seed)
+{
+    EncryptedFile file;
+    std::mt19937 rng(seed);
+    mega::byte transferkey[mega::SymmCipher::KEYLENGTH];
+    for (auto& b : transferkey)
+    {
+        b = mega::byte(rng());
+    }
+    int64_t ctriv = int64_t(rng()) << 32 | rng();
+
+    // as TransferSlot encrypts an upload, chunk by chunk, and derives the node key from it
+    mega::SymmCipher cipher(transferkey);
+    mega::chunkmac_map macs;
+    std::string data = plain;
+    data.resize((plain.size() + mega::SymmCipher::BLOCKSIZE - 1) & ~size_t(mega::SymmCipher::BLOCKSIZE - 1));
+    mega::EncryptBufferByChunks eb((mega::byte*)data.data(), &cipher, &macs, ctriv);
+    std::string suffix;
+    eb.encrypt(0, m_off_t(plain.size()), suffix);
+    data.resize(plain.size());
+    file.data = std::move(data);
+
+    memcpy(file.filekey, transferkey, sizeof transferkey);
+    ((int64_t*)file.filekey)[2] = ctriv;
+    ((int64_t*)file.filekey)[3] = macs.macsmac(&cipher);
+    mega::SymmCipher::xorblock(file.filekey + mega::SymmCipher::KEYLENGTH, file.filekey);
+    return file;
+}
+
+std::string decryptFile(const std::string& data, const mega::byte* transferkey, int64_t ctriv)
+{
+    mega::SymmCipher cipher(transferkey);
+    std::string plain = data;
+    plain.resize((data.size() + mega::SymmCipher::BLOCKSIZE - 1) & ~size_t(mega::SymmCipher::BLOCKSIZE - 1));
+    cipher.ctr_crypt((mega::byte*)plain.data(), unsigned(data.size()), 0, ctriv, nullptr, false);
+    plain.resize(data.size());
+    return plain;
+}
+
+std::vector<std::string> StorageServer::serveDownload(const std::string& name, const std::string& data, bool raid)
+{
+    std::string url = STORAGE_URL + "dl/" + name;
+    if (!raid)
+    {
+        objects[url].data = data;
+        return {url};
+    }
+
+    // the data parts take the sectors of each line in turn, and part 0 is their parity
+    const size_t lines = (data.size() + mega::RAIDLINE - 1) / mega::RAIDLINE;
+    std::string padded = data;
+    padded.resize(lines * mega::RAIDLINE, '\0');
+
+    std::vector<std::string> parts(mega::RAIDPARTS, std::string(lines * mega::RAIDSECTOR, '\0'));
+    for (size_t line = 0; line < lines; line++)
+    {
+        for (unsigned j = 1; j < mega::RAIDPARTS; j++)
+        {
+            const char* sector = padded.data() + line * mega::RAIDLINE + (j - 1) * mega::RAIDSECTOR;
+            memcpy(&parts[j][line * mega::RAIDSECTOR], sector, mega::RAIDSECTOR);
+            for (unsigned k = 0; k < mega::RAIDSECTOR; k++)
+            {
+                parts[0][line * mega::RAIDSECTOR + k] ^= sector[k];
+            }
+        }
+    }
+
+    std::vector<std::string> urls;
+    for (unsigned j = 0; j < mega::RAIDPARTS; j++)
+    {
+        parts[j].resize(size_t(mega::RaidBufferManager::raidPartSize(j, m_off_t(data.size()))));
+        urls.push_back(url + ".part" + std::to_string(j));
+        objects[urls.back()].data = std::move(parts[j]);
+    }
+    return urls;
+}
+
+std::string StorageServer::acceptUpload(const std::string& name, m_off_t size)
+{
+    std::string url = STORAGE_URL + "ul/" + name;
+    Object& o = objects[url];
+    o.upload = true;
+    o.size = size;
+    return url;
+}
+
+StorageBehaviour& StorageServer::behaviour(const std::string& url)
+{
+    return objects[url].behaviour;
+}
+
+std::string StorageServer::uploaded(const std::string& url) const
+{
+    std::string data;
+    auto it = objects.find(url);
+    if (it != objects.end())
+    {
+        for (auto& chunk : it->second.chunks)
+        {
+            data.resize(size_t(chunk.first));
+            data += chunk.second;
+        }
+    }
+    return data;
+}
+
+m_off_t StorageServer::tokenSize(const std::string& token) const
+{
+    auto it = tokens.find(token);
+    return it == tokens.end() ? -1 : it->second;
+}
+
+void StorageServer::post(mega::HttpReq* req, const char* data, unsigned len)
+{
+    requests++;
+    req->in.clear();
+    req->status = mega::REQ_INFLIGHT;
+
+    auto it = objects.find(baseof(req->posturl));
+    std::string tail = req->posturl.substr(req->posturl.rfind('/') + 1);
+    if (it == objects.end())
+    {
+        req->httpstatus = 404;
+        req->status = mega::REQ_FAILURE;
+        req->httpio = nullptr;
+        return;
+    }
+
+    std::unique_ptr<Response> r(new Response);
+    r->req = req;
+    r->object = &it->second;
+    r->start = clock::now();
+    if (r->object->upload)
+    {
+        // <pos>?c=<crc>
+        r->pos = atoll(tail.c_str());
+        r->body.assign(data ? data : "", len);
+        r->size = len;
+    }
+    else
+    {
+        // <first>-<last>, both included
+        m_off_t first = atoll(tail.c_str());
+        m_off_t last = atoll(tail.c_str() + tail.find('-') + 1);
+        r->pos = std::min(first, m_off_t(r->object->data.size()));
+        r->size = std::min(last + 1, m_off_t(r->object->data.size())) - r->pos;
+    }
+
+    StorageBehaviour& b = r->object->behaviour;
+    r->fails = b.failures > 0;
+    if (r->fails)
+    {
+        b.failures--;
+        failed++;
+    }
+
+    req->httpiohandle = r.get();
+    inflight[req] = std::move(r);
+}
+
+void StorageServer::cancel(mega::HttpReq* req)
+{
+    if (inflight.erase(req))
+    {
+        req->httpstatus = 0;
+        req->status = mega::REQ_FAILURE;
+        req->httpiohandle = nullptr;
+    }
+}
+
+m_off_t StorageServer::postpos(void* handle)
+{
+    return handle ? static_cast<Response*>(handle)->sent : 0;
+}
+
+bool StorageServer::doio()
+{
+    bool changed = false;
+    clock::time_point now = clock::now();
+    for (auto it = inflight.begin(); it != inflight.end(); )
+    {
+        Response& r = *it++->second;
+        const StorageBehaviour& b = r.object->behaviour;
+        double seconds = std::chrono::duration<double>(now - r.start).count() - b.latencyMs / 1000.0;
+        if (seconds < 0)
+        {
+            continue;
+        }
+
+        if (!r.started)
+        {
+            r.started = true;
+            r.req->ttfbms = int(std::chrono::duration_cast<std::chrono::milliseconds>(now - r.start).count());
+            changed = true;
+            if (r.fails && !b.failAfter)
+            {
+                r.req->httpstatus = b.failStatus;
+                finish(r, mega::REQ_FAILURE);
+                continue;
+            }
+
+            r.req->httpstatus = 200;
+            if (!r.object->upload)
+            {
+                r.req->setcontentlength(r.size);
+            }
+        }
+
+        m_off_t due = b.bytesPerSecond > 0 ? std::min(r.size, m_off_t(seconds * b.bytesPerSecond)) : r.size;
+        if (r.fails)
+        {
+            due = std::min(due, b.failAfter);
+        }
+
+        if (due > r.sent)
+        {
+            if (!r.object->upload)
+            {
+                r.req->put((void*)(r.object->data.data() + r.pos + r.sent), unsigned(due - r.sent), true);
+            }
+            r.sent = due;
+            r.req->lastdata = mega::Waiter::ds;
+            lastdata = mega::Waiter::ds;
+            changed = true;
+        }
+
+        if (r.fails && r.sent >= std::min(b.failAfter, r.size))
+        {
+            finish(r, mega::REQ_FAILURE);
+        }
+        else if (r.sent == r.size)
+        {
+            if (r.object->upload)
+            {
+                Object& o = *r.object;
+                m_off_t received = 0;
+                o.chunks[r.pos] = std::move(r.body);
+                for (auto& chunk : o.chunks)
+                {
+                    received += m_off_t(chunk.second.size());
+                }
+
+                if (received == o.size)
+                {
+                    // a new style token: binary, ending in 1, and unique
+                    r.req->in.assign(mega::NewNode::UPLOADTOKENLEN, '\0');
+                    ++nextToken;
+                    memcpy(&r.req->in[0], &nextToken, sizeof nextToken);
+                    r.req->in[mega::NewNode::UPLOADTOKENLEN - 1] = 1;
+                    tokens[r.req->in] = o.size;
+                }
+            }
+            finish(r, mega::REQ_SUCCESS);
+        }
+    }
+    return changed;
+}
+
+void StorageServer::finish(Response& r, mega::reqstatus_t status)
+{
+    mega::HttpReq* req = r.req;
+    req->elapsedms = int(std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - r.start).count());
+    req->status = status;
+    req->httpiohandle = nullptr;
+    req->httpio = nullptr;
+    if (status == mega::REQ_SUCCESS)
+    {
+        req->lastdata = mega::Waiter::ds;
+    }
+    if (req->httpstatus)
+    {
+        // the network works, even if the request did not
+        success = true;
+    }
+    inflight.erase(req);
+}
+
+StorageServer::~StorageServer()
+{
+    for (auto& r : inflight)
+    {
+        r.first->httpiohandle = nullptr;
+        r.first->httpio = nullptr;
+    }
+}
+
+} // mt
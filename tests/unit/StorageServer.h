@@ -0,0 +1,122 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <mega/http.h>
+
+namespace mt {
+
+// How the server answers the requests to one URL (a file, or one CloudRAID part of it)
+struct StorageBehaviour
+{
+    int latencyMs = 0;              // before the first byte of each response
+    double bytesPerSecond = 0;      // of each response (0: as fast as the client takes them)
+    unsigned failures = 0;          // requests that fail before the others succeed...
+    int failStatus = 503;           // ...with this status (0: no reply at all, as a dropped connection)...
+    m_off_t failAfter = 0;          // ...or, if set, with a 200 and this many bytes before the connection drops
+};
+
+// A file encrypted the way the client uploads it, and the node key that decrypts it
+struct EncryptedFile
+{
+    std::string data;
+    mega::byte filekey[mega::FILENODEKEYLENGTH];
+};
+
+EncryptedFile encryptFile(const std::string& plain, unsigned seed);
+
+// the plain contents of an uploaded file, from what the server received and the transfer's key and IV
+std::string decryptFile(const std::string& data, const mega::byte* transferkey, int64_t ctriv);
+
+// Storage servers in memory, as the HttpIO of a client that has its temporary URLs already:
+// they serve downloads of registered files (whole, or split into the six CloudRAID parts) with
+// the range requests of TransferSlot, and take the chunks of uploads, replying to the one
+// that completes a file with an upload token.
+// The time of each response follows the behaviour of its URL, on the wall clock
+class StorageServer : public mega::HttpIO
+{
+public:
+    // the temporary URL of the file (1) or of each of its parts (RAIDPARTS)
+    std::vector<std::string> serveDownload(const std::string& name, const std::string& data, bool raid);
+    std::string acceptUpload(const std::string& name, m_off_t size);
+
+    StorageBehaviour& behaviour(const std::string& url);
+
+    // what an upload has received so far, in order
+    std::string uploaded(const std::string& url) const;
+
+    // the size of the upload that replied with this token (-1: none did)
+    m_off_t tokenSize(const std::string& token) const;
+
+    // whether any request is in flight
+    bool busy() const { return !inflight.empty(); }
+
+    // requests posted, and those that failed on purpose
+    unsigned requests = 0;
+    unsigned failed = 0;
+
+    void addevents(mega::Waiter*, int) override {}
+    void post(mega::HttpReq*, const char* = NULL, unsigned = 0) override;
+    void cancel(mega::HttpReq*) override;
+    m_off_t postpos(void*) override;
+    bool doio(void) override;
+    void setuseragent(std::string*) override {}
+
+    ~StorageServer();
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct Object
+    {
+        std::string data;
+        m_off_t size = 0;                           // of an upload: complete when data.size() reaches it
+        bool upload = false;
+        std::map<m_off_t, std::string> chunks;      // of an upload, by position
+        StorageBehaviour behaviour;
+    };
+
+    struct Response
+    {
+        mega::HttpReq* req;
+        Object* object;
+        clock::time_point start;
+        m_off_t pos;
+        m_off_t size;
+        m_off_t sent = 0;
+        bool fails;
+        bool started = false;
+        std::string body;                           // of an upload chunk
+    };
+
+    std::map<std::string, Object> objects;
+    std::map<mega::HttpReq*, std::unique_ptr<Response>> inflight;
+    std::map<std::string, m_off_t> tokens;
+    uint32_t nextToken = 0;
+
+    void finish(Response& r, mega::reqstatus_t status);
+};
+
+} // mt
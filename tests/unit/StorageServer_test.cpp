@@ -0,0 +1,534 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <mega.h>
+
+#include "StorageServer.h"
+#include "utils.h"
+
+namespace {
+
+const m_off_t MB = 1 << 20;
+
+std::string randomData(size_t size, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::string data(size, '\0');
+    for (auto& c : data)
+    {
+        c = char(rng());
+    }
+    return data;
+}
+
+std::string readFile(const std::string& path)
+{
+    std::ifstream f(path, std::ios::binary);
+    std::ostringstream s;
+    s << f.rdbuf();
+    return s.str();
+}
+
+// The file of a transfer, which records how it ended instead of going on to the API
+struct TransferFile : mega::File
+{
+    bool done = false;
+    mega::error result = mega::API_OK;
+    mega::byte transferkey[mega::SymmCipher::KEYLENGTH];
+    int64_t ctriv = 0;
+
+    void completed(mega::Transfer* t, mega::LocalNode*) override
+    {
+        memcpy(transferkey, t->transferkey, sizeof transferkey);
+        ctriv = t->ctriv;
+        done = true;
+    }
+
+    bool failed(mega::error e) override
+    {
+        result = e;
+        done = true;
+        return false;
+    }
+};
+
+// A client with real files, whose transfers know their URLs already: nothing goes to the API
+template <class FileSystemAccess = mega::FSACCESS_CLASS>
+struct BasicOfflineClient
+{
+    mega::MegaApp app;
+    mt::StorageServer server;
+    FileSystemAccess fsaccess;
+    mega::MegaClient client{&app, nullptr, &server, &fsaccess, nullptr, nullptr, "XXX", "unit_test"};
+
+    // starts the transfer of f and runs the client's transfer loop until it ends (false: it did not, in time)
+    bool transfer(mega::direction_t d, TransferFile& f, std::vector<std::string> urls, unsigned connections)
+    {
+        client.connections[d] = static_cast<unsigned char>(connections);
+        {
+            mega::DBTableTransactionCommitter committer(client.tctable);
+            if (!client.startxfer(d, &f, committer))
+            {
+                return false;
+            }
+        }
+        f.transfer->tempurls = std::move(urls);
+        client.dispatchTransfers();
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::minutes(2);
+        while (!f.done)
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+            {
+                client.stopxfer(&f, nullptr);
+                return false;
+            }
+
+            mega::Waiter::bumpds();
+            bool io = server.doio();
+
+            // what MegaClient::exec() does with the active transfers.  A failed chunk is retried once
+            // another reply shows the network works: with no API traffic here, an idle server will do
+            if (!server.busy())
+            {
+                server.success = true;
+            }
+            client.retryfailedchunks();
+
+            mega::DBTableTransactionCommitter committer(client.tctable);
+            client.slotit = client.tslots.begin();
+            while (client.slotit != client.tslots.end())
+            {
+                mega::TransferSlot* slot = *client.slotit++;
+                if (!slot->retrying || slot->retrybt.armed())
+                {
+                    slot->doio(&client, committer);
+                }
+            }
+
+            if (!io)
+            {
+                // waiting on the server: the latency or bandwidth of its responses
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+        return f.result == mega::API_OK;
+    }
+
+    // downloads a file served from urls to `path`
+    bool download(const std::string& path, const mt::EncryptedFile& file, std::vector<std::string> urls, unsigned connections)
+    {
+        TransferFile f;
+        f.name = path;
+        f.localname = path;
+        f.h = 1;
+        f.hprivate = false;
+        f.hforeign = false;
+        f.size = m_off_t(file.data.size());
+        memcpy(f.filekey, file.filekey, sizeof f.filekey);
+        return transfer(mega::GET, f, std::move(urls), connections);
+    }
+
+    // uploads the file at `path` to url, and decrypts what the server got
+    bool upload(const std::string& path, const std::string& url, unsigned connections, std::string& received)
+    {
+        if (!client.nodebyhandle(1))
+        {
+            mt::makeNode(client, mega::FOLDERNODE, 1);
+        }
+
+        TransferFile f;
+        f.name = path;
+        f.localname = path;
+        f.h = 1;
+        if (!transfer(mega::PUT, f, {url}, connections))
+        {
+            return false;
+        }
+        received = mt::decryptFile(server.uploaded(url), f.transferkey, f.ctriv);
+        return true;
+    }
+};
+
+using OfflineClient = BasicOfflineClient<>;
+
+#ifndef _WIN32
+// Real files that record the position and size of each write
+struct WriteRecordingFileSystemAccess : mega::PosixFileSystemAccess
+{
+    std::vector<std::pair<m_off_t, unsigned>> writes;
+
+    struct FileAccess : mega::PosixFileAccess
+    {
+        std::vector<std::pair<m_off_t, unsigned>>& writes;
+
+        FileAccess(mega::Waiter* w, std::vector<std::pair<m_off_t, unsigned>>& wr)
+            : mega::PosixFileAccess(w), writes(wr)
+        {
+        }
+
+        bool fwrite(const mega::byte* data, unsigned len, m_off_t pos) override
+        {
+            writes.emplace_back(pos, len);
+            return mega::PosixFileAccess::fwrite(data, len, pos);
+        }
+
+        void asyncsyswrite(mega::AsyncIOContext* context) override
+        {
+            writes.emplace_back(context->pos, context->len);
+            mega::PosixFileAccess::asyncsyswrite(context);
+        }
+    };
+
+    std::unique_ptr<mega::FileAccess> newfileaccess(bool) override
+    {
+        return std::unique_ptr<mega::FileAccess>(new FileAccess(waiter, writes));
+    }
+};
+#endif
+
+}
+
+TEST(StorageServer, downloadsPlainAndRaidFiles)
+{
+    OfflineClient c;
+    const std::string plain = randomData(size_t(3 * MB + 12345), 1);
+    const mt::EncryptedFile file = mt::encryptFile(plain, 2);
+
+    ASSERT_TRUE(c.download("storageserver_plain", file, c.server.serveDownload("plain", file.data, false), 3));
+    ASSERT_EQ(plain, readFile("storageserver_plain"));
+
+    ASSERT_TRUE(c.download("storageserver_raid", file, c.server.serveDownload("raid", file.data, true), 1));
+    ASSERT_EQ(plain, readFile("storageserver_raid"));
+    ASSERT_EQ(0u, c.server.failed);
+
+    remove("storageserver_plain");
+    remove("storageserver_raid");
+}
+
+#ifndef _WIN32
+TEST(StorageServer, coalescedDownloadWritesAreLargeAndSequential)
+{
+    BasicOfflineClient<WriteRecordingFileSystemAccess> c;
+    const size_t limit = size_t(2 * MB);
+    c.client.coalesceddownloadwrites = limit;
+    c.client.orderdownloadedchunks = true;
+    const std::string plain = randomData(size_t(5 * MB + 4321), 9);
+    const mt::EncryptedFile file = mt::encryptFile(plain, 10);
+
+    // in order, the pieces of all connections go out front to back in a few large writes
+    ASSERT_TRUE(c.download("storageserver_coalesced", file, c.server.serveDownload("coalesced", file.data, false), 3));
+    ASSERT_EQ(plain, readFile("storageserver_coalesced"));
+    ASSERT_LE(c.fsaccess.writes.size(), 5u);
+    m_off_t end = 0;
+    for (auto& w : c.fsaccess.writes)
+    {
+        ASSERT_EQ(end, w.first);
+        ASSERT_LE(w.second, limit);
+        end += w.second;
+    }
+    ASSERT_EQ(m_off_t(plain.size()), end);
+
+    // out of order, and raid, the data still all arrives
+    c.client.orderdownloadedchunks = false;
+    ASSERT_TRUE(c.download("storageserver_coalesced", file, c.server.serveDownload("coalesced_unordered", file.data, false), 3));
+    ASSERT_EQ(plain, readFile("storageserver_coalesced"));
+    ASSERT_TRUE(c.download("storageserver_coalesced", file, c.server.serveDownload("coalesced_raid", file.data, true), 1));
+    ASSERT_EQ(plain, readFile("storageserver_coalesced"));
+
+    remove("storageserver_coalesced");
+}
+#endif
+
+TEST(StorageServer, raidDownloadOutlastsAFailingAndASlowPart)
+{
+    OfflineClient c;
+    c.client.settransfercryptothreads(2);
+    const std::string plain = randomData(size_t(5 * MB + 999), 3);
+    const mt::EncryptedFile file = mt::encryptFile(plain, 4);
+    std::vector<std::string> urls = c.server.serveDownload("faulty", file.data, true);
+
+    // a connection dropped part way through a request, and a part that lags behind the others
+    mt::StorageBehaviour& failing = c.server.behaviour(urls[2]);
+    failing.failures = 1;
+    failing.failAfter = 100000;
+    c.server.behaviour(urls[4]).latencyMs = 300;
+    for (auto& url : urls)
+    {
+        c.server.behaviour(url).bytesPerSecond = 4.0 * MB;
+    }
+
+    ASSERT_TRUE(c.download("storageserver_faulty", file, urls, 1));
+    ASSERT_EQ(plain, readFile("storageserver_faulty"));
+    ASSERT_EQ(1u, c.server.failed);
+
+    remove("storageserver_faulty");
+}
+
+TEST(StorageServer, uploadArrivesEncryptedWithTheTransferKey)
+{
+    OfflineClient c;
+    const std::string plain = randomData(size_t(4 * MB + 77), 5);
+    {
+        std::ofstream f("storageserver_upload", std::ios::binary);
+        f << plain;
+    }
+
+    std::string url = c.server.acceptUpload("upload", m_off_t(plain.size()));
+    c.server.behaviour(url).failures = 1;
+    std::string received;
+    ASSERT_TRUE(c.upload("storageserver_upload", url, 3, received));
+    ASSERT_EQ(plain, received);
+
+    remove("storageserver_upload");
+}
+
+TEST(StorageServer, uploadEncryptedOnTheCryptoPoolArrivesIntact)
+{
+    OfflineClient c;
+    c.client.settransfercryptothreads(2);
+    const std::string plain = randomData(size_t(6 * MB + 4099), 6);
+    {
+        std::ofstream f("storageserver_upload_pool", std::ios::binary);
+        f << plain;
+    }
+
+    // a chunk sent again after a failure goes as it was encrypted
+    std::string url = c.server.acceptUpload("upload_pool", m_off_t(plain.size()));
+    c.server.behaviour(url).failures = 1;
+    std::string received;
+    ASSERT_TRUE(c.upload("storageserver_upload_pool", url, 4, received));
+    ASSERT_EQ(plain, received);
+
+    remove("storageserver_upload_pool");
+}
+
+TEST(UploadReadahead, servesChunksReadAheadAndMissesTheRest)
+{
+    const std::string plain = randomData(size_t(5 * MB + 333), 11);
+    {
+        std::ofstream f("storageserver_readahead", std::ios::binary);
+        f << plain;
+    }
+
+    mega::WAIT_CLASS waiter;
+    mega::FSACCESS_CLASS fsaccess;
+    std::string localname = "storageserver_readahead";
+    auto fa = fsaccess.newfileaccess();
+    ASSERT_TRUE(fa->fopen(&localname));
+    auto pool = std::make_shared<mega::BufferPool>(size_t(8 * MB));
+
+    // taken in order, each chunk comes from memory once the reader got to it
+    {
+        mega::UploadReadahead readahead(&fsaccess, localname, fa->size, fa->mtime, 0, size_t(2 * MB), pool, &waiter);
+        std::string read(plain.size(), '\0');
+        const unsigned chunk = 300000;
+        for (m_off_t pos = 0; pos < m_off_t(plain.size()); pos += chunk)
+        {
+            unsigned len = unsigned(std::min<m_off_t>(chunk, m_off_t(plain.size()) - pos));
+            mega::UploadReadahead::result_t r;
+            while ((r = readahead.take((mega::byte*)&read[size_t(pos)], len, pos)) == mega::UploadReadahead::PENDING)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            ASSERT_EQ(mega::UploadReadahead::READ, r) << pos;
+        }
+        ASSERT_EQ(plain, read);
+
+        // taken already
+        ASSERT_EQ(mega::UploadReadahead::MISSED, readahead.take((mega::byte*)&read[0], 1000, 0));
+    }
+
+    // far beyond the window, and for a file that changed since
+    {
+        std::string read(1000, '\0');
+        mega::UploadReadahead readahead(&fsaccess, localname, fa->size, fa->mtime, 0, size_t(1 * MB), pool, &waiter);
+        ASSERT_EQ(mega::UploadReadahead::MISSED, readahead.take((mega::byte*)&read[0], 1000, 4 * MB));
+
+        mega::UploadReadahead changed(&fsaccess, localname, fa->size + 1, fa->mtime, 0, size_t(1 * MB), pool, &waiter);
+        mega::UploadReadahead::result_t r;
+        while ((r = changed.take((mega::byte*)&read[0], 1000, 0)) == mega::UploadReadahead::PENDING)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ASSERT_EQ(mega::UploadReadahead::MISSED, r);
+    }
+
+    // and through an upload
+    OfflineClient c;
+    c.client.uploadreadahead = size_t(2 * MB);
+    std::string url = c.server.acceptUpload("readahead", m_off_t(plain.size()));
+    std::string received;
+    ASSERT_TRUE(c.upload("storageserver_readahead", url, 3, received));
+    ASSERT_EQ(plain, received);
+
+    remove("storageserver_readahead");
+}
+
+// Downloads and uploads through the whole transfer engine (TransferSlot, the raid buffers, the
+// crypto, the file writes) from the storage server in memory: with no latency nor bandwidth limit,
+// so the client is the bottleneck, at different connection counts; then a shaped, faulty raid
+// download. Reports MB/s, the CPU seconds per GB moved and the memory of each
+TEST(PartialDownloadCheck, keepsTheLeadingChunksThatAreThere)
+{
+    // written up to 1.5 MB, and preallocated (zeros) up to its size
+    const std::string plain = randomData(size_t(3 * MB + 333), 12);
+    {
+        std::ofstream f("storageserver_partial", std::ios::binary);
+        f << plain.substr(0, size_t(MB + MB / 2)) << std::string(plain.size() - size_t(MB + MB / 2), '\0');
+    }
+
+    mega::WAIT_CLASS waiter;
+    mega::FSACCESS_CLASS fsaccess;
+    std::string localname = "storageserver_partial";
+    mega::byte key[mega::SymmCipher::KEYLENGTH] = { 3, 1, 4 };
+    const int64_t ctriv = 0x1122334455667788;
+    const m_off_t size = m_off_t(plain.size());
+
+    mega::chunkmac_map macs;
+    {
+        mega::PartialDownloadCheck check(&fsaccess, localname, size, key, ctriv, 3, &waiter);
+        while (!check.finished())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        // 128K + 256K + 384K + 512K: the chunk at 1.25 MB is not all there
+        ASSERT_EQ(m_off_t(1280 * 1024), check.take(&macs));
+    }
+    ASSERT_EQ(4u, macs.size());
+
+    // the MACs are the ones of the plain chunks
+    mega::SymmCipher cipher;
+    cipher.setkey(key);
+    for (auto& it : macs)
+    {
+        m_off_t end = mega::ChunkedHash::chunkceil(it.first, size);
+        std::string chunk = plain.substr(size_t(it.first), size_t(end - it.first));
+        mega::byte mac[mega::SymmCipher::BLOCKSIZE];
+        cipher.ctr_crypt((mega::byte*)&chunk[0], unsigned(chunk.size()), it.first, ctriv, mac, true);
+        ASSERT_TRUE(it.second.finished);
+        ASSERT_EQ(0, memcmp(mac, it.second.mac, sizeof mac)) << it.first;
+    }
+
+    // nothing to resume from a missing file
+    {
+        mega::PartialDownloadCheck check(&fsaccess, "storageserver_nopartial", size, key, ctriv, 2, &waiter);
+        while (!check.finished())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        mega::chunkmac_map none;
+        ASSERT_EQ(0, check.take(&none));
+        ASSERT_TRUE(none.empty());
+    }
+
+    remove("storageserver_partial");
+}
+
+TEST(StorageServer, DISABLED_transfer_benchmark)
+{
+    const m_off_t size = 64 * MB;
+    const std::string plain = randomData(size_t(size), 6);
+    const mt::EncryptedFile file = mt::encryptFile(plain, 7);
+    {
+        std::ofstream f("storageserver_benchmark_upload", std::ios::binary);
+        f << plain;
+    }
+
+    auto run = [size](const std::string& name, std::function<bool()> f)
+    {
+        double cpu = mt::cpuSeconds();
+        bool ok = false;
+        double ms = mt::elapsedMs([&]() { ok = f(); });
+        cpu = mt::cpuSeconds() - cpu;
+        ASSERT_TRUE(ok) << name;
+
+        double mbps = size / double(MB) / (ms / 1000);
+        double cpuPerGB = cpu / (size / double(1 << 30));
+        long rss = mt::residentMemoryKB();
+        long peak = mt::peakMemoryKB();
+        mt::recordBenchmark(name + "_mb_s", mbps);
+        mt::recordBenchmark(name + "_cpu_s_per_gb", cpuPerGB);
+        mt::recordBenchmark(name + "_rss_kb", double(rss));
+        mt::recordBenchmark(name + "_peak_rss_kb", double(peak));
+    };
+
+    for (unsigned connections : { 1, 2, 4, 6 })
+    {
+        OfflineClient c;
+        auto urls = c.server.serveDownload("plain", file.data, false);
+        run("download_" + std::to_string(connections), [&]()
+        {
+            return c.download("storageserver_benchmark", file, urls, connections) && readFile("storageserver_benchmark") == plain;
+        });
+    }
+
+    for (unsigned threads : { 0, 4 })
+    {
+        OfflineClient c;
+        c.client.settransfercryptothreads(threads);
+        auto urls = c.server.serveDownload("raid", file.data, true);
+        run("download_raid_crypto" + std::to_string(threads), [&]()
+        {
+            return c.download("storageserver_benchmark", file, urls, 1) && readFile("storageserver_benchmark") == plain;
+        });
+    }
+
+    {
+        // 40 MB/s over five parts, one of them dropping once and another lagging far behind
+        OfflineClient c;
+        auto urls = c.server.serveDownload("raid", file.data, true);
+        for (auto& url : urls)
+        {
+            c.server.behaviour(url).latencyMs = 20;
+            c.server.behaviour(url).bytesPerSecond = 8.0 * MB;
+        }
+        c.server.behaviour(urls[1]).failures = 1;
+        c.server.behaviour(urls[1]).failAfter = MB;
+        c.server.behaviour(urls[5]).latencyMs = 500;
+        run("download_raid_shaped", [&]()
+        {
+            return c.download("storageserver_benchmark", file, urls, 1) && readFile("storageserver_benchmark") == plain;
+        });
+    }
+
+    for (unsigned connections : { 1, 3, 6 })
+    {
+        OfflineClient c;
+        std::string url = c.server.acceptUpload("upload", size);
+        run("upload_" + std::to_string(connections), [&]()
+        {
+            std::string received;
+            return c.upload("storageserver_benchmark_upload", url, connections, received) && received == plain;
+        });
+    }
+
+    remove("storageserver_benchmark");
+    remove("storageserver_benchmark_upload");
+}
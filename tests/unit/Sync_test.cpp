@@ -17,9 +17,11 @@
  */
 
 #include <memory>
+#include <thread>
 
 #include <gtest/gtest.h>
 
+#include <mega.h>
 #include <mega/megaclient.h>
 #include <mega/megaapp.h>
 #include <mega/types.h>
@@ -274,6 +276,29 @@ struct Fixture
 
 }
 
+TEST(FileSystemAccess, normalize_composesNonAsciiAndLeavesAsciiAlone)
+{
+    mt::DefaultedFileSystemAccess fsaccess;
+
+    std::string name = "a plain name, longer than a vector.txt";
+    fsaccess.normalize(&name);
+    ASSERT_EQ("a plain name, longer than a vector.txt", name);
+
+    // e + combining acute, before and after an ASCII run and a NUL byte
+    name = std::string("caf") + "e\xcc\x81" + std::string(1, '\0') + "long enough to be vectorised e\xcc\x81";
+    fsaccess.normalize(&name);
+    ASSERT_EQ(std::string("caf\xc3\xa9") + std::string(1, '\0') + "long enough to be vectorised \xc3\xa9", name);
+
+    name = "d\xc3\xa9j\xc3\xa0 NFC";
+    fsaccess.normalize(&name);
+    ASSERT_EQ("d\xc3\xa9j\xc3\xa0 NFC", name);
+
+    // not UTF-8
+    name = "bad \xff name";
+    fsaccess.normalize(&name);
+    ASSERT_TRUE(name.empty());
+}
+
 TEST(Sync, isPathSyncable)
 {
     ASSERT_TRUE(mega::isPathSyncable("dir/foo", "dir/foo" + mt::gLocalDebris, "/"));
@@ -309,6 +334,250 @@ void test_computeReversePathMatchScore(const std::string& sep)
 
 }
 
+TEST(Sync, affectssync_onlyForSyncedNodesAndTheirAncestors)
+{
+    MockApp app;
+    mt::DefaultedFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    auto& root = mt::makeNode(*client, mega::FOLDERNODE, 1);
+    auto& outside = mt::makeNode(*client, mega::FILENODE, 2, &root);
+    ASSERT_FALSE(client->affectssync(&outside));
+
+    auto sync = mt::makeSync(*client, "d");
+    mega::Node* syncroot = sync->localroot->node;
+    syncroot->setparent(&root);
+    auto& inside = mt::makeNode(*client, mega::FILENODE, 3, syncroot);
+
+    ASSERT_TRUE(client->affectssync(syncroot));
+    ASSERT_TRUE(client->affectssync(&inside));
+    ASSERT_TRUE(client->affectssync(&root));
+    ASSERT_FALSE(client->affectssync(&outside));
+    ASSERT_FALSE(client->affectssync(nullptr));
+}
+
+TEST(Sync, localnodebypath_findsChildrenOfLargeFoldersThroughTheIndex)
+{
+    Fixture fx{"d"};
+    mega::LocalNode& ld = *fx.mSync->localroot;
+    auto ld_0 = mt::makeLocalNode(*fx.mSync, ld, mega::FOLDERNODE, "d_0", {});
+    ASSERT_EQ(nullptr, ld_0->childindex);
+
+    std::vector<std::unique_ptr<mega::LocalNode>> files;
+    for (size_t i = 0; i < mega::LocalNode::CHILDINDEX_THRESHOLD; ++i)
+    {
+        files.push_back(mt::makeLocalNode(*fx.mSync, *ld_0, mega::FILENODE, "f_" + std::to_string(i), {}));
+    }
+    ASSERT_NE(nullptr, ld_0->childindex);
+    ASSERT_EQ(files.size(), ld_0->childindex->size());
+
+    std::string path = "d/d_0/f_7";
+    ASSERT_EQ(files[7].get(), fx.mSync->localnodebypath(nullptr, &path));
+
+    std::string name = "f_8";
+    ASSERT_EQ(files[8].get(), ld_0->childbyname(&name));
+
+    // renamed within the folder
+    std::string newpath = "d/d_0/renamed";
+    files[8]->setnameparent(ld_0.get(), &newpath);
+    ASSERT_EQ(nullptr, ld_0->childbyname(&name));
+    name = "renamed";
+    ASSERT_EQ(files[8].get(), ld_0->childbyname(&name));
+    ASSERT_EQ(files.size(), ld_0->childindex->size());
+
+    // gone
+    files[8].reset();
+    ASSERT_EQ(nullptr, ld_0->childbyname(&name));
+    ASSERT_EQ(files.size() - 1, ld_0->childindex->size());
+
+    std::string residual;
+    mega::LocalNode* parent = nullptr;
+    path = "d/d_0/missing";
+    ASSERT_EQ(nullptr, fx.mSync->localnodebypath(nullptr, &path, &parent, &residual));
+    ASSERT_EQ(ld_0.get(), parent);
+    ASSERT_EQ("missing", residual);
+}
+
+TEST(Sync, setsyncdirty_flagsTheNodeAndItsAncestorsOnly)
+{
+    Fixture fx{"d"};
+    mega::LocalNode& ld = *fx.mSync->localroot;
+    auto ld_1 = mt::makeLocalNode(*fx.mSync, ld, mega::FOLDERNODE, "d_1", {});
+    auto ld_0 = mt::makeLocalNode(*fx.mSync, ld, mega::FOLDERNODE, "d_0", {});
+    auto lf_0_0 = mt::makeLocalNode(*fx.mSync, *ld_0, mega::FILENODE, "f_0_0", {});
+
+    // new nodes have yet to be looked at
+    ASSERT_TRUE(lf_0_0->syncdowndirty && lf_0_0->syncupdirty);
+
+    for (auto l : {&ld, ld_0.get(), lf_0_0.get(), ld_1.get()})
+    {
+        l->syncdowndirty = l->syncupdirty = false;
+    }
+
+    lf_0_0->setsyncdirty();
+    for (auto l : {&ld, ld_0.get(), lf_0_0.get()})
+    {
+        ASSERT_TRUE(l->syncdowndirty && l->syncupdirty);
+    }
+    ASSERT_FALSE(ld_1->syncdowndirty || ld_1->syncupdirty);
+
+    // moving a node flags both folders
+    for (auto l : {&ld, ld_0.get(), lf_0_0.get()})
+    {
+        l->syncdowndirty = l->syncupdirty = false;
+    }
+    std::string newpath = "d/d_1/f_0_0";
+    lf_0_0->setnameparent(ld_1.get(), &newpath);
+    ASSERT_TRUE(ld_0->syncdowndirty && ld_0->syncupdirty);
+    ASSERT_TRUE(ld_1->syncdowndirty && ld_1->syncupdirty);
+    ASSERT_TRUE(ld.syncdowndirty && ld.syncupdirty);
+}
+
+TEST(Sync, bumpnagleds_followsTheCadenceOfFilesThatKeepChanging)
+{
+    Fixture fx{"d"};
+    mega::Waiter::ds = 1000;
+    auto lf = mt::makeLocalNode(*fx.mSync, *fx.mSync->localroot, mega::FILENODE, "f", {});
+    lf->nagleinitialds = 0;
+
+    // a one-off change waits the usual delay, and no longer once its writer closed it
+    lf->lastchangeds = 0;
+    lf->bumpnagleds();
+    ASSERT_EQ(lf->nagleds, 1000 + mega::Sync::FILE_NAGLE_DS);
+    lf->closewritten();
+    ASSERT_EQ(lf->nagleds, 1000u);
+
+    // changes every 100 ds wait for about that long, even when closed
+    for (int i = 1; i <= 5; i++)
+    {
+        mega::Waiter::ds = 1000 + 100 * i;
+        lf->bumpnagleds();
+        ASSERT_EQ(lf->changeintervalds, 100u);
+        ASSERT_EQ(lf->nagleds, mega::Waiter::ds + 100);
+        lf->closewritten();
+        ASSERT_EQ(lf->nagleds, mega::Waiter::ds + 100);
+    }
+
+    // but not beyond FILE_NAGLE_MAX_DS since the first change that is still to be uploaded
+    mega::Waiter::ds = lf->nagleinitialds + mega::Sync::FILE_NAGLE_MAX_DS;
+    lf->lastchangeds = mega::Waiter::ds - 100;
+    lf->bumpnagleds();
+    ASSERT_EQ(lf->nagleds, mega::Waiter::ds + mega::Sync::FILE_NAGLE_DS);
+
+    // changes further apart than the window start afresh
+    lf->nagleinitialds = 0;
+    mega::Waiter::ds += mega::Sync::FILE_CADENCE_WINDOW_DS;
+    lf->bumpnagleds();
+    ASSERT_EQ(lf->changeintervalds, 0u);
+    ASSERT_EQ(lf->nagleds, mega::Waiter::ds + mega::Sync::FILE_NAGLE_DS);
+}
+
+TEST(Sync, getlocalpath_followsRenamesAndMovesOfAncestors)
+{
+    Fixture fx{"d"};
+    mega::LocalNode& ld = *fx.mSync->localroot;
+    auto ld_0 = mt::makeLocalNode(*fx.mSync, ld, mega::FOLDERNODE, "d_0", {});
+    auto ld_1 = mt::makeLocalNode(*fx.mSync, ld, mega::FOLDERNODE, "d_1", {});
+    auto ld_0_0 = mt::makeLocalNode(*fx.mSync, *ld_0, mega::FOLDERNODE, "d_0_0", {});
+    auto lf_0_0_0 = mt::makeLocalNode(*fx.mSync, *ld_0_0, mega::FILENODE, "f_0_0_0", {});
+
+    std::string path;
+    lf_0_0_0->getlocalpath(&path);
+    ASSERT_EQ("d/d_0/d_0_0/f_0_0_0", path);
+
+    // the cached folder paths follow a rename of an ancestor
+    std::string newpath = "d/e_0";
+    ld_0->setnameparent(&ld, &newpath);
+    lf_0_0_0->getlocalpath(&path);
+    ASSERT_EQ("d/e_0/d_0_0/f_0_0_0", path);
+
+    // and a move
+    newpath = "d/d_1/d_0_0";
+    ld_0_0->setnameparent(ld_1.get(), &newpath);
+    lf_0_0_0->getlocalpath(&path);
+    ASSERT_EQ("d/d_1/d_0_0/f_0_0_0", path);
+    ld_0_0->getlocalpath(&path);
+    ASSERT_EQ("d/d_1/d_0_0", path);
+
+    // another separator builds the path without the cache
+    const std::string separator = "\\";
+    lf_0_0_0->getlocalpath(&path, false, &separator);
+    ASSERT_EQ("d\\d_1\\d_0_0\\f_0_0_0", path);
+}
+
+TEST(Sync, findmovedlocalnode_matchesVanishedFilesByFingerprint)
+{
+    Fixture fx{"d"};
+    mega::LocalNode& ld = *fx.mSync->localroot;
+
+    mega::FileFingerprint ffp;
+    ffp.size = 42;
+    ffp.mtime = 1000;
+    ffp.crc = {1, 2, 3, 4};
+    ffp.isvalid = true;
+
+    auto lf_0 = mt::makeLocalNode(*fx.mSync, ld, mega::FILENODE, "f_0", ffp);
+    auto lf_1 = mt::makeLocalNode(*fx.mSync, ld, mega::FILENODE, "f_1", ffp);
+    ASSERT_TRUE(fx.mClient->localsyncmovecandidates.empty());
+
+    // only vanished files are candidates, and only synced ones can be re-linked locally
+    lf_0->setnotseen(1);
+    ASSERT_EQ(1u, fx.mClient->localsyncmovecandidates.size());
+    ASSERT_EQ(nullptr, fx.mClient->findmovedlocalnode(fx.mSync.get(), ffp, false));
+
+    lf_0->deleted = true;
+    ASSERT_EQ(lf_0.get(), fx.mClient->findmovedlocalnode(fx.mSync.get(), ffp, true));
+
+    mega::FileFingerprint other = ffp;
+    other.crc[3] = 5;
+    ASSERT_EQ(nullptr, fx.mClient->findmovedlocalnode(fx.mSync.get(), other, true));
+
+    // seen again and not deleted: no longer a candidate
+    lf_0->deleted = false;
+    lf_0->setnotseen(0);
+    ASSERT_TRUE(fx.mClient->localsyncmovecandidates.empty());
+
+    lf_1->setnotseen(1);
+    lf_1.reset();
+    ASSERT_TRUE(fx.mClient->localsyncmovecandidates.empty());
+}
+
+TEST(Sync, getstats_reportsQueuesAndLagOfThisSyncOnly)
+{
+    Fixture fx{"d"};
+    mega::LocalNode& ld = *fx.mSync->localroot;
+    auto ld_0 = mt::makeLocalNode(*fx.mSync, ld, mega::FOLDERNODE, "d_0", {});
+    auto lf_0 = mt::makeLocalNode(*fx.mSync, ld, mega::FILENODE, "f_0", {});
+
+    auto other = mt::makeSync(*fx.mClient, "e");
+    auto le_0 = mt::makeLocalNode(*other, *other->localroot, mega::FOLDERNODE, "e_0", {});
+
+    fx.mSync->dirnotify->notify(mega::DirNotify::DIREVENTS, &ld, "f_1", 3);
+    fx.mSync->dirnotify->notify(mega::DirNotify::DIREVENTS, &ld, "f_2", 3);
+    fx.mSync->dirnotify->notify(mega::DirNotify::RETRY, &ld, "f_3", 3);
+    fx.mClient->synccreate.push_back(ld_0.get());
+    fx.mClient->synccreate.push_back(le_0.get());
+    lf_0->setnotseen(1);
+    le_0->setnotseen(1);
+    fx.mSync->addlag(30);
+    fx.mSync->addlag(10);
+
+    mega::SyncStats stats;
+    fx.mSync->getstats(stats);
+    ASSERT_EQ(2u, stats.queued[mega::DirNotify::DIREVENTS]);
+    ASSERT_EQ(1u, stats.queued[mega::DirNotify::RETRY]);
+    ASSERT_EQ(0u, stats.queued[mega::DirNotify::EXTRA]);
+    ASSERT_EQ(1u, stats.synccreate);
+    ASSERT_EQ(1u, stats.notseen);
+    ASSERT_EQ(0u, stats.gets + stats.puts);
+    ASSERT_EQ(2u, stats.lagsamples);
+    ASSERT_EQ(10, stats.lastlagds);
+    ASSERT_EQ(30, stats.maxlagds);
+    ASSERT_EQ(20, stats.avglagds);
+
+    fx.mClient->synccreate.clear();
+}
+
 TEST(Sync, computeReverseMatchScore_oneByteSeparator)
 {
     test_computeReversePathMatchScore("/");
@@ -384,6 +653,507 @@ TEST(Sync, assignFilesystemIds_whenFilesystemFingerprintsMatchLocalNodes)
     ASSERT_TRUE(fx.iteratorsCorrect(*lf_1_1_0));
 }
 
+TEST(Sync, procdirscan_keepsValidCachedNodesAndQueuesTheRest)
+{
+    Fixture fx{"d"};
+
+    mt::FsNode d{nullptr, mega::FOLDERNODE, "d"};
+    mega::LocalNode& ld = *fx.mSync->localroot;
+    static_cast<mega::FileFingerprint&>(ld) = d.getFingerprint();
+
+    // unchanged folder and file
+    mt::FsNode d_0{&d, mega::FOLDERNODE, "d_0"};
+    auto ld_0 = mt::makeLocalNode(*fx.mSync, ld, mega::FOLDERNODE, "d_0", d_0.getFingerprint());
+    d_0.setFsId(ld_0->fsid);
+    mt::FsNode f_0_0{&d_0, mega::FILENODE, "f_0_0"};
+    auto lf_0_0 = mt::makeLocalNode(*fx.mSync, *ld_0, mega::FILENODE, "f_0_0", f_0_0.getFingerprint());
+    f_0_0.setFsId(lf_0_0->fsid);
+
+    // modified file
+    mt::FsNode f_1{&d, mega::FILENODE, "f_1"};
+    auto ffp = f_1.getFingerprint();
+    ++ffp.mtime;
+    auto lf_1 = mt::makeLocalNode(*fx.mSync, ld, mega::FILENODE, "f_1", ffp);
+    f_1.setFsId(lf_1->fsid);
+
+    // new file
+    mt::FsNode f_2{&d, mega::FILENODE, "f_2"};
+
+    mt::collectAllFsNodes(fx.mFsNodes, d);
+
+    // as after loading the sync from the state cache
+    ++fx.mSync->scanseqno;
+
+    // a single thread, as MockFileAccess allows two open files at a time
+    fx.mSync->startdirscan("d", 1);
+    for (int i = 0; i < 1000 && fx.mSync->dirscanner; ++i)
+    {
+        ASSERT_TRUE(fx.mSync->procdirscan());
+        if (fx.mSync->dirscanner)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    ASSERT_FALSE(fx.mSync->dirscanner);
+    ASSERT_FALSE(fx.mSync->initializing);
+
+    ASSERT_EQ(fx.mSync->scanseqno, ld_0->scanseqno);
+    ASSERT_EQ(fx.mSync->scanseqno, lf_0_0->scanseqno);
+    ASSERT_NE(fx.mSync->scanseqno, lf_1->scanseqno);
+
+    std::set<std::string> queued;
+    for (const auto& notification : fx.mSync->dirnotify->notifyq[mega::DirNotify::DIREVENTS])
+    {
+        queued.insert(notification.path);
+    }
+    const std::set<std::string> expected{"d/f_1", "d/f_2"};
+    ASSERT_EQ(expected, queued);
+}
+
+TEST(Sync, pollfolders_rescansFoldersWhoseMtimeChanged)
+{
+    Fixture fx{"d"};
+
+    mt::FsNode d{nullptr, mega::FOLDERNODE, "d"};
+    mega::LocalNode& ld = *fx.mSync->localroot;
+    mt::FsNode d_0{&d, mega::FOLDERNODE, "d_0"};
+    auto ld_0 = mt::makeLocalNode(*fx.mSync, ld, mega::FOLDERNODE, "d_0", {});
+    mt::FsNode f_0_0{&d_0, mega::FILENODE, "f_0_0"};
+    auto lf_0_0 = mt::makeLocalNode(*fx.mSync, *ld_0, mega::FILENODE, "f_0_0", f_0_0.getFingerprint());
+    // no longer there
+    auto lf_0_1 = mt::makeLocalNode(*fx.mSync, *ld_0, mega::FILENODE, "f_0_1", {});
+
+    mt::collectAllFsNodes(fx.mFsNodes, d);
+    fx.mSync->initializing = false;
+    auto& notifyq = fx.mSync->dirnotify->notifyq[mega::DirNotify::DIREVENTS];
+
+    // the first look only takes note
+    ASSERT_FALSE(fx.mSync->pollfolders());
+    ASSERT_TRUE(notifyq.empty());
+    ASSERT_EQ(mega::Sync::POLL_MIN_INTERVAL_DS, ld_0->pollintervalds);
+
+    // nothing due
+    d_0.setMTime(d_0.getMTime() + 1);
+    ASSERT_FALSE(fx.mSync->pollfolders());
+
+    ld_0->pollds = 0;
+    ld.pollintervalds = 4 * mega::Sync::POLL_MIN_INTERVAL_DS;
+    ASSERT_TRUE(fx.mSync->pollfolders());
+
+    std::set<std::pair<mega::LocalNode*, std::string>> queued;
+    for (const auto& notification : notifyq)
+    {
+        queued.emplace(notification.localnode, notification.path);
+    }
+    const std::set<std::pair<mega::LocalNode*, std::string>> expected{
+        {nullptr, "d/d_0/f_0_0"},
+        {ld_0.get(), "f_0_1"},
+    };
+    ASSERT_EQ(expected, queued);
+    ASSERT_EQ(mega::Sync::POLL_MIN_INTERVAL_DS, ld_0->pollintervalds);
+    ASSERT_EQ(2 * mega::Sync::POLL_MIN_INTERVAL_DS, ld.pollintervalds);
+
+    // unchanged since: back off
+    notifyq.clear();
+    ld_0->pollds = 0;
+    ASSERT_FALSE(fx.mSync->pollfolders());
+    ASSERT_TRUE(notifyq.empty());
+    ASSERT_EQ(2 * mega::Sync::POLL_MIN_INTERVAL_DS, ld_0->pollintervalds);
+}
+
+namespace {
+
+class MockJournalDirNotify : public mega::DirNotify
+{
+public:
+    struct Record
+    {
+        mega::handle fsid;
+        mega::handle parentfsid;
+        std::string localname;
+    };
+
+    MockJournalDirNotify(std::string root, std::vector<Record> records)
+    : mega::DirNotify{&root, &root}
+    , mRecords{std::move(records)}
+    {}
+
+    bool journalchanges(const std::string& cursor, const journalchange_callback& callback) override
+    {
+        if (cursor != "cursor")
+        {
+            return false;
+        }
+        for (const auto& record : mRecords)
+        {
+            callback(record.fsid, record.parentfsid, record.localname);
+        }
+        return true;
+    }
+
+private:
+    std::vector<Record> mRecords;
+};
+
+}
+
+TEST(Sync, resumefromjournal_queuesOnlyTheJournaledPaths)
+{
+    Fixture fx{"d"};
+    mega::LocalNode& ld = *fx.mSync->localroot;
+    ld.setfsid(mt::nextFsId(), fx.mClient->fsidnode);
+
+    auto ld_0 = mt::makeLocalNode(*fx.mSync, ld, mega::FOLDERNODE, "d_0", {});
+    auto lf_0_0 = mt::makeLocalNode(*fx.mSync, *ld_0, mega::FILENODE, "f_0_0", {});
+    auto lf_1 = mt::makeLocalNode(*fx.mSync, ld, mega::FILENODE, "f_1", {});
+
+    const mega::handle elsewhere = mt::nextFsId();
+    fx.mSync->dirnotify.reset(new MockJournalDirNotify{"d", {
+        {mt::nextFsId(), ld_0->fsid, "new"},           // created in a synced folder
+        {lf_1->fsid, elsewhere, "f_1"},                 // moved out of the sync
+        {mt::nextFsId(), elsewhere, "unrelated"},       // somewhere else on the volume
+    }});
+    fx.mSync->dirnotify->sync = fx.mSync.get();
+    fx.mSync->fsstableids = true;
+    ++fx.mSync->scanseqno;
+
+    // nothing stored yet
+    ASSERT_FALSE(fx.mSync->resumefromjournal());
+
+    fx.mSync->journalcursor = "cursor";
+    ASSERT_TRUE(fx.mSync->resumefromjournal());
+
+    ASSERT_EQ(fx.mSync->scanseqno, ld_0->scanseqno);
+    ASSERT_EQ(fx.mSync->scanseqno, lf_0_0->scanseqno);
+    ASSERT_EQ(fx.mSync->scanseqno, lf_1->scanseqno);
+
+    std::set<std::string> queued;
+    for (const auto& notification : fx.mSync->dirnotify->notifyq[mega::DirNotify::DIREVENTS])
+    {
+        queued.insert(notification.path);
+    }
+    const std::set<std::string> expected{"d/d_0/new", "d/f_1"};
+    ASSERT_EQ(expected, queued);
+}
+
+namespace {
+
+class CountingDbTable : public mt::DefaultedDbTable
+{
+public:
+    using mt::DefaultedDbTable::DefaultedDbTable;
+    bool putBatch(uint32_t, const std::vector<mega::Cacheable*>& records, mega::SymmCipher*) override
+    {
+        for (auto record : records)
+        {
+            if (!record->dbid)
+            {
+                record->dbid = ++mNextId;
+            }
+            ++mPut;
+        }
+        return true;
+    }
+    bool del(uint32_t) override
+    {
+        ++mDeleted;
+        return true;
+    }
+    void begin() override {}
+    void commit() override {}
+
+    uint32_t mNextId = 0;
+    unsigned mPut = 0;
+    unsigned mDeleted = 0;
+};
+
+}
+
+TEST(Sync, cachenodes_skipsUnchangedRecordsAndBatchesDuringNotifications)
+{
+    Fixture fx{"d"};
+    mega::PrnGen rng;
+    auto table = new CountingDbTable{rng, false};
+    fx.mSync->statecachetable = table;
+    fx.mSync->state = mega::SYNC_ACTIVE;
+
+    mega::LocalNode& ld = *fx.mSync->localroot;
+    auto ld_0 = mt::makeLocalNode(*fx.mSync, ld, mega::FOLDERNODE, "d_0", {});
+    auto lf_0_0 = mt::makeLocalNode(*fx.mSync, *ld_0, mega::FILENODE, "f_0_0", {});
+    auto lf_1 = mt::makeLocalNode(*fx.mSync, ld, mega::FILENODE, "f_1", {});
+    for (auto l : {ld_0.get(), lf_0_0.get(), lf_1.get()})
+    {
+        fx.mSync->statecacheadd(l);
+    }
+
+    // the child is written once its parent has a dbid
+    fx.mSync->cachenodes();
+    ASSERT_EQ(3u, table->mPut);
+    ASSERT_TRUE(fx.mSync->insertq.empty());
+
+    // nothing changed
+    for (auto l : {ld_0.get(), lf_0_0.get(), lf_1.get()})
+    {
+        fx.mSync->statecacheadd(l);
+    }
+    fx.mSync->cachenodes();
+    ASSERT_EQ(3u, table->mPut);
+    ASSERT_EQ(3u, fx.mSync->statecachestats.unchanged);
+
+    // held back while notifications are pending, unless forced
+    fx.mSync->dirnotify->notify(mega::DirNotify::DIREVENTS, &ld, "f_1", 3);
+    lf_1->mtime += 1;
+    fx.mSync->statecacheadd(lf_1.get());
+    fx.mSync->cachenodes();
+    ASSERT_EQ(3u, table->mPut);
+    ASSERT_EQ(1u, fx.mSync->insertq.size());
+    fx.mSync->cachenodes(true);
+    ASSERT_EQ(4u, table->mPut);
+    ASSERT_EQ(3u, fx.mSync->statecachestats.flushes);
+    ASSERT_EQ(4u, fx.mSync->statecachestats.written);
+
+    fx.mSync->statecachetable = nullptr;
+    delete table;
+    fx.mSync->state = mega::SYNC_CANCELED;
+}
+
+TEST(Sync, dnextstat_returnsWhatFileAccessReturns)
+{
+    mega::FSACCESS_CLASS fsaccess;
+    std::string folder = "dnextstat_test";
+    std::string localfolder;
+    fsaccess.path2local(&folder, &localfolder);
+    ASSERT_TRUE(fsaccess.mkdirlocal(&localfolder, false));
+
+    std::set<std::string> names{"f_0", "f_1", "d_0"};
+    for (const auto& name : names)
+    {
+        std::string path = folder + "/" + name;
+        std::string localpath;
+        fsaccess.path2local(&path, &localpath);
+        if (name[0] == 'd')
+        {
+            ASSERT_TRUE(fsaccess.mkdirlocal(&localpath, false));
+        }
+        else
+        {
+            auto fa = fsaccess.newfileaccess();
+            ASSERT_TRUE(fa->fopen(&localpath, false, true));
+            ASSERT_TRUE(fa->fwrite((const mega::byte*)name.data(), unsigned(name.size()), 0));
+        }
+    }
+
+    std::unique_ptr<mega::DirAccess> da{fsaccess.newdiraccess()};
+    ASSERT_TRUE(da->dopen(&localfolder, nullptr, false));
+
+    std::set<std::string> found;
+    mega::DirEntry entry;
+    while (da->dnextstat(&localfolder, &entry, false))
+    {
+        std::string name;
+        fsaccess.local2path(&entry.localname, &name);
+        found.insert(name);
+
+        std::string localpath = localfolder + fsaccess.localseparator + entry.localname;
+        auto fa = fsaccess.newfileaccess(false);
+        ASSERT_TRUE(fa->fopen(&localpath, false, false));
+        ASSERT_EQ(fa->type, entry.type);
+
+        // the platform may not return them in bulk
+        if (entry.statvalid)
+        {
+            ASSERT_EQ(fa->fsid, entry.fsid);
+            ASSERT_EQ(fa->mtime, entry.mtime);
+            if (entry.type == mega::FILENODE)
+            {
+                ASSERT_EQ(fa->size, entry.size);
+            }
+        }
+
+        fa.reset();
+        ASSERT_TRUE(entry.type == mega::FOLDERNODE ? fsaccess.rmdirlocal(&localpath) : fsaccess.unlinklocal(&localpath));
+        entry = mega::DirEntry();
+    }
+    ASSERT_EQ(names, found);
+    da.reset();
+    ASSERT_TRUE(fsaccess.rmdirlocal(&localfolder));
+}
+
+TEST(Sync, SyncDebrisQueue_movesUnchangedFilesAndDropsForgottenNodes)
+{
+    mega::FSACCESS_CLASS fsaccess;
+    auto local = [&fsaccess](std::string path)
+    {
+        std::string localpath;
+        fsaccess.path2local(&path, &localpath);
+        return localpath;
+    };
+
+    std::string localfolder = local("debrisqueue_test");
+    std::string localdebris = local("debrisqueue_test/debris");
+    ASSERT_TRUE(fsaccess.mkdirlocal(&localfolder, false));
+
+    // the queue only hands the LocalNodes back
+    int tokens[3];
+    mega::LocalNode* unchanged = reinterpret_cast<mega::LocalNode*>(&tokens[0]);
+    mega::LocalNode* changed = reinterpret_cast<mega::LocalNode*>(&tokens[1]);
+    mega::LocalNode* forgotten = reinterpret_cast<mega::LocalNode*>(&tokens[2]);
+
+    std::vector<std::string> paths;
+    std::vector<mega::FileFingerprint> fingerprints(3);
+    for (int i = 0; i < 3; i++)
+    {
+        paths.push_back(local("debrisqueue_test/f_" + std::to_string(i)));
+        auto fa = fsaccess.newfileaccess();
+        ASSERT_TRUE(fa->fopen(&paths[i], false, true));
+        ASSERT_TRUE(fa->fwrite((const mega::byte*)"abc", 3, 0));
+        fa.reset();
+        fa = fsaccess.newfileaccess();
+        ASSERT_TRUE(fa->fopen(&paths[i], true, false));
+        ASSERT_TRUE(fingerprints[i].genfingerprint(fa.get()));
+    }
+    fingerprints[1].size++;
+
+    {
+        mega::SyncDebrisQueue queue([]() -> mega::FileSystemAccess* { return new mega::FSACCESS_CLASS; }, 2, nullptr);
+        queue.add(unchanged, paths[0], localdebris, &fingerprints[0]);
+        queue.add(changed, paths[1], localdebris, &fingerprints[1]);
+        queue.add(forgotten, paths[2], localdebris, &fingerprints[2]);
+        queue.forget(forgotten);
+
+        while (!queue.idle())
+        {
+            std::map<mega::LocalNode*, mega::SyncDebrisQueue::result_t> results;
+            mega::SyncDebrisQueue::Result result;
+            while (queue.next(result))
+            {
+                results[result.localnode] = result.result;
+            }
+            if (results.empty())
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            ASSERT_EQ(0u, results.count(forgotten));
+            if (results.count(unchanged))
+            {
+                ASSERT_EQ(mega::SyncDebrisQueue::MOVED, results[unchanged]);
+            }
+            if (results.count(changed))
+            {
+                ASSERT_EQ(mega::SyncDebrisQueue::CHANGED, results[changed]);
+            }
+        }
+    }
+
+    // the changed file stays, the others went to the debris
+    auto fa = fsaccess.newfileaccess(false);
+    ASSERT_FALSE(fa->fopen(&paths[0], true, false));
+    ASSERT_TRUE(fa->fopen(&paths[1], true, false));
+    fa.reset();
+    ASSERT_TRUE(fsaccess.unlinklocal(&paths[1]));
+
+    // debris/<day>/f_0 and f_2
+    std::unique_ptr<mega::DirAccess> days{fsaccess.newdiraccess()};
+    ASSERT_TRUE(days->dopen(&localdebris, nullptr, false));
+    std::string day;
+    ASSERT_TRUE(days->dnext(&localdebris, &day, false));
+    std::string localday = localdebris + fsaccess.localseparator + day;
+    std::unique_ptr<mega::DirAccess> moved{fsaccess.newdiraccess()};
+    ASSERT_TRUE(moved->dopen(&localday, nullptr, false));
+    std::set<std::string> names;
+    std::string name;
+    while (moved->dnext(&localday, &name, false))
+    {
+        std::string localpath = localday + fsaccess.localseparator + name;
+        ASSERT_TRUE(fsaccess.unlinklocal(&localpath));
+        fsaccess.local2path(&name, &localpath);
+        names.insert(localpath);
+    }
+    ASSERT_EQ((std::set<std::string>{"f_0", "f_2"}), names);
+    moved.reset();
+    days.reset();
+    ASSERT_TRUE(fsaccess.rmdirlocal(&localday));
+    ASSERT_TRUE(fsaccess.rmdirlocal(&localdebris));
+    ASSERT_TRUE(fsaccess.rmdirlocal(&localfolder));
+}
+
+TEST(Sync, SyncFingerprintPrefetcher_handsBackFingerprintsOfUnchangedFiles)
+{
+    mega::FSACCESS_CLASS fsaccess;
+    auto local = [&fsaccess](std::string path)
+    {
+        std::string localpath;
+        fsaccess.path2local(&path, &localpath);
+        return localpath;
+    };
+
+    std::string localfolder = local("prefetch_test");
+    ASSERT_TRUE(fsaccess.mkdirlocal(&localfolder, false));
+
+    std::vector<std::string> paths;
+    for (int i = 0; i < 2; i++)
+    {
+        paths.push_back(local("prefetch_test/f_" + std::to_string(i)));
+        auto fa = fsaccess.newfileaccess();
+        ASSERT_TRUE(fa->fopen(&paths[i], false, true));
+        ASSERT_TRUE(fa->fwrite((const mega::byte*)"abc", 3, 0));
+    }
+
+    mega::SyncFingerprintPrefetcher prefetcher([]() -> mega::FileSystemAccess* { return new mega::FSACCESS_CLASS; }, 3, nullptr);
+    ASSERT_TRUE(prefetcher.threaded());
+    ASSERT_TRUE(prefetcher.add(paths[0]));
+    ASSERT_TRUE(prefetcher.add(paths[1]));
+    ASSERT_TRUE(prefetcher.add(localfolder));
+    ASSERT_TRUE(prefetcher.add(paths[0]));
+    ASSERT_EQ(3u, prefetcher.size());
+    while (!prefetcher.idle())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // full of fingerprints nobody took: the oldest makes room
+    std::string missing = local("prefetch_test/missing");
+    ASSERT_TRUE(prefetcher.add(missing));
+    ASSERT_EQ(3u, prefetcher.size());
+
+    // the unchanged file gets the fingerprint it would have had
+    auto fa = fsaccess.newfileaccess(false);
+    ASSERT_TRUE(fa->fopen(&paths[1], true, false));
+    mega::FileFingerprint expected;
+    ASSERT_TRUE(expected.genfingerprint(fa.get()));
+    mega::FileFingerprint fp;
+    ASSERT_TRUE(prefetcher.take(paths[1], *fa, &fp));
+    ASSERT_EQ(expected, fp);
+    ASSERT_FALSE(prefetcher.take(paths[1], *fa, &fp));
+
+    // not for a file that changed since, a folder, or a file that got dropped
+    fa->size++;
+    ASSERT_TRUE(prefetcher.add(paths[1]));
+    while (!prefetcher.idle())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_FALSE(prefetcher.take(paths[1], *fa, &fp));
+    fa.reset();
+
+    fa = fsaccess.newfileaccess(false);
+    ASSERT_TRUE(fa->fopen(&localfolder, true, false));
+    ASSERT_FALSE(prefetcher.take(localfolder, *fa, &fp));
+    fa.reset();
+
+    fa = fsaccess.newfileaccess(false);
+    ASSERT_TRUE(fa->fopen(&paths[0], true, false));
+    ASSERT_FALSE(prefetcher.take(paths[0], *fa, &fp));
+    fa.reset();
+
+    for (auto& path : paths)
+    {
+        ASSERT_TRUE(fsaccess.unlinklocal(&path));
+    }
+    ASSERT_TRUE(fsaccess.rmdirlocal(&localfolder));
+}
+
 TEST(Sync, assignFilesystemIds_whenFilesystemFingerprintsMatchLocalNodes_oppositeDeclarationOrder)
 {
     Fixture fx{"d"};
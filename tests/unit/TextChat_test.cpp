@@ -126,4 +126,44 @@ TEST(TextChat, unserialize_32bit)
     auto newTc = mega::TextChat::unserialize(client.get(), &d);
     checkTextChats(tc, *newTc);
 }
+
+TEST(TextChat, attachmentchats_followsAccessChanges)
+{
+    mega::MegaApp app;
+    MockFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    mega::TextChat tc;
+    tc.id = 1;
+    tc.userpriv = new mega::userpriv_vector;
+    tc.attachedNodes[7].insert(8);
+    std::string d;
+    ASSERT_TRUE(tc.serialize(&d));
+
+    // the chats read from the cache are indexed
+    mega::TextChat* chat1 = mega::TextChat::unserialize(client.get(), &d);
+    ASSERT_NE(nullptr, chat1);
+    ASSERT_EQ(mega::handle_set{1}, client->attachmentchats[7]);
+
+    mega::TextChat* chat2 = client->chats[2] = new mega::TextChat();
+    chat2->id = 2;
+    ASSERT_TRUE(client->setattachmentaccess(chat2, 7, 8));
+    ASSERT_TRUE(client->setattachmentaccess(chat2, 9, 8));
+    ASSERT_EQ((mega::handle_set{1, 2}), client->attachmentchats[7]);
+    ASSERT_EQ(mega::handle_set{2}, client->attachmentchats[9]);
+
+    // a node stays attached while some user has access to it
+    ASSERT_TRUE(client->setattachmentaccess(chat2, 9, 10));
+    ASSERT_TRUE(client->setattachmentaccess(chat2, 9, 8, true));
+    ASSERT_EQ(mega::handle_set{2}, client->attachmentchats[9]);
+    ASSERT_TRUE(client->setattachmentaccess(chat2, 9, 10, true));
+    ASSERT_EQ(0u, client->attachmentchats.count(9));
+    ASSERT_FALSE(client->setattachmentaccess(chat2, 9, 10, true));
+
+    // reading a chat again replaces its attachments
+    ASSERT_TRUE(client->setattachmentaccess(chat1, 11, 8));
+    ASSERT_EQ(chat1, mega::TextChat::unserialize(client.get(), &d));
+    ASSERT_EQ(0u, client->attachmentchats.count(11));
+    ASSERT_EQ((mega::handle_set{1, 2}), client->attachmentchats[7]);
+}
 #endif
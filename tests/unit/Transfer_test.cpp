@@ -16,12 +16,17 @@
  * program.
  */
 
+#include <iostream>
+
 #include <gtest/gtest.h>
 
 #include <mega/megaclient.h>
 #include <mega/megaapp.h>
 #include <mega/transfer.h>
+#include <mega/transferslot.h>
 
+#include "DefaultedDbTable.h"
+#include "DefaultedFileAccess.h"
 #include "DefaultedFileSystemAccess.h"
 #include "utils.h"
 
@@ -32,6 +37,57 @@ class MockFileSystemAccess : public mt::DefaultedFileSystemAccess
 {
 };
 
+// counts the records written, by id, and deleted
+class CountingDbTable : public mt::DefaultedDbTable
+{
+public:
+    using mt::DefaultedDbTable::DefaultedDbTable;
+
+    std::map<uint32_t, int> puts;
+    unsigned dels = 0;
+
+    bool put(uint32_t id, char*, unsigned) override
+    {
+        puts[id]++;
+        return true;
+    }
+    bool del(uint32_t) override
+    {
+        dels++;
+        return true;
+    }
+    bool delBatch(const std::vector<uint32_t>& ids) override
+    {
+        batches++;
+        dels += unsigned(ids.size());
+        return true;
+    }
+    unsigned batches = 0;
+    void begin() override {}
+    void commit() override {}
+    void abort() override {}
+    void remove() override {}
+};
+
+// a file with the given content
+class ContentFileAccess : public mt::DefaultedFileAccess
+{
+public:
+    std::string content;
+
+    explicit ContentFileAccess(std::string c)
+        : content(std::move(c))
+    {
+        size = m_off_t(content.size());
+    }
+
+    bool sysread(mega::byte* buffer, unsigned len, m_off_t offset) override
+    {
+        memcpy(buffer, content.data() + offset, len);
+        return true;
+    }
+};
+
 void checkTransfers(const mega::Transfer& exp, const mega::Transfer& act)
 {
     ASSERT_EQ(exp.type, act.type);
@@ -145,3 +201,829 @@ TEST(Transfer, unserialize_32bit)
     auto newTf = std::unique_ptr<mega::Transfer>{mega::Transfer::unserialize(client.get(), &d, &tfMap)};
     checkTransfers(tf, *newTf);
 }
+
+TEST(Transfer, progressIsCachedOncePerFlush)
+{
+    mega::MegaApp app;
+    MockFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+    auto table = new CountingDbTable(client->rng, false);
+    client->tctable = table;
+
+    std::unique_ptr<mega::Transfer> a(new mega::Transfer(client.get(), mega::GET));
+    std::unique_ptr<mega::Transfer> b(new mega::Transfer(client.get(), mega::PUT));
+    for (int i = 0; i < 10; i++)
+    {
+        client->transfercachedirty(a.get());
+        client->transfercachedirty(b.get());
+    }
+    ASSERT_TRUE(table->puts.empty());
+
+    // one record per transfer, however many times it progressed
+    client->transfercacheflush(nullptr);
+    ASSERT_EQ(table->puts.size(), 2u);
+    ASSERT_EQ(table->puts[a->dbid], 1);
+    ASSERT_EQ(table->puts[b->dbid], 1);
+
+    // a transfer written or gone meanwhile is not written again
+    client->transfercachedirty(a.get());
+    client->transfercachedirty(b.get());
+    client->transfercacheadd(a.get(), nullptr);
+    b.reset();
+    client->transfercacheflush(nullptr);
+    ASSERT_EQ(table->puts.size(), 2u);
+    ASSERT_EQ(table->puts[a->dbid], 2);
+    ASSERT_TRUE(client->tcdirty.empty());
+
+    a.reset();
+    client->tctable = nullptr;
+    delete table;
+}
+
+TEST(Transfer, cachedFilesAreResumedInBatches)
+{
+    mega::MegaApp app;      // resumes nothing: every cached file is dropped
+    MockFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+    auto table = new CountingDbTable(client->rng, false);
+    client->tctable = table;
+
+    const unsigned batch = mega::MegaClient::TRANSFERRESUME_BATCH;
+    const unsigned files = 2 * batch + 10;
+    for (unsigned i = 0; i < files; i++)
+    {
+        client->cachedfiles.push_back("file");
+        client->cachedfilesdbids.push_back((i + 1) * 16 + mega::MegaClient::CACHEDFILE);
+    }
+    client->cachedfilesresuming = true;
+
+    client->resumecachedfiles();
+    ASSERT_EQ(table->dels, batch);
+    ASSERT_TRUE(client->cachedfilesresuming);
+
+    client->resumecachedfiles();
+    client->resumecachedfiles();
+    ASSERT_EQ(table->dels, files);
+    ASSERT_FALSE(client->cachedfilesresuming);
+    ASSERT_TRUE(client->cachedfiles.empty());
+
+    client->tctable = nullptr;
+    delete table;
+}
+
+TEST(MegaClient, stopxfersCancelsTheQueueInOneBatch)
+{
+    struct CountingApp : mega::MegaApp
+    {
+        unsigned filesRemoved = 0;
+        unsigned transfersRemoved = 0;
+        void file_removed(mega::File*, mega::error) override { filesRemoved++; }
+        void transfer_removed(mega::Transfer*) override { transfersRemoved++; }
+    } app;
+    MockFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+    auto table = new CountingDbTable(client->rng, false);
+    client->tctable = table;
+
+    // every tenth transfer also has a file of a sync, which stays
+    std::vector<std::unique_ptr<mega::File>> files;
+    {
+        mega::DBTableTransactionCommitter committer(client->tctable);
+        for (uint32_t i = 0; i < 1000; i++)
+        {
+            auto t = new mega::Transfer(client.get(), mega::GET);
+            t->dbid = (3 * i + 1) * 16 + mega::MegaClient::CACHEDTRANSFER;
+            for (uint32_t j = 0; j < 2; j++)
+            {
+                files.emplace_back(new mega::File);
+                auto f = files.back().get();
+                f->syncxfer = j && !(i % 10);
+                f->dbid = (3 * i + 2 + j) * 16 + mega::MegaClient::CACHEDFILE;
+                f->transfer = t;
+                f->file_it = t->files.insert(t->files.end(), f);
+            }
+            client->transferlist.addtransfer(t, committer);
+        }
+    }
+    table->dels = 0;
+
+    {
+        mega::DBTableTransactionCommitter committer(client->tctable);
+        client->stopxfers(mega::GET, [](mega::File* f) { return !f->syncxfer; }, committer);
+    }
+
+    ASSERT_EQ(1900u, app.filesRemoved);
+    ASSERT_EQ(900u, app.transfersRemoved);
+    ASSERT_EQ(1u, table->batches);
+    ASSERT_EQ(1900u + 900u, table->dels);
+
+    auto& list = client->transferlist.transfers[mega::GET];
+    ASSERT_EQ(100u, list.size());
+    for (size_t i = 0; i < list.size(); i++)
+    {
+        ASSERT_EQ(1u, list[i]->files.size());
+        ASSERT_TRUE(list[i]->files.front()->syncxfer);
+        if (i)
+        {
+            ASSERT_LT(list[i - 1]->priority, list[i]->priority);
+        }
+    }
+
+    while (!list.empty())
+    {
+        delete list.back();
+    }
+    client->tctable = nullptr;
+    delete table;
+}
+
+TEST(TransferList, movesRenumberFewTransfers)
+{
+    struct CountingApp : mega::MegaApp
+    {
+        unsigned updates = 0;
+        void transfer_update(mega::Transfer*) override { updates++; }
+    } app;
+    MockFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+    mega::DBTableTransactionCommitter committer(nullptr);
+
+    std::vector<std::unique_ptr<mega::Transfer>> transfers;
+    for (int i = 0; i < 10000; i++)
+    {
+        transfers.emplace_back(new mega::Transfer(client.get(), mega::PUT));
+        client->transferlist.addtransfer(transfers.back().get(), committer);
+    }
+
+    // the same spot runs out of priorities every few moves
+    const unsigned moves = 1000;
+    for (unsigned i = 0; i < moves; i++)
+    {
+        auto& list = client->transferlist.transfers[mega::PUT];
+        client->transferlist.movetransfer(list.back(), list[5000], committer);
+        client->transferlist.movetransfer(list[7000], list[3000], committer);
+    }
+
+    auto& list = client->transferlist.transfers[mega::PUT];
+    ASSERT_EQ(list.size(), transfers.size());
+    for (size_t i = 1; i < list.size(); i++)
+    {
+        ASSERT_LT(list[i - 1]->priority, list[i]->priority);
+        ASSERT_EQ(client->transferlist.iterator(list[i]) - list.begin(), ptrdiff_t(i));
+    }
+
+    // each move updates the transfer moved, and renumbering the ones around it adds a few more
+    ASSERT_LT(app.updates, 2 * moves * 20);
+}
+
+TEST(BackoffTimerGroupTracker, wakesUpForTheSoonestTimer)
+{
+    mega::PrnGen rng;
+    mega::BackoffTimerGroupTracker tracker;
+    mega::BackoffTimerTracked a(rng, tracker), b(rng, tracker), c(rng, tracker);
+    a.backoff(300);
+    b.backoff(100);
+    c.backoff(200);
+
+    const mega::dstime never = ~mega::dstime(0);
+    mega::dstime nds = never;
+    tracker.update(&nds, true);
+    ASSERT_EQ(nds, mega::Waiter::ds + 100);
+
+    // due ones wake up at once, and fire only once
+    mega::Waiter::ds += 150;
+    nds = never;
+    tracker.update(&nds, true);
+    ASSERT_EQ(nds, 0u);
+    ASSERT_TRUE(b.armed());
+
+    nds = never;
+    tracker.update(&nds, true);
+    ASSERT_EQ(nds, mega::Waiter::ds + 50);
+    mega::Waiter::ds -= 150;
+}
+
+TEST(RequestSizeController, sizesFromBandwidthDelayProduct)
+{
+    mega::RequestSizeController c;
+    const m_off_t MB = 1 << 20;
+
+    // no estimate yet
+    ASSERT_EQ(4 * MB, c.nextRequestSize(4 * MB, 16 * MB));
+    ASSERT_EQ(2 * MB, c.nextRequestSize(4 * MB, 2 * MB));
+
+    // 1 MB/s with a 50 ms round trip: 8 round trips worth is 400 KB
+    c.sample(MB, 50000, 1000000);
+    ASSERT_EQ(8 * MB / 20, c.nextRequestSize(4 * MB, 16 * MB));
+
+    // the lowest round trip and the best rate win
+    c.sample(MB, 100000, 2000000);
+    ASSERT_EQ(8 * MB / 20, c.nextRequestSize(4 * MB, 16 * MB));
+
+    // a fast, distant link is capped
+    c.sample(100 * MB, 500000, 1000000);
+    ASSERT_EQ(16 * MB, c.nextRequestSize(4 * MB, 16 * MB));
+
+    // old samples age out
+    for (size_t i = 0; i < mega::RequestSizeController::BANDWIDTH_SAMPLES; i++)
+    {
+        c.sample(MB, -1, 1000000);
+    }
+    ASSERT_EQ(8 * MB / 20, c.nextRequestSize(4 * MB, 16 * MB));
+}
+
+TEST(RequestSizeController, measuresRequestsAsTheyHappen)
+{
+    using clock = mega::RequestSizeController::clock;
+    mega::RequestSizeController c;
+    const m_off_t MB = 1 << 20;
+
+    clock::time_point t = clock::now();
+    c.posted(t);
+    c.received(t + std::chrono::milliseconds(10), 0);
+    c.received(t + std::chrono::milliseconds(100), 1000);
+    c.received(t + std::chrono::milliseconds(500), MB / 2);
+    c.completed(t + std::chrono::milliseconds(1100), MB);
+
+    // 100 ms to the first byte, then 1 MB in 1 s
+    ASSERT_EQ(8 * MB / 10, c.nextRequestSize(4 * MB, 16 * MB));
+
+    // a second completion without a new request is ignored
+    c.completed(t + std::chrono::seconds(60), MB);
+    ASSERT_EQ(8 * MB / 10, c.nextRequestSize(4 * MB, 16 * MB));
+}
+
+TEST(RequestSizeController, DISABLED_transfer_benchmark)
+{
+    const m_off_t MB = 1 << 20;
+
+    // what TransferBufferManager makes of a size limit: a power of two of chunks, or a single (up to 1 MB) chunk
+    auto requestBytes = [MB](m_off_t limit)
+    {
+        m_off_t bytes = MB;
+        while (bytes * 2 <= limit)
+        {
+            bytes *= 2;
+        }
+        return limit < 2 * MB ? std::max<m_off_t>(limit, 128 * 1024) : bytes;
+    };
+
+    struct Result { double throughput; double requestSeconds; };
+
+    // one connection downloading `total` bytes over a link of `bandwidth` bytes/s and `rtt` seconds,
+    // each request paying a round trip before its data flows
+    auto simulate = [&](double bandwidth, double rtt, m_off_t fixed, m_off_t ceiling, bool adaptive)
+    {
+        mega::RequestSizeController c;
+        const m_off_t total = 256 * MB;
+        double seconds = 0;
+        int requests = 0;
+        for (m_off_t done = 0; done < total; requests++)
+        {
+            m_off_t bytes = std::min(requestBytes(adaptive ? c.nextRequestSize(fixed, ceiling) : fixed), total - done);
+            double transfer = bytes / bandwidth;
+            c.sample(bytes, int64_t(rtt * 1000000), int64_t(transfer * 1000000));
+            seconds += rtt + transfer;
+            done += bytes;
+        }
+        return Result{ total / seconds, seconds / requests };
+    };
+
+    // a distant fast link with the 4 MB desktop default, and a slow mobile link with the 2 MB mobile limit
+    Result fastFixed = simulate(50.0 * MB, 0.25, 4 * MB, 16 * MB, false);
+    Result fastAdaptive = simulate(50.0 * MB, 0.25, 4 * MB, 16 * MB, true);
+    Result slowFixed = simulate(0.2 * MB, 0.4, 2 * MB, 2 * MB, false);
+    Result slowAdaptive = simulate(0.2 * MB, 0.4, 2 * MB, 2 * MB, true);
+
+    mt::recordBenchmark("fast_fixed_mb_s", fastFixed.throughput / MB);
+    mt::recordBenchmark("fast_adaptive_mb_s", fastAdaptive.throughput / MB);
+    mt::recordBenchmark("slow_fixed_request_s", slowFixed.requestSeconds);
+    mt::recordBenchmark("slow_adaptive_request_s", slowAdaptive.requestSeconds);
+
+
+    ASSERT_GT(fastAdaptive.throughput, fastFixed.throughput * 1.5);
+    ASSERT_LT(slowAdaptive.requestSeconds, slowFixed.requestSeconds / 2);
+    ASSERT_GT(slowAdaptive.throughput, slowFixed.throughput * 0.85);
+}
+
+TEST(AdaptiveConcurrency, growsWhileFastAndShrinksWhenSlowOrRefused)
+{
+    mega::AdaptiveConcurrency c(2, 8, 4);
+    ASSERT_EQ(4, c.limit());
+
+    // one more per round of fast completions, up to the maximum
+    for (int i = 0; i < 4; i++)
+    {
+        c.completed(10);
+    }
+    ASSERT_EQ(5, c.limit());
+    for (int i = 0; i < 100; i++)
+    {
+        c.completed(12);
+    }
+    ASSERT_EQ(8, c.limit());
+
+    // much slower: a quarter less, once per round
+    for (int i = 0; i < 6; i++)
+    {
+        c.completed(100);
+    }
+    ASSERT_EQ(6, c.limit());
+
+    // refused: half, not below the minimum
+    c.refused();
+    ASSERT_EQ(3, c.limit());
+    for (int i = 0; i < 20; i++)
+    {
+        c.refused();
+    }
+    ASSERT_EQ(2, c.limit());
+}
+
+TEST(FairTransferScheduler, interleavesGroupsByWeightedBytes)
+{
+    mega::MegaApp app;
+    MockFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+    const m_off_t MB = 1 << 20;
+
+    // in priority order: twenty 1 MB files of a folder upload, then three 10 MB files of another, then a tiny one
+    std::vector<std::unique_ptr<mega::File>> files;
+    std::vector<std::unique_ptr<mega::Transfer>> transfers;
+    auto add = [&](int group, m_off_t size)
+    {
+        files.emplace_back(new mega::File);
+        files.back()->schedulinggroup = group;
+        transfers.emplace_back(new mega::Transfer(client.get(), mega::PUT));
+        transfers.back()->size = size;
+        transfers.back()->files.push_back(files.back().get());
+    };
+    for (int i = 0; i < 20; i++)
+    {
+        add(1, MB);
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        add(2, 10 * MB);
+    }
+    add(1, 1000);
+
+    auto order = [&](mega::FairTransferScheduler& scheduler)
+    {
+        std::vector<mega::Transfer*> ready;
+        for (auto& t : transfers)
+        {
+            ready.push_back(t.get());
+        }
+        scheduler.order(mega::PUT, ready, mega::transferslot_list());
+        EXPECT_EQ(transfers.size(), ready.size());
+        return ready;
+    };
+    auto position = [&](const std::vector<mega::Transfer*>& ready, size_t index)
+    {
+        return size_t(std::find(ready.begin(), ready.end(), transfers[index].get()) - ready.begin());
+    };
+
+    // equal weights: the first large file comes once the other group has started about as many bytes
+    mega::FairTransferScheduler fair;
+    std::vector<mega::Transfer*> ready = order(fair);
+    ASSERT_EQ(transfers[0].get(), ready[0]);
+    ASSERT_GE(position(ready, 20), 8u);
+    ASSERT_LE(position(ready, 20), 10u);
+
+    // each group keeps its priority order
+    for (size_t i = 1; i < 20; i++)
+    {
+        ASSERT_LT(position(ready, i - 1), position(ready, i));
+    }
+
+    // what a group starts is charged to it
+    for (size_t i = 0; i < 10; i++)
+    {
+        fair.started(transfers[i].get());
+    }
+    ASSERT_EQ(transfers[20].get(), order(fair)[0]);
+
+    // a heavier group goes earlier
+    mega::FairTransferScheduler weighted;
+    weighted.setweight(2, 10);
+    ASSERT_LE(position(order(weighted), 20), 1u);
+
+    // a group below its minimum speed goes first
+    mega::FairTransferScheduler minspeed;
+    minspeed.setminspeed(2, MB);
+    ASSERT_EQ(transfers[20].get(), order(minspeed)[0]);
+
+    // and small files can skip the queue
+    mega::FairTransferScheduler fastlane;
+    fastlane.setfastlane(4096, 1);
+    ASSERT_EQ(transfers[23].get(), order(fastlane)[0]);
+}
+
+TEST(DirectReadNode, cachedPiecesServeLaterReadsAndReadaheadFollowsThePattern)
+{
+    struct App : mega::MegaApp
+    {
+        std::string received;
+
+        bool pread_data(mega::byte* data, m_off_t len, m_off_t, m_off_t, m_off_t, void*) override
+        {
+            received.append((const char*)data, size_t(len));
+            return true;
+        }
+    } app;
+    MockFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+    client->directreadcachelimit = 1000;
+
+    mega::SymmCipher cipher;
+    auto drn = new mega::DirectReadNode(client.get(), 1, true, &cipher, 0, nullptr, nullptr, nullptr);
+    drn->hdrn_it = client->hdrns.insert(std::make_pair(mega::handle(1), drn)).first;
+
+    std::string data;
+    for (int i = 0; i < 600; ++i)
+    {
+        data.push_back(char('a' + i % 26));
+    }
+    const mega::byte* bytes = (const mega::byte*)data.data();
+
+    // overlapping pieces are stored once
+    drn->cachepiece(0, bytes, 400);
+    drn->cachepiece(300, bytes + 300, 300);
+    ASSERT_EQ(600u, drn->cachedbytes);
+    ASSERT_EQ(2u, drn->cached.size());
+
+    // a read inside the cache is served completely, across pieces
+    ASSERT_TRUE((new mega::DirectRead(drn, 500, 50, 0, nullptr))->servecached());
+    ASSERT_EQ(data.substr(50, 500), app.received);
+
+    // one going past it gets what there is, and fetches the rest
+    app.received.clear();
+    auto dr = new mega::DirectRead(drn, 200, 500, 0, nullptr);
+    ASSERT_FALSE(dr->servecached());
+    ASSERT_EQ(100, dr->progress);
+    ASSERT_EQ(data.substr(500), app.received);
+    delete dr;
+
+    // the pieces furthest from the new one go first
+    drn->cachepiece(2000, bytes, 600);
+    ASSERT_LE(drn->cachedbytes, 1000u);
+    ASSERT_EQ(2000, drn->cached.rbegin()->first);
+
+    // a seek reads a short burst ahead, sequential reads grow it
+    client->directreadcachelimit = 64 << 20;
+    drn->size = 100 << 20;
+    drn->enqueue(10000, 1000, 0, nullptr);
+    ASSERT_NE(nullptr, drn->prefetchread);
+    ASSERT_EQ(11000, drn->prefetchread->offset);
+    ASSERT_EQ(mega::DirectReadNode::READAHEAD_BURST, drn->prefetchread->count);
+    ASSERT_TRUE(drn->prefetching(11000 + 1000));
+
+    delete drn->prefetchread;
+    ASSERT_EQ(nullptr, drn->prefetchread);
+    drn->enqueue(11000, 1000, 0, nullptr);
+    ASSERT_EQ(2 * mega::DirectReadNode::READAHEAD_BURST, drn->prefetchread->count);
+
+    delete drn;
+}
+
+TEST(DirectRead, lentPiecesHoldTheReadUntilTheAppGivesThemBack)
+{
+    struct App : mega::MegaApp
+    {
+        std::vector<std::unique_ptr<mega::DirectReadLease>> leases;
+
+        bool pread_lease(mega::DirectReadLease* lease, m_off_t, m_off_t, void*) override
+        {
+            leases.emplace_back(lease);
+            return true;
+        }
+    } app;
+    MockFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+    client->directreadcachelimit = 1000;
+
+    mega::SymmCipher cipher;
+    auto drn = new mega::DirectReadNode(client.get(), 1, true, &cipher, 0, nullptr, nullptr, nullptr);
+    drn->hdrn_it = client->hdrns.insert(std::make_pair(mega::handle(1), drn)).first;
+
+    std::string data(600, 'x');
+    drn->cachepiece(0, (const mega::byte*)data.data(), 400);
+    drn->cachepiece(400, (const mega::byte*)data.data() + 400, 200);
+
+    auto dr = new mega::DirectRead(drn, 500, 50, 0, nullptr);
+    dr->leases = std::make_shared<mega::DirectReadLeases>(300, nullptr);
+
+    // the first piece reaches the limit
+    ASSERT_FALSE(dr->servecached());
+    ASSERT_EQ(350, dr->progress);
+    ASSERT_EQ(1u, app.leases.size());
+    ASSERT_EQ(50, app.leases[0]->pos);
+    ASSERT_EQ(350u, app.leases[0]->buf.datalen());
+    ASSERT_TRUE(dr->held());
+
+    // giving it back lets the read go on
+    auto leases = dr->leases;
+    app.leases.clear();
+    ASSERT_EQ(0, leases->bytes.load());
+    ASSERT_FALSE(dr->held());
+    ASSERT_TRUE(dr->servecached());
+    ASSERT_EQ(1u, app.leases.size());
+    ASSERT_EQ(400, app.leases[0]->pos);
+    ASSERT_EQ(150, leases->bytes.load());
+
+    // and pieces may outlive their read
+    app.leases.clear();
+    ASSERT_EQ(0, leases->bytes.load());
+
+    delete drn;
+}
+
+TEST(MegaClient, memoryPressureShrinksTheCachesUntilItEases)
+{
+    struct App : mega::MegaApp
+    {
+        std::vector<mega::mempressure_t> levels;
+
+        void memory_pressure(mega::mempressure_t pressure) override
+        {
+            levels.push_back(pressure);
+        }
+    } app;
+    MockFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+    client->directreadcachelimit = 1000;
+    client->setbufferpoollimit(4 << 20);
+
+    mega::SymmCipher cipher;
+    auto drn = new mega::DirectReadNode(client.get(), 1, true, &cipher, 0, nullptr, nullptr, nullptr);
+    drn->hdrn_it = client->hdrns.insert(std::make_pair(mega::handle(1), drn)).first;
+    std::string data(1000, 'x');
+    drn->cachepiece(0, (const mega::byte*)data.data(), 1000);
+
+    // a buffer out, and the cache, are accounted
+    size_t capacity;
+    mega::byte* buf = client->bufferpool->get(1 << 20, capacity);
+    client->setmemorybudget(2 << 20);
+    ASSERT_EQ(size_t(1 << 20), client->memoryusage(mega::MEMORY_TRANSFERBUFFERS));
+    ASSERT_EQ(1000u, client->memoryusage(mega::MEMORY_DIRECTREADS));
+    ASSERT_EQ(mega::MEMORY_PRESSURE_NONE, client->memorypressure);
+    ASSERT_TRUE(app.levels.empty());
+
+    // over the budget: the cache goes, and requests are smaller
+    client->setmemorybudget(1 << 20);
+    ASSERT_EQ(mega::MEMORY_PRESSURE_CRITICAL, client->memorypressure);
+    ASSERT_EQ(0u, drn->cachedbytes);
+    ASSERT_EQ(0u, client->directreadlimit());
+    ASSERT_EQ(0u, client->bufferpool->stats().maxIdleBytes);
+    const m_off_t critical = mega::MegaClient::MEMORY_CRITICAL_REQSIZE;
+    ASSERT_EQ(critical, client->pressurerequestsize(16 << 20));
+
+    // halfway back
+    client->setmemorybudget((1 << 20) + (1 << 20) / 10);
+    ASSERT_EQ(mega::MEMORY_PRESSURE_MODERATE, client->memorypressure);
+    ASSERT_EQ(500u, client->directreadlimit());
+    ASSERT_EQ(size_t(2 << 20), client->bufferpool->stats().maxIdleBytes);
+
+    // an idle buffer counts too; the settings come back with room to spare
+    client->bufferpool->put(buf, capacity);
+    client->setmemorybudget(8 << 20);
+    ASSERT_EQ(size_t(1 << 20), client->memoryusage(mega::MEMORY_TRANSFERBUFFERS));
+    ASSERT_EQ(mega::MEMORY_PRESSURE_NONE, client->memorypressure);
+    ASSERT_EQ(1000u, client->directreadlimit());
+    ASSERT_EQ(size_t(4 << 20), client->bufferpool->stats().maxIdleBytes);
+    ASSERT_EQ(m_off_t(16 << 20), client->pressurerequestsize(16 << 20));
+    ASSERT_EQ(std::vector<mega::mempressure_t>({ mega::MEMORY_PRESSURE_CRITICAL, mega::MEMORY_PRESSURE_MODERATE, mega::MEMORY_PRESSURE_NONE }), app.levels);
+
+    delete drn;
+}
+
+TEST(Transfer, unacknowledgedChunksAreResentAsTheyWereEncrypted)
+{
+    mega::MegaApp app;
+    MockFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+    client->maxunackedchunkbytes = 3 * 1024;
+
+    mega::Transfer transfer(client.get(), mega::PUT);
+    mega::SymmCipher cipher;
+    mega::byte key[mega::SymmCipher::KEYLENGTH] = { 1 };
+    cipher.setkey(key);
+
+    // a slot that went away with two chunks sent, and nothing acknowledged
+    auto sent = [&](m_off_t pos, mega::reqstatus_t status) {
+        std::unique_ptr<mega::HttpReqUL> req(new mega::HttpReqUL);
+        memset(req->bodybuffer(1024, 0), int(pos), 1024);
+        req->prepare("http://old/", &cipher, &transfer.chunkmacs, 7, pos, pos + 1024);
+        req->status = status;
+        return req;
+    };
+    auto a = sent(0, mega::REQ_INFLIGHT);
+    auto b = sent(1024, mega::REQ_FAILURE);
+    auto acked = sent(2048, mega::REQ_SUCCESS);
+    std::string encrypted((const char*)a->body, 1024);
+    std::string suffix = a->posturl.substr(strlen("http://old/"));
+    transfer.keepunackedchunk(a.get(), 100);
+    transfer.keepunackedchunk(b.get(), 100);
+    transfer.keepunackedchunk(acked.get(), 100);
+    ASSERT_EQ(2u, transfer.unackedchunks.size());
+    ASSERT_EQ(size_t(2048), client->unackedchunkbytes);
+    ASSERT_EQ(nullptr, a->body);
+
+    // the next slot sends the first one again to its own URL, with the MAC it had
+    transfer.chunkmacs.clear();
+    ASSERT_EQ(nullptr, transfer.takeunackedchunk(0, 512, 100));
+    auto kept = transfer.takeunackedchunk(0, 1024, 100);
+    ASSERT_NE(nullptr, kept);
+    ASSERT_EQ(size_t(1024), client->unackedchunkbytes);
+
+    mega::HttpReqUL retry;
+    retry.swapbody(*kept);
+    retry.resend("http://new/", &transfer.chunkmacs);
+    ASSERT_EQ(encrypted, std::string((const char*)retry.body, retry.size));
+    ASSERT_EQ("http://new/" + suffix, retry.posturl);
+    ASSERT_EQ(1u, transfer.chunkmacs.size());
+    ASSERT_EQ(1u, transfer.chunkmacs.count(0));
+
+    // over the budget, nothing more is kept
+    auto c = sent(4096, mega::REQ_PREPARED);
+    auto d = sent(5120, mega::REQ_PREPARED);
+    auto e = sent(6144, mega::REQ_PREPARED);
+    transfer.keepunackedchunk(c.get(), 100);
+    transfer.keepunackedchunk(d.get(), 100);
+    transfer.keepunackedchunk(e.get(), 100);
+    ASSERT_EQ(size_t(3 * 1024), client->unackedchunkbytes);
+    ASSERT_NE(nullptr, e->body);
+
+    // a changed file is read again
+    ASSERT_EQ(nullptr, transfer.takeunackedchunk(1024, 2048, 101));
+    ASSERT_TRUE(transfer.unackedchunks.empty());
+    ASSERT_EQ(0u, client->unackedchunkbytes);
+}
+
+TEST(MegaClient, uploadOfContentInTheAccountTakesItsKeyAndAttributes)
+{
+    mega::MegaApp app;
+    MockFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    std::string content(300000, '\0');
+    for (size_t i = 0; i < content.size(); i++)
+    {
+        content[i] = char(i * 7 + i / 1000);
+    }
+
+    // a node of that content, as an upload with this key made it
+    mega::byte transferkey[mega::SymmCipher::KEYLENGTH] = { 9, 8, 7 };
+    const int64_t ctriv = 0x0102030405060708;
+    mega::SymmCipher cipher;
+    cipher.setkey(transferkey);
+    mega::chunkmac_map macs;
+    for (m_off_t pos = 0; pos < m_off_t(content.size()); pos = mega::ChunkedHash::chunkceil(pos, content.size()))
+    {
+        std::string chunk = content.substr(size_t(pos), size_t(mega::ChunkedHash::chunkceil(pos, content.size()) - pos));
+        chunk.resize((chunk.size() + 15) & ~size_t(15));
+        mega::ChunkMAC& chunkmac = macs[pos];
+        chunkmac.finished = true;
+        cipher.ctr_crypt((mega::byte*)&chunk[0], unsigned(mega::ChunkedHash::chunkceil(pos, content.size()) - pos), pos, ctriv, chunkmac.mac, true);
+    }
+    mega::byte nodekey[mega::FILENODEKEYLENGTH];
+    memcpy(nodekey + mega::SymmCipher::KEYLENGTH, &ctriv, sizeof ctriv);
+    int64_t metamac = macs.macsmac(&cipher);
+    memcpy(nodekey + mega::SymmCipher::KEYLENGTH + sizeof ctriv, &metamac, sizeof metamac);
+    memcpy(nodekey, transferkey, sizeof transferkey);
+    mega::SymmCipher::xorblock(nodekey + mega::SymmCipher::KEYLENGTH, nodekey);
+
+    auto& n = mt::makeNode(*client, mega::FILENODE, 1);
+    client->mFingerprints.remove(&n);
+    n.setkey(nodekey);
+    n.size = m_off_t(content.size());
+    n.mtime = 1000;
+    n.isvalid = true;
+    client->mFingerprints.add(&n);
+    n.fileattrstring = "123:0*AAAAAAAAAAA/456:8*BBBBBBBBBBB";
+
+    mega::Transfer t(client.get(), mega::PUT);
+    static_cast<mega::FileFingerprint&>(t) = n;
+    t.uploadhandle = 42;
+
+    // a different file with the same fingerprint keeps its own key
+    ContentFileAccess other(content);
+    other.content[200000] ^= 1;
+    ASSERT_EQ(-1, client->takefileattributes(&t, &other));
+    ASSERT_NE(0, memcmp(transferkey, t.transferkey, sizeof transferkey));
+    ASSERT_TRUE(client->reusedfa.empty());
+
+    // the same content takes them, and still needs its preview
+    ContentFileAccess same(content);
+    ASSERT_EQ(1 << mega::GfxProc::PREVIEW, client->takefileattributes(&t, &same));
+    ASSERT_EQ(0, memcmp(transferkey, t.transferkey, sizeof transferkey));
+    ASSERT_EQ(ctriv, t.ctriv);
+    ASSERT_TRUE(t.reusedmedia);
+
+    std::string fa;
+    client->pendingattrstring(42, &fa);
+    ASSERT_EQ("0*AAAAAAAAAAA/8*BBBBBBBBBBB", fa);
+    ASSERT_TRUE(client->reusedfa.empty());
+}
+
+TEST(StreamingScheduler, throttlesBackgroundDownloadsWhileAStreamIsBehind)
+{
+    const m_off_t KB = 1024;
+    mega::BandwidthShaper shaper;
+    mega::StreamingScheduler scheduler;
+    shaper.update(100, 0);
+
+    // 600 MB over ten minutes
+    ASSERT_EQ(1000 * KB, mega::StreamingScheduler::bitrateof(600000 * KB, 600));
+    ASSERT_EQ(0, mega::StreamingScheduler::bitrateof(600000 * KB, 0));
+
+    // nothing to protect: downloads go freely, and the only stream keeps the default floor
+    scheduler.update(shaper, 4000 * KB, 1, 1000 * KB, false, 100);
+    ASSERT_EQ(4000 * KB, scheduler.capacity());
+    ASSERT_EQ(0, scheduler.backgroundlimit());
+    ASSERT_EQ(mega::BandwidthShaper::FREE, shaper.blocked(mega::GET, 0));
+
+    // a stream falls behind: the rest get what its bitrate leaves, the stream itself is not limited
+    scheduler.update(shaper, 4000 * KB, 1, 1000 * KB, true, 110);
+    ASSERT_EQ(4000 * KB - 1250 * KB, scheduler.backgroundlimit());
+    shaper.consume(mega::GET, 0, 4000 * KB);
+    ASSERT_EQ(mega::BandwidthShaper::GROUP_LIMITED, shaper.blocked(mega::GET, 0));
+    ASSERT_EQ(mega::BandwidthShaper::FREE, shaper.blocked(mega::GET, mega::BandwidthShaper::STREAMING_GROUP));
+    ASSERT_EQ(mega::BandwidthShaper::FREE, shaper.blocked(mega::PUT, 0));
+
+    // background never stops completely
+    scheduler.update(shaper, 4000 * KB, 3, 4000 * KB, true, 120);
+    ASSERT_EQ(m_off_t(mega::StreamingScheduler::MIN_BACKGROUND_SPEED), scheduler.backgroundlimit());
+
+    // and recovers once the streams caught up
+    scheduler.update(shaper, 4000 * KB, 1, 1000 * KB, false, 130);
+    ASSERT_EQ(0, scheduler.backgroundlimit());
+    ASSERT_EQ(mega::BandwidthShaper::FREE, shaper.blocked(mega::GET, 0));
+
+    // a slot at a third of the bitrate on this link is worth retrying
+    ASSERT_EQ(500 * KB, scheduler.minspeed(1000 * KB));
+    ASSERT_EQ(m_off_t(mega::DirectReadSlot::MIN_BYTES_PER_SECOND), scheduler.minspeed(0));
+
+    // but several streams sharing a slow link don't retry each other
+    mega::StreamingScheduler slow;
+    slow.update(shaper, 40 * KB, 4, 400 * KB, true, 100);
+    ASSERT_EQ(5 * KB, slow.minspeed(100 * KB));
+    ASSERT_EQ(5 * KB, slow.minspeed(0));
+}
+
+TEST(DirectReadNode, streamIsBehindUntilItBuffersItsTarget)
+{
+    mega::MegaApp app;
+    MockFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    mega::SymmCipher cipher;
+    auto drn = new mega::DirectReadNode(client.get(), 1, true, &cipher, 0, nullptr, nullptr, nullptr);
+    drn->hdrn_it = client->hdrns.insert(std::make_pair(mega::handle(1), drn)).first;
+
+    // unknown bitrate: never behind
+    ASSERT_FALSE(drn->streamingbehind(mega::Waiter::ds));
+
+    drn->bitrate = 1000;
+    drn->enqueue(0, 100000, 0, nullptr);
+    mega::dstime start = drn->streamstart;
+    ASSERT_TRUE(drn->streamingbehind(start));
+
+    drn->streambytes = 1000 * mega::StreamingScheduler::BUFFER_SECONDS;
+    ASSERT_FALSE(drn->streamingbehind(start));
+
+    // playback goes on by the clock
+    ASSERT_TRUE(drn->streamingbehind(start + 50));
+
+    // the next range continues the stream, a seek starts it over
+    drn->enqueue(100000, 1000, 0, nullptr);
+    ASSERT_EQ(1000 * mega::StreamingScheduler::BUFFER_SECONDS, drn->streambytes);
+    drn->enqueue(500000, 1000, 0, nullptr);
+    ASSERT_EQ(0, drn->streambytes);
+
+    delete drn;
+}
+
+TEST(MegaClient, preconnectOncePerHostAndDirection)
+{
+    mega::MegaApp app;
+    MockFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    client->preconnect("http://gfs1.userstorage.mega.co.nz/dl/abc", mega::GET);
+    client->preconnect("http://gfs1.userstorage.mega.co.nz/dl/def", mega::GET);
+    client->preconnect("http://gfs1.userstorage.mega.co.nz/ul/abc", mega::PUT);
+    client->preconnect("http://gfs2.userstorage.mega.co.nz/dl/abc", mega::GET);
+    client->preconnect("not a url", mega::GET);
+    ASSERT_EQ(3u, client->preconnects.size());
+    ASSERT_EQ(mega::GET, client->preconnects.front()->preconnect);
+    ASSERT_EQ(mega::METHOD_NONE, client->preconnects.front()->method);
+
+    // again once the connections may have been closed
+    mega::Waiter::ds += mega::MegaClient::PRECONNECT_INTERVAL_DS;
+    client->preconnect("http://gfs1.userstorage.mega.co.nz/dl/abc", mega::GET);
+    ASSERT_EQ(4u, client->preconnects.size());
+    ASSERT_EQ(1u, client->preconnected.size());
+    mega::Waiter::ds -= mega::MegaClient::PRECONNECT_INTERVAL_DS;
+}
@@ -0,0 +1,123 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <iostream>
+
+#include <gtest/gtest.h>
+
+#include <mega.h>
+
+#include "DefaultedFileSystemAccess.h"
+#include "utils.h"
+
+namespace {
+
+struct MockClient
+{
+    mega::MegaApp app;
+    mt::DefaultedFileSystemAccess fs;
+    std::shared_ptr<mega::MegaClient> cli = mt::makeClient(app, fs);
+};
+
+mega::UserAlert::NewSharedNodes* newSharedNodes(mega::UserAlerts& ua, int files, mega::handle user, mega::handle folder, mega::m_time_t ts)
+{
+    return new mega::UserAlert::NewSharedNodes(0, files, user, folder, ts, ua.nextId());
+}
+
+} // anonymous
+
+TEST(UserAlerts, newSharedNodesMergeByUserAndFolder)
+{
+    MockClient client;
+    mega::UserAlerts& ua = client.cli->useralerts;
+
+    // two users uploading to two folders, in turns
+    ua.add(newSharedNodes(ua, 1, 1, 10, 1000));
+    ua.add(newSharedNodes(ua, 2, 1, 20, 1010));
+    ua.add(newSharedNodes(ua, 3, 2, 10, 1020));
+    ua.add(newSharedNodes(ua, 4, 1, 10, 1030));
+    ua.add(newSharedNodes(ua, 5, 1, 20, 1040));
+    ua.add(newSharedNodes(ua, 6, 2, 10, 1050));
+
+    ASSERT_EQ(3u, ua.alerts.size());
+    auto counts = [&ua](size_t i) { return static_cast<mega::UserAlert::NewSharedNodes*>(ua.alerts[i])->fileCount; };
+    ASSERT_EQ(5u, counts(0));
+    ASSERT_EQ(7u, counts(1));
+    ASSERT_EQ(9u, counts(2));
+
+    // until five minutes after the first
+    ua.add(newSharedNodes(ua, 7, 1, 10, 1300));
+    ASSERT_EQ(4u, ua.alerts.size());
+    ua.add(newSharedNodes(ua, 8, 1, 10, 1310));
+    ASSERT_EQ(4u, ua.alerts.size());
+    ASSERT_EQ(15u, counts(3));
+
+    // nodes without a known folder stay separate
+    ua.add(newSharedNodes(ua, 1, 1, mega::UNDEF, 1320));
+    ua.add(newSharedNodes(ua, 1, 1, mega::UNDEF, 1330));
+    ASSERT_EQ(6u, ua.alerts.size());
+
+    // and nothing is left to merge into after clear()
+    ua.clear();
+    ua.add(newSharedNodes(ua, 1, 1, 10, 1340));
+    ASSERT_EQ(1u, ua.alerts.size());
+    ASSERT_EQ(1u, counts(0));
+}
+
+TEST(UserAlerts, successfulPaymentHidesReminders)
+{
+    MockClient client;
+    mega::UserAlerts& ua = client.cli->useralerts;
+
+    ua.add(new mega::UserAlert::PaymentReminder(1000, ua.nextId()));
+    ua.add(new mega::UserAlert::PaymentReminder(1010, ua.nextId()));
+    ua.add(new mega::UserAlert::Payment(false, 1, 1020, ua.nextId()));
+    ASSERT_TRUE(ua.alerts[0]->relevant);
+    ASSERT_TRUE(ua.alerts[1]->relevant);
+
+    ua.add(new mega::UserAlert::Payment(true, 1, 1030, ua.nextId()));
+    ua.add(new mega::UserAlert::PaymentReminder(1040, ua.nextId()));
+    ASSERT_FALSE(ua.alerts[0]->relevant);
+    ASSERT_FALSE(ua.alerts[1]->relevant);
+    ASSERT_TRUE(ua.alerts[4]->relevant);
+
+    ua.add(new mega::UserAlert::Payment(true, 1, 1050, ua.nextId()));
+    ASSERT_FALSE(ua.alerts[4]->relevant);
+}
+
+TEST(UserAlerts, DISABLED_add_benchmark)
+{
+    MockClient client;
+    mega::UserAlerts& ua = client.cli->useralerts;
+
+    // heavy activity in many shared folders
+    const int count = 50000;
+    double ms = mt::elapsedMs([&]()
+    {
+        for (int i = 0; i < count; i++)
+        {
+            ua.add(newSharedNodes(ua, 1, mega::handle(i % 7), mega::handle(i % 1000), 1000 + i / 100));
+            if (i % 100 == 0)
+            {
+                ua.add(new mega::UserAlert::Payment(true, 1, 1000 + i / 100, ua.nextId()));
+            }
+        }
+    });
+
+    mt::recordBenchmark("useralerts_add_us", ms * 1000 / count);
+}
@@ -118,3 +118,36 @@ TEST(User, unserialize_32bit)
     auto newUser = mega::User::unserialize(client.get(), &d);
     checkUsers(user, *newUser);
 }
+
+TEST(User, nonexistentAttributesAreCachedUntilInvalidated)
+{
+    mega::MegaApp app;
+    MockFileSystemAccess fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    mega::User user{"foo@bar.com"};
+    user.userhandle = 13;
+    std::string firstname = "f";
+    std::string version = "v";
+    user.setattr(mega::ATTR_FIRSTNAME, &firstname, &version);
+    user.setnonexistentattr(mega::ATTR_LASTNAME);
+    user.setnonexistentattr(mega::ATTR_AVATAR);
+    std::string key(128, 1);
+    user.pubk.setkey(mega::AsymmCipher::PUBKEY, reinterpret_cast<const mega::byte*>(key.c_str()), static_cast<int>(key.size()));
+
+    std::string d;
+    ASSERT_TRUE(user.serialize(&d));
+    auto newUser = mega::User::unserialize(client.get(), &d);
+    ASSERT_TRUE(newUser);
+    ASSERT_FALSE(newUser->isattrnonexistent(mega::ATTR_FIRSTNAME));
+    ASSERT_TRUE(newUser->isattrnonexistent(mega::ATTR_LASTNAME));
+    ASSERT_TRUE(newUser->isattrnonexistent(mega::ATTR_AVATAR));
+
+    // an action packet reports the attribute, or it is set
+    newUser->invalidateattr(mega::ATTR_LASTNAME);
+    ASSERT_FALSE(newUser->isattrnonexistent(mega::ATTR_LASTNAME));
+    ASSERT_FALSE(newUser->isattrvalid(mega::ATTR_LASTNAME));
+    newUser->setattr(mega::ATTR_AVATAR, nullptr, &version);
+    ASSERT_FALSE(newUser->isattrnonexistent(mega::ATTR_AVATAR));
+    ASSERT_FALSE(newUser->getattr(mega::ATTR_AVATAR));
+}
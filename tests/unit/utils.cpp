@@ -18,7 +18,17 @@
 
 #include "utils.h"
 
+#include <chrono>
+#include <fstream>
 #include <random>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include <gtest/gtest.h>
 
 #include <mega/megaapp.h>
 
@@ -130,4 +140,60 @@ mega::byte nextRandomByte()
     return static_cast<mega::byte>(dist(gRandomGenerator));
 }
 
+void recordBenchmark(const std::string& name, double value)
+{
+    std::ostringstream s;
+    s << value;
+    ::testing::Test::RecordProperty(name, s.str());
+}
+
+double elapsedMs(const std::function<void()>& f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+long residentMemoryKB()
+{
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    long pages, resident;
+    if (statm >> pages >> resident)
+    {
+        return resident * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+#endif
+    return -1;
+}
+
+long peakMemoryKB()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (!getrusage(RUSAGE_SELF, &usage))
+    {
+#ifdef __APPLE__
+        return long(usage.ru_maxrss / 1024);
+#else
+        return long(usage.ru_maxrss);
+#endif
+    }
+#endif
+    return -1;
+}
+
+double cpuSeconds()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (!getrusage(RUSAGE_SELF, &usage))
+    {
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+                + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+#endif
+    return -1;
+}
+
 } // mt
@@ -18,7 +18,9 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <string>
 
 #include <mega/megaclient.h>
 #include <mega/node.h>
@@ -49,4 +51,18 @@ std::uint16_t nextRandomInt();
 
 mega::byte nextRandomByte();
 
+// Records a figure of a DISABLED_*_benchmark case as a property of the running test, so that
+// --gtest_output=json:<file> collects them all for regression tracking (the megabench target)
+void recordBenchmark(const std::string& name, double value);
+
+// Wall-clock milliseconds taken by f()
+double elapsedMs(const std::function<void()>& f);
+
+// The resident set size of the process now, and at its peak so far (-1 where unknown)
+long residentMemoryKB();
+long peakMemoryKB();
+
+// User and system time of the whole process so far, in seconds (-1 where unknown)
+double cpuSeconds();
+
 } // mt
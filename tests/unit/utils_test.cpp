@@ -17,10 +17,12 @@
  */
 
 #include <array>
+#include <thread>
 #include <tuple>
 
 #include <gtest/gtest.h>
 
+#include <mega.h>
 #include <mega/utils.h>
 
 TEST(utils, hashCombine_integer)
@@ -34,3 +36,300 @@ TEST(utils, hashCombine_integer)
     ASSERT_EQ(2654435811ull, hash);
 #endif
 }
+
+TEST(utils, FixedSizePool_recyclesAndReleasesBlocks)
+{
+    mega::FixedSizePool pool(24, 8, 4);
+    ASSERT_EQ(0u, pool.bytesReserved());
+
+    std::vector<void*> blocks;
+    for (int i = 0; i < 6; ++i)
+    {
+        blocks.push_back(pool.allocate());
+        ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(blocks.back()) % 8);
+    }
+    ASSERT_EQ(6u * 24, pool.bytesInUse());
+    ASSERT_EQ(2u * 4 * 24, pool.bytesReserved());
+
+    // a freed block is handed out again before carving new ones
+    void* freed = blocks[2];
+    pool.deallocate(freed);
+    ASSERT_EQ(freed, pool.allocate());
+    ASSERT_EQ(2u * 4 * 24, pool.bytesReserved());
+
+    // slabs go back to the heap once nothing is in use, all but one
+    for (auto b : blocks)
+    {
+        pool.deallocate(b);
+    }
+    ASSERT_EQ(0u, pool.bytesInUse());
+    ASSERT_EQ(1u * 4 * 24, pool.bytesReserved());
+
+    // which serves the next allocations without going back to the heap
+    void* again = pool.allocate();
+    pool.deallocate(again);
+    ASSERT_EQ(1u * 4 * 24, pool.bytesReserved());
+}
+
+TEST(utils, FixedSizePool_threadCachesGiveTheirBlocksBackWhenThreadsEnd)
+{
+    mega::FixedSizePool pool(24, 8, 64, true);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&pool]()
+        {
+            std::vector<void*> blocks;
+            for (int round = 0; round < 50; ++round)
+            {
+                for (int i = 0; i < 100; ++i)
+                {
+                    blocks.push_back(pool.allocate());
+                    memset(blocks.back(), round, 24);
+                }
+                for (auto b : blocks)
+                {
+                    pool.deallocate(b);
+                }
+                blocks.clear();
+            }
+
+            // blocks allocated here and freed elsewhere are fine too
+            blocks.push_back(pool.allocate());
+            ASSERT_GT(pool.blocksInUse(), 0u);
+            std::thread([&]() { pool.deallocate(blocks.back()); }).join();
+        });
+    }
+
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    ASSERT_EQ(0u, pool.blocksInUse());
+    ASSERT_EQ(1u * 64 * 24, pool.bytesReserved());
+}
+
+TEST(utils, CpuFeatures_includeWhatTheCompilerTargets)
+{
+    const mega::CpuFeatures& f = mega::CpuFeatures::get();
+    ASSERT_EQ(&f, &mega::CpuFeatures::get());
+
+    // code built for an extension wouldn't be running here without it
+#ifdef __SSSE3__
+    ASSERT_TRUE(f.ssse3);
+#endif
+#ifdef __SSE4_1__
+    ASSERT_TRUE(f.sse41);
+#endif
+#ifdef __PCLMUL__
+    ASSERT_TRUE(f.pclmul);
+#endif
+#ifdef __AVX2__
+    ASSERT_TRUE(f.avx2);
+#endif
+
+    // each implies the previous ones on every CPU shipped
+    ASSERT_TRUE(!f.avx2 || f.sse41);
+    ASSERT_TRUE(!f.sse41 || f.ssse3);
+}
+
+TEST(utils, PoolAllocator_nodeContainer)
+{
+    std::map<int, std::string, std::less<int>, mega::PoolAllocator<std::pair<const int, std::string>>> m;
+    for (int i = 0; i < 1000; ++i)
+    {
+        m[i] = std::to_string(i);
+    }
+    m.erase(500);
+    ASSERT_EQ(999u, m.size());
+    ASSERT_EQ("999", m[999]);
+    ASSERT_GT(mega::FixedSizePool::totalBytesReserved(), 0u);
+}
+
+TEST(utils, CodeCounter_histogramPercentiles)
+{
+    mega::CodeCounter::Histogram h;
+    ASSERT_EQ(0u, h.percentile(0.5));
+
+    for (int i = 1; i <= 100; i++)
+    {
+        h.add(std::chrono::microseconds(i * 10));
+    }
+
+    // within a bucket, ie. 25%, of the exact value
+    ASSERT_GE(h.percentile(0.5), 500u);
+    ASSERT_LE(h.percentile(0.5), 625u);
+    ASSERT_GE(h.percentile(0.99), 990u);
+    ASSERT_LE(h.percentile(0.99), 1240u);
+
+    for (uint64_t us : { 0ull, 3ull, 4ull, 7ull, 8ull, 1000ull, 123456789ull })
+    {
+        unsigned b = mega::CodeCounter::Histogram::bucket(us);
+        ASSERT_LE(us, mega::CodeCounter::Histogram::upperbound(b));
+        ASSERT_TRUE(b == 0 || us > mega::CodeCounter::Histogram::upperbound(b - 1));
+    }
+
+    h.reset();
+    ASSERT_EQ(0u, h.percentile(0.99));
+}
+
+TEST(utils, CodeCounter_scopeTimerOnlyCountsWhenEnabled)
+{
+    bool wasEnabled = mega::CodeCounter::enabled();
+    mega::CodeCounter::ScopeStats stats("test");
+
+    mega::CodeCounter::setEnabled(false);
+    {
+        mega::CodeCounter::ScopeTimer t(stats);
+    }
+    ASSERT_EQ(0u, stats.count);
+
+    mega::CodeCounter::setEnabled(true);
+    {
+        mega::CodeCounter::ScopeTimer t(stats);
+    }
+    ASSERT_EQ(1u, stats.count);
+
+    mega::CodeCounter::setEnabled(wasEnabled);
+}
+
+TEST(utils, ExecTracer_breaksDownAndKeepsSlowestIterations)
+{
+    using Tracer = mega::MegaClient::ExecTracer;
+    Tracer tracer;
+
+    // disabled by default
+    {
+        Tracer::Cycle c(tracer);
+        Tracer::Phase p(tracer, Tracer::SC);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    ASSERT_TRUE(tracer.slowest().empty());
+
+    tracer.setthreshold(5);
+    for (int i = 1; i <= int(Tracer::SLOWEST) + 2; i++)
+    {
+        Tracer::Cycle c(tracer);
+        Tracer::Phase sc(tracer, Tracer::SC);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5 + i));
+        {
+            // not counted in sc
+            Tracer::Phase db(tracer, Tracer::DBCOMMIT);
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+    {
+        // under the threshold
+        Tracer::Cycle c(tracer);
+    }
+
+    const std::vector<Tracer::Iteration>& slowest = tracer.slowest();
+    ASSERT_EQ(Tracer::SLOWEST, slowest.size());
+    for (size_t i = 1; i < slowest.size(); i++)
+    {
+        ASSERT_GE(slowest[i - 1].total, slowest[i].total);
+    }
+
+    const Tracer::Iteration& it = slowest.front();
+    ASSERT_GE(it.phases[Tracer::SC], std::chrono::milliseconds(5 + int(Tracer::SLOWEST) + 2));
+    ASSERT_GE(it.phases[Tracer::DBCOMMIT], std::chrono::milliseconds(2));
+    ASSERT_LT(it.phases[Tracer::DBCOMMIT], it.phases[Tracer::SC]);
+    ASSERT_EQ(it.phases[Tracer::SC] + it.phases[Tracer::DBCOMMIT] + it.phases[Tracer::OTHER], it.total);
+
+    std::string report = it.report();
+    ASSERT_NE(std::string::npos, report.find(": sc "));
+    ASSERT_NE(std::string::npos, report.find(", dbcommit "));
+
+    tracer.clear();
+    ASSERT_TRUE(tracer.slowest().empty());
+}
+
+TEST(utils, CodeCounter_traceRecordsSpansOfEachThread)
+{
+    mega::CodeCounter::ScopeStats stats("traced scope");
+
+    {
+        mega::CodeCounter::ScopeTimer t(stats);
+    }
+    mega::CodeCounter::startTrace();
+    ASSERT_TRUE(mega::CodeCounter::tracing());
+    {
+        mega::CodeCounter::ScopeTimer t(stats);
+        mega::CodeCounter::TraceSpan span("test", "traced span");
+    }
+    mega::CodeCounter::traceAsync("test", "async \"op\"", 'b', 42);
+    std::thread([]()
+    {
+        mega::CodeCounter::TraceSpan span("test", "other thread");
+        mega::CodeCounter::traceAsync("test", "async \"op\"", 'e', 42);
+    }).join();
+    std::string trace = mega::CodeCounter::stopTrace();
+    ASSERT_FALSE(mega::CodeCounter::tracing());
+
+    {
+        // not recorded
+        mega::CodeCounter::TraceSpan span("test", "after the trace");
+    }
+
+    ASSERT_EQ(0u, trace.find("{\"traceEvents\":["));
+    ASSERT_NE(std::string::npos, trace.find("{\"name\":\"traced scope\",\"cat\":\"scope\",\"ph\":\"X\""));
+    ASSERT_NE(std::string::npos, trace.find("{\"name\":\"traced span\",\"cat\":\"test\",\"ph\":\"X\""));
+    ASSERT_NE(std::string::npos, trace.find("\"name\":\"other thread\""));
+    ASSERT_NE(std::string::npos, trace.find("{\"name\":\"async \\\"op\\\"\",\"cat\":\"test\",\"ph\":\"b\""));
+    ASSERT_NE(std::string::npos, trace.find("\"ph\":\"e\""));
+    ASSERT_NE(std::string::npos, trace.find("\"id\":\"0x2a\""));
+    ASSERT_EQ(std::string::npos, trace.find("after the trace"));
+
+    // a new trace doesn't repeat the events of the previous one
+    mega::CodeCounter::startTrace();
+    trace = mega::CodeCounter::stopTrace();
+    ASSERT_EQ(std::string::npos, trace.find("traced span"));
+}
+
+TEST(utils, WorkerPool_runsEveryTaskOnceWithinTheLimitOfItsClass)
+{
+    mega::WorkerPool pool;
+    pool.setthreads(3);
+    ASSERT_EQ(4u, pool.parallelism(mega::WorkerPool::WORK_FILES));
+    ASSERT_EQ(3u, pool.threads());
+
+    pool.setclasslimit(mega::WorkerPool::WORK_FILES, 1);
+    ASSERT_EQ(2u, pool.parallelism(mega::WorkerPool::WORK_FILES));
+    ASSERT_EQ(4u, pool.parallelism(mega::WorkerPool::WORK_NODES));
+
+    // the caller and at most one thread of the pool
+    std::vector<std::atomic<int>> runs(64);
+    std::mutex m;
+    std::set<std::thread::id> ids;
+    pool.run(mega::WorkerPool::WORK_FILES, runs.size(), [&](size_t i)
+    {
+        runs[i]++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::lock_guard<std::mutex> g(m);
+        ids.insert(std::this_thread::get_id());
+    });
+    for (auto& r : runs)
+    {
+        ASSERT_EQ(1, r);
+    }
+    ASSERT_LE(ids.size(), 2u);
+
+    mega::WorkerPool::ClassStats stats = pool.stats(mega::WorkerPool::WORK_FILES);
+    ASSERT_EQ(1u, stats.jobs);
+    ASSERT_EQ(runs.size(), stats.tasks);
+    ASSERT_LE(stats.queuedtasks, stats.tasks);
+
+    // without threads, everything runs in the caller
+    pool.setthreads(0);
+    ASSERT_EQ(1u, pool.parallelism(mega::WorkerPool::WORK_NODES));
+    size_t n = 0;
+    std::thread::id caller = std::this_thread::get_id();
+    pool.run(mega::WorkerPool::WORK_NODES, 10, [&](size_t)
+    {
+        ASSERT_EQ(caller, std::this_thread::get_id());
+        n++;
+    });
+    ASSERT_EQ(10u, n);
+}